@@ -9,7 +9,11 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include "portable/socket.h"
+#include <errno.h>
+#include <signal.h>
 
+#include "inn/buffer.h"
 #include "inn/messages.h"
 #include "inn/qio.h"
 #include "inn/vector.h"
@@ -25,6 +29,19 @@
 #include <pwd.h>
 #include <grp.h>
 
+/* How passwords are checked, from the command-line options. */
+enum authtype { AUTH_NONE, AUTH_SHADOW, AUTH_FILE, AUTH_DBM };
+
+struct method {
+    enum authtype type;
+    const char *filename;
+    bool wantgroup;
+};
+
+/* Where the server puts the warnings for the request it is handling, sent
+   back as Error: lines, or NULL outside of a request. */
+static struct buffer *reply = NULL;
+
 
 /*
 **  If compiling with Berkeley DB, use its ndbm compatibility layer
@@ -110,18 +127,19 @@ pass_conv(int num_msg, PAM_CONST struct pam_message **msgm UNUSED,
 **  PAM stack, but just assumes that the authenticated user was the same as
 **  the username given.
 **
-**  Right now, all failures are handled via die.  This may be worth revisiting
-**  in case we want to try other authentication methods if this fails for a
-**  reason other than the system not having PAM support.
+**  Returns 1 if the user authenticated, 0 without PAM support, and -1 after
+**  warning on any failure.  This may be worth revisiting in case we want to
+**  try other authentication methods if this fails for a reason other than
+**  the system not having PAM support.
 */
 #if !HAVE_PAM
-static bool
+static int
 auth_pam(char *username UNUSED, char *password UNUSED)
 {
-    return false;
+    return 0;
 }
 #else
-static bool
+static int
 auth_pam(const char *username, char *password)
 {
     pam_handle_t *pamh;
@@ -131,20 +149,30 @@ auth_pam(const char *username, char *password)
     conv.conv = pass_conv;
     conv.appdata_ptr = password;
     status = pam_start("nnrpd", username, &conv, &pamh);
-    if (status != PAM_SUCCESS)
-        die("pam_start failed: %s", pam_strerror(pamh, status));
+    if (status != PAM_SUCCESS) {
+        warn("pam_start failed: %s", pam_strerror(pamh, status));
+        return -1;
+    }
     status = pam_authenticate(pamh, PAM_SILENT);
-    if (status != PAM_SUCCESS)
-        die("pam_authenticate failed: %s", pam_strerror(pamh, status));
+    if (status != PAM_SUCCESS) {
+        warn("pam_authenticate failed: %s", pam_strerror(pamh, status));
+        pam_end(pamh, status);
+        return -1;
+    }
     status = pam_acct_mgmt(pamh, PAM_SILENT);
-    if (status != PAM_SUCCESS)
-        die("pam_acct_mgmt failed: %s", pam_strerror(pamh, status));
+    if (status != PAM_SUCCESS) {
+        warn("pam_acct_mgmt failed: %s", pam_strerror(pamh, status));
+        pam_end(pamh, status);
+        return -1;
+    }
     status = pam_end(pamh, status);
-    if (status != PAM_SUCCESS)
-        die("pam_end failed: %s", pam_strerror(pamh, status));
+    if (status != PAM_SUCCESS) {
+        warn("pam_end failed: %s", pam_strerror(pamh, status));
+        return -1;
+    }
 
     /* If we get to here, the user successfully authenticated. */
-    return true;
+    return 1;
 }
 #endif /* HAVE_PAM */
 
@@ -213,10 +241,11 @@ password_shadow(const char *user)
 
 /*
 **  Try to get a password out of a file.  The crypted password, if found, is
-**  returned as a newly allocated string; otherwise, NULL is returned.
+**  returned as a newly allocated string; otherwise, NULL is returned, and
+**  failed is set after warning if the file couldn't be read.
 */
 static char *
-password_file(const char *username, const char *file)
+password_file(const char *username, const char *file, bool *failed)
 {
     QIOSTATE *qp;
     char *line, *password;
@@ -236,10 +265,13 @@ password_file(const char *username, const char *file)
         cvector_free(info);
         return password;
     }
-    if (QIOtoolong(qp))
-        die("line too long in %s", file);
-    if (QIOerror(qp))
-        sysdie("error reading %s", file);
+    if (QIOtoolong(qp)) {
+        warn("line too long in %s", file);
+        *failed = true;
+    } else if (QIOerror(qp)) {
+        syswarn("error reading %s", file);
+        *failed = true;
+    }
     QIOclose(qp);
     cvector_free(info);
     return NULL;
@@ -286,20 +318,230 @@ group_system(const char *username)
 
 
 /*
-**  Output username (and group, if desired) in correct return format.
+**  Return the username (and group, if desired) in the format to return to
+**  nnrpd, as a newly allocated string, or NULL after warning.
+*/
+static char *
+user_string(const char *username, bool wantgroup)
+{
+    char *group, *user;
+
+    if (!wantgroup)
+        return xstrdup(username);
+    group = group_system(username);
+    if (group == NULL) {
+        warn("group info for user %s not available", username);
+        return NULL;
+    }
+    user = concat(username, "@", group, (char *) 0);
+    free(group);
+    return user;
+}
+
+
+/*
+**  Check a username and password with the given method.  Returns the user
+**  to return to nnrpd as a newly allocated string, or NULL after warning
+**  why the user isn't authenticated.
+*/
+static char *
+authenticate(const struct method *method, struct auth_info *authinfo)
+{
+    char *password = NULL;
+    const char *hash;
+    bool failed = false;
+
+    if (authinfo->username[0] == '\0') {
+        warn("null username");
+        return NULL;
+    }
+
+    /* Run the appropriate authentication routines. */
+    switch (method->type) {
+    case AUTH_SHADOW:
+        password = password_shadow(authinfo->username);
+        if (password == NULL)
+            password = password_system(authinfo->username);
+        break;
+    case AUTH_FILE:
+        password = password_file(authinfo->username, method->filename,
+                                 &failed);
+        break;
+    case AUTH_DBM:
+        password = password_dbm(authinfo->username, method->filename);
+        break;
+    case AUTH_NONE:
+        switch (auth_pam(authinfo->username, authinfo->password)) {
+        case 1:
+            return user_string(authinfo->username, method->wantgroup);
+        case -1:
+            return NULL;
+        default:
+            break;
+        }
+        password = password_system(authinfo->username);
+        break;
+    }
+
+    if (failed)
+        return NULL;
+    if (password == NULL) {
+        warn("user %s unknown", authinfo->username);
+        return NULL;
+    }
+    hash = crypt(authinfo->password, password);
+    if (hash == NULL || strcmp(password, hash) != 0) {
+        warn("invalid password for user %s", authinfo->username);
+        free(password);
+        return NULL;
+    }
+    free(password);
+
+    /* The password matched. */
+    return user_string(authinfo->username, method->wantgroup);
+}
+
+
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+/*
+**  Warnings while handling a request go back to nnrpd as Error: lines, like
+**  what an authenticator run by nnrpd prints on standard error.
+*/
+static void __attribute__((__format__(printf, 2, 0)))
+reply_error(size_t len, const char *fmt, va_list args, int err)
+{
+    if (reply == NULL) {
+        message_log_stderr(len, fmt, args, err);
+        return;
+    }
+    buffer_append(reply, "Error:", strlen("Error:"));
+    buffer_append_vsprintf(reply, fmt, args);
+    if (err)
+        buffer_append_sprintf(reply, ": %s", strerror(err));
+    buffer_append(reply, "\r\n", 2);
+}
+
+
+/*
+**  Handle a request, setting reply to what to send back, from the cache if
+**  it is there.
+*/
+static void
+handle_request(const struct method *method, struct auth_cache *cache,
+               char *request)
+{
+    struct auth_info *authinfo;
+    const char *cached;
+    char *user;
+
+    buffer_set(reply, NULL, 0);
+    authinfo = parse_auth_info(request);
+    if (authinfo == NULL) {
+        buffer_append(reply, ".\r\n", 3);
+        return;
+    }
+    cached = auth_cache_lookup(cache, authinfo);
+    if (cached != NULL) {
+        buffer_set(reply, cached, strlen(cached));
+        free_auth_info(authinfo);
+        return;
+    }
+
+    user = authenticate(method, authinfo);
+    if (user != NULL) {
+        buffer_append_sprintf(reply, "User:%s\r\n", user);
+        free(user);
+    }
+    buffer_append(reply, ".\r\n", 3);
+    auth_cache_store(cache, authinfo, reply->data, reply->left);
+    free_auth_info(authinfo);
+}
+
+
+/*
+**  Run as a server answering the requests of nnrpd on a Unix domain socket
+**  at path, the same requests an authenticator run by nnrpd reads on its
+**  standard input, with a line holding a single period after the reply.
+**  Every connection is read as soon as something comes on it, so a slow
+**  client doesn't hold up the others, and the replies are cached for ttl
+**  seconds.
 */
 static void
-output_user(const char *username, bool wantgroup)
+serve(const struct method *method, const char *path, unsigned long ttl)
 {
-    if (wantgroup) {
-        char *group = group_system(username);
-        if (group == NULL)
-            die("group info for user %s not available", username);
-        printf("User:%s@%s\r\n", username, group);
+    struct buffer *input[FD_SETSIZE];
+    struct auth_cache *cache;
+    fd_set fds, rfds;
+    int listener, fd, maxfd, status;
+    size_t length;
+    ssize_t count;
+    char *request;
+
+    listener = auth_listen(path);
+    if (listener >= FD_SETSIZE)
+        die("too many open file descriptors");
+    signal(SIGPIPE, SIG_IGN);
+
+    reply = buffer_new();
+    message_handlers_warn(1, reply_error);
+    cache = auth_cache_new(ttl);
+    memset(input, 0, sizeof(input));
+    FD_ZERO(&fds);
+    FD_SET(listener, &fds);
+    maxfd = listener;
+    while (1) {
+        rfds = fds;
+        status = select(maxfd + 1, &rfds, NULL, NULL, NULL);
+        if (status < 0) {
+            if (errno == EINTR)
+                continue;
+            sysdie("select failed");
+        }
+
+        if (FD_ISSET(listener, &rfds)) {
+            fd = accept(listener, NULL, NULL);
+            if (fd < 0)
+                syswarn("cannot accept connection");
+            else if (fd >= FD_SETSIZE) {
+                warn("too many connections");
+                close(fd);
+            } else {
+                input[fd] = buffer_new();
+                FD_SET(fd, &fds);
+                if (fd > maxfd)
+                    maxfd = fd;
+            }
+        }
+
+        for (fd = 0; fd <= maxfd; fd++) {
+            if (fd == listener || !FD_ISSET(fd, &rfds) || input[fd] == NULL)
+                continue;
+            buffer_compact(input[fd]);
+            buffer_resize(input[fd], input[fd]->left + 1024);
+            count = buffer_read(input[fd], fd);
+            while (count > 0) {
+                length = auth_request_length(input[fd]->data + input[fd]->used,
+                                             input[fd]->left);
+                if (length == 0)
+                    break;
+                request = xstrndup(input[fd]->data + input[fd]->used, length);
+                input[fd]->used += length;
+                input[fd]->left -= length;
+                handle_request(method, cache, request);
+                free(request);
+                if (xwrite(fd, reply->data, reply->left) < 0)
+                    count = -1;
+            }
+            if (count <= 0 || input[fd]->left > AUTH_MAX_REQUEST) {
+                close(fd);
+                FD_CLR(fd, &fds);
+                buffer_free(input[fd]);
+                input[fd] = NULL;
+            }
+        }
     }
-    else
-        print_user(username);
 }
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
 
 
 /*
@@ -311,45 +553,48 @@ output_user(const char *username, bool wantgroup)
 int
 main(int argc, char *argv[])
 {
-    enum authtype { AUTH_NONE, AUTH_SHADOW, AUTH_FILE, AUTH_DBM };
-
     int opt;
-    const char *hash;
-    enum authtype type = AUTH_NONE;
-    bool wantgroup = false;
-    const char *filename = NULL;
+    struct method method = { AUTH_NONE, NULL, false };
     struct auth_info *authinfo = NULL;
-    char *password = NULL;
+    const char *socket_path = NULL;
+    unsigned long ttl = 60;
+    char *user;
 
     message_program_name = "ckpasswd";
 
-    while ((opt = getopt(argc, argv, "gf:u:p:" OPT_DBM OPT_SHADOW)) != -1) {
+    while ((opt = getopt(argc, argv, "gf:u:p:S:t:" OPT_DBM OPT_SHADOW)) != -1) {
         switch (opt) {
         case 'g':
-            if (type == AUTH_DBM || type == AUTH_FILE)
+            if (method.type == AUTH_DBM || method.type == AUTH_FILE)
                 die("-g option is incompatible with -d or -f");
-            wantgroup = true;
+            method.wantgroup = true;
             break;
         case 'd':
-            if (type != AUTH_NONE)
+            if (method.type != AUTH_NONE)
                 die("only one of -s, -f, or -d allowed");
-            if (wantgroup)
+            if (method.wantgroup)
                 die("-g option is incompatible with -d or -f");
-            type = AUTH_DBM;
-            filename = optarg;
+            method.type = AUTH_DBM;
+            method.filename = optarg;
             break;
         case 'f':
-            if (type != AUTH_NONE)
+            if (method.type != AUTH_NONE)
                 die("only one of -s, -f, or -d allowed");
-            if (wantgroup)
+            if (method.wantgroup)
                 die("-g option is incompatible with -d or -f");
-            type = AUTH_FILE;
-            filename = optarg;
+            method.type = AUTH_FILE;
+            method.filename = optarg;
             break;
         case 's':
-            if (type != AUTH_NONE)
+            if (method.type != AUTH_NONE)
                 die("only one of -s, -f, or -d allowed");
-            type = AUTH_SHADOW;
+            method.type = AUTH_SHADOW;
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 't':
+            ttl = strtoul(optarg, NULL, 10);
             break;
         case 'u':
             if (authinfo == NULL) {
@@ -376,44 +621,27 @@ main(int argc, char *argv[])
     if (authinfo != NULL && authinfo->password == NULL)
         die("-p option is required if -u option is given");
 
+    /* Answer the requests of nnrpd on a socket until killed. */
+    if (socket_path != NULL) {
+        if (authinfo != NULL)
+            die("-S option is incompatible with -u and -p");
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+        serve(&method, socket_path, ttl);
+#else
+        die("Unix domain sockets not supported on this system");
+#endif
+    }
+
     /* Unless a username or password was given on the command line, assume
        we're being run by nnrpd. */
     if (authinfo == NULL)
         authinfo = get_auth_info(stdin);
     if (authinfo == NULL)
         die("no authentication information from nnrpd");
-    if (authinfo->username[0] == '\0')
-        die("null username");
-
-    /* Run the appropriate authentication routines. */
-    switch (type) {
-    case AUTH_SHADOW:
-        password = password_shadow(authinfo->username);
-        if (password == NULL)
-            password = password_system(authinfo->username);
-        break;
-    case AUTH_FILE:
-        password = password_file(authinfo->username, filename);
-        break;
-    case AUTH_DBM:
-        password = password_dbm(authinfo->username, filename);
-        break;
-    case AUTH_NONE:
-        if (auth_pam(authinfo->username, authinfo->password)) {
-            output_user(authinfo->username, wantgroup);
-            exit(0);
-        }
-        password = password_system(authinfo->username);
-        break;
-    }
 
-    if (password == NULL)
-        die("user %s unknown", authinfo->username);
-    hash = crypt(authinfo->password, password);
-    if (hash == NULL || strcmp(password, hash) != 0)
-        die("invalid password for user %s", authinfo->username);
-
-    /* The password matched. */
-    output_user(authinfo->username, wantgroup);
+    user = authenticate(&method, authinfo);
+    if (user == NULL)
+        exit(1);
+    print_user(user);
     exit(0);
 }
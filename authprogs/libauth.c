@@ -9,7 +9,14 @@
 #include "config.h"
 #include "clibrary.h"
 #include "portable/socket.h"
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+# include <sys/un.h>
+#endif
 
+#include "inn/hashtab.h"
+#include "inn/md5.h"
 #include "inn/messages.h"
 #include "libauth.h"
 #include "inn/libinn.h"
@@ -23,18 +30,27 @@
 #define LOCIP "LocalIP: "
 #define LOCPORT "LocalPort: "
 
+/* A reply kept in a cache, keyed by the MD5 hash of the username and
+   password it is for. */
+struct cached {
+    unsigned char key[16];
+    time_t expires;
+    char *reply;
+};
+
+struct auth_cache {
+    struct hash *replies;
+    unsigned long ttl;
+    time_t sweep;
+};
+
 /*
-**  Main loop.  If res != NULL, expects to get resolver info from nnrpd, and
-**  writes it into the struct.  If auth != NULL, expects to get authentication
-**  info from nnrpd, and writes it into the struct.
+**  Zero the fields of the structs (anything remaining NULL after parsing is
+**  missing data).
 */
-static bool
-get_connection_info(FILE *stream, struct res_info *res, struct auth_info *auth)
+static void
+clear_connection_info(struct res_info *res, struct auth_info *auth)
 {
-    char buff[SMBUF];
-    size_t length;
-
-    /* Zero fields first (anything remaining NULL after is missing data). */
     if (res != NULL) {
         res->clienthostname = NULL;
         res->clientip = NULL;
@@ -46,39 +62,43 @@ get_connection_info(FILE *stream, struct res_info *res, struct auth_info *auth)
         auth->username = NULL;
         auth->password = NULL;
     }
+}
 
-    /* Read input from nnrpd a line at a time, stripping \r\n. */
-    while (fgets(buff, sizeof(buff), stream) != NULL) {
-        length = strlen(buff);
-        if (length == 0 || buff[length - 1] != '\n')
-            return false;
-        buff[length - 1] = '\0';
-        if (length > 1 && buff[length - 2] == '\r')
-            buff[length - 2] = '\0';
 
-        /* Parse */
-        if (strncmp(buff, ".", 2) == 0)
-            break;
-        else if (auth != NULL && strncmp(buff, NAMESTR, strlen(NAMESTR)) == 0)
-            auth->username = xstrdup(buff + strlen(NAMESTR));
-        else if (auth != NULL && strncmp(buff, PASSSTR, strlen(PASSSTR)) == 0)
-            auth->password = xstrdup(buff + strlen(PASSSTR));
-        else if (res != NULL && strncmp(buff, CLIHOST, strlen(CLIHOST)) == 0)
-            res->clienthostname = xstrdup(buff + strlen(CLIHOST));
-        else if (res != NULL && strncmp(buff, CLIIP, strlen(CLIIP)) == 0)
-            res->clientip = xstrdup(buff + strlen(CLIIP));
-        else if (res != NULL && strncmp(buff, CLIPORT, strlen(CLIPORT)) == 0)
-            res->clientport = xstrdup(buff + strlen(CLIPORT));
-        else if (res != NULL && strncmp(buff, LOCIP, strlen(LOCIP)) == 0)
-            res->localip = xstrdup(buff + strlen(LOCIP));
-        else if (res != NULL && strncmp(buff, LOCPORT, strlen(LOCPORT)) == 0)
-            res->localport = xstrdup(buff + strlen(LOCPORT));
-        else {
-            debug("libauth: unexpected data from nnrpd: \"%s\"", buff);
-        }
+/*
+**  Parse one line of input from nnrpd, already stripped of its \r\n, into
+**  the structs that aren't NULL.
+*/
+static void
+parse_connection_line(const char *buff, struct res_info *res,
+                      struct auth_info *auth)
+{
+    if (auth != NULL && strncmp(buff, NAMESTR, strlen(NAMESTR)) == 0)
+        auth->username = xstrdup(buff + strlen(NAMESTR));
+    else if (auth != NULL && strncmp(buff, PASSSTR, strlen(PASSSTR)) == 0)
+        auth->password = xstrdup(buff + strlen(PASSSTR));
+    else if (res != NULL && strncmp(buff, CLIHOST, strlen(CLIHOST)) == 0)
+        res->clienthostname = xstrdup(buff + strlen(CLIHOST));
+    else if (res != NULL && strncmp(buff, CLIIP, strlen(CLIIP)) == 0)
+        res->clientip = xstrdup(buff + strlen(CLIIP));
+    else if (res != NULL && strncmp(buff, CLIPORT, strlen(CLIPORT)) == 0)
+        res->clientport = xstrdup(buff + strlen(CLIPORT));
+    else if (res != NULL && strncmp(buff, LOCIP, strlen(LOCIP)) == 0)
+        res->localip = xstrdup(buff + strlen(LOCIP));
+    else if (res != NULL && strncmp(buff, LOCPORT, strlen(LOCPORT)) == 0)
+        res->localport = xstrdup(buff + strlen(LOCPORT));
+    else {
+        debug("libauth: unexpected data from nnrpd: \"%s\"", buff);
     }
+}
+
 
-    /* If some field is missing, free the rest and error out. */
+/*
+**  Check that all the requested fields were sent.
+*/
+static bool
+check_connection_info(struct res_info *res, struct auth_info *auth)
+{
     if (auth != NULL && (auth->username == NULL || auth->password == NULL)) {
         warn("libauth: requested authenticator data not sent by nnrpd");
         return false;
@@ -93,6 +113,39 @@ get_connection_info(FILE *stream, struct res_info *res, struct auth_info *auth)
 }
 
 
+/*
+**  Main loop.  If res != NULL, expects to get resolver info from nnrpd, and
+**  writes it into the struct.  If auth != NULL, expects to get authentication
+**  info from nnrpd, and writes it into the struct.
+*/
+static bool
+get_connection_info(FILE *stream, struct res_info *res, struct auth_info *auth)
+{
+    char buff[SMBUF];
+    size_t length;
+
+    clear_connection_info(res, auth);
+
+    /* Read input from nnrpd a line at a time, stripping \r\n. */
+    while (fgets(buff, sizeof(buff), stream) != NULL) {
+        length = strlen(buff);
+        if (length == 0 || buff[length - 1] != '\n')
+            return false;
+        buff[length - 1] = '\0';
+        if (length > 1 && buff[length - 2] == '\r')
+            buff[length - 2] = '\0';
+
+        /* Parse */
+        if (strncmp(buff, ".", 2) == 0)
+            break;
+        parse_connection_line(buff, res, auth);
+    }
+
+    /* If some field is missing, error out. */
+    return check_connection_info(res, auth);
+}
+
+
 /*
 **  Free a struct res_info, including all of its members.
 */
@@ -163,6 +216,36 @@ get_auth_info(FILE *stream)
 }
 
 
+/*
+**  Parse authenticator information from nnrpd held in memory, such as a
+**  request received on a socket, returning an allocated struct on success.
+**  The request is modified.
+*/
+struct auth_info *
+parse_auth_info(char *request)
+{
+    struct auth_info *auth = xmalloc(sizeof(struct auth_info));
+    char *line, *end;
+
+    clear_connection_info(NULL, auth);
+    for (line = request; *line != '\0'; line = end + 1) {
+        end = strchr(line, '\n');
+        if (end == NULL)
+            break;
+        *end = '\0';
+        if (end > line && end[-1] == '\r')
+            end[-1] = '\0';
+        if (strcmp(line, ".") == 0)
+            break;
+        parse_connection_line(line, NULL, auth);
+    }
+    if (check_connection_info(NULL, auth))
+        return auth;
+    free_auth_info(auth);
+    return NULL;
+}
+
+
 /*
 **  Print the User: result on standard output in the format expected by
 **  nnrpd.  The string passed in should be exactly the user, with no
@@ -173,3 +256,235 @@ print_user(const char *user)
 {
     printf("User:%s\r\n", user);
 }
+
+
+/*
+**  Return the length of the first complete request in data, ending with a
+**  line holding a single period, or 0 if there is none yet.
+*/
+size_t
+auth_request_length(const char *data, size_t length)
+{
+    const char *line, *end;
+
+    line = data;
+    while ((end = memchr(line, '\n', length - (line - data))) != NULL) {
+        if (line[0] == '.'
+            && (end == line + 1 || (end == line + 2 && line[1] == '\r')))
+            return end + 1 - data;
+        line = end + 1;
+    }
+    return 0;
+}
+
+
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+/*
+**  Create a Unix domain socket at path, replacing whatever is there, and
+**  listen on it.  Dies on failure.
+*/
+int
+auth_listen(const char *path)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        die("socket path %s too long", path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        sysdie("cannot create socket");
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strlcpy(address.sun_path, path, sizeof(address.sun_path));
+    if (unlink(path) < 0 && errno != ENOENT)
+        sysdie("cannot remove %s", path);
+    if (bind(fd, (struct sockaddr *) &address, SUN_LEN(&address)) < 0)
+        sysdie("cannot bind to %s", path);
+    if (listen(fd, SOMAXCONN) < 0)
+        sysdie("cannot listen on %s", path);
+    return fd;
+}
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
+
+
+/*
+**  Functions for the hash table of cached replies.
+*/
+static unsigned long
+cached_hash(const void *key)
+{
+    unsigned long hash;
+
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static const void *
+cached_key(const void *entry)
+{
+    const struct cached *cached = entry;
+
+    return cached->key;
+}
+
+static bool
+cached_equal(const void *key, const void *entry)
+{
+    const struct cached *cached = entry;
+
+    return memcmp(key, cached->key, sizeof(cached->key)) == 0;
+}
+
+static void
+cached_delete(void *entry)
+{
+    struct cached *cached = entry;
+
+    free(cached->reply);
+    free(cached);
+}
+
+
+/*
+**  Collect the expired replies while traversing the table.
+*/
+struct expired {
+    time_t now;
+    struct cached **replies;
+    size_t count;
+    size_t size;
+};
+
+static void
+cached_expired(void *entry, void *cookie)
+{
+    struct cached *cached = entry;
+    struct expired *expired = cookie;
+
+    if (cached->expires > expired->now)
+        return;
+    if (expired->count == expired->size) {
+        expired->size = (expired->size == 0) ? 64 : expired->size * 2;
+        expired->replies = xreallocarray(expired->replies, expired->size,
+                                         sizeof(struct cached *));
+    }
+    expired->replies[expired->count++] = cached;
+}
+
+
+/*
+**  Remove the expired replies from the cache, once every ttl seconds.
+*/
+static void
+cache_sweep(struct auth_cache *cache, time_t now)
+{
+    struct expired expired;
+    unsigned char key[16];
+    size_t i;
+
+    if (now < cache->sweep)
+        return;
+    cache->sweep = now + cache->ttl;
+    expired.now = now;
+    expired.replies = NULL;
+    expired.count = 0;
+    expired.size = 0;
+    hash_traverse(cache->replies, cached_expired, &expired);
+    for (i = 0; i < expired.count; i++) {
+        memcpy(key, expired.replies[i]->key, sizeof(key));
+        hash_delete(cache->replies, key);
+    }
+    free(expired.replies);
+}
+
+
+/*
+**  The key of the replies for a username and password.  The username can't
+**  hold a newline, so this key is unambiguous.
+*/
+static void
+cache_key(const struct auth_info *auth, unsigned char key[16])
+{
+    struct md5_context context;
+
+    md5_init(&context);
+    md5_update(&context, (const unsigned char *) auth->username,
+               strlen(auth->username));
+    md5_update(&context, (const unsigned char *) "\n", 1);
+    md5_update(&context, (const unsigned char *) auth->password,
+               strlen(auth->password));
+    md5_final(&context);
+    memcpy(key, context.digest, sizeof(context.digest));
+}
+
+
+/*
+**  Create a cache keeping replies for ttl seconds.
+*/
+struct auth_cache *
+auth_cache_new(unsigned long ttl)
+{
+    struct auth_cache *cache;
+
+    cache = xmalloc(sizeof(struct auth_cache));
+    cache->replies = hash_create(1024, cached_hash, cached_key, cached_equal,
+                                 cached_delete);
+    cache->ttl = ttl;
+    cache->sweep = time(NULL) + ttl;
+    return cache;
+}
+
+
+/*
+**  Return the reply cached for a username and password, or NULL if there is
+**  none or it has expired.
+*/
+const char *
+auth_cache_lookup(struct auth_cache *cache, const struct auth_info *auth)
+{
+    struct cached *cached;
+    unsigned char key[16];
+
+    if (cache->ttl == 0)
+        return NULL;
+    cache_key(auth, key);
+    cached = hash_lookup(cache->replies, key);
+    if (cached == NULL || cached->expires <= time(NULL))
+        return NULL;
+    return cached->reply;
+}
+
+
+/*
+**  Keep the reply of the given length for a username and password.
+*/
+void
+auth_cache_store(struct auth_cache *cache, const struct auth_info *auth,
+                 const char *reply, size_t length)
+{
+    struct cached *cached;
+    time_t now;
+
+    if (cache->ttl == 0)
+        return;
+    now = time(NULL);
+    cache_sweep(cache, now);
+    cached = xmalloc(sizeof(struct cached));
+    cache_key(auth, cached->key);
+    cached->expires = now + cache->ttl;
+    cached->reply = xstrndup(reply, length);
+    if (!hash_insert(cache->replies, cached->key, cached))
+        hash_replace(cache->replies, cached->key, cached);
+}
+
+
+/*
+**  Free a cache and all the replies it holds.
+*/
+void
+auth_cache_free(struct auth_cache *cache)
+{
+    hash_free(cache->replies);
+    free(cache);
+}
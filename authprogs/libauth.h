@@ -25,6 +25,10 @@ struct auth_info {
     char *password;
 };
 
+/* Replies of an authenticator kept for a while.  The layout of this struct
+   is internal to libauth. */
+struct auth_cache;
+
 BEGIN_DECLS
 
 /* Reads connection information from a file descriptor (normally stdin, when
@@ -37,6 +41,9 @@ BEGIN_DECLS
 extern struct auth_info *get_auth_info(FILE *);
 extern struct res_info  *get_res_info (FILE *);
 
+/* Same as get_auth_info for a request held in memory, which is modified. */
+extern struct auth_info *parse_auth_info(char *request);
+
 /* Free a res_info or auth_info struct. */
 extern void free_auth_info(struct auth_info *);
 extern void free_res_info (struct res_info  *);
@@ -44,6 +51,29 @@ extern void free_res_info (struct res_info  *);
 /* Return the user string to nnrpd. */
 extern void print_user(const char *);
 
+/* For authenticators answering requests on a Unix domain socket, in the
+   same format as they are otherwise read on standard input, terminated by
+   a line holding a single period.  auth_request_length returns the length
+   of the first complete request in data, or 0 if there is none yet, and
+   auth_listen creates and listens on the socket, dying on failure.
+   Connections with a longer request pending than AUTH_MAX_REQUEST are
+   closed. */
+#define AUTH_MAX_REQUEST 8192
+extern size_t auth_request_length(const char *data, size_t length);
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+extern int auth_listen(const char *path);
+#endif
+
+/* A cache of the replies given for usernames and passwords, each one kept
+   for ttl seconds (with 0 meaning nothing is cached).  auth_cache_lookup
+   returns NULL if there is no reply for that username and password. */
+extern struct auth_cache *auth_cache_new(unsigned long ttl);
+extern const char *auth_cache_lookup(struct auth_cache *,
+                                     const struct auth_info *);
+extern void auth_cache_store(struct auth_cache *, const struct auth_info *,
+                             const char *reply, size_t length);
+extern void auth_cache_free(struct auth_cache *);
+
 END_DECLS
 
 #endif /* !LIBAUTH_H */
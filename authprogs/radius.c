@@ -20,12 +20,14 @@
 # include <sys/select.h>
 #endif
 
+#include "inn/buffer.h"
 #include "inn/innconf.h"
 #include "inn/md5.h"
 #include "inn/messages.h"
 #include "inn/libinn.h"
 #include "inn/nntp.h"
 #include "inn/paths.h"
+#include "inn/timer.h"
 #include "conffile.h"
 
 #include "libauth.h"
@@ -212,38 +214,242 @@ static int read_config(char *authfile, rad_config_t *radconf)
 #define RAD_NAS_IP_ADDRESS      4       /* IP address */
 #define RAD_NAS_PORT            5       /* Integer */
 
-static void req_copyto (auth_req *to, sending_t *from)
-{
-    *to = from->req;
-}
+/* In server mode, how long to wait for a reply from the radius servers
+   before sending a request to them again, in seconds, and how many times to
+   send it.  nnrpd waits five seconds for the reply. */
+#define RAD_RETRY       1.0
+#define RAD_TRIES       4
+
+/* A request of nnrpd being handled in server mode, found by the radius
+   identifier of the packets sent for it. */
+struct pending {
+    struct auth_info *authinfo; /* NULL if the identifier is free. */
+    int fd;                     /* Connection of nnrpd, -1 if closed. */
+    sending_t *requests;        /* One packet per radius server. */
+    int tries;
+    double retry;               /* When to send the packets again. */
+};
+
+/* The state of the server. */
+struct radserver {
+    rad_config_t *config;
+    int servers;                /* Number of radius servers. */
+    int sock;                   /* Socket to the radius servers. */
+    struct sockaddr_in sinl;
+    struct sockaddr_in *sinr;   /* Address of each radius server. */
+    struct auth_cache *cache;
+    struct pending pending[256];
+    unsigned int next;          /* Next identifier to try. */
+    struct buffer *input[FD_SETSIZE];
+    int waiting[FD_SETSIZE];    /* Identifier waited for, or -1. */
+};
+
 
-static void req_copyfrom (sending_t *to, auth_req *from)
+/*
+**  Set up the local address and the address of the radius server for a
+**  configuration block.  Returns false after warning if one of them cannot
+**  be resolved.
+*/
+static bool
+rad_addresses(rad_config_t *config, struct sockaddr_in *sinl,
+              struct sockaddr_in *sinr)
 {
-    to->req = *from;
+    char hostname[SMBUF];
+    struct hostent *hent;
+
+    memset(sinl, '\0', sizeof(*sinl));
+    memset(sinr, '\0', sizeof(*sinr));
+    sinl->sin_family = AF_INET;
+    sinr->sin_family = AF_INET;
+    if (config->lochost == NULL) {
+        if (gethostname(hostname, sizeof(hostname)) != 0) {
+            syswarn("cannot get local hostname");
+            return false;
+        }
+        config->lochost = xstrdup(hostname);
+    }
+    if (inet_aton(config->lochost, &sinl->sin_addr) != 1) {
+        if ((hent = gethostbyname(config->lochost)) == NULL) {
+            warn("cannot gethostbyname lochost %s", config->lochost);
+            return false;
+        }
+        memcpy(&sinl->sin_addr.s_addr, hent->h_addr, sizeof(struct in_addr));
+    }
+    if (inet_aton(config->radhost, &sinr->sin_addr) != 1) {
+        if ((hent = gethostbyname(config->radhost)) == NULL) {
+            warn("cannot gethostbyname radhost %s", config->radhost);
+            return false;
+        }
+        memcpy(&sinr->sin_addr.s_addr, hent->h_addr_list[0],
+               sizeof(struct in_addr));
+    }
+    if (config->radport)
+        sinr->sin_port = htons(config->radport);
+    else
+        sinr->sin_port = htons(PW_AUTH_UDP_PORT);
+    return true;
 }
 
-static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
+
+/*
+**  Build in sreq the packet asking the radius server of a configuration
+**  block about a username and password, with the given identifier.
+*/
+static void
+rad_request(rad_config_t *config, const struct sockaddr_in *sinl,
+            unsigned char id, const char *uname, const char *pass,
+            sending_t *sreq)
 {
     auth_req req;
     int i, j, jlen, passstart;
     unsigned char secbuf[128];
-    char hostname[SMBUF];
     unsigned char digest[MD5_DIGESTSIZE];
+    int passlen;
+    uint32_t nvalue;
+
+    memset(&req, '\0', sizeof(req));
+
+    /* build the visible part of the auth vector randomly */
+    for (i = 0; i < AUTH_VECTOR_LEN; i++)
+        req.vector[i] = random() % 256;
+    strlcpy((char *) secbuf, config->secret, sizeof(secbuf));
+    memcpy(secbuf+strlen(config->secret), req.vector, AUTH_VECTOR_LEN);
+    md5_hash(secbuf, strlen(config->secret)+AUTH_VECTOR_LEN, digest);
+    /* fill in the auth_req data */
+    req.code = PW_AUTHENTICATION_REQUEST;
+    req.id = id;
+
+    /* bracket the username in the configured prefix/suffix */
+    req.data[0] = PW_USER_NAME;
+    req.data[1] = 2;
+    req.data[2] = '\0';
+    if (config->prefix) {
+        req.data[1] += strlen(config->prefix);
+        strlcat((char *) &req.data[2], config->prefix, sizeof(req.data) - 2);
+    }
+    req.data[1] += strlen(uname);
+    strlcat((char *)&req.data[2], uname, sizeof(req.data) - 2);
+    if (!strchr(uname, '@') && config->suffix) {
+        req.data[1] += strlen(config->suffix);
+        strlcat((char *)&req.data[2], config->suffix, sizeof(req.data) - 2);
+    }
+    req.datalen = req.data[1];
+
+    /* set the password */
+    passstart = req.datalen;
+    req.data[req.datalen] = PW_PASSWORD;
+    /* Null pad the password */
+    passlen = (strlen(pass) + 15) / 16;
+    passlen *= 16;
+    req.data[req.datalen+1] = passlen+2;
+    strlcpy((char *)&req.data[req.datalen+2], pass,
+            sizeof(req.data) - req.datalen - 2);
+    passlen -= strlen(pass);
+    while (passlen--)
+        req.data[req.datalen+passlen+2+strlen(pass)] = '\0';
+    req.datalen += req.data[req.datalen+1];
+
+    /* Add NAS_PORT and NAS_IP_ADDRESS into request */
+    if ((nvalue = config->locport) == 0)
+        nvalue = RADIUS_LOCAL_PORT;
+    req.data[req.datalen++] = RAD_NAS_PORT;
+    req.data[req.datalen++] = sizeof(nvalue) + 2;
+    nvalue = htonl(nvalue);
+    memcpy(req.data + req.datalen, &nvalue, sizeof(nvalue));
+    req.datalen += sizeof(nvalue);
+    req.data[req.datalen++] = RAD_NAS_IP_ADDRESS;
+    req.data[req.datalen++] = sizeof(struct in_addr) + 2;
+    memcpy(req.data + req.datalen, &sinl->sin_addr.s_addr,
+           sizeof(struct in_addr));
+    req.datalen += sizeof(struct in_addr);
+
+    /* we're only doing authentication */
+    req.data[req.datalen] = PW_SERVICE_TYPE;
+    req.data[req.datalen+1] = 6;
+    req.data[req.datalen+2] = (PW_SERVICE_AUTH_ONLY >> 24) & 0x000000ff;
+    req.data[req.datalen+3] = (PW_SERVICE_AUTH_ONLY >> 16) & 0x000000ff;
+    req.data[req.datalen+4] = (PW_SERVICE_AUTH_ONLY >> 8) & 0x000000ff;
+    req.data[req.datalen+5] = PW_SERVICE_AUTH_ONLY & 0x000000ff;
+    req.datalen += req.data[req.datalen+1];
+
+    /* filled in the data, now we know what the actual length is. */
+    req.length = 4+AUTH_VECTOR_LEN+req.datalen;
+
+    /* "encrypt" the password */
+    for (i = 0; i < req.data[passstart+1]-2; i += sizeof(HASH)) {
+        jlen = sizeof(HASH);
+        if (req.data[passstart+1]-(unsigned)i-2 < sizeof(HASH))
+            jlen = req.data[passstart+1]-i-2;
+        for (j = 0; j < jlen; j++)
+            req.data[passstart+2+i+j] ^= digest[j];
+        if (jlen == sizeof(HASH)) {
+            /* Recalculate the digest from the HASHed previous */
+            strlcpy((char *) secbuf, config->secret, sizeof(secbuf));
+            memcpy(secbuf+strlen(config->secret), &req.data[passstart+2+i],
+                   sizeof(HASH));
+            md5_hash(secbuf, strlen(config->secret)+sizeof(HASH), digest);
+        }
+    }
+    sreq->reqlen = req.length;
+    req.length = htons(req.length);
+    sreq->req = req;
+}
+
+
+/*
+**  Check the size of a packet received from a radius server, returning
+**  false after warning if it is wrong.
+*/
+static bool
+rad_reply_size(const auth_req *reply, ssize_t len)
+{
+    if (len < 4+AUTH_VECTOR_LEN || len != ntohs(reply->length)) {
+        warn("received badly-sized packet");
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  Whether a packet, of a size already checked, is the reply of the radius
+**  server of a configuration block to the request in sreq: its
+**  authenticator is the MD5 hash of the packet with the authenticator of
+**  the request instead, followed by the secret.
+*/
+static bool
+rad_reply_matches(const rad_config_t *config, const sending_t *sreq,
+                  const auth_req *reply)
+{
+    struct md5_context context;
+    size_t length;
+
+    length = ntohs(reply->length);
+    md5_init(&context);
+    md5_update(&context, (const unsigned char *) reply, 4);
+    md5_update(&context, sreq->req.vector, AUTH_VECTOR_LEN);
+    md5_update(&context, reply->data, length - 4 - AUTH_VECTOR_LEN);
+    md5_update(&context, (const unsigned char *) config->secret,
+               strlen(config->secret));
+    md5_final(&context);
+    return memcmp(context.digest, reply->vector, AUTH_VECTOR_LEN) == 0;
+}
+
+
+static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
+{
+    auth_req req;
     struct timeval seed;
     struct sockaddr_in sinl;
     int sock;
-    struct hostent *hent;
-    int passlen;
-    time_t now, end;
+    ssize_t jlen;
     struct timeval tmout;
     int got;
     fd_set rdfds;
-    uint32_t nvalue;
     socklen_t slen;
     int authtries= 3; /* number of times to try reaching the radius server */
     rad_config_t *config;
     sending_t *reqtop, *sreq, *new;
-    int done;
 
     /* set up the linked list */
     config = radconfig;
@@ -257,6 +463,10 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
       reqtop = NULL;
     }
 
+    /* seed the random number generator for the auth vector */
+    gettimeofday(&seed, 0);
+    srandom((unsigned) seed.tv_sec+seed.tv_usec);
+
     while (config != NULL){
       new = xmalloc(sizeof(sending_t));
       new->next = NULL;
@@ -268,132 +478,10 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
 	sreq->next = new;
 	sreq = sreq->next;
       }
-      req_copyto(&req, sreq);
-  
-      /* first, build the sockaddrs */
-      memset(&sinl, '\0', sizeof(sinl));
-      memset(&sreq->sinr, '\0', sizeof(sreq->sinr));
-      sinl.sin_family = AF_INET;
-      sreq->sinr.sin_family = AF_INET;
-      if (config->lochost == NULL) {
-        if (gethostname(hostname, sizeof(hostname)) != 0) {
-          syswarn("cannot get local hostname");
-          return(-2);
-        }
-	config->lochost = xstrdup(hostname);
-      }
-      if (config->lochost) {
-	if (inet_aton(config->lochost, &sinl.sin_addr) != 1) {
-          if ((hent = gethostbyname(config->lochost)) == NULL) {
-            warn("cannot gethostbyname lochost %s", config->lochost);
-            return(-2);
-          }
-          memcpy(&sinl.sin_addr.s_addr, hent->h_addr,
-                 sizeof(struct in_addr));
-	}
-      }
-      if (inet_aton(config->radhost, &sreq->sinr.sin_addr) != 1) {
-        if ((hent = gethostbyname(config->radhost)) == NULL) {
-          warn("cannot gethostbyname radhost %s", config->radhost);
-          return(-2);
-        }
-	memcpy(&sreq->sinr.sin_addr.s_addr, hent->h_addr_list[0],
-               sizeof(struct in_addr));
-      }
-
-      if (config->radport)
-        sreq->sinr.sin_port = htons(config->radport);
-      else
-	sreq->sinr.sin_port = htons(PW_AUTH_UDP_PORT);
-
-      /* seed the random number generator for the auth vector */
-      gettimeofday(&seed, 0);
-      srandom((unsigned) seed.tv_sec+seed.tv_usec);
-      /* build the visible part of the auth vector randomly */
-      for (i = 0; i < AUTH_VECTOR_LEN; i++)
-	req.vector[i] = random() % 256;
-      strlcpy((char *) secbuf, config->secret, sizeof(secbuf));
-      memcpy(secbuf+strlen(config->secret), req.vector, AUTH_VECTOR_LEN);
-      md5_hash(secbuf, strlen(config->secret)+AUTH_VECTOR_LEN, digest);
-      /* fill in the auth_req data */
-      req.code = PW_AUTHENTICATION_REQUEST;
-      req.id = 0;
-
-      /* bracket the username in the configured prefix/suffix */
-      req.data[0] = PW_USER_NAME;
-      req.data[1] = 2;
-      req.data[2] = '\0';
-      if (config->prefix) {
-	req.data[1] += strlen(config->prefix);
-	strlcat((char *) &req.data[2], config->prefix, sizeof(req.data) - 2);
-      }
-      req.data[1] += strlen(uname);
-      strlcat((char *)&req.data[2], uname, sizeof(req.data) - 2);
-      if (!strchr(uname, '@') && config->suffix) {
-	req.data[1] += strlen(config->suffix);
-	strlcat((char *)&req.data[2], config->suffix, sizeof(req.data) - 2);
-      }
-      req.datalen = req.data[1];
-
-      /* set the password */
-      passstart = req.datalen;
-      req.data[req.datalen] = PW_PASSWORD;
-      /* Null pad the password */
-      passlen = (strlen(pass) + 15) / 16;
-      passlen *= 16;
-      req.data[req.datalen+1] = passlen+2;
-      strlcpy((char *)&req.data[req.datalen+2], pass,
-              sizeof(req.data) - req.datalen - 2);
-      passlen -= strlen(pass);
-      while (passlen--)
-	req.data[req.datalen+passlen+2+strlen(pass)] = '\0';
-      req.datalen += req.data[req.datalen+1];
-
-      /* Add NAS_PORT and NAS_IP_ADDRESS into request */
-      if ((nvalue = config->locport) == 0)
-        nvalue = RADIUS_LOCAL_PORT;
-      req.data[req.datalen++] = RAD_NAS_PORT;
-      req.data[req.datalen++] = sizeof(nvalue) + 2;
-      nvalue = htonl(nvalue);
-      memcpy(req.data + req.datalen, &nvalue, sizeof(nvalue));
-      req.datalen += sizeof(nvalue);
-      req.data[req.datalen++] = RAD_NAS_IP_ADDRESS;
-      req.data[req.datalen++] = sizeof(struct in_addr) + 2;
-      memcpy(req.data + req.datalen, &sinl.sin_addr.s_addr,
-           sizeof(struct in_addr));
-      req.datalen += sizeof(struct in_addr);
-
-      /* we're only doing authentication */
-      req.data[req.datalen] = PW_SERVICE_TYPE;
-      req.data[req.datalen+1] = 6;
-      req.data[req.datalen+2] = (PW_SERVICE_AUTH_ONLY >> 24) & 0x000000ff;
-      req.data[req.datalen+3] = (PW_SERVICE_AUTH_ONLY >> 16) & 0x000000ff;
-      req.data[req.datalen+4] = (PW_SERVICE_AUTH_ONLY >> 8) & 0x000000ff;
-      req.data[req.datalen+5] = PW_SERVICE_AUTH_ONLY & 0x000000ff;
-      req.datalen += req.data[req.datalen+1];
-
-      /* filled in the data, now we know what the actual length is. */
-      req.length = 4+AUTH_VECTOR_LEN+req.datalen;
-
-      /* "encrypt" the password */
-      for (i = 0; i < req.data[passstart+1]-2; i += sizeof(HASH)) {
-	jlen = sizeof(HASH);
-	if (req.data[passstart+1]-(unsigned)i-2 < sizeof(HASH))
-	    jlen = req.data[passstart+1]-i-2;
-	for (j = 0; j < jlen; j++)
-	    req.data[passstart+2+i+j] ^= digest[j];
-	if (jlen == sizeof(HASH)) {
-	    /* Recalculate the digest from the HASHed previous */
-	    strlcpy((char *) secbuf, config->secret, sizeof(secbuf));
-	    memcpy(secbuf+strlen(config->secret), &req.data[passstart+2+i],
-                   sizeof(HASH));
-            md5_hash(secbuf, strlen(config->secret)+sizeof(HASH), digest);
-	}
-      }
-      sreq->reqlen = req.length;
-      req.length = htons(req.length);
 
-      req_copyfrom(sreq, &req);
+      if (!rad_addresses(config, &sinl, &sreq->sinr))
+        return(-2);
+      rad_request(config, &sinl, 0, uname, pass, sreq);
 
       /* Go to the next record in the list */
       config = config->next;
@@ -413,13 +501,12 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
       return(-1);
     }
 
-    for(done = 0; authtries > 0 && !done; authtries--) {
-      for (config = radconfig, sreq = reqtop; sreq != NULL && !done;
+    for (; authtries > 0; authtries--) {
+      for (config = radconfig, sreq = reqtop; sreq != NULL;
 	   config = config->next, sreq = sreq->next){
-	req_copyto(&req, sreq);
 
 	/* send out the packet and wait for reply. */
-	if (sendto(sock, (char *)&req, sreq->reqlen, 0, 
+	if (sendto(sock, (char *) &sreq->req, sreq->reqlen, 0,
 		   (struct sockaddr*) &sreq->sinr, 
 		   sizeof (struct sockaddr_in)) < 0) {
           syswarn("cannot send auth_reg");
@@ -428,13 +515,9 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
 	}
 
 	/* wait 5 seconds maximum for a radius reply. */
-	now = time(0);
-	end = now+5;
 	tmout.tv_sec = 6;
 	tmout.tv_usec = 0;
 	FD_ZERO(&rdfds);
-	/* store the old vector to verify next checksum */
-	memcpy(secbuf+sizeof(req.vector), req.vector, sizeof(req.vector));
 	FD_SET(sock, &rdfds);
 	got = select(sock+1, &rdfds, 0, 0, &tmout);
 	if (got < 0) {
@@ -442,9 +525,6 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
 	    break;
 	} else if (got == 0) {
 	    /* timer ran out */
-	    now = time(0);
-	    tmout.tv_sec = end - now + 1;
-	    tmout.tv_usec = 0;
 	    warn("timeout talking to remote radius server %s:%d",
                  inet_ntoa(sreq->sinr.sin_addr), ntohs(sreq->sinr.sin_port));
 	    continue;
@@ -463,25 +543,14 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
 		continue;
 	    }
 	}
-	sreq->reqlen = ntohs(req.length);
-	if (jlen < 4+AUTH_VECTOR_LEN || jlen != sreq->reqlen) {
-            warn("received badly-sized packet");
+	if (!rad_reply_size(&req, jlen))
 	    continue;
-	}
-	/* verify the checksum */
-	memcpy(((char*)&req)+sreq->reqlen, config->secret, strlen(config->secret));
-	memcpy(secbuf, req.vector, sizeof(req.vector));
-	memcpy(req.vector, secbuf+sizeof(req.vector), sizeof(req.vector));
-        md5_hash((unsigned char *)&req, strlen(config->secret)+sreq->reqlen,
-	    digest);
-	if (memcmp(digest, secbuf, sizeof(HASH)) != 0) {
+	if (!rad_reply_matches(config, sreq, &req)) {
             warn("checksum didn't match");
 	    continue;
 	}
 	/* FINALLY!  Got back a known-good packet.  See if we're in. */
 	close(sock);
-        done = 1;
-        req_copyfrom(sreq, &req);
 	return (req.code == PW_AUTHENTICATION_ACK) ? 0 : -1;
       }
     }
@@ -490,6 +559,333 @@ static int rad_auth(rad_config_t *radconfig, char *uname, char *pass)
     return(-2);
 }
 
+
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+/*
+**  Send a reply to a connection of nnrpd, closing it on failure.
+*/
+static void
+rad_answer(struct radserver *server, int fd, const char *reply, size_t len)
+{
+    if (fd < 0)
+        return;
+    if (xwrite(fd, reply, len) < 0) {
+        close(fd);
+        buffer_free(server->input[fd]);
+        server->input[fd] = NULL;
+    }
+}
+
+
+/*
+**  Send the packets of a request to all the radius servers.
+*/
+static void
+rad_send(struct radserver *server, struct pending *pending)
+{
+    int i;
+
+    for (i = 0; i < server->servers; i++)
+        if (sendto(server->sock, (char *) &pending->requests[i].req,
+                   pending->requests[i].reqlen, 0,
+                   (struct sockaddr *) &pending->requests[i].sinr,
+                   sizeof(struct sockaddr_in)) < 0)
+            syswarn("cannot send auth_reg to %s:%d",
+                    inet_ntoa(pending->requests[i].sinr.sin_addr),
+                    ntohs(pending->requests[i].sinr.sin_port));
+    pending->tries++;
+    pending->retry = TMRnow_double() + RAD_RETRY;
+}
+
+
+/*
+**  Answer the request waiting on an identifier with the verdict of a radius
+**  server, or as failed if code is 0, and free the identifier.
+*/
+static void
+rad_finish(struct radserver *server, unsigned int id, int code)
+{
+    struct pending *pending = &server->pending[id];
+    struct buffer *reply;
+
+    reply = buffer_new();
+    if (code == PW_AUTHENTICATION_ACK) {
+        buffer_sprintf(reply, "User:%s\r\n.\r\n", pending->authinfo->username);
+        auth_cache_store(server->cache, pending->authinfo, reply->data,
+                         reply->left);
+    } else if (code == 0)
+        buffer_sprintf(reply, "Error:cannot talk to any remote radius"
+                       " servers\r\n.\r\n");
+    else
+        buffer_sprintf(reply, "Error:user %s password doesn't match\r\n.\r\n",
+                       pending->authinfo->username);
+    if (pending->fd >= 0) {
+        server->waiting[pending->fd] = -1;
+        rad_answer(server, pending->fd, reply->data, reply->left);
+    }
+    buffer_free(reply);
+    free_auth_info(pending->authinfo);
+    pending->authinfo = NULL;
+    free(pending->requests);
+    pending->requests = NULL;
+}
+
+
+/*
+**  Read a packet from a radius server, and answer the request it is the
+**  reply to.  Replies to requests already answered, such as those from the
+**  servers which didn't reply first, are ignored.
+*/
+static void
+rad_receive(struct radserver *server)
+{
+    auth_req reply;
+    struct sockaddr_in sinr;
+    socklen_t slen;
+    ssize_t len;
+    struct pending *pending;
+    rad_config_t *config;
+    sending_t *sreq;
+    int i;
+
+    slen = sizeof(sinr);
+    len = recvfrom(server->sock, (char *) &reply, sizeof(reply) - sizeof(int),
+                   0, (struct sockaddr *) &sinr, &slen);
+    if (len < 0) {
+        if (errno != EINTR && errno != EAGAIN)
+            syswarn("cannot recvfrom");
+        return;
+    }
+    if (!rad_reply_size(&reply, len))
+        return;
+    pending = &server->pending[reply.id];
+    if (pending->authinfo == NULL)
+        return;
+    for (config = server->config, i = 0; config != NULL;
+         config = config->next, i++) {
+        sreq = &pending->requests[i];
+        if (!config->ignore_source
+            && (sinr.sin_addr.s_addr != sreq->sinr.sin_addr.s_addr
+                || sinr.sin_port != sreq->sinr.sin_port))
+            continue;
+        if (rad_reply_matches(config, sreq, &reply)) {
+            rad_finish(server, reply.id, reply.code);
+            return;
+        }
+    }
+    warn("unexpected or badly signed UDP packet from %s:%d",
+         inet_ntoa(sinr.sin_addr), ntohs(sinr.sin_port));
+}
+
+
+/*
+**  Start on the next request read from a connection, if the connection
+**  isn't already waiting for a verdict, it has a complete request, and
+**  there is a free identifier for it (otherwise it waits in the buffer).
+**  Requests with a cached verdict are answered at once.
+*/
+static void
+rad_start(struct radserver *server, int fd)
+{
+    struct buffer *input;
+    struct pending *pending;
+    struct auth_info *authinfo;
+    rad_config_t *config;
+    const char *cached;
+    char *request;
+    size_t length;
+    unsigned int id, i;
+    int n;
+
+    while (server->input[fd] != NULL && server->waiting[fd] < 0) {
+        input = server->input[fd];
+        length = auth_request_length(input->data + input->used, input->left);
+        if (length == 0)
+            return;
+        for (i = 0; i < 256; i++) {
+            id = (server->next + i) % 256;
+            if (server->pending[id].authinfo == NULL)
+                break;
+        }
+        if (i == 256)
+            return;
+        request = xstrndup(input->data + input->used, length);
+        input->used += length;
+        input->left -= length;
+        authinfo = parse_auth_info(request);
+        free(request);
+        if (authinfo == NULL) {
+            rad_answer(server, fd, ".\r\n", 3);
+            continue;
+        }
+        if (authinfo->username[0] == '\0') {
+            free_auth_info(authinfo);
+            rad_answer(server, fd, "Error:empty username\r\n.\r\n",
+                       strlen("Error:empty username\r\n.\r\n"));
+            continue;
+        }
+        cached = auth_cache_lookup(server->cache, authinfo);
+        if (cached != NULL) {
+            free_auth_info(authinfo);
+            rad_answer(server, fd, cached, strlen(cached));
+            continue;
+        }
+
+        /* Ask all the servers at once, and take the first reply. */
+        server->next = id + 1;
+        pending = &server->pending[id];
+        pending->authinfo = authinfo;
+        pending->fd = fd;
+        pending->tries = 0;
+        pending->requests = xcalloc(server->servers, sizeof(sending_t));
+        for (config = server->config, n = 0; config != NULL;
+             config = config->next, n++) {
+            pending->requests[n].sinr = server->sinr[n];
+            rad_request(config, &server->sinl, id, authinfo->username,
+                        authinfo->password, &pending->requests[n]);
+        }
+        server->waiting[fd] = id;
+        rad_send(server, pending);
+    }
+}
+
+
+/*
+**  Run as a server answering the requests of nnrpd on a Unix domain socket
+**  at path, in the same format as ckpasswd -S.  The packets for all the
+**  outstanding requests go through one UDP socket, told apart by their
+**  radius identifier, and each request is sent to all the radius servers
+**  at once, the first reply giving the verdict.  Accepted usernames and
+**  passwords are cached for ttl seconds; rejections are not, so that a user
+**  who just fixed their password doesn't have to wait.
+*/
+static void
+rad_serve(rad_config_t *radconfig, const char *path, unsigned long ttl)
+{
+    struct radserver *server;
+    struct timeval seed, tv, *timeout;
+    fd_set fds, rfds;
+    rad_config_t *config;
+    int listener, fd, maxfd, status;
+    unsigned int id;
+    ssize_t count;
+    double now, first;
+
+    server = xcalloc(1, sizeof(struct radserver));
+    server->config = radconfig;
+    for (config = radconfig; config != NULL; config = config->next)
+        server->servers++;
+    server->sinr = xcalloc(server->servers, sizeof(struct sockaddr_in));
+    for (config = radconfig, fd = 0; config != NULL;
+         config = config->next, fd++)
+        if (!rad_addresses(config, &server->sinl, &server->sinr[fd]))
+            exit(1);
+    server->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (server->sock < 0)
+        sysdie("cannot build reply socket");
+    if (bind(server->sock, (struct sockaddr *) &server->sinl,
+             sizeof(server->sinl)) < 0)
+        sysdie("cannot bind reply socket");
+    gettimeofday(&seed, 0);
+    srandom((unsigned) seed.tv_sec + seed.tv_usec);
+    server->next = random() % 256;
+    server->cache = auth_cache_new(ttl);
+    for (fd = 0; fd < FD_SETSIZE; fd++)
+        server->waiting[fd] = -1;
+
+    listener = auth_listen(path);
+    if (listener >= FD_SETSIZE || server->sock >= FD_SETSIZE)
+        die("too many open file descriptors");
+    signal(SIGPIPE, SIG_IGN);
+    maxfd = (listener > server->sock) ? listener : server->sock;
+    while (1) {
+        FD_ZERO(&rfds);
+        FD_SET(listener, &rfds);
+        FD_SET(server->sock, &rfds);
+        for (fd = 0; fd <= maxfd; fd++)
+            if (server->input[fd] != NULL)
+                FD_SET(fd, &rfds);
+
+        /* Wake up for the next request to send again. */
+        timeout = NULL;
+        first = 0;
+        for (id = 0; id < 256; id++)
+            if (server->pending[id].authinfo != NULL
+                && (first == 0 || server->pending[id].retry < first))
+                first = server->pending[id].retry;
+        if (first != 0) {
+            now = TMRnow_double();
+            first = (first > now) ? first - now : 0;
+            tv.tv_sec = (time_t) first;
+            tv.tv_usec = (long) ((first - tv.tv_sec) * 1e6);
+            timeout = &tv;
+        }
+        fds = rfds;
+        status = select(maxfd + 1, &fds, NULL, NULL, timeout);
+        if (status < 0) {
+            if (errno == EINTR)
+                continue;
+            sysdie("select failed");
+        }
+
+        if (FD_ISSET(server->sock, &fds))
+            rad_receive(server);
+
+        if (FD_ISSET(listener, &fds)) {
+            fd = accept(listener, NULL, NULL);
+            if (fd < 0)
+                syswarn("cannot accept connection");
+            else if (fd >= FD_SETSIZE) {
+                warn("too many connections");
+                close(fd);
+            } else {
+                server->input[fd] = buffer_new();
+                server->waiting[fd] = -1;
+                if (fd > maxfd)
+                    maxfd = fd;
+            }
+        }
+
+        for (fd = 0; fd <= maxfd; fd++) {
+            if (fd == listener || fd == server->sock || !FD_ISSET(fd, &fds)
+                || server->input[fd] == NULL)
+                continue;
+            buffer_compact(server->input[fd]);
+            buffer_resize(server->input[fd], server->input[fd]->left + 1024);
+            count = buffer_read(server->input[fd], fd);
+            if (count <= 0 || server->input[fd]->left > AUTH_MAX_REQUEST) {
+                if (server->waiting[fd] >= 0)
+                    server->pending[server->waiting[fd]].fd = -1;
+                server->waiting[fd] = -1;
+                close(fd);
+                buffer_free(server->input[fd]);
+                server->input[fd] = NULL;
+            }
+        }
+
+        /* Send again the requests without a reply, or give up on them. */
+        now = TMRnow_double();
+        for (id = 0; id < 256; id++) {
+            if (server->pending[id].authinfo == NULL
+                || server->pending[id].retry > now)
+                continue;
+            if (server->pending[id].tries < RAD_TRIES)
+                rad_send(server, &server->pending[id]);
+            else {
+                warn("cannot talk to any remote radius servers");
+                rad_finish(server, id, 0);
+            }
+        }
+
+        /* Start on the requests which can be. */
+        for (fd = 0; fd <= maxfd; fd++)
+            if (server->input[fd] != NULL)
+                rad_start(server, fd);
+    }
+}
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
+
+
 #define RAD_HAVE_HOST 1
 #define RAD_HAVE_PORT 2
 #define RAD_HAVE_PREFIX 4
@@ -505,6 +901,8 @@ int main(int argc, char *argv[])
     rad_config_t radconfig;
     int retval;
     char *radius_config;
+    const char *socket_path = NULL;
+    unsigned long ttl = 30;
 
     message_program_name = "radius";
 
@@ -514,7 +912,7 @@ int main(int argc, char *argv[])
     memset(&radconfig, '\0', sizeof(rad_config_t));
     haveother = havefile = 0;
 
-    while ((opt = getopt(argc, argv, "f:h")) != -1) {
+    while ((opt = getopt(argc, argv, "f:hS:t:")) != -1) {
 	switch (opt) {
 	  case 'f':
 	    if (haveother)
@@ -528,8 +926,14 @@ int main(int argc, char *argv[])
 	    read_config(optarg, &radconfig);
 	    break;
 	case 'h':
-	  printf("Usage: radius [-f config]\n");
+	  printf("Usage: radius [-f config] [-S socket [-t ttl]]\n");
           exit(0);
+	case 'S':
+	  socket_path = optarg;
+	  break;
+	case 't':
+	  ttl = strtoul(optarg, NULL, 10);
+	  break;
 	}
     }
     if (argc != optind)
@@ -541,6 +945,15 @@ int main(int argc, char *argv[])
       free(radius_config);
     }
 
+    /* Answer the requests of nnrpd on a socket until killed. */
+    if (socket_path != NULL) {
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+        rad_serve(&radconfig, socket_path, ttl);
+#else
+        die("Unix domain sockets not supported on this system");
+#endif
+    }
+
     authinfo = get_auth_info(stdin);
     if (authinfo == NULL)
         die("failed getting auth info");
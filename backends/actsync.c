@@ -33,6 +33,7 @@
  *			    aK1	like both 'a1' and 'aK'
  *			    c	output in ctlinnd change commands
  *			    x	no output, safely exec ctlinnd commands
+ *			    xb	no output, send commands to innd directly
  *			    xi	no output, safely exec commands interactively
  *	-p %		min % host1 lines unchanged allowed	  (def: -p 96)
  *	-q hostid	silence errors from a host (see -b)	  (def: -q 0)
@@ -72,11 +73,13 @@
 #include <sys/wait.h>
 
 #include "inn/innconf.h"
+#include "inn/inndcomm.h"
 #include "inn/messages.h"
 #include "inn/hashtab.h"
 #include "inn/qio.h"
 #include "inn/libinn.h"
 #include "inn/paths.h"
+#include "inn/xwrite.h"
 
 static const char usage[] = "\
 Usage: actsync [-A][-b hostid][-d hostid][-i ignore_file][-I hostid][-k]\n\
@@ -110,6 +113,7 @@ Usage: actsync [-A][-b hostid][-d hostid][-i ignore_file][-I hostid][-k]\n\
                 aK1     like both 'a1' and 'aK'\n\
                 c       output in ctlinnd change commands\n\
                 x       no output, safely exec ctlinnd commands\n\
+                xb      no output, send commands to innd directly\n\
                 xi      no output, safely exec commands interactively\n\
     -p %        min % host1 lines unchanged allowed     (def: -p 96)\n\
     -q hostid   silence errors from a host (see -b)     (def: -q 0)\n\
@@ -263,6 +267,10 @@ struct eqgrp {
 #define OUTPUT_CTLINND 2	/* output in ctlinnd change commands */
 #define OUTPUT_EXEC 3		/* no output, safely exec commands */
 #define OUTPUT_IEXEC 4		/* no output, exec commands interactively */
+#define OUTPUT_BATCH 5		/* no output, send commands over one channel */
+
+#define EXEC_OUTPUT \
+    (o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC || o_flag == OUTPUT_BATCH)
 
 /* -q macros */
 #define QUIET(hostid)  \
@@ -313,10 +321,17 @@ int w_flag = 30;        /* sleep w_flag sec before ctlinnd timing out */
 int z_flag = 4;			/* sleep z_flag sec per exec if -o x */
 int A_flag = 0;         /* 1 => authentication before LIST command */
 
+static pid_t fetch_pid;		/* process started by fetch_active */
+static int icc_open = 0;	/* 1 => control channel open for -o xb */
+
 /* forward declarations */
 static void process_args(int argc, char *argv[], char **host1, char **host2);
 static struct grp *get_active(char *host, int hostid, int *len, struct grp *,
-                              int *errs);
+                              int *errs, int fd);
+static FILE *open_remote(char *host, FILE **from, FILE **to);
+static void close_remote(FILE *from, FILE *to);
+static int fetch_active(char *host);
+static void fetch_wait(char *host, int fd);
 static int bad_grpname(char *name, int num_chk);
 static struct pat *get_ignore(char *filename, int *len);
 static void ignore_grps(struct grp *, int grplen, struct pat *, int iglen);
@@ -330,6 +345,7 @@ static int mark_eq_probs(struct grp *, int grplen, int hostid, char *host1,
                          char *host2);
 static int exec_cmd(int mode, const char *cmd, char *grp, char *type,
                     const char *who);
+static int send_cmd(const char *cmd, char *grp, char *type, const char *who);
 static int new_top_hier(char *name, struct hash *existing_hier);
 static const void *string_key(const void *entry);
 static bool string_equal(const void *key, const void *entry);
@@ -343,6 +359,7 @@ main(int argc, char *argv[])
     int iglen;			/* length of ignore list */
     char *host1;		/* host to change */
     char *host2;		/* comparison host */
+    int fd;			/* host2 data fetched in the background */
 
     /* First thing, set up our identity. */
     message_program_name = "actsync";
@@ -352,9 +369,10 @@ main(int argc, char *argv[])
         exit(1);
     process_args(argc, argv, &host1, &host2);
 
-    /* obtain the active files */
-    grp = get_active(host1, HOSTID1, &grplen, NULL, &host1_errs);
-    grp = get_active(host2, HOSTID2, &grplen, grp, &host2_errs);
+    /* obtain the active files, fetching host2 while host1 is read */
+    fd = fetch_active(host2);
+    grp = get_active(host1, HOSTID1, &grplen, NULL, &host1_errs, -1);
+    grp = get_active(host2, HOSTID2, &grplen, grp, &host2_errs, fd);
 
     /* ignore groups from both active files, if -i */
     if (ign_file != NULL) {
@@ -569,12 +587,15 @@ process_args(int argc, char *argv[], char **host1, char **host2)
 	    case 'x':
 		if (optarg[1] == 'i') {
 		    o_flag = OUTPUT_IEXEC;
+		} else if (optarg[1] == 'b') {
+		    o_flag = OUTPUT_BATCH;
 		} else {
 		    o_flag = OUTPUT_EXEC;
 		}
 		break;
 	    default:
-                warn("-o type must be a, a1, ak, aK, ak1, aK1, a1k, a1K, c, x, or xi");
+                warn("-o type must be a, a1, ak, aK, ak1, aK1, a1k, a1K, c, x, xb,"
+                     " or xi");
 		die("%s", usage);
 	    }
 	    break;
@@ -707,22 +728,24 @@ process_args(int argc, char *argv[], char **host1, char **host2)
  *	len	pointer to length of grp return array
  *	grp	existing host array to add, or NULL
  *	errs	count of lines that were found to have some error
+ *	fd	descriptor from fetch_active, or -1
  *
  * returns;
  *	Pointer to an array of grp structures describing each active entry.
  *	Does not return on fatal error.
  *
  * If host starts with a '/' or '.', then it is assumed to be a local file.
- * In that case, the local file is opened and read.
+ * In that case, the local file is opened and read.  If fd is not -1, the
+ * active data was already fetched by fetch_active and is read from fd.
  */
 static struct grp *
-get_active(char *host, int hostid, int *len, struct grp *grp, int *errs)
+get_active(char *host, int hostid, int *len, struct grp *grp, int *errs,
+           int fd)
 {
     FILE *active;		/* stream for fetched active data */
-    FILE *FromServer;		/* stream from server */
-    FILE *ToServer;		/* stream to server */
+    FILE *FromServer = NULL;	/* stream from server */
+    FILE *ToServer = NULL;	/* stream to server */
     QIOSTATE *qp;		/* QIO active state */
-    char buff[8192+1];		/* QIO buffer */
     char *line;			/* the line just read */
     struct grp *ret;		/* array of groups to return */
     struct grp *cur;		/* current grp entry being formed */
@@ -732,8 +755,6 @@ get_active(char *host, int hostid, int *len, struct grp *grp, int *errs)
     int namelen;		/* length of newsgroup name */
     int is_file;		/* 1 => host is actually a filename */
     int num_check;		/* true => check for all numeric components */
-    char *rhost;
-    int rport;
     char *p;
     int i;
 
@@ -769,39 +790,25 @@ get_active(char *host, int hostid, int *len, struct grp *grp, int *errs)
 	if ((qp = QIOopen(host)) == NULL)
             sysdie("cannot open active file");
 
+    /* case: host was already fetched by fetch_active */
+    } else if (fd >= 0) {
+
+	/* the data is read like a local file */
+	is_file = 1;
+
+	/* reap the fetching process and rewind its output */
+	fetch_wait(host, fd);
+	if ((qp = QIOfdopen(fd)) == NULL)
+            sysdie("cannot read temp file");
+
     /* case: host is a hostname */
     } else {
 
 	/* note that host is actually a hostname */
 	is_file = 0;
 
-        /* prepare remote host variables */
-	if ((p = strchr(host, ':')) != NULL) {
-		rport = atoi(p + 1);
-		*p = '\0';
-		rhost = xstrdup(host);
-		*p = ':';
-	} else {
-		rhost = xstrdup(host);
-		rport = NNTP_PORT;
-	}
-
-	/* open a connection to the server */
-	buff[0] = '\0';
-	if (NNTPconnect(rhost, rport, &FromServer, &ToServer, buff,
-                        sizeof(buff)) < 0)
-            die("cannot connect to server: %s",
-                buff[0] ? buff : strerror(errno));
-
-        if (A_flag && NNTPsendpassword(rhost, FromServer, ToServer) < 0)
-            die("cannot authenticate to server");
-
-	free(rhost);
-
 	/* get the active data from the server */
-	active = CAlistopen(FromServer, ToServer, NULL);
-	if (active == NULL)
-            sysdie("cannot retrieve data");
+	active = open_remote(host, &FromServer, &ToServer);
 
 	/* setup to read the retrieved data quickly */
 	if ((qp = QIOfdopen((int)fileno(active))) == NULL)
@@ -1092,15 +1099,165 @@ get_active(char *host, int hostid, int *len, struct grp *grp, int *errs)
     if (is_file) {
 	QIOclose(qp);
     } else {
-	CAclose();
-	fprintf(ToServer, "QUIT\r\n");
-	fclose(ToServer);
-	fgets(buff, sizeof buff, FromServer);
-	fclose(FromServer);
+	close_remote(FromServer, ToServer);
     }
     return ret;
 }
 
+/*
+ * open_remote - retrieve the active file of a remote host
+ *
+ * given:
+ *	host	host to contact, optionally followed by :port
+ *	from	set to the stream from the server
+ *	to	set to the stream to the server
+ *
+ * returns:
+ *	The stream of the retrieved active data.
+ *	Does not return on fatal error.
+ */
+static FILE *
+open_remote(char *host, FILE **from, FILE **to)
+{
+    FILE *active;		/* stream for fetched active data */
+    char buff[8192+1];		/* NNTPconnect error buffer */
+    char *rhost;
+    int rport;
+    char *p;
+
+    /* prepare remote host variables */
+    if ((p = strchr(host, ':')) != NULL) {
+	rport = atoi(p + 1);
+	*p = '\0';
+	rhost = xstrdup(host);
+	*p = ':';
+    } else {
+	rhost = xstrdup(host);
+	rport = NNTP_PORT;
+    }
+
+    /* open a connection to the server */
+    buff[0] = '\0';
+    if (NNTPconnect(rhost, rport, from, to, buff, sizeof(buff)) < 0)
+        die("cannot connect to server: %s",
+            buff[0] ? buff : strerror(errno));
+
+    if (A_flag && NNTPsendpassword(rhost, *from, *to) < 0)
+        die("cannot authenticate to server");
+
+    free(rhost);
+
+    /* get the active data from the server */
+    active = CAlistopen(*from, *to, NULL);
+    if (active == NULL)
+        sysdie("cannot retrieve data");
+    return active;
+}
+
+/*
+ * close_remote - end a session opened by open_remote
+ *
+ * given:
+ *	from	stream from the server
+ *	to	stream to the server
+ */
+static void
+close_remote(FILE *from, FILE *to)
+{
+    char buff[BUFSIZ];		/* reply to QUIT */
+
+    CAclose();
+    fprintf(to, "QUIT\r\n");
+    fclose(to);
+    fgets(buff, sizeof buff, from);
+    fclose(from);
+}
+
+/*
+ * fetch_active - start retrieving a remote active file in the background
+ *
+ * given:
+ *	host	host to contact or file to read
+ *
+ * returns:
+ *	-1 if host is a local file, else a descriptor on an unlinked
+ *	temporary file that a child process is filling with the active
+ *	data of host; fetch_wait must be called before reading it.
+ *	Does not return on fatal error.
+ *
+ * This lets the transfer from host2 overlap the transfer and parsing
+ * of the host1 active file.
+ */
+static int
+fetch_active(char *host)
+{
+    FILE *active;		/* stream for fetched active data */
+    FILE *FromServer;		/* stream from server */
+    FILE *ToServer;		/* stream to server */
+    char buff[8192];		/* copy buffer */
+    char *path;
+    size_t n;
+    int fd;
+
+    /* local files are read directly */
+    if (host[0] == '/' || host[0] == '.')
+	return -1;
+
+    /* create the temporary file the child will fill */
+    path = concatpath(innconf->pathtmp, INN_PATH_TEMPACTIVE);
+    fd = mkstemp(path);
+    if (fd < 0)
+        sysdie("cannot create temporary file %s", path);
+    unlink(path);
+    free(path);
+
+    /* fork the fetching process */
+    fflush(stdout);
+    fflush(stderr);
+    fetch_pid = fork();
+    if (fetch_pid == -1)
+        sysdie("fork failed");
+    if (fetch_pid > 0)
+	return fd;
+
+    /* case: child process, copy the active data into fd */
+    if (D_BUG)
+        warn("STATUS: fetching active file from %s in the background", host);
+    active = open_remote(host, &FromServer, &ToServer);
+    while ((n = fread(buff, 1, sizeof(buff), active)) > 0) {
+	if (xwrite(fd, buff, n) < 0)
+            sysdie("cannot write temporary file");
+    }
+    if (ferror(active))
+        sysdie("cannot read temp file");
+    close_remote(FromServer, ToServer);
+    _exit(0);
+}
+
+/*
+ * fetch_wait - wait for a fetch started by fetch_active
+ *
+ * given:
+ *	host	host being fetched
+ *	fd	descriptor returned by fetch_active
+ *
+ * Does not return if the fetch failed.
+ */
+static void
+fetch_wait(char *host, int fd)
+{
+    int status;			/* wait status */
+
+    while (waitpid(fetch_pid, &status, 0) < 0) {
+	if (errno != EINTR)
+            sysdie("wait returned -1");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("cannot retrieve active file from %s", host);
+    if (lseek(fd, 0, SEEK_SET) < 0)
+        sysdie("cannot rewind temporary file");
+}
+
 /*
  * bad_grpname - test if the string is a valid group name
  *
@@ -2081,7 +2238,8 @@ output_grps(struct grp *grp, int grplen)
 		}
 
 	    /* case: exec ctlinnd commands */
-	    } else if (o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC) {
+	    } else if (o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC ||
+		       o_flag == OUTPUT_BATCH) {
 
 		/* warn about sleeping if needed and first time */
 		if (o_flag == OUTPUT_EXEC && z_flag > 0 && sleep_msg == 0) {
@@ -2096,7 +2254,7 @@ output_grps(struct grp *grp, int grplen)
 
 		    /* exec rmgroup */
 		    if (rm_cycle) {
-			if (D_REPORT && o_flag == OUTPUT_EXEC)
+			if (D_REPORT && o_flag != OUTPUT_IEXEC)
                             warn("rmgroup %s", grp[i].name);
 			if (! exec_cmd(o_flag, "rmgroup",
 			    grp[i].name, NULL, NULL)) {
@@ -2112,7 +2270,7 @@ output_grps(struct grp *grp, int grplen)
 
 		    /* exec newgroup */
 		    if (!rm_cycle) {
-			if (D_REPORT && o_flag == OUTPUT_EXEC)
+			if (D_REPORT && o_flag != OUTPUT_IEXEC)
                             warn("newgroup %s %s %s",
                                  grp[i].name, grp[i].outtype, new_name);
 			if (! exec_cmd(o_flag, "newgroup", grp[i].name,
@@ -2130,7 +2288,7 @@ output_grps(struct grp *grp, int grplen)
 
 		    /* exec changegroup */
 		    if (!rm_cycle) {
-			if (D_REPORT && o_flag == OUTPUT_EXEC)
+			if (D_REPORT && o_flag != OUTPUT_IEXEC)
                             warn("changegroup %s %s",
                                  grp[i].name, grp[i].outtype);
 			if (! exec_cmd(o_flag, "changegroup", grp[i].name,
@@ -2152,24 +2310,28 @@ output_grps(struct grp *grp, int grplen)
 	}
     } while (--rm_cycle >= 0);
 
+    /* end the control channel session, if -o xb opened one */
+    if (icc_open && ICCclose() < 0)
+        syswarn("cannot close the control channel");
+
     /* final accounting, if -v */
     if (D_SUMMARY || (D_IF_SUMM && (work > 0 || not_done > 0))) {
         warn("STATUS: %d group(s)", add+remove+change+same);
         warn("STATUS: %d group(s)%s added", add,
-             ((o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC) ?
+             (EXEC_OUTPUT ?
               "" : " to be"));
         warn("STATUS: %d group(s)%s removed",	remove,
-             ((o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC) ?
+             (EXEC_OUTPUT ?
               "" : " to be"));
         warn("STATUS: %d group(s)%s changed", change,
-             ((o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC) ?
+             (EXEC_OUTPUT ?
               "" : " to be"));
         warn("STATUS: %d group(s) %s the same", same,
-             ((o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC) ?
+             (EXEC_OUTPUT ?
               "remain" : "are"));
         warn("STATUS: %.2f%% of lines unchanged", host1_same);
         warn("STATUS: %d group(s) ignored", ignore);
-	if (o_flag == OUTPUT_EXEC || o_flag == OUTPUT_IEXEC)
+	if (EXEC_OUTPUT)
             warn("STATUS: %d exec(s) not performed", not_done);
     }
 }
@@ -2506,7 +2668,7 @@ mark_eq_probs(struct grp *grp, int grplen, int hostid, char *host1,
  * exec_cmd - exec a ctlinnd command in forked process
  *
  * given:
- *	mode	OUTPUT_EXEC or OUTPUT_IEXEC (interactive mode)
+ *	mode	OUTPUT_EXEC, OUTPUT_IEXEC (interactive mode) or OUTPUT_BATCH
  *	cmd	"changegroup", "newgroup", "rmgroup"
  *	grp	name of group
  *	type	type of group or NULL
@@ -2532,6 +2694,10 @@ exec_cmd(int mode, const char *cmd, char *grp, char *type, const char *who)
     if (cmd == NULL || grp == NULL)
         die("internal error #13, cmd or grp is NULL");
 
+    /* batch mode talks to innd directly */
+    if (mode == OUTPUT_BATCH)
+	return send_cmd(cmd, grp, type, who);
+
     /* if interactive, ask the question */
     if (mode == OUTPUT_IEXEC) {
 
@@ -2704,6 +2870,77 @@ exec_cmd(int mode, const char *cmd, char *grp, char *type, const char *who)
     return 1;
 }
 
+/*
+ * send_cmd - send a ctlinnd command to innd over the control channel
+ *
+ * given:
+ *	cmd	"changegroup", "newgroup", "rmgroup"
+ *	grp	name of group
+ *	type	type of group or NULL
+ *	who	newgroup creator or NULL
+ *
+ * returns:
+ *	1	command was performed
+ *	0	command was not performed
+ *
+ * The channel is opened on the first call and kept open until output_grps
+ * is done, so each change costs one request to innd rather than a fork
+ * and exec of ctlinnd.
+ */
+static int
+send_cmd(const char *cmd, char *grp, char *type, const char *who)
+{
+    const char *args[4];	/* arguments of the command */
+    char *reply = NULL;		/* reply from innd */
+    char letter;		/* control channel command */
+    int status;			/* exit code sent by innd */
+    char *p;
+
+    /* open the channel the first time through */
+    if (!icc_open) {
+	ICCsettimeout(w_flag);
+	if (ICCopen() < 0)
+            sysdie("cannot open the control channel (%s failure)",
+                   ICCfailure ? ICCfailure : "unknown");
+	icc_open = 1;
+    }
+
+    /* map the command to its control channel letter */
+    if (strcmp(cmd, "rmgroup") == 0)
+	letter = SC_RMGROUP;
+    else if (strcmp(cmd, "newgroup") == 0)
+	letter = SC_NEWGROUP;
+    else if (strcmp(cmd, "changegroup") == 0)
+	letter = SC_CHANGEGROUP;
+    else
+        die("internal error #14, unknown command %s", cmd);
+    args[0] = grp;
+    args[1] = type;
+    args[2] = (type == NULL) ? NULL : who;
+    args[3] = NULL;
+
+    /* send the command and wait for the reply */
+    status = ICCcommand(letter, args, &reply);
+    if (status < 0) {
+        syswarn("    cannot send %s %s (%s failure)", cmd, grp,
+                ICCfailure ? ICCfailure : "unknown");
+	free(reply);
+	return 0;
+    }
+    if (status != 0) {
+	/* skip the "<exitcode><space>" part of the reply */
+	for (p = reply; p != NULL && isdigit((unsigned char) *p); p++)
+	    continue;
+	while (p != NULL && ISWHITE(*p))
+	    p++;
+        warn("    %s %s failed: %s", cmd, grp, p != NULL ? p : "no reply");
+	free(reply);
+	return 0;
+    }
+    free(reply);
+    return 1;
+}
+
 /*
  * new_top_hier - determine if the newsgroup represents a new hierarchy
  *
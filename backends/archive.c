@@ -4,7 +4,9 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <time.h>
 
@@ -17,7 +19,15 @@
 #include "inn/libinn.h"
 #include "inn/paths.h"
 #include "inn/storage.h"
+#include "inn/xwrite.h"
+#include "../storage/timecaf/caf.h"
 
+#if defined(HAVE_ZLIB)
+# include <zlib.h>
+#endif
+
+/* How many consecutive article numbers of a group each chunk holds. */
+#define ARCHIVE_CHUNK   65536
 
 /* Holds various configuration options and command-line parameters. */
 struct config {
@@ -26,8 +36,16 @@ struct config {
     FILE *index;                /* Where to put the index entries. */
     bool concat;                /* Concatenate articles together. */
     bool flat;                  /* Use a flat directory structure. */
+    bool chunk;                 /* Append articles to chunk files. */
+    bool compress;              /* Compress articles in chunks. */
 };
 
+/* The chunk file last written to, kept open and locked. */
+static struct {
+    char *path;
+    int fd;
+} Chunk = { NULL, -1 };
+
 
 /*
 **  Try to make one directory.  Return false on error.
@@ -143,6 +161,290 @@ write_article(ARTHANDLE *article, const char *file, bool concatenate)
 }
 
 
+/*
+**  Given the path an article would have in its own file, comp/foo/bar/1123,
+**  return the path of the chunk holding it, comp/foo/bar/1.CF, and store
+**  the article number in artnum and the first number of the chunk in base.
+**  Returns NULL if the path does not end with an article number.
+*/
+static char *
+chunk_path(const char *file, ARTNUM *artnum, ARTNUM *base)
+{
+    const char *p;
+    char *end, *cfpath;
+    unsigned long number;
+
+    p = strrchr(file, '/');
+    if (p == NULL || !isdigit((unsigned char) p[1]))
+        return NULL;
+    errno = 0;
+    number = strtoul(p + 1, &end, 10);
+    if (*end != '\0' || number == 0 || errno != 0)
+        return NULL;
+    *artnum = number;
+    *base = (number - 1) / ARCHIVE_CHUNK * ARCHIVE_CHUNK + 1;
+    xasprintf(&cfpath, "%.*s/%lu.%s", (int) (p - file), file,
+              (unsigned long) *base, CAF_NAME);
+    return cfpath;
+}
+
+
+/*
+**  Close the chunk file kept open, if any.
+*/
+static void
+close_chunk(void)
+{
+    if (Chunk.fd >= 0)
+        close(Chunk.fd);
+    Chunk.fd = -1;
+    free(Chunk.path);
+    Chunk.path = NULL;
+}
+
+
+/*
+**  Get ready to write an article of the given size to a chunk file, creating
+**  it if needed, and return the descriptor to write it to.  A new chunk gets
+**  the first number of its range as its low mark so that articles arriving
+**  out of order still fit.  Returns -1 on error, with caf_error set.
+*/
+static int
+open_chunk(const char *cfpath, ARTNUM base, ARTNUM *artnum, size_t size)
+{
+    struct stat st;
+    char *path;
+    int fd = -1;
+
+    if (Chunk.path != NULL && strcmp(Chunk.path, cfpath) == 0) {
+        if (CAFStartWriteFd(Chunk.fd, artnum, size) < 0) {
+            /* The descriptor has been closed by the CAF library. */
+            Chunk.fd = -1;
+            close_chunk();
+            return -1;
+        }
+        return Chunk.fd;
+    }
+    close_chunk();
+
+    path = xstrdup(cfpath);
+    if (stat(path, &st) < 0 && errno == ENOENT) {
+        if (!mkpath(path)) {
+            syswarn("cannot mkdir for %s", path);
+            free(path);
+            return -1;
+        }
+        fd = CAFCreateCAFFile(path, base, ARCHIVE_CHUNK, 0, false, NULL, 0);
+        if (fd < 0 && caf_errno != EEXIST) {
+            free(path);
+            return -1;
+        }
+        if (fd >= 0 && CAFStartWriteFd(fd, artnum, size) < 0) {
+            free(path);
+            return -1;
+        }
+    }
+    if (fd < 0)
+        fd = CAFOpenArtWrite(path, artnum, true, size);
+    if (fd < 0) {
+        free(path);
+        return -1;
+    }
+    Chunk.path = path;
+    Chunk.fd = fd;
+    return fd;
+}
+
+
+#if defined(HAVE_ZLIB)
+/*
+**  Compress an article in gzip format, so that it can also be read with
+**  standard tools once extracted.  Returns a newly allocated buffer, and
+**  its length in length, or NULL on error.
+*/
+static char *
+compress_article(const char *text, size_t *length)
+{
+    z_stream z;
+    char *data;
+    size_t size;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        warn("cannot initialize zlib: %s", z.msg != NULL ? z.msg : "");
+        return NULL;
+    }
+    size = deflateBound(&z, *length);
+    data = xmalloc(size);
+    z.next_in = (unsigned char *) text;
+    z.avail_in = *length;
+    z.next_out = (unsigned char *) data;
+    z.avail_out = size;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        warn("cannot compress article: %s", z.msg != NULL ? z.msg : "");
+        deflateEnd(&z);
+        free(data);
+        return NULL;
+    }
+    *length = size - z.avail_out;
+    deflateEnd(&z);
+    return data;
+}
+#endif
+
+
+/*
+**  Append an article to the chunk holding its number, in the directory in
+**  which it would otherwise get its own file.  Chunks are CAF files, as used
+**  by the timecaf storage method, so each of them takes a single inode for
+**  ARCHIVE_CHUNK articles.  An article already in its chunk (because its
+**  batch is processed again) is left alone.
+*/
+static bool
+write_chunk(ARTHANDLE *article, const char *file, struct config *config)
+{
+    char *cfpath, *text, *data;
+    size_t length;
+    ARTNUM artnum, base;
+    int fd;
+    bool status = true;
+
+    cfpath = chunk_path(file, &artnum, &base);
+    if (cfpath == NULL) {
+        warn("bad article number in %s", file);
+        return false;
+    }
+    text = wire_to_native(article->data, article->len, &length);
+    data = text;
+#if defined(HAVE_ZLIB)
+    if (config->compress) {
+        data = compress_article(text, &length);
+        if (data == NULL) {
+            free(text);
+            free(cfpath);
+            return false;
+        }
+    }
+#endif
+
+    fd = open_chunk(cfpath, base, &artnum, length);
+    if (fd < 0) {
+        if (caf_error != CAF_ERR_ARTALREADYHERE) {
+            warn("cannot open %s for writing: %s", cfpath, CAFErrorStr());
+            status = false;
+        }
+        close_chunk();
+    } else if (xwrite(fd, data, length) != (ssize_t) length) {
+        syswarn("cannot write to %s", cfpath);
+        close_chunk();
+        status = false;
+    } else if (CAFFinishArtWrite(fd) < 0) {
+        warn("cannot write to %s: %s", cfpath, CAFErrorStr());
+        close_chunk();
+        status = false;
+    }
+    if (data != text)
+        free(data);
+    free(text);
+    free(cfpath);
+    return status;
+}
+
+
+/*
+**  Write out the data of an archived article to standard output, expanding
+**  it if it was compressed.
+*/
+static bool
+print_data(const char *name, const char *data, size_t length)
+{
+#if defined(HAVE_ZLIB)
+    z_stream z;
+    char buffer[BUFSIZ * 8];
+    int status;
+
+    if (length > 2 && data[0] == '\x1f' && data[1] == '\x8b') {
+        memset(&z, 0, sizeof(z));
+        if (inflateInit2(&z, 15 + 16) != Z_OK) {
+            warn("cannot initialize zlib: %s", z.msg != NULL ? z.msg : "");
+            return false;
+        }
+        z.next_in = (unsigned char *) data;
+        z.avail_in = length;
+        do {
+            z.next_out = (unsigned char *) buffer;
+            z.avail_out = sizeof(buffer);
+            status = inflate(&z, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END) {
+                warn("cannot uncompress %s: %s", name,
+                     z.msg != NULL ? z.msg : "truncated data");
+                inflateEnd(&z);
+                return false;
+            }
+            fwrite(buffer, sizeof(buffer) - z.avail_out, 1, stdout);
+        } while (status != Z_STREAM_END);
+        inflateEnd(&z);
+        return true;
+    }
+#endif
+    fwrite(data, length, 1, stdout);
+    return true;
+}
+
+
+/*
+**  Write to standard output an archived article, given by its path relative
+**  to the root of the archive as in the index.  It is read from its chunk if
+**  there is one, and else from its own file.
+*/
+static bool
+print_article(const char *name, struct config *config)
+{
+    char *file, *cfpath, *data;
+    ARTNUM artnum, base;
+    size_t length = 0, done;
+    ssize_t n;
+    struct stat st;
+    int fd = -1;
+    bool status;
+
+    file = concatpath(config->root, name);
+    cfpath = chunk_path(file, &artnum, &base);
+    if (cfpath != NULL) {
+        fd = CAFOpenArtRead(cfpath, artnum, &length);
+        free(cfpath);
+    }
+    if (fd < 0) {
+        fd = open(file, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            syswarn("cannot open %s", name);
+            if (fd >= 0)
+                close(fd);
+            free(file);
+            return false;
+        }
+        length = st.st_size;
+    }
+    free(file);
+
+    data = xmalloc(length + 1);
+    for (done = 0; done < length; done += n) {
+        n = read(fd, data + done, length - done);
+        if (n <= 0) {
+            syswarn("cannot read %s", name);
+            close(fd);
+            free(data);
+            return false;
+        }
+    }
+    close(fd);
+    status = print_data(name, data, length);
+    free(data);
+    return status;
+}
+
+
 /*
 **  Link an article.  First try a hard link, then a soft link, and if both
 **  fail, write the article out again to the new path.
@@ -319,8 +621,12 @@ process_article(ARTHANDLE *art, const char *token, struct config *config)
 
         /* If this isn't the first group, and we're not saving by date, try to
            just link or symlink between the archive directories rather than
-           writing out multiple copies. */
-        if (first == NULL || config->concat) {
+           writing out multiple copies.  Chunks cannot share an article, so
+           each group gets its own copy. */
+        if (config->chunk) {
+            if (!write_chunk(art, path->data, config))
+                continue;
+        } else if (first == NULL || config->concat) {
             if (!write_article(art, path->data, config->concat))
                 continue;
             if (groups->count > 2)
@@ -344,16 +650,52 @@ process_article(ARTHANDLE *art, const char *token, struct config *config)
 }
 
 
+/*
+**  Read an article following its token in the input, as written by innd
+**  for the A flag of newsfeeds, into the given buffer and point art at it.
+**  The article is in wire format, ending with the ".\r\n" line, and is
+**  followed by an empty line.  Returns false if the input ended early.
+*/
+static bool
+read_article(QIOSTATE *qp, struct buffer *text, ARTHANDLE *art)
+{
+    char *line;
+    bool done = false;
+
+    buffer_set(text, NULL, 0);
+    while (!done) {
+        line = QIOread(qp);
+        if (line == NULL)
+            return false;
+        buffer_append(text, line, QIOlength(qp));
+        buffer_append(text, "\n", 1);
+        done = (strcmp(line, ".\r") == 0);
+    }
+    line = QIOread(qp);
+    if (line == NULL)
+        return false;
+    if (*line != '\0')
+        warn("junk after article: %s", line);
+    memset(art, 0, sizeof(*art));
+    art->data = text->data;
+    art->len = text->left;
+    return true;
+}
+
+
 int
 main(int argc, char *argv[])
 {
-    struct config config = { NULL, NULL, NULL, 0, 0 };
+    struct config config = { NULL, NULL, NULL, 0, 0, 0, 0 };
     int option, status;
     bool redirect = true;
+    bool extract = false;
+    bool inline_articles = false;
     QIOSTATE *qp;
     char *line, *file;
     TOKEN token;
-    ARTHANDLE *art;
+    ARTHANDLE *art, inline_art;
+    struct buffer *text = NULL;
     FILE *spool;
     char buffer[BUFSIZ];
 
@@ -367,11 +709,14 @@ main(int argc, char *argv[])
     umask(NEWSUMASK);
 
     /* Parse options. */
-    while ((option = getopt(argc, argv, "a:cfi:p:r")) != EOF)
+    while ((option = getopt(argc, argv, "Aa:cCfi:p:rxz")) != EOF)
         switch (option) {
         default:
             die("usage error");
             break;
+        case 'A':
+            inline_articles = true;
+            break;
         case 'a':
             config.root = optarg;
             break;
@@ -379,6 +724,9 @@ main(int argc, char *argv[])
             config.flat = true;
             config.concat = true;
             break;
+        case 'C':
+            config.chunk = true;
+            break;
         case 'f':
             config.flat = true;
             break;
@@ -393,7 +741,32 @@ main(int argc, char *argv[])
         case 'r':
             redirect = false;
             break;
+        case 'x':
+            extract = true;
+            break;
+        case 'z':
+#if defined(HAVE_ZLIB)
+            config.compress = true;
+#else
+            die("compression not supported (zlib is not available)");
+#endif
+            break;
         }
+    if (config.chunk && config.concat)
+        die("-c and -C cannot be used together");
+    if (config.compress && !config.chunk)
+        die("-z can only be used with -C");
+
+    /* Extraction mode just prints the articles given as arguments. */
+    if (extract) {
+        status = 0;
+        for (option = optind; option < argc; option++)
+            if (!print_article(argv[option], &config))
+                status = 1;
+        if (fflush(stdout) == EOF || ferror(stdout))
+            sysdie("cannot write to standard output");
+        exit(status);
+    }
 
     /* Parse arguments, which should just be the batch file. */
     argc -= optind;
@@ -408,8 +781,10 @@ main(int argc, char *argv[])
         if (freopen(argv[0], "r", stdin) == NULL)
             sysdie("cannot open %s for input", argv[0]);
 
-    /* Initialize the storage manager. */
-    if (!SMinit())
+    /* Initialize the storage manager, unless innd hands us the articles. */
+    if (inline_articles)
+        text = buffer_new();
+    else if (!SMinit())
         die("cannot initialize storage manager: %s", SMerrorstr);
 
     /* Read input. */
@@ -423,7 +798,17 @@ main(int argc, char *argv[])
         /* Currently, we only handle tokens.  It would be good to handle
            regular files as well, if for no other reason than for testing, but
            we need a good way of faking an ARTHANDLE from a file. */
-        if (IsToken(line)) {
+        if (IsToken(line) && inline_articles) {
+            line = xstrdup(line);
+            if (!read_article(qp, text, &inline_art)) {
+                warn("cannot read article for %s", line);
+                free(line);
+                line = NULL;
+                break;
+            }
+            process_article(&inline_art, line, &config);
+            free(line);
+        } else if (IsToken(line)) {
             token = TextToToken(line);
             art = SMretrieve(token, RETR_ALL);
             if (art == NULL) {
@@ -438,7 +823,11 @@ main(int argc, char *argv[])
     }
 
     /* Close down the storage manager API. */
-    SMshutdown();
+    close_chunk();
+    if (inline_articles)
+        buffer_free(text);
+    else
+        SMshutdown();
 
     /* If we read all our input, try to remove the file, and we're done. */
     if (!QIOerror(qp)) {
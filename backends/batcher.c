@@ -11,6 +11,10 @@
 #include <syslog.h> 
 #include <sys/stat.h>
 
+#if defined(HAVE_ZLIB)
+# include <zlib.h>
+#endif
+
 #include "inn/innconf.h"
 #include "inn/messages.h"
 #include "inn/timer.h"
@@ -43,6 +47,54 @@ static sig_atomic_t	GotInterrupt;
 static const char *Separator = "#! rnews %ld";
 static char	*ERRLOG;
 
+#if defined(HAVE_ZLIB)
+/*
+**  With -z, everything after the initial string of a batch goes through a
+**  gzip stream, set up once and reset for each batch, along with the
+**  buffer for its output.
+*/
+static bool		Compress;
+static z_stream		Deflating;
+static unsigned char	Deflated[64 * 1024];
+#endif
+
+
+/*
+**  Write data to the batch, compressing it if asked to.  With flush, also
+**  end the compressed stream.  Returns false on error.
+*/
+static bool
+BATCHwrite(FILE *F, const char *data, size_t length, bool flush UNUSED)
+{
+#if defined(HAVE_ZLIB)
+    int		status;
+    size_t	size;
+
+    if (Compress) {
+	Deflating.next_in = (unsigned char *) data;
+	Deflating.avail_in = length;
+	do {
+	    Deflating.next_out = Deflated;
+	    Deflating.avail_out = sizeof(Deflated);
+	    status = deflate(&Deflating, flush ? Z_FINISH : Z_NO_FLUSH);
+	    if (status == Z_STREAM_ERROR) {
+		warn("%s cannot compress batch %d", Host, BATCHcount);
+		return false;
+	    }
+	    size = sizeof(Deflated) - Deflating.avail_out;
+	    if (size > 0 && fwrite(Deflated, 1, size, F) != size)
+		return false;
+	} while (Deflating.avail_out == 0
+		 || (flush && status != Z_STREAM_END));
+	return !ferror(F);
+    }
+#endif
+    if (length > 0 && fwrite(data, 1, length, F) != length)
+	return false;
+    return !ferror(F);
+}
+
+
 /*
 **  Start a batch process.
 */
@@ -68,6 +120,17 @@ BATCHstart(void)
 	F = stdout;
     BATCHopen = true;
     BATCHcount++;
+
+    /* The initial string is never compressed, since it says how to
+       uncompress the rest. */
+    if (InitialString && *InitialString) {
+	fprintf(F, "%s\n", InitialString);
+	BytesWritten += strlen(InitialString) + 1;
+    }
+#if defined(HAVE_ZLIB)
+    if (Compress)
+	deflateReset(&Deflating);
+#endif
     return F;
 }
 
@@ -79,6 +142,13 @@ static int
 BATCHclose(FILE *F)
 {
     BATCHopen = false;
+#if defined(HAVE_ZLIB)
+    if (Compress && !BATCHwrite(F, NULL, 0, true)) {
+	if (F != stdout)
+	    pclose(F);
+	return -1;
+    }
+#endif
     if (F == stdout)
 	return fflush(stdout) == EOF ? 1 : 0;
     return pclose(F);
@@ -198,7 +268,6 @@ main(int ac, char *av[])
     TOKEN	token;
     ARTHANDLE	*art;
     char	*artdata;
-    size_t      written;
 
     /* Set defaults. */
     openlog("batcher", L_OPENLOG_FLAGS | LOG_PID, LOG_INN_PROG);
@@ -213,7 +282,7 @@ main(int ac, char *av[])
     message_handlers_notice(1, message_log_syslog_notice);
 
     /* Parse JCL. */
-    while ((i = getopt(ac, av, "a:A:b:B:i:N:p:rs:v")) != EOF)
+    while ((i = getopt(ac, av, "a:A:b:B:i:N:p:rs:vz")) != EOF)
 	switch (i) {
 	default:
             die("usage error");
@@ -249,6 +318,13 @@ main(int ac, char *av[])
             message_handlers_notice(2, message_log_syslog_notice,
                                     message_log_stdout);
 	    break;
+	case 'z':
+#if defined(HAVE_ZLIB)
+	    Compress = true;
+#else
+            die("compression not supported (zlib is not available)");
+#endif
+	    break;
 	}
     if (MaxArts && ArtsInBatch == 0)
 	ArtsInBatch = MaxArts;
@@ -271,6 +347,14 @@ main(int ac, char *av[])
     if (Redirect)
 	freopen(ERRLOG, "a", stderr);
 
+#if defined(HAVE_ZLIB)
+    if (Compress && deflateInit2(&Deflating, Z_DEFAULT_COMPRESSION,
+				 Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+		    != Z_OK)
+        die("%s cannot initialize zlib: %s", Host,
+	    Deflating.msg != NULL ? Deflating.msg : "");
+#endif
+
     /* Set initial counters, etc. */
     BytesInCB = 0;
     ArtsInCB = 0;
@@ -332,11 +416,6 @@ main(int ac, char *av[])
                 syswarn("%s cannot start batch %d", Host, BATCHcount);
 		break;
 	    }
-	    if (InitialString && *InitialString) {
-		fprintf(F, "%s\n", InitialString);
-		BytesInCB += strlen(InitialString) + 1;
-		BytesWritten += strlen(InitialString) + 1;
-	    }
 	    goto SendIt;
 	}
 
@@ -382,9 +461,10 @@ main(int ac, char *av[])
 #if __GNUC__ > 4
 # pragma GCC diagnostic warning "-Wformat-nonliteral"
 #endif
-	    BytesInCB += strlen(buff) + 1;
-	    BytesWritten += strlen(buff) + 1;
-	    if (fprintf(F, "%s\n", buff) == EOF || ferror(F)) {
+	    strlcat(buff, "\n", sizeof(buff));
+	    BytesInCB += strlen(buff);
+	    BytesWritten += strlen(buff);
+	    if (!BATCHwrite(F, buff, strlen(buff), false)) {
                 syswarn("%s cannot write separator", Host);
 		break;
 	    }
@@ -392,9 +472,11 @@ main(int ac, char *av[])
 
         /* Write the article.  In case of interrupts, retry the read but not
          * the fwrite because we can't check that reliably and portably. */
-        written = fwrite(artdata, 1, BytesInArt, F);
-	if (written != BytesInArt || ferror(F))
+	if (!BATCHwrite(F, artdata, BytesInArt, false)) {
+	    free(artdata);
 	    break;
+	}
+	free(artdata);
 
 	/* Update the counts. */
 	BytesInCB += BytesInArt;
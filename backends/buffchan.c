@@ -6,8 +6,10 @@
 #include "clibrary.h"
 #include <ctype.h>
 #include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include "inn/innconf.h"
@@ -15,6 +17,7 @@
 #include "inn/qio.h"
 #include "inn/libinn.h"
 #include "inn/paths.h"
+#include "inn/xwrite.h"
 #include "map.h"
 
 /*
@@ -25,6 +28,12 @@
 #define SITE_SIZE	128
 #define SITE_BUCKET(j)	&SITEtable[j & (SITE_SIZE - 1)]
 
+/*
+**  With -B, lines are copied once into this much memory and each site
+**  keeps pointers to its lines until they are all written out.
+*/
+#define BATCH_SIZE	(1024 * 1024)
+
 
 /*
 **  Entry for a single active site.
@@ -41,6 +50,10 @@ typedef struct _SITE {
     FILE	*F;
     const char	*Filename;
     char	*Buffer;
+    struct iovec *Iov;		/* lines batched for the next write */
+    int		IovUsed;
+    int		IovSize;
+    unsigned long LastUsed;	/* for closing the least recently used */
 } SITE;
 
 
@@ -58,6 +71,12 @@ typedef struct _SITEHASH {
 static char	*Format;
 static const char *Map;
 static int	BufferMode;
+static bool	Batch;
+static char	*BatchData;
+static size_t	BatchUsed;
+static int	MaxOpen;
+static int	OpenCount;
+static unsigned long	UseClock;
 static int	CloseEvery;
 static int	FlushEvery;
 static int	CloseSeconds;
@@ -83,6 +102,77 @@ SITEsetup(void)
 }
 
 
+/*
+**  Write out the lines batched for a site, with as few writev calls as
+**  possible.
+*/
+static void
+SITEdrain(SITE *sp)
+{
+    int		start, n;
+
+    for (start = 0; start < sp->IovUsed; start += n) {
+	n = sp->IovUsed - start;
+	if (n > IOV_MAX)
+	    n = IOV_MAX;
+	if (xwritev((int)fileno(sp->F), &sp->Iov[start], n) < 0) {
+            syswarn("%s cannot write", sp->Name);
+	    break;
+	}
+    }
+    sp->IovUsed = 0;
+}
+
+
+/*
+**  Write out the lines batched for all sites, which frees the batch.
+*/
+static void
+SITEdrainall(void)
+{
+    SITEHASH	*shp;
+    SITE	*sp;
+    int	i;
+
+    for (shp = SITEtable; shp < ARRAY_END(SITEtable); shp++)
+	for (sp = shp->Sites, i = shp->Used; --i >= 0; sp++)
+	    if (sp->IovUsed > 0)
+		SITEdrain(sp);
+    BatchUsed = 0;
+}
+
+
+/*
+**  Copy a line into the batch, writing the batch out first if it is full.
+*/
+static char *
+BATCHsave(const char *text, size_t len)
+{
+    char	*p;
+
+    if (BatchUsed + len > BATCH_SIZE)
+	SITEdrainall();
+    p = BatchData + BatchUsed;
+    memcpy(p, text, len);
+    BatchUsed += len;
+    return p;
+}
+
+
+/*
+**  Return whether more input is waiting on standard input.
+*/
+static bool
+input_waiting(void)
+{
+    struct pollfd pfd;
+
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+
 /*
 **  Close a site
 */
@@ -92,14 +182,39 @@ SITEclose(SITE *sp)
     FILE	*F;
 
     if ((F = sp->F) != NULL) {
+	SITEdrain(sp);
 	if (fflush(F) == EOF || ferror(F)
 	 || fchmod((int)fileno(F), 0664) < 0
 	 || fclose(F) == EOF)
             syswarn("%s cannot close %s", sp->Name, sp->Filename);
 	sp->F = NULL;
+	OpenCount--;
     }
 }
 
+
+/*
+**  Close the least recently written file to stay under the open file
+**  limit.  It is reopened when the site is written to again.
+*/
+static void
+SITEcloselru(SITE *keep)
+{
+    SITEHASH	*shp;
+    SITE	*sp;
+    SITE	*oldest;
+    int	i;
+
+    oldest = NULL;
+    for (shp = SITEtable; shp < ARRAY_END(SITEtable); shp++)
+	for (sp = shp->Sites, i = shp->Used; --i >= 0; sp++)
+	    if (sp->F != NULL && sp != keep
+	     && (oldest == NULL || sp->LastUsed < oldest->LastUsed))
+		oldest = sp;
+    if (oldest != NULL)
+	SITEclose(oldest);
+}
+
 /*
 **  Close all open sites.
 */
@@ -121,6 +236,9 @@ SITEcloseall(void)
 */
 static void SITEopen(SITE *sp)
 {
+    if (MaxOpen > 0 && OpenCount >= MaxOpen)
+	SITEcloselru(sp);
+
     if ((sp->F = xfopena(sp->Filename)) == NULL
      && (errno != EACCES || chmod(sp->Filename, 0644) < 0
       || (sp->F = xfopena(sp->Filename)) == NULL)) {
@@ -131,6 +249,7 @@ static void SITEopen(SITE *sp)
     }
     else if (fchmod((int)fileno(sp->F), 0444) < 0)
         syswarn("%s cannot fchmod %s", sp->Name, sp->Filename);
+    OpenCount++;
 	
     if (BufferMode != '\0')
 	setbuf(sp->F, sp->Buffer);
@@ -188,6 +307,10 @@ SITEfind(char *Name, bool CanCreate)
 	sp->Buffer = NULL;
     else if (BufferMode == 'b')
 	sp->Buffer = xmalloc(BUFSIZ);
+    sp->Iov = NULL;
+    sp->IovUsed = 0;
+    sp->IovSize = 0;
+    sp->LastUsed = UseClock;
     SITEopen(sp);
 
     return sp;
@@ -200,15 +323,7 @@ SITEfind(char *Name, bool CanCreate)
 static void
 SITEflush(SITE *sp)
 {
-    FILE	*F;
-
-    if ((F = sp->F) != NULL) {
-	if (fflush(F) == EOF || ferror(F)
-	 || fchmod((int)fileno(F), 0664) < 0
-	 || fclose(F) == EOF)
-            syswarn("%s cannot close %s", sp->Name, sp->Filename);
-	sp->F = NULL;
-    }
+    SITEclose(sp);
     if (!sp->Dropped)
 	SITEopen(sp);
 }
@@ -239,10 +354,20 @@ SITEwrite(char *name, char *text, size_t len)
     SITE	*sp;
 
     sp = SITEfind(name, true);
+    sp->LastUsed = ++UseClock;
     if (sp->F == NULL)
 	SITEopen(sp);
 
-    if (fwrite(text, 1, len, sp->F) != len)
+    if (Batch) {
+	if (sp->IovUsed == sp->IovSize) {
+	    sp->IovSize = sp->IovSize == 0 ? 64 : sp->IovSize * 2;
+	    sp->Iov = xrealloc(sp->Iov, sp->IovSize * sizeof(struct iovec));
+	}
+	sp->Iov[sp->IovUsed].iov_base = text;
+	sp->Iov[sp->IovUsed].iov_len = len;
+	sp->IovUsed++;
+    }
+    else if (fwrite(text, 1, len, sp->F) != len)
         syswarn("%s cannot write", sp->Name);
 
     /* Bump line count; see if time to close or flush. */
@@ -255,12 +380,14 @@ SITEwrite(char *name, char *text, size_t len)
 	return;
     }
     if (FlushEvery && ++(sp->FlushLines) >= FlushEvery) {
+	SITEdrain(sp);
 	if (fflush(sp->F) == EOF || ferror(sp->F))
             syswarn("%s cannot flush %s", sp->Name, sp->Filename);
 	sp->LastFlushed = Now;
 	sp->FlushLines = 0;
     }
     else if (FlushSeconds && sp->LastFlushed + FlushSeconds < Now) {
+	SITEdrain(sp);
 	if (fflush(sp->F) == EOF || ferror(sp->F))
             syswarn("%s cannot flush %s", sp->Name, sp->Filename);
 	sp->LastFlushed = Now;
@@ -364,7 +491,7 @@ main(int ac, char *av[])
     xsignal(SIGALRM, CATCHinterrupt);
 
     /* Parse JCL. */
-    while ((i = getopt(ac, av, "bc:C:d:f:l:L:m:p:rs:u")) != EOF)
+    while ((i = getopt(ac, av, "bBc:C:d:f:l:L:m:o:p:rs:u")) != EOF)
 	switch (i) {
 	default:
             die("usage error");
@@ -373,6 +500,9 @@ main(int ac, char *av[])
 	case 'u':
 	    BufferMode = i;
 	    break;
+	case 'B':
+	    Batch = true;
+	    break;
 	case 'c':
 	    CloseEvery = atoi(optarg);
 	    break;
@@ -397,6 +527,9 @@ main(int ac, char *av[])
 	    Map = optarg;
 	    MAPread(Map);
 	    break;
+	case 'o':
+	    MaxOpen = atoi(optarg);
+	    break;
 	case 'p':
 	    if ((F = fopen(optarg, "w")) == NULL)
                 sysdie("cannot fopen %s", optarg);
@@ -424,9 +557,14 @@ main(int ac, char *av[])
     if (Directory && chdir(Directory) < 0)
         sysdie("cannot chdir to %s", Directory);
     SITEsetup();
+    if (Batch)
+	BatchData = xmalloc(BATCH_SIZE);
 
     /* Read input. */
     for (qp = QIOfdopen((int)fileno(stdin)); !GotInterrupt ; ) {
+	/* Write out the batch before we would wait for more input. */
+	if (Batch && BatchUsed > 0 && !QIOhasline(qp) && !input_waiting())
+	    SITEdrainall();
 	if ((line = QIOread(qp)) == NULL) {
 	    if (QIOerror(qp)) {
                 syswarn("cannot read");
@@ -443,6 +581,8 @@ main(int ac, char *av[])
 
 	/* Command? */
 	if (*line == EXP_CONTROL && *++line != EXP_CONTROL) {
+	    if (Batch)
+		SITEdrainall();
 	    Process(line);
 	    continue;
 	}
@@ -462,6 +602,9 @@ main(int ac, char *av[])
         /* Update the current time. */
         Now = time(NULL);
 
+	if (Batch)
+	    line = BATCHsave(line, i);
+
 	/* Rest of the line is space-separated list of filenames. */
 	for (; *p; p = next) {
 	    /* Skip whitespace, get next word. */
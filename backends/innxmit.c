@@ -47,9 +47,11 @@
 */
 
 /*
-**  Max number of articles that can be streamed ahead.
+**  Default number of articles that can be streamed ahead, and the most -w
+**  will allow.
 */
 #define STNBUF 32
+#define STNMAX 10000
 
 /*
 ** Send TAKETHIS without CHECK if this many articles were
@@ -61,7 +63,7 @@
 **  Typical number of articles to stream.
 **  Must be able to fopen this many articles.
 */
-#define STNBUFL (STNBUF/2)
+#define STNBUFL ((stnbuf + 1) / 2)
 
 /*
 **  Number of retries before requeueing to disk.
@@ -77,7 +79,8 @@ struct stbufs {		/* for each article we are procesing */
 	int   st_hash;		/* hash value to speed searches */
 	long  st_size;		/* article size */
 };
-static struct stbufs stbuf[STNBUF]; /* we keep track of this many articles */
+static struct stbufs *stbuf;	/* we keep track of this many articles */
+static int stnbuf = STNBUF;	/* number of entries in stbuf */
 static int stnq;	/* current number of active entries in stbuf */
 static long stnofail;	/* Count of consecutive successful sends */
 
@@ -184,7 +187,7 @@ static int
 stindex(char *MessageID, int hash) {
     int i;
 
-    for (i = 0; i < STNBUF; i++) { /* linear search for ID */
+    for (i = 0; i < stnbuf; i++) { /* linear search for ID */
 	if ((stbuf[i].st_id) && (stbuf[i].st_id[0])
 	 && (stbuf[i].st_hash == hash)) {
 	    int n;
@@ -199,7 +202,7 @@ stindex(char *MessageID, int hash) {
                 break;	/* found a match */
 	}
     }
-    if (i >= STNBUF) i = -1;  /* no match found ? */
+    if (i >= stnbuf) i = -1;  /* no match found ? */
     return (i);
 }
 
@@ -226,10 +229,10 @@ static int
 stalloc(char *Article, char *MessageID, ARTHANDLE *art, int hash) {
     int i;
 
-    for (i = 0; i < STNBUF; i++) {
+    for (i = 0; i < stnbuf; i++) {
 	if ((!stbuf[i].st_fname) || (stbuf[i].st_fname[0] == '\0')) break;
     }
-    if (i >= STNBUF) { /* stnq says not full but can not find unused */
+    if (i >= stnbuf) { /* stnq says not full but can not find unused */
 	syslog(L_ERROR, "stalloc: Internal error");
 	return (-1);
     }
@@ -342,6 +345,32 @@ ExitWithStats(int x)
 }
 
 
+/*
+**  Return the next line of the batch file without its newline, or NULL at
+**  the end of it.  QIO maps the batch file where possible and returns its
+**  lines in place.
+*/
+static char *
+BATCHread(void)
+{
+    char		*p;
+
+    while ((p = QIOread(BATCHqp)) == NULL) {
+	if (QIOtoolong(BATCHqp)) {
+            warn("skipping long line in %s", BATCHname);
+	    continue;
+	}
+	if (QIOerror(BATCHqp)) {
+            syswarn("cannot read %s", BATCHname);
+	    ExitWithStats(1);
+	}
+	/* Normal EOF. */
+	break;
+    }
+    return p;
+}
+
+
 /*
 **  Close the batchfile and the temporary file, and rename the temporary
 **  to be the batchfile.
@@ -424,7 +453,7 @@ RequeueRestAndExit(char *Article, char *MessageID) {
     if (CanStream) {	/* streaming mode has a buffer of articles */
 	int i;
 
-	for (i = 0; i < STNBUF; i++) {    /* requeue unacknowledged articles */
+	for (i = 0; i < stnbuf; i++) {    /* requeue unacknowledged articles */
 	    if ((stbuf[i].st_fname) && (stbuf[i].st_fname[0] != '\0')) {
 		if (Debug)
 		    fprintf(stderr, "stbuf[%d]= %s, %s\n",
@@ -437,21 +466,7 @@ RequeueRestAndExit(char *Article, char *MessageID) {
     }
     Requeue(Article, MessageID);
 
-    for ( ; BATCHqp; ) {
-	if ((p = QIOread(BATCHqp)) == NULL) {
-	    if (QIOtoolong(BATCHqp)) {
-                warn("skipping long line in %s", BATCHname);
-		continue;
-	    }
-	    if (QIOerror(BATCHqp)) {
-                syswarn("cannot read %s", BATCHname);
-		ExitWithStats(1);
-	    }
-
-	    /* Normal EOF. */
-	    break;
-	}
-
+    while (BATCHqp && (p = BATCHread()) != NULL) {
 	if (fprintf(BATCHfp, "%s\n", p) == EOF
 	 || ferror(BATCHfp)) {
             syswarn("cannot requeue %s", p);
@@ -916,7 +931,7 @@ strlisten(void)
 static void
 Usage(void)
 {
-    die("Usage: innxmit [-acdHlprs] [-t#] [-T#] host file");
+    die("Usage: innxmit [-acdHlprsv] [-P port] [-t#] [-T#] [-w#] host file");
 }
 
 
@@ -1035,7 +1050,7 @@ int main(int ac, char *av[]) {
     umask(NEWSUMASK);
 
     /* Parse JCL. */
-    while ((i = getopt(ac, av, "acdHlpP:rst:T:v")) != EOF)
+    while ((i = getopt(ac, av, "acdHlpP:rst:T:vw:")) != EOF)
 	switch (i) {
 	default:
 	    Usage();
@@ -1077,6 +1092,11 @@ int main(int ac, char *av[]) {
 	case 'v':
 	    STATprint = true;
 	    break;
+	case 'w':
+	    stnbuf = atoi(optarg);
+	    if (stnbuf < 1 || stnbuf > STNMAX)
+		die("window must be between 1 and %d", STNMAX);
+	    break;
 	}
     ac -= optind;
     av += optind;
@@ -1208,11 +1228,7 @@ int main(int ac, char *av[]) {
 		}
 	    }
 	    if (CanStream) {
-		for (i = 0; i < STNBUF; i++) { /* reset buffers */
-		    stbuf[i].st_fname = 0;
-		    stbuf[i].st_id = 0;
-		    stbuf[i].art = 0;
-		}
+		stbuf = xcalloc(stnbuf, sizeof(struct stbufs));
 		stnq = 0;
 	    }
 	}
@@ -1268,16 +1284,7 @@ int main(int ac, char *av[]) {
 	if (GotInterrupt)
 	    Interrupted(Article, MessageID);
 
-	if ((Article = QIOread(BATCHqp)) == NULL) {
-	    if (QIOtoolong(BATCHqp)) {
-                warn("skipping long line in %s", BATCHname);
-		continue;
-	    }
-	    if (QIOerror(BATCHqp)) {
-                syswarn("cannot read %s", BATCHname);
-		ExitWithStats(1);
-	    }
-
+	if ((Article = BATCHread()) == NULL) {
 	    /* Normal EOF -- we're done. */
 	    QIOclose(BATCHqp);
 	    BATCHqp = NULL;
@@ -1365,7 +1372,7 @@ int main(int ac, char *av[]) {
 	     * in several being sent in one packet reducing the network
 	     * overhead.
 	     */
-	    if (DoCheck && (stnofail < STNC)) lim = STNBUF;
+	    if (DoCheck && (stnofail < STNC)) lim = stnbuf;
 	    else                              lim = STNBUFL;
 	    if (stnq >= lim) { /* need to empty a buffer */
 		while (stnq >= STNBUFL) { /* or several */
@@ -1391,7 +1398,7 @@ int main(int ac, char *av[]) {
 		}
 	    }
 	    /* check for need to resend any IDs */
-	    for (i = 0; i < STNBUF; i++) {
+	    for (i = 0; i < stnbuf; i++) {
 		if ((stbuf[i].st_fname) && (stbuf[i].st_fname[0] != '\0')) {
 		    if (stbuf[i].st_age++ > stnq) {
 			/* This should not happen but just in case ... */
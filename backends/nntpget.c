@@ -2,14 +2,22 @@
 **  Connect to a remote site, and get news from it to offer to our local
 **  server.  Read list on stdin, or get it via NEWNEWS command.  Writes
 **  list of articles still needed to stdout.
+**
+**  The ARTICLE commands are pipelined, with up to a window of them waiting
+**  for their answer, and the articles are offered to the local server with
+**  TAKETHIS if it streams.  With several connections to the remote site,
+**  the list is shared between as many processes, each one getting its own
+**  connections and taking the Message-IDs in turn.
 */
 
 #include "config.h"
 #include "clibrary.h"
 #include "portable/socket.h"
 #include <errno.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
 
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
@@ -21,6 +29,7 @@
 # include <sys/select.h>
 #endif
 
+#include "inn/buffer.h"
 #include "inn/history.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
@@ -38,9 +47,17 @@ typedef struct _SITE {
     char	Buffer[BUFSIZ];
     char	*bp;
     int		Count;
+    bool	Streaming;
 } SITE;
 
 
+/*
+**  How many Message-IDs are read from the list, and checked against the
+**  history, at once.
+*/
+#define LIST_BATCH	4096
+
+
 /*
 **  Global variables.
 */
@@ -52,6 +69,13 @@ static unsigned long	STAToffered;
 static unsigned long	STATsent;
 static unsigned long	STATrejected;
 static struct history	*History;
+static unsigned long	Window = 10;
+static unsigned long	Connections = 1;
+static unsigned long	ListLine;
+static bool		Verbose;
+static char		**Offered;
+static size_t		OfferedFirst;
+static size_t		OfferedCount;
 
 
 /*
@@ -114,6 +138,25 @@ SITEread(SITE *sp, char *start)
 }
 
 
+/*
+**  Whether a line from the site is there to be read.
+*/
+static bool
+SITEready(SITE *sp)
+{
+    struct timeval	t;
+    fd_set		rmask;
+
+    if (sp->Count > 0)
+	return true;
+    FD_ZERO(&rmask);
+    FD_SET(sp->Rfd, &rmask);
+    t.tv_sec = 0;
+    t.tv_usec = 0;
+    return select(sp->Rfd + 1, &rmask, NULL, NULL, &t) > 0;
+}
+
+
 /*
 **  Send a line to the server, adding \r\n.  Don't need to do dot-escape
 **  since it's only for sending DATA to local site, and the data we got from
@@ -158,6 +201,7 @@ SITEconnect(char *host)
     sp->Wfd = fileno(To);
     sp->bp = sp->Buffer;
     sp->Count = 0;
+    sp->Streaming = false;
     return sp;
 }
 
@@ -175,10 +219,285 @@ SITEquit(SITE *sp)
 }
 
 
+/*
+**  Write a batch of Message-IDs to the list, leaving out those already in
+**  the history if it is open, and free them.  Returns false if the list
+**  cannot be written.
+*/
 static bool
-HIShaveit(char *mesgid)
+LISTwrite(FILE *F, char **ids, size_t count)
+{
+    bool	found[LIST_BATCH];
+    bool	ok = true;
+    size_t	i;
+
+    if (History != NULL)
+	HIScheckbatch(History, (const char *const *) ids, count, found);
+    for (i = 0; i < count; i++) {
+	if (ok && (History == NULL || !found[i])
+	 && fprintf(F, "%s\n", ids[i]) == EOF)
+	    ok = false;
+	free(ids[i]);
+    }
+    return ok && !ferror(F);
+}
+
+
+/*
+**  Read the next batch of the Message-IDs of the list that are this
+**  process's share.  Returns how many were read, 0 at the end of the list.
+*/
+static size_t
+LISTread(FILE *F, char **ids, unsigned long share)
+{
+    char	mesgid[NNTP_MAXLEN_MSGID + 10];
+    char	*p;
+    size_t	count;
+
+    for (count = 0; count < LIST_BATCH; ) {
+	if (fgets(mesgid, sizeof mesgid, F) == NULL)
+	    break;
+	if ((p = strchr(mesgid, '\n')) != NULL)
+	    *p = '\0';
+	if (ListLine++ % Connections != share)
+	    continue;
+	STATgot++;
+	ids[count++] = xstrdup(mesgid);
+    }
+    return count;
+}
+
+
+/*
+**  Read the answer to an ARTICLE command and, if the article is there, the
+**  article itself into the buffer, with the lines ending in \r\n if it is
+**  to be sent to the local server or in \n otherwise.  Returns 1 if the
+**  article was read, 0 if the remote site doesn't have it, and -1 on
+**  failure.
+*/
+static int
+ARTread(SITE *sp, const char *mesgid, struct buffer *article, bool Offer)
+{
+    char	buff[NNTP_MAXLEN_COMMAND];
+
+    if (!SITEread(sp, buff)) {
+	syswarn("cannot get %s", mesgid);
+	return -1;
+    }
+    if (atoi(buff) != NNTP_OK_ARTICLE)
+	return 0;
+
+    if (Verbose)
+	notice("%s...", mesgid);
+
+    buffer_set(article, NULL, 0);
+    for ( ; ; ) {
+	if (!SITEread(sp, buff)) {
+	    syswarn("cannot read %s from %s", mesgid, sp->Name);
+	    return -1;
+	}
+	buffer_append(article, buff, strlen(buff));
+	buffer_append(article, Offer ? "\r\n" : "\n", Offer ? 2 : 1);
+	if (strcmp(buff, ".") == 0)
+	    return 1;
+    }
+}
+
+
+/*
+**  Offer an article to the local server with IHAVE.  Returns false if it
+**  was deferred or cannot be offered, in which case it is still needed and
+**  nothing more should be offered.
+*/
+static bool
+OFFERihave(SITE *sp, const char *mesgid, struct buffer *article)
+{
+    char	buff[NNTP_MAXLEN_COMMAND];
+    int		i;
+
+    STAToffered++;
+    snprintf(buff, sizeof(buff), "IHAVE %s", mesgid);
+    if (!SITEwrite(sp, buff, (int)strlen(buff))
+     || !SITEread(sp, buff)) {
+	syswarn("cannot offer %s", mesgid);
+	return false;
+    }
+    i = atoi(buff);
+    if (i == NNTP_FAIL_IHAVE_DEFER)
+	return false;
+    if (i != NNTP_CONT_IHAVE)
+	return true;
+
+    if (xwrite(sp->Wfd, article->data, article->left) < 0) {
+	syswarn("cannot send %s", mesgid);
+	return false;
+    }
+    STATsent++;
+    if (!SITEread(sp, buff)) {
+	syswarn("no reply after %s", mesgid);
+	return false;
+    }
+    i = atoi(buff);
+    if (i == NNTP_OK_IHAVE)
+	return true;
+    if (i == NNTP_FAIL_IHAVE_DEFER)
+	return false;
+    warn("%s to %s", buff, mesgid);
+    STATrejected++;
+    return true;
+}
+
+
+/*
+**  Read the answer of the local server to the oldest TAKETHIS waiting for
+**  one.  Returns false if the article was not taken for now, after writing
+**  it out as still needed.
+*/
+static bool
+OFFERreply(SITE *sp)
+{
+    char	buff[NNTP_MAXLEN_COMMAND];
+    char	*mesgid;
+    bool	ok = true;
+
+    mesgid = Offered[OfferedFirst];
+    OfferedFirst = (OfferedFirst + 1) % Window;
+    OfferedCount--;
+    if (!SITEread(sp, buff)) {
+	syswarn("no reply after %s", mesgid);
+	ok = false;
+    }
+    else if (atoi(buff) == NNTP_FAIL_TAKETHIS_REJECT) {
+	warn("%s rejected", mesgid);
+	STATrejected++;
+    }
+    else if (atoi(buff) != NNTP_OK_TAKETHIS)
+	ok = false;
+    if (!ok)
+	printf("%s\n", mesgid);
+    free(mesgid);
+    return ok;
+}
+
+
+/*
+**  Offer an article to the local server with TAKETHIS, without waiting for
+**  the answer, unless a window of them are already waiting.  Returns as
+**  OFFERihave does.
+*/
+static bool
+OFFERtakethis(SITE *sp, const char *mesgid, struct buffer *article)
+{
+    char		buff[NNTP_MAXLEN_COMMAND];
+    struct iovec	vec[2];
+
+    if (OfferedCount == Window && !OFFERreply(sp))
+	return false;
+    while (OfferedCount > 0 && SITEready(sp))
+	if (!OFFERreply(sp))
+	    return false;
+
+    STAToffered++;
+    snprintf(buff, sizeof(buff), "TAKETHIS %s\r\n", mesgid);
+    vec[0].iov_base = buff;
+    vec[0].iov_len = strlen(buff);
+    vec[1].iov_base = article->data;
+    vec[1].iov_len = article->left;
+    if (xwritev(sp->Wfd, vec, 2) < 0) {
+	syswarn("cannot send %s", mesgid);
+	return false;
+    }
+    STATsent++;
+    Offered[(OfferedFirst + OfferedCount) % Window] = xstrdup(mesgid);
+    OfferedCount++;
+    return true;
+}
+
+
+/*
+**  Get this process's share of the articles of the list from the remote
+**  site, with a window of ARTICLE commands in flight, and offer them to the
+**  local server if there is one or write them to stdout otherwise.  After a
+**  failure, the rest of the share is written out as still needed.
+*/
+static void
+Fetch(SITE *Remote, SITE *Local, FILE *F, unsigned long share)
 {
-    return HIScheck(History, mesgid);
+    char		*ids[LIST_BATCH];
+    struct buffer	*commands;
+    struct buffer	*article;
+    size_t		count;
+    size_t		asked;
+    size_t		done;
+    size_t		i;
+    bool		Stopped = false;
+    int			status;
+
+    commands = buffer_new();
+    article = buffer_new();
+    Offered = xcalloc(Window, sizeof(char *));
+    while (!Stopped && (count = LISTread(F, ids, share)) > 0) {
+	for (asked = done = 0; done < count; done++) {
+	    /* Keep the window of ARTICLE commands full. */
+	    buffer_set(commands, NULL, 0);
+	    for ( ; asked < count && asked - done < Window; asked++)
+		buffer_append_sprintf(commands, "ARTICLE %s\r\n", ids[asked]);
+	    if (commands->left > 0
+	     && xwrite(Remote->Wfd, commands->data, commands->left) < 0) {
+		syswarn("cannot get %s", ids[done]);
+		Stopped = true;
+		break;
+	    }
+
+	    status = ARTread(Remote, ids[done], article, Local != NULL);
+	    if (status < 0) {
+		Stopped = true;
+		break;
+	    }
+	    if (status == 0)
+		continue;
+	    if (Local == NULL) {
+		fwrite(article->data, 1, article->left, stdout);
+		STATsent++;
+	    }
+	    else if (!(Local->Streaming
+		       ? OFFERtakethis(Local, ids[done], article)
+		       : OFFERihave(Local, ids[done], article))) {
+		Stopped = true;
+		break;
+	    }
+	}
+
+	/* Write out what is still needed, and free the batch. */
+	for (i = 0; i < count; i++) {
+	    if (i >= done)
+		printf("%s\n", ids[i]);
+	    free(ids[i]);
+	}
+    }
+
+    /* Wait for the answers to the articles still offered. */
+    while (OfferedCount > 0) {
+	if (Stopped) {
+	    printf("%s\n", Offered[OfferedFirst]);
+	    free(Offered[OfferedFirst]);
+	    OfferedFirst = (OfferedFirst + 1) % Window;
+	    OfferedCount--;
+	}
+	else if (!OFFERreply(Local))
+	    Stopped = true;
+    }
+
+    /* Write rest of the list. */
+    while ((count = LISTread(F, ids, share)) > 0)
+	for (i = 0; i < count; i++) {
+	    printf("%s\n", ids[i]);
+	    free(ids[i]);
+	}
+
+    free(Offered);
+    buffer_free(commands);
+    buffer_free(article);
 }
 
 
@@ -186,17 +505,44 @@ static void
 Usage(const char *p)
 {
     warn("%s", p);
-    fprintf(stderr, "Usage: nntpget"
+    fprintf(stderr, "Usage: nntpget [-c conns] [-w window]"
             " [ -d dist -n grps [-f file | -t time -u file]] host\n");
     exit(1);
 }
 
 
+/*
+**  Open a connection to the remote site, or to the local server if host is
+**  NULL, and get it ready: ask for reader mode on the remote site, and
+**  whether the local server streams.
+*/
+static SITE *
+SITEopen(char *host)
+{
+    char	buff[NNTP_MAXLEN_COMMAND];
+    SITE	*sp;
+
+    sp = SITEconnect(host);
+    if (host != NULL) {
+	if (!SITEwrite(sp, READER, (int)strlen(READER))
+	 || !SITEread(sp, buff))
+	    sysdie("cannot start reading");
+    }
+    else {
+	if (!SITEwrite(sp, "MODE STREAM", 11)
+	 || !SITEread(sp, buff))
+	    sysdie("cannot start streaming");
+	sp->Streaming = atoi(buff) == NNTP_OK_STREAM;
+    }
+    return sp;
+}
+
+
 int
 main(int ac, char *av[])
 {
     char	buff[NNTP_MAXLEN_COMMAND];
-    char	mesgid[NNTP_MAXLEN_MSGID+10];
+    char	*ids[LIST_BATCH];
     char	tbuff[SMBUF];
     char	*msgidfile = NULL;
     int         msgidfd;
@@ -207,14 +553,19 @@ main(int ac, char *av[])
     int		i;
     struct tm	*gt;
     struct stat	Sb;
-    SITE	*Remote;
-    SITE	*Local = NULL;
+    SITE	**Remote;
+    SITE	**Local = NULL;
     FILE	*F;
     bool	Offer;
-    bool	Error;
-    bool	Verbose = false;
     char	*Update;
     char	*p;
+    size_t	count;
+    unsigned long share;
+    unsigned long got, offered, sent, rejected;
+    int		*Results = NULL;
+    int		fds[2];
+    int		status;
+    pid_t	pid;
 
     /* First thing, set up our identity. */
     message_program_name = "nntpget";
@@ -231,11 +582,16 @@ main(int ac, char *av[])
     umask(NEWSUMASK);
 
     /* Parse JCL. */
-    while ((i = getopt(ac, av, "d:f:n:t:ovu:")) != EOF)
+    while ((i = getopt(ac, av, "c:d:f:n:t:ovu:w:")) != EOF)
 	switch (i) {
 	default:
 	    Usage("bad flag");
 	    /* NOTREACHED */
+	case 'c':
+	    Connections = strtoul(optarg, NULL, 10);
+	    if (Connections == 0)
+		Usage("bad number of connections");
+	    break;
 	case 'd':
 	    distributions = optarg;
 	    break;
@@ -259,7 +615,7 @@ main(int ac, char *av[])
 	case 'o':
 	    /* Open the history file. */
             path = concatpath(innconf->pathdb, INN_PATH_HISTORY);
-	    History = HISopen(path, innconf->hismethod, HIS_RDONLY);
+	    History = HISopen(path, innconf->hismethod, HIS_RDONLY | HIS_MMAP);
 	    if (!History)
                 sysdie("cannot open history");
             free(path);
@@ -273,22 +629,30 @@ main(int ac, char *av[])
 	case 'v':
 	    Verbose = true;
 	    break;
+	case 'w':
+	    Window = strtoul(optarg, NULL, 10);
+	    if (Window == 0)
+		Usage("bad window");
+	    break;
 	}
     ac -= optind;
     av += optind;
     if (ac != 1)
 	Usage("no host given");
+    if (Connections > 1 && !Offer)
+	Usage("-c may only be given with -o");
+
+    /* The local server may close the connection while articles are
+       still being streamed to it. */
+    xsignal(SIGPIPE, SIG_IGN);
 
     /* Set up the scatter/gather vectors used by SITEwrite. */
     SITEvec[1].iov_base = SITEv1;
     SITEvec[1].iov_len = strlen(SITEv1);
 
     /* Connect to the remote server. */
-    if ((Remote = SITEconnect(av[0])) == NULL)
-        sysdie("cannot connect to %s", av[0]);
-    if (!SITEwrite(Remote, READER, (int)strlen(READER))
-     || !SITEread(Remote, buff))
-        sysdie("cannot start reading");
+    Remote = xcalloc(Connections, sizeof(SITE *));
+    Remote[0] = SITEopen(av[0]);
 
     if (Since == NULL) {
 	F = stdin;
@@ -304,15 +668,18 @@ main(int ac, char *av[])
                      Groups, Since, distributions);
 	else
 	    snprintf(buff, sizeof(buff), "NEWNEWS %s %s", Groups, Since);
-	if (!SITEwrite(Remote, buff, (int)strlen(buff))
-	 || !SITEread(Remote, buff))
+	if (!SITEwrite(Remote[0], buff, (int)strlen(buff))
+	 || !SITEread(Remote[0], buff))
             sysdie("cannot start list");
 	if (buff[0] != NNTP_CLASS_OK) {
-	    SITEquit(Remote);
-            die("protocol error from %s, got %s", Remote->Name, buff);
+	    SITEquit(Remote[0]);
+            die("protocol error from %s, got %s", Remote[0]->Name, buff);
 	}
+    }
 
-        /* Create a temporary file. */
+    /* Store the list in a temporary file, checked against the history, if
+       it is to be shared or offered to the local server. */
+    if (Since != NULL || Offer) {
         msgidfile = concatpath(innconf->pathtmp, "nntpgetXXXXXX");
         msgidfd = mkstemp(msgidfile);
         if (msgidfd < 0)
@@ -320,147 +687,123 @@ main(int ac, char *av[])
         F = fopen(msgidfile, "w+");
         if (F == NULL)
             sysdie("cannot open %s", msgidfile);
+        close(msgidfd);
 
 	/* Read and store the Message-ID list. */
-	for ( ; ; ) {
-	    if (!SITEread(Remote, buff)) {
-                syswarn("cannot read from %s", Remote->Name);
-		fclose(F);
-		SITEquit(Remote);
-		exit(1);
+	for (count = 0; ; ) {
+	    if (Since != NULL) {
+		if (!SITEread(Remote[0], buff)) {
+		    syswarn("cannot read from %s", Remote[0]->Name);
+		    fclose(F);
+		    SITEquit(Remote[0]);
+		    exit(1);
+		}
+		if (strcmp(buff, ".") == 0)
+		    break;
 	    }
-	    if (strcmp(buff, ".") == 0)
-		break;
-	    if (Offer && HIShaveit(buff))
+	    else {
+		if (fgets(buff, sizeof buff, stdin) == NULL)
+		    break;
+		if ((p = strchr(buff, '\n')) != NULL)
+		    *p = '\0';
+	    }
+	    if (buff[0] == '\0')
 		continue;
-	    if (fprintf(F, "%s\n", buff) == EOF || ferror(F)) {
-                syswarn("cannot write %s", msgidfile);
-		fclose(F);
-		SITEquit(Remote);
-		exit(1);
+	    ids[count++] = xstrdup(buff);
+	    if (count == LIST_BATCH) {
+		if (!LISTwrite(F, ids, count)) {
+		    syswarn("cannot write %s", msgidfile);
+		    fclose(F);
+		    SITEquit(Remote[0]);
+		    exit(1);
+		}
+		count = 0;
 	    }
 	}
-	if (fflush(F) == EOF) {
+	if (!LISTwrite(F, ids, count) || fflush(F) == EOF) {
             syswarn("cannot flush %s", msgidfile);
 	    fclose(F);
-	    SITEquit(Remote);
+	    SITEquit(Remote[0]);
 	    exit(1);
 	}
 	fseeko(F, 0, SEEK_SET);
     }
 
+    /* Open the other connections, and the ones to the local server. */
+    for (share = 1; share < Connections; share++)
+	Remote[share] = SITEopen(av[0]);
     if (Offer) {
-	/* Connect to the local server. */
-	if ((Local = SITEconnect((char *)NULL)) == NULL) {
-            syswarn("cannot connect to local server");
-	    fclose(F);
-	    exit(1);
-	}
+	Local = xcalloc(Connections, sizeof(SITE *));
+	for (share = 0; share < Connections; share++)
+	    Local[share] = SITEopen(NULL);
     }
 
-    /* Loop through the list of Message-ID's. */
-    while (fgets(mesgid, sizeof mesgid, F) != NULL) {
-	STATgot++;
-	if ((p = strchr(mesgid, '\n')) != NULL)
-	    *p = '\0';
-
-	if (Offer) {
-	    /* See if the local server wants it. */
-	    STAToffered++;
-	    snprintf(buff, sizeof(buff), "IHAVE %s", mesgid);
-	    if (!SITEwrite(Local, buff, (int)strlen(buff))
-	     || !SITEread(Local, buff)) {
-                syswarn("cannot offer %s", mesgid);
-		break;
-	    }
-	    if (atoi(buff) != NNTP_CONT_IHAVE)
-		continue;
-	}
-
-	/* Try to get the article. */
-	snprintf(buff, sizeof(buff), "ARTICLE %s", mesgid);
-	if (!SITEwrite(Remote, buff, (int)strlen(buff))
-	 || !SITEread(Remote, buff)) {
-            syswarn("cannot get %s", mesgid);
-	    printf("%s\n", mesgid);
-	    break;
-	}
-	if (atoi(buff) != NNTP_OK_ARTICLE) {
-          if (Offer) {
-              SITEwrite(Local, ".", 1);
-              if (!SITEread(Local, buff)) {
-                  syswarn("no reply after %s", mesgid);
-                  break;
-              }
-          }
-          continue;
+    /* Each process other than this one gets its share of the list with its
+       own connections, and reports its statistics through a pipe. */
+    if (Connections > 1) {
+	Results = xcalloc(Connections, sizeof(int));
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	fflush(stdout);
+    }
+    for (share = 1; share < Connections; share++) {
+	if (pipe(fds) < 0)
+	    sysdie("cannot create pipe");
+	pid = fork();
+	if (pid < 0)
+	    sysdie("cannot fork");
+	if (pid == 0) {
+	    close(fds[0]);
+	    F = fopen(msgidfile, "r");
+	    if (F == NULL)
+		sysdie("cannot open %s", msgidfile);
+	    Fetch(Remote[share], Local[share], F, share);
+	    SITEquit(Remote[share]);
+	    SITEquit(Local[share]);
+	    snprintf(buff, sizeof(buff), "%lu %lu %lu %lu\n",
+		     STATgot, STAToffered, STATsent, STATrejected);
+	    if (xwrite(fds[1], buff, strlen(buff)) < 0)
+		sysdie("cannot report statistics");
+	    fflush(stdout);
+	    _exit(0);
 	}
+	close(fds[1]);
+	Results[share] = fds[0];
+	close(Remote[share]->Rfd);
+	close(Remote[share]->Wfd);
+	close(Local[share]->Rfd);
+	close(Local[share]->Wfd);
+    }
 
-	if (Verbose)
-            notice("%s...", mesgid);
-
-	/* Read each line in the article and write it. */
-	for (Error = false; ; ) {
-	    if (!SITEread(Remote, buff)) {
-                syswarn("cannot read %s from %s", mesgid, Remote->Name);
-		Error = true;
-		break;
-	    }
-	    if (Offer) {
-		if (!SITEwrite(Local, buff, (int)strlen(buff))) {
-                    syswarn("cannot send %s", mesgid);
-		    Error = true;
-		    break;
-		}
-	    }
-	    else
-		printf("%s\n", buff);
-	    if (strcmp(buff, ".") == 0)
-		break;
-	}
-	if (Error) {
-	    printf("%s\n", mesgid);
-	    break;
-	}
-	STATsent++;
+    /* Loop through our share of the list of Message-ID's. */
+    Fetch(Remote[0], Offer ? Local[0] : NULL, F, 0);
+    fclose(F);
 
-	/* How did the local server respond? */
-	if (Offer) {
-	    if (!SITEread(Local, buff)) {
-                syswarn("no reply after %s", mesgid);
-		printf("%s\n", mesgid);
-		break;
-	    }
-	    i = atoi(buff);
-	    if (i == NNTP_OK_IHAVE)
-		continue;
-	    if (i == NNTP_FAIL_IHAVE_DEFER) {
-		printf("%s\n", mesgid);
-		break;
-	    }
-            syswarn("%s to %s", buff, mesgid);
-	    STATrejected++;
+    /* Add up the statistics of the other processes. */
+    for (share = 1; share < Connections; share++) {
+	F = fdopen(Results[share], "r");
+	if (F != NULL
+	 && fscanf(F, "%lu %lu %lu %lu", &got, &offered, &sent, &rejected)
+	    == 4) {
+	    STATgot += got;
+	    STAToffered += offered;
+	    STATsent += sent;
+	    STATrejected += rejected;
 	}
+	if (F != NULL)
+	    fclose(F);
     }
-
-    /* Write rest of the list, close the input. */
-    if (!feof(F))
-	while (fgets(mesgid, sizeof mesgid, F) != NULL) {
-	    if ((p = strchr(mesgid, '\n')) != NULL)
-		*p = '\0';
-	    printf("%s\n", mesgid);
-	    STATgot++;
-	}
-    fclose(F);
+    while ((pid = wait(&status)) > 0)
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    warn("process %lu failed", (unsigned long) pid);
 
     /* Remove our temp file. */
     if (msgidfile && unlink(msgidfile) < 0)
         syswarn("cannot remove %s", msgidfile);
 
     /* All done. */
-    SITEquit(Remote);
+    SITEquit(Remote[0]);
     if (Offer)
-	SITEquit(Local);
+	SITEquit(Local[0]);
 
     /* Update timestamp file? */
     if (Update) {
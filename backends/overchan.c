@@ -7,6 +7,12 @@
 **  program that's not part of INN's main processing loop.  overchan can also
 **  be used to add batches of data to overview when needed, such as when
 **  running makehistory -O.
+**
+**  Lines are written out in batches.  While more input is waiting, as when
+**  overchan is catching up after a restart or reading a file, the batches
+**  grow up to BULK_SIZE lines, which lets the overview method group the
+**  records by newsgroup; otherwise each batch is written out as soon as
+**  nothing more can be read without waiting, so as not to delay overview.
 */
 
 #include "config.h"
@@ -15,11 +21,16 @@
 #include <syslog.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
 #include <time.h>
 
+#include "inn/buffer.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
 #include "inn/overview.h"
@@ -27,12 +38,27 @@
 #include "inn/libinn.h"
 #include "inn/paths.h"
 
+/* The maximum number of articles written to overview at once. */
+#define BULK_SIZE 4096
+
 /* Statistics kept while overchan is running. */
 struct statistics {
     unsigned long articles;
     unsigned long busy;
 };
 
+/* Input lines read but not yet written to overview.  The lines are copied,
+   nul-terminated, into a single buffer.  The other arrays are scratch space
+   for write_batch. */
+struct batch {
+    struct buffer *lines;
+    size_t offsets[BULK_SIZE];
+    size_t count;
+    struct overview_data data[BULK_SIZE];
+    const char *xref[BULK_SIZE];
+    bool success[BULK_SIZE];
+};
+
 
 /*
 **  Take a line of data and parse it into the provided overview_data struct.
@@ -86,48 +112,90 @@ parse_line(char *line, struct overview_data *data)
 
 
 /*
-**  Write the supplied data to the overview database and update the
+**  Write the batched lines to the overview database and update the
 **  statistics.  The ugly code is to locate the Xref data to tell the overview
 **  API what groups and article numbers to use.
 */
 static void
-write_overview(struct overview *overview, struct overview_data *data,
-               struct statistics *statistics)
+write_batch(struct overview *overview, struct batch *batch,
+            struct statistics *statistics)
 {
+    struct overview_data *data = batch->data;
+    const char **xref = batch->xref;
+    bool *success = batch->success;
     struct timeval start, end;
     const char *p;
-    const char *xref = NULL;
+    size_t i, count;
 
-    statistics->articles++;
-    for (p = data->overview + data->overlen - 1; p > data->overview + 5; p--)
-        if (*p == ':' && strncasecmp(p - 5, "\tXref", 5) == 0) {
-            xref = p + 2;
-            break;
+    for (count = 0, i = 0; i < batch->count; i++) {
+        if (!parse_line(batch->lines->data + batch->offsets[i], &data[count]))
+            continue;
+        statistics->articles++;
+        xref[count] = NULL;
+        for (p = data[count].overview + data[count].overlen - 1;
+             p > data[count].overview + 5; p--)
+            if (*p == ':' && strncasecmp(p - 5, "\tXref", 5) == 0) {
+                xref[count] = p + 2;
+                break;
+            }
+        if (xref[count] == NULL) {
+            warn("no Xref found in overview data %s", data[count].overview);
+            continue;
         }
-    if (xref == NULL) {
-        warn("no Xref found in overview data %s", data->overview);
-        return;
+        count++;
     }
+    batch->count = 0;
+    buffer_set(batch->lines, NULL, 0);
+    if (count == 0)
+        return;
+
     gettimeofday(&start, NULL);
-    if (!overview_add_xref(overview, xref, data))
-        warn("cannot write overview data for %s", TokenToText(data->token));
+    if (!overview_add_xref_batch(overview, xref, data, success, count))
+        for (i = 0; i < count; i++)
+            if (!success[i])
+                warn("cannot write overview data for %s",
+                     TokenToText(data[i].token));
     gettimeofday(&end, NULL);
     statistics->busy += (end.tv_sec  - start.tv_sec)  * 1000;
     statistics->busy += (end.tv_usec - start.tv_usec) / 1000;
 }
 
 
+/*
+**  Returns whether more input can be read from qp without waiting for it.
+*/
+static bool
+input_waiting(QIOSTATE *qp)
+{
+    fd_set fds;
+    struct timeval tv;
+    int fd;
+
+    if (QIOhasline(qp))
+        return true;
+    fd = QIOfileno(qp);
+    if (fd >= FD_SETSIZE)
+        return false;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    return select(fd + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+
 /*
 **  Process a single file.  Takes the open overview struct, the file name
-**  (which may be - to process standard intput), and the statistics struct and
-**  calls parse_line and write_overview for each line.
+**  (which may be - to process standard intput), and the statistics struct.
+**  Lines are collected into a batch, which is written out with write_batch
+**  when full or when no more input is available without waiting for it.
 */
 static void
 process_file(struct overview *overview, const char *file,
              struct statistics *statistics)
 {
     char *line;
-    struct overview_data data;
+    struct batch *batch;
     QIOSTATE *qp;
 
     if (strcmp(file, "-") == 0)
@@ -139,6 +207,9 @@ process_file(struct overview *overview, const char *file,
         return;
     }
 
+    batch = xmalloc(sizeof(struct batch));
+    batch->lines = buffer_new();
+    batch->count = 0;
     while (1) {
         line = QIOread(qp);
         if (line == NULL) {
@@ -148,10 +219,14 @@ process_file(struct overview *overview, const char *file,
             }
             break;
         }
-        if (!parse_line(line, &data))
-            continue;
-        write_overview(overview, &data, statistics);
+        batch->offsets[batch->count++] = batch->lines->left;
+        buffer_append(batch->lines, line, QIOlength(qp) + 1);
+        if (batch->count == BULK_SIZE || !input_waiting(qp))
+            write_batch(overview, batch, statistics);
     }
+    write_batch(overview, batch, statistics);
+    buffer_free(batch->lines);
+    free(batch);
     QIOclose(qp);
 }
 
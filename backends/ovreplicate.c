@@ -0,0 +1,236 @@
+/*
+**  Copy the overview of a server to other machines.
+**
+**  On the master, ovreplicate -s writes the overview replication log (see
+**  storage/ovreplog.c) to standard output, starting at a given position and
+**  optionally following it as it grows.  On a follower, ovreplicate reads
+**  that stream on standard input and applies it to the local overview,
+**  saving after each batch the position reached in the log of the master,
+**  which ovreplicate -p prints.  The two are connected by whatever
+**  transport is convenient, typically:
+**
+**      ssh master ovreplicate -f -s `ovreplicate -p` | ovreplicate
+**
+**  Records are applied in batches.  While more input is waiting, as when a
+**  follower is catching up, the batches grow up to BATCH_SIZE bytes, which
+**  lets the overview method group the records by newsgroup; otherwise each
+**  batch is applied as soon as nothing more can be read without waiting.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "inn/buffer.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/paths.h"
+
+/* How much to read from standard input at once, and the most to read
+   before applying a batch. */
+#define READ_SIZE       (64 * 1024)
+#define BATCH_SIZE      (4 * 1024 * 1024)
+
+/* The length of the position saved by a follower, with the newline. */
+#define POSITION_SIZE   42
+
+
+/*
+**  Parse a position in the log, of the form <hour>:<offset>.  Returns false
+**  if it is malformed.
+*/
+static bool
+parse_position(const char *position, unsigned long *hour,
+               unsigned long *offset)
+{
+    char *end;
+
+    errno = 0;
+    *hour = strtoul(position, &end, 10);
+    if (*end != ':' || errno == ERANGE)
+        return false;
+    *offset = strtoul(end + 1, &end, 10);
+    return (*end == '\0' || *end == '\n') && errno != ERANGE;
+}
+
+
+/*
+**  Open the file holding the position of a follower, and read the position
+**  from it.  A follower which never applied anything is at 0:0, which means
+**  the start of the log.
+*/
+static int
+open_position(bool create, unsigned long *hour, unsigned long *offset)
+{
+    char *path;
+    char data[POSITION_SIZE + 1];
+    ssize_t count;
+    int fd;
+
+    path = concatpath(innconf->pathoverview, INN_PATH_REPLOGPOS);
+    fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, ARTFILE_MODE);
+    if (fd < 0 && (create || errno != ENOENT))
+        sysdie("cannot open %s", path);
+    *hour = 0;
+    *offset = 0;
+    if (fd >= 0) {
+        count = read(fd, data, POSITION_SIZE);
+        if (count < 0)
+            sysdie("cannot read %s", path);
+        data[count] = '\0';
+        if (count > 0 && !parse_position(data, hour, offset))
+            die("invalid position in %s", path);
+    }
+    free(path);
+    return fd;
+}
+
+
+/*
+**  Save the position of a follower.  The position always has the same
+**  length, so that it can be overwritten in place.
+*/
+static void
+save_position(int fd, unsigned long hour, unsigned long offset)
+{
+    char data[POSITION_SIZE + 1];
+
+    snprintf(data, sizeof(data), "%020lu:%020lu\n", hour, offset);
+    if (xpwrite(fd, data, POSITION_SIZE, 0) < 0)
+        sysdie("cannot save position in the replication log");
+}
+
+
+/*
+**  Send the log from the given position to standard output.
+*/
+static void
+send_log(const char *position, bool follow)
+{
+    struct buffer *output;
+    unsigned long hour, offset;
+    void *reader;
+
+    if (!parse_position(position, &hour, &offset))
+        die("invalid position %s", position);
+    reader = OVopenreplog(hour, offset, follow);
+    if (reader == NULL)
+        die("cannot read the replication log");
+    output = buffer_new();
+    while (OVreplogread(reader, output)) {
+        if (xwrite(STDOUT_FILENO, output->data + output->used,
+                   output->left) < 0)
+            sysdie("cannot write to standard output");
+        buffer_set(output, NULL, 0);
+    }
+    OVclosereplog(reader);
+    buffer_free(output);
+}
+
+
+/*
+**  Return whether more input is waiting on standard input.
+*/
+static bool
+input_waiting(void)
+{
+    struct pollfd pfd;
+
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+
+/*
+**  Apply the stream on standard input to the local overview.
+*/
+static void
+apply_log(void)
+{
+    struct buffer *input;
+    unsigned long hour, offset;
+    ssize_t count;
+    int fd;
+
+    if (!OVopen(OV_READ | OV_WRITE))
+        die("cannot open overview");
+    fd = open_position(true, &hour, &offset);
+    input = buffer_new();
+    do {
+        buffer_compact(input);
+        do {
+            if (input->size < input->left + READ_SIZE)
+                buffer_resize(input, input->left + READ_SIZE);
+            count = buffer_read(input, STDIN_FILENO);
+            if (count < 0)
+                sysdie("cannot read standard input");
+        } while (count > 0 && input->left < BATCH_SIZE && input_waiting());
+        if (!OVreplay(input, &hour, &offset))
+            die("cannot apply replication stream at %lu:%lu", hour, offset);
+        save_position(fd, hour, offset);
+    } while (count > 0);
+    if (input->left > 0)
+        warn("replication stream ends with a truncated record");
+    buffer_free(input);
+    close(fd);
+    OVclose();
+}
+
+
+static void
+usage(void)
+{
+    fputs("Usage: ovreplicate [-p | [-f] -s position]\n", stderr);
+    exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    bool follow = false, print = false, send = false;
+    unsigned long hour, offset;
+    int option, fd;
+
+    message_program_name = "ovreplicate";
+    while ((option = getopt(argc, argv, "fps")) != EOF) {
+        switch (option) {
+        case 'f':
+            follow = true;
+            break;
+        case 'p':
+            print = true;
+            break;
+        case 's':
+            send = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if ((print && send) || (follow && !send) || argc != (send ? 1 : 0))
+        usage();
+
+    if (!innconf_read(NULL))
+        exit(1);
+    umask(NEWSUMASK);
+    if (print) {
+        fd = open_position(false, &hour, &offset);
+        if (fd >= 0)
+            close(fd);
+        printf("%lu:%lu\n", hour, offset);
+    } else if (send) {
+        send_log(argv[0], follow);
+    } else {
+        apply_log();
+    }
+    exit(0);
+}
@@ -0,0 +1,571 @@
+/*
+**  Feed generated articles to a news server and measure how fast it takes
+**  them.
+**
+**  innbench offers articles over a single connection, with IHAVE or with
+**  the streaming commands CHECK and TAKETHIS, and reports the throughput and
+**  the latency of each command.  The size of the articles, the number of
+**  newsgroups they are crossposted to and the proportion of message-IDs
+**  offered again are configurable, and the articles only depend on the
+**  options and the random seed, so runs can be compared with each other.
+**
+**  With -G, it also resets the latencies of innd before the run and prints
+**  them afterwards, through the control channel like "ctlinnd latency"
+**  does, which gives the latency of each stage of the processing of
+**  articles by the server.  This requires running it as the news user on
+**  the host of the server.
+**
+**  The server has to accept the connection as a peer, so the host running
+**  innbench must be listed in incoming.conf, and it should feed to nobody
+**  else unless propagation is what is being measured.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <ctype.h>
+#include <errno.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/histogram.h"
+#include "inn/inndcomm.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/network.h"
+#include "inn/nntp.h"
+#include "inn/vector.h"
+
+/* Length of the lines of the body of the articles, without CRLF. */
+#define LINE_LENGTH     72
+
+/* Sizes of the bodies of the articles, with the relative weight of each. */
+struct size {
+    unsigned long size;
+    unsigned long weight;
+};
+
+/* The state of a run. */
+struct bench {
+    FILE *in;                   /* Responses from the server. */
+    int fd;                     /* Connection to the server. */
+    struct buffer out;          /* Commands waiting to be written. */
+    struct vector *groups;      /* Newsgroups to post to. */
+    struct size *sizes;         /* Sizes of the bodies. */
+    size_t nsizes;
+    unsigned long total_weight;
+    unsigned long crosspost;    /* Maximum number of newsgroups. */
+    unsigned long duplicates;   /* Percentage of message-IDs offered again. */
+    unsigned long window;       /* Commands in flight in streaming mode. */
+    unsigned long offered;      /* Number of message-IDs generated. */
+    unsigned long seed;
+    time_t started;
+
+    /* Results. */
+    unsigned long accepted;
+    unsigned long refused;
+    unsigned long rejected;
+    unsigned long deferred;
+    double bytes;               /* Size of the accepted articles. */
+    struct histogram *check;
+    struct histogram *takethis;
+    struct histogram *ihave;
+    struct histogram *article;
+};
+
+
+/*
+**  Parse a size with an optional k or m suffix.  Dies on error.
+*/
+static unsigned long
+parse_size(const char *string)
+{
+    unsigned long size;
+    char *end;
+
+    errno = 0;
+    size = strtoul(string, &end, 10);
+    if (errno != 0 || end == string)
+        die("invalid size %s", string);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' && *end != ':')
+        die("invalid size %s", string);
+    return size;
+}
+
+
+/*
+**  Parse the list of sizes of the bodies of the articles, a comma-separated
+**  list of sizes each optionally followed by a colon and a weight.
+*/
+static void
+parse_sizes(struct bench *bench, const char *spec)
+{
+    struct vector *list;
+    const char *weight;
+    size_t i;
+
+    list = vector_split(spec, ',', NULL);
+    bench->sizes = xcalloc(list->count, sizeof(struct size));
+    bench->nsizes = list->count;
+    bench->total_weight = 0;
+    for (i = 0; i < list->count; i++) {
+        bench->sizes[i].size = parse_size(list->strings[i]);
+        weight = strchr(list->strings[i], ':');
+        bench->sizes[i].weight = (weight == NULL) ? 1 : strtoul(weight + 1,
+                                                                NULL, 10);
+        bench->total_weight += bench->sizes[i].weight;
+    }
+    if (bench->nsizes == 0 || bench->total_weight == 0)
+        die("invalid sizes %s", spec);
+    vector_free(list);
+}
+
+
+/*
+**  Return the message-ID of the nth article offered.
+*/
+static const char *
+message_id(struct bench *bench, unsigned long n)
+{
+    static char id[128];
+
+    snprintf(id, sizeof(id), "<%lu.%lu.%lu@innbench.invalid>", n,
+             bench->seed, (unsigned long) bench->started);
+    return id;
+}
+
+
+/*
+**  Pick the message-ID of the next offer, either a new one or, for the
+**  configured proportion of offers, one already offered.  Returns its
+**  number.
+*/
+static unsigned long
+next_article(struct bench *bench)
+{
+    if (bench->offered > 0
+        && (unsigned long) random() % 100 < bench->duplicates)
+        return (unsigned long) random() % bench->offered;
+    return bench->offered++;
+}
+
+
+/*
+**  A small xorshift generator for the contents of the articles, so that they
+**  don't depend on the sequence of offers.
+*/
+static unsigned long
+article_random(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+
+/*
+**  Append the nth article to the output buffer, in wire format, and return
+**  its size.  Its size and newsgroups are picked at random; the article
+**  only depends on n and the seed, so that what is offered again is the
+**  same article.
+*/
+static size_t
+append_article(struct bench *bench, unsigned long n)
+{
+    char date[64];
+    char line[LINE_LENGTH + 3];
+    unsigned long state, pick, size, ngroups, i;
+    size_t start, group;
+
+    state = bench->seed * 2654435761UL + n + 1;
+    pick = article_random(&state) % bench->total_weight;
+    for (i = 0; pick >= bench->sizes[i].weight; i++)
+        pick -= bench->sizes[i].weight;
+    size = bench->sizes[i].size;
+    ngroups = 1 + article_random(&state) % bench->crosspost;
+    if (ngroups > bench->groups->count)
+        ngroups = bench->groups->count;
+
+    start = bench->out.used + bench->out.left;
+    if (!makedate(bench->started, false, date, sizeof(date)))
+        die("cannot format date");
+    buffer_append_sprintf(&bench->out, "Path: innbench!not-for-mail\r\n"
+                          "From: innbench <innbench@innbench.invalid>\r\n"
+                          "Newsgroups: ");
+    group = article_random(&state) % bench->groups->count;
+    for (i = 0; i < ngroups; i++) {
+        if (i > 0)
+            buffer_append(&bench->out, ",", 1);
+        buffer_append_sprintf(&bench->out, "%s",
+                              bench->groups->strings[group]);
+        group = (group + 1) % bench->groups->count;
+    }
+    buffer_append_sprintf(&bench->out, "\r\nSubject: innbench article %lu\r\n"
+                          "Message-ID: %s\r\nDate: %s\r\n\r\n", n,
+                          message_id(bench, n), date);
+    memset(line, 'a' + n % 26, LINE_LENGTH);
+    memcpy(line + LINE_LENGTH, "\r\n", 2);
+    for (i = 0; i < size; i += LINE_LENGTH + 2)
+        buffer_append(&bench->out, line, LINE_LENGTH + 2);
+    buffer_append(&bench->out, ".\r\n", 3);
+    return bench->out.used + bench->out.left - start;
+}
+
+
+/*
+**  Write out the pending commands.
+*/
+static void
+flush_output(struct bench *bench)
+{
+    if (bench->out.left == 0)
+        return;
+    if (xwrite(bench->fd, bench->out.data + bench->out.used,
+               bench->out.left) < 0)
+        sysdie("cannot write to server");
+    buffer_set(&bench->out, NULL, 0);
+}
+
+
+/*
+**  Read a response and return its code, recording the time elapsed since
+**  start in the given histogram.  Dies on EOF or an unexpected response.
+*/
+static int
+response(struct bench *bench, struct histogram *hist,
+         const struct timeval *start)
+{
+    char line[NNTP_MAXLEN_COMMAND];
+    int code;
+
+    if (fgets(line, sizeof(line), bench->in) == NULL)
+        die("server closed the connection");
+    if (hist != NULL)
+        histogram_record_since(hist, start);
+    code = atoi(line);
+    if (code < 200 || code >= 500) {
+        line[strcspn(line, "\r\n")] = '\0';
+        die("unexpected response: %s", line);
+    }
+    return code;
+}
+
+
+/*
+**  Account for the answer to an article.
+*/
+static void
+result(struct bench *bench, int code, size_t size)
+{
+    switch (code) {
+    case NNTP_OK_IHAVE:
+    case NNTP_OK_TAKETHIS:
+        bench->accepted++;
+        bench->bytes += size;
+        break;
+    case NNTP_FAIL_IHAVE_REJECT:
+    case NNTP_FAIL_TAKETHIS_REJECT:
+        bench->rejected++;
+        break;
+    default:
+        bench->deferred++;
+        break;
+    }
+}
+
+
+/*
+**  Offer count articles with IHAVE, one at a time.
+*/
+static void
+run_ihave(struct bench *bench, unsigned long count)
+{
+    struct timeval start;
+    unsigned long i, n;
+    size_t size;
+    int code;
+
+    for (i = 0; i < count; i++) {
+        n = next_article(bench);
+        buffer_append_sprintf(&bench->out, "IHAVE %s\r\n",
+                              message_id(bench, n));
+        gettimeofday(&start, NULL);
+        flush_output(bench);
+        code = response(bench, bench->ihave, &start);
+        if (code == NNTP_FAIL_IHAVE_REFUSE) {
+            bench->refused++;
+            continue;
+        } else if (code != NNTP_CONT_IHAVE) {
+            bench->deferred++;
+            continue;
+        }
+        size = append_article(bench, n);
+        gettimeofday(&start, NULL);
+        flush_output(bench);
+        result(bench, response(bench, bench->article, &start), size);
+    }
+}
+
+
+/*
+**  Offer count articles with CHECK and TAKETHIS, window commands at a time,
+**  or only with TAKETHIS if nocheck is true.  Latencies are measured from
+**  the time the batch of commands is written.
+*/
+static void
+run_stream(struct bench *bench, unsigned long count, bool nocheck)
+{
+    struct timeval start;
+    unsigned long *batch, *wanted;
+    size_t *sizes;
+    unsigned long i, nbatch, nwanted;
+    int code;
+
+    batch = xcalloc(bench->window, sizeof(unsigned long));
+    wanted = xcalloc(bench->window, sizeof(unsigned long));
+    sizes = xcalloc(bench->window, sizeof(size_t));
+    while (count > 0) {
+        nbatch = (count < bench->window) ? count : bench->window;
+        count -= nbatch;
+        for (i = 0; i < nbatch; i++)
+            batch[i] = next_article(bench);
+
+        /* Find out which of them the server wants. */
+        if (nocheck) {
+            memcpy(wanted, batch, nbatch * sizeof(unsigned long));
+            nwanted = nbatch;
+        } else {
+            for (i = 0; i < nbatch; i++)
+                buffer_append_sprintf(&bench->out, "CHECK %s\r\n",
+                                      message_id(bench, batch[i]));
+            gettimeofday(&start, NULL);
+            flush_output(bench);
+            for (nwanted = 0, i = 0; i < nbatch; i++) {
+                code = response(bench, bench->check, &start);
+                if (code == NNTP_OK_CHECK)
+                    wanted[nwanted++] = batch[i];
+                else if (code == NNTP_FAIL_CHECK_REFUSE)
+                    bench->refused++;
+                else
+                    bench->deferred++;
+            }
+        }
+
+        /* Send them. */
+        for (i = 0; i < nwanted; i++) {
+            buffer_append_sprintf(&bench->out, "TAKETHIS %s\r\n",
+                                  message_id(bench, wanted[i]));
+            sizes[i] = append_article(bench, wanted[i]);
+        }
+        gettimeofday(&start, NULL);
+        flush_output(bench);
+        for (i = 0; i < nwanted; i++)
+            result(bench, response(bench, bench->takethis, &start),
+                   sizes[i]);
+    }
+    free(batch);
+    free(wanted);
+    free(sizes);
+}
+
+
+/*
+**  Send a latency command to innd through the control channel and return
+**  its reply, without the leading status code.  The result should be
+**  freed.
+*/
+static char *
+server_latency(const char *what)
+{
+    const char *args[2];
+    char *reply, *p;
+    int status;
+
+    args[0] = what;
+    args[1] = NULL;
+    if (ICCopen() < 0)
+        sysdie("cannot open the control channel of innd");
+    status = ICCcommand(SC_LATENCY, args, &reply);
+    if (status < 0)
+        sysdie("cannot send latency command to innd");
+    ICCclose();
+    if (reply == NULL)
+        return xstrdup("");
+    for (p = reply; isdigit((unsigned char) *p) || *p == ' '; p++)
+        ;
+    p = xstrdup(p);
+    free(reply);
+    return p;
+}
+
+
+/*
+**  Print the summary of a histogram, if anything was recorded in it.
+*/
+static void
+print_histogram(const char *name, const struct histogram *hist)
+{
+    struct buffer *summary;
+
+    if (histogram_count(hist) == 0)
+        return;
+    summary = buffer_new();
+    histogram_summary(hist, summary);
+    printf("%-9s %.*s\n", name, (int) summary->left,
+           summary->data + summary->used);
+    buffer_free(summary);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct bench bench;
+    struct timeval start, end;
+    const char *host = "localhost";
+    const char *mode = "stream";
+    const char *sizes = "2k";
+    const char *groups = "misc.test";
+    unsigned short port = 119;
+    unsigned long count = 1000;
+    bool server = false;
+    char line[NNTP_MAXLEN_COMMAND];
+    char *latency = NULL;
+    double seconds;
+    int option;
+
+    message_program_name = "innbench";
+    memset(&bench, 0, sizeof(bench));
+    bench.crosspost = 1;
+    bench.window = 16;
+    bench.seed = 1;
+
+    while ((option = getopt(argc, argv, "c:d:g:Gm:p:r:s:w:x:")) != EOF) {
+        switch (option) {
+        case 'c':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            bench.duplicates = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            groups = optarg;
+            break;
+        case 'G':
+            server = true;
+            break;
+        case 'm':
+            mode = optarg;
+            break;
+        case 'p':
+            port = (unsigned short) atoi(optarg);
+            break;
+        case 'r':
+            bench.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'w':
+            bench.window = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            bench.crosspost = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            die("usage: innbench [-G] [-c count] [-d duplicates] [-g groups]"
+                " [-m ihave|stream|takethis] [-p port] [-r seed] [-s sizes]"
+                " [-w window] [-x crossposts] [host]");
+        }
+    }
+    if (optind < argc)
+        host = argv[optind];
+    if (bench.duplicates > 100 || bench.window == 0 || bench.crosspost == 0)
+        die("invalid duplicates, window or crosspost count");
+    if (strcmp(mode, "ihave") != 0 && strcmp(mode, "stream") != 0
+        && strcmp(mode, "takethis") != 0)
+        die("unknown mode %s", mode);
+    parse_sizes(&bench, sizes);
+    bench.groups = vector_split(groups, ',', NULL);
+    if (bench.groups->count == 0)
+        die("no newsgroups given");
+    bench.started = time(NULL);
+    srandom((unsigned int) bench.seed);
+    bench.check = histogram_new();
+    bench.takethis = histogram_new();
+    bench.ihave = histogram_new();
+    bench.article = histogram_new();
+
+    if (server) {
+        if (!innconf_read(NULL))
+            exit(1);
+        free(server_latency("reset"));
+    }
+
+    /* Connect, and switch to streaming if needed. */
+    bench.fd = network_connect_host(host, port, NULL, 30);
+    if (bench.fd == INVALID_SOCKET)
+        sysdie("cannot connect to %s port %hu", host, port);
+    bench.in = fdopen(bench.fd, "r");
+    if (bench.in == NULL)
+        sysdie("cannot fdopen socket");
+    if (fgets(line, sizeof(line), bench.in) == NULL || line[0] != '2')
+        die("server refused the connection");
+    if (strcmp(mode, "ihave") != 0) {
+        buffer_append_sprintf(&bench.out, "MODE STREAM\r\n");
+        flush_output(&bench);
+        if (response(&bench, NULL, NULL) != NNTP_OK_STREAM)
+            die("server does not support streaming");
+    }
+
+    gettimeofday(&start, NULL);
+    if (strcmp(mode, "ihave") == 0)
+        run_ihave(&bench, count);
+    else
+        run_stream(&bench, count, strcmp(mode, "takethis") == 0);
+    gettimeofday(&end, NULL);
+    buffer_append_sprintf(&bench.out, "QUIT\r\n");
+    flush_output(&bench);
+    fclose(bench.in);
+
+    if (server)
+        latency = server_latency("show");
+
+    seconds = (end.tv_sec - start.tv_sec)
+              + (end.tv_usec - start.tv_usec) / 1e6;
+    if (seconds <= 0)
+        seconds = 1e-6;
+    printf("articles %lu accepted %lu refused %lu rejected %lu deferred %lu"
+           " seconds %.2f\n", count, bench.accepted, bench.refused,
+           bench.rejected, bench.deferred, seconds);
+    printf("throughput %.1f articles/s %.2f MB/s\n", bench.accepted / seconds,
+           bench.bytes / seconds / (1024 * 1024));
+    print_histogram("check", bench.check);
+    print_histogram("takethis", bench.takethis);
+    print_histogram("ihave", bench.ihave);
+    print_histogram("article", bench.article);
+    if (latency != NULL) {
+        printf("%s\n", latency);
+        free(latency);
+    }
+
+    histogram_free(bench.check);
+    histogram_free(bench.takethis);
+    histogram_free(bench.ihave);
+    histogram_free(bench.article);
+    vector_free(bench.groups);
+    free(bench.sizes);
+    free(bench.out.data);
+    exit(0);
+}
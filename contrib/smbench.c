@@ -0,0 +1,613 @@
+/*
+**  Measure how fast the storage manager stores and retrieves articles.
+**
+**  smbench drives the storage methods configured in storage.conf directly,
+**  like sm does, with generated articles.  It first stores a set of
+**  articles, then runs concurrent reader processes retrieving them at random
+**  while one writer process stores more, in the given ratio of reads to
+**  writes.  It then walks through the spool with SMnext and cancels every
+**  article it stored.  For each storage method and operation, it reports the
+**  operations and megabytes per second, over the time between the first and
+**  the last of these operations, and the latency distribution.  When several
+**  methods are measured together, they share that time, so measure one at a
+**  time to compare their throughput.
+**
+**  There is only ever one writer, as with innd, since the storage methods
+**  don't support concurrent writers.  The articles are stored in the
+**  newsgroups given with -g, which should be routed by storage.conf to the
+**  storage method to measure and not be carried by the server, as
+**  tradspool stores articles under their newsgroup and article number.
+**  innd can keep running; the articles aren't in history or overview.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/histogram.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "inn/vector.h"
+
+/* Length of the lines of the body of the articles, without CRLF. */
+#define LINE_LENGTH     72
+
+/* The storage methods by token type, as stored in tokens on disk. */
+static const char *const method_names[] = {
+    "trash", NULL, "timehash", "cnfs", "timecaf", "tradspool"
+};
+#define METHOD_MAX      (sizeof(method_names) / sizeof(method_names[0]))
+
+/* The operations measured. */
+enum op {
+    OP_STORE,
+    OP_RETRIEVE,
+    OP_NEXT,
+    OP_CANCEL,
+    OP_MAX
+};
+static const char *const op_names[OP_MAX] = {
+    "store", "retrieve", "next", "cancel"
+};
+
+/* One operation done by a worker, sent back to the parent. */
+struct sample {
+    enum op op;
+    unsigned int type;          /* Token type, or TOKEN_EMPTY on failure. */
+    struct timeval start;
+    unsigned long usec;
+    unsigned long bytes;
+    TOKEN token;                /* Token of a stored article. */
+};
+
+/* Results by storage method and operation, with when the first of these
+   operations started and the last one ended over all workers. */
+struct result {
+    struct histogram *hist;
+    double bytes;
+    struct timeval start;
+    struct timeval end;
+};
+
+/* Sizes of the bodies of the articles, with the relative weight of each. */
+struct size {
+    unsigned long size;
+    unsigned long weight;
+};
+
+/* The state of a run. */
+struct bench {
+    struct vector *groups;      /* Newsgroups to store articles in. */
+    struct size *sizes;
+    size_t nsizes;
+    unsigned long total_weight;
+    unsigned long seed;
+    time_t started;
+
+    /* Tokens of the stored articles. */
+    TOKEN *tokens;
+    size_t ntokens;
+    size_t tokens_size;
+
+    /* Results. */
+    struct result results[METHOD_MAX][OP_MAX];
+    unsigned long failures[OP_MAX];
+};
+
+
+/*
+**  Parse a size with an optional k or m suffix.  Dies on error.
+*/
+static unsigned long
+parse_size(const char *string)
+{
+    unsigned long size;
+    char *end;
+
+    errno = 0;
+    size = strtoul(string, &end, 10);
+    if (errno != 0 || end == string)
+        die("invalid size %s", string);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' && *end != ':')
+        die("invalid size %s", string);
+    return size;
+}
+
+
+/*
+**  Parse the list of sizes of the bodies of the articles, a comma-separated
+**  list of sizes each optionally followed by a colon and a weight.
+*/
+static void
+parse_sizes(struct bench *bench, const char *spec)
+{
+    struct vector *list;
+    const char *weight;
+    size_t i;
+
+    list = vector_split(spec, ',', NULL);
+    bench->sizes = xcalloc(list->count, sizeof(struct size));
+    bench->nsizes = list->count;
+    bench->total_weight = 0;
+    for (i = 0; i < list->count; i++) {
+        bench->sizes[i].size = parse_size(list->strings[i]);
+        weight = strchr(list->strings[i], ':');
+        bench->sizes[i].weight = (weight == NULL) ? 1 : strtoul(weight + 1,
+                                                                NULL, 10);
+        bench->total_weight += bench->sizes[i].weight;
+    }
+    if (bench->nsizes == 0 || bench->total_weight == 0)
+        die("invalid sizes %s", spec);
+    vector_free(list);
+}
+
+
+/*
+**  Build the nth article in wire format in the given buffer, and fill in
+**  the article handle to store it.  Its size and newsgroup are picked at
+**  random.
+*/
+static void
+build_article(struct bench *bench, unsigned long n, struct buffer *article,
+              struct buffer *groups, ARTHANDLE *handle, struct iovec *iov)
+{
+    char line[LINE_LENGTH + 3];
+    unsigned long pick, size, i;
+    const char *group;
+
+    pick = (unsigned long) random() % bench->total_weight;
+    for (i = 0; pick >= bench->sizes[i].weight; i++)
+        pick -= bench->sizes[i].weight;
+    size = bench->sizes[i].size;
+    group = bench->groups->strings[n % bench->groups->count];
+
+    buffer_sprintf(article, "Path: smbench!not-for-mail\r\n"
+                   "From: smbench <smbench@smbench.invalid>\r\n"
+                   "Newsgroups: %s\r\nSubject: smbench article %lu\r\n"
+                   "Message-ID: <%lu.%lu.%lu@smbench.invalid>\r\n\r\n",
+                   group, n, n, bench->seed, (unsigned long) bench->started);
+    memset(line, 'a' + n % 26, LINE_LENGTH);
+    memcpy(line + LINE_LENGTH, "\r\n", 2);
+    for (i = 0; i < size; i += LINE_LENGTH + 2)
+        buffer_append(article, line, LINE_LENGTH + 2);
+    buffer_append(article, ".\r\n", 3);
+    buffer_sprintf(groups, "%s:%lu", group, n / bench->groups->count + 1);
+
+    memset(handle, 0, sizeof(*handle));
+    handle->type = TOKEN_EMPTY;
+    handle->data = article->data;
+    handle->len = article->left;
+    iov->iov_base = article->data;
+    iov->iov_len = article->left;
+    handle->iov = iov;
+    handle->iovcnt = 1;
+    handle->arrived = time(NULL);
+    handle->groups = groups->data;
+    handle->groupslen = groups->left;
+}
+
+
+/*
+**  Account for one operation, either done by the parent or sent back by a
+**  worker.
+*/
+static void
+add_sample(struct bench *bench, const struct sample *sample)
+{
+    struct result *result;
+    struct timeval end;
+
+    if (sample->type >= METHOD_MAX || method_names[sample->type] == NULL) {
+        bench->failures[sample->op]++;
+        return;
+    }
+    result = &bench->results[sample->type][sample->op];
+    if (result->hist == NULL) {
+        result->hist = histogram_new();
+        result->start = sample->start;
+    }
+    histogram_record(result->hist, sample->usec);
+    result->bytes += sample->bytes;
+    end.tv_sec = sample->start.tv_sec + (time_t) (sample->usec / 1000000);
+    end.tv_usec = sample->start.tv_usec + (long) (sample->usec % 1000000);
+    if (end.tv_usec >= 1000000) {
+        end.tv_sec++;
+        end.tv_usec -= 1000000;
+    }
+    if (timercmp(&sample->start, &result->start, <))
+        result->start = sample->start;
+    if (timercmp(&end, &result->end, >))
+        result->end = end;
+    if (sample->op == OP_STORE) {
+        if (bench->ntokens == bench->tokens_size) {
+            bench->tokens_size = (bench->tokens_size + 1) * 2;
+            bench->tokens = xreallocarray(bench->tokens, bench->tokens_size,
+                                          sizeof(TOKEN));
+        }
+        bench->tokens[bench->ntokens++] = sample->token;
+    }
+}
+
+
+/*
+**  Do one operation, filling in the sample for it.  For a store, article
+**  is the handle of the article to store; for a retrieval or a
+**  cancellation, token is the token of the article.
+*/
+static void
+run_op(struct sample *sample, enum op op, const ARTHANDLE *article,
+       TOKEN token)
+{
+    struct timeval end;
+    ARTHANDLE *art;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->op = op;
+    sample->type = token.type;
+    gettimeofday(&sample->start, NULL);
+    switch (op) {
+    case OP_STORE:
+        sample->token = SMstore(*article);
+        sample->type = sample->token.type;
+        sample->bytes = article->len;
+        break;
+    case OP_RETRIEVE:
+        art = SMretrieve(token, RETR_ALL);
+        if (art == NULL)
+            sample->type = TOKEN_EMPTY;
+        else {
+            sample->bytes = art->len;
+            SMfreearticle(art);
+        }
+        break;
+    case OP_CANCEL:
+        if (!SMcancel(token))
+            sample->type = TOKEN_EMPTY;
+        break;
+    case OP_NEXT:
+    case OP_MAX:
+        break;
+    }
+    gettimeofday(&end, NULL);
+    sample->usec = (end.tv_sec - sample->start.tv_sec) * 1000000UL
+                   + (unsigned long) (end.tv_usec - sample->start.tv_usec);
+}
+
+
+/*
+**  Store count articles, numbered from first.
+*/
+static void
+store_articles(struct bench *bench, unsigned long first, unsigned long count,
+               struct buffer *out)
+{
+    struct buffer *article, *groups;
+    struct sample sample;
+    struct iovec iov;
+    ARTHANDLE handle;
+    TOKEN token;
+    unsigned long i;
+
+    article = buffer_new();
+    groups = buffer_new();
+    memset(&token, 0, sizeof(token));
+    for (i = first; i < first + count; i++) {
+        build_article(bench, i, article, groups, &handle, &iov);
+        run_op(&sample, OP_STORE, &handle, token);
+        if (out == NULL)
+            add_sample(bench, &sample);
+        else
+            buffer_append(out, (char *) &sample, sizeof(sample));
+    }
+    buffer_free(article);
+    buffer_free(groups);
+}
+
+
+/*
+**  Retrieve count articles at random among those stored so far.
+*/
+static void
+retrieve_articles(struct bench *bench, unsigned long count,
+                  struct buffer *out)
+{
+    struct sample sample;
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        run_op(&sample, OP_RETRIEVE, NULL,
+               bench->tokens[(unsigned long) random() % bench->ntokens]);
+        buffer_append(out, (char *) &sample, sizeof(sample));
+    }
+}
+
+
+/*
+**  Start a worker, which stores articles if writes is not zero and
+**  otherwise retrieves reads articles.  Returns the file descriptor from
+**  which its results will be read.
+*/
+static int
+start_worker(struct bench *bench, unsigned long id, unsigned long reads,
+             unsigned long writes, pid_t *pid)
+{
+    struct buffer *out;
+    int fds[2];
+    bool value;
+
+    if (pipe(fds) < 0)
+        sysdie("cannot create pipe");
+    *pid = fork();
+    if (*pid < 0)
+        sysdie("cannot fork");
+    if (*pid > 0) {
+        close(fds[1]);
+        return fds[0];
+    }
+
+    /* In the worker.  Send the results only once done, so that the parent
+       reading them doesn't get in the way. */
+    close(fds[0]);
+    srandom((unsigned int) (bench->seed + id));
+    value = (writes > 0);
+    if (!SMsetup(SM_RDWR, &value) || !SMinit())
+        die("cannot initialize storage manager: %s", SMerrorstr);
+    out = buffer_new();
+    if (writes > 0)
+        store_articles(bench, bench->ntokens, writes, out);
+    else
+        retrieve_articles(bench, reads, out);
+    SMshutdown();
+    if (xwrite(fds[1], out->data, out->left) < 0)
+        sysdie("cannot send results");
+    exit(0);
+}
+
+
+/*
+**  Read the results of a worker and wait for it.
+*/
+static void
+finish_worker(struct bench *bench, int fd, pid_t pid)
+{
+    struct buffer *in;
+    struct sample sample;
+    size_t offset;
+    int status;
+
+    in = buffer_new();
+    if (!buffer_read_all(in, fd))
+        sysdie("cannot read results of worker %lu", (unsigned long) pid);
+    close(fd);
+    if (waitpid(pid, &status, 0) < 0)
+        sysdie("cannot wait for worker %lu", (unsigned long) pid);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("worker %lu failed", (unsigned long) pid);
+    for (offset = 0; offset + sizeof(sample) <= in->left;
+         offset += sizeof(sample)) {
+        memcpy(&sample, in->data + offset, sizeof(sample));
+        add_sample(bench, &sample);
+    }
+    buffer_free(in);
+}
+
+
+/*
+**  Walk through the spool with SMnext, looking at up to count articles.
+*/
+static void
+scan_spool(struct bench *bench, unsigned long count)
+{
+    struct sample sample;
+    struct timeval end;
+    ARTHANDLE *art = NULL;
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        memset(&sample, 0, sizeof(sample));
+        gettimeofday(&sample.start, NULL);
+        art = SMnext(art, RETR_ALL);
+        gettimeofday(&end, NULL);
+        if (art == NULL)
+            break;
+        sample.op = OP_NEXT;
+        sample.type = art->type;
+        sample.bytes = art->len;
+        sample.usec = (end.tv_sec - sample.start.tv_sec) * 1000000UL
+                      + (unsigned long) (end.tv_usec - sample.start.tv_usec);
+        add_sample(bench, &sample);
+    }
+    if (art != NULL)
+        SMfreearticle(art);
+}
+
+
+/*
+**  Cancel all the articles stored.
+*/
+static void
+cancel_articles(struct bench *bench)
+{
+    struct sample sample;
+    size_t i, count;
+
+    count = bench->ntokens;
+    for (i = 0; i < count; i++) {
+        run_op(&sample, OP_CANCEL, NULL, bench->tokens[i]);
+        add_sample(bench, &sample);
+    }
+}
+
+
+/*
+**  Print the results of each storage method and operation.
+*/
+static void
+report(struct bench *bench)
+{
+    struct buffer *summary;
+    struct result *result;
+    double seconds;
+    unsigned long count;
+    size_t type;
+    int op;
+
+    summary = buffer_new();
+    for (type = 0; type < METHOD_MAX; type++)
+        for (op = 0; op < OP_MAX; op++) {
+            result = &bench->results[type][op];
+            if (result->hist == NULL)
+                continue;
+            seconds = (result->end.tv_sec - result->start.tv_sec)
+                      + (result->end.tv_usec - result->start.tv_usec) / 1e6;
+            if (seconds <= 0)
+                seconds = 1e-6;
+            count = histogram_count(result->hist);
+            buffer_set(summary, NULL, 0);
+            histogram_summary(result->hist, summary);
+            printf("%-9s %-8s %9.0f ops/s %8.2f MB/s  %.*s\n",
+                   method_names[type], op_names[op], count / seconds,
+                   result->bytes / seconds / (1024 * 1024),
+                   (int) summary->left, summary->data + summary->used);
+        }
+    for (op = 0; op < OP_MAX; op++)
+        if (bench->failures[op] > 0)
+            printf("%lu failed %s operations\n", bench->failures[op],
+                   op_names[op]);
+    buffer_free(summary);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct bench bench;
+    const char *sizes = "2k:60,16k:30,256k:10";
+    const char *groups = "smbench.test";
+    const char *ratio = "9:1";
+    unsigned long articles = 1000;
+    unsigned long readers = 4;
+    unsigned long reads = 1000;
+    unsigned long scan = 0;
+    bool scanset = false;
+    unsigned long writes, rweight, wweight, i;
+    bool keep = false;
+    bool value;
+    char *end;
+    int option;
+    int *fds;
+    pid_t *pids;
+
+    message_program_name = "smbench";
+    message_handlers_notice(0);
+    memset(&bench, 0, sizeof(bench));
+    bench.seed = 1;
+
+    while ((option = getopt(argc, argv, "a:g:kn:o:R:r:s:w:")) != EOF) {
+        switch (option) {
+        case 'a':
+            articles = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            groups = optarg;
+            break;
+        case 'k':
+            keep = true;
+            break;
+        case 'n':
+            scan = strtoul(optarg, NULL, 10);
+            scanset = true;
+            break;
+        case 'o':
+            reads = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            ratio = optarg;
+            break;
+        case 'r':
+            bench.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'w':
+            readers = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            die("usage: smbench [-k] [-a articles] [-g groups] [-n scan]"
+                " [-o reads] [-R reads:writes] [-r seed] [-s sizes]"
+                " [-w readers]");
+        }
+    }
+    if (articles == 0)
+        die("at least one article must be stored");
+    if (!scanset)
+        scan = articles;
+    rweight = strtoul(ratio, &end, 10);
+    if (*end != ':' || rweight == 0)
+        die("invalid ratio %s", ratio);
+    wweight = strtoul(end + 1, NULL, 10);
+    writes = readers * reads / rweight * wweight;
+    parse_sizes(&bench, sizes);
+    bench.groups = vector_split(groups, ',', NULL);
+    if (bench.groups->count == 0)
+        die("no newsgroups given");
+    bench.started = time(NULL);
+    srandom((unsigned int) bench.seed);
+    if (!innconf_read(NULL))
+        exit(1);
+
+    /* Store the initial articles. */
+    value = true;
+    if (!SMsetup(SM_RDWR, &value) || !SMinit())
+        die("cannot initialize storage manager: %s", SMerrorstr);
+    store_articles(&bench, 0, articles, NULL);
+    if (bench.ntokens == 0)
+        die("cannot store articles: %s", SMerrorstr);
+    SMshutdown();
+
+    /* Concurrent readers and one writer. */
+    fds = xcalloc(readers + 1, sizeof(int));
+    pids = xcalloc(readers + 1, sizeof(pid_t));
+    for (i = 0; i < readers; i++)
+        fds[i] = start_worker(&bench, i + 1, reads, 0, &pids[i]);
+    if (writes > 0)
+        fds[readers] = start_worker(&bench, 0, 0, writes, &pids[readers]);
+    for (i = 0; i < readers; i++)
+        finish_worker(&bench, fds[i], pids[i]);
+    if (writes > 0)
+        finish_worker(&bench, fds[readers], pids[readers]);
+    free(fds);
+    free(pids);
+
+    /* Walk through the spool and clean up. */
+    value = true;
+    if (!SMsetup(SM_RDWR, &value) || !SMinit())
+        die("cannot initialize storage manager: %s", SMerrorstr);
+    if (scan > 0)
+        scan_spool(&bench, scan);
+    if (!keep)
+        cancel_articles(&bench);
+    SMshutdown();
+
+    printf("%lu articles stored first, %lu readers of %lu articles, %lu"
+           " articles written meanwhile\n", articles, readers, reads, writes);
+    report(&bench);
+    return 0;
+}
@@ -101,6 +101,10 @@ END
 sub docheckgroups {
     my ($body, $newsgrouppats, $exclusionpats, $maxchanges, $log, $sender) = @_;
 
+    # docheckgroups compares against the active file, which must therefore
+    # reflect the changes already made by previous control articles.
+    flush_changes();
+
     my $tempfile = "$INN::Config::tmpdir/checkgroups.$$";
     open(TEMPART, ">$tempfile.art")
         or logdie("Cannot open $tempfile.art: $!");
@@ -146,19 +150,13 @@ sub docheckgroups {
         }
 
         if ($dochanges) {
-            open(OLDIN, '<&STDIN') or die $!;
-            open(OLDOUT, '>&STDOUT') or die $!;
-            open(STDIN, "$tempfile") or die $!;
-            open(STDOUT, ">$tempfile.modact") or die $!;
-
-            my $st = system("$INN::Config::pathbin/mod-active");
-            logdie('Cannot run mod-active: ' . $!) if $st == -1;
-            logdie('mod-active returned status ' . ($st & 255)) if $st > 0;
-
-            close(STDIN);
-            close(STDOUT);
-            open(STDIN, '<&OLDIN') or die $!;
-            open(STDOUT, '>&OLDOUT') or die $!;
+            # Apply all the changes at once with "ctlinnd batch", which
+            # rewrites the active file a single time without pausing innd.
+            foreach my $line (@output) {
+                next unless $line =~ /^\s*\S*ctlinnd (newgroup|rmgroup|changegroup) (\S+)(?: (\S+))?(?: (\S+))?/;
+                ctlinnd($1, $2, $3, $4);
+            }
+            flush_changes();
 
             if ($log) {
                 unshift(@output, '');
@@ -180,7 +178,7 @@ sub docheckgroups {
         logmsg("checkgroups by $sender processed (no change)");
     }
     close TEMPFILE;
-    unlink($tempfile, "$tempfile.art", "$tempfile.modact");
+    unlink($tempfile, "$tempfile.art");
 }
 
 1;
@@ -77,15 +77,9 @@ sub control_newgroup {
     $modflag ||= '';
     my $modcmd = $modflag eq 'moderated' ? 'm' : 'y';
 
-    # Scan active to see what sort of change we are making.
-    open(ACTIVE, $INN::Config::active) or logdie("Cannot open $INN::Config::active: $!");
-    my @oldgroup;
-    while (<ACTIVE>) {
-        next unless /^(\Q$groupname\E)\s\d+\s\d+\s(\w)/;
-        @oldgroup = split /\s+/;
-        last;
-    }
-    close ACTIVE;
+    # Look up what sort of change we are making, taking into account the
+    # changes not yet applied.
+    my @oldgroup = active_group($groupname);
 
     my $status;
     my $ngdesc = '';
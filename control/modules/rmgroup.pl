@@ -24,15 +24,9 @@ sub control_rmgroup {
     my @headers = split(/\r?\n/, $head->stringify);
     my @body = split(/\r?\n/, $article->stringify_body);
 
-    # Scan active to see what sort of change we are making.
-    open(ACTIVE, $INN::Config::active) or logdie("Cannot open $INN::Config::active: $!");
-    my @oldgroup;
-    while (<ACTIVE>) {
-        next unless /^(\Q$groupname\E)\s\d+\s\d+\s(\w)/;
-        @oldgroup = split /\s+/;
-        last;
-    }
-    close ACTIVE;
+    # Look up what sort of change we are making, taking into account the
+    # changes not yet applied.
+    my @oldgroup = active_group($groupname);
     my $status;
     if (not @oldgroup) {
         $status = 'not change';
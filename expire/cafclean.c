@@ -0,0 +1,235 @@
+/*
+**  Clean the CAF files of the timecaf storage method.
+**
+**  When timecafdeferclean is set in inn.conf, cancelling or expiring
+**  articles only marks their space in the CAF files as free.  This program
+**  looks at the header of every CAF file in the spool, and cleans those
+**  with enough free space, most fragmented first, pausing between files so
+**  as not to copy more than a given amount of data per second.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/newsuser.h"
+#include "../storage/timecaf/caf.h"
+
+static const char usage[] = "\
+Usage: cafclean [-nv] [-p percent] [-r rate]\n";
+
+/* CAF files written to more recently than this many seconds ago are left
+   alone, since innd may still hold them open to add articles. */
+#define RECENT_CAF 3600
+
+/* A CAF file worth cleaning. */
+struct caffile {
+    char *path;
+    double percentfree;
+    size_t used;
+};
+
+static struct caffile *files = NULL;
+static size_t nfiles = 0;
+static size_t maxfiles = 0;
+
+
+/*
+**  Sort the CAF files with the most free space first.
+*/
+static int
+caffile_compare(const void *a, const void *b)
+{
+    const struct caffile *f1 = a;
+    const struct caffile *f2 = b;
+
+    if (f1->percentfree > f2->percentfree)
+        return -1;
+    return (f1->percentfree < f2->percentfree) ? 1 : 0;
+}
+
+
+/*
+**  Check whether a directory entry name is made of a prefix followed by a
+**  given number of hexadecimal digits and a suffix.
+*/
+static bool
+hexname(const char *name, const char *prefix, size_t digits,
+        const char *suffix)
+{
+    size_t i;
+
+    if (strncmp(name, prefix, strlen(prefix)) != 0)
+        return false;
+    name += strlen(prefix);
+    for (i = 0; i < digits; i++)
+        if (!isxdigit((unsigned char) name[i]))
+            return false;
+    return strcmp(name + digits, suffix) == 0;
+}
+
+
+/*
+**  Read the header of a CAF file and remember it if at least threshold
+**  percent of it is free space.
+*/
+static void
+check_file(const char *path, double threshold, time_t now)
+{
+    CAFHEADER head;
+    struct stat st;
+    size_t datasize;
+    double percentfree;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            syswarn("can't open %s", path);
+        return;
+    }
+    if (fstat(fd, &st) < 0 || read(fd, &head, sizeof(head)) != sizeof(head)
+        || memcmp(head.Magic, CAF_MAGIC, CAF_MAGIC_LEN) != 0) {
+        warn("can't read CAF header of %s", path);
+        close(fd);
+        return;
+    }
+    close(fd);
+    if (st.st_mtime > now - RECENT_CAF || st.st_size <= head.StartDataBlock)
+        return;
+    datasize = st.st_size - head.StartDataBlock;
+    percentfree = (100.0 * head.Free) / datasize;
+    if (percentfree < threshold)
+        return;
+    if (nfiles == maxfiles) {
+        maxfiles = (maxfiles == 0) ? 64 : maxfiles * 2;
+        files = xrealloc(files, maxfiles * sizeof(struct caffile));
+    }
+    files[nfiles].path = xstrdup(path);
+    files[nfiles].percentfree = percentfree;
+    files[nfiles].used = datasize - head.Free;
+    nfiles++;
+}
+
+
+/*
+**  Walk the timecaf-XX/YY/ZZZZ.CF files of the spool.
+*/
+static void
+scan_spool(double threshold)
+{
+    DIR *top, *sec, *ter;
+    struct dirent *topde, *secde, *terde;
+    char *topdir, *secdir, *path;
+    time_t now;
+
+    now = time(NULL);
+    top = opendir(innconf->patharticles);
+    if (top == NULL)
+        sysdie("can't open %s", innconf->patharticles);
+    while ((topde = readdir(top)) != NULL) {
+        if (!hexname(topde->d_name, "timecaf-", 2, ""))
+            continue;
+        topdir = concatpath(innconf->patharticles, topde->d_name);
+        sec = opendir(topdir);
+        while (sec != NULL && (secde = readdir(sec)) != NULL) {
+            if (!hexname(secde->d_name, "", 2, ""))
+                continue;
+            secdir = concatpath(topdir, secde->d_name);
+            ter = opendir(secdir);
+            while (ter != NULL && (terde = readdir(ter)) != NULL) {
+                if (!hexname(terde->d_name, "", 4, "." CAF_NAME))
+                    continue;
+                path = concatpath(secdir, terde->d_name);
+                check_file(path, threshold, now);
+                free(path);
+            }
+            if (ter != NULL)
+                closedir(ter);
+            free(secdir);
+        }
+        if (sec != NULL)
+            closedir(sec);
+        free(topdir);
+    }
+    closedir(top);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    double threshold = 10.0;
+    unsigned long rate = 0;
+    unsigned long long copied = 0;
+    bool list_only = false;
+    bool verbose = false;
+    time_t start, elapsed, needed;
+    size_t i;
+    int option;
+    int status = 0;
+
+    message_program_name = "cafclean";
+    openlog("cafclean", L_OPENLOG_FLAGS | LOG_PID, LOG_INN_PROG);
+
+    while ((option = getopt(argc, argv, "np:r:v")) != EOF) {
+        switch (option) {
+        case 'n':
+            list_only = true;
+            break;
+        case 'p':
+            threshold = atof(optarg);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "%s", usage);
+            exit(1);
+        }
+    }
+    if (argc != optind) {
+        fprintf(stderr, "%s", usage);
+        exit(1);
+    }
+    if (!innconf_read(NULL))
+        exit(1);
+    if (!list_only && getenv("INN_TESTSUITE") == NULL)
+        ensure_news_user_grp(true, true);
+
+    scan_spool(threshold);
+    qsort(files, nfiles, sizeof(struct caffile), caffile_compare);
+
+    /* Clean the files, sleeping after each one as long as needed to keep
+       the average amount of data copied under rate KB per second. */
+    start = time(NULL);
+    for (i = 0; i < nfiles; i++) {
+        if (list_only)
+            printf("%s %.1f%%\n", files[i].path, files[i].percentfree);
+        else if (CAFClean(files[i].path, verbose, threshold) < 0) {
+            warn("can't clean %s: %s", files[i].path, CAFErrorStr());
+            status = 1;
+        } else if (rate > 0) {
+            copied += files[i].used;
+            needed = copied / (rate * 1024);
+            elapsed = time(NULL) - start;
+            if (needed > elapsed)
+                sleep(needed - elapsed);
+        }
+        free(files[i].path);
+    }
+    free(files);
+    exit(status);
+}
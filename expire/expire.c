@@ -9,6 +9,9 @@
 #include <sys/stat.h>
 #include <syslog.h>
 #include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "inn/history.h"
 #include "inn/innconf.h"
@@ -33,6 +36,9 @@ typedef struct _EXPIRECLASS {
 */
 #define MAGIC_TIME	49710.
 
+/* Articles to remove are handed to SMcancelbatch that many at a time. */
+#define EXP_CANCELBATCH	1024
+
 static bool		EXPtracing;
 static bool		EXPusepost;
 static bool		Ignoreselfexpire = false;
@@ -53,6 +59,22 @@ static long		EXPstillhere;
 static struct history	*History;
 static char		*NHistory;
 
+/* Articles waiting to be removed. */
+static TOKEN		*EXPcancels;
+static size_t		EXPncancels;
+
+/* With -j, EXPdoline is called from several threads at once; the storage
+   API, the statistics and the output are then only used with this lock
+   held. */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	EXPmutex = PTHREAD_MUTEX_INITIALIZER;
+# define EXPlock()	pthread_mutex_lock(&EXPmutex)
+# define EXPunlock()	pthread_mutex_unlock(&EXPmutex)
+#else
+# define EXPlock()	/* empty */
+# define EXPunlock()	/* empty */
+#endif
+
 static void CleanupAndExit(bool Server, bool Paused, int x)
     __attribute__ ((__noreturn__));
 static void Usage(void) __attribute__ ((__noreturn__));
@@ -279,19 +301,22 @@ static enum KR EXPkeepit(const TOKEN *token, time_t when, time_t Expires)
 
     class = EXPclasses[token->class];
     if (class.Missing) {
+        EXPlock();
         if (EXPclasses[NUM_STORAGE_CLASSES].Missing) {
             /* no default */
-            if (!class.ReportedMissing) {
+            if (!EXPclasses[token->class].ReportedMissing) {
                 warn("class definition for %d missing from control file,"
                      " assuming it should never expire", token->class);
                 EXPclasses[token->class].ReportedMissing = true;
             }
+            EXPunlock();
             return Keep;
         } else {
             /* use the default */
             class = EXPclasses[NUM_STORAGE_CLASSES];
             EXPclasses[token->class] = class;
         }
+        EXPunlock();
     }
     /* Bad posting date? */
     if (when > (RealNow + 86400)) {
@@ -299,6 +324,7 @@ static enum KR EXPkeepit(const TOKEN *token, time_t when, time_t Expires)
 	when = Expires ? class.Purge : class.Default;
     }
     if (EXPverbose > 2) {
+	EXPlock();
 	if (EXPverbose > 3)
 	    printf("%s age = %0.2f\n", TokenToText(*token), (Now - when) / 86400.);
 	if (Expires == 0) {
@@ -312,6 +338,7 @@ static enum KR EXPkeepit(const TOKEN *token, time_t when, time_t Expires)
 	    if (Now >= Expires)
 		printf("%s later than header\n", TokenToText(*token));
 	}
+	EXPunlock();
     }
     
     /* If no expiration, make sure it wasn't posted before the default. */
@@ -331,8 +358,20 @@ static enum KR EXPkeepit(const TOKEN *token, time_t when, time_t Expires)
 
 
 /*
-**  An article can be removed.  Either print a note, or actually remove it.
-**  Also fill in the article size.
+**  Remove the articles waiting for it.
+*/
+static void
+EXPcancelflush(void)
+{
+    if (EXPncancels > 0 && !SMcancelbatch(EXPcancels, EXPncancels))
+        warn("cannot remove some articles: %s", SMerrorstr);
+    EXPncancels = 0;
+}
+
+
+/*
+**  An article can be removed.  Either print a note, or queue it to be
+**  removed with the next batch.  Called with the lock held.
 */
 static void
 EXPremove(const TOKEN *token)
@@ -356,12 +395,16 @@ EXPremove(const TOKEN *token)
 	fclose(EXPunlinkfile);
 	EXPunlinkfile = NULL;
     }
-    if (!SMcancel(*token) && SMerrno != SMERR_NOENT && SMerrno != SMERR_UNINIT)
-        warn("cannot unlink %s", TokenToText(*token));
+    if (EXPcancels == NULL)
+        EXPcancels = xmalloc(EXP_CANCELBATCH * sizeof(TOKEN));
+    EXPcancels[EXPncancels++] = *token;
+    if (EXPncancels == EXP_CANCELBATCH)
+        EXPcancelflush();
 }
 
 /*
-**  Do the work of expiring one line.
+**  Do the work of expiring one line.  With -j, this is called from several
+**  threads at once.
 */
 static bool
 EXPdoline(void *cookie UNUSED, time_t arrived, time_t posted, time_t expires,
@@ -373,8 +416,10 @@ EXPdoline(void *cookie UNUSED, time_t arrived, time_t posted, time_t expires,
     ARTHANDLE		*article;
     enum KR             kr;
     bool		r;
+    bool		Unlink = false;
 
     if (innconf->groupbaseexpiry || SMprobe(SELFEXPIRE, token, NULL)) {
+	EXPlock();
 	if ((article = SMretrieve(*token, RETR_STAT)) == (ARTHANDLE *)NULL) {
 	    HasSelfexpire = true;
 	    Selfexpired = true;
@@ -384,33 +429,36 @@ EXPdoline(void *cookie UNUSED, time_t arrived, time_t posted, time_t expires,
 	    if (innconf->groupbaseexpiry || !Ignoreselfexpire)
 		HasSelfexpire = true;
 	}
+	EXPunlock();
     }
     if (EXPusepost && posted != 0)
 	when = posted;
     else
 	when = arrived;
-    EXPprocessed++;
 	
     if (HasSelfexpire) {
-	if (Selfexpired || token->type == TOKEN_EMPTY) {
-	    EXPallgone++;
+	if (Selfexpired || token->type == TOKEN_EMPTY)
 	    r = false;
-	} else {
-	    EXPstillhere++;
+	else
 	    r = true;
-	}
     } else  {
 	kr = EXPkeepit(token, when, expires);
 	if (kr == Remove) {
-	    EXPremove(token);
-	    EXPallgone++;
+	    Unlink = true;
 	    r = false;
-	} else {
-	    EXPstillhere++;
+	} else
 	    r = true;
-	}
     }
 
+    EXPlock();
+    EXPprocessed++;
+    if (Unlink)
+	EXPremove(token);
+    if (r)
+	EXPstillhere++;
+    else
+	EXPallgone++;
+    EXPunlock();
     return r;
 }
 
@@ -439,6 +487,8 @@ CleanupAndExit(bool Server, bool Paused, int x)
         syswarn("cannot close -z file");
 	x = 1;
     }
+    EXPcancelflush();
+    free(EXPcancels);
 
     /* Report stats. */
     if (EXPverbose) {
@@ -499,6 +549,7 @@ main(int ac, char *av[])
     bool		val;
     time_t		TimeWarp;
     size_t              Size = 0;
+    size_t              Threads = 0;
 
     /* First thing, set up logging and our identity. */
     openlog("expire", L_OPENLOG_FLAGS | LOG_PID, LOG_INN_PROG);
@@ -526,7 +577,7 @@ main(int ac, char *av[])
     }
 
     /* Parse JCL. */
-    while ((i = getopt(ac, av, "d:f:g:h:iNnpr:s:tv:w:xz:")) != EOF)
+    while ((i = getopt(ac, av, "d:f:g:h:ij:Nnpr:s:tv:w:xz:")) != EOF)
 	switch (i) {
 	default:
 	    Usage();
@@ -546,6 +597,9 @@ main(int ac, char *av[])
 	case 'i':
 	    IgnoreOld = true;
 	    break;
+	case 'j':
+	    Threads = atoi(optarg);
+	    break;
 	case 'N':
 	    Ignoreselfexpire = true;
 	    break;
@@ -658,6 +712,9 @@ main(int ac, char *av[])
     if (Size != 0) {
 	HISctl(History, HISCTLS_NPAIRS, &Size);
     }
+    if (Threads > 1 && !HISctl(History, HISCTLS_EXPIRETHREADS, &Threads))
+        warn("cannot use threads with this history method or build,"
+             " expiring in a single thread");
 
     val = true;
     if (!SMsetup(SM_RDWR, (void *)&val) || !SMsetup(SM_PREOPEN, (void *)&val)) {
@@ -5,12 +5,24 @@
 **  groupbaseexpiry is true, this program also handles the removal of
 **  articles that have expired.  It's separate from the process that scans
 **  and expires the history file.
+**
+**  With -j, the newsgroups are split between several worker processes, each
+**  with its own connection to the history, the storage manager and the
+**  overview, and the statistics and rm files of the workers are merged at
+**  the end.  This relies on the overview method locking each group, so it
+**  is only allowed for tradindexed.
+**
+**  With -c, the newsgroups are compacted instead of expired, which rewrites
+**  the overview of each one in article order in a single run of blocks.
+**  Only buffindexed supports it; it can be run at any time while innd is
+**  running, throttled to the given rate.
 */
 
 #include "config.h"
 #include "clibrary.h"
 #include <errno.h>
 #include <signal.h>
+#include <sys/wait.h>
 #include <syslog.h>
 #include <time.h>
 
@@ -22,44 +34,328 @@
 #include "inn/paths.h"
 #include "inn/qio.h"
 #include "inn/storage.h"
+#include "inn/vector.h"
 
 static const char usage[] = "\
-Usage: expireover [-ekNpqs] [-f file] [-w offset] [-z rmfile] [-Z lowmarkfile]\n";
+Usage: expireover [-ekNpqs] [-c rate] [-f file] [-j jobs] [-w offset]\n\
+                  [-z rmfile] [-Z lowmarkfile]\n";
 
 /* Set to 1 if we've received a signal; expireover then terminates after
    finishing the newsgroup that it's working on (this prevents corruption of
    the overview by killing expireover). */
 static volatile sig_atomic_t signalled = 0;
 
+/* The worker processes, so that signals can be passed on to them. */
+static pid_t *workers = NULL;
+static unsigned long nworkers = 0;
+
 
 /*
 **  Handle a fatal signal and set signalled.  Restore the default signal
 **  behavior after receiving a signal so that repeating the signal will kill
-**  the program immediately.
+**  the program immediately.  Workers are sent the same signal, so that they
+**  also stop after their current newsgroup.
 */
 static void
 fatal_signal(int sig)
 {
+    unsigned long i;
+
     signalled = 1;
+    for (i = 0; i < nworkers; i++)
+        if (workers[i] > 0)
+            kill(workers[i], sig);
     xsignal(sig, SIG_DFL);
 }
 
 
+/*
+**  Open the history, the storage manager and the overview, and configure
+**  the overview for expiration.  Returns the history handle.
+*/
+static struct history *
+expire_open(OVGE *ovge, bool always_stat)
+{
+    struct history *history;
+    char *path;
+    bool value;
+
+    /* open up the history manager */
+    path = concatpath(innconf->pathdb, INN_PATH_HISTORY);
+    history = HISopen(path, innconf->hismethod, HIS_RDONLY);
+    free(path);
+
+    /* Initialize the storage manager.  We only need to initialize it in
+       read/write mode if we're not going to be writing a separate file for
+       the use of fastrm. */
+    if (!ovge->delayrm) {
+        value = true;
+        if (!SMsetup(SM_RDWR, &value))
+            die("can't setup storage manager read/write");
+    }
+    value = true;
+    if (!SMsetup(SM_PREOPEN, &value))
+        die("can't setup storage manager");
+    if (!SMinit())
+        die("can't initialize storage manager: %s", SMerrorstr);
+
+    /* Initialize and configure the overview subsystem. */
+    if (!OVopen(OV_READ | OV_WRITE))
+        die("can't open overview database");
+    if (innconf->groupbaseexpiry) {
+        time(&ovge->now);
+        if (!OVctl(OVGROUPBASEDEXPIRE, ovge))
+            die("can't configure group-based expire");
+    }
+    if (!OVctl(OVSTATALL, &always_stat))
+        die("can't configure overview stat behavior");
+    return history;
+}
+
+
+/*
+**  Close everything opened by expire_open.
+*/
+static void
+expire_close(struct history *history)
+{
+    OVclose();
+    SMshutdown();
+    HISclose(history);
+}
+
+
+/*
+**  Expire the newsgroup named at the start of a line of the newsgroup list,
+**  writing its new low water mark to the lowmark file if desired.
+*/
+static void
+expire_group(char *line, struct history *history, FILE *lowmark)
+{
+    char *p;
+    int low;
+
+    p = strchr(line, ' ');
+    if (p != NULL)
+        *p = '\0';
+    p = strchr(line, '\t');
+    if (p != NULL)
+        *p = '\0';
+    if (!OVexpiregroup(line, &low, history))
+        warn("can't expire %s", line);
+    else if (lowmark != NULL && low != 0)
+        fprintf(lowmark, "%s %d\n", line, low);
+}
+
+
+/*
+**  Compact the newsgroup named at the start of a line of the newsgroup list,
+**  writing at most rate KB per second.  Returns whether it was rewritten.
+*/
+static bool
+compact_group(char *line, unsigned long rate)
+{
+    OVCOMPACT compact;
+    char *p;
+
+    p = strchr(line, ' ');
+    if (p != NULL)
+        *p = '\0';
+    p = strchr(line, '\t');
+    if (p != NULL)
+        *p = '\0';
+    compact.group = line;
+    compact.rate = rate;
+    if (!OVctl(OVCOMPACTGROUP, &compact)) {
+        warn("can't compact %s", line);
+        return false;
+    }
+    return compact.compacted;
+}
+
+
+/*
+**  Return the name of the rm file of a worker.
+*/
+static char *
+worker_rmfile(const char *rmfile, unsigned long worker)
+{
+    char suffix[32];
+
+    snprintf(suffix, sizeof(suffix), ".%lu", worker);
+    return concat(rmfile, suffix, (char *) 0);
+}
+
+
+/*
+**  Expire the newsgroups in a worker process.  Worker n of jobs takes every
+**  jobs-th newsgroup of the list starting with the n-th one, so that large
+**  hierarchies are spread over all of them, and the first worker also
+**  purges deleted newsgroups if desired.  The statistics are written to fd
+**  for the parent.  Never returns.
+*/
+static void
+expire_worker(unsigned long n, unsigned long jobs, struct vector *groups,
+              OVGE *ovge, bool always_stat, bool purge_deleted,
+              FILE *lowmark, int fd)
+{
+    struct history *history;
+    OVEXPSTATS stats;
+    size_t i;
+
+    nworkers = 0;
+    if (ovge->delayrm)
+        ovge->filename = worker_rmfile(ovge->filename, n);
+    history = expire_open(ovge, always_stat);
+    for (i = n; i < groups->count && !signalled; i += jobs)
+        expire_group(groups->strings[i], history, lowmark);
+    if (!signalled && purge_deleted && n == 0)
+        if (!OVexpiregroup(NULL, NULL, history))
+            warn("can't expire deleted newsgroups");
+    memset(&stats, 0, sizeof(stats));
+    OVctl(OVEXPIRESTATS, &stats);
+    if (xwrite(fd, &stats, sizeof(stats)) < 0)
+        syswarn("can't send statistics to the parent");
+    expire_close(history);
+    exit(0);
+}
+
+
+/*
+**  Append the rm file of a worker to the final rm file and remove it.
+*/
+static void
+merge_rmfile(FILE *rm, const char *rmfile, unsigned long worker)
+{
+    char buffer[8192];
+    char *path;
+    FILE *part;
+    size_t length;
+
+    path = worker_rmfile(rmfile, worker);
+    part = fopen(path, "r");
+    if (part == NULL) {
+        syswarn("can't open %s", path);
+        free(path);
+        return;
+    }
+    while ((length = fread(buffer, 1, sizeof(buffer), part)) > 0)
+        if (fwrite(buffer, 1, length, rm) != length) {
+            syswarn("can't write to %s", rmfile);
+            break;
+        }
+    fclose(part);
+    if (unlink(path) < 0)
+        syswarn("can't remove %s", path);
+    free(path);
+}
+
+
+/*
+**  Split the expiration between jobs worker processes, wait for them and
+**  merge their results.  Returns false if any of them failed.
+*/
+static bool
+expire_parallel(unsigned long jobs, struct vector *groups, OVGE *ovge,
+                bool always_stat, bool purge_deleted, FILE *lowmark)
+{
+    OVEXPSTATS stats, total;
+    int *fds, fd[2], status;
+    unsigned long i;
+    bool okay = true;
+    FILE *rm;
+
+    /* Each lowmark line must be written at once, since the workers share
+       the file. */
+    if (lowmark != NULL)
+        setvbuf(lowmark, NULL, _IOLBF, 0);
+    fflush(stdout);
+    fflush(stderr);
+
+    workers = xcalloc(jobs, sizeof(pid_t));
+    fds = xcalloc(jobs, sizeof(int));
+    for (i = 0; i < jobs; i++) {
+        if (pipe(fd) < 0)
+            sysdie("can't create pipe");
+        workers[i] = fork();
+        if (workers[i] < 0)
+            sysdie("can't fork worker");
+        if (workers[i] == 0) {
+            close(fd[0]);
+            expire_worker(i, jobs, groups, ovge, always_stat, purge_deleted,
+                          lowmark, fd[1]);
+        }
+        nworkers = i + 1;
+        close(fd[1]);
+        fds[i] = fd[0];
+    }
+
+    /* Collect the statistics of each worker as it finishes. */
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < jobs; i++) {
+        memset(&stats, 0, sizeof(stats));
+        if (read(fds[i], &stats, sizeof(stats)) != sizeof(stats))
+            memset(&stats, 0, sizeof(stats));
+        close(fds[i]);
+        while (waitpid(workers[i], &status, 0) < 0)
+            if (errno != EINTR) {
+                syswarn("can't wait for worker %lu", i);
+                break;
+            }
+        workers[i] = 0;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            warn("worker %lu failed", i);
+            okay = false;
+        }
+        total.processed += stats.processed;
+        total.dropped += stats.dropped;
+        total.indexdropped += stats.indexdropped;
+    }
+    nworkers = 0;
+
+    /* Merge the rm files of the workers. */
+    if (ovge->delayrm) {
+        rm = fopen(ovge->filename, "w");
+        if (rm == NULL)
+            sysdie("can't open %s", ovge->filename);
+        for (i = 0; i < jobs; i++)
+            merge_rmfile(rm, ovge->filename, i);
+        if (fclose(rm) == EOF)
+            syswarn("can't close %s", ovge->filename);
+    }
+
+    /* Report the same statistics as OVclose would for a single process. */
+    if (!ovge->quiet && total.processed != 0) {
+        printf("Article lines processed %8ld\n", total.processed);
+        printf("Articles dropped        %8ld\n", total.dropped);
+        printf("Overview index dropped  %8ld\n", total.indexdropped);
+    }
+    free(fds);
+    free(workers);
+    workers = NULL;
+    return okay;
+}
+
+
 int
 main(int argc, char *argv[])
 {
-    int option, low;
-    char *line, *p;
+    int option;
+    char *line;
     QIOSTATE *qp;
-    bool value;
     OVGE ovge;
     char *active_path = NULL;
     char *lowmark_path = NULL;
-    char *path;
     FILE *lowmark = NULL;
     bool purge_deleted = false;
     bool always_stat = false;
+    bool okay = true;
+    bool compact = false;
+    unsigned long jobs = 1;
+    unsigned long rate = 0;
+    unsigned long compacted;
     struct history *history;
+    struct vector *groups;
 
     /* First thing, set up logging and our identity. */
     openlog("expireover", L_OPENLOG_FLAGS | LOG_PID, LOG_INN_PROG);
@@ -77,14 +373,23 @@ main(int argc, char *argv[])
     ovge.delayrm = false;
 
     /* Parse the command-line options. */
-    while ((option = getopt(argc, argv, "ef:kNpqsw:z:Z:")) != EOF) {
+    while ((option = getopt(argc, argv, "c:ef:j:kNpqsw:z:Z:")) != EOF) {
         switch (option) {
+        case 'c':
+            compact = true;
+            rate = strtoul(optarg, NULL, 10);
+            break;
         case 'e':
             ovge.earliest = true;
             break;
         case 'f':
             active_path = xstrdup(optarg);
             break;
+        case 'j':
+            jobs = strtoul(optarg, NULL, 10);
+            if (jobs == 0)
+                die("-j must be a positive number of jobs");
+            break;
         case 'k':
             ovge.keep = true;
             break;
@@ -122,6 +427,15 @@ main(int argc, char *argv[])
     if (!innconf_read(NULL))
         exit(1);
 
+    if (compact && strcmp(innconf->ovmethod, "buffindexed") != 0)
+        die("-c is only supported for buffindexed");
+
+    /* Only tradindexed locks each group against concurrent expiration. */
+    if (jobs > 1 && strcmp(innconf->ovmethod, "tradindexed") != 0) {
+        warn("-j is only supported for tradindexed, using a single job");
+        jobs = 1;
+    }
+
     /* Change to the runasuser user and runasgroup group if necessary. */
     ensure_news_user_grp(true, true);
 
@@ -151,74 +465,64 @@ main(int argc, char *argv[])
     }
     free(active_path);
 
-    /* open up the history manager */
-    path = concatpath(innconf->pathdb, INN_PATH_HISTORY);
-    history = HISopen(path, innconf->hismethod, HIS_RDONLY);
-    free(path);
-
-    /* Initialize the storage manager.  We only need to initialize it in
-       read/write mode if we're not going to be writing a separate file for
-       the use of fastrm. */
-    if (!ovge.delayrm) {
-        value = true;
-        if (!SMsetup(SM_RDWR, &value))
-            die("can't setup storage manager read/write");
-    }
-    value = true;
-    if (!SMsetup(SM_PREOPEN, &value))
-        die("can't setup storage manager");
-    if (!SMinit())
-        die("can't initialize storage manager: %s", SMerrorstr);
-
-    /* Initialize and configure the overview subsystem. */
-    if (!OVopen(OV_READ | OV_WRITE))
-        die("can't open overview database");
-    if (innconf->groupbaseexpiry) {
-        time(&ovge.now);
-        if (!OVctl(OVGROUPBASEDEXPIRE, &ovge))
-            die("can't configure group-based expire");
-    }
-    if (!OVctl(OVSTATALL, &always_stat))
-        die("can't configure overview stat behavior");
-
     /* We want to be careful about being interrupted from this point on, so
        set up our signal handlers. */
     xsignal(SIGTERM, fatal_signal);
     xsignal(SIGINT, fatal_signal);
     xsignal(SIGHUP, fatal_signal);
 
-    /* Loop through each line of the input file and process each group,
-       writing data to the lowmark file if desired. */
-    line = QIOread(qp);
-    while (line != NULL && !signalled) {
-        p = strchr(line, ' ');
-        if (p != NULL)
-            *p = '\0';
-        p = strchr(line, '\t');
-        if (p != NULL)
-            *p = '\0';
-        if (!OVexpiregroup(line, &low, history))
-            warn("can't expire %s", line);
-        else if (lowmark != NULL && low != 0)
-            fprintf(lowmark, "%s %d\n", line, low);
+    if (compact) {
+        if (!OVopen(OV_READ | OV_WRITE))
+            die("can't open overview database");
+        compacted = 0;
         line = QIOread(qp);
-    }
-    if (signalled)
-        warn("received signal, exiting");
+        while (line != NULL && !signalled) {
+            if (compact_group(line, rate))
+                compacted++;
+            line = QIOread(qp);
+        }
+        if (signalled)
+            warn("received signal, exiting");
+        QIOclose(qp);
+        OVclose();
+        if (!ovge.quiet)
+            printf("Newsgroups compacted    %8lu\n", compacted);
+    } else if (jobs > 1) {
+        /* The workers need the whole list of newsgroups up front. */
+        groups = vector_new();
+        while ((line = QIOread(qp)) != NULL)
+            vector_add(groups, line);
+        QIOclose(qp);
+        okay = expire_parallel(jobs, groups, &ovge, always_stat,
+                               purge_deleted, lowmark);
+        vector_free(groups);
+        if (signalled)
+            warn("received signal, exiting");
+    } else {
+        history = expire_open(&ovge, always_stat);
 
-    /* If desired, purge all deleted newsgroups. */
-    if (!signalled && purge_deleted)
-        if (!OVexpiregroup(NULL, NULL, history))
-            warn("can't expire deleted newsgroups");
+        /* Loop through each line of the input file and process each group,
+           writing data to the lowmark file if desired. */
+        line = QIOread(qp);
+        while (line != NULL && !signalled) {
+            expire_group(line, history, lowmark);
+            line = QIOread(qp);
+        }
+        if (signalled)
+            warn("received signal, exiting");
 
-    /* Close everything down in an orderly fashion. */
-    QIOclose(qp);
-    OVclose();
-    SMshutdown();
-    HISclose(history);
+        /* If desired, purge all deleted newsgroups. */
+        if (!signalled && purge_deleted)
+            if (!OVexpiregroup(NULL, NULL, history))
+                warn("can't expire deleted newsgroups");
+
+        /* Close everything down in an orderly fashion. */
+        QIOclose(qp);
+        expire_close(history);
+    }
     if (lowmark != NULL)
         if (fclose(lowmark) == EOF)
             syswarn("can't close %s", lowmark_path);
 
-    return 0;
+    return okay ? 0 : 1;
 }
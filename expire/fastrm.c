@@ -18,6 +18,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <syslog.h>
 
 #include "inn/innconf.h"
@@ -75,6 +76,17 @@ static bool sm_initialized = false;
 /* True if unlink may be able to remove directories. */
 static bool unlink_dangerous = false;
 
+/* The number of worker processes removing files in parallel (0 if files are
+   removed by the main process), and the pipes over which they are sent the
+   lists of files to remove. */
+static int worker_count = 0;
+static pid_t *worker_pids = NULL;
+static FILE **worker_pipes = NULL;
+
+/* How often to report progress if progress is true, in files. */
+#define PROGRESS_INTERVAL 100000
+static bool progress = false;
+
 
 
 /*
@@ -595,6 +607,135 @@ unlink_filelist(filelist *list, int filecount)
 }
 
 
+/*
+**  Body of a worker process.  Read lists of files from fd, as sent by
+**  send_filelist, and remove them.  Never returns.
+*/
+static void
+worker_run(int fd)
+{
+    QIOSTATE *qp;
+    filelist *list = NULL;
+    char *line;
+
+    qp = QIOfdopen(fd);
+    if (qp == NULL)
+        sysdie("can't reopen worker pipe");
+    while ((line = QIOread(qp)) != NULL) {
+        switch (*line) {
+        case 'D':
+            list = filelist_new(xstrdup(line + 1));
+            break;
+        case 'N':
+            list = filelist_new(NULL);
+            break;
+        case 'F':
+            if (list != NULL)
+                filelist_insert(list, line + 1);
+            break;
+        case 'E':
+            if (list != NULL)
+                unlink_filelist(list, list->count);
+            list = NULL;
+            break;
+        }
+    }
+    if (QIOerror(qp)) {
+        syswarn("can't read worker pipe");
+        error_count++;
+    }
+    QIOclose(qp);
+    _exit(error_count > 0 ? 1 : 0);
+}
+
+
+/*
+**  Start count worker processes.  They inherit the base directory as their
+**  working directory.
+*/
+static void
+workers_start(int count)
+{
+    int i, fds[2];
+
+    worker_count = count;
+    worker_pids = xmalloc(count * sizeof(pid_t));
+    worker_pipes = xmalloc(count * sizeof(FILE *));
+    for (i = 0; i < count; i++) {
+        if (pipe(fds) < 0)
+            sysdie("can't create pipe");
+        fflush(stdout);
+        worker_pids[i] = fork();
+        if (worker_pids[i] < 0)
+            sysdie("can't fork worker process");
+        if (worker_pids[i] == 0) {
+            close(fds[1]);
+            while (i-- > 0)
+                fclose(worker_pipes[i]);
+            worker_run(fds[0]);
+        }
+        close(fds[0]);
+        worker_pipes[i] = fdopen(fds[1], "w");
+        if (worker_pipes[i] == NULL)
+            sysdie("can't open pipe to worker");
+    }
+}
+
+
+/*
+**  Hand a filelist over to a worker.  All the files of a given directory
+**  go to the same worker, so that two processes never search the same
+**  directory at once.
+*/
+static void
+send_filelist(filelist *list)
+{
+    unsigned long hash = 5381;
+    const char *p;
+    FILE *F;
+    int i;
+
+    if (list->dir != NULL)
+        for (p = list->dir; *p != '\0'; p++)
+            hash = hash * 33 + (unsigned char) *p;
+    F = worker_pipes[hash % worker_count];
+    if (list->dir != NULL)
+        fprintf(F, "D%s\n", list->dir);
+    else
+        fputs("N\n", F);
+    for (i = 0; i < list->count; i++)
+        fprintf(F, "F%s\n", list->files[i]);
+    fputs("E\n", F);
+    if (ferror(F))
+        sysdie("can't write to worker");
+    filelist_free(list);
+}
+
+
+/*
+**  Close the pipes to the workers and wait for them to finish their lists.
+*/
+static void
+workers_finish(void)
+{
+    int i, status;
+
+    for (i = 0; i < worker_count; i++)
+        if (fclose(worker_pipes[i]) == EOF) {
+            syswarn("can't flush pipe to worker");
+            error_count++;
+        }
+    for (i = 0; i < worker_count; i++) {
+        if (waitpid(worker_pids[i], &status, 0) < 0)
+            sysdie("can't wait for worker");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            error_count++;
+    }
+    free(worker_pipes);
+    free(worker_pids);
+}
+
+
 /*
 **  Check a path to see if it's okay (not likely to confuse us).  This
 **  ensures that it doesn't contain elements like "./" or "../" and doesn't
@@ -632,6 +773,8 @@ main(int argc, char *argv[])
     QIOSTATE *qp;
     filelist *list;
     int filecount, deleted;
+    unsigned long files = 0, dirs = 0, tokens = 0, reported = 0;
+    int workers = 0;
     bool empty_error = false;
 
     /* Establish our identity.  Since we use the storage manager, we need to
@@ -674,6 +817,15 @@ main(int argc, char *argv[])
             case 'e':
                 empty_error = true;
                 continue;
+            case 'j':
+                workers = 4;
+                if (!isdigit((unsigned char) p[1]))
+                    continue;
+                workers = atoi(p + 1);
+                break;
+            case 'p':
+                progress = true;
+                continue;
             case 's':
                 sort_threshold = 5;
                 if (!isdigit((unsigned char) p[1]))
@@ -711,12 +863,31 @@ main(int argc, char *argv[])
     qp = QIOfdopen(fileno(stdin));
     if (qp == NULL)
         sysdie("can't reopen stdin");
+    if (workers > 1 && !debug_only)
+        workers_start(workers);
     while ((list = process_line(qp, &filecount, &deleted)) != NULL) {
         empty_error = false;
-        unlink_filelist(list, filecount);
+        files += filecount;
+        tokens += deleted;
+        dirs++;
+        if (worker_count > 0)
+            send_filelist(list);
+        else
+            unlink_filelist(list, filecount);
+        if (progress && files + tokens - reported >= PROGRESS_INTERVAL) {
+            notice("%lu files in %lu directories and %lu tokens so far",
+                   files, dirs, tokens);
+            reported = files + tokens;
+        }
     }
     if (deleted > 0)
         empty_error = false;
+    tokens += deleted;
+    if (worker_count > 0)
+        workers_finish();
+    if (progress)
+        notice("%lu files in %lu directories and %lu tokens removed",
+               files, dirs, tokens);
 
     /* All done. */
     SMshutdown();
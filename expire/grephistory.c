@@ -15,9 +15,42 @@
 
 static void Usage(void) __attribute__ ((__noreturn__));
 
+/* How many message-IDs read on stdin are looked up at once. */
+#define BATCH 4096
+
+/*
+**  Look up a batch of message-IDs read on stdin, print what was asked for
+**  them, and free them.
+*/
+static void
+Answer(struct history *h, char What, char **ids, size_t count, bool *found)
+{
+    size_t i;
+    time_t arrived, posted, expires;
+    TOKEN token;
+
+    if (count == 0)
+	return;
+    HIScheckbatch(h, (const char *const *) ids, count, found);
+    for (i = 0; i < count; i++) {
+	/* Ihave -- say if we want it, and continue. */
+	if (What == 'i') {
+	    if (!found[i])
+		printf("%s\n", ids[i]);
+	} else if (found[i]) {
+	    if (HISlookup(h, ids[i], &arrived, &posted, &expires, &token))
+		printf("%s\n", TokenToText(token));
+	}
+	free(ids[i]);
+    }
+}
+
+
 /*
 **  Read stdin for list of Message-ID's, output list of ones we
-**  don't have.  Or, output list of files for ones we DO have.
+**  don't have.  Or, output list of files for ones we DO have.  They are
+**  checked by batches, which lets the history method read its index in
+**  order rather than at random.
 */
 static void
 IhaveSendme(struct history *h, char What)
@@ -25,11 +58,11 @@ IhaveSendme(struct history *h, char What)
     char		*p;
     char		*q;
     char		buff[BUFSIZ];
+    char		*ids[BATCH];
+    bool		found[BATCH];
+    size_t		count = 0;
 
     while (fgets(buff, sizeof buff, stdin) != NULL) {
-	time_t arrived, posted, expires;
-	TOKEN token;
-
 	for (p = buff; ISWHITE(*p); p++)
 	    ;
 	if (*p != '<')
@@ -40,20 +73,13 @@ IhaveSendme(struct history *h, char What)
 	    continue;
 	*++q = '\0';
 
-	if (!HIScheck(h, p)) {
-	    if (What == 'i')
-		printf("%s\n", p);
-	    continue;
+	ids[count++] = xstrdup(p);
+	if (count == BATCH) {
+	    Answer(h, What, ids, count, found);
+	    count = 0;
 	}
-
-	/* Ihave -- say if we want it, and continue. */
-	if (What == 'i') {
-	    continue;
-	}
-
-	if (HISlookup(h, p, &arrived, &posted, &expires, &token))
-	    printf("%s\n", TokenToText(token));
     }
+    Answer(h, What, ids, count, found);
 }
 
 
@@ -119,7 +145,11 @@ main(int ac, char *av[])
     ac -= optind;
     av += optind;
 
-    history = HISopen(History, innconf->hismethod, HIS_RDONLY);
+    /* Many lookups are worth mapping the history index once rather than
+       reading it slot by slot. */
+    history = HISopen(History, innconf->hismethod,
+                      (What == 'i' || What == 's') ? HIS_RDONLY | HIS_MMAP
+                                                   : HIS_RDONLY);
     if (history == NULL)
         die("cannot open history");
 
@@ -21,6 +21,11 @@
  * go */
 #define HIS_FIELDSEP            '\t'
 
+/* How many entries are stored at once.  dbz stores a batch in the order of
+   the place where its entries go in the tables, loading the next places
+   ahead; larger batches spend more time sorting than they save. */
+#define BATCH                   (64 * 1024)
+
 char *TextFile = NULL;
 char *HistoryDir = NULL;
 char *HISTORY = NULL;
@@ -83,6 +88,35 @@ Countlines(void)
 }
 
 
+/*
+**  Store a batch of entries, and report those already there.  Returns false
+**  if one of them couldn't be stored.
+*/
+static bool
+StoreBatch(const HASH *keys, const off_t *offsets, size_t count,
+           DBZSTORE_RESULT *results)
+{
+    size_t i;
+
+    if (!dbzstorebatch(keys, offsets, count, results))
+        return false;
+    for (i = 0; i < count; i++) {
+        switch (results[i]) {
+        case DBZSTORE_EXISTS:
+            warn("duplicate message ID [%s in history text",
+                 HashToText(keys[i]));
+            break;
+        case DBZSTORE_ERROR:
+            syswarn("cannot store [%s", HashToText(keys[i]));
+            return false;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+
 /*
 **  Rebuild the DBZ file from the text file.
 */
@@ -97,6 +131,10 @@ Rebuild(off_t size, bool IgnoreOld, bool Overwrite)
     HASH		key;
     char		temp[SMBUF];
     dbzoptions          opt;
+    HASH                *keys;
+    off_t               *offsets;
+    DBZSTORE_RESULT     *results;
+    size_t              batched;
 
     if (chdir(HistoryDir) < 0)
         sysdie("cannot chdir to %s", HistoryDir);
@@ -160,7 +198,12 @@ Rebuild(off_t size, bool IgnoreOld, bool Overwrite)
 	}
     }
 
-    /* Loop through all lines in the text file. */
+    /* Loop through all lines in the text file, storing the entries a batch
+       at a time. */
+    keys = xmalloc(BATCH * sizeof(HASH));
+    offsets = xmalloc(BATCH * sizeof(off_t));
+    results = xmalloc(BATCH * sizeof(DBZSTORE_RESULT));
+    batched = 0;
     count = 0;
     for (where = QIOtell(qp); (p = QIOread(qp)) != NULL; where = QIOtell(qp)) {
 	count++;
@@ -183,18 +226,16 @@ Rebuild(off_t size, bool IgnoreOld, bool Overwrite)
             warn("invalid message ID %s in history text", p);
 	    continue;
 	}
-	switch (dbzstore(key, where)) {
-	case DBZSTORE_EXISTS:
-            warn("duplicate message ID %s in history text", p);
-	    break;
-	case DBZSTORE_ERROR:
-            syswarn("cannot store %s", p);
+	keys[batched] = key;
+	offsets[batched] = where;
+	if (++batched < BATCH)
+	    continue;
+	if (!StoreBatch(keys, offsets, batched, results)) {
 	    if (temp[0])
 		unlink(temp);
 	    exit(1);
-	default:
-	    break;
 	}
+	batched = 0;
     }
     if (QIOerror(qp)) {
         syswarn("cannot read %s near line %lu", TextFile,
@@ -210,6 +251,15 @@ Rebuild(off_t size, bool IgnoreOld, bool Overwrite)
 	exit(1);
     }
 
+    if (!StoreBatch(keys, offsets, batched, results)) {
+	if (temp[0])
+	    unlink(temp);
+	exit(1);
+    }
+    free(keys);
+    free(offsets);
+    free(results);
+
     /* Close files. */
     QIOclose(qp);
     if (!dbzclose()) {
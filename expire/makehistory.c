@@ -6,9 +6,13 @@
 #include "clibrary.h"
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <syslog.h>
 #include <sys/wait.h>
 #include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "inn/buffer.h"
 #include "inn/history.h"
@@ -45,13 +49,15 @@ getloadavg(double loadavg[], int nelem)
 #endif
 
 static const char usage[] = "\
-Usage: makehistory [-abFIOSx] [-f file] [-l count] [-L load] [-s size] [-T tmpdir]\n\
+Usage: makehistory [-abFIOSx] [-f file] [-j workers] [-l count] [-L load]\n\
+                   [-s size] [-T tmpdir]\n\
 \n\
     -a          open output history file in append mode\n\
     -b          delete bad articles from spool\n\
     -F          fork when writing overview\n\
     -f file     write history entries to file (default $pathdb/history)\n\
     -I          do not create overview for articles numbered below lowmark\n\
+    -j workers  read the spool and sort overview with this many workers\n\
     -l count    size of overview updates (default 10000)\n\
     -L load     pause when load average exceeds threshold\n\
     -O          create overview entries for articles\n\
@@ -83,14 +89,33 @@ FILE *Overchan;
 bool DoOverview;
 bool Fork;
 bool Cutofflow = false;
+bool BulkLoad = true;
 char *TmpDir;
 int OverTmpSegSize, OverTmpSegCount;
-FILE *OverTmpFile;
-char *OverTmpPath = NULL;
 bool NoHistory;
 OVSORTTYPE sorttype;
 bool WriteStdout = false;
 
+/* When reading the spool with several worker processes, each worker writes
+   its history and overview entries to a file which the parent then feeds
+   to the history and overview databases.  A record is a WORKRECORD followed
+   by len1 and then len2 bytes of data (the message-ID for a history entry,
+   the Xref header and the overview data for an overview entry). */
+typedef struct {
+    char                type;
+    TOKEN               token;
+    time_t              arrived;
+    time_t              posted;
+    time_t              expires;
+    size_t              len1;
+    size_t              len2;
+} WORKRECORD;
+
+#define WORK_HISTORY    'H'
+#define WORK_OVERVIEW   'O'
+
+FILE *WorkFile = NULL;
+
 /* Misc variables needed for the overview creation code. */
 static char             BYTES[] = "Bytes";
 static char             DATE[] = "Date";
@@ -112,6 +137,8 @@ static ARTOVERFIELD     *Xrefp = (ARTOVERFIELD *)NULL;
 static ARTOVERFIELD	*Missfields; /* Header fields not used in overview
                                       * but that we need (e.g. Expires:). */
 static size_t		Missfieldsize = 0;
+static struct wire_header *Headers; /* ARTfields then Missfields, to find
+                                     * all of them in one pass. */
 
 static void OverAddAllNewsgroups(void);
 
@@ -134,39 +161,342 @@ GetMessageID(char *p)
 }
 
 /*
- * The overview temp file is used to accumulate overview lines as articles are
- * scanned.  The format is
- * (1st) newsgroup name\tToken\toverview data.
- * When about 10000 lines of this overview data are accumulated, the data
- * file is sorted and then read back in and the data added to overview.
- * The sorting/batching helps improve efficiency.
- */
+**  Overview lines are accumulated in memory as articles are scanned, each
+**  prefixed with its sort key (the newsgroup name if the overview method
+**  wants it, then the arrival and expiration times, then the token).  When
+**  about 10000 lines are accumulated, they are sorted and added to overview;
+**  the sorting/batching helps improve efficiency.  The lines are kept
+**  NUL-terminated in OverBuffer at the offsets in OverLines.
+**
+**  Sorting is done by SortThreads threads, each sorting a slice of the lines,
+**  and the slices are then merged.  If the lines take more than OVER_RUNSIZE
+**  bytes before the segment is flushed, they are sorted and written out as a
+**  run to a temporary file, and the runs are merged as well when the segment
+**  is flushed.  The merge feeds the overview database directly.
+*/
+#define OVER_RUNSIZE    (64 * 1024 * 1024)
+
+static struct buffer *OverBuffer = NULL;
+static size_t *OverLines = NULL;
+static size_t OverLinesCount = 0;
+static size_t OverLinesSize = 0;
+static struct vector *OverRuns = NULL;
+static unsigned int SortThreads = 1;
+
+/* A sorted source of lines for the merge, either a slice of the lines in
+   memory or a run file.  line is the current line, or NULL at the end. */
+struct mergesource {
+    char **lines;
+    size_t count;
+    size_t next;
+    QIOSTATE *qp;
+    char *line;
+};
+
+/* The state of a merge: a heap of the sources which have lines left, with
+   the one holding the smallest line first. */
+struct overmerge {
+    struct mergesource **heap;
+    size_t count;
+    bool started;
+    bool error;
+};
+
 
 /*
- * Flush the unwritten OverTempFile data to disk, sort the file, read it 
- * back in, and add it to overview. 
- */
+**  Compare two overview lines, byte-wise like sort(1) in the C locale.
+*/
+static int
+OverCompare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+**  Thread sorting one slice of the lines.
+*/
+static void *
+OverSortThread(void *arg)
+{
+    struct mergesource *slice = arg;
+    sigset_t set;
+
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    qsort(slice->lines, slice->count, sizeof(char *), OverCompare);
+    return NULL;
+}
+#endif
+
+
+/*
+**  Sort the lines in memory.  Returns an array of lines, to be freed by the
+**  caller, and fills in slices (of SortThreads elements) with its sorted
+**  slices, returning how many there are.
+*/
+static size_t
+OverSort(char ***lines, struct mergesource *slices)
+{
+    size_t i, nslices, start;
+#ifdef HAVE_PTHREAD
+    pthread_t *threads;
+    bool *started;
+#endif
+
+    *lines = xmalloc((OverLinesCount + 1) * sizeof(char *));
+    for (i = 0; i < OverLinesCount; i++)
+        (*lines)[i] = OverBuffer->data + OverLines[i];
+    nslices = SortThreads;
+    if (nslices > OverLinesCount / 1000)
+        nslices = OverLinesCount / 1000;
+    if (nslices == 0)
+        nslices = 1;
+    for (i = 0, start = 0; i < nslices; i++) {
+        memset(&slices[i], 0, sizeof(slices[i]));
+        slices[i].lines = *lines + start;
+        slices[i].count = OverLinesCount / nslices
+            + (i < OverLinesCount % nslices ? 1 : 0);
+        start += slices[i].count;
+    }
+
+#ifdef HAVE_PTHREAD
+    /* The first slice is sorted by this thread, and any slice whose thread
+       cannot be started as well. */
+    threads = xmalloc(nslices * sizeof(pthread_t));
+    started = xcalloc(nslices, sizeof(bool));
+    for (i = 1; i < nslices; i++)
+        started[i] = (pthread_create(&threads[i], NULL, OverSortThread,
+                                     &slices[i]) == 0);
+    for (i = 0; i < nslices; i++)
+        if (!started[i])
+            qsort(slices[i].lines, slices[i].count, sizeof(char *),
+                  OverCompare);
+    for (i = 1; i < nslices; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    free(threads);
+    free(started);
+#else
+    for (i = 0; i < nslices; i++)
+        qsort(slices[i].lines, slices[i].count, sizeof(char *), OverCompare);
+#endif
+    return nslices;
+}
+
 
+/*
+**  Move a source of the merge to its next line.
+*/
 static void
-FlushOverTmpFile(void)
+OverSourceNext(struct overmerge *merge, struct mergesource *source)
 {
-    char temp[SMBUF];
-    char *SortedTmpPath;
-    int i, pid, fd;
-    float f;
-    TOKEN token;
-    QIOSTATE *qp;
-    int count;
-    char *line, *p;
-    char *q = NULL;
-    char *r = NULL;
+    if (source->qp == NULL) {
+        if (source->next < source->count)
+            source->line = source->lines[source->next++];
+        else
+            source->line = NULL;
+        return;
+    }
+    while ((source->line = QIOread(source->qp)) == NULL) {
+        if (!QIOtoolong(source->qp)) {
+            if (QIOerror(source->qp)) {
+                syswarn("cannot read temporary overview file");
+                merge->error = true;
+            }
+            return;
+        }
+        warn("overview line is too long");
+    }
+}
+
+
+/*
+**  Restore the heap order from the given position down.
+*/
+static void
+OverMergeSift(struct overmerge *merge, size_t i)
+{
+    struct mergesource *source;
+    size_t child;
+
+    source = merge->heap[i];
+    while ((child = 2 * i + 1) < merge->count) {
+        if (child + 1 < merge->count
+            && strcmp(merge->heap[child + 1]->line,
+                      merge->heap[child]->line) < 0)
+            child++;
+        if (strcmp(source->line, merge->heap[child]->line) <= 0)
+            break;
+        merge->heap[i] = merge->heap[child];
+        i = child;
+    }
+    merge->heap[i] = source;
+}
+
+
+/*
+**  Start merging the given sources.
+*/
+static void
+OverMergeStart(struct overmerge *merge, struct mergesource *sources,
+               size_t count)
+{
+    size_t i;
+
+    memset(merge, 0, sizeof(*merge));
+    merge->heap = xmalloc((count + 1) * sizeof(struct mergesource *));
+    for (i = 0; i < count; i++) {
+        OverSourceNext(merge, &sources[i]);
+        if (sources[i].line != NULL)
+            merge->heap[merge->count++] = &sources[i];
+    }
+    for (i = merge->count / 2; i-- > 0; )
+        OverMergeSift(merge, i);
+}
+
+
+/*
+**  Return the next line of the merge, or NULL at the end.  The line may be
+**  modified by the caller, and is valid until the next call.
+*/
+static char *
+OverMergeNext(struct overmerge *merge)
+{
+    if (merge->started && merge->count > 0) {
+        OverSourceNext(merge, merge->heap[0]);
+        if (merge->heap[0]->line == NULL)
+            merge->heap[0] = merge->heap[--merge->count];
+        if (merge->count > 0)
+            OverMergeSift(merge, 0);
+    }
+    merge->started = true;
+    return merge->count > 0 ? merge->heap[0]->line : NULL;
+}
+
+
+/*
+**  Forget the lines in memory, keeping the memory for the next ones.
+*/
+static void
+OverReset(void)
+{
+    if (OverBuffer != NULL)
+        buffer_set(OverBuffer, NULL, 0);
+    OverLinesCount = 0;
+}
+
+
+/*
+**  Sort the lines in memory and write them out as a run to a temporary file,
+**  to be merged when the segment is flushed.
+*/
+static void
+OverSpill(void)
+{
+    struct mergesource *slices;
+    struct overmerge merge;
+    char **lines;
+    char *path, *line;
+    size_t nslices;
+    int fd;
+    FILE *F;
+
+    slices = xmalloc(SortThreads * sizeof(struct mergesource));
+    nslices = OverSort(&lines, slices);
+    path = concatpath(TmpDir, "histXXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0)
+        sysdie("cannot create temporary file");
+    F = fdopen(fd, "w");
+    if (F == NULL)
+        sysdie("cannot open %s", path);
+    OverMergeStart(&merge, slices, nslices);
+    while ((line = OverMergeNext(&merge)) != NULL)
+        if (fputs(line, F) == EOF || putc('\n', F) == EOF)
+            sysdie("cannot write %s", path);
+    if (fclose(F) == EOF)
+        sysdie("cannot close %s", path);
+    if (OverRuns == NULL)
+        OverRuns = vector_new();
+    vector_add(OverRuns, path);
+    free(path);
+    free(merge.heap);
+    free(lines);
+    free(slices);
+    OverReset();
+}
+
+
+/*
+**  Parse a sorted overview line and add it to overview.
+*/
+static void
+OverAddLine(char *line, int count)
+{
+    char *p, *q, *r;
     time_t arrived, expires;
+    TOKEN token;
+    float f;
+
+    if ((p = strchr(line, '\t')) == NULL
+        || (q = strchr(p+1, '\t')) == NULL
+        || (r = strchr(q+1, '\t')) == NULL) {
+        warn("sorted overview data has a bad line at %d", count);
+        return;
+    }
+    /* p+1 now points to start of token, q+1 points to start of overline. */
+    if (sorttype == OVNEWSGROUP) {
+        *p++ = '\0';
+        *q++ = '\0';
+        *r++ = '\0';
+        arrived = (time_t)atol(p);
+        expires = (time_t)atol(q);
+        q = r;
+        if ((r = strchr(r, '\t')) == NULL) {
+            warn("sorted overview data has a bad line at %d", count);
+            return;
+        }
+        *r++ = '\0';
+    } else {
+        *p++ = '\0';
+        *q++ = '\0';
+        *r++ = '\0';
+        arrived = (time_t)atol(line);
+        expires = (time_t)atol(p);
+    }
+    token = TextToToken(q);
+    if (OVadd(token, r, strlen(r), arrived, expires) == OVADDFAILED) {
+        if (OVctl(OVSPACE, (void *)&f) && (int)(f+0.01f) == OV_NOSPACE) {
+            warn("no space left for overview");
+            OVclose();
+            Fork ? _exit(1) : exit(1);
+        }
+        warn("cannot write overview data \"%.40s\"", q);
+    }
+}
+
+
+/*
+**  Sort the overview lines of the segment, merging them with the runs
+**  written out, and add them to overview.
+*/
+static void
+FlushOverTmpFile(void)
+{
+    struct mergesource *sources;
+    struct overmerge merge;
+    char **lines;
+    char *line;
+    size_t i, nruns, nsources;
+    int pid, count;
     static int first = 1;
 
-    if (OverTmpFile == NULL)
+    nruns = (OverRuns == NULL) ? 0 : OverRuns->count;
+    if (OverLinesCount == 0 && nruns == 0)
 	return;
-    if (fflush(OverTmpFile) == EOF || ferror(OverTmpFile) || fclose(OverTmpFile) == EOF)
-        sysdie("cannot close temporary overview file");
+    OverTmpSegCount = 0;
     if(Fork) {
         if(!first) { /* if previous one is running, wait for it */
 	    int status;
@@ -180,10 +510,11 @@ FlushOverTmpFile(void)
 	if(pid == -1)
             sysdie("cannot fork");
 	if(pid > 0) {
-	    /* parent */
+	    /* parent; the child now owns the lines and the runs. */
 	    first = 0;
-	    free(OverTmpPath);
-	    OverTmpPath = NULL;
+	    OverReset();
+	    if (OverRuns != NULL)
+	        vector_clear(OverRuns);
 	    return;
 	}
 
@@ -203,106 +534,73 @@ FlushOverTmpFile(void)
 	    OVclose();
 	    _exit(1);
 	}
+	/* Not all overview methods have a bulk loading mode. */
+	OVctl(OVBULKLOAD, (void *)&BulkLoad);
     }
 
-    /* This is a bit odd, but as long as other user's files can't be deleted
-       out of the temporary directory, it should work.  We're using mkstemp to
-       create a file and then passing its name to sort, which will then open
-       it again and overwrite it. */
-    SortedTmpPath = concatpath(TmpDir, "hisTXXXXXX");
-    fd = mkstemp(SortedTmpPath);
-    if (fd < 0) {
-        syswarn("cannot create temporary file");
+    /* Merge the sorted slices of the lines in memory and the runs. */
+    sources = xmalloc((SortThreads + nruns) * sizeof(struct mergesource));
+    nsources = OverSort(&lines, sources);
+    for (i = 0; i < nruns; i++) {
+        memset(&sources[nsources], 0, sizeof(sources[nsources]));
+        sources[nsources].qp = QIOopen(OverRuns->strings[i]);
+        if (sources[nsources].qp == NULL) {
+            syswarn("cannot open temporary overview file %s",
+                    OverRuns->strings[i]);
+            OVclose();
+            Fork ? _exit(1) : exit(1);
+        }
+        nsources++;
+    }
+    OverMergeStart(&merge, sources, nsources);
+    for (count = 1; (line = OverMergeNext(&merge)) != NULL; count++)
+        OverAddLine(line, count);
+    if (merge.error) {
         OVclose();
         Fork ? _exit(1) : exit(1);
     }
-    close(fd);
-    snprintf(temp, sizeof(temp), "exec %s -T %s -t'%c' -o %s %s",
-             INN_PATH_SORT, TmpDir, '\t', SortedTmpPath, OverTmpPath);
-    
-    i = system(temp) >> 8;
-    if (i != 0) {
-        syswarn("cannot sort temporary overview file (%s exited %d)",
-                INN_PATH_SORT, i);
-	OVclose();
-	Fork ? _exit(1) : exit(1);
-    }
-
-    /* don't need old path anymore. */
-    unlink(OverTmpPath);
-    free(OverTmpPath);
-    OverTmpPath = NULL;
-
-    /* read sorted lines. */
-    if ((qp = QIOopen(SortedTmpPath)) == NULL) {
-        syswarn("cannot open sorted overview file %s", SortedTmpPath);
-	OVclose();
-	Fork ? _exit(1) : exit(1);
-    }
-
-    for (count = 1; ; ++count) {
-	line = QIOread(qp);
-	if (line == NULL) {
-	    if (QIOtoolong(qp)) {
-                warn("overview line %d is too long", count);
-		continue;
-	    } else
-		break;
-	}
-	if ((p = strchr(line, '\t')) == NULL 
-	    || (q = strchr(p+1, '\t')) == NULL
-	    || (r = strchr(q+1, '\t')) == NULL) {
-            warn("sorted overview file %s has a bad line at %d",
-                 SortedTmpPath, count);
-	    continue;
-	}
-	/* p+1 now points to start of token, q+1 points to start of overline. */
-	if (sorttype == OVNEWSGROUP) {
-	    *p++ = '\0';
-	    *q++ = '\0';
-	    *r++ = '\0';
-	    arrived = (time_t)atol(p);
-	    expires = (time_t)atol(q);
-	    q = r;
-	    if ((r = strchr(r, '\t')) == NULL) {
-                warn("sorted overview file %s has a bad line at %d",
-                     SortedTmpPath, count);
-		continue;
-	    }
-	    *r++ = '\0';
-	} else {
-	    *p++ = '\0';
-	    *q++ = '\0';
-	    *r++ = '\0';
-	    arrived = (time_t)atol(line);
-	    expires = (time_t)atol(p);
-	}
-	token = TextToToken(q);
-	if (OVadd(token, r, strlen(r), arrived, expires) == OVADDFAILED) {
-	    if (OVctl(OVSPACE, (void *)&f) && (int)(f+0.01f) == OV_NOSPACE) {
-                warn("no space left for overview");
-		OVclose();
-		Fork ? _exit(1) : exit(1);
-	    }
-            warn("cannot write overview data \"%.40s\"", q);
-	}
-    }
-    /* Check for errors and close. */
-    if (QIOerror(qp)) {
-        syswarn("cannot read sorted overview file %s", SortedTmpPath);
-	OVclose();
-	Fork ? _exit(1) : exit(1);
-    }
-    QIOclose(qp);
-    /* unlink sorted tmp file */
-    unlink(SortedTmpPath);
-    free(SortedTmpPath);
+    for (i = 0; i < nsources; i++)
+        if (sources[i].qp != NULL)
+            QIOclose(sources[i].qp);
+    for (i = 0; i < nruns; i++)
+        unlink(OverRuns->strings[i]);
+    if (OverRuns != NULL)
+        vector_clear(OverRuns);
+    free(merge.heap);
+    free(lines);
+    free(sources);
+    OverReset();
     if(Fork) {
 	OVclose();
 	_exit(0);
     }
 }
-	    
+
+
+/*
+**  Append a history or overview entry to the file of a worker process.
+*/
+static void
+WriteWorkRecord(char type, const TOKEN *token, time_t arrived, time_t posted,
+                time_t expires, const char *data1, size_t len1,
+                const char *data2, size_t len2)
+{
+    WORKRECORD record;
+
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.token = *token;
+    record.arrived = arrived;
+    record.posted = posted;
+    record.expires = expires;
+    record.len1 = len1;
+    record.len2 = len2;
+    if (fwrite(&record, sizeof(record), 1, WorkFile) != 1
+        || (len1 > 0 && fwrite(data1, len1, 1, WorkFile) != 1)
+        || (len2 > 0 && fwrite(data2, len2, 1, WorkFile) != 1))
+        sysdie("cannot write worker file");
+}
+
 
 /*
 **  Write a line to the overview temp file, standard output, our child process
@@ -315,9 +613,15 @@ WriteOverLine(TOKEN *token, const char *xrefs, int xrefslen,
 {
     char temp[SMBUF];
     const char *p, *q, *r;
-    int fd;
     float f;
 
+    /* Workers leave the entry for the parent process. */
+    if (WorkFile != NULL) {
+        WriteWorkRecord(WORK_OVERVIEW, token, arrived, 0, expires, xrefs,
+                        xrefslen, overdata, overlen);
+        return;
+    }
+
     /* If WriteStdout is set, just print the overview information to standard
        output and return. */
     if (WriteStdout) {
@@ -349,22 +653,18 @@ WriteOverLine(TOKEN *token, const char *xrefs, int xrefslen,
 	return;
     }
 
-    /* Otherwise, we need the temporary file.  Create it if it doesn't already
-       exist. */
-    if (OverTmpPath == NULL) {
-	/* need new temp file, so create it. */
-        OverTmpPath = concatpath(TmpDir, "histXXXXXX");
-        fd = mkstemp(OverTmpPath);
-        if (fd < 0)
-            sysdie("cannot create temporary file");
-        OverTmpFile = fdopen(fd, "w");
-	if (OverTmpFile == NULL)
-            sysdie("cannot open %s", OverTmpPath);
-	OverTmpSegCount = 0;
+    /* Otherwise, the line is kept in memory until the segment is sorted. */
+    if (OverBuffer == NULL)
+        OverBuffer = buffer_new();
+    if (OverLinesCount == OverLinesSize) {
+        OverLinesSize = (OverLinesSize == 0) ? 1024 : OverLinesSize * 2;
+        OverLines = xrealloc(OverLines, OverLinesSize * sizeof(size_t));
     }
+    OverLines[OverLinesCount] = OverBuffer->left;
+    if (OverBuffer->size < OverBuffer->left + overlen + SMBUF + 64)
+        buffer_resize(OverBuffer, 2 * OverBuffer->size + overlen + SMBUF + 64);
 
-    /* Print out the data to the teporary file with the appropriate keys for
-       sorting. */
+    /* Add the data with the appropriate keys for sorting. */
     if (sorttype == OVNEWSGROUP) {
 	/* find first ng name in xref. */
 	for (p = xrefs, q=NULL ; p < xrefs+xrefslen ; ++p) {
@@ -394,18 +694,22 @@ WriteOverLine(TOKEN *token, const char *xrefs, int xrefslen,
         assert((ptrdiff_t) sizeof(temp) > r - q + 1);
 	memcpy(temp, q, r - q + 1);
         temp[r - q + 1] = '\0';
-	fprintf(OverTmpFile, "%s\t%10lu\t%lu\t%s\t", temp,
-                (unsigned long) arrived, (unsigned long) expires,
-                TokenToText(*token));
+	buffer_append_sprintf(OverBuffer, "%s\t%10lu\t%lu\t%s\t", temp,
+                              (unsigned long) arrived, (unsigned long) expires,
+                              TokenToText(*token));
     } else
-	fprintf(OverTmpFile, "%10lu\t%lu\t%s\t", (unsigned long) arrived,
-                (unsigned long) expires,
-                TokenToText(*token));
+	buffer_append_sprintf(OverBuffer, "%10lu\t%lu\t%s\t",
+                              (unsigned long) arrived, (unsigned long) expires,
+                              TokenToText(*token));
 
-    fwrite(overdata, overlen, 1, OverTmpFile);
-    fprintf(OverTmpFile, "\n");
+    buffer_append(OverBuffer, overdata, overlen);
+    buffer_append(OverBuffer, "", 1);
+    OverLinesCount++;
     OverTmpSegCount++;
 
+    if (OverBuffer->left >= OVER_RUNSIZE)
+        OverSpill();
+
     if (OverTmpSegSize != 0 && OverTmpSegCount >= OverTmpSegSize) {
 	FlushOverTmpFile();
     }
@@ -560,6 +864,17 @@ ARTreadschema(bool Overview)
 	    Xrefp = fp++;
 	}
     }
+
+    /* Someone managed to break their server so that they were appending
+       multiple Xref headers, and INN had a bug where it wouldn't notice this
+       and reject the article.  Just in case, use the last Xref header. */
+    Headers = xcalloc(ARTfieldsize + Missfieldsize, sizeof(struct wire_header));
+    for (fp = ARTfields, i = 0; i < ARTfieldsize; i++, fp++) {
+        Headers[i].name = fp->Headername;
+        Headers[i].last = (fp == Xrefp);
+    }
+    for (fp = Missfields, i = 0; i < Missfieldsize; i++, fp++)
+        Headers[ARTfieldsize + i].name = fp->Headername;
 }
 
 /*
@@ -605,28 +920,10 @@ DoArt(ARTHANDLE *art)
 	    fp->HasHeader = false;
 	}
     }
+    wire_findheaders(art->data, art->len, Headers,
+                     ARTfieldsize + Missfieldsize, false);
     for (fp = ARTfields, i = 0; i < ARTfieldsize; i++, fp++) {
-        fp->Header = wire_findheader(art->data, art->len, fp->Headername, false);
-
-        /* Someone managed to break their server so that they were appending
-           multiple Xref headers, and INN had a bug where it wouldn't notice
-           this and reject the article.  Just in case, see if there are
-           multiple Xref headers and use the last one. */
-        if (fp == Xrefp) {
-            const char *next = fp->Header;
-            size_t left;
-
-            while (next != NULL) {
-                next = wire_endheader(fp->Header, art->data + art->len - 1);
-                if (next == NULL)
-                    break;
-                next++;
-                left = art->len - (next - art->data);
-                next = wire_findheader(next, left, fp->Headername, false);
-                if (next != NULL)
-                    fp->Header = next;
-            }
-        }
+        fp->Header = Headers[i].value;
 
         /* Work out the real values for :bytes and :lines. */
         if (fp == Bytesp || fp == Linesp) {
@@ -681,7 +978,7 @@ DoArt(ARTHANDLE *art)
     }
     if (Missfieldsize > 0) {
 	for (fp = Missfields, i = 0; i < Missfieldsize; i++, fp++) {
-            fp->Header = wire_findheader(art->data, art->len, fp->Headername, false);
+            fp->Header = Headers[ARTfieldsize + i].value;
             if (fp->Header != NULL) {
 		fp->HasHeader = true;
                 p = wire_endheader(fp->Header, art->data + art->len - 1);
@@ -801,7 +1098,10 @@ DoArt(ARTHANDLE *art)
 		      buffer.data, buffer.left, Arrived, Expires);
     }
 
-    if (!NoHistory) {
+    if (!NoHistory && WorkFile != NULL) {
+        WriteWorkRecord(WORK_HISTORY, art->token, Arrived, Posted, Expires,
+                        MessageID, strlen(MessageID), NULL, 0);
+    } else if (!NoHistory) {
 	bool r;
 
 	r = HISwrite(History, MessageID,
@@ -856,13 +1156,141 @@ OverAddAllNewsgroups(void)
 }
 
 
+/*
+**  Scan the spool (or, for a worker, its slice of the spool), nuke any bad
+**  arts if needed, and process each article.  We take a break when the load
+**  is too high.
+*/
+static void
+ScanSpool(int LoadAverage)
+{
+    ARTHANDLE *art = NULL;
+    double load[1];
+
+    while ((art = SMnext(art, RETR_ALL)) != NULL) {
+	if (art->len == 0) {
+	    if (NukeBadArts && art->data == NULL && art->token != NULL)
+		SMcancel(*art->token);
+	    continue;
+	}
+
+	DoArt(art);
+
+        if (LoadAverage > 0) {
+            while (getloadavg(load, 1) > 0 &&
+                   (int) (load[0]) >= LoadAverage) {
+                sleep(1);
+            }
+        }
+    }
+}
+
+
+/*
+**  Start a worker process which reads the index'th of count slices of the
+**  spool and writes the resulting entries to a temporary file, whose path
+**  is returned in *path.
+*/
+static pid_t
+StartWorker(unsigned int index, unsigned int count, int LoadAverage,
+            char **path)
+{
+    SMPARTITION partition;
+    pid_t pid;
+    bool val;
+    int fd;
+
+    *path = concatpath(TmpDir, "histXXXXXX");
+    fd = mkstemp(*path);
+    if (fd < 0)
+        sysdie("cannot create temporary file");
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+        sysdie("cannot fork worker process");
+    if (pid > 0) {
+        close(fd);
+        return pid;
+    }
+
+    if ((WorkFile = fdopen(fd, "w")) == NULL)
+        sysdie("cannot open %s", *path);
+    partition.index = index;
+    partition.count = count;
+    val = true;
+    if (!SMsetup(SM_RDWR, (void *)&val) || !SMsetup(SM_PREOPEN, (void *)&val)
+        || !SMsetup(SM_PARTITION, (void *)&partition))
+        sysdie("cannot set up storage manager");
+    if (!SMinit())
+        sysdie("cannot initialize storage manager: %s", SMerrorstr);
+    ScanSpool(LoadAverage);
+    if (fclose(WorkFile) == EOF)
+        sysdie("cannot flush %s", *path);
+    SMshutdown();
+    _exit(0);
+}
+
+
+/*
+**  Wait for a worker to finish its slice of the spool.
+*/
+static void
+WaitWorker(pid_t pid)
+{
+    int status;
+
+    if (waitpid(pid, &status, 0) < 0)
+        sysdie("cannot wait for worker %lu", (unsigned long) pid);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("worker %lu failed", (unsigned long) pid);
+}
+
+
+/*
+**  Feed the entries found by a worker to the history and overview databases.
+*/
+static void
+ReadWorker(char *path)
+{
+    WORKRECORD record;
+    struct buffer data = { 0, 0, 0, NULL };
+    FILE *F;
+
+    if ((F = fopen(path, "r")) == NULL)
+        sysdie("cannot open %s", path);
+    while (fread(&record, sizeof(record), 1, F) == 1) {
+        buffer_resize(&data, record.len1 + record.len2 + 1);
+        if (record.len1 + record.len2 > 0
+            && fread(data.data, record.len1 + record.len2, 1, F) != 1)
+            break;
+        if (record.type == WORK_HISTORY) {
+            data.data[record.len1] = '\0';
+            if (!HISwrite(History, data.data, record.arrived, record.posted,
+                          record.expires, &record.token))
+                sysdie("cannot write history line");
+        } else {
+            WriteOverLine(&record.token, data.data, record.len1,
+                          data.data + record.len1, record.len2,
+                          record.arrived, record.expires);
+        }
+    }
+    if (ferror(F) || !feof(F))
+        die("cannot read worker file %s", path);
+    fclose(F);
+    unlink(path);
+    free(path);
+    free(data.data);
+}
+
+
 int
 main(int argc, char **argv)
 {
-    ARTHANDLE *art = NULL;
     bool AppendMode;
     int LoadAverage;
-    double load[1];
+    unsigned int Workers;
+    pid_t *WorkerPids = NULL;
+    char **WorkerPaths = NULL;
     int i;
     bool val;
     char *HistoryDir;
@@ -892,8 +1320,9 @@ main(int argc, char **argv)
     AppendMode = false;
     LoadAverage = 0;
     NoHistory = false;
+    Workers = 0;
 
-    while ((i = getopt(argc, argv, "abFf:Il:L:OSs:T:x")) != EOF) {
+    while ((i = getopt(argc, argv, "abFf:Ij:l:L:OSs:T:x")) != EOF) {
 	switch(i) {
 	case 'a':
 	    AppendMode = true;
@@ -910,6 +1339,9 @@ main(int argc, char **argv)
 	case 'I':
 	    Cutofflow = true;
 	    break;
+	case 'j':
+	    Workers = atoi(optarg);
+	    break;
 	case 'l':
 	    OverTmpSegSize = atoi(optarg);
 	    break;
@@ -966,6 +1398,16 @@ main(int argc, char **argv)
 
     /* Read in the overview schema. */
     ARTreadschema(DoOverview);
+
+    /* Start the workers before anything is opened in the parent, which then
+       only writes what they send. */
+    if (Workers > 1) {
+        WorkerPids = xmalloc(Workers * sizeof(pid_t));
+        WorkerPaths = xmalloc(Workers * sizeof(char *));
+        for (i = 0; i < (int) Workers; i++)
+            WorkerPids[i] = StartWorker(i, Workers, LoadAverage,
+                                        &WorkerPaths[i]);
+    }
     
     if (DoOverview && !WriteStdout) {
 	/* init the overview setup. */
@@ -976,6 +1418,7 @@ main(int argc, char **argv)
 	if (!Fork) {
 	    if (!OVctl(OVCUTOFFLOW, (void *)&Cutofflow))
                 die("cannot obtain overview cutoff information");
+	    OVctl(OVBULKLOAD, (void *)&BulkLoad);
 	    OverAddAllNewsgroups();
 	} else {
 	    OverAddAllNewsgroups();
@@ -990,11 +1433,14 @@ main(int argc, char **argv)
     }
 
     /* Init the Storage Manager */
-    val = true;
-    if (!SMsetup(SM_RDWR, (void *)&val) || !SMsetup(SM_PREOPEN, (void *)&val))
-        sysdie("cannot set up storage manager");
-    if (!SMinit())
-        sysdie("cannot initialize storage manager: %s", SMerrorstr);
+    if (WorkerPids == NULL) {
+        val = true;
+        if (!SMsetup(SM_RDWR, (void *)&val)
+            || !SMsetup(SM_PREOPEN, (void *)&val))
+            sysdie("cannot set up storage manager");
+        if (!SMinit())
+            sysdie("cannot initialize storage manager: %s", SMerrorstr);
+    }
 
     /* Initialise the history manager */
     if (!NoHistory) {
@@ -1010,26 +1456,22 @@ main(int argc, char **argv)
             sysdie("cannot open %s", HistoryPath);
     }
 
-    /*
-     * Scan the entire spool, nuke any bad arts if needed, and process each
-     * article.  We take a break when the load is too high.
-     */
-	
-    while ((art = SMnext(art, RETR_ALL)) != NULL) {
-	if (art->len == 0) {
-	    if (NukeBadArts && art->data == NULL && art->token != NULL)
-		SMcancel(*art->token);
-	    continue;
-	}
-
-	DoArt(art);
-
-        if (LoadAverage > 0) {
-            while (getloadavg(load, 1) > 0 &&
-                   (int) (load[0]) >= LoadAverage) {
-                sleep(1);
-            }
-        }
+    /* The overview data is sorted by as many threads as there are workers. */
+    if (Workers > 1)
+        SortThreads = Workers;
+
+    /* Scan the spool, or collect what the workers found in it. */
+    if (WorkerPids == NULL)
+        ScanSpool(LoadAverage);
+    else {
+        /* All the workers are reaped first, since flushing the overview
+           temporary file waits for any child. */
+        for (i = 0; i < (int) Workers; i++)
+            WaitWorker(WorkerPids[i]);
+        for (i = 0; i < (int) Workers; i++)
+            ReadWorker(WorkerPaths[i]);
+        free(WorkerPids);
+        free(WorkerPaths);
     }
 
     if (!NoHistory) {
@@ -0,0 +1,292 @@
+/*
+**  Move articles between storage methods as they age.
+**
+**  storage.conf entries with an age key only match articles older than the
+**  given age, so new articles are stored by the entries without one.  This
+**  program walks the history file and stores again each article that has
+**  become old enough to be routed elsewhere, then points history and
+**  overview to the new copy before cancelling the old one.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/uio.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/newsuser.h"
+#include "inn/ov.h"
+#include "inn/paths.h"
+#include "inn/storage.h"
+#include "inn/wire.h"
+
+static const char usage[] = "\
+Usage: smmigrate [-v] [-f file] [-r rate]\n";
+
+/* State of the walk through history. */
+struct migration {
+    struct history *history;
+    time_t cutoff;              /* Articles arrived after this stay put. */
+    unsigned long rate;         /* Maximum KB per second copied, or 0. */
+    bool verbose;
+    time_t start;
+    unsigned long moved;
+    unsigned long failed;
+    unsigned long long copied;
+};
+
+
+/*
+**  Return a copy of the value of a header of an article, without its final
+**  CRLF, or NULL if it isn't found.
+*/
+static char *
+header_value(const ARTHANDLE *art, const char *name)
+{
+    const char *start, *end;
+
+    start = wire_findheader(art->data, art->len, name, true);
+    if (start == NULL)
+        return NULL;
+    end = wire_endheader(start, art->data + art->len - 1);
+    if (end == NULL || end - start < 1)
+        return NULL;
+
+    /* end points to the \n of the terminating \r\n. */
+    return xstrndup(start, end - start - 1);
+}
+
+
+/*
+**  Look up the overview data of an article in the first group of its Xref
+**  value (without the host name).  Returns a newly allocated copy of the
+**  data and sets its length, or returns NULL if the article has none.
+*/
+static char *
+overview_data(const char *xref, int *len)
+{
+    char *group, *p, *data, *copy = NULL;
+    ARTNUM artnum;
+    void *handle;
+    TOKEN token;
+    time_t arrived;
+
+    group = xstrdup(xref);
+    p = strchr(group, ' ');
+    if (p != NULL)
+        *p = '\0';
+    p = strchr(group, ':');
+    if (p == NULL) {
+        free(group);
+        return NULL;
+    }
+    *p++ = '\0';
+    artnum = strtoul(p, NULL, 10);
+    handle = OVopensearch(group, artnum, artnum);
+    if (handle != NULL) {
+        if (OVsearch(handle, &artnum, &data, len, &token, &arrived)) {
+            copy = xmalloc(*len);
+            memcpy(copy, data, *len);
+        }
+        OVclosesearch(handle);
+    }
+    free(group);
+    return copy;
+}
+
+
+/*
+**  Called for each history entry.  Moves the article if storage.conf now
+**  sends it elsewhere.  Errors are reported but don't stop the walk.
+*/
+static bool
+migrate(void *cookie, time_t arrived, time_t posted, time_t expires,
+        const TOKEN *token)
+{
+    struct migration *state = cookie;
+    ARTHANDLE *art;
+    ARTHANDLE handle = ARTHANDLE_INITIALIZER;
+    struct iovec iov;
+    TOKEN newtoken;
+    char *msgid = NULL, *xref = NULL, *groups = NULL, *data = NULL;
+    char *p;
+    int len = 0;
+    time_t needed, elapsed;
+
+    if (token == NULL || arrived > state->cutoff)
+        return true;
+
+    /* Articles that are gone from the spool are left for expire. */
+    art = SMretrieve(*token, RETR_ALL);
+    if (art == NULL)
+        return true;
+    msgid = header_value(art, "Message-ID");
+    xref = header_value(art, "Xref");
+    if (msgid == NULL || xref == NULL) {
+        warn("cannot find Message-ID or Xref in %s", TokenToText(*token));
+        goto fail;
+    }
+
+    /* Skip the host name to get the groups of the Xref header. */
+    p = strchr(xref, ' ');
+    if (p == NULL) {
+        warn("malformed Xref header in %s", TokenToText(*token));
+        goto fail;
+    }
+    p++;
+    if (innconf->storeonxref)
+        groups = xstrdup(p);
+    else if ((groups = header_value(art, "Newsgroups")) == NULL) {
+        warn("cannot find Newsgroups in %s", TokenToText(*token));
+        goto fail;
+    }
+
+    iov.iov_base = (char *) art->data;
+    iov.iov_len = art->len;
+    handle.type = art->type;
+    handle.data = art->data;
+    handle.iov = &iov;
+    handle.iovcnt = 1;
+    handle.len = art->len;
+    handle.arrived = arrived;
+    handle.expires = expires;
+    handle.groups = groups;
+    handle.groupslen = strlen(groups);
+    newtoken = SMmigrate(*token, handle);
+    if (newtoken.type == TOKEN_EMPTY) {
+        warn("cannot store %s again: %s", msgid, SMerrorstr);
+        goto fail;
+    }
+    if (memcmp(&newtoken, token, sizeof(TOKEN)) == 0) {
+        SMfreearticle(art);
+        free(msgid);
+        free(xref);
+        free(groups);
+        return true;
+    }
+
+    /* Point history and overview to the new copy.  Until the old copy is
+       cancelled, readers using either token find the article. */
+    if (!HISreplace(state->history, msgid, arrived, posted, expires,
+                    &newtoken)) {
+        warn("cannot update history for %s: %s", msgid,
+             HISerror(state->history));
+        SMcancel(newtoken);
+        goto fail;
+    }
+    data = overview_data(p, &len);
+    if (data != NULL) {
+        OVcancel(*token);
+        if (OVadd(newtoken, data, len, arrived, expires) != OVADDCOMPLETED)
+            warn("cannot update overview for %s", msgid);
+    }
+    if (!SMcancel(*token))
+        warn("cannot cancel old copy of %s: %s", msgid, SMerrorstr);
+    if (state->verbose) {
+        /* TokenToText returns a static buffer. */
+        p = xstrdup(TokenToText(*token));
+        printf("%s %s -> %s\n", msgid, p, TokenToText(newtoken));
+        free(p);
+    }
+    state->moved++;
+    state->copied += art->len;
+    SMfreearticle(art);
+    free(msgid);
+    free(xref);
+    free(groups);
+    free(data);
+
+    /* Sleep as long as needed to keep the average amount of data copied
+       under rate KB per second. */
+    if (state->rate > 0) {
+        needed = state->copied / (state->rate * 1024);
+        elapsed = time(NULL) - state->start;
+        if (needed > elapsed)
+            sleep(needed - elapsed);
+    }
+    return true;
+
+fail:
+    state->failed++;
+    SMfreearticle(art);
+    free(msgid);
+    free(xref);
+    free(groups);
+    return true;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct migration state;
+    const char *path = NULL;
+    char *history_path;
+    bool value = true;
+    int option;
+
+    message_program_name = "smmigrate";
+    openlog("smmigrate", L_OPENLOG_FLAGS | LOG_PID, LOG_INN_PROG);
+
+    memset(&state, 0, sizeof(state));
+    while ((option = getopt(argc, argv, "f:r:v")) != EOF) {
+        switch (option) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'r':
+            state.rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            state.verbose = true;
+            break;
+        default:
+            fprintf(stderr, "%s", usage);
+            exit(1);
+        }
+    }
+    if (argc != optind) {
+        fprintf(stderr, "%s", usage);
+        exit(1);
+    }
+    if (!innconf_read(NULL))
+        exit(1);
+    if (getenv("INN_TESTSUITE") == NULL)
+        ensure_news_user_grp(true, true);
+
+    if (!SMsetup(SM_RDWR, &value) || !SMsetup(SM_PREOPEN, &value))
+        die("cannot set up storage manager");
+    if (!SMinit())
+        die("cannot initialize storage manager: %s", SMerrorstr);
+    if (SMminage() == 0) {
+        notice("no storage.conf entry has an age key, nothing to do");
+        SMshutdown();
+        exit(0);
+    }
+    if (!OVopen(OV_READ | OV_WRITE))
+        die("cannot open overview");
+    history_path = (path != NULL) ? xstrdup(path)
+                                  : concatpath(innconf->pathdb,
+                                               INN_PATH_HISTORY);
+    state.history = HISopen(history_path, innconf->hismethod, HIS_RDWR);
+    if (state.history == NULL)
+        sysdie("cannot open %s", history_path);
+
+    state.start = time(NULL);
+    state.cutoff = state.start - SMminage();
+    if (!HISwalk(state.history, NULL, &state, migrate))
+        warn("cannot walk %s: %s", history_path, HISerror(state.history));
+    notice("moved %lu articles (%llu bytes), %lu failed", state.moved,
+           state.copied, state.failed);
+
+    if (!HISclose(state.history))
+        syswarn("cannot close %s", history_path);
+    free(history_path);
+    OVclose();
+    SMshutdown();
+    exit(state.failed > 0 ? 1 : 0);
+}
@@ -32,6 +32,8 @@ static COMMAND	Commands[] = {
 	5,	SC_ADDHIST,	true	},
     {	"allow",	"reason...\t\t\tAllow remote connections",
 	1,	SC_ALLOW,	true	},
+    {	"batch",	"file\t\t\tApply group and flush commands in file",
+	1,	SC_BATCH,	false	},
     {	"begin",	"site\t\t\tStart newly-added site",
 	1,	SC_BEGIN,	false	},
     {	"cancel",	"id\t\t\tCancel message locally",
@@ -52,6 +54,8 @@ static COMMAND	Commands[] = {
 	1,	SC_GO,		true	},
     {	"hangup",	"channel\t\tHangup specified incoming channel",
 	1,	SC_HANGUP,	false	},
+    {	"latency",	"show|reset\t\tPrint storage and overview latencies",
+	1,	SC_LATENCY,	false	},
     {	"logmode",		"\t\t\t\tSend server mode to syslog",
 	0,	SC_LOGMODE,	false		},
     {	"mode",		"\t\t\t\tPrint operating mode",
@@ -46,10 +46,11 @@ main(int argc, char *argv[])
     bool okay = true;
     bool version = false;
     bool checking = false;
+    bool snapshot = false;
 
     message_program_name = "innconfval";
 
-    while ((option = getopt(argc, argv, "Ci:pstv")) != EOF)
+    while ((option = getopt(argc, argv, "Ci:pSstv")) != EOF)
         switch (option) {
         default:
             die("usage error");
@@ -63,6 +64,9 @@ main(int argc, char *argv[])
         case 'p':
             quoting = INNCONF_QUOTE_PERL;
             break;
+        case 'S':
+            snapshot = true;
+            break;
         case 's':
             quoting = INNCONF_QUOTE_SHELL;
             break;
@@ -82,6 +86,8 @@ main(int argc, char *argv[])
     }
     if (checking)
         exit(innconf_check(file) ? 0 : 1);
+    if (snapshot)
+        exit(innconf_write_snapshot(file) ? 0 : 1);
 
     /* Read in the inn.conf file specified. */
     if (!innconf_read(file))
@@ -228,6 +228,61 @@ do_srch(struct reader *r)
     r->mode = MODE_WRITE;
 }
 
+/* Reply with as many of the next records of a search as fit in a batch, so
+   that the client doesn't need a round trip for each of them. */
+static void
+do_srchbatch(struct reader *r)
+{
+    struct rs_cmd *cmd = r->buf;
+    struct rs_srchbatch *reply;
+    struct rs_srch record;
+    uint32_t max;
+    size_t size, used;
+    ARTNUM artnum;
+    TOKEN token;
+    time_t arrived;
+    int len;
+    char *data;
+
+    max = cmd->arthi;
+    if(max == 0 || max > OVDB_SERVER_BATCH)
+	max = OVDB_SERVER_BATCH;
+    size = sizeof(struct rs_srchbatch) + OVDB_SERVER_BATCH_SIZE;
+    used = sizeof(struct rs_srchbatch);
+    reply = xmalloc(size);
+    reply->status = CMD_SRCHBATCH;
+    reply->count = 0;
+    reply->done = 0;
+    while(reply->count < max
+	  && used < sizeof(struct rs_srchbatch) + OVDB_SERVER_BATCH_SIZE) {
+	if(!ovdb_search(cmd->handle, &artnum, &data, &len, &token,
+			&arrived)) {
+	    reply->done = 1;
+	    break;
+	}
+	if(used + sizeof(record) + (size_t) len > size) {
+	    size = used + sizeof(record) + (size_t) len;
+	    reply = xrealloc(reply, size);
+	}
+	memset(&record, 0, sizeof(record));
+	record.status = CMD_SRCH;
+	record.artnum = artnum;
+	record.token = token;
+	record.arrived = arrived;
+	record.len = len;
+	memcpy((char *)reply + used, &record, sizeof(record));
+	memcpy((char *)reply + used + sizeof(record), data, len);
+	used += sizeof(record) + len;
+	reply->count++;
+    }
+    reply->len = used - sizeof(struct rs_srchbatch);
+    free(r->buf);
+    r->buf = reply;
+    r->buflen = used;
+    r->bufpos = 0;
+    r->mode = MODE_WRITE;
+}
+
 static void
 do_closesrch(struct reader *r)
 {
@@ -304,6 +359,9 @@ process_cmd(struct reader *r)
     case CMD_SRCH:
 	do_srch(r);
 	break;
+    case CMD_SRCHBATCH:
+	do_srchbatch(r);
+	break;
     case CMD_CLOSESRCH:
 	do_closesrch(r);
 	break;
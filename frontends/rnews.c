@@ -26,21 +26,52 @@
 #include "inn/storage.h"
 #include "inn/wire.h"
 
+#if defined(HAVE_ZLIB)
+# include <zlib.h>
+#endif
+
+/* How many articles may be awaiting a reply from the server when streaming.
+   This is the number of articles kept in memory. */
+#define STREAM_WINDOW   16
 
 typedef struct _HEADER {
     const char *Name;
     int size;
 } HEADER;
 
+/* An article offered with CHECK, or sent with TAKETHIS if Sent is true,
+   whose reply has not been read yet. */
+typedef struct _STREAMART {
+    char        *MessageID;
+    char        *Wire;
+    size_t      WireLength;
+    char        *Article;
+    size_t      Length;
+    char        Path[40];
+    bool        Sent;
+} STREAMART;
+
 
 static bool     additionalUnpackers = true;
 static bool     backupBad = false;
 static bool     logDuplicates = false;
 static bool     Verbose = false;
+static bool     WantStreaming = false;
+static bool     Streaming = false;
+static int      Jobs = 1;
+static STREAMART StreamQueue[STREAM_WINDOW];
+static int      StreamHead;
+static int      StreamCount;
+#if defined(HAVE_ZLIB)
+static z_stream *Inflating;
+static bool     InflateEnded;
+static unsigned char InflateBuffer[BUFSIZ * 8];
+#endif
 static const char	*InputFile = "stdin";
 static char	*UUCPHost;
 static char	*PathBadNews = NULL;
 static char	*remoteServer;
+static int      Port = NNTP_PORT;
 static FILE	*FromServer;
 static FILE	*ToServer;
 static char	UNPACK[] = "gzip";
@@ -61,6 +92,9 @@ static HEADER	RequiredHeaders[] = {
 #define IS_MESGID(hp)	((hp) == &RequiredHeaders[_messageid])
 #define IS_PATH(hp)	((hp) == &RequiredHeaders[_path])
 
+static void     OpenServer(int mode, int fd);
+static void     CloseServer(void);
+
 
 
 /*
@@ -142,6 +176,117 @@ WaitForChildren(int n)
 
 
 
+/*
+**  Read from the batch, through the in-process decompression if a gzip
+**  batch is being read.  Like read, returns 0 at the end of the input.
+*/
+static ssize_t
+ReadInput(int fd, void *buff, size_t size)
+{
+#if defined(HAVE_ZLIB)
+    ssize_t n;
+    int status;
+
+    if (Inflating == NULL)
+        return read(fd, buff, size);
+
+    Inflating->next_out = buff;
+    Inflating->avail_out = size;
+    while (Inflating->avail_out == size) {
+        if (Inflating->avail_in == 0) {
+            n = read(fd, InflateBuffer, sizeof(InflateBuffer));
+            if (n < 0)
+                return -1;
+            if (n == 0) {
+                if (!InflateEnded)
+                    warn("truncated gzip batch");
+                return 0;
+            }
+            Inflating->next_in = InflateBuffer;
+            Inflating->avail_in = n;
+        }
+
+        /* As gzip does, decompress concatenated members in turn, but take
+           anything else after a member as padding and ignore it. */
+        if (InflateEnded) {
+            if (Inflating->next_in[0] != 0x1f)
+                return 0;
+            inflateReset(Inflating);
+            InflateEnded = false;
+        }
+        status = inflate(Inflating, Z_NO_FLUSH);
+        if (status == Z_STREAM_END)
+            InflateEnded = true;
+        else if (status != Z_OK && status != Z_BUF_ERROR) {
+            warn("cannot decompress batch: %s",
+                 Inflating->msg != NULL ? Inflating->msg : "unknown error");
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return size - Inflating->avail_out;
+#else
+    return read(fd, buff, size);
+#endif
+}
+
+
+#if defined(HAVE_ZLIB)
+/*
+**  Start decompressing the rest of the batch in-process, rather than with a
+**  gzip child.  The bytes already read from it are given as seen.
+*/
+static bool
+StartInflate(const char *seen, size_t length)
+{
+    Inflating = xcalloc(1, sizeof(z_stream));
+    if (inflateInit2(Inflating, 15 + 16) != Z_OK) {
+        warn("cannot initialize zlib: %s",
+             Inflating->msg != NULL ? Inflating->msg : "unknown error");
+        free(Inflating);
+        Inflating = NULL;
+        return false;
+    }
+    if (length > 0)
+        memcpy(InflateBuffer, seen, length);
+    Inflating->next_in = InflateBuffer;
+    Inflating->avail_in = length;
+    InflateEnded = false;
+    return true;
+}
+#endif
+
+
+/*
+**  Whether the batch is being decompressed in-process.
+*/
+static bool
+InflatingBatch(void)
+{
+#if defined(HAVE_ZLIB)
+    return Inflating != NULL;
+#else
+    return false;
+#endif
+}
+
+
+/*
+**  Release the in-process decompression state once a batch is done.
+*/
+static void
+EndInflate(void)
+{
+#if defined(HAVE_ZLIB)
+    if (Inflating != NULL) {
+        inflateEnd(Inflating);
+        free(Inflating);
+        Inflating = NULL;
+    }
+#endif
+}
+
+
 /*
 **  Clean up the NNTP escapes from a line.
 */
@@ -212,6 +357,154 @@ Reject(const char *article, size_t length UNUSED, const char *reason,
 }
 
 
+/*
+**  Forget about an article of the streaming queue.
+*/
+static void
+StreamFree(STREAMART *sp)
+{
+    free(sp->MessageID);
+    free(sp->Wire);
+    free(sp->Article);
+}
+
+
+/*
+**  Read the reply to the oldest command awaiting one and act on it.  When
+**  CHECK gets a go-ahead, the article is sent with TAKETHIS and queued
+**  again, its reply coming after the ones of the commands already sent.
+**  Return false if the whole batch needs to be saved, as Process does.
+*/
+static bool
+StreamReply(void)
+{
+    STREAMART	*sp;
+    char	buff[SMBUF];
+    bool	ok = true;
+    int		code;
+
+    sp = &StreamQueue[StreamHead];
+    StreamHead = (StreamHead + 1) % STREAM_WINDOW;
+    StreamCount--;
+
+    if (fflush(ToServer) == EOF) {
+        syswarn("cant fflush after %s", sp->Sent ? "takethis" : "check");
+        StreamFree(sp);
+        return false;
+    }
+    if (fgets(buff, sizeof buff, FromServer) == NULL) {
+        if (ferror(FromServer))
+            syswarn("cannot fgets after %s", sp->Sent ? "takethis" : "check");
+        else
+            warn("unexpected EOF from server after %s",
+                 sp->Sent ? "takethis" : "check");
+        StreamFree(sp);
+        return false;
+    }
+    REMclean(buff);
+    code = isdigit((unsigned char) buff[0]) ? atoi(buff) : 0;
+
+    if (!sp->Sent) {
+        switch (code) {
+        default:
+            notice("unknown_reply after check %s", buff);
+            ok = false;
+            break;
+        case NNTP_FAIL_CHECK_DEFER:
+            ok = false;
+            break;
+        case NNTP_FAIL_CHECK_REFUSE:
+            if (logDuplicates)
+                notice("duplicate %s %s", sp->MessageID, sp->Path);
+            break;
+        case NNTP_OK_CHECK:
+            fprintf(ToServer, "takethis %s\r\n", sp->MessageID);
+            if (fwrite(sp->Wire, sp->WireLength, 1, ToServer) != 1) {
+                sysnotice("cant sendarticle");
+                StreamFree(sp);
+                return false;
+            }
+            sp->Sent = true;
+            StreamQueue[(StreamHead + StreamCount) % STREAM_WINDOW] = *sp;
+            StreamCount++;
+            return true;
+        }
+    } else {
+        switch (code) {
+        default:
+            notice("unknown_reply after takethis %s", buff);
+            ok = false;
+            break;
+        case NNTP_OK_TAKETHIS:
+            break;
+        case NNTP_FAIL_TAKETHIS_REJECT:
+            Reject(sp->Article, sp->Length, "rejected %s", buff);
+            break;
+        }
+    }
+    StreamFree(sp);
+    return ok;
+}
+
+
+/*
+**  Read the replies for all the articles still awaiting one.  Once one of
+**  them failed, the remaining replies are still read to keep in step with
+**  the server, unless the connection itself failed.
+*/
+static bool
+StreamDrain(void)
+{
+    bool ok = true;
+
+    while (StreamCount > 0) {
+        if (!StreamReply()) {
+            ok = false;
+            if (ferror(ToServer) || ferror(FromServer) || feof(FromServer)) {
+                while (StreamCount > 0) {
+                    StreamFree(&StreamQueue[StreamHead]);
+                    StreamHead = (StreamHead + 1) % STREAM_WINDOW;
+                    StreamCount--;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+
+/*
+**  Offer an article with CHECK without waiting for the reply, first making
+**  room in the queue if needed.  The message-ID and the wire-format article
+**  are taken over.
+*/
+static bool
+StreamOffer(char *msgid, char *wirefmt, size_t length, const char *article,
+            size_t artlen, const char *path)
+{
+    STREAMART	*sp;
+    bool	ok = true;
+
+    while (StreamCount == STREAM_WINDOW)
+        if (!StreamReply())
+            ok = false;
+
+    sp = &StreamQueue[(StreamHead + StreamCount) % STREAM_WINDOW];
+    sp->MessageID = msgid;
+    sp->Wire = wirefmt;
+    sp->WireLength = length;
+    sp->Article = xmalloc(artlen + 1);
+    memcpy(sp->Article, article, artlen + 1);
+    sp->Length = artlen;
+    strlcpy(sp->Path, path, sizeof(sp->Path));
+    sp->Sent = false;
+    StreamCount++;
+
+    fprintf(ToServer, "check %s\r\n", msgid);
+    return ok;
+}
+
+
 /*
 **  Process one article.  Return true if the article was okay; false if the
 **  whole batch needs to be saved (such as when the server goes down or if
@@ -229,6 +522,8 @@ Process(char *article, size_t artlen)
     char		buff[SMBUF];
     char		path[40];
 
+    path[0] = '\0';
+
     /* Empty article? */
     if (*article == '\0')
 	return true;
@@ -265,10 +560,12 @@ Process(char *article, size_t artlen)
 	return true;
     }
     msgid = xstrndup(id, p - id);
-    fprintf(ToServer, "ihave %s\r\n", msgid);
-    fflush(ToServer);
     if (UUCPHost)
         notice("offered %s %s", msgid, UUCPHost);
+    if (Streaming)
+        return StreamOffer(msgid, wirefmt, length, article, artlen, path);
+    fprintf(ToServer, "ihave %s\r\n", msgid);
+    fflush(ToServer);
     free(msgid);
 
     /* Get a reply, see if they want the article. */
@@ -298,7 +595,7 @@ Process(char *article, size_t artlen)
 	break;
     case NNTP_FAIL_IHAVE_REFUSE:
         if (logDuplicates) {
-            notice("duplicate %s %s", msgid, path);
+            notice("duplicate %.*s %s", (int) (p - id), id, path);
         }
         free(wirefmt);
 	return true;
@@ -373,7 +670,7 @@ ReadRemainder(int fd, char first, char second)
     skipnl = 0;
 
     /* Read the input, coverting line ends as we go if necessary. */
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    while ((n = ReadInput(fd, buf, sizeof(buf))) > 0) {
 	p = article + used;
 	for (i = 0; i < n; i++) {
 	    if (skipnl) {
@@ -437,7 +734,7 @@ ReadBytecount(int fd, int artsize)
        article into bad and then someone might reprocess it, leaving us with
        accepting the truncated version. */
     for (p = article, left = artsize; left; p += i, left -= i) {
-        i = read(fd, p, left);
+        i = ReadInput(fd, p, left);
         if (i <= 0) {
             warn("cannot read, wanted %d got %d", artsize, artsize - left);
             return true;
@@ -464,7 +761,7 @@ ReadLine(char *p, int size, int fd)
 
     /* Fill the buffer, a byte at a time. */
     for (save = p; size > 0; p++, size--) {
-	if (read(fd, p, 1) != 1) {
+	if (ReadInput(fd, p, 1) != 1) {
 	    *p = '\0';
             sysdie("cannot read first line, got %s", save);
 	}
@@ -499,7 +796,7 @@ UnpackOne(int *fdp, size_t *countp)
     *countp = 0;
     for (SawCunbatch = false, HadCount = false; ; ) {
 	/* Get the first character. */
-	if ((i = read(*fdp, &buff[0], 1)) < 0) {
+	if ((i = ReadInput(*fdp, &buff[0], 1)) < 0) {
             syswarn("cannot read first character");
 	    return false;
 	}
@@ -514,7 +811,7 @@ UnpackOne(int *fdp, size_t *countp)
 	    return HadCount ? false : ReadRemainder(*fdp, buff[0], '\0');
 
 	/* Get the second character. */
-	if ((i = read(*fdp, &buff[1], 1)) < 0) {
+	if ((i = ReadInput(*fdp, &buff[1], 1)) < 0) {
             syswarn("cannot read second character");
 	    return false;
 	}
@@ -525,6 +822,18 @@ UnpackOne(int *fdp, size_t *countp)
 	/* Check second magic character. */
 	/* gzipped ($1f$8b) or compressed ($1f$9d) */
 	if (gzip && ((buff[1] == (char)0x8b) || (buff[1] == (char)0x9d))) {
+            if (InflatingBatch()) {
+                warn("nested_cunbatch");
+                return false;
+            }
+#if defined(HAVE_ZLIB)
+            if (buff[1] == (char) 0x8b) {
+                if (!StartInflate(buff, 2))
+                    return false;
+                SawCunbatch = true;
+                continue;
+            }
+#endif
 	    cargv[0] = "gzip";
 	    cargv[1] = "-d";
 	    cargv[2] = NULL;
@@ -575,6 +884,21 @@ UnpackOne(int *fdp, size_t *countp)
 	    continue;
 	}
 
+        /* A gzip batch is unpacked in-process rather than with gunbatch, and
+           an unpacker cannot be run on what is already being unpacked. */
+        if (additionalUnpackers && InflatingBatch()) {
+            warn("nested_cunbatch");
+            return false;
+        }
+#if defined(HAVE_ZLIB)
+        if (additionalUnpackers && strcmp(buff, "#! gunbatch") == 0) {
+            if (!StartInflate(NULL, 0))
+                return false;
+            SawCunbatch = true;
+            continue;
+        }
+#endif
+
         if (additionalUnpackers) {
             cargv[0] = UNPACK;
             cargv[1] = NULL;
@@ -614,12 +938,11 @@ UnpackOne(int *fdp, size_t *countp)
 
 
 /*
-**  Read all articles in the spool directory and unpack them.  Print all
-**  errors with xperror as well as syslog, since we're probably being run
-**  interactively.
+**  Unpack all the spooled batches of the current directory which are not
+**  already being unpacked by another process.
 */
 static void
-Unspool(void)
+UnspoolFiles(void)
 {
     DIR	*dp;
     struct dirent       *ep;
@@ -630,12 +953,6 @@ Unspool(void)
     size_t		i;
     char                *uuhost;
 
-    message_handlers_die(2, message_log_stderr, message_log_syslog_err);
-    message_handlers_warn(2, message_log_stderr, message_log_syslog_err);
-
-    /* Go to the spool directory, get ready to scan it. */
-    if (chdir(innconf->pathincoming) < 0)
-        sysdie("cannot chdir to %s", innconf->pathincoming);
     if ((dp = opendir(".")) == NULL)
         sysdie("cannot open spool directory");
 
@@ -658,8 +975,11 @@ Unspool(void)
 	    continue;
 	}
 
-	/* Make sure multiple Unspools don't stomp on eachother. */
-	if (!inn_lock_file(fd, INN_LOCK_WRITE, 0)) {
+	/* Make sure multiple Unspools don't stomp on eachother.  The file
+           may also have been fully processed and removed by another one
+           between our open and our lock. */
+	if (!inn_lock_file(fd, INN_LOCK_WRITE, 0)
+            || fstat(fd, &Sb) < 0 || Sb.st_nlink == 0) {
 	    close(fd);
 	    continue;
 	}
@@ -676,6 +996,9 @@ Unspool(void)
 	    UUCPHost = hostname;
 	}
 	ok = UnpackOne(&fd, &i);
+        if (!StreamDrain())
+            ok = false;
+        EndInflate();
 	WaitForChildren(i);
 	UUCPHost = uuhost;
 
@@ -691,6 +1014,50 @@ Unspool(void)
 	close(fd);
     }
     closedir(dp);
+}
+
+
+/*
+**  Read all articles in the spool directory and unpack them.  Print all
+**  errors with xperror as well as syslog, since we're probably being run
+**  interactively.  With more than one job, each additional one is a child
+**  process with its own connection to the server, and the files are shared
+**  out through their locks.
+*/
+static void
+Unspool(void)
+{
+    pid_t	*pids;
+    int		i, n;
+
+    message_handlers_die(2, message_log_stderr, message_log_syslog_err);
+    message_handlers_warn(2, message_log_stderr, message_log_syslog_err);
+
+    /* Go to the spool directory, get ready to scan it. */
+    if (chdir(innconf->pathincoming) < 0)
+        sysdie("cannot chdir to %s", innconf->pathincoming);
+
+    pids = xcalloc(Jobs, sizeof(pid_t));
+    for (n = 0; n < Jobs - 1; n++) {
+        pids[n] = fork();
+        if (pids[n] < 0) {
+            syswarn("cannot fork unspool job");
+            break;
+        }
+        if (pids[n] == 0) {
+            fclose(FromServer);
+            fclose(ToServer);
+            OpenServer('U', -1);
+            UnspoolFiles();
+            CloseServer();
+            exit(0);
+        }
+    }
+    UnspoolFiles();
+    for (i = 0; i < n; i++)
+        if (waitpid(pids[i], NULL, 0) < 0 && errno != ECHILD)
+            syswarn("cannot wait for unspool job %ld", (long) pids[i]);
+    free(pids);
 
     message_handlers_die(1, message_log_syslog_err);
     message_handlers_warn(1, message_log_syslog_err);
@@ -812,14 +1179,73 @@ CantConnect(char *buff, int mode, int fd)
 }
 
 
+/*
+**  Open the link to the server, and ask for streaming if wanted.  If the
+**  server does not allow it, articles are offered with IHAVE.
+*/
+static void
+OpenServer(int mode, int fd)
+{
+    char	buff[SMBUF];
+
+    if (remoteServer != NULL) {
+	if (!OpenRemote(remoteServer, Port, buff, sizeof(buff)))
+		CantConnect(buff,mode,fd);
+    } else if (innconf->nnrpdposthost != NULL) {
+	if (!OpenRemote(innconf->nnrpdposthost,
+                        (Port != NNTP_PORT) ? (unsigned) Port : innconf->nnrpdpostport,
+                        buff, sizeof(buff)))
+		CantConnect(buff, mode, fd);
+    }
+    else {
+	if (NNTPlocalopen(&FromServer, &ToServer, buff, sizeof(buff)) < 0) {
+	    /* If server rejected us, no point in continuing. */
+	    if (buff[0])
+		CantConnect(buff, mode, fd);
+	    if (!OpenRemote(NULL, (Port != NNTP_PORT) ? (unsigned) Port : innconf->port,
+                            buff, sizeof(buff)))
+			CantConnect(buff, mode, fd);
+	}
+    }
+    fdflag_close_exec(fileno(FromServer), true);
+    fdflag_close_exec(fileno(ToServer), true);
+
+    Streaming = false;
+    if (WantStreaming) {
+        fprintf(ToServer, "mode stream\r\n");
+        if (fflush(ToServer) == EOF
+            || fgets(buff, sizeof buff, FromServer) == NULL) {
+            buff[0] = '\0';
+            CantConnect(buff, mode, fd);
+        }
+        Streaming = (atoi(buff) == NNTP_OK_STREAM);
+        if (!Streaming)
+            notice("streaming refused %s, using ihave", REMclean(buff));
+    }
+}
+
+
+/*
+**  Tell the server we're quitting, get his okay message.
+*/
+static void
+CloseServer(void)
+{
+    char	buff[SMBUF];
+
+    fprintf(ToServer, "quit\r\n");
+    fflush(ToServer);
+    fgets(buff, sizeof buff, FromServer);
+}
+
+
 int main(int ac, char *av[])
 {
     int		fd;
     int		i;
     size_t	count;
     int		mode;
-    char	buff[SMBUF];
-    int         port = NNTP_PORT;
+    bool	ok;
 
     /* First thing, set up logging and our identity. */
     openlog("rnews", L_OPENLOG_FLAGS, LOG_INN_PROG);
@@ -873,14 +1299,14 @@ int main(int ac, char *av[])
         exit(1);
     UUCPHost = getenv(INN_ENV_UUCPHOST);
     PathBadNews = concatpath(innconf->pathincoming, INN_PATH_BADNEWS);
-    port = innconf->nnrpdpostport;
+    Port = innconf->nnrpdpostport;
 
     umask(NEWSUMASK);
 
     /* Parse JCL. */
     fd = STDIN_FILENO;
     mode = '\0';
-    while ((i = getopt(ac, av, "abdh:NP:r:S:Uv")) != EOF)
+    while ((i = getopt(ac, av, "abdh:j:NP:r:sS:Uv")) != EOF)
 	switch (i) {
 	default:
 	    die("usage error");
@@ -897,12 +1323,17 @@ int main(int ac, char *av[])
 	case 'h':
 	    UUCPHost = *optarg ? optarg : NULL;
 	    break;
+        case 'j':
+            Jobs = atoi(optarg);
+            if (Jobs < 1)
+                die("usage error");
+            break;
 	case 'N':
 	case 'U':
 	    mode = i;
 	    break;
 	case 'P':
-	    port = atoi(optarg);
+	    Port = atoi(optarg);
 	    break;
 	case 'v':
 	    Verbose = true;
@@ -911,6 +1342,9 @@ int main(int ac, char *av[])
 	case 'S':
 	    remoteServer = optarg;
 	    break;
+        case 's':
+            WantStreaming = true;
+            break;
 	}
     ac -= optind;
     av += optind;
@@ -933,33 +1367,17 @@ int main(int ac, char *av[])
     }
 
     /* Open the link to the server. */
-    if (remoteServer != NULL) {
-	if (!OpenRemote(remoteServer, port, buff, sizeof(buff)))
-		CantConnect(buff,mode,fd);
-    } else if (innconf->nnrpdposthost != NULL) {
-	if (!OpenRemote(innconf->nnrpdposthost,
-                        (port != NNTP_PORT) ? (unsigned) port : innconf->nnrpdpostport,
-                        buff, sizeof(buff)))
-		CantConnect(buff, mode, fd);
-    }
-    else {
-	if (NNTPlocalopen(&FromServer, &ToServer, buff, sizeof(buff)) < 0) {
-	    /* If server rejected us, no point in continuing. */
-	    if (buff[0])
-		CantConnect(buff, mode, fd);
-	    if (!OpenRemote(NULL, (port != NNTP_PORT) ? (unsigned) port : innconf->port,
-                            buff, sizeof(buff)))
-			CantConnect(buff, mode, fd);
-	}
-    }
-    fdflag_close_exec(fileno(FromServer), true);
-    fdflag_close_exec(fileno(ToServer), true);
+    OpenServer(mode, fd);
 
     /* Execute the command. */
     if (mode == 'U')
 	Unspool();
     else {
-	if (!UnpackOne(&fd, &count)) {
+	ok = UnpackOne(&fd, &count);
+        if (!StreamDrain())
+            ok = false;
+        EndInflate();
+	if (!ok) {
 	    lseek(fd, 0, 0);
 	    Spool(fd, mode);
 	}
@@ -967,10 +1385,7 @@ int main(int ac, char *av[])
 	WaitForChildren(count);
     }
 
-    /* Tell the server we're quitting, get his okay message. */
-    fprintf(ToServer, "quit\r\n");
-    fflush(ToServer);
-    fgets(buff, sizeof buff, FromServer);
+    CloseServer();
 
     /* Return the appropriate status. */
     exit(0);
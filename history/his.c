@@ -55,39 +55,94 @@
 #include "hisinterface.h"
 #include "hismethods.h"
 
+/*
+**  The history cache is set-associative: the low bits of the hash select a
+**  set of HIS_CACHE_WAYS entries, and within a set entries are replaced
+**  using the clock algorithm.  Each set is independent of the others, so a
+**  lookup or an insertion only ever touches one set.
+*/
+#define HIS_CACHE_WAYS	8
+
 struct hiscache {
-    HASH Hash;	/* Hash value of the message-id using Hash() */
-    bool Found;	/* Whether this entry is in the dbz file yet */
+    HASH Hash;		/* Hash value of the message-id using Hash() */
+    bool Found;		/* Whether this entry is in the dbz file yet */
+    bool Used;		/* Whether this entry holds anything */
+    bool Referenced;	/* Whether this entry was hit since the hand passed */
 };
 
 struct history {
     struct hismethod *methods;
     void *sub;
     struct hiscache *cache;
-    size_t cachesize;
+    size_t cachesize;		/* Total number of entries */
+    size_t cacheways;		/* Entries per set */
+    size_t cachesets;		/* Number of sets */
+    size_t cacheused;		/* Entries holding a hash */
+    unsigned char *cachehand;	/* Clock hand of each set */
     const char *error;
     struct histstats stats;
 };
 
 enum HISRESULT {HIScachehit, HIScachemiss, HIScachedne};
 
-static const struct histstats nullhist = { 0, 0, 0, 0 };
+static const struct histstats nullhist = { 0, 0, 0, 0, 0, 0, 0 };
 
 /*
-** Put an entry into the history cache 
+** Return the index of the set in which MessageID belongs.
+*/
+static size_t
+his_cacheset(struct history *h, HASH MessageID)
+{
+    unsigned int loc;
+
+    memcpy(&loc, ((char *)&MessageID) + (sizeof(HASH) - sizeof(loc)),
+	   sizeof(loc));
+    return loc % h->cachesets;
+}
+
+/*
+** Put an entry into the history cache.  If the set is full, the clock hand
+** sweeps over it, giving a second chance to referenced entries, and the
+** first unreferenced entry is replaced.
 */
 static void
 his_cacheadd(struct history *h, HASH MessageID, bool Found)
 {
-    unsigned int  i, loc;
+    struct hiscache *set, *entry;
+    size_t i, n;
 
     his_logger("HIScacheadd begin", S_HIScacheadd);
     if (h->cache != NULL) {
-	memcpy(&loc, ((char *)&MessageID) + (sizeof(HASH) - sizeof(loc)),
-	       sizeof(loc));
-	i = loc % h->cachesize;
-	memcpy((char *)&h->cache[i].Hash, (char *)&MessageID, sizeof(HASH));
-	h->cache[i].Found = Found;
+	n = his_cacheset(h, MessageID);
+	set = &h->cache[n * h->cacheways];
+	entry = NULL;
+	for (i = 0; i < h->cacheways; i++) {
+	    if (!set[i].Used) {
+		if (entry == NULL)
+		    entry = &set[i];
+	    } else if (memcmp(&set[i].Hash, &MessageID, sizeof(HASH)) == 0) {
+		set[i].Found = Found;
+		set[i].Referenced = true;
+		his_logger("HIScacheadd end", S_HIScacheadd);
+		return;
+	    }
+	}
+	if (entry == NULL) {
+	    i = h->cachehand[n];
+	    while (set[i].Referenced) {
+		set[i].Referenced = false;
+		i = (i + 1) % h->cacheways;
+	    }
+	    entry = &set[i];
+	    h->cachehand[n] = (i + 1) % h->cacheways;
+	    h->stats.evicted++;
+	} else {
+	    h->cacheused++;
+	}
+	memcpy(&entry->Hash, &MessageID, sizeof(HASH));
+	entry->Found = Found;
+	entry->Used = true;
+	entry->Referenced = false;
     }
     his_logger("HIScacheadd end", S_HIScacheadd);
 }
@@ -98,24 +153,23 @@ his_cacheadd(struct history *h, HASH MessageID, bool Found)
 static enum HISRESULT
 his_cachelookup(struct history *h, HASH MessageID)
 {
-    unsigned int i, loc;
+    struct hiscache *set;
+    size_t i;
 
     if (h->cache == NULL)
 	return HIScachedne;
     his_logger("HIScachelookup begin", S_HIScachelookup);
-    memcpy(&loc, ((char *)&MessageID) + (sizeof(HASH) - sizeof(loc)), sizeof(loc));
-    i = loc % h->cachesize;
-    if (memcmp((char *)&h->cache[i].Hash, (char *)&MessageID, sizeof(HASH)) == 0) {
-	his_logger("HIScachelookup end", S_HIScachelookup);
-        if (h->cache[i].Found) {
-            return HIScachehit;
-        } else {
-            return HIScachemiss;
-        }
-    } else {
-	his_logger("HIScachelookup end", S_HIScachelookup);
-        return HIScachedne;
+    set = &h->cache[his_cacheset(h, MessageID) * h->cacheways];
+    for (i = 0; i < h->cacheways; i++) {
+	if (set[i].Used
+	    && memcmp(&set[i].Hash, &MessageID, sizeof(HASH)) == 0) {
+	    set[i].Referenced = true;
+	    his_logger("HIScachelookup end", S_HIScachelookup);
+	    return set[i].Found ? HIScachehit : HIScachemiss;
+	}
     }
+    his_logger("HIScachelookup end", S_HIScachelookup);
+    return HIScachedne;
 }
 
 /*
@@ -156,6 +210,10 @@ HISopen(const char *path, const char *method, int flags)
     h->cache = NULL;
     h->error = NULL;
     h->cachesize = 0;
+    h->cacheways = 0;
+    h->cachesets = 0;
+    h->cacheused = 0;
+    h->cachehand = NULL;
     h->stats = nullhist;
     h->sub = (*h->methods->open)(path, flags, h);
     if (h->sub == NULL) {
@@ -185,6 +243,7 @@ HISclose(struct history *h)
     r = (*h->methods->close)(h->sub);
     if (h->cache) {
 	free(h->cache);
+	free(h->cachehand);
 	h->cache = NULL;
     }
     if (h->error) {
@@ -256,6 +315,70 @@ HIScheck(struct history *h, const char *key)
     return r;
 }
 
+/*
+**  Check whether each of count keys is in the history, setting found[i]
+**  for keys[i].  The cache answers what it can, like for HIScheck, and the
+**  other keys are looked up by the method all at once.
+*/
+bool
+HIScheckbatch(struct history *h, const char *const *keys, size_t count,
+	      bool *found)
+{
+    bool r = true;
+    HASH *hashes;
+    const char **misses;
+    size_t *where;
+    bool *missfound;
+    size_t i, n;
+
+    if (his_checknull(h))
+	return false;
+    TMRstart(TMR_HISHAVE);
+    hashes = xmalloc(count * sizeof(HASH));
+    misses = xmalloc(count * sizeof(char *));
+    where = xmalloc(count * sizeof(size_t));
+    missfound = xmalloc(count * sizeof(bool));
+    HashMessageIDs(keys, count, hashes);
+    for (i = 0, n = 0; i < count; i++) {
+	switch (his_cachelookup(h, hashes[i])) {
+	case HIScachehit:
+	    h->stats.hitpos++;
+	    found[i] = true;
+	    break;
+
+	case HIScachemiss:
+	    h->stats.hitneg++;
+	    found[i] = false;
+	    break;
+
+	case HIScachedne:
+	    misses[n] = keys[i];
+	    where[n] = i;
+	    n++;
+	    break;
+	}
+    }
+    if (n > 0) {
+	r = (*h->methods->checkbatch)(h->sub, misses, n, missfound);
+	for (i = 0; i < n; i++) {
+	    found[where[i]] = r && missfound[i];
+	    if (!r)
+		continue;
+	    his_cacheadd(h, hashes[where[i]], missfound[i]);
+	    if (missfound[i])
+		h->stats.misses++;
+	    else
+		h->stats.dne++;
+	}
+    }
+    free(hashes);
+    free(misses);
+    free(where);
+    free(missfound);
+    TMRstop(TMR_HISHAVE);
+    return r;
+}
+
 bool
 HISwrite(struct history *h, const char *key, time_t arrived,
 	 time_t posted, time_t expires, const TOKEN *token)
@@ -347,21 +470,32 @@ HISexpire(struct history *h, const char *path, const char *reason,
 void
 HISsetcache(struct history *h, size_t size)
 {
+    size_t entries;
+
     if (h == NULL)
 	return;
     if (h->cache) {
 	free(h->cache);
+	free(h->cachehand);
 	h->cache = NULL;
+	h->cachehand = NULL;
     }
-    h->cachesize = size / sizeof(struct hiscache);
-    if (h->cachesize != 0)
+    entries = size / sizeof(struct hiscache);
+    h->cacheways = entries < HIS_CACHE_WAYS ? entries : HIS_CACHE_WAYS;
+    h->cachesets = h->cacheways == 0 ? 0 : entries / h->cacheways;
+    h->cachesize = h->cachesets * h->cacheways;
+    h->cacheused = 0;
+    if (h->cachesize != 0) {
 	h->cache = xcalloc(h->cachesize, sizeof(struct hiscache));
+	h->cachehand = xcalloc(h->cachesets, 1);
+    }
     h->stats = nullhist;
 }
 
 
 /*
-**  return current history cache stats and zero the counters
+**  return current history cache stats and zero the counters (the size and
+**  the number of used entries describe the cache and are never zeroed)
 */
 struct histstats
 HISstats(struct history *h)
@@ -371,6 +505,8 @@ HISstats(struct history *h)
     if (h == NULL)
 	return nullhist;
     r = h->stats;
+    r.size = h->cachesize;
+    r.used = h->cacheused;
     h->stats = nullhist;
     return r;
 }
@@ -20,6 +20,7 @@ typedef struct hismethod {
     bool (*lookup)(void *, const char *, time_t *, time_t *, time_t *,
 		   struct token *);
     bool (*check)(void *, const char *);
+    bool (*checkbatch)(void *, const char *const *, size_t, bool *);
     bool (*write)(void *, const char *, time_t, time_t, time_t,
 		  const struct token *);
     bool (*replace)(void *, const char *, time_t, time_t, time_t,
@@ -0,0 +1,88 @@
+/* This file is automatically generated by buildconfig. */
+
+#include "hisinterface.h"
+#include "hismethods.h"
+#include "hisremote/hisremote.h"
+#include "hisseg/hisseg.h"
+#include "hisshard/hisshard.h"
+#include "hisv6/hisv6.h"
+#include "hisv7/hisv7.h"
+
+HIS_METHOD his_methods[5] = {
+{
+    "hisremote",
+    hisremote_open,
+    hisremote_close,
+    hisremote_sync,
+    hisremote_lookup,
+    hisremote_check,
+    hisremote_checkbatch,
+    hisremote_write,
+    hisremote_replace,
+    hisremote_expire,
+    hisremote_walk,
+    hisremote_remember,
+    hisremote_ctl
+},
+{
+    "hisseg",
+    hisseg_open,
+    hisseg_close,
+    hisseg_sync,
+    hisseg_lookup,
+    hisseg_check,
+    hisseg_checkbatch,
+    hisseg_write,
+    hisseg_replace,
+    hisseg_expire,
+    hisseg_walk,
+    hisseg_remember,
+    hisseg_ctl
+},
+{
+    "hisshard",
+    hisshard_open,
+    hisshard_close,
+    hisshard_sync,
+    hisshard_lookup,
+    hisshard_check,
+    hisshard_checkbatch,
+    hisshard_write,
+    hisshard_replace,
+    hisshard_expire,
+    hisshard_walk,
+    hisshard_remember,
+    hisshard_ctl
+},
+{
+    "hisv6",
+    hisv6_open,
+    hisv6_close,
+    hisv6_sync,
+    hisv6_lookup,
+    hisv6_check,
+    hisv6_checkbatch,
+    hisv6_write,
+    hisv6_replace,
+    hisv6_expire,
+    hisv6_walk,
+    hisv6_remember,
+    hisv6_ctl
+},
+{
+    "hisv7",
+    hisv7_open,
+    hisv7_close,
+    hisv7_sync,
+    hisv7_lookup,
+    hisv7_check,
+    hisv7_checkbatch,
+    hisv7_write,
+    hisv7_replace,
+    hisv7_expire,
+    hisv7_walk,
+    hisv7_remember,
+    hisv7_ctl
+}
+};
+
@@ -0,0 +1,4 @@
+hisremote/hisserver: hisremote/hisserver.o hisremote/hisserver.lo \
+	    libinnhist.$(EXTLIB)
+	$(LIBLD) $(LDFLAGS) -o $@ hisremote/hisserver.lo libinnhist.$(EXTLIB) \
+	    $(LIBSTORAGE) $(LIBINN) $(STORAGE_LIBS) $(LIBS)
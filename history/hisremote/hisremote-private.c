@@ -0,0 +1,157 @@
+/*
+**  Encoding of the messages between hisserver and the hisremote method.
+**
+**  See hisremote-private.h for the protocol.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "hisremote-private.h"
+#include "inn/buffer.h"
+
+
+void
+hisremote_pack_u8(struct buffer *buffer, unsigned int value)
+{
+    unsigned char byte = value;
+
+    buffer_append(buffer, (char *) &byte, 1);
+}
+
+
+void
+hisremote_pack_u16(struct buffer *buffer, unsigned int value)
+{
+    unsigned char bytes[2];
+
+    bytes[0] = (value >> 8) & 0xff;
+    bytes[1] = value & 0xff;
+    buffer_append(buffer, (char *) bytes, sizeof(bytes));
+}
+
+
+void
+hisremote_pack_u32(struct buffer *buffer, uint32_t value)
+{
+    unsigned char bytes[4];
+    int i;
+
+    for (i = 3; i >= 0; i--, value >>= 8)
+        bytes[i] = value & 0xff;
+    buffer_append(buffer, (char *) bytes, sizeof(bytes));
+}
+
+
+void
+hisremote_pack_u64(struct buffer *buffer, uint64_t value)
+{
+    unsigned char bytes[8];
+    int i;
+
+    for (i = 7; i >= 0; i--, value >>= 8)
+        bytes[i] = value & 0xff;
+    buffer_append(buffer, (char *) bytes, sizeof(bytes));
+}
+
+
+bool
+hisremote_unpack(struct buffer *buffer, void *data, size_t count)
+{
+    if (count > buffer->left)
+        return false;
+    if (data != NULL && count > 0)
+        memcpy(data, buffer->data + buffer->used, count);
+    buffer->used += count;
+    buffer->left -= count;
+    return true;
+}
+
+
+/*
+**  Take an integer of length bytes from the buffer.
+*/
+static bool
+unpack_integer(struct buffer *buffer, size_t length, uint64_t *value)
+{
+    const unsigned char *bytes;
+    size_t i;
+
+    if (length > buffer->left)
+        return false;
+    bytes = (const unsigned char *) buffer->data + buffer->used;
+    *value = 0;
+    for (i = 0; i < length; i++)
+        *value = (*value << 8) | bytes[i];
+    buffer->used += length;
+    buffer->left -= length;
+    return true;
+}
+
+
+bool
+hisremote_unpack_u8(struct buffer *buffer, unsigned int *value)
+{
+    uint64_t n;
+
+    if (!unpack_integer(buffer, 1, &n))
+        return false;
+    *value = n;
+    return true;
+}
+
+
+bool
+hisremote_unpack_u16(struct buffer *buffer, unsigned int *value)
+{
+    uint64_t n;
+
+    if (!unpack_integer(buffer, 2, &n))
+        return false;
+    *value = n;
+    return true;
+}
+
+
+bool
+hisremote_unpack_u32(struct buffer *buffer, uint32_t *value)
+{
+    uint64_t n;
+
+    if (!unpack_integer(buffer, 4, &n))
+        return false;
+    *value = n;
+    return true;
+}
+
+
+bool
+hisremote_unpack_u64(struct buffer *buffer, uint64_t *value)
+{
+    return unpack_integer(buffer, 8, value);
+}
+
+
+size_t
+hisremote_start(struct buffer *buffer, unsigned int code)
+{
+    size_t start = buffer->left;
+
+    hisremote_pack_u32(buffer, 0);
+    hisremote_pack_u8(buffer, code);
+    return start;
+}
+
+
+void
+hisremote_finish(struct buffer *buffer, size_t start)
+{
+    unsigned char *bytes;
+    uint32_t length;
+    int i;
+
+    length = buffer->left - start;
+    bytes = (unsigned char *) buffer->data + buffer->used + start;
+    for (i = 3; i >= 0; i--, length >>= 8)
+        bytes[i] = length & 0xff;
+}
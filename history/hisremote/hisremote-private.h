@@ -0,0 +1,190 @@
+#ifndef HISREMOTE_PRIVATE_H
+#define HISREMOTE_PRIVATE_H 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/buffer.h"
+
+#define HISREMOTE_PROTOCOL_VERSION      1
+
+#define HISREMOTE_SERVER_PIDFILE        "hisserver.pid"
+
+/* The most keys a single request may carry. */
+#define HISREMOTE_BATCH                 1024
+
+/* The largest request the server accepts. */
+#define HISREMOTE_MAXREQUEST            0x100000
+
+/* This needs to stay in sync with the dispatch array in hisserver.c. */
+enum {
+    request_hello,
+    request_lookup,
+    request_check,
+
+    count_request_codes
+};
+
+enum {
+    response_ok                         = 0x00,
+    response_lookup,
+    response_check,
+
+    response_error                      = 0x80,
+
+    response_fatal                      = 0xC0,
+    response_bad_request,
+    response_oversized,
+    response_wrong_state,
+    response_wrong_version
+};
+
+enum {
+    lookup_found                        = 0x01,
+    lookup_token                        = 0x02
+};
+
+BEGIN_DECLS
+
+/* Append integers in network byte order to a buffer. */
+extern void hisremote_pack_u8(struct buffer *, unsigned int);
+extern void hisremote_pack_u16(struct buffer *, unsigned int);
+extern void hisremote_pack_u32(struct buffer *, uint32_t);
+extern void hisremote_pack_u64(struct buffer *, uint64_t);
+
+/* Take integers in network byte order from the unused part of a buffer.
+   Return false if there aren't enough bytes left. */
+extern bool hisremote_unpack_u8(struct buffer *, unsigned int *);
+extern bool hisremote_unpack_u16(struct buffer *, unsigned int *);
+extern bool hisremote_unpack_u32(struct buffer *, uint32_t *);
+extern bool hisremote_unpack_u64(struct buffer *, uint64_t *);
+
+/* Take count bytes from a buffer, copying them to data if it isn't NULL. */
+extern bool hisremote_unpack(struct buffer *, void *data, size_t count);
+
+/* Start a message with the given code at the end of the data in a buffer,
+   returning where it starts, and fill in its length once complete. */
+extern size_t hisremote_start(struct buffer *, unsigned int code);
+extern void hisremote_finish(struct buffer *, size_t start);
+
+END_DECLS
+
+#endif /* ! HISREMOTE_PRIVATE_H */
+
+
+/****************************************************************************
+
+hisserver protocol version 1
+
+The protocol is binary and uses no alignment padding anywhere.  Since the
+server and its clients are usually on different machines, all integer
+values are in network byte order.  This description uses "u8", "u16", etc.
+for unsigned integer values.  Repeat counts are given in brackets.  Braces
+specify a group of fields to be repeated.
+
+Each request starts with a u32 specifying the total length in bytes
+(including the length itself) and a u8 containing the request code.  Each
+response starts the same way with a response code.
+
+The server sends exactly one response for each received request, in the
+order of the requests, so a client may send several requests before reading
+the responses.
+
+Success responses use codes less than 0x80.
+Error responses use codes from 0x80 and up.
+Fatal error responses use codes from 0xC0 and up.
+The server closes the connection after sending a fatal error response.
+
+
+=== request formats ===
+
+request_hello
+    u32 length
+    u8 code
+    u32 version
+
+This must be sent as the first (and only the first) request.  The version
+field specifies the expected protocol version.  Returns response_ok.
+
+
+request_lookup
+    u32 length
+    u8 code
+    u16 count
+    { u8 msgid_len
+      u8 msgid[msgid_len] } [count]
+
+Looks up count message-IDs, at most HISREMOTE_BATCH.  Returns
+response_lookup.
+
+
+request_check
+    u32 length
+    u8 code
+    u16 count
+    { u8 msgid_len
+      u8 msgid[msgid_len] } [count]
+
+Checks whether count message-IDs, at most HISREMOTE_BATCH, are in the
+history.  Returns response_check.
+
+
+=== response formats ===
+
+response_ok
+    u32 length
+    u8 code
+
+The generic success response.
+
+
+response_lookup
+    u32 length
+    u8 code
+    u16 count
+    { u8 flags
+      u64 arrived           (if flags & lookup_found)
+      u64 posted            (if flags & lookup_found)
+      u64 expires           (if flags & lookup_found)
+      u8 token[18] }        (if flags & lookup_token)
+      [count]
+
+Returned from request_lookup, one entry per message-ID in the order of the
+request.  lookup_token is only set along with lookup_found.
+
+
+response_check
+    u32 length
+    u8 code
+    u16 count
+    u8 found[count]
+
+Returned from request_check, one byte per message-ID in the order of the
+request, 1 if it is in the history and 0 otherwise.
+
+
+response_error
+
+The history couldn't be read.
+
+
+response_bad_request
+
+The request was malformed.
+
+
+response_oversized
+
+The request was larger than HISREMOTE_MAXREQUEST.
+
+
+response_wrong_state
+
+The first request wasn't request_hello, or a later one was.
+
+
+response_wrong_version
+
+The server doesn't speak the protocol version the client asked for.
+
+****************************************************************************/
@@ -0,0 +1,478 @@
+/*
+**  Remote history implementation against the history API.
+**
+**  The history is read from hisserver on another machine, which answers
+**  lookups and checks from its own history.  Several reader machines can
+**  thus share one history kept by the machine which receives the articles,
+**  without copying it around or reading it over NFS.  The history can only
+**  be read this way:  it is written and expired on the machine of the
+**  server with its own method.
+**
+**  Requests of several message-IDs are sent at once by HIScheckbatch, and
+**  when there are more than fit in one request, all of them are sent before
+**  reading the responses.  If the connection to the server breaks, it is
+**  opened again once, so that the server can be restarted.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/socket.h"
+#include <errno.h>
+#include "hisinterface.h"
+#include "hisremote.h"
+#include "hisremote-private.h"
+#include "inn/buffer.h"
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/network.h"
+#include "inn/storage.h"
+
+/* How long to wait for the server, in seconds. */
+#define HISREMOTE_TIMEOUT       30
+
+struct hisremote {
+    char *path;
+    int flags;
+    struct history *history;
+    socket_type fd;
+    struct buffer *request;
+    struct buffer *response;
+};
+
+
+/*
+**  set error status to that indicated by s; doesn't copy the string,
+**  assumes the caller did that for us
+*/
+static void
+hisremote_seterror(struct hisremote *h, const char *s)
+{
+    his_seterror(h->history, s);
+}
+
+
+/*
+**  Close the connection to the server.
+*/
+static void
+hisremote_disconnect(struct hisremote *h)
+{
+    if (h->fd != INVALID_SOCKET) {
+        socket_close(h->fd);
+        h->fd = INVALID_SOCKET;
+    }
+}
+
+
+/*
+**  Send the requests in the request buffer.  Closes the connection on
+**  failure.
+*/
+static bool
+hisremote_send(struct hisremote *h)
+{
+    bool r;
+
+    r = network_write(h->fd, h->request->data + h->request->used,
+                      h->request->left, HISREMOTE_TIMEOUT);
+    buffer_set(h->request, NULL, 0);
+    if (!r) {
+        hisremote_seterror(h, concat("can't write to hisserver ",
+                                     socket_strerror(socket_errno), NULL));
+        hisremote_disconnect(h);
+    }
+    return r;
+}
+
+
+/*
+**  Read the next response into the response buffer, positioned after its
+**  code, and check that its code is the expected one.  Closes the
+**  connection on failure.
+*/
+static bool
+hisremote_receive(struct hisremote *h, unsigned int expected)
+{
+    struct buffer *response = h->response;
+    unsigned char bytes[4];
+    uint32_t length;
+    unsigned int code;
+
+    if (!network_read(h->fd, bytes, sizeof(bytes), HISREMOTE_TIMEOUT)) {
+        hisremote_seterror(h, concat("can't read from hisserver ",
+                                     socket_strerror(socket_errno), NULL));
+        hisremote_disconnect(h);
+        return false;
+    }
+    buffer_set(response, (char *) bytes, sizeof(bytes));
+    hisremote_unpack_u32(response, &length);
+    if (length < 5 || length > HISREMOTE_MAXREQUEST) {
+        hisremote_seterror(h, concat("bad response from hisserver", NULL));
+        hisremote_disconnect(h);
+        return false;
+    }
+    buffer_resize(response, length);
+    if (!network_read(h->fd, response->data + sizeof(bytes),
+                      length - sizeof(bytes), HISREMOTE_TIMEOUT)) {
+        hisremote_seterror(h, concat("can't read from hisserver ",
+                                     socket_strerror(socket_errno), NULL));
+        hisremote_disconnect(h);
+        return false;
+    }
+    response->left = length - sizeof(bytes);
+    hisremote_unpack_u8(response, &code);
+    if (code != expected) {
+        if (code == response_error)
+            hisremote_seterror(h, concat("hisserver can't read history",
+                                         NULL));
+        else
+            hisremote_seterror(h, concat("unexpected response from",
+                                         " hisserver", NULL));
+        hisremote_disconnect(h);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  Connect to the server and introduce ourselves.
+*/
+static bool
+hisremote_connect(struct hisremote *h)
+{
+    size_t start;
+
+    if (innconf == NULL || innconf->hisserver == NULL) {
+        hisremote_seterror(h, concat("hisserver not set for ", h->path,
+                                     NULL));
+        return false;
+    }
+    h->fd = network_connect_host(innconf->hisserver, innconf->hisserverport,
+                                 NULL, HISREMOTE_TIMEOUT);
+    if (h->fd == INVALID_SOCKET) {
+        hisremote_seterror(h, concat("can't connect to hisserver ",
+                                     innconf->hisserver, " ",
+                                     socket_strerror(socket_errno), NULL));
+        return false;
+    }
+    start = hisremote_start(h->request, request_hello);
+    hisremote_pack_u32(h->request, HISREMOTE_PROTOCOL_VERSION);
+    hisremote_finish(h->request, start);
+    return hisremote_send(h) && hisremote_receive(h, response_ok);
+}
+
+
+/*
+**  Add requests of the given code for count keys to the request buffer, as
+**  many as needed to keep each of them under HISREMOTE_BATCH keys, and send
+**  them all at once.  A message-ID too long for the protocol can't be in
+**  the history, so an empty one is sent in its place.
+*/
+static bool
+hisremote_request(struct hisremote *h, unsigned int code,
+                  const char *const *keys, size_t count)
+{
+    size_t i, j, n, start, length;
+
+    if (h->fd == INVALID_SOCKET && !hisremote_connect(h))
+        return false;
+    for (i = 0; i < count; i += n) {
+        n = (count - i > HISREMOTE_BATCH) ? HISREMOTE_BATCH : count - i;
+        start = hisremote_start(h->request, code);
+        hisremote_pack_u16(h->request, n);
+        for (j = i; j < i + n; j++) {
+            length = strlen(keys[j]);
+            if (length > 255)
+                length = 0;
+            hisremote_pack_u8(h->request, length);
+            buffer_append(h->request, keys[j], length);
+        }
+        hisremote_finish(h->request, start);
+    }
+    return hisremote_send(h);
+}
+
+
+/*
+**  Check count keys; the answers are stored in found.  Returns false if the
+**  server couldn't be asked.
+*/
+static bool
+hisremote_checkkeys(struct hisremote *h, const char *const *keys,
+                    size_t count, bool *found)
+{
+    unsigned int n, value, tries;
+    size_t i, j;
+
+    for (tries = 0; tries < 2; tries++) {
+        if (!hisremote_request(h, request_check, keys, count))
+            continue;
+        for (i = 0; i < count; i += n) {
+            if (!hisremote_receive(h, response_check))
+                break;
+            if (!hisremote_unpack_u16(h->response, &n) || n == 0
+                || n > count - i) {
+                hisremote_seterror(h, concat("bad response from hisserver",
+                                             NULL));
+                hisremote_disconnect(h);
+                break;
+            }
+            for (j = i; j < i + n; j++) {
+                if (!hisremote_unpack_u8(h->response, &value))
+                    value = 0;
+                found[j] = (value != 0);
+            }
+        }
+        if (i >= count)
+            return true;
+    }
+    return false;
+}
+
+
+/*
+**  dispose (and clean up) an existing history structure
+*/
+static bool
+hisremote_dispose(struct hisremote *h)
+{
+    hisremote_disconnect(h);
+    buffer_free(h->request);
+    buffer_free(h->response);
+    free(h->path);
+    free(h);
+    return true;
+}
+
+
+/*
+**  open the history database identified by path in mode flags
+*/
+void *
+hisremote_open(const char *path, int flags, struct history *history)
+{
+    struct hisremote *h;
+
+    h = xcalloc(1, sizeof(struct hisremote));
+    h->flags = flags;
+    h->history = history;
+    h->fd = INVALID_SOCKET;
+    h->request = buffer_new();
+    h->response = buffer_new();
+    if (flags & HIS_RDWR) {
+        hisremote_seterror(h, concat("remote history can't be written",
+                                     NULL));
+        hisremote_dispose(h);
+        return NULL;
+    }
+    if (path != NULL) {
+        h->path = xstrdup(path);
+        if (!hisremote_connect(h)) {
+            hisremote_dispose(h);
+            h = NULL;
+        }
+    }
+    return h;
+}
+
+
+/*
+**  close and free a history handle
+*/
+bool
+hisremote_close(void *history)
+{
+    return hisremote_dispose(history);
+}
+
+
+/*
+**  nothing is ever written
+*/
+bool
+hisremote_sync(void *history UNUSED)
+{
+    return true;
+}
+
+
+/*
+**  lookup up the entry `key' on the server
+*/
+bool
+hisremote_lookup(void *history, const char *key, time_t *arrived,
+                 time_t *posted, time_t *expires, TOKEN *token)
+{
+    struct hisremote *h = history;
+    unsigned int n, flags, tries;
+    uint64_t times[3];
+
+    for (tries = 0; tries < 2; tries++) {
+        if (!hisremote_request(h, request_lookup, &key, 1)
+            || !hisremote_receive(h, response_lookup))
+            continue;
+        if (!hisremote_unpack_u16(h->response, &n) || n != 1
+            || !hisremote_unpack_u8(h->response, &flags)) {
+            hisremote_seterror(h, concat("bad response from hisserver",
+                                         NULL));
+            hisremote_disconnect(h);
+            return false;
+        }
+        if (!(flags & lookup_found))
+            return false;
+        if (!hisremote_unpack_u64(h->response, &times[0])
+            || !hisremote_unpack_u64(h->response, &times[1])
+            || !hisremote_unpack_u64(h->response, &times[2])
+            || ((flags & lookup_token)
+                && h->response->left < sizeof(TOKEN))) {
+            hisremote_seterror(h, concat("bad response from hisserver",
+                                         NULL));
+            hisremote_disconnect(h);
+            return false;
+        }
+        if (arrived != NULL)
+            *arrived = times[0];
+        if (posted != NULL)
+            *posted = times[1];
+        if (expires != NULL)
+            *expires = times[2];
+        if (!(flags & lookup_token))
+            return false;
+        hisremote_unpack(h->response, token, sizeof(TOKEN));
+        return true;
+    }
+    return false;
+}
+
+
+/*
+**  check `key' has been seen on the server
+*/
+bool
+hisremote_check(void *history, const char *key)
+{
+    bool found;
+
+    if (!hisremote_checkkeys(history, &key, 1, &found))
+        return false;
+    return found;
+}
+
+
+/*
+**  check whether each of `count' keys has been seen, asking the server
+**  about all of them at once
+*/
+bool
+hisremote_checkbatch(void *history, const char *const *keys, size_t count,
+                     bool *found)
+{
+    return hisremote_checkkeys(history, keys, count, found);
+}
+
+
+/*
+**  the remote history is only written on the machine of the server
+*/
+static bool
+hisremote_readonly(struct hisremote *h)
+{
+    hisremote_seterror(h, concat("remote history can't be written", NULL));
+    return false;
+}
+
+bool
+hisremote_write(void *history, const char *key UNUSED,
+                time_t arrived UNUSED, time_t posted UNUSED,
+                time_t expires UNUSED, const TOKEN *token UNUSED)
+{
+    return hisremote_readonly(history);
+}
+
+bool
+hisremote_remember(void *history, const char *key UNUSED,
+                   time_t arrived UNUSED, time_t posted UNUSED)
+{
+    return hisremote_readonly(history);
+}
+
+bool
+hisremote_replace(void *history, const char *key UNUSED,
+                  time_t arrived UNUSED, time_t posted UNUSED,
+                  time_t expires UNUSED, const TOKEN *token UNUSED)
+{
+    return hisremote_readonly(history);
+}
+
+bool
+hisremote_expire(void *history, const char *path UNUSED,
+                 const char *reason UNUSED, bool writing UNUSED,
+                 void *cookie UNUSED, time_t threshold UNUSED,
+                 bool (*exists)(void *, time_t, time_t, time_t,
+                                TOKEN *) UNUSED)
+{
+    return hisremote_readonly(history);
+}
+
+
+/*
+**  the server doesn't send the whole history
+*/
+bool
+hisremote_walk(void *history, const char *reason UNUSED,
+               void *cookie UNUSED,
+               bool (*callback)(void *, time_t, time_t, time_t,
+                                const TOKEN *) UNUSED)
+{
+    struct hisremote *h = history;
+
+    hisremote_seterror(h, concat("remote history can't be walked", NULL));
+    return false;
+}
+
+
+/*
+**  control interface; the settings of the history are those of the
+**  server, so they are accepted and ignored
+*/
+bool
+hisremote_ctl(void *history, int selector, void *val)
+{
+    struct hisremote *h = history;
+    bool r = true;
+
+    switch (selector) {
+    case HISCTLG_PATH:
+        *(char **) val = h->path;
+        break;
+
+    case HISCTLS_PATH:
+        if (h->path) {
+            hisremote_seterror(h, concat("path already set in handle",
+                                         NULL));
+            r = false;
+        } else {
+            h->path = xstrdup((char *) val);
+            if (!hisremote_connect(h)) {
+                free(h->path);
+                h->path = NULL;
+                r = false;
+            }
+        }
+        break;
+
+    case HISCTLS_STATINTERVAL:
+    case HISCTLS_SYNCCOUNT:
+    case HISCTLS_NPAIRS:
+    case HISCTLS_IGNOREOLD:
+        break;
+
+    default:
+        /* deliberately doesn't call hisremote_seterror, as hisv6 */
+        r = false;
+        break;
+    }
+    return r;
+}
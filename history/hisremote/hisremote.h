@@ -0,0 +1,46 @@
+/*
+** Internal history API interface exposed to HISxxx
+*/
+
+#ifndef HISREMOTE_H
+#define HISREMOTE_H 1
+
+struct token;
+struct histopts;
+struct history;
+
+void *hisremote_open(const char *path, int flags, struct history *);
+
+bool hisremote_close(void *);
+
+bool hisremote_sync(void *);
+
+bool hisremote_lookup(void *, const char *key, time_t *arrived,
+		      time_t *posted, time_t *expires, struct token *token);
+
+bool hisremote_check(void *, const char *key);
+
+bool hisremote_checkbatch(void *, const char *const *keys, size_t count,
+			  bool *found);
+
+bool hisremote_write(void *, const char *key, time_t arrived,
+		     time_t posted, time_t expires, const struct token *token);
+
+bool hisremote_replace(void *, const char *key, time_t arrived,
+		       time_t posted, time_t expires, const struct token *token);
+
+bool hisremote_expire(void *, const char *, const char *, bool,
+		      void *, time_t threshold,
+		      bool (*exists)(void *, time_t, time_t, time_t,
+				     struct token *));
+
+bool hisremote_walk(void *, const char *, void *,
+		    bool (*)(void *, time_t, time_t, time_t,
+			     const struct token *));
+
+bool hisremote_remember(void *, const char *key, time_t arrived,
+			time_t posted);
+
+bool hisremote_ctl(void *, int, void *);
+
+#endif
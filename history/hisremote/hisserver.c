@@ -0,0 +1,488 @@
+/*
+**  Serve the history to the hisremote method of other machines.
+**
+**  hisserver opens the local history read-only with the method set in
+**  inn.conf and answers the lookups and checks of its clients, as
+**  described in hisremote-private.h.  Every client may send many requests
+**  without waiting for the responses; they are answered in order.  The
+**  history is checked for replacement every 30 seconds, as nnrpd does, so
+**  that an expired history is picked up.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/socket.h"
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
+#include "hisremote-private.h"
+#include "inn/buffer.h"
+#include "inn/fdflag.h"
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/network.h"
+#include "inn/paths.h"
+#include "inn/storage.h"
+
+/* Stop reading the requests of a client which doesn't read the responses
+   once this much is waiting for it. */
+#define HISSERVER_MAXOUTPUT     (4 * HISREMOTE_MAXREQUEST)
+
+struct client {
+    socket_type fd;
+    bool hello;                 /* request_hello has been received. */
+    bool closing;               /* Close once the output is sent. */
+    struct buffer *in;
+    struct buffer *out;
+};
+
+static struct history *History;
+static socket_type *listeners;
+static unsigned int nlisteners;
+static struct client *clients;
+static size_t nclients, capacity;
+static char *pidfile = NULL;
+static volatile sig_atomic_t terminating = 0;
+
+
+static void
+catcher(int sig UNUSED)
+{
+    terminating = 1;
+}
+
+
+/*
+**  Add a client for a new connection.
+*/
+static void
+add_client(socket_type fd)
+{
+    struct client *client;
+
+    if (nclients >= capacity) {
+        capacity = (nclients + 1) * 3 / 2;
+        clients = xreallocarray(clients, capacity, sizeof(struct client));
+    }
+    client = &clients[nclients++];
+    memset(client, 0, sizeof(*client));
+    client->fd = fd;
+    client->in = buffer_new();
+    client->out = buffer_new();
+    fdflag_nonblocking(fd, true);
+}
+
+
+/*
+**  Close the connection of a client and forget about it.
+*/
+static void
+del_client(struct client *client)
+{
+    socket_close(client->fd);
+    buffer_free(client->in);
+    buffer_free(client->out);
+    *client = clients[--nclients];
+}
+
+
+/*
+**  Add a response with no content.  Fatal responses close the connection
+**  once they are sent.
+*/
+static void
+simple_response(struct client *client, unsigned int code)
+{
+    size_t start;
+
+    start = hisremote_start(client->out, code);
+    hisremote_finish(client->out, start);
+    if (code >= response_fatal)
+        client->closing = true;
+}
+
+
+/*
+**  Take the message-ID of a request into key, which holds 256 bytes.
+*/
+static bool
+unpack_key(struct buffer *request, char *key)
+{
+    unsigned int length;
+
+    if (!hisremote_unpack_u8(request, &length)
+        || !hisremote_unpack(request, key, length))
+        return false;
+    key[length] = '\0';
+    return true;
+}
+
+
+static void
+do_hello(struct client *client, struct buffer *request)
+{
+    uint32_t version;
+
+    if (!hisremote_unpack_u32(request, &version) || request->left != 0)
+        simple_response(client, response_bad_request);
+    else if (version != HISREMOTE_PROTOCOL_VERSION)
+        simple_response(client, response_wrong_version);
+    else {
+        client->hello = true;
+        simple_response(client, response_ok);
+    }
+}
+
+
+static void
+do_lookup(struct client *client, struct buffer *request)
+{
+    struct buffer *out = client->out;
+    char key[256];
+    unsigned int count, i, flags;
+    size_t start, mark;
+    time_t arrived, posted, expires;
+    TOKEN token;
+
+    if (!hisremote_unpack_u16(request, &count) || count > HISREMOTE_BATCH) {
+        simple_response(client, response_bad_request);
+        return;
+    }
+    mark = out->left;
+    start = hisremote_start(out, response_lookup);
+    hisremote_pack_u16(out, count);
+    for (i = 0; i < count; i++) {
+        if (!unpack_key(request, key)) {
+            out->left = mark;
+            simple_response(client, response_bad_request);
+            return;
+        }
+        arrived = posted = expires = 0;
+        flags = 0;
+        if (HISlookup(History, key, &arrived, &posted, &expires, &token))
+            flags = lookup_found | lookup_token;
+        else if (HIScheck(History, key))
+            flags = lookup_found;
+        hisremote_pack_u8(out, flags);
+        if (flags & lookup_found) {
+            hisremote_pack_u64(out, arrived > 0 ? arrived : 0);
+            hisremote_pack_u64(out, posted > 0 ? posted : 0);
+            hisremote_pack_u64(out, expires > 0 ? expires : 0);
+        }
+        if (flags & lookup_token)
+            buffer_append(out, (char *) &token, sizeof(token));
+    }
+    hisremote_finish(out, start);
+}
+
+
+static void
+do_check(struct client *client, struct buffer *request)
+{
+    struct buffer *out = client->out;
+    char *keys;
+    const char **pointers;
+    bool *found;
+    unsigned int count, i;
+    size_t start;
+
+    if (!hisremote_unpack_u16(request, &count) || count > HISREMOTE_BATCH) {
+        simple_response(client, response_bad_request);
+        return;
+    }
+    keys = xmalloc(count * 256 + 1);
+    pointers = xmalloc((count + 1) * sizeof(char *));
+    found = xmalloc((count + 1) * sizeof(bool));
+    for (i = 0; i < count; i++) {
+        pointers[i] = keys + i * 256;
+        if (!unpack_key(request, keys + i * 256)) {
+            simple_response(client, response_bad_request);
+            goto done;
+        }
+    }
+    if (!HIScheckbatch(History, pointers, count, found)) {
+        simple_response(client, response_error);
+        goto done;
+    }
+    start = hisremote_start(out, response_check);
+    hisremote_pack_u16(out, count);
+    for (i = 0; i < count; i++)
+        hisremote_pack_u8(out, found[i] ? 1 : 0);
+    hisremote_finish(out, start);
+
+done:
+    free(keys);
+    free(pointers);
+    free(found);
+}
+
+
+static void (*dispatch[count_request_codes])(struct client *,
+                                              struct buffer *) = {
+    do_hello,
+    do_lookup,
+    do_check
+};
+
+
+/*
+**  Answer every complete request read from the client.
+*/
+static void
+handle_requests(struct client *client)
+{
+    struct buffer *in = client->in;
+    struct buffer request;
+    uint32_t length;
+    unsigned int code;
+
+    while (!client->closing && in->left >= 5) {
+        request.data = in->data + in->used;
+        request.size = in->left;
+        request.used = 0;
+        request.left = in->left;
+        hisremote_unpack_u32(&request, &length);
+        if (length < 5) {
+            simple_response(client, response_bad_request);
+            return;
+        }
+        if (length > HISREMOTE_MAXREQUEST) {
+            simple_response(client, response_oversized);
+            return;
+        }
+        if (in->left < length)
+            return;
+        request.left = length - 4;
+        in->used += length;
+        in->left -= length;
+        hisremote_unpack_u8(&request, &code);
+        if (code >= count_request_codes)
+            simple_response(client, response_bad_request);
+        else if ((code == request_hello) == client->hello)
+            simple_response(client, response_wrong_state);
+        else
+            (*dispatch[code])(client, &request);
+    }
+    if (in->left == 0)
+        in->used = 0;
+}
+
+
+/*
+**  Read what the client sent.  Returns false if the client went away.
+*/
+static bool
+handle_read(struct client *client)
+{
+    struct buffer *in = client->in;
+    ssize_t n;
+
+    buffer_compact(in);
+    buffer_resize(in, in->left + 64 * 1024);
+    n = socket_read(client->fd, in->data + in->left, in->size - in->left);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK);
+    if (n == 0)
+        return false;
+    in->left += n;
+    handle_requests(client);
+    return true;
+}
+
+
+/*
+**  Send what is waiting for the client.  Returns false if the client went
+**  away or has to be closed.
+*/
+static bool
+handle_write(struct client *client)
+{
+    struct buffer *out = client->out;
+    ssize_t n;
+
+    n = socket_write(client->fd, out->data + out->used, out->left);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK);
+    out->used += n;
+    out->left -= n;
+    if (out->left == 0) {
+        out->used = 0;
+        if (client->closing)
+            return false;
+    }
+    return true;
+}
+
+
+/*
+**  Accept a new connection on a listening socket.
+*/
+static void
+handle_accept(socket_type listener)
+{
+    socket_type fd;
+
+    fd = accept(listener, NULL, NULL);
+    if (fd == INVALID_SOCKET)
+        return;
+    if (fd >= FD_SETSIZE) {
+        warn("too many clients, closing connection");
+        socket_close(fd);
+        return;
+    }
+    add_client(fd);
+}
+
+
+static void
+mainloop(void)
+{
+    fd_set readfds, writefds;
+    socket_type maxfd;
+    struct client *client;
+    unsigned int i;
+    size_t j;
+    int n;
+
+    while (!terminating) {
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        maxfd = -1;
+        for (i = 0; i < nlisteners; i++) {
+            FD_SET(listeners[i], &readfds);
+            if (listeners[i] > maxfd)
+                maxfd = listeners[i];
+        }
+        for (j = 0; j < nclients; j++) {
+            client = &clients[j];
+            if (!client->closing && client->out->left < HISSERVER_MAXOUTPUT)
+                FD_SET(client->fd, &readfds);
+            if (client->out->left > 0)
+                FD_SET(client->fd, &writefds);
+            if (client->fd > maxfd)
+                maxfd = client->fd;
+        }
+        n = select(maxfd + 1, &readfds, &writefds, NULL, NULL);
+        if (n < 0) {
+            if (errno != EINTR)
+                syswarn("select failed");
+            continue;
+        }
+        for (i = 0; i < nlisteners; i++)
+            if (FD_ISSET(listeners[i], &readfds))
+                handle_accept(listeners[i]);
+
+        /* Go backwards, since del_client moves the last client in place of
+           the one removed. */
+        for (j = nclients; j-- > 0;) {
+            client = &clients[j];
+            if (FD_ISSET(client->fd, &readfds) && !handle_read(client)) {
+                del_client(client);
+                continue;
+            }
+            if ((FD_ISSET(client->fd, &writefds) || client->out->left > 0)
+                && !handle_write(client))
+                del_client(client);
+        }
+    }
+}
+
+
+static void
+usage(void)
+{
+    fputs("Usage: hisserver [-d] [-p port]\n", stderr);
+    exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    bool debug = false;
+    unsigned long port = 0;
+    unsigned int i;
+    time_t statinterval = 30;
+    char *path;
+    FILE *pf;
+    int option;
+
+    message_program_name = "hisserver";
+    while ((option = getopt(argc, argv, "dp:")) != EOF) {
+        switch (option) {
+        case 'd':
+            debug = true;
+            break;
+        case 'p':
+            port = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (debug) {
+        message_handlers_warn(1, message_log_stderr);
+        message_handlers_die(1, message_log_stderr);
+    } else {
+        openlog("hisserver", L_OPENLOG_FLAGS | LOG_PID, LOG_INN_PROG);
+        message_handlers_warn(1, message_log_syslog_err);
+        message_handlers_die(1, message_log_syslog_err);
+    }
+    if (!innconf_read(NULL))
+        exit(1);
+    if (strcmp(innconf->hismethod, "hisremote") == 0)
+        die("hismethod can't be hisremote on the machine of hisserver");
+    if (port == 0)
+        port = innconf->hisserverport;
+    if (port == 0 || port > 65535)
+        die("invalid port %lu", port);
+
+    if (!network_bind_all(SOCK_STREAM, port, &listeners, &nlisteners))
+        sysdie("cannot bind to port %lu", port);
+    for (i = 0; i < nlisteners; i++) {
+        if (listen(listeners[i], innconf->maxlisten) < 0)
+            sysdie("cannot listen on socket");
+        fdflag_nonblocking(listeners[i], true);
+    }
+
+    if (!debug)
+        daemonize(innconf->pathtmp);
+    xsignal_norestart(SIGINT, catcher);
+    xsignal_norestart(SIGTERM, catcher);
+    xsignal_norestart(SIGHUP, catcher);
+    xsignal(SIGPIPE, SIG_IGN);
+
+    pidfile = concatpath(innconf->pathrun, HISREMOTE_SERVER_PIDFILE);
+    pf = fopen(pidfile, "w");
+    if (pf == NULL || fprintf(pf, "%ld\n", (long) getpid()) < 0
+        || fclose(pf) != 0)
+        sysdie("cannot write PID file %s", pidfile);
+
+    path = concatpath(innconf->pathdb, INN_PATH_HISTORY);
+    History = HISopen(path, innconf->hismethod, HIS_RDONLY | HIS_MMAP);
+    if (History == NULL)
+        die("cannot open history %s", path);
+    free(path);
+    HISctl(History, HISCTLS_STATINTERVAL, &statinterval);
+    HISsetcache(History, 1024 * innconf->hiscachesize);
+    if (setfdlimit(FD_SETSIZE) == -1)
+        syswarn("cannot set file descriptor limit");
+
+    mainloop();
+
+    while (nclients > 0)
+        del_client(&clients[nclients - 1]);
+    for (i = 0; i < nlisteners; i++)
+        socket_close(listeners[i]);
+    network_bind_all_free(listeners);
+    HISclose(History);
+    unlink(pidfile);
+    free(pidfile);
+    return 0;
+}
@@ -0,0 +1,780 @@
+/*
+**  Segmented history implementation against the history API.
+**
+**  The history is split by arrival time into segments of a day, each of
+**  them a complete history v6 database (text file and dbz index) named
+**  after the path of the history with the creation time of the segment
+**  appended, like history.1792000000.  New entries go to the newest
+**  segment and lookups try the segments from the newest to the oldest.
+**
+**  Expiry doesn't rewrite anything.  The entries of every segment are
+**  passed to the expire callback as usual, but a segment is only removed,
+**  as a whole, once none of its entries has to be kept any more; until
+**  then, the entries of articles that have been removed keep their token.
+**  The cost of an expiry is therefore reading the history rather than
+**  writing a new one and rebuilding its index.
+**
+**  A history v6 database at the path itself, as used by the hisv6 method,
+**  is kept as the oldest segment, so that an existing history can be
+**  switched to this method and goes away once all its entries expired.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "hisinterface.h"
+#include "hisseg.h"
+#include "hisv6/hisv6.h"
+#include "inn/history.h"
+#include "inn/inndcomm.h"
+#include "inn/libinn.h"
+#include "inn/sequence.h"
+#include "inn/storage.h"
+#include "inn/timer.h"
+
+/* How long new entries go to the same segment. */
+#define HISSEG_LENGTH   (24 * 60 * 60)
+
+/* Rough length of a history line, to size a new segment after the
+   previous one. */
+#define HISSEG_LINE     64
+
+struct hisseg_segment {
+    time_t start;               /* Creation time, 0 for a hisv6 history. */
+    char *path;
+    void *his;                  /* hisv6 handle. */
+};
+
+struct hisseg {
+    char *path;
+    int flags;
+    struct history *history;
+    struct hisseg_segment *segments;    /* Oldest first. */
+    size_t count;
+    unsigned long statinterval;
+    unsigned long nextcheck;
+    size_t synccount;
+    ssize_t npairs;
+};
+
+/* Passed through hisv6_walk during expiry. */
+struct hisseg_expirestate {
+    bool (*exists)(void *, time_t, time_t, time_t, TOKEN *);
+    void *cookie;
+    time_t threshold;
+    bool keep;                  /* An entry of the segment is still needed. */
+};
+
+
+/*
+**  set error status to that indicated by s; doesn't copy the string,
+**  assumes the caller did that for us
+*/
+static void
+hisseg_seterror(struct hisseg *h, const char *s)
+{
+    his_seterror(h->history, s);
+}
+
+
+/*
+**  Compare two segment creation times, for qsort.
+*/
+static int
+hisseg_compare(const void *a, const void *b)
+{
+    time_t x = *(const time_t *) a;
+    time_t y = *(const time_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*
+**  Find the segments of the history at path.  Returns their creation times,
+**  oldest first, in a newly allocated array and sets count, or NULL if the
+**  directory of the history can't be read.  A history v6 database at path
+**  itself counts as a segment created at 0.
+*/
+static time_t *
+hisseg_list(const char *path, size_t *count)
+{
+    const char *name, *p;
+    char *dirname, *end;
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    time_t *starts;
+    unsigned long start;
+    size_t length, size;
+
+    p = strrchr(path, '/');
+    if (p == NULL) {
+        dirname = xstrdup(".");
+        name = path;
+    } else {
+        dirname = (p == path) ? xstrdup("/") : xstrndup(path, p - path);
+        name = p + 1;
+    }
+    dir = opendir(dirname);
+    free(dirname);
+    if (dir == NULL)
+        return NULL;
+
+    length = strlen(name);
+    size = 16;
+    starts = xmalloc(size * sizeof(time_t));
+    *count = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        p = entry->d_name;
+        if (strncmp(p, name, length) != 0 || p[length] != '.')
+            continue;
+        p += length + 1;
+        if (!isdigit((unsigned char) *p))
+            continue;
+        start = strtoul(p, &end, 10);
+        if (*end != '\0' || start == 0)
+            continue;
+        if (*count + 1 >= size) {
+            size *= 2;
+            starts = xreallocarray(starts, size, sizeof(time_t));
+        }
+        starts[(*count)++] = (time_t) start;
+    }
+    closedir(dir);
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        starts[(*count)++] = 0;
+    qsort(starts, *count, sizeof(time_t), hisseg_compare);
+    return starts;
+}
+
+
+/*
+**  Return the path of the segment created at start, in newly allocated
+**  memory.
+*/
+static char *
+hisseg_path(const char *path, time_t start)
+{
+    char suffix[32];
+
+    if (start == 0)
+        return xstrdup(path);
+    snprintf(suffix, sizeof(suffix), ".%lu", (unsigned long) start);
+    return concat(path, suffix, (char *) 0);
+}
+
+
+/*
+**  Remove the files of the segment at path.  A missing file isn't an
+**  error, since which index files exist depends on the dbz format.
+*/
+static bool
+hisseg_unlink(struct hisseg *h, const char *path)
+{
+    static const char *const suffixes[] = {
+        "", ".dir", ".index", ".hash", ".pag"
+    };
+    char *file;
+    size_t i;
+    bool r = true;
+
+    for (i = 0; i < ARRAY_SIZE(suffixes); i++) {
+        file = concat(path, suffixes[i], (char *) 0);
+        if (unlink(file) < 0 && errno != ENOENT) {
+            hisseg_seterror(h, concat("can't unlink ", file, " ",
+                                      strerror(errno), NULL));
+            r = false;
+        }
+        free(file);
+    }
+    return r;
+}
+
+
+/*
+**  Return the flags to open a segment with.  Only the newest segment is
+**  written to, but all of them can be written when the history is open for
+**  writing since entries are replaced in place.
+*/
+static int
+hisseg_flags(struct hisseg *h, bool newest)
+{
+    int flags = h->flags & ~HIS_CREAT;
+
+    if (!newest)
+        flags &= ~HIS_INCORE;
+    return flags;
+}
+
+
+/*
+**  Open the segment seg, whose creation time is set, with flags.  npairs is
+**  the number of entries the segment should be sized for if it is created,
+**  or 0 for the default.
+*/
+static bool
+hisseg_opensegment(struct hisseg *h, struct hisseg_segment *seg, int flags,
+                   ssize_t npairs)
+{
+    size_t value;
+
+    seg->path = hisseg_path(h->path, seg->start);
+    seg->his = hisv6_open(NULL, flags, h->history);
+    if (seg->his == NULL) {
+        free(seg->path);
+        return false;
+    }
+    hisv6_ctl(seg->his, HISCTLS_SYNCCOUNT, &h->synccount);
+    if (npairs > 0) {
+        value = npairs;
+        hisv6_ctl(seg->his, HISCTLS_NPAIRS, &value);
+    }
+    if (!hisv6_ctl(seg->his, HISCTLS_PATH, seg->path)) {
+        hisv6_close(seg->his);
+        free(seg->path);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  Close the segment seg.
+*/
+static bool
+hisseg_closesegment(struct hisseg_segment *seg)
+{
+    bool r;
+
+    r = hisv6_close(seg->his);
+    free(seg->path);
+    return r;
+}
+
+
+/*
+**  Bring the open segments up to date with those on disk, closing the ones
+**  which were removed and opening the new ones.
+*/
+static bool
+hisseg_refresh(struct hisseg *h)
+{
+    struct hisseg_segment *segments;
+    struct stat st;
+    time_t *starts;
+    size_t count, i, j, n;
+    bool r = true;
+
+    starts = hisseg_list(h->path, &count);
+    if (starts == NULL) {
+        hisseg_seterror(h, concat("can't read directory of ", h->path, " ",
+                                  strerror(errno), NULL));
+        return false;
+    }
+    segments = xcalloc(count + 1, sizeof(struct hisseg_segment));
+    for (i = 0, j = 0, n = 0; j < count; j++) {
+        while (i < h->count && h->segments[i].start < starts[j])
+            hisseg_closesegment(&h->segments[i++]);
+        if (i < h->count && h->segments[i].start == starts[j]) {
+            segments[n++] = h->segments[i++];
+            continue;
+        }
+        segments[n].start = starts[j];
+        if (hisseg_opensegment(h, &segments[n], hisseg_flags(h, j + 1 == count),
+                               0))
+            n++;
+        else {
+            /* It may just have been expired. */
+            segments[n].path = hisseg_path(h->path, starts[j]);
+            if (stat(segments[n].path, &st) == 0)
+                r = false;
+            free(segments[n].path);
+        }
+    }
+    while (i < h->count)
+        hisseg_closesegment(&h->segments[i++]);
+    free(h->segments);
+    free(starts);
+    h->segments = segments;
+    h->count = n;
+    return r;
+}
+
+
+/*
+**  Look for new or removed segments if the stat interval has passed.
+*/
+static void
+hisseg_checkfiles(struct hisseg *h)
+{
+    unsigned long t;
+
+    if (h->statinterval == 0)
+        return;
+    t = TMRnow();
+    if (seq_lcompare(t, h->nextcheck) == 1) {
+        hisseg_refresh(h);
+        h->nextcheck = t + h->statinterval;
+    }
+}
+
+
+/*
+**  Return the segment new entries go to, starting a new one once the
+**  newest segment is older than HISSEG_LENGTH.  The new segment is sized
+**  after the previous one.
+*/
+static struct hisseg_segment *
+hisseg_current(struct hisseg *h)
+{
+    struct hisseg_segment *newest = NULL, seg;
+    struct stat st;
+    ssize_t npairs;
+    time_t now;
+
+    now = time(NULL);
+    if (h->count > 0) {
+        newest = &h->segments[h->count - 1];
+        if (newest->start != 0 && now < newest->start + HISSEG_LENGTH)
+            return newest;
+    }
+    if (!(h->flags & HIS_RDWR)) {
+        hisseg_seterror(h, concat("history not open for writing ",
+                                  h->path, NULL));
+        return NULL;
+    }
+
+    seg.start = now;
+    if (newest != NULL && seg.start <= newest->start)
+        seg.start = newest->start + 1;
+    npairs = h->npairs;
+    if (npairs == 0 && newest != NULL && newest->start != 0
+        && stat(newest->path, &st) == 0)
+        npairs = st.st_size / HISSEG_LINE;
+    if (!hisseg_opensegment(h, &seg, hisseg_flags(h, true) | HIS_CREAT,
+                            npairs))
+        return NULL;
+    h->segments = xreallocarray(h->segments, h->count + 1,
+                                sizeof(struct hisseg_segment));
+    h->segments[h->count++] = seg;
+    return &h->segments[h->count - 1];
+}
+
+
+/*
+**  Open the history at path, creating a single new segment in place of
+**  any existing one if asked to.
+*/
+static bool
+hisseg_setpath(struct hisseg *h, const char *path)
+{
+    time_t *starts;
+    size_t count, i;
+    char *p;
+    bool r = true;
+
+    h->path = xstrdup(path);
+    if (h->flags & HIS_CREAT) {
+        starts = hisseg_list(h->path, &count);
+        if (starts != NULL) {
+            for (i = 0; i < count; i++) {
+                p = hisseg_path(h->path, starts[i]);
+                if (!hisseg_unlink(h, p))
+                    r = false;
+                free(p);
+            }
+            free(starts);
+        }
+        if (r && hisseg_current(h) == NULL)
+            r = false;
+        h->flags &= ~HIS_CREAT;
+    } else {
+        r = hisseg_refresh(h);
+        if (r && h->count == 0) {
+            hisseg_seterror(h, concat("no history segments for ", h->path,
+                                      NULL));
+            r = false;
+        }
+    }
+    return r;
+}
+
+
+/*
+**  close the segments of an existing history structure and free it
+*/
+static bool
+hisseg_dispose(struct hisseg *h)
+{
+    size_t i;
+    bool r = true;
+
+    for (i = 0; i < h->count; i++)
+        if (!hisseg_closesegment(&h->segments[i]))
+            r = false;
+    free(h->segments);
+    free(h->path);
+    free(h);
+    return r;
+}
+
+
+/*
+**  open the history database identified by path in mode flags
+*/
+void *
+hisseg_open(const char *path, int flags, struct history *history)
+{
+    struct hisseg *h;
+
+    h = xcalloc(1, sizeof(struct hisseg));
+    h->flags = flags;
+    h->history = history;
+    if (path != NULL && !hisseg_setpath(h, path)) {
+        hisseg_dispose(h);
+        h = NULL;
+    }
+    return h;
+}
+
+
+/*
+**  close and free a history handle
+*/
+bool
+hisseg_close(void *history)
+{
+    return hisseg_dispose(history);
+}
+
+
+/*
+**  synchronise any outstanding history changes to disk
+*/
+bool
+hisseg_sync(void *history)
+{
+    struct hisseg *h = history;
+    size_t i;
+    bool r = true;
+
+    for (i = 0; i < h->count; i++)
+        if (!hisv6_sync(h->segments[i].his))
+            r = false;
+    return r;
+}
+
+
+/*
+**  lookup up the entry `key' in the newest segment which has it
+*/
+bool
+hisseg_lookup(void *history, const char *key, time_t *arrived,
+              time_t *posted, time_t *expires, TOKEN *token)
+{
+    struct hisseg *h = history;
+    size_t i;
+
+    hisseg_checkfiles(h);
+    for (i = h->count; i-- > 0;)
+        if (hisv6_check(h->segments[i].his, key))
+            return hisv6_lookup(h->segments[i].his, key, arrived, posted,
+                                expires, token);
+    return false;
+}
+
+
+/*
+**  check `key' has been seen in any segment
+*/
+bool
+hisseg_check(void *history, const char *key)
+{
+    struct hisseg *h = history;
+    size_t i;
+
+    hisseg_checkfiles(h);
+    for (i = h->count; i-- > 0;)
+        if (hisv6_check(h->segments[i].his, key))
+            return true;
+    return false;
+}
+
+
+/*
+**  check whether each of `count' keys has been seen in any segment, only
+**  looking in older segments for the keys not found in newer ones
+*/
+bool
+hisseg_checkbatch(void *history, const char *const *keys, size_t count,
+                  bool *found)
+{
+    struct hisseg *h = history;
+    const char **left;
+    size_t *where;
+    bool *seen;
+    size_t i, j, n;
+
+    hisseg_checkfiles(h);
+    left = xmalloc(count * sizeof(char *));
+    where = xmalloc(count * sizeof(size_t));
+    seen = xmalloc(count * sizeof(bool));
+    for (j = 0; j < count; j++) {
+        found[j] = false;
+        left[j] = keys[j];
+        where[j] = j;
+    }
+    n = count;
+    for (i = h->count; i-- > 0 && n > 0;) {
+        if (!hisv6_checkbatch(h->segments[i].his, left, n, seen))
+            continue;
+        for (j = 0; j < n;) {
+            if (seen[j]) {
+                found[where[j]] = true;
+                n--;
+                left[j] = left[n];
+                where[j] = where[n];
+                seen[j] = seen[n];
+            } else
+                j++;
+        }
+    }
+    free(left);
+    free(where);
+    free(seen);
+    return true;
+}
+
+
+/*
+**  write a history entry to the current segment
+*/
+bool
+hisseg_write(void *history, const char *key, time_t arrived,
+             time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisseg *h = history;
+    struct hisseg_segment *seg;
+
+    seg = hisseg_current(h);
+    if (seg == NULL)
+        return false;
+    return hisv6_write(seg->his, key, arrived, posted, expires, token);
+}
+
+
+/*
+**  remember a history entry in the current segment
+*/
+bool
+hisseg_remember(void *history, const char *key, time_t arrived,
+                time_t posted)
+{
+    struct hisseg *h = history;
+    struct hisseg_segment *seg;
+
+    seg = hisseg_current(h);
+    if (seg == NULL)
+        return false;
+    return hisv6_remember(seg->his, key, arrived, posted);
+}
+
+
+/*
+**  replace an existing history entry in the segment which has it
+*/
+bool
+hisseg_replace(void *history, const char *key, time_t arrived,
+               time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisseg *h = history;
+    size_t i;
+
+    for (i = h->count; i-- > 0;)
+        if (hisv6_check(h->segments[i].his, key))
+            return hisv6_replace(h->segments[i].his, key, arrived, posted,
+                                 expires, token);
+    return false;
+}
+
+
+/*
+**  traverse the segments, oldest first; the server is only paused at the
+**  end of the newest one
+*/
+bool
+hisseg_walk(void *history, const char *reason, void *cookie,
+            bool (*callback)(void *, time_t, time_t, time_t,
+                             const TOKEN *))
+{
+    struct hisseg *h = history;
+    size_t i;
+
+    for (i = 0; i < h->count; i++)
+        if (!hisv6_walk(h->segments[i].his,
+                        (i + 1 == h->count) ? reason : NULL, cookie,
+                        callback))
+            return false;
+    return true;
+}
+
+
+/*
+**  callback used during expire, recording whether the entry would be kept
+**  by hisv6: either its article is still there, or it has to be remembered
+**  until threshold
+*/
+static bool
+hisseg_expirecb(void *cookie, time_t arrived, time_t posted, time_t expires,
+                const TOKEN *token)
+{
+    struct hisseg_expirestate *state = cookie;
+    TOKEN ltoken;
+
+    if (token != NULL) {
+        ltoken = *token;
+        if ((*state->exists)(state->cookie, arrived, posted, expires,
+                             &ltoken))
+            state->keep = true;
+    }
+    if (posted >= state->threshold
+        || (posted <= 0 && arrived >= state->threshold))
+        state->keep = true;
+    return true;
+}
+
+
+/*
+**  expire the history database in place, removing the segments none of
+**  whose entries are needed any more; the newest segment, which is being
+**  written to, is always kept
+*/
+bool
+hisseg_expire(void *history, const char *path, const char *reason,
+              bool writing, void *cookie, time_t threshold,
+              bool (*exists)(void *, time_t, time_t, time_t, TOKEN *))
+{
+    struct hisseg *h = history;
+    struct hisseg_expirestate state;
+    bool *drop = NULL;
+    bool paused = false;
+    bool r = true;
+    size_t i, n;
+
+    if (path != NULL) {
+        hisseg_seterror(h, concat("can't expire segmented history ",
+                                  h->path, " to ", path, NULL));
+        return false;
+    }
+    if (writing && (h->flags & HIS_RDWR)) {
+        hisseg_seterror(h, concat("can't expire from read/write history ",
+                                  h->path, NULL));
+        return false;
+    }
+    if (!hisseg_refresh(h))
+        return false;
+
+    state.exists = exists;
+    state.cookie = cookie;
+    state.threshold = threshold;
+    drop = xcalloc(h->count + 1, sizeof(bool));
+    for (i = 0; i < h->count; i++) {
+        state.keep = false;
+        if (!hisv6_walk(h->segments[i].his, NULL, &state, hisseg_expirecb)) {
+            r = false;
+            goto fail;
+        }
+        drop[i] = !state.keep && i + 1 < h->count;
+    }
+
+    /* Pause the server as hisv6 does, so that it reopens the history and
+       lets go of the removed segments when our caller restarts it. */
+    if (reason != NULL) {
+        if (ICCpause(reason) != 0) {
+            hisseg_seterror(h, concat("can't pause server ", h->path, " ",
+                                      strerror(errno), NULL));
+            r = false;
+            goto fail;
+        }
+        paused = true;
+    }
+
+    if (writing) {
+        for (i = 0, n = 0; i < h->count; i++) {
+            if (!drop[i]) {
+                h->segments[n++] = h->segments[i];
+                continue;
+            }
+            if (!hisseg_unlink(h, h->segments[i].path))
+                r = false;
+            if (!hisseg_closesegment(&h->segments[i]))
+                r = false;
+        }
+        h->count = n;
+    }
+
+ fail:
+    free(drop);
+    if (r == false && paused)
+        ICCgo(reason);
+    return r;
+}
+
+
+/*
+**  control interface
+*/
+bool
+hisseg_ctl(void *history, int selector, void *val)
+{
+    struct hisseg *h = history;
+    size_t i;
+    bool r = true;
+
+    switch (selector) {
+    case HISCTLG_PATH:
+        *(char **) val = h->path;
+        break;
+
+    case HISCTLS_PATH:
+        if (h->path) {
+            hisseg_seterror(h, concat("path already set in handle", NULL));
+            r = false;
+        } else if (!hisseg_setpath(h, (char *) val)) {
+            free(h->path);
+            h->path = NULL;
+            r = false;
+        }
+        break;
+
+    case HISCTLS_STATINTERVAL:
+        h->statinterval = *(time_t *) val * 1000;
+        h->nextcheck = TMRnow() + h->statinterval;
+        break;
+
+    case HISCTLS_SYNCCOUNT:
+        h->synccount = *(size_t *) val;
+        for (i = 0; i < h->count; i++)
+            hisv6_ctl(h->segments[i].his, HISCTLS_SYNCCOUNT, &h->synccount);
+        break;
+
+    case HISCTLS_NPAIRS:
+        h->npairs = (ssize_t) *(size_t *) val;
+        break;
+
+    case HISCTLS_IGNOREOLD:
+        /* Nothing is rebuilt during expiry. */
+        break;
+
+    default:
+        /* deliberately doesn't call hisseg_seterror, as hisv6 */
+        r = false;
+        break;
+    }
+    return r;
+}
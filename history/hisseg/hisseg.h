@@ -0,0 +1,45 @@
+/*
+** Internal history API interface exposed to HISxxx
+*/
+
+#ifndef HISSEG_H
+#define HISSEG_H 1
+
+struct token;
+struct histopts;
+struct history;
+
+void *hisseg_open(const char *path, int flags, struct history *);
+
+bool hisseg_close(void *);
+
+bool hisseg_sync(void *);
+
+bool hisseg_lookup(void *, const char *key, time_t *arrived,
+		   time_t *posted, time_t *expires, struct token *token);
+
+bool hisseg_check(void *, const char *key);
+
+bool hisseg_checkbatch(void *, const char *const *keys, size_t count,
+		       bool *found);
+
+bool hisseg_write(void *, const char *key, time_t arrived,
+		  time_t posted, time_t expires, const struct token *token);
+
+bool hisseg_replace(void *, const char *key, time_t arrived,
+		    time_t posted, time_t expires, const struct token *token);
+
+bool hisseg_expire(void *, const char *, const char *, bool,
+		   void *, time_t threshold,
+		   bool (*exists)(void *, time_t, time_t, time_t,
+				  struct token *));
+
+bool hisseg_walk(void *, const char *, void *,
+		 bool (*)(void *, time_t, time_t, time_t,
+			  const struct token *));
+
+bool hisseg_remember(void *, const char *key, time_t arrived, time_t posted);
+
+bool hisseg_ctl(void *, int, void *);
+
+#endif
@@ -0,0 +1,517 @@
+/*
+**  Sharded history implementation against the history API.
+**
+**  The history is split by the hash of the message-ID between shards, each
+**  of them a complete history v6 database (text file and dbz index) in one
+**  of the directories listed in the hisshards parameter of inn.conf, named
+**  like the history itself.  Relative directories are taken from the
+**  directory of the history, so with the default path and hisshards set to
+**  [ /disk1 /disk2 ], the shards are /disk1/history and /disk2/history.
+**  Every entry lives in exactly one shard, so a lookup, a check or a write
+**  only touches the files of that shard, and putting the shards on
+**  different disks spreads the load between them.  The list of directories
+**  must therefore not change as long as the history is kept.
+**
+**  Walks and expiry go through the shards in turn, since the callbacks of
+**  the caller can't be run concurrently, but ask the kernel to read all the
+**  shards in the background first so that the disks work at the same time.
+**  Each shard is expired like a hisv6 history, pausing the server at the
+**  end to catch up with the entries added in the meantime; the server is
+**  then restarted before going on with the next shard, except after the
+**  last one which is left for the caller as usual.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "hisinterface.h"
+#include "hisshard.h"
+#include "hisv6/hisv6.h"
+#include "inn/history.h"
+#include "inn/inndcomm.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/storage.h"
+#include "inn/vector.h"
+
+struct hisshard_shard {
+    char *path;
+    void *his;                  /* hisv6 handle. */
+};
+
+struct hisshard {
+    char *path;
+    int flags;
+    struct history *history;
+    struct hisshard_shard *shards;
+    size_t count;
+    time_t statinterval;
+    size_t synccount;
+    ssize_t npairs;
+};
+
+
+/*
+**  set error status to that indicated by s; doesn't copy the string,
+**  assumes the caller did that for us
+*/
+static void
+hisshard_seterror(struct hisshard *h, const char *s)
+{
+    his_seterror(h->history, s);
+}
+
+
+/*
+**  Return the directory of the shard listed as dir for the history at
+**  path, in newly allocated memory.
+*/
+static char *
+hisshard_dir(const char *path, const char *dir)
+{
+    const char *p;
+    char *base, *result;
+
+    p = strrchr(path, '/');
+    if (dir[0] == '/' || p == NULL)
+        return xstrdup(dir);
+    base = xstrndup(path, p - path + 1);
+    result = concat(base, dir, (char *) 0);
+    free(base);
+    return result;
+}
+
+
+/*
+**  Return the number of the shard which has key.  The first bytes of the
+**  hash are used since dbz places entries after the last ones.
+*/
+static size_t
+hisshard_index(struct hisshard *h, const char *key)
+{
+    HASH hash;
+    uint32_t n;
+
+    hash = HashMessageID(key);
+    memcpy(&n, hash.hash, sizeof(n));
+    return n % h->count;
+}
+
+
+/*
+**  Open the shard with the flags and settings of the history.
+*/
+static bool
+hisshard_openshard(struct hisshard *h, struct hisshard_shard *shard,
+                   size_t count)
+{
+    size_t value;
+    bool ignoreold = true;
+
+    shard->his = hisv6_open(NULL, h->flags, h->history);
+    if (shard->his == NULL)
+        return false;
+    hisv6_ctl(shard->his, HISCTLS_SYNCCOUNT, &h->synccount);
+    if (h->statinterval != 0)
+        hisv6_ctl(shard->his, HISCTLS_STATINTERVAL, &h->statinterval);
+    if (h->npairs > 0) {
+        value = h->npairs / count + 1;
+        hisv6_ctl(shard->his, HISCTLS_NPAIRS, &value);
+    } else if (h->npairs == -1)
+        hisv6_ctl(shard->his, HISCTLS_IGNOREOLD, &ignoreold);
+    if (!hisv6_ctl(shard->his, HISCTLS_PATH, shard->path)) {
+        hisv6_close(shard->his);
+        shard->his = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  Open the shards of the history at path, creating their directories if
+**  the history is being created.
+*/
+static bool
+hisshard_setpath(struct hisshard *h, const char *path)
+{
+    struct vector *dirs;
+    struct hisshard_shard *shard;
+    const char *name;
+    char *dir;
+    size_t i;
+
+    dirs = (innconf != NULL) ? innconf->hisshards : NULL;
+    if (dirs == NULL || dirs->count == 0) {
+        hisshard_seterror(h, concat("hisshards not set for ", path, NULL));
+        return false;
+    }
+    h->path = xstrdup(path);
+    name = strrchr(path, '/');
+    name = (name == NULL) ? path : name + 1;
+    h->shards = xcalloc(dirs->count, sizeof(struct hisshard_shard));
+    for (i = 0; i < dirs->count; i++) {
+        shard = &h->shards[i];
+        dir = hisshard_dir(path, dirs->strings[i]);
+        if ((h->flags & HIS_CREAT) && mkdir(dir, 0755) < 0
+            && errno != EEXIST) {
+            hisshard_seterror(h, concat("can't create ", dir, " ",
+                                        strerror(errno), NULL));
+            free(dir);
+            return false;
+        }
+        shard->path = concat(dir, "/", name, (char *) 0);
+        free(dir);
+        if (!hisshard_openshard(h, shard, dirs->count)) {
+            free(shard->path);
+            return false;
+        }
+        h->count++;
+    }
+    h->flags &= ~HIS_CREAT;
+    return true;
+}
+
+
+/*
+**  close the shards of an existing history structure and free it
+*/
+static bool
+hisshard_dispose(struct hisshard *h)
+{
+    size_t i;
+    bool r = true;
+
+    for (i = 0; i < h->count; i++) {
+        if (!hisv6_close(h->shards[i].his))
+            r = false;
+        free(h->shards[i].path);
+    }
+    free(h->shards);
+    free(h->path);
+    free(h);
+    return r;
+}
+
+
+/*
+**  Ask the kernel to read every shard but the first, which is read right
+**  away, in the background.
+*/
+static void
+hisshard_prefetch(struct hisshard *h UNUSED)
+{
+#ifdef HAVE_POSIX_FADVISE
+    size_t i;
+    int fd;
+
+    for (i = 1; i < h->count; i++) {
+        fd = open(h->shards[i].path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#endif
+}
+
+
+/*
+**  open the history database identified by path in mode flags
+*/
+void *
+hisshard_open(const char *path, int flags, struct history *history)
+{
+    struct hisshard *h;
+
+    h = xcalloc(1, sizeof(struct hisshard));
+    h->flags = flags;
+    h->history = history;
+    if (path != NULL && !hisshard_setpath(h, path)) {
+        hisshard_dispose(h);
+        h = NULL;
+    }
+    return h;
+}
+
+
+/*
+**  close and free a history handle
+*/
+bool
+hisshard_close(void *history)
+{
+    return hisshard_dispose(history);
+}
+
+
+/*
+**  synchronise any outstanding history changes to disk
+*/
+bool
+hisshard_sync(void *history)
+{
+    struct hisshard *h = history;
+    size_t i;
+    bool r = true;
+
+    for (i = 0; i < h->count; i++)
+        if (!hisv6_sync(h->shards[i].his))
+            r = false;
+    return r;
+}
+
+
+/*
+**  lookup up the entry `key' in its shard
+*/
+bool
+hisshard_lookup(void *history, const char *key, time_t *arrived,
+                time_t *posted, time_t *expires, TOKEN *token)
+{
+    struct hisshard *h = history;
+
+    if (h->count == 0)
+        return false;
+    return hisv6_lookup(h->shards[hisshard_index(h, key)].his, key, arrived,
+                        posted, expires, token);
+}
+
+
+/*
+**  check `key' has been seen in its shard
+*/
+bool
+hisshard_check(void *history, const char *key)
+{
+    struct hisshard *h = history;
+
+    if (h->count == 0)
+        return false;
+    return hisv6_check(h->shards[hisshard_index(h, key)].his, key);
+}
+
+
+/*
+**  check whether each of `count' keys has been seen, passing every shard
+**  the keys it has at once
+*/
+bool
+hisshard_checkbatch(void *history, const char *const *keys, size_t count,
+                    bool *found)
+{
+    struct hisshard *h = history;
+    const char **left;
+    size_t *shard, *where;
+    bool *seen;
+    size_t i, j, n;
+
+    if (h->count == 0) {
+        hisshard_seterror(h, concat("history not open", NULL));
+        return false;
+    }
+    left = xmalloc(count * sizeof(char *));
+    shard = xmalloc(count * sizeof(size_t));
+    where = xmalloc(count * sizeof(size_t));
+    seen = xmalloc(count * sizeof(bool));
+    for (j = 0; j < count; j++) {
+        found[j] = false;
+        shard[j] = hisshard_index(h, keys[j]);
+    }
+    for (i = 0; i < h->count; i++) {
+        for (j = 0, n = 0; j < count; j++)
+            if (shard[j] == i) {
+                left[n] = keys[j];
+                where[n++] = j;
+            }
+        if (n == 0 || !hisv6_checkbatch(h->shards[i].his, left, n, seen))
+            continue;
+        for (j = 0; j < n; j++)
+            found[where[j]] = seen[j];
+    }
+    free(left);
+    free(shard);
+    free(where);
+    free(seen);
+    return true;
+}
+
+
+/*
+**  write a history entry to its shard
+*/
+bool
+hisshard_write(void *history, const char *key, time_t arrived,
+               time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisshard *h = history;
+
+    if (h->count == 0)
+        return false;
+    return hisv6_write(h->shards[hisshard_index(h, key)].his, key, arrived,
+                       posted, expires, token);
+}
+
+
+/*
+**  remember a history entry in its shard
+*/
+bool
+hisshard_remember(void *history, const char *key, time_t arrived,
+                  time_t posted)
+{
+    struct hisshard *h = history;
+
+    if (h->count == 0)
+        return false;
+    return hisv6_remember(h->shards[hisshard_index(h, key)].his, key,
+                          arrived, posted);
+}
+
+
+/*
+**  replace an existing history entry in its shard
+*/
+bool
+hisshard_replace(void *history, const char *key, time_t arrived,
+                 time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisshard *h = history;
+
+    if (h->count == 0)
+        return false;
+    return hisv6_replace(h->shards[hisshard_index(h, key)].his, key,
+                         arrived, posted, expires, token);
+}
+
+
+/*
+**  traverse the shards in turn; the server is paused at the end of each of
+**  them and restarted before the next one
+*/
+bool
+hisshard_walk(void *history, const char *reason, void *cookie,
+              bool (*callback)(void *, time_t, time_t, time_t,
+                               const TOKEN *))
+{
+    struct hisshard *h = history;
+    size_t i;
+
+    hisshard_prefetch(h);
+    for (i = 0; i < h->count; i++) {
+        if (!hisv6_walk(h->shards[i].his, reason, cookie, callback))
+            return false;
+        if (reason != NULL && i + 1 < h->count)
+            ICCgo(reason);
+    }
+    return true;
+}
+
+
+/*
+**  expire the shards in turn, as hisv6 does for a single history
+*/
+bool
+hisshard_expire(void *history, const char *path, const char *reason,
+                bool writing, void *cookie, time_t threshold,
+                bool (*exists)(void *, time_t, time_t, time_t, TOKEN *))
+{
+    struct hisshard *h = history;
+    size_t i;
+
+    if (path != NULL) {
+        hisshard_seterror(h, concat("can't expire sharded history ",
+                                    h->path, " to ", path, NULL));
+        return false;
+    }
+    hisshard_prefetch(h);
+    for (i = 0; i < h->count; i++) {
+        if (!hisv6_expire(h->shards[i].his, NULL, reason, writing, cookie,
+                          threshold, exists))
+            return false;
+        if (reason != NULL && i + 1 < h->count)
+            ICCgo(reason);
+    }
+    return true;
+}
+
+
+/*
+**  control interface
+*/
+bool
+hisshard_ctl(void *history, int selector, void *val)
+{
+    struct hisshard *h = history;
+    size_t i, value;
+    bool r = true;
+
+    switch (selector) {
+    case HISCTLG_PATH:
+        *(char **) val = h->path;
+        break;
+
+    case HISCTLS_PATH:
+        if (h->path) {
+            hisshard_seterror(h, concat("path already set in handle", NULL));
+            r = false;
+        } else if (!hisshard_setpath(h, (char *) val)) {
+            for (i = 0; i < h->count; i++) {
+                hisv6_close(h->shards[i].his);
+                free(h->shards[i].path);
+            }
+            free(h->shards);
+            h->shards = NULL;
+            h->count = 0;
+            free(h->path);
+            h->path = NULL;
+            r = false;
+        }
+        break;
+
+    case HISCTLS_STATINTERVAL:
+        h->statinterval = *(time_t *) val;
+        for (i = 0; i < h->count; i++)
+            hisv6_ctl(h->shards[i].his, HISCTLS_STATINTERVAL,
+                      &h->statinterval);
+        break;
+
+    case HISCTLS_SYNCCOUNT:
+        h->synccount = *(size_t *) val;
+        for (i = 0; i < h->count; i++)
+            hisv6_ctl(h->shards[i].his, HISCTLS_SYNCCOUNT, &h->synccount);
+        break;
+
+    case HISCTLS_NPAIRS:
+        h->npairs = (ssize_t) *(size_t *) val;
+        value = (h->npairs > 0 && h->count > 0)
+            ? h->npairs / h->count + 1 : 0;
+        for (i = 0; i < h->count; i++)
+            hisv6_ctl(h->shards[i].his, HISCTLS_NPAIRS, &value);
+        break;
+
+    case HISCTLS_IGNOREOLD:
+        if (h->npairs == 0 && *(bool *) val) {
+            h->npairs = -1;
+        } else if (h->npairs == -1 && !*(bool *) val) {
+            h->npairs = 0;
+        }
+        for (i = 0; i < h->count; i++)
+            hisv6_ctl(h->shards[i].his, HISCTLS_IGNOREOLD, val);
+        break;
+
+    case HISCTLS_EXPIRETHREADS:
+        for (i = 0; i < h->count; i++)
+            if (!hisv6_ctl(h->shards[i].his, HISCTLS_EXPIRETHREADS, val))
+                r = false;
+        break;
+
+    default:
+        /* deliberately doesn't call hisshard_seterror, as hisv6 */
+        r = false;
+        break;
+    }
+    return r;
+}
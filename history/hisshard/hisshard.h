@@ -0,0 +1,46 @@
+/*
+** Internal history API interface exposed to HISxxx
+*/
+
+#ifndef HISSHARD_H
+#define HISSHARD_H 1
+
+struct token;
+struct histopts;
+struct history;
+
+void *hisshard_open(const char *path, int flags, struct history *);
+
+bool hisshard_close(void *);
+
+bool hisshard_sync(void *);
+
+bool hisshard_lookup(void *, const char *key, time_t *arrived,
+		     time_t *posted, time_t *expires, struct token *token);
+
+bool hisshard_check(void *, const char *key);
+
+bool hisshard_checkbatch(void *, const char *const *keys, size_t count,
+			 bool *found);
+
+bool hisshard_write(void *, const char *key, time_t arrived,
+		    time_t posted, time_t expires, const struct token *token);
+
+bool hisshard_replace(void *, const char *key, time_t arrived,
+		      time_t posted, time_t expires, const struct token *token);
+
+bool hisshard_expire(void *, const char *, const char *, bool,
+		     void *, time_t threshold,
+		     bool (*exists)(void *, time_t, time_t, time_t,
+				    struct token *));
+
+bool hisshard_walk(void *, const char *, void *,
+		   bool (*)(void *, time_t, time_t, time_t,
+			    const struct token *));
+
+bool hisshard_remember(void *, const char *key, time_t arrived,
+		       time_t posted);
+
+bool hisshard_ctl(void *, int, void *);
+
+#endif
@@ -30,6 +30,15 @@
     1 - \n */
 #define HISV6_MAXLINE 137
 
+/* the history text is read this much at a time when warming up, and the
+   progress is reported every so many bytes */
+#define HISV6_WARMUP_CHUNK (1024 * 1024)
+#define HISV6_WARMUP_REPORT (64 * 1024 * 1024)
+
+/* the history text is handed to the expire threads in chunks of this size,
+   two of them per thread */
+#define HISV6_EXPIRE_CHUNK (1024 * 1024)
+
 /* minimum length of a history line:
    34 - hash
     1 - \t
@@ -50,6 +59,18 @@ struct hisv6 {
     int readfd;
     int flags;
     struct stat st;
+    struct dbz *dbz;            /* dbz set aside for another history. */
+    bool datasync;              /* fdatasync after each write? */
+    size_t writebehind;         /* Entries held before writing them. */
+    size_t npending;            /* Entries held, in the order written, */
+    HASH *pendhash;             /* with their hashes, */
+    off_t *pendoffset;          /* their offsets in the history file, */
+    size_t *pendline;           /* and where their lines start in pendbuf. */
+    char *pendbuf;              /* The lines held, one after the other. */
+    size_t pendused;
+    size_t *pendslots;          /* Index of the entries by hash, 1-based. */
+    size_t pendmask;
+    size_t expirethreads;       /* Threads deciding what expire keeps. */
 };
 
 /* values in the bitmap returned from hisv6_splitline */
@@ -78,4 +99,10 @@ struct hisv6_walkstate {
 /* maximum length of the string from hisv6_errloc */
 #define HISV6_MAX_LOCATION 22
 
+/* split a history line into its components, also used by hisv7 to convert
+ * a history v6 */
+int hisv6_splitline(const char *line, const char **error, HASH *hash,
+                    time_t *arrived, time_t *posted, time_t *expires,
+                    TOKEN *token);
+
 #endif
@@ -47,14 +47,22 @@
 #include "inn/dbz.h"
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
+#include "inn/messages.h"
 #include "inn/timer.h"
 #include "inn/qio.h"
 #include "inn/sequence.h"
 #include "inn/inndcomm.h"
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+# include <signal.h>
+#endif
+
 /*
 **  because we can only have one open dbz per process, we keep a
-**  pointer to which of the current history structures owns it
+**  pointer to which of the current history structures owns it; the
+**  dbz of other history structures opened with hisv6_open is set
+**  aside until they are used
 */
 static struct hisv6 *hisv6_dbzowner;
 
@@ -92,7 +100,7 @@ hisv6_errloc(char *s, size_t line, off_t offset)
 **  -1 for error.  *error is set to a string which describes the
 **  failure.
 */
-static int
+int
 hisv6_splitline(const char *line, const char **error, HASH *hash,
 		 time_t *arrived, time_t *posted, time_t *expires,
 		 TOKEN *token)
@@ -204,6 +212,46 @@ hisv6_nextcheck(struct hisv6 *h, unsigned long now)
 }
 
 
+/*
+**  set aside the dbz of the current owner, so that the next history
+**  structure to be opened gets one of its own
+*/
+static void
+hisv6_dbzpark(void)
+{
+    if (hisv6_dbzowner != NULL) {
+	hisv6_dbzowner->dbz = dbzsave();
+	hisv6_dbzowner = NULL;
+    }
+}
+
+
+/*
+**  make h the owner of the dbz instance, bringing back the dbz it had
+**  set aside if needed
+*/
+static bool
+hisv6_dbzuse(struct hisv6 *h)
+{
+    if (h == hisv6_dbzowner)
+	return true;
+    if (h->dbz == NULL) {
+	hisv6_seterror(h, concat("dbz not open for this history file ",
+				  h->histpath, NULL));
+	return false;
+    }
+    hisv6_dbzpark();
+    if (!dbzrestore(h->dbz)) {
+	hisv6_seterror(h, concat("can't restore dbz for ", h->histpath,
+				  NULL));
+	return false;
+    }
+    h->dbz = NULL;
+    hisv6_dbzowner = h;
+    return true;
+}
+
+
 /*
 **  close any dbz structures associated with h; we also manage the
 **  single dbz instance voodoo
@@ -213,6 +261,8 @@ hisv6_dbzclose(struct hisv6 *h)
 {
     bool r = true;
 
+    if (h->dbz != NULL && !hisv6_dbzuse(h))
+	return false;
     if (h == hisv6_dbzowner) {
 	if (!hisv6_sync(h))
 	    r = false;
@@ -228,6 +278,211 @@ hisv6_dbzclose(struct hisv6 *h)
 }
 
 
+/*
+**  flush the history text to disk, for those who want each write to
+**  survive a crash
+*/
+static bool
+hisv6_datasync(struct hisv6 *h)
+{
+#ifdef HAVE_FDATASYNC
+    if (fdatasync(fileno(h->writefp)) == 0)
+	return true;
+#else
+    if (fsync(fileno(h->writefp)) == 0)
+	return true;
+#endif
+    hisv6_seterror(h, concat("can't sync history ", h->histpath, " ",
+			      strerror(errno), NULL));
+    return false;
+}
+
+
+/*
+**  The write-behind buffer holds the entries written until writebehind of
+**  them are there, so that they are written to the history file at once
+**  and stored in the dbz as a batch.  Meanwhile, they are found by hash
+**  through pendslots, an open-addressing table twice as large as the
+**  buffer.
+*/
+static size_t
+hisv6_pendslot(const struct hisv6 *h, const HASH *hash)
+{
+    size_t slot;
+
+    memcpy(&slot, hash, sizeof(slot));
+    return slot & h->pendmask;
+}
+
+
+/*
+**  return the index of the held entry for hash, or -1 if there is none
+*/
+static ssize_t
+hisv6_pendfind(const struct hisv6 *h, const HASH *hash)
+{
+    size_t slot, i;
+
+    if (h->npending == 0)
+	return -1;
+    for (slot = hisv6_pendslot(h, hash); (i = h->pendslots[slot]) != 0;
+	 slot = (slot + 1) & h->pendmask)
+	if (memcmp(&h->pendhash[i - 1], hash, sizeof(HASH)) == 0)
+	    return i - 1;
+    return -1;
+}
+
+
+/*
+**  return the length of the line of a held entry, with its newline
+*/
+static size_t
+hisv6_pendlength(const struct hisv6 *h, size_t i)
+{
+    if (i + 1 < h->npending)
+	return h->pendline[i + 1] - h->pendline[i];
+    return h->pendused - h->pendline[i];
+}
+
+
+/*
+**  hold a line to be written at the current offset of the history file
+*/
+static void
+hisv6_pendadd(struct hisv6 *h, const HASH *hash, const char *line,
+	      size_t length)
+{
+    size_t slot, i = h->npending++;
+
+    h->pendhash[i] = *hash;
+    h->pendoffset[i] = h->offset;
+    h->pendline[i] = h->pendused;
+    memcpy(h->pendbuf + h->pendused, line, length);
+    h->pendused += length;
+    for (slot = hisv6_pendslot(h, hash); h->pendslots[slot] != 0;
+	 slot = (slot + 1) & h->pendmask)
+	;
+    h->pendslots[slot] = i + 1;
+}
+
+
+/*
+**  forget the held entries
+*/
+static void
+hisv6_pendclear(struct hisv6 *h)
+{
+    if (h->npending != 0)
+	memset(h->pendslots, 0, (h->pendmask + 1) * sizeof(size_t));
+    h->npending = 0;
+    h->pendused = 0;
+}
+
+
+/*
+**  write the held entries to the history file with a single write, sync
+**  it if asked to, then store them in the dbz all at once
+*/
+static bool
+hisv6_flush(struct hisv6 *h)
+{
+    DBZSTORE_RESULT *results;
+    char location[HISV6_MAX_LOCATION];
+    const char *error;
+    size_t i, n;
+    bool r = true;
+
+    if (h->npending == 0)
+	return true;
+    if (!hisv6_dbzuse(h))
+	return false;
+
+    /* As for a single line, rewind over a partial write. */
+    n = fwrite(h->pendbuf, 1, h->pendused, h->writefp);
+    if (n < h->pendused
+	|| (!(h->flags & HIS_INCORE) && fflush(h->writefp) == EOF)) {
+	hisv6_errloc(location, (size_t)-1, h->pendoffset[0]);
+	hisv6_seterror(h, concat("can't write history ", h->histpath,
+				  location, " ", strerror(errno), NULL));
+	if (fseeko(h->writefp, h->pendoffset[0], SEEK_SET) == -1)
+	    h->offset = h->pendoffset[0] + n;
+	else
+	    h->offset = h->pendoffset[0];
+	hisv6_pendclear(h);
+	return false;
+    }
+    if (h->datasync && !hisv6_datasync(h))
+	r = false;
+
+    results = xmalloc(h->npending * sizeof(DBZSTORE_RESULT));
+    if (!dbzstorebatch(h->pendhash, h->pendoffset, h->npending, results)) {
+	hisv6_seterror(h, concat("dbzstore error ", h->histpath, " ",
+				  strerror(errno), NULL));
+	r = false;
+    } else {
+	for (i = 0; i < h->npending; i++) {
+	    if (results[i] == DBZSTORE_OK)
+		continue;
+	    /* a duplicate is not an error, as with a single line */
+	    if (results[i] == DBZSTORE_EXISTS)
+		error = "dbzstore duplicate message-id ";
+	    else {
+		error = "dbzstore error ";
+		r = false;
+	    }
+	    hisv6_errloc(location, (size_t)-1, h->pendoffset[i]);
+	    hisv6_seterror(h, concat(error, h->histpath,
+				      ":[", HashToText(h->pendhash[i]), "]",
+				      location, NULL));
+	}
+    }
+    free(results);
+    h->dirty += h->npending;
+    hisv6_pendclear(h);
+    if (r && h->synccount != 0 && h->dirty >= h->synccount)
+	r = hisv6_sync(h);
+    return r;
+}
+
+
+/*
+**  set the size of the write-behind buffer, writing what it holds first
+*/
+static bool
+hisv6_setwritebehind(struct hisv6 *h, size_t count)
+{
+    size_t slots;
+    bool r;
+
+    r = hisv6_flush(h);
+    free(h->pendhash);
+    free(h->pendoffset);
+    free(h->pendline);
+    free(h->pendbuf);
+    free(h->pendslots);
+    h->pendhash = NULL;
+    h->pendoffset = NULL;
+    h->pendline = NULL;
+    h->pendbuf = NULL;
+    h->pendslots = NULL;
+    h->pendmask = 0;
+    h->npending = 0;
+    h->pendused = 0;
+    h->writebehind = count;
+    if (count == 0)
+	return r;
+    for (slots = 2; slots < 2 * count; slots *= 2)
+	;
+    h->pendhash = xmalloc(count * sizeof(HASH));
+    h->pendoffset = xmalloc(count * sizeof(off_t));
+    h->pendline = xmalloc(count * sizeof(size_t));
+    h->pendbuf = xmalloc(count * HISV6_MAXLINE);
+    h->pendslots = xcalloc(slots, sizeof(size_t));
+    h->pendmask = slots - 1;
+    return r;
+}
+
+
 /*
 **  close an existing history structure, cleaning it to the point
 **  where we can reopon without leaking resources
@@ -237,6 +492,8 @@ hisv6_closefiles(struct hisv6 *h)
 {
     bool r = true;
 
+    if (!hisv6_flush(h))
+	r = false;
     if (!hisv6_dbzclose(h))
 	r = false;
 
@@ -370,8 +627,16 @@ hisv6_reopen(struct hisv6 *h)
 		opt.exists_incore = INCORE_MMAP;
 	    }
 # endif
+	    /* Huge pages only back private memory, so the writer then keeps
+	       its own copy of the tables, written through to the files. */
+	    if ((h->flags & HIS_HUGEPAGES) && (h->flags & HIS_RDWR)) {
+		opt.pag_incore = INCORE_MEM;
+		opt.exists_incore = INCORE_MEM;
+	    }
 #endif
 	}
+	opt.filter = (h->flags & HIS_FILTER) && (h->flags & HIS_RDWR);
+	opt.hugepages = (h->flags & HIS_HUGEPAGES) != 0;
 	dbzsetoptions(opt);
 	if (h->flags & HIS_CREAT) {
 	    size_t npairs;
@@ -454,6 +719,7 @@ hisv6_dispose(struct hisv6 *h)
 	free(h->histpath);
 	h->histpath = NULL;
     }
+    hisv6_setwritebehind(h, 0);
 
     free(h);
     return r;
@@ -479,7 +745,19 @@ hisv6_new(const char *path, int flags, struct history *history)
     h->statinterval = 0;
     h->npairs = 0;
     h->dirty = 0;
+    h->dbz = NULL;
     h->synccount = 0;
+    h->datasync = false;
+    h->writebehind = 0;
+    h->npending = 0;
+    h->pendhash = NULL;
+    h->pendoffset = NULL;
+    h->pendline = NULL;
+    h->pendbuf = NULL;
+    h->pendused = 0;
+    h->pendslots = NULL;
+    h->pendmask = 0;
+    h->expirethreads = 0;
     h->st.st_ino = (ino_t)-1;
     /* FIXME - mips defines dev_t to be 64-bits whereas st_dev is 32-bits,
      * so we have an overflow when casting to dev_t.
@@ -502,6 +780,7 @@ hisv6_open(const char *path, int flags, struct history *history)
 
     h = hisv6_new(path, flags, history);
     if (path) {
+	hisv6_dbzpark();
 	if (!hisv6_reopen(h)) {
 	    hisv6_dispose(h);
 	    h = NULL;
@@ -537,6 +816,8 @@ hisv6_sync(void *history)
     struct hisv6 *h = history;
     bool r = true;
 
+    if (!hisv6_flush(h))
+	r = false;
     if (h->writefp != NULL) {
 	his_logger("HISsync begin", S_HISsync);
 	if (fflush(h->writefp) == EOF) {
@@ -545,7 +826,8 @@ hisv6_sync(void *history)
 				      strerror(errno), NULL));
 	    r = false;
 	}
-	if (h->dirty && h == hisv6_dbzowner) {
+	if (h->dirty && (h == hisv6_dbzowner || h->dbz != NULL)
+	    && hisv6_dbzuse(h)) {
 	    if (!dbzsync()) {
 		hisv6_seterror(h, concat("can't dbzsync ", h->histpath,
 					  " ", strerror(errno), NULL));
@@ -570,11 +852,18 @@ hisv6_fetchline(struct hisv6 *h, const HASH *hash, char *buf, off_t *poff)
 {
     off_t offset;
     bool r;
+    ssize_t i;
 
-    if (h != hisv6_dbzowner) {
-	hisv6_seterror(h, concat("dbz not open for this history file ",
-				  h->histpath, NULL));
+    if (!hisv6_dbzuse(h))
 	return false;
+
+    /* Entries not written yet are found in memory. */
+    if ((i = hisv6_pendfind(h, hash)) >= 0) {
+	offset = h->pendline[i];
+	memcpy(buf, h->pendbuf + offset, hisv6_pendlength(h, i) - 1);
+	buf[hisv6_pendlength(h, i) - 1] = '\0';
+	*poff = h->pendoffset[i];
+	return true;
     }
     if ((h->flags & (HIS_RDWR | HIS_INCORE)) == (HIS_RDWR | HIS_INCORE)) {
 	/* need to fflush as we may be reading uncommitted data
@@ -714,16 +1003,44 @@ hisv6_check(void *history, const char *key)
     bool r;    
     HASH hash;
     
-    if (h != hisv6_dbzowner) {
-	hisv6_seterror(h, concat("dbz not open for this history file ",
-				  h->histpath, NULL));
+    if (!hisv6_dbzuse(h))
 	return false;
-    }
 
     his_logger("HIShavearticle begin", S_HIShavearticle);
     hisv6_checkfiles(h);
     hash = HashMessageID(key);
-    r = dbzexists(hash);
+    r = hisv6_pendfind(h, &hash) >= 0 || dbzexists(hash);
+    his_logger("HIShavearticle end", S_HIShavearticle);
+    return r;
+}
+
+
+/*
+**  check whether each of `count' keys has been seen in this history
+**  database, all at once
+*/
+bool
+hisv6_checkbatch(void *history, const char *const *keys, size_t count,
+		 bool *found)
+{
+    struct hisv6 *h = history;
+    bool r;
+    HASH *hashes;
+    size_t i;
+
+    if (!hisv6_dbzuse(h))
+	return false;
+
+    his_logger("HIShavearticle begin", S_HIShavearticle);
+    hisv6_checkfiles(h);
+    hashes = xmalloc(count * sizeof(HASH));
+    HashMessageIDs(keys, count, hashes);
+    r = dbzexistsbatch(hashes, count, found);
+    if (r && h->npending != 0)
+	for (i = 0; i < count; i++)
+	    if (!found[i])
+		found[i] = hisv6_pendfind(h, &hashes[i]) >= 0;
+    free(hashes);
     his_logger("HIShavearticle end", S_HIShavearticle);
     return r;
 }
@@ -832,16 +1149,13 @@ static bool
 hisv6_writeline(struct hisv6 *h, const HASH *hash, time_t arrived,
 		time_t posted, time_t expires, const TOKEN *token)
 {
-    bool r;
+    bool r, synced;
     size_t i, length;
     char hisline[HISV6_MAXLINE + 1];
     char location[HISV6_MAX_LOCATION];
 
-    if (h != hisv6_dbzowner) {
-	hisv6_seterror(h, concat("dbz not open for this history file ",
-				  h->histpath, NULL));
+    if (!hisv6_dbzuse(h))
 	return false;
-    }
 
     if (!(h->flags & HIS_RDWR)) {
 	hisv6_seterror(h, concat("history not open for writing ",
@@ -856,6 +1170,16 @@ hisv6_writeline(struct hisv6 *h, const HASH *hash, time_t arrived,
 	return false;
     }	
 
+    /* With a write-behind buffer, the line is only written once enough of
+       them are held. */
+    if (h->writebehind != 0) {
+	hisv6_pendadd(h, hash, hisline, length);
+	h->offset += length;
+	if (h->npending >= h->writebehind)
+	    return hisv6_flush(h);
+	return true;
+    }
+
     i = fwrite(hisline, 1, length, h->writefp);
 
     /* If the write failed, the history line is now an orphan.  Attempt to
@@ -872,7 +1196,8 @@ hisv6_writeline(struct hisv6 *h, const HASH *hash, time_t arrived,
 	goto fail;
     }
 
-    r = hisv6_writedbz(h, hash, h->offset);
+    synced = !h->datasync || hisv6_datasync(h);
+    r = hisv6_writedbz(h, hash, h->offset) && synced;
     h->offset += length;     /* increment regardless of error from writedbz */
  fail:
     return r;
@@ -941,6 +1266,9 @@ hisv6_replace(void *history, const char *key, time_t arrived,
 	return false;
     }
 
+    /* The line to replace has to be in the file. */
+    if (!hisv6_flush(h))
+	return false;
     hash = HashMessageID(key);
     r = hisv6_fetchline(h, &hash, old, &offset);
     if (r == true) {
@@ -1007,6 +1335,8 @@ hisv6_traverse(struct hisv6 *h, struct hisv6_walkstate *cookie,
     size_t line;
     char location[HISV6_MAX_LOCATION];
 
+    if (!hisv6_flush(h))
+	return false;
     if ((qp = QIOopen(h->histpath)) == NULL) {
 	hisv6_seterror(h, concat("can't QIOopen history file ",
 				  h->histpath, strerror(errno), NULL));
@@ -1128,6 +1458,49 @@ hisv6_walk(void *history, const char *reason, void *cookie,
 }
 
 
+/*
+**  check whether a message id seen during expire is already in the new
+**  history, reporting it if so
+**/
+static bool
+hisv6_expiredup(struct hisv6 *h, struct hisv6_walkstate *hiscookie,
+		const HASH *hash)
+{
+    if (hiscookie->new && dbzexists(*hash)) {
+	/* continue after duplicates, it's serious, but not fatal */
+	hisv6_seterror(h, concat("duplicate message-id [",
+				 HashToText(*hash), "] in history ",
+				 hiscookie->new->histpath, NULL));
+	return true;
+    }
+    return false;
+}
+
+
+/*
+**  write an entry kept by expire to the new history; token is NULL if
+**  there is none, or if the article has been expired and only the message
+**  id may be remembered
+**/
+static bool
+hisv6_expirewrite(struct hisv6_walkstate *hiscookie, const HASH *hash,
+		  time_t arrived, time_t posted, time_t expires,
+		  const TOKEN *token)
+{
+    /* When token is NULL (no token), the message-ID is removed from
+     * history when the posting time of the article is older than
+     * threshold, as set by the /remember/ line in expire.ctl.
+     * We keep the check for the arrival time because some entries
+     * might not have one. */
+    if (hiscookie->new &&
+	(token != NULL || posted >= hiscookie->threshold
+	 || (posted <= 0 && arrived >= hiscookie->threshold)))
+	return hisv6_writeline(hiscookie->new, hash,
+			       arrived, posted, expires, token);
+    return true;
+}
+
+
 /*
 **  internal callback used during expire
 **/
@@ -1137,53 +1510,346 @@ hisv6_expirecb(struct hisv6 *h, void *cookie, const HASH *hash,
 		const TOKEN *token)
 {
     struct hisv6_walkstate *hiscookie = cookie;
-    bool r = true;
+    TOKEN ltoken, *t = NULL;
 
     /* check if we've seen this message id already */
-    if (hiscookie->new && dbzexists(*hash)) {
-	/* continue after duplicates, it's serious, but not fatal */
-	hisv6_seterror(h, concat("duplicate message-id [",
-				 HashToText(*hash), "] in history ",
-				 hiscookie->new->histpath, NULL));
-    } else {
-	TOKEN ltoken, *t;
-
-	/* if we have a token pass it to the discrimination function */
-	if (token) {
-	    bool keep;
-
-	    /* make a local copy of the token so the callback can
-	     * modify it */
-	    ltoken = *token;
-	    t = &ltoken;
-	    keep = (*hiscookie->cb.expire)(hiscookie->cookie,
-					   arrived, posted, expires,
-					   t);
-	    /* If the callback returns true, we should keep the
-	     * token for the time being, else we just remember
-	     * it. */
-	    if (keep == false) {
-		t = NULL;
-		expires = 0;
-	    }
-	} else {
+    if (hisv6_expiredup(h, hiscookie, hash))
+	return true;
+
+    /* if we have a token pass it to the discrimination function */
+    if (token) {
+	bool keep;
+
+	/* make a local copy of the token so the callback can
+	 * modify it */
+	ltoken = *token;
+	t = &ltoken;
+	keep = (*hiscookie->cb.expire)(hiscookie->cookie,
+				       arrived, posted, expires,
+				       t);
+	/* If the callback returns true, we should keep the
+	 * token for the time being, else we just remember
+	 * it. */
+	if (keep == false) {
 	    t = NULL;
+	    expires = 0;
+	}
+    }
+    return hisv6_expirewrite(hiscookie, hash, arrived, posted, expires, t);
+}
+
+
+#ifdef HAVE_PTHREAD
+
+/* what an expire thread found out about a history line */
+struct hisv6_expireline {
+    int status;			/* from hisv6_splitline */
+    const char *error;
+    HASH hash;
+    time_t arrived;
+    time_t posted;
+    time_t expires;
+    TOKEN token;
+    bool keep;			/* what the callback said about token */
+};
+
+/* a chunk of whole lines of the history text */
+struct hisv6_expirechunk {
+    enum {
+	HISV6_CHUNK_FREE,	/* can be filled by the reading thread */
+	HISV6_CHUNK_READY,	/* waiting for an expire thread */
+	HISV6_CHUNK_BUSY,	/* being decided by an expire thread */
+	HISV6_CHUNK_DONE	/* waiting for the reading thread */
+    } state;
+    char *data;
+    size_t length;
+    struct hisv6_expireline *lines;
+    size_t count;
+    size_t size;
+};
+
+/* state shared by the reading thread and the expire threads */
+struct hisv6_expirepool {
+    struct hisv6_walkstate *cookie;
+    struct hisv6_expirechunk *chunks;
+    size_t nchunks;
+    size_t next;		/* chunk the reading thread waits for */
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;	/* signaled when a chunk is ready or on stop */
+    pthread_cond_t done;	/* signaled when a chunk is done */
+};
+
+
+/*
+**  parse the lines of a chunk and call the expire callback for those which
+**  have a token; runs in an expire thread
+**/
+static void
+hisv6_expiredecide(struct hisv6_walkstate *cookie,
+		   struct hisv6_expirechunk *chunk)
+{
+    struct hisv6_expireline *line;
+    char *p, *end;
+
+    chunk->count = 0;
+    for (p = chunk->data; p < chunk->data + chunk->length; p = end + 1) {
+	end = memchr(p, '\n', chunk->data + chunk->length - p);
+	*end = '\0';
+	if (chunk->count == chunk->size) {
+	    chunk->size = (chunk->size == 0) ? 1024 : chunk->size * 2;
+	    chunk->lines = xreallocarray(chunk->lines, chunk->size,
+					 sizeof(struct hisv6_expireline));
+	}
+	line = &chunk->lines[chunk->count++];
+	line->status = hisv6_splitline(p, &line->error, &line->hash,
+				       &line->arrived, &line->posted,
+				       &line->expires, &line->token);
+	line->keep = false;
+	if (line->status > 0 && (line->status & HISV6_HAVE_TOKEN))
+	    line->keep = (*cookie->cb.expire)(cookie->cookie, line->arrived,
+					      line->posted, line->expires,
+					      &line->token);
+    }
+}
+
+
+/*
+**  an expire thread, deciding the chunks in the order they were read
+**/
+static void *
+hisv6_expirethread(void *arg)
+{
+    struct hisv6_expirepool *pool = arg;
+    struct hisv6_expirechunk *chunk;
+    sigset_t set;
+    size_t i;
+
+    /* All signals are handled by the calling thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+	chunk = NULL;
+	for (i = 0; i < pool->nchunks; i++) {
+	    chunk = &pool->chunks[(pool->next + i) % pool->nchunks];
+	    if (chunk->state == HISV6_CHUNK_READY)
+		break;
+	    chunk = NULL;
+	}
+	if (chunk == NULL) {
+	    pthread_cond_wait(&pool->ready, &pool->lock);
+	    continue;
+	}
+	chunk->state = HISV6_CHUNK_BUSY;
+	pthread_mutex_unlock(&pool->lock);
+	hisv6_expiredecide(pool->cookie, chunk);
+	pthread_mutex_lock(&pool->lock);
+	chunk->state = HISV6_CHUNK_DONE;
+	pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+/*
+**  fill a chunk with the whole lines which follow in the history text,
+**  starting with the partial line left over by the previous chunk in
+**  carry; returns 1 if the chunk has lines, 0 if there are none more for
+**  now, and -1 on a read error or a line too long to fit in a chunk
+**/
+static int
+hisv6_expirefill(int fd, struct hisv6_expirechunk *chunk, char *carry,
+		 size_t *carried)
+{
+    size_t used = *carried;
+    ssize_t n;
+
+    memcpy(chunk->data, carry, used);
+    while (used < HISV6_EXPIRE_CHUNK) {
+	n = read(fd, chunk->data + used, HISV6_EXPIRE_CHUNK - used);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    return -1;
+	if (n == 0)
+	    break;
+	used += n;
+    }
+    for (n = used; n > 0 && chunk->data[n - 1] != '\n'; n--)
+	;
+    if (n == 0 && used == HISV6_EXPIRE_CHUNK) {
+	errno = 0;
+	return -1;
+    }
+    chunk->length = n;
+    *carried = used - n;
+    memcpy(carry, chunk->data + n, *carried);
+    return (n > 0) ? 1 : 0;
+}
+
+
+/*
+**  expire the history with expirethreads threads deciding which entries to
+**  keep, while this thread reads the history text and writes the kept
+**  entries to the new history in order; behaves as hisv6_traverse with
+**  hisv6_expirecb, except that the callback also sees duplicates
+**/
+static bool
+hisv6_expireparallel(struct hisv6 *h, struct hisv6_walkstate *cookie,
+		     const char *reason)
+{
+    struct hisv6_expirepool pool;
+    struct hisv6_expirechunk *chunk;
+    struct hisv6_expireline *l;
+    pthread_t *threads;
+    size_t nthreads, started, i, line, filled, consumed, carried;
+    char *carry;
+    char location[HISV6_MAX_LOCATION];
+    int fd, status;
+    bool r = true, eof = false;
+
+    if (!hisv6_flush(h))
+	return false;
+    if ((fd = open(h->histpath, O_RDONLY)) < 0) {
+	hisv6_seterror(h, concat("can't open history file ",
+				  h->histpath, strerror(errno), NULL));
+	return false;
+    }
+
+    nthreads = h->expirethreads;
+    pool.cookie = cookie;
+    pool.nchunks = nthreads * 2;
+    pool.chunks = xcalloc(pool.nchunks, sizeof(struct hisv6_expirechunk));
+    for (i = 0; i < pool.nchunks; i++)
+	pool.chunks[i].data = xmalloc(HISV6_EXPIRE_CHUNK);
+    pool.next = 0;
+    pool.stop = false;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.ready, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    threads = xmalloc(nthreads * sizeof(pthread_t));
+    for (started = 0; started < nthreads; started++)
+	if (pthread_create(&threads[started], NULL, hisv6_expirethread,
+			   &pool) != 0)
+	    break;
+    if (started == 0) {
+	/* do it all in this thread, as without expirethreads */
+	close(fd);
+	r = hisv6_traverse(h, cookie, reason, hisv6_expirecb);
+	goto done;
+    }
+
+    carry = xmalloc(HISV6_EXPIRE_CHUNK);
+    carried = 0;
+    line = 1;
+    filled = 0;
+    consumed = 0;
+    while (r) {
+	/* keep all the chunks busy as long as there is text to read; once
+	   everything has been read and handled for the first time, pause
+	   the server and handle the lines which sneaked through in the
+	   interim */
+	while (!eof && filled - consumed < pool.nchunks) {
+	    chunk = &pool.chunks[filled % pool.nchunks];
+	    status = hisv6_expirefill(fd, chunk, carry, &carried);
+	    if (status < 0) {
+		hisv6_errloc(location, line, (off_t)-1);
+		if (errno == 0)
+		    hisv6_seterror(h, concat("line too long ",
+					     h->histpath, location, NULL));
+		else
+		    hisv6_seterror(h, concat("can't read line ",
+					     h->histpath, location, " ",
+					     strerror(errno), NULL));
+		r = false;
+		break;
+	    }
+	    if (status == 0) {
+		eof = true;
+		break;
+	    }
+	    pthread_mutex_lock(&pool.lock);
+	    chunk->state = HISV6_CHUNK_READY;
+	    pthread_cond_signal(&pool.ready);
+	    pthread_mutex_unlock(&pool.lock);
+	    filled++;
 	}
-        /* When t is NULL (no token), the message-ID is removed from
-         * history when the posting time of the article is older than
-         * threshold, as set by the /remember/ line in expire.ctl.
-         * We keep the check for the arrival time because some entries
-         * might not have one. */
-	if (hiscookie->new &&
-	    (t != NULL || posted >= hiscookie->threshold
-             || (posted <= 0 && arrived >= hiscookie->threshold))) {
-	    r = hisv6_writeline(hiscookie->new, hash,
-				 arrived, posted, expires, t);
+	if (!r)
+	    break;
+	if (filled == consumed) {
+	    if (reason == NULL || cookie->paused)
+		break;
+	    if (ICCpause(reason) != 0) {
+		hisv6_seterror(h, concat("can't pause server ",
+					  h->histpath, strerror(errno), NULL));
+		r = false;
+		break;
+	    }
+	    cookie->paused = true;
+	    eof = false;
+	    continue;
+	}
+
+	/* write out what was kept in the next chunk, in order */
+	chunk = &pool.chunks[consumed % pool.nchunks];
+	pthread_mutex_lock(&pool.lock);
+	while (chunk->state != HISV6_CHUNK_DONE)
+	    pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < chunk->count && r; i++, line++) {
+	    l = &chunk->lines[i];
+	    if (l->status <= 0) {
+		hisv6_errloc(location, line, (off_t)-1);
+		hisv6_seterror(h, concat(l->error, " ", h->histpath, location,
+					  NULL));
+		/* if we're not ignoring errors set the status */
+		if (!cookie->ignore)
+		    r = false;
+		continue;
+	    }
+	    if (hisv6_expiredup(h, cookie, &l->hash))
+		continue;
+	    if ((l->status & HISV6_HAVE_TOKEN) && l->keep)
+		r = hisv6_expirewrite(cookie, &l->hash, l->arrived, l->posted,
+				      l->expires, &l->token);
+	    else
+		r = hisv6_expirewrite(cookie, &l->hash, l->arrived, l->posted,
+				      (l->status & HISV6_HAVE_TOKEN)
+				      ? 0 : l->expires, NULL);
 	}
+	pthread_mutex_lock(&pool.lock);
+	chunk->state = HISV6_CHUNK_FREE;
+	consumed++;
+	pool.next = consumed % pool.nchunks;
+	pthread_mutex_unlock(&pool.lock);
+    }
+    free(carry);
+    close(fd);
+
+ done:
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0; i < started; i++)
+	pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.ready);
+    pthread_cond_destroy(&pool.done);
+    for (i = 0; i < pool.nchunks; i++) {
+	free(pool.chunks[i].data);
+	free(pool.chunks[i].lines);
     }
+    free(pool.chunks);
     return r;
 }
 
+#endif /* HAVE_PTHREAD */
+
 
 /*
 **  unlink files associated with the history structure h
@@ -1286,6 +1952,11 @@ hisv6_expire(void *history, const char *path, const char *reason,
 	goto fail;
     }
 
+    if (!hisv6_dbzuse(h)) {
+	r = false;
+	goto fail;
+    }
+
     if (writing) {
 	/* form base name for new history file */
 	if (path != NULL) {
@@ -1348,7 +2019,12 @@ hisv6_expire(void *history, const char *path, const char *reason,
     hiscookie.cookie = cookie;
     hiscookie.new = hnew;
     hiscookie.threshold = threshold;
-    r = hisv6_traverse(h, &hiscookie, reason, hisv6_expirecb);
+#ifdef HAVE_PTHREAD
+    if (h->expirethreads > 1)
+	r = hisv6_expireparallel(h, &hiscookie, reason);
+    else
+#endif
+	r = hisv6_traverse(h, &hiscookie, reason, hisv6_expirecb);
 
  fail:
     if (writing) {
@@ -1396,6 +2072,76 @@ hisv6_expire(void *history, const char *path, const char *reason,
 }
 
 
+/*
+**  Read the end of the history text, where the entries of the articles
+**  peers are most likely to offer again are, from a descriptor of our own
+**  so as not to get in the way of the lookups.
+*/
+static bool
+hisv6_warmtext(struct hisv6 *h, const struct histwarmup *w)
+{
+    struct stat st;
+    char *buf;
+    off_t start, done, report;
+    ssize_t n;
+    int fd;
+    bool r = true;
+
+    if ((fd = open(h->histpath, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	syswarn("hisv6: warmup: can't open %s", h->histpath);
+	if (fd >= 0)
+	    close(fd);
+	return false;
+    }
+    start = (st.st_size > w->tail) ? st.st_size - w->tail : 0;
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(fd, start, 0, POSIX_FADV_WILLNEED);
+#endif
+    buf = xmalloc(HISV6_WARMUP_CHUNK);
+    report = HISV6_WARMUP_REPORT;
+    for (done = 0; start + done < st.st_size; done += n) {
+	n = pread(fd, buf, HISV6_WARMUP_CHUNK, start + done);
+	if (n <= 0) {
+	    if (n < 0) {
+		syswarn("hisv6: warmup: can't read %s", h->histpath);
+		r = false;
+	    }
+	    break;
+	}
+	if (w->progress != NULL && done + n >= report
+	    && start + done + n < st.st_size) {
+	    report = done + n + HISV6_WARMUP_REPORT;
+	    if (!(*w->progress)(w->cookie, "", done + n,
+				st.st_size - start)) {
+		r = false;
+		break;
+	    }
+	}
+    }
+    free(buf);
+    if (r && w->progress != NULL
+	&& !(*w->progress)(w->cookie, "", done, st.st_size - start))
+	r = false;
+    close(fd);
+    return r;
+}
+
+
+/*
+**  Read the dbz tables, if we have them, and the end of the history text
+**  into memory.
+*/
+static bool
+hisv6_warmup(struct hisv6 *h, const struct histwarmup *w)
+{
+    if (h == hisv6_dbzowner && !dbzwarmup(w->lock, w->progress, w->cookie))
+	return false;
+    if (w->tail > 0)
+	return hisv6_warmtext(h, w);
+    return true;
+}
+
+
 /*
 **  control interface
 */
@@ -1416,6 +2162,7 @@ hisv6_ctl(void *history, int selector, void *val)
 	    r = false;
 	} else {
 	    h->histpath = xstrdup((char *)val);
+	    hisv6_dbzpark();
 	    if (!hisv6_reopen(h)) {
 		free(h->histpath);
 		h->histpath = NULL;
@@ -1436,6 +2183,35 @@ hisv6_ctl(void *history, int selector, void *val)
 	h->npairs = (ssize_t)*(size_t *)val;
 	break;
 
+    case HISCTLS_WARMUP:
+	r = hisv6_warmup(h, val);
+	break;
+
+    case HISCTLS_WRITEBEHIND:
+	if (!(h->flags & HIS_RDWR)) {
+	    hisv6_seterror(h, concat("history not open for writing ",
+				      h->histpath, NULL));
+	    r = false;
+	} else
+	    r = hisv6_setwritebehind(h, *(size_t *)val);
+	break;
+
+    case HISCTLS_DATASYNC:
+	h->datasync = *(bool *)val;
+	break;
+
+    case HISCTLS_FLUSH:
+	r = hisv6_flush(h);
+	break;
+
+    case HISCTLS_EXPIRETHREADS:
+#ifdef HAVE_PTHREAD
+	h->expirethreads = *(size_t *)val;
+#else
+	r = false;
+#endif
+	break;
+
     case HISCTLS_IGNOREOLD:
 	if (h->npairs == 0 && *(bool *)val) {
 	    h->npairs = -1;
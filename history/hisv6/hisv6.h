@@ -20,6 +20,9 @@ bool hisv6_lookup(void *, const char *key, time_t *arrived,
 
 bool hisv6_check(void *, const char *key);
 
+bool hisv6_checkbatch(void *, const char *const *keys, size_t count,
+		      bool *found);
+
 bool hisv6_write(void *, const char *key, time_t arrived,
 		 time_t posted, time_t expires, const struct token *token);
 
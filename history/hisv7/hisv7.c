@@ -0,0 +1,1250 @@
+/*
+**  History v7 implementation against the history API.
+**
+**  The history is a file of fixed-size binary records after a header, one
+**  record per entry, and the dbz index of the entries gives the offset of
+**  their record.  A lookup reads a single record at a known place instead
+**  of reading and parsing a text line, a replacement always fits, and
+**  expiry and walks read the records in large blocks without parsing
+**  anything.  The records hold the hash of the message-ID, the arrival,
+**  posting and expiry times and the storage token, in native byte order,
+**  so the file can't be moved to a machine of another architecture.
+**
+**  A history v6 text file found at the path when the history is opened
+**  read/write is converted on the spot:  its entries are written to a new
+**  history next to it, which then replaces it and its dbz files, and the
+**  text file is kept with .v6 appended to its name.
+**
+**  Only the untagged dbz format can index the records, since the tagged
+**  one reads the text of the history to tell colliding keys apart.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "hisinterface.h"
+#include "hisv7.h"
+#include "hisv6/hisv6-private.h"
+#include "inn/dbz.h"
+#include "inn/fdflag.h"
+#include "inn/history.h"
+#include "inn/inndcomm.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/qio.h"
+#include "inn/sequence.h"
+#include "inn/storage.h"
+#include "inn/timer.h"
+
+#define HISV7_MAGIC     "INNHIS7\n"
+#define HISV7_VERSION   1
+
+/* Records kept in memory by a history opened with HIS_INCORE before they
+   are written. */
+#define HISV7_BUFFER    1024
+
+/* Records read at once when going through the history. */
+#define HISV7_CHUNK     1024
+
+/* Rough length of a history v6 line, to size the index of a converted
+   history when there is no index to size it after. */
+#define HISV7_V6LINE    90
+
+struct hisv7_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reclen;                    /* sizeof(struct hisv7_record) */
+    char unused[48];
+};
+
+/* Flags of a record. */
+#define HISV7_ENTRY     (1 << 0)        /* Set in every record. */
+#define HISV7_TOKEN     (1 << 1)        /* The token is valid. */
+
+struct hisv7_record {
+    HASH hash;
+    uint64_t arrived;
+    uint64_t posted;                    /* 0 if unknown. */
+    uint64_t expires;                   /* 0 if none. */
+    TOKEN token;
+    unsigned char flags;
+    char unused[5];
+};
+
+struct hisv7 {
+    char *histpath;
+    int flags;
+    int fd;
+    off_t offset;                       /* Where the next record goes. */
+    struct hisv7_record *buffer;        /* Records not written yet. */
+    size_t buffered;
+    struct dbz *dbz;
+    struct history *history;
+    unsigned long statinterval;
+    unsigned long nextcheck;
+    size_t synccount;
+    size_t dirty;
+    ssize_t npairs;
+    struct stat st;
+};
+
+/* Passed to the callbacks of hisv7_traverse. */
+struct hisv7_walkstate {
+    union {
+        bool (*expire)(void *, time_t, time_t, time_t, TOKEN *);
+        bool (*walk)(void *, time_t, time_t, time_t, const TOKEN *);
+    } cb;
+    void *cookie;
+    bool paused;
+    bool ignore;
+    struct hisv7 *new;                  /* Only used during expire. */
+    time_t threshold;
+};
+
+
+/*
+**  set error status to that indicated by s; doesn't copy the string,
+**  assumes the caller did that for us
+*/
+static void
+hisv7_seterror(struct hisv7 *h, const char *s)
+{
+    his_seterror(h->history, s);
+}
+
+
+/*
+**  format an offset into a string for error reporting; s should hold at
+**  least 22 characters
+*/
+static void
+hisv7_errloc(char *s, off_t offset)
+{
+    snprintf(s, 22, "@%lu", (unsigned long) offset);
+}
+
+
+/*
+**  fill in the dbz options for the index of h
+*/
+static void
+hisv7_dbzoptions(struct hisv7 *h, dbzoptions *opt)
+{
+    dbzgetoptions(opt);
+
+    /* HIS_INCORE usually means we're rebuilding from scratch, so keep the
+       whole lot in core until we flush. */
+    if (h->flags & HIS_INCORE) {
+        opt->writethrough = false;
+        opt->pag_incore = INCORE_MEM;
+        opt->exists_incore = INCORE_MEM;
+    } else {
+        opt->writethrough = true;
+        opt->pag_incore = (h->flags & HIS_MMAP) ? INCORE_MMAP : INCORE_NO;
+        opt->exists_incore = (h->flags & HIS_MMAP) ? INCORE_MMAP : INCORE_NO;
+#if defined(MMAP_NEEDS_MSYNC) && INND_DBZINCORE == 1
+        if (!innconf->nfsreader) {
+            opt->pag_incore = INCORE_MMAP;
+            opt->exists_incore = INCORE_MMAP;
+        }
+#endif
+        if ((h->flags & HIS_HUGEPAGES) && (h->flags & HIS_RDWR)) {
+            opt->pag_incore = INCORE_MEM;
+            opt->exists_incore = INCORE_MEM;
+        }
+    }
+    opt->filter = (h->flags & HIS_FILTER) && (h->flags & HIS_RDWR);
+    opt->hugepages = (h->flags & HIS_HUGEPAGES) != 0;
+}
+
+
+/*
+**  write out the records kept in memory
+*/
+static bool
+hisv7_flush(struct hisv7 *h)
+{
+    size_t length = h->buffered * sizeof(struct hisv7_record);
+    ssize_t n;
+    char location[22];
+
+    if (h->buffered == 0)
+        return true;
+    h->buffered = 0;
+    n = xpwrite(h->fd, h->buffer, length, h->offset - length);
+    if (n < 0 || (size_t) n != length) {
+        hisv7_errloc(location, h->offset - length);
+        hisv7_seterror(h, concat("can't write history ", h->histpath,
+                                 location, " ", strerror(errno), NULL));
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  close the files of an existing history structure, cleaning it to the
+**  point where we can reopen without leaking resources
+*/
+static bool
+hisv7_closefiles(struct hisv7 *h)
+{
+    bool r = true;
+
+    if (h->fd != -1 && !hisv7_flush(h))
+        r = false;
+    if (h->dbz != NULL) {
+        if (!dbz_close(h->dbz)) {
+            hisv7_seterror(h, concat("can't close dbz ", h->histpath, " ",
+                                     strerror(errno), NULL));
+            r = false;
+        }
+        h->dbz = NULL;
+    }
+    if (h->fd != -1) {
+        if (close(h->fd) != 0 && errno != EINTR) {
+            hisv7_seterror(h, concat("can't close history ", h->histpath,
+                                     " ", strerror(errno), NULL));
+            r = false;
+        }
+        h->fd = -1;
+    }
+    h->offset = 0;
+    h->dirty = 0;
+    h->nextcheck = 0;
+    h->st.st_ino = (ino_t) -1;
+    h->st.st_dev = (dev_t) -1;
+    return r;
+}
+
+
+/*
+**  unlink files associated with the history structure h
+*/
+static bool
+hisv7_unlink(struct hisv7 *h)
+{
+    static const char *const exts[] = { ".dir", ".index", ".hash", "" };
+    bool r = true;
+    char *p;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(exts); i++) {
+        p = concat(h->histpath, exts[i], NULL);
+        r = (unlink(p) == 0) && r;
+        free(p);
+    }
+    return r;
+}
+
+
+/*
+**  rename files associated with hold to hnew; the history itself comes
+**  last, so that it is only replaced once its index is in place
+*/
+static bool
+hisv7_rename(struct hisv7 *hold, struct hisv7 *hnew)
+{
+    static const char *const exts[] = { ".dir", ".index", ".hash", "" };
+    bool r = true;
+    char *old, *new;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(exts); i++) {
+        old = concat(hold->histpath, exts[i], NULL);
+        new = concat(hnew->histpath, exts[i], NULL);
+        if (rename(old, new) != 0) {
+            hisv7_seterror(hold, concat("can't rename ", old, " to ", new,
+                                        " ", strerror(errno), NULL));
+            r = false;
+        }
+        free(old);
+        free(new);
+    }
+    return r;
+}
+
+
+/*
+**  return a newly constructed, but empty, history structure
+*/
+static struct hisv7 *
+hisv7_new(const char *path, int flags, struct history *history)
+{
+    struct hisv7 *h;
+
+    h = xcalloc(1, sizeof(struct hisv7));
+    h->histpath = path ? xstrdup(path) : NULL;
+    h->flags = flags;
+    h->fd = -1;
+    h->history = history;
+    h->st.st_ino = (ino_t) -1;
+    h->st.st_dev = (dev_t) -1;
+    return h;
+}
+
+
+/*
+**  dispose (and clean up) an existing history structure
+*/
+static bool
+hisv7_dispose(struct hisv7 *h)
+{
+    bool r;
+
+    r = hisv7_closefiles(h);
+    free(h->histpath);
+    free(h->buffer);
+    free(h);
+    return r;
+}
+
+
+/*
+**  store the fields of an entry in a record
+*/
+static void
+hisv7_fillrecord(struct hisv7_record *rec, const HASH *hash, time_t arrived,
+                 time_t posted, time_t expires, const TOKEN *token)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->hash = *hash;
+    rec->arrived = arrived > 0 ? arrived : 0;
+    rec->posted = posted > 0 ? posted : 0;
+    rec->flags = HISV7_ENTRY;
+    if (token != NULL) {
+        rec->expires = expires > 0 ? expires : 0;
+        rec->token = *token;
+        rec->flags |= HISV7_TOKEN;
+    }
+}
+
+
+/*
+**  read the record at offset, which may still be in memory
+*/
+static bool
+hisv7_readrecord(struct hisv7 *h, off_t offset, struct hisv7_record *rec)
+{
+    off_t written;
+    ssize_t n;
+    char location[22];
+
+    written = h->offset - h->buffered * sizeof(struct hisv7_record);
+    if (h->buffered > 0 && offset >= written) {
+        *rec = h->buffer[(offset - written) / sizeof(struct hisv7_record)];
+        return true;
+    }
+    do {
+        n = pread(h->fd, rec, sizeof(*rec), offset);
+    } while (n == -1 && errno == EINTR);
+    if (n != sizeof(*rec) || !(rec->flags & HISV7_ENTRY)) {
+        hisv7_errloc(location, offset);
+        hisv7_seterror(h, concat("can't read record in history ",
+                                 h->histpath, location, NULL));
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  write the hash and offset to the dbz
+*/
+static bool
+hisv7_writedbz(struct hisv7 *h, const HASH *hash, off_t offset)
+{
+    bool r;
+    char location[22];
+    const char *error;
+
+    switch (dbz_store(h->dbz, *hash, offset)) {
+    case DBZSTORE_EXISTS:
+        /* not `false' so that we duplicate the behaviour of hisv6 */
+        error = "dbzstore duplicate message-id ";
+        r = true;
+        break;
+
+    case DBZSTORE_ERROR:
+        error = "dbzstore error ";
+        r = false;
+        break;
+
+    default:
+        error = NULL;
+        r = true;
+        break;
+    }
+    if (error) {
+        hisv7_errloc(location, offset);
+        hisv7_seterror(h, concat(error, h->histpath, ":[",
+                                 HashToText(*hash), "]", location, " ",
+                                 strerror(errno), NULL));
+    }
+    if (r && h->synccount != 0 && ++h->dirty >= h->synccount)
+        r = hisv7_sync(h);
+    return r;
+}
+
+
+/*
+**  append a record for an entry and index it
+*/
+static bool
+hisv7_writerecord(struct hisv7 *h, const HASH *hash, time_t arrived,
+                  time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisv7_record rec;
+    off_t offset;
+    ssize_t n;
+    char location[22];
+
+    if (!(h->flags & HIS_RDWR)) {
+        hisv7_seterror(h, concat("history not open for writing ",
+                                 h->histpath, NULL));
+        return false;
+    }
+    if (h->dbz == NULL) {
+        hisv7_seterror(h, concat("history not open ", h->histpath, NULL));
+        return false;
+    }
+
+    hisv7_fillrecord(&rec, hash, arrived, posted, expires, token);
+    offset = h->offset;
+    if (h->flags & HIS_INCORE) {
+        if (h->buffered == HISV7_BUFFER && !hisv7_flush(h))
+            return false;
+        if (h->buffer == NULL)
+            h->buffer = xmalloc(HISV7_BUFFER * sizeof(struct hisv7_record));
+        h->buffer[h->buffered++] = rec;
+    } else {
+        n = xpwrite(h->fd, &rec, sizeof(rec), offset);
+        if (n != sizeof(rec)) {
+            hisv7_errloc(location, offset);
+            hisv7_seterror(h, concat("can't write history ", h->histpath,
+                                     location, " ", strerror(errno), NULL));
+            return false;
+        }
+    }
+    h->offset += sizeof(rec);
+    return hisv7_writedbz(h, hash, offset);
+}
+
+
+/*
+**  Convert the history v6 text file at the path of h into a history v7,
+**  keeping the text file with .v6 appended to its name.  Lines which can't
+**  be parsed and duplicates are dropped, as expire would do.
+*/
+static bool hisv7_reopen(struct hisv7 *h, const char *oldpath);
+
+static bool
+hisv7_convert(struct hisv7 *h)
+{
+    struct hisv7 *hnew = NULL;
+    QIOSTATE *qp;
+    struct stat st;
+    char *p, *npath, *v6path;
+    const char *error;
+    HASH hash;
+    time_t arrived, posted, expires;
+    TOKEN token;
+    int status;
+    unsigned long count = 0, dropped = 0;
+    bool r = false;
+
+    if ((qp = QIOopen(h->histpath)) == NULL) {
+        hisv7_seterror(h, concat("can't QIOopen history file ", h->histpath,
+                                 " ", strerror(errno), NULL));
+        return false;
+    }
+
+    /* Size the new index after the old one if there is one. */
+    npath = concat(h->histpath, ".n", NULL);
+    hnew = hisv7_new(npath, HIS_CREAT | HIS_RDWR | HIS_INCORE, h->history);
+    free(npath);
+    p = concat(h->histpath, ".dir", NULL);
+    if (stat(p, &st) < 0 && fstat(QIOfileno(qp), &st) == 0)
+        hnew->npairs = st.st_size / HISV7_V6LINE + 1;
+    free(p);
+    if (!hisv7_reopen(hnew, h->histpath))
+        goto fail;
+
+    for (;;) {
+        p = QIOread(qp);
+        if (p == NULL) {
+            if (QIOtoolong(qp)) {
+                dropped++;
+                continue;
+            }
+            break;
+        }
+        status = hisv6_splitline(p, &error, &hash, &arrived, &posted,
+                                 &expires, &token);
+        if (status < 0 || dbz_exists(hnew->dbz, hash)) {
+            dropped++;
+            continue;
+        }
+        if (!hisv7_writerecord(hnew, &hash, arrived, posted, expires,
+                               (status & HISV6_HAVE_TOKEN) ? &token : NULL))
+            goto fail;
+        count++;
+    }
+    if (QIOerror(qp)) {
+        hisv7_seterror(h, concat("can't read history ", h->histpath, " ",
+                                 strerror(errno), NULL));
+        goto fail;
+    }
+    if (!hisv7_closefiles(hnew))
+        goto fail;
+
+    v6path = concat(h->histpath, ".v6", NULL);
+    if (rename(h->histpath, v6path) != 0) {
+        hisv7_seterror(h, concat("can't rename ", h->histpath, " to ",
+                                 v6path, " ", strerror(errno), NULL));
+        free(v6path);
+        goto fail;
+    }
+    free(v6path);
+    if (!hisv7_rename(hnew, h))
+        goto fail;
+    notice("converted history %s to v7, %lu entries, %lu lines dropped",
+           h->histpath, count, dropped);
+    r = true;
+
+ fail:
+    if (!r)
+        hisv7_unlink(hnew);
+    hisv7_dispose(hnew);
+    QIOclose(qp);
+    return r;
+}
+
+
+/*
+**  Reopen (or open from fresh) a history structure; assumes the flags &
+**  path are all set up, ready to roll.  A new history gets an index sized
+**  after the one of oldpath if it isn't NULL and npairs is 0, else sized
+**  for npairs entries.
+*/
+static bool
+hisv7_reopen(struct hisv7 *h, const char *oldpath)
+{
+    struct hisv7_header header;
+    struct stat st;
+    dbzoptions opt;
+    ssize_t n;
+    size_t npairs;
+
+#ifdef DO_TAGGED_HASH
+    hisv7_seterror(h, concat("hisv7 needs untagged dbz, can't open ",
+                             h->histpath, NULL));
+    return false;
+#endif
+
+    if (h->flags & HIS_RDWR) {
+        if (h->flags & HIS_CREAT)
+            h->fd = open(h->histpath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        else
+            h->fd = open(h->histpath, O_RDWR);
+    } else
+        h->fd = open(h->histpath, O_RDONLY);
+    if (h->fd < 0) {
+        hisv7_seterror(h, concat("can't open ", h->histpath, " ",
+                                 strerror(errno), NULL));
+        goto fail;
+    }
+    fdflag_close_exec(h->fd, true);
+    if (fstat(h->fd, &st) < 0) {
+        hisv7_seterror(h, concat("can't fstat ", h->histpath, " ",
+                                 strerror(errno), NULL));
+        goto fail;
+    }
+
+    if (st.st_size == 0 && (h->flags & HIS_RDWR)) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HISV7_MAGIC, sizeof(header.magic));
+        header.version = HISV7_VERSION;
+        header.reclen = sizeof(struct hisv7_record);
+        if (xpwrite(h->fd, &header, sizeof(header), 0) != sizeof(header)) {
+            hisv7_seterror(h, concat("can't write history ", h->histpath,
+                                     " ", strerror(errno), NULL));
+            goto fail;
+        }
+        st.st_size = sizeof(header);
+    } else {
+        memset(&header, 0, sizeof(header));
+        n = pread(h->fd, &header, sizeof(header), 0);
+        if (n > 0 && header.magic[0] == '[') {
+            /* A history v6, which has to be converted first. */
+            if (!(h->flags & HIS_RDWR)) {
+                hisv7_seterror(h, concat("history v6 ", h->histpath,
+                                         " must be opened read/write once",
+                                         " to be converted", NULL));
+                goto fail;
+            }
+            close(h->fd);
+            h->fd = -1;
+            if (!hisv7_convert(h))
+                goto fail;
+            return hisv7_reopen(h, NULL);
+        }
+        if (n != sizeof(header)
+            || memcmp(header.magic, HISV7_MAGIC, sizeof(header.magic)) != 0
+            || header.version != HISV7_VERSION
+            || header.reclen != sizeof(struct hisv7_record)) {
+            hisv7_seterror(h, concat("not a history v7 ", h->histpath,
+                                     NULL));
+            goto fail;
+        }
+    }
+
+    /* Anything after the last whole record is left from a failed write. */
+    h->offset = st.st_size
+        - (st.st_size - sizeof(header)) % sizeof(struct hisv7_record);
+    h->buffered = 0;
+    h->st = st;
+
+    hisv7_dbzoptions(h, &opt);
+    if (h->flags & HIS_CREAT) {
+        /* must only do this once! */
+        h->flags &= ~HIS_CREAT;
+        npairs = (h->npairs == -1) ? 0 : h->npairs;
+        if (oldpath != NULL && h->npairs == 0)
+            h->dbz = dbz_again(h->histpath, oldpath, &opt);
+        else
+            h->dbz = dbz_fresh(h->histpath, dbzsize(npairs), &opt);
+    } else
+        h->dbz = dbz_open(h->histpath, &opt);
+    if (h->dbz == NULL) {
+        hisv7_seterror(h, concat("can't open dbz ", h->histpath, " ",
+                                 strerror(errno), NULL));
+        goto fail;
+    }
+    h->nextcheck = TMRnow() + h->statinterval;
+    return true;
+
+ fail:
+    hisv7_closefiles(h);
+    return false;
+}
+
+
+/*
+**  check if the history file has changed, if so rotate to the new history
+**  file.  Returns false on failure (which is probably fatal as we'll have
+**  closed the files)
+*/
+static bool
+hisv7_checkfiles(struct hisv7 *h)
+{
+    unsigned long t = TMRnow();
+    struct stat st;
+
+    if (h->statinterval == 0)
+        return true;
+
+    if (h->fd == -1) {
+        /* a previous reopen failed */
+        hisv7_closefiles(h);
+        if (!hisv7_reopen(h, NULL))
+            return false;
+    }
+    if (seq_lcompare(t, h->nextcheck) == 1) {
+        if (stat(h->histpath, &st) == 0
+            && (st.st_ino != h->st.st_ino || st.st_dev != h->st.st_dev)) {
+            hisv7_closefiles(h);
+            if (!hisv7_reopen(h, NULL))
+                return false;
+        }
+        h->nextcheck = t + h->statinterval;
+    }
+    return true;
+}
+
+
+/*
+**  open the history database identified by path in mode flags
+*/
+void *
+hisv7_open(const char *path, int flags, struct history *history)
+{
+    struct hisv7 *h;
+
+    his_logger("HISsetup begin", S_HISsetup);
+    h = hisv7_new(path, flags, history);
+    if (path && !hisv7_reopen(h, NULL)) {
+        hisv7_dispose(h);
+        h = NULL;
+    }
+    his_logger("HISsetup end", S_HISsetup);
+    return h;
+}
+
+
+/*
+**  close and free a history handle
+*/
+bool
+hisv7_close(void *history)
+{
+    bool r;
+
+    his_logger("HISclose begin", S_HISclose);
+    r = hisv7_dispose(history);
+    his_logger("HISclose end", S_HISclose);
+    return r;
+}
+
+
+/*
+**  synchronise any outstanding history changes to disk
+*/
+bool
+hisv7_sync(void *history)
+{
+    struct hisv7 *h = history;
+    bool r = true;
+
+    if (!(h->flags & HIS_RDWR) || h->dbz == NULL)
+        return true;
+    his_logger("HISsync begin", S_HISsync);
+    if (!hisv7_flush(h))
+        r = false;
+    if (!dbz_sync(h->dbz)) {
+        hisv7_seterror(h, concat("can't dbzsync ", h->histpath, " ",
+                                 strerror(errno), NULL));
+        r = false;
+    } else
+        h->dirty = 0;
+    his_logger("HISsync end", S_HISsync);
+    return r;
+}
+
+
+/*
+**  fetch the record of `hash' and its offset (if poff isn't NULL); a
+**  reader picks up what the writer added to the index since it was opened
+**  when the hash isn't found
+*/
+static bool
+hisv7_fetch(struct hisv7 *h, const HASH *hash, struct hisv7_record *rec,
+            off_t *poff)
+{
+    off_t offset;
+    char location[22];
+
+    if (h->dbz == NULL) {
+        hisv7_seterror(h, concat("history not open ", h->histpath, NULL));
+        return false;
+    }
+    if (!dbz_fetch(h->dbz, *hash, &offset)
+        && ((h->flags & HIS_RDWR) || !dbz_refresh(h->dbz)
+            || !dbz_fetch(h->dbz, *hash, &offset)))
+        return false;
+    if (!hisv7_readrecord(h, offset, rec))
+        return false;
+    if (memcmp(&rec->hash, hash, sizeof(HASH)) != 0) {
+        hisv7_errloc(location, offset);
+        hisv7_seterror(h, concat("index points to another entry in ",
+                                 h->histpath, location, NULL));
+        return false;
+    }
+    if (poff != NULL)
+        *poff = offset;
+    return true;
+}
+
+
+/*
+**  lookup up the entry `key' in the history database, returning arrived,
+**  posted and expires (for those which aren't NULL pointers), and any
+**  storage token associated with the entry
+**
+**  If any of arrived, posted or expires aren't available, return zero for
+**  that component.
+*/
+bool
+hisv7_lookup(void *history, const char *key, time_t *arrived,
+             time_t *posted, time_t *expires, TOKEN *token)
+{
+    struct hisv7 *h = history;
+    struct hisv7_record rec;
+    HASH hash;
+    bool r;
+
+    his_logger("HISfilesfor begin", S_HISfilesfor);
+    hisv7_checkfiles(h);
+    hash = HashMessageID(key);
+    r = hisv7_fetch(h, &hash, &rec, NULL);
+    if (r) {
+        if (arrived != NULL)
+            *arrived = rec.arrived;
+        if (posted != NULL)
+            *posted = rec.posted;
+        if (expires != NULL)
+            *expires = rec.expires;
+        if (token != NULL && (rec.flags & HISV7_TOKEN))
+            *token = rec.token;
+
+        /* if we have a token then we have the article */
+        r = (rec.flags & HISV7_TOKEN) != 0;
+    }
+    his_logger("HISfilesfor end", S_HISfilesfor);
+    return r;
+}
+
+
+/*
+**  check `key' has been seen in this history database
+*/
+bool
+hisv7_check(void *history, const char *key)
+{
+    struct hisv7 *h = history;
+    HASH hash;
+    bool r;
+
+    his_logger("HIShavearticle begin", S_HIShavearticle);
+    hisv7_checkfiles(h);
+    if (h->dbz == NULL)
+        r = false;
+    else {
+        hash = HashMessageID(key);
+        r = dbz_exists(h->dbz, hash);
+        if (!r && !(h->flags & HIS_RDWR) && dbz_refresh(h->dbz))
+            r = dbz_exists(h->dbz, hash);
+    }
+    his_logger("HIShavearticle end", S_HIShavearticle);
+    return r;
+}
+
+
+/*
+**  check whether each of `count' keys has been seen in this history
+**  database, all at once
+*/
+bool
+hisv7_checkbatch(void *history, const char *const *keys, size_t count,
+                 bool *found)
+{
+    struct hisv7 *h = history;
+    HASH *hashes;
+    size_t i;
+
+    hisv7_checkfiles(h);
+    if (h->dbz == NULL) {
+        hisv7_seterror(h, concat("history not open ", h->histpath, NULL));
+        return false;
+    }
+    his_logger("HIShavearticle begin", S_HIShavearticle);
+    hashes = xmalloc(count * sizeof(HASH));
+    HashMessageIDs(keys, count, hashes);
+    dbz_existsbatch(h->dbz, hashes, count, found);
+    if (!(h->flags & HIS_RDWR)) {
+        for (i = 0; i < count && found[i]; i++)
+            ;
+        if (i < count && dbz_refresh(h->dbz))
+            for (; i < count; i++)
+                if (!found[i])
+                    found[i] = dbz_exists(h->dbz, hashes[i]);
+    }
+    free(hashes);
+    his_logger("HIShavearticle end", S_HIShavearticle);
+    return true;
+}
+
+
+/*
+**  write a history entry, key, with times arrived, posted and expires, and
+**  storage token
+*/
+bool
+hisv7_write(void *history, const char *key, time_t arrived,
+            time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisv7 *h = history;
+    HASH hash;
+    bool r;
+
+    his_logger("HISwrite begin", S_HISwrite);
+    hash = HashMessageID(key);
+    r = hisv7_writerecord(h, &hash, arrived, posted, expires, token);
+    his_logger("HISwrite end", S_HISwrite);
+    return r;
+}
+
+
+/*
+**  remember a history entry, key, with arrival time, and also posting time
+**  if known
+*/
+bool
+hisv7_remember(void *history, const char *key, time_t arrived,
+               time_t posted)
+{
+    struct hisv7 *h = history;
+    HASH hash;
+    bool r;
+
+    his_logger("HISwrite begin", S_HISwrite);
+    hash = HashMessageID(key);
+    r = hisv7_writerecord(h, &hash, arrived, posted, 0, NULL);
+    his_logger("HISwrite end", S_HISwrite);
+    return r;
+}
+
+
+/*
+**  replace an existing history entry, `key', with times arrived, posted
+**  and expires, and (optionally) storage token `token'; the record is
+**  rewritten in place
+*/
+bool
+hisv7_replace(void *history, const char *key, time_t arrived,
+              time_t posted, time_t expires, const TOKEN *token)
+{
+    struct hisv7 *h = history;
+    struct hisv7_record rec;
+    HASH hash;
+    off_t offset, written;
+    ssize_t n;
+    char location[22];
+
+    if (!(h->flags & HIS_RDWR)) {
+        hisv7_seterror(h, concat("history not open for writing ",
+                                 h->histpath, NULL));
+        return false;
+    }
+    hash = HashMessageID(key);
+    if (!hisv7_fetch(h, &hash, &rec, &offset))
+        return false;
+    hisv7_fillrecord(&rec, &hash, arrived, posted, expires, token);
+
+    written = h->offset - h->buffered * sizeof(struct hisv7_record);
+    if (h->buffered > 0 && offset >= written) {
+        h->buffer[(offset - written) / sizeof(struct hisv7_record)] = rec;
+        return true;
+    }
+    n = xpwrite(h->fd, &rec, sizeof(rec), offset);
+    if (n != sizeof(rec)) {
+        hisv7_errloc(location, offset);
+        hisv7_seterror(h, concat("can't write history ", h->histpath,
+                                 location, " ", strerror(errno), NULL));
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  traverse a history database, passing the pieces through a callback;
+**  note that we have more parameters in the callback than the public
+**  interface, we add the internal history struct and the message hash so
+**  we can use those if we need them.  If the callback returns false we
+**  abort the traversal.
+*/
+static bool
+hisv7_traverse(struct hisv7 *h, struct hisv7_walkstate *cookie,
+               const char *reason,
+               bool (*callback)(struct hisv7 *, void *, const HASH *,
+                                time_t, time_t, time_t, const TOKEN *))
+{
+    struct hisv7_record *recs;
+    off_t offset;
+    ssize_t n;
+    size_t i, count;
+    char location[22];
+    bool r = false;
+
+    if (h->fd == -1) {
+        hisv7_seterror(h, concat("history not open ", h->histpath, NULL));
+        return false;
+    }
+    if (!hisv7_flush(h))
+        return false;
+
+    recs = xmalloc(HISV7_CHUNK * sizeof(struct hisv7_record));
+    offset = sizeof(struct hisv7_header);
+
+    /* we come back to again after we hit EOF for the first time, when we
+       pause the server & clean up any records which sneak through in the
+       interim */
+ again:
+    for (;;) {
+        n = pread(h->fd, recs, HISV7_CHUNK * sizeof(struct hisv7_record),
+                  offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            hisv7_errloc(location, offset);
+            hisv7_seterror(h, concat("can't read history ", h->histpath,
+                                     location, " ", strerror(errno), NULL));
+            goto fail;
+        }
+        count = n / sizeof(struct hisv7_record);
+        if (count == 0)
+            break;
+        for (i = 0; i < count; i++) {
+            const struct hisv7_record *rec = &recs[i];
+
+            if (!(rec->flags & HISV7_ENTRY)) {
+                hisv7_errloc(location,
+                             offset + i * sizeof(struct hisv7_record));
+                hisv7_seterror(h, concat("invalid record in history ",
+                                         h->histpath, location, NULL));
+                /* if we're not ignoring errors set the status */
+                if (!cookie->ignore)
+                    goto fail;
+                continue;
+            }
+            if (!(*callback)(h, cookie, &rec->hash, rec->arrived,
+                             rec->posted, rec->expires,
+                             (rec->flags & HISV7_TOKEN) ? &rec->token
+                                                        : NULL)) {
+                hisv7_seterror(h, concat("callback failed ", h->histpath,
+                                         NULL));
+                goto fail;
+            }
+        }
+        offset += count * sizeof(struct hisv7_record);
+    }
+
+    /* must have been EOF, pause the server & clean up any stragglers */
+    if (reason && !cookie->paused) {
+        if (ICCpause(reason) != 0) {
+            hisv7_seterror(h, concat("can't pause server ", h->histpath,
+                                     " ", strerror(errno), NULL));
+            goto fail;
+        }
+        cookie->paused = true;
+        goto again;
+    }
+    r = true;
+
+ fail:
+    free(recs);
+    return r;
+}
+
+
+/*
+**  internal callback used during hisv7_traverse; we just pass on the
+**  parameters the user callback expects
+*/
+static bool
+hisv7_traversecb(struct hisv7 *h UNUSED, void *cookie,
+                 const HASH *hash UNUSED, time_t arrived, time_t posted,
+                 time_t expires, const TOKEN *token)
+{
+    struct hisv7_walkstate *hiscookie = cookie;
+
+    return (*hiscookie->cb.walk)(hiscookie->cookie, arrived, posted,
+                                 expires, token);
+}
+
+
+/*
+**  history API interface to the database traversal routine
+*/
+bool
+hisv7_walk(void *history, const char *reason, void *cookie,
+           bool (*callback)(void *, time_t, time_t, time_t, const TOKEN *))
+{
+    struct hisv7_walkstate hiscookie;
+
+    /* our internal walk routine passes too many parameters, so add a
+       wrapper */
+    hiscookie.cb.walk = callback;
+    hiscookie.cookie = cookie;
+    hiscookie.new = NULL;
+    hiscookie.paused = false;
+    hiscookie.ignore = false;
+    return hisv7_traverse(history, &hiscookie, reason, hisv7_traversecb);
+}
+
+
+/*
+**  internal callback used during expire
+*/
+static bool
+hisv7_expirecb(struct hisv7 *h, void *cookie, const HASH *hash,
+               time_t arrived, time_t posted, time_t expires,
+               const TOKEN *token)
+{
+    struct hisv7_walkstate *hiscookie = cookie;
+    TOKEN ltoken, *t = NULL;
+
+    /* check if we've seen this message id already */
+    if (hiscookie->new && dbz_exists(hiscookie->new->dbz, *hash)) {
+        /* continue after duplicates, it's serious, but not fatal */
+        hisv7_seterror(h, concat("duplicate message-id [",
+                                 HashToText(*hash), "] in history ",
+                                 hiscookie->new->histpath, NULL));
+        return true;
+    }
+
+    /* if we have a token pass it to the discrimination function, which
+       may modify a local copy of it; if it returns false, we just
+       remember the article */
+    if (token) {
+        ltoken = *token;
+        t = &ltoken;
+        if (!(*hiscookie->cb.expire)(hiscookie->cookie, arrived, posted,
+                                     expires, t)) {
+            t = NULL;
+            expires = 0;
+        }
+    }
+
+    /* When t is NULL (no token), the message-ID is removed from history
+     * when the posting time of the article is older than threshold, as set
+     * by the /remember/ line in expire.ctl.  We keep the check for the
+     * arrival time because some entries might not have one. */
+    if (hiscookie->new
+        && (t != NULL || posted >= hiscookie->threshold
+            || (posted <= 0 && arrived >= hiscookie->threshold)))
+        return hisv7_writerecord(hiscookie->new, hash, arrived, posted,
+                                 expires, t);
+    return true;
+}
+
+
+/*
+**  expire the history database, history
+*/
+bool
+hisv7_expire(void *history, const char *path, const char *reason,
+             bool writing, void *cookie, time_t threshold,
+             bool (*exists)(void *, time_t, time_t, time_t, TOKEN *))
+{
+    struct hisv7 *h = history, *hnew = NULL;
+    char *nhistory = NULL;
+    bool r;
+    struct hisv7_walkstate hiscookie;
+
+    /* this flag is always tested in the fail clause, so initialise it
+       now */
+    hiscookie.paused = false;
+
+    /* during expire we ignore errors whilst reading the history file so
+       any errors in it get fixed automagically */
+    hiscookie.ignore = true;
+
+    if (writing && (h->flags & HIS_RDWR)) {
+        hisv7_seterror(h, concat("can't expire from read/write history ",
+                                 h->histpath, NULL));
+        r = false;
+        goto fail;
+    }
+
+    if (writing) {
+        /* form base name for new history file */
+        nhistory = concat(path != NULL ? path : h->histpath, ".n", NULL);
+        hnew = hisv7_new(nhistory, HIS_CREAT | HIS_RDWR | HIS_INCORE,
+                         h->history);
+        hnew->npairs = h->npairs;
+        if (!hisv7_reopen(hnew, h->histpath)) {
+            hisv7_dispose(hnew);
+            hnew = NULL;
+            r = false;
+            goto fail;
+        }
+    }
+
+    /* set up the callback handler */
+    hiscookie.cb.expire = exists;
+    hiscookie.cookie = cookie;
+    hiscookie.new = hnew;
+    hiscookie.threshold = threshold;
+    r = hisv7_traverse(h, &hiscookie, reason, hisv7_expirecb);
+
+ fail:
+    if (writing && hnew != NULL) {
+        if (!hisv7_closefiles(hnew)) {
+            /* error will already have been set */
+            r = false;
+        }
+        if (!r) {
+            /* something went pear shaped, unlink the new files */
+            hisv7_unlink(hnew);
+        } else if (path == NULL) {
+            /* if the new path was explicitly specified don't move the
+               files around, our caller is planning to do it out of
+               band; otherwise replace the old files and reopen them */
+            hisv7_closefiles(h);
+            r = hisv7_rename(hnew, h);
+            if (!hisv7_reopen(h, NULL))
+                r = false;
+        }
+    }
+
+    if (hnew && !hisv7_dispose(hnew))
+        r = false;
+    free(nhistory);
+    if (r == false && hiscookie.paused)
+        ICCgo(reason);
+    return r;
+}
+
+
+/*
+**  control interface
+*/
+bool
+hisv7_ctl(void *history, int selector, void *val)
+{
+    struct hisv7 *h = history;
+    bool r = true;
+
+    switch (selector) {
+    case HISCTLG_PATH:
+        *(char **) val = h->histpath;
+        break;
+
+    case HISCTLS_PATH:
+        if (h->histpath) {
+            hisv7_seterror(h, concat("path already set in handle", NULL));
+            r = false;
+        } else {
+            h->histpath = xstrdup((char *) val);
+            if (!hisv7_reopen(h, NULL)) {
+                free(h->histpath);
+                h->histpath = NULL;
+                r = false;
+            }
+        }
+        break;
+
+    case HISCTLS_STATINTERVAL:
+        h->statinterval = *(time_t *) val * 1000;
+        break;
+
+    case HISCTLS_SYNCCOUNT:
+        h->synccount = *(size_t *) val;
+        break;
+
+    case HISCTLS_NPAIRS:
+        h->npairs = (ssize_t) *(size_t *) val;
+        break;
+
+    case HISCTLS_IGNOREOLD:
+        if (h->npairs == 0 && *(bool *) val) {
+            h->npairs = -1;
+        } else if (h->npairs == -1 && !*(bool *) val) {
+            h->npairs = 0;
+        }
+        break;
+
+    default:
+        /* deliberately doesn't call hisv7_seterror as we don't want to
+         * spam the error log if someone's passing in stuff which would be
+         * relevant to a different history manager */
+        r = false;
+        break;
+    }
+    return r;
+}
@@ -0,0 +1,45 @@
+/*
+** Internal history API interface exposed to HISxxx
+*/
+
+#ifndef HISV7_H
+#define HISV7_H 1
+
+struct token;
+struct histopts;
+struct history;
+
+void *hisv7_open(const char *path, int flags, struct history *);
+
+bool hisv7_close(void *);
+
+bool hisv7_sync(void *);
+
+bool hisv7_lookup(void *, const char *key, time_t *arrived,
+		  time_t *posted, time_t *expires, struct token *token);
+
+bool hisv7_check(void *, const char *key);
+
+bool hisv7_checkbatch(void *, const char *const *keys, size_t count,
+		      bool *found);
+
+bool hisv7_write(void *, const char *key, time_t arrived,
+		 time_t posted, time_t expires, const struct token *token);
+
+bool hisv7_replace(void *, const char *key, time_t arrived,
+		   time_t posted, time_t expires, const struct token *token);
+
+bool hisv7_expire(void *, const char *, const char *, bool,
+		  void *, time_t threshold,
+		  bool (*exists)(void *, time_t, time_t, time_t,
+				 struct token *));
+
+bool hisv7_walk(void *, const char *, void *,
+		bool (*)(void *, time_t, time_t, time_t,
+			 const struct token *));
+
+bool hisv7_remember(void *, const char *key, time_t arrived, time_t posted);
+
+bool hisv7_ctl(void *, int, void *);
+
+#endif
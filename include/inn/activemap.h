@@ -0,0 +1,83 @@
+/*
+**  Shared table of newsgroup statistics.
+**
+**  innd publishes the low and high water marks, estimated article count and
+**  flag of every newsgroup in a file that readers map into memory, so that
+**  nnrpd can answer GROUP and LIST without parsing the active file or asking
+**  the overview method.  The table is a hash of the newsgroup names, which
+**  never change once it has been published; when newsgroups are added or
+**  removed, innd publishes a new table and marks the old one as stale, and
+**  readers transparently switch to the new one.
+**
+**  innd is the only writer.  It brackets its updates with activemap_begin
+**  and activemap_end, which maintain a sequence count that readers check to
+**  retry a lookup that raced with an update, so readers never take a lock.
+*/
+
+#ifndef INN_ACTIVEMAP_H
+#define INN_ACTIVEMAP_H 1
+
+#include <inn/defines.h>
+
+/* The layout of this struct is entirely internal to the implementation. */
+struct activemap;
+
+BEGIN_DECLS
+
+/* Create a new table for the given number of newsgroups, whose names take
+   at most namesize bytes including their nul characters.  It is written to
+   a temporary file and only becomes visible to readers once published.
+   Returns NULL on failure, after warning. */
+struct activemap *activemap_create(const char *path, unsigned long groups,
+                                   size_t namesize);
+
+/* Add a newsgroup to a table being created.  Returns its slot, to be used
+   with activemap_set, or -1 if the table is full. */
+long activemap_add(struct activemap *, const char *group, int lo, int hi,
+                   int count, int flag);
+
+/* Make a newly created table visible to readers, replacing the file
+   previously at its path.  Returns false on failure, after warning. */
+bool activemap_publish(struct activemap *);
+
+/* Return the slot of a newsgroup in a table, or -1 if it isn't there. */
+long activemap_find(struct activemap *, const char *group);
+
+/* Read or change the statistics or the flag in a slot.  Only innd may use
+   these, and activemap_set and activemap_setflag must be called between
+   activemap_begin and activemap_end. */
+void activemap_get(struct activemap *, long slot, int *lo, int *hi,
+                   int *count);
+void activemap_set(struct activemap *, long slot, int lo, int hi, int count);
+void activemap_setflag(struct activemap *, long slot, int flag);
+void activemap_begin(struct activemap *);
+void activemap_end(struct activemap *);
+
+/* Mark a table as replaced so that readers reopen the file, and free it. */
+void activemap_retire(struct activemap *);
+
+/* Open the published table for reading.  Returns NULL if it doesn't exist
+   or is unusable. */
+struct activemap *activemap_open(const char *path);
+
+/* Look up a newsgroup, with the same interface as OVgroupstats.  Returns
+   false if the newsgroup isn't in the table or if the table went away. */
+bool activemap_lookup(struct activemap *, const char *group, int *lo,
+                      int *hi, int *count, int *flag);
+
+/* Switch a table opened for reading to the current one if innd replaced
+   it.  Returns a number that changes each time the table does, so that
+   callers keeping data indexed by slot know when to discard it, or 0 if no
+   table is available. */
+unsigned long activemap_refresh(struct activemap *);
+
+/* Return the number of slots of a table, which bounds the slots returned
+   by activemap_find. */
+unsigned long activemap_slots(struct activemap *);
+
+/* Free a table opened for reading. */
+void activemap_free(struct activemap *);
+
+END_DECLS
+
+#endif /* INN_ACTIVEMAP_H */
@@ -12,6 +12,14 @@
  * of the data is used + left.  If a buffer is just used to store some data,
  * used can be set to 0 and left stores the length of the data.
  *
+ * The buffer_ring_* functions instead treat the buffer as a ring: the data
+ * starts at used and wraps around the end of the allocated memory, so that
+ * consuming data from the front never requires moving what remains.  Such a
+ * buffer holds at most two segments of data, which can be read from or
+ * written to a file descriptor in one call with readv and writev.  A ring
+ * that has not wrapped is also a valid ordinary buffer.  Do not mix the
+ * ordinary append and read functions with a ring that may have wrapped.
+ *
  * The canonical version of this file is maintained in the rra-c-util package,
  * which can be found at <https://www.eyrie.org/~eagle/software/rra-c-util/>.
  *
@@ -50,6 +58,8 @@
 #include <stdarg.h>
 #include <sys/types.h>
 
+struct iovec;
+
 struct buffer {
     size_t size; /* Total allocated length. */
     size_t used; /* Data already used. */
@@ -141,6 +151,53 @@ bool buffer_read_all(struct buffer *, int fd) __attribute__((__nonnull__));
  */
 bool buffer_read_file(struct buffer *, int fd) __attribute__((__nonnull__));
 
+/*
+ * Append data to a ring buffer, after whatever is there and possibly wrapping
+ * around the end of the allocated memory.  When the ring is full, it is
+ * linearized and then grown.
+ */
+void buffer_ring_append(struct buffer *, const char *data, size_t length)
+    __attribute__((__nonnull__(1)));
+
+/*
+ * Mark length bytes at the front of a ring buffer as consumed.  When the
+ * ring becomes empty, used goes back to 0.
+ */
+void buffer_ring_consume(struct buffer *, size_t length)
+    __attribute__((__nonnull__));
+
+/*
+ * Rearrange the data of a ring buffer so that it is contiguous and starts at
+ * the beginning of the allocated memory.  Invalidates pointers into the
+ * buffer.
+ */
+void buffer_ring_linearize(struct buffer *) __attribute__((__nonnull__));
+
+/*
+ * Fill iov (which must have room for two elements) with the data segments of
+ * a ring buffer, and return how many were filled, which is 0 if the ring is
+ * empty.
+ */
+int buffer_ring_iov(struct buffer *, struct iovec *iov)
+    __attribute__((__nonnull__));
+
+/*
+ * Read from a file descriptor into the free space of a ring buffer with a
+ * single readv call, retrying only if interrupted by a signal.  Returns the
+ * number of bytes read, or -1 on error with errno set.  A full ring is grown
+ * first.
+ */
+ssize_t buffer_ring_read(struct buffer *, int fd) __attribute__((__nonnull__));
+
+/*
+ * Write the data of a ring buffer to a file descriptor with a single writev
+ * call, retrying only if interrupted by a signal, and consume what was
+ * written.  Returns the number of bytes written, or -1 on error with errno
+ * set.
+ */
+ssize_t buffer_ring_write(struct buffer *, int fd)
+    __attribute__((__nonnull__));
+
 END_DECLS
 
 #endif /* INN_BUFFER_H */
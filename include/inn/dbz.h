@@ -37,6 +37,13 @@ typedef struct {
     /* Whether dbzstore should update the database async or sync.  This
        is only applicable if you're not mmaping the database */
     bool             nonblock;
+    /* Whether to keep a Bloom filter of the stored keys in memory, so that
+       lookups of most keys not in the database don't touch the tables.
+       Only used by the process writing to the database. */
+    bool             filter;
+    /* Whether to back the in-core tables with huge pages, which makes the
+       random lookups in large tables cheaper for the processor. */
+    bool             hugepages;
 } dbzoptions;
 
 #if !defined(lint) && (defined(__SUNPRO_C) || defined(_nec_ews))
@@ -62,13 +69,61 @@ extern bool dbzclose(void);
 extern bool dbzfresh(const char *name, off_t size);
 extern bool dbzagain(const char *name, const char *oldname);
 extern bool dbzexists(const HASH key);
+extern bool dbzexistsbatch(const HASH *keys, size_t count, bool *found);
 extern bool dbzfetch(const HASH key, off_t *value);
 extern DBZSTORE_RESULT dbzstore(const HASH key, off_t data);
+extern bool dbzstorebatch(const HASH *keys, const off_t *data, size_t count,
+                          DBZSTORE_RESULT *results);
 extern bool dbzsync(void);
 extern long dbzsize(off_t contents);
 extern void dbzsetoptions(const dbzoptions options);
+
+/* Read the tables of a database from start to end in large chunks, so
+   that the lookups that follow find them in memory instead of going to
+   disk for each of them, then lock their in-core copies in memory if lock
+   is set.  progress, if not NULL, is called now and then with the suffix
+   of the file being read, the bytes read so far and its size; returning
+   false stops the warm-up.  This can run in another thread than the one
+   using the database, as long as the database isn't closed meanwhile.
+   Returns false on error or if stopped. */
+typedef bool (*dbz_progress)(void *cookie, const char *what, off_t done,
+                             off_t total);
+extern bool dbzwarmup(bool lock, dbz_progress progress, void *cookie);
 extern void dbzgetoptions(dbzoptions *options);
 
+/* The functions above work on the one open database, which can be set
+   aside to use another one and restored later. */
+struct dbz;
+typedef struct dbz dbzstate;
+extern dbzstate *dbzsave(void);
+extern bool dbzrestore(dbzstate *state);
+
+/* The same functions on a handle, so that several databases can be open at
+   once.  The options are copied when the database is opened.  Lookups on
+   one handle may run concurrently as long as nothing stores into, syncs,
+   refreshes or closes it at the same time (except with the tagged format,
+   whose lookups share a file position).  A read-only handle only sees the
+   generations another process added after dbz_refresh.  dbz_fresh and
+   dbz_again create the database and return it open. */
+extern struct dbz *dbz_open(const char *name, const dbzoptions *options);
+extern struct dbz *dbz_fresh(const char *name, off_t size,
+                             const dbzoptions *options);
+extern struct dbz *dbz_again(const char *name, const char *oldname,
+                             const dbzoptions *options);
+extern bool dbz_close(struct dbz *db);
+extern bool dbz_exists(struct dbz *db, const HASH key);
+extern void dbz_existsbatch(struct dbz *db, const HASH *keys, size_t count,
+                            bool *found);
+extern bool dbz_fetch(struct dbz *db, const HASH key, off_t *value);
+extern DBZSTORE_RESULT dbz_store(struct dbz *db, const HASH key, off_t data);
+extern void dbz_storebatch(struct dbz *db, const HASH *keys,
+                           const off_t *data, size_t count,
+                           DBZSTORE_RESULT *results);
+extern bool dbz_sync(struct dbz *db);
+extern bool dbz_warmup(struct dbz *db, bool lock, dbz_progress progress,
+                       void *cookie);
+extern bool dbz_refresh(struct dbz *db);
+
 #ifdef DBZTEST
 extern int timediffms(struct timeval start, struct timeval end);
 extern void RemoveDBZ(char *filename);
@@ -0,0 +1,44 @@
+/*
+**  Shared-memory ring of records from innd to a channel feed.
+**
+**  innd writes a record for every article it sends to the channel into a
+**  ring in a file that both processes map into memory, and only writes a
+**  newline to the channel's pipe when the ring was empty, to wake the
+**  program up.  The program then takes all the records it finds in the ring
+**  without any system call.  There is one writer and one reader, and
+**  neither takes locks.
+*/
+
+#ifndef INN_FEEDRING_H
+#define INN_FEEDRING_H 1
+
+#include <inn/defines.h>
+#include <inn/buffer.h>
+
+/* The layout of this struct is entirely internal to the implementation. */
+struct feedring;
+
+BEGIN_DECLS
+
+/* Open the ring at path, creating it with room for size bytes of records
+   (rounded up to a power of two) if it doesn't exist or is invalid.  An
+   existing ring keeps its size and the records still in it.  A size of 0
+   only opens an existing ring.  Returns NULL on failure, after warning. */
+struct feedring *feedring_open(const char *path, unsigned long size);
+
+/* Add a record to the ring.  Returns false if there is no room for it.
+   Otherwise, sets wake to whether the reader may have found the ring empty
+   and has to be woken up. */
+bool feedring_put(struct feedring *, const void *data, size_t length,
+                  bool *wake);
+
+/* Append the oldest record of the ring to the buffer and remove it from
+   the ring.  Returns false if the ring is empty. */
+bool feedring_get(struct feedring *, struct buffer *);
+
+/* Unmap the ring and free the structure. */
+void feedring_free(struct feedring *);
+
+END_DECLS
+
+#endif /* INN_FEEDRING_H */
@@ -48,7 +48,8 @@ unsigned long   hash_searches(struct hash *);
 unsigned long   hash_collisions(struct hash *);
 unsigned long   hash_expansions(struct hash *);
 
-/* Hash functions available for callers. */
+/* Hash functions available for callers.  hash_string depends on the
+   features of the processor, so its results should not be stored. */
 unsigned long   hash_string(const void *);
 
 /* Functions useful for constructing new hashes. */
@@ -0,0 +1,57 @@
+/*
+**  Latency histogram interface.
+**
+**  A histogram records durations in microseconds in log-linear buckets, in
+**  the style of HdrHistogram: each power of two is split into sixteen
+**  linear sub-buckets, so quantiles are accurate to within about 6% over
+**  the whole range while recording stays cheap and never allocates.
+*/
+
+#ifndef INN_HISTOGRAM_H
+#define INN_HISTOGRAM_H 1
+
+#include <inn/defines.h>
+#include <sys/types.h>
+
+struct buffer;
+struct histogram;
+struct timeval;
+
+BEGIN_DECLS
+
+/* Allocate a new, empty histogram, and free one. */
+struct histogram *histogram_new(void);
+void histogram_free(struct histogram *);
+
+/* Record a duration in microseconds, or the time elapsed since start as
+   returned by gettimeofday. */
+void histogram_record(struct histogram *, unsigned long usec);
+void histogram_record_since(struct histogram *, const struct timeval *start);
+
+/* Forget everything recorded so far. */
+void histogram_reset(struct histogram *);
+
+/* Add the durations recorded in the second histogram to the first. */
+void histogram_merge(struct histogram *, const struct histogram *);
+
+/* The size in bytes of a histogram.  A histogram holds no pointers, so it
+   can be written to and read back from a file as it is, by the same
+   build. */
+size_t histogram_size(void);
+
+/* The number of recorded durations, and the duration in microseconds below
+   which the fraction q (between 0 and 1) of them fall. */
+unsigned long histogram_count(const struct histogram *);
+unsigned long histogram_quantile(const struct histogram *, double q);
+
+/* The sum of all the recorded durations in microseconds. */
+double histogram_sum(const struct histogram *);
+
+/* Append a one-line summary to a buffer: the count followed by the mean,
+   p50, p99, p999 and maximum durations in microseconds, without a
+   trailing newline. */
+void histogram_summary(const struct histogram *, struct buffer *);
+
+END_DECLS
+
+#endif /* INN_HISTOGRAM_H */
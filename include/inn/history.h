@@ -29,6 +29,28 @@ struct histstats {
     int misses;
     /* number of does not exists (negative hit, but not in cache) */
     int dne;
+    /* number of entries evicted from the cache to make room */
+    int evicted;
+    /* number of cache entries in use */
+    int used;
+    /* total number of cache entries */
+    int size;
+};
+
+/*
+**  structure passed to HISctl with HISCTLS_WARMUP
+*/
+struct histwarmup {
+    /* bytes to read at the end of the history text, where the most recent
+       entries are */
+    off_t tail;
+    /* whether to lock the in-core data in memory once read */
+    bool lock;
+    /* called now and then with the suffix added to the path of the history
+       to name the file being read, the bytes read so far and the total;
+       returning false stops the warm-up */
+    bool (*progress)(void *cookie, const char *what, off_t done, off_t total);
+    void *cookie;
 };
 
 
@@ -54,6 +76,12 @@ struct histstats {
 /* hint that the data should be kept mmap()ed */
 #define HIS_MMAP (1<<4)
 
+/* hint that a filter of the stored keys should be kept in core */
+#define HIS_FILTER (1<<5)
+
+/* hint that in-core data should be backed by huge pages */
+#define HIS_HUGEPAGES (1<<6)
+
 /*
 **  values passed to HISctl
 */
@@ -76,7 +104,28 @@ enum {
     /* (time_t) interval, in s, between stats of the history database
      * for * detecting a replacement, or 0 to disable (no checks);
      * defaults {hisv6, taggedhash} */
-    HISCTLS_STATINTERVAL
+    HISCTLS_STATINTERVAL,
+
+    /* (size_t) how many written entries may be held in memory to be
+     * written at once, or 0 to write each of them right away; held
+     * entries are seen by lookups {hisv6} */
+    HISCTLS_WRITEBEHIND,
+
+    /* (bool) whether to sync the history to disk on each write {hisv6} */
+    HISCTLS_DATASYNC,
+
+    /* (ignored) write the entries held in memory now {hisv6} */
+    HISCTLS_FLUSH,
+
+    /* (struct histwarmup *) read what lookups need into memory; may be
+     * called from another thread than the one using the history, which
+     * must not be closed until it returns {hisv6} */
+    HISCTLS_WARMUP,
+
+    /* (size_t) number of threads parsing the history text and calling the
+     * callback of HISexpire, which must then be safe to call from several
+     * threads at once, or 0 to do it all in the calling thread {hisv6} */
+    HISCTLS_EXPIRETHREADS
 
 };
 
@@ -87,6 +136,8 @@ void                    HISsetcache(struct history *, size_t);
 bool                    HISlookup(struct history *, const char *, time_t *,
 				  time_t *, time_t *, struct token *);
 bool                    HIScheck(struct history *, const char *);
+bool                    HIScheckbatch(struct history *, const char *const *,
+				      size_t, bool *);
 bool                    HISwrite(struct history *, const char *, time_t,
 				 time_t, time_t, const struct token *);
 bool                    HISremember(struct history *, const char *, time_t, time_t);
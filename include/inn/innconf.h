@@ -32,13 +32,24 @@ struct innconf {
 
     /* Feed Configuration */
     unsigned long artcutoff;    /* Max accepted article age */
+    unsigned long backpressurelatency; /* Storage latency slowing peers */
     char *bindaddress;          /* Which interface IP to bind to */
     char *bindaddress6;         /* Which interface IPv6 to bind to */
+    unsigned long cancelbatch;  /* Cancels queued to be applied together */
     bool dontrejectfiltered;    /* Don't reject filtered article? */
+    unsigned long filterworkers; /* Processes running the article filters */
     unsigned long hiscachesize; /* Size of the history cache in kB */
+    bool hisdatasync;           /* Sync history to disk on each write? */
+    bool hisfilter;             /* Keep a filter of known Message-IDs? */
+    bool hishugepages;          /* Back in-core history with huge pages? */
+    bool hiswarmup;             /* Read history into memory at startup? */
+    bool hiswarmuplock;         /* Then lock it in memory? */
+    unsigned long hiswarmuptail; /* kB at the end of history text to read */
+    unsigned long hiswritebehind; /* History entries written at once */
     bool ignorenewsgroups;      /* Propagate cmsgs by affected group? */
     bool immediatecancel;       /* Immediately cancel timecaf messages? */
     unsigned long linecountfuzz;/* Check linecount and reject if off by more */
+    unsigned long maxartinmemory; /* Receive larger articles into a file */
     unsigned long maxartsize;   /* Reject articles bigger than this */
     unsigned long maxconnections; /* Max number of incoming NNTP connections */
     char *pathalias;            /* Prepended Host for the Path: line */
@@ -47,6 +58,7 @@ struct innconf {
     unsigned long port;         /* Which port innd should listen on */
     bool refusecybercancels;    /* Reject message IDs with "<cancel."? */
     bool remembertrash;         /* Put unwanted article IDs into history */
+    bool reuseport;             /* Share the port with other servers */
     char *sourceaddress;        /* Source IP for outgoing NNTP connections */
     char *sourceaddress6;       /* Source IPv6 for outgoing NNTP connections */
     bool verifycancels;         /* Verify cancels against article author */
@@ -57,9 +69,14 @@ struct innconf {
 
     /* History settings */
     char *hismethod;            /* Which history method to use */
+    char *hisserver;            /* Host of hisserver for hisremote */
+    unsigned long hisserverport; /* Port of hisserver */
+    struct vector *hisshards;   /* Directories of the history shards */
     
     /* Article Storage */
     unsigned long cnfscheckfudgesize; /* Additional CNFS integrity checking */
+    unsigned long cnfswritebuffer; /* Size of CNFS write buffers in KB */
+    unsigned long cnfswritedelay; /* Longest an article waits in them */
     bool enableoverview;        /* Store overview info for articles? */
     struct vector
       *extraoverviewadvertised; /* Extra overview fields for LIST OVERVIEW.FMT */
@@ -69,28 +86,46 @@ struct innconf {
     bool mergetogroups;         /* Refile articles from to.* into to */
     bool nfswriter;             /* Use NFS writer functionality */
     unsigned long overcachesize; /* fd size cache for tradindexed */
+    unsigned long overcachemapsize; /* Mapped KB limit for that cache */
     char *ovgrouppat;           /* Newsgroups to store overview for */
+    unsigned long ovhotsize;    /* KB of recent overview kept in memory */
     char *ovmethod;             /* Which overview method to use */
+    unsigned long ovqueuesize;  /* Overview writer thread queue length */
+    unsigned long ovreplicationhours; /* Hours of overview changes logged */
+    unsigned long ovtokenindexsize; /* KB of the token to overview index */
     bool storeonxref;           /* SMstore use Xref to detemine class? */
+    bool timecafdeferclean;     /* Leave CAF cleaning to cafclean? */
+    unsigned long timehashdedupsize; /* Smallest body timehash shares */
     bool useoverchan;           /* overchan write the overview, not innd? */
     bool wireformat;            /* Store tradspool articles in wire format? */
     bool xrefslave;             /* Act as a slave of another server? */
+    bool xrefslavefilters;      /* Run the article filters as a slave? */
 
     /* Reading */
     bool allownewnews;          /* Allow use of the NEWNEWS command */
+    unsigned long articlecachesize; /* Size in KB of the shared article cache */
     bool articlemmap;           /* Use mmap to read articles? */
     unsigned long clienttimeout;  /* How long nnrpd can be inactive */
     unsigned long initialtimeout; /* How long nnrpd waits for first command */
     unsigned long msgidcachesize; /* Number of entries in the message ID cache */
+    unsigned long newnewsindexhours; /* Hours of arrivals logged for NEWNEWS */
     bool nfsreader;             /* Use NFS reader functionality */
     unsigned long nfsreaderdelay; /* Delay applied to article arrival */
     bool nnrpdcheckart;         /* Check article existence before returning? */
     char *nnrpdflags;           /* Arguments to pass when spawning nnrpd */
     unsigned long nnrpdloadlimit; /* Maximum getloadvg() we allow */
+    unsigned long nnrpdovercachesize; /* Size of the OVER reply cache */
+    unsigned long nnrpdreadahead; /* Articles read ahead when sequential */
     bool noreader;              /* Refuse to fork nnrpd for readers? */
     bool readerswhenstopped;    /* Allow nnrpd when server is paused */
     bool readertrack;           /* Use the reader tracking system? */
+    bool sharedactive;          /* Publish group stats for nnrpd? */
+    unsigned long sharedmsgidcachesize; /* Entries in the shared token cache */
+    bool tradindexedcompact;    /* Write compact tradindexed .IDX files? */
+    bool tradindexedcompress;   /* Compress new tradindexed .DAT files? */
     bool tradindexedmmap;       /* Whether to mmap for tradindexed */
+    unsigned long tradindexedpreadsize; /* Read smaller groups with pread */
+    unsigned long tradindexedrepack; /* Expire in place up to this % wasted */
 
     /* Reading -- Keyword Support */
     bool keywords;              /* Generate keywords in overview? */
@@ -137,6 +172,8 @@ struct innconf {
     char *tlseccurve;           /* ECDH curve name */
     bool tlspreferserverciphers; /* Make server select the cipher */
     struct vector *tlsprotocols; /* List of supported TLS versions */
+    bool tlsktls;               /* Let the kernel encrypt TLS records */
+    unsigned long tlsticketlifetime; /* Shared session ticket key lifetime */
 
     /* Monitoring */
     bool doinnwatch;            /* Start innwatch from rc.news? */
@@ -159,11 +196,15 @@ struct innconf {
     bool logipaddr;             /* Log by host IP address? */
     bool logsitename;           /* Log outgoing site names? */
     bool logstatus;             /* Send a status report to syslog? */
+    unsigned long logsync;      /* Seconds between syncs of the logs */
     bool logtrash;              /* Log unwanted newsgroups? */
+    bool logwriter;             /* Write the logs from a child process? */
+    bool nnrpdcommandstats;     /* Record per-command latencies and bytes? */
     bool nnrpdoverstats;        /* Log overview statistics? */
     bool nntplinklog;           /* Put storage token into the log? */
     char *stathist;             /* Filename for history profiler outputs */
     unsigned long status;       /* Status file update interval */
+    bool statusmetrics;         /* Serve statistics on a local socket? */
     unsigned long timer;        /* Performance monitoring interval */
 
     /* System Tuning */
@@ -173,6 +214,8 @@ struct innconf {
     unsigned long chanretrytime;/* How long before channel restarts */
     unsigned long datamovethreshold; /* Threshold to extend buffer or move data */
     unsigned long icdsynccount; /* Articles between active & history updates */
+    char *inndcpus;             /* Processors innd runs on */
+    char *innfeedcpus;          /* Processors innfeed runs on */
     unsigned long keepmmappedthreshold; /* Threshold for keeping mmap in buffindexed */
     unsigned long maxcmdreadsize; /* Max NNTP command read size used by innd */
     unsigned long maxforks;     /* Give up after this many fork failure. */
@@ -180,9 +223,12 @@ struct innconf {
     long nicekids;              /* Child processes get niced to this */
     unsigned long nicenewnews;  /* If NEWNEWS command is used, nice to this */
     unsigned long nicennrpd;    /* nnrpd is niced to this */
+    char *nnrpdcpus;            /* Processors nnrpd runs on */
+    char *ovsqlitecpus;         /* Processors ovsqlite-server runs on */
     unsigned long pauseretrytime; /* Seconds before seeing if pause is ended */
     unsigned long peertimeout;  /* How long peers can be inactive */
     long rlimitnofile;          /* File descriptor limit to set */
+    unsigned long sitebuffermax; /* KB queued for channel feeds before spooling */
 
     /* Paths */
     char *patharchive;          /* Archived news */
@@ -216,9 +262,16 @@ enum innconf_quoting {
 
 BEGIN_DECLS
 
-/* Parse the given file into innconf, using the default path if NULL. */
+/* Parse the given file into innconf, using the default path if NULL.  An
+   up-to-date snapshot of the file is used instead if there is one. */
 bool innconf_read(const char *path);
 
+/* Parse the given file into innconf, like innconf_read, and save the result
+   as the snapshot of that file, which innconf_read then loads instead of
+   parsing the file until it changes.  Returns false, after warning, if
+   either fails. */
+bool innconf_write_snapshot(const char *path);
+
 /* Free an innconf struct and all allocated memory for it. */
 void innconf_free(struct innconf *);
 
@@ -28,6 +28,7 @@ typedef char ICC_PROTOCOLTYPE ;
  * at the same time. */
 #define SC_ADDHIST	'a'
 #define SC_ALLOW	'D'
+#define SC_BATCH	'K'
 #define SC_BEGIN	'b'
 #define SC_CANCEL	'c'
 #define SC_CHANGEGROUP	'u'
@@ -38,6 +39,7 @@ typedef char ICC_PROTOCOLTYPE ;
 #define SC_FLUSHLOGS	'g'
 #define SC_GO		'h'
 #define SC_HANGUP	'i'
+#define SC_LATENCY	'G'
 #define SC_LOGMODE	'E'
 #define SC_LOWMARK	'L'
 #define SC_MODE		's'
@@ -65,7 +67,7 @@ typedef char ICC_PROTOCOLTYPE ;
 #define SC_XEXEC	'y'
 
     /* Yes, we don't want anyone to use this. */
-#define SC_FIRSTFREE	G
+#define SC_FIRSTFREE	I
 
 #define MAX_REASON_LEN	80
 
@@ -0,0 +1,61 @@
+/*
+**  Shared table of latency histograms.
+**
+**  Processes of the same kind, for instance all the nnrpd processes, add
+**  what they measured of each of their operations, a histogram of the
+**  durations and a count of bytes, to a file of slots found by the hash of
+**  a key, such as the name of an access group.  The names of the operations
+**  are kept in the file, so that other programs can read it without knowing
+**  them.  When all the slots are taken by other keys, the additions for a
+**  new key are dropped.
+*/
+
+#ifndef INN_LATENCYTABLE_H
+#define INN_LATENCYTABLE_H 1
+
+#include <inn/defines.h>
+#include <sys/types.h>
+
+struct histogram;
+
+/* The layout of this struct is entirely internal to the implementation. */
+struct latency_table;
+
+BEGIN_DECLS
+
+/* Open the table at path, creating it with the given number of slots and
+   the nops operations named in ops if it doesn't exist yet.  If ops is
+   NULL, the table is opened read-only and must exist.  Returns NULL on
+   failure, or if the table exists with other operations, after
+   warning. */
+struct latency_table *latency_table_open(const char *path,
+                                         unsigned long slots,
+                                         const char *const *ops, size_t nops);
+
+/* Add a histogram and a count of bytes to what is recorded for an
+   operation of key.  Returns false, after warning, if the table cannot be
+   updated, or if it has no room left for key. */
+bool latency_table_add(struct latency_table *, const char *key, size_t op,
+                       const struct histogram *, unsigned long bytes);
+
+/* The number of slots and of operations of a table, and the name of an
+   operation. */
+unsigned long latency_table_slots(const struct latency_table *);
+size_t latency_table_ops(const struct latency_table *);
+const char *latency_table_opname(const struct latency_table *, size_t op);
+
+/* Return the key of a slot, or NULL if the slot is unused.  The key is
+   only valid until the next call. */
+const char *latency_table_key(struct latency_table *, unsigned long slot);
+
+/* Read what is recorded in a slot for an operation into hist and bytes.
+   Returns false if it cannot be read. */
+bool latency_table_get(struct latency_table *, unsigned long slot, size_t op,
+                       struct histogram *hist, unsigned long *bytes);
+
+/* Close the table and free the structure. */
+void latency_table_free(struct latency_table *);
+
+END_DECLS
+
+#endif /* INN_LATENCYTABLE_H */
@@ -57,6 +57,15 @@ extern bool             uwildmat(const char *text, const char *pat);
 extern bool             uwildmat_simple(const char *text, const char *pat);
 extern enum uwildmat    uwildmat_poison(const char *text, const char *pat);
 
+/* Compiled wildmat expressions, for matching one against many strings. */
+struct wildmat;
+extern struct wildmat * uwildmat_compile(const char *pat, bool allowpoison);
+extern struct wildmat * uwildmat_compile_list(char *const *pats,
+                                              bool allowpoison);
+extern enum uwildmat    uwildmat_match(const struct wildmat *,
+                                       const char *text);
+extern void             uwildmat_free(struct wildmat *);
+
 
 /*
 **  FILE LOCKING
@@ -76,8 +85,11 @@ extern bool     inn_lock_range(int fd, enum inn_locktype type, bool block,
 **  MISCELLANEOUS UTILITY FUNCTIONS
 */
 extern void     daemonize(const char *path);
+extern bool     inn_setaffinity(const char *list);
+extern char *   inn_getaffinity(void);
 extern int      getfdlimit(void);
 extern int      setfdlimit(unsigned int limit);
+extern int      setfdlimit_any(unsigned int limit);
 extern void     (*xsignal(int signum, void (*sigfunc)(int)))(int);
 extern void     (*xsignal_norestart(int signum, void (*sigfunc)(int)))(int);
 extern void     xsignal_mask(void);
@@ -158,6 +170,8 @@ typedef struct {
 extern HASH     Hash(const void *value, const size_t len);
 /* Return the hash of a case mapped message-id */
 extern HASH     HashMessageID(const char *MessageID);
+extern void     HashMessageIDs(const char *const *MessageIDs, size_t count,
+                               HASH *hashes);
 extern bool     HashEmpty(const HASH hash);
 extern void     HashClear(HASH *hash);
 extern char *   HashToText(const HASH hash);
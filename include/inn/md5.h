@@ -69,6 +69,8 @@ struct md5_context {
 };
 
 extern void md5_hash(const unsigned char *, size_t, unsigned char *);
+extern void md5_hash_many(const unsigned char *const *, const size_t *,
+                          size_t count, unsigned char *);
 extern void md5_init(struct md5_context *);
 extern void md5_update(struct md5_context *, const unsigned char *, size_t);
 extern void md5_final(struct md5_context *);
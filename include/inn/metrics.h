@@ -0,0 +1,36 @@
+/*
+**  Formatting of statistics for monitoring systems.
+**
+**  Programs that export their counters build the reply in a buffer with
+**  these functions, which produce the OpenMetrics text format (as scraped by
+**  Prometheus): each family of metrics is introduced by its type and help
+**  text, then comes one sample per line with its labels, and the whole
+**  exposition ends with a line containing only "# EOF".
+*/
+
+#ifndef INN_METRICS_H
+#define INN_METRICS_H 1
+
+#include <inn/defines.h>
+
+struct buffer;
+
+BEGIN_DECLS
+
+/* Introduce a family of metrics.  type is one of "counter", "gauge" or
+   "info".  The samples of a counter family must be named with a _total
+   suffix, and those of an info family with an _info suffix. */
+void metrics_family(struct buffer *, const char *name, const char *type,
+                    const char *help);
+
+/* Append a sample.  The arguments after value are label names and values,
+   alternately, terminated by a NULL pointer; label values are quoted as
+   needed. */
+void metrics_sample(struct buffer *, const char *name, double value, ...);
+
+/* End the exposition. */
+void metrics_end(struct buffer *);
+
+END_DECLS
+
+#endif /* INN_METRICS_H */
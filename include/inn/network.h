@@ -37,6 +37,7 @@
 #include "inn/portable-socket.h"
 #include "inn/portable-stdbool.h"
 
+#include <sys/select.h>
 #include <sys/types.h>
 
 BEGIN_DECLS
@@ -93,15 +94,50 @@ socket_type network_accept_any(socket_type fds[], unsigned int count,
 
 /*
  * Create a socket and connect it to the remote service given by the linked
- * list of addrinfo structs.  Returns the new file descriptor on success and
- * INVALID_SOCKET on failure, with the error left in errno.  Takes an optional
- * source address and a timeout in seconds, which may be 0 for no timeout.
+ * list of addrinfo structs, racing its addresses as network_race_start does.
+ * Returns the new file descriptor on success and INVALID_SOCKET on failure,
+ * with the error left in errno.  Takes an optional source address and a
+ * timeout in seconds for each address, which may be 0 for no timeout.
  * (Source may also be "all" or "any", which mean the same thing as NULL: do
  * not use any particular source address.)
  */
 socket_type network_connect(const struct addrinfo *, const char *source,
                             time_t) __attribute__((__nonnull__(1)));
 
+/*
+ * Racing connection attempts to the addresses of a remote service, as
+ * recommended by RFC 8305, for callers with their own event loop.  The
+ * addresses are tried alternating between the family of the first one and
+ * the other ones, starting another attempt every stagger seconds as long as
+ * none of those in progress has connected, or at once when all of them have
+ * failed.  An attempt is given up after timeout seconds, unless it is 0.  The
+ * list of addrinfo structs must not be freed before the race.
+ *
+ * network_race_poll never blocks.  It returns the socket of the first attempt
+ * that connected, in blocking mode, which is then the caller's to close.
+ * Otherwise, it returns INVALID_SOCKET with errno set to EINPROGRESS while
+ * attempts are in progress, after filling set and maxfd with their sockets
+ * and wait with how many seconds to wait at most (or -1 for no limit) for one
+ * of them to become writable before calling it again, or with errno set to
+ * the error of the last attempt if all of them failed.  network_race_free
+ * closes the sockets of the attempts still in progress.
+ *
+ * NETWORK_RACE_STAGGER is the delay between two attempts used by
+ * network_connect.
+ */
+#define NETWORK_RACE_STAGGER 0.25
+
+struct network_race;
+
+struct network_race *network_race_start(const struct addrinfo *,
+                                        const char *source, double stagger,
+                                        time_t timeout)
+    __attribute__((__nonnull__(1)));
+socket_type network_race_poll(struct network_race *, fd_set *set,
+                              socket_type *maxfd, double *wait)
+    __attribute__((__nonnull__));
+void network_race_free(struct network_race *) __attribute__((__nonnull__));
+
 /*
  * Like network_connect but takes a host and port instead.  If host lookup
  * fails, errno may not be set to anything useful.
@@ -129,12 +165,15 @@ socket_type network_client_create(int domain, int type, const char *source);
  * network_set_freebind sets IP_FREEBIND, which allows binding IPv6 addresses
  * that may not have been set up yet.  network_set_reuseaddr sets SO_REUSEADDR
  * so that something new can listen on the same port immediately if the daemon
- * dies unexpectedly.  network_set_v6only sets IP_V6ONLY, which avoids binding
- * to the backward-compatibility IPv4 address when binding an IPv6 socket
- * (generally preferred since the behavior is more predictable).
+ * dies unexpectedly.  network_set_reuseport sets SO_REUSEPORT so that several
+ * daemons can listen on the same port, with the kernel spreading incoming
+ * connections among them.  network_set_v6only sets IP_V6ONLY, which avoids
+ * binding to the backward-compatibility IPv4 address when binding an IPv6
+ * socket (generally preferred since the behavior is more predictable).
  */
 void network_set_freebind(socket_type fd);
 void network_set_reuseaddr(socket_type fd);
+void network_set_reuseport(socket_type fd);
 void network_set_v6only(socket_type fd);
 
 /*
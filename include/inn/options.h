@@ -134,6 +134,7 @@ typedef unsigned long           ARTNUM;
 
 /* Only used by innd and cvtbatch, should be moved to a more specific header
    file. */
+#define FEED_ARTICLE            'A'
 #define FEED_BYTESIZE           'b'
 #define FEED_FULLNAME           'f'
 #define FEED_HASH               'h'
@@ -11,7 +11,7 @@ BEGIN_DECLS
 #define OV_READ  1
 #define OV_WRITE 2
 
-typedef enum {OVSPACE, OVSORT, OVCUTOFFLOW, OVGROUPBASEDEXPIRE, OVSTATICSEARCH, OVSTATALL, OVCACHEKEEP, OVCACHEFREE} OVCTLTYPE;
+typedef enum {OVSPACE, OVSORT, OVCUTOFFLOW, OVGROUPBASEDEXPIRE, OVSTATICSEARCH, OVSTATALL, OVCACHEKEEP, OVCACHEFREE, OVEXPIRESTATS, OVCOMPACTGROUP, OVINDEXONLY, OVBULKLOAD, OVTOKENLOOKUP} OVCTLTYPE;
 #define OV_NOSPACE 100
 typedef enum {OVNEWSGROUP, OVARRIVED, OVNOSORT} OVSORTTYPE;
 typedef enum {OVADDCOMPLETED, OVADDFAILED, OVADDGROUPNOMATCH} OVADDRESULT;
@@ -33,12 +33,59 @@ typedef struct _OVGE {
     float	timewarp;	  /* used to bias expiry time */
 } OVGE;
 
+/* Filled in by OVctl(OVEXPIRESTATS), which also resets the statistics so
+   that OVclose doesn't report them. */
+typedef struct _OVEXPSTATS {
+    long	processed;	  /* article lines processed */
+    long	dropped;	  /* articles dropped */
+    long	indexdropped;	  /* overview index entries dropped */
+} OVEXPSTATS;
+
+/* Passed to OVctl(OVCOMPACTGROUP) to rewrite the overview of a newsgroup so that
+   it can be read sequentially.  Only buffindexed supports it. */
+typedef struct _OVCOMPACT {
+    const char	*group;		  /* newsgroup to compact */
+    unsigned long rate;		  /* at most this many KB written per second
+				     on average, or 0 for no limit */
+    bool	compacted;	  /* set if the newsgroup was rewritten */
+} OVCOMPACT;
+
+/* One article passed to OVaddbatch, which fills in result. */
+typedef struct _OVBATCH {
+    TOKEN	token;
+    char	*data;
+    int		len;
+    time_t	arrived;
+    time_t	expires;
+    OVADDRESULT	result;
+} OVBATCH;
+
+/* One article from the log of arrivals, returned by OVarrival.  groups is the
+   list of newsgroup:number pairs of its Xref header field. */
+typedef struct _OVARRIVAL {
+    time_t	arrived;
+    TOKEN	token;
+    char	*msgid;
+    char	*groups;
+} OVARRIVAL;
+
+/* The argument of OVctl(OVTOKENLOOKUP), which finds with the token index a
+   newsgroup and article number under which the overview of the article
+   with the given token is stored.  group points to internal storage, valid
+   until the next call. */
+typedef struct _OVTOKENINFO {
+    TOKEN	token;
+    char	*group;
+    ARTNUM	artnum;
+} OVTOKENINFO;
+
 extern bool	OVstatall;
 bool OVopen(int mode);
 bool OVgroupstats(char *group, int *lo, int *hi, int *count, int *flag);
 bool OVgroupadd(char *group, ARTNUM lo, ARTNUM hi, char *flag);
 bool OVgroupdel(char *group);
 OVADDRESULT OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires);
+bool OVaddbatch(OVBATCH *articles, size_t count);
 bool OVcancel(TOKEN token);
 void *OVopensearch(char *group, int low, int high);
 bool OVsearch(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN *token, time_t *arrived);
@@ -47,6 +94,14 @@ bool OVgetartinfo(char *group, ARTNUM artnum, TOKEN *token);
 bool OVexpiregroup(char *group, int *lo, struct history *h);
 bool OVctl(OVCTLTYPE type, void *val);
 void OVclose(void);
+void OVlatency(struct buffer *output, bool reset);
+void *OVopenarrivals(time_t since);
+bool OVarrival(void *handle, OVARRIVAL *arrival);
+void OVclosearrivals(void *handle);
+void *OVopenreplog(unsigned long hour, unsigned long offset, bool follow);
+bool OVreplogread(void *handle, struct buffer *output);
+void OVclosereplog(void *handle);
+bool OVreplay(struct buffer *input, unsigned long *hour, unsigned long *offset);
 
 END_DECLS
 
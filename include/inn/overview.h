@@ -133,6 +133,14 @@ bool overview_add(struct overview *, const char *, struct overview_data *);
 bool overview_add_xref(struct overview *, const char *xref,
                        struct overview_data *);
 
+/* Add data for several articles at once, each with its own Xref information,
+   letting the overview method batch its writes.  success[i] is set to true
+   only if data[i] was stored in every group.  Returns true only if all of
+   the articles were. */
+bool overview_add_xref_batch(struct overview *, const char **xref,
+                             struct overview_data *, bool *success,
+                             size_t count);
+
 /* Cancel the overview data for an article (make it inaccessible to searches).
    Unfortunately, most callers will have to use the _xref interface. */
 bool overview_cancel(struct overview *, const char *group, ARTNUM);
@@ -187,6 +195,9 @@ struct cvector *overview_split(const char *line, size_t length,
 			       ARTNUM *number, struct cvector *vector);
 char *overview_get_standard_header(const struct cvector *vector, unsigned int element);
 char *overview_get_extra_header(const struct cvector *vector, const char *header);
+bool overview_find_field(const char *line, size_t length, int element,
+                         const char *header, const char **field,
+                         size_t *fieldlen);
 
 END_DECLS
 
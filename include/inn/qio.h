@@ -3,7 +3,8 @@
 **
 **  The interface to the Quick I/O package, optimized for reading through
 **  files line by line.  This package uses internal buffering like stdio,
-**  but is even more aggressive about its buffering.
+**  but is even more aggressive about its buffering.  Regular files are
+**  mapped into memory when possible and their lines returned in place.
 */
 
 #ifndef INN_QIO_H
@@ -16,6 +17,10 @@
    larger than the longest overview line INN supports. */
 #define QIO_BUFFERSIZE  (32 * 1024)
 
+/* The internal buffer starts at QIO_BUFFERSIZE and doubles, up to this size,
+   while each read fills it, as when reading from a busy pipe. */
+#define QIO_MAXBUFFER   (1024 * 1024)
+
 BEGIN_DECLS
 
 /*
@@ -33,6 +38,8 @@ typedef struct {
     char *      _start;         /* Start of the unread data. */
     char *      _end;           /* End of the available data. */
     off_t       _count;         /* Number of bytes read so far. */
+    char *      _map;           /* Mapping of the file, if any. */
+    size_t      _maplength;
     enum QIOflag _flag;
 } QIOSTATE;
 
@@ -45,6 +52,7 @@ typedef struct {
 extern QIOSTATE *       QIOopen(const char *name);
 extern QIOSTATE *       QIOfdopen(int fd);
 extern char *           QIOread(QIOSTATE *qp);
+extern bool             QIOhasline(const QIOSTATE *qp);
 extern void             QIOclose(QIOSTATE *qp);
 extern int              QIOrewind(QIOSTATE *qp);
 
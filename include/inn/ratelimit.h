@@ -0,0 +1,62 @@
+/*
+**  Token buckets limiting the rate of a flow of bytes.
+**
+**  A bucket holds up to burst bytes and fills at rate bytes per second;
+**  sending takes bytes from it.  Rather than refusing to send when the
+**  bucket is short, charging it for what is about to be sent returns how
+**  long to wait first, so that the caller can wait however suits it, and
+**  only once for a whole chunk.  The bucket is kept as the time at which it
+**  will be full again, which is all that needs storing.
+**
+**  Buckets shared between processes, for instance by all the nnrpd
+**  processes serving clients with the same access, are kept in a file of
+**  slots found by the hash of a key, each one updated under an fcntl lock.
+**  Two keys falling in the same slot share their bucket.
+*/
+
+#ifndef INN_RATELIMIT_H
+#define INN_RATELIMIT_H 1
+
+#include <inn/defines.h>
+#include <sys/types.h>
+
+struct ratelimit {
+    double rate;                /* Bytes per second. */
+    double burst;               /* Bytes that can be sent at once. */
+    double full;                /* When the bucket will be full again. */
+};
+
+/* The layout of this struct is entirely internal to the implementation. */
+struct ratelimit_table;
+
+BEGIN_DECLS
+
+/* Set up a bucket, initially full.  A burst of 0 means one second's
+   worth. */
+void ratelimit_init(struct ratelimit *, unsigned long rate,
+                    unsigned long burst);
+
+/* Charge a bucket for length bytes to be sent at time now (in seconds, as
+   returned by TMRnow_double), and return how many seconds to wait before
+   sending them. */
+double ratelimit_charge(struct ratelimit *, size_t length, double now);
+
+/* Open the table of shared buckets at path, creating it with the given
+   number of slots if it doesn't exist yet.  Returns NULL on failure, after
+   warning. */
+struct ratelimit_table *ratelimit_table_open(const char *path,
+                                             unsigned long slots);
+
+/* Same as ratelimit_charge for the shared bucket of key, with the given
+   rate and burst.  Returns 0 if the table cannot be updated, after
+   warning. */
+double ratelimit_table_charge(struct ratelimit_table *, const char *key,
+                              unsigned long rate, unsigned long burst,
+                              size_t length, double now);
+
+/* Close the table and free the structure. */
+void ratelimit_table_free(struct ratelimit_table *);
+
+END_DECLS
+
+#endif /* INN_RATELIMIT_H */
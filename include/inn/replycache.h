@@ -0,0 +1,54 @@
+/*
+**  Shared cache of ready-to-send replies.
+**
+**  nnrpd processes keep the bodies of the replies that are expensive to
+**  generate and likely to be asked for again by other clients, such as the
+**  overview of the last articles of busy newsgroups, in a file that they all
+**  map into memory.  Replies are found by a key string that must identify
+**  everything the reply depends on, so that a reply never has to be
+**  invalidated: when something changes, the key changes, and the old reply
+**  is eventually overwritten.
+**
+**  The file is made of a fixed number of slots of a fixed size, and each key
+**  can only be stored in one slot.  Writers lock the slot they fill and skip
+**  storing a reply if another process is already filling it; readers never
+**  lock but check a sequence count in the slot to discard a reply that was
+**  being replaced while they copied it.
+*/
+
+#ifndef INN_REPLYCACHE_H
+#define INN_REPLYCACHE_H 1
+
+#include <inn/defines.h>
+#include <sys/types.h>
+
+struct buffer;
+
+/* The layout of this struct is entirely internal to the implementation. */
+struct replycache;
+
+BEGIN_DECLS
+
+/* Open the cache at path, creating it with slots of slotsize bytes taking
+   about size bytes in all if it doesn't exist yet.  An existing cache keeps
+   its layout, whatever the sizes given.  Returns NULL on failure, after
+   warning. */
+struct replycache *replycache_open(const char *path, size_t size,
+                                   size_t slotsize);
+
+/* Look up the reply stored for key and copy it into reply.  Returns false if
+   there is none. */
+bool replycache_get(struct replycache *, const char *key,
+                    struct buffer *reply);
+
+/* Store a reply for key, replacing what is in its slot.  Replies longer than
+   a slot are not stored.  Returns false if the reply wasn't stored. */
+bool replycache_put(struct replycache *, const char *key, const char *data,
+                    size_t length);
+
+/* Unmap the cache and free the structure. */
+void replycache_free(struct replycache *);
+
+END_DECLS
+
+#endif /* INN_REPLYCACHE_H */
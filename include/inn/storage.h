@@ -17,7 +17,14 @@
 #define TOKEN_EMPTY     255
 
 typedef enum {RETR_ALL, RETR_HEAD, RETR_BODY, RETR_STAT} RETRTYPE;
-typedef enum {SM_RDWR, SM_PREOPEN} SMSETUP;
+typedef enum {SM_RDWR, SM_PREOPEN, SM_PARTITION} SMSETUP;
+
+/* Argument to SMsetup(SM_PARTITION): SMnext only returns the articles in
+   the index'th of count roughly equal slices of the spool. */
+typedef struct {
+    unsigned int        index;
+    unsigned int        count;
+} SMPARTITION;
 
 #define NUM_STORAGE_CLASSES 256
 typedef unsigned char STORAGECLASS;
@@ -45,6 +52,13 @@ typedef struct {
   TOKEN          *token;     /* A pointer to the article's TOKEN */
 } ARTHANDLE;
 
+/* One article passed to SMstorebatch, which fills in token (TOKEN_EMPTY if
+   the article couldn't be stored). */
+typedef struct {
+  ARTHANDLE      article;
+  TOKEN          token;
+} SMBATCH;
+
 /* Initializer for the ARTHANDLE structure. */
 #define ARTHANDLE_INITIALIZER { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
 
@@ -60,17 +74,44 @@ typedef struct {
 #define SMERR_BADTOKEN         9
 #define SMERR_NOMATCH         10
 
-extern int              SMerrno;
-extern char             *SMerrorstr;
-
-typedef enum {SELFEXPIRE, SMARTNGNUM, EXPENSIVESTAT} PROBETYPE;
+/* The error of the last failed call is kept for each thread, so that
+   threads using the storage manager at once don't see each other's. */
+#if defined(__GNUC__) || defined(__clang__)
+# define SM_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+# define SM_THREAD_LOCAL _Thread_local
+#else
+# define SM_THREAD_LOCAL /* empty */
+#endif
+
+extern SM_THREAD_LOCAL int      SMerrno;
+extern SM_THREAD_LOCAL char     *SMerrorstr;
+
+typedef enum {SELFEXPIRE, SMARTNGNUM, EXPENSIVESTAT, SMARTFILE,
+              SMPREFETCH, THREADSAFE} PROBETYPE;
 typedef enum {SM_ALL, SM_HEAD, SM_CANCELLEDART} FLUSHTYPE;
 
+struct buffer;
+
 struct artngnum {
     char	*groupname;
     ARTNUM	artnum;
 };
 
+/* Filled in by SMprobe(SMARTFILE) when the data of a retrieved article is
+   stored verbatim in a file; the descriptor remains valid until the article
+   is freed. */
+struct artfile {
+    const ARTHANDLE *art;   /* Article returned by SMretrieve */
+    int		fd;         /* File holding art->data */
+    off_t	offset;     /* Offset of art->data in that file */
+};
+
+/* SMprobe(SMPREFETCH) asks the method to start reading an article in the
+   background, because it is likely to be retrieved soon.  It takes no value
+   and returns false if the method can't do that.  SMadvise does the same
+   for a list of articles. */
+
 BEGIN_DECLS
 
 char *      TokenToText(const TOKEN token);
@@ -80,15 +121,21 @@ bool        IsToken(const char *text);
 bool        SMsetup(SMSETUP type, void *value);
 bool        SMinit(void);
 TOKEN       SMstore(const ARTHANDLE article);
+bool        SMstorebatch(SMBATCH *articles, size_t count);
 ARTHANDLE * SMretrieve(const TOKEN token, const RETRTYPE amount);
 ARTHANDLE * SMnext(ARTHANDLE *article, const RETRTYPE amount);
 void        SMfreearticle(ARTHANDLE *article);
 bool        SMcancel(TOKEN token);
+bool        SMcancelbatch(TOKEN *tokens, size_t count);
+TOKEN       SMmigrate(const TOKEN token, const ARTHANDLE article);
+time_t      SMminage(void);
 bool        SMprobe(PROBETYPE type, TOKEN *token, void *value);
+size_t      SMadvise(const TOKEN *tokens, size_t count);
 bool        SMflushcacheddata(FLUSHTYPE type);
 void        SMprintfiles(FILE *file, TOKEN token, char **xref, int ngroups);
 char *      SMexplaintoken(const TOKEN token);
 void        SMshutdown(void);
+void        SMlatency(struct buffer *output, bool reset);
 
 END_DECLS
     
@@ -0,0 +1,20 @@
+/* Automatically generated by mksystem from config.h; do not edit. */
+
+/* This header contains information obtained by INN at configure time that
+   is needed by INN headers.  Autoconf results that may conflict with the
+   autoconf results of another package have INN_ prepended to the
+   preprocessor symbols. */
+
+#ifndef INN_SYSTEM_H
+#define INN_SYSTEM_H 1
+
+#define INN_HAVE_C99_VAMACROS 1
+#define INN_HAVE_GNU_VAMACROS 1
+#define INN_HAVE_INET6 1
+#define INN_HAVE_INTTYPES_H 1
+#define INN_HAVE_MSYNC_3_ARG 1
+#define INN_HAVE_STDBOOL_H 1
+#define INN_HAVE_SYS_BITYPES_H 1
+#define INN_HAVE__BOOL 1
+
+#endif /* INN_SYSTEM_H */
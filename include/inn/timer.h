@@ -4,7 +4,8 @@
 **  An interface to a simple profiling library.  An application can declare
 **  its intent to use n timers by calling TMRinit(n), and then start and
 **  stop numbered timers with TMRstart and TMRstop.  TMRsummary logs the
-**  results to syslog given labels for each numbered timer.
+**  results to syslog given labels for each numbered timer, and TMRstats
+**  reports the distribution of the durations of each timer.
 */
 
 #ifndef INN_TIMER_H
@@ -12,6 +13,8 @@
 
 #include <inn/defines.h>
 
+struct buffer;
+
 BEGIN_DECLS
 
 enum {
@@ -26,6 +29,8 @@ void            TMRinit(unsigned int);
 void            TMRstart(unsigned int);
 void            TMRstop(unsigned int);
 void            TMRsummary(const char *prefix, const char *const *labels);
+void            TMRstats(struct buffer *, const char *prefix,
+                         const char *const *labels, bool reset);
 unsigned long   TMRnow(void);
 void            TMRfree(void);
 
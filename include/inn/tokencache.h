@@ -0,0 +1,49 @@
+/*
+**  Shared cache of message-ID to storage token translations.
+**
+**  innd adds the token of every article it stores, and nnrpd processes add
+**  the tokens they find while serving overview, to a table in a file that
+**  they all map into memory.  nnrpd then looks up message-IDs there before
+**  going to the history database, so that a new reader session benefits
+**  from what the server and the other sessions already found.
+**
+**  The table is made of buckets of a few entries, and a message-ID can only
+**  be stored in the bucket given by its hash.  Entries are replaced in clock
+**  order within a bucket, skipping those looked up since the hand last went
+**  by.  Neither readers nor writers take locks: a writer claims an entry
+**  with an atomic operation and simply doesn't store a translation if
+**  another process is writing the same entry, and readers check a sequence
+**  count in the entry to discard one that was being replaced while they
+**  copied it.
+*/
+
+#ifndef INN_TOKENCACHE_H
+#define INN_TOKENCACHE_H 1
+
+#include <inn/defines.h>
+#include <inn/libinn.h>
+#include <inn/storage.h>
+
+/* The layout of this struct is entirely internal to the implementation. */
+struct tokencache;
+
+BEGIN_DECLS
+
+/* Open the cache at path, creating it with room for about entries
+   translations if it doesn't exist yet.  An existing cache keeps its size.
+   Returns NULL on failure, after warning. */
+struct tokencache *tokencache_open(const char *path, unsigned long entries);
+
+/* Store the token of a message-ID given by its hash. */
+void tokencache_add(struct tokencache *, const HASH *, const TOKEN *);
+
+/* Look up the token of a message-ID given by its hash.  Returns false if it
+   is not in the cache. */
+bool tokencache_get(struct tokencache *, const HASH *, TOKEN *);
+
+/* Unmap the cache and free the structure. */
+void tokencache_free(struct tokencache *);
+
+END_DECLS
+
+#endif /* INN_TOKENCACHE_H */
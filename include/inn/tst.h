@@ -56,10 +56,8 @@ enum tst_constants {
 struct tst;
 
 /* Allocate a new ternary search trie.  width is the number of nodes allocated
-   at a time and should be chosen carefully.  One node is required for every
-   character in the tree.  If you choose a value that is too small, your
-   application will spend too much time calling malloc and your node space
-   will be too spread out.  Too large a value is just a waste of space. */
+   at first, and the least number of nodes added when they are all in use.
+   One node is required for every character in the tree. */
 struct tst *tst_init(int width);
 
 /* Insert a value into the tree.  If the key already exists in the tree,
@@ -81,6 +79,11 @@ void *tst_search(struct tst *, const unsigned char *key);
    to.  If the key was not found, returns NULL. */
 void *tst_delete(struct tst *, const unsigned char *key);
 
+/* Rebuild the trie so that its nodes are contiguous and no memory is kept
+   for deleted keys.  tst_delete does this by itself once more than half of
+   the nodes are free, so that a long-lived trie stays bounded. */
+void tst_compact(struct tst *);
+
 /* Free the given ternary search trie and all resources it uses. */
 void tst_cleanup(struct tst *);
 
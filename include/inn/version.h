@@ -0,0 +1,12 @@
+/* Automatically generated by mkversion, edit Makefile.global to change. */
+
+#ifndef INN_VERSION_H
+#define INN_VERSION_H 1
+
+#define INN_VERSION_MAJOR 2
+#define INN_VERSION_MINOR 7
+#define INN_VERSION_PATCH 0
+#define INN_VERSION_EXTRA "20261015 prerelease"
+#define INN_VERSION_STRING "INN 2.7.0 (20261015 prerelease)"
+
+#endif /* INN_VERSION_H */
@@ -25,6 +25,17 @@ char *wire_findbody(const char *, size_t);
    remaining in the article. */
 char *wire_nextline(const char *, const char *end);
 
+/* Given a pointer into an article and a length, find the first nul, CR or
+   LF octet, or return NULL if there is none.  This is the fast path of
+   parsers that have to look at every line ending and reject nuls. */
+char *wire_findspecial(const char *, size_t);
+
+/* Given a pointer into an article and a length, find the first period at the
+   start of a line (the given pointer counts as the start of a line), or
+   return NULL if there is none.  Only such lines need dot-stuffing, so a
+   NULL return means that the data can be sent as is. */
+char *wire_finddotline(const char *, size_t);
+
 /* Given a pointer to the start of an article and the name of a header, find
    the beginning of the value of the given header (the returned pointer will
    be after the name of the header, and also any initial whitespace if specified
@@ -33,6 +44,20 @@ char *wire_nextline(const char *, const char *end);
    NULL. */
 char *wire_findheader(const char *article, size_t, const char *header, bool stripspaces);
 
+/* A header looked for by wire_findheaders, which sets value as
+   wire_findheader would return it.  The first occurrence of the header is
+   found, or its last one if last is set. */
+struct wire_header {
+    const char *name;
+    bool last;
+    char *value;
+};
+
+/* Same as wire_findheader for count headers at once, walking through the
+   headers of the article only once rather than once per header. */
+void wire_findheaders(const char *article, size_t, struct wire_header *,
+                      size_t count, bool stripspaces);
+
 /* Given a pointer inside a header's value and a pointer to the end of the
    article, returns a pointer to the end of the header value (the \n at the
    end of the terminating \r\n with folding taken into account), or NULL if no
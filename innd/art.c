@@ -7,6 +7,8 @@
 #include "portable/macros.h"
 #include <sys/uio.h>
 
+#include "inn/buffer.h"
+#include "inn/histogram.h"
 #include "inn/innconf.h"
 #include "inn/md5.h"
 #include "inn/ov.h"
@@ -41,18 +43,18 @@ typedef struct _HEADERP {
 #define HPCOUNT		4
 
 /*
-**  For speed we build a binary tree of the headers, sorted by their
-**  name.  We also store the header's Name fields in the tree to avoid
-**  doing an extra indirection.
+**  For speed we keep the headers in a small hash table, keyed on the length
+**  of their name and its first and last characters folded to lowercase.
+**  That tells nearly all of them apart, so finding a header usually costs a
+**  single strncasecmp, and other headers are mostly rejected without any.
+**  The size must be a power of two, well above the number of headers.
 */
-typedef struct _TREE {
-  const char	*Name;
-  const ARTHEADER *Header;
-  struct _TREE	*Before;
-  struct _TREE	*After;
-} TREE;
+#define ARTHASH_SIZE	256
+#define ARTHASH(name, len)						\
+  (((len) * 29 + tolower((unsigned char) (name)[0]) * 35			\
+    + tolower((unsigned char) (name)[(len) - 1])) & (ARTHASH_SIZE - 1))
 
-static TREE	*ARTheadertree;
+static const ARTHEADER	*ARTheaderhash[ARTHASH_SIZE];
 
 /*
 **  For doing the overview database, we keep a list of the headers and
@@ -77,6 +79,37 @@ static char	ARTjnk[] = "junk";
 static char             hostcclass[256];
 #define ARThostchar(c)  ((hostcclass[(unsigned char)(c)]) != 0)
 
+/*
+**  Stages of the processing of an accepted article whose latency is recorded
+**  for ctlinnd latency.  Unlike the timers, they are always recorded, so that
+**  a benchmark can look at their distribution rather than at totals.
+*/
+enum art_stage {
+  STAGE_PARSE,          /* Checking the headers and the Path: header. */
+  STAGE_HISLOOKUP,      /* Looking for a duplicate in history. */
+  STAGE_STORE,          /* Storing the article. */
+  STAGE_OVERVIEW,       /* Generating and writing (or queuing) overview. */
+  STAGE_HISWRITE,       /* Writing the history entry. */
+  STAGE_PROPAGATE,      /* Finding and feeding the sites. */
+  STAGE_MAX
+};
+
+static const char *const stage_name[STAGE_MAX] = {
+  "parse", "hislookup", "store", "overview", "hiswrite", "propagate"
+};
+
+static struct histogram *stage_latency[STAGE_MAX];
+
+/*
+**  Moving average of the time storing an article and its overview takes, in
+**  microseconds, for backpressurelatency, and when it was last updated.  It
+**  is only trusted for BACKPRESSURE_STALE seconds, so that the slowed down
+**  peers are let in again when nothing else brings articles to measure.
+*/
+#define BACKPRESSURE_STALE 2
+static double store_latency;
+static time_t store_latency_time;
+
 /* Prototypes. */
 static void ARTerror(CHANNEL *cp, const char *format, ...)
     __attribute__((__format__(printf, 2, 3)));
@@ -187,42 +220,22 @@ ARTreadschema(void)
 
 
 /*
-**  Build a balanced tree for the headers in subscript range [lo..hi).
-**  This only gets called once, and the tree only has about 37 entries,
-**  so we don't bother to unroll the recursion.
-*/
-static TREE *
-ARTbuildtree(const ARTHEADER **Table, int lo, int hi)
-{
-  int	mid;
-  TREE	*tp;
-
-  mid = lo + (hi - lo) / 2;
-  tp = xmalloc(sizeof(TREE));
-  tp->Header = Table[mid];
-  tp->Name = tp->Header->Name;
-  if (mid == lo)
-    tp->Before = NULL;
-  else
-    tp->Before = ARTbuildtree(Table, lo, mid);
-  if (mid == hi - 1)
-    tp->After = NULL;
-  else
-    tp->After = ARTbuildtree(Table, mid + 1, hi);
-  return tp;
-}
-
-
-/*
-**  Sorting predicate for qsort call in ARTsetup.
+**  Return the entry of the header table for the header whose name has the
+**  given length, or NULL if it is not a system header.
 */
-static int
-ARTcompare(const void *p1, const void *p2)
+const ARTHEADER *
+ARTfindheader(const char *name, int len)
 {
-    const char *n1 = ((const ARTHEADER * const *) p1)[0]->Name;
-    const char *n2 = ((const ARTHEADER * const *) p2)[0]->Name;
-
-    return strcasecmp(n1, n2);
+  const ARTHEADER	*hp;
+  unsigned int		i;
+
+  if (len <= 0)
+    return NULL;
+  for (i = ARTHASH(name, len); (hp = ARTheaderhash[i]) != NULL;
+       i = (i + 1) & (ARTHASH_SIZE - 1))
+    if (hp->Size == len && strncasecmp(name, hp->Name, len) == 0)
+      return hp;
+  return NULL;
 }
 
 
@@ -232,9 +245,8 @@ ARTcompare(const void *p1, const void *p2)
 void
 ARTsetup(void)
 {
-  const ARTHEADER **	table;
   const unsigned char *p;
-  unsigned int	i;
+  unsigned int	i, j;
 
   /* Set up the character class tables.  These are written a
    * little strangely to work around a GCC2.0 bug. */
@@ -254,33 +266,20 @@ ARTsetup(void)
   /* Also initialize the character class tables for message-IDs. */
   InitializeMessageIDcclass();
 
-  /* Build the header tree. */
-  table = xmalloc(ARRAY_SIZE(ARTheaders) * sizeof(ARTHEADER *));
-  for (i = 0; i < ARRAY_SIZE(ARTheaders); i++)
-    table[i] = &ARTheaders[i];
-  qsort(table, ARRAY_SIZE(ARTheaders), sizeof *table, ARTcompare);
-  ARTheadertree = ARTbuildtree(table, 0, ARRAY_SIZE(ARTheaders));
-  free(table);
+  /* Build the header hash table. */
+  memset(ARTheaderhash, 0, sizeof(ARTheaderhash));
+  for (i = 0; i < ARRAY_SIZE(ARTheaders); i++) {
+    for (j = ARTHASH(ARTheaders[i].Name, ARTheaders[i].Size);
+         ARTheaderhash[j] != NULL; j = (j + 1) & (ARTHASH_SIZE - 1))
+      continue;
+    ARTheaderhash[j] = &ARTheaders[i];
+  }
 
   /* Set up database; ignore errors. */
   ARTreadschema();
 }
 
 
-static void
-ARTfreetree(TREE *tp)
-{
-  TREE	*next;
-
-  for ( ; tp != NULL; tp = next) {
-    if (tp->Before)
-      ARTfreetree(tp->Before);
-    next = tp->After;
-    free(tp);
-  }
-}
-
-
 void
 ARTclose(void)
 {
@@ -288,7 +287,6 @@ ARTclose(void)
     free(ARTfields);
     ARTfields = NULL;
   }
-  ARTfreetree(ARTheadertree);
 }
 
 /*
@@ -328,17 +326,97 @@ ARTlog(const ARTDATA *data, char code, const char *text)
   TMRstop(TMR_ARTLOG);
 }
 
+/*
+**  Return the number of microseconds elapsed since start, and make start the
+**  current time so that it is the beginning of the next stage.
+*/
+static unsigned long
+ARTelapsed(struct timeval *start)
+{
+  struct timeval now;
+  long usec;
+
+  gettimeofday(&now, NULL);
+  usec = (now.tv_sec - start->tv_sec) * 1000000L
+         + (now.tv_usec - start->tv_usec);
+  *start = now;
+  return usec < 0 ? 0 : (unsigned long) usec;
+}
+
+
+/*
+**  Record the time a stage of article processing took.
+*/
+static void
+ARTstage(enum art_stage stage, unsigned long usec)
+{
+  if (stage_latency[stage] == NULL)
+    stage_latency[stage] = histogram_new();
+  histogram_record(stage_latency[stage], usec);
+}
+
+
+/*
+**  Add the time storing an article and its overview took to the average
+**  used for backpressure.
+*/
+static void
+ARTstorelatency(unsigned long usec)
+{
+  store_latency += ((double) usec - store_latency) / 8;
+  store_latency_time = Now.tv_sec;
+}
+
+
+/*
+**  Whether storage is currently slower than backpressurelatency, in which
+**  case the peers marked with backpressure in incoming.conf are slowed down.
+*/
+bool
+ARTbackpressure(void)
+{
+  if (innconf->backpressurelatency == 0)
+    return false;
+  if (Now.tv_sec - store_latency_time > BACKPRESSURE_STALE)
+    return false;
+  return store_latency > innconf->backpressurelatency * 1000.0;
+}
+
+
+/*
+**  Append a line per stage of article processing to output, with the latency
+**  summary in microseconds, and optionally reset the histograms.
+*/
+void
+ARTlatency(struct buffer *output, bool reset)
+{
+  int i;
+
+  for (i = 0; i < STAGE_MAX; i++) {
+    if (stage_latency[i] == NULL)
+      continue;
+    if (histogram_count(stage_latency[i]) > 0) {
+      buffer_append_sprintf(output, "innd %s ", stage_name[i]);
+      histogram_summary(stage_latency[i], output);
+      buffer_append(output, "\n", 1);
+    }
+    if (reset)
+      histogram_reset(stage_latency[i]);
+  }
+}
+
+
 /*
 **  Parse a Path line, splitting it up into NULL-terminated array of strings.
 */
 static int
-ARTparsepath(const char *p, int size, LISTBUFFER *list)
+ARTparsepath(ARENA *arena, const char *p, int size, LISTBUFFER *list)
 {
   int	i;
   char	*q, **hp;
 
   /* setup buffer */ 
-  SetupListBuffer(size, list);
+  SetupListBuffer(arena, size, list);
 
   /* loop over text and copy */
   for (i = 0, q = list->Data, hp = list->List ; *p ; p++, *q++ = '\0') { 
@@ -349,8 +427,7 @@ ARTparsepath(const char *p, int size, LISTBUFFER *list)
       break;
 
     if (list->ListLength <= i) {
-      list->ListLength += DEFAULTNGBOXSIZE;
-      list->List = xrealloc(list->List, list->ListLength * sizeof(char *));
+      GrowListBuffer(arena, list);
       hp = &list->List[i];
     }
     /* mark the start of the host, move to the end of it while copying */  
@@ -361,14 +438,70 @@ ARTparsepath(const char *p, int size, LISTBUFFER *list)
   }
   *q = '\0';
   if (i == list->ListLength) {
-    list->ListLength += DEFAULTNGBOXSIZE;
-    list->List = xrealloc(list->List, list->ListLength * sizeof(char *));
+    GrowListBuffer(arena, list);
     hp = &list->List[i];
   }
   *hp = NULL;
   return i;
 }
 
+/*
+**  Hash a host name of the Path header body, case-insensitively (FNV-1a on
+**  the folded characters).  Site names and exclusions are hashed once by
+**  SITEparseone.
+*/
+unsigned int
+ARThophash(const char *hop)
+{
+  unsigned int hash = 2166136261U;
+
+  for (; *hop != '\0'; hop++)
+    hash = (hash ^ (unsigned char) tolower((unsigned char) *hop)) * 16777619U;
+  return hash;
+}
+
+/*
+**  Put the hops parsed by ARTparsepath in a hash table at least twice as
+**  large, so that ARTpathhas costs about one comparison whatever the length
+**  of the Path.
+*/
+static void
+ARTpathset(ARENA *arena, const char **hops, int hopcount, PATHSET *set)
+{
+  unsigned int size, slot, hash;
+  int i;
+
+  for (size = 8; size < 2 * (unsigned int) hopcount; size <<= 1)
+    continue;
+  set->Hops = ARENAalloc(arena, size * sizeof(char *));
+  set->Hashes = ARENAalloc(arena, size * sizeof(unsigned int));
+  set->Mask = size - 1;
+  memset(set->Hops, 0, size * sizeof(char *));
+  for (i = 0; i < hopcount; i++) {
+    hash = ARThophash(hops[i]);
+    for (slot = hash & set->Mask; set->Hops[slot] != NULL;
+         slot = (slot + 1) & set->Mask)
+      continue;
+    set->Hops[slot] = hops[i];
+    set->Hashes[slot] = hash;
+  }
+}
+
+/*
+**  Return true if a host, whose ARThophash is given, is in the Path.
+*/
+static bool
+ARTpathhas(const PATHSET *set, const char *host, unsigned int hash)
+{
+  unsigned int slot;
+
+  for (slot = hash & set->Mask; set->Hops[slot] != NULL;
+       slot = (slot + 1) & set->Mask)
+    if (set->Hashes[slot] == hash && strcasecmp(set->Hops[slot], host) == 0)
+      return true;
+  return false;
+}
+
 /*
 **  We're rejecting an article.  Log a message to the news log about that,
 **  including all the interesting article information.
@@ -399,8 +532,8 @@ ARTlogreject(CHANNEL *cp, const char *text)
         if (HDR_FOUND(HDR__PATH)) {
             HDR_LASTCHAR_SAVE(HDR__PATH);
             HDR_PARSE_START(HDR__PATH);
-            hopcount =
-                ARTparsepath(HDR(HDR__PATH), HDR_LEN(HDR__PATH), &data->Path);
+            hopcount = ARTparsepath(&data->Arena, HDR(HDR__PATH),
+                                    HDR_LEN(HDR__PATH), &data->Path);
             HDR_PARSE_END(HDR__PATH);
             hops = data->Path.List;
             if (hopcount > 0 && hops != NULL && hops[0] != NULL) {
@@ -576,6 +709,15 @@ ARTstore(CHANNEL *cp)
     return result;
   }
 
+  /* Keep the stored article for the sites which get it, so that they do
+   * not have to read it back from the storage manager. */
+  if (NeedArticle) {
+    buffer_resize(&data->Article, arth.len);
+    buffer_set(&data->Article, NULL, 0);
+    for (i = 0 ; i < iovcnt ; i++)
+      buffer_append(&data->Article, iov[i].iov_base, iov[i].iov_len);
+  }
+
   /* calculate stored size */
   for (data->BytesValue = i = 0 ; i < iovcnt ; i++) {
     if (NeedHeaders && (i + 1 == iovcnt)) {
@@ -627,7 +769,6 @@ ARTcheckheader(CHANNEL *cp, int size)
   ARTDATA	*data = &cp->Data;
   char		*header = cp->In.data + data->CurHeader;
   HDRCONTENT	*hc = cp->Data.HdrContent;
-  TREE		*tp;
   const ARTHEADER *hp;
   char		c, *p, *colon;
   int		i;
@@ -649,19 +790,9 @@ ARTcheckheader(CHANNEL *cp, int size)
     return;
   }
 
-  /* See if this is a system header.  A fairly tightly-coded binary search. */
-  c = islower((unsigned char) *header) ? toupper((unsigned char) *header) : *header;
-  for (*colon = '\0', tp = ARTheadertree; tp; ) {
-    if ((i = c - tp->Name[0]) == 0 && (i = strcasecmp(header, tp->Name)) == 0)
-      break;
-    if (i < 0)
-      tp = tp->Before;
-    else
-      tp = tp->After;
-  }
-  *colon = ':';
-
-  if (tp == NULL) {
+  /* See if this is a system header. */
+  hp = ARTfindheader(header, colon - header);
+  if (hp == NULL) {
     /* Not a system header, make sure we have <word><colon><space>. */
     for (p = colon; --p > header; ) {
       if (ISWHITE(*p)) {
@@ -677,7 +808,6 @@ ARTcheckheader(CHANNEL *cp, int size)
     }
     return;
   }
-  hp = tp->Header;
   i = hp - ARTheaders;
   /* remember to ditch if it's Bytes: */
   if (i == HDR__BYTES)
@@ -742,6 +872,10 @@ ARTprepare(CHANNEL *cp)
   data->BytesHeader = NULL;
   data->Feedsite = "?";
   data->FeedsiteLength = strlen(data->Feedsite);
+  ARENAreset(&data->Arena);
+  memset(&data->Newsgroups, 0, sizeof(data->Newsgroups));
+  memset(&data->Distribution, 0, sizeof(data->Distribution));
+  memset(&data->Path, 0, sizeof(data->Path));
   *cp->Error = '\0';
 }
 
@@ -815,8 +949,16 @@ ARTparseheader(CHANNEL *cp)
     struct buffer *bp = &cp->In;
     ARTDATA *data = &cp->Data;
     size_t i;
+    char *p;
 
     for (i = cp->Next; i < bp->used; i++) {
+        /* Skip to the next nul, \r or \n, the only interesting octets. */
+        p = wire_findspecial(&bp->data[i], bp->used - i);
+        if (p == NULL) {
+            i = bp->used;
+            break;
+        }
+        i = p - bp->data;
         if (bp->data[i] == '\0')
             ARTerror(cp, "Nul character in header");
         if (bp->data[i] == '\n') {
@@ -896,8 +1038,15 @@ ARTparsebody(CHANNEL *cp)
     struct buffer *bp = &cp->In;
     ARTDATA *data = &cp->Data;
     size_t i;
+    char *p;
 
     for (i = cp->Next; i < bp->used; i++) {
+        p = wire_findspecial(&bp->data[i], bp->used - i);
+        if (p == NULL) {
+            i = bp->used;
+            break;
+        }
+        i = p - bp->data;
         if (bp->data[i] == '\0')
             ARTerror(cp, "Nul character in body");
         if (bp->data[i] == '\n')
@@ -1088,7 +1237,7 @@ ARTclean(ARTDATA *data, char *buff, bool ihave)
   /* Colon or whitespace in the Newsgroups: header? */
   /* Assumes Newsgroups: header is required header. */
   if ((data->Groupcount =
-    NGsplit(HDR(HDR__NEWSGROUPS), HDR_LEN(HDR__NEWSGROUPS),
+    NGsplit(&data->Arena, HDR(HDR__NEWSGROUPS), HDR_LEN(HDR__NEWSGROUPS),
     &data->Newsgroups)) == 0) {
     TMRstop(TMR_ARTCLEAN);
     sprintf(buff, "%d Unwanted character in \"Newsgroups\" header",
@@ -1152,11 +1301,11 @@ ARTreject(Reject_type code, CHANNEL *cp)
 /*
 **  Verify if a cancel message is valid.  Unless at least one group in the 
 **  cancel message's Newsgroups: line can be found in the Newsgroups: line 
-**  of the article to be cancelled, the cancel is considered bogus and 
-**  false is returned.
+**  of the article to be cancelled, whose token is given, the cancel is
+**  considered bogus and false is returned.
 */
-static bool
-ARTcancelverify(const ARTDATA *data, const char *MessageID, TOKEN *token)
+bool
+ARTcancelverify(const ARTDATA *data, const char *MessageID, TOKEN token)
 {
   const char	*p;
   char		*q, *q1;
@@ -1166,9 +1315,7 @@ ARTcancelverify(const ARTDATA *data, const char *MessageID, TOKEN *token)
   ARTHANDLE	*art;
   bool		r;
 
-  if (!HISlookup(History, MessageID, NULL, NULL, NULL, token))
-    return false;
-  if ((art = SMretrieve(*token, RETR_HEAD)) == NULL)
+  if ((art = SMretrieve(token, RETR_HEAD)) == NULL)
     return false;
 
   /* Copy Newsgroups: from article be to cancelled to q.
@@ -1221,14 +1368,35 @@ ARTcancelverify(const ARTDATA *data, const char *MessageID, TOKEN *token)
 }
 
 /*
-**  Process a cancel message.
+**  Remove the article with the given token from the overview and the
+**  spool, and log it.  The caller has to call OVQsync first, and to flush
+**  the articles cached by the storage method for immediatecancel.
+*/
+void
+ARTcanceltoken(const ARTDATA *data, const char *MessageID, TOKEN token)
+{
+  char	buff[SMBUF+16];
+
+  if (innconf->enableoverview)
+    OVcancel(token);
+  if (!SMcancel(token) && SMerrno != SMERR_NOENT && SMerrno != SMERR_UNINIT)
+    syslog(L_ERROR, "%s cant cancel %s (SMerrno %d)", LogName,
+           TokenToText(token), SMerrno);
+  snprintf(buff, sizeof(buff), "Cancelling %s",
+           MaxLength(MessageID, MessageID));
+  ARTlog(data, ART_CANC, buff);
+}
+
+/*
+**  Process a cancel message.  Unless cancelbatch is zero, a cancel of an
+**  article which is here is only queued, and applied by CANQflush.
 */
 void
 ARTcancel(const ARTDATA *data, const char *MessageID, const bool Trusted)
 {
   char	buff[SMBUF+16];
   TOKEN	token;
-  bool	r;
+  bool	verify;
 
   TMRstart(TMR_ARTCNCL);
   if (!DoCancels && !Trusted) {
@@ -1257,26 +1425,26 @@ ARTcancel(const ARTDATA *data, const char *MessageID, const bool Trusted)
     TMRstop(TMR_ARTCNCL);
     return;
   }
-  if (Trusted || !innconf->verifycancels)
-      r = HISlookup(History, MessageID, NULL, NULL, NULL, &token);
-  else
-      r = ARTcancelverify(data, MessageID, &token);
-  if (r == false) {
+  if (!HISlookup(History, MessageID, NULL, NULL, NULL, &token)) {
+    TMRstop(TMR_ARTCNCL);
+    return;
+  }
+  verify = !Trusted && innconf->verifycancels;
+  if (CANQadd(data, MessageID, token, verify)) {
+    TMRstop(TMR_ARTCNCL);
+    return;
+  }
+  if (verify && !ARTcancelverify(data, MessageID, token)) {
     TMRstop(TMR_ARTCNCL);
     return;
   }
 
   /* Get stored message and zap them. */
   if (innconf->enableoverview)
-    OVcancel(token);
-  if (!SMcancel(token) && SMerrno != SMERR_NOENT && SMerrno != SMERR_UNINIT)
-    syslog(L_ERROR, "%s cant cancel %s (SMerrno %d)", LogName,
-           TokenToText(token), SMerrno);
+    OVQsync();
+  ARTcanceltoken(data, MessageID, token);
   if (innconf->immediatecancel && !SMflushcacheddata(SM_CANCELLEDART))
     syslog(L_ERROR, "%s cant cancel cached %s", LogName, TokenToText(token));
-  snprintf(buff, sizeof(buff), "Cancelling %s",
-           MaxLength(MessageID, MessageID));
-  ARTlog(data, ART_CANC, buff);
   TMRstop(TMR_ARTCNCL);
 }
 
@@ -1306,13 +1474,13 @@ ARTcontrol(ARTDATA *data, char *Control, CHANNEL *cp UNUSED)
 **  strings.
 */
 static void
-ARTparsedist(const char *p, int size, LISTBUFFER *list)
+ARTparsedist(ARENA *arena, const char *p, int size, LISTBUFFER *list)
 {
   int	i;
   char	*q, **dp;
 
   /* setup buffer */ 
-  SetupListBuffer(size, list);
+  SetupListBuffer(arena, size, list);
 
   /* loop over text and copy */
   for (i = 0, q = list->Data, dp = list->List ; *p ; p++, *q++ = '\0') { 
@@ -1323,8 +1491,7 @@ ARTparsedist(const char *p, int size, LISTBUFFER *list)
       break;
 
     if (list->ListLength <= i) {
-      list->ListLength += DEFAULTNGBOXSIZE;
-      list->List = xrealloc(list->List, list->ListLength * sizeof(char *));
+      GrowListBuffer(arena, list);
       dp = &list->List[i];
     }
     /* mark the start of the host, move to the end of it while copying */  
@@ -1335,8 +1502,7 @@ ARTparsedist(const char *p, int size, LISTBUFFER *list)
   }
   *q = '\0';
   if (i == list->ListLength) {
-    list->ListLength += DEFAULTNGBOXSIZE;
-    list->List = xrealloc(list->List, list->ListLength * sizeof(char *));
+    GrowListBuffer(arena, list);
     dp = &list->List[i];
   }
   *dp = NULL;
@@ -1561,72 +1727,33 @@ ARTxrefslave(ARTDATA *data)
 }
 
 /*
-**  Return true if a list of strings has a specific one.  This is a
-**  generic routine, but is used for seeing if a host is in the Path: line.
+**  The hashes of the Message-ID used by hashfeeds, computed once per article
+**  by HashFeedMatch the first time a site needs them.
 */
-static bool
-ListHas(const char **list, const char *p)
-{
-    size_t i;
-     
-    for (i = 0; list[i] != NULL; i++)
-        if (strcasecmp(p, list[i]) == 0)
-            return true;
-    return false;
-}
+struct hashfeed {
+  bool done;
+  unsigned char digest[MD5_DIGESTSIZE];     /* MD5 hashfeeds */
+  unsigned int quickhash;                   /* Old-style Diablo quickhash */
+};
 
 /*
 **  Even though we have already calculated the Message-ID MD5sum,
 **  we have to do it again since unfortunately HashMessageID()
 **  lowercases the Message-ID first.  We also need to remain
-**  compatible with Diablo's hashfeed.
+**  compatible with Diablo's hashfeed.  The quickhash of Diablo (< 5.1)
+**  is the sum of the bytes of the Message-ID.
 */
-static unsigned int
-HashFeedMD5(char *MessageID, unsigned int offset)
-{
-  static char LastMessageID[128];
-  static char *LastMessageIDPtr;
-  static struct md5_context context;
-  unsigned int ret;
-
-  if (offset > 12)
-    return 0;
-
-  /* Some light caching. */
-  if (MessageID != LastMessageIDPtr ||
-      strcmp(MessageID, LastMessageID) != 0) {
-    md5_init(&context);
-    md5_update(&context, (unsigned char *)MessageID, strlen(MessageID));
-    md5_final(&context);
-    LastMessageIDPtr = MessageID;
-    strncpy(LastMessageID, MessageID, sizeof(LastMessageID) - 1);
-    LastMessageID[sizeof(LastMessageID) - 1] = 0;
-  }
-
-  memcpy(&ret, &context.digest[12 - offset], 4);
-
-  return ntohl(ret);
-}
-
-/*
-** Old-style Diablo (< 5.1) quickhash.
-*/
-static unsigned int
-HashFeedQH(char *MessageID, unsigned int *tmp)
+static void
+HashFeedCompute(struct hashfeed *hash, const char *MessageID)
 {
-  unsigned char *p;
-  int n;
-
-  if (*tmp != (unsigned int)-1)
-    return *tmp;
-
-  p = (unsigned char *)MessageID;
-  n = 0;
-  while (*p)
-    n += *p++;
-  *tmp = (unsigned int)n;
+  const unsigned char *p;
 
-  return *tmp;
+  md5_hash((const unsigned char *) MessageID, strlen(MessageID),
+           hash->digest);
+  hash->quickhash = 0;
+  for (p = (const unsigned char *) MessageID; *p != '\0'; p++)
+    hash->quickhash += *p;
+  hash->done = true;
 }
 
 /*
@@ -1634,23 +1761,27 @@ HashFeedQH(char *MessageID, unsigned int *tmp)
 **  the hash of the Message-ID.
 */
 static bool
-HashFeedMatch(HASHFEEDLIST *hf, char *MessageID)
+HashFeedMatch(HASHFEEDLIST *hf, struct hashfeed *hash, const char *MessageID)
 {
-  unsigned int qh = (unsigned int)-1;
+  uint32_t ret;
   unsigned int h;
 
-  while (hf) {
-    if (hf->type == HASHFEED_MD5)
-      h = HashFeedMD5(MessageID, hf->offset);
-    else if (hf->type == HASHFEED_QH)
-      h = HashFeedQH(MessageID, &qh);
+  if (!hash->done)
+    HashFeedCompute(hash, MessageID);
+  for (; hf != NULL; hf = hf->next) {
+    if (hf->type == HASHFEED_MD5) {
+      if (hf->offset > 12)
+        continue;
+      memcpy(&ret, &hash->digest[12 - hf->offset], 4);
+      h = ntohl(ret);
+    } else if (hf->type == HASHFEED_QH)
+      h = hash->quickhash;
     else
       continue;
 
     if ((h % hf->mod + 1) >= hf->begin &&
         (h % hf->mod + 1) <= hf->end)
       return true;
-    hf = hf->next;
   }
 
   return false;
@@ -1660,7 +1791,7 @@ HashFeedMatch(HASHFEEDLIST *hf, char *MessageID)
 **  Propagate an article to the sites have "expressed an interest."
 */
 static void
-ARTpropagate(ARTDATA *data, const char **hops, int hopcount, char **list,
+ARTpropagate(ARTDATA *data, int hopcount, char **list,
   bool ControlStore, bool OverviewCreated, bool Filtered)
 {
   HDRCONTENT	*hc = data->HdrContent;
@@ -1668,8 +1799,10 @@ ARTpropagate(ARTDATA *data, const char **hops, int hopcount, char **list,
   int		i, j, Groupcount, Followcount, Crosscount;
   char	        *p, *q, *begin, savec;
   bool		sendit;
+  struct hashfeed hash;
 
   /* Work out which sites should really get it. */
+  hash.done = false;
   Groupcount = data->Groupcount;
   Followcount = data->Followcount;
   Crosscount = Groupcount + Followcount * Followcount;
@@ -1747,7 +1880,8 @@ ARTpropagate(ARTDATA *data, const char **hops, int hopcount, char **list,
       continue;
 
     if ((sp->Hops && hopcount > sp->Hops)
-      || (!sp->IgnorePath && ListHas(hops, sp->Name))
+      || (!sp->IgnorePath
+          && ARTpathhas(&data->PathSet, sp->Name, sp->NameHash))
       || (sp->Groupcount && Groupcount > sp->Groupcount)
       || (sp->Followcount && Followcount > sp->Followcount)
       || (sp->Crosscount && Crosscount > sp->Crosscount))
@@ -1756,7 +1890,7 @@ ARTpropagate(ARTDATA *data, const char **hops, int hopcount, char **list,
       continue;
 
     if (sp->HashFeedList
-      && !HashFeedMatch(sp->HashFeedList, HDR(HDR__MESSAGE_ID)))
+      && !HashFeedMatch(sp->HashFeedList, &hash, HDR(HDR__MESSAGE_ID)))
       /* Hashfeed doesn't match. */
       continue;
 
@@ -1770,7 +1904,7 @@ ARTpropagate(ARTDATA *data, const char **hops, int hopcount, char **list,
 
     if (sp->Exclusions) {
       for (j = 0; (p = sp->Exclusions[j]) != NULL; j++)
-	if (ListHas(hops, p))
+	if (ARTpathhas(&data->PathSet, p, sp->ExclusionHashes[j]))
 	  break;
       if (p != NULL)
 	/* A host in the site's exclusion list was in the Path. */
@@ -1857,12 +1991,10 @@ ARTmakeoverview(CHANNEL *cp)
       /* Ensure that there are Keywords: to shovel. */
       if (hp == &ARTheaders[HDR__KEYWORDS] && HDR(HDR__KEYWORDS) == NULL) {
         keywords_generated = true;
-        KEYgenerate(&hc[HDR__KEYWORDS], cp->In.data + data->Body,
-                    cp->Next - data->Body);
+        KEYgenerate(&data->Arena, &hc[HDR__KEYWORDS],
+                    cp->In.data + data->Body, cp->Next - data->Body);
         /* Do not memorize an empty Keywords: header. */
         if (HDR_LEN(HDR__KEYWORDS) == 0) {
-          if (HDR(HDR__KEYWORDS) != NULL)
-              free(HDR(HDR__KEYWORDS)); /* malloc'd within. */
           HDR(HDR__KEYWORDS) = NULL;
           keywords_generated = false;
         }
@@ -1918,8 +2050,6 @@ ARTmakeoverview(CHANNEL *cp)
     /* Patch the old keywords back in. */
     if (DO_KEYWORDS && innconf->keywords) {
       if (keywords_generated) {
-        if (HDR(HDR__KEYWORDS) != NULL)
-          free(HDR(HDR__KEYWORDS)); /* malloc'd within. */
         HDR(HDR__KEYWORDS) = NULL;
         HDR_LEN(HDR__KEYWORDS) = 0;
         keywords_generated = false;
@@ -1929,205 +2059,39 @@ ARTmakeoverview(CHANNEL *cp)
 }
 
 /*
-**  This routine is the heart of it all.  Take a full article, parse it,
-**  file or reject it, feed it to the other sites.  Return the NNTP
-**  message to send back.
+**  The rest of ARTpost, once the article has gone through the embedded
+**  filters.  Filtered is set if a filter rejected it but dontrejectfiltered
+**  is set.
 */
-bool
-ARTpost(CHANNEL *cp)
+static bool
+ARTpostfiltered(CHANNEL *cp, bool Filtered)
 {
   char		*p, **groups, ControlWord[SMBUF], **hops, *controlgroup;
   int		i, j, *isp, hopcount, oerrno, canpost;
   float         f;
-  size_t        n;
   NEWSGROUP	*ngp, **ngptr;
   NEWSGROUP     *ngpjunk;
   SITE		*sp;
   ARTDATA	*data = &cp->Data;
   HDRCONTENT	*hc = data->HdrContent;
   bool		Approved, Accepted, LikeNewgroup, ToGroup, GroupMissing;
-  bool		NoHistoryUpdate, artclean;
+  bool		NoHistoryUpdate;
   bool		ControlStore = false;
   bool		NonExist = false;
   bool		OverviewCreated = false;
+  bool		queued;
   bool		IsControl = false;
-  bool		Filtered = false;
   bool          ihave;
-  HASH		hash;
   TOKEN		token;
   char		*groupbuff[2];
-#if defined(DO_PERL) || defined(DO_PYTHON)
-  struct buffer *article;
-  char		*filterrc;
-#endif
   OVADDRESULT	result;
+  struct timeval start;
+  unsigned long propagate, elapsed, usec;
 
-  /* Check whether we are receiving the article via IHAVE or TAKETHIS. */
   ihave = (cp->Sendid.size > 3) ? false : true;
-
-#if defined(DO_PERL) || defined(DO_PYTHON)
-  article = &cp->In;
-#endif
-
-  /* Preliminary clean-ups. */
-  artclean = ARTclean(data, cp->Error, ihave);
-
-  /* We have not parsed the Path: header yet.  We do not check for logipaddr
-   * right now (it will be done afterwards and change data->Feedsite
-   * in consequence).  We assign a feed site for the next call to ARTlog(). */
-  if (cp->Address.ss_family != 0) {
-    data->Feedsite = RChostname(cp);
-  } else {
-    data->Feedsite = "localhost";
-  }
-  if (data->Feedsite == NULL)
-    data->Feedsite = CHANname(cp);
-  data->FeedsiteLength = strlen(data->Feedsite);
-
-  /* If we don't have Path: or Message-ID:, we can't continue. */
-  if (!artclean && (!HDR_FOUND(HDR__PATH) || !HDR_FOUND(HDR__MESSAGE_ID))) {
-    /* cp->Error is set since Path: and Message-ID: are required headers and one
-     * of them is not found during ARTclean().
-     * We do not remember the message-ID of this article because another
-     * peer may send it with a good Path: header. */
-    ARTlog(data, ART_REJECT, cp->Error);
-    ARTreject(REJECT_OTHER, cp);
-    return false;
-  }
-  hopcount = ARTparsepath(HDR(HDR__PATH), HDR_LEN(HDR__PATH), &data->Path);
-  if (hopcount == 0) {
-    snprintf(cp->Error, sizeof(cp->Error), "%d Illegal path element",
-             ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT);
-    /* We do not remember the message-ID of this article because another
-     * peer may send it with a good Path: header. */
-    ARTlog(data, ART_REJECT, cp->Error);
-    ARTreject(REJECT_OTHER, cp);
-    return false;
-  }
   hops = data->Path.List;
-
-  if (innconf->logipaddr) {
-    if (strcmp("0.0.0.0", data->Feedsite) == 0 || data->Feedsite[0] == '\0')
-      data->Feedsite = hops && hops[0] ? hops[0] : CHANname(cp);
-  } else {
-    data->Feedsite = hops && hops[0] ? hops[0] : CHANname(cp);
-  }
-  data->FeedsiteLength = strlen(data->Feedsite);
-
-  hash = HashMessageID(HDR(HDR__MESSAGE_ID));
-  data->Hash = &hash;
-  if (HIScheck(History, HDR(HDR__MESSAGE_ID))) {
-    snprintf(cp->Error, sizeof(cp->Error), "%d Duplicate",
-             ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT);
-    ARTlog(data, ART_REJECT, cp->Error);
-    ARTreject(REJECT_DUPLICATE, cp);
-    return false;
-  }
-  if (!artclean) {
-    ARTlog(data, ART_REJECT, cp->Error);
-    /* If the article posting time has not been properly parsed, data->Posted
-     * will be negative or zero. */
-    if (innconf->remembertrash && (Mode == OMrunning) &&
-	!InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
-      syslog(L_ERROR, "%s cant write history %s %m", LogName,
-	HDR(HDR__MESSAGE_ID));
-    ARTreject(REJECT_OTHER, cp);
-    return false;
-  }
-
-  n = strlen(hops[0]);
-  if (n == Path.used - 1 &&
-    strncasecmp(Path.data, hops[0], Path.used - 1) == 0)
-    data->Hassamepath = true;
-  else
-    data->Hassamepath = false;
-  if (Pathcluster.data != NULL &&
-    n == Pathcluster.used - 1 &&
-    strncasecmp(Pathcluster.data, hops[0], Pathcluster.used - 1) == 0)
-    data->Hassamecluster = true;
-  else
-    data->Hassamecluster = false;
-  if (Pathalias.data != NULL &&
-    !ListHas((const char **)hops, (const char *)innconf->pathalias))
-    data->AddAlias = true;
-  else
-    data->AddAlias = false;
-
-  /* And now check the path for unwanted sites -- Andy */
-  for(j = 0 ; ME.Exclusions && ME.Exclusions[j] ; j++) {
-    if (ListHas((const char **)hops, (const char *)ME.Exclusions[j])) {
-      snprintf(cp->Error, sizeof(cp->Error), "%d Unwanted site %s in path",
-	       ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT,
-               MaxLength(ME.Exclusions[j], ME.Exclusions[j]));
-      ARTlog(data, ART_REJECT, cp->Error);
-      if (innconf->remembertrash && (Mode == OMrunning) &&
-	  !InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
-	syslog(L_ERROR, "%s cant write history %s %m", LogName,
-	  HDR(HDR__MESSAGE_ID));
-      ARTreject(REJECT_SITE, cp);
-      return false;
-    }
-  }
-
-#if defined(DO_PYTHON)
-  TMRstart(TMR_PYTHON);
-  filterrc = PYartfilter(data, article->data + data->Body,
-    cp->Next - data->Body, data->Lines);
-  TMRstop(TMR_PYTHON);
-  if (filterrc != NULL) {
-    if (innconf->dontrejectfiltered) {
-      Filtered = true;
-      syslog(L_NOTICE, "rejecting[python] %s %d %.200s (with dontrejectfiltered)",
-             HDR(HDR__MESSAGE_ID),
-             ihave ? NNTP_OK_IHAVE : NNTP_OK_TAKETHIS,
-             filterrc);
-    } else {
-      snprintf(cp->Error, sizeof(cp->Error), "%d %.200s",
-               ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT,
-               filterrc);
-      syslog(L_NOTICE, "rejecting[python] %s %s", HDR(HDR__MESSAGE_ID),
-             cp->Error);
-      ARTlog(data, ART_REJECT, cp->Error);
-      if (innconf->remembertrash && (Mode == OMrunning) &&
-	  !InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
-	syslog(L_ERROR, "%s cant write history %s %m", LogName,
-	  HDR(HDR__MESSAGE_ID));
-      ARTreject(REJECT_FILTER, cp);
-      return false;
-    }
-  }
-#endif /* DO_PYTHON */
-
-  /* I suppose some masochist will run with Python and Perl in together */
-
-#if defined(DO_PERL)
-  TMRstart(TMR_PERL);
-  filterrc = PLartfilter(data, article->data + data->Body,
-    cp->Next - data->Body, data->Lines);
-  TMRstop(TMR_PERL);
-  if (filterrc) {
-    if (innconf->dontrejectfiltered) {
-      Filtered = true;
-      syslog(L_NOTICE, "rejecting[perl] %s %d %.200s (with dontrejectfiltered)",
-             HDR(HDR__MESSAGE_ID),
-             ihave ? NNTP_OK_IHAVE : NNTP_OK_TAKETHIS,
-             filterrc);
-    } else {
-      snprintf(cp->Error, sizeof(cp->Error), "%d %.200s",
-               ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT,
-               filterrc);
-      syslog(L_NOTICE, "rejecting[perl] %s %s", HDR(HDR__MESSAGE_ID),
-             cp->Error);
-      ARTlog(data, ART_REJECT, cp->Error);
-      if (innconf->remembertrash && (Mode == OMrunning) &&
-	  !InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
-	syslog(L_ERROR, "%s cant write history %s %m", LogName,
-	  HDR(HDR__MESSAGE_ID));
-      ARTreject(REJECT_FILTER, cp);
-      return false;
-    }
-  }
-#endif /* DO_PERL */
+  for (hopcount = 0; hops[hopcount] != NULL; hopcount++)
+    ;
 
   /* If we limit what distributions we get, see if we want this one. */
   if (HDR_FOUND(HDR__DISTRIBUTION)) {
@@ -2143,8 +2107,8 @@ ARTpost(CHANNEL *cp)
       ARTreject(REJECT_DISTRIB, cp);
       return false;
     } else {
-      ARTparsedist(HDR(HDR__DISTRIBUTION), HDR_LEN(HDR__DISTRIBUTION),
-	&data->Distribution);
+      ARTparsedist(&data->Arena, HDR(HDR__DISTRIBUTION),
+	HDR_LEN(HDR__DISTRIBUTION), &data->Distribution);
       if (ME.Distributions && data->Distribution.List != NULL
           && *data->Distribution.List != NULL
 	  && !DISTwantany(ME.Distributions, data->Distribution.List)) {
@@ -2163,7 +2127,7 @@ ARTpost(CHANNEL *cp)
       }
     }
   } else {
-    ARTparsedist("", 0, &data->Distribution);
+    ARTparsedist(&data->Arena, "", 0, &data->Distribution);
   }
 
   for (i = nSites, sp = Sites; --i >= 0; sp++) {
@@ -2502,6 +2466,7 @@ ARTpost(CHANNEL *cp)
     ICDwriteactive();
     ICDactivedirty = 0;
   }
+  gettimeofday(&start, NULL);
   TMRstart(TMR_ARTWRITE);
   for (i = 0; (ngp = GroupPointers[i]) != NULL; i++)
     ngp->PostCount = 0;
@@ -2526,28 +2491,48 @@ ARTpost(CHANNEL *cp)
     return false;
   }
   TMRstop(TMR_ARTWRITE);
+  elapsed = ARTelapsed(&start);
+  ARTstage(STAGE_STORE, elapsed);
   if ((innconf->enableoverview && !innconf->useoverchan) || NeedOverview) {
     TMRstart(TMR_OVERV);
     ARTmakeoverview(cp);
     if (innconf->enableoverview && !innconf->useoverchan) {
-      if ((result = OVadd(token, data->Overview.data, data->Overview.left,
-	data->Arrived, data->Expires)) == OVADDFAILED) {
-	if (OVctl(OVSPACE, (void *)&f) && (int)(f+0.01f) == OV_NOSPACE)
-	  IOError("creating overview", ENOSPC);
-	else
-	  IOError("creating overview", 0);
-	syslog(L_ERROR, "%s cant store overview for %s", LogName,
-	  TokenToText(token));
-	OverviewCreated = false;
-      } else {
-	if (result == OVADDCOMPLETED)
-	  OverviewCreated = true;
-	else
-	  OverviewCreated = false;
+      /* Sites with the o flag only get the article once its overview has
+       * been written, so it can't be left to the overview writer thread. */
+      queued = false;
+      for (sp = Sites, j = nSites; --j >= 0; sp++)
+        if (sp->Sendit && sp->NeedOverviewCreation)
+          break;
+      if (j < 0)
+        queued = OVQadd(token, data->Overview.data, data->Overview.left,
+                        data->Arrived, data->Expires);
+      if (queued)
+        OverviewCreated = true;
+      else {
+        OVQsync();
+        if ((result = OVadd(token, data->Overview.data, data->Overview.left,
+          data->Arrived, data->Expires)) == OVADDFAILED) {
+          if (OVctl(OVSPACE, (void *)&f) && (int)(f+0.01f) == OV_NOSPACE)
+            IOError("creating overview", ENOSPC);
+          else
+            IOError("creating overview", 0);
+          syslog(L_ERROR, "%s cant store overview for %s", LogName,
+            TokenToText(token));
+          OverviewCreated = false;
+        } else {
+          if (result == OVADDCOMPLETED)
+            OverviewCreated = true;
+          else
+            OverviewCreated = false;
+        }
       }
     }
     TMRstop(TMR_OVERV);
+    usec = ARTelapsed(&start);
+    ARTstage(STAGE_OVERVIEW, usec);
+    elapsed += usec;
   }
+  ARTstorelatency(elapsed);
   strlcpy(data->TokenText, TokenToText(token), sizeof(data->TokenText));
 
   /* Update history if we didn't get too many I/O errors above. */
@@ -2564,6 +2549,7 @@ ARTpost(CHANNEL *cp)
     ARTreject(REJECT_OTHER, cp);
     return false;
   }
+  ARTstage(STAGE_HISWRITE, ARTelapsed(&start));
 
   if (NeedStoredGroup)
     data->StoredGroupLength = strlen(data->Newsgroups.List[0]);
@@ -2609,8 +2595,10 @@ ARTpost(CHANNEL *cp)
     }
   }
 
-  ARTpropagate(data, (const char **)hops, hopcount, data->Distribution.List,
+  gettimeofday(&start, NULL);
+  ARTpropagate(data, hopcount, data->Distribution.List,
     ControlStore, OverviewCreated, Filtered);
+  propagate = ARTelapsed(&start);
 
   /* Now that it's been written, process the control message.  This has
    * a small window, if we get a new article before the newgroup message
@@ -2629,6 +2617,7 @@ ARTpost(CHANNEL *cp)
   /* And finally, send to everyone who should get it.
    * sp->Sendit is false for funnel sites:  ARTpropagate()
    * transferred it to the corresponding funnel. */
+  gettimeofday(&start, NULL);
   for (sp = Sites, i = nSites; --i >= 0; sp++) {
     if (sp->Sendit) {
       TMRstart(TMR_SITESEND);
@@ -2636,6 +2625,247 @@ ARTpost(CHANNEL *cp)
       TMRstop(TMR_SITESEND);
     }
   }
+  ARTstage(STAGE_PROPAGATE, propagate + ARTelapsed(&start));
 
   return true;
 }
+
+
+/*
+**  This routine is the heart of it all.  Take a full article, parse it,
+**  file or reject it, feed it to the other sites.  Return the NNTP
+**  message to send back.
+**
+**  If the article is handed to a filter worker, false is returned with the
+**  channel in the CSfiltering state; posting resumes in ARTfiltered once
+**  the verdict is back.
+*/
+bool
+ARTpost(CHANNEL *cp)
+{
+  char		**hops;
+  int		j, hopcount;
+  size_t        n;
+  ARTDATA	*data = &cp->Data;
+  HDRCONTENT	*hc = data->HdrContent;
+  bool		artclean, duplicate;
+  bool          ihave;
+  struct timeval start;
+
+  /* Check whether we are receiving the article via IHAVE or TAKETHIS. */
+  ihave = (cp->Sendid.size > 3) ? false : true;
+
+  /* Preliminary clean-ups. */
+  gettimeofday(&start, NULL);
+  artclean = ARTclean(data, cp->Error, ihave);
+
+  /* We have not parsed the Path: header yet.  We do not check for logipaddr
+   * right now (it will be done afterwards and change data->Feedsite
+   * in consequence).  We assign a feed site for the next call to ARTlog(). */
+  if (cp->Address.ss_family != 0) {
+    data->Feedsite = RChostname(cp);
+  } else {
+    data->Feedsite = "localhost";
+  }
+  if (data->Feedsite == NULL)
+    data->Feedsite = CHANname(cp);
+  data->FeedsiteLength = strlen(data->Feedsite);
+
+  /* If we don't have Path: or Message-ID:, we can't continue. */
+  if (!artclean && (!HDR_FOUND(HDR__PATH) || !HDR_FOUND(HDR__MESSAGE_ID))) {
+    /* cp->Error is set since Path: and Message-ID: are required headers and one
+     * of them is not found during ARTclean().
+     * We do not remember the message-ID of this article because another
+     * peer may send it with a good Path: header. */
+    ARTlog(data, ART_REJECT, cp->Error);
+    ARTreject(REJECT_OTHER, cp);
+    return false;
+  }
+  hopcount = ARTparsepath(&data->Arena, HDR(HDR__PATH), HDR_LEN(HDR__PATH),
+			  &data->Path);
+  ARTstage(STAGE_PARSE, ARTelapsed(&start));
+  if (hopcount == 0) {
+    snprintf(cp->Error, sizeof(cp->Error), "%d Illegal path element",
+             ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT);
+    /* We do not remember the message-ID of this article because another
+     * peer may send it with a good Path: header. */
+    ARTlog(data, ART_REJECT, cp->Error);
+    ARTreject(REJECT_OTHER, cp);
+    return false;
+  }
+  hops = data->Path.List;
+  ARTpathset(&data->Arena, (const char **) hops, hopcount, &data->PathSet);
+
+  if (innconf->logipaddr) {
+    if (strcmp("0.0.0.0", data->Feedsite) == 0 || data->Feedsite[0] == '\0')
+      data->Feedsite = hops && hops[0] ? hops[0] : CHANname(cp);
+  } else {
+    data->Feedsite = hops && hops[0] ? hops[0] : CHANname(cp);
+  }
+  data->FeedsiteLength = strlen(data->Feedsite);
+
+  data->MessageIDHash = HashMessageID(HDR(HDR__MESSAGE_ID));
+  data->Hash = &data->MessageIDHash;
+  duplicate = HIScheck(History, HDR(HDR__MESSAGE_ID));
+  ARTstage(STAGE_HISLOOKUP, ARTelapsed(&start));
+  if (duplicate) {
+    snprintf(cp->Error, sizeof(cp->Error), "%d Duplicate",
+             ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT);
+    ARTlog(data, ART_REJECT, cp->Error);
+    ARTreject(REJECT_DUPLICATE, cp);
+    return false;
+  }
+  if (!artclean) {
+    ARTlog(data, ART_REJECT, cp->Error);
+    /* If the article posting time has not been properly parsed, data->Posted
+     * will be negative or zero. */
+    if (innconf->remembertrash && (Mode == OMrunning) &&
+	!InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
+      syslog(L_ERROR, "%s cant write history %s %m", LogName,
+	HDR(HDR__MESSAGE_ID));
+    ARTreject(REJECT_OTHER, cp);
+    return false;
+  }
+
+  n = strlen(hops[0]);
+  if (n == Path.used - 1 &&
+    strncasecmp(Path.data, hops[0], Path.used - 1) == 0)
+    data->Hassamepath = true;
+  else
+    data->Hassamepath = false;
+  if (Pathcluster.data != NULL &&
+    n == Pathcluster.used - 1 &&
+    strncasecmp(Pathcluster.data, hops[0], Pathcluster.used - 1) == 0)
+    data->Hassamecluster = true;
+  else
+    data->Hassamecluster = false;
+  if (Pathalias.data != NULL &&
+    !ARTpathhas(&data->PathSet, innconf->pathalias,
+                ARThophash(innconf->pathalias)))
+    data->AddAlias = true;
+  else
+    data->AddAlias = false;
+
+  /* And now check the path for unwanted sites -- Andy */
+  for(j = 0 ; ME.Exclusions && ME.Exclusions[j] ; j++) {
+    if (ARTpathhas(&data->PathSet, ME.Exclusions[j],
+                   ME.ExclusionHashes[j])) {
+      snprintf(cp->Error, sizeof(cp->Error), "%d Unwanted site %s in path",
+	       ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT,
+               MaxLength(ME.Exclusions[j], ME.Exclusions[j]));
+      ARTlog(data, ART_REJECT, cp->Error);
+      if (innconf->remembertrash && (Mode == OMrunning) &&
+	  !InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
+	syslog(L_ERROR, "%s cant write history %s %m", LogName,
+	  HDR(HDR__MESSAGE_ID));
+      ARTreject(REJECT_SITE, cp);
+      return false;
+    }
+  }
+
+  /* A slave may trust its master to have filtered the article. */
+  if (innconf->xrefslave && !innconf->xrefslavefilters)
+    return ARTpostfiltered(cp, false);
+
+  /* Let a filter worker run the embedded filters if there is one. */
+  if (FLTQsubmit(cp))
+    return false;
+  return ARTfilter(cp);
+}
+
+
+#if defined(DO_PERL) || defined(DO_PYTHON)
+/*
+**  Act on the verdict of an embedded filter, which is NULL or the empty
+**  string if the article is accepted.  Returns false if the article has been
+**  rejected, and sets Filtered if it is only to be marked as such because of
+**  dontrejectfiltered.
+*/
+static bool
+ARTfilterverdict(CHANNEL *cp, const char *filter, const char *filterrc,
+                 bool *Filtered)
+{
+  ARTDATA	*data = &cp->Data;
+  HDRCONTENT	*hc = data->HdrContent;
+  bool          ihave;
+
+  if (filterrc == NULL || *filterrc == '\0')
+    return true;
+  ihave = (cp->Sendid.size > 3) ? false : true;
+  if (innconf->dontrejectfiltered) {
+    *Filtered = true;
+    syslog(L_NOTICE, "rejecting[%s] %s %d %.200s (with dontrejectfiltered)",
+           filter, HDR(HDR__MESSAGE_ID),
+           ihave ? NNTP_OK_IHAVE : NNTP_OK_TAKETHIS,
+           filterrc);
+    return true;
+  }
+  snprintf(cp->Error, sizeof(cp->Error), "%d %.200s",
+           ihave ? NNTP_FAIL_IHAVE_REJECT : NNTP_FAIL_TAKETHIS_REJECT,
+           filterrc);
+  syslog(L_NOTICE, "rejecting[%s] %s %s", filter, HDR(HDR__MESSAGE_ID),
+         cp->Error);
+  ARTlog(data, ART_REJECT, cp->Error);
+  if (innconf->remembertrash && (Mode == OMrunning) &&
+      !InndHisRemember(HDR(HDR__MESSAGE_ID), data->Posted))
+    syslog(L_ERROR, "%s cant write history %s %m", LogName,
+      HDR(HDR__MESSAGE_ID));
+  ARTreject(REJECT_FILTER, cp);
+  return false;
+}
+
+
+/*
+**  Finish posting an article with the verdicts of the Python and Perl
+**  filters returned by a filter worker.  Returns like ARTpost.
+*/
+bool
+ARTfiltered(CHANNEL *cp, const char *pythonrc, const char *perlrc)
+{
+  bool		Filtered = false;
+
+  if (!ARTfilterverdict(cp, "python", pythonrc, &Filtered))
+    return false;
+  if (!ARTfilterverdict(cp, "perl", perlrc, &Filtered))
+    return false;
+  return ARTpostfiltered(cp, Filtered);
+}
+#endif /* DO_PERL || DO_PYTHON */
+
+
+/*
+**  Run the embedded filters on an article in innd itself and finish posting
+**  it.  Returns like ARTpost.
+*/
+bool
+ARTfilter(CHANNEL *cp)
+{
+  bool		Filtered = false;
+#if defined(DO_PERL) || defined(DO_PYTHON)
+  ARTDATA	*data = &cp->Data;
+  struct buffer *article = &cp->In;
+  char		*filterrc;
+#endif
+
+#if defined(DO_PYTHON)
+  TMRstart(TMR_PYTHON);
+  filterrc = PYartfilter(data, article->data + data->Body,
+    cp->Next - data->Body, data->Lines);
+  TMRstop(TMR_PYTHON);
+  if (!ARTfilterverdict(cp, "python", filterrc, &Filtered))
+    return false;
+#endif /* DO_PYTHON */
+
+  /* I suppose some masochist will run with Python and Perl in together */
+
+#if defined(DO_PERL)
+  TMRstart(TMR_PERL);
+  filterrc = PLartfilter(data, article->data + data->Body,
+    cp->Next - data->Body, data->Lines);
+  TMRstop(TMR_PERL);
+  if (!ARTfilterverdict(cp, "perl", filterrc, &Filtered))
+    return false;
+#endif /* DO_PERL */
+
+  return ARTpostfiltered(cp, Filtered);
+}
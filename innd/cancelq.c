@@ -0,0 +1,209 @@
+/*
+**  Cancel queue.
+**
+**  When cancelbatch is set in inn.conf, ARTcancel only looks up the token of
+**  the article to cancel and queues it, instead of verifying the cancel and
+**  removing the article from the overview and the spool at once.  The main
+**  loop applies what was queued with CANQstep when it has nothing else to
+**  do, or when the oldest queued cancel has waited for a second, so that a
+**  flood of cancels (from NoCeM notices through INN::cancel or ctlinnd
+**  cancel, for instance) does not stall the incoming feeds article by
+**  article.
+**
+**  The queued cancels are sorted by token before being applied, which
+**  groups them by storage method and storage class and, for CNFS, by
+**  cycbuff and then offset, so that the spool is visited in order.  The
+**  overview queue is synced and the articles cached by the storage method
+**  are flushed for immediatecancel once per batch instead of once per
+**  cancel.  The queue holds at most cancelbatch cancels; when it is full,
+**  it is flushed before queuing another one.
+**
+**  The queue is flushed before the server is paused or throttled, since
+**  expire may run then, and when innd exits.  While the server is not
+**  running, cancels are applied at once as before.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/innconf.h"
+#include "inn/ov.h"
+#include "inn/storage.h"
+#include "innd.h"
+
+/* How long a queued cancel may wait while the server is busy. */
+#define CANQ_MAXAGE 1
+
+/* One queued cancel. */
+struct canq_entry {
+    TOKEN token;
+    char *msgid;                /* Message-ID of the article to cancel. */
+    char *cancelid;             /* Message-ID of the cancel, or NULL. */
+    char *feedsite;
+    char **groups;              /* Newsgroups to verify against, or NULL. */
+};
+
+static struct {
+    struct canq_entry *entries;
+    size_t size;
+    size_t count;
+    time_t oldest;              /* When the first queued cancel came. */
+    bool flushing;              /* CANQflush is running. */
+} canq;
+
+
+/*
+**  Copy a NULL-terminated list of newsgroups into a single allocation.
+*/
+static char **
+CANQcopylist(char **list)
+{
+    char **copy, *p;
+    size_t count, length, i;
+
+    for (count = 0, length = 0; list[count] != NULL; count++)
+        length += strlen(list[count]) + 1;
+    copy = xmalloc((count + 1) * sizeof(char *) + length);
+    p = (char *) (copy + count + 1);
+    for (i = 0; i < count; i++) {
+        length = strlen(list[i]) + 1;
+        memcpy(p, list[i], length);
+        copy[i] = p;
+        p += length;
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+
+/*
+**  Order cancels by token: storage method, storage class, then the token
+**  itself, which starts with the cycbuff name and offset for CNFS.
+*/
+static int
+CANQcompare(const void *a, const void *b)
+{
+    const struct canq_entry *x = a;
+    const struct canq_entry *y = b;
+
+    if (x->token.type != y->token.type)
+        return (x->token.type < y->token.type) ? -1 : 1;
+    if (x->token.class != y->token.class)
+        return (x->token.class < y->token.class) ? -1 : 1;
+    return memcmp(x->token.token, y->token.token, sizeof(x->token.token));
+}
+
+
+/*
+**  Queue the cancel of the article with the given token.  Returns false if
+**  cancels are not batched, in which case the caller has to apply it.
+*/
+bool
+CANQadd(const ARTDATA *data, const char *MessageID, TOKEN token, bool verify)
+{
+    const HDRCONTENT *hc = data->HdrContent;
+    struct canq_entry *entry;
+
+    if (innconf->cancelbatch == 0 || Mode != OMrunning || canq.flushing)
+        return false;
+    if (canq.count >= innconf->cancelbatch)
+        CANQflush();
+    if (canq.count >= canq.size) {
+        canq.size = innconf->cancelbatch;
+        canq.entries = xreallocarray(canq.entries, canq.size,
+                                     sizeof(struct canq_entry));
+    }
+    if (canq.count == 0)
+        canq.oldest = Now.tv_sec;
+    entry = &canq.entries[canq.count++];
+    entry->token = token;
+    entry->msgid = xstrdup(MessageID);
+    if (HDR_FOUND(HDR__MESSAGE_ID))
+        entry->cancelid = xstrndup(HDR(HDR__MESSAGE_ID),
+                                   HDR_LEN(HDR__MESSAGE_ID));
+    else
+        entry->cancelid = NULL;
+    entry->feedsite = xstrdup(data->Feedsite != NULL ? data->Feedsite : "?");
+    entry->groups = verify ? CANQcopylist(data->Newsgroups.List) : NULL;
+    return true;
+}
+
+
+/*
+**  Whether cancels are waiting for CANQflush.
+*/
+bool
+CANQpending(void)
+{
+    return canq.count > 0;
+}
+
+
+/*
+**  Called at each pass of the main loop, with idle true when no channel
+**  was ready.  Applies the queued cancels if the server is idle or the
+**  oldest one has waited long enough.
+*/
+void
+CANQstep(bool idle)
+{
+    if (canq.count == 0)
+        return;
+    if (idle || Now.tv_sec - canq.oldest >= CANQ_MAXAGE)
+        CANQflush();
+}
+
+
+/*
+**  Apply all the queued cancels.  A cancel logs in the name of the site
+**  which sent it, as ARTcancel would have done.
+*/
+void
+CANQflush(void)
+{
+    static ARTDATA data;
+    struct canq_entry *entry;
+    size_t i;
+
+    if (canq.count == 0 || canq.flushing)
+        return;
+    canq.flushing = true;
+    TMRstart(TMR_ARTCNCL);
+    qsort(canq.entries, canq.count, sizeof(struct canq_entry), CANQcompare);
+    if (innconf->enableoverview)
+        OVQsync();
+    for (i = 0; i < canq.count; i++) {
+        entry = &canq.entries[i];
+        data.Posted = data.Arrived = Now.tv_sec;
+        data.Feedsite = entry->feedsite;
+        data.HdrContent[HDR__MESSAGE_ID].Value = entry->cancelid;
+        data.HdrContent[HDR__MESSAGE_ID].Length =
+            (entry->cancelid != NULL) ? strlen(entry->cancelid) : 0;
+        data.Newsgroups.List = entry->groups;
+        if (entry->groups == NULL
+            || ARTcancelverify(&data, entry->msgid, entry->token))
+            ARTcanceltoken(&data, entry->msgid, entry->token);
+        free(entry->msgid);
+        free(entry->cancelid);
+        free(entry->feedsite);
+        free(entry->groups);
+    }
+    if (innconf->immediatecancel && !SMflushcacheddata(SM_CANCELLEDART))
+        syslog(L_ERROR, "%s cant cancel cached articles", LogName);
+    canq.count = 0;
+    canq.flushing = false;
+    TMRstop(TMR_ARTCNCL);
+}
+
+
+/*
+**  Apply what is queued and free the queue.
+*/
+void
+CANQclose(void)
+{
+    CANQflush();
+    free(canq.entries);
+    canq.entries = NULL;
+    canq.size = 0;
+}
@@ -20,6 +20,7 @@
 
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
+#include "inn/ov.h"
 #include "inn/qio.h"
 #include "innd.h"
 #include "inn/inndcomm.h"
@@ -37,6 +38,7 @@ typedef struct _CCDISPATCH {
 
 
 static const char *	CCallow(char *av[]);
+static const char *	CCbatch(char *av[]);
 static const char *	CCbegin(char *av[]);
 static const char *	CCchgroup(char *av[]);
 static const char *	CCdrop(char *av[]);
@@ -46,6 +48,7 @@ static const char *	CCflushlogs(char *unused[]);
 static const char *	CCgo(char *av[]);
 static const char *	CChangup(char *av[]);
 static const char *	CCreserve(char *av[]);
+static const char *	CClatency(char *av[]);
 static const char *	CClogmode(char *unused[]);
 static const char *	CCmode(char *unused[]);
 static const char *	CCname(char *av[]);
@@ -81,6 +84,7 @@ static char		CCnochannel[] = "1 No such channel";
 static char		CCnoreason[] = "1 Empty reason";
 static char		CCbigreason[] = "1 Reason too long";
 static char		CCnotrunning[] = "1 Must be running";
+static char		CCdefaultrest[] = "y";
 static struct buffer	CCreply;
 static CHANNEL		*CCchan;
 #ifdef HAVE_UNIX_DOMAIN_SOCKETS
@@ -89,6 +93,7 @@ static int		CCwriter;
 static CCDISPATCH	CCcommands[] = {
     {	SC_ADDHIST,	5, CCaddhist	},
     {	SC_ALLOW,	1, CCallow	},
+    {	SC_BATCH,	1, CCbatch	},
     {	SC_BEGIN,	1, CCbegin	},
     {	SC_CANCEL,	1, CCcancel	},
     {	SC_CHANGEGROUP,	2, CCchgroup	},
@@ -101,6 +106,7 @@ static CCDISPATCH	CCcommands[] = {
     {	SC_FLUSHLOGS,	0, CCflushlogs	},
     {	SC_GO,		1, CCgo		},
     {	SC_HANGUP,	1, CChangup	},
+    {	SC_LATENCY,	1, CClatency	},
     {	SC_LOGMODE,	0, CClogmode	},
     {	SC_MODE,	0, CCmode	},
     {	SC_NAME,	1, CCname	},
@@ -346,6 +352,320 @@ CCallow(char *av[])
 }
 
 
+/*
+**  Check that a name is valid for a new newsgroup.  Returns NULL if it is,
+**  or the reply to send.
+*/
+static const char *
+CCcheckname(const char *Name)
+{
+    const char		*p;
+
+    if (Name[0] == '.' || strspn(Name, "0123456789") == strlen(Name))
+	return "1 Illegal newsgroup name";
+    for (p = Name; *p; p++)
+	if (*p == '.') {
+	    if (p[1] == '.' || p[1] == '\0')
+		return "1 Double or trailing period in newsgroup name";
+	}
+	else if (ISWHITE(*p) || *p == ':' || *p == '!' || *p == '/')
+	    return "1 Illegal character in newsgroup name";
+    return NULL;
+}
+
+
+/*
+**  Keep only the lowercased first letter of newsgroup flags, unless they
+**  name an alias.
+*/
+static void
+CCfixrest(char *Rest)
+{
+    if (Rest[0] != NF_FLAG_ALIAS) {
+	Rest[1] = '\0';
+	if (isupper((unsigned char) Rest[0]))
+	    Rest[0] = tolower((unsigned char) Rest[0]);
+    }
+}
+
+
+/*
+**  Append lines to the log of groups created.  Don't use stdio because
+**  SunOS 4.1 has broken libc which can't handle fd's greater than 127.
+*/
+static void
+CCactivetimes(const char *text)
+{
+    static char		*TIMES = NULL;
+    static char		WHEN[] = "updating active.times";
+    int			fd;
+    int			oerrno;
+
+    if (TIMES == NULL)
+	TIMES = concatpath(innconf->pathdb, INN_PATH_ACTIVETIMES);
+    if ((fd = open(TIMES, O_WRONLY | O_APPEND | O_CREAT, 0664)) < 0) {
+	oerrno = errno;
+	syslog(L_ERROR, "%s cant open %s %m", LogName, TIMES);
+	IOError(WHEN, oerrno);
+	return;
+    }
+    if (xwrite(fd, text, strlen(text)) < 0) {
+	oerrno = errno;
+	syslog(L_ERROR, "%s cant write %s %m", LogName, TIMES);
+	IOError(WHEN, oerrno);
+    }
+    if (close(fd) < 0) {
+	oerrno = errno;
+	syslog(L_ERROR, "%s cant close %s %m", LogName, TIMES);
+	IOError(WHEN, oerrno);
+    }
+}
+
+
+/*
+**  Compare two changes by newsgroup name, to find duplicates.
+*/
+static int
+CCcomparechange(const void *a, const void *b)
+{
+    const GROUPCHANGE	*ga = *(GROUPCHANGE * const *) a;
+    const GROUPCHANGE	*gb = *(GROUPCHANGE * const *) b;
+
+    return strcmp(ga->Name, gb->Name);
+}
+
+
+/*
+**  Parse one line of a batch into a change, or a site to flush.  Returns
+**  NULL if the line is valid, or the reply to send.
+*/
+static const char *
+CCbatchline(char *line, GROUPCHANGE *gc, char **flush, char *seen)
+{
+    char		*fields[4];
+    char		*p;
+    const char		*ret;
+    int			n;
+
+    /* Split the line into whitespace-separated fields. */
+    for (n = 0, p = line; *p != '\0'; ) {
+	while (ISWHITE(*p))
+	    p++;
+	if (*p == '\0')
+	    break;
+	if ((size_t) n == ARRAY_SIZE(fields))
+	    return "1 Too many fields";
+	fields[n++] = p;
+	while (*p != '\0' && !ISWHITE(*p))
+	    p++;
+	if (*p != '\0')
+	    *p++ = '\0';
+    }
+    if (n == 0)
+	return "1 Bad command";
+
+    memset(gc, 0, sizeof(*gc));
+    if (strcmp(fields[0], "flush") == 0) {
+	if (n > 2)
+	    return "1 Wrong number of parameters";
+	*flush = (n == 2) ? fields[1] : (char *) "";
+	if (**flush != '\0' && SITEfind(*flush) == NULL)
+	    return CCnosite;
+	return NULL;
+    }
+    if (strcmp(fields[0], "newgroup") == 0) {
+	if (n < 2 || n > 4)
+	    return "1 Wrong number of parameters";
+	gc->Type = SC_NEWGROUP;
+	gc->Rest = (n > 2) ? fields[2] : CCdefaultrest;
+	gc->Who = (n > 3) ? fields[3] : NEWSMASTER;
+	if ((ret = CCcheckname(fields[1])) != NULL)
+	    return ret;
+	if (!is_valid_utf8(gc->Who))
+	    return "1 Invalid UTF-8 creator's name";
+    }
+    else if (strcmp(fields[0], "rmgroup") == 0) {
+	if (n != 2)
+	    return "1 Wrong number of parameters";
+	gc->Type = SC_RMGROUP;
+	if (ICDprotected(fields[1]))
+	    return "1 Group cannot be removed";
+    }
+    else if (strcmp(fields[0], "changegroup") == 0) {
+	if (n != 3)
+	    return "1 Wrong number of parameters";
+	gc->Type = SC_CHANGEGROUP;
+	gc->Rest = fields[2];
+    }
+    else
+	return "1 Bad command";
+
+    gc->Name = fields[1];
+    if (gc->Rest != NULL) {
+	CCfixrest(gc->Rest);
+	if (strlen(gc->Name) + strlen(gc->Rest) > SMBUF - 24)
+	    return "1 Name too long";
+    }
+    gc->ngp = NGfind(gc->Name);
+    if (gc->ngp == NULL) {
+	if (gc->Type != SC_NEWGROUP)
+	    return CCnogroup;
+	return NULL;
+    }
+    if (seen[gc->ngp - Groups])
+	return "1 Group appears more than once";
+    seen[gc->ngp - Groups] = true;
+
+    /* As with CCnewgroup, creating an existing group changes it. */
+    if (gc->Type == SC_NEWGROUP)
+	gc->Type = SC_CHANGEGROUP;
+
+    /* Drop changes to the flags the group already has. */
+    if (gc->Type == SC_CHANGEGROUP && gc->ngp->Rest[0] == gc->Rest[0]) {
+	n = strlen(gc->Rest);
+	if (gc->ngp->Rest[n] == '\n'
+	    && strncmp(gc->ngp->Rest, gc->Rest, n) == 0)
+	    gc->Type = '\0';
+    }
+    return NULL;
+}
+
+
+/*
+**  Read a file of newgroup, rmgroup, changegroup and flush commands and
+**  apply them as one transaction.  Every line is checked before anything
+**  is done, and the active file is written and parsed again only once for
+**  all the newsgroup changes, instead of once per ctlinnd command.  Sites
+**  are flushed afterwards.
+*/
+static const char *
+CCbatch(char *av[])
+{
+    QIOSTATE		*qp;
+    GROUPCHANGE		*changes = NULL;
+    GROUPCHANGE		**added = NULL;
+    GROUPCHANGE		*gc;
+    struct buffer	*times = NULL;
+    char		**lines = NULL;
+    char		**flushes = NULL;
+    char		*flush;
+    char		*line;
+    char		*seen;
+    const char		*ret = NULL;
+    int			nlines = 0;
+    int			nchanges = 0;
+    int			nadded = 0;
+    int			nflushes = 0;
+    int			lineno = 0;
+    int			i;
+
+    if (Mode != OMrunning)
+	return CCnotrunning;
+    if (ICDneedsetup)
+	return "1 Must first reload newsfeeds";
+    if ((qp = QIOopen(av[0])) == NULL) {
+	syslog(L_ERROR, "%s cant open %s %m", LogName, av[0]);
+	return "1 Cannot read input file";
+    }
+
+    /* Check everything first; lines are kept since fields point in them. */
+    seen = xcalloc(nGroups + 1, 1);
+    while ((line = QIOread(qp)) != NULL) {
+	lineno++;
+	while (ISWHITE(*line))
+	    line++;
+	if (*line == '\0' || *line == '#')
+	    continue;
+	lines = xrealloc(lines, (nlines + 1) * sizeof(char *));
+	changes = xrealloc(changes, (nchanges + 1) * sizeof(GROUPCHANGE));
+	flushes = xrealloc(flushes, (nflushes + 1) * sizeof(char *));
+	lines[nlines++] = xstrdup(line);
+	flush = NULL;
+	if ((ret = CCbatchline(lines[nlines - 1], &changes[nchanges], &flush,
+			       seen)) != NULL)
+	    break;
+	if (flush != NULL)
+	    flushes[nflushes++] = flush;
+	else if (changes[nchanges].Type != '\0')
+	    nchanges++;
+    }
+    if (ret == NULL && QIOtoolong(qp)) {
+	lineno++;
+	ret = "1 Malformed input line (too long)";
+    }
+    if (ret == NULL && QIOerror(qp)) {
+	syslog(L_ERROR, "%s cant read %s %m", LogName, av[0]);
+	ret = "1 Error reading input file";
+	lineno = 0;
+    }
+    QIOclose(qp);
+    free(seen);
+
+    /* New newsgroups may only be named once, too. */
+    if (ret == NULL) {
+	added = xmalloc((nchanges + 1) * sizeof(GROUPCHANGE *));
+	for (i = 0; i < nchanges; i++)
+	    if (changes[i].ngp == NULL)
+		added[nadded++] = &changes[i];
+	qsort(added, nadded, sizeof(GROUPCHANGE *), CCcomparechange);
+	for (i = 1; i < nadded; i++)
+	    if (strcmp(added[i - 1]->Name, added[i]->Name) == 0) {
+		buffer_sprintf(&CCreply, "1 Group %s appears more than once",
+			       added[i]->Name);
+		ret = CCreply.data;
+		lineno = 0;
+		break;
+	    }
+    }
+    if (ret != NULL && lineno > 0) {
+	buffer_sprintf(&CCreply, "1 Line %d: %s", lineno, ret + 2);
+	ret = CCreply.data;
+    }
+
+    /* Apply the newsgroup changes. */
+    if (ret == NULL && nchanges > 0) {
+	if (!ICDbatch(changes, nchanges)) {
+	    syslog(L_NOTICE, "%s cant batch %s", LogName, av[0]);
+	    ret = "1 Batch failed (probably can't write active?)";
+	}
+	else {
+	    times = buffer_new();
+	    for (i = 0; i < nchanges; i++) {
+		gc = &changes[i];
+		if (gc->Type == SC_RMGROUP)
+		    syslog(L_NOTICE, "%s rmgroup %s", LogName, gc->Name);
+		else if (gc->ngp != NULL)
+		    syslog(L_NOTICE, "%s change_group %s to %s", LogName,
+			   gc->Name, gc->Rest);
+		else {
+		    syslog(L_NOTICE, "%s newgroup %s as %s", LogName,
+			   gc->Name, gc->Rest);
+		    buffer_append_sprintf(times, "%s %ld %s\n", gc->Name,
+					  (long) Now.tv_sec, gc->Who);
+		}
+	    }
+	    if (times->left > 0) {
+		buffer_append(times, "", 1);
+		CCactivetimes(times->data);
+	    }
+	    buffer_free(times);
+	}
+    }
+
+    /* Then flush the sites. */
+    for (i = 0; ret == NULL && i < nflushes; i++)
+	CCflush(&flushes[i]);
+
+    for (i = 0; i < nlines; i++)
+	free(lines[i]);
+    free(lines);
+    free(changes);
+    free(added);
+    free(flushes);
+    return ret;
+}
+
+
 /*
 **  Do the work needed to start feeding a (new) site.
 */
@@ -458,11 +778,7 @@ CCchgroup(char *av[])
     if ((ngp = NGfind(av[0])) == NULL)
 	return CCnogroup;
     Rest = av[1];
-    if (Rest[0] != NF_FLAG_ALIAS) {
-	Rest[1] = '\0';
-	if (isupper((unsigned char) Rest[0]))
-	    Rest[0] = tolower((unsigned char) Rest[0]);
-    }
+    CCfixrest(Rest);
     return CCdochange(ngp, Rest);
 }
 
@@ -516,7 +832,8 @@ CCcheckfile(char *av[] UNUSED)
   int		errors;
   const char *	error;
   SITE		fake;
-  bool		needheaders, needoverview, needpath, needstoredgroup;
+  bool		needarticle, needheaders, needoverview, needpath;
+  bool		needstoredgroup;
   bool		needreplicdata;
 
   /* Parse all site entries. */
@@ -524,6 +841,7 @@ CCcheckfile(char *av[] UNUSED)
   fake.Buffer.size = 0;
   fake.Buffer.data = NULL;
   /* save global variables not to be changed */
+  needarticle = NeedArticle;
   needheaders = NeedHeaders;
   needoverview = NeedOverview;
   needpath = NeedPath;
@@ -538,6 +856,7 @@ CCcheckfile(char *av[] UNUSED)
   }
   free(strings);
   /* restore global variables not to be changed */
+  NeedArticle = needarticle;
   NeedHeaders = needheaders;
   NeedOverview = needoverview;
   NeedPath = needpath;
@@ -632,6 +951,7 @@ CCperl(char *av[] UNUSED)
         PerlFilter(false);
 	break;
     }
+    FLTQrestart();
     return NULL;
 #else
     return "1 Perl filtering support not compiled in";
@@ -643,7 +963,12 @@ static const char *
 CCpython(char *av[] UNUSED)
 {
 #ifdef DO_PYTHON
-    return PYcontrol(av);
+    const char *p;
+
+    p = PYcontrol(av);
+    if (p == NULL)
+        FLTQrestart();
+    return p;
 #else
     return "1 Python filtering support not compiled in";
 #endif
@@ -741,6 +1066,7 @@ CCgo(char *av[])
     free(ModeReason);
     ModeReason = NULL;
     Mode = OMrunning;
+    FLTQrestart();
     ThrottledbyIOError = false;
 
     if (NNRPReason != NULL && !innconf->readerswhenstopped) {
@@ -954,6 +1280,39 @@ CCmode(char *unused[] UNUSED)
 }
 
 
+/*
+**  Report the latencies of the stages of article processing, of the storage
+**  and overview methods and of the timers, in microseconds, and start afresh
+**  if asked to reset them.
+*/
+static const char *
+CClatency(char *av[])
+{
+    bool reset;
+
+    if (strcmp(av[0], "reset") == 0)
+        reset = true;
+    else if (strcmp(av[0], "show") == 0 || av[0][0] == '\0')
+        reset = false;
+    else
+        return "1 Bad argument";
+
+    /* Queued overview writes must be accounted for. */
+    OVQsync();
+    buffer_sprintf(&CCreply, "0 ");
+    ARTlatency(&CCreply, reset);
+    SMlatency(&CCreply, reset);
+    OVlatency(&CCreply, reset);
+    CHANtimerstats(&CCreply, reset);
+    if (CCreply.left == 2)
+        buffer_append_sprintf(&CCreply, "No latencies recorded");
+    else if (CCreply.data[CCreply.used + CCreply.left - 1] == '\n')
+        CCreply.left--;
+    buffer_append(&CCreply, "", 1);
+    return CCreply.data;
+}
+
+
 /*
 **  Log our operating mode (via syslog).
 */
@@ -1015,6 +1374,18 @@ CCname(char *av[])
 	case CTcontrol:
             buffer_append_sprintf(&CCreply, ":control::");
 	    break;
+	case CTmetrics:
+            buffer_append_sprintf(&CCreply, ":metrics::");
+	    break;
+	case CTfilter:
+            buffer_append_sprintf(&CCreply, ":filter::");
+	    break;
+	case CTident:
+            buffer_append_sprintf(&CCreply, ":ident::");
+	    break;
+	case CTlogger:
+            buffer_append_sprintf(&CCreply, ":logger::");
+	    break;
 	case CTfile:
             buffer_append_sprintf(&CCreply, "::");
 	    break;
@@ -1040,37 +1411,19 @@ CCname(char *av[])
 static const char *
 CCnewgroup(char *av[])
 {
-    static char		*TIMES = NULL;
-    static char		WHEN[] = "updating active.times";
-    int			fd;
-    char		*p;
+    const char		*p;
     NEWSGROUP		*ngp;
     char		*Name;
     char		*Rest;
     const char *		who;
     char		*buff = NULL;
-    int			oerrno;
-
-    if (TIMES == NULL)
-	TIMES = concatpath(innconf->pathdb, INN_PATH_ACTIVETIMES);
 
     Name = av[0];
-    if (Name[0] == '.' || strspn(Name, "0123456789") == strlen(Name))
-	return "1 Illegal newsgroup name";
-    for (p = Name; *p; p++)
-	if (*p == '.') {
-	    if (p[1] == '.' || p[1] == '\0')
-		return "1 Double or trailing period in newsgroup name";
-	}
-	else if (ISWHITE(*p) || *p == ':' || *p == '!' || *p == '/')
-	    return "1 Illegal character in newsgroup name";
+    if ((p = CCcheckname(Name)) != NULL)
+	return p;
 
     Rest = av[1];
-    if (Rest[0] != NF_FLAG_ALIAS) {
-	Rest[1] = '\0';
-	if (isupper((unsigned char) Rest[0]))
-	    Rest[0] = tolower((unsigned char) Rest[0]);
-    }
+    CCfixrest(Rest);
 
     who = av[2];
     if (*who == '\0')
@@ -1087,29 +1440,10 @@ CCnewgroup(char *av[])
     if (Mode == OMthrottled && ThrottledbyIOError)
 	return "1 server throttled";
 
-    /* Update the log of groups created.  Don't use stdio because SunOS
-     * 4.1 has broken libc which can't handle fd's greater than 127. */
-    if ((fd = open(TIMES, O_WRONLY | O_APPEND | O_CREAT, 0664)) < 0) {
-	oerrno = errno;
-	syslog(L_ERROR, "%s cant open %s %m", LogName, TIMES);
-	IOError(WHEN, oerrno);
-    }
-    else {
-        xasprintf(&buff, "%s %ld %s\n", Name, (long) Now.tv_sec, who);
-	if (xwrite(fd, buff, strlen(buff)) < 0) {
-	    oerrno = errno;
-	    syslog(L_ERROR, "%s cant write %s %m", LogName, TIMES);
-	    IOError(WHEN, oerrno);
-	}
-
-	free(buff);
-	
-	if (close(fd) < 0) {
-	    oerrno = errno;
-	    syslog(L_ERROR, "%s cant close %s %m", LogName, TIMES);
-	    IOError(WHEN, oerrno);
-	}
-    }
+    /* Update the log of groups created. */
+    xasprintf(&buff, "%s %ld %s\n", Name, (long) Now.tv_sec, who);
+    CCactivetimes(buff);
+    free(buff);
 
     /* Update the in-core data. */
     if (!ICDnewgroup(Name, Rest))
@@ -1236,6 +1570,9 @@ CCblock(OPERATINGMODE NewMode, char *reason)
 	Reservation = NULL;
     }
 
+    /* No article is posted while the server is not running, so the filter
+     * workers are stopped now and started again by CCgo. */
+    FLTQclose();
 #ifdef DO_PERL
     PLmode(Mode, NewMode, reason);
 #endif
@@ -1243,6 +1580,7 @@ CCblock(OPERATINGMODE NewMode, char *reason)
     PYmode(Mode, NewMode, reason);
 #endif
 
+    CANQflush();
     ICDwrite();
     InndHisClose();
     Mode = NewMode;
@@ -1455,6 +1793,7 @@ CCreload(char *av[])
         if (PYreadfilter())
             syslog(L_NOTICE, "reloaded pyfilter OK");
 #endif
+        FLTQrestart();
 	p = "all";
     }
     else if (strcmp(p, "active") == 0 || strcmp(p, "newsfeeds") == 0) {
@@ -1522,15 +1861,20 @@ CCreload(char *av[])
         path = concatpath(innconf->pathfilter, INN_PATH_PERL_FILTER_INND);
         if (!PERLreadfilter(path, "filter_art")) {
             free(path);
+            FLTQrestart();
             return BADPERLRELOAD;
         }
         free(path);
+        FLTQrestart();
     }
 #endif
 #ifdef DO_PYTHON
     else if (strcmp(p, "filter.python") == 0) {
-	if (!PYreadfilter())
+	if (!PYreadfilter()) {
+            FLTQrestart();
 	    return BADPYRELOAD;
+        }
+        FLTQrestart();
     }
 #endif
     else
@@ -1562,8 +1906,8 @@ CCrenumber(char *av[])
 	if (!NGrenumber(ngp))
 	    return CANTRENUMBER;
     }
-    else if (!ICDrenumberactive())
-	return CANTRENUMBER;
+    else
+	ICDrenumberstart();
     return NULL;
 }
 
@@ -7,20 +7,40 @@
 **  are all channel operations.
 **
 **  Channels can be in one of three states: reading, writing, or sleeping.
-**  The first two are represented in the select file descriptor sets.  The
-**  last sits there until something else wakes the channel up.  CHANreadloop
-**  is the main I/O loop for innd, calling select and then dispatching control
-**  to whatever channels have work to do.
+**  The first two are registered with the event backend (epoll, kqueue or
+**  select, depending on what the system supports).  The last sits there
+**  until something else wakes the channel up.  CHANreadloop is the main I/O
+**  loop for innd, waiting for the event backend to report ready channels and
+**  then dispatching control to whatever channels have work to do.
 */
 
 #include "config.h"
 #include "clibrary.h"
 
+/* Pick the event backend.  epoll and kqueue scale with the number of ready
+   channels rather than with the highest file descriptor, and aren't limited
+   by FD_SETSIZE, so prefer them when available. */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+# define CHAN_EPOLL 1
+# include <sys/epoll.h>
+#elif defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE)
+# define CHAN_KQUEUE 1
+# include <sys/event.h>
+#else
+# define CHAN_SELECT 1
+#endif
+
 /* Needed on AIX 4.1 to get fd_set and friends. */
 #ifdef HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif
 
+#include "portable/mmap.h"
+#include <sys/uio.h>
+#if defined(HAVE_ZLIB)
+# include <zlib.h>
+#endif
+
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
 #include "inn/network.h"
@@ -47,14 +67,81 @@ static const char * const timer_name[] = {
    in the read loop. */
 #define COMP_THRESHOLD 10
 
+/* Bytes a channel may read per pass of the main loop for each unit of the
+   weight given to its peer in incoming.conf. */
+#define CHAN_QUANTUM    (16 * 1024)
+
+/* Per-descriptor flags, used both for the channels a descriptor is
+   registered for and for what the event backend reported ready. */
+#define CHAN_READ       0x01
+#define CHAN_WRITE      0x02
+#define CHAN_SLEEP      0x04
+#define CHAN_NOPOLL     0x08    /* Event backend refused the descriptor. */
+#define CHAN_IO         (CHAN_READ | CHAN_WRITE)
+
+/* The In buffers of channels come from a pool with one free list per size
+   class.  The classes are START_BUFF_SIZE and its doublings up to 1MB; past
+   that, buffers grow by GROW_AMOUNT and are freed rather than pooled.  An
+   NNTP channel waiting for a command gives its buffers back after being
+   silent for POOL_IDLE seconds, and every POOL_TRIM seconds the pool frees
+   the buffers it didn't need since the previous trim. */
+#define POOL_CLASSES    9
+#define POOL_MAXSIZE    ((size_t) START_BUFF_SIZE << (POOL_CLASSES - 1))
+#define POOL_IDLE       10
+#define POOL_TRIM       60
+
+/* Channels using COMPRESS read the compressed data into a pooled buffer of
+   this size, a size class, before inflating it into their In buffer.  The
+   window is the largest one, as RFC 8054 requires for raw deflate. */
+#define CHAN_ZBUFF_SIZE ((size_t) START_BUFF_SIZE << 2)
+#define CHAN_ZWINDOW    (-15)
+
+/* Free list of one size class. */
+struct chanpool {
+    char **free;                /* Stack of free buffers. */
+    int count;                  /* Number of entries in free. */
+    int size;                   /* Allocated size of free. */
+    int spare;                  /* Fewest free buffers since the last trim. */
+};
+
+/* An In buffer larger than maxartinmemory, mapped from a file in pathtmp
+   rather than allocated.  There are only a few at a time, so they are kept
+   in a list. */
+struct chanspill {
+    char *data;                 /* The mapping. */
+    size_t size;                /* Its size, and that of the file. */
+    int fd;                     /* The file, already unlinked. */
+    struct chanspill *next;
+};
+
 /* Global data about the channels. */
 struct channels {
+    unsigned char *mask;        /* CHAN_* flags for each descriptor. */
+    unsigned char *revents;     /* Readiness reported by the last wait. */
+    int *ready;                 /* Descriptors reported by the last wait. */
+    int ready_count;            /* Number of entries in ready. */
+    int *nopoll;                /* Registered but unpollable descriptors. */
+    int nopoll_count;           /* Number of entries in nopoll. */
+#if CHAN_EPOLL
+    int pollfd;                 /* epoll descriptor. */
+    struct epoll_event *events; /* Buffer for epoll_wait. */
+#elif CHAN_KQUEUE
+    int pollfd;                 /* kqueue descriptor. */
+    struct kevent *events;      /* Buffer for kevent. */
+#else
     fd_set read_set;
-    fd_set sleep_set;
     fd_set write_set;
+    int select_start;           /* Where to start reporting ready channels. */
+#endif
     int sleep_count;            /* Number of sleeping channels. */
-    int max_fd;                 /* Max fd in read_set or write_set. */
-    int max_sleep_fd;           /* Max fd in sleep_set. */
+    int max_fd;                 /* Max fd registered for reading or writing. */
+    int max_sleep_fd;           /* Max fd sleeping. */
+    time_t next_wake;           /* Earliest wake time of sleeping channels. */
+    bool wake_pending;          /* SCHANwakeup woke up some channels. */
+    time_t last_scan;           /* Last full pass over the channel table. */
+    struct chanpool pool[POOL_CLASSES]; /* Free In buffers by size class. */
+    time_t pool_trim;           /* Last time the pool was trimmed. */
+    struct chanspill *spills;   /* In buffers mapped from files. */
     int table_size;             /* Total number of channels. */
     CHANNEL *table;             /* Table of channel structs. */
 
@@ -99,6 +186,546 @@ CHANsystemdsa(CHANNEL *cp)
 }
 
 
+/*
+**  Remember a descriptor the event backend can't watch (epoll refuses regular
+**  files, for instance).  Such descriptors are always reported ready, which
+**  is what select would do for them.
+*/
+static void
+CHANnopoll_add(int fd)
+{
+    channels.nopoll[channels.nopoll_count++] = fd;
+    channels.mask[fd] |= CHAN_NOPOLL;
+}
+
+
+/*
+**  Forget about an unpollable descriptor.
+*/
+static void
+CHANnopoll_remove(int fd)
+{
+    int i;
+
+    for (i = 0; i < channels.nopoll_count; i++)
+        if (channels.nopoll[i] == fd) {
+            channels.nopoll[i] = channels.nopoll[--channels.nopoll_count];
+            break;
+        }
+    channels.mask[fd] &= ~CHAN_NOPOLL;
+}
+
+
+/*
+**  Return the name of the event backend in use.
+*/
+const char *
+CHANmethod(void)
+{
+#if CHAN_EPOLL
+    return "epoll";
+#elif CHAN_KQUEUE
+    return "kqueue";
+#else
+    return "select";
+#endif
+}
+
+
+/*
+**  Returns true if the event backend can only handle descriptors below
+**  FD_SETSIZE.
+*/
+bool
+CHANfdsetlimited(void)
+{
+#if CHAN_SELECT
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/*
+**  Set up the event backend for count descriptors.
+*/
+static void
+CHANpoll_setup(int count)
+{
+#if CHAN_EPOLL
+    channels.pollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (channels.pollfd < 0)
+        sysdie("SERVER cant epoll_create1");
+    channels.events = xcalloc(count, sizeof(struct epoll_event));
+#elif CHAN_KQUEUE
+    channels.pollfd = kqueue();
+    if (channels.pollfd < 0)
+        sysdie("SERVER cant kqueue");
+    fdflag_close_exec(channels.pollfd, true);
+    channels.events = xcalloc(2 * count, sizeof(struct kevent));
+#else
+    FD_ZERO(&channels.read_set);
+    FD_ZERO(&channels.write_set);
+    channels.select_start = 0;
+    (void) count;
+#endif
+}
+
+
+/*
+**  Release the event backend.
+*/
+static void
+CHANpoll_shutdown(void)
+{
+#if CHAN_EPOLL || CHAN_KQUEUE
+    if (channels.pollfd >= 0)
+        close(channels.pollfd);
+    channels.pollfd = -1;
+    free(channels.events);
+    channels.events = NULL;
+#else
+    FD_ZERO(&channels.read_set);
+    FD_ZERO(&channels.write_set);
+#endif
+}
+
+
+/*
+**  Tell the event backend that the read and write interest of a descriptor
+**  changed from old to new (both CHAN_IO masks).
+*/
+static void
+CHANpoll_update(int fd, unsigned int old, unsigned int new)
+{
+#if CHAN_EPOLL
+    struct epoll_event ev;
+    int op, status;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (new & CHAN_READ)
+        ev.events |= EPOLLIN;
+    if (new & CHAN_WRITE)
+        ev.events |= EPOLLOUT;
+    if (old == 0)
+        op = EPOLL_CTL_ADD;
+    else if (new == 0)
+        op = EPOLL_CTL_DEL;
+    else
+        op = EPOLL_CTL_MOD;
+    status = epoll_ctl(channels.pollfd, op, fd, &ev);
+
+    /* Cope with descriptors closed and reopened behind our back, which
+       epoll forgets about on its own. */
+    if (status < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+        status = epoll_ctl(channels.pollfd, EPOLL_CTL_ADD, fd, &ev);
+    else if (status < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+        status = epoll_ctl(channels.pollfd, EPOLL_CTL_MOD, fd, &ev);
+    if (status < 0) {
+        if (op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF))
+            return;
+        if (errno == EPERM) {
+            CHANnopoll_add(fd);
+            return;
+        }
+        syswarn("%s cant epoll_ctl %d", LogName, fd);
+    }
+#elif CHAN_KQUEUE
+    struct kevent changes[2];
+    int n = 0;
+
+    if ((old ^ new) & CHAN_READ) {
+        EV_SET(&changes[n], fd, EVFILT_READ,
+               (new & CHAN_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+        n++;
+    }
+    if ((old ^ new) & CHAN_WRITE) {
+        EV_SET(&changes[n], fd, EVFILT_WRITE,
+               (new & CHAN_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+        n++;
+    }
+    if (kevent(channels.pollfd, changes, n, NULL, 0, NULL) < 0) {
+        if ((new & ~old) == 0 && (errno == ENOENT || errno == EBADF))
+            return;
+        syswarn("%s cant kevent %d", LogName, fd);
+        if (new != 0)
+            CHANnopoll_add(fd);
+    }
+#else
+    (void) old;
+    if (fd >= FD_SETSIZE) {
+        warn("%s descriptor %d exceeds FD_SETSIZE", LogName, fd);
+        return;
+    }
+    if (new & CHAN_READ)
+        FD_SET(fd, &channels.read_set);
+    else
+        FD_CLR(fd, &channels.read_set);
+    if (new & CHAN_WRITE)
+        FD_SET(fd, &channels.write_set);
+    else
+        FD_CLR(fd, &channels.write_set);
+#endif
+}
+
+
+/*
+**  Note that fd is ready for the CHAN_IO events given by what, if this is
+**  something the channel is still interested in.
+*/
+static void
+CHANpoll_ready(int fd, unsigned int what)
+{
+    if (fd < 0 || fd >= channels.table_size)
+        return;
+    what &= channels.mask[fd];
+    if (what == 0)
+        return;
+    if (channels.revents[fd] == 0)
+        channels.ready[channels.ready_count++] = fd;
+    channels.revents[fd] |= what;
+}
+
+
+/*
+**  Wait for channels to become ready, for at most tv.  Fills in the ready
+**  list and returns the number of ready channels, or -1 on error with errno
+**  set.
+*/
+static int
+CHANpoll_wait(struct timeval *tv)
+{
+    int i, fd, count;
+#if CHAN_EPOLL
+    int timeout;
+    unsigned int what;
+#elif CHAN_KQUEUE
+    struct timespec ts;
+#else
+    fd_set rdfds, wrfds;
+    int start;
+#endif
+
+    for (i = 0; i < channels.ready_count; i++)
+        channels.revents[channels.ready[i]] = 0;
+    channels.ready_count = 0;
+
+    /* Unpollable descriptors are always ready, so don't block if we have
+       any of them. */
+    if (channels.nopoll_count > 0) {
+        tv->tv_sec = 0;
+        tv->tv_usec = 0;
+    }
+
+#if CHAN_EPOLL
+    timeout = tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    count = epoll_wait(channels.pollfd, channels.events, channels.table_size,
+                       timeout);
+    if (count < 0)
+        return -1;
+    for (i = 0; i < count; i++) {
+        what = 0;
+        if (channels.events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            what |= CHAN_READ;
+        if (channels.events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            what |= CHAN_WRITE;
+        CHANpoll_ready(channels.events[i].data.fd, what);
+    }
+#elif CHAN_KQUEUE
+    ts.tv_sec = tv->tv_sec;
+    ts.tv_nsec = tv->tv_usec * 1000;
+    count = kevent(channels.pollfd, NULL, 0, channels.events,
+                   2 * channels.table_size, &ts);
+    if (count < 0)
+        return -1;
+    for (i = 0; i < count; i++) {
+        fd = channels.events[i].ident;
+        if (channels.events[i].filter == EVFILT_READ)
+            CHANpoll_ready(fd, CHAN_READ);
+        else if (channels.events[i].filter == EVFILT_WRITE)
+            CHANpoll_ready(fd, CHAN_WRITE);
+    }
+#else
+    rdfds = channels.read_set;
+    wrfds = channels.write_set;
+    count = select(channels.max_fd + 1, &rdfds, &wrfds, NULL, tv);
+    if (count < 0)
+        return -1;
+
+    /* In order to be fair (i.e., don't always give descriptor n priority
+       over n+1), rotate where we start reporting ready descriptors. */
+    if (count > 0) {
+        start = channels.select_start;
+        if (start > channels.max_fd)
+            start = 0;
+        fd = start;
+        do {
+            if (FD_ISSET(fd, &rdfds))
+                CHANpoll_ready(fd, CHAN_READ);
+            if (FD_ISSET(fd, &wrfds))
+                CHANpoll_ready(fd, CHAN_WRITE);
+            fd = (fd >= channels.max_fd) ? 0 : fd + 1;
+        } while (fd != start);
+        channels.select_start = start + 1;
+    }
+#endif
+
+    for (i = 0; i < channels.nopoll_count; i++) {
+        fd = channels.nopoll[i];
+        CHANpoll_ready(fd, channels.mask[fd] & CHAN_IO);
+    }
+    return channels.ready_count;
+}
+
+
+/*
+**  Change the registration flags of a descriptor, telling the event backend
+**  if its read or write interest changed.
+*/
+static void
+CHANsetmask(int fd, unsigned int flags, bool on)
+{
+    unsigned int old, new;
+
+    if (fd < 0 || fd >= channels.table_size)
+        return;
+    old = channels.mask[fd];
+    new = on ? (old | flags) : (old & ~flags);
+    channels.mask[fd] = new;
+    if ((old & CHAN_IO) == (new & CHAN_IO))
+        return;
+    if (old & CHAN_NOPOLL) {
+        if ((new & CHAN_IO) == 0)
+            CHANnopoll_remove(fd);
+        return;
+    }
+    CHANpoll_update(fd, old & CHAN_IO, new & CHAN_IO);
+}
+
+
+/*
+**  Returns true if fd is registered with any of the given flags.
+*/
+static bool
+CHANhasmask(int fd, unsigned int flags)
+{
+    if (fd < 0 || fd >= channels.table_size || channels.mask == NULL)
+        return false;
+    return (channels.mask[fd] & flags) != 0;
+}
+
+
+/*
+**  Return the mapped In buffer starting at data, or NULL if it is an
+**  ordinary one.
+*/
+static struct chanspill *
+CHANspill_find(const char *data)
+{
+    struct chanspill *sp;
+
+    for (sp = channels.spills; sp != NULL; sp = sp->next)
+        if (sp->data == data)
+            return sp;
+    return NULL;
+}
+
+
+/*
+**  Reserve the space for size bytes in the file of a mapped In buffer and map
+**  that much of it, keeping the previous mapping if anything fails.  The
+**  space is allocated up front, as running out of it while writing into the
+**  mapping would kill innd with SIGBUS.
+*/
+static bool
+CHANspill_map(struct chanspill *sp, size_t size)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_POSIX_FALLOCATE)
+    char *data;
+
+    if (size > sp->size && posix_fallocate(sp->fd, 0, size) != 0)
+        return false;
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sp->fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+    if (sp->data != NULL)
+        munmap(sp->data, sp->size);
+    if (size < sp->size && ftruncate(sp->fd, size) < 0)
+        syswarn("SERVER cant truncate spill file");
+    sp->data = data;
+    sp->size = size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/*
+**  Get an In buffer of the given size mapped from a new file in pathtmp, or
+**  NULL if that can't be done and an ordinary buffer should be used.
+*/
+static char *
+CHANspill_get(size_t size)
+{
+    struct chanspill *sp;
+    char *path;
+    int fd;
+
+    path = concatpath(innconf->pathtmp, "innd-spill-XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        syswarn("SERVER cant create %s", path);
+        free(path);
+        return NULL;
+    }
+    unlink(path);
+    free(path);
+    fdflag_close_exec(fd, true);
+    sp = xcalloc(1, sizeof(struct chanspill));
+    sp->fd = fd;
+    if (!CHANspill_map(sp, size)) {
+        syswarn("SERVER cant map %lu bytes for a large article",
+                (unsigned long) size);
+        close(fd);
+        free(sp);
+        return NULL;
+    }
+    sp->next = channels.spills;
+    channels.spills = sp;
+    return sp->data;
+}
+
+
+/*
+**  Unmap an In buffer mapped from a file, which removes the file.
+*/
+static void
+CHANspill_put(struct chanspill *sp)
+{
+    struct chanspill **prev;
+
+    for (prev = &channels.spills; *prev != sp; prev = &(*prev)->next)
+        ;
+    *prev = sp->next;
+    munmap(sp->data, sp->size);
+    close(sp->fd);
+    free(sp);
+}
+
+
+/*
+**  Return the size class of a buffer size, or -1 if buffers of that size
+**  aren't pooled.
+*/
+static int
+CHANpool_class(size_t size)
+{
+    int i;
+
+    for (i = 0; i < POOL_CLASSES; i++)
+        if (size == (size_t) START_BUFF_SIZE << i)
+            return i;
+    return -1;
+}
+
+
+/*
+**  Round a buffer size up to the next size class, if there is one.
+*/
+static size_t
+CHANpool_round(size_t size)
+{
+    size_t class;
+
+    if (size > POOL_MAXSIZE)
+        return size;
+    for (class = START_BUFF_SIZE; class < size; class *= 2)
+        ;
+    return class;
+}
+
+
+/*
+**  Get a buffer of the given size, from the pool if it is a size class.
+*/
+static char *
+CHANpool_get(size_t size)
+{
+    struct chanpool *pp;
+    int class;
+
+    class = CHANpool_class(size);
+    if (class < 0 || channels.pool[class].count == 0)
+        return xmalloc(size);
+    pp = &channels.pool[class];
+    pp->count--;
+    if (pp->spare > pp->count)
+        pp->spare = pp->count;
+    return pp->free[pp->count];
+}
+
+
+/*
+**  Give a buffer back to the pool, or free it if its size isn't a size
+**  class.
+*/
+static void
+CHANpool_put(char *data, size_t size)
+{
+    struct chanpool *pp;
+    struct chanspill *sp;
+    int class;
+
+    if (data == NULL)
+        return;
+    if ((sp = CHANspill_find(data)) != NULL) {
+        CHANspill_put(sp);
+        return;
+    }
+    class = CHANpool_class(size);
+    if (class < 0) {
+        free(data);
+        return;
+    }
+    pp = &channels.pool[class];
+    if (pp->count == pp->size) {
+        pp->size = (pp->size == 0) ? 16 : pp->size * 2;
+        pp->free = xreallocarray(pp->free, pp->size, sizeof(char *));
+    }
+    pp->free[pp->count++] = data;
+}
+
+
+/*
+**  Free the pooled buffers which weren't needed since the last trim, or all
+**  of them if all is true.  This is how memory taken by a burst of activity
+**  goes back to the system once the burst is over.
+*/
+static void
+CHANpool_trim(bool all)
+{
+    struct chanpool *pp;
+    int i, keep;
+
+    for (i = 0; i < POOL_CLASSES; i++) {
+        pp = &channels.pool[i];
+        keep = all ? 0 : pp->count - pp->spare;
+        while (pp->count > keep)
+            free(pp->free[--pp->count]);
+        pp->spare = pp->count;
+        if (all) {
+            free(pp->free);
+            pp->free = NULL;
+            pp->size = 0;
+        }
+    }
+    channels.pool_trim = Now.tv_sec;
+}
+
+
 /*
 **  Tear down our world.  Free all of the allocated channels and clear all
 **  global state data.  This function can also be used to initialize the
@@ -110,13 +737,6 @@ CHANshutdown(void)
     CHANNEL *cp;
     int i;
 
-    FD_ZERO(&channels.read_set);
-    FD_ZERO(&channels.sleep_set);
-    FD_ZERO(&channels.write_set);
-    channels.sleep_count = 0;
-    channels.max_fd = -1;
-    channels.max_sleep_fd = -1;
-
     if (channels.table != NULL) {
         cp = channels.table;
         for (i = channels.table_size; --i >= 0; cp++) {
@@ -125,7 +745,7 @@ CHANshutdown(void)
             if (cp->Type != CTfree)
                 CHANclose(cp, CHANname(cp));
             if (cp->In.data)
-                free(cp->In.data);
+                CHANpool_put(cp->In.data, cp->In.size);
             if (cp->Out.data)
                 free(cp->Out.data);
         }
@@ -133,6 +753,25 @@ CHANshutdown(void)
     free(channels.table);
     channels.table = NULL;
     channels.table_size = 0;
+    CHANpool_trim(true);
+    if (channels.mask != NULL)
+        CHANpoll_shutdown();
+    free(channels.mask);
+    channels.mask = NULL;
+    free(channels.revents);
+    channels.revents = NULL;
+    free(channels.ready);
+    channels.ready = NULL;
+    channels.ready_count = 0;
+    free(channels.nopoll);
+    channels.nopoll = NULL;
+    channels.nopoll_count = 0;
+    channels.sleep_count = 0;
+    channels.max_fd = -1;
+    channels.max_sleep_fd = -1;
+    channels.next_wake = 0;
+    channels.wake_pending = false;
+    channels.last_scan = 0;
     if (channels.prioritized_size > 0) {
         free(channels.prioritized);
         channels.prioritized_size = 0;
@@ -155,6 +794,11 @@ CHANsetup(int count)
     CHANshutdown();
     channels.table_size = count;
     channels.table = xmalloc(count * sizeof(CHANNEL));
+    channels.mask = xcalloc(count, 1);
+    channels.revents = xcalloc(count, 1);
+    channels.ready = xcalloc(count, sizeof(int));
+    channels.nopoll = xcalloc(count, sizeof(int));
+    CHANpoll_setup(count);
 
     /* Finish initializing CHANnull, since we can't do this entirely with a
        static initializer without having to list every element in the
@@ -201,9 +845,14 @@ CHANcreate(int fd, enum channel_type type, enum channel_state state,
        FIXME: Design a better data structure that can be resized easily. */
     cp = &channels.table[fd];
 
-    /* Don't lose the existing buffers when overwriting with CHANnull. */
-    in = cp->In;
-    buffer_resize(&in, START_BUFF_SIZE);
+    /* Don't lose the existing buffers when overwriting with CHANnull.  The
+       In buffer comes from the pool, at the smallest size. */
+    if (cp->In.size != START_BUFF_SIZE) {
+        CHANpool_put(cp->In.data, cp->In.size);
+        in.data = CHANpool_get(START_BUFF_SIZE);
+    } else
+        in.data = cp->In.data;
+    in.size = START_BUFF_SIZE;
     in.used = 0;
     in.left = in.size;
     out = cp->Out;
@@ -280,14 +929,14 @@ CHANtracing(CHANNEL *cp, bool flag)
                                 (struct sockaddr *) &cp->Address);
         notice("%s trace address %s lastactive %ld nextlog %ld", name,
                addr, (long) cp->LastActive, (long) cp->NextLog);
-        if (FD_ISSET(cp->fd, &channels.sleep_set))
+        if (CHANhasmask(cp->fd, CHAN_SLEEP))
             notice("%s trace sleeping %ld 0x%p", name, (long) cp->Waketime,
                    (void *) cp->Waker);
-        if (FD_ISSET(cp->fd, &channels.read_set))
+        if (CHANhasmask(cp->fd, CHAN_READ))
             notice("%s trace reading %lu %s", name,
                    (unsigned long) cp->In.used,
                    MaxLength(cp->In.data, cp->In.data));
-        if (FD_ISSET(cp->fd, &channels.write_set))
+        if (CHANhasmask(cp->fd, CHAN_WRITE))
             notice("%s trace writing %lu %s", name,
                    (unsigned long) cp->Out.left,
                    MaxLength(cp->Out.data, cp->Out.data));
@@ -306,6 +955,7 @@ CHANtracing(CHANNEL *cp, bool flag)
 static void
 CHANclose_nntp(CHANNEL *cp, const char *name)
 {
+    FLTQforget(cp);
     WIPprecomfree(cp);
     NCclearwip(cp);
     if (cp->State == CScancel)
@@ -330,30 +980,10 @@ CHANclose_nntp(CHANNEL *cp, const char *name)
                (double) cp->Size, (double) cp->DuplicateSize,
                (double) cp->RejectSize);
     }
-    if (cp->Data.Newsgroups.Data != NULL) {
-        free(cp->Data.Newsgroups.Data);
-        cp->Data.Newsgroups.Data = NULL;
-    }
-    if (cp->Data.Newsgroups.List != NULL) {
-        free(cp->Data.Newsgroups.List);
-        cp->Data.Newsgroups.List = NULL;
-    }
-    if (cp->Data.Distribution.Data != NULL) {
-        free(cp->Data.Distribution.Data);
-        cp->Data.Distribution.Data = NULL;
-    }
-    if (cp->Data.Distribution.List != NULL) {
-        free(cp->Data.Distribution.List);
-        cp->Data.Distribution.List = NULL;
-    }
-    if (cp->Data.Path.Data != NULL) {
-        free(cp->Data.Path.Data);
-        cp->Data.Path.Data = NULL;
-    }
-    if (cp->Data.Path.List != NULL) {
-        free(cp->Data.Path.List);
-        cp->Data.Path.List = NULL;
-    }
+    ARENAfree(&cp->Data.Arena);
+    memset(&cp->Data.Newsgroups, 0, sizeof(cp->Data.Newsgroups));
+    memset(&cp->Data.Distribution, 0, sizeof(cp->Data.Distribution));
+    memset(&cp->Data.Path, 0, sizeof(cp->Data.Path));
     if (cp->Data.Overview.size != 0) {
         free(cp->Data.Overview.data);
         cp->Data.Overview.data = NULL;
@@ -361,6 +991,13 @@ CHANclose_nntp(CHANNEL *cp, const char *name)
         cp->Data.Overview.left = 0;
         cp->Data.Overview.used = 0;
     }
+    if (cp->Data.Article.size != 0) {
+        free(cp->Data.Article.data);
+        cp->Data.Article.data = NULL;
+        cp->Data.Article.size = 0;
+        cp->Data.Article.left = 0;
+        cp->Data.Article.used = 0;
+    }
     if (cp->Data.XrefBufLength != 0) {
         free(cp->Data.Xref);
         cp->Data.Xref = NULL;
@@ -400,6 +1037,34 @@ CHANclose_nntp(CHANNEL *cp, const char *name)
 }
 
 
+/*
+**  End COMPRESS on a channel being closed, logging how well it did, and
+**  give its buffer of compressed input back to the pool.
+*/
+static void
+CHANzclose(CHANNEL *cp, const char *name)
+{
+#if defined(HAVE_ZLIB)
+    notice("%s compress in %lu/%lu out %lu/%lu", name, cp->ZIn->total_in,
+           cp->ZIn->total_out, cp->ZOut->total_out, cp->ZOut->total_in);
+    inflateEnd(cp->ZIn);
+    deflateEnd(cp->ZOut);
+    free(cp->ZIn);
+    free(cp->ZOut);
+#else
+    name = name;
+#endif
+    cp->ZIn = NULL;
+    cp->ZOut = NULL;
+    cp->ZFlush = false;
+    CHANpool_put(cp->ZRaw.data, cp->ZRaw.size);
+    cp->ZRaw.data = NULL;
+    cp->ZRaw.size = 0;
+    cp->ZRaw.used = 0;
+    cp->ZRaw.left = 0;
+}
+
+
 /*
 **  Close a channel.
 */
@@ -415,9 +1080,11 @@ CHANclose(CHANNEL *cp, const char *name)
             CHANclose_nntp(cp, name);
         else if (cp->Type == CTreject)
             notice("%s %ld", name, cp->Rejected); /* Use cp->Rejected for the response code. */
+        else if (cp->Type == CTident)
+            RCidentclose(cp);
         else if (cp->Out.left)
             warn("%s closed lost %lu", name, (unsigned long) cp->Out.left);
-        else
+        else if (cp->Type != CTmetrics)
             notice("%s closed", name);
         WCHANremove(cp);
         RCHANremove(cp);
@@ -438,14 +1105,15 @@ CHANclose(CHANNEL *cp, const char *name)
     cp->Argument = NULL;
     cp->ActiveCnx = 0;
 
-    /* Free the buffers if they got big. */
-    if (cp->In.size > BIG_BUFFER) {
-        cp->In.size = 0;
-        cp->In.used = 0;
-        cp->In.left = 0;
-        free(cp->In.data);
-        cp->In.data = NULL;
-    }
+    /* Give the In buffer back to the pool, and free the Out buffer if it
+       got big. */
+    if (cp->ZIn != NULL)
+        CHANzclose(cp, name);
+    CHANpool_put(cp->In.data, cp->In.size);
+    cp->In.size = 0;
+    cp->In.used = 0;
+    cp->In.left = 0;
+    cp->In.data = NULL;
     if (cp->Out.size > BIG_BUFFER) {
         cp->Out.size = 0;
         cp->Out.used = 0;
@@ -516,6 +1184,19 @@ CHANname(CHANNEL *cp)
     case CTcontrol:
         snprintf(cp->Name, sizeof(cp->Name), "control:%d", cp->fd);
         break;
+    case CTmetrics:
+        snprintf(cp->Name, sizeof(cp->Name), "metrics:%d", cp->fd);
+        break;
+    case CTfilter:
+        snprintf(cp->Name, sizeof(cp->Name), "filter:%d", cp->fd);
+        break;
+    case CTident:
+        snprintf(cp->Name, sizeof(cp->Name), "%s ident",
+                 RChostname(cp));
+        break;
+    case CTlogger:
+        snprintf(cp->Name, sizeof(cp->Name), "logger:%d", cp->fd);
+        break;
     case CTexploder:
     case CTfile:
     case CTprocess:
@@ -589,8 +1270,7 @@ static void
 CHANresetlast(int fd)
 {
     if (fd == channels.max_fd)
-        while (   !FD_ISSET(channels.max_fd, &channels.read_set)
-               && !FD_ISSET(channels.max_fd, &channels.write_set)
+        while (   !CHANhasmask(channels.max_fd, CHAN_IO)
                && channels.max_fd > 1)
             channels.max_fd--;
 }
@@ -604,7 +1284,7 @@ static void
 CHANresetlastsleeping(int fd)
 {
     if (fd == channels.max_sleep_fd) {
-        while (   !FD_ISSET(channels.max_sleep_fd, &channels.sleep_set)
+        while (   !CHANhasmask(channels.max_sleep_fd, CHAN_SLEEP)
                && channels.max_sleep_fd > 1)
             channels.max_sleep_fd--;
     }
@@ -617,7 +1297,7 @@ CHANresetlastsleeping(int fd)
 void
 RCHANadd(CHANNEL *cp)
 {
-    FD_SET(cp->fd, &channels.read_set);
+    CHANsetmask(cp->fd, CHAN_READ, true);
     if (cp->fd > channels.max_fd)
         channels.max_fd = cp->fd;
 
@@ -633,8 +1313,8 @@ RCHANadd(CHANNEL *cp)
 void
 RCHANremove(CHANNEL *cp)
 {
-    if (FD_ISSET(cp->fd, &channels.read_set)) {
-        FD_CLR(cp->fd, &channels.read_set);
+    if (CHANhasmask(cp->fd, CHAN_READ)) {
+        CHANsetmask(cp->fd, CHAN_READ, false);
         CHANresetlast(cp->fd);
     }
 }
@@ -650,10 +1330,12 @@ SCHANadd(CHANNEL *cp, time_t wake, void *event, innd_callback_func waker,
 {
     if (!CHANsleeping(cp)) {
         channels.sleep_count++;
-        FD_SET(cp->fd, &channels.sleep_set);
+        CHANsetmask(cp->fd, CHAN_SLEEP, true);
     }
     if (cp->fd > channels.max_sleep_fd)
         channels.max_sleep_fd = cp->fd;
+    if (channels.sleep_count == 1 || wake < channels.next_wake)
+        channels.next_wake = wake;
     cp->Waketime = wake;
     cp->Waker = waker;
     if (cp->Argument != arg) {
@@ -672,7 +1354,7 @@ SCHANremove(CHANNEL *cp)
 {
     if (!CHANsleeping(cp))
         return;
-    FD_CLR(cp->fd, &channels.sleep_set);
+    CHANsetmask(cp->fd, CHAN_SLEEP, false);
     channels.sleep_count--;
     cp->Waketime = 0;
 
@@ -687,7 +1369,7 @@ SCHANremove(CHANNEL *cp)
 bool
 CHANsleeping(CHANNEL *cp)
 {
-    return FD_ISSET(cp->fd, &channels.sleep_set);
+    return CHANhasmask(cp->fd, CHAN_SLEEP);
 }
 
 
@@ -703,8 +1385,10 @@ SCHANwakeup(void *event)
     int i;
 
     for (cp = channels.table, i = channels.table_size; --i >= 0; cp++)
-        if (cp->Type != CTfree && cp->Event == event && CHANsleeping(cp))
+        if (cp->Type != CTfree && cp->Event == event && CHANsleeping(cp)) {
             cp->Waketime = 0;
+            channels.wake_pending = true;
+        }
 }
 
 
@@ -715,8 +1399,10 @@ SCHANwakeup(void *event)
 void
 WCHANadd(CHANNEL *cp)
 {
+    if (cp->ZFlush)
+        CHANdeflateflush(cp);
     if (cp->Out.left > 0) {
-        FD_SET(cp->fd, &channels.write_set);
+        CHANsetmask(cp->fd, CHAN_WRITE, true);
         if (cp->fd > channels.max_fd)
             channels.max_fd = cp->fd;
     }
@@ -729,8 +1415,8 @@ WCHANadd(CHANNEL *cp)
 void
 WCHANremove(CHANNEL *cp)
 {
-    if (FD_ISSET(cp->fd, &channels.write_set)) {
-        FD_CLR(cp->fd, &channels.write_set);
+    if (CHANhasmask(cp->fd, CHAN_WRITE)) {
+        CHANsetmask(cp->fd, CHAN_WRITE, false);
         CHANresetlast(cp->fd);
 
         /* No data left -- reset used so we don't grow the buffer. */
@@ -743,11 +1429,13 @@ WCHANremove(CHANNEL *cp)
 
 
 /*
-**  Set a channel to start off with the contents of an existing channel.
+**  Set a channel to start off with the contents of an existing channel.  The
+**  buffer may be the Out ring of that channel, so straighten it out first.
 */
 void
 WCHANsetfrombuffer(CHANNEL *cp, struct buffer *bp)
 {
+    buffer_ring_linearize(bp);
     WCHANset(cp, &bp->data[bp->used], bp->left);
 }
 
@@ -760,7 +1448,8 @@ static void
 CHANresize(CHANNEL *cp, size_t size)
 {
     struct buffer *bp;
-    char *p;
+    struct chanspill *sp;
+    char *p, *q;
     size_t change;
     ptrdiff_t offset;
     int i;
@@ -772,8 +1461,9 @@ CHANresize(CHANNEL *cp, size_t size)
     bp->left += change;
     p = bp->data;
 
-    /* Reallocate the buffer and adjust offets if realloc moved the location
-       of the memory region.  Only adjust offets if we're in a state where we
+    /* Reallocate the buffer, through the pool if both sizes are size
+       classes, and adjust offets if that moved the location of the memory
+       region.  Only adjust offets if we're in a state where we
        care about the header contents.
 
        FIXME: This is invalid C, although it will work on most (all?)  common
@@ -784,7 +1474,30 @@ CHANresize(CHANNEL *cp, size_t size)
        (Not to mention that two pointers to different objects may not be
        compared and arithmetic may not be performed on them. */
     TMRstart(TMR_DATAMOVE);
-    bp->data = xrealloc(bp->data, bp->size);
+    sp = CHANspill_find(p);
+    q = NULL;
+    if (innconf->maxartinmemory != 0 && size > innconf->maxartinmemory
+        && cp->Type == CTnntp) {
+        /* Past maxartinmemory, the buffer is mapped from a file, which
+           only has to be mapped again to grow. */
+        if (sp != NULL) {
+            if (CHANspill_map(sp, size))
+                q = sp->data;
+        } else if ((q = CHANspill_get(size)) != NULL) {
+            memcpy(q, p, bp->used < size ? bp->used : size);
+            CHANpool_put(p, size - change);
+        }
+    }
+    if (q != NULL)
+        bp->data = q;
+    else if (sp != NULL
+             || (CHANpool_class(size) >= 0
+                 && CHANpool_class(size - change) >= 0)) {
+        bp->data = CHANpool_get(size);
+        memcpy(bp->data, p, bp->used < size ? bp->used : size);
+        CHANpool_put(p, size - change);
+    } else
+        bp->data = xrealloc(bp->data, bp->size);
     offset = p - bp->data;
     if (offset != 0) {
         if (cp->State == CSgetheader || cp->State == CSgetbody ||
@@ -801,6 +1514,263 @@ CHANresize(CHANNEL *cp, size_t size)
 }
 
 
+/*
+**  Give the buffers of a channel back, if nothing is pending in them.  The In
+**  buffer goes back to the pool and CHANreadtext gets a new one when data
+**  arrives again; the Out buffer is allocated again by the next write.
+*/
+void
+CHANrelease(CHANNEL *cp)
+{
+    if (cp->In.used != 0 || cp->Out.left != 0 || cp->ZFlush
+        || cp->ZRaw.left != 0)
+        return;
+    CHANpool_put(cp->In.data, cp->In.size);
+    cp->In.data = NULL;
+    cp->In.size = 0;
+    cp->In.left = 0;
+    CHANpool_put(cp->ZRaw.data, cp->ZRaw.size);
+    cp->ZRaw.data = NULL;
+    cp->ZRaw.size = 0;
+    cp->ZRaw.used = 0;
+    free(cp->Out.data);
+    cp->Out.data = NULL;
+    cp->Out.size = 0;
+    cp->Out.used = 0;
+}
+
+
+#if defined(HAVE_ZLIB)
+
+/*
+**  Memory allocation hooks for zlib, so that running out of memory is
+**  handled as everywhere else.
+*/
+static voidpf
+CHANzalloc(voidpf opaque UNUSED, uInt items, uInt size)
+{
+    return xcalloc(items, size);
+}
+
+static void
+CHANzfree(voidpf opaque UNUSED, voidpf address)
+{
+    free(address);
+}
+
+
+/*
+**  Inflate the compressed data of a channel into its In buffer, growing it
+**  as needed so that all of it is consumed; otherwise, what is left would
+**  wait for the peer to send more, which it may not do before we reply.
+**  Returns the number of bytes added to the buffer, or -1 if the data is
+**  corrupt.
+*/
+static ssize_t
+CHANinflate(CHANNEL *cp)
+{
+    struct buffer *bp = &cp->In;
+    struct buffer *zp = &cp->ZRaw;
+    z_stream *z = cp->ZIn;
+    size_t room, total = 0;
+    int status;
+
+    z->next_in = (Bytef *) &zp->data[zp->used];
+    z->avail_in = zp->left;
+    do {
+        if (bp->size - bp->used <= LOW_WATER)
+            CHANresize(cp, CHANpool_round(bp->size + GROW_AMOUNT(bp->size)));
+        room = bp->size - bp->used;
+        z->next_out = (Bytef *) &bp->data[bp->used];
+        z->avail_out = room;
+        status = inflate(z, Z_SYNC_FLUSH);
+        room -= z->avail_out;
+        bp->used += room;
+        bp->left -= room;
+        total += room;
+    } while (status == Z_OK && (z->avail_in > 0 || z->avail_out == 0));
+    zp->used += zp->left - z->avail_in;
+    zp->left = z->avail_in;
+    if (status != Z_OK && status != Z_BUF_ERROR) {
+        warn("%s cant inflate: %s", CHANname(cp),
+             z->msg != NULL ? z->msg : "end of stream");
+        return -1;
+    }
+    return total;
+}
+
+
+/*
+**  Read compressed data from a channel and inflate it into its In buffer.
+**  Returns like read(2), with errno set to EAGAIN if nothing could be
+**  inflated yet, except that the count is that of the bytes inflated.
+*/
+static ssize_t
+CHANzread(CHANNEL *cp, size_t maxbyte)
+{
+    struct buffer *zp = &cp->ZRaw;
+    ssize_t count;
+
+    if (zp->size == 0) {
+        zp->data = CHANpool_get(CHAN_ZBUFF_SIZE);
+        zp->size = CHAN_ZBUFF_SIZE;
+        zp->used = 0;
+        zp->left = 0;
+    }
+    buffer_compact(zp);
+    if (maxbyte > zp->size - zp->left)
+        maxbyte = zp->size - zp->left;
+    count = read(cp->fd, &zp->data[zp->left], maxbyte);
+    if (count <= 0)
+        return count;
+    zp->left += count;
+    count = CHANinflate(cp);
+    if (count <= 0) {
+        errno = (count < 0) ? EIO : EAGAIN;
+        return -1;
+    }
+    return count;
+}
+
+
+/*
+**  Deflate data at the end of the Out buffer of a channel.  With
+**  Z_SYNC_FLUSH, everything deflated so far can be inflated by the peer once
+**  written.
+*/
+static void
+CHANzwrite(CHANNEL *cp, const char *data, size_t length, int flush)
+{
+    struct buffer *bp = &cp->Out;
+    z_stream *z = cp->ZOut;
+    size_t end, room;
+
+    z->next_in = (Bytef *) (uintptr_t) data;
+    z->avail_in = length;
+    do {
+        /* Deflate straight into Out, so its data must not wrap around. */
+        end = bp->used + bp->left;
+        if (end > bp->size || bp->size - end < LOW_WATER) {
+            buffer_ring_linearize(bp);
+            end = bp->left;
+            if (bp->size - end < LOW_WATER)
+                buffer_resize(bp, end + length / 2 + START_BUFF_SIZE);
+        }
+        room = bp->size - end;
+        z->next_out = (Bytef *) &bp->data[end];
+        z->avail_out = room;
+        deflate(z, flush);
+        bp->left += room - z->avail_out;
+    } while (z->avail_in > 0 || z->avail_out == 0);
+    cp->ZFlush = (flush == Z_NO_FLUSH);
+}
+
+
+/*
+**  Start COMPRESS DEFLATE (RFC 8054) on a channel.  The data already in its
+**  Out buffer, such as the reply to the command, is written as is, and what
+**  is appended from now on is deflated.  Whatever the peer sent after the
+**  command is compressed, so it is inflated in place.  Returns false if
+**  zlib can't be set up.
+*/
+bool
+CHANcompress(CHANNEL *cp)
+{
+    struct buffer *bp = &cp->In;
+    struct buffer *zp = &cp->ZRaw;
+    z_stream *zin, *zout;
+    size_t rest;
+
+    if (cp->ZIn != NULL)
+        return false;
+    zin = xcalloc(1, sizeof(z_stream));
+    zout = xcalloc(1, sizeof(z_stream));
+    zin->zalloc = CHANzalloc;
+    zin->zfree = CHANzfree;
+    zout->zalloc = CHANzalloc;
+    zout->zfree = CHANzfree;
+    if (inflateInit2(zin, CHAN_ZWINDOW) != Z_OK) {
+        free(zin);
+        free(zout);
+        return false;
+    }
+    if (deflateInit2(zout, Z_DEFAULT_COMPRESSION, Z_DEFLATED, CHAN_ZWINDOW,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        inflateEnd(zin);
+        free(zin);
+        free(zout);
+        return false;
+    }
+    cp->ZIn = zin;
+    cp->ZOut = zout;
+    cp->ZFlush = false;
+
+    rest = bp->used - cp->Next;
+    zp->size = CHANpool_round(rest > CHAN_ZBUFF_SIZE ? rest : CHAN_ZBUFF_SIZE);
+    zp->data = CHANpool_get(zp->size);
+    zp->used = 0;
+    zp->left = rest;
+    if (rest > 0) {
+        memcpy(zp->data, &bp->data[cp->Next], rest);
+        bp->used = cp->Next;
+        bp->left = bp->size - bp->used;
+        CHANinflate(cp);
+    }
+    return true;
+}
+
+
+/*
+**  Deflate data into the Out buffer of a channel, for WCHANappend.
+*/
+void
+CHANdeflate(CHANNEL *cp, const char *data, size_t length)
+{
+    if (length > 0)
+        CHANzwrite(cp, data, length, Z_NO_FLUSH);
+}
+
+
+/*
+**  Complete the deflated data in the Out buffer of a channel, before it is
+**  written.
+*/
+void
+CHANdeflateflush(CHANNEL *cp)
+{
+    if (cp->ZOut != NULL)
+        CHANzwrite(cp, NULL, 0, Z_SYNC_FLUSH);
+}
+
+#else /* !HAVE_ZLIB */
+
+static ssize_t
+CHANzread(CHANNEL *cp UNUSED, size_t maxbyte UNUSED)
+{
+    errno = EIO;
+    return -1;
+}
+
+bool
+CHANcompress(CHANNEL *cp UNUSED)
+{
+    return false;
+}
+
+void
+CHANdeflate(CHANNEL *cp UNUSED, const char *data UNUSED,
+            size_t length UNUSED)
+{
+}
+
+void
+CHANdeflateflush(CHANNEL *cp UNUSED)
+{
+}
+
+#endif /* !HAVE_ZLIB */
+
+
 /*
 **  Read in text data, return the amount we read.
 */
@@ -809,7 +1779,7 @@ CHANreadtext(CHANNEL *cp)
 {
     struct buffer *bp;
     char *name;
-    int oerrno, maxbyte;
+    int oerrno, maxbyte, share;
     ssize_t count;
 
     /* Grow buffer if we're getting close to current limit.
@@ -817,9 +1787,14 @@ CHANreadtext(CHANNEL *cp)
        FIXME: The In buffer doesn't use the normal meanings of .used and
        .left.  */
     bp = &cp->In;
+    if (bp->size == 0) {
+        bp->data = CHANpool_get(START_BUFF_SIZE);
+        bp->size = START_BUFF_SIZE;
+        bp->used = 0;
+    }
     bp->left = bp->size - bp->used;
     if (bp->left <= LOW_WATER)
-        CHANresize(cp, bp->size + GROW_AMOUNT(bp->size));
+        CHANresize(cp, CHANpool_round(bp->size + GROW_AMOUNT(bp->size)));
 
     /* Read in whatever is there, up to some reasonable limit.
 
@@ -846,9 +1821,29 @@ CHANreadtext(CHANNEL *cp)
         maxbyte = bp->left;
     else
         maxbyte = innconf->maxcmdreadsize;
+
+    /* Channels of peers with a weight are scheduled by deficit round robin:
+       each pass gives them their weight in quanta, which bounds what they
+       may read.  What a full buffer kept them from reading is carried over
+       (up to one more pass), but nothing is kept once the peer has sent all
+       it had, so that a peer dumping articles at line rate can't starve the
+       other channels, including local posts. */
+    if (cp->Weight > 0) {
+        share = cp->Weight * CHAN_QUANTUM;
+        cp->Deficit += share;
+        if (cp->Deficit > 2 * share)
+            cp->Deficit = 2 * share;
+        if (maxbyte > cp->Deficit)
+            maxbyte = cp->Deficit;
+    }
     TMRstart(TMR_NNTPREAD);
-    count = read(cp->fd, &bp->data[bp->used], maxbyte);
+    if (cp->ZIn != NULL)
+        count = CHANzread(cp, maxbyte);
+    else
+        count = read(cp->fd, &bp->data[bp->used], maxbyte);
     TMRstop(TMR_NNTPREAD);
+    if (cp->Weight > 0)
+        cp->Deficit = (count < maxbyte) ? 0 : cp->Deficit - count;
 
     /* Solaris (at least 2.4 through 2.6) will occasionally return EAGAIN in
        response to a read even if the file descriptor already selected true
@@ -871,8 +1866,12 @@ CHANreadtext(CHANNEL *cp)
         notice("%s readclose", name);
         return 0;
     }
-    bp->used += count;
-    bp->left -= count;
+
+    /* Inflated data is already in the buffer. */
+    if (cp->ZIn == NULL) {
+        bp->used += count;
+        bp->left -= count;
+    }
     return count;
 }
 
@@ -915,6 +1914,34 @@ CHANwrite(int fd, const char *data, long length)
 }
 
 
+/*
+**  Write out the Out ring of a channel and consume what was written.  When
+**  the data wraps around the end of the ring, both parts go out in a single
+**  writev, so that a partial write never forces the rest to be moved.
+*/
+static ssize_t
+CHANwriteout(CHANNEL *cp)
+{
+    struct buffer *bp = &cp->Out;
+    struct iovec iov[2];
+    ssize_t count;
+    int n;
+
+    n = buffer_ring_iov(bp, iov);
+    if (n == 0)
+        return 0;
+    if (n == 2) {
+        count = buffer_ring_write(bp, cp->fd);
+        if (count >= 0 || errno != EMSGSIZE)
+            return count;
+    }
+    count = CHANwrite(cp->fd, iov[0].iov_base, iov[0].iov_len);
+    if (count > 0)
+        buffer_ring_consume(bp, count);
+    return count;
+}
+
+
 /*
 **  Try to flush out the buffer.  Use this only on file channels!
 */
@@ -925,8 +1952,8 @@ WCHANflush(CHANNEL *cp)
     ssize_t count;
 
     /* Write it. */
-    for (bp = &cp->Out; bp->left > 0; bp->left -= count, bp->used += count) {
-        count = CHANwrite(cp->fd, &bp->data[bp->used], bp->left);
+    for (bp = &cp->Out; bp->left > 0;) {
+        count = CHANwriteout(cp);
         if (count <= 0) {
             syswarn("%s cant flush count %lu", CHANname(cp),
                     (unsigned long) bp->left);
@@ -968,6 +1995,7 @@ CHANwritesleep(CHANNEL *cp, const char *name)
         default:
             break;
         case CTreject:
+        case CTmetrics:
         case CTnntp:
         case CTfile:
         case CTexploder:
@@ -996,25 +2024,27 @@ CHANdiagnose(void)
 
     FD_ZERO(&test);
     for (fd = channels.max_fd; fd >= 0; fd--) {
-        if (FD_ISSET(fd, &channels.read_set)) {
+        if (fd >= FD_SETSIZE)
+            continue;
+        if (CHANhasmask(fd, CHAN_READ)) {
             FD_SET(fd, &test);
             tv.tv_sec = 0;
             tv.tv_usec = 0;
             if (select(fd + 1, &test, NULL, NULL, &tv) < 0 && errno != EINTR) {
                 warn("%s bad read file %d", LogName, fd);
-                FD_CLR(fd, &channels.read_set);
+                CHANsetmask(fd, CHAN_READ, false);
                 /* Probably do something about the file descriptor here; call
                    CHANclose on it? */
             }
             FD_CLR(fd, &test);
         }
-        if (FD_ISSET(fd, &channels.write_set)) {
+        if (CHANhasmask(fd, CHAN_WRITE)) {
             FD_SET(fd, &test);
             tv.tv_sec = 0;
             tv.tv_usec = 0;
             if (select(fd + 1, NULL, &test, NULL, &tv) < 0 && errno != EINTR) {
                 warn("%s bad write file %d", LogName, fd);
-                FD_CLR(fd, &channels.write_set);
+                CHANsetmask(fd, CHAN_WRITE, false);
                 /* Probably do something about the file descriptor here; call
                    CHANclose on it? */
             }
@@ -1082,7 +2112,7 @@ CHANhandle_read(CHANNEL *cp)
     if (cp->In.used == 0)
         CHANresize(cp, START_BUFF_SIZE);
     else if ((cp->In.size / cp->In.used) > 10) {
-        size = cp->In.used * 2;
+        size = CHANpool_round(cp->In.used * 2);
         if (size < START_BUFF_SIZE)
             size = START_BUFF_SIZE;
         CHANresize(cp, size);
@@ -1109,6 +2139,8 @@ CHANhandle_write(CHANNEL *cp)
         cp->fd = -1;
         return;
     }
+    if (cp->ZFlush)
+        CHANdeflateflush(cp);
     bp = &cp->Out;
     if (bp->left == 0) {
         /* Should not be possible. */
@@ -1116,7 +2148,7 @@ CHANhandle_write(CHANNEL *cp)
         return;
     }
     cp->LastActive = Now.tv_sec;
-    count = CHANwrite(cp->fd, &bp->data[bp->used], bp->left);
+    count = CHANwriteout(cp);
     if (count <= 0) {
         oerrno = errno;
         name = CHANname(cp);
@@ -1143,11 +2175,7 @@ CHANhandle_write(CHANNEL *cp)
     } else {
         cp->BadWrites = 0;
         cp->BlockedWrites = 0;
-        bp->left -= count;
-        bp->used += count;
-        if (bp->left > 0)
-            buffer_compact(bp);
-        else {
+        if (bp->left == 0) {
             WCHANremove(cp);
             (*cp->WriteDone)(cp);
         }
@@ -1155,37 +2183,165 @@ CHANhandle_write(CHANNEL *cp)
 }
 
 
+/*
+**  Check to see if this peer has too many open connections, and if so, either
+**  close or make inactive this connection.  Returns true if the channel
+**  shouldn't be serviced any further on this pass.
+*/
+static bool
+CHANcheck_maxcnx(CHANNEL *cp)
+{
+    if (cp->Type != CTnntp || cp->MaxCnx <= 0 || cp->HoldTime <= 0)
+        return false;
+    CHANcount_active(cp);
+    if (cp->ActiveCnx <= cp->MaxCnx || cp->fd <= 0)
+        return false;
+    if (cp->Started + cp->HoldTime < Now.tv_sec)
+        CHANclose(cp, CHANname(cp));
+    else {
+        cp->ActiveCnx = 0;
+        RCHANremove(cp);
+    }
+    return true;
+}
+
+
+/*
+**  Walk the whole channel table, waking up channels whose sleep is over and
+**  closing channels that have been inactive for too long.  All these timers
+**  have a resolution of one second, so the main loop only calls this once a
+**  second, or when a sleeping channel may need waking up sooner.
+*/
+static void
+CHANscan(void)
+{
+    int fd, lastfd;
+    CHANNEL *cp;
+    unsigned long silence;
+    const char *name;
+
+    channels.last_scan = Now.tv_sec;
+    if (channels.pool_trim + POOL_TRIM <= Now.tv_sec)
+        CHANpool_trim(false);
+    channels.wake_pending = false;
+    channels.next_wake = 0;
+    lastfd = channels.max_fd;
+    if (lastfd < channels.max_sleep_fd)
+        lastfd = channels.max_sleep_fd;
+    for (fd = 0; fd <= lastfd && fd < channels.table_size; fd++) {
+        cp = &channels.table[fd];
+        if (CHANcheck_maxcnx(cp))
+            continue;
+
+        /* Coming off a sleep? */
+        if (CHANhasmask(fd, CHAN_SLEEP)) {
+            if (cp->Waketime > Now.tv_sec) {
+                if (channels.next_wake == 0
+                    || cp->Waketime < channels.next_wake)
+                    channels.next_wake = cp->Waketime;
+            } else if (cp->Type == CTfree) {
+                warn("%s %d free but was in SMASK", CHANname(cp), fd);
+                CHANsetmask(fd, CHAN_SLEEP, false);
+                channels.sleep_count--;
+                CHANresetlastsleeping(fd);
+                close(fd);
+                cp->fd = -1;
+            } else {
+                cp->LastActive = Now.tv_sec;
+                SCHANremove(cp);
+                if (cp->Waker != NULL) {
+                    (*cp->Waker)(cp);
+                } else {
+                    name = CHANname(cp);
+                    warn("%s %d sleeping without Waker", name, fd);
+                    SITEchanclose(cp);
+                    CHANclose(cp, name);
+                }
+            }
+        }
+
+        /* Toss CTreject channel, and metrics clients, early if they're
+           inactive. */
+        if ((cp->Type == CTreject
+             || (cp->Type == CTmetrics && cp->State == CSwritegoodbye))
+            && cp->LastActive + REJECT_TIMEOUT < Now.tv_sec) {
+            name = CHANname(cp);
+            notice("%s timeout reject", name);
+            CHANclose(cp, name);
+        }
+
+        /* Give up on ident servers which don't answer. */
+        if (cp->Type == CTident
+            && cp->LastActive + REJECT_TIMEOUT < Now.tv_sec) {
+            name = CHANname(cp);
+            notice("%s timeout", name);
+            CHANclose(cp, name);
+        }
+
+        /* Has this channel been inactive very long? */
+        if (cp->Type == CTnntp
+            && cp->LastActive + cp->NextLog < Now.tv_sec) {
+            name = CHANname(cp);
+            silence = Now.tv_sec - cp->LastActive;
+            cp->NextLog += innconf->chaninacttime;
+            notice("%s inactive %ld", name, silence / 60L);
+            if (silence > innconf->peertimeout) {
+                notice("%s timeout", name);
+                CHANclose(cp, name);
+            }
+        }
+
+        /* Peers which keep their connection open without sending anything
+           don't need their buffers in the meantime. */
+        if (cp->Type == CTnntp && cp->State == CSgetcmd && cp->In.size != 0
+            && cp->LastActive + POOL_IDLE < Now.tv_sec)
+            CHANrelease(cp);
+    }
+}
+
+
+/*
+**  Append the statistics of the timers of innd to a buffer, if they are
+**  enabled, for ctlinnd latency.
+*/
+void
+CHANtimerstats(struct buffer *out, bool reset)
+{
+    if (innconf->timer != 0)
+        TMRstats(out, "timer", timer_name, reset);
+}
+
+
 /*
 **  Main I/O loop.  Wait for data, call the channel's handler when there is
-**  something to read or when the queued write is finished.  In order to be
-**  fair (i.e., don't always give descriptor n priority over n+1), we remember
-**  where we last had something and pick up from there.
+**  something to read or when the queued write is finished.  Only the
+**  channels reported ready by the event backend are looked at, so the cost
+**  of a pass scales with the number of active channels; timers are handled
+**  by CHANscan.
 **
 **  Yes, the main code has really wandered over to the side a lot.
 */
 void
 CHANreadloop(void)
 {
-    int i, startpoint, count, lastfd;
+    int i, count, fd;
+    unsigned int what;
     CHANNEL *cp;
-    fd_set rdfds, wrfds;
     struct timeval tv;
-    unsigned long silence;
-    const char *name;
-    time_t last_sync;
-    int fd = 0;
+    time_t last_sync, last_flush, last_hisflush, flush_delay;
 
     STATUSinit();
     gettimeofday(&Now, NULL);
     last_sync = Now.tv_sec;
+    last_flush = Now.tv_sec;
+    last_hisflush = Now.tv_sec;
+    flush_delay = innconf->cnfswritedelay > 0 ? innconf->cnfswritedelay : 1;
 
     while (1) {
         /* See if any processes died. */
         PROCscan();
 
         /* Wait for data, note the time. */
-        rdfds = channels.read_set;
-        wrfds = channels.write_set;
         tv = TimeOut;
         if (innconf->timer != 0) {
             unsigned long now = TMRnow();
@@ -1199,17 +2355,40 @@ CHANreadloop(void)
             }
         }
 
-        /* Mask signals when not in select to prevent a signal handler
-           from accessing data that the main code is mutating. */
+        /* Wake up in time to write out the CNFS write buffers. */
+        if (innconf->cnfswritebuffer != 0 && tv.tv_sec > flush_delay)
+            tv.tv_sec = flush_delay;
+
+        /* Don't wait while a background renumber has groups left, nor
+           longer than a second while cancels are queued. */
+        if (CANQpending() && tv.tv_sec > 0) {
+            tv.tv_sec = 1;
+            tv.tv_usec = 0;
+        }
+
+        /* Don't sleep past the time a sleeping channel has to be woken up. */
+        if (channels.sleep_count > 0
+            && channels.next_wake - Now.tv_sec < tv.tv_sec) {
+            tv.tv_sec = channels.next_wake > Now.tv_sec
+                            ? channels.next_wake - Now.tv_sec : 0;
+            tv.tv_usec = 0;
+        }
+        if (ICDrenumbering()) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+        }
+
+        /* Mask signals when not waiting to prevent a signal handler from
+           accessing data that the main code is mutating. */
         TMRstart(TMR_IDLE);
         xsignal_unmask();
-        count = select(channels.max_fd + 1, &rdfds, &wrfds, NULL, &tv);
+        count = CHANpoll_wait(&tv);
         xsignal_mask();
         TMRstop(TMR_IDLE);
 
         if (count < 0) {
             if (errno != EINTR) {
-                syswarn("%s cant select", LogName);
+                syswarn("%s cant %s", LogName, CHANmethod());
 #ifdef INND_FIND_BAD_FDS
                 CHANdiagnose();
 #endif      
@@ -1239,6 +2418,17 @@ CHANreadloop(void)
             }
             last_sync = Now.tv_sec;
         }
+        if (innconf->hiswritebehind != 0 && Now.tv_sec != last_hisflush) {
+            HISctl(History, HISCTLS_FLUSH, NULL);
+            last_hisflush = Now.tv_sec;
+        }
+        if (innconf->cnfswritebuffer != 0
+            && Now.tv_sec >= last_flush + flush_delay) {
+            SMflushcacheddata(SM_ALL);
+            last_flush = Now.tv_sec;
+        }
+        ICDrenumberstep();
+        CANQstep(count == 0);
 
         /* If no channels are active, flush and skip if nobody's sleeping. */
         if (count == 0) {
@@ -1250,59 +2440,34 @@ CHANreadloop(void)
 
         /* Try the prioritized channels first. */
         for (i = 0; i < channels.prioritized_size; i++) {
-            int pfd;
-
             if (channels.prioritized[i] == NULL)
                 continue;
-            pfd = channels.prioritized[i]->fd;
-            if (FD_ISSET(pfd, &channels.read_set) && FD_ISSET(pfd, &rdfds)) {
-                count--;
-                if (count > 4)
-                    count = 4; /* might be more requests */
+            fd = channels.prioritized[i]->fd;
+            if (CHANhasmask(fd, CHAN_READ)
+                && (channels.revents[fd] & CHAN_READ)) {
+                channels.revents[fd] &= ~CHAN_READ;
                 (*channels.prioritized[i]->Reader)(channels.prioritized[i]);
-                FD_CLR(pfd, &rdfds);
             }
         }
 
-        /* Loop through all active channels.  Somebody could have closed a
-           channel so we double-check the global mask before looking at what
-           select returned.  The code here is written so that a channel could
-           be reading and writing and sleeping at the same time, even though
-           that's not possible.  (Just as well, since in SysVr4 the count
-           would be wrong.) */
-        lastfd = channels.max_fd;
-        if (lastfd < channels.max_sleep_fd)
-            lastfd = channels.max_sleep_fd;
-        if (fd > lastfd)
-            fd = 0;
-        startpoint = fd;
-        do {
+        /* Loop through the ready channels.  Somebody could have closed a
+           channel so we double-check the registration before looking at
+           what the event backend returned.  The code here is written so that
+           a channel could be reading and writing at the same time, even
+           though that's not possible. */
+        for (i = 0; i < channels.ready_count; i++) {
+            fd = channels.ready[i];
+            what = channels.revents[fd];
+            channels.revents[fd] = 0;
+            if (what == 0)
+                continue;
             cp = &channels.table[fd];
+            if (CHANcheck_maxcnx(cp))
+                continue;
 
-            /* Check to see if this peer has too many open connections, and if
-               so, either close or make inactive this connection. */
-            if (cp->Type == CTnntp && cp->MaxCnx > 0 && cp->HoldTime > 0) {
-                CHANcount_active(cp);
-                if (cp->ActiveCnx > cp->MaxCnx && cp->fd > 0) {
-                    if (cp->Started + cp->HoldTime < Now.tv_sec)
-                        CHANclose(cp, CHANname(cp));
-                    else {
-                        if (fd >= lastfd)
-                            fd = 0;
-                        else
-                            fd++;
-                        cp->ActiveCnx = 0;
-                        RCHANremove(cp);
-                    }
-                    continue;
-                }
-            }
-            
             /* Anything to read? */
-            if (FD_ISSET(fd, &channels.read_set) && FD_ISSET(fd, &rdfds)) {
-                count--;
+            if ((what & CHAN_READ) && CHANhasmask(fd, CHAN_READ))
                 CHANhandle_read(cp);
-            }
 
             /* Possibly recheck for dead children so we don't get SIGPIPE on
                readerless channels. */
@@ -1310,69 +2475,15 @@ CHANreadloop(void)
                 PROCscan();
 
             /* Ready to write? */
-            if (FD_ISSET(fd, &channels.write_set) && FD_ISSET(fd, &wrfds)) {
-                count--;
+            if ((what & CHAN_WRITE) && CHANhasmask(fd, CHAN_WRITE))
                 CHANhandle_write(cp);
-            }
-
-            /* Coming off a sleep? */
-            if (FD_ISSET(fd, &channels.sleep_set)
-                && cp->Waketime <= Now.tv_sec) {
-                if (cp->Type == CTfree) {
-                    warn("%s %d free but was in SMASK", CHANname(cp), fd);
-                    FD_CLR(fd, &channels.sleep_set);
-                    channels.sleep_count--;
-                    CHANresetlastsleeping(fd);
-                    close(fd);
-                    cp->fd = -1;
-                } else {
-                    cp->LastActive = Now.tv_sec;
-                    SCHANremove(cp);
-                    if (cp->Waker != NULL) {
-                        (*cp->Waker)(cp);
-                    } else {
-                        name = CHANname(cp);
-                        warn("%s %d sleeping without Waker", name, fd);
-                        SITEchanclose(cp);
-                        CHANclose(cp, name);
-                    }
-                }
-            }
-
-            /* Toss CTreject channel early if it's inactive. */
-            if (cp->Type == CTreject
-                && cp->LastActive + REJECT_TIMEOUT < Now.tv_sec) {
-                name = CHANname(cp);
-                notice("%s timeout reject", name);
-                CHANclose(cp, name);
-            }
-
-            /* Has this channel been inactive very long? */
-            if (cp->Type == CTnntp
-                && cp->LastActive + cp->NextLog < Now.tv_sec) {
-                name = CHANname(cp);
-                silence = Now.tv_sec - cp->LastActive;
-                cp->NextLog += innconf->chaninacttime;
-                notice("%s inactive %ld", name, silence / 60L);
-                if (silence > innconf->peertimeout) {
-                    notice("%s timeout", name);
-                    CHANclose(cp, name);
-                }
-            }
-
-            /* Bump pointer, modulo the table size. */
-            if (fd >= lastfd)
-                fd = 0;
-            else
-                fd++;
-
-            /* If there is nothing to do, break out.
+        }
+        channels.ready_count = 0;
 
-               FIXME: Do we really want to keep going until sleep_count is
-               zero?  That means that when there are sleeping channels, we do
-               a full traversal every time through the select loop. */
-            if (count == 0 && channels.sleep_count == 0)
-                break;
-        } while (fd != startpoint);
+        /* Handle sleeping channels and inactivity timeouts. */
+        if (Now.tv_sec != channels.last_scan || channels.wake_pending
+            || (channels.sleep_count > 0
+                && channels.next_wake <= Now.tv_sec))
+            CHANscan();
     }
 }
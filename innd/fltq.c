@@ -0,0 +1,670 @@
+/*
+**  Embedded filter workers.
+**
+**  When filterworkers is set in inn.conf, the Perl and Python article
+**  filters are run by worker processes instead of innd itself, so that a
+**  slow filter only holds up the channel whose article it is looking at.
+**  The workers are copies of innd forked once the filters are loaded, each
+**  with a region of shared memory and a socket to innd.
+**
+**  ARTpost calls FLTQsubmit once the article has gone through the checks
+**  that come before the filters.  The headers the filters see and the body
+**  are copied to the region of an idle worker, which is told about it on its
+**  socket, and the channel goes to the CSfiltering state:  it stops reading
+**  and keeps its article, its parsed headers and its work-in-progress entry
+**  until the verdicts come back on the socket, which is an ordinary innd
+**  channel of type CTfilter.  ARTfiltered then finishes posting the article
+**  and NCfiltered answers the peer.  When all the workers are busy, the
+**  channel waits in line for one of them.
+**
+**  Articles too big for the region, articles of a channel whose worker died
+**  under them, and the articles of the waiting channels when the workers are
+**  stopped are filtered by innd itself, as without workers.  The workers are
+**  stopped, after their current article is finished, and started again
+**  whenever the filters or the server mode change, so that they always run
+**  the same code in the same mode as innd.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include "portable/socket.h"
+#include <errno.h>
+#include <signal.h>
+
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "innd.h"
+#include "innperl.h"
+
+#if defined(DO_PERL) || defined(DO_PYTHON)
+
+#ifndef MAP_ANON
+# ifdef MAP_ANONYMOUS
+#  define MAP_ANON MAP_ANONYMOUS
+# endif
+#endif
+
+/* Size of the region when maxartsize is 0, and room added for the lengths
+   of the headers and the NULs terminating them. */
+#define FLTQ_REGIONSIZE (1024 * 1024)
+#define FLTQ_SLACK      (MAX_ARTHEADER * (sizeof(int) + 1) + 64)
+
+/* A worker that dies within that many seconds of being started without
+   having been given an article is not restarted. */
+#define FLTQ_MINLIFE    10
+
+/* The verdicts sent back by a worker; an empty string accepts the article. */
+struct fltq_reply {
+    char python[256];
+    char perl[256];
+};
+
+struct fltq_worker {
+    pid_t pid;
+    CHANNEL *cp;                /* Our end of the socket. */
+    CHANNEL *client;            /* Channel whose article is being filtered. */
+    bool busy;
+    time_t started;
+    char *region;
+    size_t size;
+};
+
+static struct fltq_worker *workers;
+static unsigned long nworkers;
+
+/* Channels waiting for a free worker, oldest first. */
+static CHANNEL **waiting;
+static size_t nwaiting;
+static size_t waitingsize;
+
+/* Set while the workers are being stopped, so that the articles that come
+   in meanwhile are filtered by innd itself. */
+static bool draining = false;
+
+static void FLTQreader(CHANNEL *cp);
+static void FLTQwritedone(CHANNEL *cp);
+
+
+/*
+**  Get some memory shared with the children.
+*/
+static void *
+FLTQsharemem(size_t size)
+{
+#ifdef MAP_ANON
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED,
+                -1, 0);
+#else
+    int fd;
+    void *p;
+
+    fd = open("/dev/zero", O_RDWR, 0);
+    if (fd < 0)
+        return MAP_FAILED;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return p;
+#endif
+}
+
+
+/*
+**  Read exactly size bytes from a blocking descriptor.  Returns false on
+**  error or end of file.
+*/
+static bool
+FLTQreadall(int fd, void *p, size_t size)
+{
+    ssize_t count;
+    size_t done;
+
+    for (done = 0; done < size; done += count) {
+        count = read(fd, (char *) p + done, size - done);
+        if (count < 0 && errno == EINTR) {
+            count = 0;
+            continue;
+        }
+        if (count <= 0)
+            return false;
+    }
+    return true;
+}
+
+
+/*
+**  The main loop of a worker.  Each request is the length of the article
+**  copied to the region by FLTQcopy; the verdicts are sent back.
+*/
+static void
+FLTQworker(struct fltq_worker *wp, int fd)
+{
+    static ARTDATA data;
+    HDRCONTENT *hc = data.HdrContent;
+    struct fltq_reply reply;
+    size_t length;
+    long bodylength;
+    const char *p, *filterrc;
+    char *body;
+    int i;
+
+    while (FLTQreadall(fd, &length, sizeof(length))) {
+        p = wp->region;
+        memcpy(&data.Lines, p, sizeof(int));
+        p += sizeof(int);
+        for (i = 0; i < MAX_ARTHEADER; i++) {
+            memcpy(&hc[i].Length, p, sizeof(int));
+            p += sizeof(int);
+            if (hc[i].Length > 0) {
+                hc[i].Value = (char *) p;
+                p += hc[i].Length + 1;
+            } else
+                hc[i].Value = NULL;
+        }
+        memcpy(&bodylength, p, sizeof(long));
+        body = (char *) p + sizeof(long);
+
+        memset(&reply, 0, sizeof(reply));
+#if defined(DO_PYTHON)
+        filterrc = PYartfilter(&data, body, bodylength, data.Lines);
+        if (filterrc != NULL)
+            strlcpy(reply.python, filterrc, sizeof(reply.python));
+#endif
+#if defined(DO_PERL)
+        if (reply.python[0] == '\0' || innconf->dontrejectfiltered) {
+            filterrc = PLartfilter(&data, body, bodylength, data.Lines);
+            if (filterrc != NULL)
+                strlcpy(reply.perl, filterrc, sizeof(reply.perl));
+        }
+#endif
+        if (xwrite(fd, &reply, sizeof(reply)) < 0)
+            _exit(1);
+    }
+    _exit(0);
+}
+
+
+/*
+**  Start a worker.  Returns false if it could not be started.
+*/
+static bool
+FLTQspawn(struct fltq_worker *wp)
+{
+    static const int signals[] = { SIGHUP, SIGINT, SIGTERM, SIGUSR1, SIGCHLD };
+    int fds[2];
+    size_t i;
+    int j;
+    pid_t pid;
+    CHANNEL *cp;
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        syslog(L_ERROR, "%s cant socketpair for filter worker %m", LogName);
+        return false;
+    }
+    pid = fork();
+    if (pid < 0) {
+        syslog(L_ERROR, "%s cant fork filter worker %m", LogName);
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    /* The worker keeps nothing of innd's channels but its own socket. */
+    if (pid == 0) {
+        xsignal_forked();
+        for (i = 0; i < ARRAY_SIZE(signals); i++)
+            xsignal(signals[i], SIG_DFL);
+        close(fds[0]);
+        for (j = 0; (cp = CHANiter(&j, CTany)) != NULL; ) {
+            if (cp->Type == CTident)
+                RCidentforget(cp);
+            if (cp->fd >= 0)
+                close(cp->fd);
+        }
+        FLTQworker(wp, fds[1]);
+    }
+
+    close(fds[1]);
+    wp->pid = pid;
+    wp->busy = false;
+    wp->client = NULL;
+    wp->started = Now.tv_sec;
+    wp->cp = CHANcreate(fds[0], CTfilter, CSwaiting, FLTQreader,
+                        FLTQwritedone);
+    RCHANadd(wp->cp);
+    return true;
+}
+
+
+/*
+**  Start the filter workers if filterworkers asks for them and one of the
+**  article filters is enabled.  Called once the filters are loaded.
+*/
+void
+FLTQsetup(void)
+{
+    struct fltq_worker *wp;
+    unsigned long i;
+    size_t size;
+
+    if (nworkers > 0 || innconf->filterworkers == 0)
+        return;
+#if defined(DO_PERL) && defined(DO_PYTHON)
+    if (!PerlFilterActive && !PythonFilterActive)
+        return;
+#elif defined(DO_PERL)
+    if (!PerlFilterActive)
+        return;
+#else
+    if (!PythonFilterActive)
+        return;
+#endif
+
+    size = innconf->maxartsize > 0 ? innconf->maxartsize : FLTQ_REGIONSIZE;
+    size += FLTQ_SLACK;
+    workers = xcalloc(innconf->filterworkers, sizeof(struct fltq_worker));
+    for (i = 0; i < innconf->filterworkers; i++) {
+        wp = &workers[nworkers];
+        wp->region = FLTQsharemem(size);
+        if (wp->region == MAP_FAILED) {
+            syslog(L_ERROR, "%s cant map memory for filter worker %m",
+                   LogName);
+            break;
+        }
+        wp->size = size;
+        if (!FLTQspawn(wp)) {
+            munmap(wp->region, wp->size);
+            break;
+        }
+        nworkers++;
+    }
+    if (nworkers == 0) {
+        free(workers);
+        workers = NULL;
+        return;
+    }
+    syslog(L_NOTICE, "%s started %lu filter workers", LogName, nworkers);
+}
+
+
+/*
+**  Return the room needed in a region for the article of a channel.
+*/
+static size_t
+FLTQlength(CHANNEL *cp)
+{
+    ARTDATA *data = &cp->Data;
+    HDRCONTENT *hc = data->HdrContent;
+    size_t length;
+    int i;
+
+    length = sizeof(int) + MAX_ARTHEADER * sizeof(int) + sizeof(long)
+        + (cp->Next - data->Body) + 1;
+    for (i = 0; i < MAX_ARTHEADER; i++)
+        if (HDR_FOUND(i))
+            length += HDR_LEN(i) + 1;
+    return length;
+}
+
+
+/*
+**  Copy the article of a channel to the region of a worker, in the form read
+**  by FLTQworker.  Returns its length, or 0 if it does not fit.
+*/
+static size_t
+FLTQcopy(struct fltq_worker *wp, CHANNEL *cp)
+{
+    ARTDATA *data = &cp->Data;
+    HDRCONTENT *hc = data->HdrContent;
+    long bodylength;
+    size_t length;
+    char *p;
+    int i;
+
+    length = FLTQlength(cp);
+    if (length > wp->size)
+        return 0;
+    bodylength = cp->Next - data->Body;
+
+    p = wp->region;
+    memcpy(p, &data->Lines, sizeof(int));
+    p += sizeof(int);
+    for (i = 0; i < MAX_ARTHEADER; i++) {
+        memcpy(p, &hc[i].Length, sizeof(int));
+        p += sizeof(int);
+        if (HDR_FOUND(i)) {
+            memcpy(p, HDR(i), HDR_LEN(i));
+            p += HDR_LEN(i);
+            *p++ = '\0';
+        }
+    }
+    memcpy(p, &bodylength, sizeof(long));
+    p += sizeof(long);
+    memcpy(p, cp->In.data + data->Body, bodylength);
+    p[bodylength] = '\0';
+    return length;
+}
+
+
+/*
+**  Hand the article of a channel to a worker.  Returns false if it could
+**  not be done, in which case the caller filters the article itself.
+*/
+static bool
+FLTQsend(struct fltq_worker *wp, CHANNEL *cp)
+{
+    size_t length;
+
+    length = FLTQcopy(wp, cp);
+    if (length == 0)
+        return false;
+    if (xwrite(wp->cp->fd, &length, sizeof(length)) < 0) {
+        syslog(L_ERROR, "%s cant write to filter worker %ld %m", LogName,
+               (long) wp->pid);
+        return false;
+    }
+    wp->busy = true;
+    wp->client = cp;
+    return true;
+}
+
+
+/*
+**  Return an idle worker, or NULL if they are all busy.
+*/
+static struct fltq_worker *
+FLTQidle(void)
+{
+    unsigned long i;
+
+    for (i = 0; i < nworkers; i++)
+        if (workers[i].cp != NULL && !workers[i].busy)
+            return &workers[i];
+    return NULL;
+}
+
+
+/*
+**  Finish posting the article of a channel with the verdicts of a worker,
+**  or by filtering it in innd itself if reply is NULL, and answer the peer.
+**  If an I/O error throttled the server while the workers were being
+**  stopped, the article is dropped as NCproc would do.
+*/
+static void
+FLTQfinish(CHANNEL *cp, struct fltq_reply *reply)
+{
+    if (Mode == OMthrottled) {
+        ARTreject(REJECT_OTHER, cp);
+        ARTlogreject(cp, ModeReason);
+        NCclearwip(cp);
+        NCwriteshutdown(cp, ModeReason);
+        return;
+    }
+    if (reply == NULL) {
+        NCfiltered(cp, ARTfilter(cp));
+        return;
+    }
+    reply->python[sizeof(reply->python) - 1] = '\0';
+    reply->perl[sizeof(reply->perl) - 1] = '\0';
+    NCfiltered(cp, ARTfiltered(cp, reply->python, reply->perl));
+}
+
+
+/*
+**  Give the channels waiting for a worker to the idle ones.  While the
+**  workers are being stopped, FLTQclose takes care of them instead.
+*/
+static void
+FLTQnext(void)
+{
+    struct fltq_worker *wp;
+    CHANNEL *cp;
+
+    if (draining)
+        return;
+    while (nwaiting > 0 && (wp = FLTQidle()) != NULL) {
+        cp = waiting[0];
+        nwaiting--;
+        memmove(waiting, waiting + 1, nwaiting * sizeof(CHANNEL *));
+        if (!FLTQsend(wp, cp))
+            FLTQfinish(cp, NULL);
+    }
+}
+
+
+/*
+**  Hand the article of a channel to a worker, or queue the channel until one
+**  is free.  Returns true if the channel is now in the CSfiltering state and
+**  will be answered by NCfiltered, or false if the caller should filter the
+**  article itself.
+*/
+bool
+FLTQsubmit(CHANNEL *cp)
+{
+    struct fltq_worker *wp;
+
+    if (nworkers == 0 || draining)
+        return false;
+
+    /* Articles which don't fit in the regions are filtered here. */
+    if (FLTQlength(cp) > workers[0].size)
+        return false;
+
+    wp = (nwaiting == 0) ? FLTQidle() : NULL;
+    if (wp != NULL) {
+        if (!FLTQsend(wp, cp))
+            return false;
+    } else {
+        if (nwaiting == waitingsize) {
+            waitingsize += 16;
+            waiting = xrealloc(waiting, waitingsize * sizeof(CHANNEL *));
+        }
+        waiting[nwaiting++] = cp;
+    }
+    cp->State = CSfiltering;
+    return true;
+}
+
+
+/*
+**  Forget about a channel which is being closed.  Its worker, if any, goes
+**  on and its verdict is thrown away.
+*/
+void
+FLTQforget(CHANNEL *cp)
+{
+    unsigned long i;
+    size_t j;
+
+    for (i = 0; i < nworkers; i++)
+        if (workers[i].client == cp)
+            workers[i].client = NULL;
+    for (j = 0; j < nwaiting; j++)
+        if (waiting[j] == cp) {
+            nwaiting--;
+            memmove(waiting + j, waiting + j + 1,
+                    (nwaiting - j) * sizeof(CHANNEL *));
+            break;
+        }
+}
+
+
+/*
+**  A worker is done with its article.  Give it the next waiting channel
+**  before finishing the article, so that the channels are served in order.
+*/
+static void
+FLTQdone(struct fltq_worker *wp, struct fltq_reply *reply)
+{
+    CHANNEL *client;
+
+    client = wp->client;
+    wp->client = NULL;
+    wp->busy = false;
+    FLTQnext();
+    if (client != NULL)
+        FLTQfinish(client, reply);
+}
+
+
+/*
+**  A worker died.  Start another one unless it died right away, and filter
+**  its article here.
+*/
+static void
+FLTQdied(struct fltq_worker *wp)
+{
+    CHANNEL *client;
+    bool busy;
+
+    client = wp->client;
+    busy = wp->busy;
+    syslog(L_ERROR, "%s filter worker %ld died", LogName, (long) wp->pid);
+    CHANclose(wp->cp, CHANname(wp->cp));
+    wp->cp = NULL;
+    wp->client = NULL;
+    wp->busy = false;
+    if (draining)
+        ;
+    else if (busy || wp->started + FLTQ_MINLIFE <= Now.tv_sec)
+        FLTQspawn(wp);
+    else
+        syslog(L_ERROR, "%s not restarting filter worker", LogName);
+    if (client != NULL)
+        FLTQfinish(client, NULL);
+    FLTQnext();
+}
+
+
+/*
+**  Read the verdicts sent back by a worker.
+*/
+static void
+FLTQreader(CHANNEL *cp)
+{
+    struct fltq_worker *wp = NULL;
+    struct fltq_reply reply;
+    unsigned long i;
+    int count;
+
+    for (i = 0; i < nworkers; i++)
+        if (workers[i].cp == cp)
+            wp = &workers[i];
+    if (wp == NULL) {
+        CHANclose(cp, CHANname(cp));
+        return;
+    }
+    count = CHANreadtext(cp);
+    if (count == -2)
+        return;
+    if (count <= 0) {
+        FLTQdied(wp);
+        return;
+    }
+    if (cp->In.used < sizeof(reply))
+        return;
+    memcpy(&reply, cp->In.data, sizeof(reply));
+    cp->In.used = 0;
+    FLTQdone(wp, &reply);
+}
+
+
+/*
+**  Nothing is ever queued for writing on the socket of a worker.
+*/
+static void
+FLTQwritedone(CHANNEL *cp UNUSED)
+{
+}
+
+
+/*
+**  Stop the workers once they are done with their current article, and
+**  filter here the articles of the channels still waiting for one.
+*/
+void
+FLTQclose(void)
+{
+    struct fltq_worker *wp;
+    struct fltq_reply reply;
+    struct buffer *bp;
+    unsigned long i;
+    CHANNEL *cp;
+
+    if (nworkers == 0 || draining)
+        return;
+    draining = true;
+    for (i = 0; i < nworkers; i++) {
+        wp = &workers[i];
+        if (wp->cp == NULL || !wp->busy)
+            continue;
+        bp = &wp->cp->In;
+        memcpy(&reply, bp->data, bp->used);
+        if (!fdflag_nonblocking(wp->cp->fd, false)
+            || !FLTQreadall(wp->cp->fd, (char *) &reply + bp->used,
+                            sizeof(reply) - bp->used)) {
+            FLTQdied(wp);
+            continue;
+        }
+        bp->used = 0;
+        FLTQdone(wp, &reply);
+    }
+    while (nwaiting > 0) {
+        cp = waiting[0];
+        nwaiting--;
+        memmove(waiting, waiting + 1, nwaiting * sizeof(CHANNEL *));
+        FLTQfinish(cp, NULL);
+    }
+    for (i = 0; i < nworkers; i++) {
+        wp = &workers[i];
+        if (wp->cp != NULL)
+            CHANclose(wp->cp, CHANname(wp->cp));
+        munmap(wp->region, wp->size);
+    }
+    free(workers);
+    workers = NULL;
+    nworkers = 0;
+    draining = false;
+}
+
+
+/*
+**  Restart the workers, so that they pick up a change of the filters or of
+**  the server mode.
+*/
+void
+FLTQrestart(void)
+{
+    FLTQclose();
+    FLTQsetup();
+}
+
+#else /* !(DO_PERL || DO_PYTHON) */
+
+void
+FLTQsetup(void)
+{
+}
+
+bool
+FLTQsubmit(CHANNEL *cp UNUSED)
+{
+    return false;
+}
+
+void
+FLTQforget(CHANNEL *cp UNUSED)
+{
+}
+
+void
+FLTQrestart(void)
+{
+}
+
+void
+FLTQclose(void)
+{
+}
+
+#endif /* !(DO_PERL || DO_PYTHON) */
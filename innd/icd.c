@@ -7,9 +7,12 @@
 #include "portable/mmap.h"
 #include <sys/uio.h>
 
+#include "inn/activemap.h"
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
+#include "inn/inndcomm.h"
 #include "inn/mmap.h"
+#include "inn/xwrite.h"
 #include "innd.h"
 #include "inn/ov.h"
 
@@ -23,6 +26,13 @@ static char		*ICDactpath = NULL;
 static char		*ICDactpointer;
 static int		ICDactfd;
 static int		ICDactsize;
+static char		*ICDmappath = NULL;
+static struct activemap	*ICDmap = NULL;
+
+/* Next group of a background renumber, or -1 if none is running. */
+static int		ICDrenumbernext = -1;
+
+static void ICDmapupdate(void);
 
 
 /*
@@ -129,6 +139,12 @@ ICDclose(void)
 {
     ICDwrite();
     ICDcloseactive();
+    if (ICDmap != NULL) {
+	if (unlink(ICDmappath) < 0)
+	    syslog(L_ERROR, "%s cant unlink %s %m", LogName, ICDmappath);
+	activemap_retire(ICDmap);
+	ICDmap = NULL;
+    }
 }
 
 
@@ -150,6 +166,60 @@ ICDrenumberactive(void)
 }
 
 
+/*
+**  Renumber the active file in the background.  Querying the overview for
+**  every group takes a while on a large active file, so ICDrenumberstep
+**  is called from the main loop and only renumbers ICD_RENUMBER_BATCH
+**  groups each time; channels are served in between.  Groups added or
+**  removed meanwhile may be skipped or renumbered twice, which is harmless.
+*/
+#define ICD_RENUMBER_BATCH	64
+
+void
+ICDrenumberstart(void)
+{
+    if (ICDrenumbernext >= 0)
+	syslog(L_NOTICE, "%s renumber restarted", LogName);
+    else
+	syslog(L_NOTICE, "%s renumber started", LogName);
+    ICDrenumbernext = 0;
+}
+
+bool
+ICDrenumbering(void)
+{
+    return ICDrenumbernext >= 0 && Mode == OMrunning;
+}
+
+void
+ICDrenumberstep(void)
+{
+    int	i;
+
+    if (!ICDrenumbering())
+	return;
+    if (ICDneedsetup) {
+	syslog(L_ERROR, "%s renumber aborted, must reload", LogName);
+	ICDrenumbernext = -1;
+	return;
+    }
+    for (i = 0; i < ICD_RENUMBER_BATCH && ICDrenumbernext < nGroups; i++) {
+	if (!NGrenumber(&Groups[ICDrenumbernext])) {
+	    syslog(L_ERROR, "%s renumber aborted at %s", LogName,
+		   Groups[ICDrenumbernext].Name);
+	    ICDrenumbernext = -1;
+	    return;
+	}
+	ICDrenumbernext++;
+    }
+    if (ICDrenumbernext >= nGroups) {
+	ICDwrite();
+	syslog(L_NOTICE, "%s renumber done", LogName);
+	ICDrenumbernext = -1;
+    }
+}
+
+
 /*
 **  Use writev() to replace the active file.
 */
@@ -292,6 +362,41 @@ bailout:
 }
 
 
+/*
+**  Write new flags of the same length over those of a newsgroup, in place.
+**  Nothing moves in the active file, so there is no need to rewrite it and
+**  parse it again; only the sites getting the newsgroup may change, if some
+**  of them only get moderated or unmoderated newsgroups.
+*/
+static bool
+ICDsetflags(NEWSGROUP *ngp, const char *Rest, size_t length)
+{
+#ifndef HAVE_MMAP
+    int			oerrno;
+#endif
+
+    memcpy(ngp->Rest, Rest, length);
+#ifdef HAVE_MMAP
+    if (inn_msync_page(ngp->Rest, length, MS_ASYNC) < 0)
+	syslog(L_ERROR, "%s msync failed %s %m", LogName, ICDactpath);
+#else
+    if (xpwrite(ICDactfd, Rest, length, ngp->Rest - ICDactpointer) < 0) {
+	oerrno = errno;
+	syslog(L_ERROR, "%s cant write %s %m", LogName, ICDactpath);
+	IOError("updating active", oerrno);
+	return false;
+    }
+#endif
+    SITEsubscribe(ngp);
+    if (ICDmap != NULL && ngp->Slot >= 0) {
+	activemap_begin(ICDmap);
+	activemap_setflag(ICDmap, ngp->Slot, ngp->Rest[0]);
+	activemap_end(ICDmap);
+    }
+    return true;
+}
+
+
 /*
 **  Change the flag on a newsgroup.  Fairly easy.
 */
@@ -304,6 +409,19 @@ ICDchangegroup(NEWSGROUP *ngp, char *Rest)
     bool		ret;
     char		*Name;
     long		Last;
+    size_t		length;
+
+    /* Flags of the same length are changed in place, unless an alias is
+       involved since aliases are resolved when the file is parsed. */
+    length = strcspn(ngp->Rest, "\n");
+    if (strlen(Rest) == length && Rest[0] != NF_FLAG_ALIAS
+	&& ngp->Rest[0] != NF_FLAG_ALIAS) {
+	if (!ICDsetflags(ngp, Rest, length))
+	    return false;
+	OVQsync();
+	return !innconf->enableoverview
+	    || OVgroupadd(ngp->Name, 0, ngp->Last, Rest);
+    }
 
     /* Set up the scatter/gather vectors. */
     ICDiovset(&iov[0], ICDactpointer, ngp->Rest - ICDactpointer);
@@ -325,6 +443,7 @@ ICDchangegroup(NEWSGROUP *ngp, char *Rest)
     ICDiovrelease(&iov[2]);
 
     if (ret) {
+	OVQsync();
 	if (innconf->enableoverview && !OVgroupadd(Name, 0, Last, Rest)) {
 	    free(Name);
 	    return false;
@@ -336,13 +455,47 @@ ICDchangegroup(NEWSGROUP *ngp, char *Rest)
 
 
 /*
-**  Add a newsgroup.  Append a line to the end of the active file and reload.
+**  Append a line to the active file in place, and add its newsgroup to the
+**  in-core tables.  Unlike ICDwritevactive, this writes neither a backup
+**  nor the whole file, and doesn't parse the active and newsfeeds files
+**  again, which takes seconds with a large active file.
+*/
+static bool
+ICDappendactive(const char *line, size_t length)
+{
+    char		*old;
+    char		*active;
+    char		*end;
+    int			oerrno;
+
+#ifndef HAVE_MMAP
+    /* Changes in the in-core copy would be lost when reading it again. */
+    ICDwriteactive();
+#endif
+    if (xpwrite(ICDactfd, line, length, ICDactsize) < 0) {
+	oerrno = errno;
+	syslog(L_ERROR, "%s cant write %s %m", LogName, ICDactpath);
+	IOError("appending to active", oerrno);
+	return false;
+    }
+    old = ICDactpointer;
+    ICDcloseactive();
+    active = ICDreadactive(&end);
+    if (!NGappend(old, active, end)) {
+	ICDsetup(true);
+	return false;
+    }
+    return true;
+}
+
+
+/*
+**  Add a newsgroup.  Append a line to the end of the active file.
 */
 bool
 ICDnewgroup(char *Name, char *Rest)
 {
     char		buff[SMBUF];
-    struct iovec	iov[2];
     bool		ret;
 
     /* Set up the scatter/gather vectors. */
@@ -351,13 +504,9 @@ ICDnewgroup(char *Name, char *Rest)
 	return false;
     }
     snprintf(buff, sizeof(buff), "%s 0000000000 0000000001 %s\n", Name, Rest);
-    ICDiovset(&iov[0], ICDactpointer, ICDactsize);
-    ICDiovset(&iov[1], buff, strlen(buff));
-
-    ret = ICDwritevactive(iov, 2);
-    ICDiovrelease(&iov[0]);
-    ICDiovrelease(&iov[1]);
+    ret = ICDappendactive(buff, strlen(buff));
     if (ret) {
+	OVQsync();
 	if (innconf->enableoverview && !OVgroupadd(Name, 1, 0, Rest))
 	    return false;
     }
@@ -365,6 +514,19 @@ ICDnewgroup(char *Name, char *Rest)
 }
 
 
+/*
+**  Whether a newsgroup is one that INN requires to exist.
+*/
+bool
+ICDprotected(const char *Name)
+{
+    if (strcmp(Name, "junk") == 0 || strcmp(Name, "control") == 0
+        || strcmp(Name, "control.cancel") == 0)
+        return true;
+    return innconf->mergetogroups && strcmp(Name, "to") == 0;
+}
+
+
 /*
 **  Remove a newsgroup.  Splice the line out of the active file and reload.
 */
@@ -377,10 +539,7 @@ ICDrmgroup(NEWSGROUP *ngp)
     char *Name;
 
     /* Don't let anyone remove newsgroups that INN requires exist. */
-    if (strcmp(ngp->Name, "junk") == 0 || strcmp(ngp->Name, "control") == 0
-        || strcmp(ngp->Name, "control.cancel") == 0)
-        return false;
-    if (innconf->mergetogroups && strcmp(ngp->Name, "to") == 0)
+    if (ICDprotected(ngp->Name))
         return false;
 
     Name = xstrdup(ngp->Name);
@@ -391,6 +550,7 @@ ICDrmgroup(NEWSGROUP *ngp)
 	ret = ICDwritevactive(iov, 1);
 	ICDiovrelease(&iov[0]);
 	if (ret) {
+	    OVQsync();
 	    if (innconf->enableoverview && !OVgroupdel(Name)) {
 		free(Name);
 		return false;
@@ -408,6 +568,7 @@ ICDrmgroup(NEWSGROUP *ngp)
 	ret = ICDwritevactive(iov, 1);
 	ICDiovrelease(&iov[0]);
 	if (ret) {
+	    OVQsync();
 	    if (innconf->enableoverview && !OVgroupdel(Name)) {
 		free(Name);
 		return false;
@@ -424,6 +585,7 @@ ICDrmgroup(NEWSGROUP *ngp)
     ICDiovrelease(&iov[0]);
     ICDiovrelease(&iov[1]);
     if (ret) {
+	OVQsync();
 	if (innconf->enableoverview && !OVgroupdel(Name)) {
 	    free(Name);
 	    return false;
@@ -435,6 +597,88 @@ ICDrmgroup(NEWSGROUP *ngp)
 
 
 
+/*
+**  Apply a batch of newsgroup changes with a single rewrite of the active
+**  file, instead of one per change.  Changed and removed newsgroups keep
+**  their place and new ones are appended.  The caller has checked that
+**  each newsgroup appears only once and that none of them is protected.
+*/
+bool
+ICDbatch(GROUPCHANGE *changes, int count)
+{
+    GROUPCHANGE		**bygroup;
+    GROUPCHANGE		*gc;
+    NEWSGROUP		*ngp;
+    struct buffer	*active;
+    struct iovec	iov;
+    long		start;
+    long		next;
+    int			i;
+    bool		ret;
+
+    /* Index the changes to existing newsgroups by their position. */
+    bygroup = xcalloc(nGroups, sizeof(GROUPCHANGE *));
+    for (i = 0; i < count; i++) {
+	gc = &changes[i];
+	if (gc->ngp != NULL) {
+	    bygroup[gc->ngp - Groups] = gc;
+	    gc->Last = gc->ngp->Last;
+	}
+    }
+
+    /* Copy the unchanged runs of lines, splicing in the changes. */
+    active = buffer_new();
+    buffer_resize(active, ICDactsize + 1);
+    for (start = 0, i = 0; i < nGroups; i++) {
+	if ((gc = bygroup[i]) == NULL)
+	    continue;
+	ngp = &Groups[i];
+	next = (i + 1 < nGroups) ? Groups[i + 1].Start : ICDactsize;
+	if (gc->Type == SC_RMGROUP) {
+	    buffer_append(active, &ICDactpointer[start], ngp->Start - start);
+	} else {
+	    buffer_append(active, &ICDactpointer[start],
+			  ngp->Rest - ICDactpointer - start);
+	    buffer_append_sprintf(active, "%s\n", gc->Rest);
+	}
+	start = next;
+    }
+    buffer_append(active, &ICDactpointer[start], ICDactsize - start);
+    free(bygroup);
+
+    /* New newsgroups go at the end, as with ICDnewgroup. */
+    for (i = 0; i < count; i++) {
+	gc = &changes[i];
+	if (gc->Type == SC_NEWGROUP && gc->ngp == NULL)
+	    buffer_append_sprintf(active, "%s 0000000000 0000000001 %s\n",
+				  gc->Name, gc->Rest);
+    }
+
+    /* Write it once; this also parses the new file. */
+    iov.iov_base = active->data;
+    iov.iov_len = active->left;
+    ret = ICDwritevactive(&iov, 1);
+    buffer_free(active);
+    if (!ret)
+	return false;
+
+    /* Bring the overview in line. */
+    OVQsync();
+    if (!innconf->enableoverview)
+	return true;
+    for (i = 0; i < count; i++) {
+	gc = &changes[i];
+	if (gc->Type == SC_RMGROUP)
+	    ret = OVgroupdel(gc->Name) && ret;
+	else if (gc->ngp == NULL)
+	    ret = OVgroupadd(gc->Name, 1, 0, gc->Rest) && ret;
+	else
+	    ret = OVgroupadd(gc->Name, 0, gc->Last, gc->Rest) && ret;
+    }
+    return ret;
+}
+
+
 /*
 **  Open the active file and "map" it into memory.
 */
@@ -492,6 +736,7 @@ ICDreadactive(char **endp)
 void
 ICDwriteactive(void)
 {
+    ICDmapupdate();
 #ifdef HAVE_MMAP
     if (inn_msync_page(ICDactpointer, ICDactsize, MS_ASYNC) < 0) {
         syslog(L_FATAL, "%s msync failed %s 0x%lx %d %m", LogName, ICDactpath, (unsigned long) ICDactpointer, ICDactsize);
@@ -508,3 +753,111 @@ ICDwriteactive(void)
     }
 #endif /* HAVE_MMAP */
 }
+
+
+/*
+**  Publish a new shared table of newsgroup statistics for nnrpd, once the
+**  active file has been parsed.  The statistics of the newsgroups that were
+**  already in the previous table are carried over; for the others, they
+**  come from the overview database, or are estimated from the water marks
+**  in the active file when there is no overview.
+*/
+void
+ICDmapactive(void)
+{
+    struct activemap	*map;
+    NEWSGROUP		*ngp;
+    size_t		size;
+    long		slot;
+    int			i, lo, hi, count;
+
+    if (!innconf->sharedactive)
+	return;
+    if (ICDmappath == NULL)
+	ICDmappath = concatpath(innconf->pathrun, INN_PATH_ACTIVEMAP);
+    for (size = 0, i = nGroups, ngp = Groups; --i >= 0; ngp++)
+	size += ngp->NameLength + 1;
+    map = activemap_create(ICDmappath, nGroups, size);
+    if (map != NULL) {
+	OVQsync();
+	for (i = nGroups, ngp = Groups; --i >= 0; ngp++) {
+	    if (ICDmap != NULL
+		&& (slot = activemap_find(ICDmap, ngp->Name)) >= 0) {
+		activemap_get(ICDmap, slot, &lo, &hi, &count);
+		if ((int) ngp->Last > hi)
+		    count += ngp->Last - hi;
+	    }
+	    else if (!innconf->enableoverview
+		     || !OVgroupstats(ngp->Name, &lo, &hi, &count, NULL)) {
+		/* The low water mark follows the high one in the active file. */
+		lo = atol(ngp->LastString + ngp->Lastwidth + 1);
+		count = (int) ngp->Last >= lo ? ngp->Last - lo + 1 : 0;
+	    }
+	    ngp->Slot = activemap_add(map, ngp->Name, lo, ngp->Last, count,
+				      ngp->Rest[0]);
+	}
+	if (!activemap_publish(map)) {
+	    activemap_retire(map);
+	    map = NULL;
+	}
+    }
+    if (ICDmap != NULL)
+	activemap_retire(ICDmap);
+    ICDmap = map;
+}
+
+
+/*
+**  Record the new water marks of a renumbered newsgroup in the shared table.
+**  A negative count keeps the previous one, bounded by the new water marks.
+*/
+void
+ICDmapgroup(NEWSGROUP *ngp, long lomark, int count)
+{
+    int			lo, hi, old;
+
+    if (ICDmap == NULL || ngp->Slot < 0)
+	return;
+    if (count < 0) {
+	activemap_get(ICDmap, ngp->Slot, &lo, &hi, &old);
+	count = (int) ngp->Last >= lomark ? ngp->Last - lomark + 1 : 0;
+	if (old < count)
+	    count = old;
+    }
+    activemap_begin(ICDmap);
+    activemap_set(ICDmap, ngp->Slot, lomark, ngp->Last, count);
+    activemap_end(ICDmap);
+}
+
+
+/*
+**  Bring the high water marks in the shared table up to date, along with the
+**  counts of articles, which grow by the number of articles received since.
+*/
+static void
+ICDmapupdate(void)
+{
+    NEWSGROUP		*ngp;
+    bool		changed;
+    int			i, lo, hi, count;
+
+    if (ICDmap == NULL)
+	return;
+    changed = false;
+    for (i = nGroups, ngp = Groups; --i >= 0; ngp++) {
+	if (ngp->Slot < 0)
+	    continue;
+	activemap_get(ICDmap, ngp->Slot, &lo, &hi, &count);
+	if ((int) ngp->Last == hi)
+	    continue;
+	if (!changed) {
+	    activemap_begin(ICDmap);
+	    changed = true;
+	}
+	if ((int) ngp->Last > hi)
+	    count += ngp->Last - hi;
+	activemap_set(ICDmap, ngp->Slot, lo, ngp->Last, count);
+    }
+    if (changed)
+	activemap_end(ICDmap);
+}
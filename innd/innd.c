@@ -4,6 +4,11 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include <signal.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "inn/innconf.h"
 #include "inn/messages.h"
@@ -48,14 +53,6 @@ bool BufferedLogs = true;
 FILE *Log = NULL;
 FILE *Errlog = NULL;
 
-/* Some very old systems have a completely inadequate BUFSIZ buffer size, at
-   least for our logging purposes. */
-#if BUFSIZ < 4096
-# define LOG_BUFSIZ 4096
-#else
-# define LOG_BUFSIZ BUFSIZ
-#endif
-
 /* Internal prototypes. */
 static void             catch_terminate(int sig);
 static void             xmalloc_abort(const char *what, size_t size,
@@ -282,14 +279,18 @@ CleanupAndExit(int status, const char *why)
 void
 JustCleanup(void)
 {
+    FLTQclose();
+    CANQclose();
     SITEflushall(false);
     CCclose();
     LCclose();
+    STATUSclose();
     NCclose();
     RCclose();
     ICDclose();
     InndHisClose();
     ARTclose();
+    OVQclose();
     if (innconf->enableoverview) 
         OVclose();
     NGclose();
@@ -325,7 +326,7 @@ ReopenLog(FILE *F)
     char *path, *oldpath;
     int mask;
 
-    if (Debug)
+    if (Debug || LOGWrotate(F))
 	return;
 
     path = concatpath(innconf->pathlog,
@@ -344,6 +345,155 @@ ReopenLog(FILE *F)
 }
 
 
+/*
+**  Open the history, if the server is running.
+*/
+static void
+StartHistory(void)
+{
+    if (Mode == OMrunning)
+        InndHisOpen();
+}
+
+
+/*
+**  Set up the storage manager.
+*/
+static void
+StartStorage(void)
+{
+    bool flag = true;
+
+    if (!SMsetup(SM_RDWR, &flag) || !SMsetup(SM_PREOPEN, &flag))
+        die("SERVER cant set up storage manager");
+    if (!SMinit())
+        die("SERVER cant initialize storage manager: %s", SMerrorstr);
+}
+
+
+/*
+**  Open the overview, if enabled.
+*/
+static void
+StartOverview(void)
+{
+    if (innconf->enableoverview && !OVopen(OV_WRITE))
+        die("SERVER cant open overview method");
+}
+
+
+/*
+**  Opening the history, the storage manager and the overview can each take
+**  a long while on a big server, and none of them needs the others nor the
+**  rest of innd, so they are opened in threads of their own while the
+**  active file, newsfeeds, incoming.conf and the filters are loaded.
+**  StartupWait is called before anything uses them.
+*/
+static const struct {
+    const char *name;
+    void (*start)(void);
+} StartupTasks[] = {
+    { "history",  StartHistory  },
+    { "storage",  StartStorage  },
+    { "overview", StartOverview },
+};
+
+static struct startup_task {
+    const char *name;
+    void (*start)(void);
+    long elapsed;               /* Milliseconds taken. */
+#ifdef HAVE_PTHREAD
+    pthread_t thread;
+    bool running;
+#endif
+} Startup[ARRAY_SIZE(StartupTasks)];
+
+
+/*
+**  Run one of the startup tasks, timing it.
+*/
+static void
+StartupRun(struct startup_task *task)
+{
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    (*task->start)();
+    gettimeofday(&end, NULL);
+    task->elapsed = (end.tv_sec - start.tv_sec) * 1000
+                    + (end.tv_usec - start.tv_usec) / 1000;
+}
+
+
+#ifdef HAVE_PTHREAD
+static void *
+StartupThread(void *arg)
+{
+    sigset_t set;
+
+    /* All signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    StartupRun(arg);
+    return NULL;
+}
+#endif
+
+
+/*
+**  Start the startup tasks, running them right away if no thread can be
+**  started for them.
+*/
+static void
+StartupBegin(void)
+{
+    struct startup_task *task;
+    size_t i;
+#ifdef HAVE_PTHREAD
+    int status;
+#endif
+
+    for (i = 0; i < ARRAY_SIZE(Startup); i++) {
+        task = &Startup[i];
+        task->name = StartupTasks[i].name;
+        task->start = StartupTasks[i].start;
+#ifdef HAVE_PTHREAD
+        status = pthread_create(&task->thread, NULL, StartupThread, task);
+        if (status == 0) {
+            task->running = true;
+            continue;
+        }
+        syslog(L_ERROR, "%s cant start thread to open %s: %s", LogName,
+               task->name, strerror(status));
+#endif
+        StartupRun(task);
+    }
+}
+
+
+/*
+**  Wait for the startup tasks to be done.
+*/
+static void
+StartupWait(void)
+{
+    struct startup_task *task;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(Startup); i++) {
+        task = &Startup[i];
+#ifdef HAVE_PTHREAD
+        if (task->running) {
+            pthread_join(task->thread, NULL);
+            task->running = false;
+        }
+#endif
+        syslog(L_NOTICE, "%s opened %s in %ld ms", LogName, task->name,
+               task->elapsed);
+    }
+}
+
+
 /*
 **  Print a usage message and exit.
 */
@@ -359,8 +509,7 @@ int
 main(int ac, char *av[])
 {
     const char *name, *p;
-    char *path;
-    bool flag;
+    char *path, *cpus;
     static char		WHEN[] = "PID file";
     int			i;
     size_t              j;
@@ -629,23 +778,34 @@ main(int ac, char *av[])
     Log = stdout;
     Errlog = stderr;
 
-    /* Initialize overview if necessary. */
-    if (innconf->enableoverview && !OVopen(OV_WRITE))
-        die("SERVER cant open overview method");
-
     /* Attempt to increase the number of open file descriptors. */
     if (innconf->rlimitnofile > 0) {
-        if (setfdlimit(innconf->rlimitnofile) < 0)
+        if (CHANfdsetlimited())
+            status = setfdlimit(innconf->rlimitnofile);
+        else
+            status = setfdlimit_any(innconf->rlimitnofile);
+        if (status < 0)
             syswarn("SERVER cant set file descriptor limit");
     }
 
+    /* Move to the processors we are given before the history and overview
+       are mapped, so that their memory is allocated close to them. */
+    if (innconf->inndcpus != NULL && !inn_setaffinity(innconf->inndcpus))
+        syswarn("SERVER cant run on processors %s", innconf->inndcpus);
+    cpus = inn_getaffinity();
+    if (cpus != NULL) {
+        syslog(L_NOTICE, "%s processors %s", LogName, cpus);
+        free(cpus);
+    }
+
     /* Get number of open channels. */
     i = getfdlimit();
     if (i < 0)
         sysdie("SERVER cant get file descriptor limit");
 
+    /* Only the select event backend is limited by FD_SETSIZE. */
 #ifdef FD_SETSIZE
-    if (FD_SETSIZE > 0 && (unsigned) i >= FD_SETSIZE) {
+    if (CHANfdsetlimited() && FD_SETSIZE > 0 && (unsigned) i >= FD_SETSIZE) {
         /* Only log a warning if rlimitnofile has been set
          * to a value different than the default setting of letting
          * the system set the number of file descriptors. */
@@ -670,7 +830,7 @@ main(int ac, char *av[])
             max = 5000;
         i = max;
     }
-    syslog(L_NOTICE, "%s descriptors %d", LogName, i);
+    syslog(L_NOTICE, "%s descriptors %d (%s)", LogName, i, CHANmethod());
     if (MaxOutgoing == 0) {
 	/* getfdlimit() - (stdio + dbz + cc + lc + rc + art + fudge) */
 	MaxOutgoing = i - (  3   +  3  +  2 +  1 +  1 +  1  +  2  );
@@ -703,12 +863,17 @@ main(int ac, char *av[])
        so call PROCsetup before ICDsetup.  NNTP needs to know if it's a slave,
        so call RCsetup before NCsetup.  RCsetup calls innbind and waits for
        it, so call PROCsetup after RCsetup to not interpose a signal
-       handler. */
+       handler.  The history, the storage manager and the overview are
+       opened meanwhile, once the log writer is forked. */
     CHANsetup(i);
-    if (Mode == OMrunning)
-        InndHisOpen();
+    LOGWsetup();
+    status = sd_notify(false, "STATUS=Opening history, storage and overview");
+    if (status < 0)
+        warn("cannot notify systemd of startup: %s", strerror(-status));
+    StartupBegin();
     CCsetup();
     LCsetup();
+    STATUSsetup();
     RCsetup();
     PROCsetup(10);
     WIPsetup();
@@ -718,13 +883,6 @@ main(int ac, char *av[])
     if (innconf->timer != 0)
         TMRinit(TMR_MAX);
 
-    /* Initialize the storage subsystem. */
-    flag = true;
-    if (!SMsetup(SM_RDWR, &flag) || !SMsetup(SM_PREOPEN, &flag))
-        die("SERVER cant set up storage manager");
-    if (!SMinit())
-        die("SERVER cant initialize storage manager: %s", SMerrorstr);
-
 #if	defined(_DEBUG_MALLOC_INC)
     m.i = 1;
     dbmallopt(MALLOC_CKCHAIN, &m);
@@ -773,6 +931,12 @@ main(int ac, char *av[])
     if (!filter)
 	PYfilter(false);
 #endif /* DO_PYTHON */
+
+    /* The filter workers are forked, so wait for the threads first. */
+    StartupWait();
+    InndHisWarmup();
+    OVQsetup();
+    FLTQsetup();
  
     /* And away we go... */
     if (ShouldRenumber) {
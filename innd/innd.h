@@ -70,6 +70,14 @@ typedef short	SITEIDX;
 #define NF_FIELD_SEP            ':'
 #define NF_SUBFIELD_SEP         '/'
 
+/* Some very old systems have a completely inadequate BUFSIZ buffer size, at
+   least for our logging purposes. */
+#if BUFSIZ < 4096
+# define LOG_BUFSIZ 4096
+#else
+# define LOG_BUFSIZ BUFSIZ
+#endif
+
 
 /*
 **  Server's operating mode.  Note that OMshutdown is only used internally
@@ -91,6 +99,32 @@ typedef struct _LISTBUFFER {
   int	    ListLength;
 } LISTBUFFER;
 
+/*
+**  The hops of a Path header body in an open addressing hash table keyed by
+**  their case-folded hash, so that whether a site is in the Path is found
+**  without comparing its name with every hop.
+*/
+typedef struct _PATHSET {
+  const char  **  Hops;		/* NULL for an empty slot */
+  unsigned int *  Hashes;
+  unsigned int	  Mask;		/* number of slots less one */
+} PATHSET;
+
+
+/*
+**  A bump allocator for the scratch memory of the article being processed
+**  on a channel, reset by ARTprepare.  Allocations that don't fit in the
+**  block are made separately, and the block is grown at the next reset to
+**  hold all that the article needed.
+*/
+typedef struct _ARENA {
+  char	*   Block;
+  size_t    Size;
+  size_t    Used;
+  void	*   Overflow;		/* separate allocations, chained */
+  size_t    OverflowSize;	/* their total size */
+} ARENA;
+
 /*
 **  What program to handoff a connection to.
 */
@@ -245,6 +279,7 @@ typedef struct _ARTDATA {
                                            received article. */
   char		  TokenText[(sizeof(TOKEN) * 2) + 3];
 					/* token of stored article */
+  ARENA		  Arena;		/* per-article scratch memory */
   LISTBUFFER	  Newsgroups;		/* newsgroup list */
   int		  Groupcount;		/* number of newsgroups */
   int		  Followcount;		/* number of folloup to newsgroups */
@@ -256,13 +291,17 @@ typedef struct _ARTDATA {
   const char  *   Feedsite;		/* who gives me this article */
   int		  FeedsiteLength;	/* length of Feedsite */
   LISTBUFFER	  Path;			/* path name list */
+  PATHSET	  PathSet;		/* the same, hashed */
   int		  StoredGroupLength;	/* 1st newsgroup name in Xref */
   char	      *   Replic;		/* replication data */
   int		  ReplicLength;		/* length of Replic */
   HASH	      *   Hash;			/* Message-ID hash */
+  HASH		  MessageIDHash;	/* storage for Hash */
   struct buffer	  Headers;		/* buffer for headers which will be sent
 					   to site */
   struct buffer	  Overview;		/* buffer for overview data */
+  struct buffer	  Article;		/* stored article, for sites which
+					   get it with the A item */
   int		  CRwithoutLF;		/* counter for '\r' without '\n' */
   int		  LFwithoutCR;		/* counter for '\n' without '\r' */
   int             DotStuffedLines;      /* counter for lines beginning with '.' */
@@ -288,9 +327,13 @@ enum channel_type {
     CTnntp,
     CTlocalconn,
     CTcontrol,
+    CTmetrics,
     CTfile,
     CTexploder,
-    CTprocess
+    CTprocess,
+    CTfilter,
+    CTident,
+    CTlogger
 };
 
 /* The state a channel is in.  Interpretation of this depends on the channel's
@@ -311,7 +354,8 @@ enum channel_state {
     CSeatarticle,
     CSeatcommand,
     CSgetxbatch,
-    CScancel
+    CScancel,
+    CSfiltering
 };
 
 
@@ -340,6 +384,8 @@ typedef struct _CHANNEL {
   bool		       NoResendId;
   bool		       privileged;
   bool		       Nolist;
+  bool		       Backpressure;
+  bool                 Compress;        /* May use COMPRESS? */
   bool                 CanAuthenticate; /* Can use AUTHINFO? */
   bool                 IsAuthenticated; /* No need to use AUTHINFO? */
   bool                 HasSentUsername; /* Has used AUTHINFO USER? */
@@ -394,6 +440,10 @@ typedef struct _CHANNEL {
   void		    *  Event;
   struct buffer	       In;
   struct buffer	       Out;
+  struct z_stream_s *  ZIn;		/* inflates what is read into In */
+  struct z_stream_s *  ZOut;		/* deflates what is appended to Out */
+  struct buffer	       ZRaw;		/* compressed data read, not inflated */
+  bool		       ZFlush;		/* deflated data waits for a flush */
   bool		       Tracing;
   struct buffer	       Sendid;
   HASH		       CurrentMessageIDHash;
@@ -405,6 +455,8 @@ typedef struct _CHANNEL {
   int		       ActiveCnx;
   int		       MaxCnx;
   int		       HoldTime;
+  int		       Weight;		/* weight: from incoming.conf */
+  int		       Deficit;		/* bytes it may still read */
   time_t	       ArtBeg;
   int		       ArtMax;
   size_t	       Start;		/* where current cmd/article starts
@@ -417,6 +469,7 @@ typedef struct _CHANNEL {
 } CHANNEL;
 
 #define	DEFAULTNGBOXSIZE	64
+#define	ARENABLOCKSIZE		(16 * 1024)	/* initial arena block */
 
 /*
 **  Different types of rejected articles.
@@ -434,6 +487,7 @@ typedef struct _NEWSGROUP {
   char		     *  Name;
   int			NameLength;
   ARTNUM		Last;
+  long			Slot;	     /* Slot in the shared table     */
   ARTNUM		Filenum;     /* File name to use             */
   int			Lastwidth;
   int			PostCount;   /* Have we already put it here? */
@@ -444,9 +498,24 @@ typedef struct _NEWSGROUP {
   SITEIDX		nPoison;
   int		     *  Poison;
   struct _NEWSGROUP  *  Alias;
+  unsigned int		Hash;	     /* Hash of the name             */
+  struct _NEWSGROUP  *  HashNext;    /* Next group in the hash chain */
 } NEWSGROUP;
 
 
+/*
+**  One newsgroup change of a "ctlinnd batch" transaction.
+*/
+typedef struct _GROUPCHANGE {
+  char			Type;	     /* SC_NEWGROUP, SC_RMGROUP, etc. */
+  char		     *  Name;
+  char		     *  Rest;	     /* New flags, NULL for rmgroup  */
+  const char	     *  Who;	     /* Creator, for newgroup        */
+  NEWSGROUP	     *  ngp;	     /* NULL for a new newsgroup     */
+  ARTNUM		Last;	     /* Set by ICDbatch              */
+} GROUPCHANGE;
+
+
 /*
 **  How a site is fed.
 */
@@ -484,8 +553,11 @@ typedef struct _SITE {
   char	      *   Entry;
   int		  NameLength;
   char	      **  Exclusions;
+  unsigned int	  NameHash;	/* ARThophash of Name */
+  unsigned int *  ExclusionHashes;	/* and of each of Exclusions */
   char	      **  Distributions;
   char	      **  Patterns;
+  struct wildmat *Wildmat;	/* ME and site patterns, compiled */
   bool		  Poison;
   bool		  PoisonEntry;
   bool		  Sendit;
@@ -499,6 +571,8 @@ typedef struct _SITE {
   bool		  FeedwithoutOriginator;
   bool		  DropFiltered;
   bool            FeedTrash;
+  bool		  JustModerated;
+  bool		  JustUnmoderated;
   int		  Hops;
   int		  Groupcount;
   int		  Followcount;
@@ -511,6 +585,7 @@ typedef struct _SITE {
   long		  StartWriting;
   long		  StopWriting;
   long		  StartSpooling;
+  unsigned long	  Sent;
   char	      *   Param;
   char		  FileFlags[FEED_MAXFLAGS + 1];
   long		  MaxSize;
@@ -527,6 +602,8 @@ typedef struct _SITE {
   size_t	  Flushpoint;
   struct buffer	  Buffer;
   bool		  Buffered;
+  unsigned long	  RingSize;
+  struct feedring *Ring;
   char	      **  Originator;
   HASHFEEDLIST *  HashFeedList;
   int		  Next;
@@ -596,10 +673,14 @@ enum timer {
 /*
 **  In-line macros for efficiency.
 **
-**  Set or append data to a channel's output buffer.
+**  Set or append data to a channel's output buffer.  Once COMPRESS is active
+**  on a channel, what is appended is deflated into it.
 */
 #define WCHANset(cp, p, l)      buffer_set(&(cp)->Out, (p), (l))
-#define WCHANappend(cp, p, l)   buffer_append(&(cp)->Out, (p), (l))
+#define WCHANappend(cp, p, l)                      \
+  ((cp)->ZOut == NULL                              \
+   ? buffer_ring_append(&(cp)->Out, (p), (l))      \
+   : CHANdeflate((cp), (p), (l)))
 
 /*
 **  Mark that an I/O error occurred, and block if we got too many.
@@ -628,6 +709,7 @@ extern bool		BufferedLogs;
 EXTERN bool		AnyIncoming;
 extern bool		Debug;
 EXTERN bool		ICDneedsetup;
+EXTERN bool		NeedArticle;
 EXTERN bool		NeedHeaders;
 EXTERN bool		NeedOverview;
 EXTERN bool		NeedPath;
@@ -663,6 +745,8 @@ EXTERN struct timeval	Now;		/* Reasonably accurate time     */
 EXTERN bool		ThrottledbyIOError;
 EXTERN char	    *   NCgreeting;
 EXTERN struct history   *History;
+EXTERN unsigned long	ARENAallocs;	/* Article scratch allocations */
+EXTERN unsigned long	ARENAmallocs;	/* ...which needed malloc      */
 
 /*
 ** Table size for limiting incoming connects.  Do not change the table
@@ -688,6 +772,7 @@ extern int		RemoteTotal;	/* Total limit. */
 */
 extern void	        InndHisOpen(void);
 extern void             InndHisClose(void);
+extern void             InndHisWarmup(void);
 extern bool             InndHisWrite(const char *key, time_t arrived,
 				     time_t posted, time_t expires,
 				     TOKEN *token);
@@ -696,7 +781,12 @@ extern void             InndHisLogStats(void);
 extern bool		FormatLong(char *p, unsigned long value, int width);
 extern bool		NeedShell(char *p, const char **av, const char **end);
 extern char	    **	CommaSplit(char *text);
-extern void		SetupListBuffer(int size, LISTBUFFER *list);
+extern void	    *	ARENAalloc(ARENA *arena, size_t size);
+extern void		ARENAreset(ARENA *arena);
+extern void		ARENAfree(ARENA *arena);
+extern void		SetupListBuffer(ARENA *arena, int size,
+					LISTBUFFER *list);
+extern void		GrowListBuffer(ARENA *arena, LISTBUFFER *list);
 extern char         *	MaxLength(const char *p, const char *q);
 extern pid_t		Spawn(int niceval, int fd0, int fd1, int fd2,
 			      char * const av[]);
@@ -712,8 +802,19 @@ extern bool		ARTreadschema(void);
 extern const char   *	ARTreadarticle(char *files);
 extern char	    *   ARTreadheader(char *files);
 extern bool		ARTpost(CHANNEL *cp);
+extern const ARTHEADER *ARTfindheader(const char *name, int len);
+extern unsigned int	ARThophash(const char *hop);
+extern void		ARTlatency(struct buffer *output, bool reset);
+extern bool		ARTbackpressure(void);
+extern bool		ARTfilter(CHANNEL *cp);
+extern bool		ARTfiltered(CHANNEL *cp, const char *pythonrc,
+				    const char *perlrc);
 extern void		ARTcancel(const ARTDATA *data,
 				  const char *MessageID, bool Trusted);
+extern bool		ARTcancelverify(const ARTDATA *data,
+					const char *MessageID, TOKEN token);
+extern void		ARTcanceltoken(const ARTDATA *data,
+				       const char *MessageID, TOKEN token);
 extern void		ARTclose(void);
 extern void		ARTsetup(void);
 extern void		ARTprepare(CHANNEL *cp);
@@ -721,7 +822,13 @@ extern void		ARTparse(CHANNEL *cp);
 extern void             ARTlogreject(CHANNEL *cp, const char *text);
 extern void		ARTreject(Reject_type, CHANNEL *);
 
+extern bool		CHANfdsetlimited(void);
+extern const char   *   CHANmethod(void);
 extern bool		CHANsleeping(CHANNEL *cp);
+extern bool		CHANcompress(CHANNEL *cp);
+extern void		CHANdeflate(CHANNEL *cp, const char *data,
+				    size_t length);
+extern void		CHANdeflateflush(CHANNEL *cp);
 extern bool             CHANsystemdsa(CHANNEL *cp);
 extern CHANNEL      *	CHANcreate(int fd, enum channel_type type,
 				   enum channel_state state,
@@ -731,11 +838,13 @@ extern CHANNEL      *	CHANiter(int *ip, enum channel_type type);
 extern CHANNEL      *	CHANfromdescriptor(int fd);
 extern char	    *   CHANname(CHANNEL *cp);
 extern int		CHANreadtext(CHANNEL *cp);
+extern void		CHANrelease(CHANNEL *cp);
 extern void		CHANclose(CHANNEL *cp, const char *name);
 extern void		CHANreadloop(void)
     __attribute__ ((__noreturn__));
 extern void		CHANsetup(int count);
 extern void		CHANshutdown(void);
+extern void		CHANtimerstats(struct buffer *out, bool reset);
 extern void		CHANtracing(CHANNEL *cp, bool flag);
 extern void		CHANcount_active(CHANNEL *cp);
 
@@ -758,11 +867,18 @@ extern const char   *	CCblock(OPERATINGMODE NewMode, char *reason);
 extern const char   *	CCcancel(char *av[]);
 extern const char   *	CCcheckfile(char *av[]);
 
+extern bool		ICDbatch(GROUPCHANGE *changes, int count);
 extern bool		ICDnewgroup(char *Name, char *Rest);
 extern char	    *   ICDreadactive(char **endp);
 extern bool		ICDchangegroup(NEWSGROUP *ngp, char *Rest);
 extern void		ICDclose(void);
+extern void		ICDmapactive(void);
+extern void		ICDmapgroup(NEWSGROUP *ngp, long lomark, int count);
+extern bool		ICDprotected(const char *Name);
 extern bool		ICDrenumberactive(void);
+extern bool		ICDrenumbering(void);
+extern void		ICDrenumberstart(void);
+extern void		ICDrenumberstep(void);
 extern bool		ICDrmgroup(NEWSGROUP *ngp);
 extern void		ICDsetup(bool StartSites);
 extern void		ICDwrite(void);
@@ -771,25 +887,51 @@ extern void		ICDwriteactive(void);
 extern void		CCclose(void);
 extern void		CCsetup(void);
 
-extern void             KEYgenerate(HDRCONTENT *, const char *, size_t);
+extern void		FLTQsetup(void);
+extern bool		FLTQsubmit(CHANNEL *cp);
+extern void		FLTQforget(CHANNEL *cp);
+extern void		FLTQrestart(void);
+extern void		FLTQclose(void);
+
+extern void		LOGWsetup(void);
+extern bool		LOGWrotate(FILE *F);
+
+extern void             KEYgenerate(ARENA *, HDRCONTENT *, const char *,
+                                    size_t);
 
 extern void		LCclose(void);
 extern void		LCsetup(void);
 
-extern int		NGsplit(char *p, int size, LISTBUFFER *list);
+extern int		NGsplit(ARENA *arena, char *p, int size,
+				LISTBUFFER *list);
 extern NEWSGROUP    *	NGfind(const char *Name);
 extern void		NGclose(void);
 extern CHANNEL	    *	NCcreate(int fd, bool MustAuthorize, bool IsLocal);
 extern void		NGparsefile(void);
+extern bool		NGappend(const char *old, char *active, char *end);
 extern bool		NGrenumber(NEWSGROUP *ngp);
 extern bool		NGlowmark(NEWSGROUP *ngp, long lomark);
 
 extern void		NCclearwip(CHANNEL *cp);
 extern void		NCclose(void);
+extern void		NCfiltered(CHANNEL *cp, bool accepted);
 extern void		NCsetup(void);
 extern void		NCwritereply(CHANNEL *cp, const char *text);
 extern void		NCwriteshutdown(CHANNEL *cp, const char *text);
 
+extern bool		CANQadd(const ARTDATA *data, const char *MessageID,
+				TOKEN token, bool verify);
+extern bool		CANQpending(void);
+extern void		CANQstep(bool idle);
+extern void		CANQflush(void);
+extern void		CANQclose(void);
+
+extern void		OVQsetup(void);
+extern bool		OVQadd(TOKEN token, const char *data, int len,
+			       time_t arrived, time_t expires);
+extern void		OVQsync(void);
+extern void		OVQclose(void);
+
 /* perl.c */
 extern char	    *	PLartfilter(const ARTDATA *Data, char *artBody, long artLen, int lines);
 extern char	    *   PLmidfilter(char *messageID);
@@ -810,12 +952,15 @@ extern bool		RCauthorized(CHANNEL *cp, char *pass);
 extern int		RCcanpost(CHANNEL *cp, char *group);
 extern char	    *	RChostname(const CHANNEL *cp);
 extern char	    *	RClabelname(CHANNEL *cp);
+extern void		RCidentclose(CHANNEL *cp);
+extern void		RCidentforget(CHANNEL *cp);
 extern void		RCclose(void);
 extern void		RChandoff(int fd, HANDOFF h);
 extern void		RCreadlist(void);
 extern void		RCsetup(void);
 
 extern bool		SITEfunnelpatch(void);
+extern void		SITEsubscribe(NEWSGROUP *ngp);
 extern bool		SITEsetup(SITE *sp);
 extern bool		SITEwantsgroup(SITE *sp, char *name);
 extern bool		SITEpoisongroup(SITE *sp, char *name);
@@ -836,8 +981,10 @@ extern void		SITEprocdied(SITE *sp, int process, PROCESS *pp);
 extern void		SITEsend(SITE *sp, ARTDATA *Data);
 extern void		SITEwrite(SITE *sp, const char *text);
 
+extern void		STATUSclose(void);
 extern void		STATUSinit(void);
 extern void		STATUSmainloophook(void);
+extern void		STATUSsetup(void);
 
 extern void		WIPsetup(void);
 extern WIP	    *	WIPnew(const char *messageid, CHANNEL *cp);
@@ -25,8 +25,8 @@
 */
 #if !DO_KEYWORDS
 void
-KEYgenerate(HDRCONTENT *hc UNUSED, const char *body UNUSED,
-            size_t bodylen UNUSED)
+KEYgenerate(ARENA *arena UNUSED, HDRCONTENT *hc UNUSED,
+            const char *body UNUSED, size_t bodylen UNUSED)
 {
 }
 
@@ -93,6 +93,7 @@ ptr_strcmp(const void *p1, const void *p2)
 
 void
 KEYgenerate(
+    ARENA	*arena,         /* Scratch memory of the article. */
     HDRCONTENT	*hc,            /* Header data. */
     const char	*body,          /* Article body. */
     size_t      bodylen)        /* Article body length. */
@@ -100,7 +101,7 @@ KEYgenerate(
 
     unsigned long word_count, word_index, word_length, distinct_words;
     int		last;
-    char	*text, *orig_text, *text_end, *this_word, *chase, *punc;
+    char	*text, *text_end, *this_word, *chase, *punc;
     static struct word_entry	*word_vec;
     static char		**word;
     static const char	*whitespace  = " \t\r\n";
@@ -132,7 +133,7 @@ KEYgenerate(
 
     /* Initialize a fresh Keywords: value, limited to the size
      * specified by the keylimit parameter in inn.conf. */
-    hc->Value = xmalloc(innconf->keylimit + 1);
+    hc->Value = ARENAalloc(arena, innconf->keylimit + 1);
     *hc->Value = '\0';
     hc->Length = 0;
 
@@ -141,11 +142,10 @@ KEYgenerate(
     if ((bodylen < 100) || (bodylen > innconf->keyartlimit)) /* Too small/big to bother. */
 	return;
 
-    /* Nul-terminate the body.  orig_text will be freed later. */
-    orig_text = xmalloc(bodylen + 1);
-    memcpy(orig_text, body, bodylen);
-    orig_text[bodylen] = '\0';
-    text = orig_text;
+    /* Nul-terminate the body. */
+    text = ARENAalloc(arena, bodylen + 1);
+    memcpy(text, body, bodylen);
+    text[bodylen] = '\0';
 
     text_end = text + bodylen;
 
@@ -189,7 +189,7 @@ KEYgenerate(
 
     /* If there were no words, we're done. */
     if (word_count < 1)
-	goto out;
+	return;
 
     /* Sort the words. */
     qsort(word, word_count, sizeof(word[0]), ptr_strcmp);
@@ -258,10 +258,6 @@ KEYgenerate(
     }
 
     hc->Length = strlen(hc->Value);
-
-out:
-    /* We must dispose of the original strdup'd text area. */
-    free(orig_text);
 }
 
 #endif /* DO_KEYWORDS */
@@ -1,8 +1,9 @@
 /*
 **  Routines for the local connect channel.  Create a Unix-domain stream
 **  socket that processes on the local server connect to.  Once the
-**  connection is set up, we speak NNTP.  The connect channel is used only
-**  by rnews to feed in articles from the UUCP sites.
+**  connection is set up, we speak NNTP.  The connect channel is used by
+**  rnews to feed in articles from the UUCP sites, and by nntpget, which
+**  streams them.
 */
 
 #include "config.h"
@@ -39,6 +40,7 @@ LCreader(CHANNEL *cp)
 	return;
     }
     if ((new = NCcreate(fd, false, true)) != NULL) {
+	new->Streaming = true;
 	memset( &new->Address, 0, sizeof( new->Address ) );
 	syslog(L_NOTICE, "%s connected %d", "localhost", new->fd);
 	NCwritereply(new, (char *)NCgreeting);
@@ -0,0 +1,412 @@
+/*
+**  The log writer.
+**
+**  When logwriter is set in inn.conf, the news log and the error log are
+**  not written by innd itself but by a child process, so that a slow disk
+**  under pathlog no longer holds up the whole server.  stdout and stderr of
+**  innd become pipes to the writer, which gathers what comes in and writes
+**  it out in large batches, forcing it to disk every logsync seconds when
+**  that parameter is set.  Since innd only ever blocks when the writer has
+**  fallen a whole pipe behind, the pipes are made as large as the system
+**  allows.
+**
+**  The writer also has a socket to innd, an ordinary channel of type
+**  CTlogger, on which ReopenLog asks it to rotate a log; innd waits for the
+**  answer, so that the old log is complete when ctlinnd flushlogs returns.
+**  If the writer dies, innd writes its logs directly again.  The writer
+**  goes away once innd and all the processes sharing its stdout and stderr
+**  are gone.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/socket.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/select.h>
+
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "inn/paths.h"
+#include "innd.h"
+
+/* Size at which what was gathered for a log is written out, how long a
+   smaller batch may wait, and the size asked for the pipes. */
+#define LOGW_BATCH      (64 * 1024)
+#define LOGW_DELAY      1
+#define LOGW_PIPESIZE   (1024 * 1024)
+
+struct logw_file {
+    const char *name;           /* Name of the log under pathlog. */
+    char command;               /* Byte asking to rotate it. */
+    int in;                     /* Our end of its pipe, -1 at end of file. */
+    int out;                    /* The log itself. */
+    struct buffer data;
+    time_t since;               /* When the oldest data gathered came. */
+    bool dirty;                 /* Written since it was last synced. */
+};
+
+static CHANNEL *LOGWchannel = NULL;
+
+static void LOGWreader(CHANNEL *cp);
+static void LOGWwritedone(CHANNEL *cp);
+
+
+/*
+**  Write out what was gathered for a log.
+*/
+static void
+LOGWwrite(struct logw_file *lp)
+{
+    if (lp->data.left == 0)
+        return;
+    if (xwrite(lp->out, lp->data.data + lp->data.used, lp->data.left) < 0)
+        syslog(L_ERROR, "%s cant write %s %m", LogName, lp->name);
+    lp->data.used = 0;
+    lp->data.left = 0;
+    lp->dirty = true;
+}
+
+
+/*
+**  Force a log to disk if logsync asks for it.
+*/
+static void
+LOGWsync(struct logw_file *lp)
+{
+    if (innconf->logsync == 0 || !lp->dirty)
+        return;
+    if (fsync(lp->out) < 0)
+        syslog(L_ERROR, "%s cant fsync %s %m", LogName, lp->name);
+    lp->dirty = false;
+}
+
+
+/*
+**  Read what is waiting in the pipe of a log.  Returns false once there is
+**  nothing more to read for now.
+*/
+static bool
+LOGWfill(struct logw_file *lp)
+{
+    ssize_t count;
+
+    if (lp->in < 0)
+        return false;
+    if (lp->data.left == 0)
+        lp->since = time(NULL);
+    if (lp->data.size - lp->data.left < LOGW_BATCH)
+        buffer_resize(&lp->data, lp->data.left + LOGW_BATCH);
+    count = read(lp->in, lp->data.data + lp->data.left,
+                 lp->data.size - lp->data.left);
+    if (count < 0 && (errno == EINTR || errno == EAGAIN))
+        return false;
+    if (count <= 0) {
+        if (count < 0)
+            syslog(L_ERROR, "%s cant read %s pipe %m", LogName, lp->name);
+        close(lp->in);
+        lp->in = -1;
+        return false;
+    }
+    lp->data.left += count;
+    return true;
+}
+
+
+/*
+**  Rotate a log:  write out everything innd sent before asking, then move
+**  the log aside and start a new one.
+*/
+static void
+LOGWrotatefile(struct logw_file *lp)
+{
+    char *path, *oldpath;
+    int fd;
+
+    while (LOGWfill(lp))
+        ;
+    LOGWwrite(lp);
+    LOGWsync(lp);
+    path = concatpath(innconf->pathlog, lp->name);
+    oldpath = concat(path, ".old", (char *) 0);
+    if (rename(path, oldpath) < 0)
+        syslog(L_ERROR, "%s cant rename %s to %s %m", LogName, path, oldpath);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        syslog(L_ERROR, "%s cant open %s %m", LogName, path);
+    else {
+        close(lp->out);
+        lp->out = fd;
+        lp->dirty = false;
+    }
+    free(oldpath);
+    free(path);
+}
+
+
+/*
+**  The main loop of the writer.
+*/
+static void
+LOGWmain(struct logw_file *files, size_t nfiles, int fd)
+{
+    struct logw_file *lp;
+    struct timeval tv, *tvp;
+    fd_set rmask;
+    time_t now, synced;
+    char command;
+    ssize_t count;
+    size_t i;
+    int maxfd;
+
+    synced = time(NULL);
+    for (;;) {
+        FD_ZERO(&rmask);
+        maxfd = -1;
+        tvp = NULL;
+        if (fd >= 0) {
+            FD_SET(fd, &rmask);
+            maxfd = fd;
+        }
+        for (i = 0, lp = files; i < nfiles; i++, lp++) {
+            if (lp->in >= 0) {
+                FD_SET(lp->in, &rmask);
+                if (lp->in > maxfd)
+                    maxfd = lp->in;
+            }
+            if (lp->data.left > 0 || (lp->dirty && innconf->logsync > 0))
+                tvp = &tv;
+        }
+        if (maxfd < 0)
+            break;
+        tv.tv_sec = LOGW_DELAY;
+        tv.tv_usec = 0;
+        if (select(maxfd + 1, &rmask, NULL, NULL, tvp) < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(L_ERROR, "%s cant select %m", LogName);
+            break;
+        }
+
+        now = time(NULL);
+        for (i = 0, lp = files; i < nfiles; i++, lp++) {
+            if (lp->in >= 0 && FD_ISSET(lp->in, &rmask))
+                LOGWfill(lp);
+            if (lp->data.left >= LOGW_BATCH || lp->in < 0
+                || (lp->data.left > 0 && lp->since + LOGW_DELAY <= now))
+                LOGWwrite(lp);
+        }
+        if (innconf->logsync > 0
+            && synced + (time_t) innconf->logsync <= now) {
+            for (i = 0; i < nfiles; i++)
+                LOGWsync(&files[i]);
+            synced = now;
+        }
+
+        /* Requests from innd come last, so that all that innd wrote before
+           asking is already gathered. */
+        if (fd >= 0 && FD_ISSET(fd, &rmask)) {
+            count = read(fd, &command, 1);
+            if (count < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (count <= 0) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            for (i = 0; i < nfiles; i++)
+                if (files[i].command == command)
+                    LOGWrotatefile(&files[i]);
+            if (xwrite(fd, &command, 1) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    for (i = 0; i < nfiles; i++) {
+        LOGWwrite(&files[i]);
+        LOGWsync(&files[i]);
+    }
+    _exit(0);
+}
+
+
+/*
+**  Start the writer if logwriter asks for it.  Called once the logs are
+**  opened as stdout and stderr and the channels are set up.
+*/
+void
+LOGWsetup(void)
+{
+    static const int signals[] = { SIGHUP, SIGINT, SIGTERM, SIGUSR1 };
+    static struct logw_file files[2];
+    int logfds[2], errfds[2], fds[2];
+    size_t i;
+    pid_t pid;
+
+    if (Debug || !innconf->logwriter)
+        return;
+    if (pipe(logfds) < 0) {
+        syslog(L_ERROR, "%s cant pipe for log writer %m", LogName);
+        return;
+    }
+    if (pipe(errfds) < 0) {
+        syslog(L_ERROR, "%s cant pipe for log writer %m", LogName);
+        close(logfds[0]);
+        close(logfds[1]);
+        return;
+    }
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        syslog(L_ERROR, "%s cant socketpair for log writer %m", LogName);
+        close(logfds[0]);
+        close(logfds[1]);
+        close(errfds[0]);
+        close(errfds[1]);
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+        syslog(L_ERROR, "%s cant fork log writer %m", LogName);
+        close(logfds[0]);
+        close(logfds[1]);
+        close(errfds[0]);
+        close(errfds[1]);
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    /* The writer keeps the logs open by innd and the other ends of the
+       pipes.  It only goes away once all of them are closed, whatever
+       signal is sent to the process group of innd. */
+    if (pid == 0) {
+        xsignal_forked();
+        for (i = 0; i < ARRAY_SIZE(signals); i++)
+            xsignal(signals[i], SIG_IGN);
+        xsignal(SIGCHLD, SIG_DFL);
+        close(logfds[1]);
+        close(errfds[1]);
+        close(fds[0]);
+        files[0].name = INN_PATH_LOGFILE;
+        files[0].command = 'l';
+        files[0].in = logfds[0];
+        files[0].out = STDOUT_FILENO;
+        files[1].name = INN_PATH_ERRLOG;
+        files[1].command = 'e';
+        files[1].in = errfds[0];
+        files[1].out = STDERR_FILENO;
+        fdflag_nonblocking(logfds[0], true);
+        fdflag_nonblocking(errfds[0], true);
+        LOGWmain(files, ARRAY_SIZE(files), fds[1]);
+    }
+
+    close(logfds[0]);
+    close(errfds[0]);
+    close(fds[1]);
+#ifdef F_SETPIPE_SZ
+    fcntl(logfds[1], F_SETPIPE_SZ, LOGW_PIPESIZE);
+    fcntl(errfds[1], F_SETPIPE_SZ, LOGW_PIPESIZE);
+#endif
+    if (dup2(logfds[1], STDOUT_FILENO) < 0 || dup2(errfds[1], STDERR_FILENO) < 0)
+        sysdie("SERVER cant dup2 log writer pipes");
+    close(logfds[1]);
+    close(errfds[1]);
+    fdflag_close_exec(fds[0], true);
+    LOGWchannel = CHANcreate(fds[0], CTlogger, CSwaiting, LOGWreader,
+                             LOGWwritedone);
+    RCHANadd(LOGWchannel);
+    syslog(L_NOTICE, "%s log writer %ld started", LogName, (long) pid);
+}
+
+
+/*
+**  Write a log directly again, after the writer is gone.
+*/
+static void
+LOGWdirect(FILE *F)
+{
+    char *path;
+
+    path = concatpath(innconf->pathlog,
+                      (F == stdout) ? INN_PATH_LOGFILE : INN_PATH_ERRLOG);
+    if (freopen(path, "a", F) != F)
+        sysdie("SERVER cant freopen %s", path);
+    free(path);
+    if (BufferedLogs)
+        setvbuf(F, NULL, (F == stdout) ? _IOFBF : _IOLBF, LOG_BUFSIZ);
+}
+
+
+/*
+**  The writer died or stopped answering.  What is still in its pipes is
+**  lost.
+*/
+static void
+LOGWdied(void)
+{
+    syslog(L_ERROR, "%s log writer died, writing logs directly", LogName);
+    CHANclose(LOGWchannel, CHANname(LOGWchannel));
+    LOGWchannel = NULL;
+    fflush(stdout);
+    fflush(stderr);
+    LOGWdirect(stdout);
+    LOGWdirect(stderr);
+}
+
+
+/*
+**  Ask the writer to rotate a log, and wait for it to be done.  Returns
+**  false if there is no writer, in which case innd rotates the log itself.
+*/
+bool
+LOGWrotate(FILE *F)
+{
+    char command, answer;
+    int fd;
+
+    if (LOGWchannel == NULL)
+        return false;
+    command = (F == stdout) ? 'l' : 'e';
+    fd = LOGWchannel->fd;
+    if (fflush(F) == EOF || xwrite(fd, &command, 1) < 0
+        || !fdflag_nonblocking(fd, false)
+        || read(fd, &answer, 1) != 1 || answer != command
+        || !fdflag_nonblocking(fd, true)) {
+        LOGWdied();
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  The writer only answers LOGWrotate, which reads the answer itself, so
+**  reading from its socket here means that it went away.
+*/
+static void
+LOGWreader(CHANNEL *cp)
+{
+    int count;
+
+    count = CHANreadtext(cp);
+    if (count == -2)
+        return;
+    if (count <= 0) {
+        LOGWdied();
+        return;
+    }
+    cp->In.used = 0;
+}
+
+
+/*
+**  Nothing is ever queued for writing on the socket of the writer.
+*/
+static void
+LOGWwritedone(CHANNEL *cp UNUSED)
+{
+}
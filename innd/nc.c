@@ -13,6 +13,9 @@
 
 #define BAD_COMMAND_COUNT	10
 
+/* Most CHECK commands looked up in history at once. */
+#define CHECK_BATCH		64
+
 
 extern bool laxmid;
 
@@ -35,6 +38,9 @@ static void NCauthinfo       (CHANNEL *cp);
 static void NCcancel         (CHANNEL *cp);
 static void NCcapabilities   (CHANNEL *cp);
 static void NCcheck          (CHANNEL *cp);
+#if defined(HAVE_ZLIB)
+static void NCcompress       (CHANNEL *cp);
+#endif
 static void NChead           (CHANNEL *cp);
 static void NChelp           (CHANNEL *cp);
 static void NCihave          (CHANNEL *cp);
@@ -53,6 +59,10 @@ static void NC_unimp         (CHANNEL *cp);
 
 /* Supporting functions. */
 static void NCwritedone      (CHANNEL *cp);
+static void NCposted         (CHANNEL *cp, bool accepted);
+static void NCproc           (CHANNEL *cp);
+static void NCprocess        (CHANNEL *cp);
+static void NCwriteout       (CHANNEL *cp, bool pending);
 
 /* Set up the dispatch table for all of the commands. */
 #define NC_any -1
@@ -66,6 +76,10 @@ static NCDISPATCH NCcommands[] = {
             "[keyword]"),
     COMMAND("CHECK",         NCcheck,         true,  2,  2, false,
             "message-ID"),
+#if defined(HAVE_ZLIB)
+    COMMAND("COMPRESS",      NCcompress,      true,  2,  2, true,
+            "DEFLATE"),
+#endif
     COMMAND("HEAD",          NChead,          true,  1,  2, true,
             "message-ID"),
     COMMAND("HELP",          NChelp,          false, 1,  1, true,
@@ -89,9 +103,6 @@ static NCDISPATCH NCcommands[] = {
        READER command. */
     COMMAND_READER("ARTICLE"),
     COMMAND_READER("BODY"),
-#if defined(HAVE_ZLIB)
-    COMMAND_READER("COMPRESS"),
-#endif /* HAVE_ZLIB */
     COMMAND_READER("DATE"),
     COMMAND_READER("GROUP"),
     COMMAND_READER("HDR"),
@@ -124,6 +135,17 @@ static char		*NCquietlist[] = { INND_QUIET_BADLIST };
 static const char	NCterm[] = "\r\n";
 static const char 	NCdot[] = "." ;
 
+/* The answers of history for the CHECK commands in the input buffer, in
+   the order of the commands; only valid during one call to NCproc. */
+static HASH		NCbatchhash[CHECK_BATCH];
+static bool		NCbatchfound[CHECK_BATCH];
+static size_t		NCbatchcount;
+static size_t		NCbatchnext;
+
+/* The channel whose input NCproc is processing; its replies are gathered
+   and written at once when it is done. */
+static CHANNEL		*NCgather;
+
 /*
 ** Clear the WIP entry for the given channel.
 */
@@ -147,39 +169,57 @@ NCclearwip(CHANNEL *cp)
 **  If the reply that we are writing now is associated with a state change,
 **  then cp->State must be set to its new value *before* NCwritereply is
 **  called.
+**
+**  While NCproc is processing the input of the channel, the reply is only
+**  buffered, so that the replies to all the commands a peer sent at once go
+**  out in a single write when NCproc is done.
 */
 void
 NCwritereply(CHANNEL *cp, const char *text)
 {
-    struct buffer *bp;
-    int i;
+    bool pending;
 
     /* XXX could do RCHANremove(cp) here, as the old NCwritetext() used to
      * do, but that would be wrong if the channel is streaming (because it
      * would zap the channel's input buffer).  There's no harm in
      * never calling RCHANremove here.  */
 
-    bp = &cp->Out;
-    i = bp->left;
+    pending = (cp->Out.left != 0);
     WCHANappend(cp, text, strlen(text));	/* Text in buffer. */
     WCHANappend(cp, NCterm, strlen(NCterm));	/* Add CR LF to text. */
 
-    if (i == 0) {	/* If only new data, then try to write directly. */
-	i = write(cp->fd, &bp->data[bp->used], bp->left);
+    if (cp != NCgather)
+        NCwriteout(cp, pending);
+    if (Tracing || cp->Tracing)
+	syslog(L_TRACE, "%s > %s", CHANname(cp), text);
+}
+
+/*
+**  Write the buffered replies of a channel.  If no output was pending
+**  before them, try to write them directly as described above.
+*/
+static void
+NCwriteout(CHANNEL *cp, bool pending)
+{
+    struct buffer *bp;
+    const char *p;
+    size_t length;
+    ssize_t i;
+
+    if (cp->ZFlush)
+        CHANdeflateflush(cp);
+    bp = &cp->Out;
+    if (!pending) {	/* If only new data, then try to write directly. */
+	p = &bp->data[bp->used];
+	length = bp->left;
+	i = buffer_ring_write(bp, cp->fd);
 	if (Tracing || cp->Tracing)
-	    syslog(L_TRACE, "%s NCwritereply %d=write(%d, \"%.15s\", %lu)",
-		CHANname(cp), i, cp->fd, &bp->data[bp->used],
-		(unsigned long) bp->left);
-	if (i > 0)
-            bp->used += i;
-	if (bp->used == bp->left) {
+	    syslog(L_TRACE, "%s NCwritereply %ld=write(%d, \"%.15s\", %lu)",
+		CHANname(cp), (long) i, cp->fd, p, (unsigned long) length);
+	if (i > 0 && bp->left == 0) {
 	    /* All the data was written. */
-	    bp->used = bp->left = 0;
 	    NCwritedone(cp);
 	} else {
-            if (i > 0) {
-                bp->left -= i;
-            }
             i = 0;
         }
     } else {
@@ -188,8 +228,6 @@ NCwritereply(CHANNEL *cp, const char *text)
     if (i <= 0) {	/* Write failed, queue it for later. */
 	WCHANadd(cp);
     }
-    if (Tracing || cp->Tracing)
-	syslog(L_TRACE, "%s > %s", CHANname(cp), text);
 }
 
 /*
@@ -217,8 +255,8 @@ NCwriteshutdown(CHANNEL *cp, const char *text)
 static void
 NCpostit(CHANNEL *cp)
 {
-  const char	*response;
   char	buff[SMBUF];
+  bool	accepted;
 
   if (Mode == OMthrottled) {
     cp->Reported++;
@@ -252,7 +290,30 @@ NCpostit(CHANNEL *cp)
   }
 
   /* Note that some use break, some use return here. */
-  if (ARTpost(cp)) {
+  accepted = ARTpost(cp);
+
+  /* The article went to a filter worker; NCfiltered will be called with the
+   * verdict.  Stop reading from the channel until then, so that the article
+   * stays where it is in the input buffer. */
+  if (cp->State == CSfiltering) {
+    RCHANremove(cp);
+    return;
+  }
+  NCposted(cp, accepted);
+}
+
+
+/*
+**  Send the response to IHAVE or TAKETHIS once the article has been posted
+**  or rejected, and log a checkpoint if it is time to.
+*/
+static void
+NCposted(CHANNEL *cp, bool accepted)
+{
+  const char	*response;
+  char	buff[SMBUF];
+
+  if (accepted) {
     cp->Received++;
     if (cp->Sendid.size > 3) { /* We are streaming. */
       cp->Takethis_Ok++;
@@ -307,6 +368,21 @@ NCpostit(CHANNEL *cp)
 }
 
 
+/*
+**  Called with the outcome of an article handed to a filter worker.  Answer
+**  it, and go on with whatever the peer sent in the meantime.
+*/
+void
+NCfiltered(CHANNEL *cp, bool accepted)
+{
+  NCposted(cp, accepted);
+  NCclearwip(cp);
+  cp->Start = cp->Next;
+  RCHANadd(cp);
+  NCproc(cp);
+}
+
+
 /*
 **  Write-done function.  Close down or set state for what we expect to
 **  read next.
@@ -334,6 +410,10 @@ NCwritedone(CHANNEL *cp)
     case CScancel:
 	RCHANadd(cp);
 	break;
+
+    case CSfiltering:
+	/* Reading resumes with the filter verdict. */
+	break;
     }
 }
 
@@ -602,6 +682,11 @@ NCcapabilities(CHANNEL *cp)
         WCHANappend(cp, NCterm, strlen(NCterm));
     }
 
+    if (cp->IsAuthenticated && cp->Compress && cp->ZOut == NULL) {
+        WCHANappend(cp, "COMPRESS DEFLATE", 16);
+        WCHANappend(cp, NCterm, strlen(NCterm));
+    }
+
     if (cp->IsAuthenticated) {
         WCHANappend(cp, "IHAVE", 5);
         WCHANappend(cp, NCterm, strlen(NCterm));
@@ -632,6 +717,53 @@ NCcapabilities(CHANNEL *cp)
 }
 
 
+#if defined(HAVE_ZLIB)
+/*
+**  The COMPRESS command (RFC 8054), for the peers allowed to use it in
+**  incoming.conf.  The reply is sent in clear, and everything after it is
+**  compressed both ways.
+*/
+static void
+NCcompress(CHANNEL *cp)
+{
+    char buff[SMBUF];
+
+    cp->Start = cp->Next;
+
+    if (strcasecmp(cp->av[1], "DEFLATE") != 0) {
+        snprintf(buff, sizeof(buff),
+                 "%d Only the DEFLATE compression algorithm is supported",
+                 NNTP_ERR_UNAVAILABLE);
+        NCwritereply(cp, buff);
+        return;
+    }
+    if (!cp->Compress) {
+        snprintf(buff, sizeof(buff), "%d Compression not allowed",
+                 NNTP_ERR_ACCESS);
+        NCwritereply(cp, buff);
+        return;
+    }
+    if (cp->ZOut != NULL) {
+        snprintf(buff, sizeof(buff), "%d Already using a compression layer",
+                 NNTP_ERR_ACCESS);
+        NCwritereply(cp, buff);
+        return;
+    }
+
+    snprintf(buff, sizeof(buff), "%d Compression now active",
+             NNTP_OK_COMPRESS);
+    NCwritereply(cp, buff);
+    if (!CHANcompress(cp)) {
+        syslog(L_ERROR, "%s cant start compression", CHANname(cp));
+        NCwriteshutdown(cp, "Cannot start compression");
+        return;
+    }
+    syslog(L_NOTICE, "%s NCcompress \"COMPRESS DEFLATE\" received",
+           CHANname(cp));
+}
+#endif /* HAVE_ZLIB */
+
+
 /*
 **  The IHAVE command.  Check the message-ID, and see if we want the
 **  article or not.  Set the state appropriately.
@@ -747,6 +879,12 @@ NCihave(CHANNEL *cp)
             NCwritereply(cp, buff);
             free(buff);
 	}
+    } else if (cp->Backpressure && ARTbackpressure()) {
+        cp->Ihave_Deferred++;
+        xasprintf(&buff, "%d Storage busy, retry later",
+                  NNTP_FAIL_IHAVE_DEFER);
+        NCwritereply(cp, buff);
+        free(buff);
     } else {
 	if (cp->Sendid.size > 0) {
             free(cp->Sendid.data);
@@ -970,6 +1108,13 @@ NCmode(CHANNEL *cp)
         /* MODE READER. */
         syslog(L_NOTICE, "%s NCmode \"MODE READER\" received",
                CHANname(cp));
+        if (cp->ZIn != NULL) {
+            /* nnrpd could not take over the compressed stream. */
+            snprintf(buff, sizeof(buff), "%d Compression is active",
+                     NNTP_ERR_ACCESS);
+            NCwritereply(cp, buff);
+            return;
+        }
         if (!cp->CanAuthenticate) {
             /* AUTHINFO has already been successfully used. */
             snprintf(buff, sizeof(buff), "%d Already authenticated as a feeder",
@@ -1011,7 +1156,9 @@ NCmode(CHANNEL *cp)
         return;
     }
 
-    /* Hand off if reached. */
+    /* Hand off if reached, once the replies gathered so far are sent. */
+    if (cp->Out.left > 0 && cp->Out.used == 0)
+        NCwriteout(cp, false);
     RChandoff(cp->fd, h);
     if (NCcount > 0)
         NCcount--;
@@ -1076,12 +1223,101 @@ NC_unimp(CHANNEL *cp)
 
 
 
+/*
+**  Look up in history at once the message-IDs of the CHECK commands that
+**  follow in the input buffer of a streaming channel, so that NCcheck finds
+**  the answers ready.  Stops at the first incomplete line or other command.
+*/
+static void
+NCcheckahead(CHANNEL *cp)
+{
+    static struct buffer ids;
+    const char *keys[CHECK_BATCH];
+    struct buffer *bp = &cp->In;
+    size_t start, end, i, n;
+    char *p;
+
+    NCbatchcount = NCbatchnext = 0;
+    if (StreamingOff || !cp->Streaming || Mode != OMrunning)
+        return;
+    buffer_set(&ids, NULL, 0);
+    for (start = cp->Start, n = 0; n < CHECK_BATCH; start = end + 1) {
+        p = memchr(&bp->data[start], '\n', bp->used - start);
+        if (p == NULL)
+            break;
+        end = p - bp->data;
+        if (end - start < 7 || strncasecmp(&bp->data[start], "CHECK", 5) != 0
+            || !ISWHITE(bp->data[start + 5]))
+            break;
+        for (i = start + 5; i < end && ISWHITE(bp->data[i]); i++)
+            ;
+        p = &bp->data[end];
+        if (p[-1] == '\r')
+            p--;
+        if (&bp->data[i] >= p || p - &bp->data[i] > NNTP_MAXLEN_ARG)
+            break;
+        buffer_append(&ids, &bp->data[i], p - &bp->data[i]);
+        buffer_append(&ids, "", 1);
+        n++;
+    }
+    if (n < 2)
+        return;
+
+    /* The buffer may have moved while growing, so point at the keys now. */
+    for (i = 0, p = ids.data; i < n; i++, p += strlen(p) + 1) {
+        keys[i] = p;
+        NCbatchhash[i] = HashMessageID(p);
+    }
+    if (HIScheckbatch(History, keys, n, NCbatchfound))
+        NCbatchcount = n;
+}
+
+/*
+**  Return the answer of history looked up by NCcheckahead for the
+**  message-ID of a CHECK command, or -1 if there is none.  Answers for
+**  commands that didn't get to NCcheck are skipped.
+*/
+static int
+NCbatched(const char *msgid)
+{
+    HASH hash;
+    size_t i;
+
+    if (NCbatchnext >= NCbatchcount)
+        return -1;
+    hash = HashMessageID(msgid);
+    for (i = NCbatchnext; i < NCbatchcount; i++)
+        if (HashCompare(&hash, &NCbatchhash[i]) == 0) {
+            NCbatchnext = i + 1;
+            return NCbatchfound[i];
+        }
+    return -1;
+}
+
+/*
+**  Process whatever data is available on the channel, gathering the replies
+**  to all the commands found there, and write them at once.
+*/
+static void
+NCproc(CHANNEL *cp)
+{
+    CHANNEL *previous = NCgather;
+    bool pending = (cp->Out.left != 0);
+    size_t left = cp->Out.left;
+
+    NCgather = cp;
+    NCprocess(cp);
+    NCgather = previous;
+    if (previous != cp && cp->Type != CTfree && cp->Out.left > left)
+        NCwriteout(cp, pending);
+}
+
 /*
 **  Check whatever data is available on the channel.  If we got the
 **  full amount (i.e., the command or the whole article) process it.
 */
 static void
-NCproc(CHANNEL *cp)
+NCprocess(CHANNEL *cp)
 {
   char	        *p, *q;
   NCDISPATCH   	*dp;
@@ -1102,6 +1338,7 @@ NCproc(CHANNEL *cp)
            (unsigned long) cp->In.used);
 
   bp = &cp->In;
+  NCbatchcount = NCbatchnext = 0;
   if (bp->used == 0)
     return;
 
@@ -1122,12 +1359,18 @@ NCproc(CHANNEL *cp)
       break;
 
     case CSwritegoodbye:
+    case CSfiltering:
       movedata = false;
       readmore = true;
       break;
 
     case CSgetcmd:
     case CScancel:
+      /* Look up the next CHECK commands at once when the previous ones
+       * have all been answered. */
+      if (cp->State == CSgetcmd && NCbatchnext >= NCbatchcount)
+        NCcheckahead(cp);
+
       /* Did we get the whole command, terminated with "\r\n"? */
       for (i = cp->Next; (i < bp->used) && (bp->data[i] != '\n'); i++) ;
       if (i == bp->used) {
@@ -1469,6 +1712,12 @@ NCproc(CHANNEL *cp)
 	cp->Argument = NULL;
       }
       NCpostit(cp);
+      /* Keep the work-in-progress entry while a filter worker looks at the
+       * article. */
+      if (cp->State == CSfiltering) {
+	readmore = true;
+	break;
+      }
       /* Clear the work-in-progress entry. */
       NCclearwip(cp);
       if (cp->State == CSwritegoodbye)
@@ -1645,6 +1894,16 @@ NCproc(CHANNEL *cp)
 }
 
 
+/*
+**  Wake up a channel which stopped reading while storage was slow.
+*/
+static void
+NCbackpressurewake(CHANNEL *cp)
+{
+    RCHANadd(cp);
+}
+
+
 /*
 **  Read whatever data is available on the channel.  If we got the
 **  full amount (i.e., the command or the whole article) process it.
@@ -1658,6 +1917,16 @@ NCreader(CHANNEL *cp)
 	syslog(L_TRACE, "%s NCreader Used=%lu",
 	    CHANname(cp), (unsigned long) cp->In.used);
 
+    /* A peer marked with backpressure is not read for a second while storage
+     * is slower than backpressurelatency, unless replies are still waiting
+     * to be written (the channel may then have to sleep for writing). */
+    if (cp->Backpressure && ARTbackpressure() && cp->Out.left == 0
+        && !CHANsleeping(cp)) {
+        RCHANremove(cp);
+        SCHANadd(cp, Now.tv_sec + 1, NULL, NCbackpressurewake, NULL);
+        return;
+    }
+
     /* Read any data that's there; ignore errors (retry next time it's our
      * turn) and if we got nothing, then it's EOF so mark it closed. */
     if ((i = CHANreadtext(cp)) <= 0) {
@@ -1799,12 +2068,14 @@ NCcheck(CHANNEL *cp)
 {
     char                *buff = NULL;
     size_t		idlen, msglen;
+    int                 batched;
 #if defined(DO_PERL) || defined(DO_PYTHON)
     char		*filterrc = NULL;
 #endif /* DO_PERL || DO_PYTHON */
 
     cp->Check++;
     cp->Start = cp->Next;
+    batched = NCbatched(cp->av[1]);
 
     idlen = strlen(cp->av[1]);
     msglen = idlen + 5; /* 3 digits + space + id + null. */
@@ -1872,7 +2143,8 @@ NCcheck(CHANNEL *cp)
     }
 #endif /* defined(DO_PYTHON) */
 
-    if (HIScheck(History, cp->av[1]) || cp->Ignore) {
+    if ((batched >= 0 ? batched : HIScheck(History, cp->av[1]))
+        || cp->Ignore) {
 	cp->Refused++;
 	cp->Check_got++;
 	snprintf(cp->Sendid.data, cp->Sendid.size, "%d %s Duplicate",
@@ -1889,6 +2161,12 @@ NCcheck(CHANNEL *cp)
                      NNTP_FAIL_CHECK_DEFER, cp->av[1]);
 	}
 	NCwritereply(cp, cp->Sendid.data);
+    } else if (cp->Backpressure && ARTbackpressure()) {
+	cp->Check_deferred++;
+	snprintf(cp->Sendid.data, cp->Sendid.size,
+                 "%d %s Storage busy, retry later",
+                 NNTP_FAIL_CHECK_DEFER, cp->av[1]);
+	NCwritereply(cp, cp->Sendid.data);
     } else {
 	cp->Check_send++;
 	snprintf(cp->Sendid.data, cp->Sendid.size, "%d %s Send it",
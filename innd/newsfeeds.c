@@ -4,8 +4,11 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
 
 #include "inn/innconf.h"
+#include "inn/paths.h"
 #include "innd.h"
 
 /*
@@ -25,6 +28,41 @@ static SITE	SITEnull;
 static char	*SITEfeedspath = NULL;
 static SITEVARIABLES  *SITEvariables = NULL;
 
+/*
+**  Matching the patterns of every site against every newsgroup is what
+**  takes most of the time when parsing newsfeeds on a big server, so the
+**  result is kept in INN_PATH_FEEDCACHE in pathdb between parses.  Each
+**  entry is keyed by a hash of the patterns of ME and of a site and holds
+**  the newsgroups subscribed and poisoned by them, as two bitmaps in the
+**  order of the active file.  The whole cache is only valid for the list
+**  of newsgroups it was computed for, whose hash is in its header.  The
+**  flags of a site which depend on the status of the newsgroups are still
+**  applied after each parse.
+*/
+#define SITE_CACHE_MAGIC	"INNFC01"
+
+typedef struct _SITECACHEHEADER {
+    char	Magic[8];
+    uint32_t	Groups;
+    uint32_t	Count;
+    HASH	Names;
+} SITECACHEHEADER;
+
+typedef struct _SITECACHEENTRY {
+    HASH		Key;
+    unsigned char	*Bits;		/* Subscribed, then poisoned. */
+    bool		Used;
+} SITECACHEENTRY;
+
+static SITECACHEENTRY	*SITEcache = NULL;
+static int		SITEcachecount;
+static int		SITEcachesize;
+static size_t		SITEcachebytes;	/* Size of one bitmap. */
+static HASH		SITEcachenames;
+static bool		SITEcachechanged;
+static struct buffer	*SITEcachedata;
+static bool		SITEcacheopen = false;
+
 
 /*
 **  Return a copy of an array of strings.
@@ -345,11 +383,248 @@ SITEreadfile(const bool ReadOnly)
 }
 
 
+/*
+**  Compute the hash of the list of newsgroups.
+*/
+static HASH
+SITEcachehashnames(void)
+{
+    struct buffer	*b;
+    NEWSGROUP		*ngp;
+    int			i;
+    HASH		hash;
+
+    b = buffer_new();
+    for (ngp = Groups, i = nGroups; --i >= 0; ngp++) {
+	buffer_append(b, ngp->Name, ngp->NameLength);
+	buffer_append(b, "\n", 1);
+    }
+    hash = Hash(b->data != NULL ? b->data : "", b->left);
+    buffer_free(b);
+    return hash;
+}
+
+
+/*
+**  Load the cache of subscriptions, if it matches the current list of
+**  newsgroups.  Called before parsing newsfeeds.
+*/
+static void
+SITEcacheload(void)
+{
+    SITECACHEHEADER	header;
+    char		*path;
+    char		*p;
+    size_t		length;
+    int			fd;
+    int			i;
+
+    SITEcachecount = 0;
+    SITEcachechanged = false;
+    SITEcachebytes = (nGroups + 7) / 8;
+    SITEcachenames = SITEcachehashnames();
+    SITEcacheopen = true;
+    SITEcachedata = buffer_new();
+
+    path = concatpath(innconf->pathdb, INN_PATH_FEEDCACHE);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	if (errno != ENOENT)
+	    syslog(L_ERROR, "%s cant open %s %m", LogName, path);
+	free(path);
+	return;
+    }
+    if (!buffer_read_file(SITEcachedata, fd))
+	syslog(L_ERROR, "%s cant read %s %m", LogName, path);
+    close(fd);
+    free(path);
+
+    /* Ignore a cache for other newsgroups, or truncated. */
+    if (SITEcachedata->left < sizeof(header))
+	return;
+    memcpy(&header, SITEcachedata->data, sizeof(header));
+    length = sizeof(HASH) + 2 * SITEcachebytes;
+    if (memcmp(header.Magic, SITE_CACHE_MAGIC, sizeof(header.Magic)) != 0
+	|| header.Groups != (uint32_t) nGroups
+	|| memcmp(&header.Names, &SITEcachenames, sizeof(HASH)) != 0
+	|| SITEcachedata->left != sizeof(header) + header.Count * length)
+	return;
+
+    if (SITEcachesize < (int) header.Count) {
+	SITEcachesize = header.Count;
+	SITEcache = xrealloc(SITEcache, SITEcachesize * sizeof(SITECACHEENTRY));
+    }
+    p = SITEcachedata->data + sizeof(header);
+    for (i = 0; i < (int) header.Count; i++, p += length) {
+	memcpy(&SITEcache[i].Key, p, sizeof(HASH));
+	SITEcache[i].Bits = (unsigned char *) p + sizeof(HASH);
+	SITEcache[i].Used = false;
+    }
+    SITEcachecount = header.Count;
+}
+
+
+/*
+**  Compute the key of the subscriptions of a site.
+*/
+static HASH
+SITEcachekey(SITE *sp)
+{
+    static struct buffer	b = { 0, 0, 0, NULL };
+    char			**pp;
+
+    buffer_set(&b, "", 0);
+    if (ME.Patterns)
+	for (pp = ME.Patterns; *pp != NULL; pp++) {
+	    buffer_append(&b, *pp, strlen(*pp));
+	    buffer_append(&b, ",", 1);
+	}
+    buffer_append(&b, "\n", 1);
+    for (pp = sp->Patterns; *pp != NULL; pp++) {
+	buffer_append(&b, *pp, strlen(*pp));
+	buffer_append(&b, ",", 1);
+    }
+    return Hash(b.data, b.left);
+}
+
+
+/*
+**  Set "subbed" and "poison" from the cache.  Returns false if the
+**  subscriptions of the site aren't in it.
+*/
+static bool
+SITEcachefind(HASH key, char *subbed, char *poison)
+{
+    SITECACHEENTRY	*ep;
+    unsigned char	*bits;
+    int			i;
+
+    for (ep = SITEcache, i = SITEcachecount; --i >= 0; ep++)
+	if (memcmp(&ep->Key, &key, sizeof(HASH)) == 0)
+	    break;
+    if (i < 0)
+	return false;
+    ep->Used = true;
+    bits = ep->Bits;
+    for (i = 0; i < nGroups; i++) {
+	subbed[i] = (bits[i / 8] >> (i % 8)) & 1;
+	poison[i] = (bits[SITEcachebytes + i / 8] >> (i % 8)) & 1;
+    }
+    return true;
+}
+
+
+/*
+**  Add the subscriptions of a site to the cache.
+*/
+static void
+SITEcacheadd(HASH key, const char *subbed, const char *poison)
+{
+    SITECACHEENTRY	*ep;
+    unsigned char	*bits;
+    int			i;
+
+    if (SITEcachecount == SITEcachesize) {
+	SITEcachesize = SITEcachesize == 0 ? 64 : 2 * SITEcachesize;
+	SITEcache = xrealloc(SITEcache, SITEcachesize * sizeof(SITECACHEENTRY));
+    }
+    bits = xcalloc(2 * SITEcachebytes + 1, 1);
+    for (i = 0; i < nGroups; i++) {
+	if (subbed[i])
+	    bits[i / 8] |= 1 << (i % 8);
+	if (poison[i])
+	    bits[SITEcachebytes + i / 8] |= 1 << (i % 8);
+    }
+    ep = &SITEcache[SITEcachecount++];
+    ep->Key = key;
+    ep->Bits = bits;
+    ep->Used = true;
+    SITEcachechanged = true;
+}
+
+
+/*
+**  Write the cache again if entries were added to it or some of them
+**  weren't used, and forget it.  Called once newsfeeds is parsed.
+*/
+static void
+SITEcachesave(void)
+{
+    SITECACHEHEADER	header;
+    SITECACHEENTRY	*ep;
+    struct buffer	*b;
+    char		*path;
+    char		*tmp;
+    int			fd;
+    int			i;
+
+    for (ep = SITEcache, i = SITEcachecount; --i >= 0; ep++)
+	if (!ep->Used)
+	    SITEcachechanged = true;
+    if (SITEcachechanged) {
+	b = buffer_new();
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, SITE_CACHE_MAGIC, sizeof(header.Magic));
+	header.Groups = nGroups;
+	header.Names = SITEcachenames;
+	buffer_append(b, (char *) &header, sizeof(header));
+	for (ep = SITEcache, i = SITEcachecount; --i >= 0; ep++)
+	    if (ep->Used) {
+		buffer_append(b, (char *) &ep->Key, sizeof(HASH));
+		buffer_append(b, (char *) ep->Bits, 2 * SITEcachebytes);
+		header.Count++;
+	    }
+	memcpy(b->data, &header, sizeof(header));
+
+	path = concatpath(innconf->pathdb, INN_PATH_FEEDCACHE);
+	tmp = concat(path, ".tmp", (char *) 0);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, ARTFILE_MODE);
+	if (fd < 0)
+	    syslog(L_ERROR, "%s cant open %s %m", LogName, tmp);
+	else if (xwrite(fd, b->data, b->left) < 0 || close(fd) < 0) {
+	    syslog(L_ERROR, "%s cant write %s %m", LogName, tmp);
+	    unlink(tmp);
+	} else if (rename(tmp, path) < 0) {
+	    syslog(L_ERROR, "%s cant rename %s %m", LogName, tmp);
+	    unlink(tmp);
+	}
+	free(tmp);
+	free(path);
+	buffer_free(b);
+    }
+
+    /* Entries added during this parse have bits of their own. */
+    for (ep = SITEcache, i = SITEcachecount; --i >= 0; ep++)
+	if (SITEcachedata->data == NULL
+	    || (char *) ep->Bits < SITEcachedata->data
+	    || (char *) ep->Bits >= SITEcachedata->data + SITEcachedata->left)
+	    free(ep->Bits);
+    SITEcachecount = 0;
+    buffer_free(SITEcachedata);
+    SITEcachedata = NULL;
+    SITEcacheopen = false;
+}
+
+
+/*
+**  Note whether "patlist" has poison patterns.
+*/
+static void
+SITEsetpoison(char **patlist, bool *poisonEntry)
+{
+    char	*pat;
+
+    while ((pat = *patlist++) != NULL)
+	if (*pat == SUB_POISON && pat[1] != '\0')
+	    *poisonEntry = true;
+}
+
+
 /*
 **  Modify "subbed" according to the patterns in "patlist."
 */
 static void
-SITEsetlist(char **patlist, char *subbed, char *poison, bool *poisonEntry)
+SITEsetlist(char **patlist, char *subbed, char *poison)
 {
     char	*pat;
     char	*p;
@@ -366,8 +641,6 @@ SITEsetlist(char **patlist, char *subbed, char *poison, bool *poisonEntry)
 	    pat++;
 	if (!*pat)
 	    continue;
-	if (!*poisonEntry && poisonvalue)
-	    *poisonEntry = true;
 
 	/* See if pattern is a simple newsgroup name.  If so, set the
 	 * right subbed element for that one group (if found); if not,
@@ -392,6 +665,70 @@ SITEsetlist(char **patlist, char *subbed, char *poison, bool *poisonEntry)
     }
 }
 
+/*
+**  Apply the patterns in "patlist" to a single newsgroup, the way SITEsetlist
+**  does for all of them.
+*/
+static void
+SITEsetone(char **patlist, const char *name, char *subbed, char *poison)
+{
+    char	*pat;
+    char	*p;
+    char	subvalue;
+    char	poisonvalue;
+
+    while ((pat = *patlist++) != NULL) {
+	subvalue = *pat != SUB_NEGATE && *pat != SUB_POISON;
+	poisonvalue = *pat == SUB_POISON;
+	if (!subvalue)
+	    pat++;
+	if (!*pat)
+	    continue;
+	for (p = pat; *p; p++)
+	    if (*p == '?' || *p == '*' || *p == '[')
+		break;
+	if (*p == '\0' ? strcmp(name, pat) == 0 : uwildmat(name, pat)) {
+	    *subbed = subvalue;
+	    *poison = poisonvalue;
+	}
+    }
+}
+
+
+/*
+**  Set the sites that get a newsgroup, or for which it is poison, from the
+**  subscriptions of the sites already parsed.  Used for a newsgroup added
+**  or changed without parsing the newsfeeds file again, so this must give
+**  the same result as SITEparseone for that newsgroup.
+*/
+void
+SITEsubscribe(NEWSGROUP *ngp)
+{
+    SITE	*sp;
+    char	subbed;
+    char	poison;
+    int		i;
+
+    ngp->nSites = 0;
+    ngp->nPoison = 0;
+    for (i = 0, sp = Sites; i < nSites; i++, sp++) {
+	subbed = SUB_DEFAULT;
+	poison = SUB_DEFAULT;
+	if (ME.Patterns)
+	    SITEsetone(ME.Patterns, ngp->Name, &subbed, &poison);
+	if (sp->Patterns)
+	    SITEsetone(sp->Patterns, ngp->Name, &subbed, &poison);
+	if (sp->JustModerated && ngp->Rest[0] != NF_FLAG_MODERATED)
+	    subbed = false;
+	if (sp->JustUnmoderated && ngp->Rest[0] == NF_FLAG_MODERATED)
+	    subbed = false;
+	if (subbed)
+	    ngp->Sites[ngp->nSites++] = i;
+	if (poison)
+	    ngp->Poison[ngp->nPoison++] = i;
+    }
+}
+
 /*
 **  Split text into slash-separated fields.  Return an allocated
 **  NULL-terminated array of the fields within the modified argument that
@@ -442,12 +779,19 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
     char		*f4;
     char		**save;
     char		**argv;
-    bool		JustModerated;
-    bool		JustUnmoderated;
     int			isp;
     SITE		*nsp;
     struct buffer	b;
     HASHFEEDLIST        *hf;
+    HASH		key;
+
+    /* The compiled subscriptions of every site include those of ME. */
+    if (sp == &ME)
+	for (i = nSites, nsp = Sites; Sites != NULL && --i >= 0; nsp++)
+	    if (nsp->Wildmat != NULL) {
+		uwildmat_free(nsp->Wildmat);
+		nsp->Wildmat = NULL;
+	    }
 
     b = sp->Buffer;
     *sp = SITEnull;
@@ -482,6 +826,14 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
 	sp->Exclusions = CommaSplit(p);
     }
     sp->NameLength = strlen(sp->Name);
+    sp->NameHash = ARThophash(sp->Name);
+    if (sp->Exclusions) {
+	for (i = 0; sp->Exclusions[i] != NULL; i++)
+	    continue;
+	sp->ExclusionHashes = xmalloc(i * sizeof(unsigned int));
+	for (i = 0; sp->Exclusions[i] != NULL; i++)
+	    sp->ExclusionHashes[i] = ARThophash(sp->Exclusions[i]);
+    }
 
     /* Parse the second field, the subscriptions. */
     if ((f3 = strchr(f2, NF_FIELD_SEP)) == NULL)
@@ -497,20 +849,31 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
     sp->Patterns = CommaSplit(f2);
 
     if (subbed) {
-	/* Read the subscription patterns and set the bits. */
-	memset(subbed, SUB_DEFAULT, nGroups);
-	memset(poison, SUB_DEFAULT, nGroups);
 	if (ME.Patterns)
-	    SITEsetlist(ME.Patterns, subbed, poison, &ME.PoisonEntry);
-	SITEsetlist(sp->Patterns, subbed, poison, &sp->PoisonEntry);
+	    SITEsetpoison(ME.Patterns, &ME.PoisonEntry);
+	SITEsetpoison(sp->Patterns, &sp->PoisonEntry);
+    }
+    if (subbed && sp != &ME) {
+	/* Read the subscription patterns and set the bits, unless they are
+	   in the cache. */
+	key = SITEcachekey(sp);
+	if (!SITEcacheopen || !SITEcachefind(key, subbed, poison)) {
+	    memset(subbed, SUB_DEFAULT, nGroups);
+	    memset(poison, SUB_DEFAULT, nGroups);
+	    if (ME.Patterns)
+		SITEsetlist(ME.Patterns, subbed, poison);
+	    SITEsetlist(sp->Patterns, subbed, poison);
+	    if (SITEcacheopen)
+		SITEcacheadd(key, subbed, poison);
+	}
     }
 
     /* Get the third field, the flags. */
     if ((f4 = strchr(f3, NF_FIELD_SEP)) == NULL)
 	return "missing field 4";
     *f4++ = '\0';
-    JustModerated = false;
-    JustUnmoderated = false;
+    sp->JustModerated = false;
+    sp->JustUnmoderated = false;
     sp->Type = FTfile;
     for (save = argv = CommaSplit(f3); (p = *argv++) != NULL; )
 	switch (*p) {
@@ -588,8 +951,8 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
 		switch (*p) {
 		default:
 		    return "unknown N param in field 3";
-		case 'm': JustModerated = true;		break;
-		case 'u': JustUnmoderated = true;	break;
+		case 'm': sp->JustModerated = true;	break;
+		case 'u': sp->JustUnmoderated = true;	break;
 		}
 	    break;
 	case 'O':
@@ -634,6 +997,10 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
             hf->next = sp->HashFeedList;
             sp->HashFeedList = hf;
             break;
+	case 'R':
+	    if (*++p && isdigit((unsigned char) *p))
+		sp->RingSize = strtoul(p, NULL, 10) * 1024;
+	    break;
 	case 'S':
 	    if (*++p && isdigit((unsigned char) *p))
 		sp->StartSpooling = atol(p);
@@ -664,6 +1031,9 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
 		case FEED_FNLNAMES:		/* Funnel feed names	*/
 		    sp->FNLwantsnames = true;
 		    break;
+		case FEED_ARTICLE:		/* Whole article	*/
+		    NeedArticle = true;
+		    break;
 		case FEED_HEADERS:		/* Article headers	*/
 		    NeedHeaders = true;
 		    break;
@@ -705,14 +1075,16 @@ SITEparseone(char *Entry, SITE *sp, char *subbed, char *poison)
 	return "I param with non-file feed";
     if (sp->Flushpoint == 0 && sp->Type == FTfile)
 	sp->Flushpoint = SITE_BUFFER_SIZE;
+    if (sp->RingSize && sp->Type != FTchannel)
+	return "R param with non-channel feed";
 
     if (subbed) {
 	/* Modify the subscription list based on the flags. */
-	if (JustModerated)
+	if (sp->JustModerated)
 	    for (p = subbed, ngp = Groups, i = nGroups; --i >= 0; ngp++, p++)
 		if (ngp->Rest[0] != NF_FLAG_MODERATED)
 		    *p = false;
-	if (JustUnmoderated)
+	if (sp->JustUnmoderated)
 	    for (p = subbed, ngp = Groups, i = nGroups; --i >= 0; ngp++, p++)
 		if (ngp->Rest[0] == NF_FLAG_MODERATED)
 		    *p = false;
@@ -883,9 +1255,10 @@ SITEparsefile(bool StartSite)
   /* Set up scratch subscription list. */
   subbed = xmalloc(nGroups);
   poison = xmalloc(nGroups);
+  SITEcacheload();
   /* reset global variables */
-  NeedHeaders = NeedOverview = NeedPath = NeedStoredGroup = NeedReplicdata
-    = false;
+  NeedArticle = NeedHeaders = NeedOverview = NeedPath = NeedStoredGroup
+    = NeedReplicdata = false;
 
   ME.Prev = 0; /* Used as a flag to ensure exactly one ME entry */
   for (sp = Sites, errors = 0, setuperrors = 0, i = 0; i < nSites; i++) {
@@ -930,6 +1303,7 @@ SITEparsefile(bool StartSite)
 
   /* Free our scratch array, set up the funnel links. */
   nSites = sp - Sites;
+  SITEcachesave();
   free(subbed);
   free(poison);
   free(strings);
@@ -21,45 +21,23 @@
 
 
 /*
-**  Size of hash table.   Change NGH_BUCKET if not a power of two.
+**  The hash table is an array of chains of newsgroups linked through their
+**  HashNext field.  Its size is a power of two, chosen when the active file
+**  is parsed so that there are about as many buckets as newsgroups; chains
+**  then hold one or two newsgroups, and the full hash value stored in each
+**  newsgroup saves most string comparisons.  NGH_MINSIZE keeps small active
+**  files from resizing the table at every reload.
 */
-#define NGH_SIZE	2048
-#define NGH_BUCKET(j)	&NGHtable[j & (NGH_SIZE - 1)]
-
-
-/*
-**  Newsgroup hash entry, which is really a hash bucket -- pointers
-**  to all the groups with this hash code.
-*/
-typedef struct _NGHASH {
-    int			Size;
-    int			Used;
-    NEWSGROUP		**Groups;
-} NGHASH;
+#define NGH_MINSIZE	2048
+#define NGH_BUCKET(j)	&NGHtable[j & (NGHsize - 1)]
 
 
 static struct buffer	NGnames;
-static NGHASH		NGHtable[NGH_SIZE];
-static int		NGHbuckets;
+static NEWSGROUP	**NGHtable;
+static unsigned int	NGHsize;
 static int		NGHcount;
 
 
-
-/*
-**  Sorting predicate for qsort call in NGparsefile.  Put newsgroups in
-**  rough order of their activity.  Will be better if we write a "counts"
-**  file sometime.
-*/
-static int
-NGcompare(const void *p1, const void *p2)
-{
-    const NEWSGROUP *const *n1 = p1;
-    const NEWSGROUP *const *n2 = p2;
-
-    return n1[0]->Last - n2[0]->Last;
-}
-
-
 /*
 **  Parse a single line from the active file, filling in ngp.  Be careful
 **  not to write NUL's into the in-core copy, since we're either mmap(2)'d,
@@ -70,8 +48,8 @@ NGparseentry(NEWSGROUP *ngp, const char *p, char *end)
 {
     char		*q;
     unsigned int	j;
-    NGHASH		*htp;
-    NEWSGROUP		**ngpp;
+    NEWSGROUP		**htp;
+    NEWSGROUP		*hp;
     int			i;
     ARTNUM		lo;
 
@@ -97,26 +75,26 @@ NGparseentry(NEWSGROUP *ngp, const char *p, char *end)
     ngp->Rest = ++q;
     /* We count on atoi() to stop at the space after the digits! */
     ngp->Last = atol(ngp->LastString);
+    ngp->Slot = -1;
     ngp->nSites = 0;
     ngp->Sites = xmalloc(NGHcount * sizeof(int));
     ngp->nPoison = 0;
     ngp->Poison = xmalloc(NGHcount * sizeof(int));
     ngp->Alias = NULL;
 
-    /* Find the right bucket for the group, make sure there is room. */
+    /* Find the right bucket for the group, and add it to the chain. */
     NGH_HASH(ngp->Name, p, j);
     htp = NGH_BUCKET(j);
-    for (p = ngp->Name, ngpp = htp->Groups, i = htp->Used; --i >= 0; ngpp++)
-	if (*p == ngpp[0]->Name[0] && strcmp(p, ngpp[0]->Name) == 0) {
-	    syslog(L_ERROR, "%s duplicate_group %s", LogName, p);
+    for (hp = *htp; hp != NULL; hp = hp->HashNext)
+	if (hp->Hash == j && strcmp(ngp->Name, hp->Name) == 0) {
+	    syslog(L_ERROR, "%s duplicate_group %s", LogName, ngp->Name);
 	    return false;
 	}
-    if (htp->Used >= htp->Size) {
-	htp->Size += NGHbuckets;
-        htp->Groups = xrealloc(htp->Groups, htp->Size * sizeof(NEWSGROUP *));
-    }
-    htp->Groups[htp->Used++] = ngp;
+    ngp->Hash = j;
+    ngp->HashNext = *htp;
+    *htp = ngp;
 
+    OVQsync();
     if (innconf->enableoverview && !OVgroupadd(ngp->Name, lo, ngp->Last, ngp->Rest))
 	return false;
 
@@ -124,6 +102,26 @@ NGparseentry(NEWSGROUP *ngp, const char *p, char *end)
 }
 
 
+/*
+**  Chase down the alias flag of a newsgroup.
+*/
+static void
+NGfindalias(NEWSGROUP *ngp)
+{
+    char	*p;
+
+    ngp->Alias = ngp;
+    if ((p = strchr(ngp->Alias->Rest, '\n')) != NULL)
+	*p = '\0';
+    ngp->Alias = NGfind(&ngp->Alias->Rest[1]);
+    if (p)
+	*p = '\n';
+    if (ngp->Alias != NULL && ngp->Alias->Rest[0] == NF_FLAG_ALIAS)
+	syslog(L_NOTICE, "%s alias_error %s too many levels",
+	    LogName, ngp->Name);
+}
+
+
 /*
 **  Parse the active file, building the initial Groups global.
 */
@@ -135,7 +133,7 @@ NGparsefile(void)
     int		i;
     bool	SawMe;
     NEWSGROUP	*ngp;
-    NGHASH	*htp;
+    unsigned int size;
     char	**strings;
     char	*active;
     char	*end;
@@ -162,19 +160,15 @@ NGparsefile(void)
     NGnames.data = xmalloc(NGnames.size + 1);
     NGnames.used = 0;
 
-    /* Set up the default hash buckets. */
-    NGHbuckets = nGroups / NGH_SIZE;
-    if (NGHbuckets == 0)
-	NGHbuckets = 1;
-    if (NGHtable[0].Groups)
-	for (i = NGH_SIZE, htp = NGHtable; --i >= 0; htp++)
-	    htp->Used = 0;
-    else
-	for (i = NGH_SIZE, htp = NGHtable; --i >= 0; htp++) {
-	    htp->Size = NGHbuckets;
-	    htp->Groups = xmalloc(htp->Size * sizeof(NEWSGROUP *));
-	    htp->Used = 0;
-	}
+    /* Size the hash table for the number of groups, and empty it. */
+    for (size = NGH_MINSIZE; size < (unsigned int) nGroups; size <<= 1)
+	continue;
+    if (size != NGHsize) {
+	free(NGHtable);
+	NGHtable = xmalloc(size * sizeof(NEWSGROUP *));
+	NGHsize = size;
+    }
+    memset(NGHtable, 0, NGHsize * sizeof(NEWSGROUP *));
 
     /* Count the number of sites. */
     SawMe = false;
@@ -198,24 +192,82 @@ NGparsefile(void)
 	}
     }
 
-    /* Sort each bucket. */
-    for (i = NGH_SIZE, htp = NGHtable; --i >= 0; htp++)
-	if (htp->Used > 1)
-	    qsort(htp->Groups, htp->Used, sizeof htp->Groups[0], NGcompare);
-
     /* Chase down any alias flags. */
     for (ngp = Groups, i = nGroups; --i >= 0; ngp++)
-	if (ngp->Rest[0] == NF_FLAG_ALIAS) {
-	    ngp->Alias = ngp;
-	    if ((p = strchr(ngp->Alias->Rest, '\n')) != NULL)
-		*p = '\0';
-	    ngp->Alias = NGfind(&ngp->Alias->Rest[1]);
-	    if (p)
-		*p = '\n';
-	    if (ngp->Alias != NULL && ngp->Alias->Rest[0] == NF_FLAG_ALIAS)
-		syslog(L_NOTICE, "%s alias_error %s too many levels",
-		    LogName, ngp->Name);
+	if (ngp->Rest[0] == NF_FLAG_ALIAS)
+	    NGfindalias(ngp);
+
+    ICDmapactive();
+}
+
+
+/*
+**  Add to the in-core tables the newsgroup on the last line of the active
+**  file, which ICDnewgroup appended in place rather than rewriting the file
+**  and parsing it again along with newsfeeds.  The active file is now
+**  mapped at active instead of old, so the pointers into it are moved
+**  first; Groups and the names may move too as they grow, and then so do
+**  the hash chains and aliases.  Returns false if the line can't be parsed,
+**  in which case the caller parses the whole file again.
+*/
+bool
+NGappend(const char *old, char *active, char *end)
+{
+    NEWSGROUP	*ngp;
+    NEWSGROUP	*oldgroups;
+    char	*oldnames;
+    char	*p;
+    unsigned int j;
+    int		i;
+
+    if (active != old)
+	for (i = nGroups, ngp = Groups; --i >= 0; ngp++) {
+	    ngp->LastString = active + (ngp->LastString - old);
+	    ngp->Rest = active + (ngp->Rest - old);
 	}
+
+    /* Find the new line, which ends at the end of the file. */
+    for (p = end - 1; p > active && p[-1] != '\n'; p--)
+	continue;
+
+    oldgroups = Groups;
+    Groups = xrealloc(Groups, (nGroups + 1) * sizeof(NEWSGROUP));
+    GroupPointers = xrealloc(GroupPointers,
+			     (nGroups + 1) * sizeof(NEWSGROUP *));
+    if (Groups != oldgroups) {
+	for (j = 0; j < NGHsize; j++)
+	    if (NGHtable[j] != NULL)
+		NGHtable[j] = Groups + (NGHtable[j] - oldgroups);
+	for (i = nGroups, ngp = Groups; --i >= 0; ngp++) {
+	    if (ngp->HashNext != NULL)
+		ngp->HashNext = Groups + (ngp->HashNext - oldgroups);
+	    if (ngp->Alias != NULL)
+		ngp->Alias = Groups + (ngp->Alias - oldgroups);
+	}
+    }
+
+    oldnames = NGnames.data;
+    NGnames.size += end - p;
+    NGnames.data = xrealloc(NGnames.data, NGnames.size + 1);
+    if (NGnames.data != oldnames)
+	for (i = nGroups, ngp = Groups; --i >= 0; ngp++)
+	    ngp->Name = NGnames.data + (ngp->Name - oldnames);
+
+    ngp = &Groups[nGroups];
+    memset(ngp, 0, sizeof(NEWSGROUP));
+    ngp->Start = p - active;
+    if (!NGparseentry(ngp, p, end - 1)) {
+	syslog(L_ERROR, "%s bad_active %s...", LogName, MaxLength(p, end - 1));
+	free(ngp->Sites);
+	free(ngp->Poison);
+	return false;
+    }
+    nGroups++;
+    if (ngp->Rest[0] == NF_FLAG_ALIAS)
+	NGfindalias(ngp);
+    SITEsubscribe(ngp);
+    ICDmapactive();
+    return true;
 }
 
 /*
@@ -226,7 +278,6 @@ NGclose(void)
 {
     int		i;
     NEWSGROUP	*ngp;
-    NGHASH	*htp;
 
     if (Groups) {
 	for (i = nGroups, ngp = Groups; --i >= 0; ngp++) {
@@ -238,15 +289,8 @@ NGclose(void)
 	free(GroupPointers);
 	free(NGnames.data);
     }
-
-    for (i = NGH_SIZE, htp = NGHtable; --i >= 0; htp++) {
-      htp->Size = NGHbuckets;
-      if (htp->Groups) {
-	free(htp->Groups);
-	htp->Used = 0;
-	htp->Groups = NULL;
-      }
-    }
+    if (NGHtable != NULL)
+	memset(NGHtable, 0, NGHsize * sizeof(NEWSGROUP *));
 }
 
 /*
@@ -256,17 +300,15 @@ NEWSGROUP *
 NGfind(const char *Name)
 {
     const char		*p;
-    int			i;
     unsigned int	j;
-    NEWSGROUP		**ngp;
-    char		c;
-    NGHASH		*htp;
+    NEWSGROUP		*ngp;
 
+    if (NGHtable == NULL)
+	return NULL;
     NGH_HASH(Name, p, j);
-    htp = NGH_BUCKET(j);
-    for (c = *Name, ngp = htp->Groups, i = htp->Used; --i >= 0; ngp++)
-	if (c == ngp[0]->Name[0] && strcmp(Name, ngp[0]->Name) == 0)
-	    return ngp[0];
+    for (ngp = *NGH_BUCKET(j); ngp != NULL; ngp = ngp->HashNext)
+	if (ngp->Hash == j && strcmp(Name, ngp->Name) == 0)
+	    return ngp;
     return NULL;
 }
 
@@ -276,13 +318,13 @@ NGfind(const char *Name)
 **  number of newsgroups.  ' ' and '\t' are dropped when copying.
 */
 int
-NGsplit(char *p, int size, LISTBUFFER *list)
+NGsplit(ARENA *arena, char *p, int size, LISTBUFFER *list)
 {
   char		**gp, *q;
   int		i;
 
   /* setup buffer */
-  SetupListBuffer(size, list);
+  SetupListBuffer(arena, size, list);
 
   /* loop over and copy */
   for (i = 0, q = list->Data, gp = list->List ; *p ; p++, *q++ = '\0') {
@@ -293,8 +335,7 @@ NGsplit(char *p, int size, LISTBUFFER *list)
       break;
 
     if (i == list->ListLength) {
-      list->ListLength += DEFAULTNGBOXSIZE;
-      list->List = xrealloc(list->List, list->ListLength * sizeof(char *));
+      GrowListBuffer(arena, list);
       gp = &list->List[i];
     }
     /* mark the start of the newsgroup, move to the end of it while copying */
@@ -310,8 +351,7 @@ NGsplit(char *p, int size, LISTBUFFER *list)
   }
   *q = '\0';
   if (i == list->ListLength) {
-    list->ListLength += DEFAULTNGBOXSIZE;
-    list->List = xrealloc(list->List, list->ListLength * sizeof(char *));
+    GrowListBuffer(arena, list);
     gp = &list->List[i];
   }
   *gp = NULL;
@@ -356,6 +396,7 @@ NGrenumber(NEWSGROUP *ngp)
     }
 
     /* Check overview data for the group. */
+    OVQsync();
     if (!OVgroupstats(ngp->Name, &low, &high, &count, &flag)) return false;
     if (count != 0) {
 	/* Non-empty group, so set low/high water marks from overview. */
@@ -394,6 +435,7 @@ NGrenumber(NEWSGROUP *ngp)
 	}
 	ICDactivedirty++;
     }
+    ICDmapgroup(ngp, lomark, count);
     return true;
 }
 
@@ -441,5 +483,6 @@ NGlowmark(NEWSGROUP *ngp, long lomark)
         }
         ICDactivedirty++;
     }
+    ICDmapgroup(ngp, lomark, -1);
     return true;
 }
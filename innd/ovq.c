@@ -0,0 +1,291 @@
+/*
+**  Overview write queue.
+**
+**  When ovqueuesize is set in inn.conf, innd hands the overview data of
+**  accepted articles to a separate writer thread instead of calling OVadd
+**  inline, so that a slow overview method doesn't stall every incoming feed.
+**  The queue is bounded; when it is full, the main loop waits for the writer
+**  to catch up.  Whatever accumulated while the writer was busy is stored
+**  with a single OVaddbatch call, so the busier the server, the larger the
+**  batches handed to the overview method.
+**
+**  The writer thread is the only one calling the overview API while it has
+**  work queued.  Anything else in innd that needs the overview API (creating
+**  or removing newsgroups, renumbering, cancels) first calls OVQsync, which
+**  waits until the queue is empty.  Since the main thread is the only one
+**  adding to the queue, the writer then stays idle until the next OVQadd.
+**  Errors are reported back to the main thread, which is the only one
+**  allowed to throttle the server.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <signal.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "inn/innconf.h"
+#include "inn/ov.h"
+#include "innd.h"
+
+#ifdef HAVE_PTHREAD
+
+/* One queued overview record. */
+struct ovq_entry {
+    TOKEN token;
+    char *data;
+    int len;
+    time_t arrived;
+    time_t expires;
+};
+
+/* The queue itself, a ring of size entries. */
+static struct {
+    struct ovq_entry *entries;
+    size_t size;
+    size_t head;                /* Next entry for the writer. */
+    size_t count;               /* Number of queued entries. */
+    bool busy;                  /* Writer is processing an entry. */
+    bool shutdown;              /* Writer should exit once drained. */
+    unsigned long failed;       /* Failed articles not yet reported. */
+    bool nospace;               /* One of those failures was ENOSPC. */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* Signaled when entries are added. */
+    pthread_cond_t done;        /* Signaled when entries are consumed. */
+} ovq;
+
+static bool ovq_running = false;
+
+
+/*
+**  The writer thread.  Takes everything queued so far off the queue and
+**  stores it with a single OVaddbatch call, until told to shut down, and
+**  records failures for OVQcheck.
+*/
+static void *
+OVQwriter(void *arg UNUSED)
+{
+    OVBATCH *batch;
+    struct ovq_entry *entry;
+    size_t count, i;
+    unsigned long failed;
+    sigset_t set;
+    bool nospace;
+    float f;
+
+    /* All signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    batch = xcalloc(ovq.size, sizeof(OVBATCH));
+    pthread_mutex_lock(&ovq.lock);
+    while (1) {
+        while (ovq.count == 0 && !ovq.shutdown)
+            pthread_cond_wait(&ovq.work, &ovq.lock);
+        if (ovq.count == 0)
+            break;
+        for (count = 0; ovq.count > 0; count++) {
+            entry = &ovq.entries[ovq.head];
+            batch[count].token = entry->token;
+            batch[count].data = entry->data;
+            batch[count].len = entry->len;
+            batch[count].arrived = entry->arrived;
+            batch[count].expires = entry->expires;
+            ovq.head = (ovq.head + 1) % ovq.size;
+            ovq.count--;
+        }
+        ovq.busy = true;
+        pthread_cond_broadcast(&ovq.done);
+        pthread_mutex_unlock(&ovq.lock);
+
+        failed = 0;
+        nospace = false;
+        if (!OVaddbatch(batch, count)) {
+            for (i = 0; i < count; i++)
+                if (batch[i].result == OVADDFAILED) {
+                    failed++;
+                    syslog(L_ERROR, "%s cant store overview for %s", LogName,
+                           TokenToText(batch[i].token));
+                }
+            if (OVctl(OVSPACE, (void *) &f) && (int) (f + 0.01f) == OV_NOSPACE)
+                nospace = true;
+        }
+        for (i = 0; i < count; i++)
+            free(batch[i].data);
+
+        pthread_mutex_lock(&ovq.lock);
+        ovq.busy = false;
+        ovq.failed += failed;
+        if (nospace)
+            ovq.nospace = true;
+        pthread_cond_broadcast(&ovq.done);
+    }
+    pthread_mutex_unlock(&ovq.lock);
+    free(batch);
+    return NULL;
+}
+
+
+/*
+**  Start the writer thread if ovqueuesize asks for one.  Called after the
+**  overview method has been opened.
+*/
+void
+OVQsetup(void)
+{
+    int status;
+
+    if (ovq_running || innconf->ovqueuesize == 0)
+        return;
+    if (!innconf->enableoverview || innconf->useoverchan)
+        return;
+
+    memset(&ovq, 0, sizeof(ovq));
+    ovq.size = innconf->ovqueuesize;
+    ovq.entries = xcalloc(ovq.size, sizeof(struct ovq_entry));
+    pthread_mutex_init(&ovq.lock, NULL);
+    pthread_cond_init(&ovq.work, NULL);
+    pthread_cond_init(&ovq.done, NULL);
+    status = pthread_create(&ovq.thread, NULL, OVQwriter, NULL);
+    if (status != 0) {
+        errno = status;
+        syswarn("SERVER cant start overview writer thread");
+        pthread_cond_destroy(&ovq.done);
+        pthread_cond_destroy(&ovq.work);
+        pthread_mutex_destroy(&ovq.lock);
+        free(ovq.entries);
+        return;
+    }
+    ovq_running = true;
+    syslog(L_NOTICE, "%s overview writer thread queue %lu", LogName,
+           (unsigned long) ovq.size);
+}
+
+
+/*
+**  Report the failures the writer thread ran into since the last call.  Only
+**  the main thread may throttle the server.
+*/
+static void
+OVQcheck(void)
+{
+    unsigned long failed;
+    bool nospace;
+
+    pthread_mutex_lock(&ovq.lock);
+    failed = ovq.failed;
+    nospace = ovq.nospace;
+    ovq.failed = 0;
+    ovq.nospace = false;
+    pthread_mutex_unlock(&ovq.lock);
+    for (; failed > 0; failed--) {
+        errno = nospace ? ENOSPC : EIO;
+        IOError("creating overview", errno);
+    }
+}
+
+
+/*
+**  Queue overview data for the writer thread.  The data is copied.  Returns
+**  false if there is no writer thread, in which case the caller should call
+**  OVadd itself (after OVQsync).
+*/
+bool
+OVQadd(TOKEN token, const char *data, int len, time_t arrived,
+       time_t expires)
+{
+    struct ovq_entry *entry;
+
+    if (!ovq_running)
+        return false;
+    OVQcheck();
+
+    pthread_mutex_lock(&ovq.lock);
+    while (ovq.count == ovq.size)
+        pthread_cond_wait(&ovq.done, &ovq.lock);
+    entry = &ovq.entries[(ovq.head + ovq.count) % ovq.size];
+    entry->token = token;
+    entry->data = xmalloc(len);
+    memcpy(entry->data, data, len);
+    entry->len = len;
+    entry->arrived = arrived;
+    entry->expires = expires;
+    ovq.count++;
+    pthread_cond_signal(&ovq.work);
+    pthread_mutex_unlock(&ovq.lock);
+    return true;
+}
+
+
+/*
+**  Wait until the writer thread has stored everything queued so far.  The
+**  main thread may then use the overview API until its next OVQadd.
+*/
+void
+OVQsync(void)
+{
+    if (!ovq_running)
+        return;
+    pthread_mutex_lock(&ovq.lock);
+    while (ovq.count > 0 || ovq.busy)
+        pthread_cond_wait(&ovq.done, &ovq.lock);
+    pthread_mutex_unlock(&ovq.lock);
+    OVQcheck();
+}
+
+
+/*
+**  Drain the queue and stop the writer thread.  Must be called before the
+**  overview method is closed.
+*/
+void
+OVQclose(void)
+{
+    if (!ovq_running)
+        return;
+    pthread_mutex_lock(&ovq.lock);
+    ovq.shutdown = true;
+    pthread_cond_signal(&ovq.work);
+    pthread_mutex_unlock(&ovq.lock);
+    pthread_join(ovq.thread, NULL);
+    ovq_running = false;
+    OVQcheck();
+    pthread_cond_destroy(&ovq.done);
+    pthread_cond_destroy(&ovq.work);
+    pthread_mutex_destroy(&ovq.lock);
+    free(ovq.entries);
+    ovq.entries = NULL;
+}
+
+#else /* !HAVE_PTHREAD */
+
+void
+OVQsetup(void)
+{
+    if (innconf->ovqueuesize > 0 && innconf->enableoverview
+        && !innconf->useoverchan)
+        syslog(L_ERROR, "%s ovqueuesize ignored, no thread support",
+               LogName);
+}
+
+bool
+OVQadd(TOKEN token UNUSED, const char *data UNUSED, int len UNUSED,
+       time_t arrived UNUSED, time_t expires UNUSED)
+{
+    return false;
+}
+
+void
+OVQsync(void)
+{
+}
+
+void
+OVQclose(void)
+{
+}
+
+#endif /* !HAVE_PTHREAD */
@@ -59,6 +59,70 @@ XS(XS_INN_havehist);
 XS(XS_INN_head);
 XS(XS_INN_newsgroup);
 
+/* Hash magic able to supply keys on lookup appeared in Perl 5.10.0; older
+   versions always fill %hdr. */
+#if (PERL_REVISION == 5) && (PERL_VERSION >= 10)
+# define PL_LAZY_HDR 1
+#endif
+
+#ifdef PL_LAZY_HDR
+/* The headers of the article being filtered when %hdr is filled lazily,
+   and which of them have already been put in it. */
+static const HDRCONTENT *PLlazyhc = NULL;
+static bool PLlazydone[MAX_ARTHEADER];
+static bool PLlazybusy = false;
+
+
+/*
+**  Called by Perl before each lookup of a key of %hdr while it is filled
+**  lazily.  If the key is a header of the article not yet in %hdr, store it
+**  there first, so that the lookup then finds it.  The store recurses into
+**  this function, hence the guard.
+*/
+static I32
+PLlazyfetch(pTHX_ IV action, SV *hv)
+{
+    const HDRCONTENT *hc = PLlazyhc;
+    const ARTHEADER *hp;
+    MAGIC *mg;
+    const char *name;
+    STRLEN len;
+    int i;
+
+    if (hc == NULL || PLlazybusy || (action & HV_FETCH_ISSTORE))
+        return 0;
+    mg = mg_find(hv, PERL_MAGIC_uvar);
+    if (mg == NULL || mg->mg_obj == NULL || !SvPOK(mg->mg_obj))
+        return 0;
+    name = SvPV(mg->mg_obj, len);
+    if (len > INT_MAX || (hp = ARTfindheader(name, (int) len)) == NULL)
+        return 0;
+    i = hp - ARTheaders;
+    if (PLlazydone[i] || !HDR_FOUND(i) || memcmp(name, hp->Name, len) != 0)
+        return 0;
+    PLlazydone[i] = true;
+    PLlazybusy = true;
+    (void) hv_store((HV *) hv, (char *) hp->Name, hp->Size,
+                    newSVpv(HDR(i), 0), 0);
+    PLlazybusy = false;
+    return 0;
+}
+
+
+/*
+**  Whether the filter asked for %hdr to be filled lazily, by setting
+**  $lazy_hdr.
+*/
+static bool
+PLlazy(void)
+{
+    SV *flag;
+
+    flag = perl_get_sv("lazy_hdr", 0);
+    return flag != NULL && SvTRUE(flag);
+}
+#endif /* PL_LAZY_HDR */
+
 
 /*
 **  Run an incoming article through the Perl article filter.  Returns NULL
@@ -77,13 +141,44 @@ PLartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
     static char buf[256];
     bool        failure;
     SV *        errsv;
+#ifdef PL_LAZY_HDR
+    struct ufuncs uf;
+    SV *        body = NULL;
+#endif
 
     if (!PerlFilterActive) return NULL;
     filter = perl_get_cv("filter_art", 0);
     if (!filter) return NULL;
 
-    /* Create %hdr and stash a copy of every known header. */
     hdr = perl_get_hv("hdr", 1);
+
+#ifdef PL_LAZY_HDR
+    /* If the filter set $lazy_hdr, headers are only copied into %hdr when
+       it looks them up, and the body is not copied at all:  $hdr{__BODY__}
+       is a read-only scalar pointing into the article.  Its string is
+       taken away afterwards in case the filter kept a reference to it. */
+    if (PLlazy()) {
+        PLlazyhc = hc;
+        memset(PLlazydone, 0, sizeof(PLlazydone));
+        uf.uf_val = PLlazyfetch;
+        uf.uf_set = NULL;
+        uf.uf_index = 0;
+        sv_magic((SV *) hdr, NULL, PERL_MAGIC_uvar, (char *) &uf, sizeof(uf));
+        if (artBody) {
+            body = newSV_type(SVt_PV);
+            SvPV_set(body, artBody);
+            SvCUR_set(body, artLen);
+            SvLEN_set(body, 0);
+            SvPOK_only(body);
+            SvREADONLY_on(body);
+            (void) hv_store(hdr, "__BODY__", 8, SvREFCNT_inc(body), 0);
+        }
+        (void) hv_store(hdr, "__LINES__", 9, newSViv(lines), 0);
+        goto call;
+    }
+#endif
+
+    /* Create %hdr and stash a copy of every known header. */
     for (i = 0 ; i < MAX_ARTHEADER ; i++) {
 	if (HDR_FOUND(i)) {
 	    hp = &ARTheaders[i];
@@ -109,6 +204,9 @@ PLartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
 
     (void) hv_store(hdr, "__LINES__", 9, newSViv(lines), 0);
 
+#ifdef PL_LAZY_HDR
+ call:
+#endif
     ENTER;
     SAVETMPS;
     PUSHMARK(SP);
@@ -116,6 +214,19 @@ PLartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
     rc = perl_call_sv((SV *) filter, G_EVAL|G_SCALAR|G_NOARGS);
     SPAGAIN;
 
+#ifdef PL_LAZY_HDR
+    if (PLlazyhc != NULL) {
+        PLlazyhc = NULL;
+        sv_unmagic((SV *) hdr, PERL_MAGIC_uvar);
+        if (body != NULL) {
+            SvREADONLY_off(body);
+            SvPV_set(body, NULL);
+            SvCUR_set(body, 0);
+            SvOK_off(body);
+            SvREFCNT_dec(body);
+        }
+    }
+#endif
     hv_undef(hdr);
 
     /* Check $@, which will be set if the sub died. */
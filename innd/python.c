@@ -47,9 +47,13 @@
 # define PyString_InternFromString PyUnicode_InternFromString
 # define PYBUFF_FROMMEMORY(str, len) \
       PyMemoryView_FromMemory((str), (len), PyBUF_WRITE)
+# define PYBUFF_FROMREADONLY(str, len) \
+      PyMemoryView_FromMemory((str), (len), PyBUF_READ)
 #else
 # define PYBUFF_FROMMEMORY(str, len) \
       PyBuffer_FromMemory((str), (len))
+# define PYBUFF_FROMREADONLY(str, len) \
+      PyBuffer_FromMemory((str), (len))
 #endif
 
 #include "clibrary.h"
@@ -68,9 +72,28 @@ PyObject	**PYheaditem;
 PyObject	**PYheadkey;
 PyObject	*PYlineskey, *PYbodykey;
 
+/*  The article handed to filter_article, whose items are only made when the
+ *  filter asks for them.  It is reused from one article to the next unless
+ *  the filter keeps a reference to it. */
+typedef struct {
+    PyObject_HEAD
+    const HDRCONTENT *hc;
+    char *body;
+    Py_ssize_t bodylen;
+    int lines;
+} PYarticle;
+
+/*  The other fields are filled in by PYsetup, since their layout depends on
+ *  the version of Python. */
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+static PyTypeObject PYarticletype = { PyVarObject_HEAD_INIT(NULL, 0) };
+#pragma GCC diagnostic warning "-Wmissing-field-initializers"
+static PYarticle *PYart = NULL;
+
 /*  External functions. */
 PyObject	*msgid_method = NULL;
 PyObject	*art_method = NULL;
+PyObject	*article_method = NULL;
 PyObject	*mode_method = NULL;
 PyObject	*pre_reload_method = NULL;
 PyObject	*close_method = NULL;
@@ -118,20 +141,17 @@ PYcontrol(char **av)
 
 
 /*
-**  Reject articles we don't like.
+**  Call filter_art with a dictionary of all the headers of the article,
+**  its body and its line count.
 */
-char *
-PYartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
+static PyObject *
+PYartdict(const ARTDATA *data, char *artBody, long artLen, int lines)
 {
     const HDRCONTENT *hc = data->HdrContent;
     int		hdrnum;
     int		i;
-    static char buf[256];
     PyObject	*result;
 
-    if (!PythonFilterActive || PYFilterObject == NULL || art_method == NULL)
-	return NULL;
-
     /* Add headers to the dictionary... */
     hdrnum = 0;
     for (i = 0 ; i < MAX_ARTHEADER ; i++) {
@@ -154,13 +174,8 @@ PYartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
     PYheaditem[hdrnum] = PyInt_FromLong((long) lines);
     PyDict_SetItem(PYheaders, PYlineskey, PYheaditem[hdrnum++]);
 
-    /* Now see if the filter likes it. */
+    /* Now see what the filter thinks of it. */
     result = PyObject_CallFunction(art_method, (char *) "O", PYheaders);
-    if ((result != NULL) && PyObject_IsTrue(result))
-	strlcpy(buf, PyString_AS_STRING(result), sizeof(buf));
-    else
-	*buf = '\0';
-    Py_XDECREF(result);
 
     /* Clean up after ourselves. */
     PyDict_Clear(PYheaders);
@@ -168,6 +183,74 @@ PYartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
 	if (PYheaditem[i] != Py_None) {
 	    Py_DECREF(PYheaditem[i]);
         }
+    return result;
+}
+
+
+
+/*
+**  Call filter_article with an article object pointing into the article,
+**  which only makes the items the filter looks at.  Once the call returns,
+**  the object no longer answers, since the article may go away.
+*/
+static PyObject *
+PYartobject(const ARTDATA *data, char *artBody, long artLen, int lines)
+{
+    PyObject	*result;
+
+    if (PYart == NULL) {
+        PYart = PyObject_New(PYarticle, &PYarticletype);
+        if (PYart == NULL)
+            return NULL;
+    }
+    PYart->hc = data->HdrContent;
+    if (artLen && artBody != NULL) {
+        PYart->body = artBody;
+        PYart->bodylen = artLen - 1;
+    } else {
+        PYart->body = NULL;
+        PYart->bodylen = 0;
+    }
+    PYart->lines = lines;
+
+    result = PyObject_CallFunction(article_method, (char *) "O", PYart);
+
+    PYart->hc = NULL;
+    PYart->body = NULL;
+    if (Py_REFCNT(PYart) > 1) {
+        Py_DECREF(PYart);
+        PYart = NULL;
+    }
+    return result;
+}
+
+
+
+/*
+**  Reject articles we don't like.  filter_article is used when the filter
+**  defines it, and filter_art otherwise.
+*/
+char *
+PYartfilter(const ARTDATA *data, char *artBody, long artLen, int lines)
+{
+    static char buf[256];
+    PyObject	*result;
+
+    if (!PythonFilterActive || PYFilterObject == NULL)
+	return NULL;
+    if (article_method != NULL)
+        result = PYartobject(data, artBody, artLen, lines);
+    else if (art_method != NULL)
+        result = PYartdict(data, artBody, artLen, lines);
+    else
+        return NULL;
+
+    /* See if the filter likes it. */
+    if ((result != NULL) && PyObject_IsTrue(result))
+	strlcpy(buf, PyString_AS_STRING(result), sizeof(buf));
+    else
+	*buf = '\0';
+    Py_XDECREF(result);
 
     if (*buf != '\0')
 	return buf;
@@ -553,6 +636,183 @@ PY_hashstring(PyObject *self UNUSED, PyObject *args)
 
 
 
+/*
+**  Return the name of a header given as a key of an article object, and set
+**  len to its length, or return NULL if it is not a string.
+*/
+static const char *
+PYarticle_keyname(PyObject *key, Py_ssize_t *len)
+{
+    const char *name;
+
+#if PY_MAJOR_VERSION >= 3
+    if (!PyUnicode_Check(key))
+        return NULL;
+    name = PyUnicode_AsUTF8AndSize(key, len);
+    if (name == NULL)
+        PyErr_Clear();
+#else
+    if (!PyString_Check(key))
+        return NULL;
+    name = PyString_AS_STRING(key);
+    *len = PyString_GET_SIZE(key);
+#endif
+    return name;
+}
+
+
+
+/*
+**  Look up an item of an article object.  The headers are found through
+**  innd's header table, so their names are matched without regard to case.
+**  Returns the same items as the dictionary given to filter_art, and raises
+**  KeyError for names which are not keys of that dictionary.
+*/
+static PyObject *
+PYarticle_subscript(PyObject *obj, PyObject *key)
+{
+    PYarticle *self = (PYarticle *) obj;
+    const HDRCONTENT *hc = self->hc;
+    const ARTHEADER *hp;
+    const char *name;
+    Py_ssize_t len;
+    int i;
+
+    if (hc == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "article no longer available");
+        return NULL;
+    }
+    name = PYarticle_keyname(key, &len);
+    if (name == NULL) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    if (len == 8 && memcmp(name, "__BODY__", 8) == 0) {
+        if (self->body == NULL)
+            Py_RETURN_NONE;
+        return PYBUFF_FROMREADONLY(self->body, self->bodylen);
+    }
+    if (len == 9 && memcmp(name, "__LINES__", 9) == 0)
+        return PyInt_FromLong((long) self->lines);
+    hp = (len > INT_MAX) ? NULL : ARTfindheader(name, (int) len);
+    if (hp == NULL) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    i = hp - ARTheaders;
+    if (!HDR_FOUND(i))
+        Py_RETURN_NONE;
+    return PYBUFF_FROMREADONLY(HDR(i), HDR_LEN(i));
+}
+
+
+
+/*
+**  The number of items of an article object, which like the dictionary
+**  given to filter_art has all the headers known to innd.
+*/
+static Py_ssize_t
+PYarticle_length(PyObject *obj UNUSED)
+{
+    return MAX_ARTHEADER + 2;
+}
+
+
+
+/*
+**  Whether a name is a key of an article object.
+*/
+static int
+PYarticle_contains(PyObject *obj UNUSED, PyObject *key)
+{
+    const char *name;
+    Py_ssize_t len;
+
+    name = PYarticle_keyname(key, &len);
+    if (name == NULL)
+        return 0;
+    if ((len == 8 && memcmp(name, "__BODY__", 8) == 0)
+        || (len == 9 && memcmp(name, "__LINES__", 9) == 0))
+        return 1;
+    return len <= INT_MAX && ARTfindheader(name, (int) len) != NULL;
+}
+
+
+
+/*
+**  Return the list of the keys of an article object.
+*/
+static PyObject *
+PYarticle_keys(PyObject *obj UNUSED, PyObject *args UNUSED)
+{
+    PyObject *keys;
+    int i;
+
+    keys = PyList_New(MAX_ARTHEADER + 2);
+    if (keys == NULL)
+        return NULL;
+    for (i = 0; i < MAX_ARTHEADER; i++) {
+        Py_INCREF(PYheadkey[i]);
+        PyList_SET_ITEM(keys, i, PYheadkey[i]);
+    }
+    Py_INCREF(PYbodykey);
+    PyList_SET_ITEM(keys, i++, PYbodykey);
+    Py_INCREF(PYlineskey);
+    PyList_SET_ITEM(keys, i, PYlineskey);
+    return keys;
+}
+
+
+
+/*
+**  Iterate over the keys of an article object.
+*/
+static PyObject *
+PYarticle_iter(PyObject *obj)
+{
+    PyObject *keys, *iter;
+
+    keys = PYarticle_keys(obj, NULL);
+    if (keys == NULL)
+        return NULL;
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+
+
+/*
+**  Like dict.get, return an item of an article object or a default value
+**  if it is not a key.
+*/
+static PyObject *
+PYarticle_get(PyObject *obj, PyObject *args)
+{
+    PyObject *key, *value;
+    PyObject *fallback = Py_None;
+
+    if (!PyArg_ParseTuple(args, (char *) "O|O:get", &key, &fallback))
+        return NULL;
+    value = PYarticle_subscript(obj, key);
+    if (value == NULL && PyErr_ExceptionMatches(PyExc_KeyError)) {
+        PyErr_Clear();
+        Py_INCREF(fallback);
+        value = fallback;
+    }
+    return value;
+}
+
+
+
+static void
+PYarticle_dealloc(PyObject *obj)
+{
+    PyObject_Del(obj);
+}
+
+
+
 /*
 **  Make the internal INN module's functions visible to Python.  Python
 **  annoyingly doesn't use const where appropriate in its structure
@@ -575,6 +835,20 @@ static PyMethodDef INNPyMethods[] = {
     METHOD(NULL,              NULL,               0,            "")
 };
 
+static PyMethodDef PYarticlemethods[] = {
+    METHOD("get",             PYarticle_get,      METH_VARARGS, ""),
+    METHOD("keys",            PYarticle_keys,     METH_NOARGS,  ""),
+    METHOD(NULL,              NULL,               0,            "")
+};
+
+static PyMappingMethods PYarticlemapping = {
+    PYarticle_length,                     /* mp_length */
+    PYarticle_subscript,                  /* mp_subscript */
+    NULL,                                 /* mp_ass_subscript */
+};
+
+static PySequenceMethods PYarticlesequence;
+
 #if PY_MAJOR_VERSION >= 3
 static struct PyModuleDef INNPyModule = {
     PyModuleDef_HEAD_INIT,                /* m_base */
@@ -666,6 +940,7 @@ PYdefmethods(void)
 {
     PYdefonemethod(&msgid_method, "filter_messageid");
     PYdefonemethod(&art_method, "filter_art");
+    PYdefonemethod(&article_method, "filter_article");
     PYdefonemethod(&mode_method, "filter_mode");
     PYdefonemethod(&pre_reload_method, "filter_before_reload");
     PYdefonemethod(&close_method, "filter_close");
@@ -800,6 +1075,19 @@ PYsetup(void)
     PYlineskey = PyString_InternFromString("__LINES__");
     PYbodykey = PyString_InternFromString("__BODY__");
 
+    /* Set up the type of the article given to filter_article. */
+    PYarticlesequence.sq_contains = PYarticle_contains;
+    PYarticletype.tp_name = (char *) "INN.Article";
+    PYarticletype.tp_basicsize = sizeof(PYarticle);
+    PYarticletype.tp_dealloc = PYarticle_dealloc;
+    PYarticletype.tp_as_sequence = &PYarticlesequence;
+    PYarticletype.tp_as_mapping = &PYarticlemapping;
+    PYarticletype.tp_flags = Py_TPFLAGS_DEFAULT;
+    PYarticletype.tp_iter = PYarticle_iter;
+    PYarticletype.tp_methods = PYarticlemethods;
+    if (PyType_Ready(&PYarticletype) < 0)
+        syslog(L_ERROR, "failed to set up the python article type");
+
     syslog(L_NOTICE, "python interpreter initialized OK");
 }
 
@@ -34,6 +34,7 @@ typedef struct _REMOTEHOST {
     char	*Label;         /* Peer label */
     char	*Name;          /* Hostname */
     struct sockaddr_storage Address;     /* List of ip addresses */
+    int		Bits;		/* Length of the prefix of Address */
     char	*Password;      /* Optional password */
     char 	*Identd;	/* Optional identd */
     bool	Streaming;      /* Streaming allowed ? */
@@ -41,12 +42,15 @@ typedef struct _REMOTEHOST {
     bool        Ignore;        /* Ignore articles sent by this peer? */
     bool	NoResendId;	/* Don't send RESEND responses ? */
     bool	Nolist;		/* no list command allowed */
+    bool	Backpressure;	/* Slowed down when storage is slow ? */
+    bool	Compress;	/* COMPRESS allowed ? */
     int		MaxCnx;		/* Max connections (per peer) */
     char	**Patterns;	/* List of groups allowed */
     char	*Pattern;       /* List of groups allowed (string) */
     char        *Email;         /* Email(s) of contact */
     char	*Comment;	/* Commentary [max size = MAXBUFF] */
     int		HoldTime;	/* Hold time before disconnect over MaxCnx */
+    int		Weight;		/* Share of the reads of the main loop */
     int		Keysetbit;	/* Bit to check duplicated key */
 } REMOTEHOST;
 
@@ -56,6 +60,31 @@ typedef struct _REMOTEHOST_DATA {
     char        *value;         /* Value */
 } REMOTEHOST_DATA;
 
+/*
+**  The peers are indexed by address in a binary trie, so that finding the
+**  peer of a connection doesn't depend on the size of incoming.conf.  IPv4
+**  addresses are mapped into IPv6 space (::ffff:a.b.c.d) so that a single
+**  trie of 128-bit keys holds both.  Each node records the first peer whose
+**  prefix ends there; a lookup returns the peer with the longest prefix
+**  matching the address, so that a single host always wins over a block.
+*/
+#define RC_HOSTBITS	128
+#define RC_V4BITS	96
+
+typedef struct _RCNODE {
+    unsigned int	Child[2];	/* Index of the children, 0 if none */
+    REMOTEHOST		*Peer;		/* Peer with exactly this prefix */
+} RCNODE;
+
+/*
+**  An ident query in progress, held as the Argument of a CTident channel.
+*/
+typedef struct _RCIDENT {
+    int		fd;		/* Connection waiting for the answer */
+    struct sockaddr_storage Address;	/* Address of that connection */
+    char	Query[32];	/* Query sent to the ident server */
+} RCIDENT;
+
 typedef struct _REMOTETABLE {
     struct sockaddr_storage Address;
     time_t         Expires;
@@ -69,6 +98,9 @@ static unsigned int	chanlimit;
 static REMOTEHOST_DATA	*RCpeerlistfile;
 static REMOTEHOST	*RCpeerlist;
 static int		RCnpeerlist;
+static RCNODE		*RCtrie;
+static unsigned int	RCtriesize;
+static unsigned int	RCtrieused;
 static char		RCbuff[BIG_BUFFER];
 
 #define PEER	        "peer"
@@ -86,11 +118,15 @@ static char		RCbuff[BIG_BUFFER];
 #define NORESENDID	"noresendid:"
 #define HOLD_TIME	"hold-time:"
 #define NOLIST		"nolist:"
+#define WEIGHT		"weight:"
+#define BACKPRESSURE	"backpressure:"
+#define COMPRESS	"compress:"
 
 typedef enum {K_END, K_BEGIN_PEER, K_BEGIN_GROUP, K_END_PEER, K_END_GROUP,
 	      K_STREAM, K_HOSTNAME, K_MAX_CONN, K_PASSWORD, K_IDENTD,
 	      K_EMAIL, K_PATTERNS, K_COMMENT, K_SKIP, K_IGNORE, K_NORESENDID,
-	      K_HOLD_TIME, K_NOLIST
+	      K_HOLD_TIME, K_NOLIST, K_WEIGHT, K_BACKPRESSURE,
+	      K_COMPRESS
 	     } _Keywords;
 
 typedef enum {T_STRING, T_BOOLEAN, T_INTEGER} _Types;
@@ -115,109 +151,291 @@ static REMOTETABLE	remotetable[REMOTETABLESIZE];
 static int		remotecount;
 static int		remotefirst;
 
+static void RCaccept(int fd, const struct sockaddr_storage *remote,
+                     bool identok);
+
 /*
- * Check that the client has the right identd. Return true if is the
- * case, false, if not.
- */
+**  Return the key under which an address is indexed in RCtrie, mapping IPv4
+**  addresses into IPv6 space.  Returns false for other address families.
+*/
 static bool
-GoodIdent(int fd, char *identd)
+RCaddrkey(const struct sockaddr *sa, unsigned char key[16])
+{
+    const struct sockaddr_in *sin;
+#ifdef HAVE_INET6
+    const struct sockaddr_in6 *sin6;
+#endif
+
+    if (sa->sa_family == AF_INET) {
+        sin = (const struct sockaddr_in *) (const void *) sa;
+        memset(key, 0, 10);
+        key[10] = 0xff;
+        key[11] = 0xff;
+        memcpy(key + 12, &sin->sin_addr, 4);
+        return true;
+    }
+#ifdef HAVE_INET6
+    if (sa->sa_family == AF_INET6) {
+        sin6 = (const struct sockaddr_in6 *) (const void *) sa;
+        memcpy(key, &sin6->sin6_addr, 16);
+        return true;
+    }
+#endif
+    return false;
+}
+
+/*
+**  Add a peer to RCtrie, unless an earlier peer has the same prefix.
+*/
+static void
+RCindex(REMOTEHOST *rp)
+{
+    unsigned char key[16];
+    unsigned int node, bit;
+    int i;
+
+    if (!RCaddrkey((struct sockaddr *) &rp->Address, key))
+        return;
+    for (node = 0, i = 0; i < rp->Bits; i++) {
+        bit = (key[i / 8] >> (7 - i % 8)) & 1;
+        if (RCtrie[node].Child[bit] == 0) {
+            if (RCtrieused == RCtriesize) {
+                RCtriesize *= 2;
+                RCtrie = xrealloc(RCtrie, RCtriesize * sizeof(RCNODE));
+            }
+            memset(&RCtrie[RCtrieused], 0, sizeof(RCNODE));
+            RCtrie[node].Child[bit] = RCtrieused++;
+        }
+        node = RCtrie[node].Child[bit];
+    }
+    if (RCtrie[node].Peer == NULL)
+        RCtrie[node].Peer = rp;
+}
+
+/*
+**  Return the peer matching an address with the longest prefix, or NULL if
+**  the address isn't one of our peers.
+*/
+static REMOTEHOST *
+RCfind(const struct sockaddr *sa)
+{
+    unsigned char key[16];
+    unsigned int node;
+    REMOTEHOST *rp;
+    int i;
+
+    if (RCtrie == NULL || !RCaddrkey(sa, key))
+        return NULL;
+    for (rp = NULL, node = 0, i = 0; ; i++) {
+        if (RCtrie[node].Peer != NULL)
+            rp = RCtrie[node].Peer;
+        if (i == RC_HOSTBITS)
+            break;
+        node = RCtrie[node].Child[(key[i / 8] >> (7 - i % 8)) & 1];
+        if (node == 0)
+            break;
+    }
+    return rp;
+}
+
+/*
+**  Parse the answer of an ident server, and return whether it names the
+**  expected user.
+*/
+static bool
+RCidentmatch(char *buf, ssize_t lu, const char *identd)
 {
-#define PORT_IDENTD 113
     char IDENTuser[80];
-    struct sockaddr *s_local;
-    struct sockaddr *s_distant = NULL;
-    int ident_fd;
-    socklen_t local_len, distant_len;
-    int port1,port2;
+    char *buf2;
+
+    buf[lu] = '\0';
+    if ((lu > 0) && (strstr(buf, "ERROR") == NULL)
+        && ((buf2 = strrchr(buf, ':')) != NULL)) {
+	buf2++;
+	while (*buf2 == ' ')
+            buf2++;
+	strlcpy(IDENTuser, buf2, sizeof(IDENTuser));
+	buf2 = strchr(IDENTuser, '\r');
+	if (!buf2)
+            buf2 = strchr(IDENTuser, '\n');
+	if (buf2)
+            *buf2 = '\0';
+    } else
+        strlcpy(IDENTuser, "UNKNOWN", sizeof(IDENTuser));
+    return strcmp(identd, IDENTuser) == 0;
+}
+
+/*
+**  Called when the ident server answered, or when its connection failed.
+**  Accept the waiting connection with the verdict.  The peer is looked up
+**  again, since incoming.conf may have been reloaded in the meantime.
+*/
+static void
+RCidentreader(CHANNEL *cp)
+{
+    RCIDENT *ip;
+    REMOTEHOST *rp;
+    char buf[80];
     ssize_t lu;
-    char buf[80], *buf2;
+    bool good;
 
-    if (identd[0] == '\0')
-         return true;
+    lu = read(cp->fd, buf, sizeof(buf) - 1);
+    /* Avoid -Wlogical-op warnings if EWOULDBLOCK == EAGAIN. */
+    if (lu < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (lu < 0 && errno == EWOULDBLOCK)
+        return;
+    ip = cp->Argument;
+    cp->Argument = NULL;
+    rp = RCfind((struct sockaddr *) &ip->Address);
+    if (rp == NULL || rp->Identd[0] == '\0')
+        good = true;
+    else if (lu < 0) {
+	syslog(L_ERROR, "error reading from ident server: %m");
+        good = false;
+    } else
+        good = RCidentmatch(buf, lu, rp->Identd);
+    CHANclose(cp, CHANname(cp));
+    RCaccept(ip->fd, &ip->Address, good);
+    free(ip);
+}
 
-    s_local = xmalloc(sizeof(struct sockaddr_storage));
-    local_len = sizeof(struct sockaddr_storage);
-    if ((getsockname(fd, s_local, &local_len)) < 0) {
+/*
+**  Called when the query has been sent to the ident server.  The channel
+**  was left in the read mask, so there is nothing more to do than wait.
+*/
+static void
+RCidentwritedone(CHANNEL *cp)
+{
+    cp->State = CSwaiting;
+}
+
+/*
+**  Start checking the identity of the user who opened a connection from a
+**  peer with an identd: key.  Waiting for the ident server would block innd
+**  for as long as it takes to answer, so the query is sent on a CTident
+**  channel and the connection is held until RCidentreader gets the answer,
+**  or RCidentclose if it doesn't come within REJECT_TIMEOUT seconds.
+*/
+static void
+RCidentstart(int fd, const struct sockaddr_storage *remote)
+{
+#define PORT_IDENTD 113
+    struct sockaddr_storage s_local, s_distant;
+    socklen_t local_len, distant_len;
+    int ident_fd = -1;
+    int port1, port2;
+    char buf[32];
+    RCIDENT *ip;
+    CHANNEL *cp;
+
+    local_len = sizeof(s_local);
+    if ((getsockname(fd, (struct sockaddr *) &s_local, &local_len)) < 0) {
 	syslog(L_ERROR, "can't do getsockname for identd");
         goto fail;
     }
-    s_distant = xmalloc(sizeof(struct sockaddr_storage));
-    distant_len = sizeof(struct sockaddr_storage);
-    if ((getpeername(fd, s_distant, &distant_len)) < 0) {
+    distant_len = sizeof(s_distant);
+    if ((getpeername(fd, (struct sockaddr *) &s_distant, &distant_len)) < 0) {
 	syslog(L_ERROR, "can't do getpeername for identd");
         goto fail;
     }
 #ifdef HAVE_INET6
-    if (s_local->sa_family == AF_INET6)
-    {
-        port1 = ntohs(((struct sockaddr_in6 *) (void *) s_local)->sin6_port);
-        port2 = ntohs(((struct sockaddr_in6 *) (void *) s_distant)->sin6_port);
-        ((struct sockaddr_in6 *) (void *) s_local)->sin6_port = 0;
-        ((struct sockaddr_in6 *) (void *) s_distant)->sin6_port = htons(PORT_IDENTD);
+    if (s_local.ss_family == AF_INET6) {
+        struct sockaddr_in6 *l6 = (struct sockaddr_in6 *) (void *) &s_local;
+        struct sockaddr_in6 *d6 = (struct sockaddr_in6 *) (void *) &s_distant;
+
+        port1 = ntohs(l6->sin6_port);
+        port2 = ntohs(d6->sin6_port);
+        l6->sin6_port = 0;
+        d6->sin6_port = htons(PORT_IDENTD);
 	ident_fd = socket(PF_INET6, SOCK_STREAM, 0);
     } else
 #endif
-    if (s_local->sa_family == AF_INET)
-    {
-        port1 = ntohs(((struct sockaddr_in *) (void *) s_local)->sin_port);
-        port2 = ntohs(((struct sockaddr_in *) (void *) s_distant)->sin_port);
-        ((struct sockaddr_in *) (void *) s_local)->sin_port = 0;
-        ((struct sockaddr_in *) (void *) s_distant)->sin_port = htons(PORT_IDENTD);
+    if (s_local.ss_family == AF_INET) {
+        struct sockaddr_in *l4 = (struct sockaddr_in *) (void *) &s_local;
+        struct sockaddr_in *d4 = (struct sockaddr_in *) (void *) &s_distant;
+
+        port1 = ntohs(l4->sin_port);
+        port2 = ntohs(d4->sin_port);
+        l4->sin_port = 0;
+        d4->sin_port = htons(PORT_IDENTD);
 	ident_fd = socket(PF_INET, SOCK_STREAM, 0);
-    } else
-    {
-	syslog(L_ERROR, "Bad address family: %d\n", s_local->sa_family);
+    } else {
+	syslog(L_ERROR, "Bad address family: %d\n", s_local.ss_family);
         goto fail;
     }
     if (ident_fd < 0) {
 	syslog(L_ERROR, "can't open socket for identd (%m)");
         goto fail;
     }
-    if (bind(ident_fd, s_local, local_len) < 0) {
+    if (!fdflag_nonblocking(ident_fd, true)) {
+	syslog(L_ERROR, "can't nonblock socket for identd (%m)");
+        goto fail;
+    }
+    if (bind(ident_fd, (struct sockaddr *) &s_local, local_len) < 0) {
 	syslog(L_ERROR, "can't bind socket for identd (%m)");
-        close(ident_fd);
         goto fail;
     }
-    if (connect(ident_fd, s_distant, distant_len) < 0) {
+    if (connect(ident_fd, (struct sockaddr *) &s_distant, distant_len) < 0
+        && errno != EINPROGRESS) {
 	syslog(L_ERROR, "can't connect to identd (%m)");
-        close(ident_fd);
         goto fail;
     }
-    free(s_local);
-    free(s_distant);
-
-    snprintf(buf,sizeof(buf),"%d,%d\r\n",port2, port1);
-    write(ident_fd,buf, strlen(buf));
-    memset( buf, 0, 80 );
-    lu=read(ident_fd, buf, 79); /* pas encore parfait ("not yet perfect"?) */
-    if (lu<0)
-    {
-	syslog(L_ERROR, "error reading from ident server: %m" );
-	close( ident_fd );
-	return false;
-    }
-    buf[lu]='\0';
-    if ((lu>0) && (strstr(buf,"ERROR")==NULL)
-		    && ((buf2=strrchr(buf,':'))!=NULL)) 
-    {
-	buf2++;
-	while(*buf2 == ' ') buf2++;
-	strlcpy(IDENTuser, buf2, sizeof(IDENTuser));
-	buf2=strchr(IDENTuser,'\r');
-	if (!buf2) buf2=strchr(IDENTuser,'\n');
-	if (buf2) *buf2='\0';
-    } else
-        strlcpy(IDENTuser, "UNKNOWN", sizeof(IDENTuser));
-    close(ident_fd);
 
-    return strcmp(identd, IDENTuser) == 0;
+    /* The query is written once the connection is established; a failed
+       connection makes the socket readable, and RCidentreader then gets the
+       error. */
+    ip = xmalloc(sizeof(RCIDENT));
+    ip->fd = fd;
+    memcpy(&ip->Address, remote, sizeof(ip->Address));
+    cp = CHANcreate(ident_fd, CTident, CSwriting, RCidentreader,
+                    RCidentwritedone);
+    memcpy(&cp->Address, remote, sizeof(cp->Address));
+    cp->Argument = ip;
+    snprintf(buf, sizeof(buf), "%d,%d\r\n", port2, port1);
+    WCHANset(cp, buf, strlen(buf));
+    WCHANadd(cp);
+    return;
 
 fail:
-    if (s_local != NULL)
-        free(s_local);
-    if (s_distant != NULL)
-        free(s_distant);
-    return false;
+    if (ident_fd >= 0)
+        close(ident_fd);
+    RCaccept(fd, remote, false);
+}
+
+/*
+**  Called by CHANclose for a CTident channel.  If the ident server never
+**  answered, either because it timed out or because the query couldn't be
+**  written, accept the waiting connection as if the identity were wrong.
+*/
+void
+RCidentclose(CHANNEL *cp)
+{
+    RCIDENT *ip;
+
+    ip = cp->Argument;
+    if (ip == NULL)
+        return;
+    cp->Argument = NULL;
+    RCaccept(ip->fd, &ip->Address, false);
+    free(ip);
+}
+
+/*
+**  Drop the connection waiting for the answer to an ident query, without
+**  accepting it.  Used when shutting down and in child processes.
+*/
+void
+RCidentforget(CHANNEL *cp)
+{
+    RCIDENT *ip;
+
+    ip = cp->Argument;
+    if (ip == NULL)
+        return;
+    cp->Argument = NULL;
+    close(ip->fd);
+    free(ip);
 }
 
 /*
@@ -266,19 +484,17 @@ bool
 RCauthorized(CHANNEL *cp, char *pass)
 {
     REMOTEHOST *rp;
-    int	i;
     char addr[INET6_ADDRSTRLEN];
 
     network_sockaddr_sprint(addr, sizeof(addr),
                             (struct sockaddr *) &cp->Address);
-    for (rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++)
-	if (network_sockaddr_equal((struct sockaddr *) &cp->Address,
-                                   (struct sockaddr *) &rp->Address)) {
-	    if (rp->Password[0] == '\0' || strcmp(pass, rp->Password) == 0)
-		return true;
-            warn("%s (%s) bad_auth", rp->Label, addr);
-	    return false;
-	}
+    rp = RCfind((struct sockaddr *) &cp->Address);
+    if (rp != NULL) {
+        if (rp->Password[0] == '\0' || strcmp(pass, rp->Password) == 0)
+            return true;
+        warn("%s (%s) bad_auth", rp->Label, addr);
+        return false;
+    }
 
     /* Not found in our table; this can't happen. */
     if (!AnyIncoming)
@@ -295,12 +511,10 @@ bool
 RCnolimit(CHANNEL *cp)
 {
     REMOTEHOST	*rp;
-    int		i;
 
-    for (rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++)
-	if (network_sockaddr_equal((struct sockaddr *) &cp->Address,
-                                   (struct sockaddr *) &rp->Address))
-            return !rp->MaxCnx;
+    rp = RCfind((struct sockaddr *) &cp->Address);
+    if (rp != NULL)
+        return !rp->MaxCnx;
 
     /* Not found in our table; this can't happen. */
     return false;
@@ -313,12 +527,10 @@ int
 RClimit(CHANNEL *cp)
 {
     REMOTEHOST	*rp;
-    int		i;
 
-    for (rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++)
-	if (network_sockaddr_equal((struct sockaddr *) &cp->Address,
-                                   (struct sockaddr *) &rp->Address))
-	    return rp->MaxCnx;
+    rp = RCfind((struct sockaddr *) &cp->Address);
+    if (rp != NULL)
+        return rp->MaxCnx;
     /* Not found in our table; this can't happen. */
     return RemoteLimit;
 }
@@ -429,15 +641,12 @@ RCreader(CHANNEL *cp)
     unsigned int        j;
     REMOTEHOST          *rp;
     CHANNEL		*new;
-    char		*name;
     long		reject_val = 0;
     char		*reject_message;
     int			count;
     int			found;
     time_t		now;
     CHANNEL		tempchan;
-    char		buff[SMBUF];
-    char                addr[INET6_ADDRSTRLEN];
 
     for (j = 0 ; j < chanlimit ; j++) {
 	if (RCchan[j] == cp) {
@@ -549,20 +758,40 @@ RCreader(CHANNEL *cp)
 	return;
     }
 
-    /* See if it's one of our servers. */
-    for (name = NULL, rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++)
-	if (network_sockaddr_equal((struct sockaddr *) &rp->Address,
-                                   (struct sockaddr *) &remote)) {
-	    name = rp->Name;
-	    break;
-	}
+    /* See if it's one of our servers, and check its identd if needed. */
+    rp = RCfind((struct sockaddr *) &remote);
+    if (rp != NULL && !rp->Skip && rp->Identd[0] != '\0')
+        RCidentstart(fd, &remote);
+    else
+        RCaccept(fd, &remote, true);
+}
+
+
+/*
+**  Accept a connection once we know whether it comes from one of our
+**  servers whose identd, if any, is right.  Create an NNTP channel for it
+**  or spawn an nnrpd to handle it.
+*/
+static void
+RCaccept(int fd, const struct sockaddr_storage *remote, bool identok)
+{
+    REMOTEHOST          *rp;
+    CHANNEL		*new;
+    char		*name;
+    long		reject_val;
+    char		*reject_message;
+    char		buff[SMBUF];
+    char                addr[INET6_ADDRSTRLEN];
+
+    rp = RCfind((const struct sockaddr *) remote);
+    name = (rp != NULL && rp->Bits == RC_HOSTBITS) ? rp->Name : NULL;
 
     /* If not a server, and not allowing anyone, hand him off unless
        not spawning nnrpd in which case we return an error. */
-    if ((i >= 0) && !rp->Skip) {
+    if (rp != NULL && !rp->Skip) {
 
-	/* We check now the identd if we have to */
-	if(! GoodIdent(fd, rp->Identd))
+	/* The identd was checked by RCidentstart if we had to. */
+	if (!identok)
 	{
 	    if (!innconf->noreader) {
 		RChandoff(fd, HOnntpd);
@@ -578,10 +807,13 @@ RCreader(CHANNEL *cp)
             new->Ignore = rp->Ignore;
             new->NoResendId = rp->NoResendId;
             new->Nolist = rp->Nolist;
+            new->Backpressure = rp->Backpressure;
+            new->Compress = rp->Compress;
             new->CanAuthenticate = true; /* Can use AUTHINFO. */
             new->MaxCnx = rp->MaxCnx;
             new->HoldTime = rp->HoldTime;
-	    memcpy(&new->Address, &remote, sizeof(new->Address));
+            new->Weight = rp->Weight;
+	    memcpy(&new->Address, remote, sizeof(new->Address));
 	    if (new->MaxCnx > 0 && new->HoldTime == 0) {
 		CHANcount_active(new);
 		if((new->ActiveCnx > new->MaxCnx) && (new->fd > 0)) {
@@ -597,7 +829,7 @@ RCreader(CHANNEL *cp)
 		NCwritereply(new, (char *)NCgreeting);
 	    }
 	}
-    } else if (AnyIncoming && !rp->Skip) {
+    } else if (AnyIncoming && rp == NULL) {
 	if ((new = NCcreate(fd, false, false)) != NULL) {
 	    NCwritereply(new, (char *)NCgreeting);
 	}
@@ -611,7 +843,7 @@ RCreader(CHANNEL *cp)
 	xasprintf(&reject_message, "%d Permission denied", NNTP_ERR_ACCESS);
         new = CHANcreate(fd, CTreject, CSwritegoodbye, RCrejectreader,
             RCrejectwritedone);
-	memcpy(&new->Address, &remote, sizeof(new->Address));
+	memcpy(&new->Address, remote, sizeof(new->Address));
         /* Use cp->Rejected for the response code in CHANclose. */
         new->Rejected = reject_val;
         RCHANremove(new);
@@ -623,9 +855,9 @@ RCreader(CHANNEL *cp)
     }
 
     if (new != NULL) {
-	memcpy(&new->Address, &remote, sizeof(new->Address));
+	memcpy(&new->Address, remote, sizeof(new->Address));
         network_sockaddr_sprint(addr, sizeof(addr),
-                                (struct sockaddr *) &remote);
+                                (const struct sockaddr *) remote);
         notice("%s connected %d streaming %s", name ? name : addr, new->fd,
                (!StreamingOff && new->Streaming) ? "allowed" : "not allowed");
     }
@@ -821,6 +1053,7 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
     if (ret != 0)
         die("%s cant getaddrinfo 127.0.0.1: %s", LogName, gai_strerror(ret));
     memcpy(&rp->Address, ai->ai_addr, ai->ai_addrlen);
+    rp->Bits = RC_HOSTBITS;
     freeaddrinfo(ai);
     rp->Name = xstrdup("localhost");
     rp->Label = xstrdup("localhost");
@@ -835,7 +1068,10 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
     rp->Ignore = false;
     rp->NoResendId = false;
     rp->Nolist = false;
+    rp->Backpressure = false;
+    rp->Compress = false;
     rp->HoldTime = 0;
+    rp->Weight = 0;
     rp++;
     (*count)++;
 #endif	/* !defined(HAVE_UNIX_DOMAIN_SOCKETS) */
@@ -850,8 +1086,11 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
     default_params.Ignore = false;
     default_params.NoResendId = false;
     default_params.Nolist = false;
+    default_params.Backpressure = false;
+    default_params.Compress = false;
     default_params.MaxCnx = 0;
     default_params.HoldTime = 0;
+    default_params.Weight = 0;
     default_params.Password = xstrdup(NOPASS);
     default_params.Identd = xstrdup(NOIDENTD);
     default_params.Email = xstrdup(NOEMAIL);
@@ -897,6 +1136,10 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	  groups[groupcount - 2].NoResendId : default_params.NoResendId;
 	group_params->Nolist = groupcount > 1 ?
 	  groups[groupcount - 2].Nolist : default_params.Nolist;
+	group_params->Backpressure = groupcount > 1 ?
+	  groups[groupcount - 2].Backpressure : default_params.Backpressure;
+	group_params->Compress = groupcount > 1 ?
+	  groups[groupcount - 2].Compress : default_params.Compress;
 	group_params->Email = groupcount > 1 ?
 	  groups[groupcount - 2].Email : default_params.Email;
 	group_params->Comment = groupcount > 1 ?
@@ -911,6 +1154,8 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	  groups[groupcount - 2].MaxCnx : default_params.MaxCnx;
 	group_params->HoldTime = groupcount > 1 ?
 	  groups[groupcount - 2].HoldTime : default_params.HoldTime;
+	group_params->Weight = groupcount > 1 ?
+	  groups[groupcount - 2].Weight : default_params.Weight;
 
 	if ((word = RCreaddata (&linecount, F, &toolong)) == NULL) {
 	  syslog(L_ERROR, LEFT_BRACE, LogName, filename, linecount);
@@ -956,6 +1201,10 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	  group_params->NoResendId : default_params.NoResendId;
 	peer_params.Nolist = groupcount > 0 ?
 	  group_params->Nolist : default_params.Nolist;
+	peer_params.Backpressure = groupcount > 0 ?
+	  group_params->Backpressure : default_params.Backpressure;
+	peer_params.Compress = groupcount > 0 ?
+	  group_params->Compress : default_params.Compress;
 	peer_params.Email = groupcount > 0 ?
 	  group_params->Email : default_params.Email;
 	peer_params.Comment = groupcount > 0 ?
@@ -970,6 +1219,8 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	  group_params->MaxCnx : default_params.MaxCnx;
 	peer_params.HoldTime = groupcount > 0 ?
 	  group_params->HoldTime : default_params.HoldTime;
+	peer_params.Weight = groupcount > 0 ?
+	  group_params->Weight : default_params.Weight;
 
 	peer_params.Keysetbit = 0;
 
@@ -1001,7 +1252,9 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 
 	  for(r = q = RCCommaSplit(xstrdup(peer_params.Name)); *q != NULL; q++) {
 	      struct addrinfo *res, *res0, hints;
-	      int gai_ret;
+	      int gai_ret, bits, max;
+	      char *slash, *end;
+	      long prefix;
 
 	    (*count)++;
 
@@ -1013,13 +1266,36 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	    memset( &hints, 0, sizeof( hints ) );
 	    hints.ai_socktype = SOCK_STREAM;
 	    hints.ai_family = PF_UNSPEC;
-	    if ((gai_ret = getaddrinfo(*q, NULL, &hints, &res0)) != 0) {
+
+	    /* An address block is given as address/prefix-length. */
+	    if ((slash = strchr(*q, '/')) != NULL) {
+		*slash = '\0';
+		hints.ai_flags = AI_NUMERICHOST;
+	    }
+	    gai_ret = getaddrinfo(*q, NULL, &hints, &res0);
+	    if (slash != NULL)
+		*slash = '/';
+	    if (gai_ret != 0) {
 		syslog(L_ERROR, "%s cant getaddrinfo %s %s", LogName, *q,
 				gai_strerror( gai_ret ) );
 		/* decrement *count, since we never got to add this record. */
 		(*count)--;
 		continue;
 	    }
+	    bits = RC_HOSTBITS;
+	    if (slash != NULL) {
+		max = (res0->ai_family == AF_INET) ? 32 : 128;
+		errno = 0;
+		prefix = strtol(slash + 1, &end, 10);
+		if (slash[1] == '\0' || *end != '\0' || errno != 0
+		    || prefix < 0 || prefix > max) {
+		    syslog(L_ERROR, "%s bad prefix length in %s", LogName, *q);
+		    freeaddrinfo(res0);
+		    (*count)--;
+		    continue;
+		}
+		bits = (int) prefix + RC_HOSTBITS - max;
+	    }
 	    /* Count the addresses and see if we have to grow the list */
 	    i = 0;
 	    for (res = res0; res != NULL; res = res->ai_next)
@@ -1033,6 +1309,7 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	    /* Add all hosts */
 	    for (res = res0; res != NULL; res = res->ai_next) {
 		(void)memcpy(&rp->Address, res->ai_addr, res->ai_addrlen);
+		rp->Bits = bits;
 		rp->Name = xstrdup (*q);
 		rp->Label = xstrdup (peer_params.Label);
 		rp->Email = xstrdup(peer_params.Email);
@@ -1042,12 +1319,15 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
                 rp->Ignore = peer_params.Ignore;
 		rp->NoResendId = peer_params.NoResendId;
 		rp->Nolist = peer_params.Nolist;
+		rp->Backpressure = peer_params.Backpressure;
+		rp->Compress = peer_params.Compress;
 		rp->Password = xstrdup(peer_params.Password);
 		rp->Identd = xstrdup(peer_params.Identd);
 		rp->Patterns = peer_params.Pattern != NULL ?
 		    RCCommaSplit(xstrdup(peer_params.Pattern)) : NULL;
 		rp->MaxCnx = peer_params.MaxCnx;
 		rp->HoldTime = peer_params.HoldTime;
+		rp->Weight = peer_params.Weight;
 		rp++;
 	    }
 	    freeaddrinfo(res0);
@@ -1234,6 +1514,70 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	continue;
       }
 
+      /* backpressure */
+      if (!strncmp (word, BACKPRESSURE, sizeof BACKPRESSURE)) {
+	free(word);
+	TEST_CONFIG(K_BACKPRESSURE, bit);
+        if (bit) {
+	  syslog(L_ERROR, DUPLICATE_KEY, LogName, filename, linecount);
+	  break;
+	}
+	if ((word = RCreaddata (&linecount, F, &toolong)) == NULL) {
+	  break;
+	}
+	if (!strcmp (word, "true"))
+	  flag = true;
+	else
+	  if (!strcmp (word, "false"))
+	    flag = false;
+	  else {
+	    syslog(L_ERROR, MUST_BE_BOOL, LogName, filename, linecount);
+	    break;
+	  }
+	RCadddata(data, &infocount, K_BACKPRESSURE, T_STRING, word);
+	if (peer_params.Label != NULL)
+	  peer_params.Backpressure = flag;
+	else
+	  if (groupcount > 0 && group_params->Label != NULL)
+	    group_params->Backpressure = flag;
+	  else
+	    default_params.Backpressure = flag;
+	SET_CONFIG(K_BACKPRESSURE);
+	continue;
+      }
+
+      /* compress */
+      if (!strncmp (word, COMPRESS, sizeof COMPRESS)) {
+	free(word);
+	TEST_CONFIG(K_COMPRESS, bit);
+        if (bit) {
+	  syslog(L_ERROR, DUPLICATE_KEY, LogName, filename, linecount);
+	  break;
+	}
+	if ((word = RCreaddata (&linecount, F, &toolong)) == NULL) {
+	  break;
+	}
+	if (!strcmp (word, "true"))
+	  flag = true;
+	else
+	  if (!strcmp (word, "false"))
+	    flag = false;
+	  else {
+	    syslog(L_ERROR, MUST_BE_BOOL, LogName, filename, linecount);
+	    break;
+	  }
+	RCadddata(data, &infocount, K_COMPRESS, T_STRING, word);
+	if (peer_params.Label != NULL)
+	  peer_params.Compress = flag;
+	else
+	  if (groupcount > 0 && group_params->Label != NULL)
+	    group_params->Compress = flag;
+	  else
+	    default_params.Compress = flag;
+	SET_CONFIG(K_COMPRESS);
+	continue;
+      }
+
       /* max-connections */
       if (!strncmp (word, MAX_CONN, sizeof MAX_CONN)) {
 	int max;
@@ -1296,6 +1640,34 @@ RCreadfile (REMOTEHOST_DATA **data, REMOTEHOST **list, int *count,
 	continue;
       }
 
+      /* weight */
+      if (!strncmp (word, WEIGHT, sizeof WEIGHT)) {
+	free(word);
+	TEST_CONFIG(K_WEIGHT, bit);
+        if (bit) {
+	  syslog(L_ERROR, DUPLICATE_KEY, LogName, filename, linecount);
+	  break;
+	}
+	if ((word = RCreaddata (&linecount, F, &toolong)) == NULL) {
+	  break;
+	}
+	RCadddata(data, &infocount, K_WEIGHT, T_STRING, word);
+	for (p = word; isdigit((unsigned char) *p) && *p != '\0'; p++);
+	if (*p != '\0') {
+	  syslog(L_ERROR, MUST_BE_INT, LogName, filename, linecount);
+	  break;
+	}
+	if (peer_params.Label != NULL)
+	  peer_params.Weight = atoi(word);
+	else
+	  if (groupcount > 0 && group_params->Label != NULL)
+	    group_params->Weight = atoi(word);
+	  else
+	    default_params.Weight = atoi(word);
+	SET_CONFIG(K_WEIGHT);
+	continue;
+      }
+
       /* hostname */
       if (!strncmp (word, HOSTNAME, sizeof HOSTNAME)) {
 	free(word);
@@ -1571,6 +1943,18 @@ RCwritelist(char *filename)
 	    RCwritelistvalue (F, RCpeerlistfile[i].value);
 	    fputc ('\n', F);
 	    break;
+	  case K_BACKPRESSURE:
+	    RCwritelistindent (F, inc);
+	    fprintf(F, "%s\t", BACKPRESSURE);
+	    RCwritelistvalue (F, RCpeerlistfile[i].value);
+	    fputc ('\n', F);
+	    break;
+	  case K_COMPRESS:
+	    RCwritelistindent (F, inc);
+	    fprintf(F, "%s\t", COMPRESS);
+	    RCwritelistvalue (F, RCpeerlistfile[i].value);
+	    fputc ('\n', F);
+	    break;
 	  case K_HOSTNAME:
 	    RCwritelistindent (F, inc);
 	    fprintf(F, "%s\t", HOSTNAME);
@@ -1589,6 +1973,12 @@ RCwritelist(char *filename)
 	    RCwritelistvalue (F, RCpeerlistfile[i].value);
 	    fputc ('\n', F);
 	    break;
+	  case K_WEIGHT:
+	    RCwritelistindent (F, inc);
+	    fprintf(F, "%s\t", WEIGHT);
+	    RCwritelistvalue (F, RCpeerlistfile[i].value);
+	    fputc ('\n', F);
+	    break;
 	  case K_PASSWORD:
 	    RCwritelistindent (F, inc);
 	    fprintf(F, "%s\t", PASSWORD);
@@ -1632,12 +2022,23 @@ void
 RCreadlist(void)
 {
     static char	*INNDHOSTS = NULL;
+    int		i;
 
     if (INNDHOSTS == NULL)
 	INNDHOSTS = concatpath(innconf->pathetc, INN_PATH_INNDHOSTS);
     StreamingOff = false;
     RCreadfile(&RCpeerlistfile, &RCpeerlist, &RCnpeerlist, INNDHOSTS);
     /* RCwritelist("/tmp/incoming.conf.new"); */
+
+    /* Index the peers by address, in the order of the file. */
+    if (RCtrie == NULL) {
+        RCtriesize = 1024;
+        RCtrie = xmalloc(RCtriesize * sizeof(RCNODE));
+    }
+    memset(&RCtrie[0], 0, sizeof(RCNODE));
+    RCtrieused = 1;
+    for (i = 0; i < RCnpeerlist; i++)
+        RCindex(&RCpeerlist[i]);
 }
 
 /*
@@ -1650,12 +2051,11 @@ RChostname(const CHANNEL *cp)
 {
     static char	buff[INET6_ADDRSTRLEN];
     REMOTEHOST	*rp;
-    int		i;
 
-    for (rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++)
-	if (network_sockaddr_equal((struct sockaddr *) &cp->Address,
-                                   (struct sockaddr *) &rp->Address))
-	    return rp->Name;
+    /* A peer given as an address block has no name of its own. */
+    rp = RCfind((struct sockaddr *) &cp->Address);
+    if (rp != NULL && rp->Bits == RC_HOSTBITS)
+        return rp->Name;
     network_sockaddr_sprint(buff, sizeof(buff),
                             (struct sockaddr *) &cp->Address);
     return buff;
@@ -1667,14 +2067,9 @@ RChostname(const CHANNEL *cp)
 char *
 RClabelname(CHANNEL *cp) {
     REMOTEHOST	*rp;
-    int		i;
 
-    for (rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++) {
-	if (network_sockaddr_equal((struct sockaddr *) &cp->Address,
-                                   (struct sockaddr *) &rp->Address))
-	    return rp->Label;
-    }
-    return NULL;
+    rp = RCfind((struct sockaddr *) &cp->Address);
+    return rp != NULL ? rp->Label : NULL;
 }
 
 /*
@@ -1688,32 +2083,26 @@ RCcanpost(CHANNEL *cp, char *group)
     char	        subvalue;
     char	        **argv;
     char	        *pat;
-    int	                i;
 
     /* Connections from lc.c are from local nnrpd and should always work */
     if (cp->Address.ss_family == 0)
 	return 1;
 
-    for (rp = RCpeerlist, i = RCnpeerlist; --i >= 0; rp++) {
-	if (!network_sockaddr_equal((struct sockaddr *) &cp->Address,
-                                    (struct sockaddr *) &rp->Address))
-	    continue;
-	if (rp->Patterns == NULL)
-	    break;
-	for (match = 0, argv = rp->Patterns; (pat = *argv++) != NULL; ) {
-	    subvalue = (*pat != SUB_NEGATE) && (*pat != SUB_POISON) ?
-	      0 : *pat;
-	    if (subvalue)
-		pat++;
-	    if ((match != subvalue) && uwildmat(group, pat)) {
-		if (subvalue == SUB_POISON)
-		    return -1;
-		match = subvalue;
-	    }
-	}
-	return !match;
+    rp = RCfind((struct sockaddr *) &cp->Address);
+    if (rp == NULL || rp->Patterns == NULL)
+        return 1;
+    for (match = 0, argv = rp->Patterns; (pat = *argv++) != NULL; ) {
+        subvalue = (*pat != SUB_NEGATE) && (*pat != SUB_POISON) ?
+          0 : *pat;
+        if (subvalue)
+            pat++;
+        if ((match != subvalue) && uwildmat(group, pat)) {
+            if (subvalue == SUB_POISON)
+                return -1;
+            match = subvalue;
+        }
     }
-    return 1;
+    return !match;
 }
 
 
@@ -1868,9 +2257,16 @@ void
 RCclose(void)
 {
     REMOTEHOST   *rp;
+    CHANNEL      *cp;
     int          i;
     unsigned int j;
 
+    /* Drop the connections still waiting for an ident answer. */
+    for (i = 0; (cp = CHANiter(&i, CTident)) != NULL; ) {
+        RCidentforget(cp);
+        CHANclose(cp, CHANname(cp));
+    }
+
     for (j = 0 ; j < chanlimit ; j++) {
         if (RCchan[j] != NULL) {
             /* Do not close the listening sockets if socket activation is being
@@ -1904,6 +2300,10 @@ RCclose(void)
 	RCpeerlist = NULL;
 	RCnpeerlist = 0;
     }
+    free(RCtrie);
+    RCtrie = NULL;
+    RCtriesize = 0;
+    RCtrieused = 0;
 
     if (RCpeerlistfile) {
         for (i = 0; RCpeerlistfile[i].key != K_END; i++)
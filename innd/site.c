@@ -7,6 +7,7 @@
 #include "clibrary.h"
 
 #include "inn/fdflag.h"
+#include "inn/feedring.h"
 #include "inn/innconf.h"
 #include "innd.h"
 
@@ -164,6 +165,7 @@ SITEbufferoldest(void)
     /* If there's any unwritten data, copy it. */
     out = &sp->Channel->Out;
     if (out->left) {
+        buffer_ring_linearize(out);
         buffer_set(bp, &out->data[out->used], out->left);
 	out->left = 0;
     }
@@ -203,16 +205,13 @@ SITECHANbilge(SITE *sp)
     if (togo != NULL)
         free(togo);
     while (sp->Channel->Out.left > 0) {
-        i = write(fd, &sp->Channel->Out.data[sp->Channel->Out.used],
-                  sp->Channel->Out.left);
+        i = buffer_ring_write(&sp->Channel->Out, fd);
         if(i <= 0) {
             syslog(L_ERROR,"%s cant spool count %lu", CHANname(sp->Channel),
                 (unsigned long) sp->Channel->Out.left);
             close(fd);
             return false;
         }
-        sp->Channel->Out.left -= i;
-        sp->Channel->Out.used += i;
     }
     close(fd);
     free(sp->Channel->Out.data);
@@ -223,6 +222,34 @@ SITECHANbilge(SITE *sp)
     return true;
 }
 
+/*
+**  Whether a channel or exploder site whose queue has grown past its S
+**  limit should spool.  Without sitebuffermax, it always does.  Otherwise,
+**  the queues of those sites may use up to sitebuffermax KB together, and
+**  once they do, only the sites queuing more than their share of it spool.
+*/
+static bool
+SITEoverbudget(size_t queued)
+{
+    SITE	        *sp;
+    int	                i, n;
+    size_t	        budget, total;
+
+    if (innconf->sitebuffermax == 0)
+	return true;
+    budget = innconf->sitebuffermax * 1024;
+    for (total = 0, n = 0, sp = Sites, i = nSites; --i >= 0; sp++) {
+	if (sp->Name == NULL || sp->Channel == NULL
+	    || (sp->Type != FTchannel && sp->Type != FTexploder))
+	    continue;
+	total += sp->Channel->Out.left;
+	n++;
+    }
+    if (total < budget || n == 0)
+	return false;
+    return queued >= budget / n;
+}
+
 /*
 **  Check if we need to write out the site's buffer.  If we're buffered
 **  or the feed is backed up, this gets a bit complicated.
@@ -257,38 +284,18 @@ SITEflushcheck(SITE *sp, struct buffer *bp)
     i = cp->Out.left;
     if (i < sp->StopWriting)
 	WCHANremove(cp);
+    /* Channel feeds aren't written to right away either, so that the lines
+       queued for all the articles received until the channel is next
+       writable go out with a single write. */
     if ((sp->StartWriting == 0 || i > sp->StartWriting)
-     && !CHANsleeping(cp)) {
-	if (sp->Type == FTchannel) {	/* channel feed, try the write */
-	    int j;
-	    if (bp->left == 0)
-		return;
-	    j = write(cp->fd, &bp->data[bp->used], bp->left);
-	    if (j > 0) {
-		bp->left -= j;
-		bp->used += j;
-		i = cp->Out.left;
-		/* Since we just had a successful write, we need to clear the 
-		 * channel's error counts. - dave@jetcafe.org */
-		cp->BadWrites = 0;
-		cp->BlockedWrites = 0;
-	    }
-	    if (bp->left <= 0) {
-                /* reset Used, Left on bp, keep channel buffer size from
-                   exploding. */
-                bp->used = bp->left = 0;
-		WCHANremove(cp);
-            } else
-		WCHANadd(cp);
-	}
-	else
-	    WCHANadd(cp);
-    }
+     && !CHANsleeping(cp))
+	WCHANadd(cp);
 
     cp->LastActive = Now.tv_sec;
 
     /* If we're a channel that's getting big, see if we need to spool. */
-    if (sp->Type == FTfile || sp->StartSpooling == 0 || i < sp->StartSpooling)
+    if (sp->Type == FTfile || sp->StartSpooling == 0 || i < sp->StartSpooling
+	|| !SITEoverbudget(i))
 	return;
 
     syslog(L_ERROR, "%s spooling %d bytes", sp->Name, i);
@@ -316,9 +323,9 @@ SITEwrite(SITE *sp, const char *text)
 	sp->Channel->LastActive = Now.tv_sec;
 	bp = &sp->Channel->Out;
     }
-    buffer_append(bp, PREFIX, strlen(PREFIX));
-    buffer_append(bp, text, strlen(text));
-    buffer_append(bp, "\n", 1);
+    buffer_ring_append(bp, PREFIX, strlen(PREFIX));
+    buffer_ring_append(bp, text, strlen(text));
+    buffer_ring_append(bp, "\n", 1);
     if (sp->Channel != NULL)
 	WCHANadd(sp->Channel);
 }
@@ -339,6 +346,8 @@ SITEwritefromflags(SITE *sp, ARTDATA *Data)
     struct buffer       *bp;
     SITE	        *spx;
     int	                i;
+    static struct buffer *RingLine = NULL;
+    bool		wake;
 
     if (sp->Buffered)
 	bp = &sp->Buffer;
@@ -350,137 +359,159 @@ SITEwritefromflags(SITE *sp, ARTDATA *Data)
 	    return;
 	bp = &sp->Channel->Out;
     }
+
+    /* A program reading a ring gets the line there instead. */
+    if (sp->Ring != NULL && !sp->Buffered && !sp->Spooling) {
+	if (RingLine == NULL)
+	    RingLine = buffer_new();
+	buffer_set(RingLine, NULL, 0);
+	bp = RingLine;
+    }
     for (Dirty = false, p = sp->FileFlags; *p; p++) {
 	switch (*p) {
 	default:
 	    syslog(L_ERROR, "%s internal SITEwritefromflags %c", sp->Name, *p);
 	    continue;
+	case FEED_ARTICLE:
+	    if (Dirty)
+		buffer_ring_append(bp, NL, strlen(NL));
+	    buffer_ring_append(bp, Data->Article.data, Data->Article.left);
+	    break;
 	case FEED_BYTESIZE:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, Data->Bytes + sizeof("Bytes: ") - 1,
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, Data->Bytes + sizeof("Bytes: ") - 1,
                           Data->BytesLength);
 	    break;
 	case FEED_FULLNAME:
 	case FEED_NAME:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, Data->TokenText, sizeof(TOKEN) * 2 + 2);
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, Data->TokenText, sizeof(TOKEN) * 2 + 2);
 	    break;
 	case FEED_HASH:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, "[", 1);
-	    buffer_append(bp, HashToText(*(Data->Hash)), sizeof(HASH)*2);
-	    buffer_append(bp, "]", 1);
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, "[", 1);
+	    buffer_ring_append(bp, HashToText(*(Data->Hash)), sizeof(HASH)*2);
+	    buffer_ring_append(bp, "]", 1);
 	    break;
 	case FEED_HDR_DISTRIB:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, HDR(HDR__DISTRIBUTION),
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, HDR(HDR__DISTRIBUTION),
                           HDR_LEN(HDR__DISTRIBUTION));
 	    break;
 	case FEED_HDR_NEWSGROUP:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, HDR(HDR__NEWSGROUPS), HDR_LEN(HDR__NEWSGROUPS));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, HDR(HDR__NEWSGROUPS), HDR_LEN(HDR__NEWSGROUPS));
 	    break;
 	case FEED_HEADERS:
 	    if (Dirty)
-		buffer_append(bp, NL, strlen(NL));
-	    buffer_append(bp, Data->Headers.data, Data->Headers.left);
+		buffer_ring_append(bp, NL, strlen(NL));
+	    buffer_ring_append(bp, Data->Headers.data, Data->Headers.left);
 	    break;
 	case FEED_OVERVIEW:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, Data->Overview.data, Data->Overview.left);
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, Data->Overview.data, Data->Overview.left);
 	    break;
 	case FEED_PATH:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
 	    if (!Data->Hassamepath || Data->AddAlias || Pathcluster.used) {
                 if (Pathcluster.used)
-                    buffer_append(bp, Pathcluster.data, Pathcluster.used);
-                buffer_append(bp, Path.data, Path.used);
+                    buffer_ring_append(bp, Pathcluster.data, Pathcluster.used);
+                buffer_ring_append(bp, Path.data, Path.used);
                 if (Data->AddAlias)
-                    buffer_append(bp, Pathalias.data, Pathalias.used);
+                    buffer_ring_append(bp, Pathalias.data, Pathalias.used);
             }
             if (Data->Hassamecluster)
-                buffer_append(bp, HDR(HDR__PATH) + Pathcluster.used,
+                buffer_ring_append(bp, HDR(HDR__PATH) + Pathcluster.used,
                     HDR_LEN(HDR__PATH) - Pathcluster.used);
             else
-                buffer_append(bp, HDR(HDR__PATH), HDR_LEN(HDR__PATH));
+                buffer_ring_append(bp, HDR(HDR__PATH), HDR_LEN(HDR__PATH));
 	    break;
 	case FEED_REPLIC:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, Data->Replic, Data->ReplicLength);
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, Data->Replic, Data->ReplicLength);
 	    break;
 	case FEED_STOREDGROUP:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, Data->Newsgroups.List[0],
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, Data->Newsgroups.List[0],
                           Data->StoredGroupLength);
 	    break;
 	case FEED_TIMERECEIVED:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
 	    snprintf(pbuff, sizeof(pbuff), "%ld", (long) Data->Arrived);
-	    buffer_append(bp, pbuff, strlen(pbuff));
+	    buffer_ring_append(bp, pbuff, strlen(pbuff));
 	    break;
 	case FEED_TIMEPOSTED:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
 	    snprintf(pbuff, sizeof(pbuff), "%ld", (long) Data->Posted);
-	    buffer_append(bp, pbuff, strlen(pbuff));
+	    buffer_ring_append(bp, pbuff, strlen(pbuff));
 	    break;
 	case FEED_TIMEEXPIRED:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
 	    snprintf(pbuff, sizeof(pbuff), "%ld", (long) Data->Expires);
-	    buffer_append(bp, pbuff, strlen(pbuff));
+	    buffer_ring_append(bp, pbuff, strlen(pbuff));
 	    break;
 	case FEED_MESSAGEID:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, HDR(HDR__MESSAGE_ID), HDR_LEN(HDR__MESSAGE_ID));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, HDR(HDR__MESSAGE_ID), HDR_LEN(HDR__MESSAGE_ID));
 	    break;
 	case FEED_FNLNAMES:
 	    if (sp->FNLnames.left != 0) {
 		/* Funnel; write names of our sites that got it. */
 		if (Dirty)
-		    buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-		buffer_append(bp, sp->FNLnames.data, sp->FNLnames.left);
+		    buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+		buffer_ring_append(bp, sp->FNLnames.data, sp->FNLnames.left);
 	    }
 	    else {
 		/* Not funnel; write names of all sites that got it. */
 		for (spx = Sites, i = nSites; --i >= 0; spx++)
 		    if (spx->Sendit) {
 			if (Dirty)
-			    buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-			buffer_append(bp, spx->Name, spx->NameLength);
+			    buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+			buffer_ring_append(bp, spx->Name, spx->NameLength);
 			Dirty = true;
 		    }
 	    }
 	    break;
 	case FEED_NEWSGROUP:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
 	    if (sp->ng)
-		buffer_append(bp, sp->ng->Name, sp->ng->NameLength);
+		buffer_ring_append(bp, sp->ng->Name, sp->ng->NameLength);
 	    else
-		buffer_append(bp, "?", 1);
+		buffer_ring_append(bp, "?", 1);
 	    break;
 	case FEED_SITE:
 	    if (Dirty)
-		buffer_append(bp, ITEMSEP, strlen(ITEMSEP));
-	    buffer_append(bp, Data->Feedsite, Data->FeedsiteLength);
+		buffer_ring_append(bp, ITEMSEP, strlen(ITEMSEP));
+	    buffer_ring_append(bp, Data->Feedsite, Data->FeedsiteLength);
 	    break;
 	}
 	Dirty = true;
     }
     if (Dirty) {
-	buffer_append(bp, "\n", 1);
+	if (bp == RingLine) {
+	    /* Only wake the program up if it may have found the ring empty,
+	       and fall back on the pipe if the ring is full. */
+	    bp = &sp->Channel->Out;
+	    if (!feedring_put(sp->Ring, RingLine->data, RingLine->left, &wake))
+		buffer_ring_append(bp, RingLine->data, RingLine->left);
+	    else if (!wake)
+		return;
+	}
+	buffer_ring_append(bp, "\n", 1);
 	SITEflushcheck(sp, bp);
     }
 }
@@ -498,6 +529,7 @@ SITEsend(SITE *sp, ARTDATA *Data)
     char		buff[BUFSIZ];
     char *		argv[MAX_BUILTIN_ARGV];
 
+    sp->Sent++;
     switch (sp->Type) {
     default:
 	syslog(L_ERROR, "%s internal SITEsend type %d", sp->Name, sp->Type);
@@ -595,6 +627,7 @@ SITEstartprocess(SITE *sp)
     pid_t	        i;
     char		*argv[MAX_BUILTIN_ARGV];
     char		*process;
+    char		*ring;
     int			*ip;
     int			pan[2];
 
@@ -622,9 +655,25 @@ SITEstartprocess(SITE *sp)
 	argv[3] = NULL;
     }
 
+    /* Set up the ring, kept as is if the program is restarted, and tell
+       the program where it is. */
+    ring = NULL;
+    if (sp->RingSize != 0) {
+	ring = concat(innconf->pathrun, "/", sp->Name, ".ring", (char *) 0);
+	if (sp->Ring == NULL
+	    && (sp->Ring = feedring_open(ring, sp->RingSize)) == NULL)
+	    syslog(L_ERROR, "%s cant open ring %s", sp->Name, ring);
+	if (sp->Ring != NULL)
+	    setenv("INN_FEEDRING", ring, true);
+    }
+
     /* Fork a child. */
     i = Spawn(sp->Nice, pan[PIPE_READ], (int)fileno(Errlog),
 	      (int)fileno(Errlog), argv);
+    if (ring != NULL) {
+	unsetenv("INN_FEEDRING");
+	free(ring);
+    }
     if (i > 0) {
 	sp->pid = i;
 	sp->Spooling = false;
@@ -633,6 +682,11 @@ SITEstartprocess(SITE *sp)
 	sp->Channel = CHANcreate(pan[PIPE_WRITE],
 			sp->Type == FTchannel ? CTprocess : CTexploder,
 			CSwriting, SITEreader, SITEwritedone);
+	/* Have the program look at what a previous one left in the ring. */
+	if (sp->Ring != NULL) {
+	    buffer_ring_append(&sp->Channel->Out, "\n", 1);
+	    WCHANadd(sp->Channel);
+	}
 	free(process);
 	return true;
     }
@@ -869,8 +923,10 @@ SITEflush(SITE *sp, const bool Restart)
 	    if (sp->Buffered) {
 		/* SITEsetup had to buffer us; save any residue. */
 		out = &cp->Out;
-	        if (out->left)
+	        if (out->left) {
+		    buffer_ring_linearize(out);
 		    buffer_set(&sp->Buffer, &out->data[out->used], out->left);
+		}
 	    }
 	    else
 		WCHANsetfrombuffer(sp->Channel, &cp->Out);
@@ -918,6 +974,36 @@ SITEflushall(const bool Restart)
 }
 
 
+/*
+**  Match a newsgroup against the subscriptions of a site, including those of
+**  the ME entry.  They are compiled the first time they are needed.  Returns
+**  UWILDMAT_MATCH if the site wants the group, UWILDMAT_POISON if it is
+**  poisoned, UWILDMAT_FAIL otherwise.
+*/
+static enum uwildmat
+SITEmatchgroup(SITE *sp, const char *name)
+{
+    char	        **pats;
+    size_t	        i, n;
+
+    if (sp->Wildmat == NULL) {
+	for (n = 0; ME.Patterns && ME.Patterns[n] != NULL; n++)
+	    ;
+	for (i = 0; sp->Patterns && sp->Patterns[i] != NULL; i++)
+	    ;
+	pats = xmalloc((n + i + 1) * sizeof(char *));
+	for (n = 0; ME.Patterns && ME.Patterns[n] != NULL; n++)
+	    pats[n] = ME.Patterns[n];
+	for (i = 0; sp->Patterns && sp->Patterns[i] != NULL; i++)
+	    pats[n + i] = sp->Patterns[i];
+	pats[n + i] = NULL;
+	sp->Wildmat = uwildmat_compile_list(pats, true);
+	free(pats);
+    }
+    return uwildmat_match(sp->Wildmat, name);
+}
+
+
 /*
 **  Run down the site's pattern list and see if it wants the specified
 **  newsgroup.
@@ -925,29 +1011,7 @@ SITEflushall(const bool Restart)
 bool
 SITEwantsgroup(SITE *sp, char *name)
 {
-    bool	        match;
-    bool	        subvalue;
-    char	        *pat;
-    char	        **argv;
-
-    match = SUB_DEFAULT;
-    if (ME.Patterns) {
-	for (argv = ME.Patterns; (pat = *argv++) != NULL; ) {
-	    subvalue = *pat != SUB_NEGATE && *pat != SUB_POISON;
-	    if (!subvalue)
-		pat++;
-	    if ((match != subvalue) && uwildmat(name, pat))
-		match = subvalue;
-	}
-    }
-    for (argv = sp->Patterns; (pat = *argv++) != NULL; ) {
-	subvalue = *pat != SUB_NEGATE && *pat != SUB_POISON;
-	if (!subvalue)
-	    pat++;
-	if ((match != subvalue) && uwildmat(name, pat))
-	    match = subvalue;
-    }
-    return match;
+    return SITEmatchgroup(sp, name) == UWILDMAT_MATCH;
 }
 
 
@@ -958,29 +1022,7 @@ SITEwantsgroup(SITE *sp, char *name)
 bool
 SITEpoisongroup(SITE *sp, char *name)
 {
-    bool	        match;
-    bool	        poisonvalue;
-    char	        *pat;
-    char	        **argv;
-
-    match = SUB_DEFAULT;
-    if (ME.Patterns) {
-	for (argv = ME.Patterns; (pat = *argv++) != NULL; ) {
-	    poisonvalue = *pat == SUB_POISON;
-	    if (*pat == SUB_NEGATE || *pat == SUB_POISON)
-		pat++;
-	    if (uwildmat(name, pat))
-		match = poisonvalue;
-	}
-    }
-    for (argv = sp->Patterns; (pat = *argv++) != NULL; ) {
-	poisonvalue = *pat == SUB_POISON;
-	if (*pat == SUB_NEGATE || *pat == SUB_POISON)
-	    pat++;
-	if (uwildmat(name, pat))
-	    match = poisonvalue;
-    }
-    return match;
+    return SITEmatchgroup(sp, name) == UWILDMAT_POISON;
 }
 
 
@@ -1030,6 +1072,10 @@ SITEfree(SITE *sp)
 	CHANclose(sp->Channel, CHANname(sp->Channel));
 	sp->Channel = NULL;
     }
+    if (sp->Ring) {
+	feedring_free(sp->Ring);
+	sp->Ring = NULL;
+    }
 
     SITEunlink(sp);
 
@@ -1059,10 +1105,18 @@ SITEfree(SITE *sp)
 	free(sp->Patterns);
 	sp->Patterns = NULL;
     }
+    if (sp->Wildmat) {
+	uwildmat_free(sp->Wildmat);
+	sp->Wildmat = NULL;
+    }
     if (sp->Exclusions) {
 	free(sp->Exclusions);
 	sp->Exclusions = NULL;
     }
+    if (sp->ExclusionHashes) {
+	free(sp->ExclusionHashes);
+	sp->ExclusionHashes = NULL;
+    }
     if (sp->Distributions) {
 	free(sp->Distributions);
 	sp->Distributions = NULL;
@@ -5,8 +5,12 @@
 #include "clibrary.h"
 #include "portable/socket.h"
 
+#include "inn/buffer.h"
+#include "inn/histogram.h"
+#include "inn/latencytable.h"
 #include "inn/network.h"
 #include "inn/innconf.h"
+#include "inn/metrics.h"
 #include "inn/version.h"
 #include "innd.h"
 #include "innperl.h"
@@ -52,8 +56,18 @@ typedef struct _STATUS {
 } STATUS;
 
 static unsigned STATUSlast_time;
+static time_t   STATUSstarted;
 char            start_time[50];
 
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+# include "portable/socket-unix.h"
+
+static char     *STATUSpath = NULL;
+static CHANNEL  *STATUSchan = NULL;
+
+static void STATUSmetricswritedone(CHANNEL *cp);
+#endif
+
 static unsigned
 STATUSgettime(void)
 {
@@ -77,6 +91,7 @@ STATUSinit(void)
   
   STATUSlast_time = STATUSgettime();	/* First invocation */
   now = time (NULL) ;
+  STATUSstarted = now;
   strlcpy(start_time, ctime(&now), sizeof(start_time));
 }
 
@@ -93,53 +108,20 @@ PrettySize(float size, char *str)
   return (str);
 }
 
-static void
-STATUSsummary(void)
+/*
+**  Gather the statistics of the incoming NNTP channels by peer.  Returns a
+**  list of STATUS structs, in the order in which the peers were first seen,
+**  which the caller should free.
+*/
+static STATUS *
+STATUSpeers(void)
 {
-  FILE			*F;
   int			i;
   CHANNEL               *cp;
-  int			activeCxn = 0;
-  int			sleepingCxns = 0;
-  time_t		seconds = 0;
-  unsigned long		duplicate = 0;
-  unsigned long		offered;
-  unsigned long		accepted = 0;
-  unsigned long		refused = 0;
-  unsigned long		rejected = 0;
-  float			size = 0;
-  float			DuplicateSize = 0;
-  float			RejectSize = 0;
-  int			peers = 0;
   char                  TempString[SMBUF];
-  char			*path;
   char                  other_ip_addr[INET6_ADDRSTRLEN];
   char                  *p;
   STATUS		*head, *status, *tmp;
-  char                  str[315]; /* Maximum buffer size for PrettySize() */
-  time_t		now;
- 
-  if (innconf->htmlstatus) {
-    path = concatpath(innconf->pathhttp, "inn_status.html");
-  } else {
-    path = concatpath(innconf->pathlog, "inn.status");
-  }
-  if ((F = Fopen(path, "w", TEMPORARYOPEN)) == NULL) {
-    syswarn("SERVER cant open %s", path);
-    return;
-  }
-
-  /* HTML header. */
-  if (innconf->htmlstatus) {
-    fprintf(F, "<!DOCTYPE html>\n<html lang=\"en\">\n<head>\n");
-    fprintf(F, "<meta http-equiv=\"refresh\" content=\"%lu\">\n",
-            innconf->status < MIN_REFRESH ? MIN_REFRESH : innconf->status);
-    fprintf(F, "<title>%s: incoming feeds</title>\n", innconf->pathhost);
-    fprintf(F, "</head>\n<body>\n<pre>\n");
-  }
-
-  fprintf (F, "%s\n", INN_VERSION_STRING);
-  fprintf (F, "pid %d started %s\n", (int) getpid(), start_time);
 
   tmp = head = NULL;
   for (i = 0; (cp = CHANiter(&i, CTnntp)) != NULL; ) {
@@ -152,7 +134,6 @@ STATUSsummary(void)
     }
     if (status == NULL) {
       status = xmalloc(sizeof(STATUS));
-      peers++;                                              /* A new peer. */
       strlcpy(status->name, TempString, sizeof(status->name));
       if (cp->Address.ss_family == 0) {
           /* Connections from lc.c do not have an IP address. */
@@ -201,16 +182,10 @@ STATUSsummary(void)
 
     if (Now.tv_sec - cp->Started > status->seconds)
       status->seconds = Now.tv_sec - cp->Started;
-    if (Now.tv_sec - cp->Started > seconds)
-      seconds = Now.tv_sec - cp->Started;
     status->accepted += cp->Received;
-    accepted += cp->Received;
     status->refused += cp->Refused;
-    refused += cp->Refused;
     status->rejected += cp->Rejected;
-    rejected += cp->Rejected;
     status->Duplicate += cp->Duplicate;
-    duplicate += cp->Duplicate;
     status->Unwanted_u += cp->Unwanted_u;
     status->Unwanted_d += cp->Unwanted_d;
     status->Unwanted_g += cp->Unwanted_g;
@@ -232,16 +207,73 @@ STATUSsummary(void)
     status->Size += cp->Size;
     status->DuplicateSize += cp->DuplicateSize;
     status->RejectSize += cp->RejectSize;
-    size += cp->Size;
-    DuplicateSize += cp->DuplicateSize;
-    RejectSize += cp->RejectSize;
-    if (CHANsleeping(cp)) {
-      sleepingCxns++;
+    if (CHANsleeping(cp))
       status->sleepingCxns++;
-    } else {
-      activeCxn++;
+    else
       status->activeCxn++;
-    }
+  }
+
+  return head;
+}
+
+static void
+STATUSsummary(void)
+{
+  FILE			*F;
+  int			activeCxn = 0;
+  int			sleepingCxns = 0;
+  time_t		seconds = 0;
+  unsigned long		duplicate = 0;
+  unsigned long		offered;
+  unsigned long		accepted = 0;
+  unsigned long		refused = 0;
+  unsigned long		rejected = 0;
+  float			size = 0;
+  float			DuplicateSize = 0;
+  float			RejectSize = 0;
+  int			peers = 0;
+  char                  TempString[SMBUF];
+  char			*path;
+  STATUS		*head, *status, *tmp;
+  char                  str[315]; /* Maximum buffer size for PrettySize() */
+  time_t		now;
+ 
+  if (innconf->htmlstatus) {
+    path = concatpath(innconf->pathhttp, "inn_status.html");
+  } else {
+    path = concatpath(innconf->pathlog, "inn.status");
+  }
+  if ((F = Fopen(path, "w", TEMPORARYOPEN)) == NULL) {
+    syswarn("SERVER cant open %s", path);
+    return;
+  }
+
+  /* HTML header. */
+  if (innconf->htmlstatus) {
+    fprintf(F, "<!DOCTYPE html>\n<html lang=\"en\">\n<head>\n");
+    fprintf(F, "<meta http-equiv=\"refresh\" content=\"%lu\">\n",
+            innconf->status < MIN_REFRESH ? MIN_REFRESH : innconf->status);
+    fprintf(F, "<title>%s: incoming feeds</title>\n", innconf->pathhost);
+    fprintf(F, "</head>\n<body>\n<pre>\n");
+  }
+
+  fprintf (F, "%s\n", INN_VERSION_STRING);
+  fprintf (F, "pid %d started %s\n", (int) getpid(), start_time);
+
+  head = STATUSpeers();
+  for (status = head; status != NULL; status = status->next) {
+    peers++;
+    if (status->seconds > seconds)
+      seconds = status->seconds;
+    accepted += status->accepted;
+    refused += status->refused;
+    rejected += status->rejected;
+    duplicate += status->Duplicate;
+    size += status->Size;
+    DuplicateSize += status->DuplicateSize;
+    RejectSize += status->RejectSize;
+    activeCxn += status->activeCxn;
+    sleepingCxns += status->sleepingCxns;
   }
 
   /* Header */
@@ -401,3 +433,359 @@ STATUSmainloophook(void)
     STATUSlast_time = now;
   }
 }
+
+
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+
+/*
+**  Append the statistics of the server to a buffer in the OpenMetrics
+**  format.  The per-peer counters cover the connections that are currently
+**  open, as in the status report.
+*/
+/*
+**  Add what the nnrpd processes recorded of their commands in the shared
+**  table, if nnrpdcommandstats made them keep one: per access group and
+**  command, the count, total duration and bytes sent, and a few quantiles
+**  of the durations.
+*/
+static void
+STATUSmetricsnnrpd(struct buffer *out)
+{
+  static const double	quantiles[] = { 0.5, 0.99, 0.999 };
+  static const char	*const qnames[] = { "0.5", "0.99", "0.999" };
+  struct latency_table	*table;
+  struct histogram	*hist, **hists;
+  unsigned long		*bytes, slot, slots, i;
+  const char		*key;
+  char			*path, **keys;
+  size_t		op, ops, q;
+
+  if (!innconf->nnrpdcommandstats)
+    return;
+  path = concatpath(innconf->pathrun, INN_PATH_NNRPDSTATS);
+  table = (access(path, F_OK) == 0)
+    ? latency_table_open(path, 0, NULL, 0) : NULL;
+  free(path);
+  if (table == NULL)
+    return;
+
+  /* Read everything first, since each family lists all the samples. */
+  slots = latency_table_slots(table);
+  ops = latency_table_ops(table);
+  keys = xcalloc(slots, sizeof(char *));
+  hists = xcalloc(slots * ops, sizeof(struct histogram *));
+  bytes = xcalloc(slots * ops, sizeof(unsigned long));
+  for (slot = 0; slot < slots; slot++) {
+    if ((key = latency_table_key(table, slot)) == NULL)
+      continue;
+    keys[slot] = xstrdup(key);
+    for (op = 0; op < ops; op++) {
+      hist = histogram_new();
+      if (latency_table_get(table, slot, op, hist, &bytes[slot * ops + op])
+          && histogram_count(hist) > 0)
+        hists[slot * ops + op] = hist;
+      else
+        histogram_free(hist);
+    }
+  }
+
+  metrics_family(out, "innd_nnrpd_commands", "counter",
+                 "Commands run by nnrpd, by access group.");
+  for (i = 0; i < slots * ops; i++)
+    if (hists[i] != NULL)
+      metrics_sample(out, "innd_nnrpd_commands_total",
+                     histogram_count(hists[i]), "group", keys[i / ops],
+                     "command", latency_table_opname(table, i % ops),
+                     (char *) NULL);
+  metrics_family(out, "innd_nnrpd_command_seconds", "counter",
+                 "Time spent by nnrpd running commands, by access group.");
+  for (i = 0; i < slots * ops; i++)
+    if (hists[i] != NULL)
+      metrics_sample(out, "innd_nnrpd_command_seconds_total",
+                     histogram_sum(hists[i]) / 1e6, "group", keys[i / ops],
+                     "command", latency_table_opname(table, i % ops),
+                     (char *) NULL);
+  metrics_family(out, "innd_nnrpd_command_bytes", "counter",
+                 "Data sent by nnrpd in reply to commands, by access group.");
+  for (i = 0; i < slots * ops; i++)
+    if (hists[i] != NULL)
+      metrics_sample(out, "innd_nnrpd_command_bytes_total", bytes[i],
+                     "group", keys[i / ops],
+                     "command", latency_table_opname(table, i % ops),
+                     (char *) NULL);
+  metrics_family(out, "innd_nnrpd_command_latency_seconds", "gauge",
+                 "Quantiles of the duration of nnrpd commands.");
+  for (q = 0; q < ARRAY_SIZE(quantiles); q++)
+    for (i = 0; i < slots * ops; i++)
+      if (hists[i] != NULL)
+        metrics_sample(out, "innd_nnrpd_command_latency_seconds",
+                       histogram_quantile(hists[i], quantiles[q]) / 1e6,
+                       "group", keys[i / ops],
+                       "command", latency_table_opname(table, i % ops),
+                       "quantile", qnames[q], (char *) NULL);
+
+  for (slot = 0; slot < slots; slot++)
+    free(keys[slot]);
+  for (i = 0; i < slots * ops; i++)
+    if (hists[i] != NULL)
+      histogram_free(hists[i]);
+  free(keys);
+  free(hists);
+  free(bytes);
+  latency_table_free(table);
+}
+
+
+static void
+STATUSmetrics(struct buffer *out)
+{
+  static const char *const modes[] = { "running", "paused", "throttled" };
+  STATUS		*head, *status, *tmp;
+  SITE			*sp;
+  CHANNEL		*cp;
+  const char		*name;
+  size_t		queued;
+  int			i, peers = 0;
+
+  metrics_family(out, "innd_build", "info", "Version of INN.");
+  metrics_sample(out, "innd_build_info", 1, "version", INN_VERSION_STRING,
+                 (char *) NULL);
+  metrics_family(out, "innd_start_time_seconds", "gauge",
+                 "Time at which innd started, in seconds since the epoch.");
+  metrics_sample(out, "innd_start_time_seconds", (double) STATUSstarted,
+                 (char *) NULL);
+  metrics_family(out, "innd_mode", "gauge",
+                 "Whether innd is in the given operating mode.");
+  for (i = 0; i < (int) ARRAY_SIZE(modes); i++)
+    metrics_sample(out, "innd_mode",
+                   (Mode == OMrunning && i == 0)
+                   || (Mode == OMpaused && i == 1)
+                   || (Mode == OMthrottled && i == 2),
+                   "mode", modes[i], (char *) NULL);
+  metrics_family(out, "innd_article_scratch_allocations", "counter",
+                 "Allocations of scratch memory while processing articles.");
+  metrics_sample(out, "innd_article_scratch_allocations_total",
+                 (double) ARENAallocs, (char *) NULL);
+  metrics_family(out, "innd_article_scratch_mallocs", "counter",
+                 "Calls to malloc these allocations needed.");
+  metrics_sample(out, "innd_article_scratch_mallocs_total",
+                 (double) ARENAmallocs, (char *) NULL);
+
+  /* Incoming feeds. */
+  head = STATUSpeers();
+  for (status = head; status != NULL; status = status->next)
+    peers++;
+  metrics_family(out, "innd_peers", "gauge",
+                 "Number of peers with an open incoming connection.");
+  metrics_sample(out, "innd_peers", peers, (char *) NULL);
+  metrics_family(out, "innd_peer_connections", "gauge",
+                 "Incoming connections from the peer.");
+  for (status = head; status != NULL; status = status->next) {
+    metrics_sample(out, "innd_peer_connections", status->activeCxn,
+                   "peer", status->name, "state", "active", (char *) NULL);
+    metrics_sample(out, "innd_peer_connections", status->sleepingCxns,
+                   "peer", status->name, "state", "sleeping", (char *) NULL);
+  }
+  metrics_family(out, "innd_peer_articles", "counter",
+                 "Articles offered by the peer, by outcome.");
+  for (status = head; status != NULL; status = status->next) {
+    metrics_sample(out, "innd_peer_articles_total", status->accepted,
+                   "peer", status->name, "result", "accepted", (char *) NULL);
+    metrics_sample(out, "innd_peer_articles_total", status->refused,
+                   "peer", status->name, "result", "refused", (char *) NULL);
+    metrics_sample(out, "innd_peer_articles_total", status->rejected,
+                   "peer", status->name, "result", "rejected", (char *) NULL);
+    metrics_sample(out, "innd_peer_articles_total", status->Duplicate,
+                   "peer", status->name, "result", "duplicate",
+                   (char *) NULL);
+  }
+  metrics_family(out, "innd_peer_unwanted_articles", "counter",
+                 "Articles from the peer that were not wanted, by reason.");
+  for (status = head; status != NULL; status = status->next) {
+    metrics_sample(out, "innd_peer_unwanted_articles_total",
+                   status->Unwanted_u, "peer", status->name,
+                   "reason", "unapproved", (char *) NULL);
+    metrics_sample(out, "innd_peer_unwanted_articles_total",
+                   status->Unwanted_d, "peer", status->name,
+                   "reason", "distribution", (char *) NULL);
+    metrics_sample(out, "innd_peer_unwanted_articles_total",
+                   status->Unwanted_g, "peer", status->name,
+                   "reason", "newsgroups", (char *) NULL);
+    metrics_sample(out, "innd_peer_unwanted_articles_total",
+                   status->Unwanted_s, "peer", status->name,
+                   "reason", "site", (char *) NULL);
+    metrics_sample(out, "innd_peer_unwanted_articles_total",
+                   status->Unwanted_f, "peer", status->name,
+                   "reason", "filtered", (char *) NULL);
+  }
+  metrics_family(out, "innd_peer_bytes", "counter",
+                 "Size of the articles offered by the peer, by outcome.");
+  for (status = head; status != NULL; status = status->next) {
+    metrics_sample(out, "innd_peer_bytes_total", status->Size,
+                   "peer", status->name, "result", "accepted", (char *) NULL);
+    metrics_sample(out, "innd_peer_bytes_total", status->DuplicateSize,
+                   "peer", status->name, "result", "duplicate",
+                   (char *) NULL);
+    metrics_sample(out, "innd_peer_bytes_total", status->RejectSize,
+                   "peer", status->name, "result", "rejected", (char *) NULL);
+  }
+  metrics_family(out, "innd_peer_commands", "counter",
+                 "Transfer commands received from the peer.");
+  for (status = head; status != NULL; status = status->next) {
+    metrics_sample(out, "innd_peer_commands_total", status->Ihave,
+                   "peer", status->name, "command", "ihave", (char *) NULL);
+    metrics_sample(out, "innd_peer_commands_total", status->Check,
+                   "peer", status->name, "command", "check", (char *) NULL);
+    metrics_sample(out, "innd_peer_commands_total", status->Takethis,
+                   "peer", status->name, "command", "takethis",
+                   (char *) NULL);
+  }
+  for (status = head; status != NULL; status = tmp) {
+    tmp = status->next;
+    free(status);
+  }
+
+  /* Outgoing feeds. */
+  metrics_family(out, "innd_site_articles", "counter",
+                 "Articles sent to the site since newsfeeds was loaded.");
+  for (i = nSites, sp = Sites; --i >= 0; sp++)
+    if (sp->Name != NULL)
+      metrics_sample(out, "innd_site_articles_total", sp->Sent,
+                     "site", sp->Name, (char *) NULL);
+  metrics_family(out, "innd_site_queued_bytes", "gauge",
+                 "Data for the site buffered in memory.");
+  for (i = nSites, sp = Sites; --i >= 0; sp++) {
+    if (sp->Name == NULL)
+      continue;
+    queued = sp->Buffered ? sp->Buffer.left : 0;
+    if (sp->Channel != NULL)
+      queued += sp->Channel->Out.left;
+    metrics_sample(out, "innd_site_queued_bytes", queued,
+                   "site", sp->Name, (char *) NULL);
+  }
+  metrics_family(out, "innd_site_spooling", "gauge",
+                 "Whether the site is spooling to disk.");
+  for (i = nSites, sp = Sites; --i >= 0; sp++)
+    if (sp->Name != NULL)
+      metrics_sample(out, "innd_site_spooling", sp->Spooling,
+                     "site", sp->Name, (char *) NULL);
+
+  /* Channels, except those serving these statistics. */
+  metrics_family(out, "innd_channel_output_bytes", "gauge",
+                 "Data waiting to be written to the channel.");
+  for (i = 0; (cp = CHANiter(&i, CTany)) != NULL; ) {
+    if (cp->Type == CTfree || cp->Type == CTmetrics)
+      continue;
+    name = CHANname(cp);
+    metrics_sample(out, "innd_channel_output_bytes", cp->Out.left,
+                   "channel", name, (char *) NULL);
+  }
+  metrics_family(out, "innd_channel_idle_seconds", "gauge",
+                 "Time since the last activity on the channel.");
+  for (i = 0; (cp = CHANiter(&i, CTany)) != NULL; ) {
+    if (cp->Type == CTfree || cp->Type == CTmetrics)
+      continue;
+    name = CHANname(cp);
+    metrics_sample(out, "innd_channel_idle_seconds",
+                   (double) (Now.tv_sec - cp->LastActive),
+                   "channel", name, (char *) NULL);
+  }
+  STATUSmetricsnnrpd(out);
+  metrics_end(out);
+}
+
+
+/*
+**  Read function for the metrics socket.  Accept the connection and queue
+**  the statistics on it; the channel is closed once they have been written.
+*/
+static void
+STATUSmetricsreader(CHANNEL *cp)
+{
+  static struct buffer	*reply = NULL;
+  CHANNEL		*new;
+  int			fd;
+
+  if ((fd = accept(cp->fd, NULL, NULL)) < 0) {
+    syswarn("%s cant accept metrics connection", LogName);
+    return;
+  }
+  if (reply == NULL)
+    reply = buffer_new();
+  buffer_set(reply, NULL, 0);
+  STATUSmetrics(reply);
+  new = CHANcreate(fd, CTmetrics, CSwritegoodbye, STATUSmetricsreader,
+                   STATUSmetricswritedone);
+  RCHANremove(new);
+  WCHANsetfrombuffer(new, reply);
+  WCHANadd(new);
+}
+
+
+/*
+**  Write-done function for the connections to the metrics socket.
+*/
+static void
+STATUSmetricswritedone(CHANNEL *cp)
+{
+  CHANclose(cp, CHANname(cp));
+}
+
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
+
+
+/*
+**  Create the socket on which statistics are served, if enabled.  Failures
+**  are not fatal since the server works fine without it.
+*/
+void
+STATUSsetup(void)
+{
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+  int			fd;
+  struct sockaddr_un	server;
+
+  if (!innconf->statusmetrics)
+    return;
+  if (STATUSpath == NULL)
+    STATUSpath = concatpath(innconf->pathrun, INN_PATH_INNDMETRICS);
+  if (unlink(STATUSpath) < 0 && errno != ENOENT) {
+    syswarn("%s cant unlink %s", LogName, STATUSpath);
+    return;
+  }
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    syswarn("%s cant socket %s", LogName, STATUSpath);
+    return;
+  }
+  memset(&server, 0, sizeof server);
+  server.sun_family = AF_UNIX;
+  strlcpy(server.sun_path, STATUSpath, sizeof(server.sun_path));
+  if (bind(fd, (struct sockaddr *) &server, SUN_LEN(&server)) < 0
+      || listen(fd, innconf->maxlisten) < 0) {
+    syswarn("%s cant bind %s", LogName, STATUSpath);
+    close(fd);
+    return;
+  }
+  STATUSchan = CHANcreate(fd, CTmetrics, CSwaiting, STATUSmetricsreader,
+                          STATUSmetricswritedone);
+  syslog(L_NOTICE, "%s metricssetup %s", LogName, CHANname(STATUSchan));
+  RCHANadd(STATUSchan);
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
+}
+
+
+/*
+**  Close the statistics socket.
+*/
+void
+STATUSclose(void)
+{
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+  if (STATUSchan == NULL)
+    return;
+  CHANclose(STATUSchan, CHANname(STATUSchan));
+  STATUSchan = NULL;
+  if (unlink(STATUSpath) < 0)
+    syswarn("%s cant unlink %s", LogName, STATUSpath);
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
+}
@@ -5,9 +5,15 @@
 #include "config.h"
 #include "clibrary.h"
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
 #include "inn/libinn.h"
+#include "inn/paths.h"
+#include "inn/tokencache.h"
 
 #include "innd.h"
 
@@ -122,26 +128,106 @@ CommaSplit(char *text)
 
 
 /*
-**  Set up LISTBUFFER so that data will be put into array
-**  it allocates buffer and array for data if needed, otherwise use already
-**  allocated one
+**  Allocate size bytes of scratch memory for the current article from the
+**  arena, suitably aligned for any of the types put there.  What doesn't
+**  fit in the block is allocated separately and freed at the next reset.
+*/
+void *
+ARENAalloc(ARENA *arena, size_t size)
+{
+    union align { void *p; long l; double d; };
+    void **overflow;
+
+    size = (size + sizeof(union align) - 1) & ~(sizeof(union align) - 1);
+    ARENAallocs++;
+    if (arena->Block == NULL) {
+        arena->Size = ARENABLOCKSIZE;
+        arena->Block = xmalloc(arena->Size);
+        ARENAmallocs++;
+    }
+    if (arena->Size - arena->Used >= size) {
+        arena->Used += size;
+        return arena->Block + arena->Used - size;
+    }
+    ARENAmallocs++;
+    overflow = xmalloc(sizeof(union align) + size);
+    *overflow = arena->Overflow;
+    arena->Overflow = overflow;
+    arena->OverflowSize += size;
+    return (char *) overflow + sizeof(union align);
+}
+
+
+/*
+**  Release all the scratch memory of the previous article.  If it needed
+**  more than the block, grow the block so that the next one probably won't.
+**  The block itself is only allocated when first needed, since most kinds
+**  of channels never process an article.
 */
 void
-SetupListBuffer(int size, LISTBUFFER *list)
+ARENAreset(ARENA *arena)
+{
+    void *overflow, *next;
+
+    for (overflow = arena->Overflow; overflow != NULL; overflow = next) {
+        next = *(void **) overflow;
+        free(overflow);
+    }
+    arena->Overflow = NULL;
+    if (arena->OverflowSize > 0) {
+        free(arena->Block);
+        arena->Size = arena->Used + arena->OverflowSize;
+        arena->Block = xmalloc(arena->Size);
+        ARENAmallocs++;
+    }
+    arena->Used = 0;
+    arena->OverflowSize = 0;
+}
+
+
+/*
+**  Free an arena when its channel is closed.
+*/
+void
+ARENAfree(ARENA *arena)
+{
+    arena->OverflowSize = 0;
+    ARENAreset(arena);
+    free(arena->Block);
+    arena->Block = NULL;
+    arena->Size = 0;
+}
+
+
+/*
+**  Set up LISTBUFFER so that data will be put into array, allocating the
+**  buffer and the array for the data from the arena of the article.
+*/
+void
+SetupListBuffer(ARENA *arena, int size, LISTBUFFER *list)
 {
   /* get space for data to be splitted */
-  if (list->Data == NULL) {
-    list->DataLength = size;
-    list->Data = xmalloc(list->DataLength + 1);
-  } else if (list->DataLength < size) {
-    list->DataLength = size;
-    list->Data = xrealloc(list->Data, list->DataLength + 1);
-  }
+  list->DataLength = size;
+  list->Data = ARENAalloc(arena, list->DataLength + 1);
   /* get an array of character pointers. */
-  if (list->List == NULL) {
-    list->ListLength = DEFAULTNGBOXSIZE;
-    list->List = xmalloc(list->ListLength * sizeof(char *));
-  }
+  list->ListLength = DEFAULTNGBOXSIZE;
+  list->List = ARENAalloc(arena, list->ListLength * sizeof(char *));
+}
+
+
+/*
+**  Make room in the array of a LISTBUFFER for DEFAULTNGBOXSIZE more
+**  pointers.
+*/
+void
+GrowListBuffer(ARENA *arena, LISTBUFFER *list)
+{
+  char **old = list->List;
+
+  list->List = ARENAalloc(arena, (list->ListLength + DEFAULTNGBOXSIZE)
+                                 * sizeof(char *));
+  memcpy(list->List, old, list->ListLength * sizeof(char *));
+  list->ListLength += DEFAULTNGBOXSIZE;
 }
 
 
@@ -312,7 +398,7 @@ InndHisOpen(void)
 {
     char *histpath;
     int flags;
-    size_t synccount;
+    size_t synccount, writebehind;
 
     histpath = concatpath(innconf->pathdb, INN_PATH_HISTORY);
     if (innconf->hismethod == NULL) {
@@ -321,6 +407,10 @@ InndHisOpen(void)
     }
 
     flags = HIS_RDWR | (INND_DBZINCORE ? HIS_MMAP : HIS_ONDISK);
+    if (innconf->hisfilter)
+        flags |= HIS_FILTER;
+    if (innconf->hishugepages)
+        flags |= HIS_HUGEPAGES;
     History = HISopen(histpath, innconf->hismethod, flags);
     if (!History) {
 	sysdie("SERVER can't open history %s", histpath);
@@ -330,6 +420,101 @@ InndHisOpen(void)
     HISsetcache(History, 1024 * innconf->hiscachesize);
     synccount = innconf->icdsynccount;
     HISctl(History, HISCTLS_SYNCCOUNT, &synccount);
+    if (innconf->hisdatasync)
+        HISctl(History, HISCTLS_DATASYNC, &innconf->hisdatasync);
+    if (innconf->hiswritebehind != 0) {
+        writebehind = innconf->hiswritebehind;
+        if (!HISctl(History, HISCTLS_WRITEBEHIND, &writebehind))
+            syslog(L_ERROR, "%s cant hold history writes: %s", LogName,
+                   HISerror(History) != NULL ? HISerror(History)
+                                             : "not supported");
+    }
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+**  The thread reading the history into memory after startup, and whether
+**  it should stop because the history is about to be closed.
+*/
+static pthread_t HISwarmthread;
+static bool HISwarming = false;
+static volatile bool HISwarmstop = false;
+
+/*
+**  Log the progress of the warm-up, and stop it if asked to.
+*/
+static bool
+InndHisWarmupProgress(void *cookie, const char *what, off_t done,
+                      off_t total)
+{
+    syslog(L_NOTICE, "%s history warmup %s%s %lu of %lu MB", LogName,
+           (const char *) cookie, what, (unsigned long) (done >> 20),
+           (unsigned long) (total >> 20));
+    return !HISwarmstop;
+}
+
+static void *
+InndHisWarmupThread(void *arg)
+{
+    struct histwarmup warmup;
+    struct timeval start, end;
+    sigset_t set;
+    char *histpath = arg;
+    bool ok;
+
+    /* All signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    memset(&warmup, 0, sizeof(warmup));
+    warmup.tail = (off_t) innconf->hiswarmuptail * 1024;
+    warmup.lock = innconf->hiswarmuplock;
+    warmup.progress = InndHisWarmupProgress;
+    warmup.cookie = histpath;
+    gettimeofday(&start, NULL);
+    ok = HISctl(History, HISCTLS_WARMUP, &warmup);
+    gettimeofday(&end, NULL);
+    if (ok)
+        syslog(L_NOTICE, "%s history warmup done in %ld ms", LogName,
+               (long) ((end.tv_sec - start.tv_sec) * 1000
+                       + (end.tv_usec - start.tv_usec) / 1000));
+    else if (!HISwarmstop)
+        syslog(L_ERROR, "%s history warmup failed", LogName);
+    free(histpath);
+    return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/*
+**  Start reading the history into memory in the background if hiswarmup
+**  is set, so that lookups stop going to disk shortly after startup
+**  without holding up the server meanwhile.
+*/
+void
+InndHisWarmup(void)
+{
+#ifdef HAVE_PTHREAD
+    char *histpath;
+    int status;
+
+    if (!innconf->hiswarmup || History == NULL || HISwarming)
+        return;
+    histpath = concatpath(innconf->pathdb, INN_PATH_HISTORY);
+    HISwarmstop = false;
+    status = pthread_create(&HISwarmthread, NULL, InndHisWarmupThread,
+                            histpath);
+    if (status != 0) {
+        syslog(L_ERROR, "%s cant start thread to warm up history: %s",
+               LogName, strerror(status));
+        free(histpath);
+        return;
+    }
+    HISwarming = true;
+#else
+    if (innconf->hiswarmup)
+        syslog(L_NOTICE, "%s history warmup needs thread support", LogName);
+#endif
 }
 
 void
@@ -337,6 +522,13 @@ InndHisClose(void)
 {
     if (History == NULL)
         return;
+#ifdef HAVE_PTHREAD
+    if (HISwarming) {
+        HISwarmstop = true;
+        pthread_join(HISwarmthread, NULL);
+        HISwarming = false;
+    }
+#endif
     if (!HISclose(History)) {
         char *histpath;
 
@@ -351,10 +543,28 @@ bool
 InndHisWrite(const char *key, time_t arrived, time_t posted, time_t expires,
 	     TOKEN *token)
 {
+    static struct tokencache *cache = NULL;
+    static bool tried = false;
     bool r = HISwrite(History, key, arrived, posted, expires, token);
+    HASH hash;
+    char *path;
 
-    if (r != true)
+    if (r != true) {
 	IOError("history write", errno);
+        return r;
+    }
+
+    /* Let nnrpd find the new article without a history lookup. */
+    if (!tried && innconf->sharedmsgidcachesize != 0) {
+        tried = true;
+        path = concatpath(innconf->pathrun, INN_PATH_MSGIDCACHE);
+        cache = tokencache_open(path, innconf->sharedmsgidcachesize);
+        free(path);
+    }
+    if (cache != NULL && token != NULL) {
+        hash = HashMessageID(key);
+        tokencache_add(cache, &hash, token);
+    }
     return r;
 }
 
@@ -379,6 +589,9 @@ InndHisLogStats(void)
 
     notice("ME HISstats %d hitpos %d hitneg %d missed %d dne",
            stats.hitpos, stats.hitneg, stats.misses, stats.dne);
+    if (stats.size > 0)
+        notice("ME HIScache %d size %d used %d evicted",
+               stats.size, stats.used, stats.evicted);
 }
 
 
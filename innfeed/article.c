@@ -11,6 +11,12 @@
 **  off disk and returns a set of Buffer objects. The Article holds onto these
 **  Buffers so that the next Connection that wants to transmit it won't have
 **  to wait for a disk read to be done again.
+**
+**  When the last reference to an Article goes away, its contents and NNTP
+**  buffers are kept for a while in case the same article is handed to us
+**  again (from a backlog file, or because another peer is fed it a little
+**  later).  These cached Articles, and the contents of the Articles still in
+**  use, are released least recently used first when memory gets short.
 */
 
 #include "innfeed.h"
@@ -64,6 +70,11 @@ struct article_s
     bool loggedMissing ;        /* true if article is missing and we logged */
     bool articleOk ;            /* true until we know otherwise. */
     bool inWireFormat ;         /* true if ->contents is \r\n/dot-escaped */
+    bool cached ;               /* true if only kept for its contents */
+    bool prefetched ;           /* true if asked to be read in background */
+    struct hash_entry_s *entry ; /* our entry in the hash table */
+    struct article_s *nextCached ; /* next older cached article */
+    struct article_s *prevCached ; /* next newer cached article */
 } ;
 
 struct hash_entry_s {
@@ -104,6 +115,13 @@ static bool artFreeContents (Article art) ;  /* Tell the Article to release
 static void artUnmap (Article article) ; /* munmap an mmap()ed
                                                      article */
 
+static void artDestroy (Article article) ;  /* Free an article that has
+                                                no more references. */
+
+  /* Keep an unreferenced article for its contents, or take it back. */
+static void artCache (Article article) ;
+static void artUncache (Article article) ;
+
 
   /*
    * Hash table routine declarations.
@@ -113,14 +131,17 @@ static void artUnmap (Article article) ; /* munmap an mmap()ed
 static unsigned int hashString (const char *string) ;
 
   /* Locates the article with the given message ID, in the has table. */
-static Article hashFindArticle (const char *msgid) ;
+static Article hashFindArticle (const char *msgid, unsigned int hash) ;
 
   /* Puts the given article in the hash table. */
-static void hashAddArticle (Article article) ;
+static void hashAddArticle (Article article, unsigned int hash) ;
 
   /* Removes the given article from the has table */
 static bool hashRemoveArticle (Article article) ;
 
+  /* Moves the given article to the front of the chronological list. */
+static void hashTouchArticle (Article article) ;
+
   /* Does some simple-minded hash table validation */
 static void hashValidateTable (void) ;
 
@@ -157,6 +178,15 @@ static unsigned int maxBytesInUse ;   /* the limit we want to stay under for tot
 
 static unsigned int articlesInUse ;  /* number of articles currently allocated. */
 
+static unsigned int articlesCached ; /* number of allocated articles that
+                                        nothing references any more. */
+
+static unsigned int bytesCached ;   /* article contents bytes held (read or
+                                       mapped) by those articles. */
+
+static Article cacheHead ;      /* the most recently cached article */
+static Article cacheTail ;      /* the oldest cached article */
+
 static unsigned int byteTotal ;        /* number of bytes for article contents
                                    allocated totally since last log. */
 
@@ -171,7 +201,8 @@ static MapInfo mapInfo;
    */
 
 static HashEntry *hashTable ;   /* the has table itself */
-static HashEntry chronList ;    /* chronologically ordered. Points at newest */
+static HashEntry chronList ;    /* ordered by last use. Points at newest */
+static HashEntry chronTail ;    /* the least recently used entry */
 
 #define TABLE_SIZE 2048          /* MUST be a power of 2 */
 #define HASH_MASK (TABLE_SIZE - 1)
@@ -188,8 +219,23 @@ static HashEntry chronList ;    /* chronologically ordered. Points at newest */
      (after incrementing the reference count). */
 Article newArticle (const char *filename, const char *msgid)
 {
-  Article newArt = NULL ;
-  
+  Article newArt ;
+
+  newArticles (&filename, &msgid, 1, &newArt) ;
+  return newArt ;
+}
+
+
+  /* Create or find the articles for COUNT commands at once. The message id
+     of each is hashed once for both the lookup and the insertion, and the
+     article, its message id and its file name share one allocation. */
+void newArticles (const char **filenames, const char **msgids,
+                  unsigned int count, Article *articles)
+{
+  Article newArt ;
+  unsigned int idx, hash ;
+  size_t msgidLen, fnameLen ;
+
   TMRstart(TMR_NEWARTICLE);
   if (hashTable == NULL)
     {                           /* first-time through initialization. */
@@ -207,40 +253,66 @@ Article newArticle (const char *filename, const char *msgid)
         articleStatsId = prepareSleep (logArticleStats,ARTICLE_STATS_PERIOD,0);
     }
 
-    /* now look for it in the hash table. We presume the disk file is still
-       ok */
-  if ((newArt = hashFindArticle (msgid)) == NULL)
+  for (idx = 0 ; idx < count ; idx++)
     {
-      newArt = xcalloc (1, sizeof(struct article_s)) ;
+      const char *filename = filenames [idx] ;
+      const char *msgid = msgids [idx] ;
 
-      newArt->fname = xstrdup (filename) ;
-      newArt->msgid = xstrdup (msgid) ;
-      
-      newArt->contents = NULL ;
-      newArt->mapInfo = NULL ;
-      newArt->refCount = 1 ;
-      newArt->loggedMissing = false ;
-      newArt->articleOk = true ;
-      newArt->inWireFormat = false ;
-      
-      d_printf (3,"Adding a new article(%p): %s\n", (void *)newArt, msgid) ;
-      
-      articlesInUse++ ;
-      articleTotal++ ;
-      
-      hashAddArticle (newArt) ;
-    }
-  else
-    {
-      if (strcmp (filename,newArt->fname) != 0)
-        warn ("ME two filenames for same article: %s, %s", filename,
-              newArt->fname) ;
-      
-      newArt->refCount++ ;
-      d_printf (2,"Reusing existing article for %s\n",msgid) ;
+      hash = hashString (msgid) ;
+
+        /* now look for it in the hash table. We presume the disk file is
+           still ok */
+      newArt = hashFindArticle (msgid, hash) ;
+      if (newArt != NULL && newArt->cached
+          && strcmp (filename,newArt->fname) != 0)
+        {
+          artUncache (newArt) ; /* stale copy, start again from the new one. */
+          artDestroy (newArt) ;
+          newArt = NULL ;
+        }
+
+      if (newArt == NULL)
+        {
+          msgidLen = strlen (msgid) + 1 ;
+          fnameLen = strlen (filename) + 1 ;
+          newArt = xcalloc (1, sizeof(struct article_s) + msgidLen + fnameLen) ;
+
+          newArt->msgid = (char *) (newArt + 1) ;
+          memcpy (newArt->msgid, msgid, msgidLen) ;
+          newArt->fname = newArt->msgid + msgidLen ;
+          memcpy (newArt->fname, filename, fnameLen) ;
+          
+          newArt->contents = NULL ;
+          newArt->mapInfo = NULL ;
+          newArt->refCount = 1 ;
+          newArt->loggedMissing = false ;
+          newArt->articleOk = true ;
+          newArt->inWireFormat = false ;
+          newArt->prefetched = false ;
+          
+          d_printf (3,"Adding a new article(%p): %s\n", (void *)newArt, msgid) ;
+          
+          articlesInUse++ ;
+          articleTotal++ ;
+          
+          hashAddArticle (newArt, hash) ;
+        }
+      else
+        {
+          if (strcmp (filename,newArt->fname) != 0)
+            warn ("ME two filenames for same article: %s, %s", filename,
+                  newArt->fname) ;
+          
+          if (newArt->cached)
+            artUncache (newArt) ;
+          newArt->refCount++ ;
+          hashTouchArticle (newArt) ;
+          d_printf (2,"Reusing existing article for %s\n",msgid) ;
+        }
+
+      articles [idx] = newArt ;
     }
   TMRstop(TMR_NEWARTICLE);
-  return newArt ;
 }
 
 
@@ -255,31 +327,11 @@ void delArticle (Article article)
 
   if (--(article->refCount) == 0)
     {
-      bool removed = hashRemoveArticle (article) ;
-
-      ASSERT (removed == true) ;
-
-      d_printf (2,"Cleaning up article (%p): %s\n", 
-          (void *)article, article->msgid) ;
-
-      if (article->contents != NULL)
-        {
-          if (article->mapInfo)
-            artUnmap(article);
-          else
-            bytesInUse -= bufferDataSize (article->contents) ;
-      
-          if (article->nntpBuffers != NULL)
-            freeBufferArray (article->nntpBuffers) ;
-
-          delBuffer (article->contents) ;
-        }
-
-      articlesInUse-- ;
-
-      free (article->fname) ;
-      free (article->msgid) ;
-      free (article) ;
+      if (article->contents != NULL && article->articleOk
+          && bufferDataSize (article->contents) <= maxBytesInUse / 2)
+        artCache (article) ;
+      else
+        artDestroy (article) ;
     }
 
   VALIDATE_HASH_TABLE () ;
@@ -307,6 +359,8 @@ void gPrintArticleInfo (FILE *fp, unsigned int indentAmt)
   fprintf (fp,"%s  bytesInUse : %u\n",indent,bytesInUse) ;
   fprintf (fp,"%s  maxBytesInUse : %u\n",indent,maxBytesInUse) ;
   fprintf (fp,"%s  articlesInUse : %u\n",indent,articlesInUse) ;
+  fprintf (fp,"%s  articlesCached : %u\n",indent,articlesCached) ;
+  fprintf (fp,"%s  bytesCached : %u\n",indent,bytesCached) ;
   fprintf (fp,"%s  byteTotal : %u\n",indent,byteTotal) ;
   fprintf (fp,"%s  articleTotal : %u\n",indent,articleTotal) ;
   fprintf (fp,"%s  articleStatsId : %d\n",indent,articleStatsId) ;
@@ -335,6 +389,7 @@ void printArticleInfo (Article art, FILE *fp, unsigned int indentAmt)
   fprintf (fp,"%sArticle : %p {\n",indent,(void *) art) ;
   fprintf (fp,"%s    article ok : %s\n",indent,boolToString (art->articleOk)) ;
   fprintf (fp,"%s    refcount : %d\n",indent,art->refCount) ;
+  fprintf (fp,"%s    cached : %s\n",indent,boolToString (art->cached)) ;
   fprintf (fp,"%s    filename : %s\n",indent,art->fname) ;
   fprintf (fp,"%s    msgid : %s\n",indent,art->msgid) ;
 
@@ -375,6 +430,24 @@ bool artContentsOk (Article article)
 }
 
 
+  /* Start reading the article in the background if it's not in memory yet,
+     so that the read in fillContents() doesn't wait for the disk and stall
+     all the other connections. Done once per article. */
+void artPrefetch (Article article)
+{
+  TOKEN token ;
+
+  if (article->contents != NULL || article->prefetched || !article->articleOk)
+    return ;
+  article->prefetched = true ;
+  if (IsToken (article->fname))
+    {
+      token = TextToToken (article->fname) ;
+      SMprobe (SMPREFETCH, &token, NULL) ;
+    }
+}
+
+
   /* bump reference count on the article. */
 Article artTakeRef (Article article) 
 {
@@ -402,6 +475,7 @@ Buffer *artGetNntpBuffers (Article article)
   if ( !prepareArticleForNNTP (article) )
     return NULL ;
 
+  hashTouchArticle (article) ;
   return dupBufferArray (article->nntpBuffers) ;
 }
 
@@ -441,7 +515,7 @@ void artLogMissingArticles (bool val)
   /* set the limit we want to stay under. */
 void artSetMaxBytesInUse (unsigned int val)
 {
-  ASSERT (maxBytesInUse > 0) ;  /* can only set one time. */
+  ASSERT (maxBytesInUse == 0) ; /* can only set one time. */
   ASSERT (val > 0) ;
   
   maxBytesInUse = val ;
@@ -541,6 +615,7 @@ static void logArticleStats (TimeoutId id, void *data UNUSED)
   ASSERT (id == articleStatsId) ;
 
   notice ("ME articles active %d bytes %d", articlesInUse, bytesInUse) ;
+  notice ("ME articles cached %d bytes %d", articlesCached, bytesCached) ;
   notice ("ME articles total %d bytes %d", articleTotal, byteTotal) ;
   
   byteTotal = 0 ;
@@ -569,7 +644,8 @@ static bool fillContents (Article article)
     int amt = 0 ;
     size_t idx = 0, amtToRead ;
     size_t newBufferSize ;
-    HashEntry h ;
+    HashEntry h, older ;
+    Article art, newer ;
     ARTHANDLE *arthandle = NULL;
     const void *mMapping = NULL;
 
@@ -684,15 +760,21 @@ static bool fillContents (Article article)
 	newBufferSize ++ ;
 	
 	/* if we're going over the limit try to free up some older article's
-	   contents.  */
-	if (amtToRead + bytesInUse > maxBytesInUse)
+	   contents, first those of articles no longer in use.  */
+	for (art = cacheTail ; art != NULL ; art = newer)
 	{
-	    for (h = chronList ; h != NULL ; h = h->nextTime)
-	    {
-		if (artFreeContents (h->article))
-		    if (amtToRead + bytesInUse <= maxBytesInUse)
-			break ;
-	    }
+	    if (amtToRead + bytesInUse <= maxBytesInUse)
+		break ;
+	    newer = art->prevCached ;
+	    artUncache (art) ;
+	    artDestroy (art) ;
+	}
+	for (h = chronTail ; h != NULL ; h = older)
+	{
+	    if (amtToRead + bytesInUse <= maxBytesInUse)
+		break ;
+	    older = h->prevTime ;
+	    artFreeContents (h->article) ;
 	}
 	
 	/* we we couldn't get below, then log it (one time only) */
@@ -919,6 +1001,87 @@ static bool artFreeContents (Article art)
 }
 
 
+  /* free an article that nothing references any more, along with its
+     contents. */
+static void artDestroy (Article article)
+{
+  bool removed = hashRemoveArticle (article) ;
+
+  ASSERT (removed == true) ;
+  ASSERT (article->refCount == 0 && !article->cached) ;
+
+  d_printf (2,"Cleaning up article (%p): %s\n",
+      (void *)article, article->msgid) ;
+
+  if (article->contents != NULL)
+    {
+      if (article->mapInfo)
+        artUnmap(article);
+      else
+        bytesInUse -= bufferDataSize (article->contents) ;
+
+      if (article->nntpBuffers != NULL)
+        freeBufferArray (article->nntpBuffers) ;
+
+      delBuffer (article->contents) ;
+    }
+
+  articlesInUse-- ;
+
+  free (article) ;          /* the message id and file name go with it */
+}
+
+
+  /* keep an article whose last reference just went away, so that its
+     contents and NNTP buffers can be handed out again if it comes back.
+     The oldest cached articles make room for it. */
+static void artCache (Article article)
+{
+  size_t size = bufferDataSize (article->contents) ;
+
+  while (cacheTail != NULL && bytesCached + size > maxBytesInUse / 2)
+    {
+      Article old = cacheTail ;
+
+      artUncache (old) ;
+      artDestroy (old) ;
+    }
+
+  article->cached = true ;
+  article->prevCached = NULL ;
+  article->nextCached = cacheHead ;
+  if (cacheHead != NULL)
+    cacheHead->prevCached = article ;
+  else
+    cacheTail = article ;
+  cacheHead = article ;
+
+  articlesCached++ ;
+  bytesCached += size ;
+}
+
+
+  /* take an article off the list of cached ones, either because it is
+     wanted again or before destroying it. */
+static void artUncache (Article article)
+{
+  ASSERT (article->cached) ;
+
+  if (article->prevCached != NULL)
+    article->prevCached->nextCached = article->nextCached ;
+  else
+    cacheHead = article->nextCached ;
+  if (article->nextCached != NULL)
+    article->nextCached->prevCached = article->prevCached ;
+  else
+    cacheTail = article->prevCached ;
+
+  article->cached = false ;
+  articlesCached-- ;
+  bytesCached -= bufferDataSize (article->contents) ;
+}
+
+
 
 
 
@@ -945,9 +1108,8 @@ static unsigned int hashString (const char *string)
 
 
   /* find the article in the has table and return it. */
-static Article hashFindArticle (const char *msgid)
+static Article hashFindArticle (const char *msgid, unsigned int hash)
 {
-  unsigned int hash = hashString (msgid) ;
   HashEntry h ;
 
   for (h = hashTable [TABLE_ENTRY(hash)] ; h != NULL ; h = h->next)
@@ -959,9 +1121,8 @@ static Article hashFindArticle (const char *msgid)
 
 
   /* add the article to the hash table. */
-static void hashAddArticle (Article article)
+static void hashAddArticle (Article article, unsigned int hash)
 {
-  unsigned int hash = hashString (article->msgid) ;
   HashEntry h ;
   HashEntry ne ;
 
@@ -984,8 +1145,11 @@ static void hashAddArticle (Article article)
 
   if (chronList != NULL)
     chronList->prevTime = ne ;
+  else
+    chronTail = ne ;
 
   chronList = ne ;
+  article->entry = ne ;
 }
 
 
@@ -993,15 +1157,12 @@ static void hashAddArticle (Article article)
      Does not delete the article itself. */
 static bool hashRemoveArticle (Article article)
 {
-  unsigned int hash = hashString (article->msgid) ;
-  HashEntry h ;
-
-  for (h = hashTable [TABLE_ENTRY(hash)] ; h != NULL ; h = h->next)
-    if (hash == h->hash && strcmp (article->msgid,h->article->msgid) == 0)
-      break ;
+  HashEntry h = article->entry ;
+  unsigned int hash ;
 
   if (h == NULL)
     return false ;
+  hash = h->hash ;
 
   if (h == hashTable [TABLE_ENTRY(hash)])
     {
@@ -1023,17 +1184,41 @@ static bool hashRemoveArticle (Article article)
         chronList->prevTime = NULL ;
     }
   else
-    {
-      h->prevTime->nextTime = h->nextTime ;
-      if (h->nextTime != NULL)
-        h->nextTime->prevTime = h->prevTime ;
-    }
+    h->prevTime->nextTime = h->nextTime ;
+
+  if (chronTail == h)
+    chronTail = h->prevTime ;
+  else
+    h->nextTime->prevTime = h->prevTime ;
 
   free (h) ;
+  article->entry = NULL ;
   
   return true ;
 }
 
+
+  /* move the article to the front of the chronological list, so that its
+     contents are the last to be freed when memory gets short. */
+static void hashTouchArticle (Article article)
+{
+  HashEntry h = article->entry ;
+
+  if (h == chronList)
+    return ;
+
+  h->prevTime->nextTime = h->nextTime ;
+  if (h->nextTime != NULL)
+    h->nextTime->prevTime = h->prevTime ;
+  else
+    chronTail = h->prevTime ;
+
+  h->prevTime = NULL ;
+  h->nextTime = chronList ;
+  chronList->prevTime = h ;
+  chronList = h ;
+}
+
 #define HASH_VALIDATE_BUCKET_COUNT 1 /* hash buckets to check per call */
 
 static void hashValidateTable (void)
@@ -1046,7 +1231,7 @@ static void hashValidateTable (void)
   for (i = 0 ; i < HASH_VALIDATE_BUCKET_COUNT ; i++)
     {
       for (he = hashTable [hbn] ; he != NULL ; he = he->next)
-        ASSERT (he->article->refCount > 0) ;
+        ASSERT (he->article->refCount > 0 || he->article->cached) ;
       if (++hbn >= TABLE_SIZE)
         hbn = 0 ;
     }
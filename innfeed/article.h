@@ -26,6 +26,11 @@
   /* article is in. MSGID is the news message id of the article */
 Article newArticle (const char *filename, const char *msgid) ;
 
+  /* Create COUNT Article objects at once, one for each FILENAMES[i] and
+     MSGIDS[i] pair, and place them in ARTICLES. */
+void newArticles (const char **filenames, const char **msgids,
+                  unsigned int count, Article *articles) ;
+
   /* delete the given article. Just decrements refcount and then FREEs if the
      refcount is 0. */
 void delArticle (Article article) ;
@@ -42,6 +47,10 @@ bool artFileIsValid (Article article) ;
      the reading off the disk). */
 bool artContentsOk (Article article) ;
 
+  /* ask the storage manager to start reading the article's contents in the
+     background, because they'll be needed soon. */
+void artPrefetch (Article article) ;
+
   /* increments reference count and returns a copy of article that can be
      kept (or passed off to someone else) */
 Article artTakeRef (Article article) ;
@@ -71,6 +71,9 @@ void configCleanup (void) ;
 #define IP_NAME "ip-name"
 #define MAX_CONNECTIONS "max-connections"
 #define MAX_QUEUE_SIZE "max-queue-size"
+#define WRITE_BATCH_SIZE "write-batch-size"
+#define LARGE_ARTICLE_SIZE "large-article-size"
+#define LARGE_ARTICLE_CXNS "large-article-connections"
 #define NO_CHECK_HIGH "no-check-high"
 #define NO_CHECK_LOW "no-check-low"
 #define PORT_NUMBER "port-number"
@@ -67,9 +67,11 @@
 # include <sys/ioctl.h>
 #endif
 
+#include "inn/buffer.h"
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
+#include "inn/metrics.h"
 #include "inn/network.h"
 #include "inn/libinn.h"
 
@@ -97,6 +99,7 @@ extern const char *pidFile ;
 typedef struct art_holder_s
 {
     Article article ;
+    double sent ;               /* when the CHECK was issued */
     struct art_holder_s *next ;
 } *ArtHolder ;
 
@@ -142,7 +145,21 @@ struct connection_s
     char *ipName ;              /* the ip name (possibly quad) of the remote */
 
     unsigned int maxCheck ;            /* the max number of CHECKs to send */
+
+    /*
+     * The adaptive streaming window (dynamic-method 4). maxCheck follows
+     * window, which grows by one per CHECK answered in slow start and by
+     * one per window of them afterwards, and is halved when the CHECK round
+     * trips show queueing or the peer defers articles.
+     */
+    double window ;
+    double ssthresh ;           /* slow-start threshold */
+    double srtt ;               /* smoothed CHECK round trip, in seconds */
+    double minRtt ;             /* the quickest CHECK round trip seen */
+    double lastCut ;            /* when the window was last halved */
     unsigned short port ;              /* the port number to use */
+    unsigned int ipFailures ;   /* addresses of the host that failed since
+                                   the last connection */
 
     /*
      * Timeout values and their callback IDs
@@ -243,11 +260,13 @@ static void getBanner (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void getAuthUserResponse (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void getAuthPassResponse (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void getModeResponse (EndPoint e, IoStatus i, Buffer *b, void *d) ;
+static void getCompressResponse (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void responseIsRead (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void quitWritten (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void ihaveBodyDone (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void commandWriteDone (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void modeCmdIssued (EndPoint e, IoStatus i, Buffer *b, void *d) ;
+static void compressCmdIssued (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void authUserIssued (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void authPassIssued (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static void writeProgress (EndPoint e, IoStatus i, Buffer *b, void *d) ;
@@ -265,6 +284,8 @@ static void cxnWorkProc (EndPoint ep, void *data) ;
 
 
 static void cxnSleepOrDie (Connection cxn) ;
+static bool cxnOpen (Connection cxn) ;
+static bool cxnConnectFailed (Connection cxn) ;
 
 /* Response processing. */
 static void processResponse205 (Connection cxn, char *response) ;
@@ -298,7 +319,8 @@ static bool issueIHAVE (Connection cxn) ;
 static void issueIHAVEBody (Connection cxn) ;
 static bool issueStreamingCommands (Connection cxn) ;
 static Buffer buildCheckBuffer (Connection cxn) ;
-static Buffer *buildTakethisBuffers (Connection cxn, Buffer checkBuffer) ;
+static Buffer *buildTakethisBuffers (Connection cxn, Buffer checkBuffer,
+                                     ArtHolder *rest) ;
 static void issueQUIT (Connection cxn) ;
 static void initReadBlockedTimeout (Connection cxn) ;
 static int prepareWriteWithTimeout (EndPoint endp, Buffer *buffers,
@@ -311,6 +333,7 @@ static void validateConnection (Connection cxn) ;
 static const char *stateToString (CxnState state) ;
 
 static void issueModeStream (EndPoint e, Connection cxn) ;
+static void issueCompress (EndPoint e, Connection cxn) ;
 static void issueAuthUser (EndPoint e, Connection cxn) ;
 static void issueAuthPass (EndPoint e, Connection cxn) ;
 
@@ -325,6 +348,9 @@ static void appendArtHolder (ArtHolder artH, ArtHolder *head, unsigned int *coun
 static ArtHolder artHolderByMsgId (const char *msgid, ArtHolder head) ;
 
 static int fudgeFactor (int initVal) ;
+static double timeNow (void) ;
+static void resetWindow (Connection cxn) ;
+static void checkAnswered (Connection cxn, ArtHolder artH, bool deferred) ;
 
 
 
@@ -488,12 +514,6 @@ Connection newConnection (Host host,
  */
 bool cxnConnect (Connection cxn)
 {
-  struct sockaddr *cxnAddr;
-  socklen_t len;
-  int fd, rval;
-  const char *src;
-  const char *peerName = hostPeerName (cxn->myHost) ;
-
   ASSERT (cxn->myEp == NULL) ;
 
   if (!(cxn->state == cxnStartingS ||
@@ -515,6 +535,22 @@ bool cxnConnect (Connection cxn)
 
   cxn->state = cxnConnectingS ;
 
+  return cxnOpen (cxn) ;
+}
+
+
+/* Start the non-blocking connect of the Connection, in the
+ * cxnConnectingS state, to the current IP address of its host. Returns
+ * as cxnConnect does.
+ */
+static bool cxnOpen (Connection cxn)
+{
+  struct sockaddr *cxnAddr;
+  socklen_t len;
+  int fd, rval;
+  const char *src;
+  const char *peerName = hostPeerName (cxn->myHost) ;
+
   cxnAddr = hostIpAddr (cxn->myHost) ;
 
   if (cxnAddr == NULL)
@@ -568,12 +604,9 @@ bool cxnConnect (Connection cxn)
   if (rval < 0 && errno != EINPROGRESS)
     {
       syswarn ("%s:%d connect", peerName, cxn->ident) ;
-      hostIpFailed (cxn->myHost) ;
       close (fd) ;
 
-      cxnSleepOrDie (cxn) ;
-
-      return false ;
+      return cxnConnectFailed (cxn) ;
     }
 
   if ((cxn->myEp = newEndPoint (fd)) == NULL)
@@ -599,6 +632,36 @@ bool cxnConnect (Connection cxn)
 
 
 
+/* Called when connecting to the current IP address of the host failed,
+ * with the endpoint for it, if any, still there. Unless all the addresses
+ * of the host have now failed since the last successful connection, the
+ * next one is tried at once rather than after the reconnection period, so
+ * that a peer with a dead IPv6 address is fed over IPv4 without delay.
+ * Returns true if the Connection is still connecting.
+ */
+static bool cxnConnectFailed (Connection cxn)
+{
+  hostIpFailed (cxn->myHost) ;
+  if (cxn->myEp != NULL)
+    {
+      delEndPoint (cxn->myEp) ;
+      cxn->myEp = NULL ;
+    }
+
+  if (++cxn->ipFailures >= hostIpAddrCount (cxn->myHost))
+    {
+      cxn->ipFailures = 0 ;
+      cxnSleepOrDie (cxn) ;
+      return false ;
+    }
+
+  return cxnOpen (cxn) ;
+}
+
+
+
+
+
 /* Put the Connection into the wait state.
  *
  * Pre-state		Reason cxnWait called
@@ -893,7 +956,13 @@ bool cxnTakeArticle (Connection cxn, Article art)
         break ;
 
       case cxnFeedingS:
-        doSomeWrites (cxn) ;
+        /* When batching, wait for the end of this pass through the event
+           loop so that all the articles the Host hands us in it go out
+           in a single write. */
+        if (cxn->doesStreaming && hostWriteBatchSize (cxn->myHost) > 0)
+          addWorkCallback (cxn->myEp,cxnWorkProc,cxn) ;
+        else
+          doSomeWrites (cxn) ;
         break ;
 
       case cxnConnectingS:
@@ -986,6 +1055,10 @@ bool cxnQueueArticle (Connection cxn, Article art)
                cxn->ident,artMsgId (art)) ;
 
       cxn->artsTaken++ ;
+
+      /* Its CHECK, or the rest of the queue, gives the disk time to read
+         it before TAKETHIS or IHAVE needs its contents. */
+      artPrefetch (art) ;
     }
 
   return rval ;
@@ -1074,10 +1147,12 @@ size_t cxnQueueSpace (Connection cxn)
 
   ASSERT (cxn != NULL) ;
 
-  if (cxn->state == cxnFeedingS ||
-      cxn->state == cxnIdleS ||
-      cxn->state == cxnConnectingS ||
-      cxn->state == cxnWaitingS)
+  /* the queue may be over maxCheck if the streaming window shrank. */
+  if ((cxn->state == cxnFeedingS ||
+       cxn->state == cxnIdleS ||
+       cxn->state == cxnConnectingS ||
+       cxn->state == cxnWaitingS) &&
+      cxn->articleQTotal < cxn->maxCheck)
     rval = cxn->maxCheck - cxn->articleQTotal ;
 
   return rval ;
@@ -1087,6 +1162,22 @@ size_t cxnQueueSpace (Connection cxn)
 
 
 
+/*
+ * Return the smoothed and the quickest round trip of the CHECKs on the
+ * connection, or zeros if it hasn't timed any yet.
+ */
+void cxnRoundTrip (Connection cxn, double *srtt, double *minRtt)
+{
+  ASSERT (cxn != NULL) ;
+
+  *srtt = cxn->srtt ;
+  *minRtt = cxn->minRtt ;
+}
+
+
+
+
+
 /*
  * Print info on all the connections that currently exist.
  */
@@ -1109,6 +1200,82 @@ void gPrintCxnInfo (FILE *fp, unsigned int indentAmt)
 
 
 
+/*
+ * Append the state and statistics of every connection to OUT.  The
+ * article counters cover the current session of the connection, like the
+ * "final" lines of cxnLogStats.
+ */
+void gCxnMetrics (struct buffer *out)
+{
+  static const char *const states [] = {
+    "starting", "waiting", "connecting", "idle", "idletimeout", "feeding",
+    "sleeping", "flushing", "closing", "dead"
+  } ;
+  Connection cxn ;
+  const char *peer ;
+  char ident [20] ;
+
+  metrics_family (out, "innfeed_connection", "info",
+                  "State of the connection.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_info", 1,
+                      "peer", hostPeerName (cxn->myHost), "connection", ident,
+                      "state", ((size_t) cxn->state < ARRAY_SIZE (states)
+                                ? states [cxn->state] : "unknown"),
+                      (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_connection_queued_articles", "gauge",
+                  "Articles queued on the connection.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_queued_articles",
+                      cxn->articleQTotal, "peer", hostPeerName (cxn->myHost),
+                      "connection", ident, (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_connection_articles", "counter",
+                  "Articles offered on the connection, by outcome.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      peer = hostPeerName (cxn->myHost) ;
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_articles_total",
+                      cxn->checksIssued, "peer", peer, "connection", ident,
+                      "result", "offered", (char *) NULL) ;
+      metrics_sample (out, "innfeed_connection_articles_total",
+                      cxn->takesOkayed, "peer", peer, "connection", ident,
+                      "result", "accepted", (char *) NULL) ;
+      metrics_sample (out, "innfeed_connection_articles_total",
+                      cxn->checksRefused, "peer", peer, "connection", ident,
+                      "result", "refused", (char *) NULL) ;
+      metrics_sample (out, "innfeed_connection_articles_total",
+                      cxn->takesRejected, "peer", peer, "connection", ident,
+                      "result", "rejected", (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_connection_max_checks", "gauge",
+                  "CHECKs the connection may have outstanding.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_max_checks", cxn->maxCheck,
+                      "peer", hostPeerName (cxn->myHost), "connection", ident,
+                      (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_connection_check_rtt_seconds", "gauge",
+                  "Smoothed round trip time of CHECK commands.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_check_rtt_seconds", cxn->srtt,
+                      "peer", hostPeerName (cxn->myHost), "connection", ident,
+                      (char *) NULL) ;
+    }
+}
+
+
+
 
 
 /*
@@ -1132,6 +1299,10 @@ void printCxnInfo (Connection cxn, FILE *fp, unsigned int indentAmt)
   fprintf (fp,"%s    ip-name : %s\n", indent, cxn->ipName) ;
   fprintf (fp,"%s    port-number : %u\n",indent,cxn->port) ;
   fprintf (fp,"%s    max-checks : %u\n",indent,cxn->maxCheck) ;
+  fprintf (fp,"%s    window : %.1f (ssthresh %.1f)\n",indent,cxn->window,
+           cxn->ssthresh) ;
+  fprintf (fp,"%s    check-rtt : %.3f (min %.3f)\n",indent,cxn->srtt,
+           cxn->minRtt) ;
   fprintf (fp,"%s    does-streaming : %s\n",indent,
            boolToString (cxn->doesStreaming)) ;
   fprintf (fp,"%s    authenticated : %s\n",indent,
@@ -1284,12 +1455,12 @@ static void connectionDone (EndPoint e, IoStatus i, Buffer *b, void *d)
          the SO_ERROR value out of the socket. */
       errno = optval ;
       syswarn ("%s:%d cxnsleep connect", peerName, cxn->ident) ;
-      hostIpFailed (cxn->myHost) ;
 
-      cxnSleepOrDie (cxn) ;
+      cxnConnectFailed (cxn) ;
     }
   else
     {
+      cxn->ipFailures = 0 ;
       readBuffers = makeBufferArray (bufferTakeRef (cxn->respBuffer), NULL) ;
 
       if ( !prepareRead (e, readBuffers, getBanner, cxn, 1) )
@@ -1439,7 +1610,7 @@ static void getBanner (EndPoint e, IoStatus i, Buffer *b, void *d)
 	      && hostPassword (cxn->myHost) != NULL)
 	    issueAuthUser (e,cxn);
 	  else
-	    issueModeStream (e,cxn);
+	    issueCompress (e,cxn);
 	}
     }
   freeBufferArray (b) ;
@@ -1580,6 +1751,60 @@ static void issueModeStream (EndPoint e, Connection cxn)
 
 
 
+/*
+ * Ask for COMPRESS DEFLATE if the host wants it, and go on with MODE STREAM
+ * otherwise.
+ */
+static void issueCompress (EndPoint e, Connection cxn)
+{
+  Buffer *compressCmdBuffers,*readBuffers ;
+  Buffer compressBuffer ;
+  char *p;
+
+#define  COMPRESS_CMD "COMPRESS DEFLATE\r\n"
+
+  if (!hostWantsCompress (cxn->myHost))
+    {
+      issueModeStream (e,cxn) ;
+      return ;
+    }
+
+  compressBuffer = newBuffer (strlen (COMPRESS_CMD) + 1) ;
+  p = bufferBase (compressBuffer) ;
+
+  d_printf (1, "%s:%d Issuing the compress command\n",
+            hostPeerName (cxn->myHost), cxn->ident) ;
+
+  strlcpy (p, COMPRESS_CMD, bufferSize (compressBuffer)) ;
+
+  bufferSetDataSize (compressBuffer, strlen (p)) ;
+
+  compressCmdBuffers = makeBufferArray (compressBuffer, NULL) ;
+
+  if ( !prepareWriteWithTimeout (e, compressCmdBuffers, compressCmdIssued,
+				 cxn) )
+    {
+      die ("%s:%d fatal prepare write for compress failed",
+           hostPeerName (cxn->myHost), cxn->ident) ;
+    }
+
+  bufferSetDataSize (cxn->respBuffer, 0) ;
+
+  readBuffers = makeBufferArray (bufferTakeRef(cxn->respBuffer),NULL);
+
+  if ( !prepareRead (e, readBuffers, getCompressResponse, cxn, 1) )
+    {
+      warn ("%s:%d cxnsleep prepare read failed", hostPeerName (cxn->myHost),
+            cxn->ident) ;
+      freeBufferArray (readBuffers) ;
+      cxnSleepOrDie (cxn) ;
+    }
+}
+
+
+
+
+
 /*
  *
  */
@@ -1659,7 +1884,7 @@ static void getAuthUserResponse (EndPoint e, IoStatus i, Buffer *b, void *d)
               warn ("%s:%d cxnsleep response to AUTHINFO USER: %s", peerName,
                     cxn->ident, p) ;
 	      cxn->authenticated = true;
-	      issueModeStream (e,cxn);
+	      issueCompress (e,cxn);
 	      break ;
 	    }
 
@@ -1743,7 +1968,7 @@ static void getAuthPassResponse (EndPoint e, IoStatus i, Buffer *b, void *d)
 	    case 281:
               notice ("%s:%d authenticated", peerName, cxn->ident) ;
 	      cxn->authenticated = true ;
-	      issueModeStream (e,cxn);
+	      issueCompress (e,cxn);
 	      break ;
 
 	    default:
@@ -1761,6 +1986,95 @@ static void getAuthPassResponse (EndPoint e, IoStatus i, Buffer *b, void *d)
 
 
 
+/*
+ * Process the remote's response to our COMPRESS command. Whatever it is,
+ * we go on with MODE STREAM, compressed or not.
+ */
+static void getCompressResponse (EndPoint e, IoStatus i, Buffer *b, void *d)
+{
+  Connection cxn = (Connection) d ;
+  int code ;
+  char *p = bufferBase (b[0]) ;
+  Buffer *buffers ;
+  const char *peerName ;
+
+  ASSERT (e == cxn->myEp) ;
+  ASSERT (b [0] == cxn->respBuffer) ;
+  ASSERT (b [1] == NULL) ;      /* only ever one buffer on this read */
+  ASSERT (cxn->state == cxnConnectingS) ;
+  VALIDATE_CONNECTION (cxn) ;
+
+  peerName = hostPeerName (cxn->myHost) ;
+
+  bufferAddNullByte (b[0]) ;
+
+  d_printf (1,"%s:%d Processing compress response: %s", /* no NL */
+           hostPeerName (cxn->myHost), cxn->ident, p) ;
+
+  if (i == IoDone && writeIsPending (cxn->myEp))
+    {                           /* badness. should never happen */
+      warn ("%s:%d cxnsleep compress command still pending", peerName,
+            cxn->ident) ;
+
+      cxnSleepOrDie (cxn) ;
+    }
+  else if (i != IoDone)
+    {
+      if (i != IoEOF)
+        {
+          errno = endPointErrno (e) ;
+          syswarn ("%s:%d cxnsleep can't read response", peerName, cxn->ident);
+        }
+      cxnSleepOrDie (cxn) ;
+    }
+  else if (strchr (p, '\n') == NULL)
+    {                           /* partial read */
+      expandBuffer (b [0], BUFFER_EXPAND_AMOUNT) ;
+
+      buffers = makeBufferArray (bufferTakeRef (b [0]), NULL) ;
+      if ( !prepareRead (e, buffers, getCompressResponse, cxn, 1) )
+        {
+          warn ("%s:%d cxnsleep prepare read failed", peerName, cxn->ident) ;
+          freeBufferArray (buffers) ;
+          cxnSleepOrDie (cxn) ;
+        }
+    }
+  else
+    {
+      clearTimer (cxn->readBlockedTimerId) ;
+
+      if ( !getNntpResponse (p, &code, NULL) )
+        {
+          warn ("%s:%d cxnsleep response to COMPRESS: %s", peerName,
+                cxn->ident, p) ;
+
+          cxnSleepOrDie (cxn) ;
+        }
+      else
+        {
+          trim_ws (p) ;
+          if (code == 206 && !endPointCompress (e))
+            {
+              /* the remote compresses now, so we can't go on without it */
+              warn ("%s:%d cxnsleep can't start compression", peerName,
+                    cxn->ident) ;
+              cxnSleepOrDie (cxn) ;
+            }
+          else
+            {
+              if (code != 206)
+                notice ("%s:%d not compressing: %s", peerName, cxn->ident, p) ;
+              issueModeStream (e,cxn) ;
+            }
+        }
+    }
+  freeBufferArray (b) ;
+}
+
+
+
+
+
 /*
  * Process the remote's response to our MODE STREAM command. This is where
  * the Connection moves into the cxnFeedingS state. If the remote has given
@@ -1841,6 +2155,8 @@ static void getModeResponse (EndPoint e, IoStatus i, Buffer *b, void *d)
                   {
                     cxn->doesStreaming = true ;
                     cxn->maxCheck = hostMaxChecks (cxn->myHost) ;
+                    if (hostAdaptiveWindow (cxn->myHost))
+                      resetWindow (cxn) ;
                   }
                 else
                   cxn->maxCheck = 1 ;
@@ -2372,6 +2688,38 @@ static void commandWriteDone (EndPoint e, IoStatus i, Buffer *b, void *d)
 
 
 
+/*
+ * Called when the COMPRESS command has been written down the pipe.
+ */
+static void compressCmdIssued (EndPoint e, IoStatus i, Buffer *b, void *d)
+{
+  Connection cxn = (Connection) d ;
+
+  ASSERT (e == cxn->myEp) ;
+
+  clearTimer (cxn->writeBlockedTimerId) ;
+
+  /* The compress command has been sent, so start the response timer */
+  initReadBlockedTimeout (cxn) ;
+
+  if (i != IoDone)
+    {
+      d_printf (1,"%s:%d COMPRESS command failed to write\n",
+               hostPeerName (cxn->myHost), cxn->ident) ;
+
+      syswarn ("%s:%d cxnsleep can't write COMPRESS",
+               hostPeerName (cxn->myHost), cxn->ident) ;
+
+      cxnSleepOrDie (cxn) ;
+    }
+
+  freeBufferArray (b) ;
+}
+
+
+
+
+
 /*
  * Called when the MODE STREAM command has been written down the pipe.
  */
@@ -2853,6 +3201,7 @@ static void processResponse238 (Connection cxn, char *response)
     {
       /* now remove the article from the check queue and move it onto the
          transmit queue. Another function wil take care of transmitting */
+      checkAnswered (cxn, artHolder, false) ;
       remArtHolder (artHolder, &cxn->checkRespHead, &cxn->articleQTotal) ;
       if (cxn->state != cxnClosingS)
         appendArtHolder (artHolder, &cxn->takeHead, &cxn->articleQTotal) ;
@@ -2915,6 +3264,7 @@ static void processResponse431 (Connection cxn, char *response)
     noSuchMessageId (cxn,431,msgid,response) ;
   else
     {
+      checkAnswered (cxn, artHolder, true) ;
       remArtHolder (artHolder, &cxn->checkRespHead, &cxn->articleQTotal) ;
       if (cxn->articleQTotal == 0 && !writeIsPending (cxn->myEp))
         cxnIdle (cxn) ;
@@ -2976,6 +3326,7 @@ static void processResponse438 (Connection cxn, char *response)
     {
       cxn->checksRefused++ ;
 
+      checkAnswered (cxn, artHolder, false) ;
       remArtHolder (artHolder, &cxn->checkRespHead, &cxn->articleQTotal) ;
       if (cxn->articleQTotal == 0 && !writeIsPending (cxn->myEp))
         cxnIdle (cxn) ;
@@ -4087,7 +4438,7 @@ static bool issueStreamingCommands (Connection cxn)
 {
   Buffer checkBuffer = NULL ;   /* the buffer with the CHECK commands in it. */
   Buffer *writeArray = NULL ;
-  ArtHolder p, q ;
+  ArtHolder p, q, rest ;
   bool rval = false ;
 
   ASSERT (cxn != NULL) ;
@@ -4112,7 +4463,7 @@ static bool issueStreamingCommands (Connection cxn)
     }
   
 
-  writeArray = buildTakethisBuffers (cxn,checkBuffer) ; /* may be null */
+  writeArray = buildTakethisBuffers (cxn,checkBuffer,&rest) ; /* may be null */
 
   /* If not null, then writeArray will have checkBuffer (if it wasn't NULL)
      in the first spot and the takethis buffers after that. */
@@ -4136,7 +4487,7 @@ static bool issueStreamingCommands (Connection cxn)
       else
         p->next = cxn->takeHead ;
       
-      cxn->takeHead = NULL ;
+      cxn->takeHead = rest ;    /* left for the next write, if any */
     }
 
   /* we defer the missing article notification to here because if there
@@ -4169,6 +4520,7 @@ static Buffer buildCheckBuffer (Connection cxn)
   size_t lenBuff = 0 ;
   Buffer checkBuffer = NULL ;
   const char *peerName = hostPeerName (cxn->myHost) ;
+  double now = timeNow () ;
 
   p = cxn->checkHead ;
   while (p != NULL)
@@ -4208,6 +4560,7 @@ static Buffer buildCheckBuffer (Connection cxn)
 
           cxn->checksIssued++ ;
           hostArticleOffered (cxn->myHost,cxn) ;
+          p->sent = now ;
 
           p = p->next ;
         }
@@ -4228,17 +4581,25 @@ static Buffer buildCheckBuffer (Connection cxn)
 /*
  * Construct and array of TAKETHIS commands and the command bodies. Any
  * articles on the queue that are missing will be removed and the Host will
- * be informed.
+ * be informed. If the Host limits the size of a write, the articles that
+ * didn't fit are cut off the queue and returned in REST.
  */
-static Buffer *buildTakethisBuffers (Connection cxn, Buffer checkBuffer)
+static Buffer *buildTakethisBuffers (Connection cxn, Buffer checkBuffer,
+                                     ArtHolder *rest)
 {
   size_t lenArray = 0 ;
+  size_t batchSize = hostWriteBatchSize (cxn->myHost) ;
+  size_t writeSize = 0 ;
   ArtHolder p, q ;
   Buffer *rval = NULL ;
   const char *peerName = hostPeerName (cxn->myHost) ;
 
+  *rest = NULL ;
   if (checkBuffer != NULL)
-    lenArray++ ;
+    {
+      lenArray++ ;
+      writeSize += bufferDataSize (checkBuffer) ;
+    }
 
   if (cxn->takeHead != NULL)    /* some TAKETHIS commands to be done. */
     {
@@ -4269,6 +4630,16 @@ static Buffer *buildTakethisBuffers (Connection cxn, Buffer checkBuffer)
           Buffer *articleBuffers ;
           int i, nntpLen ;
 
+          if (batchSize > 0 && writeIdx > 0 && writeSize >= batchSize)
+            {                   /* full, the rest waits for the next write */
+              *rest = p ;
+              if (q == NULL)
+                cxn->takeHead = NULL ;
+              else
+                q->next = NULL ;
+              break ;
+            }
+
           article = p->article ;
           nntpLen = artNntpBufferCount (article) ;
           msgid = artMsgId (article) ;
@@ -4316,6 +4687,7 @@ static Buffer *buildTakethisBuffers (Connection cxn, Buffer checkBuffer)
                 }
 
               freeBufferArray (articleBuffers) ;
+              writeSize += takeBuffLen + artSize (article) ;
 
               if ( !cxn->needsChecks )
                 {
@@ -4771,6 +5143,7 @@ static ArtHolder newArtHolder (Article article)
   ArtHolder a = xmalloc (sizeof(struct art_holder_s)) ;
 
   a->article = article ;
+  a->sent = 0 ;
   a->next = NULL ;
 
   return a ;
@@ -4895,3 +5268,91 @@ static int fudgeFactor (int initVal)
 
   return newValue ;
 }
+
+
+
+/*
+ * The current time, to the microsecond, for timing CHECK round trips.
+ */
+static double timeNow (void)
+{
+  struct timeval tv ;
+
+  gettimeofday (&tv, NULL) ;
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0 ;
+}
+
+
+
+/*
+ * Start the adaptive streaming window over, in slow start, for a new
+ * streaming connection.
+ */
+static void resetWindow (Connection cxn)
+{
+  unsigned int max = hostMaxChecks (cxn->myHost) ;
+
+  cxn->window = MIN (INIT_WINDOW, max) ;
+  cxn->ssthresh = max ;
+  cxn->srtt = 0.0 ;
+  cxn->minRtt = 0.0 ;
+  cxn->lastCut = 0.0 ;
+  cxn->maxCheck = (unsigned int) cxn->window ;
+}
+
+
+
+/*
+ * Take the round trip of the CHECK for ARTH, which has just been answered,
+ * and move the streaming window: up while the round trips stay near the
+ * quickest seen, and down by half, once per window, when they grow or the
+ * peer DEFERRED the article.
+ */
+static void checkAnswered (Connection cxn, ArtHolder artH, bool deferred)
+{
+  double now, rtt ;
+  unsigned int max ;
+  bool queueing ;
+
+  if (!cxn->doesStreaming || artH->sent == 0
+      || !hostAdaptiveWindow (cxn->myHost))
+    return ;
+
+  now = timeNow () ;
+  rtt = now - artH->sent ;
+  if (rtt < 0.0)
+    rtt = 0.0 ;
+  if (cxn->srtt == 0.0)
+    cxn->srtt = rtt ;
+  else
+    cxn->srtt = cxn->srtt * 0.875 + rtt * 0.125 ;
+  if (cxn->minRtt == 0.0 || rtt < cxn->minRtt)
+    cxn->minRtt = rtt ;
+
+  queueing = (cxn->srtt > cxn->minRtt * RTT_INFLATION
+              && cxn->srtt - cxn->minRtt > RTT_SLACK) ;
+
+  if (deferred || queueing)
+    {
+      /* CHECKs sent before the last cut saw the old window. */
+      if (artH->sent > cxn->lastCut)
+        {
+          cxn->ssthresh = cxn->window / 2 < 1.0 ? 1.0 : cxn->window / 2 ;
+          cxn->window = cxn->ssthresh ;
+          cxn->lastCut = now ;
+          d_printf (1,"%s:%d window cut to %.1f (rtt %.3f min %.3f%s)\n",
+                    hostPeerName (cxn->myHost), cxn->ident, cxn->window,
+                    cxn->srtt, cxn->minRtt, deferred ? " deferred" : "") ;
+        }
+    }
+  else if (cxn->window < cxn->ssthresh)
+    cxn->window += 1.0 ;
+  else
+    cxn->window += 1.0 / cxn->window ;
+
+  max = hostMaxChecks (cxn->myHost) ;
+  if (cxn->window > max)
+    cxn->window = max ;
+  cxn->maxCheck = (unsigned int) cxn->window ;
+}
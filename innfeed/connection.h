@@ -27,6 +27,8 @@
 
 #include "misc.h"
 
+struct buffer;
+
 
   /*
    * Create a new Connection.
@@ -97,11 +99,19 @@ void cxnLogStats (Connection cxn, bool final) ;
      the host shovel in as many as possible. May be zero. */
 size_t cxnQueueSpace (Connection cxn) ;
 
+  /* return the smoothed and the quickest CHECK round trip time, in
+     seconds, measured under dynamic-method 4. Zero if not measured. */
+void cxnRoundTrip (Connection cxn, double *srtt, double *minRtt) ;
+
   /* adjust the mode no-CHECK filter values */
 void cxnSetCheckThresholds (Connection cxn,
 			    double lowFilter, double highFilter,
 			    double lowPassFilter) ;
 
+  /* append the statistics of all the connections to OUT, in the format of
+     inn/metrics.h. */
+void gCxnMetrics (struct buffer *out) ;
+
   /* print some debugging info. */
 void gPrintCxnInfo (FILE *fp, unsigned int indentAmt) ;
 void printCxnInfo (Connection cxn, FILE *fp, unsigned int indentAmt) ;
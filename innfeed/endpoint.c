@@ -9,6 +9,11 @@
 **  users of the EndPoint tell the EndPoints to notify them when a read or
 **  write has been completed (or simple if the file descriptor is read or
 **  write ready).
+**
+**  Where the system has epoll or kqueue, they replace select, so that each
+**  pass through the loop only looks at the EndPoints that are ready.  The
+**  timers are kept in a wheel of one-second slots, so that adding and
+**  removing one takes constant time however many are pending.
 */
 
 #include "innfeed.h"
@@ -16,6 +21,19 @@
 #include "clibrary.h"
 #include "portable/socket.h"
 
+/* Pick the readiness backend.  epoll and kqueue scale with the number of
+   ready endpoints rather than with the highest file descriptor, and aren't
+   limited by FD_SETSIZE, so prefer them when available. */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+# define ENDP_EPOLL 1
+# include <sys/epoll.h>
+#elif defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE)
+# define ENDP_KQUEUE 1
+# include <sys/event.h>
+#else
+# define ENDP_SELECT 1
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -37,6 +55,10 @@
 #endif
 #include <time.h>
 
+#if defined (HAVE_ZLIB)
+# include <zlib.h>
+#endif
+
 #include "inn/innconf.h"
 #include "inn/messages.h"
 #include "inn/libinn.h"
@@ -55,6 +77,14 @@ static const char *const timer_name[] = {
 #define NSIG 32
 #endif
 
+  /* What an EndPoint waits for, and what the backend found it ready for. */
+#define ENDP_READ       0x01
+#define ENDP_WRITE      0x02
+
+  /* The size of the buffer of compressed data read, and the initial size of
+     the one of the data to write, once COMPRESS is active. */
+#define ENDP_ZBUFF_SIZE 16384
+
 
   /* This is the structure that is the EndPoint */
 struct endpoint_s 
@@ -83,8 +113,30 @@ struct endpoint_s
 
     int myFd ;                  /* the file descriptor we're handling */
     int myErrno ;               /* the errno when I/O fails */
+    unsigned int watch ;        /* ENDP_READ and ENDP_WRITE waited for */
     
     double selectHits ;		/* indicates how often it's ready */
+
+    bool zInPending ;           /* compressed input is left to inflate */
+#if defined (HAVE_ZLIB)
+      /* fields for COMPRESS DEFLATE, once endPointCompress is called */
+    z_stream *zIn ;             /* inflates what is read */
+    z_stream *zOut ;            /* deflates what is to be written */
+    char *zInBuf ;              /* compressed data read, not inflated yet */
+    size_t zInStart ;           /* where it starts in zInBuf */
+    size_t zInLen ;             /* how much of it there is */
+    char *zOutBuf ;             /* the deflated outBuffer */
+    size_t zOutSize ;           /* size of zOutBuf */
+    size_t zOutLen ;            /* amount of deflated data in it */
+    size_t zOutIndex ;          /* amount of it written so far */
+#endif
+
+#if ! defined (ENDP_SELECT)
+    unsigned int ready ;        /* what the last poll found ready */
+    int readyIdx ;              /* index in readyList, or -1 */
+    int workIdx ;               /* index in workList, or -1 */
+    bool noPoll ;               /* the backend refused the fd */
+#endif
 };
 
 
@@ -96,7 +148,10 @@ typedef struct timerqelem_s
     time_t when ;               /* The time the timer should go off */
     EndpTCB func ;              /* the function to call */
     void *data ;                /* the client callback data */
-    struct timerqelem_s *next ; /* next in the queue */
+    struct timerqelem_s *next ; /* next in the same list */
+    struct timerqelem_s *prev ; /* previous in the same list */
+    struct timerqelem_s **list ; /* head of the list we're on */
+    struct timerqelem_s *hashNext ; /* next with the same id hash */
 } *TimerElem, TimerElemStruct ;
 
 
@@ -124,16 +179,32 @@ static volatile sig_atomic_t *sigFlags ;
   /* private functions */
 static IoStatus doRead (EndPoint endp) ;
 static IoStatus doWrite (EndPoint endp) ;
-static IoStatus doExcept (EndPoint endp) ;
 static void pipeHandler (int s) ;
 static void signalHandler (int s) ;
+#if defined (ENDP_SELECT)
+static IoStatus doExcept (EndPoint endp) ;
 static int hitCompare (const void *v1, const void *v2) ;
 static void reorderPriorityList (void) ;
+#endif
 static TimerElem newTimerElem (TimeoutId i, time_t w, EndpTCB f, void *d) ;
 static TimeoutId timerElemAdd (time_t when, EndpTCB func, void *data) ;
+static void timerElemFree (TimerElem p) ;
+static void timerLink (TimerElem p, TimerElem *list) ;
+static void timerUnlink (TimerElem p) ;
+static void timerHashGrow (void) ;
+static TimerElem timerHashRemove (TimeoutId id) ;
+static time_t timerNextAfter (time_t now) ;
+static void runTimers (void) ;
 static struct timeval *getTimeout (struct timeval *tout) ;
-static void doTimeout (void) ;
 static void handleSignals (void) ;
+static void endPointWatch (EndPoint ep, unsigned int what, bool on) ;
+#if ! defined (ENDP_SELECT)
+static void pollUpdate (EndPoint ep, unsigned int old) ;
+static void pollReady (EndPoint ep, unsigned int what) ;
+static int pollWait (struct timeval *tout) ;
+static void endPointService (EndPoint ep) ;
+static void workRemove (EndPoint ep) ;
+#endif
 
 #if 0
 static int ff_set (fd_set *set, unsigned int start) ;
@@ -141,6 +212,15 @@ static int ff_free (fd_set *set, unsigned int start) ;
 #endif
 static void endpointCleanup (void) ;
 
+static void zSetPending (EndPoint ep, bool pending) ;
+static bool zPendingWaiting (void) ;
+#if defined (HAVE_ZLIB)
+static IoStatus zInflate (EndPoint endp, size_t *amt) ;
+static IoStatus zRead (EndPoint endp) ;
+static bool zDeflate (EndPoint endp, Buffer *buffers) ;
+static IoStatus zWrite (EndPoint endp) ;
+#endif
+
 
   /* Private data */
 static size_t maxEndPoints ;
@@ -152,14 +232,48 @@ static int absHighestFd = 0 ;       /* never goes down */
 static int highestFd = -1 ;
 static unsigned int endPointCount = 0 ;
 static unsigned int priorityCount = 0 ;
+static unsigned int zPendingCount = 0 ; /* endpoints with zInPending set */
 
+#if defined (ENDP_SELECT)
 static fd_set rdSet ;
 static fd_set wrSet ;
 static fd_set exSet ;
+#else
+#define POLL_EVENTS 256         /* events fetched per poll */
+
+static int pollFd = -1 ;        /* the epoll or kqueue descriptor */
+#if defined (ENDP_EPOLL)
+static struct epoll_event *pollEvents ;
+#else
+static struct kevent *pollEvents ;
+#endif
+static EndPoint *readyList ;    /* endpoints the last poll found ready */
+static unsigned int readyCount ;
+static EndPoint *workList ;     /* endpoints with a work callback */
+static unsigned int workCount ;
+static unsigned int noPollCount ; /* endpoints the backend refused */
+static EndPoint dispatchEp ;    /* endpoint being serviced, NULL if deleted */
+#endif
 
 static int keepSelecting ;
 
-static TimerElem timeoutQueue ;
+  /* Timers live in a wheel of one-second slots, each slot holding the
+     timers set for any time congruent to it modulo the wheel size, so
+     those more than one turn away are skipped until their turn comes.
+     Timers that are already due when they are added wait on dueTimers for
+     the next pass through the main loop.  A hash on the ids finds the
+     timer to remove. */
+#define TIMER_WHEEL_SIZE 1024   /* MUST be a power of 2 */
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_HASH(id,size) ((unsigned int) (id) & ((size) - 1))
+
+static TimerElem timerWheel [TIMER_WHEEL_SIZE] ;
+static TimerElem dueTimers ;
+static TimerElem runningTimers ; /* the due timers being run */
+static time_t wheelTime ;       /* the timers up to this time have been run */
+static time_t nextTimer ;       /* no timer on the wheel goes off before this */
+static TimerElem *timerHash ;
+static unsigned int timerHashSize ;
 static TimerElem timeoutPool ;
 static TimeoutId nextId ;
 static int timeoutQueueLength ;
@@ -222,6 +336,10 @@ EndPoint newEndPoint (int fd)
           priorityList = xrealloc (priorityList,
                                    sizeof(EndPoint) * maxEndPoints) ;
         }
+#if ! defined (ENDP_SELECT)
+      readyList = xrealloc (readyList, sizeof(EndPoint) * maxEndPoints) ;
+      workList = xrealloc (workList, sizeof(EndPoint) * maxEndPoints) ;
+#endif
 
       for ( ; i < maxEndPoints ; i++)
         endPoints [i] = priorityList [i] = NULL ;
@@ -229,10 +347,30 @@ EndPoint newEndPoint (int fd)
   
   ASSERT (endPoints [fd] == NULL) ;
 
+#if ! defined (ENDP_SELECT)
+  if (pollFd < 0)
+    {
+#if defined (ENDP_EPOLL)
+      pollFd = epoll_create1 (EPOLL_CLOEXEC) ;
+      if (pollFd < 0)
+        sysdie ("ME oserr epoll_create1") ;
+      pollEvents = xcalloc (POLL_EVENTS, sizeof(struct epoll_event)) ;
+#else
+      pollFd = kqueue () ;
+      if (pollFd < 0)
+        sysdie ("ME oserr kqueue") ;
+      fcntl (pollFd, F_SETFD, FD_CLOEXEC) ;
+      pollEvents = xcalloc (POLL_EVENTS, sizeof(struct kevent)) ;
+#endif
+    }
+#endif
+
   if (fd > absHighestFd)
     {
           
-#if defined (FD_SETSIZE)
+#if ! defined (ENDP_SELECT)
+      /* no limit on the descriptors epoll or kqueue can watch */
+#elif defined (FD_SETSIZE)
       if ((unsigned int) fd >= FD_SETSIZE)
         {
           warn ("ME fd (%d) looks too big (%d -- FD_SETSIZE)", fd,
@@ -275,9 +413,19 @@ EndPoint newEndPoint (int fd)
   
   ep->myFd = fd ;
   ep->myErrno = 0 ;
+  ep->watch = 0 ;
 
   ep->selectHits = 0.0 ;
 
+  ep->zInPending = false ;
+
+#if ! defined (ENDP_SELECT)
+  ep->ready = 0 ;
+  ep->readyIdx = -1 ;
+  ep->workIdx = -1 ;
+  ep->noPoll = false ;
+#endif
+
   endPoints [fd] = ep ;
   priorityList [priorityCount++] = ep ;
   endPointCount++ ;
@@ -310,12 +458,35 @@ void delEndPoint (EndPoint ep)
   if (ep->outBuffer != NULL)
     freeBufferArray (ep->outBuffer) ;
 
-  close (ep->myFd) ;
+  zSetPending (ep, false) ;
+#if defined (HAVE_ZLIB)
+  if (ep->zIn != NULL)
+    {
+      inflateEnd (ep->zIn) ;
+      deflateEnd (ep->zOut) ;
+      free (ep->zIn) ;
+      free (ep->zOut) ;
+      free (ep->zInBuf) ;
+      free (ep->zOutBuf) ;
+    }
+#endif
 
   /* remove from selectable bits */
-  FD_CLR (ep->myFd,&rdSet) ;
-  FD_CLR (ep->myFd,&wrSet) ;
+  endPointWatch (ep, ENDP_READ | ENDP_WRITE, false) ;
+#if defined (ENDP_SELECT)
   FD_CLR (ep->myFd,&exSet) ;
+#else
+  if (ep->readyIdx >= 0)
+    readyList [ep->readyIdx] = NULL ;
+  if (ep->workIdx >= 0)
+    workRemove (ep) ;
+  if (ep->noPoll)
+    noPollCount-- ;
+  if (ep == dispatchEp)
+    dispatchEp = NULL ;
+#endif
+
+  close (ep->myFd) ;
 
   /* Adjust the global arrays to account for deleted endpoint. */
   endPoints [ep->myFd] = NULL ;
@@ -347,6 +518,56 @@ int endPointFd (EndPoint endp)
 
 
 
+/* Compress everything read and written from now on with DEFLATE, as
+   COMPRESS DEFLATE (RFC 8054) does. No read or write must be pending.
+   Returns false if compression can't be set up. */
+bool endPointCompress (EndPoint endp)
+{
+#if defined (HAVE_ZLIB)
+  z_stream *zin, *zout ;
+
+  ASSERT (endp != NULL) ;
+  ASSERT (endp->inBuffer == NULL && endp->outBuffer == NULL) ;
+
+  if (endp->zIn != NULL)
+    return false ;
+
+  zin = xcalloc (1, sizeof (z_stream)) ;
+  zout = xcalloc (1, sizeof (z_stream)) ;
+  if (inflateInit2 (zin, -15) != Z_OK)
+    {
+      free (zin) ;
+      free (zout) ;
+      return false ;
+    }
+  if (deflateInit2 (zout, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      inflateEnd (zin) ;
+      free (zin) ;
+      free (zout) ;
+      return false ;
+    }
+
+  endp->zIn = zin ;
+  endp->zOut = zout ;
+  endp->zInBuf = xmalloc (ENDP_ZBUFF_SIZE) ;
+  endp->zInStart = 0 ;
+  endp->zInLen = 0 ;
+  endp->zOutSize = ENDP_ZBUFF_SIZE ;
+  endp->zOutBuf = xmalloc (endp->zOutSize) ;
+  endp->zOutLen = 0 ;
+  endp->zOutIndex = 0 ;
+  return true ;
+#else
+  ASSERT (endp != NULL) ;
+
+  return false ;
+#endif
+}
+
+
+
 
 /* Request a read to be done next time there's data. The endpoint ENDP
  * is what will do the read. BUFFERS is the array of Buffers the data
@@ -375,7 +596,7 @@ int prepareRead (EndPoint endp,
   
   ASSERT (endp != NULL) ;
   
-  if (endp->inBuffer != NULL || FD_ISSET (endp->myFd,&rdSet)) 
+  if (endp->inBuffer != NULL || (endp->watch & ENDP_READ)) 
     return 0 ;                  /* something already there */
 
   for (idx = 0 ; buffers != NULL && buffers [idx] != NULL ; idx++)
@@ -394,9 +615,11 @@ int prepareRead (EndPoint endp,
   endp->inAmtRead = 0 ;
   endp->inClientData = clientData ;
 
-  FD_SET (endp->myFd, &rdSet) ;
+  endPointWatch (endp, ENDP_READ, true) ;
+#if defined (ENDP_SELECT)
   if ( InputFile == NULL )
     FD_SET (endp->myFd, &exSet) ;
+#endif
 
   return 1 ;
 }
@@ -426,7 +649,7 @@ int prepareWrite (EndPoint endp,
 
   ASSERT (endp != NULL) ;
   
-  if (endp->outBuffer != NULL || FD_ISSET (endp->myFd,&wrSet))
+  if (endp->outBuffer != NULL || (endp->watch & ENDP_WRITE))
     return 0 ;                  /* something already there */
 
   for (idx = 0 ; buffers != NULL && buffers [idx] != NULL ; idx++)
@@ -441,8 +664,18 @@ int prepareWrite (EndPoint endp,
   endp->outSize = bufferSizeTotal ;
   endp->outAmtWritten = 0 ;
 
-  FD_SET (endp->myFd, &wrSet) ;
+#if defined (HAVE_ZLIB)
+  if (endp->zOut != NULL && !zDeflate (endp, buffers))
+    {
+      endp->outBuffer = NULL ;
+      return 0 ;
+    }
+#endif
+
+  endPointWatch (endp, ENDP_WRITE, true) ;
+#if defined (ENDP_SELECT)
   FD_SET (endp->myFd, &exSet) ;
+#endif
 
   return 1 ;
 }
@@ -451,9 +684,11 @@ int prepareWrite (EndPoint endp,
 /* Cancel the pending read. */
 void cancelRead (EndPoint endp)
 {
-  FD_CLR (endp->myFd,&rdSet) ;
+  endPointWatch (endp, ENDP_READ, false) ;
+#if defined (ENDP_SELECT)
   if (!FD_ISSET (endp->myFd, &wrSet))
     FD_CLR (endp->myFd,&exSet) ;
+#endif
 
   freeBufferArray (endp->inBuffer) ;
   
@@ -473,9 +708,11 @@ void cancelRead (EndPoint endp)
   it. */
 void cancelWrite (EndPoint endp, char *buffer UNUSED, size_t *len UNUSED)
 {
-  FD_CLR (endp->myFd, &wrSet) ;
+  endPointWatch (endp, ENDP_WRITE, false) ;
+#if defined (ENDP_SELECT)
   if (!FD_ISSET (endp->myFd, &rdSet))
     FD_CLR (endp->myFd, &exSet) ;
+#endif
 
 #if 0
 #error XXX need to copy data to buffer and *len
@@ -491,6 +728,11 @@ void cancelWrite (EndPoint endp, char *buffer UNUSED, size_t *len UNUSED)
   endp->outClientData = NULL ;
   endp->outSize = 0 ;
   endp->outAmtWritten = 0 ;
+
+#if defined (HAVE_ZLIB)
+  endp->zOutLen = 0 ;
+  endp->zOutIndex = 0 ;
+#endif
 }
 
 /* queue up a new timeout request. to go off at a specific time. */
@@ -539,7 +781,6 @@ TimeoutId updateSleep (TimeoutId tid, EndpTCB func, int timeToSleep,
     return prepareSleep (func, timeToSleep, clientData) ;
   else
     {
-      /* XXX - quick and dirty but CPU wasteful implementation */
       removeTimeout (tid) ;
       return prepareSleep (func, timeToSleep, clientData) ;
     }
@@ -550,35 +791,22 @@ TimeoutId updateSleep (TimeoutId tid, EndpTCB func, int timeToSleep,
    is just ignored. */
 bool removeTimeout (TimeoutId tid)
 {
-  TimerElem n = timeoutQueue ;
-  TimerElem p = NULL ;
+  TimerElem n ;
 
   if (tid == 0)
     return true ;
   
-  while (n != NULL && n->id != tid)
-    {
-      p = n ;
-      n = n->next ;
-    }
-
-  if (n == NULL)
+  if ((n = timerHashRemove (tid)) == NULL)
     return false ;
 
-  if (p == NULL)                /* at the head. */
-    timeoutQueue = n->next ;
-  else
-    p->next = n->next ;
-
-  n->next = timeoutPool ;
-  timeoutPool = n ;
-
-  timeoutQueueLength-- ;
+  timerElemFree (n) ;
   
   return true ;
 }
 
 
+#if defined (ENDP_SELECT)
+
 /* The main routine. This is a near-infinite loop that drives the whole
    program. */
 void Run (void) 
@@ -596,10 +824,12 @@ void Run (void)
       struct timeval *twait ;
       int sval ;
       unsigned int idx ;
-      bool modifiedTime = false ;
       
       twait = getTimeout (&timeout) ;
 
+      if (!keepSelecting)      /* a timer callback stopped us */
+        break ;
+
       memcpy (&rSet,&rdSet,sizeof (rdSet)) ;
       memcpy (&wSet,&wrSet,sizeof (wrSet)) ;
       memcpy (&eSet,&exSet,sizeof (exSet)) ;
@@ -614,7 +844,6 @@ void Run (void)
             if (priorityList [idx] != NULL &&
                 priorityList [idx]->workCbk != NULL)
               {
-                modifiedTime = true ;
                 twait->tv_sec = 0 ;
                 twait->tv_usec = 0 ;
 
@@ -627,10 +856,27 @@ void Run (void)
       gCalcHostBlStat ();
       TMRstop(TMR_BACKLOGSTATS);
 
+      /* compressed input left to inflate is ready to be read now */
+      if (zPendingWaiting ())
+        {
+          timeout.tv_sec = 0 ;
+          timeout.tv_usec = 0 ;
+          twait = &timeout ;
+        }
+
       TMRstart(TMR_IDLE);
       sval = select (highestFd + 1, &rSet, &wSet, &eSet, twait) ;
       TMRstop(TMR_IDLE);
 
+      if (sval >= 0 && zPendingCount > 0)
+        for (idx = 0 ; (int) idx <= highestFd ; idx++)
+          if (endPoints [idx] != NULL && endPoints [idx]->zInPending
+              && FD_ISSET (idx, &rdSet) && !FD_ISSET (idx, &rSet))
+            {
+              FD_SET (idx, &rSet) ;
+              sval++ ;
+            }
+
       timePasses () ;
       if (innconf->timer != 0 && TMRnow() > innconf->timer * 1000) {
           TMRsummary ("ME", timer_name);
@@ -735,7 +981,7 @@ void Run (void)
                         {
                           Buffer *buff = ep->inBuffer ;
 
-                          FD_CLR (fd, &rdSet) ;
+                          endPointWatch (ep, ENDP_READ, false) ;
 
                           /* incase callback wants to issue read */
                           ep->inBuffer = NULL ; 
@@ -772,7 +1018,7 @@ void Run (void)
                         {
                           Buffer *buff = ep->outBuffer ;
 
-                          FD_CLR (fd, &wrSet) ;
+                          endPointWatch (ep, ENDP_WRITE, false) ;
 
                           /* incase callback wants to issue a write */
                           ep->outBuffer = NULL ;        
@@ -820,8 +1066,6 @@ void Run (void)
           
           reorderPriorityList () ;
         }
-      else if (sval == 0 && !modifiedTime)
-        doTimeout () ;
 
         /* now we're done processing all read fds and/or the
            timeout(s). Next we do the work callbacks for all the endpoints
@@ -852,6 +1096,107 @@ void Run (void)
     }
 }
 
+#else /* ! ENDP_SELECT */
+
+/* The main routine. This is a near-infinite loop that drives the whole
+   program. */
+void Run (void) 
+{
+  keepSelecting = 1 ;
+  xsignal (SIGPIPE, pipeHandler) ;
+
+  while (keepSelecting)
+    {
+      struct timeval timeout ;
+      struct timeval *twait ;
+      int sval ;
+      unsigned int idx, count ;
+      
+      twait = getTimeout (&timeout) ;
+
+      if (!keepSelecting)      /* a timer callback stopped us */
+        break ;
+
+      if (endPointCount == 0 && twait == NULL) /* no fds and no timeout */
+        break ;
+
+      /* if we have any workprocs registered, or fds that are always ready,
+         or compressed input left to inflate, we poll rather than block */
+      if (workCount > 0 || noPollCount > 0 || zPendingWaiting ())
+        {
+          timeout.tv_sec = 0 ;
+          timeout.tv_usec = 0 ;
+          twait = &timeout ;
+        }
+
+      /* calculate host backlog statistics */
+      TMRstart(TMR_BACKLOGSTATS);
+      gCalcHostBlStat ();
+      TMRstop(TMR_BACKLOGSTATS);
+
+      TMRstart(TMR_IDLE);
+      sval = pollWait (twait) ;
+      TMRstop(TMR_IDLE);
+
+      timePasses () ;
+      if (innconf->timer != 0 && TMRnow() > innconf->timer * 1000) {
+          TMRsummary ("ME", timer_name);
+      }
+
+      if (sval < 0 && errno == EINTR)
+        {
+	  handleSignals () ;
+        }
+      else if (sval < 0) 
+        {
+          syswarn ("ME exception: poll failed: %d", sval) ;
+          stopRun () ;
+        }
+      else if (sval > 0)
+        {
+          handleSignals() ;
+
+          /* the endpoints deleted by callbacks are cleared from the list */
+          for (idx = 0 ; idx < readyCount ; idx++)
+            if (readyList [idx] != NULL)
+              endPointService (readyList [idx]) ;
+        }
+
+        /* now we're done processing all ready fds. Next we do the work
+           callbacks for all the endpoints whose fds weren't ready. Those
+           registered by these callbacks wait for the next time around. */
+      count = workCount ;
+      for (idx = 0 ; idx < count ; idx++)
+        {
+          EndPoint ep = workList [idx] ;
+
+          if (ep != NULL && ep->readyIdx < 0)
+            {
+              EndpWorkCbk func = ep->workCbk ;
+              void *data = ep->workData ;
+
+              workRemove (ep) ;
+              ep->workCbk = NULL ;
+              ep->workData = NULL ;
+              TMRstart(TMR_CALLBACK);
+              func (ep,data) ;
+              TMRstop(TMR_CALLBACK);
+            }
+        }
+
+      for (idx = count = 0 ; idx < workCount ; idx++)
+        if (workList [idx] != NULL)
+          {
+            workList [count] = workList [idx] ;
+            workList [count]->workIdx = count ;
+            count++ ;
+          }
+      workCount = count ;
+    }
+}
+
+#endif /* ! ENDP_SELECT */
+
 void *addWorkCallback (EndPoint endp, EndpWorkCbk cbk, void *data)
 {
   void *oldBk = endp->workData ;
@@ -859,6 +1204,16 @@ void *addWorkCallback (EndPoint endp, EndpWorkCbk cbk, void *data)
   endp->workCbk = cbk ;
   endp->workData = data ;
 
+#if ! defined (ENDP_SELECT)
+  if (cbk != NULL && endp->workIdx < 0)
+    {
+      endp->workIdx = workCount ;
+      workList [workCount++] = endp ;
+    }
+  else if (cbk == NULL && endp->workIdx >= 0)
+    workRemove (endp) ;
+#endif
+
   return oldBk ;
 }
 
@@ -904,17 +1259,18 @@ int getMainEndPointFd (void)
 
 void freeTimeoutQueue (void)
 {
-  TimerElem p, n ;
+  unsigned int i ;
 
-  p = timeoutQueue ;
-  while (p)
-    {
-      n = p->next ;
-      p->next = timeoutPool ;
-      timeoutPool = p;
-      p = n ;
-      timeoutQueueLength-- ;
-    }
+  for (i = 0 ; i < TIMER_WHEEL_SIZE ; i++)
+    while (timerWheel [i] != NULL)
+      timerElemFree (timerWheel [i]) ;
+  while (dueTimers != NULL)
+    timerElemFree (dueTimers) ;
+  while (runningTimers != NULL)
+    timerElemFree (runningTimers) ;
+
+  if (timerHash != NULL)
+    memset (timerHash, 0, sizeof(TimerElem) * timerHashSize) ;
 }
 
 
@@ -938,6 +1294,15 @@ static IoStatus doRead (EndPoint endp)
   IoStatus rval = IoIncomplete ;
 
   TMRstart(TMR_READ);
+#if defined (HAVE_ZLIB)
+  if (endp->zIn != NULL)
+    {
+      rval = zRead (endp) ;
+      TMRstop(TMR_READ);
+      return rval ;
+    }
+#endif
+
   for (i = currIdx ; buffers && buffers [i] != NULL ; i++)
     bCount++ ;
 
@@ -1060,6 +1425,15 @@ static IoStatus doWrite (EndPoint endp)
   IoStatus rval = IoIncomplete ;
   
   TMRstart(TMR_WRITE);
+#if defined (HAVE_ZLIB)
+  if (endp->zOut != NULL)
+    {
+      rval = zWrite (endp) ;
+      TMRstop(TMR_WRITE);
+      return rval ;
+    }
+#endif
+
   for (i = currIdx ; buffers && buffers [i] != NULL ; i++)
     bCount++ ;
 
@@ -1153,6 +1527,224 @@ static IoStatus doWrite (EndPoint endp)
 }
 
 
+/* Note whether the endpoint has compressed input left to inflate, which
+   makes it ready to read whether its fd is or not. */
+static void zSetPending (EndPoint ep, bool pending)
+{
+  if (ep->zInPending == pending)
+    return ;
+
+  ep->zInPending = pending ;
+  if (pending)
+    zPendingCount++ ;
+  else
+    zPendingCount-- ;
+}
+
+
+/* Return true if an endpoint waiting for a read has compressed input left
+   to inflate, so that waiting for the fds must not block. */
+static bool zPendingWaiting (void)
+{
+  int fd ;
+
+  if (zPendingCount == 0)
+    return false ;
+
+  for (fd = 0 ; fd <= highestFd ; fd++)
+    if (endPoints [fd] != NULL && endPoints [fd]->zInPending
+        && (endPoints [fd]->watch & ENDP_READ))
+      return true ;
+
+  return false ;
+}
+
+
+#if defined (HAVE_ZLIB)
+
+/* Inflate the compressed data read into the read buffers, setting AMT to
+   the amount added to them. What doesn't fit is left for the next read. */
+static IoStatus zInflate (EndPoint endp, size_t *amt)
+{
+  Buffer *buffers = endp->inBuffer ;
+  z_stream *z = endp->zIn ;
+  size_t room ;
+  int status = Z_OK ;
+
+  *amt = 0 ;
+  z->next_in = (Bytef *) endp->zInBuf + endp->zInStart ;
+  z->avail_in = endp->zInLen ;
+  while (buffers [endp->inBufferIdx] != NULL)
+    {
+      Buffer b = buffers [endp->inBufferIdx] ;
+
+      room = bufferSize (b) - bufferDataSize (b) ;
+      if (room == 0)
+        {
+          endp->inBufferIdx++ ;
+          continue ;
+        }
+      z->next_out = (Bytef *) bufferBase (b) + bufferDataSize (b) ;
+      z->avail_out = room ;
+      status = inflate (z, Z_SYNC_FLUSH) ;
+      room -= z->avail_out ;
+      bufferIncrDataSize (b, room) ;
+      *amt += room ;
+      if (status != Z_OK || z->avail_out > 0)
+        break ;
+    }
+
+  endp->zInStart += endp->zInLen - z->avail_in ;
+  endp->zInLen = z->avail_in ;
+  if (endp->zInLen == 0)
+    endp->zInStart = 0 ;
+
+  /* with the buffers full, inflate may hold more output */
+  zSetPending (endp,
+               endp->zInLen > 0 || buffers [endp->inBufferIdx] == NULL) ;
+
+  if (status != Z_OK && status != Z_BUF_ERROR)
+    {
+      warn ("ME cant inflate on fd %d: %s", endp->myFd,
+            z->msg != NULL ? z->msg : "end of stream") ;
+      endp->myErrno = EIO ;
+      return IoFailed ;
+    }
+  return IoIncomplete ;
+}
+
+
+/* The doRead of a compressed endpoint. What was left to inflate is given
+   first, then what can be read. */
+static IoStatus zRead (EndPoint endp)
+{
+  IoStatus rval ;
+  ssize_t i ;
+  size_t amt ;
+
+  if (endp->inBuffer == NULL || endp->inBuffer [endp->inBufferIdx] == NULL)
+    return IoDone ;
+
+  rval = zInflate (endp, &amt) ;
+  if (rval == IoIncomplete && amt == 0 && endp->zInLen < ENDP_ZBUFF_SIZE)
+    {
+      if (endp->zInStart > 0)
+        {
+          memmove (endp->zInBuf, endp->zInBuf + endp->zInStart,
+                   endp->zInLen) ;
+          endp->zInStart = 0 ;
+        }
+
+      i = read (endp->myFd, endp->zInBuf + endp->zInLen,
+                ENDP_ZBUFF_SIZE - endp->zInLen) ;
+      if (i > 0)
+        {
+          endp->zInLen += i ;
+          rval = zInflate (endp, &amt) ;
+        }
+      else if (i < 0 && errno == EINTR)
+        handleSignals () ;
+      else if (i < 0 && errno != EAGAIN)
+        {
+          endp->myErrno = errno ;
+          rval = IoFailed ;
+        }
+      else if (i == 0)
+        rval = IoEOF ;
+    }
+
+  if (rval == IoIncomplete && amt > 0)
+    {
+      endp->inAmtRead += amt ;
+      if (endp->inAmtRead >= endp->inMinLen)
+        rval = IoDone ;
+    }
+  return rval ;
+}
+
+
+/* Deflate the data of the buffers to write, ending with a sync flush so
+   that the peer can inflate all of it. */
+static bool zDeflate (EndPoint endp, Buffer *buffers)
+{
+  z_stream *z = endp->zOut ;
+  unsigned int idx ;
+  int flush ;
+
+  endp->zOutLen = 0 ;
+  endp->zOutIndex = 0 ;
+  if (buffers == NULL)
+    return true ;
+
+  for (idx = 0 ; ; idx++)
+    {
+      if (buffers [idx] != NULL)
+        {
+          flush = Z_NO_FLUSH ;
+          z->next_in = (Bytef *) bufferBase (buffers [idx]) ;
+          z->avail_in = bufferDataSize (buffers [idx]) ;
+        }
+      else
+        {
+          flush = Z_SYNC_FLUSH ;
+          z->next_in = NULL ;
+          z->avail_in = 0 ;
+        }
+
+      do
+        {
+          if (endp->zOutSize - endp->zOutLen < ENDP_ZBUFF_SIZE / 4)
+            {
+              endp->zOutSize *= 2 ;
+              endp->zOutBuf = xrealloc (endp->zOutBuf, endp->zOutSize) ;
+            }
+          z->next_out = (Bytef *) endp->zOutBuf + endp->zOutLen ;
+          z->avail_out = endp->zOutSize - endp->zOutLen ;
+          if (deflate (z, flush) == Z_STREAM_ERROR)
+            return false ;
+          endp->zOutLen = endp->zOutSize - z->avail_out ;
+        }
+      while (z->avail_in > 0 || z->avail_out == 0) ;
+
+      if (flush == Z_SYNC_FLUSH)
+        break ;
+    }
+  return true ;
+}
+
+
+/* The doWrite of a compressed endpoint. */
+static IoStatus zWrite (EndPoint endp)
+{
+  ssize_t i ;
+
+  if (endp->zOutIndex >= endp->zOutLen)
+    return IoDone ;
+
+  i = write (endp->myFd, endp->zOutBuf + endp->zOutIndex,
+             endp->zOutLen - endp->zOutIndex) ;
+  if (i > 0)
+    {
+      endp->zOutIndex += i ;
+      if (endp->zOutIndex < endp->zOutLen)
+        return IoProgress ;
+      endp->outAmtWritten = endp->outSize ;
+      return IoDone ;
+    }
+  else if (i < 0 && errno == EINTR)
+    handleSignals () ;
+  else if (i < 0 && errno != EAGAIN)
+    {
+      endp->myErrno = errno ;
+      return IoFailed ;
+    }
+  return IoIncomplete ;
+}
+
+#endif /* HAVE_ZLIB */
+
+
+#if defined (ENDP_SELECT)
 static IoStatus doExcept (EndPoint endp)
 {
   int optval;
@@ -1178,6 +1770,7 @@ static IoStatus doExcept (EndPoint endp)
   /* Not reached */
   return IoFailed ;
 }
+#endif
 
 #if 0
 static void endPointPrint (EndPoint ep, FILE *fp)
@@ -1201,6 +1794,8 @@ static void pipeHandler (int s)
 }
 
 
+#if defined (ENDP_SELECT)
+
 /* compare the hit ratio of two endpoint for qsort. We're sorting the
    endpoints on their relative activity */
 static int hitCompare (const void *v1, const void *v2)
@@ -1254,6 +1849,8 @@ static void reorderPriorityList (void)
   qsort (priorityList, (size_t)priorityCount, sizeof (EndPoint), &hitCompare);
 }
 
+#endif /* ENDP_SELECT */
+
 
 #define TIMEOUT_POOL_SIZE ((4096 - 2 * (sizeof (void *))) / (sizeof (TimerElemStruct)))
 
@@ -1289,97 +1886,485 @@ static TimerElem newTimerElem (TimeoutId i, time_t w, EndpTCB f, void *d)
 
 
 
-/* add a new timeout structure to the global list. */
+/* put the timeout structure at the head of LIST. */
+static void timerLink (TimerElem p, TimerElem *list)
+{
+  p->list = list ;
+  p->prev = NULL ;
+  p->next = *list ;
+  if (*list != NULL)
+    (*list)->prev = p ;
+  *list = p ;
+}
+
+
+/* take the timeout structure off the list it's on. */
+static void timerUnlink (TimerElem p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next ;
+  else
+    *(p->list) = p->next ;
+  if (p->next != NULL)
+    p->next->prev = p->prev ;
+  p->list = NULL ;
+}
+
+
+/* take the timeout structure off its list and give it back to the pool.
+   The caller has already taken it out of the hash. */
+static void timerElemFree (TimerElem p)
+{
+  timerUnlink (p) ;
+  p->next = timeoutPool ;
+  timeoutPool = p ;
+
+  timeoutQueueLength-- ;
+}
+
+
+/* double the size of the hash of timer ids. */
+static void timerHashGrow (void)
+{
+  unsigned int size = (timerHashSize == 0 ? 256 : timerHashSize * 2) ;
+  TimerElem *table = xcalloc (size, sizeof(TimerElem)) ;
+  unsigned int i ;
+
+  for (i = 0 ; i < timerHashSize ; i++)
+    while (timerHash [i] != NULL)
+      {
+        TimerElem p = timerHash [i] ;
+        TimerElem *bucket = &table [TIMER_HASH (p->id, size)] ;
+
+        timerHash [i] = p->hashNext ;
+        p->hashNext = *bucket ;
+        *bucket = p ;
+      }
+
+  free (timerHash) ;
+  timerHash = table ;
+  timerHashSize = size ;
+}
+
+
+/* find the timer with the given id and take it out of the hash. Returns
+   NULL if there's no such timer. */
+static TimerElem timerHashRemove (TimeoutId id)
+{
+  TimerElem *q ;
+  TimerElem p ;
+
+  if (timerHashSize == 0)
+    return NULL ;
+
+  for (q = &timerHash [TIMER_HASH (id, timerHashSize)] ; (p = *q) != NULL ;
+       q = &p->hashNext)
+    if (p->id == id)
+      {
+        *q = p->hashNext ;
+        return p ;
+      }
+
+  return NULL ;
+}
+
+
+/* add a new timeout structure to the wheel. */
 static TimeoutId timerElemAdd (time_t when, EndpTCB func, void *data)
 {
   TimerElem p = newTimerElem (++nextId ? nextId : ++nextId,when,func,data) ;
-  TimerElem n = timeoutQueue ;
-  TimerElem q = NULL ;
-  
-  while (n != NULL && n->when <= when)
+  TimerElem *bucket ;
+
+  if (when <= wheelTime)
+    timerLink (p, &dueTimers) ;
+  else
     {
-      q = n ;
-      n = n->next ;
+      timerLink (p, &timerWheel [when & TIMER_WHEEL_MASK]) ;
+      if (when < nextTimer)
+        nextTimer = when ;
     }
+  
+  timeoutQueueLength++ ;
+  if ((unsigned int) timeoutQueueLength > timerHashSize)
+    timerHashGrow () ;
+
+  bucket = &timerHash [TIMER_HASH (p->id, timerHashSize)] ;
+  p->hashNext = *bucket ;
+  *bucket = p ;
+  
+  return p->id ;
+}
+
+
+/* Returns the time the first timer on the wheel after NOW goes off. If
+   there's none within a turn of the wheel, returns a time past that. */
+static time_t timerNextAfter (time_t now)
+{
+  time_t t ;
+  TimerElem p ;
+
+  for (t = now + 1 ; t <= now + TIMER_WHEEL_SIZE ; t++)
+    for (p = timerWheel [t & TIMER_WHEEL_MASK] ; p != NULL ; p = p->next)
+      if (p->when == t)
+        return t ;
 
-  if (n == NULL && q == NULL)   /* empty list so put at head */
-    timeoutQueue = p ;
-  else if (q == NULL)           /* put at head of list */
+  return now + TIMER_WHEEL_SIZE + 1 ;
+}
+
+
+/* Run the timeouts whose time has come. The timers they set up that are
+   already due are only run the next time we're called. */
+static void runTimers (void)
+{
+  time_t now = theTime() ;
+  TimerElem p, n ;
+
+  if (now > wheelTime)
     {
-      p->next = timeoutQueue ;
-      timeoutQueue = p ;
+      if (now >= nextTimer)
+        {
+          time_t t, last ;
+
+          /* turn the wheel, moving what's due to the due list. */
+          last = (now - wheelTime > TIMER_WHEEL_SIZE ?
+                  wheelTime + TIMER_WHEEL_SIZE : now) ;
+          for (t = wheelTime + 1 ; t <= last ; t++)
+            for (p = timerWheel [t & TIMER_WHEEL_MASK] ; p != NULL ; p = n)
+              {
+                n = p->next ;
+                if (p->when <= now)
+                  {
+                    timerUnlink (p) ;
+                    timerLink (p, &dueTimers) ;
+                  }
+              }
+
+          nextTimer = timerNextAfter (now) ;
+        }
+      wheelTime = now ;
     }
-  else if (n == NULL)           /* put at end of list */
-    q->next = p ;
-  else                          /* in middle of list */
+
+  /* run them oldest first; the callbacks may remove the ones still
+     waiting to be run. */
+  for (p = dueTimers, dueTimers = NULL ; p != NULL ; p = n)
     {
-      p->next = q->next ;
-      q->next = p ;
+      n = p->next ;
+      timerLink (p, &runningTimers) ;
     }
 
-  timeoutQueueLength++ ;
+  while (runningTimers != NULL)
+    {
+      EndpTCB cbk ;
+      void *data ;
+      TimeoutId tid ;
+
+      p = runningTimers ;
+      cbk = p->func ;
+      data = p->data ;
+      tid = p->id ;
+
+      timerHashRemove (tid) ;
+      timerElemFree (p) ;
   
-  return p->id ;
+      if (cbk)
+        (*cbk) (tid, data) ;    /* call the callback function */
+    }
 }
 
 
-/* Fills in TOUT with the timeout to use on the next call to
- * select. Returns TOUT. If there is no timeout, then returns NULL.  If the
- * timeout has already passed, then it calls the timeout handling routine
- * first.
+/* Runs the timeouts that are due, then fills in TOUT with the timeout to
+ * use on the next call to select. Returns TOUT. If there is no timeout,
+ * then returns NULL.
  */
 static struct timeval *getTimeout (struct timeval *tout)
 {
   struct timeval *rval = NULL ;
-  
-  if (timeoutQueue != NULL)
+
+  runTimers () ;
+
+  if (dueTimers != NULL)
+    {
+      tout->tv_sec = 0 ;
+      tout->tv_usec = 0 ;
+      rval = tout ;
+    }
+  else if (timeoutQueueLength > 0)
     {
       time_t now = theTime() ;
 
-      while (timeoutQueue && now > timeoutQueue->when)
-        doTimeout () ;
-          
-      if (timeoutQueue != NULL && now == timeoutQueue->when)
-        {
-          tout->tv_sec = 0 ;
-          tout->tv_usec = 0 ;
-          rval = tout ;
-        }
-      else if (timeoutQueue != NULL)
+      tout->tv_sec = (nextTimer > now ? nextTimer - now : 0) ;
+      tout->tv_usec = 0 ;
+      rval = tout ;
+    }
+
+  return rval ;
+}
+
+
+/* Start (ON true) or stop waiting for the endpoint's file descriptor to
+   be ready for WHAT, a mask of ENDP_READ and ENDP_WRITE. */
+static void endPointWatch (EndPoint ep, unsigned int what, bool on)
+{
+  unsigned int old = ep->watch ;
+
+  ep->watch = (on ? (old | what) : (old & ~what)) ;
+
+#if defined (ENDP_SELECT)
+  if (what & ENDP_READ)
+    {
+      if (on)
+        FD_SET (ep->myFd, &rdSet) ;
+      else
+        FD_CLR (ep->myFd, &rdSet) ;
+    }
+  if (what & ENDP_WRITE)
+    {
+      if (on)
+        FD_SET (ep->myFd, &wrSet) ;
+      else
+        FD_CLR (ep->myFd, &wrSet) ;
+    }
+#else
+  if (ep->watch != old && !ep->noPoll)
+    pollUpdate (ep, old) ;
+#endif
+}
+
+
+
+#if ! defined (ENDP_SELECT)
+
+/* Tell the backend that what the endpoint waits for changed from OLD. */
+static void pollUpdate (EndPoint ep, unsigned int old)
+{
+#if defined (ENDP_EPOLL)
+  struct epoll_event ev ;
+  int op ;
+
+  memset (&ev, 0, sizeof (ev)) ;
+  ev.data.fd = ep->myFd ;
+  if (ep->watch & ENDP_READ)
+    ev.events |= EPOLLIN ;
+  if (ep->watch & ENDP_WRITE)
+    ev.events |= EPOLLOUT ;
+
+  if (old == 0)
+    op = EPOLL_CTL_ADD ;
+  else if (ep->watch == 0)
+    op = EPOLL_CTL_DEL ;
+  else
+    op = EPOLL_CTL_MOD ;
+
+  if (epoll_ctl (pollFd, op, ep->myFd, &ev) < 0)
+    {
+      if (errno == EPERM)
         {
-          tout->tv_sec = timeoutQueue->when - now ;
-          tout->tv_usec = 0 ;
-          rval = tout ;
+          /* regular files can't be polled, they're always ready */
+          ep->noPoll = true ;
+          noPollCount++ ;
         }
+      else if (op != EPOLL_CTL_DEL)
+        syswarn ("ME oserr epoll_ctl (%d)", ep->myFd) ;
     }
+#else
+  struct kevent changes [2] ;
+  int n = 0 ;
 
-  return rval ;
+  if ((old ^ ep->watch) & ENDP_READ)
+    {
+      EV_SET (&changes [n], ep->myFd, EVFILT_READ,
+              (ep->watch & ENDP_READ) ? EV_ADD : EV_DELETE, 0, 0, 0) ;
+      n++ ;
+    }
+  if ((old ^ ep->watch) & ENDP_WRITE)
+    {
+      EV_SET (&changes [n], ep->myFd, EVFILT_WRITE,
+              (ep->watch & ENDP_WRITE) ? EV_ADD : EV_DELETE, 0, 0, 0) ;
+      n++ ;
+    }
+
+  if (kevent (pollFd, changes, n, NULL, 0, NULL) < 0 && (ep->watch & ~old))
+    {
+      syswarn ("ME oserr kevent (%d)", ep->myFd) ;
+      ep->noPoll = true ;
+      noPollCount++ ;
+    }
+#endif
 }
 
-      
-  
 
+/* Note that the endpoint is ready for WHAT, if it's waiting for it. */
+static void pollReady (EndPoint ep, unsigned int what)
+{
+  if (ep == NULL)
+    return ;
+
+  what &= ep->watch ;
+  if (what == 0)
+    return ;
 
-  
-static void doTimeout (void)
+  if (ep->readyIdx < 0)
+    {
+      ep->readyIdx = readyCount ;
+      readyList [readyCount++] = ep ;
+    }
+  ep->ready |= what ;
+}
+
+
+/* Wait for endpoints to become ready for at most TOUT (forever if NULL),
+   and fill in the ready list with them, the mainEndPoint first. Returns
+   the number of ready endpoints, or -1 with errno set. */
+static int pollWait (struct timeval *tout)
+{
+  unsigned int i ;
+  int count, j ;
+  EndPoint ep ;
+#if defined (ENDP_EPOLL)
+  unsigned int what ;
+#else
+  struct timespec ts ;
+#endif
+
+  for (i = 0 ; i < readyCount ; i++)
+    if ((ep = readyList [i]) != NULL)
+      {
+        ep->ready = 0 ;
+        ep->readyIdx = -1 ;
+      }
+  readyCount = 0 ;
+
+#if defined (ENDP_EPOLL)
+  count = epoll_wait (pollFd, pollEvents, POLL_EVENTS,
+                      tout == NULL ? -1 : (int) (tout->tv_sec * 1000
+                                                 + tout->tv_usec / 1000)) ;
+  if (count < 0)
+    return -1 ;
+
+  for (j = 0 ; j < count ; j++)
+    {
+      what = 0 ;
+      if (pollEvents [j].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        what |= ENDP_READ ;
+      if (pollEvents [j].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        what |= ENDP_WRITE ;
+      pollReady (endPoints [pollEvents [j].data.fd], what) ;
+    }
+#else
+  if (tout != NULL)
+    {
+      ts.tv_sec = tout->tv_sec ;
+      ts.tv_nsec = tout->tv_usec * 1000 ;
+    }
+  count = kevent (pollFd, NULL, 0, pollEvents, POLL_EVENTS,
+                  tout == NULL ? NULL : &ts) ;
+  if (count < 0)
+    return -1 ;
+
+  for (j = 0 ; j < count ; j++)
+    {
+      int fd = (int) pollEvents [j].ident ;
+
+      if (fd < 0 || (unsigned int) fd >= maxEndPoints)
+        continue ;
+      if (pollEvents [j].filter == EVFILT_READ)
+        pollReady (endPoints [fd], ENDP_READ) ;
+      else if (pollEvents [j].filter == EVFILT_WRITE)
+        pollReady (endPoints [fd], ENDP_WRITE) ;
+    }
+#endif
+
+  if (noPollCount > 0)
+    for (j = 0 ; j <= highestFd ; j++)
+      if ((ep = endPoints [j]) != NULL && ep->noPoll)
+        pollReady (ep, ep->watch) ;
+
+  if (zPendingCount > 0)
+    for (j = 0 ; j <= highestFd ; j++)
+      if ((ep = endPoints [j]) != NULL && ep->zInPending)
+        pollReady (ep, ENDP_READ) ;
+
+  /* innd must not block writing to us, so see to its input first. */
+  if (mainEndPoint != NULL && mainEndPoint->readyIdx > 0)
+    {
+      i = mainEndPoint->readyIdx ;
+      readyList [i] = readyList [0] ;
+      readyList [i]->readyIdx = i ;
+      readyList [0] = mainEndPoint ;
+      mainEndPoint->readyIdx = 0 ;
+    }
+
+  return (int) readyCount ;
+}
+
+
+/* Do the reads and writes the endpoint was found ready for, calling the
+   callbacks of those that complete. */
+static void endPointService (EndPoint ep)
 {
-  EndpTCB cbk = timeoutQueue->func ;
-  void *data = timeoutQueue->data ;
-  TimerElem p = timeoutQueue ;
-  TimeoutId tid = timeoutQueue->id ;
+  IoStatus rval ;
 
-  timeoutQueue = timeoutQueue->next ;
+  dispatchEp = ep ;
 
-  p->next = timeoutPool ;
-  timeoutPool = p ;
+  if ((ep->ready & ENDP_READ) && (ep->watch & ENDP_READ))
+    {
+      if ((rval = doRead (ep)) != IoIncomplete)
+        {
+          Buffer *buff = ep->inBuffer ;
 
-  timeoutQueueLength-- ;
-  
-  if (cbk)
-    (*cbk) (tid, data) ;        /* call the callback function */
+          endPointWatch (ep, ENDP_READ, false) ;
+
+          /* incase callback wants to issue read */
+          ep->inBuffer = NULL ; 
+                          
+          if (ep->inCbk != NULL)
+            (*ep->inCbk) (ep,rval,buff,ep->inClientData) ;
+          else
+            freeBufferArray (buff) ;
+        }
+    }
+
+  /* the read callback may have deleted the endpoint */
+  if (dispatchEp == ep && (ep->ready & ENDP_WRITE) && (ep->watch & ENDP_WRITE))
+    {
+      rval = doWrite (ep) ;
+      if (rval != IoIncomplete && rval != IoProgress)
+        {
+          Buffer *buff = ep->outBuffer ;
+
+          endPointWatch (ep, ENDP_WRITE, false) ;
+
+          /* incase callback wants to issue a write */
+          ep->outBuffer = NULL ;        
+                          
+          if (ep->outDoneCbk != NULL)
+            (*ep->outDoneCbk) (ep,rval,buff,ep->outClientData) ;
+          else
+            freeBufferArray (buff) ;
+        }
+      else if (rval == IoProgress)
+        {
+          Buffer *buff = ep->outBuffer ;
+
+          if (ep->outProgressCbk != NULL)
+            (*ep->outProgressCbk) (ep,rval,buff,ep->outClientData) ;
+        }
+    }
+
+  dispatchEp = NULL ;
 }
 
 
+/* take the endpoint off the list of those with a work callback. */
+static void workRemove (EndPoint ep)
+{
+  workList [ep->workIdx] = NULL ;
+  ep->workIdx = -1 ;
+}
+
+#endif /* ! ENDP_SELECT */
+
+
 
 
 #if defined (WANT_MAIN)
@@ -1474,7 +2459,7 @@ static void printDate (TimeoutId tid, void *data)
   d_printf (1,"Timeout (%d) time now is %ld %s\n",
             (int) tid, (long) t, dateString) ;
 
-  if (timeoutQueue == NULL) 
+  if (timeoutQueueLength == 0)
     {
       int ti = (rand () % 10) + 1 ;
 
@@ -1502,12 +2487,12 @@ static void Timeout (TimeoutId tid, void *data)
   d_printf (1,"Timeout (%d) time now is %ld %s\n",
             (int) tid, (long) t, dateString) ;
 
-  if (timeoutQueue != NULL && timeoutQueue->next != NULL)
+  if (timeoutQueueLength > 1)
     d_printf (1,"%s timeout id %d\n",
              (removeTimeout (rm) ? "REMOVED" : "FAILED TO REMOVE"), rm) ;
   rm = 0 ;
   
-  howMany = (rand() % 10) + (timeoutQueue == NULL ? 1 : 0) ;
+  howMany = (rand() % 10) + (timeoutQueueLength == 0 ? 1 : 0) ;
 
   for (i = 0 ; i < howMany ; i++ )
     {
@@ -1751,7 +2736,21 @@ static void endpointCleanup (void)
   free (endPoints) ;
   free (priorityList) ;
   free (sigHandlers) ;
+  free (timerHash) ;
   endPoints = NULL ;
   priorityList = NULL ;
   sigHandlers = NULL ;
+  timerHash = NULL ;
+  timerHashSize = 0 ;
+#if ! defined (ENDP_SELECT)
+  free (readyList) ;
+  free (workList) ;
+  free (pollEvents) ;
+  if (pollFd >= 0)
+    close (pollFd) ;
+  readyList = NULL ;
+  workList = NULL ;
+  pollEvents = NULL ;
+  pollFd = -1 ;
+#endif
 }
@@ -78,6 +78,10 @@ void delEndPoint (EndPoint ep);
 /* return the file descriptor the endpoint is managing */
 int endPointFd (EndPoint endp) ;
 
+/* compress what is read and written from now on, as COMPRESS DEFLATE
+   does. Returns false if it can't be done. */
+bool endPointCompress (EndPoint endp) ;
+
 /* Request a read when available. Reads MINLEN bytes into the
  * buffers in BUFFERS. BUFFERS is an array of Buffers, the last of which
  * must be NULL. Note that ownership of BUFFERS is never asserted, but
@@ -22,12 +22,19 @@
 # include <limits.h>
 #endif
 
+#include "inn/buffer.h"
+#include "inn/fdflag.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
+#include "inn/metrics.h"
 #include "inn/network.h"
 #include "inn/version.h"
 #include "inn/libinn.h"
 
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+# include "portable/socket-unix.h"
+#endif
+
 #include "article.h"
 #include "buffer.h"
 #include "configfile.h"
@@ -51,6 +58,7 @@
 #define METHOD_APS 1
 #define METHOD_QUEUE 2
 #define METHOD_COMBINED 3
+#define METHOD_AIMD 4
 
 /* the limit of number of connections open when a host is
    set to 0 to mean "infinite" */
@@ -78,6 +86,14 @@ typedef struct proc_q_elem
     time_t whenToRequeue ;
 } *ProcQElem ;
 
+/* deferred articles are kept in a min-heap on the time to requeue them */
+typedef struct defer_elem
+{
+    Article article ;
+    time_t whenToRequeue ;
+    unsigned long seq ;         /* keeps equal times in arrival order */
+} *DeferElem ;
+
 typedef struct host_param_s
 {
   char *peerName;
@@ -89,6 +105,9 @@ typedef struct host_param_s
   unsigned int initialConnections;
   unsigned int absMaxConnections;
   unsigned int maxChecks;
+  unsigned int writeBatchSize;
+  unsigned int largeArticleSize;
+  unsigned int largeCxns;
   unsigned short portNum;
   bool forceIPv4;
   unsigned int closePeriod;
@@ -106,6 +125,7 @@ typedef struct host_param_s
   double dynBacklogLowWaterMark ;
   double dynBacklogHighWaterMark ;
   bool backlogFeedFirst ;
+  bool wantCompress ;
   char *username;
   char *password;
 } *HostParams ;
@@ -131,12 +151,15 @@ struct host_s
     
     ProcQElem queued ;          /* articles done nothing with yet. */
     ProcQElem queuedTail ;
+    ProcQElem largeQueued ;     /* the same, for the large-article lane */
+    ProcQElem largeQueuedTail ;
 
     ProcQElem processed ;       /* articles given to a Connection */
     ProcQElem processedTail ;
 
-    ProcQElem deferred ;	/* articles which have been deferred by */
-    ProcQElem deferredTail ;	/* a connection */
+    DeferElem deferred ;	/* heap of articles which have been */
+    unsigned int deferSize ;	/* deferred by a connection */
+    unsigned long deferSeq ;
     
     TimeoutId statsId ;         /* timeout id for stats logging. */
     TimeoutId ChkCxnsId ;	/* timeout id for dynamic connections */
@@ -145,7 +168,8 @@ struct host_s
     Tape myTape ;
     
     bool backedUp ;             /* set to true when all cxns are full */
-    unsigned int backlog ;             /* number of arts in `queued' queue */
+    unsigned int backlog ;             /* number of arts in the `queued' queues */
+    unsigned int largeBacklog ;        /* how many of them are in `largeQueued' */
     unsigned int deferLen ;		/* number of arts in `deferred' queue */
 
     bool loggedModeOn ;         /* true if we logged going into no-CHECK mode */
@@ -186,6 +210,12 @@ struct host_s
     double artsSizeAccepted_checkpoint ;
     double artsSizeRejected ;	/* size of articles remote rejected */
     double artsSizeRejected_checkpoint ;
+    unsigned int artsLargeOffered ;    /* the same for the large-article lane */
+    unsigned int artsLargeOffered_checkpoint ;
+    unsigned int artsLargeAccepted ;
+    unsigned int artsLargeAccepted_checkpoint ;
+    double artsSizeLargeAccepted ;
+    double artsSizeLargeAccepted_checkpoint ;
 
     /* Dynamic Peerage - MGF */
     unsigned int artsProcLastPeriod ;  /* # of articles processed in last period */
@@ -199,6 +229,9 @@ struct host_s
     unsigned int nextCxnTimeChk ;      /* next check for maxConnect */
 
     double backlogFilter;        /* IIR filter for size of backlog */
+    double lastSizeCheckPoint ;  /* bytes accepted at end of last period */
+    double lastBPS ;             /* bytes per second in last period */
+    int lastCxnStep ;            /* last change made to maxConnections */
 
     /* These numbers are as above, but for the life of the process. */
     unsigned int gArtsOffered ;        
@@ -287,6 +320,11 @@ static void queuesToTape (Host host) ;
 static bool amClosing (Host host) ;
 static void hostLogStatus (void) ;
 static void hostPrintStatus (Host host, FILE *fp) ;
+static void hostOpenMetrics (void) ;
+static void hostShardName (char **name) ;
+static void hostCloseMetrics (void) ;
+static void hostMetricsAccept (EndPoint e, IoStatus i, Buffer *b, void *d) ;
+static void hostMetricsWritten (EndPoint e, IoStatus i, Buffer *b, void *d) ;
 static int validateBool (FILE *fp, const char *name,
                          int required, bool setval,
 			 scope * sc, unsigned int inh);
@@ -316,12 +354,21 @@ static void hostCleanup (void) ;
 static void hostAlterMaxConnections(Host host,
 				    unsigned int absMaxCxns, unsigned int maxCxns,
 				    bool makeConnect);
+static void hostRoundTrip (Host host, double *srtt, double *minRtt,
+                           bool *busy) ;
 
 /* article queue management functions */
 static Article remHead (ProcQElem *head, ProcQElem *tail) ;
 static void queueArticle (Article article, ProcQElem *head, ProcQElem *tail,
 			  time_t when) ;
 static bool remArticle (Article article, ProcQElem *head, ProcQElem *tail) ;
+static void deferPush (Host host, Article article, time_t when) ;
+static Article deferPop (Host host) ;
+static unsigned int hostLargeCxns (Host host) ;
+static bool hostLargeArticle (Host host, Article article) ;
+static bool hostCxnIsLarge (Host host, Connection cxn) ;
+static bool laneFits (Host host, unsigned int idx, bool large) ;
+static Article laneHead (Host host, bool large) ;
 
 
 
@@ -352,6 +399,9 @@ static char startTime [30] ;    /* for timeToString */
 static pid_t myPid ;
 
 static char *statusFile = NULL ;
+static char *metricsPath = NULL ;       /* as configured */
+static char *metricsSocketPath = NULL ; /* as currently open */
+static EndPoint metricsEndPoint = NULL ;
 static unsigned int dnsRetPeriod ;
 static unsigned int dnsExpPeriod ;
 
@@ -425,6 +475,21 @@ int hostConfigLoadCbk (void *data)
     }
   else
     hostSetStatusFile (INNFEED_STATUS) ;
+
+  /* The socket itself is (re)opened by configHosts, so that checking the
+     configuration with -C doesn't disturb a running innfeed. */
+  free (metricsPath) ;
+  metricsPath = NULL ;
+  if (getString (topScope,"metrics-socket",&p,NO_INHERIT))
+    {
+      if (*p == '/')
+        metricsPath = p ;
+      else
+        {
+          metricsPath = concatpath (innconf->pathrun,p) ;
+          free (p) ;
+        }
+    }
   
   if (getBool (topScope,"connection-stats",&bval,NO_INHERIT))
     logConnectionStats = (bval ? true : false) ;
@@ -522,6 +587,9 @@ static HostParams newHostParams(HostParams p)
       params->initialConnections=INIT_CXNS;
       params->absMaxConnections=MAX_CXNS;
       params->maxChecks=MAX_Q_SIZE;
+      params->writeBatchSize=0;
+      params->largeArticleSize=0;
+      params->largeCxns=1;
       params->portNum=PORTNUM;
       params->forceIPv4=FORCE_IPv4;
       params->closePeriod=CLOSE_PERIOD;
@@ -539,6 +607,7 @@ static HostParams newHostParams(HostParams p)
       params->dynBacklogLowWaterMark = BACKLOGLWM;
       params->dynBacklogHighWaterMark = BACKLOGHWM;
       params->backlogFeedFirst=false;
+      params->wantCompress=false;
       params->username=NULL;
       params->password=NULL;
     }
@@ -638,6 +707,13 @@ void configHosts (bool talkSelf)
   
   while ((params = getHostInfo ()) !=NULL )
     {
+      /* Leave the peers of the other shards to them */
+      if (!listenerOwnsPeer (params->peerName))
+        {
+          freeHostParams (params) ;
+          continue ;
+        }
+
       h = findHostByName (params->peerName) ;
       /* We know the host isn't blocked as we cleared the blocked list */
       /* Have we already got this host up and running ?*/
@@ -698,6 +774,21 @@ void configHosts (bool talkSelf)
         h->removeOnReload = true ;
     }
 
+  /* Each shard writes its own status file and serves its own metrics,
+     named after the configured ones, and the main process has no peers
+     to report on. */
+  if (shardIndex >= 0)
+    {
+      hostShardName (&statusFile) ;
+      hostShardName (&metricsPath) ;
+    }
+  else if (shardCount > 0)
+    {
+      free (metricsPath) ;
+      metricsPath = NULL ;
+    }
+
+  hostOpenMetrics () ;
   hostLogStatus () ;
 }
 
@@ -729,6 +820,13 @@ hostAlterMaxConnections(Host host, unsigned int absMaxCxns,
       maxCxns = lAbsMaxCxns;
     }
 
+  /* keep at least one connection for small articles besides those of the
+     large-article lane */
+  if (host->params->largeArticleSize > 0
+      && host->params->largeCxns < lAbsMaxCxns
+      && maxCxns <= host->params->largeCxns)
+    maxCxns = host->params->largeCxns + 1 ;
+
   if ((maxCxns < host->maxConnections) && (host->connections != NULL))
     {
       /* We are going to have to nuke some connections, as the current
@@ -1017,12 +1115,15 @@ static Host newHost (InnListener listener, HostParams p)
 
   nh->queued = NULL ;
   nh->queuedTail = NULL ;
+  nh->largeQueued = NULL ;
+  nh->largeQueuedTail = NULL ;
 
   nh->processed = NULL ;
   nh->processedTail = NULL ;
 
   nh->deferred = NULL ;
-  nh->deferredTail = NULL ;
+  nh->deferSize = 0 ;
+  nh->deferSeq = 0 ;
   
   nh->statsId = 0 ;
   nh->ChkCxnsId = 0 ;
@@ -1042,6 +1143,7 @@ static Host newHost (InnListener listener, HostParams p)
 
   nh->backedUp = false ;
   nh->backlog = 0 ;
+  nh->largeBacklog = 0 ;
   nh->deferLen = 0 ;
 
   nh->loggedBacklog = false ;
@@ -1078,6 +1180,12 @@ static Host newHost (InnListener listener, HostParams p)
   nh->artsSizeAccepted_checkpoint = 0 ;
   nh->artsSizeRejected = 0 ;
   nh->artsSizeRejected_checkpoint = 0 ;
+  nh->artsLargeOffered = 0 ;
+  nh->artsLargeOffered_checkpoint = 0 ;
+  nh->artsLargeAccepted = 0 ;
+  nh->artsLargeAccepted_checkpoint = 0 ;
+  nh->artsSizeLargeAccepted = 0 ;
+  nh->artsSizeLargeAccepted_checkpoint = 0 ;
 
   nh->artsProcLastPeriod = 0;
   nh->secsInLastPeriod = 0;
@@ -1091,6 +1199,9 @@ static Host newHost (InnListener listener, HostParams p)
   nh->backlogFilter = ((nh->params->dynBacklogLowWaterMark
 			+ nh->params->dynBacklogHighWaterMark)
 		       /200.0 /(1.0-nh->params->dynBacklogFilter));
+  nh->lastSizeCheckPoint = 0 ;
+  nh->lastBPS = 0 ;
+  nh->lastCxnStep = 0 ;
 
   nh->gArtsOffered = 0 ;
   nh->gArtsAccepted = 0 ;
@@ -1258,6 +1369,18 @@ void hostDeleteIpv4Addr (Host host)
 }
 
 
+unsigned int hostIpAddrCount (Host host)
+{
+  unsigned int count = 0 ;
+
+  if (host->ipAddrs)
+    while (host->ipAddrs[count] != NULL)
+      count++ ;
+
+  return count ;
+}
+
+
 void hostIpFailed (Host host)
 {
   if (host->ipAddrs)
@@ -1326,6 +1449,12 @@ void printHostInfo (Host host, FILE *fp, unsigned int indentAmt)
   fprintf (fp,"%s    remote-streams : %s\n",indent,
            boolToString (host->remoteStreams)) ;
   fprintf (fp,"%s    max-checks : %u\n",indent,host->params->maxChecks) ;
+  fprintf (fp,"%s    write-batch-size : %u\n",indent,
+           host->params->writeBatchSize) ;
+  fprintf (fp,"%s    large-article-size : %u\n",indent,
+           host->params->largeArticleSize) ;
+  fprintf (fp,"%s    large-article-connections : %u\n",indent,
+           host->params->largeCxns) ;
   fprintf (fp,"%s    article-timeout : %u\n",indent,
 	   host->params->articleTimeout) ;
   fprintf (fp,"%s    response-timeout : %u\n",indent,
@@ -1357,6 +1486,8 @@ void printHostInfo (Host host, FILE *fp, unsigned int indentAmt)
 	   host->maxConnections) ;
   fprintf (fp,"%s    backlog-feed-first : %s\n",indent,
            boolToString (host->params->backlogFeedFirst)) ;
+  fprintf (fp,"%s    compress : %s\n",indent,
+           boolToString (host->params->wantCompress)) ;
 
 
   fprintf (fp,"%s    statistics-id : %d\n",indent,host->statsId) ;
@@ -1463,6 +1594,8 @@ void printHostInfo (Host host, FILE *fp, unsigned int indentAmt)
       fprintf (fp,"%s    %p\n",indent,(void *) qe->article) ;
 #endif
     }
+  for (qe = host->largeQueued ; qe != NULL ; qe = qe->next)
+    fprintf (fp,"%s    %p (large)\n",indent,(void *) qe->article) ;
   
   fprintf (fp,"%s    }\n",indent) ;
   
@@ -1478,23 +1611,23 @@ void printHostInfo (Host host, FILE *fp, unsigned int indentAmt)
   
   fprintf (fp,"%s    }\n",indent) ;
   fprintf (fp,"%s    DEFERRED articles {\n",indent) ;
-  for (qe = host->deferred ; qe != NULL ; qe = qe->next)
+  for (i = 0 ; i < host->deferLen ; i++)
     {
 #if 0
-	printArticleInfo (qe->article,fp,indentAmt + INDENT_INCR) ;
+	printArticleInfo (host->deferred [i].article,fp,indentAmt + INDENT_INCR) ;
 #else
-	fprintf (fp,"%s    %p\n",indent,(void *) qe->article) ;
+	fprintf (fp,"%s    %p\n",indent,(void *) host->deferred [i].article) ;
 #endif
     }
 
   fprintf (fp,"%s    }\n",indent) ;
   fprintf (fp,"%s    DEFERRED articles {\n",indent) ;
-  for (qe = host->deferred ; qe != NULL ; qe = qe->next)
+  for (i = 0 ; i < host->deferLen ; i++)
     {
 #if 0
-      printArticleInfo (qe->article,fp,indentAmt + INDENT_INCR) ;
+      printArticleInfo (host->deferred [i].article,fp,indentAmt + INDENT_INCR) ;
 #else
-      fprintf (fp,"%s    %p\n",indent,(void *) qe->article) ;
+      fprintf (fp,"%s    %p\n",indent,(void *) host->deferred [i].article) ;
 #endif
     }
   
@@ -1573,6 +1706,44 @@ void hostClose (Host host)
 }
 
 
+/*
+ * Average the CHECK round trips over the host's active connections, and
+ * see whether all of them have their streaming windows full.
+ */
+static void hostRoundTrip (Host host, double *srtt, double *minRtt,
+                           bool *busy)
+{
+  double s, m ;
+  unsigned int idx, n = 0, active = 0 ;
+
+  *srtt = *minRtt = 0.0 ;
+  *busy = true ;
+  for (idx = 0 ; idx < host->maxConnections ; idx++)
+    {
+      if (host->connections [idx] == NULL || !host->cxnActive [idx])
+        continue ;
+      active++ ;
+      if (cxnQueueSpace (host->connections [idx]) > 0)
+        *busy = false ;
+      cxnRoundTrip (host->connections [idx], &s, &m) ;
+      if (s > 0.0)
+        {
+          *srtt += s ;
+          *minRtt += m ;
+          n++ ;
+        }
+    }
+
+  if (active == 0)
+    *busy = false ;
+  if (n > 0)
+    {
+      *srtt /= n ;
+      *minRtt /= n ;
+    }
+}
+
+
 /*
  * check if host should get more connections opened, or some closed...
  */
@@ -1581,6 +1752,8 @@ void hostChkCxns(TimeoutId tid UNUSED, void *data) {
   unsigned int currArticles, currSentArticles, currTotalArticles, newMaxCxns ;
   double lastAPS, currAPS, percentTaken, ratio ;
   double backlogRatio, backlogMult;
+  double currBPS, srtt, minRtt ;
+  bool busy ;
 
   if(!host->maxCxnChk)
     return;
@@ -1614,6 +1787,10 @@ void hostChkCxns(TimeoutId tid UNUSED, void *data) {
 
   currAPS = currArticles / (host->nextCxnTimeChk * 1.0) ;
 
+  currBPS = (host->gArtsSizeAccepted - host->lastSizeCheckPoint)
+            / host->nextCxnTimeChk ;
+  host->lastSizeCheckPoint = host->gArtsSizeAccepted ;
+
   percentTaken = currSentArticles * 1.0 /
     ((currTotalArticles==0)?1:currTotalArticles);
 
@@ -1681,11 +1858,37 @@ void hostChkCxns(TimeoutId tid UNUSED, void *data) {
 	else if ((currAPS - lastAPS) < -.2)
 	  newMaxCxns--;
 	break;
+      case METHOD_AIMD:
+        /* Add a connection while all of them have full streaming windows
+         * and the bytes per second hold up. Cut a quarter of them when
+         * the CHECK round trips show the peer is queueing, or when the
+         * last connection added made things slower. Let one go when
+         * they aren't all kept busy.
+         */
+        hostRoundTrip (host, &srtt, &minRtt, &busy) ;
+
+	d_printf(1,"%s hostChkCxns - bps=%.0f last=%.0f rtt=%.3f min=%.3f%s\n",
+	       host->params->peerName, currBPS, host->lastBPS, srtt, minRtt,
+	       busy ? " busy" : "");
+
+        if ((srtt > minRtt * RTT_INFLATION && srtt - minRtt > RTT_SLACK)
+            || (host->lastCxnStep > 0 && currBPS < host->lastBPS * 0.9))
+          newMaxCxns -= (newMaxCxns + 3) / 4;
+        else if (busy && currBPS >= host->lastBPS * 0.95)
+          newMaxCxns++;
+        else if (!busy && host->backlog == 0 && newMaxCxns > 1)
+          newMaxCxns--;
+        break;
     }
 
+  host->lastBPS = currBPS ;
+  host->lastCxnStep = (int) newMaxCxns - (int) host->maxConnections ;
+
   d_printf(1, "hostChkCxns: Chngs %f\n", currAPS - lastAPS);
 
   if (newMaxCxns < 1) newMaxCxns=1;
+  if (newMaxCxns <= hostLargeCxns (host))
+    newMaxCxns = hostLargeCxns (host) + 1 ;
   if (newMaxCxns > MAXCONLIMIT(host->params->absMaxConnections))
     newMaxCxns = MAXCONLIMIT(host->params->absMaxConnections);
 
@@ -1707,7 +1910,9 @@ void hostChkCxns(TimeoutId tid UNUSED, void *data) {
 			      newMaxCxns, true);
   }
 
-  if(host->nextCxnTimeChk <= 240) host->nextCxnTimeChk *= 2;
+  if (host->params->dynamicMethod == METHOD_AIMD)
+    host->nextCxnTimeChk = 30;  /* react at a steady pace */
+  else if(host->nextCxnTimeChk <= 240) host->nextCxnTimeChk *= 2;
   else host->nextCxnTimeChk = 300;
   d_printf(1, "prepareSleep hostChkCxns, %d\n", host->nextCxnTimeChk);
   host->ChkCxnsId = prepareSleep(hostChkCxns, host->nextCxnTimeChk, host);
@@ -1719,6 +1924,8 @@ void hostChkCxns(TimeoutId tid UNUSED, void *data) {
  */
 void hostSendArticle (Host host, Article article)
 {
+  bool large ;
+
   ASSERT(host->params != NULL);
   if (host->spoolTime > 0)
     {                           /* all connections are asleep */
@@ -1731,8 +1938,10 @@ void hostSendArticle (Host host, Article article)
       return ;
     }
 
-  /* at least one connection is feeding or waiting and there's no backlog */
-  if (host->queued == NULL)
+  /* at least one connection is feeding or waiting and there's no backlog
+     in the article's lane */
+  large = hostLargeArticle (host, article) ;
+  if ((large ? host->largeQueued : host->queued) == NULL)
     {
       unsigned int idx ;
       Article extraRef ;
@@ -1748,7 +1957,8 @@ void hostSendArticle (Host host, Article article)
         unsigned int x_queue = host->params->maxChecks + 1 ;
 
         for (idx = 0 ; x_queue > 0 && idx < host->maxConnections ; idx++)
-          if ((cxn = host->connections[idx]) != host->notThisCxn && cxn != NULL) {
+          if (laneFits (host, idx, large) &&
+              (cxn = host->connections[idx]) != host->notThisCxn && cxn != NULL) {
             if (!host->cxnActive [idx]) {
               if (!host->cxnSleeping [idx]) {
                 if (cxnTakeArticle (cxn, extraRef)) {
@@ -1781,7 +1991,7 @@ void hostSendArticle (Host host, Article article)
            idleness. */
         for (idx = 0 ; idx < host->maxConnections ; idx++)
           {
-            if (host->cxnActive [idx] &&
+            if (host->cxnActive [idx] && laneFits (host, idx, large) &&
                 (cxn = host->connections[idx]) != host->notThisCxn &&
                 cxn != NULL && cxnTakeArticle (cxn, extraRef)) {
               unsigned int queue = host->params->maxChecks - cxnQueueSpace (cxn) - 1;
@@ -1794,6 +2004,7 @@ void hostSendArticle (Host host, Article article)
         /* Wasn't taken so try to give it to one of the waiting connections. */
         for (idx = 0 ; idx < host->maxConnections ; idx++)
           if (!host->cxnActive [idx] && !host->cxnSleeping [idx] &&
+              laneFits (host, idx, large) &&
               (cxn = host->connections[idx]) != host->notThisCxn && cxn != NULL)
             {
               if (cxnTakeArticle (cxn, extraRef)) {
@@ -1828,7 +2039,13 @@ void hostSendArticle (Host host, Article article)
 
   /* Either all the peer connection queues were full or we already had
      a backlog, so there was no sense in checking. */
-  queueArticle (article,&host->queued,&host->queuedTail, 0) ;
+  if (large)
+    {
+      queueArticle (article,&host->largeQueued,&host->largeQueuedTail, 0) ;
+      host->largeBacklog++ ;
+    }
+  else
+    queueArticle (article,&host->queued,&host->queuedTail, 0) ;
     
   host->backlog++ ;
   backlogToTape (host) ;
@@ -2150,11 +2367,13 @@ bool hostCxnGone (Host host, Connection cxn)
 /*
  * The connections has offered an article to the remote.
  */
-void hostArticleOffered (Host host, Connection cxn UNUSED)
+void hostArticleOffered (Host host, Connection cxn)
 {
   host->artsOffered++ ;
   host->gArtsOffered++ ;
   procArtsOffered++ ;
+  if (hostCxnIsLarge (host, cxn))
+    host->artsLargeOffered++ ;
 }
 
 
@@ -2180,6 +2399,11 @@ void hostArticleAccepted (Host host, Connection cxn, Article article)
   host->artsSizeAccepted += len ;
   host->gArtsSizeAccepted += len ;
   procArtsSizeAccepted += len ;
+  if (hostCxnIsLarge (host, cxn))
+    {
+      host->artsLargeAccepted++ ;
+      host->artsSizeLargeAccepted += len ;
+    }
 
   /* host has two references to the article here... the parameter `article'
      and the queue */
@@ -2277,7 +2501,10 @@ void hostArticleDeferred (Host host, Connection cxn, Article article)
       extraRef = artTakeRef (article) ; /* hold a reference until requeued */
       articleGone (host,cxn,article) ; /* drop from the queue */
 
-      if (host->deferred == NULL)
+      deferPush (host, article, now + deferTimeout) ;
+
+      /* (re)arm the timer if this is now the first one due */
+      if (host->deferred [0].article == article)
        {
            if (host->deferredId != 0)
              clearTimer (host->deferredId) ;
@@ -2285,9 +2512,6 @@ void hostArticleDeferred (Host host, Connection cxn, Article article)
                                             host) ;
         }
 
-      queueArticle (article,&host->deferred,&host->deferredTail,
-                   now + deferTimeout) ;
-      host->deferLen++ ;
       backlogToTape (host) ;
       delArticle (extraRef) ;
     }
@@ -2370,6 +2594,7 @@ bool hostGimmeArticle (Host host, Connection cxn)
   bool gaveSomething = false ;
   size_t amtToGive = cxnQueueSpace (cxn) ; /* may be more than one */
   int feed = 0 ;
+  bool large = hostCxnIsLarge (host, cxn) ;
 
   if (amClosing (host))
     {
@@ -2389,13 +2614,13 @@ bool hostGimmeArticle (Host host, Connection cxn)
       if (host->params->backlogFeedFirst) {
        if ((article = getArticle (host->myTape)) != NULL)
          feed = 2;
-       else if ((article = remHead (&host->queued,&host->queuedTail)) != NULL)
+       else if ((article = laneHead (host, large)) != NULL)
          feed = 1;
        else
          feed = 3;
       }
       else {
-       if ((article = remHead (&host->queued,&host->queuedTail)) != NULL)
+       if ((article = laneHead (host, large)) != NULL)
          feed = 1;
        else if ((article = getArticle (host->myTape)) != NULL)
          feed = 2;
@@ -2403,9 +2628,21 @@ bool hostGimmeArticle (Host host, Connection cxn)
          feed = 3;
       }
 
+      /* An article off the tape for the other lane goes to its queue, or
+         straight to one of its connections. */
+      if (feed == 2 && hostLargeArticle (host, article) != large)
+        {
+          host->artsFromTape++ ;
+          host->gArtsFromTape++ ;
+          procArtsFromTape++ ;
+          hostSendArticle (host, article) ;
+          if (host->backlog >= hostHighwater)
+            amtToGive = 0 ;
+          continue ;
+        }
+
       switch (feed) {
       case 1:
-          host->backlog-- ;
           tookIt = cxnQueueArticle (cxn,artTakeRef (article)) ;
 
           ASSERT (tookIt == true) ;
@@ -2513,11 +2750,33 @@ bool hostWantsStreaming (Host host)
   return host->params->wantStreaming ;
 }
 
+/* return true if the Connections for this host should ask for COMPRESS
+   DEFLATE, which needs zlib. */
+bool hostWantsCompress (Host host)
+{
+#if defined (HAVE_ZLIB)
+  return host->params->wantCompress ;
+#else
+  host = host ;
+  return false ;
+#endif
+}
+
 unsigned int hostMaxChecks (Host host)
 {
   return host->params->maxChecks ;
 }
 
+unsigned int hostWriteBatchSize (Host host)
+{
+  return host->params->writeBatchSize ;
+}
+
+bool hostAdaptiveWindow (Host host)
+{
+  return host->params->dynamicMethod == METHOD_AIMD ;
+}
+
 bool hostDropDeferred (Host host)
 {
   return host->params->dropDeferred ;
@@ -2762,9 +3021,13 @@ static HostParams hostDetails (scope *s,
   GETINT(s,fp,"initial-connections",0,LONG_MAX,NOTREQ,p->initialConnections, inherit);
   GETINT(s,fp,"max-connections",0,LONG_MAX,NOTREQ,p->absMaxConnections, inherit);
   GETINT(s,fp,"max-queue-size",1,LONG_MAX,NOTREQ,p->maxChecks, inherit);
+  GETINT(s,fp,"write-batch-size",0,LONG_MAX,NOTREQ,p->writeBatchSize, inherit);
+  GETINT(s,fp,"large-article-size",0,LONG_MAX,NOTREQ,p->largeArticleSize, inherit);
+  GETINT(s,fp,"large-article-connections",1,LONG_MAX,NOTREQ,p->largeCxns, inherit);
   GETBOOL(s,fp,"streaming",NOTREQ,p->wantStreaming, inherit);
   GETBOOL(s,fp,"drop-deferred",NOTREQ,p->dropDeferred, inherit);
   GETBOOL(s,fp,"min-queue-connection",NOTREQ,p->minQueueCxn, inherit);
+  GETBOOL(s,fp,"compress",NOTREQ,p->wantCompress, inherit);
   GETREAL(s,fp,"no-check-high",0.0,100.0,NOTREQ,p->lowPassHigh, inherit);
   GETREAL(s,fp,"no-check-low",0.0,100.0,NOTREQ,p->lowPassLow, inherit);
   GETREAL(s,fp,"no-check-filter",0.1,DBL_MAX,NOTREQ,p->lowPassFilter, inherit);
@@ -2822,7 +3085,7 @@ static HostParams hostDetails (scope *s,
   GETINT(s,fp,"backlog-limit-highwater",0,LONG_MAX,NOTREQNOADD,p->backlogLimitHigh, inherit);
   GETREAL(s,fp,"backlog-factor",1.0,DBL_MAX,NOTREQNOADD,p->backlogFactor, inherit);
 
-  GETINT(s,fp,"dynamic-method",0,3,NOTREQ,p->dynamicMethod, inherit);
+  GETINT(s,fp,"dynamic-method",0,4,NOTREQ,p->dynamicMethod, inherit);
   GETREAL(s,fp,"dynamic-backlog-filter",0.0,DBL_MAX,NOTREQ,p->dynBacklogFilter, inherit);
   GETREAL(s,fp,"dynamic-backlog-low",0.0,100.0,NOTREQ,p->dynBacklogLowWaterMark, inherit);
   GETREAL(s,fp,"dynamic-backlog-high",0.0,100.0,NOTREQ,p->dynBacklogHighWaterMark, inherit);
@@ -2903,6 +3166,7 @@ void delHost (Host host)
   delTape (host->myTape) ;
   
   free (host->connections) ;
+  free (host->deferred) ;
   free (host->cxnActive) ;
   free (host->cxnSleeping) ;
   free (host->params->peerName) ;
@@ -3100,6 +3364,22 @@ static void hostLogStats (Host host, bool final)
     host->artsDeferred_checkpoint = host->artsDeferred;
     host->artsCxnDrop_checkpoint = host->artsCxnDrop;
 
+    /* The large-article lane, whose figures are included in the above. */
+    if (hostLargeCxns (host) > 0)
+      {
+        notice("%s checkpoint large offered %d accepted %d accsize %.0f"
+               " queue %u",
+               host->params->peerName,
+               host->artsLargeOffered - host->artsLargeOffered_checkpoint,
+               host->artsLargeAccepted - host->artsLargeAccepted_checkpoint,
+               host->artsSizeLargeAccepted
+               - host->artsSizeLargeAccepted_checkpoint,
+               host->largeBacklog);
+      }
+    host->artsLargeOffered_checkpoint = host->artsLargeOffered;
+    host->artsLargeAccepted_checkpoint = host->artsLargeAccepted;
+    host->artsSizeLargeAccepted_checkpoint = host->artsSizeLargeAccepted;
+
     if (final) {
       notice("%s final seconds %ld offered %d accepted %d refused %d rejected %d"
              " missing %d accsize %.0f rejsize %.0f spooled %d on_close %d unspooled %d"
@@ -3119,6 +3399,10 @@ static void hostLogStats (Host host, bool final)
              (100.0*host->blQuartile[0])/cnt, (100.0*host->blQuartile[1])/cnt,
              (100.0*host->blQuartile[2])/cnt, (100.0*host->blQuartile[3])/cnt,
              (100.0*host->blFull)/cnt);
+      if (hostLargeCxns (host) > 0)
+        notice("%s final large offered %d accepted %d accsize %.0f",
+               host->params->peerName, host->artsLargeOffered,
+               host->artsLargeAccepted, host->artsSizeLargeAccepted);
     }
   }
 
@@ -3166,6 +3450,12 @@ static void hostLogStats (Host host, bool final)
       host->artsSizeAccepted_checkpoint = 0 ;
       host->artsSizeRejected = 0 ;
       host->artsSizeRejected_checkpoint = 0 ;
+      host->artsLargeOffered = 0 ;
+      host->artsLargeOffered_checkpoint = 0 ;
+      host->artsLargeAccepted = 0 ;
+      host->artsLargeAccepted_checkpoint = 0 ;
+      host->artsSizeLargeAccepted = 0 ;
+      host->artsSizeLargeAccepted_checkpoint = 0 ;
       
       *startPeriod = theTime () ; /* in of case STATS_RESET_PERIOD */
     }
@@ -3364,8 +3654,9 @@ Default peer configuration parameters:
       fprintf(fp," backlog limit high: %-7u         min-queue-cxn: %s\n",
 	    defaultParams->backlogLimitHigh,
 	    defaultParams->minQueueCxn ? "true " : "false");
-      fprintf(fp," backlog feed first: %s\n",
-           defaultParams->backlogFeedFirst ? "true " : "false");
+      fprintf(fp," backlog feed first: %s                compress: %s\n",
+           defaultParams->backlogFeedFirst ? "true " : "false",
+           defaultParams->wantCompress ? "true " : "false");
       fprintf(fp,"     backlog factor: %1.1f\n\n",
 	    defaultParams->backlogFactor);
 
@@ -3634,6 +3925,236 @@ static void hostPrintStatus (Host host, FILE *fp)
 }
 
 
+/*
+ * Append the statistics of the process and of each host, then those of
+ * the connections, to OUT in the OpenMetrics format.
+ */
+static void hostMetrics (struct buffer *out)
+{
+  Host h ;
+
+  metrics_family (out, "innfeed_build", "info", "Version of INN.") ;
+  metrics_sample (out, "innfeed_build_info", 1, "version", INN_VERSION_STRING,
+                  (char *) NULL) ;
+  metrics_family (out, "innfeed_start_time_seconds", "gauge",
+                  "Time at which innfeed started, in seconds since the"
+                  " epoch.") ;
+  metrics_sample (out, "innfeed_start_time_seconds", (double) start,
+                  (char *) NULL) ;
+  metrics_family (out, "innfeed_articles", "counter",
+                  "Articles handled by the process, by outcome.") ;
+  metrics_sample (out, "innfeed_articles_total", procArtsOffered,
+                  "result", "offered", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsAccepted,
+                  "result", "accepted", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsNotWanted,
+                  "result", "refused", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsRejected,
+                  "result", "rejected", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsDeferred,
+                  "result", "deferred", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsMissing,
+                  "result", "missing", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsToTape,
+                  "result", "spooled", (char *) NULL) ;
+  metrics_sample (out, "innfeed_articles_total", procArtsFromTape,
+                  "result", "unspooled", (char *) NULL) ;
+
+  metrics_family (out, "innfeed_peer_connections", "gauge",
+                  "Connections to the peer, by state.") ;
+  for (h = gHostList ; h != NULL ; h = h->next)
+    {
+      const char *peer = h->params->peerName ;
+
+      metrics_sample (out, "innfeed_peer_connections", h->activeCxns,
+                      "peer", peer, "state", "active", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_connections", h->sleepingCxns,
+                      "peer", peer, "state", "sleeping", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_connections",
+                      h->maxConnections - (h->activeCxns + h->sleepingCxns),
+                      "peer", peer, "state", "idle", (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_peer_articles", "counter",
+                  "Articles handled for the peer, by outcome.") ;
+  for (h = gHostList ; h != NULL ; h = h->next)
+    {
+      const char *peer = h->params->peerName ;
+
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsOffered,
+                      "peer", peer, "result", "offered", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsAccepted,
+                      "peer", peer, "result", "accepted", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsNotWanted,
+                      "peer", peer, "result", "refused", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsRejected,
+                      "peer", peer, "result", "rejected", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsDeferred,
+                      "peer", peer, "result", "deferred", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsMissing,
+                      "peer", peer, "result", "missing", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsToTape,
+                      "peer", peer, "result", "spooled", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsFromTape,
+                      "peer", peer, "result", "unspooled", (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_articles_total", h->gArtsCxnDrop,
+                      "peer", peer, "result", "requeued", (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_peer_bytes", "counter",
+                  "Size of the articles sent to the peer, by outcome.") ;
+  for (h = gHostList ; h != NULL ; h = h->next)
+    {
+      metrics_sample (out, "innfeed_peer_bytes_total", h->gArtsSizeAccepted,
+                      "peer", h->params->peerName, "result", "accepted",
+                      (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_bytes_total", h->gArtsSizeRejected,
+                      "peer", h->params->peerName, "result", "rejected",
+                      (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_peer_queued_articles", "gauge",
+                  "Articles waiting in memory to be sent to the peer.") ;
+  for (h = gHostList ; h != NULL ; h = h->next)
+    {
+      metrics_sample (out, "innfeed_peer_queued_articles", h->backlog,
+                      "peer", h->params->peerName, "queue", "backlog",
+                      (char *) NULL) ;
+      metrics_sample (out, "innfeed_peer_queued_articles", h->deferLen,
+                      "peer", h->params->peerName, "queue", "deferred",
+                      (char *) NULL) ;
+    }
+
+  gCxnMetrics (out) ;
+  metrics_end (out) ;
+}
+
+
+/*
+ * Append the index of our shard to the file name NAME, if set.
+ */
+static void hostShardName (char **name)
+{
+  char *p ;
+
+  if (*name == NULL)
+    return ;
+  xasprintf (&p, "%s.%d", *name, shardIndex) ;
+  free (*name) ;
+  *name = p ;
+}
+
+
+/*
+ * Open the socket on which statistics are served, closing the previous
+ * one if its path changed.
+ */
+static void hostOpenMetrics (void)
+{
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+  struct sockaddr_un server ;
+  int fd ;
+
+  if (metricsPath != NULL && metricsSocketPath != NULL
+      && strcmp (metricsPath,metricsSocketPath) == 0)
+    return ;
+  hostCloseMetrics () ;
+  if (metricsPath == NULL)
+    return ;
+
+  if (strlen (metricsPath) >= sizeof (server.sun_path))
+    {
+      warn ("ME metrics socket name too long: %s", metricsPath) ;
+      return ;
+    }
+  if (unlink (metricsPath) < 0 && errno != ENOENT)
+    {
+      syswarn ("ME oserr unlink %s", metricsPath) ;
+      return ;
+    }
+  if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+      syswarn ("ME oserr socket %s", metricsPath) ;
+      return ;
+    }
+  memset (&server, 0, sizeof (server)) ;
+  server.sun_family = AF_UNIX ;
+  strlcpy (server.sun_path, metricsPath, sizeof (server.sun_path)) ;
+  if (bind (fd, (struct sockaddr *) &server, SUN_LEN (&server)) < 0
+      || listen (fd, 5) < 0 || !fdflag_nonblocking (fd, true))
+    {
+      syswarn ("ME oserr bind %s", metricsPath) ;
+      close (fd) ;
+      return ;
+    }
+
+  metricsSocketPath = xstrdup (metricsPath) ;
+  metricsEndPoint = newEndPoint (fd) ;
+  prepareRead (metricsEndPoint, NULL, hostMetricsAccept, NULL, 0) ;
+#else
+  if (metricsPath != NULL)
+    warn ("ME metrics-socket requires Unix domain sockets") ;
+#endif
+}
+
+
+static void hostCloseMetrics (void)
+{
+  if (metricsEndPoint == NULL)
+    return ;
+  delEndPoint (metricsEndPoint) ;
+  metricsEndPoint = NULL ;
+  if (unlink (metricsSocketPath) < 0)
+    syswarn ("ME oserr unlink %s", metricsSocketPath) ;
+  free (metricsSocketPath) ;
+  metricsSocketPath = NULL ;
+}
+
+
+/*
+ * Called when a client connects to the metrics socket.  The statistics
+ * are written to it through an endpoint of its own, which is deleted once
+ * they are out.
+ */
+static void hostMetricsAccept (EndPoint e, IoStatus i UNUSED,
+                               Buffer *b UNUSED, void *d UNUSED)
+{
+  struct buffer *out ;
+  EndPoint client ;
+  Buffer *buffers ;
+  int fd ;
+
+  fd = accept (endPointFd (e), NULL, NULL) ;
+  if (fd < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        syswarn ("ME oserr accept %s", metricsSocketPath) ;
+    }
+  else if (!fdflag_nonblocking (fd, true))
+    {
+      syswarn ("ME oserr nonblocking %s", metricsSocketPath) ;
+      close (fd) ;
+    }
+  else
+    {
+      out = buffer_new () ;
+      hostMetrics (out) ;
+      client = newEndPoint (fd) ;
+      buffers = makeBufferArray (newBufferByCharP (out->data, out->size,
+                                                   out->left), NULL) ;
+      prepareWrite (client, buffers, NULL, hostMetricsWritten, out) ;
+    }
+
+  prepareRead (e, NULL, hostMetricsAccept, NULL, 0) ;
+}
+
+
+static void hostMetricsWritten (EndPoint e, IoStatus i UNUSED, Buffer *b,
+                                void *d)
+{
+  freeBufferArray (b) ;
+  buffer_free (d) ;
+  delEndPoint (e) ;
+}
+
+
 
 
 
@@ -3670,16 +4191,16 @@ static void hostDeferredArtCbk (TimeoutId tid UNUSED, void *data)
 
   ASSERT (tid == host->deferredId) ;
 
-  while (host->deferred && host->deferred->whenToRequeue <= now)
+  /* move all that are due back in one go */
+  while (host->deferLen > 0 && host->deferred [0].whenToRequeue <= now)
     {
-      article = remHead (&host->deferred,&host->deferredTail) ;
-      host->deferLen-- ;
+      article = deferPop (host) ;
       hostSendArticle (host, article) ; /* requeue it */
     }
 
-  if (host->deferred)
+  if (host->deferLen > 0)
     host->deferredId = prepareSleep (hostDeferredArtCbk,
-                                    host->deferred->whenToRequeue - now,
+                                    host->deferred [0].whenToRequeue - now,
                                     host) ;
   else
     host->deferredId = 0;
@@ -3698,16 +4219,10 @@ static void backlogToTape (Host host)
 	  host->loggedBacklog = true ;
 	}
   
-      if (host->deferred != NULL)
-       {
-         article = remHead (&host->deferred,&host->deferredTail) ;
-          host->deferLen--;
-       }
-      else
-       {
-         article = remHead (&host->queued,&host->queuedTail) ;
-          host->backlog--;
-       }
+      if (host->deferLen > 0)
+        article = deferPop (host) ;
+      else if ((article = laneHead (host, false)) == NULL)
+        article = laneHead (host, true) ;
 
       ASSERT(article != NULL);
 
@@ -3757,20 +4272,9 @@ static void queuesToTape (Host host)
       tapeTakeArticle (host->myTape,art) ;
     }
   
-  while ((art = remHead (&host->queued,&host->queuedTail)) != NULL)
-    {
-      host->backlog-- ;
-      host->artsHostClose++ ;
-      host->gArtsHostClose++ ;
-      host->artsToTape++ ;
-      host->gArtsToTape++ ;
-      procArtsToTape++ ;
-      tapeTakeArticle (host->myTape,art) ;
-    }
-
-  while ((art = remHead (&host->deferred,&host->deferredTail)) != NULL)
+  while ((art = laneHead (host, false)) != NULL
+         || (art = laneHead (host, true)) != NULL)
     {
-      host->deferLen-- ;
       host->artsHostClose++ ;
       host->gArtsHostClose++ ;
       host->artsToTape++ ;
@@ -3779,9 +4283,8 @@ static void queuesToTape (Host host)
       tapeTakeArticle (host->myTape,art) ;
     }
 
-  while ((art = remHead (&host->deferred,&host->deferredTail)) != NULL)
+  while ((art = deferPop (host)) != NULL)
     {
-      host->deferLen-- ;
       host->artsHostClose++ ;
       host->gArtsHostClose++ ;
       host->artsToTape++ ;
@@ -3883,6 +4386,87 @@ static bool remArticle (Article article, ProcQElem *head, ProcQElem *tail)
 
 
 
+/*
+ * true if deferred element a is due before b
+ */
+static bool deferBefore (DeferElem a, DeferElem b)
+{
+  if (a->whenToRequeue != b->whenToRequeue)
+    return a->whenToRequeue < b->whenToRequeue ;
+  return a->seq < b->seq ;
+}
+
+
+
+
+/*
+ * Add an article to the host's deferred heap, to be requeued at WHEN.
+ */
+static void deferPush (Host host, Article article, time_t when)
+{
+  struct defer_elem elem ;
+  unsigned int i, parent ;
+
+  if (host->deferLen == host->deferSize)
+    {
+      host->deferSize = (host->deferSize == 0 ? 64 : host->deferSize * 2) ;
+      host->deferred = xrealloc (host->deferred,
+                                 sizeof(struct defer_elem) * host->deferSize) ;
+    }
+
+  elem.article = article ;
+  elem.whenToRequeue = when ;
+  elem.seq = host->deferSeq++ ;
+
+  /* sift up from the end */
+  for (i = host->deferLen++ ; i > 0 ; i = parent)
+    {
+      parent = (i - 1) / 2 ;
+      if (!deferBefore (&elem, &host->deferred [parent]))
+        break ;
+      host->deferred [i] = host->deferred [parent] ;
+    }
+  host->deferred [i] = elem ;
+}
+
+
+
+
+/*
+ * Remove the deferred article that's due first and return it. Returns
+ * NULL if there are none.
+ */
+static Article deferPop (Host host)
+{
+  Article art ;
+  struct defer_elem last ;
+  unsigned int i, child ;
+
+  if (host->deferLen == 0)
+    return NULL ;
+
+  art = host->deferred [0].article ;
+  last = host->deferred [--host->deferLen] ;
+
+  /* sift the last element down from the root */
+  for (i = 0 ; (child = 2 * i + 1) < host->deferLen ; i = child)
+    {
+      if (child + 1 < host->deferLen
+          && deferBefore (&host->deferred [child + 1], &host->deferred [child]))
+        child++ ;
+      if (!deferBefore (&host->deferred [child], &last))
+        break ;
+      host->deferred [i] = host->deferred [child] ;
+    }
+  if (host->deferLen > 0)
+    host->deferred [i] = last ;
+
+  return art ;
+}
+
+
+
+
 /*
  * remove the article that's at the head of the queue and return
  * it. Returns NULL if the queue is empty.
@@ -3917,6 +4501,83 @@ static Article remHead (ProcQElem *head, ProcQElem *tail)
 
 
 
+
+/*
+ * The number of connections of the large-article lane, the lowest numbered
+ * ones, which the dynamic methods never close. Returns 0 if the Host has
+ * no such lane.
+ */
+static unsigned int hostLargeCxns (Host host)
+{
+  if (host->params->largeArticleSize == 0
+      || host->params->largeCxns >= MAXCONLIMIT(host->params->absMaxConnections))
+    return 0 ;
+  return host->params->largeCxns ;
+}
+
+
+
+/*
+ * Returns true if the article goes through the large-article lane. This
+ * reads it in if needed, which the connection would do anyway to send it.
+ */
+static bool hostLargeArticle (Host host, Article article)
+{
+  if (hostLargeCxns (host) == 0 || !artContentsOk (article))
+    return false ;
+  return (unsigned int) artSize (article) >= host->params->largeArticleSize ;
+}
+
+
+
+/*
+ * Returns true if the connection belongs to the large-article lane.
+ */
+static bool hostCxnIsLarge (Host host, Connection cxn)
+{
+  unsigned int idx ;
+
+  for (idx = 0 ; idx < hostLargeCxns (host) ; idx++)
+    if (host->connections [idx] == cxn)
+      return true ;
+  return false ;
+}
+
+
+
+/*
+ * Returns true if connection number idx may carry articles of the lane.
+ */
+static bool laneFits (Host host, unsigned int idx, bool large)
+{
+  return (idx < hostLargeCxns (host)) == large ;
+}
+
+
+
+/*
+ * remove the article at the head of the queue of a lane and return it.
+ * Returns NULL if the queue is empty.
+ */
+static Article laneHead (Host host, bool large)
+{
+  Article art ;
+
+  if (large)
+    art = remHead (&host->largeQueued,&host->largeQueuedTail) ;
+  else
+    art = remHead (&host->queued,&host->queuedTail) ;
+  if (art != NULL)
+    {
+      host->backlog-- ;
+      if (large)
+        host->largeBacklog-- ;
+    }
+  return art ;
+}
+
+
+
 static int validateInteger (FILE *fp, const char *name,
                      long low, long high, int required, long setval,
 		     scope * sc, unsigned int inh)
@@ -4076,6 +4737,9 @@ void gCalcHostBlStat (void)
 }
 static void hostCleanup (void)
 {
+  hostCloseMetrics () ;
+  free (metricsPath) ;
+  metricsPath = NULL ;
   if (statusFile != NULL)
     free (statusFile) ;
   statusFile = NULL ;
@@ -89,6 +89,9 @@ struct sockaddr *hostIpAddr (Host host) ;
 /* Delete all IPv4 addresses from the address list. */
 void hostDeleteIpv4Addr (Host host);
 
+/* return the number of IP addresses of the host */
+unsigned int hostIpAddrCount (Host host) ;
+
 /* mark the current IP address as failed and rotate to the next one */
 void hostIpFailed (Host host) ;
 
@@ -173,6 +176,9 @@ void hostSetStatsPeriod (unsigned int period) ;
 /* return whether or not the Connections should attempt to stream. */
 bool hostWantsStreaming (Host host) ;
 
+/* return whether or not the Connections should ask for COMPRESS DEFLATE. */
+bool hostWantsCompress (Host host) ;
+
 /* return maxChecks */
 unsigned int hostmaxChecks (Host host);
 
@@ -182,6 +188,14 @@ bool hostDropDeferred (Host host);
 /* return the maximum number of CHECKs that can be outstanding */
 unsigned int hostMaxChecks (Host host) ;
 
+/* return the number of bytes of streaming commands and articles to gather
+   into one write, or 0 to write them as soon as they are queued */
+unsigned int hostWriteBatchSize (Host host) ;
+
+/* return whether the Connections should size their streaming windows from
+   the CHECK round trips (dynamic-method 4) rather than use max-queue-size */
+bool hostAdaptiveWindow (Host host) ;
+
 /* Called by the Host's connections when they go into (true) or out of
    (false) no-CHECK mode. */
 void hostLogNoCheckMode (Host host, bool on, double low, double cur, double high) ;
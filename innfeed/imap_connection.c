@@ -33,7 +33,9 @@
 #include <time.h>
 #include <syslog.h>
 
+#include "inn/buffer.h"
 #include "inn/messages.h"
+#include "inn/metrics.h"
 #include "inn/libinn.h"
 
 #include "buffer.h"
@@ -81,6 +83,7 @@ extern char *deliver_password;
 extern char *deliver_realm;
 extern char *deliver_rcpt_to;
 extern char *deliver_to_header;
+extern int deliver_window;
 
 
 char hostname[MAXHOSTNAMELEN];
@@ -162,6 +165,8 @@ typedef enum {
     LMTP_WRITING_UPTODATA,
     LMTP_WRITING_CONTENTS,
 
+    LMTP_PIPELINING,
+
     LMTP_WRITING_QUIT,
     LMTP_READING_QUIT
 
@@ -181,11 +186,20 @@ typedef struct lmtp_capabilities_s {
     int Eightbitmime;
     int EnhancedStatusCodes;
     int pipelining;
+    int chunking;
 
     char *saslmechs;
 
 } lmtp_capabilities_t;
 
+/* Which reply a pipelined LMTP transaction is waiting for */
+typedef enum {
+    LMTP_STAGE_RSET,
+    LMTP_STAGE_MAILFROM,
+    LMTP_STAGE_RCPTTO,
+    LMTP_STAGE_BDAT
+} lmtp_stage_t;
+
 typedef enum {
     STAT_CONT = 0,
     STAT_NO = 1,
@@ -221,6 +235,14 @@ typedef struct article_queue_s {
 
     int counts_toward_size;
 
+    /* only used while in the LMTP in-flight queue */
+    lmtp_stage_t stage;
+    int rcpts_issued;   /* RCPT TO commands sent */
+    int rcpts_seen;     /* RCPT TO replies read */
+    int rcpts_okayed;   /* RCPT TO commands accepted */
+    int data_seen;      /* BDAT replies read */
+    int data_okayed;    /* BDAT replies that were successful */
+
     union {
 	Article article;
 	control_item_t *control;
@@ -320,6 +342,10 @@ typedef struct connection_s {
 
     Q_t lmtp_todeliver_q;
 
+    /* Transactions written but not yet answered when pipelining */
+    Q_t lmtp_inflight_q;
+    bool lmtp_writing;              /* a pipelined write is pending */
+
 
 
     /* IMAP stuff */
@@ -407,6 +433,7 @@ static conn_ret WriteToWire_lmtpstr(connection_t *cxn, char *str, int slen);
 static conn_ret WriteToWire(connection_t *cxn, EndpRWCB callback,
 			    EndPoint endp, Buffer *array);
 static void lmtp_sendmessage(connection_t *cxn, Article justadded);
+static void lmtp_sendpipeline(connection_t *cxn, Article justadded);
 static void imap_ProcessQueue(connection_t *cxn);
 
 static conn_ret FindHeader(Buffer *bufs, const char *header, char **start, char **end);
@@ -493,6 +520,7 @@ static const char *lmtp_stateToString(int state)
 	case LMTP_WRITING_UPTODATA:
 	    return "writing RSET, MAIL FROM, RCPT TO, DATA commands";
 	case LMTP_WRITING_CONTENTS: return "writing contents of message";
+	case LMTP_PIPELINING: return "pipelining messages";
 	case LMTP_WRITING_QUIT: return "writing QUIT";
 	case LMTP_READING_QUIT: return "reading QUIT";
 	default: return "unknown state";
@@ -591,6 +619,30 @@ static conn_ret PopFromQueue(Q_t *q, article_queue_t **item)
     return RET_OK;
 }
 
+/*
+ * Append an item that was popped from a queue to the end of a queue
+ *
+ * q     - the queue to append to
+ * entry - the item
+ */
+
+static void QueueAppend(Q_t *q, article_queue_t *entry)
+{
+    entry->next = NULL;
+
+    /* add to end of queue */
+    if (q->tail == NULL)
+    {
+	q->head = entry;
+	q->tail = entry;
+    } else {
+	q->tail->next = entry;
+	q->tail = entry;
+    }
+
+    q->size+=entry->counts_toward_size;
+}
+
 /*
  * ReQueue an item. Will either put it back in the queue for another try
  * or forget about it
@@ -616,19 +668,7 @@ static void ReQueue(connection_t *cxn, Q_t *q, article_queue_t *entry)
 
 
     /* ok let's add back to the end of the queue */
-    entry->next = NULL;
-
-    /* add to end of queue */
-    if (q->tail == NULL)
-    {
-	q->head = entry;
-	q->tail = entry;
-    } else {
-	q->tail->next = entry;
-	q->tail = entry;
-    }
-
-    q->size+=entry->counts_toward_size;
+    QueueAppend(q, entry);
 }
 
 
@@ -1912,9 +1952,11 @@ static void lmtp_Disconnect(connection_t *cxn)
     clearTimer (cxn->lmtp_writeBlockedTimerId) ;
 
     /* give any articles back to Host */
+    DeferAllArticles(cxn, &(cxn->lmtp_inflight_q)) ;
     DeferAllArticles(cxn, &(cxn->lmtp_todeliver_q)) ;
 
     cxn->lmtp_state = LMTP_DISCONNECTED;
+    cxn->lmtp_writing = false;
 
     cxn->lmtp_disconnects++;
 
@@ -2242,9 +2284,10 @@ static void lmtp_writeCB (EndPoint e UNUSED, IoStatus i UNUSED, Buffer *b,
 	cxn->lmtp_tofree_str=NULL;
     }
 
-    /* set up to receive */
+    /* set up to receive (when pipelining we may already be) */
     readBuffers = makeBufferArray (bufferTakeRef (cxn->lmtp_rBuffer), NULL) ;
-    prepareRead(cxn->lmtp_endpoint, readBuffers, lmtp_readCB, cxn, 5);
+    if (!prepareRead(cxn->lmtp_endpoint, readBuffers, lmtp_readCB, cxn, 5))
+	freeBufferArray (readBuffers);
 
    /* set up the response timer. */
     clearTimer (cxn->lmtp_readBlockedTimerId) ;
@@ -2285,6 +2328,12 @@ static void lmtp_writeCB (EndPoint e UNUSED, IoStatus i UNUSED, Buffer *b,
 	    cxn->lmtp_state = LMTP_READING_NOOP;
 	    break;
 
+	case LMTP_PIPELINING:
+	    /* the window may have room for more */
+	    cxn->lmtp_writing = false;
+	    lmtp_sendpipeline(cxn, NULL);
+	    break;
+
 	case LMTP_WRITING_QUIT:
 	    cxn->lmtp_state = LMTP_READING_QUIT;
 	    break;
@@ -3187,6 +3236,7 @@ static void lmtp_readCB (EndPoint e, IoStatus i, Buffer *b, void *d)
     conn_ret result;
     int response_code;
     conn_ret ret;
+    article_queue_t *item;
 #ifdef HAVE_SASL
     int inlen;
     char *in;
@@ -3259,6 +3309,12 @@ static void lmtp_readCB (EndPoint e, IoStatus i, Buffer *b, void *d)
 	/* set up to receive some more */
 	readBuffers = makeBufferArray (bufferTakeRef (cxn->lmtp_rBuffer), NULL) ;
 	prepareRead(cxn->lmtp_endpoint, readBuffers, lmtp_readCB, cxn, 5);
+
+	/* still owed replies to pipelined messages */
+	if (cxn->lmtp_state == LMTP_PIPELINING && cxn->lmtp_readTimeout > 0)
+	    cxn->lmtp_readBlockedTimerId = prepareSleep (lmtp_readTimeoutCbk,
+							 cxn->lmtp_readTimeout,
+							 cxn) ;
 	return;
     }
 
@@ -3319,6 +3375,8 @@ static void lmtp_readCB (EndPoint e, IoStatus i, Buffer *b, void *d)
 		cxn->lmtp_capabilities->saslmechs = xstrdup(str + 4 + 5);
 	    } else if (strncasecmp(str+4,"PIPELINING",strlen("PIPELINING"))==0) {
 		cxn->lmtp_capabilities->pipelining = 1;
+	    } else if (strncasecmp(str+4,"CHUNKING",strlen("CHUNKING"))==0) {
+		cxn->lmtp_capabilities->chunking = 1;
 	    } else {
 		/* don't care; ignore */
 	    }
@@ -3609,6 +3667,108 @@ static void lmtp_readCB (EndPoint e, IoStatus i, Buffer *b, void *d)
 	    cxn->lmtp_state = LMTP_AUTHED_IDLE;
 	    break;
 
+	case LMTP_PIPELINING:
+	    if (ask_keepgoing(str)) {
+		goto reset;
+	    }
+
+	    /* replies come back in the order the transactions were sent */
+	    item = cxn->lmtp_inflight_q.head;
+	    if (item == NULL) {
+		d_printf(0,"%s:%d:LMTP Unexpected reply while pipelining: %s\n",
+			 hostPeerName (cxn->myHost),cxn->ident, str);
+		lmtp_Disconnect(cxn);
+		return;
+	    }
+
+	    response_code = ask_code(str);
+
+	    switch (item->stage)
+		{
+		case LMTP_STAGE_RSET:
+		case LMTP_STAGE_MAILFROM:
+		    if (response_code != 250) {
+			d_printf(0,"%s:%d:LMTP %s failed with (%d)\n",
+				 hostPeerName (cxn->myHost),cxn->ident,
+				 item->stage == LMTP_STAGE_RSET ? "RSET"
+				 : "MAILFROM", response_code);
+			lmtp_Disconnect(cxn);
+			return;
+		    }
+		    if (item->stage == LMTP_STAGE_RSET)
+			item->stage = LMTP_STAGE_MAILFROM;
+		    else if (item->rcpts_issued > 0)
+			item->stage = LMTP_STAGE_RCPTTO;
+		    else
+			item->stage = LMTP_STAGE_BDAT;
+		    goto reset;
+
+		case LMTP_STAGE_RCPTTO:
+		    if (response_code != 250) {
+			d_printf(1,"%s:%d:LMTP RCPT TO failed with (%d) %s\n",
+				 hostPeerName (cxn->myHost),cxn->ident,
+				 response_code, str);
+
+			/* if got a 5xx don't try to send anymore */
+			item->trys=100;
+		    } else {
+			item->rcpts_okayed++;
+		    }
+		    if (++item->rcpts_seen == item->rcpts_issued)
+			item->stage = LMTP_STAGE_BDAT;
+		    goto reset;
+
+		case LMTP_STAGE_BDAT:
+		    item->data_seen++;
+		    if (response_code == 250) {
+			item->data_okayed++;
+		    } else if (item->rcpts_okayed > 0) {
+			d_printf(1, "%s:%d:LMTP BDAT failed with %d (%s)\n",
+				 hostPeerName (cxn->myHost),cxn->ident,
+				 response_code, str);
+		    }
+
+		    /* LMTP gives one reply for every accepted rcpt, or a
+		       single one if there were none */
+#ifdef SMTPMODE
+		    if (item->data_seen < 1)
+			goto reset;
+#else
+		    if (item->data_seen < item->rcpts_okayed)
+			goto reset;
+#endif /* SMTPMODE */
+		    break;
+		}
+
+	    /* that was the last reply for this message */
+	    PopFromQueue(&(cxn->lmtp_inflight_q), &item);
+
+	    if (item->rcpts_okayed == 0) {
+		if (item->trys < 100) {
+		    d_printf(1, "%s:%d:LMTP None of the rcpts "
+			     "were accepted for this message. Re-queueing\n",
+			     hostPeerName (cxn->myHost),cxn->ident);
+		}
+
+		ReQueue(cxn, &(cxn->lmtp_todeliver_q), item);
+	    } else {
+		if (item->data_okayed > 0) {
+		    cxn->lmtp_succeeded++;
+		    d_printf(1, "%s:%d:LMTP Woohoo! message accepted\n",
+			     hostPeerName (cxn->myHost),cxn->ident);
+		}
+
+		/* we can delete article now */
+		QueueForgetAbout(cxn, item, MSG_SUCCESS);
+	    }
+
+	    /* the window has room again */
+	    lmtp_sendpipeline(cxn, NULL);
+
+	    if (cxn->lmtp_state == LMTP_PIPELINING)
+		goto reset;
+	    break;
+
 	case LMTP_READING_QUIT:
 	    d_printf(1,"%s:%d:LMTP read quit\n",
 		     hostPeerName (cxn->myHost),cxn->ident);
@@ -3889,28 +4049,30 @@ static void imap_ProcessQueue(connection_t *cxn)
 
 
 /*
- *
- * Pulls a message off the queue and trys to start sending it. If the
+ * Pulls a message off the queue that should go out by LMTP. If the
  * message is a control message put it in the control queue and grab
  * another message. If the message doesn't exist on disk or something
- * is wrong with it tell the host and try again. If we run out of
- * messages to get tell the host we want more
+ * is wrong with it tell the host and try again.
+ *
+ * Returns RET_OK with the item and its buffers, RET_QUEUE_EMPTY if there
+ * is nothing left to send, or RET_FAIL if a message had to be put back
+ * in the queue and we should stop for now.
  *
  * cxn       - connection object
  * justadded - the article that was just added to the queue
+ * itemp     - where the item is placed upon success
+ * bufsp     - where the article buffers are placed upon success
  */
 
-static void lmtp_sendmessage(connection_t *cxn, Article justadded)
+static conn_ret lmtp_popmessage(connection_t *cxn, Article justadded,
+				article_queue_t **itemp, Buffer **bufsp)
 {
     bool res;
     conn_ret result;
-    char *p;
     Buffer *bufs;
     char *control_header = NULL;
     char *control_header_end = NULL;
-
     article_queue_t *item;
-    char *rcpt_list, *rcpt_list_end;
 
     /* retry point */
  retry:
@@ -3919,28 +4081,7 @@ static void lmtp_sendmessage(connection_t *cxn, Article justadded)
     result = PopFromQueue(&(cxn->lmtp_todeliver_q), &item);
 
     if (result == RET_QUEUE_EMPTY)
-    {
-	if (cxn->issue_quit) {
-	    lmtp_IssueQuit(cxn);
-	    return;
-	}
-	/* now we wait for articles from our Host, or we have some
-	   articles already. On infrequently used connections, the
-	   network link is torn down and rebuilt as needed. So we may
-	   be rebuilding the connection here in which case we have an
-	   article to send. */
-
-	/* make sure imap has space too */
-	d_printf(1,"%s:%d stalled waiting for articles\n",
-		 hostPeerName (cxn->myHost),cxn->ident);
-	if ((QueueItems(&(cxn->lmtp_todeliver_q)) == 0) &&
-	    (QueueItems(&(cxn->imap_controlMsg_q)) == 0)) {
-	    if (hostGimmeArticle (cxn->myHost,cxn)==true)
-		goto retry;
-	}
-
-	return;
-    }
+	return result;
 
     /* make sure contents ok; this also should load it into memory */
     res = artContentsOk (item->data.article);
@@ -3948,7 +4089,7 @@ static void lmtp_sendmessage(connection_t *cxn, Article justadded)
     {
 	if (justadded == item->data.article) {
 	    ReQueue(cxn, &(cxn->lmtp_todeliver_q), item);
-	    return;
+	    return RET_FAIL;
 	} else {
 	    /* tell to reject taking this message */
 	    QueueForgetAbout(cxn,item, MSG_MISSING);
@@ -3974,7 +4115,7 @@ static void lmtp_sendmessage(connection_t *cxn, Article justadded)
 	    d_printf(1,"%s:%d Error adding to [imap] control queue\n",
 		     hostPeerName (cxn->myHost),cxn->ident) ;
 	    ReQueue(cxn, &(cxn->lmtp_todeliver_q), item);
-	    return;
+	    return RET_FAIL;
 	}
 
 	switch(cxn->imap_state) {
@@ -4000,6 +4141,297 @@ static void lmtp_sendmessage(connection_t *cxn, Article justadded)
 	goto retry;
     }
 
+    *itemp = item;
+    *bufsp = bufs;
+
+    return RET_OK;
+}
+
+/*
+ * Copy an article out of its NNTP buffers into one string, undoing the
+ * dot-stuffing and dropping the terminating ".\r\n", as BDAT sends the
+ * message verbatim. prefix is prepended to the article.
+ *
+ * Returns the new string (to be freed by the caller) and its length in len.
+ */
+
+static char *lmtp_unstuff(Buffer *bufs, const char *prefix, size_t *len)
+{
+    size_t total, n, linestart;
+    bool bol = true, dotted = false;
+    unsigned int i;
+    size_t j;
+    char *out;
+
+    total = strlen(prefix);
+    for (i = 0; bufs[i] != NULL; i++)
+	total += bufferDataSize(bufs[i]);
+
+    out = xmalloc(total + 1);
+    n = strlen(prefix);
+    memcpy(out, prefix, n);
+    linestart = n;
+
+    for (i = 0; bufs[i] != NULL; i++) {
+	const char *base = bufferBase(bufs[i]);
+
+	for (j = 0; j < bufferDataSize(bufs[i]); j++) {
+	    if (bol) {
+		linestart = n;
+		bol = false;
+		dotted = (base[j] == '.');
+		if (dotted)
+		    continue;
+	    }
+	    out[n++] = base[j];
+	    if (base[j] == '\n')
+		bol = true;
+	}
+    }
+
+    /* the last line was the "." terminator */
+    if (dotted && n - linestart == 2)
+	n = linestart;
+
+    out[n] = '\0';
+    *len = n;
+
+    return out;
+}
+
+/*
+ * Build one pipelined transaction for an article:
+ *
+ *   RSET
+ *   MAIL FROM
+ *   RCPT TO (one per newsgroup)
+ *   BDAT <size> LAST
+ *   <article>
+ *
+ * Returns a buffer holding all of it, or NULL if the article has no
+ * recipients (in which case the item has been forgotten about).
+ */
+
+static Buffer lmtp_bdatbuffer(connection_t *cxn, article_queue_t *item,
+			      Buffer *bufs)
+{
+    conn_ret result;
+    char *rcpt_list, *rcpt_list_end;
+    char *to_list = NULL, *to_list_end;
+    char *envelope, *article;
+    char bdat[64];
+    size_t envlen, bdatlen, artlen;
+    Buffer buff;
+
+    /* find out who it's going to */
+    result = FindHeader(bufs, "Newsgroups", &rcpt_list, &rcpt_list_end);
+
+    if ((result != RET_OK) || (rcpt_list == NULL)) {
+	d_printf(1,"%s:%d Didn't find Newsgroups header\n",
+		 hostPeerName (cxn->myHost),cxn->ident) ;
+	QueueForgetAbout(cxn, item, MSG_FAIL_DELIVER);
+	return NULL;
+    }
+
+    rcpt_list = ConvertRcptList(rcpt_list, rcpt_list_end,
+				&item->rcpts_issued);
+
+    if (mailfrom_name == NULL)
+	mailfrom_name = xstrdup("");
+    envelope = concat("RSET\r\n"
+                      "MAIL FROM:<", mailfrom_name, ">\r\n",
+                      rcpt_list, (char *) 0);
+    free(rcpt_list);
+
+    /* prepend To: header to article */
+    if (deliver_to_header) {
+	result = FindHeader(bufs, "Followup-To", &to_list, &to_list_end);
+
+	if ((result != RET_OK) || (to_list == NULL)) {
+	    FindHeader(bufs, "Newsgroups", &to_list, &to_list_end);
+	}
+
+	to_list = BuildToHeader(to_list, to_list_end);
+    }
+
+    article = lmtp_unstuff(bufs, to_list != NULL ? to_list : "", &artlen);
+    free(to_list);
+
+    envlen = strlen(envelope);
+    bdatlen = snprintf(bdat, sizeof(bdat), "BDAT %lu LAST\r\n",
+		       (unsigned long) artlen);
+
+    buff = newBuffer(envlen + bdatlen + artlen);
+    memcpy(bufferBase(buff), envelope, envlen);
+    memcpy((char *) bufferBase(buff) + envlen, bdat, bdatlen);
+    memcpy((char *) bufferBase(buff) + envlen + bdatlen, article, artlen);
+    bufferSetDataSize(buff, envlen + bdatlen + artlen);
+
+    free(envelope);
+    free(article);
+
+    item->stage = LMTP_STAGE_RSET;
+    item->rcpts_seen = item->rcpts_okayed = 0;
+    item->data_seen = item->data_okayed = 0;
+
+    return buff;
+}
+
+/*
+ * Send as many messages as the in-flight window allows without waiting
+ * for the replies to earlier ones (RFC 2920). Every transaction uses
+ * BDAT (RFC 3030) so no round trip is needed before the contents are
+ * sent. Everything ready is written with a single write; when that is
+ * done or replies free up the window we're called again.
+ *
+ * cxn       - connection object
+ * justadded - the article that was just added to the queue
+ */
+
+static void lmtp_sendpipeline(connection_t *cxn, Article justadded)
+{
+    conn_ret result;
+    article_queue_t *item;
+    Buffer *bufs, *writeArr;
+    Buffer buff;
+    int room, n;
+
+ retry:
+    /* only one write at a time on the endpoint */
+    if (cxn->lmtp_writing)
+	return;
+
+    room = deliver_window - QueueItems(&(cxn->lmtp_inflight_q));
+    if (room <= 0)
+	return;
+
+    writeArr = xmalloc(sizeof(Buffer) * (room + 1));
+    n = 0;
+
+    while (n < room) {
+	result = lmtp_popmessage(cxn, justadded, &item, &bufs);
+	if (result != RET_OK)
+	    break;
+
+	buff = lmtp_bdatbuffer(cxn, item, bufs);
+	freeBufferArray(bufs);
+	if (buff == NULL)
+	    continue;
+
+	writeArr[n++] = buff;
+	QueueAppend(&(cxn->lmtp_inflight_q), item);
+	hostArticleOffered (cxn->myHost, cxn);
+    }
+    writeArr[n] = NULL;
+
+    if (n == 0) {
+	free(writeArr);
+
+	/* still waiting for replies */
+	if (QueueItems(&(cxn->lmtp_inflight_q)) > 0)
+	    return;
+
+	cxn->lmtp_state = LMTP_AUTHED_IDLE;
+
+	if (result != RET_QUEUE_EMPTY)
+	    return;
+
+	if (cxn->issue_quit) {
+	    lmtp_IssueQuit(cxn);
+	    return;
+	}
+
+	d_printf(1,"%s:%d stalled waiting for articles\n",
+		 hostPeerName (cxn->myHost),cxn->ident);
+	if ((QueueItems(&(cxn->lmtp_todeliver_q)) == 0) &&
+	    (QueueItems(&(cxn->imap_controlMsg_q)) == 0)) {
+	    if (hostGimmeArticle (cxn->myHost,cxn)==true)
+		goto retry;
+	}
+
+	return;
+    }
+
+    d_printf(1,"%s:%d:LMTP pipelining %d message(s), %d in flight\n",
+	     hostPeerName (cxn->myHost), cxn->ident, n,
+	     QueueItems(&(cxn->lmtp_inflight_q)));
+
+    /* set up the write timer. */
+    clearTimer (cxn->lmtp_writeBlockedTimerId) ;
+
+    if (cxn->lmtp_writeTimeout > 0)
+	cxn->lmtp_writeBlockedTimerId = prepareSleep (lmtp_writeTimeoutCbk,
+						      cxn->lmtp_writeTimeout,
+						      cxn) ;
+
+    cxn->lmtp_state = LMTP_PIPELINING;
+    cxn->lmtp_writing = true;
+    WriteToWire(cxn, lmtp_writeCB, cxn->lmtp_endpoint, writeArr);
+}
+
+/*
+ *
+ * Pulls a message off the queue and trys to start sending it. If the
+ * message is a control message put it in the control queue and grab
+ * another message. If the message doesn't exist on disk or something
+ * is wrong with it tell the host and try again. If we run out of
+ * messages to get tell the host we want more
+ *
+ * If the server supports CHUNKING, messages are pipelined instead (see
+ * lmtp_sendpipeline).
+ *
+ * cxn       - connection object
+ * justadded - the article that was just added to the queue
+ */
+
+static void lmtp_sendmessage(connection_t *cxn, Article justadded)
+{
+    conn_ret result;
+    char *p;
+    Buffer *bufs;
+
+    article_queue_t *item;
+    char *rcpt_list, *rcpt_list_end;
+
+    if (cxn->lmtp_capabilities != NULL && cxn->lmtp_capabilities->chunking
+	&& deliver_window > 1) {
+	lmtp_sendpipeline(cxn, justadded);
+	return;
+    }
+
+    /* retry point */
+ retry:
+
+    /* pull an article off the queue */
+    result = lmtp_popmessage(cxn, justadded, &item, &bufs);
+
+    if (result == RET_QUEUE_EMPTY)
+    {
+	if (cxn->issue_quit) {
+	    lmtp_IssueQuit(cxn);
+	    return;
+	}
+	/* now we wait for articles from our Host, or we have some
+	   articles already. On infrequently used connections, the
+	   network link is torn down and rebuilt as needed. So we may
+	   be rebuilding the connection here in which case we have an
+	   article to send. */
+
+	/* make sure imap has space too */
+	d_printf(1,"%s:%d stalled waiting for articles\n",
+		 hostPeerName (cxn->myHost),cxn->ident);
+	if ((QueueItems(&(cxn->lmtp_todeliver_q)) == 0) &&
+	    (QueueItems(&(cxn->imap_controlMsg_q)) == 0)) {
+	    if (hostGimmeArticle (cxn->myHost,cxn)==true)
+		goto retry;
+	}
+
+	return;
+    }
+
+    if (result != RET_OK)
+	return;
+
     if (cxn->current_bufs != NULL) {
 	/*	freeBufferArray(cxn->current_bufs); */
 	cxn->current_bufs = NULL;
@@ -4475,6 +4907,7 @@ static bool ProcessArticle(Connection cxn, Article art, bool must)
 	    break;
 
 	case LMTP_AUTHED_IDLE:
+	case LMTP_PIPELINING:
 	    lmtp_sendmessage(cxn,art);
 	    break;
 	default:
@@ -4601,6 +5034,46 @@ void gPrintCxnInfo (FILE *fp, unsigned int indentAmt)
   fprintf (fp,"%s}\n",indent) ;
 }
 
+/*
+ * Add the state and delivery counters of all connections to the metrics
+ * returned on the metrics socket.
+ */
+void gCxnMetrics (struct buffer *out)
+{
+  Connection cxn ;
+  const char *peer ;
+  char ident [20] ;
+
+  metrics_family (out, "innfeed_connection", "info",
+                  "State of the connection.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      peer = hostPeerName (cxn->myHost) ;
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_info", 1,
+                      "peer", peer, "connection", ident, "protocol", "imap",
+                      "state", imap_stateToString (cxn->imap_state),
+                      (char *) NULL) ;
+      metrics_sample (out, "innfeed_connection_info", 1,
+                      "peer", peer, "connection", ident, "protocol", "lmtp",
+                      "state", lmtp_stateToString (cxn->lmtp_state),
+                      (char *) NULL) ;
+    }
+  metrics_family (out, "innfeed_connection_articles", "counter",
+                  "Articles delivered on the connection, by outcome.") ;
+  for (cxn = gCxnList ; cxn != NULL ; cxn = cxn->next)
+    {
+      peer = hostPeerName (cxn->myHost) ;
+      snprintf (ident, sizeof (ident), "%u", cxn->ident) ;
+      metrics_sample (out, "innfeed_connection_articles_total",
+                      cxn->lmtp_succeeded, "peer", peer, "connection", ident,
+                      "result", "accepted", (char *) NULL) ;
+      metrics_sample (out, "innfeed_connection_articles_total",
+                      cxn->lmtp_failed, "peer", peer, "connection", ident,
+                      "result", "rejected", (char *) NULL) ;
+    }
+}
+
 void printCxnInfo (Connection cxn, FILE *fp, unsigned int indentAmt)
 {
   char indent [INDENT_BUFFER_SIZE] ;
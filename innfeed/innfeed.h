@@ -36,6 +36,7 @@
 #define TAPE_CHECKPOINT_PERIOD 	30 		/* backlog-ckpt-period */
 #define TAPE_NEWFILE_PERIOD 	600 		/* backlog-newfile-period */
 #define TAPE_DISABLE		false		/* no-backlog */
+#define TAPE_BINARY		false		/* backlog-binary */
 
 /* in main.c */
 #define PID_FILE 		"innfeed.pid" 	/* [pathrun]/pid-file */
@@ -137,6 +138,14 @@
    Ensure it's a float. */
 #define FILTERVALUE 50.0
 
+/* dynamic-method 4 takes the CHECK round trip to show queueing at the
+   peer once it's RTT_INFLATION times the quickest seen on the connection,
+   and at least RTT_SLACK seconds more. Connections start streaming with
+   INIT_WINDOW CHECKs outstanding. */
+#define RTT_INFLATION 2.0
+#define RTT_SLACK 0.05
+#define INIT_WINDOW 4
+
 /* the maximum number of peers we'll handle (not connections) */
 #define MAX_HOSTS 100
 
@@ -12,9 +12,14 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <syslog.h>
+#include <sys/wait.h>
 #include <time.h>
 
+#include "inn/buffer.h"
+#include "inn/fdflag.h"
+#include "inn/feedring.h"
 #include "inn/libinn.h"
 #include "inn/messages.h"
 #include "inn/nntp.h"
@@ -29,6 +34,9 @@
 
 #define LISTENER_INPUT_BUFFER (1024 * 8) /* byte size of the input buffer */
 #define EOF_SLEEP_TIME 1	/* seconds to sleep when EOF on InputFile */
+#define MAX_SHARDS 64		/* most shard processes we'll fork */
+#define SHARD_QUEUE_SIZE (1024 * 16) /* initial size of a shard's queue */
+#define LISTENER_BATCH 256	/* most commands parsed before handling them */
 
 struct innlistener_s 
 {
@@ -40,19 +48,52 @@ struct innlistener_s
     bool dummyListener ;
     bool dynamicPeers ;
     TimeoutId inputEOFSleepId ;
+    struct feedring *ring ;     /* where innd puts commands, if set */
 
     InnListener next ;
 };
 
+  /* A process handling the peers that hash to it. The main process keeps
+     one of these for each, to queue the commands for it. */
+typedef struct shard_s
+{
+    pid_t pid ;
+    int fd ;                    /* write end of its standard input */
+    EndPoint ep ;               /* on fd, NULL once closed */
+    Buffer queue ;              /* commands waiting for the pending write */
+    bool writing ;              /* a write is pending on ep */
+    bool started ;              /* the current command was queued for it */
+    bool closing ;              /* close ep once the queue is written */
+} *Shard ;
+
 static unsigned int listenerCount = 0 ;
 static InnListener listenerList = NULL ;
 
 InnListener mainListener ;
 
+unsigned int shardCount = 0 ;
+int shardIndex = -1 ;
+static unsigned int configShards = 0 ;
+static Shard shards = NULL ;   /* only set in the main process */
+
 static FILE *droppedFp = NULL ;
 static long droppedCount = 0 ;
 static int droppedFileCount = 0 ;
 static char *dropArtFile = NULL ;
+
+  /* A command from innd that has been parsed but not handled yet. The
+     pointers are into the input buffer or the ring records. */
+struct command
+{
+    char *fileName ;
+    char *fileNameEnd ;
+    char *msgid ;
+    char *msgidEnd ;
+    char *endc ;
+} ;
+
+static struct command batch [LISTENER_BATCH] ;
+static unsigned int batchCount = 0 ;
 bool fastExit = false ;
 
 extern const char *pidFile ;
@@ -63,12 +104,23 @@ extern bool genHtml ;
 
 static void giveArticleToPeer (InnListener lis,
                                Article article, const char *peerName) ;
+static bool queueCommand (InnListener lis, char *cmd, char *endc) ;
+static void runBatch (InnListener lis) ;
+static bool drainRing (InnListener lis) ;
 static void newArticleCommand (EndPoint ep, IoStatus i,
                                Buffer *buffs, void *data) ;
 static void wakeUp (TimeoutId id, void *data) ;
 static void writeCheckPoint (int offsetAdjust) ;
 static void dropArticle (const char *peer, Article article) ;
 static void listenerCleanup (void) ;
+static unsigned int shardOf (const char *peerName) ;
+static void shardAppend (Shard s, const char *data, size_t len) ;
+static void shardAddPeer (const char *cmd, size_t cmdLen, const char *peer) ;
+static void shardEndCommand (void) ;
+static void shardFlush (Shard s) ;
+static void shardWriteDone (EndPoint ep, IoStatus i, Buffer *b, void *d) ;
+static void shardClosed (Shard s) ;
+static void shardsClose (void) ;
 
 static bool inited = false ;
 
@@ -86,6 +138,7 @@ InnListener newListener (EndPoint endp, bool isDummy, bool dynamicPeers)
 {
   InnListener l = xcalloc (1, sizeof(struct innlistener_s)) ;
   Buffer *readArray ;
+  const char *ringPath ;
 
   if (!inited)
     {
@@ -102,6 +155,15 @@ InnListener newListener (EndPoint endp, bool isDummy, bool dynamicPeers)
   l->dummyListener = isDummy ;
   l->dynamicPeers = dynamicPeers ;
 
+  /* innd tells the main process where the ring is, if it uses one. */
+  ringPath = getenv ("INN_FEEDRING") ;
+  if (!isDummy && shardIndex < 0 && InputFile == NULL && ringPath != NULL)
+    {
+      l->ring = feedring_open (ringPath, 0) ;
+      if (l->ring != NULL)
+        notice ("ME reading commands from %s", ringPath) ;
+    }
+
   addPointerFreedOnExit ((char *)bufferBase(l->inputBuffer)) ;
   addPointerFreedOnExit ((char *)l->myHosts) ;
   addPointerFreedOnExit ((char *)l) ;
@@ -215,6 +277,14 @@ void shutDown (InnListener l)
       delEndPoint (l->myep) ;
     }
   l->myep = NULL ;
+
+  /* the shards exit when they've read all we sent them, and we exit once
+     they all have. */
+  if (l == mainListener && shards != NULL)
+    {
+      shardsClose () ;
+      return ;
+    }
   
   for (i = 0, count = 0 ; i < l->hostLen ; i++)
     if (l->myHosts [i] != NULL) 
@@ -342,14 +412,112 @@ void openInputFile (void)
 }
 
 
-int listenerConfigLoadCbk (void *data UNUSED)
+int listenerConfigLoadCbk (void *data)
 {
-  int bval ;
+  FILE *fp = (FILE *) data ;
+  int rval = 1, bval ;
+  long iv ;
 
   if (getBool (topScope,"fast-exit",&bval,NO_INHERIT))
     fastExit = (bval ? true : false) ;
 
-  return 1 ;
+  if (getInteger (topScope,"shards",&iv,NO_INHERIT))
+    {
+      if (iv < 0 || iv > MAX_SHARDS)
+        {
+          rval = 0 ;
+          logOrPrint (LOG_ERR,fp,
+                      "ME config: value of %s (%ld) in %s must be between"
+                      " 0 and %d. Using 0","shards",iv,"global scope",
+                      MAX_SHARDS) ;
+          iv = 0 ;
+        }
+    }
+  else
+    iv = 0 ;
+
+  if (shardCount > 0 && (unsigned int) iv != shardCount)
+    logOrPrint (LOG_WARNING,fp,
+                "ME config: change of %s takes effect on restart","shards") ;
+  configShards = (unsigned int) iv ;
+
+  return rval ;
+}
+
+
+void listenerForkShards (void)
+{
+  unsigned int i, j ;
+  int fds [2] ;
+  pid_t pid ;
+
+  if (configShards < 2)
+    return ;
+
+  shards = xcalloc (configShards, sizeof (struct shard_s)) ;
+  shardCount = configShards ;
+
+  for (i = 0 ; i < shardCount ; i++)
+    {
+      if (pipe (fds) < 0)
+        sysdie ("ME fatal pipe") ;
+
+      if ((pid = fork ()) < 0)
+        sysdie ("ME fatal fork") ;
+      else if (pid == 0)
+        {                       /* child */
+          for (j = 0 ; j < i ; j++)
+            close (shards [j].fd) ;
+          free (shards) ;
+          shards = NULL ;
+
+          close (fds [1]) ;
+          if (dup2 (fds [0], 0) < 0)
+            sysdie ("ME fatal dup2") ;
+          close (fds [0]) ;
+
+          /* the main process reads the funnel file, if any */
+          InputFile = NULL ;
+          shardIndex = (int) i ;
+
+          notice ("ME shard %u of %u started", i, shardCount) ;
+          return ;
+        }
+
+      close (fds [0]) ;
+      shards [i].pid = pid ;
+      shards [i].fd = fds [1] ;
+    }
+
+  for (i = 0 ; i < shardCount ; i++)
+    {
+      if (!fdflag_nonblocking (shards [i].fd, true))
+        syswarn ("ME oserr nonblocking shard %u", i) ;
+      shards [i].ep = newEndPoint (shards [i].fd) ;
+      shards [i].queue = newBuffer (SHARD_QUEUE_SIZE) ;
+    }
+}
+
+
+bool listenerOwnsPeer (const char *peerName)
+{
+  if (shardCount == 0)
+    return true ;
+
+  return shardIndex >= 0 && shardOf (peerName) == (unsigned int) shardIndex ;
+}
+
+
+void listenerSignalShards (int sig)
+{
+  unsigned int i ;
+
+  if (shards == NULL)
+    return ;
+
+  for (i = 0 ; i < shardCount ; i++)
+    if (shards [i].ep != NULL && kill (shards [i].pid, sig) < 0)
+      syswarn ("ME oserr kill shard %u (%ld)", i, (long) shards [i].pid) ;
 }
 
 /**********************************************************************/
@@ -357,21 +525,199 @@ int listenerConfigLoadCbk (void *data UNUSED)
 /**********************************************************************/
 
 
+/* Parse one command from innd, terminated at endc, and add it to the
+   batch. The buffer is left as it was. Returns false if it is malformed,
+   after handling the earlier commands and shutting the listener down. */
+static bool queueCommand (InnListener lis, char *cmd, char *endc)
+{
+  struct command *c ;
+  char *msgid, *msgidEnd ;
+  char *fileName, *fileNameEnd ;
+
+  d_printf (2,"INN Command: %s\n", cmd) ;
+
+  /* pick out the leading string (the filename) */
+  if ((fileName = findNonBlankString (cmd,&fileNameEnd)) == NULL)
+    {
+      runBatch (lis) ;
+      warn ("ME source format bad, exiting: %s", cmd) ;
+      shutDown (lis) ;
+
+      return false ;
+    }
+  
+  *fileNameEnd = '\0' ;
+
+  /* now pick out the next string (the message id) */
+  if ((msgid = findNonBlankString (fileNameEnd + 1,&msgidEnd)) == NULL)
+    {
+      *fileNameEnd = ' ' ; /* to make syslog work properly */
+      runBatch (lis) ;
+      warn ("ME source format bad, exiting: %s", cmd) ;
+      shutDown (lis) ;
+
+      return false ;
+    }
+
+  *msgidEnd = '\0' ;
+  *fileNameEnd = ' ' ;
+
+  /* Check the message ID length */
+  if (strlen(msgid) > NNTP_MAXLEN_MSGID) {
+    warn ("ME message id exceeds limit of %d octets: %s",
+          NNTP_MAXLEN_MSGID, msgid) ;
+    *(msgidEnd+1) = '\0' ;
+  }
+  if (msgidEnd < endc)  /* don't run into the next command */
+    *msgidEnd = ' ' ;
+
+  /* Check if message ID starts with < and ends with > */
+  if (*msgid != '<' || *(msgidEnd-1) != '>') {
+    warn ("ME source format bad, exiting: %s", cmd) ;
+    *(msgidEnd+1) = '\0';
+  }
+
+  c = &batch [batchCount++] ;
+  c->fileName = fileName ;
+  c->fileNameEnd = fileNameEnd ;
+  c->msgid = msgid ;
+  c->msgidEnd = msgidEnd ;
+  c->endc = endc ;
+
+  if (batchCount == LISTENER_BATCH)
+    runBatch (lis) ;
+
+  return true ;
+}
+
+/* Handle the commands in the batch: create all their articles in one go
+   and give each to all the peers on the rest of its command line. The
+   shards do that for the main process. */
+static void runBatch (InnListener lis)
+{
+  static const char *fileNames [LISTENER_BATCH] ;
+  static const char *msgids [LISTENER_BATCH] ;
+  static Article articles [LISTENER_BATCH] ;
+  struct command *c ;
+  char *peer, *peerEnd ;
+  char *s;
+  unsigned int idx ;
+
+  if (batchCount == 0)
+    return ;
+
+  if (shards == NULL)
+    {
+      for (idx = 0 ; idx < batchCount ; idx++)
+        {
+          c = &batch [idx] ;
+          *c->fileNameEnd = '\0' ; /* for the benefit of newArticles() */
+          *c->msgidEnd = '\0' ;
+          fileNames [idx] = c->fileName ;
+          msgids [idx] = c->msgid ;
+        }
+
+      /* will return null for any whose file is missing */
+      newArticles (fileNames, msgids, batchCount, articles) ;
+
+      for (idx = 0 ; idx < batchCount ; idx++)
+        {
+          *batch [idx].fileNameEnd = ' ' ;
+          if (batch [idx].msgidEnd < batch [idx].endc)
+            *batch [idx].msgidEnd = ' ' ;
+        }
+    }
+  else
+    for (idx = 0 ; idx < batchCount ; idx++)
+      articles [idx] = NULL ;
+
+  for (idx = 0 ; idx < batchCount ; idx++)
+    {
+      c = &batch [idx] ;
+
+      /* now get all the peernames off the rest of the command lines */
+      peerEnd = c->msgidEnd ;
+      if (peerEnd < c->endc)
+        do 
+          {
+            *peerEnd = ' ' ;
+
+            /* pick out the next peer name */
+            if ((peer = findNonBlankString (peerEnd + 1,&peerEnd))==NULL)
+              break ;     /* even no peer names is OK. */ /* XXX REALLY? */
+
+            *peerEnd = '\0' ;
+          
+            /* See if this is a valid peername */
+            for(s = peer; *s; s++)
+              if (!isalnum((unsigned char) *s) && *s != '.' && *s != '-' && *s != '_')
+                break;
+            if (*s != 0) {
+                warn ("ME invalid peername %s", peer) ;
+                continue;
+            }
+            if (shards != NULL)
+              shardAddPeer (c->fileName, c->msgidEnd - c->fileName, peer) ;
+            else if (articles [idx] != NULL)
+              giveArticleToPeer (lis,articles [idx],peer) ;
+          }
+        while (peerEnd < c->endc) ;
+
+      if (shards != NULL)
+        shardEndCommand () ;
+
+      delArticle (articles [idx]) ;
+    }
+
+  batchCount = 0 ;
+}
+
+/* Handle the commands innd left in the ring, a batch at a time. Returns
+   false if one of them is malformed, after shutting the listener down. */
+static bool drainRing (InnListener lis)
+{
+  static struct buffer *records = NULL ;
+  size_t starts [LISTENER_BATCH + 1] ;
+  unsigned int count, idx ;
+
+  if (records == NULL)
+    records = buffer_new () ;
+  for (;;)
+    {
+      buffer_set (records, NULL, 0) ;
+      for (count = 0 ; count < LISTENER_BATCH ; count++)
+        {
+          starts [count] = records->left ;
+          if (!feedring_get (lis->ring, records))
+            break ;
+          buffer_append (records, "", 1) ;
+        }
+      starts [count] = records->left ;
+
+      /* the records can't move any more, so point into them */
+      for (idx = 0 ; idx < count ; idx++)
+        if (!queueCommand (lis, records->data + starts [idx],
+                           records->data + starts [idx + 1] - 1))
+          return false ;
+      runBatch (lis) ;
+
+      if (count < LISTENER_BATCH)
+        return true ;
+    }
+}
+
 /* EndPoint callback function for when the InnListener's fd is ready for
    reading. */
 static void newArticleCommand (EndPoint ep, IoStatus i,
                                Buffer *buffs, void *data)
 {
   InnListener lis = (InnListener) data ;
-  char *msgid, *msgidEnd ;
-  char *fileName, *fileNameEnd ;
-  char *peer, *peerEnd ;
   char *cmd, *endc ;
   char *bbase = bufferBase (buffs [0]) ;
   size_t blen = bufferDataSize (buffs [0]) ;
   Buffer *readArray ;
   static int checkPointCounter ;
-  char *s;
+  unsigned int idx ;
 
   ASSERT (ep == lis->myep) ;
 
@@ -445,7 +791,6 @@ static void newArticleCommand (EndPoint ep, IoStatus i,
       cmd = bbase ;
       while ((cmd < (bbase + blen)) && ((endc = strchr (cmd,'\n')) != NULL))
         {
-          Article article ;
           char *next = endc + 1;
 
           if (*next == '\r')
@@ -467,82 +812,17 @@ static void newArticleCommand (EndPoint ep, IoStatus i,
               return ;
             }
           
-          d_printf (2,"INN Command: %s\n", cmd) ;
-
-          /* pick out the leading string (the filename) */
-          if ((fileName = findNonBlankString (cmd,&fileNameEnd)) == NULL)
-            {
-              warn ("ME source format bad, exiting: %s", cmd) ;
-              shutDown (lis) ;
-
-              return ;
-            }
-          
-          *fileNameEnd = '\0' ; /* for the benefit of newArticle() */
+          /* a blank line only tells us to look at the ring */
+          if (*cmd != '\0' && !queueCommand (lis, cmd, endc))
+            return ;
 
-          /* now pick out the next string (the message id) */
-          if ((msgid = findNonBlankString (fileNameEnd + 1,&msgidEnd)) == NULL)
-            {
-              *fileNameEnd = ' ' ; /* to make syslog work properly */
-              warn ("ME source format bad, exiting: %s", cmd) ;
-              shutDown (lis) ;
-
-              return ;
-            }
-
-          *msgidEnd = '\0' ;    /* for the benefit of newArticle() */
-          
-          /* now create an article object and give it all the peers on the
-             rest of the command line. Will return null if file is missing. */
-          article = newArticle (fileName, msgid) ;
-          *fileNameEnd = ' ' ;
-
-          /* Check the message ID length */
-          if (strlen(msgid) > NNTP_MAXLEN_MSGID) {
-            warn ("ME message id exceeds limit of %d octets: %s",
-                  NNTP_MAXLEN_MSGID, msgid) ;
-            *(msgidEnd+1) = '\0' ;
-          }
-          *msgidEnd = ' ' ;
-
-          /* Check if message ID starts with < and ends with > */
-          if (*msgid != '<' || *(msgidEnd-1) != '>') {
-            warn ("ME source format bad, exiting: %s", cmd) ;
-            *(msgidEnd+1) = '\0';
-          }
-
-          /* now get all the peernames off the rest of the command lines */
-          peerEnd = msgidEnd ;
-          do 
-            {
-              *peerEnd = ' ' ;
-
-              /* pick out the next peer name */
-              if ((peer = findNonBlankString (peerEnd + 1,&peerEnd))==NULL)
-                break ;     /* even no peer names is OK. */ /* XXX REALLY? */
-
-              *peerEnd = '\0' ;
-              
-              /* See if this is a valid peername */
-              for(s = peer; *s; s++)
-                if (!isalnum((unsigned char) *s) && *s != '.' && *s != '-' && *s != '_')
-                  break;
-              if (*s != 0) {
-                  warn ("ME invalid peername %s", peer) ;
-                  continue;
-              }
-              if (article != NULL)
-                giveArticleToPeer (lis,article,peer) ;
-            }
-          while (peerEnd < endc) ;
-
-          delArticle (article) ;
-          
           cmd = next ;
 
 	  /* write a checkpoint marker if we've done another large chunk */
 	  if (InputFile && *InputFile && ++checkPointCounter == 1000)
 	    {
+	      runBatch (lis) ;
+
 	      /* adjust the seek pointer value by the current location
 		 within the input buffer */
 	      writeCheckPoint (blen - (cmd - bbase)) ;
@@ -551,6 +831,16 @@ static void newArticleCommand (EndPoint ep, IoStatus i,
 
         }
 
+      /* the commands must be handled before the buffer is reused */
+      runBatch (lis) ;
+
+      if (lis->ring != NULL && !drainRing (lis))
+        return ;
+
+      if (shards != NULL)
+        for (idx = 0 ; idx < shardCount ; idx++)
+          shardFlush (&shards [idx]) ;
+
       if (*cmd != '\0')         /* partial command left in buffer */
         {
           Buffer *bArr ;
@@ -778,3 +1068,165 @@ static void listenerCleanup (void)
   free (dropArtFile) ;
   dropArtFile = NULL ;
 }
+
+
+/* The shard handling the peer. */
+static unsigned int shardOf (const char *peerName)
+{
+  unsigned long hash = 2166136261UL ;   /* FNV-1a */
+  const unsigned char *p ;
+
+  for (p = (const unsigned char *) peerName ; *p != '\0' ; p++)
+    hash = ((hash ^ *p) * 16777619UL) & 0xffffffffUL ;
+
+  return (unsigned int) (hash % shardCount) ;
+}
+
+
+/* Add LEN bytes of DATA to the commands queued for the shard. */
+static void shardAppend (Shard s, const char *data, size_t len)
+{
+  size_t used = bufferDataSize (s->queue) ;
+  size_t size = bufferSize (s->queue) ;
+
+  if (used + len > size)
+    expandBuffer (s->queue, (len > size ? len : size)) ;
+
+  memcpy ((char *) bufferBase (s->queue) + used, data, len) ;
+  bufferIncrDataSize (s->queue, len) ;
+}
+
+
+/* Queue the current command, the CMDLEN bytes of filename and message-ID
+   at CMD, for the shard of PEER, with PEER. */
+static void shardAddPeer (const char *cmd, size_t cmdLen, const char *peer)
+{
+  Shard s = &shards [shardOf (peer)] ;
+
+  if (s->ep == NULL)
+    return ;
+
+  if (!s->started)
+    {
+      shardAppend (s, cmd, cmdLen) ;
+      s->started = true ;
+    }
+  shardAppend (s, " ", 1) ;
+  shardAppend (s, peer, strlen (peer)) ;
+}
+
+
+/* Finish the current command for the shards it was queued for. */
+static void shardEndCommand (void)
+{
+  unsigned int i ;
+
+  for (i = 0 ; i < shardCount ; i++)
+    if (shards [i].started)
+      {
+        shardAppend (&shards [i], "\n", 1) ;
+        shards [i].started = false ;
+      }
+}
+
+
+/* Start writing the queued commands to the shard, unless a write is
+   already pending, in which case they go once it's done. */
+static void shardFlush (Shard s)
+{
+  Buffer *buffs ;
+
+  if (s->writing || s->ep == NULL || bufferDataSize (s->queue) == 0)
+    return ;
+
+  buffs = makeBufferArray (s->queue, NULL) ;
+  s->queue = newBuffer (SHARD_QUEUE_SIZE) ;
+  s->writing = true ;
+
+  prepareWrite (s->ep, buffs, NULL, shardWriteDone, s) ;
+}
+
+
+/* EndPoint callback for when a write to a shard has finished. */
+static void shardWriteDone (EndPoint ep, IoStatus i, Buffer *b, void *d)
+{
+  Shard s = (Shard) d ;
+
+  freeBufferArray (b) ;
+  s->writing = false ;
+
+  if (i != IoDone)
+    {
+      errno = endPointErrno (ep) ;
+      syswarn ("ME shard %u write failed, exiting",
+               (unsigned int) (s - shards)) ;
+      bufferSetDataSize (s->queue, 0) ;
+      s->closing = true ;
+      shardClosed (s) ;
+      shutDown (mainListener) ;
+      return ;
+    }
+
+  shardFlush (s) ;
+  if (s->closing && !s->writing)
+    shardClosed (s) ;
+}
+
+
+/* Close the input of the shard, now it has got everything. Once all of
+   them are closed, wait for them to exit and then exit too. */
+static void shardClosed (Shard s)
+{
+  unsigned int i ;
+  int status ;
+  time_t now ;
+  char dateString [30] ;
+
+  if (s->ep != NULL)
+    delEndPoint (s->ep) ;
+  s->ep = NULL ;
+
+  for (i = 0 ; i < shardCount ; i++)
+    if (shards [i].ep != NULL)
+      return ;
+
+  for (i = 0 ; i < shardCount ; i++)
+    {
+      status = 0 ;
+      while (waitpid (shards [i].pid, &status, 0) < 0)
+        if (errno != EINTR)
+          break ;
+      if (WIFEXITED (status) && WEXITSTATUS (status) != 0)
+        warn ("ME shard %u exited with status %d", i, WEXITSTATUS (status)) ;
+      else if (WIFSIGNALED (status))
+        warn ("ME shard %u killed by signal %d", i, WTERMSIG (status)) ;
+    }
+
+  now = theTime () ;
+  timeToString (now, dateString, sizeof (dateString)) ;
+  notice ("ME finishing at %s", dateString) ;
+
+  unlinkPidFile () ;
+  exit (0) ;
+}
+
+
+/* Called when shutting down the main process: close the input of each
+   shard once what is queued for it has been written. */
+static void shardsClose (void)
+{
+  unsigned int i ;
+
+  for (i = 0 ; i < shardCount ; i++)
+    {
+      Shard s = &shards [i] ;
+
+      if (s->ep == NULL || s->closing)
+        continue ;
+
+      s->closing = true ;
+      shardFlush (s) ;
+      if (!s->writing)
+        shardClosed (s) ;
+    }
+}
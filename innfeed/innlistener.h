@@ -22,6 +22,12 @@
 
 extern InnListener mainListener ;
 
+/* When the peers are sharded over several processes, the number of them
+   (0 otherwise), and the index of the one we are (-1 in the main process,
+   which only hands the commands it reads to the shards). */
+extern unsigned int shardCount ;
+extern int shardIndex ;
+
 /* Initialization of the InnListener object. If it fails then returns
   NULL. ENDPOINT is the endpoint where the article info will come
   from. A dummy listener exists when processing backlog files and is
@@ -67,4 +73,16 @@ void closeDroppedArticleFile (void) ;
 
 void listenerLogStatus (FILE *fp) ;
 
+/* Fork the shard processes asked for by the shards key of the config
+   file, if any. Each of them returns with shardIndex set, reading the
+   commands for its peers from its standard input. The main process
+   returns with shardIndex -1 and sends the commands it reads to them. */
+void listenerForkShards (void) ;
+
+/* true if the peer is handled by this process. */
+bool listenerOwnsPeer (const char *peerName) ;
+
+/* Pass the signal on to the shard processes. */
+void listenerSignalShards (int sig) ;
+
 #endif /* innlistener_h__ */
@@ -67,6 +67,7 @@ char *deliver_password  = NULL;
 char *deliver_realm     = NULL;
 const char *deliver_rcpt_to   = "+%s";
 char *deliver_to_header = NULL;
+int deliver_window       = 10;
 
 /* imports */
 extern bool genHtml ;
@@ -119,6 +120,7 @@ int main (int argc, char **argv)
   char dateString [30] ;
   char *copt = NULL ;
   char *debugFile;
+  char *cpus;
   bool checkConfig = false ;
   bool val;
 
@@ -421,6 +423,11 @@ int main (int argc, char **argv)
       openfds++ ;
     }
 
+  /* split the peers among several processes if so configured. Backlog
+     files are processed by a single one. */
+  if (!talkToSelf)
+    listenerForkShards () ;
+
   if (chdir (newsspool) != 0)
     sysdie ("ME fatal chdir %s", newsspool) ;
 
@@ -441,6 +448,17 @@ int main (int argc, char **argv)
     if (setfdlimit (innconf->rlimitnofile) < 0)
       syswarn ("ME oserr setrlimit(RLIM_NOFILE,%ld)", innconf->rlimitnofile) ;
 
+  if (innconf->innfeedcpus != NULL)
+    {
+      if (!inn_setaffinity (innconf->innfeedcpus))
+        syswarn ("ME oserr sched_setaffinity(%s)", innconf->innfeedcpus) ;
+      else if ((cpus = inn_getaffinity ()) != NULL)
+        {
+          notice ("ME processors %s", cpus) ;
+          free (cpus) ;
+        }
+    }
+
   if (innconf->timer != 0)
     TMRinit (TMR_MAX) ;
 
@@ -555,13 +573,15 @@ static void sigquit (int sig UNUSED)
   sigterm (0) ;
 }
 
-static void sigint (int sig UNUSED)
+static void sigint (int sig)
 {
+  listenerSignalShards (sig) ;
   gprintinfo () ;
 }
 
-static void sighup (int sig UNUSED)
+static void sighup (int sig)
 {
+  listenerSignalShards (sig) ;
   notice ("ME reloading config file %s", configFile) ;
 
   if (!readConfig (configFile,NULL,false,loggingLevel > 0))
@@ -575,8 +595,9 @@ static void sighup (int sig UNUSED)
   openLogFile() ;
 }
 
-static void sigemt (int sig UNUSED)
+static void sigemt (int sig)
 {
+  listenerSignalShards (sig) ;
   gFlushTapes () ;
 }
 
@@ -603,6 +624,7 @@ static void sigchld (int sig UNUSED)
   /* SIGUSR1 increments logging level. SIGUSR2 decrements. */
 static void sigusr (int sig)
 {
+  listenerSignalShards (sig) ;
   if (sig == SIGUSR1) {
     loggingLevel++ ;
     notice ("ME increasing logging level to %d", loggingLevel) ;
@@ -739,7 +761,8 @@ static int mainConfigLoadCbk (void *data)
 
   /***************************************************/
   
-  if (getString (topScope,"input-file",&p,NO_INHERIT))
+  /* a shard reads what the main process sends it, not the funnel file */
+  if (shardIndex < 0 && getString (topScope,"input-file",&p,NO_INHERIT))
     {
       if (*p != '\0')
 	InputFile = concatpath(getTapeDirectory(), p);
@@ -817,6 +840,19 @@ static int mainConfigLoadCbk (void *data)
       /* don't need to free */
     }
 
+  if (getInteger (topScope,"deliver-window",&ival, NO_INHERIT))
+    {
+      if (ival < 1)
+        {
+          logOrPrint (LOG_ERR,fp,
+                      "ME config: value of %s (%ld) in %s cannot be less"
+                      " than 1. Using %ld", "deliver-window",
+                      ival,"global scope",1L);
+          ival = 1 ;
+        }
+      deliver_window = (int) ival ;
+    }
+
   
 
   return 1 ;
@@ -13,6 +13,12 @@
 **  checkpointing is handled entirely by the Tape class, but the checkpoint
 **  period needs to be set by some external user before the first tape is
 **  created.
+**
+**  Tapes are text files with a "filename msgid" line per article, or,
+**  when backlog-binary is set, binary files made of a small header and a
+**  record per article.  The header holds the checkpoint, which is updated
+**  in place, and the records are read through mmap.  Each file keeps the
+**  format it was created with, so both can be read whatever the setting.
 */
 
 #include "innfeed.h"
@@ -22,6 +28,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <stddef.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <syslog.h>
@@ -37,6 +44,7 @@ typedef struct dirent DIRENTRY ;
 #include "inn/innconf.h"
 #include "inn/messages.h"
 #include "inn/libinn.h"
+#include "portable/mmap.h"
 
 #include "article.h"
 #include "configfile.h"
@@ -56,6 +64,22 @@ typedef struct q_e_s
 } *QueueElem ;
 #endif
 
+/* A binary tape starts with this header. It's followed by a record per
+   article: the lengths of the filename (or token) and of the message ID,
+   as two uint16_t, then the two of them without terminating NULs. */
+#define TAPE_MAGIC "INNFTAPE"
+#define TAPE_VERSION 1
+
+struct tapeHeader
+{
+    char magic [8] ;            /* TAPE_MAGIC */
+    uint32_t version ;          /* TAPE_VERSION */
+    uint32_t size ;             /* of the header */
+    uint64_t readPos ;          /* offset of the first record not yet sent */
+};
+
+#define TAPE_RECORD_HEAD (2 * sizeof (uint16_t))
+
 /* The Tape class type. */
 struct tape_s
 {
@@ -77,6 +101,10 @@ struct tape_s
     FILE *inFp ;                /* input FILE */
     FILE *outFp ;               /* output FILE */
 
+    char *inMap ;               /* the input file if binary, mapped */
+    size_t inMapLen ;
+    bool outBinary ;            /* the output file is binary */
+
     time_t lastRotated ;        /* time files last got switched */
     bool checkNew ;             /* set bool when we need to check for
                                    hand-crafted file. */
@@ -124,6 +152,13 @@ static void flushTape (Tape tape) ;
 static void tapesSetCheckNew (void) ;
 static void initTape (Tape nt) ;
 static void tapeCleanup (void) ;
+static void closeInput (Tape tape) ;
+static bool openBinaryInput (Tape tape) ;
+static bool getBinaryRecord (Tape tape, char *buf, size_t size,
+                             char **filename, char **msgid) ;
+static void prepareOutputFormat (Tape tape) ;
+static void putBinaryRecord (Tape tape, const char *fname, const char *msgid) ;
+static void shrinkBinaryTape (Tape tape) ;
 
 
 
@@ -158,6 +193,9 @@ unsigned int tapeHighwater ;
 
 bool debugShrinking = false ;
 
+/* whether new tape files are binary. */
+static bool binaryBacklog = TAPE_BINARY ;
+
 extern bool talkToSelf ;        /* main.c */
 
 
@@ -284,6 +322,11 @@ int tapeConfigLoadCbk (void *data)
 
   if (getBool (topScope,"debug-shrinking",&bv,NO_INHERIT))
     debugShrinking = (bv ? true : false) ;
+
+  if (getBool (topScope,"backlog-binary",&bv,NO_INHERIT))
+    binaryBacklog = (bv ? true : false) ;
+  else
+    binaryBacklog = TAPE_BINARY ;
   
   return rval ;
 }
@@ -371,6 +414,10 @@ static void initTape (Tape nt)
   nt->inFp = NULL ;
   nt->outFp = NULL ;
 
+  nt->inMap = NULL ;
+  nt->inMapLen = 0 ;
+  nt->outBinary = false ;
+
   nt->lastRotated = 0 ;
   nt->checkNew = false ;
   
@@ -452,7 +499,7 @@ void tapeFlush (Tape tape)
   if (tape->inFp != NULL)
     {
       checkpointTape (tape) ;
-      fclose (tape->inFp) ;
+      closeInput (tape) ;
     }
 
   if (tape->outFp != NULL)
@@ -544,6 +591,10 @@ void printTapeInfo (Tape tape, FILE *fp, unsigned int indentAmt)
   fprintf (fp,"%s    peerName : %s\n",indent,tape->peerName) ;
   fprintf (fp,"%s    input-FILE : %p\n",indent, (void *) tape->inFp) ;
   fprintf (fp,"%s    output-FILE : %p\n",indent, (void *) tape->outFp) ;
+  fprintf (fp,"%s    input-binary : %s\n",indent,
+           boolToString (tape->inMap != NULL)) ;
+  fprintf (fp,"%s    output-binary : %s\n",indent,
+           boolToString (tape->outBinary)) ;
   fprintf (fp,"%s    output-limit : %ld\n",indent, tape->outputLowLimit) ;
 
 #if 0
@@ -587,7 +638,9 @@ void delTape (Tape tape)
   if (tape->outFp != NULL && fclose (tape->outFp) != 0)
     syswarn ("ME ioerr fclose %s", tape->outputFilename) ;
 
-  if (stat(tape->outputFilename, &st) == 0 && st.st_size == 0)
+  if (stat(tape->outputFilename, &st) == 0
+      && (st.st_size == 0
+          || (tape->outBinary && st.st_size == sizeof (struct tapeHeader))))
     {
       d_printf (1,"removing empty output tape: %s\n",tape->outputFilename) ;
       unlink (tape->outputFilename) ;
@@ -605,7 +658,7 @@ void delTape (Tape tape)
   if (tape->inFp != NULL)
     {
       checkpointTape (tape) ;
-      fclose (tape->inFp) ;
+      closeInput (tape) ;
     }
 
   unlockFile (tape->lockFilename) ;
@@ -641,14 +694,19 @@ void tapeTakeArticle (Tape tape, Article article)
 
   fname = artFileName (article) ;
   msgid = artMsgId (article) ;
-  fprintf (tape->outFp,"%s %s\n", fname, msgid);
-  /* I'd rather know where I am each time, and I don't trust all
-   * fprintf's to give me character counts.  Therefore, do not use:
-   *   tape->outputSize += (return value of the previous fprintf call);
-   * nor:
-   *   tape->outputSize = ftello (tape->outFp);
-   */
-  tape->outputSize += strlen(fname) + strlen(msgid) + 2 ; /* " " + "\n" */
+  if (tape->outBinary)
+    putBinaryRecord (tape, fname, msgid) ;
+  else
+    {
+      fprintf (tape->outFp,"%s %s\n", fname, msgid);
+      /* I'd rather know where I am each time, and I don't trust all
+       * fprintf's to give me character counts.  Therefore, do not use:
+       *   tape->outputSize += (return value of the previous fprintf call);
+       * nor:
+       *   tape->outputSize = ftello (tape->outFp);
+       */
+      tape->outputSize += strlen(fname) + strlen(msgid) + 2 ; /* " " + "\n" */
+    }
   
   delArticle (article) ;
 
@@ -668,7 +726,11 @@ void tapeTakeArticle (Tape tape, Article article)
   if (tape->outputHighLimit > 0 && tape->outputSize >= tape->outputHighLimit)
     {
       long oldSize = tape->outputSize ;
-      shrinkfile (tape->outFp,tape->outputLowLimit,tape->outputFilename,"a+");
+      if (tape->outBinary)
+        shrinkBinaryTape (tape) ;
+      else
+        shrinkfile (tape->outFp,tape->outputLowLimit,tape->outputFilename,
+                    "a+");
       tape->outputSize = ftello (tape->outFp) ;
       tape->lossage += oldSize - tape->outputSize ;
     }
@@ -694,21 +756,37 @@ Article getArticle (Tape tape)
     {
       tape->changed = true ;
       
-      if (fgets (line,sizeof (line), tape->inFp) == NULL)
+      if (tape->inMap != NULL)
+        {
+          if (getBinaryRecord (tape,line,sizeof (line),&filename,&msgid))
+            {
+              if (filename != NULL && msgid != NULL)
+                art = newArticle (filename, msgid) ;
+            }
+          else
+            {
+              closeInput (tape) ;
+
+              d_printf (1,"No more articles on tape %s\n",
+                        tape->inputFilename) ;
+
+              unlink (tape->inputFilename) ;
+
+              if ((now - tape->lastRotated) > rotatePeriod)
+                prepareFiles (tape) ; /* rotate files to try next. */
+            }
+        }
+      else if (fgets (line,sizeof (line), tape->inFp) == NULL)
         {
           if (ferror (tape->inFp))
             syswarn ("ME ioerr on tape file %s", tape->inputFilename) ;
           else if ( !feof (tape->inFp) )
             syswarn ("ME oserr fgets %s", tape->inputFilename) ;
           
-          if (fclose (tape->inFp) != 0)
-            syswarn ("ME ioerr fclose %s", tape->inputFilename) ;
+          closeInput (tape) ;
 
           d_printf (1,"No more articles on tape %s\n",tape->inputFilename) ;
 
-          tape->inFp = NULL ;
-          tape->scribbled = false ;
-
           unlink (tape->inputFilename) ;
 
           if ((now - tape->lastRotated) > rotatePeriod)
@@ -946,6 +1024,19 @@ static void checkpointTape (Tape tape)
       d_printf (1,"Not checkpointing unchanged tape: %s\n", tape->peerName) ;
       return ;
     }
+
+  /* a binary tape has room for the position in its header. */
+  if (tape->inMap != NULL)
+    {
+      uint64_t pos = (uint64_t) tape->tellpos ;
+
+      if (pwrite (fileno (tape->inFp), &pos, sizeof (pos),
+                  offsetof (struct tapeHeader, readPos)) != sizeof (pos))
+        syswarn ("ME oserr pwrite %s", tape->inputFilename) ;
+      else
+        tape->changed = false ;
+      return ;
+    }
   
   if ((tape->tellpos = ftello (tape->inFp)) < 0)
     {
@@ -1051,7 +1142,9 @@ static void prepareFiles (Tape tape)
   else
     {
       inpExists = (tape->inFp != NULL) ? true : false ; /* can this ever be true?? */
-      outExists = (tape->outFp != NULL && tape->outputSize > 0) ? true : false ;
+      outExists = (tape->outFp != NULL && tape->outputSize >
+                   (tape->outBinary ? (long) sizeof (struct tapeHeader) : 0))
+        ? true : false ;
     }
   
 
@@ -1093,6 +1186,10 @@ static void prepareFiles (Tape tape)
       
       if ((tape->inFp = fopen (tape->inputFilename,"r+")) == NULL)
         syswarn ("ME fopen %s", tape->inputFilename) ;
+      else if (openBinaryInput (tape))
+        {
+          /* nothing else to do */
+        }
       else
         {
           char buffer [64] ;
@@ -1182,6 +1279,7 @@ static void prepareFiles (Tape tape)
       fseeko (tape->outFp,0,SEEK_END) ;
       tape->outputSize = ftello (tape->outFp) ;
       tape->lossage = 0 ;
+      prepareOutputFormat (tape) ;
     }
 }
 
@@ -1265,6 +1363,286 @@ static void flushTape (Tape tape)
 #endif
 
 
+
+/* Close the input file, unmapping it if it was binary. */
+static void closeInput (Tape tape)
+{
+  if (tape->inMap != NULL)
+    {
+      munmap (tape->inMap, tape->inMapLen) ;
+      tape->inMap = NULL ;
+      tape->inMapLen = 0 ;
+    }
+
+  if (tape->inFp != NULL && fclose (tape->inFp) != 0)
+    syswarn ("ME ioerr fclose %s", tape->inputFilename) ;
+
+  tape->inFp = NULL ;
+  tape->scribbled = false ;
+}
+
+
+/* Check whether the freshly opened input file is a binary tape and if so
+   map it and pick up the checkpoint from its header. Returns false for a
+   text tape, with the file rewound. A binary tape that can't be used is
+   closed and removed, and true is returned. */
+static bool openBinaryInput (Tape tape)
+{
+  struct tapeHeader hdr ;
+  long flength ;
+  void *map ;
+
+  if (fread (&hdr, sizeof (hdr), 1, tape->inFp) != 1
+      || memcmp (hdr.magic, TAPE_MAGIC, sizeof (hdr.magic)) != 0)
+    {
+      clearerr (tape->inFp) ;
+      rewind (tape->inFp) ;
+      return false ;
+    }
+
+  flength = fileLength (fileno (tape->inFp)) ;
+  if (hdr.version != TAPE_VERSION || hdr.size < sizeof (hdr)
+      || (long) hdr.size > flength)
+    {
+      warn ("ME tape bad header: %s (version %lu)", tape->inputFilename,
+            (unsigned long) hdr.version) ;
+      closeInput (tape) ;
+      unlink (tape->inputFilename) ;
+      return true ;
+    }
+
+  if ((long) hdr.size == flength)
+    {
+      d_printf (1,"Empty input file: %s\n",tape->inputFilename) ;
+      closeInput (tape) ;
+      unlink (tape->inputFilename) ;
+      return true ;
+    }
+
+  map = mmap (NULL, flength, PROT_READ, MAP_SHARED, fileno (tape->inFp), 0) ;
+  if (map == MAP_FAILED)
+    {
+      syswarn ("ME oserr mmap %s", tape->inputFilename) ;
+      closeInput (tape) ;
+      return true ;
+    }
+  tape->inMap = map ;
+  tape->inMapLen = flength ;
+
+  if (hdr.readPos < hdr.size)
+    tape->tellpos = hdr.size ;
+  else if (hdr.readPos > (uint64_t) flength)
+    {
+      warn ("ME tape short: %s %ld %lu", tape->inputFilename,
+            flength, (unsigned long) hdr.readPos) ;
+      tape->tellpos = hdr.size ;
+    }
+  else
+    tape->tellpos = hdr.readPos ;
+
+  return true ;
+}
+
+
+/* Take the next record off a binary input tape, copying its fields into
+   BUF. Returns false when the tape is used up or ends in a truncated
+   record. The fields are set to NULL if the record isn't usable. */
+static bool getBinaryRecord (Tape tape, char *buf, size_t size,
+                             char **filename, char **msgid)
+{
+  uint16_t lens [2] ;
+  size_t left = tape->inMapLen - tape->tellpos ;
+  const char *rec = tape->inMap + tape->tellpos ;
+
+  *filename = *msgid = NULL ;
+
+  if (tape->tellpos >= (long) tape->inMapLen || left < TAPE_RECORD_HEAD)
+    return false ;
+
+  memcpy (lens, rec, sizeof (lens)) ;
+  if (left - TAPE_RECORD_HEAD < (size_t) lens [0] + lens [1])
+    {
+      warn ("ME tape truncated record in %s at %ld", tape->inputFilename,
+            tape->tellpos) ;
+      return false ;
+    }
+  tape->tellpos += TAPE_RECORD_HEAD + lens [0] + lens [1] ;
+
+  if (lens [0] == 0 || lens [1] < 2 || (size_t) lens [0] + lens [1] + 2 > size)
+    return true ;
+
+  rec += TAPE_RECORD_HEAD ;
+  memcpy (buf, rec, lens [0]) ;
+  buf [lens [0]] = '\0' ;
+  memcpy (buf + lens [0] + 1, rec + lens [0], lens [1]) ;
+  buf [lens [0] + 1 + lens [1]] = '\0' ;
+
+  if (buf [lens [0] + 1] != '<' || buf [lens [0] + lens [1]] != '>')
+    {
+      warn ("ME tape invalid messageID in %s: %s",
+            tape->inputFilename, buf + lens [0] + 1) ;
+      return true ;
+    }
+
+  *filename = buf ;
+  *msgid = buf + lens [0] + 1 ;
+
+  return true ;
+}
+
+
+/* Work out the format of the just opened output file. A new file gets the
+   configured one, an existing file keeps its own. */
+static void prepareOutputFormat (Tape tape)
+{
+  struct tapeHeader hdr ;
+
+  if (tape->outputSize == 0)
+    {
+      tape->outBinary = binaryBacklog ;
+      if (!tape->outBinary)
+        return ;
+
+      memset (&hdr, 0, sizeof (hdr)) ;
+      memcpy (hdr.magic, TAPE_MAGIC, sizeof (hdr.magic)) ;
+      hdr.version = TAPE_VERSION ;
+      hdr.size = sizeof (hdr) ;
+      hdr.readPos = sizeof (hdr) ;
+
+      if (fwrite (&hdr, sizeof (hdr), 1, tape->outFp) != 1)
+        syswarn ("ME ioerr fwrite %s", tape->outputFilename) ;
+      tape->outputSize = sizeof (hdr) ;
+      return ;
+    }
+
+  rewind (tape->outFp) ;
+  tape->outBinary =
+    (fread (&hdr, sizeof (hdr), 1, tape->outFp) == 1
+     && memcmp (hdr.magic, TAPE_MAGIC, sizeof (hdr.magic)) == 0) ;
+  clearerr (tape->outFp) ;
+  fseeko (tape->outFp, 0, SEEK_END) ;
+}
+
+
+/* Append a record to a binary output tape. */
+static void putBinaryRecord (Tape tape, const char *fname, const char *msgid)
+{
+  size_t flen = strlen (fname) ;
+  size_t mlen = strlen (msgid) ;
+  uint16_t lens [2] ;
+
+  if (flen > UINT16_MAX || mlen > UINT16_MAX)
+    {
+      warn ("ME tape record too long for %s: %s", tape->outputFilename,
+            msgid) ;
+      return ;
+    }
+  lens [0] = flen ;
+  lens [1] = mlen ;
+
+  if (fwrite (lens, sizeof (lens), 1, tape->outFp) != 1
+      || fwrite (fname, 1, flen, tape->outFp) != flen
+      || fwrite (msgid, 1, mlen, tape->outFp) != mlen)
+    syswarn ("ME ioerr fwrite %s", tape->outputFilename) ;
+
+  tape->outputSize += sizeof (lens) + flen + mlen ;
+}
+
+
+/* The binary counterpart of shrinkfile(): keep the newest records that fit
+   in the low limit, on a record boundary, behind a fresh header. */
+static void shrinkBinaryTape (Tape tape)
+{
+  struct tapeHeader hdr ;
+  uint16_t lens [2] ;
+  char buffer [BUFSIZ] ;
+  char *tmpname ;
+  FILE *tmpFp ;
+  long currlen, pos, size ;
+  size_t i ;
+  int fd ;
+
+  fflush (tape->outFp) ;
+  currlen = ftello (tape->outFp) ;
+  if (currlen <= tape->outputLowLimit)
+    return ;
+
+  /* hop over records until enough of the file is left behind. */
+  if (fseeko (tape->outFp, 0, SEEK_SET) != 0
+      || fread (&hdr, sizeof (hdr), 1, tape->outFp) != 1)
+    {
+      syswarn ("ME error reading shrinking file %s", tape->outputFilename) ;
+      fseeko (tape->outFp, currlen, SEEK_SET) ;
+      return ;
+    }
+  pos = hdr.size ;
+  while (pos < currlen - tape->outputLowLimit)
+    {
+      if (fseeko (tape->outFp, pos, SEEK_SET) != 0
+          || fread (lens, sizeof (lens), 1, tape->outFp) != 1)
+        {
+          pos = currlen ;
+          break ;
+        }
+      pos += sizeof (lens) + lens [0] + lens [1] ;
+    }
+  if (pos > currlen)
+    pos = currlen ;
+
+  tmpname = concat (tape->outputFilename, ".XXXXXX", (char *) 0) ;
+  if ((fd = mkstemp (tmpname)) < 0 || (tmpFp = fdopen (fd, "w")) == NULL)
+    {
+      syswarn ("ME error creating temp shrink file for %s",
+               tape->outputFilename) ;
+      if (fd >= 0)
+        {
+          close (fd) ;
+          unlink (tmpname) ;
+        }
+      fseeko (tape->outFp, currlen, SEEK_SET) ;
+      free (tmpname) ;
+      return ;
+    }
+
+  hdr.size = sizeof (hdr) ;
+  hdr.readPos = sizeof (hdr) ;
+  if (fwrite (&hdr, sizeof (hdr), 1, tmpFp) != 1)
+    logAndExit (1, "ME fwrite failed to temp shrink file %s: %s", tmpname,
+                strerror (errno)) ;
+
+  /* copy the tail of the shrinking file to the temp file. */
+  fseeko (tape->outFp, pos, SEEK_SET) ;
+  while ((i = fread (buffer, 1, sizeof (buffer), tape->outFp)) > 0)
+    if (fwrite (buffer, 1, i, tmpFp) != i)
+      logAndExit (1, "ME fwrite failed to temp shrink file %s: %s", tmpname,
+                  strerror (errno)) ;
+  if (ferror (tape->outFp))
+    logAndExit (1, "ME fread failed on file %s: %s", tape->outputFilename,
+                strerror (errno)) ;
+
+  if (fclose (tmpFp) != 0)
+    logAndExit (1, "ME fclose failed on temp shrink file %s: %s", tmpname,
+                strerror (errno)) ;
+
+  /* we're in the same directory so this is ok. */
+  if (rename (tmpname, tape->outputFilename) != 0)
+    logAndExit (1, "ME oserr rename %s, %s: %s", tmpname,
+                tape->outputFilename, strerror (errno)) ;
+
+  if (freopen (tape->outputFilename, "a+", tape->outFp) != tape->outFp)
+    logAndExit (1, "ME freopen on shrink file failed %s: %s",
+                tape->outputFilename, strerror (errno)) ;
+
+  fseeko (tape->outFp, 0, SEEK_END) ;
+  size = ftello (tape->outFp) ;
+
+  notice ("ME file %s shrunk from %ld to %ld", tape->outputFilename,
+          currlen, size) ;
+
+  free (tmpname) ;
+}
+
+
 static void tapeCleanup (void)
 {
   free (tapeDirectory) ;
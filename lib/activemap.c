@@ -0,0 +1,388 @@
+/*
+**  Shared table of newsgroup statistics.
+**
+**  See include/inn/activemap.h for the interface.  The file starts with a
+**  header, followed by an open-addressing hash of slots (its size is a power
+**  of two, at least twice the number of newsgroups so that probes stay
+**  short, and groups are placed with hash_lookup2 rather than hash_string
+**  whose results depend on the processor), followed by the nul-terminated
+**  newsgroup names that the slots point to.
+**
+**  Only the statistics in the slots ever change once a table is published.
+**  The sequence count in the header is odd while innd is updating them, so a
+**  reader copies a slot between two reads of the count and retries if it
+**  saw an odd count or if the count changed in the meantime.  This needs
+**  memory barriers on processors that reorder loads and stores; without a
+**  compiler providing them, only the ordering of volatile accesses is
+**  guaranteed, which is enough on the common processors that don't.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "inn/activemap.h"
+#include "inn/concat.h"
+#include "inn/hashtab.h"
+#include "inn/messages.h"
+#include "inn/libinn.h"
+
+#define ACTIVEMAP_MAGIC   0x494e4e41U
+#define ACTIVEMAP_VERSION 1
+
+#if defined(__GNUC__)
+# define activemap_barrier() __sync_synchronize()
+#else
+# define activemap_barrier() /* empty */
+#endif
+
+struct activemap_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int sequence;      /* Odd while innd is updating slots. */
+    unsigned int stale;         /* Set once the table has been replaced. */
+    unsigned long slots;        /* Size of the hash, a power of two. */
+    unsigned long namesize;     /* Size of the names area. */
+};
+
+struct activemap_slot {
+    unsigned long name;         /* Offset of the name plus one, 0 if free. */
+    int lo;
+    int hi;
+    int count;
+    int flag;
+};
+
+struct activemap {
+    char *path;
+    char *temp;                 /* Temporary file until published. */
+    void *base;
+    size_t size;
+    volatile struct activemap_header *header;
+    volatile struct activemap_slot *slots;
+    char *names;
+    unsigned long groups;       /* Writer only, number of groups added. */
+    size_t used;                /* Writer only, bytes used in names. */
+    unsigned long generation;   /* Reader only, number of tables mapped. */
+};
+
+
+/*
+**  Set the pointers into a mapped table.
+*/
+static void
+activemap_pointers(struct activemap *map)
+{
+    map->header = map->base;
+    map->slots = (void *) (map->header + 1);
+    map->names = (void *) (map->slots + map->header->slots);
+}
+
+
+/*
+**  Map the published table read-only, checking that it looks sane.  Returns
+**  false silently if there is no table.
+*/
+static bool
+activemap_map(struct activemap *map)
+{
+    int fd;
+    struct stat st;
+    const struct activemap_header *header;
+    size_t size;
+
+    map->base = NULL;
+    fd = open(map->path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            syswarn("cannot open %s", map->path);
+        return false;
+    }
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat %s", map->path);
+        close(fd);
+        return false;
+    }
+    if ((size_t) st.st_size < sizeof(struct activemap_header)) {
+        warn("%s is too short", map->path);
+        close(fd);
+        return false;
+    }
+    map->size = st.st_size;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map->base == MAP_FAILED) {
+        syswarn("cannot mmap %s", map->path);
+        map->base = NULL;
+        return false;
+    }
+    header = map->base;
+    size = sizeof(struct activemap_header)
+        + header->slots * sizeof(struct activemap_slot) + header->namesize;
+    if (header->magic != ACTIVEMAP_MAGIC
+        || header->version != ACTIVEMAP_VERSION || header->slots == 0
+        || (header->slots & (header->slots - 1)) != 0 || size != map->size
+        || header->namesize == 0
+        || ((char *) map->base)[map->size - 1] != '\0') {
+        warn("%s is invalid", map->path);
+        munmap(map->base, map->size);
+        map->base = NULL;
+        return false;
+    }
+    activemap_pointers(map);
+    map->generation++;
+    return true;
+}
+
+
+struct activemap *
+activemap_create(const char *path, unsigned long groups, size_t namesize)
+{
+    struct activemap *map;
+    unsigned long slots;
+    int fd;
+
+    for (slots = 16; slots < groups * 2; slots *= 2)
+        ;
+    if (namesize == 0)
+        namesize = 1;
+    map = xcalloc(1, sizeof(struct activemap));
+    map->path = xstrdup(path);
+    map->temp = concat(path, ".new", (char *) 0);
+    map->size = sizeof(struct activemap_header)
+        + slots * sizeof(struct activemap_slot) + namesize;
+    fd = open(map->temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        syswarn("cannot create %s", map->temp);
+        goto fail;
+    }
+    if (ftruncate(fd, map->size) < 0) {
+        syswarn("cannot extend %s", map->temp);
+        close(fd);
+        goto fail;
+    }
+    map->base = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    if (map->base == MAP_FAILED) {
+        syswarn("cannot mmap %s", map->temp);
+        map->base = NULL;
+        goto fail;
+    }
+    map->header = map->base;
+    map->header->magic = ACTIVEMAP_MAGIC;
+    map->header->version = ACTIVEMAP_VERSION;
+    map->header->slots = slots;
+    map->header->namesize = namesize;
+    activemap_pointers(map);
+    return map;
+
+fail:
+    unlink(map->temp);
+    free(map->temp);
+    free(map->path);
+    free(map);
+    return NULL;
+}
+
+
+long
+activemap_add(struct activemap *map, const char *group, int lo, int hi,
+              int count, int flag)
+{
+    size_t length;
+    unsigned long mask, i;
+
+    length = strlen(group) + 1;
+    mask = map->header->slots - 1;
+    if (map->groups + 1 >= map->header->slots
+        || map->used + length > map->header->namesize)
+        return -1;
+    for (i = hash_lookup2(group, length - 1, 0) & mask;
+         map->slots[i].name != 0; i = (i + 1) & mask)
+        ;
+    memcpy(map->names + map->used, group, length);
+    map->slots[i].name = map->used + 1;
+    map->slots[i].lo = lo;
+    map->slots[i].hi = hi;
+    map->slots[i].count = count;
+    map->slots[i].flag = flag;
+    map->used += length;
+    map->groups++;
+    return i;
+}
+
+
+bool
+activemap_publish(struct activemap *map)
+{
+    if (rename(map->temp, map->path) < 0) {
+        syswarn("cannot rename %s to %s", map->temp, map->path);
+        return false;
+    }
+    free(map->temp);
+    map->temp = NULL;
+    return true;
+}
+
+
+long
+activemap_find(struct activemap *map, const char *group)
+{
+    unsigned long mask, i, name;
+
+    mask = map->header->slots - 1;
+    for (i = hash_lookup2(group, strlen(group), 0) & mask;
+         (name = map->slots[i].name) != 0; i = (i + 1) & mask)
+        if (name <= map->header->namesize
+            && strcmp(map->names + name - 1, group) == 0)
+            return i;
+    return -1;
+}
+
+
+void
+activemap_get(struct activemap *map, long slot, int *lo, int *hi,
+              int *count)
+{
+    *lo = map->slots[slot].lo;
+    *hi = map->slots[slot].hi;
+    *count = map->slots[slot].count;
+}
+
+
+void
+activemap_set(struct activemap *map, long slot, int lo, int hi, int count)
+{
+    map->slots[slot].lo = lo;
+    map->slots[slot].hi = hi;
+    map->slots[slot].count = count;
+}
+
+
+void
+activemap_setflag(struct activemap *map, long slot, int flag)
+{
+    map->slots[slot].flag = flag;
+}
+
+
+void
+activemap_begin(struct activemap *map)
+{
+    map->header->sequence++;
+    activemap_barrier();
+}
+
+
+void
+activemap_end(struct activemap *map)
+{
+    activemap_barrier();
+    map->header->sequence++;
+}
+
+
+void
+activemap_retire(struct activemap *map)
+{
+    if (map->temp == NULL) {
+        map->header->stale = 1;
+        activemap_barrier();
+    }
+    munmap(map->base, map->size);
+    if (map->temp != NULL) {
+        unlink(map->temp);
+        free(map->temp);
+    }
+    free(map->path);
+    free(map);
+}
+
+
+struct activemap *
+activemap_open(const char *path)
+{
+    struct activemap *map;
+
+    map = xcalloc(1, sizeof(struct activemap));
+    map->path = xstrdup(path);
+    if (!activemap_map(map)) {
+        free(map->path);
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+
+bool
+activemap_lookup(struct activemap *map, const char *group, int *lo,
+                 int *hi, int *count, int *flag)
+{
+    volatile struct activemap_slot *slot;
+    unsigned int sequence;
+    long i;
+    int l, h, c;
+
+    if (activemap_refresh(map) == 0)
+        return false;
+    i = activemap_find(map, group);
+    if (i < 0)
+        return false;
+    slot = &map->slots[i];
+    for (;;) {
+        sequence = map->header->sequence;
+        activemap_barrier();
+        if ((sequence & 1) != 0)
+            continue;
+        l = slot->lo;
+        h = slot->hi;
+        c = slot->count;
+        activemap_barrier();
+        if (map->header->sequence == sequence)
+            break;
+    }
+    if (lo != NULL)
+        *lo = l;
+    if (hi != NULL)
+        *hi = h;
+    if (count != NULL)
+        *count = c;
+    if (flag != NULL)
+        *flag = slot->flag;
+    return true;
+}
+
+
+unsigned long
+activemap_refresh(struct activemap *map)
+{
+    if (map->base != NULL && map->header->stale) {
+        munmap(map->base, map->size);
+        map->base = NULL;
+    }
+    if (map->base == NULL && !activemap_map(map))
+        return 0;
+    return map->generation;
+}
+
+
+unsigned long
+activemap_slots(struct activemap *map)
+{
+    return (map->base != NULL) ? map->header->slots : 0;
+}
+
+
+void
+activemap_free(struct activemap *map)
+{
+    if (map->base != NULL)
+        munmap(map->base, map->size);
+    free(map->path);
+    free(map);
+}
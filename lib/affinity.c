@@ -0,0 +1,134 @@
+/*
+**  Bind a process to some processors.
+**
+**  The daemons can be restricted to some processors with the *cpus
+**  parameters in inn.conf, which take a list of processor numbers and
+**  ranges like "0-3,8", as taskset -c does.  The threads and processes a
+**  daemon starts afterwards inherit the restriction.  On a machine with
+**  several NUMA nodes, binding a daemon to the processors of one node before
+**  it maps its large tables also keeps them in the memory of that node,
+**  since a page is allocated on the node of the processor which first
+**  touches it.
+**
+**  Only sched_setaffinity is supported; without it, inn_setaffinity fails
+**  with ENOSYS and inn_getaffinity returns NULL.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <ctype.h>
+#include <errno.h>
+#if HAVE_SCHED_SETAFFINITY
+# include <sched.h>
+#endif
+
+#include "inn/buffer.h"
+#include "inn/libinn.h"
+#include "inn/macros.h"
+#include "inn/xmalloc.h"
+
+#if HAVE_SCHED_SETAFFINITY
+
+/*
+**  Parse a list of processors into set.  Returns false on a syntax error or
+**  a processor number the set cannot hold.
+*/
+static bool
+parse_cpus(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+    char *end;
+    unsigned long first, last;
+
+    CPU_ZERO(set);
+    while (true) {
+        if (!isdigit((unsigned char) *p))
+            return false;
+        errno = 0;
+        first = strtoul(p, &end, 10);
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            if (!isdigit((unsigned char) *p))
+                return false;
+            last = strtoul(p, &end, 10);
+        }
+        if (errno != 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (; first <= last; first++)
+            CPU_SET(first, set);
+        if (*end == '\0')
+            return true;
+        if (*end != ',')
+            return false;
+        p = end + 1;
+    }
+}
+
+
+/*
+**  Restrict the calling process to the processors in list.  Returns false
+**  and sets errno to EINVAL if the list cannot be parsed, or to what
+**  sched_setaffinity set if the system refused it.
+*/
+bool
+inn_setaffinity(const char *list)
+{
+    cpu_set_t set;
+
+    if (!parse_cpus(list, &set)) {
+        errno = EINVAL;
+        return false;
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+
+/*
+**  Return the processors the calling process may run on, as a newly
+**  allocated list in the syntax inn_setaffinity takes, or NULL on failure.
+*/
+char *
+inn_getaffinity(void)
+{
+    cpu_set_t set;
+    struct buffer *list;
+    char *result;
+    int cpu, last;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        return NULL;
+    list = buffer_new();
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+        last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set))
+            last++;
+        buffer_append_sprintf(list, "%s%d", list->left > 0 ? "," : "", cpu);
+        if (last > cpu)
+            buffer_append_sprintf(list, "-%d", last);
+        cpu = last;
+    }
+    result = xstrndup(list->data, list->left);
+    buffer_free(list);
+    return result;
+}
+
+#else /* !HAVE_SCHED_SETAFFINITY */
+
+bool
+inn_setaffinity(const char *list UNUSED)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+char *
+inn_getaffinity(void)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+#endif /* !HAVE_SCHED_SETAFFINITY */
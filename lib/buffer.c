@@ -46,6 +46,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "inn/buffer.h"
 #include "inn/xmalloc.h"
@@ -321,3 +322,166 @@ buffer_read_file(struct buffer *buffer, int fd)
     buffer_resize(buffer, st.st_size + used);
     return buffer_read_all(buffer, fd);
 }
+
+
+/*
+ * Copy length bytes of data into a ring buffer at offset, wrapping around the
+ * end of the allocated memory.  The space must already be free.
+ */
+static void
+buffer_ring_copy(struct buffer *buffer, size_t offset, const char *data,
+                 size_t length)
+{
+    size_t first;
+
+    offset %= buffer->size;
+    first = buffer->size - offset;
+    if (first > length)
+        first = length;
+    memcpy(buffer->data + offset, data, first);
+    if (length > first)
+        memcpy(buffer->data, data + first, length - first);
+}
+
+
+/*
+ * Rearrange a ring buffer so that its data starts at the beginning of the
+ * allocated memory.  A ring that has not wrapped is just compacted; one that
+ * has goes through a temporary copy of its tail segment.
+ */
+void
+buffer_ring_linearize(struct buffer *buffer)
+{
+    size_t first;
+    char *tail;
+
+    if (buffer->used + buffer->left <= buffer->size) {
+        buffer_compact(buffer);
+        return;
+    }
+    first = buffer->size - buffer->used;
+    tail = xmalloc(first);
+    memcpy(tail, buffer->data + buffer->used, first);
+    memmove(buffer->data + first, buffer->data, buffer->left - first);
+    memcpy(buffer->data, tail, first);
+    free(tail);
+    buffer->used = 0;
+}
+
+
+/*
+ * Append data to a ring buffer.  An empty ring starts over at the beginning
+ * of the allocated memory, and a ring without enough free space is
+ * linearized and grown like an ordinary buffer.
+ */
+void
+buffer_ring_append(struct buffer *buffer, const char *data, size_t length)
+{
+    if (length == 0)
+        return;
+    if (buffer->left == 0)
+        buffer->used = 0;
+    if (buffer->size - buffer->left < length) {
+        buffer_ring_linearize(buffer);
+        buffer_resize(buffer, buffer->left + length);
+    }
+    buffer_ring_copy(buffer, buffer->used + buffer->left, data, length);
+    buffer->left += length;
+}
+
+
+/*
+ * Consume data from the front of a ring buffer.
+ */
+void
+buffer_ring_consume(struct buffer *buffer, size_t length)
+{
+    assert(length <= buffer->left);
+    buffer->left -= length;
+    if (buffer->left == 0)
+        buffer->used = 0;
+    else
+        buffer->used = (buffer->used + length) % buffer->size;
+}
+
+
+/*
+ * Describe the data of a ring buffer in at most two iovecs.
+ */
+int
+buffer_ring_iov(struct buffer *buffer, struct iovec *iov)
+{
+    size_t first;
+
+    if (buffer->left == 0)
+        return 0;
+    first = buffer->size - buffer->used;
+    iov[0].iov_base = buffer->data + buffer->used;
+    if (first >= buffer->left) {
+        iov[0].iov_len = buffer->left;
+        return 1;
+    }
+    iov[0].iov_len = first;
+    iov[1].iov_base = buffer->data;
+    iov[1].iov_len = buffer->left - first;
+    return 2;
+}
+
+
+/*
+ * Read into the free space of a ring buffer, which may be split in two
+ * around the data.
+ */
+ssize_t
+buffer_ring_read(struct buffer *buffer, int fd)
+{
+    struct iovec iov[2];
+    size_t start, first, space;
+    ssize_t count;
+    int n = 1;
+
+    if (buffer->left == 0)
+        buffer->used = 0;
+    if (buffer->left == buffer->size) {
+        buffer_ring_linearize(buffer);
+        buffer_resize(buffer, buffer->size + 1);
+    }
+    start = (buffer->used + buffer->left) % buffer->size;
+    space = buffer->size - buffer->left;
+    first = buffer->size - start;
+    iov[0].iov_base = buffer->data + start;
+    iov[0].iov_len = (first < space) ? first : space;
+    if (space > first) {
+        iov[1].iov_base = buffer->data;
+        iov[1].iov_len = space - first;
+        n = 2;
+    }
+    do {
+        count = readv(fd, iov, n);
+    } while (count == -1 && errno == EINTR);
+    if (count > 0)
+        buffer->left += count;
+    return count;
+}
+
+
+/*
+ * Write the data of a ring buffer and consume what the descriptor accepted.
+ */
+ssize_t
+buffer_ring_write(struct buffer *buffer, int fd)
+{
+    struct iovec iov[2];
+    ssize_t count;
+    int n;
+
+    n = buffer_ring_iov(buffer, iov);
+    if (n == 0)
+        return 0;
+    do {
+        count = writev(fd, iov, n);
+    } while (count == -1 && errno == EINTR);
+    if (count > 0)
+        buffer_ring_consume(buffer, count);
+    return count;
+}
@@ -57,6 +57,19 @@
 **  desirable to be a bit conservative because the overflow strategy tends to
 **  produce files with holes in them, which is a nuisance.)
 **  
+**  Since a history file often grows faster than planned, the database can
+**  also grow while it is in use, without a rebuild.  When the first table
+**  of the last "generation" of tables is full, dbzstore adds a new
+**  generation, stored after the existing ones in the same files and large
+**  enough to hold as many entries again as the whole database does.
+**  Existing entries are never moved; searches go through every generation
+**  in turn, each one being only as full as its first table was planned to
+**  be, and new entries always go into the last generation.  At most
+**  DBZ_MAXGEN generations are created, and the next rebuild (by expire or
+**  makedbz) sizes a single table for the whole history again.  A database
+**  with more than one generation has a version 7 .dir file, which older
+**  versions of dbz refuse to open rather than missing entries.
+**  
 **  Tagged hash + offset fuzzy technique merged by Sang-yong Suh (Nov, 1997)
 **  
 **  Fixed a bug handling larger than 1Gb history offset by Sang-yong Suh
@@ -101,6 +114,9 @@
  */
 
 static int dbzversion = 6;	/* for validating .dir file format */
+#ifndef	DO_TAGGED_HASH
+static int dbzgrownversion = 7;	/* .dir file format with generations */
+#endif
 
 #ifdef DO_TAGGED_HASH
 /* assume that for tagged hash, we don't want more than 4byte of_t even if
@@ -136,11 +152,11 @@ static int dbzversion = 6;	/* for validating .dir file format */
 #define BIAS(o)		((o)+1)		/* make any valid of_t non-VACANT */
 #define UNBIAS(o)	((o)-1)		/* reverse BIAS() effect */
 
-#define HASTAG(o)	((o)&taghere)
-#define TAG(o)		((o)&tagbits)
-#define NOTAG(o)	((o)&~tagboth)
-#define CANTAG(o)	(((o)&tagboth) == 0)
-#define MKTAG(v)	(((v)<<conf.tagshift)&tagbits)
+#define HASTAG(o)	((o)&db->taghere)
+#define TAG(o)		((o)&db->tagbits)
+#define NOTAG(o)	((o)&~db->tagboth)
+#define CANTAG(o)	(((o)&db->tagboth) == 0)
+#define MKTAG(v)	(((v)<<db->conf.tagshift)&db->tagbits)
 
 #ifndef NOTAGS
 #define TAGENB		0x80	/* tag enable is top bit, tag is next 7 */
@@ -158,11 +174,6 @@ static int dbzversion = 6;	/* for validating .dir file format */
  * buffer is so much larger that it is much more expensive to fill.
  */
 
-static of_t tagbits;		/* pre-shifted tag mask */
-static of_t taghere;		/* pre-shifted tag-enable bit */
-static of_t tagboth;		/* tagbits|taghere */
-static int canttag_warned;		/* flag to control can't tag warning */
-
 #endif	/* DO_TAGGED_HASH */
 
 /* Old dbz used a long as the record type for dbz entries, which became
@@ -201,6 +212,41 @@ static int canttag_warned;		/* flag to control can't tag warning */
 #endif
 #define	NUSEDS	(1+NMEMORY)
 
+/*
+ * Number of generations of tables the database can grow to before it has
+ * to be rebuilt, and alignment (in records) of the start of each
+ * generation, so that it can be mapped separately.
+ */
+#ifndef DBZ_MAXGEN
+#define DBZ_MAXGEN	8
+#endif
+#define GENALIGN	(64 * 1024)
+
+/*
+ * dbz_warmup reads the tables this much at a time, and reports its
+ * progress every so many bytes.
+ */
+#define DBZ_WARMUP_CHUNK	(1024 * 1024)
+#define DBZ_WARMUP_REPORT	(64 * 1024 * 1024)
+
+/*
+ * In-core tables backed by huge pages are rounded up to this size.  The
+ * hardware prefetch hint is used in search() and dbz_existsbatch() where
+ * the compiler has it.
+ */
+#define DBZ_HUGEPAGE	(2 * 1024 * 1024)
+#if defined(__GNUC__)
+# define dbz_prefetch(p)	__builtin_prefetch(p)
+#else
+# define dbz_prefetch(p)	/* empty */
+#endif
+
+typedef struct {
+    long base;			/* first record of this generation */
+    long size;			/* size of its first table */
+    long used;			/* entries stored in it */
+} dbzgen;
+
 typedef struct {
     long tsize;		        /* table size */
     long used[NUSEDS];          /* entries used today, yesterday, ... */
@@ -213,11 +259,12 @@ typedef struct {
     int tagshift;		/* shift count for tagmask and tagenb */
     int dropbits;		/* number of bits to discard from offset */
     int lenfuzzy;		/* num of fuzzy characters in offset */
+    int ngen;			/* number of generations */
+    dbzgen gen[DBZ_MAXGEN];	/* generation 0 is the original table */
 } dbzconfig;
-static dbzconfig conf;
 
 /*
- * Default dbzoptions to
+ * Default dbzoptions for the next database opened
  */
 static dbzoptions options = {
     false,		/* write through off */
@@ -227,7 +274,9 @@ static dbzoptions options = {
 #else
     INCORE_NO,		/* exists from disk. ignored in tagged hash mode */
 #endif
-    true		/* non-blocking writes */
+    true,		/* non-blocking writes */
+    false,		/* no filter */
+    false		/* no huge pages */
 };
 
 /*
@@ -235,6 +284,7 @@ static dbzoptions options = {
  */
 typedef struct {
     of_t place;		/* current location in file */
+    int gen;			/* which generation we're in */
     int tabno;		        /* which table we're in */
     int run;		        /* how long we'll stay in this table */
 #		ifndef MAXRUN
@@ -247,56 +297,91 @@ typedef struct {
     of_t tag;		/* tag we are looking for */
     int aborted;		/* has i/o error aborted search? */
 } searcher;
-#define	FRESH	((searcher *)NULL)
-
-/*
- * Arguably the searcher struct for a given routine ought to be local to
- * it, but a fetch() is very often immediately followed by a store(), and
- * in some circumstances it is a useful performance win to remember where
- * the fetch() completed.  So we use a global struct and remember whether
- * it is current.
- */
-static searcher srch;
-static searcher *prevp;	/* &srch or FRESH */
 
 /* Structure for hash tables */
 typedef struct {
     int fd;                     /* Non-blocking descriptor for writes */
-    off_t pos;                  /* Current offset into the table */
     int reclen;                 /* Length of records in the table */
     dbz_incore_val incore;      /* What we're using core for */
-    void *core;                 /* Pointer to in-core table */
+    void *core[DBZ_MAXGEN];     /* In-core first table of each generation */
+    size_t mapped[DBZ_MAXGEN];  /* Length of its anonymous mapping, if any */
 } hash_table;
 
-/* central data structures */
-static bool opendb = false;     /* Indicates if a database is currently open */
-static FILE *dirf;		/* descriptor for .dir file */
-static bool readonly;		/* database open read-only? */
+#ifndef	DO_TAGGED_HASH
+/*
+ * Bloom filter of the keys in the database, built when the database is
+ * opened for writing with the filter option and kept current by
+ * dbzstore.  FILTERBITS bits are used per slot of the first tables, so
+ * that even a full database has more than 10 bits per entry.
+ */
+#define FILTERBITS	8
+#define FILTERHASHES	7
+#define FILTERCHUNK	(64 * 1024)		/* records read at once */
+#define FILTERMAX	((size_t) 1 << 31)	/* largest filter, in bits */
+#endif
+
+/*
+ * An open database.  Searches keep their position in a searcher of their
+ * own, so lookups only read this structure, apart from dbz_refresh picking
+ * up the generations another process added.
+ */
+struct dbz {
+    dbzconfig conf;
+    dbzoptions options;
+    FILE *dirf;			/* descriptor for .dir file */
+    bool readonly;		/* database open read-only? */
 #ifdef	DO_TAGGED_HASH
-static FILE *basef;		/* descriptor for base file */
-static char *basefname;		/* name for not-yet-opened base file */
-static hash_table pagtab;       /* pag hash table, stores hash + offset */
+    FILE *basef;		/* descriptor for base file */
+    char *basefname;		/* name for not-yet-opened base file */
+    hash_table pagtab;		/* pag hash table, stores hash + offset */
+    of_t tagbits;		/* pre-shifted tag mask */
+    of_t taghere;		/* pre-shifted tag-enable bit */
+    of_t tagboth;		/* tagbits|taghere */
+    int canttag_warned;		/* flag to control can't tag warning */
 #else
-static hash_table idxtab;       /* index hash table, used for data retrieval */
-static hash_table etab;         /* existance hash table, used for existance checks */
+    hash_table idxtab;		/* index hash table, used for data retrieval */
+    hash_table etab;		/* existance hash table, used for existance
+				   checks */
+    unsigned char *filter;	/* the Bloom filter bits, or NULL if not used */
+    uint32_t filtermask;	/* number of bits - 1 */
+#endif
+    bool dirty;			/* has a store() been done? */
+    bool cantgrow;		/* has adding a generation failed? */
+};
+
+/* the database used by the dbzinit family of functions */
+static struct dbz *current = NULL;
+
+/* fill percentage of the last database opened, used by dbzsize */
+static int lastfill = 0;
+
+#ifndef	DO_TAGGED_HASH
+static const erec empty_rec;	/* empty rec to compare against */
 #endif
-static bool dirty;		/* has a store() been done? */
-static erec empty_rec;          /* empty rec to compare against
-				   initialized in dbzinit */
 
 /* misc. forwards */
-static bool getcore(hash_table *tab);
-static bool putcore(hash_table *tab);
+static bool getcore(struct dbz *db, hash_table *tab, int gen);
+static void dropcore(struct dbz *db, hash_table *tab, int gen);
+static bool putcore(struct dbz *db, hash_table *tab);
+static void *incore(const struct dbz *db, const hash_table *tab,
+		    const searcher *sp);
 static bool getconf(FILE *df, dbzconfig *cp);
 static int  putconf(FILE *f, dbzconfig *cp);
-static void start(searcher *sp, const HASH hash, searcher *osp);
+static void start(const struct dbz *db, searcher *sp, const HASH hash);
 #ifdef	DO_TAGGED_HASH
-static of_t search(searcher *sp);
-static bool set_pag(searcher *sp, of_t value);
+static of_t search(const struct dbz *db, searcher *sp);
+static bool set_pag(struct dbz *db, searcher *sp, of_t value);
 #else
-static bool search(searcher *sp);
+static bool search(const struct dbz *db, searcher *sp);
+#endif
+static bool set(struct dbz *db, searcher *sp, hash_table *tab, void *value);
+#ifndef	DO_TAGGED_HASH
+static bool grow(struct dbz *db);
+static bool makefilter(struct dbz *db);
+static void filterhash(const erec *key, uint32_t *h1, uint32_t *h2);
+static void filteradd(struct dbz *db, const erec *key);
+static bool filtercheck(const struct dbz *db, const erec *key);
 #endif
-static bool set(searcher *sp, hash_table *tab, void *value);
 
 /* file-naming stuff */
 static char dir[] = ".dir";
@@ -384,13 +469,13 @@ create_truncate(const char *name, const char *pag1)
     return true;
 }
 
-/* dbzfresh - set up a new database, no historical info
+/* freshfiles - write the files of a new database, no historical info
  * Return true for success, false for failure
- * name - base name; .dir and .pag must exist
+ * name - base name
  * size - table size (0 means default)
  */
-bool
-dbzfresh(const char *name, off_t size)
+static bool
+freshfiles(const char *name, off_t size)
 {
     char *fn;
     dbzconfig c;
@@ -400,10 +485,6 @@ dbzfresh(const char *name, off_t size)
     of_t m;
 #endif
 
-    if (opendb) {
-	warn("dbzfresh: database already open");
-	return false;
-    }
     if (size != 0 && size < 2) {
 	warn("dbzfresh: preposterous size (%ld)", (long) size);
 	return false;
@@ -465,9 +546,33 @@ dbzfresh(const char *name, off_t size)
     if (!create_truncate(name, exists))
 	return false;
 #endif	/* DO_TAGGED_HASH */
+    return true;
+}
 
-    /* and punt to dbzinit for the hard work */
-    return dbzinit(name);
+/* dbz_fresh - set up a new database, no historical info, and open it
+ * Returns the database, or NULL on failure
+ */
+struct dbz *
+dbz_fresh(const char *name, off_t size, const dbzoptions *o)
+{
+    if (!freshfiles(name, size))
+	return NULL;
+    return dbz_open(name, o);
+}
+
+/* dbzfresh - set up a new database, no historical info, and make it the
+ * open one
+ * Return true for success, false for failure
+ */
+bool
+dbzfresh(const char *name, off_t size)
+{
+    if (current != NULL) {
+	warn("dbzfresh: database already open");
+	return false;
+    }
+    current = dbz_fresh(name, size, &options);
+    return current != NULL;
 }
 
 #ifdef	DO_TAGGED_HASH
@@ -504,11 +609,12 @@ isprime(long x)
 #endif
 
 /*
- * dbzsize  - what's a good table size to hold this many entries?
+ * sizefor  - what's a good table size to hold this many entries, given the
+ *            fill percentage of a database?
  * contents - size of table (0 means return the default)
  */
-long
-dbzsize(off_t contents)
+static long
+sizefor(off_t contents, int fillpercent)
 {
     of_t            n;
 
@@ -517,8 +623,8 @@ dbzsize(off_t contents)
 	return DEFSIZE;
     }
 
-    if ((conf.fillpercent > 0) && (conf.fillpercent < 100))
-	n = (contents / conf.fillpercent) * 100;
+    if ((fillpercent > 0) && (fillpercent < 100))
+	n = (contents / fillpercent) * 100;
     else 
 	n = (contents * 3) / 2;	/* try to keep table at most 2/3's full */
 
@@ -538,13 +644,25 @@ dbzsize(off_t contents)
     return n;
 }
 
-/* dbzagain - set up a new database to be a rebuild of an old one
+/*
+ * dbzsize  - what's a good table size to hold this many entries in a
+ *            database like the last one opened?
+ * contents - size of table (0 means return the default)
+ */
+long
+dbzsize(off_t contents)
+{
+    return sizefor(contents, lastfill);
+}
+
+/* againfiles - write the files of a new database to be a rebuild of an
+ * old one
  * Returns true on success, false on failure
- * name - base name; .dir and .pag must exist
+ * name - base name
  * oldname - basename, all must exist
  */
-bool
-dbzagain(const char *name, const char *oldname)
+static bool
+againfiles(const char *name, const char *oldname)
 {
     char *fn;
     dbzconfig c;
@@ -559,11 +677,6 @@ dbzagain(const char *name, const char *oldname)
     struct stat sb;
 #endif
 
-    if (opendb) {
-	warn("dbzagain: database already open");
-	return false;
-    }
-
     /* pick up the old configuration */
     fn = concat(oldname, dir, (char *) 0);
     f = Fopen(fn, "r", TEMPORARYOPEN);
@@ -618,10 +731,14 @@ dbzagain(const char *name, const char *oldname)
     config_by_text_size(&c, vtop);
 #endif
 
-    newsize = dbzsize(top);
+    newsize = sizefor(top, c.fillpercent);
     if (!newtable || newsize > c.tsize)	/* don't shrink new table */
 	c.tsize = newsize;
 
+    /* the new database starts again with a single generation */
+    c.ngen = 1;
+    c.gen[0].used = 0;
+
     /* write it out */
     fn = concat(name, dir, (char *) 0);
     f = Fopen(fn, "w", TEMPORARYOPEN);
@@ -647,20 +764,46 @@ dbzagain(const char *name, const char *oldname)
     if (!create_truncate(name, exists))
 	return false;
 #endif
+    return true;
+}
+
+/* dbz_again - set up a new database to be a rebuild of an old one, and
+ * open it
+ * Returns the database, or NULL on failure
+ */
+struct dbz *
+dbz_again(const char *name, const char *oldname, const dbzoptions *o)
+{
+    if (!againfiles(name, oldname))
+	return NULL;
+    return dbz_open(name, o);
+}
 
-    /* and let dbzinit do the work */
-    return dbzinit(name);
+/* dbzagain - set up a new database to be a rebuild of an old one, and make
+ * it the open one
+ * Returns true on success, false on failure
+ */
+bool
+dbzagain(const char *name, const char *oldname)
+{
+    if (current != NULL) {
+	warn("dbzagain: database already open");
+	return false;
+    }
+    current = dbz_again(name, oldname, &options);
+    return current != NULL;
 }
 
 static bool
-openhashtable(const char *base, const char *ext, hash_table *tab,
-	      const size_t reclen, const dbz_incore_val incore)
+openhashtable(struct dbz *db, const char *base, const char *ext,
+	      hash_table *tab, const size_t reclen,
+	      const dbz_incore_val incore)
 {
     char *name;
-    int oerrno;
+    int oerrno, gen;
 
     name = concat(base, ext, (char *) 0);
-    if ((tab->fd = open(name, readonly ? O_RDONLY : O_RDWR)) < 0) {
+    if ((tab->fd = open(name, db->readonly ? O_RDONLY : O_RDWR)) < 0) {
 	syswarn("openhashtable: could not open raw");
         oerrno = errno;
 	free(name);
@@ -671,21 +814,28 @@ openhashtable(const char *base, const char *ext, hash_table *tab,
 
     tab->reclen = reclen;
     fdflag_close_exec(tab->fd, true);
-    tab->pos = -1;
 
-    /* get first table into core, if it looks desirable and feasible */
+    /* get first tables into core, if it looks desirable and feasible */
     tab->incore = incore;
+    for (gen = 0; gen < DBZ_MAXGEN; gen++) {
+	tab->core[gen] = NULL;
+	tab->mapped[gen] = 0;
+    }
     if (tab->incore != INCORE_NO) {
-	if (!getcore(tab)) {
-	    syswarn("openhashtable: getcore failure");
-            oerrno = errno;
-	    close(tab->fd);
-            errno = oerrno;
-	    return false;
+	for (gen = 0; gen < db->conf.ngen; gen++) {
+	    if (!getcore(db, tab, gen)) {
+		syswarn("openhashtable: getcore failure");
+		oerrno = errno;
+		while (--gen >= 0)
+		    dropcore(db, tab, gen);
+		close(tab->fd);
+		errno = oerrno;
+		return false;
+	    }
 	}
     }
 
-    if (options.nonblock && !fdflag_nonblocking(tab->fd, true)) {
+    if (db->options.nonblock && !fdflag_nonblocking(tab->fd, true)) {
 	syswarn("fcntl: could not set nonblock");
         oerrno = errno;
 	close(tab->fd);
@@ -695,192 +845,358 @@ openhashtable(const char *base, const char *ext, hash_table *tab,
     return true;
 }
 
-static void closehashtable(hash_table *tab) {
+static void closehashtable(struct dbz *db, hash_table *tab) {
+    int gen;
+
     close(tab->fd);
-    if (tab->incore == INCORE_MEM)
-	free(tab->core);
-    if (tab->incore == INCORE_MMAP) {
-#if defined(HAVE_MMAP)
-	if (munmap(tab->core, conf.tsize * tab->reclen) == -1) {
-	    syswarn("closehashtable: munmap failed");
-	}
-#else
-	warn("closehashtable: can't mmap files");
-#endif
-    }
+    for (gen = 0; gen < db->conf.ngen; gen++)
+	dropcore(db, tab, gen);
 }
 
 #ifdef	DO_TAGGED_HASH
 static bool
-openbasefile(const char *name)
+openbasefile(struct dbz *db, const char *name)
 {
-    basef = Fopen(name, "r", DBZ_BASE);
-    if (basef == NULL) {
+    db->basef = Fopen(name, "r", DBZ_BASE);
+    if (db->basef == NULL) {
 	syswarn("dbzinit: basefile open failed");
-        basefname = xstrdup(name);
+        db->basefname = xstrdup(name);
     } else
-	basefname = NULL;
-    if (basef != NULL)
-	fdflag_close_exec(fileno(basef), true);
-    if (basef != NULL)
-	 setvbuf(basef, NULL, _IOFBF, 64);
+	db->basefname = NULL;
+    if (db->basef != NULL)
+	fdflag_close_exec(fileno(db->basef), true);
+    if (db->basef != NULL)
+	 setvbuf(db->basef, NULL, _IOFBF, 64);
     return true;
 }
 #endif	/* DO_TAGGED_HASH */
 
 /*
- * dbzinit - open a database, creating it (using defaults) if necessary
+ * dbz_open - open a database with the given options
  *
  * We try to leave errno set plausibly, to the extent that underlying
- * functions permit this, since many people consult it if dbzinit() fails.
- * return true for success, false for failure
+ * functions permit this, since many people consult it if dbz_open() fails.
+ * Returns the database, or NULL on failure
  */
-bool
-dbzinit(const char *name)
+struct dbz *
+dbz_open(const char *name, const dbzoptions *o)
 {
+    struct dbz *db;
     char *fname;
+    int oerrno;
 
-    if (opendb) {
-	warn("dbzinit: dbzinit already called once");
-	errno = 0;
-	return false;
-    }
+    db = xcalloc(1, sizeof(struct dbz));
+    db->options = *o;
+#ifndef HAVE_MMAP
+    /* Without a working mmap on files, we should avoid it. */
+    if (db->options.pag_incore == INCORE_MMAP)
+	db->options.pag_incore = INCORE_NO;
+    if (db->options.exists_incore == INCORE_MMAP)
+	db->options.exists_incore = INCORE_NO;
+#endif
 
     /* open the .dir file */
     fname = concat(name, dir, (char *) 0);
-    if ((dirf = Fopen(fname, "r+", DBZ_DIR)) == NULL) {
-	dirf = Fopen(fname, "r", DBZ_DIR);
-	readonly = true;
+    if ((db->dirf = Fopen(fname, "r+", DBZ_DIR)) == NULL) {
+	db->dirf = Fopen(fname, "r", DBZ_DIR);
+	db->readonly = true;
     } else
-	readonly = false;
+	db->readonly = false;
     free(fname);
-    if (dirf == NULL) {
+    if (db->dirf == NULL) {
 	syswarn("dbzinit: can't open .dir file");
-	return false;
+	goto fail;
     }
-    fdflag_close_exec(fileno(dirf), true);
+    fdflag_close_exec(fileno(db->dirf), true);
 
     /* pick up configuration */
-    if (!getconf(dirf, &conf)) {
+    if (!getconf(db->dirf, &db->conf)) {
 	warn("dbzinit: getconf failure");
-	Fclose(dirf);
+	Fclose(db->dirf);
 	errno = EDOM;	/* kind of a kludge, but very portable */
-	return false;
+	goto fail;
     }
 
     /* open pag or idx/exists file */
 #ifdef	DO_TAGGED_HASH
-    if (!openhashtable(name, pag, &pagtab, SOF, options.pag_incore)) {
-	Fclose(dirf);
-	return false;
+    if (!openhashtable(db, name, pag, &db->pagtab, SOF,
+		       db->options.pag_incore)) {
+	Fclose(db->dirf);
+	goto fail;
     }
-    if (!openbasefile(name)) {
-	close(pagtab.fd);
-	Fclose(dirf);
-	return false;
+    if (!openbasefile(db, name)) {
+	close(db->pagtab.fd);
+	Fclose(db->dirf);
+	goto fail;
     }
-    tagbits = conf.tagmask << conf.tagshift;
-    taghere = conf.tagenb << conf.tagshift;
-    tagboth = tagbits | taghere;
-    canttag_warned = 0;
+    db->tagbits = db->conf.tagmask << db->conf.tagshift;
+    db->taghere = db->conf.tagenb << db->conf.tagshift;
+    db->tagboth = db->tagbits | db->taghere;
+    db->canttag_warned = 0;
 #else
-    if (!openhashtable(name, idx, &idxtab, sizeof(of_t), options.pag_incore)) {
-	Fclose(dirf);
-	return false;
+    if (!openhashtable(db, name, idx, &db->idxtab, sizeof(of_t),
+		       db->options.pag_incore)) {
+	Fclose(db->dirf);
+	goto fail;
     }
-    if (!openhashtable(name, exists, &etab, sizeof(erec),
-		options.exists_incore)) {
-	Fclose(dirf);
-	return false;
+    if (!openhashtable(db, name, exists, &db->etab, sizeof(erec),
+		       db->options.exists_incore)) {
+	closehashtable(db, &db->idxtab);
+	Fclose(db->dirf);
+	goto fail;
     }
+    db->filter = NULL;
+    if (db->options.filter && !db->readonly && !makefilter(db))
+	warn("dbzinit: can't build filter, not using it");
 #endif
 
     /* misc. setup */
-    dirty = false;
-    opendb = true;
-    prevp = FRESH;
-    memset(&empty_rec, '\0', sizeof(empty_rec));
+    db->dirty = false;
+    db->cantgrow = false;
+    lastfill = db->conf.fillpercent;
     debug("dbzinit: succeeded");
-    return true;
+    return db;
+
+fail:
+    oerrno = errno;
+    free(db);
+    errno = oerrno;
+    return NULL;
 }
 
-/* dbzclose - close a database
+/*
+ * dbzinit - open a database with the options set by dbzsetoptions and make
+ * it the open one
+ *
+ * return true for success, false for failure
  */
 bool
-dbzclose(void)
+dbzinit(const char *name)
 {
-    bool ret = true;
-
-    if (!opendb) {
-	warn("dbzclose: not opened!");
+    if (current != NULL) {
+	warn("dbzinit: dbzinit already called once");
+	errno = 0;
 	return false;
     }
+    current = dbz_open(name, &options);
+    return current != NULL;
+}
 
-    if (!dbzsync())
+/* dbz_close - close a database and free it
+ */
+bool
+dbz_close(struct dbz *db)
+{
+    bool ret = true;
+
+    if (!dbz_sync(db))
 	ret = false;
 
 #ifdef	DO_TAGGED_HASH
-    closehashtable(&pagtab);
-    if (Fclose(basef) == EOF) {
+    closehashtable(db, &db->pagtab);
+    if (db->basef != NULL && Fclose(db->basef) == EOF) {
         syswarn("dbzclose: fclose(basef) failed");
 	ret = false;
     }
-    if (basefname != NULL)
-	free(basefname);
-    basef = NULL;
+    if (db->basefname != NULL)
+	free(db->basefname);
 #else
-    closehashtable(&idxtab);
-    closehashtable(&etab);
+    closehashtable(db, &db->idxtab);
+    closehashtable(db, &db->etab);
+    free(db->filter);
 #endif
 
-    if (Fclose(dirf) == EOF) {
+    if (Fclose(db->dirf) == EOF) {
 	syswarn("dbzclose: fclose(dirf) failed");
 	ret = false;
     }
 
     debug("dbzclose: %s", (ret == true) ? "succeeded" : "failed");
-    if (ret)
-	opendb = false;
+    free(db);
     return ret;
 }
 
-/* dbzsync - push all in-core data out to disk
+/* dbzclose - close the open database
  */
 bool
-dbzsync(void)
+dbzclose(void)
 {
-    bool ret = true;
+    struct dbz *db = current;
 
-    if (!opendb) {
-	warn("dbzsync: not opened!");
+    if (db == NULL) {
+	warn("dbzclose: not opened!");
+	return false;
+    }
+    current = NULL;
+    return dbz_close(db);
+}
+
+/* dbzsave - set the open database aside, so that another one can be opened
+ * or restored; returns its state for dbzrestore, or NULL if no database is
+ * open
+ */
+dbzstate *
+dbzsave(void)
+{
+    dbzstate *state = current;
+
+    current = NULL;
+    return state;
+}
+
+/* dbzrestore - make a database set aside by dbzsave the open one again;
+ * fails if another database is open
+ */
+bool
+dbzrestore(dbzstate *state)
+{
+    if (current != NULL) {
+	warn("dbzrestore: a database is already open");
 	return false;
     }
+    current = state;
+    return true;
+}
 
-    if (!dirty)
-	return true;;
+/* dbz_sync - push all in-core data of a database out to disk
+ */
+bool
+dbz_sync(struct dbz *db)
+{
+    bool ret = true;
+
+    if (!db->dirty)
+	return true;
 
 #ifdef	DO_TAGGED_HASH
-    if (!putcore(&pagtab)) {
+    if (!putcore(db, &db->pagtab)) {
 #else
-    if (!putcore(&idxtab) || !putcore(&etab)) {
+    if (!putcore(db, &db->idxtab) || !putcore(db, &db->etab)) {
 #endif
 	warn("dbzsync: putcore failed");
-	ret = false;;
+	ret = false;
     }
 
-    if (putconf(dirf, &conf) < 0)
+    if (putconf(db->dirf, &db->conf) < 0)
 	ret = false;
 
     debug("dbzsync: %s", ret ? "succeeded" : "failed");
     return ret;
 }
 
+/* dbzsync - push all in-core data of the open database out to disk
+ */
+bool
+dbzsync(void)
+{
+    if (current == NULL) {
+	warn("dbzsync: not opened!");
+	return false;
+    }
+    return dbz_sync(current);
+}
+
+/* warmtable - read a table from its file from start to end in large
+ * chunks, so that lookups find its pages in memory, then lock its in-core
+ * copies in memory if asked to
+ *
+ * Returns false on error, or if progress asked to stop
+ */
+static bool
+warmtable(struct dbz *db, hash_table *tab, const char *what, bool lock,
+	  dbz_progress progress, void *cookie)
+{
+    struct stat st;
+    char *buf;
+    off_t done, report;
+    ssize_t nread;
+    int gen;
+    bool ret = true;
+
+    if (fstat(tab->fd, &st) < 0) {
+	syswarn("dbz: warmup: fstat of %s failed", what);
+	return false;
+    }
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(tab->fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    buf = xmalloc(DBZ_WARMUP_CHUNK);
+    report = DBZ_WARMUP_REPORT;
+    for (done = 0; done < st.st_size; done += nread) {
+	nread = pread(tab->fd, buf, DBZ_WARMUP_CHUNK, done);
+	if (nread <= 0) {
+	    if (nread < 0) {
+		syswarn("dbz: warmup: read of %s failed", what);
+		ret = false;
+	    }
+	    break;
+	}
+	if (progress != NULL && done + nread >= report
+	    && done + nread < st.st_size) {
+	    report = done + nread + DBZ_WARMUP_REPORT;
+	    if (!(*progress)(cookie, what, done + nread, st.st_size)) {
+		ret = false;
+		break;
+	    }
+	}
+    }
+    free(buf);
+    if (ret && progress != NULL
+	&& !(*progress)(cookie, what, done, st.st_size))
+	ret = false;
+
+#ifdef HAVE_MMAP
+    /* The pages are in the page cache by now, so this is quick. */
+    if (ret && lock && tab->incore != INCORE_NO) {
+	for (gen = 0; gen < db->conf.ngen; gen++) {
+	    if (tab->core[gen] == NULL)
+		continue;
+	    if (mlock(tab->core[gen], db->conf.gen[gen].size * tab->reclen)
+		< 0) {
+		syswarn("dbz: warmup: mlock of %s failed", what);
+		ret = false;
+		break;
+	    }
+	}
+    }
+#else
+    if (ret && lock && tab->incore != INCORE_NO)
+	warn("dbz: warmup: can't lock %s without mmap", what);
+#endif
+    return ret;
+}
+
+/* dbz_warmup - read the tables of a database into memory
+ */
+bool
+dbz_warmup(struct dbz *db, bool lock, dbz_progress progress, void *cookie)
+{
+#ifdef	DO_TAGGED_HASH
+    return warmtable(db, &db->pagtab, pag, lock, progress, cookie);
+#else
+    return warmtable(db, &db->etab, exists, lock, progress, cookie)
+	&& warmtable(db, &db->idxtab, idx, lock, progress, cookie);
+#endif
+}
+
+/* dbzwarmup - read the tables of the open database into memory
+ */
+bool
+dbzwarmup(bool lock, dbz_progress progress, void *cookie)
+{
+    if (current == NULL) {
+	warn("dbzwarmup: not opened!");
+	return false;
+    }
+    return dbz_warmup(current, lock, progress, cookie);
+}
+
 #ifdef	DO_TAGGED_HASH
 /*
  - okayvalue - check that a value can be stored
  */
 static int
-okayvalue(of_t value)
+okayvalue(const struct dbz *db, of_t value)
 {
     if (HASTAG(value))
         return(0);
@@ -890,36 +1206,144 @@ okayvalue(of_t value)
 }
 #endif
 
-/* dbzexists - check if the given message-id is in the database */
+/* dbz_exists - check if the given message-id is in a database */
 bool
-dbzexists(const HASH key)
+dbz_exists(struct dbz *db, const HASH key)
 {
 #ifdef	DO_TAGGED_HASH
     off_t value;
 
-    return (dbzfetch(key, &value) != 0);
+    return dbz_fetch(db, key, &value);
 #else
-    
-    if (!opendb) {
+    searcher srch;
+    erec evalue;
+
+    if (db->filter != NULL) {
+	memcpy(&evalue.hash, &key, sizeof(evalue.hash));
+	if (!filtercheck(db, &evalue))
+	    return false;
+    }
+    start(db, &srch, key);
+    return search(db, &srch);
+#endif
+}
+
+/* dbzexists - check if the given message-id is in the open database */
+bool
+dbzexists(const HASH key)
+{
+    if (current == NULL) {
 	warn("dbzexists: database not open!");
 	return false;
     }
+    if (dbz_exists(current, key))
+	return true;
+    if (current->readonly && dbz_refresh(current))
+	return dbz_exists(current, key);
+    return false;
+}
+
+#ifndef	DO_TAGGED_HASH
+/* Where a key of a batch is first probed, to sort the probes by place */
+struct probe {
+    long place;
+    size_t key;
+};
+
+static int
+probecmp(const void *a, const void *b)
+{
+    const struct probe *pa = a;
+    const struct probe *pb = b;
 
-    prevp = FRESH;
-    start(&srch, key, FRESH);
-    return search(&srch);
+    if (pa->place != pb->place)
+	return pa->place < pb->place ? -1 : 1;
+    return pa->key < pb->key ? -1 : (pa->key > pb->key);
+}
+#endif
+
+/* dbz_existsbatch - check whether each of count keys is in a database,
+ * setting found[i] for keys[i]
+ *
+ * The keys are searched in the order of the place where they are first
+ * probed, after asking the processor to load all these places, so that
+ * the memory accesses overlap and reads from the files go forward.
+ */
+void
+dbz_existsbatch(struct dbz *db, const HASH *keys, size_t count, bool *found)
+{
+#ifdef	DO_TAGGED_HASH
+    size_t i;
+
+    for (i = 0; i < count; i++)
+	found[i] = dbz_exists(db, keys[i]);
+#else
+    searcher *srch;
+    struct probe *probes;
+    const dbzgen *gen = &db->conf.gen[0];
+    erec evalue;
+    size_t i, n;
+
+    if (count == 0)
+	return;
+    srch = xmalloc(count * sizeof(searcher));
+    probes = xmalloc(count * sizeof(struct probe));
+    for (i = 0, n = 0; i < count; i++) {
+	found[i] = false;
+	if (db->filter != NULL) {
+	    memcpy(&evalue.hash, &keys[i], sizeof(evalue.hash));
+	    if (!filtercheck(db, &evalue))
+		continue;
+	}
+	start(db, &srch[i], keys[i]);
+	probes[n].place = srch[i].shorthash % gen->size;
+	probes[n].key = i;
+	if (db->etab.core[0] != NULL)
+	    dbz_prefetch((char *) db->etab.core[0]
+			 + probes[n].place * sizeof(erec));
+	n++;
+    }
+    qsort(probes, n, sizeof(struct probe), probecmp);
+    for (i = 0; i < n; i++)
+	found[probes[i].key] = search(db, &srch[probes[i].key]);
+    free(probes);
+    free(srch);
 #endif
 }
 
+/* dbzexistsbatch - check whether each of count keys is in the open
+ * database
+ */
+bool
+dbzexistsbatch(const HASH *keys, size_t count, bool *found)
+{
+    size_t i;
+
+    if (current == NULL) {
+	warn("dbzexistsbatch: database not open!");
+	return false;
+    }
+    dbz_existsbatch(current, keys, count, found);
+    for (i = 0; i < count; i++)
+	if (!found[i])
+	    break;
+    if (i < count && current->readonly && dbz_refresh(current))
+	for (; i < count; i++)
+	    if (!found[i])
+		found[i] = dbz_exists(current, keys[i]);
+    return true;
+}
+
 /*
- * dbzfetch - get offset of an entry from the database
+ * dbz_fetch - get offset of an entry from a database
  *
  * Returns the offset of the text file for input key,
  * or -1 if NOTFOUND or error occurs.
  */
 bool
-dbzfetch(const HASH key, off_t *value)
+dbz_fetch(struct dbz *db, const HASH key, off_t *value)
 {
+    searcher srch;
 #ifdef	DO_TAGGED_HASH
 #define	MAX_NB2RD	(DBZMAXKEY + MAXFUZZYLENGTH + 2)
 #define MIN_KEY_LENGTH	6	/* strlen("<1@a>") + strlen("\t") */
@@ -928,16 +1352,12 @@ dbzfetch(const HASH key, off_t *value)
     HASH hishash;
     char *keytext = NULL;
     of_t offset = NOTFOUND;
+#else
+    void *where;
+    erec evalue;
 #endif
 
-    prevp = FRESH;
-
-    if (!opendb) {
-	warn("dbzfetch: database not open!");
-	return false;
-    }
-
-    start(&srch, key, FRESH);
+    start(db, &srch, key);
 #ifdef	DO_TAGGED_HASH
     /*
      * nb2r: number of bytes to read from history file.
@@ -945,18 +1365,18 @@ dbzfetch(const HASH key, off_t *value)
      */
     nb2r = sizeof(buffer) - 1;
 
-    while ((offset = search(&srch)) != NOTFOUND) {
+    while ((offset = search(db, &srch)) != NOTFOUND) {
 	debug("got 0x%lx", offset);
 
 	/* fetch the key */
-	offset <<= conf.dropbits;
+	offset <<= db->conf.dropbits;
 	if (offset)		/* backspace 1 character to read '\n' */
 	    offset--;
-	if (fseeko(basef, offset, SEEK_SET) != 0) {
+	if (fseeko(db->basef, offset, SEEK_SET) != 0) {
 	    syswarn("dbzfetch: seek failed");
 	    return false;
 	}
-	keylen = fread(buffer, 1, nb2r, basef);
+	keylen = fread(buffer, 1, nb2r, db->basef);
 	if (keylen < MIN_KEY_LENGTH) {
 	    syswarn("dbzfetch: read failed");
 	    return false;
@@ -964,8 +1384,8 @@ dbzfetch(const HASH key, off_t *value)
 	buffer[keylen] = '\0';	/* terminate the string */
 
 	if (offset) {		/* find the '\n', the previous EOL */
-	    if (keylen > conf.lenfuzzy)
-		keylen = conf.lenfuzzy; /* keylen is fuzzy distance now */
+	    if (keylen > db->conf.lenfuzzy)
+		keylen = db->conf.lenfuzzy; /* keylen is fuzzy distance now */
 	    for (j=0,bp=buffer; j<keylen; j++,bp++)
 		if (*bp == '\n')
 		    break;
@@ -1007,18 +1427,23 @@ dbzfetch(const HASH key, off_t *value)
 
     /* we didn't find it */
     debug("fetch: failed");
-    prevp = &srch;			/* remember where we stopped */
     return false;
 #else	/* DO_TAGGED_HASH */
-    if (search(&srch) == true) {
+    if (db->filter != NULL) {
+	memcpy(&evalue.hash, &key, sizeof(evalue.hash));
+	if (!filtercheck(db, &evalue)) {
+	    debug("fetch: not in filter");
+	    return false;
+	}
+    }
+    if (search(db, &srch)) {
 	/* Actually get the data now */
-	if ((options.pag_incore != INCORE_NO) && (srch.place < conf.tsize)) {
-	    memcpy(value, &((of_t *)idxtab.core)[srch.place], sizeof(of_t));
+	if ((where = incore(db, &db->idxtab, &srch)) != NULL) {
+	    memcpy(value, where, sizeof(of_t));
 	} else {
-	    if (pread(idxtab.fd, value, sizeof(of_t), srch.place * idxtab.reclen) != sizeof(of_t)) {
+	    if (pread(db->idxtab.fd, value, sizeof(of_t),
+		      srch.place * db->idxtab.reclen) != sizeof(of_t)) {
 		syswarn("fetch: read failed");
-		idxtab.pos = -1;
-		srch.aborted = 1;
 		return false;
 	    }
 	}
@@ -1028,32 +1453,46 @@ dbzfetch(const HASH key, off_t *value)
 
     /* we didn't find it */
     debug("fetch: failed");
-    prevp = &srch;			/* remember where we stopped */
     return false;
 #endif
 }
 
 /*
- * dbzstore - add an entry to the database
+ * dbzfetch - get offset of an entry from the open database
+ */
+bool
+dbzfetch(const HASH key, off_t *value)
+{
+    if (current == NULL) {
+	warn("dbzfetch: database not open!");
+	return false;
+    }
+    if (dbz_fetch(current, key, value))
+	return true;
+    if (current->readonly && dbz_refresh(current))
+	return dbz_fetch(current, key, value);
+    return false;
+}
+
+/*
+ * dbz_store - add an entry to a database
  *
  * returns DBZSTORE_OK     for success
  *         DBZSTORE_EXISTS for existing entries (duplicates)
  *         DBZSTORE_ERROR  for other failure
  */
 DBZSTORE_RESULT
-dbzstore(const HASH key, off_t data)
+dbz_store(struct dbz *db, const HASH key, off_t data)
 {
+    searcher srch;
 #ifdef	DO_TAGGED_HASH
     of_t value;
 #else
     erec     evalue;
+    dbzgen   *last;
 #endif
 
-    if (!opendb) {
-	warn("dbzstore: database not open!");
-	return DBZSTORE_ERROR;
-    }
-    if (readonly) {
+    if (db->readonly) {
 	warn("dbzstore: database open read-only");
 	return DBZSTORE_ERROR;
     }
@@ -1063,54 +1502,201 @@ dbzstore(const HASH key, off_t data)
     memcpy(&value, &data, SOF);
 
     /* update maximum offset value if necessary */
-    if (value > conf.vused[0])
-	conf.vused[0] = value;
+    if (value > db->conf.vused[0])
+	db->conf.vused[0] = value;
 
     /* now value is in fuzzy format */
-    value >>= conf.dropbits;
+    value >>= db->conf.dropbits;
     debug("dbzstore: (%ld)", (long) value);
 
-    if (!okayvalue(value)) {
+    if (!okayvalue(db, value)) {
 	warn("dbzstore: reserved bit or overflow in 0x%lx", value);
 	return DBZSTORE_ERROR;
     }
 
-    /* find the place, exploiting previous search if possible */
-    start(&srch, key, prevp);
-    while (search(&srch) != NOTFOUND)
+    /* find the place */
+    start(db, &srch, key);
+    while (search(db, &srch) != NOTFOUND)
 	continue;
 
-    prevp = FRESH;
-    conf.used[0]++;
-    debug("store: used count %ld", conf.used[0]);
-    dirty = 1;
-    if (!set_pag(&srch, value))
+    db->conf.used[0]++;
+    debug("store: used count %ld", db->conf.used[0]);
+    db->dirty = 1;
+    if (!set_pag(db, &srch, value))
 	return DBZSTORE_ERROR;
     return DBZSTORE_OK;
 #else	/* DO_TAGGED_HASH */
 
-    /* find the place, exploiting previous search if possible */
-    start(&srch, key, prevp);
-    if (search(&srch) == true)
+    /* add a generation if the last one is full */
+    last = &db->conf.gen[db->conf.ngen - 1];
+    if (db->conf.ngen < DBZ_MAXGEN && !db->cantgrow
+	&& sizefor(last->used + 1, db->conf.fillpercent) > last->size) {
+	if (!grow(db))
+	    db->cantgrow = true;
+    }
+
+    /* find the place */
+    start(db, &srch, key);
+    if (search(db, &srch) == true)
 	return DBZSTORE_EXISTS;
 
-    prevp = FRESH;
-    conf.used[0]++;
-    debug("store: used count %ld", conf.used[0]);
-    dirty = true;
+    db->conf.used[0]++;
+    db->conf.gen[srch.gen].used++;
+    debug("store: used count %ld", db->conf.used[0]);
+    db->dirty = true;
 
     memcpy(&evalue.hash, &srch.hash,
 	   sizeof(evalue.hash) < sizeof(srch.hash) ? sizeof(evalue.hash) : sizeof(srch.hash));
 
     /* Set the value in the index first since we don't care if it's out of date */
-    if (!set(&srch, &idxtab, (void *)&data))
+    if (!set(db, &srch, &db->idxtab, (void *)&data))
 	return DBZSTORE_ERROR;
-    if (!set(&srch, &etab, &evalue))
+    if (!set(db, &srch, &db->etab, &evalue))
 	return DBZSTORE_ERROR;
+    if (db->filter != NULL)
+	filteradd(db, &evalue);
     return DBZSTORE_OK;
 #endif	/* DO_TAGGED_HASH */
 }
 
+#ifndef	DO_TAGGED_HASH
+/* An entry of a batch to store, with the place where it is first probed */
+struct pending {
+    long place;
+    size_t key;
+    HASH hash;
+    off_t data;
+};
+
+/* radixsort - sort count entries by place, keeping the order of the entries
+ * with the same place, using temp as room for another count entries
+ *
+ * Only as many bytes of the places as needed to hold max are looked at.
+ */
+static void
+radixsort(struct pending *entries, struct pending *temp, size_t count,
+	  long max)
+{
+    size_t counts[256];
+    size_t i, n, sum;
+    unsigned int shift;
+    struct pending *from = entries;
+    struct pending *to = temp;
+    struct pending *swap;
+
+    for (shift = 0; shift < sizeof(long) * 8 && (max >> shift) > 0;
+	 shift += 8) {
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < count; i++)
+	    counts[(from[i].place >> shift) & 0xff]++;
+	for (i = 0, sum = 0; i < 256; i++) {
+	    n = counts[i];
+	    counts[i] = sum;
+	    sum += n;
+	}
+	for (i = 0; i < count; i++)
+	    to[counts[(from[i].place >> shift) & 0xff]++] = from[i];
+	swap = from;
+	from = to;
+	to = swap;
+    }
+    if (from != entries)
+	memcpy(entries, from, count * sizeof(struct pending));
+}
+#endif
+
+/* dbz_storebatch - add count entries to a database, setting results[i]
+ * to what dbz_store returned for keys[i] and data[i]
+ *
+ * The entries are stored in the order of the place where they go, so that
+ * filling a large table goes through it once rather than at random.  Of
+ * several entries with the same key, the first one is stored.  Once a
+ * store fails, the remaining entries aren't stored and get DBZSTORE_ERROR.
+ */
+void
+dbz_storebatch(struct dbz *db, const HASH *keys, const off_t *data,
+	       size_t count, DBZSTORE_RESULT *results)
+{
+#ifdef	DO_TAGGED_HASH
+    size_t i;
+
+    for (i = 0; i < count; i++)
+	results[i] = dbz_store(db, keys[i], data[i]);
+#else
+    searcher srch;
+    struct pending *entries;
+    const dbzgen *last;
+    int ngen;
+    size_t i, j;
+
+    if (count == 0)
+	return;
+    entries = xmalloc(2 * count * sizeof(struct pending));
+    ngen = db->conf.ngen;
+    last = &db->conf.gen[ngen - 1];
+    for (i = 0; i < count; i++) {
+	start(db, &srch, keys[i]);
+	entries[i].place = srch.shorthash % last->size;
+	entries[i].key = i;
+	entries[i].hash = keys[i];
+	entries[i].data = data[i];
+    }
+    radixsort(entries, entries + count, count, last->size - 1);
+
+    for (i = 0; i < count; i++) {
+	/* Load the places of a later entry while storing this one, as long
+	   as the places are still those of the last generation, and where
+	   its result goes. */
+	j = i + 8;
+	if (j < count)
+	    dbz_prefetch(&results[entries[j].key]);
+	if (j < count && db->conf.ngen == ngen) {
+	    if (db->etab.core[ngen - 1] != NULL)
+		dbz_prefetch((char *) db->etab.core[ngen - 1]
+			     + entries[j].place * db->etab.reclen);
+	    if (db->idxtab.core[ngen - 1] != NULL)
+		dbz_prefetch((char *) db->idxtab.core[ngen - 1]
+			     + entries[j].place * db->idxtab.reclen);
+	}
+	results[entries[i].key] = dbz_store(db, entries[i].hash,
+					    entries[i].data);
+	if (results[entries[i].key] == DBZSTORE_ERROR) {
+	    for (i++; i < count; i++)
+		results[entries[i].key] = DBZSTORE_ERROR;
+	    break;
+	}
+    }
+    free(entries);
+#endif
+}
+
+/* dbzstorebatch - add count entries to the open database
+ */
+bool
+dbzstorebatch(const HASH *keys, const off_t *data, size_t count,
+	      DBZSTORE_RESULT *results)
+{
+    if (current == NULL) {
+	warn("dbzstorebatch: database not open!");
+	return false;
+    }
+    dbz_storebatch(current, keys, data, count, results);
+    return true;
+}
+
+/*
+ * dbzstore - add an entry to the open database
+ */
+DBZSTORE_RESULT
+dbzstore(const HASH key, off_t data)
+{
+    if (current == NULL) {
+	warn("dbzstore: database not open!");
+	return DBZSTORE_ERROR;
+    }
+    return dbz_store(current, key, data);
+}
+
 /*
  * getconf - get configuration from .dir file
  *   df    - NULL means just give me the default 
@@ -1121,6 +1707,14 @@ static bool
 getconf(FILE *df, dbzconfig *cp)
 {
     int		i;
+#ifndef	DO_TAGGED_HASH
+    int		version = 0;
+#endif
+
+    /* a single generation unless the .dir file says otherwise */
+    cp->ngen = 1;
+    cp->gen[0].base = 0;
+    cp->gen[0].used = 0;
 
     /* empty file, no configuration known */
 #ifdef	DO_TAGGED_HASH
@@ -1137,6 +1731,7 @@ getconf(FILE *df, dbzconfig *cp)
 	cp->tagshift = TAGSHIFT;
 	cp->dropbits = 0;
 	cp->lenfuzzy = 0;
+	cp->gen[0].size = cp->tsize;
 	debug("getconf: defaults (%ld, (0x%lx/0x%lx<<%d %d))",
               cp->tsize, cp->tagenb, cp->tagmask, cp->tagshift, cp->dropbits);
 	return true;
@@ -1162,13 +1757,19 @@ getconf(FILE *df, dbzconfig *cp)
 	    cp->used[i] = 0;
 	cp->valuesize = sizeof(of_t) + sizeof(erec);
 	cp->fillpercent = 66;
+	cp->gen[0].size = cp->tsize;
 	debug("getconf: defaults (%ld)", cp->tsize);
 	return true;
     }
 
-    i = fscanf(df, "dbz 6 %ld %d %d\n", &cp->tsize,
+    i = fscanf(df, "dbz %d %ld %d %d", &version, &cp->tsize,
 		&cp->valuesize, &cp->fillpercent);
-    if (i != 3) {
+    if (i == 4 && version == dbzgrownversion)
+	i += fscanf(df, "%d", &cp->ngen);
+    else if (version != dbzversion)
+	i = 0;
+    if (i != (version == dbzgrownversion ? 5 : 4)
+	|| cp->ngen < 1 || cp->ngen > DBZ_MAXGEN) {
         warn("dbz: bad first line in .dir history file");
 	return false;
     }
@@ -1177,6 +1778,7 @@ getconf(FILE *df, dbzconfig *cp)
 	return false;
     }
 #endif	/* DO_TAGGED_HASH */
+    cp->gen[0].size = cp->tsize;
     debug("size %ld", cp->tsize);
 
     /* second line, the usages */
@@ -1186,6 +1788,7 @@ getconf(FILE *df, dbzconfig *cp)
 	    return false;
 	}
     debug("used %ld %ld %ld...", cp->used[0], cp->used[1], cp->used[2]);
+    cp->gen[0].used = cp->used[0];
 
 #ifdef	DO_TAGGED_HASH
     /* third line, the text usages */
@@ -1195,6 +1798,18 @@ getconf(FILE *df, dbzconfig *cp)
 	    return false;
 	}
     debug("vused %ld %ld %ld...", cp->vused[0], cp->vused[1], cp->vused[2]);
+#else	/* DO_TAGGED_HASH */
+    /* fourth line, the generations after the first one */
+    for (i = 1; i < cp->ngen; i++) {
+	if (fscanf(df, "%ld %ld %ld", &cp->gen[i].base,
+		   &cp->gen[i].size, &cp->gen[i].used) != 3
+	    || cp->gen[i].base < cp->gen[i - 1].base + cp->gen[i - 1].size
+	    || cp->gen[i].size < 1) {
+            warn("dbz: bad generation in .dir history file");
+	    return false;
+	}
+	cp->gen[0].used -= cp->gen[i].used;
+    }
 #endif	/* DO_TAGGED_HASH */
 
     return true;
@@ -1219,8 +1834,12 @@ putconf(FILE *f, dbzconfig *cp)
 		cp->valuesize, cp->fillpercent, cp->tagenb,
 		cp->tagmask, cp->tagshift, cp->dropbits);
 #else	/* DO_TAGGED_HASH */
-    fprintf(f, "dbz %d %ld %d %d\n", dbzversion, cp->tsize,
-		   cp->valuesize, cp->fillpercent);
+    if (cp->ngen > 1)
+	fprintf(f, "dbz %d %ld %d %d %d\n", dbzgrownversion, cp->tsize,
+		cp->valuesize, cp->fillpercent, cp->ngen);
+    else
+	fprintf(f, "dbz %d %ld %d %d\n", dbzversion, cp->tsize,
+		cp->valuesize, cp->fillpercent);
 #endif	/* DO_TAGGED_HASH */
 
     for (i = 0; i < NUSEDS; i++)
@@ -1229,6 +1848,10 @@ putconf(FILE *f, dbzconfig *cp)
 #ifdef	DO_TAGGED_HASH
     for (i = 0; i < NUSEDS; i++)
 	fprintf(f, "%ld%c", cp->vused[i], (i < NUSEDS-1) ? ' ' : '\n');
+#else
+    for (i = 1; i < cp->ngen; i++)
+	fprintf(f, "%ld %ld %ld%c", cp->gen[i].base, cp->gen[i].size,
+		cp->gen[i].used, (i < cp->ngen-1) ? ' ' : '\n');
 #endif
 
     fflush(f);
@@ -1239,17 +1862,59 @@ putconf(FILE *f, dbzconfig *cp)
     return ret;
 }
 
-/* getcore - try to set up an in-core copy of file
+/* allocore - allocate memory for an in-core table, backed by huge pages
+ * if the hugepages option is set and the system supports them
  *
- * Returns: pointer to copy of file or NULL on errror
+ * Sets *mapped to the length of the anonymous mapping to unmap when done,
+ * or to 0 if the memory comes from malloc.
+ */
+static void *
+allocore(size_t length, bool hugepages, size_t *mapped)
+{
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+    void *it;
+    size_t size;
+
+    if (hugepages) {
+	size = (length + DBZ_HUGEPAGE - 1) & ~((size_t) DBZ_HUGEPAGE - 1);
+# ifdef MAP_HUGETLB
+	/* Huge pages reserved by the administrator, if there are enough. */
+	it = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (it != MAP_FAILED) {
+	    *mapped = size;
+	    return it;
+	}
+# endif
+	/* Otherwise transparent huge pages. */
+	it = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (it != MAP_FAILED) {
+# ifdef MADV_HUGEPAGE
+	    madvise(it, size, MADV_HUGEPAGE);
+# endif
+	    *mapped = size;
+	    return it;
+	}
+    }
+#endif
+    *mapped = 0;
+    return xmalloc(length);
+}
+
+/* getcore - try to set up an in-core copy of the first table of a
+ * generation
+ *
+ * Returns: true on success, false on error
  */
 static bool
-getcore(hash_table *tab)
+getcore(struct dbz *db, hash_table *tab, int gen)
 {
     char *it;
     ssize_t nread;
     size_t i;
-    size_t length = conf.tsize * tab->reclen;
+    size_t length = db->conf.gen[gen].size * tab->reclen;
+    off_t offset = (off_t) db->conf.gen[gen].base * tab->reclen;
 #ifdef HAVE_MMAP
     struct stat st;
 #endif
@@ -1260,15 +1925,15 @@ getcore(hash_table *tab)
 	    syswarn("dbz: getcore: fstat failed");
 	    return false;
 	}
-	if ((off_t) length > st.st_size) {
+	if (offset + (off_t) length > st.st_size) {
 	    /* file too small; extend it */
-	    if (ftruncate(tab->fd, length) == -1) {
+	    if (ftruncate(tab->fd, offset + length) == -1) {
 		syswarn("dbz: getcore: ftruncate failed");
 		return false;
 	    }
 	}
-	it = mmap(NULL, length, readonly ? PROT_READ : PROT_WRITE | PROT_READ,
-                  MAP_SHARED, tab->fd, 0);
+	it = mmap(NULL, length,
+		  db->readonly ? PROT_READ : PROT_WRITE | PROT_READ, MAP_SHARED, tab->fd, offset);
 	if (it == (char *)-1) {
 	    syswarn("dbz: getcore: mmap failed");
 	    return false;
@@ -1277,17 +1942,23 @@ getcore(hash_table *tab)
 	/* not present in all versions of mmap() */
 	madvise(it, length, MADV_RANDOM);
 #endif
+#ifdef MADV_HUGEPAGE
+	/* only honoured by some file systems */
+	if (db->options.hugepages)
+	    madvise(it, length, MADV_HUGEPAGE);
+#endif
 #else
 	warn("dbz: getcore: can't mmap files");
 	return false;
 #endif
     } else {
-	it = xmalloc(length);
+	it = allocore(length, db->options.hugepages, &tab->mapped[gen]);
 	
-	nread = read(tab->fd, it, length);
+	nread = pread(tab->fd, it, length, offset);
 	if (nread < 0) {
 	    syswarn("dbz: getcore: read failed");
-	    free(it);
+	    tab->core[gen] = it;
+	    dropcore(db, tab, gen);
 	    return false;
 	}
 	
@@ -1295,40 +1966,87 @@ getcore(hash_table *tab)
 	memset(it + nread, '\0', i);
     }
 
-    tab->core = it;
+    tab->core[gen] = it;
     return true;
 }
 
+/* dropcore - release the in-core copy of the first table of a generation
+ */
+static void
+dropcore(struct dbz *db, hash_table *tab, int gen)
+{
+    if (tab->core[gen] == NULL)
+	return;
+    if (tab->incore == INCORE_MEM) {
+#if defined(HAVE_MMAP)
+	if (tab->mapped[gen] != 0)
+	    munmap(tab->core[gen], tab->mapped[gen]);
+	else
+#endif
+	    free(tab->core[gen]);
+	tab->mapped[gen] = 0;
+    }
+    if (tab->incore == INCORE_MMAP) {
+#if defined(HAVE_MMAP)
+	if (munmap(tab->core[gen], db->conf.gen[gen].size * tab->reclen) == -1) {
+	    syswarn("dropcore: munmap failed");
+	}
+#else
+	warn("dropcore: can't mmap files");
+#endif
+    }
+    tab->core[gen] = NULL;
+}
+
 /* putcore - try to rewrite an in-core table
  *
  * Returns true on success, false on failure
  */
 static bool
-putcore(hash_table *tab)
+putcore(struct dbz *db, hash_table *tab)
 {
     size_t size;
     ssize_t result;
+    int gen;
     
     if (tab->incore == INCORE_MEM) {
-	if(options.writethrough)
+	if(db->options.writethrough)
 	    return true;
 	fdflag_nonblocking(tab->fd, false);
-	size = tab->reclen * conf.tsize;
-        result = xpwrite(tab->fd, tab->core, size, 0);
-	if (result < 0 || (size_t) result != size) {
-	    fdflag_nonblocking(tab->fd, options.nonblock);
-	    return false;
+	for (gen = 0; gen < db->conf.ngen; gen++) {
+	    size = tab->reclen * db->conf.gen[gen].size;
+	    result = xpwrite(tab->fd, tab->core[gen], size,
+			     (off_t) db->conf.gen[gen].base * tab->reclen);
+	    if (result < 0 || (size_t) result != size) {
+		fdflag_nonblocking(tab->fd, db->options.nonblock);
+		return false;
+	    }
 	}
-	fdflag_nonblocking(tab->fd, options.nonblock);
+	fdflag_nonblocking(tab->fd, db->options.nonblock);
     }
 #ifdef HAVE_MMAP
     if(tab->incore == INCORE_MMAP) {
-	msync(tab->core, conf.tsize * tab->reclen, MS_ASYNC);
+	for (gen = 0; gen < db->conf.ngen; gen++)
+	    msync(tab->core[gen], db->conf.gen[gen].size * tab->reclen, MS_ASYNC);
     }
 #endif
     return true;
 }
 
+/* incore - find the in-core copy of the record a search stopped at
+ *
+ * Returns a pointer into the in-core table, or NULL if the record has to
+ * be read from or written to the file
+ */
+static void *
+incore(const struct dbz *db, const hash_table *tab, const searcher *sp)
+{
+    if (tab->incore == INCORE_NO || sp->tabno != 0)
+	return NULL;
+    return (char *) tab->core[sp->gen]
+	+ (sp->place - db->conf.gen[sp->gen].base) * tab->reclen;
+}
+
 #ifdef	DO_TAGGED_HASH
 /*
  - makehash31 : make 31-bit hash from HASH
@@ -1342,52 +2060,34 @@ makehash31(const HASH *hash)
 }
 #endif
 
-/* start - set up to start or restart a search
- * osp == NULL is acceptable
+/* start - set up to start a search
  */
 static void
-start(searcher *sp, const HASH hash, searcher *osp)
+start(const struct dbz *db, searcher *sp, const HASH hash)
 {
 #ifdef	DO_TAGGED_HASH
     unsigned int	h;
 
     h = makehash31(&hash);
-    if (osp != FRESH && osp->shorthash == h) {
-	if (sp != osp)
-	    *sp = *osp;
-	sp->run--;
-	debug("search restarted");
-    } else {
-	sp->shorthash = h;
-	sp->tag = MKTAG(h / conf.tsize);
-	sp->place = h % conf.tsize;
-	debug("hash %8.8lx tag %8.8lx place %ld",
-              sp->shorthash, sp->tag, sp->place);
-	sp->tabno = 0;
-	sp->run = -1;
-	sp->aborted = 0;
-    }
-
+    sp->shorthash = h;
+    sp->tag = MKTAG(h / db->conf.tsize);
+    sp->place = h % db->conf.tsize;
+    debug("hash %8.8lx tag %8.8lx place %ld",
+	  sp->shorthash, sp->tag, sp->place);
 #else	/* DO_TAGGED_HASH */
     int tocopy;
 
-    if (osp != FRESH && !memcmp(&osp->hash, &hash, sizeof(hash))) {
-	if (sp != osp)
-	    *sp = *osp;
-	sp->run--;
-	debug("search restarted");
-    } else {
-	sp->hash = hash;
-	tocopy = sizeof(hash) < sizeof(sp->shorthash) ? sizeof(hash) : sizeof(sp->shorthash);
-	/* Copy the bottom half of thhe hash into sp->shorthash */
-	memcpy(&sp->shorthash, (const char *)&hash + (sizeof(hash) - tocopy),
-               tocopy);
-	sp->shorthash >>= 1;
-	sp->tabno = 0;
-	sp->run = -1;
-	sp->aborted = 0;
-    }
+    sp->hash = hash;
+    tocopy = sizeof(hash) < sizeof(sp->shorthash) ? sizeof(hash) : sizeof(sp->shorthash);
+    /* Copy the bottom half of thhe hash into sp->shorthash */
+    memcpy(&sp->shorthash, (const char *)&hash + (sizeof(hash) - tocopy),
+	   tocopy);
+    sp->shorthash >>= 1;
 #endif	/* DO_TAGGED_HASH */
+    sp->gen = 0;
+    sp->tabno = 0;
+    sp->run = -1;
+    sp->aborted = 0;
 }
 
 #ifdef	DO_TAGGED_HASH
@@ -1395,10 +2095,11 @@ start(searcher *sp, const HASH hash, searcher *osp)
  - search - conduct part of a search
  */
 static of_t			/* NOTFOUND if we hit VACANT or error */
-search(searcher *sp)
+search(const struct dbz *db, searcher *sp)
 {
     of_t value;
-    unsigned long taboffset = sp->tabno * conf.tsize;
+    void *where;
+    unsigned long taboffset = sp->tabno * db->conf.tsize;
 
     if (sp->aborted)
 	return(NOTFOUND);
@@ -1408,32 +2109,29 @@ search(searcher *sp)
 	if (sp->run++ == MAXRUN) {
 	    sp->tabno++;
 	    sp->run = 0;
-	    taboffset = sp->tabno * conf.tsize;
+	    taboffset = sp->tabno * db->conf.tsize;
 	}
-	sp->place = ((sp->shorthash + sp->run) % conf.tsize) + taboffset;
+	sp->place = ((sp->shorthash + sp->run) % db->conf.tsize) + taboffset;
 	debug("search @ %ld", sp->place);
 
 	/* get the tagged value */
-	if ((options.pag_incore != INCORE_NO) && (sp->place < conf.tsize)) {
+	if ((where = incore(db, &db->pagtab, sp)) != NULL) {
 	    debug("search: in core");
-	    value = ((of_t *)pagtab.core)[sp->place];
+	    memcpy(&value, where, sizeof(value));
 	} else {
 	    off_t dest;
 	    dest = sp->place * SOF;
 
 	    /* read it */
 	    errno = 0;
-	    if (pread(pagtab.fd, &value, sizeof(value), dest) != sizeof(value)) {
+	    if (pread(db->pagtab.fd, &value, sizeof(value), dest) != sizeof(value)) {
 		if (errno != 0) {
 		    syswarn("dbz: search: read failed");
-		    pagtab.pos = -1;
 		    sp->aborted = 1;
 		    return(NOTFOUND);
 		} else
 		    value = VACANT;
-                pagtab.pos = -1;
-	    } else
-                pagtab.pos += sizeof(value);
+	    }
 	}
 
 	/* vacant slot is always cause to return */
@@ -1461,14 +2159,18 @@ search(searcher *sp)
 #else	/* DO_TAGGED_HASH */
 
 /* search - conduct part of a search
+ *
+ * Generations are searched in turn, oldest first, so that a failed search
+ * stops at the place in the last generation where the key would be stored.
  *
  * return false if we hit vacant rec's or error
  */
 static bool
-search(searcher *sp)
+search(const struct dbz *db, searcher *sp)
 {
     erec value;
-    unsigned long taboffset = 0;
+    void *where;
+    const dbzgen *gen;
 
     if (sp->aborted)
 	return false;
@@ -1478,41 +2180,52 @@ search(searcher *sp)
 	if (sp->run++ == MAXRUN) {
 	    sp->tabno++;
 	    sp->run = 0;
-	    taboffset = sp->tabno * conf.tsize;
 	}
 
-	sp->place = ((sp->shorthash + sp->run) % conf.tsize) + taboffset;
+	gen = &db->conf.gen[sp->gen];
+	sp->place = ((sp->shorthash + sp->run) % gen->size)
+	    + gen->base + sp->tabno * gen->size;
 	debug("search @ %ld", (long) sp->place);
 
 	/* get the value */
-	if ((options.exists_incore != INCORE_NO) && (sp->place < conf.tsize)) {
+	if ((where = incore(db, &db->etab, sp)) != NULL) {
 	    debug("search: in core");
-	    memcpy(&value, &((erec *)etab.core)[sp->place], sizeof(erec)); 
+	    /* Start loading what the next probe will read:  the next slot,
+	       and the first slot of the next generation when probing the
+	       first slot of this one, since it is far away. */
+	    dbz_prefetch((char *) where + sizeof(erec));
+	    if (sp->run == 0 && sp->tabno == 0 && sp->gen + 1 < db->conf.ngen
+		&& db->etab.core[sp->gen + 1] != NULL)
+		dbz_prefetch((char *) db->etab.core[sp->gen + 1]
+			     + (sp->shorthash % db->conf.gen[sp->gen + 1].size)
+			       * sizeof(erec));
+	    memcpy(&value, where, sizeof(erec));
 	} else {
 	    off_t dest;
 	    dest = sp->place * sizeof(erec);
 
 	    /* read it */
 	    errno = 0;
-	    if (pread(etab.fd, &value, sizeof(erec), dest) != sizeof(erec)) {
+	    if (pread(db->etab.fd, &value, sizeof(erec), dest) != sizeof(erec)) {
 		if (errno != 0) {
 		    debug("search: read failed");
-		    etab.pos = -1;
 		    sp->aborted = 1;
 		    return false;
 		} else {
 		    memset(&value, '\0', sizeof(erec));
 		}
 	    }
-
-	    /* and finish up */
-	    etab.pos += sizeof(erec);
 	}
 
-	/* Check for an empty record */
+	/* Check for an empty record, and go on with the next generation */
 	if (!memcmp(&value, &empty_rec, sizeof(erec))) {
 	    debug("search: empty slot");
-	    return false;
+	    if (sp->gen + 1 >= db->conf.ngen)
+		return false;
+	    sp->gen++;
+	    sp->tabno = 0;
+	    sp->run = -1;
+	    continue;
 	}
 
 	/* check the value */
@@ -1530,17 +2243,16 @@ search(searcher *sp)
  * Returns:  true success, false failure
  */
 static bool
-set(searcher *sp, hash_table *tab, void *value)
+set(struct dbz *db, searcher *sp, hash_table *tab, void *value)
 {
     off_t offset;
+    void *where;
     
     if (sp->aborted)
 	return false;
 
     /* If we have the index file in memory, use it */
-    if ((tab->incore != INCORE_NO) && (sp->place < conf.tsize)) {
-	void *where = (char *)tab->core + (sp->place * tab->reclen);
-
+    if ((where = incore(db, tab, sp)) != NULL) {
 	memcpy(where, value, tab->reclen);
 	debug("set: incore");
 	if (tab->incore == INCORE_MMAP) {
@@ -1549,12 +2261,11 @@ set(searcher *sp, hash_table *tab, void *value)
 	    }
 	    return true;
 	}
-	if (!options.writethrough)
+	if (!db->options.writethrough)
 	    return true;
     }
 
     /* seek to spot */
-    tab->pos = -1;		/* invalidate position memory */
     offset = sp->place * tab->reclen;
 
     /* write in data */
@@ -1580,6 +2291,276 @@ set(searcher *sp, hash_table *tab, void *value)
     return true;
 }
 
+#ifndef	DO_TAGGED_HASH
+/* extend - make sure a table's file covers a generation, so that readers
+ * mapping it don't run past the end of the file
+ *
+ * Returns: true success, false failure
+ */
+static bool
+extend(hash_table *tab, const dbzgen *gen)
+{
+    struct stat st;
+    off_t length = (off_t) (gen->base + gen->size) * tab->reclen;
+
+    if (fstat(tab->fd, &st) == -1) {
+	syswarn("dbz: extend: fstat failed");
+	return false;
+    }
+    if (st.st_size < length && ftruncate(tab->fd, length) == -1) {
+	syswarn("dbz: extend: ftruncate failed");
+	return false;
+    }
+    return true;
+}
+
+/* tableend - find the first record past everything a table's file holds,
+ * including any overflow tables
+ */
+static bool
+tableend(hash_table *tab, long *end)
+{
+    struct stat st;
+    long records;
+
+    if (fstat(tab->fd, &st) == -1) {
+	syswarn("dbz: tableend: fstat failed");
+	return false;
+    }
+    records = (st.st_size + tab->reclen - 1) / tab->reclen;
+    if (records > *end)
+	*end = records;
+    return true;
+}
+
+/* grow - add a generation after the existing ones, large enough to hold
+ * as many entries again as the database already does
+ *
+ * Returns: true success, false failure
+ */
+static bool
+grow(struct dbz *db)
+{
+    dbzgen *gen, *last;
+    long end, total;
+    int i;
+
+    last = &db->conf.gen[db->conf.ngen - 1];
+    end = last->base + last->size;
+    if (!tableend(&db->idxtab, &end) || !tableend(&db->etab, &end))
+	return false;
+    total = 0;
+    for (i = 0; i < db->conf.ngen; i++)
+	total += db->conf.gen[i].used;
+
+    gen = &db->conf.gen[db->conf.ngen];
+    gen->base = (end + GENALIGN - 1) / GENALIGN * GENALIGN;
+    gen->size = sizefor(total, db->conf.fillpercent);
+    gen->used = 0;
+    if (!extend(&db->idxtab, gen) || !extend(&db->etab, gen))
+	return false;
+    if (db->idxtab.incore != INCORE_NO
+	&& !getcore(db, &db->idxtab, db->conf.ngen))
+	return false;
+    if (db->etab.incore != INCORE_NO
+	&& !getcore(db, &db->etab, db->conf.ngen)) {
+	dropcore(db, &db->idxtab, db->conf.ngen);
+	return false;
+    }
+    db->conf.ngen++;
+
+    /* readers find the new generation in the .dir file */
+    db->dirty = true;
+    if (putconf(db->dirf, &db->conf) < 0)
+	warn("dbz: grow: putconf failed");
+    notice("dbz: table full, added generation %d of %ld entries",
+	   db->conf.ngen, gen->size);
+
+    /* the filter is sized for the tables, so it has to be rebuilt */
+    if (db->filter != NULL && !makefilter(db))
+	warn("dbz: grow: can't rebuild filter, not using it");
+    return true;
+}
+
+/* dbz_refresh - pick up the generations another process added since the
+ * database was opened read-only
+ *
+ * Returns: true if there are new generations to search
+ */
+bool
+dbz_refresh(struct dbz *db)
+{
+    dbzconfig c;
+    int ngen;
+
+    if (fseeko(db->dirf, 0, SEEK_SET) != 0 || !getconf(db->dirf, &c))
+	return false;
+    if (c.tsize != db->conf.tsize || c.ngen <= db->conf.ngen)
+	return false;
+    for (ngen = db->conf.ngen; ngen < c.ngen; ngen++) {
+	db->conf.gen[ngen] = c.gen[ngen];
+	if (db->idxtab.incore != INCORE_NO && !getcore(db, &db->idxtab, ngen))
+	    break;
+	if (db->etab.incore != INCORE_NO && !getcore(db, &db->etab, ngen)) {
+	    dropcore(db, &db->idxtab, ngen);
+	    break;
+	}
+    }
+    if (ngen == db->conf.ngen)
+	return false;
+    db->conf.ngen = ngen;
+    return true;
+}
+
+/* filterhash - get the two hashes from which the bits of a key in the
+ * Bloom filter are derived; the second one is odd, so that the bits are
+ * all different
+ */
+static void
+filterhash(const erec *key, uint32_t *h1, uint32_t *h2)
+{
+    const unsigned char *p = (const unsigned char *) key->hash;
+    const unsigned char *q = p + sizeof(key->hash) - 4;
+
+    *h1 = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+    *h2 = q[0] | q[1] << 8 | q[2] << 16 | (uint32_t) q[3] << 24;
+    *h2 |= 1;
+}
+
+/* filteradd - add a key to the Bloom filter
+ */
+static void
+filteradd(struct dbz *db, const erec *key)
+{
+    uint32_t h1, h2, bit;
+    int i;
+
+    filterhash(key, &h1, &h2);
+    for (i = 0; i < FILTERHASHES; i++, h1 += h2) {
+	bit = h1 & db->filtermask;
+	db->filter[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+/* filtercheck - check whether a key may be in the database
+ *
+ * Returns: false if the key is certainly not in the database
+ */
+static bool
+filtercheck(const struct dbz *db, const erec *key)
+{
+    uint32_t h1, h2, bit;
+    int i;
+
+    filterhash(key, &h1, &h2);
+    for (i = 0; i < FILTERHASHES; i++, h1 += h2) {
+	bit = h1 & db->filtermask;
+	if ((db->filter[bit >> 3] & (1 << (bit & 7))) == 0)
+	    return false;
+    }
+    return true;
+}
+
+/* filterrecords - add the keys of a range of records of the .hash file
+ * to the Bloom filter
+ *
+ * Returns: true success, false failure
+ */
+static bool
+filterrecords(struct dbz *db, long from, long to)
+{
+    erec *buf;
+    ssize_t nread;
+    size_t i, count;
+
+    buf = xmalloc(FILTERCHUNK * sizeof(erec));
+    while (from < to) {
+	count = (to - from < FILTERCHUNK) ? to - from : FILTERCHUNK;
+	nread = pread(db->etab.fd, buf, count * sizeof(erec),
+		      (off_t) from * sizeof(erec));
+	if (nread < 0) {
+	    syswarn("dbz: filterrecords: read failed");
+	    free(buf);
+	    return false;
+	}
+	count = nread / sizeof(erec);
+	if (count == 0)
+	    break;
+	for (i = 0; i < count; i++)
+	    if (memcmp(&buf[i], &empty_rec, sizeof(erec)) != 0)
+		filteradd(db, &buf[i]);
+	from += count;
+    }
+    free(buf);
+    return true;
+}
+
+/* makefilter - build the Bloom filter from the keys of every generation;
+ * the first tables are taken from core when they are there, since an
+ * in-memory table may not have been written out yet
+ *
+ * Returns: true success, false failure (no filter is used then)
+ */
+static bool
+makefilter(struct dbz *db)
+{
+    struct stat st;
+    const erec *rec;
+    size_t bits, slots;
+    long i, end, next;
+    int gen;
+
+    free(db->filter);
+    db->filter = NULL;
+    if (fstat(db->etab.fd, &st) == -1) {
+	syswarn("dbz: makefilter: fstat failed");
+	return false;
+    }
+    end = st.st_size / sizeof(erec);
+
+    slots = 0;
+    for (gen = 0; gen < db->conf.ngen; gen++)
+	slots += db->conf.gen[gen].size;
+    for (bits = 8; bits < slots * FILTERBITS && bits < FILTERMAX; bits <<= 1)
+	continue;
+    db->filter = xcalloc(bits / 8, 1);
+    db->filtermask = bits - 1;
+
+    for (gen = 0; gen < db->conf.ngen; gen++) {
+	if (db->etab.core[gen] != NULL) {
+	    rec = db->etab.core[gen];
+	    for (i = 0; i < db->conf.gen[gen].size; i++)
+		if (memcmp(&rec[i], &empty_rec, sizeof(erec)) != 0)
+		    filteradd(db, &rec[i]);
+	} else if (!filterrecords(db, db->conf.gen[gen].base,
+				  db->conf.gen[gen].base + db->conf.gen[gen].size))
+	    break;
+
+	/* and the overflow tables of that generation */
+	next = (gen + 1 < db->conf.ngen) ? db->conf.gen[gen + 1].base : end;
+	if (!filterrecords(db, db->conf.gen[gen].base + db->conf.gen[gen].size,
+			   next))
+	    break;
+    }
+    if (gen < db->conf.ngen) {
+	free(db->filter);
+	db->filter = NULL;
+	return false;
+    }
+    debug("makefilter: %lu bits", (unsigned long) bits);
+    return true;
+}
+#else	/* !DO_TAGGED_HASH */
+
+/* dbz_refresh - the tagged format has no generations to pick up
+ */
+bool
+dbz_refresh(struct dbz *db UNUSED)
+{
+    return false;
+}
+#endif	/* !DO_TAGGED_HASH */
+
 #ifdef	DO_TAGGED_HASH
 /*
  - set_pag - store a value into a location previously found by search
@@ -1587,26 +2568,26 @@ set(searcher *sp, hash_table *tab, void *value)
  - Returns: true success, false failure
  */
 static bool
-set_pag(searcher *sp, of_t value)
+set_pag(struct dbz *db, searcher *sp, of_t value)
 {
     of_t v = value;
 
     if (CANTAG(v)) {
-        v |= sp->tag | taghere;
+        v |= sp->tag | db->taghere;
         if (v != UNBIAS(VACANT)) {      /* BIAS(v) won't look VACANT */
             if (v != LONG_MAX) {        /* and it won't overflow */
                 value = v;
             }
         }
-    } else if (canttag_warned == 0) {
+    } else if (db->canttag_warned == 0) {
 	fprintf(stderr, "dbz.c(set): can't tag value 0x%lx", v);
-	fprintf(stderr, " tagboth = 0x%lx\n", tagboth);
-	canttag_warned = 1;
+	fprintf(stderr, " tagboth = 0x%lx\n", db->tagboth);
+	db->canttag_warned = 1;
     }
     debug("tagged value is 0x%lx", value);
     value = BIAS(value);
 
-    return set(sp, &pagtab, &value);
+    return set(db, sp, &db->pagtab, &value);
 }
 #endif	/* DO_TAGGED_HASH */
 
@@ -9,8 +9,9 @@
 **  minimum of 20).
 **
 **  For setting the limit, only setrlimit is supported; if it isn't
-**  available, return -1 always.  We also refuse to set the limit to
-**  something higher than select can handle, checking against FD_SETSIZE.
+**  available, return -1 always.  setfdlimit refuses to set the limit to
+**  something higher than select can handle, checking against FD_SETSIZE;
+**  setfdlimit_any doesn't, and is meant for programs which don't use select.
 **
 **  Note that on some versions of Linux (2.2.x reported), sysconf may return
 **  the wrong value for the maximum file descriptors.  getrlimit is correct,
@@ -40,8 +41,6 @@
 int
 setfdlimit(unsigned int limit)
 {
-    struct rlimit rl;
-
 #ifdef FD_SETSIZE
     if (limit > FD_SETSIZE) {
         errno = EINVAL;
@@ -49,6 +48,14 @@ setfdlimit(unsigned int limit)
     }
 #endif
 
+    return setfdlimit_any(limit);
+}
+
+int
+setfdlimit_any(unsigned int limit)
+{
+    struct rlimit rl;
+
     rl.rlim_cur = 0;
     rl.rlim_max = 0;
 
@@ -75,6 +82,13 @@ setfdlimit(unsigned int limit UNUSED)
     return -1;
 }
 
+int
+setfdlimit_any(unsigned int limit UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
 #endif /* !(HAVE_SETRLIMIT && RLIMIT_NOFILE) */
 
 #if HAVE_GETRLIMIT && defined(RLIMIT_NOFILE)
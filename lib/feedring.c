@@ -0,0 +1,243 @@
+/*
+**  Shared-memory ring of records from innd to a channel feed.
+**
+**  See include/inn/feedring.h for the interface.  The file starts with a
+**  header giving the size of the data area, a power of two, and the head
+**  and tail counts, followed by the data area.  The counts only grow:  the
+**  writer adds records at head, the reader takes them at tail, and their
+**  position in the data area is the count modulo its size.  Only the writer
+**  changes head and only the reader changes tail, so no locks are needed,
+**  only memory barriers so that a record is complete before head moves past
+**  it, and taken before tail does.  This needs the builtins of GCC and
+**  compatible compilers; without them, the ring can't be opened.
+**
+**  A record is its length on four bytes followed by its data, padded to a
+**  multiple of four bytes.  A record never wraps around the end of the data
+**  area:  when it doesn't fit there, a length of FEEDRING_WRAP tells the
+**  reader that the record is at the start of the area.
+**
+**  The writer wakes the reader up when tail was at the head it started
+**  from once the new record is visible.  The reader re-reads head after
+**  moving tail, so either it sees the new record or the writer sees that it
+**  has to wake it up.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "inn/buffer.h"
+#include "inn/feedring.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+
+#define FEEDRING_MAGIC   0x494e4e52U
+#define FEEDRING_VERSION 1
+#define FEEDRING_WRAP    0xffffffffU
+#define FEEDRING_ALIGN(n) (((n) + 3) & ~((unsigned long) 3))
+
+#if defined(__GNUC__)
+# define FEEDRING_ATOMIC 1
+# define feedring_barrier() __sync_synchronize()
+#else
+# define FEEDRING_ATOMIC 0
+# define feedring_barrier() /* empty */
+#endif
+
+struct feedring_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long size;
+    volatile unsigned long head;
+    volatile unsigned long tail;
+};
+
+struct feedring {
+    void *base;
+    size_t mapped;
+    unsigned long size;
+    struct feedring_header *header;
+    unsigned char *data;
+};
+
+
+/*
+**  Write a new header for a ring of size bytes, discarding whatever was in
+**  the file.  Returns false on failure, after warning.
+*/
+static bool
+feedring_create(int fd, const char *path, unsigned long size)
+{
+    struct feedring_header header;
+    unsigned long n;
+
+    for (n = 64; n < size; n *= 2)
+        ;
+    memset(&header, 0, sizeof(header));
+    header.magic = FEEDRING_MAGIC;
+    header.version = FEEDRING_VERSION;
+    header.size = n;
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, sizeof(header) + n) < 0) {
+        syswarn("cannot extend %s", path);
+        return false;
+    }
+    if (xpwrite(fd, &header, sizeof(header), 0) < (ssize_t) sizeof(header)) {
+        syswarn("cannot write to %s", path);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  Return whether the file holds a valid ring.
+*/
+static bool
+feedring_valid(int fd)
+{
+    struct feedring_header header;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(header))
+        return false;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header))
+        return false;
+    return header.magic == FEEDRING_MAGIC
+           && header.version == FEEDRING_VERSION && header.size >= 64
+           && (header.size & (header.size - 1)) == 0
+           && (size_t) st.st_size == sizeof(header) + header.size
+           && header.head - header.tail <= header.size;
+}
+
+
+struct feedring *
+feedring_open(const char *path, unsigned long size)
+{
+    struct feedring *ring;
+    struct stat st;
+    int fd;
+
+    if (!FEEDRING_ATOMIC) {
+        warn("feed ring not supported by this compiler");
+        return NULL;
+    }
+    fd = open(path, size > 0 ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0) {
+        syswarn("cannot open %s", path);
+        return NULL;
+    }
+    if (!feedring_valid(fd)) {
+        if (size == 0) {
+            warn("%s is invalid", path);
+            goto fail;
+        }
+        if (!feedring_create(fd, path, size))
+            goto fail;
+    }
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat %s", path);
+        goto fail;
+    }
+
+    ring = xcalloc(1, sizeof(struct feedring));
+    ring->mapped = st.st_size;
+    ring->base = mmap(NULL, ring->mapped, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    close(fd);
+    if (ring->base == MAP_FAILED) {
+        syswarn("cannot mmap %s", path);
+        free(ring);
+        return NULL;
+    }
+    ring->header = ring->base;
+    ring->size = ring->header->size;
+    ring->data = (unsigned char *) ring->base + sizeof(struct feedring_header);
+    return ring;
+
+fail:
+    close(fd);
+    return NULL;
+}
+
+
+bool
+feedring_put(struct feedring *ring, const void *data, size_t length,
+             bool *wake)
+{
+    unsigned long head, tail, start, pos, need, room;
+    uint32_t n;
+
+    if (length == 0 || length >= FEEDRING_WRAP)
+        return false;
+    start = head = ring->header->head;
+    tail = ring->header->tail;
+    feedring_barrier();
+    room = ring->size - (head - tail);
+    need = FEEDRING_ALIGN(sizeof(n) + length);
+    pos = head & (ring->size - 1);
+
+    /* Skip to the start of the data area if the record doesn't fit at the
+       end.  Positions are aligned, so there is room for the marker. */
+    if (pos + need > ring->size) {
+        if (ring->size - pos + need > room)
+            return false;
+        n = FEEDRING_WRAP;
+        memcpy(ring->data + pos, &n, sizeof(n));
+        head += ring->size - pos;
+        pos = 0;
+    } else if (need > room)
+        return false;
+
+    n = length;
+    memcpy(ring->data + pos, &n, sizeof(n));
+    memcpy(ring->data + pos + sizeof(n), data, length);
+    feedring_barrier();
+    ring->header->head = head + need;
+    feedring_barrier();
+    *wake = (ring->header->tail == start);
+    return true;
+}
+
+
+bool
+feedring_get(struct feedring *ring, struct buffer *buffer)
+{
+    unsigned long head, tail, pos;
+    uint32_t n;
+
+    tail = ring->header->tail;
+    head = ring->header->head;
+    feedring_barrier();
+    if (head == tail)
+        return false;
+    pos = tail & (ring->size - 1);
+    memcpy(&n, ring->data + pos, sizeof(n));
+    if (n == FEEDRING_WRAP) {
+        tail += ring->size - pos;
+        pos = 0;
+        memcpy(&n, ring->data, sizeof(n));
+    }
+
+    /* Drop everything if the ring is corrupted rather than loop on it. */
+    if (n == 0 || FEEDRING_ALIGN(sizeof(n) + n) > head - tail) {
+        warn("feed ring corrupted, dropping %lu bytes", head - tail);
+        ring->header->tail = head;
+        return false;
+    }
+    buffer_append(buffer, (const char *) ring->data + pos + sizeof(n), n);
+    feedring_barrier();
+    ring->header->tail = tail + FEEDRING_ALIGN(sizeof(n) + n);
+    feedring_barrier();
+    return true;
+}
+
+
+void
+feedring_free(struct feedring *ring)
+{
+    munmap(ring->base, ring->mapped);
+    free(ring);
+}
@@ -0,0 +1,190 @@
+/*
+**  Latency histograms.
+**
+**  Durations below HIST_SUB microseconds each get their own bucket.  Above
+**  that, a duration with its highest bit at position e goes into one of
+**  HIST_SUB buckets for that power of two, chosen by the HIST_SUBBITS bits
+**  following the highest one.  Durations too long for the last bucket are
+**  counted there; the exact maximum is kept separately.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/histogram.h"
+#include "inn/libinn.h"
+
+#define HIST_SUBBITS    4
+#define HIST_SUB        (1UL << HIST_SUBBITS)
+#define HIST_MAXBIT     30      /* About 35 minutes. */
+#define HIST_BUCKETS    ((HIST_MAXBIT - HIST_SUBBITS + 2) * HIST_SUB)
+
+struct histogram {
+    unsigned long count;
+    unsigned long max;
+    double sum;
+    unsigned long buckets[HIST_BUCKETS];
+};
+
+
+struct histogram *
+histogram_new(void)
+{
+    return xcalloc(1, sizeof(struct histogram));
+}
+
+
+void
+histogram_free(struct histogram *hist)
+{
+    free(hist);
+}
+
+
+void
+histogram_reset(struct histogram *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+
+void
+histogram_merge(struct histogram *hist, const struct histogram *other)
+{
+    size_t i;
+
+    hist->count += other->count;
+    hist->sum += other->sum;
+    if (other->max > hist->max)
+        hist->max = other->max;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        hist->buckets[i] += other->buckets[i];
+}
+
+
+size_t
+histogram_size(void)
+{
+    return sizeof(struct histogram);
+}
+
+
+/*
+**  Return the bucket for a duration.
+*/
+static size_t
+histogram_bucket(unsigned long usec)
+{
+    unsigned int bit;
+
+    if (usec < HIST_SUB)
+        return usec;
+    for (bit = HIST_SUBBITS; bit < HIST_MAXBIT && (usec >> (bit + 1)) != 0;
+         bit++)
+        ;
+    if (usec >> (bit + 1) != 0)
+        return HIST_BUCKETS - 1;
+    return (bit - HIST_SUBBITS + 1) * HIST_SUB
+        + ((usec >> (bit - HIST_SUBBITS)) & (HIST_SUB - 1));
+}
+
+
+/*
+**  Return the largest duration that goes into a bucket.
+*/
+static unsigned long
+histogram_limit(size_t bucket)
+{
+    unsigned int bit;
+    unsigned long sub;
+
+    if (bucket < HIST_SUB)
+        return bucket;
+    bit = bucket / HIST_SUB + HIST_SUBBITS - 1;
+    sub = bucket % HIST_SUB;
+    return ((HIST_SUB + sub + 1) << (bit - HIST_SUBBITS)) - 1;
+}
+
+
+void
+histogram_record(struct histogram *hist, unsigned long usec)
+{
+    hist->buckets[histogram_bucket(usec)]++;
+    hist->count++;
+    hist->sum += usec;
+    if (usec > hist->max)
+        hist->max = usec;
+}
+
+
+void
+histogram_record_since(struct histogram *hist, const struct timeval *start)
+{
+    struct timeval now;
+    long usec;
+
+    gettimeofday(&now, NULL);
+    usec = (now.tv_sec - start->tv_sec) * 1000000L
+        + (now.tv_usec - start->tv_usec);
+    histogram_record(hist, usec > 0 ? (unsigned long) usec : 0);
+}
+
+
+unsigned long
+histogram_count(const struct histogram *hist)
+{
+    return hist->count;
+}
+
+
+double
+histogram_sum(const struct histogram *hist)
+{
+    return hist->sum;
+}
+
+
+/*
+**  Walk the buckets until the fraction q of the durations are accounted
+**  for, and return the upper limit of that bucket, or the maximum duration
+**  if it is lower.
+*/
+unsigned long
+histogram_quantile(const struct histogram *hist, double q)
+{
+    unsigned long rank, seen, limit;
+    size_t i;
+
+    if (hist->count == 0)
+        return 0;
+    if (q >= 1.0)
+        return hist->max;
+    rank = (unsigned long) (q * hist->count);
+    if (rank >= hist->count)
+        rank = hist->count - 1;
+    for (seen = 0, i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank)
+            break;
+    }
+    limit = histogram_limit(i);
+    return limit < hist->max ? limit : hist->max;
+}
+
+
+void
+histogram_summary(const struct histogram *hist, struct buffer *out)
+{
+    buffer_append_sprintf(out, "count %lu mean %.0f p50 %lu p99 %lu"
+                          " p999 %lu max %lu", hist->count,
+                          hist->count == 0 ? 0.0 : hist->sum / hist->count,
+                          histogram_quantile(hist, 0.5),
+                          histogram_quantile(hist, 0.99),
+                          histogram_quantile(hist, 0.999), hist->max);
+}
@@ -25,9 +25,14 @@
 #include "config.h"
 #include "clibrary.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
+#include "inn/buffer.h"
 #include "inn/confparse.h"
 #include "inn/innconf.h"
+#include "inn/md5.h"
 #include "inn/messages.h"
 #include "inn/vector.h"
 #include "inn/libinn.h"
@@ -115,6 +120,7 @@ const struct config config_table[] = {
     { K(extraoverviewhidden),     LIST    (NULL) },
     { K(fromhost),                STRING  (NULL) },
     { K(groupbaseexpiry),         BOOL    (true) },
+    { K(innfeedcpus),             STRING  (NULL) },
     { K(mailcmd),                 STRING  (NULL) },
     { K(maxforks),                UNUMBER   (10) },
     { K(maxlisten),               UNUMBER  (128) },
@@ -123,6 +129,7 @@ const struct config config_table[] = {
     { K(ovmethod),                STRING  (NULL) },
     { K(pathhost),                STRING  (NULL) },
     { K(rlimitnofile),            NUMBER    (-1) },
+    { K(sitebuffermax),           UNUMBER    (0) },
     { K(server),                  STRING  (NULL) },
     { K(sourceaddress),           STRING  (NULL) },
     { K(sourceaddress6),          STRING  (NULL) },
@@ -151,31 +158,46 @@ const struct config config_table[] = {
 
     /* The following settings are specific to innd. */
     { K(artcutoff),               UNUMBER   (10) },
+    { K(backpressurelatency),     UNUMBER    (0) },
     { K(badiocount),              UNUMBER    (5) },
     { K(bindaddress),             STRING  (NULL) },
     { K(bindaddress6),            STRING  (NULL) },
     { K(blockbackoff),            UNUMBER  (120) },
+    { K(cancelbatch),             UNUMBER    (0) },
     { K(chaninacttime),           UNUMBER  (600) },
     { K(chanretrytime),           UNUMBER  (300) },
     { K(datamovethreshold),       UNUMBER (16384) },
     { K(dontrejectfiltered),      BOOL   (false) },
+    { K(filterworkers),           UNUMBER    (0) },
     { K(hiscachesize),            UNUMBER  (256) },
+    { K(hisdatasync),             BOOL   (false) },
+    { K(hisfilter),               BOOL   (false) },
+    { K(hishugepages),            BOOL   (false) },
+    { K(hiswarmup),               BOOL   (false) },
+    { K(hiswarmuplock),           BOOL   (false) },
+    { K(hiswarmuptail),           UNUMBER (65536) },
+    { K(hiswritebehind),          UNUMBER    (0) },
     { K(htmlstatus),              BOOL    (true) },
     { K(icdsynccount),            UNUMBER   (10) },
     { K(ignorenewsgroups),        BOOL   (false) },
     { K(incominglogfrequency),    UNUMBER  (200) },
+    { K(inndcpus),                STRING  (NULL) },
     { K(linecountfuzz),           UNUMBER    (0) },
     { K(logartsize),              BOOL    (true) },
     { K(logcancelcomm),           BOOL   (false) },
     { K(logipaddr),               BOOL    (true) },
     { K(logsitename),             BOOL    (true) },
     { K(logstatus),               BOOL    (true) },
+    { K(logsync),                 UNUMBER    (0) },
     { K(logtrash),                BOOL    (true) },
+    { K(logwriter),               BOOL   (false) },
+    { K(maxartinmemory),          UNUMBER    (0) },
     { K(maxartsize),              UNUMBER (1000000) },
     { K(maxconnections),          UNUMBER   (50) },
     { K(mergetogroups),           BOOL   (false) },
     { K(nntplinklog),             BOOL   (false) },
     { K(noreader),                BOOL   (false) },
+    { K(ovqueuesize),             UNUMBER    (0) },
     { K(pathalias),               STRING  (NULL) },
     { K(pathcluster),             STRING  (NULL) },
     { K(pauseretrytime),          UNUMBER  (300) },
@@ -184,14 +206,19 @@ const struct config config_table[] = {
     { K(readerswhenstopped),      BOOL   (false) },
     { K(refusecybercancels),      BOOL   (false) },
     { K(remembertrash),           BOOL    (true) },
+    { K(reuseport),               BOOL   (false) },
+    { K(sharedactive),            BOOL   (false) },
+    { K(sharedmsgidcachesize),    UNUMBER    (0) },
     { K(stathist),                STRING  (NULL) },
     { K(status),                  UNUMBER  (600) },
+    { K(statusmetrics),           BOOL   (false) },
     { K(verifycancels),           BOOL   (false) },
     { K(verifygroups),            BOOL   (false) },
     { K(wanttrash),               BOOL   (false) },
     { K(wipcheck),                UNUMBER    (5) },
     { K(wipexpire),               UNUMBER   (10) },
     { K(xrefslave),               BOOL   (false) },
+    { K(xrefslavefilters),        BOOL    (true) },
 
     /* The following settings are specific to nnrpd. */
     { K(addinjectiondate),        BOOL    (true) },
@@ -216,13 +243,18 @@ const struct config config_table[] = {
     { K(maxcmdreadsize),          UNUMBER (BUFSIZ) },
     { K(msgidcachesize),          UNUMBER (64000) },
     { K(moderatormailer),         STRING  (NULL) },
+    { K(newnewsindexhours),       UNUMBER    (0) },
     { K(nfsreader),               BOOL   (false) },
     { K(nfsreaderdelay),          UNUMBER   (60) },
     { K(nicenewnews),             UNUMBER    (0) },
     { K(nicennrpd),               UNUMBER    (0) },
+    { K(nnrpdcpus),               STRING  (NULL) },
     { K(nnrpdflags),              STRING    ("") },
     { K(nnrpdauthsender),         BOOL   (false) },
     { K(nnrpdloadlimit),          UNUMBER   (16) },
+    { K(nnrpdovercachesize),      UNUMBER    (0) },
+    { K(nnrpdreadahead),          UNUMBER    (0) },
+    { K(nnrpdcommandstats),       BOOL   (false) },
     { K(nnrpdoverstats),          BOOL    (true) },
     { K(organization),            STRING  (NULL) },
     { K(readertrack),             BOOL   (false) },
@@ -239,6 +271,8 @@ const struct config config_table[] = {
     { K(tlseccurve),              STRING  (NULL) },
     { K(tlspreferserverciphers),  BOOL    (true) },
     { K(tlsprotocols),            LIST    (NULL) },
+    { K(tlsktls),                 BOOL   (false) },
+    { K(tlsticketlifetime),       UNUMBER    (0) },
 #endif /* HAVE_OPENSSL */
 
     /* The following settings are used by nnrpd and rnews. */
@@ -246,21 +280,38 @@ const struct config config_table[] = {
     { K(nnrpdpostport),           UNUMBER  (119) },
 
     /* The following settings are specific to the storage subsystem. */
+    { K(articlecachesize),        UNUMBER    (0) },
     { K(articlemmap),             BOOL    (true) },
     { K(cnfscheckfudgesize),      UNUMBER    (0) },
+    { K(cnfswritebuffer),         UNUMBER    (0) },
+    { K(cnfswritedelay),          UNUMBER    (1) },
     { K(immediatecancel),         BOOL   (false) },
     { K(keepmmappedthreshold),    UNUMBER (1024) },
     { K(nfswriter),               BOOL   (false) },
     { K(nnrpdcheckart),           BOOL    (true) },
+    { K(overcachemapsize),        UNUMBER    (0) },
     { K(overcachesize),           UNUMBER  (128) },
     { K(ovgrouppat),              STRING  (NULL) },
+    { K(ovhotsize),               UNUMBER    (0) },
+    { K(ovreplicationhours),      UNUMBER    (0) },
+    { K(ovtokenindexsize),        UNUMBER    (0) },
+    { K(ovsqlitecpus),            STRING  (NULL) },
     { K(storeonxref),             BOOL    (true) },
+    { K(timecafdeferclean),       BOOL   (false) },
+    { K(timehashdedupsize),       UNUMBER    (0) },
+    { K(tradindexedcompact),      BOOL   (false) },
+    { K(tradindexedcompress),     BOOL   (false) },
     { K(tradindexedmmap),         BOOL    (true) },
+    { K(tradindexedpreadsize),    UNUMBER    (0) },
+    { K(tradindexedrepack),       UNUMBER    (0) },
     { K(useoverchan),             BOOL   (false) },
     { K(wireformat),              BOOL    (true) },
 
     /* The following settings are specific to the history subsystem. */
     { K(hismethod),               STRING  (NULL) },
+    { K(hisserver),               STRING  (NULL) },
+    { K(hisserverport),           UNUMBER (5119) },
+    { K(hisshards),               LIST    (NULL) },
 
     /* The following settings are specific to rc.news. */
     { K(docnfsstat),              BOOL   (false) },
@@ -538,30 +589,290 @@ innconf_validate(struct config_group *group)
 
 
 /*
-**  Read in inn.conf.  Takes a single argument, which is either NULL to read
-**  the default configuration file or a path to an alternate configuration
-**  file to read.  Returns true if the file was read successfully and false
-**  otherwise.
+**  Snapshots of the innconf struct.
+**
+**  Reading inn.conf means parsing it and, unless fromhost and pathhost are
+**  set, resolving the fully qualified name of the host several times, which
+**  every short-lived program pays when it starts.  innconf_write_snapshot
+**  saves the resulting struct next to the file, and innconf_read loads it
+**  instead of the file as long as it was made from the same file, with the
+**  same host name and the same environment variables overriding inn.conf,
+**  by a build with the same table of parameters.
+**
+**  The snapshot is a header, the host name and the values of the
+**  environment variables, and then the value of each parameter in the
+**  order of the table:  a byte for booleans, a long for numbers, and for
+**  strings a 32-bit length (all ones for NULL) followed by the characters.
+**  Lists are a 32-bit count followed by the strings.
 */
-bool
-innconf_read(const char *path)
+#define SNAPSHOT_MAGIC   0x494e4e43U
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NULL    0xffffffffU
+
+struct snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    unsigned char table[MD5_DIGESTSIZE];  /* Hash of the parameter table. */
+    uint64_t dev;                         /* Identity of the source file. */
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    int64_t ctime;
+};
+
+/* The environment variables used by innconf_set_defaults. */
+static const char *const snapshot_env[] = {
+    "FROMHOST", "NNTPSERVER", "ORGANIZATION", "INND_BIND_ADDRESS",
+    "INND_BIND_ADDRESS6"
+};
+
+
+/*
+**  Fill in a snapshot header for the source file with the given status.
+*/
+static void
+snapshot_header(struct snapshot_header *header, const struct stat *st)
+{
+    struct md5_context context;
+    unsigned char type;
+    size_t i;
+
+    memset(header, 0, sizeof(*header));
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    md5_init(&context);
+    for (i = 0; i < ARRAY_SIZE(config_table); i++) {
+        type = config_table[i].type;
+        md5_update(&context, (const unsigned char *) config_table[i].name,
+                   strlen(config_table[i].name) + 1);
+        md5_update(&context, &type, 1);
+    }
+    md5_final(&context);
+    memcpy(header->table, context.digest, sizeof(header->table));
+    header->dev = st->st_dev;
+    header->ino = st->st_ino;
+    header->size = st->st_size;
+    header->mtime = st->st_mtime;
+    header->ctime = st->st_ctime;
+}
+
+
+/*
+**  Append a string, possibly NULL, to a snapshot.
+*/
+static void
+snapshot_put_string(struct buffer *snapshot, const char *string)
+{
+    uint32_t length;
+
+    length = (string == NULL) ? SNAPSHOT_NULL : strlen(string);
+    buffer_append(snapshot, (const char *) &length, sizeof(length));
+    if (string != NULL)
+        buffer_append(snapshot, string, length);
+}
+
+
+/*
+**  Take a string, possibly NULL, from a snapshot, advancing data.  Returns
+**  false if the snapshot is too short.
+*/
+static bool
+snapshot_get_string(const char **data, const char *end, char **string)
+{
+    uint32_t length;
+
+    if ((size_t) (end - *data) < sizeof(length))
+        return false;
+    memcpy(&length, *data, sizeof(length));
+    *data += sizeof(length);
+    if (length == SNAPSHOT_NULL) {
+        *string = NULL;
+        return true;
+    }
+    if ((size_t) (end - *data) < length)
+        return false;
+    *string = xstrndup(*data, length);
+    *data += length;
+    return true;
+}
+
+
+/*
+**  Append the host name and the environment variables which the struct
+**  depends on to a snapshot.
+*/
+static void
+snapshot_put_context(struct buffer *snapshot)
+{
+    char hostname[BUFSIZ];
+    size_t i;
+
+    if (gethostname(hostname, sizeof(hostname)) < 0)
+        hostname[0] = '\0';
+    hostname[sizeof(hostname) - 1] = '\0';
+    snapshot_put_string(snapshot, hostname);
+    for (i = 0; i < ARRAY_SIZE(snapshot_env); i++)
+        snapshot_put_string(snapshot, getenv(snapshot_env[i]));
+}
+
+
+/*
+**  Return the path to the snapshot of a configuration file, which the
+**  caller should free.
+*/
+static char *
+snapshot_path(const char *path)
+{
+    return concat(path, ".snapshot", (char *) 0);
+}
+
+
+/*
+**  Load the snapshot of the configuration file at path, returning a newly
+**  allocated struct, or NULL if there is no usable snapshot.
+*/
+static struct innconf *
+innconf_read_snapshot(const char *path)
+{
+    struct snapshot_header header, expected;
+    struct buffer *context;
+    struct stat st, sst;
+    struct innconf *config;
+    struct vector **list;
+    char *file, *data, *string;
+    const char *p, *end;
+    uint32_t count, j;
+    size_t i;
+    ssize_t status;
+    int fd;
+
+    if (stat(path, &st) < 0)
+        return NULL;
+    file = snapshot_path(path);
+    fd = open(file, O_RDONLY);
+    free(file);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &sst) < 0 || sst.st_size < (off_t) sizeof(header)
+        || sst.st_size > 1024 * 1024) {
+        close(fd);
+        return NULL;
+    }
+    data = xmalloc(sst.st_size);
+    status = read(fd, data, sst.st_size);
+    close(fd);
+    if (status != sst.st_size) {
+        free(data);
+        return NULL;
+    }
+
+    /* Check that the snapshot matches the file, this build, and the
+       current host name and environment. */
+    snapshot_header(&expected, &st);
+    memcpy(&header, data, sizeof(header));
+    p = data + sizeof(header);
+    end = data + sst.st_size;
+    context = buffer_new();
+    snapshot_put_context(context);
+    if (memcmp(&header, &expected, sizeof(header)) != 0
+        || (size_t) (end - p) < context->left
+        || memcmp(p, context->data, context->left) != 0) {
+        buffer_free(context);
+        free(data);
+        return NULL;
+    }
+    p += context->left;
+    buffer_free(context);
+
+    config = xcalloc(1, sizeof(struct innconf));
+    for (i = 0; i < ARRAY_SIZE(config_table); i++)
+        switch (config_table[i].type) {
+        case TYPE_BOOLEAN:
+            if (p >= end)
+                goto fail;
+            *CONF_BOOL(config, config_table[i].location) = (*p++ != 0);
+            break;
+        case TYPE_NUMBER:
+            if ((size_t) (end - p) < sizeof(long))
+                goto fail;
+            memcpy(CONF_NUMBER(config, config_table[i].location), p,
+                   sizeof(long));
+            p += sizeof(long);
+            break;
+        case TYPE_UNUMBER:
+            if ((size_t) (end - p) < sizeof(unsigned long))
+                goto fail;
+            memcpy(CONF_UNUMBER(config, config_table[i].location), p,
+                   sizeof(unsigned long));
+            p += sizeof(unsigned long);
+            break;
+        case TYPE_STRING:
+            if (!snapshot_get_string(&p, end,
+                                     CONF_STRING(config,
+                                                 config_table[i].location)))
+                goto fail;
+            break;
+        case TYPE_LIST:
+            list = CONF_LIST(config, config_table[i].location);
+            *list = vector_new();
+            if ((size_t) (end - p) < sizeof(count))
+                goto fail;
+            memcpy(&count, p, sizeof(count));
+            p += sizeof(count);
+            for (j = 0; j < count; j++) {
+                if (!snapshot_get_string(&p, end, &string) || string == NULL)
+                    goto fail;
+                vector_resize(*list, j + 1);
+                (*list)->strings[j] = string;
+                (*list)->count = j + 1;
+            }
+            break;
+        }
+    if (p != end)
+        goto fail;
+    free(data);
+    return config;
+
+fail:
+    innconf_free(config);
+    free(data);
+    return NULL;
+}
+
+
+/*
+**  Read in inn.conf, from its snapshot if it has an up-to-date one.  Takes
+**  a single argument, which is either NULL to read the default
+**  configuration file or a path to an alternate configuration file to
+**  read.  If snapshot is false, the file is always parsed.  Returns true if
+**  the file was read successfully and false otherwise.
+*/
+static bool
+innconf_load(const char *path, bool snapshot)
 {
     struct config_group *group;
     char *tmpdir;
 
     if (innconf != NULL)
         innconf_free(innconf);
+    innconf = NULL;
     if (path == NULL)
         path = getenv("INNCONF");
-    group = config_parse_file(path == NULL ? INN_PATH_CONFIG : path);
-    if (group == NULL)
-        return false;
+    if (path == NULL)
+        path = INN_PATH_CONFIG;
+    if (snapshot)
+        innconf = innconf_read_snapshot(path);
+    if (innconf == NULL) {
+        group = config_parse_file(path);
+        if (group == NULL)
+            return false;
 
-    innconf = innconf_parse(group);
-    if (!innconf_validate(group))
-        return false;
-    config_free(group);
-    innconf_set_defaults();
+        innconf = innconf_parse(group);
+        if (!innconf_validate(group))
+            return false;
+        config_free(group);
+        innconf_set_defaults();
+    }
 
     /* It's not clear that this belongs here, but it was done by the old
        configuration parser, so this is a convenient place to do it. */
@@ -576,6 +887,125 @@ innconf_read(const char *path)
 }
 
 
+/*
+**  Read in inn.conf.  Takes a single argument, which is either NULL to read
+**  the default configuration file or a path to an alternate configuration
+**  file to read.  Returns true if the file was read successfully and false
+**  otherwise.
+*/
+bool
+innconf_read(const char *path)
+{
+    return innconf_load(path, true);
+}
+
+
+/*
+**  Parse inn.conf and save the result in its snapshot, for innconf_read to
+**  use until the file changes.  Takes the same argument as innconf_read, and
+**  leaves innconf set.  Returns false, after warning, if the file cannot be
+**  read or the snapshot cannot be written.
+*/
+bool
+innconf_write_snapshot(const char *path)
+{
+    struct snapshot_header header;
+    struct buffer *snapshot;
+    struct stat st;
+    struct vector *list;
+    char *file, *tmp, *string;
+    uint32_t count, j;
+    size_t i;
+    bool okay = true;
+    int fd;
+
+    if (path == NULL)
+        path = getenv("INNCONF");
+    if (path == NULL)
+        path = INN_PATH_CONFIG;
+
+    /* Take the status of the file first, so that a change while parsing
+       it makes the snapshot unusable. */
+    if (stat(path, &st) < 0) {
+        syswarn("cannot stat %s", path);
+        return false;
+    }
+    if (!innconf_load(path, false))
+        return false;
+
+    snapshot = buffer_new();
+    snapshot_header(&header, &st);
+    buffer_append(snapshot, (const char *) &header, sizeof(header));
+    snapshot_put_context(snapshot);
+    for (i = 0; i < ARRAY_SIZE(config_table); i++)
+        switch (config_table[i].type) {
+        case TYPE_BOOLEAN:
+            buffer_append(snapshot,
+                          *CONF_BOOL(innconf, config_table[i].location)
+                              ? "\1" : "\0", 1);
+            break;
+        case TYPE_NUMBER:
+            buffer_append(snapshot,
+                          (const char *) CONF_NUMBER(innconf,
+                                                     config_table[i].location),
+                          sizeof(long));
+            break;
+        case TYPE_UNUMBER:
+            buffer_append(snapshot,
+                          (const char *) CONF_UNUMBER(innconf,
+                                                      config_table[i].location),
+                          sizeof(unsigned long));
+            break;
+        case TYPE_STRING:
+            string = *CONF_STRING(innconf, config_table[i].location);
+            snapshot_put_string(snapshot, string);
+            break;
+        case TYPE_LIST:
+            list = *CONF_LIST(innconf, config_table[i].location);
+            count = 0;
+            if (list != NULL)
+                for (j = 0; j < list->count; j++)
+                    if (list->strings[j] != NULL)
+                        count++;
+            buffer_append(snapshot, (const char *) &count, sizeof(count));
+            if (list != NULL)
+                for (j = 0; j < list->count; j++)
+                    if (list->strings[j] != NULL)
+                        snapshot_put_string(snapshot, list->strings[j]);
+            break;
+        }
+
+    /* Write it under a temporary name and rename it into place so that
+       nothing ever reads a partial snapshot. */
+    file = snapshot_path(path);
+    tmp = concat(file, ".new", (char *) 0);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        syswarn("cannot create %s", tmp);
+        okay = false;
+    } else {
+        if (xwrite(fd, snapshot->data, snapshot->left) < 0) {
+            syswarn("cannot write %s", tmp);
+            okay = false;
+        }
+        if (close(fd) < 0) {
+            syswarn("cannot close %s", tmp);
+            okay = false;
+        }
+        if (okay && rename(tmp, file) < 0) {
+            syswarn("cannot rename %s to %s", tmp, file);
+            okay = false;
+        }
+        if (!okay)
+            unlink(tmp);
+    }
+    free(tmp);
+    free(file);
+    buffer_free(snapshot);
+    return okay;
+}
+
+
 /*
 **  Check an inn.conf file.  This involves reading it in and then additionally
 **  making sure that there are no keys defined in the inn.conf file that
@@ -0,0 +1,361 @@
+/*
+**  Shared table of latency histograms.
+**
+**  See include/inn/latencytable.h for the interface.  The file starts with
+**  a header giving its layout, followed by the names of the operations and
+**  then by the slots.  Each slot holds its key, then for each operation the
+**  count of bytes followed by the histogram, as histogram_size gives it.
+**  A key is kept in the first free slot from its hash modulo the number of
+**  slots, and a slot is read and written with pread and pwrite under an
+**  fcntl lock of the range being updated, which is only held for that long.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "inn/histogram.h"
+#include "inn/latencytable.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+
+#define LATENCY_MAGIC    0x494e4e4cU
+#define LATENCY_VERSION  1
+#define LATENCY_KEYSIZE  64
+#define LATENCY_NAMESIZE 32
+
+struct latency_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long slots;
+    unsigned long ops;
+    unsigned long histsize;
+};
+
+struct latency_table {
+    int fd;
+    char *path;
+    unsigned long slots;
+    size_t ops;
+    char **names;
+    off_t start;                /* Offset of the first slot. */
+    size_t slotsize;
+    struct histogram *hist;     /* Scratch space for updates. */
+    bool full;                  /* Whether running out of slots was said. */
+    char key[LATENCY_KEYSIZE];
+};
+
+
+/*
+**  Return the offset of the record of an operation in a slot.
+*/
+static off_t
+latency_offset(const struct latency_table *table, unsigned long slot,
+               size_t op)
+{
+    return table->start + (off_t) slot * table->slotsize + LATENCY_KEYSIZE
+        + (off_t) op * (sizeof(unsigned long) + histogram_size());
+}
+
+
+/*
+**  Write the header and the names of the operations of a new table, and
+**  extend it to its full size.
+*/
+static bool
+latency_create(int fd, const char *path, unsigned long slots,
+               const char *const *ops, size_t nops)
+{
+    struct latency_header header;
+    char name[LATENCY_NAMESIZE];
+    size_t i;
+    off_t size;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LATENCY_MAGIC;
+    header.version = LATENCY_VERSION;
+    header.slots = (slots == 0) ? 1 : slots;
+    header.ops = nops;
+    header.histsize = histogram_size();
+    size = sizeof(header) + nops * LATENCY_NAMESIZE
+        + (off_t) header.slots * (LATENCY_KEYSIZE
+                                  + nops * (sizeof(unsigned long)
+                                            + histogram_size()));
+    if (ftruncate(fd, size) < 0) {
+        syswarn("cannot extend %s", path);
+        return false;
+    }
+    if (xpwrite(fd, &header, sizeof(header), 0) < (ssize_t) sizeof(header)) {
+        syswarn("cannot write to %s", path);
+        return false;
+    }
+    for (i = 0; i < nops; i++) {
+        memset(name, 0, sizeof(name));
+        strlcpy(name, ops[i], sizeof(name));
+        if (xpwrite(fd, name, sizeof(name),
+                    sizeof(header) + i * LATENCY_NAMESIZE)
+            < (ssize_t) sizeof(name)) {
+            syswarn("cannot write to %s", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+struct latency_table *
+latency_table_open(const char *path, unsigned long slots,
+                   const char *const *ops, size_t nops)
+{
+    struct latency_table *table;
+    struct latency_header header;
+    struct stat st;
+    char name[LATENCY_NAMESIZE];
+    char **names = NULL;
+    size_t i;
+    int fd;
+
+    fd = open(path, (ops == NULL) ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        syswarn("cannot open %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat %s", path);
+        goto fail;
+    }
+
+    /* Several processes may be creating the file at the same time. */
+    if (ops != NULL && st.st_size == 0) {
+        if (!inn_lock_file(fd, INN_LOCK_WRITE, true)) {
+            syswarn("cannot lock %s", path);
+            goto fail;
+        }
+        if (fstat(fd, &st) < 0) {
+            syswarn("cannot stat %s", path);
+            goto fail;
+        }
+        if (st.st_size == 0 && !latency_create(fd, path, slots, ops, nops))
+            goto fail;
+        inn_lock_file(fd, INN_LOCK_UNLOCK, false);
+    }
+    if (pread(fd, &header, sizeof(header), 0) < (ssize_t) sizeof(header)) {
+        warn("%s is too short", path);
+        goto fail;
+    }
+    if (header.magic != LATENCY_MAGIC || header.version != LATENCY_VERSION
+        || header.slots == 0 || header.histsize != histogram_size()) {
+        warn("%s is invalid", path);
+        goto fail;
+    }
+    if (ops != NULL && header.ops != nops) {
+        warn("%s records other operations", path);
+        goto fail;
+    }
+
+    /* Read the names of the operations, and check them if we have some. */
+    names = xcalloc(header.ops + 1, sizeof(char *));
+    for (i = 0; i < header.ops; i++) {
+        if (pread(fd, name, sizeof(name),
+                  sizeof(header) + i * LATENCY_NAMESIZE)
+            < (ssize_t) sizeof(name)) {
+            warn("%s is too short", path);
+            goto fail;
+        }
+        name[sizeof(name) - 1] = '\0';
+        if (ops != NULL && strncmp(name, ops[i], sizeof(name) - 1) != 0) {
+            warn("%s records other operations", path);
+            goto fail;
+        }
+        names[i] = xstrdup(name);
+    }
+
+    table = xcalloc(1, sizeof(struct latency_table));
+    table->fd = fd;
+    table->path = xstrdup(path);
+    table->slots = header.slots;
+    table->ops = header.ops;
+    table->names = names;
+    table->start = sizeof(header) + header.ops * LATENCY_NAMESIZE;
+    table->slotsize = LATENCY_KEYSIZE
+        + header.ops * (sizeof(unsigned long) + histogram_size());
+    table->hist = histogram_new();
+    return table;
+
+fail:
+    if (names != NULL) {
+        for (i = 0; names[i] != NULL; i++)
+            free(names[i]);
+        free(names);
+    }
+    close(fd);
+    return NULL;
+}
+
+
+/*
+**  Return the slot holding key, taking a free one for it if needed, or -1
+**  if there is none left.
+*/
+static long
+latency_slot(struct latency_table *table, const char *key)
+{
+    HASH hash;
+    unsigned long start, slot, n;
+    off_t offset;
+    char stored[LATENCY_KEYSIZE];
+    bool found;
+
+    hash = Hash(key, strlen(key));
+    memcpy(&start, &hash, sizeof(start));
+    for (n = 0; n < table->slots; n++) {
+        slot = (start + n) % table->slots;
+        offset = table->start + (off_t) slot * table->slotsize;
+        if (!inn_lock_range(table->fd, INN_LOCK_WRITE, true, offset,
+                            LATENCY_KEYSIZE)) {
+            syswarn("cannot lock %s", table->path);
+            return -1;
+        }
+        if (pread(table->fd, stored, sizeof(stored), offset)
+            < (ssize_t) sizeof(stored))
+            stored[0] = '\0';
+        stored[sizeof(stored) - 1] = '\0';
+        found = (strncmp(stored, key, sizeof(stored) - 1) == 0);
+        if (!found && stored[0] == '\0') {
+            memset(stored, 0, sizeof(stored));
+            strlcpy(stored, key, sizeof(stored));
+            if (xpwrite(table->fd, stored, sizeof(stored), offset)
+                < (ssize_t) sizeof(stored))
+                syswarn("cannot write to %s", table->path);
+            else
+                found = true;
+        }
+        inn_lock_range(table->fd, INN_LOCK_UNLOCK, false, offset,
+                       LATENCY_KEYSIZE);
+        if (found)
+            return (long) slot;
+    }
+    if (!table->full)
+        warn("no room left in %s for %s", table->path, key);
+    table->full = true;
+    return -1;
+}
+
+
+bool
+latency_table_add(struct latency_table *table, const char *key, size_t op,
+                  const struct histogram *hist, unsigned long bytes)
+{
+    long slot;
+    off_t offset;
+    size_t size;
+    unsigned long total;
+    bool okay = true;
+
+    if (op >= table->ops)
+        return false;
+    slot = latency_slot(table, key);
+    if (slot < 0)
+        return false;
+    offset = latency_offset(table, slot, op);
+    size = sizeof(unsigned long) + histogram_size();
+    if (!inn_lock_range(table->fd, INN_LOCK_WRITE, true, offset, size)) {
+        syswarn("cannot lock %s", table->path);
+        return false;
+    }
+    if (pread(table->fd, &total, sizeof(total), offset)
+            < (ssize_t) sizeof(total)
+        || pread(table->fd, table->hist, histogram_size(),
+                 offset + sizeof(total)) < (ssize_t) histogram_size()) {
+        total = 0;
+        histogram_reset(table->hist);
+    }
+    total += bytes;
+    histogram_merge(table->hist, hist);
+    if (xpwrite(table->fd, &total, sizeof(total), offset)
+            < (ssize_t) sizeof(total)
+        || xpwrite(table->fd, table->hist, histogram_size(),
+                   offset + sizeof(total)) < (ssize_t) histogram_size()) {
+        syswarn("cannot write to %s", table->path);
+        okay = false;
+    }
+    inn_lock_range(table->fd, INN_LOCK_UNLOCK, false, offset, size);
+    return okay;
+}
+
+
+unsigned long
+latency_table_slots(const struct latency_table *table)
+{
+    return table->slots;
+}
+
+
+size_t
+latency_table_ops(const struct latency_table *table)
+{
+    return table->ops;
+}
+
+
+const char *
+latency_table_opname(const struct latency_table *table, size_t op)
+{
+    return (op < table->ops) ? table->names[op] : NULL;
+}
+
+
+const char *
+latency_table_key(struct latency_table *table, unsigned long slot)
+{
+    off_t offset;
+
+    if (slot >= table->slots)
+        return NULL;
+    offset = table->start + (off_t) slot * table->slotsize;
+    if (pread(table->fd, table->key, sizeof(table->key), offset)
+        < (ssize_t) sizeof(table->key))
+        return NULL;
+    table->key[sizeof(table->key) - 1] = '\0';
+    return (table->key[0] == '\0') ? NULL : table->key;
+}
+
+
+bool
+latency_table_get(struct latency_table *table, unsigned long slot, size_t op,
+                  struct histogram *hist, unsigned long *bytes)
+{
+    off_t offset;
+    size_t size;
+    bool okay;
+
+    if (slot >= table->slots || op >= table->ops)
+        return false;
+    offset = latency_offset(table, slot, op);
+    size = sizeof(*bytes) + histogram_size();
+    if (!inn_lock_range(table->fd, INN_LOCK_READ, true, offset, size))
+        return false;
+    okay = (pread(table->fd, bytes, sizeof(*bytes), offset)
+                == (ssize_t) sizeof(*bytes)
+            && pread(table->fd, hist, histogram_size(),
+                     offset + sizeof(*bytes)) == (ssize_t) histogram_size());
+    inn_lock_range(table->fd, INN_LOCK_UNLOCK, false, offset, size);
+    return okay;
+}
+
+
+void
+latency_table_free(struct latency_table *table)
+{
+    size_t i;
+
+    close(table->fd);
+    for (i = 0; i < table->ops; i++)
+        free(table->names[i]);
+    free(table->names);
+    histogram_free(table->hist);
+    free(table->path);
+    free(table);
+}
@@ -77,10 +77,38 @@
    ISO C99 6.7.8 paragraph 21.  */
 static const unsigned char padding[MD5_CHUNKSIZE] = { 0x80, 0 /* 0, ... */ };
 
+/* md5_hash_many hashes several buffers at once, one per lane of a vector
+   register, where the compiler provides vector types and the target has
+   vector instructions.  On x86_64, eight lanes are used instead of four
+   when the processor supports AVX2, checked at run time. */
+#if defined(__GNUC__) \
+    && (defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__)))
+# define MD5_LANES 4
+# if defined(__x86_64__) && (__GNUC__ >= 5 || defined(__clang__))
+#  define MD5_LANES_AVX2 8
+# endif
+#endif
+#define MD5_MAXLANES 8
+
+/* The state of the hashes done at once, one per lane, and the block each of
+   them is transforming, stored by word so that each word can be loaded in a
+   vector for all the lanes. */
+struct md5_lanes {
+    uint32_t buf[MD5_DIGESTWORDS][MD5_MAXLANES];
+    uint32_t in[MD5_CHUNKWORDS][MD5_MAXLANES];
+};
+
 /* Internal prototypes. */
 static void md5_transform(uint32_t *, const uint32_t *);
 static void md5_update_block(struct md5_context *, const unsigned char *,
                              size_t);
+#ifdef MD5_LANES
+static void md5_transform_lanes(struct md5_lanes *, unsigned int);
+#endif
+#ifdef MD5_LANES_AVX2
+static void md5_transform_lanes_avx2(struct md5_lanes *)
+    __attribute__((__target__("avx2")));
+#endif
 
 /* MD5 requires that input data be treated as words in little-endian byte
    order.  From RFC 1321 section 2:
@@ -354,6 +382,121 @@ md5_hash(const unsigned char *data, size_t length, unsigned char *digest)
 }
 
 
+/*
+**  Hash count buffers at once, data[i] being length[i] bytes long, and put
+**  the digest of data[i] at digests + i * MD5_DIGESTSIZE.  This is faster
+**  than calling md5_hash for each of them where several lanes can be used.
+**
+**  MD5 is a long chain of dependent operations, so a single hash leaves
+**  most of the arithmetic units of the processor idle.  Each lane hashes
+**  one buffer, fed one block at a time, and is given the next buffer as
+**  soon as it is done with one, so that buffers of different lengths still
+**  keep all the lanes busy.  The last block or two of each buffer, with the
+**  padding and the length, are built in a small buffer of the lane.
+*/
+void
+md5_hash_many(const unsigned char *const *data, const size_t *length,
+              size_t count, unsigned char *digests)
+{
+#ifdef MD5_LANES
+    struct md5_lanes lanes;
+    struct {
+        size_t message;                 /* Index of the buffer hashed. */
+        size_t block;                   /* Next block to transform. */
+        size_t full;                    /* Full blocks in the buffer. */
+        size_t blocks;                  /* Blocks including the padding. */
+        unsigned char tail[MD5_CHUNKSIZE * 2];
+    } lane[MD5_MAXLANES];
+    uint32_t words[MD5_CHUNKWORDS];
+    uint32_t *countloc;
+    const unsigned char *block;
+    size_t next, left, i;
+    unsigned int width, active, l;
+    bool busy[MD5_MAXLANES];
+
+    width = MD5_LANES;
+# ifdef MD5_LANES_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        width = MD5_LANES_AVX2;
+# endif
+    memset(&lanes, 0, sizeof(lanes));
+    next = 0;
+    active = 0;
+    for (l = 0; l < width; l++) {
+        busy[l] = false;
+        lane[l].message = 0;
+    }
+    do {
+        /* Give the next buffer to each idle lane, starting its hash. */
+        for (l = 0; l < width; l++) {
+            if (busy[l] || next >= count)
+                continue;
+            lane[l].message = next++;
+            lane[l].block = 0;
+            lane[l].full = length[lane[l].message] / MD5_CHUNKSIZE;
+            left = length[lane[l].message] % MD5_CHUNKSIZE;
+            lane[l].blocks = lane[l].full + ((left < 64 - 8) ? 1 : 2);
+            memset(lane[l].tail, 0, sizeof(lane[l].tail));
+            memcpy(lane[l].tail,
+                   data[lane[l].message] + lane[l].full * MD5_CHUNKSIZE, left);
+            lane[l].tail[left] = 0x80;
+            lanes.buf[0][l] = 0x67452301U;
+            lanes.buf[1][l] = 0xefcdab89U;
+            lanes.buf[2][l] = 0x98badcfeU;
+            lanes.buf[3][l] = 0x10325476U;
+            busy[l] = true;
+            active++;
+        }
+        if (active == 0)
+            break;
+
+        /* Load the next block of each lane and transform all of them. */
+        for (l = 0; l < width; l++) {
+            if (!busy[l])
+                continue;
+            if (lane[l].block < lane[l].full)
+                block = data[lane[l].message] + lane[l].block * MD5_CHUNKSIZE;
+            else
+                block = lane[l].tail
+                    + (lane[l].block - lane[l].full) * MD5_CHUNKSIZE;
+            memcpy(words, block, MD5_CHUNKSIZE);
+            decode(words);
+            if (lane[l].block == lane[l].blocks - 1) {
+                countloc = &words[MD5_CHUNKWORDS - 2];
+                countloc[0] = (uint32_t) (length[lane[l].message] << 3);
+                countloc[1] = (uint32_t) ((uint64_t) length[lane[l].message]
+                                          >> 29);
+            }
+            for (i = 0; i < MD5_CHUNKWORDS; i++)
+                lanes.in[i][l] = words[i];
+        }
+# ifdef MD5_LANES_AVX2
+        if (width == MD5_LANES_AVX2)
+            md5_transform_lanes_avx2(&lanes);
+        else
+# endif
+            md5_transform_lanes(&lanes, width);
+
+        /* Recover the digest of each lane that is done. */
+        for (l = 0; l < width; l++) {
+            if (!busy[l] || ++lane[l].block < lane[l].blocks)
+                continue;
+            for (i = 0; i < MD5_DIGESTWORDS; i++)
+                words[i] = lanes.buf[i][l];
+            encode(words, digests + lane[l].message * MD5_DIGESTSIZE);
+            busy[l] = false;
+            active--;
+        }
+    } while (active > 0 || next < count);
+#else
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        md5_hash(data[i], length[i], digests + i * MD5_DIGESTSIZE);
+#endif
+}
+
+
 /*
 **  Look out, here comes the math.
 **
@@ -422,6 +565,85 @@ md5_hash(const unsigned char *data, size_t length, unsigned char *digest)
         (a) += (b);                                             \
     }
 
+/*
+**  The 64 steps of the transformation of a block, from the state in a, b, c
+**  and d and the words of the block in in.  Used both for one hash and for
+**  several hashes at once with vector types.
+*/
+#define MD5_STEPS(a, b, c, d, in)                                      \
+    /* Round 1 */                                                      \
+    FF(a, b, c, d, in[ 0], S11, 3614090360UL); /*  1 */                \
+    FF(d, a, b, c, in[ 1], S12, 3905402710UL); /*  2 */                \
+    FF(c, d, a, b, in[ 2], S13,  606105819UL); /*  3 */                \
+    FF(b, c, d, a, in[ 3], S14, 3250441966UL); /*  4 */                \
+    FF(a, b, c, d, in[ 4], S11, 4118548399UL); /*  5 */                \
+    FF(d, a, b, c, in[ 5], S12, 1200080426UL); /*  6 */                \
+    FF(c, d, a, b, in[ 6], S13, 2821735955UL); /*  7 */                \
+    FF(b, c, d, a, in[ 7], S14, 4249261313UL); /*  8 */                \
+    FF(a, b, c, d, in[ 8], S11, 1770035416UL); /*  9 */                \
+    FF(d, a, b, c, in[ 9], S12, 2336552879UL); /* 10 */                \
+    FF(c, d, a, b, in[10], S13, 4294925233UL); /* 11 */                \
+    FF(b, c, d, a, in[11], S14, 2304563134UL); /* 12 */                \
+    FF(a, b, c, d, in[12], S11, 1804603682UL); /* 13 */                \
+    FF(d, a, b, c, in[13], S12, 4254626195UL); /* 14 */                \
+    FF(c, d, a, b, in[14], S13, 2792965006UL); /* 15 */                \
+    FF(b, c, d, a, in[15], S14, 1236535329UL); /* 16 */                \
+                                                                       \
+    /* Round 2 */                                                      \
+    GG(a, b, c, d, in[ 1], S21, 4129170786UL); /* 17 */                \
+    GG(d, a, b, c, in[ 6], S22, 3225465664UL); /* 18 */                \
+    GG(c, d, a, b, in[11], S23,  643717713UL); /* 19 */                \
+    GG(b, c, d, a, in[ 0], S24, 3921069994UL); /* 20 */                \
+    GG(a, b, c, d, in[ 5], S21, 3593408605UL); /* 21 */                \
+    GG(d, a, b, c, in[10], S22,   38016083UL); /* 22 */                \
+    GG(c, d, a, b, in[15], S23, 3634488961UL); /* 23 */                \
+    GG(b, c, d, a, in[ 4], S24, 3889429448UL); /* 24 */                \
+    GG(a, b, c, d, in[ 9], S21,  568446438UL); /* 25 */                \
+    GG(d, a, b, c, in[14], S22, 3275163606UL); /* 26 */                \
+    GG(c, d, a, b, in[ 3], S23, 4107603335UL); /* 27 */                \
+    GG(b, c, d, a, in[ 8], S24, 1163531501UL); /* 28 */                \
+    GG(a, b, c, d, in[13], S21, 2850285829UL); /* 29 */                \
+    GG(d, a, b, c, in[ 2], S22, 4243563512UL); /* 30 */                \
+    GG(c, d, a, b, in[ 7], S23, 1735328473UL); /* 31 */                \
+    GG(b, c, d, a, in[12], S24, 2368359562UL); /* 32 */                \
+                                                                       \
+    /* Round 3 */                                                      \
+    HH(a, b, c, d, in[ 5], S31, 4294588738UL); /* 33 */                \
+    HH(d, a, b, c, in[ 8], S32, 2272392833UL); /* 34 */                \
+    HH(c, d, a, b, in[11], S33, 1839030562UL); /* 35 */                \
+    HH(b, c, d, a, in[14], S34, 4259657740UL); /* 36 */                \
+    HH(a, b, c, d, in[ 1], S31, 2763975236UL); /* 37 */                \
+    HH(d, a, b, c, in[ 4], S32, 1272893353UL); /* 38 */                \
+    HH(c, d, a, b, in[ 7], S33, 4139469664UL); /* 39 */                \
+    HH(b, c, d, a, in[10], S34, 3200236656UL); /* 40 */                \
+    HH(a, b, c, d, in[13], S31,  681279174UL); /* 41 */                \
+    HH(d, a, b, c, in[ 0], S32, 3936430074UL); /* 42 */                \
+    HH(c, d, a, b, in[ 3], S33, 3572445317UL); /* 43 */                \
+    HH(b, c, d, a, in[ 6], S34,   76029189UL); /* 44 */                \
+    HH(a, b, c, d, in[ 9], S31, 3654602809UL); /* 45 */                \
+    HH(d, a, b, c, in[12], S32, 3873151461UL); /* 46 */                \
+    HH(c, d, a, b, in[15], S33,  530742520UL); /* 47 */                \
+    HH(b, c, d, a, in[ 2], S34, 3299628645UL); /* 48 */                \
+                                                                       \
+    /* Round 4 */                                                      \
+    II(a, b, c, d, in[ 0], S41, 4096336452UL); /* 49 */                \
+    II(d, a, b, c, in[ 7], S42, 1126891415UL); /* 50 */                \
+    II(c, d, a, b, in[14], S43, 2878612391UL); /* 51 */                \
+    II(b, c, d, a, in[ 5], S44, 4237533241UL); /* 52 */                \
+    II(a, b, c, d, in[12], S41, 1700485571UL); /* 53 */                \
+    II(d, a, b, c, in[ 3], S42, 2399980690UL); /* 54 */                \
+    II(c, d, a, b, in[10], S43, 4293915773UL); /* 55 */                \
+    II(b, c, d, a, in[ 1], S44, 2240044497UL); /* 56 */                \
+    II(a, b, c, d, in[ 8], S41, 1873313359UL); /* 57 */                \
+    II(d, a, b, c, in[15], S42, 4264355552UL); /* 58 */                \
+    II(c, d, a, b, in[ 6], S43, 2734768916UL); /* 59 */                \
+    II(b, c, d, a, in[13], S44, 1309151649UL); /* 60 */                \
+    II(a, b, c, d, in[ 4], S41, 4149444226UL); /* 61 */                \
+    II(d, a, b, c, in[11], S42, 3174756917UL); /* 62 */                \
+    II(c, d, a, b, in[ 2], S43,  718787259UL); /* 63 */                \
+    II(b, c, d, a, in[ 9], S44, 3951481745UL); /* 64 */
+
+
 /*
 **  Basic MD5 step.  Transforms buf based on in.
 */
@@ -433,80 +655,90 @@ md5_transform(uint32_t *buf, const uint32_t *in)
     uint32_t c = buf[2];
     uint32_t d = buf[3];
 
-    /* Round 1 */
-    FF(a, b, c, d, in[ 0], S11, 3614090360UL); /*  1 */
-    FF(d, a, b, c, in[ 1], S12, 3905402710UL); /*  2 */
-    FF(c, d, a, b, in[ 2], S13,  606105819UL); /*  3 */
-    FF(b, c, d, a, in[ 3], S14, 3250441966UL); /*  4 */
-    FF(a, b, c, d, in[ 4], S11, 4118548399UL); /*  5 */
-    FF(d, a, b, c, in[ 5], S12, 1200080426UL); /*  6 */
-    FF(c, d, a, b, in[ 6], S13, 2821735955UL); /*  7 */
-    FF(b, c, d, a, in[ 7], S14, 4249261313UL); /*  8 */
-    FF(a, b, c, d, in[ 8], S11, 1770035416UL); /*  9 */
-    FF(d, a, b, c, in[ 9], S12, 2336552879UL); /* 10 */
-    FF(c, d, a, b, in[10], S13, 4294925233UL); /* 11 */
-    FF(b, c, d, a, in[11], S14, 2304563134UL); /* 12 */
-    FF(a, b, c, d, in[12], S11, 1804603682UL); /* 13 */
-    FF(d, a, b, c, in[13], S12, 4254626195UL); /* 14 */
-    FF(c, d, a, b, in[14], S13, 2792965006UL); /* 15 */
-    FF(b, c, d, a, in[15], S14, 1236535329UL); /* 16 */
-
-    /* Round 2 */
-    GG(a, b, c, d, in[ 1], S21, 4129170786UL); /* 17 */
-    GG(d, a, b, c, in[ 6], S22, 3225465664UL); /* 18 */
-    GG(c, d, a, b, in[11], S23,  643717713UL); /* 19 */
-    GG(b, c, d, a, in[ 0], S24, 3921069994UL); /* 20 */
-    GG(a, b, c, d, in[ 5], S21, 3593408605UL); /* 21 */
-    GG(d, a, b, c, in[10], S22,   38016083UL); /* 22 */
-    GG(c, d, a, b, in[15], S23, 3634488961UL); /* 23 */
-    GG(b, c, d, a, in[ 4], S24, 3889429448UL); /* 24 */
-    GG(a, b, c, d, in[ 9], S21,  568446438UL); /* 25 */
-    GG(d, a, b, c, in[14], S22, 3275163606UL); /* 26 */
-    GG(c, d, a, b, in[ 3], S23, 4107603335UL); /* 27 */
-    GG(b, c, d, a, in[ 8], S24, 1163531501UL); /* 28 */
-    GG(a, b, c, d, in[13], S21, 2850285829UL); /* 29 */
-    GG(d, a, b, c, in[ 2], S22, 4243563512UL); /* 30 */
-    GG(c, d, a, b, in[ 7], S23, 1735328473UL); /* 31 */
-    GG(b, c, d, a, in[12], S24, 2368359562UL); /* 32 */
-
-    /* Round 3 */
-    HH(a, b, c, d, in[ 5], S31, 4294588738UL); /* 33 */
-    HH(d, a, b, c, in[ 8], S32, 2272392833UL); /* 34 */
-    HH(c, d, a, b, in[11], S33, 1839030562UL); /* 35 */
-    HH(b, c, d, a, in[14], S34, 4259657740UL); /* 36 */
-    HH(a, b, c, d, in[ 1], S31, 2763975236UL); /* 37 */
-    HH(d, a, b, c, in[ 4], S32, 1272893353UL); /* 38 */
-    HH(c, d, a, b, in[ 7], S33, 4139469664UL); /* 39 */
-    HH(b, c, d, a, in[10], S34, 3200236656UL); /* 40 */
-    HH(a, b, c, d, in[13], S31,  681279174UL); /* 41 */
-    HH(d, a, b, c, in[ 0], S32, 3936430074UL); /* 42 */
-    HH(c, d, a, b, in[ 3], S33, 3572445317UL); /* 43 */
-    HH(b, c, d, a, in[ 6], S34,   76029189UL); /* 44 */
-    HH(a, b, c, d, in[ 9], S31, 3654602809UL); /* 45 */
-    HH(d, a, b, c, in[12], S32, 3873151461UL); /* 46 */
-    HH(c, d, a, b, in[15], S33,  530742520UL); /* 47 */
-    HH(b, c, d, a, in[ 2], S34, 3299628645UL); /* 48 */
-
-    /* Round 4 */
-    II(a, b, c, d, in[ 0], S41, 4096336452UL); /* 49 */
-    II(d, a, b, c, in[ 7], S42, 1126891415UL); /* 50 */
-    II(c, d, a, b, in[14], S43, 2878612391UL); /* 51 */
-    II(b, c, d, a, in[ 5], S44, 4237533241UL); /* 52 */
-    II(a, b, c, d, in[12], S41, 1700485571UL); /* 53 */
-    II(d, a, b, c, in[ 3], S42, 2399980690UL); /* 54 */
-    II(c, d, a, b, in[10], S43, 4293915773UL); /* 55 */
-    II(b, c, d, a, in[ 1], S44, 2240044497UL); /* 56 */
-    II(a, b, c, d, in[ 8], S41, 1873313359UL); /* 57 */
-    II(d, a, b, c, in[15], S42, 4264355552UL); /* 58 */
-    II(c, d, a, b, in[ 6], S43, 2734768916UL); /* 59 */
-    II(b, c, d, a, in[13], S44, 1309151649UL); /* 60 */
-    II(a, b, c, d, in[ 4], S41, 4149444226UL); /* 61 */
-    II(d, a, b, c, in[11], S42, 3174756917UL); /* 62 */
-    II(c, d, a, b, in[ 2], S43,  718787259UL); /* 63 */
-    II(b, c, d, a, in[ 9], S44, 3951481745UL); /* 64 */
+    MD5_STEPS(a, b, c, d, in);
 
     buf[0] += a;
     buf[1] += b;
     buf[2] += c;
     buf[3] += d;
 }
+
+
+#ifdef MD5_LANES
+/*
+**  Transforms the state of each of the first width lanes based on its
+**  block, four lanes at a time.  The same macros work on vector types,
+**  whose operations apply to each lane.
+*/
+typedef uint32_t md5_vector __attribute__((__vector_size__(16)));
+
+static void
+md5_transform_lanes(struct md5_lanes *lanes, unsigned int width)
+{
+    md5_vector a, b, c, d, in[MD5_CHUNKWORDS];
+    md5_vector aa, bb, cc, dd;
+    unsigned int i, l;
+
+    for (l = 0; l < width; l += 4) {
+        memcpy(&a, &lanes->buf[0][l], sizeof(a));
+        memcpy(&b, &lanes->buf[1][l], sizeof(b));
+        memcpy(&c, &lanes->buf[2][l], sizeof(c));
+        memcpy(&d, &lanes->buf[3][l], sizeof(d));
+        for (i = 0; i < MD5_CHUNKWORDS; i++)
+            memcpy(&in[i], &lanes->in[i][l], sizeof(in[i]));
+        aa = a;
+        bb = b;
+        cc = c;
+        dd = d;
+
+        MD5_STEPS(a, b, c, d, in);
+
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+        memcpy(&lanes->buf[0][l], &a, sizeof(a));
+        memcpy(&lanes->buf[1][l], &b, sizeof(b));
+        memcpy(&lanes->buf[2][l], &c, sizeof(c));
+        memcpy(&lanes->buf[3][l], &d, sizeof(d));
+    }
+}
+#endif /* MD5_LANES */
+
+
+#ifdef MD5_LANES_AVX2
+/*
+**  Same as md5_transform_lanes, with eight lanes at once.
+*/
+typedef uint32_t md5_vector_avx2 __attribute__((__vector_size__(32)));
+
+static void
+md5_transform_lanes_avx2(struct md5_lanes *lanes)
+{
+    md5_vector_avx2 a, b, c, d, in[MD5_CHUNKWORDS];
+    md5_vector_avx2 aa, bb, cc, dd;
+    unsigned int i;
+
+    memcpy(&a, lanes->buf[0], sizeof(a));
+    memcpy(&b, lanes->buf[1], sizeof(b));
+    memcpy(&c, lanes->buf[2], sizeof(c));
+    memcpy(&d, lanes->buf[3], sizeof(d));
+    for (i = 0; i < MD5_CHUNKWORDS; i++)
+        memcpy(&in[i], lanes->in[i], sizeof(in[i]));
+    aa = a;
+    bb = b;
+    cc = c;
+    dd = d;
+
+    MD5_STEPS(a, b, c, d, in);
+
+    a += aa;
+    b += bb;
+    c += cc;
+    d += dd;
+    memcpy(lanes->buf[0], &a, sizeof(a));
+    memcpy(lanes->buf[1], &b, sizeof(b));
+    memcpy(lanes->buf[2], &c, sizeof(c));
+    memcpy(lanes->buf[3], &d, sizeof(d));
+}
+#endif /* MD5_LANES_AVX2 */
@@ -0,0 +1,84 @@
+/*
+**  Formatting of statistics for monitoring systems.
+**
+**  See include/inn/metrics.h for the description of the format.  Metric and
+**  label names are trusted to be valid, since they are always constants in
+**  the callers; only label values, which may come from configuration files
+**  or the network, need escaping.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <stdarg.h>
+
+#include "inn/buffer.h"
+#include "inn/metrics.h"
+
+
+void
+metrics_family(struct buffer *out, const char *name, const char *type,
+               const char *help)
+{
+    buffer_append_sprintf(out, "# TYPE %s %s\n# HELP %s %s\n", name, type,
+                          name, help);
+}
+
+
+/*
+**  Append a label value between double quotes, escaping backslashes, double
+**  quotes and newlines.
+*/
+static void
+metrics_label_value(struct buffer *out, const char *value)
+{
+    const char *p;
+
+    buffer_append(out, "\"", 1);
+    for (p = value; *p != '\0'; p++) {
+        switch (*p) {
+        case '\\':
+            buffer_append(out, "\\\\", 2);
+            break;
+        case '"':
+            buffer_append(out, "\\\"", 2);
+            break;
+        case '\n':
+            buffer_append(out, "\\n", 2);
+            break;
+        default:
+            buffer_append(out, p, 1);
+            break;
+        }
+    }
+    buffer_append(out, "\"", 1);
+}
+
+
+void
+metrics_sample(struct buffer *out, const char *name, double value, ...)
+{
+    va_list args;
+    const char *label;
+    bool first = true;
+
+    buffer_append(out, name, strlen(name));
+    va_start(args, value);
+    while ((label = va_arg(args, const char *)) != NULL) {
+        buffer_append(out, first ? "{" : ",", 1);
+        buffer_append(out, label, strlen(label));
+        buffer_append(out, "=", 1);
+        metrics_label_value(out, va_arg(args, const char *));
+        first = false;
+    }
+    va_end(args);
+    if (!first)
+        buffer_append(out, "}", 1);
+    buffer_append_sprintf(out, " %.15g\n", value);
+}
+
+
+void
+metrics_end(struct buffer *out)
+{
+    buffer_append(out, "# EOF\n", 6);
+}
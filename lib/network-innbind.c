@@ -69,6 +69,18 @@ network_recvfd(int streams_pipe UNUSED)
 #endif
 
 
+/*
+ * Whether sockets have to be bound through innbind: when binding a privileged
+ * port without being root, and when reuseport is set, since the generic
+ * network functions don't set SO_REUSEPORT before binding.
+ */
+static bool
+network_innbind_needed(void)
+{
+    return innconf->reuseport || (innconf->port < 1024 && geteuid() != 0);
+}
+
+
 /*
  * Call innbind to bind a socket to a privileged port.  Takes the file
  * descriptor, the family, the bind address (as a string), and the port
@@ -159,7 +171,7 @@ network_innbind_ipv4(int type, const char *address, unsigned short port)
     socket_type fd, bindfd;
 
     /* Use the generic network function when innbind is not necessary. */
-    if (innconf->port >= 1024 || geteuid() == 0) {
+    if (!network_innbind_needed()) {
         return network_bind_ipv4(type, address, port);
     }
 
@@ -170,6 +182,8 @@ network_innbind_ipv4(int type, const char *address, unsigned short port)
         return INVALID_SOCKET;
     }
     network_set_reuseaddr(fd);
+    if (innconf->reuseport)
+        network_set_reuseport(fd);
 
     /* Accept "any" or "all" in the bind address to mean 0.0.0.0. */
     if (!strcmp(address, "any") || !strcmp(address, "all"))
@@ -202,7 +216,7 @@ network_innbind_ipv6(int type, const char *address, unsigned short port)
     socket_type fd, bindfd;
 
     /* Use the generic network function when innbind is not necessary. */
-    if (innconf->port >= 1024 || geteuid() == 0) {
+    if (!network_innbind_needed()) {
         return network_bind_ipv6(type, address, port);
     }
 
@@ -215,6 +229,8 @@ network_innbind_ipv6(int type, const char *address, unsigned short port)
         return INVALID_SOCKET;
     }
     network_set_reuseaddr(fd);
+    if (innconf->reuseport)
+        network_set_reuseport(fd);
 
     /*
      * Restrict the socket to IPv6 only if possible.  The default behavior is
@@ -284,7 +300,7 @@ network_innbind_all(int type, unsigned short port, socket_type **fds,
     char service[16], name[INET6_ADDRSTRLEN];
 
     /* Use the generic network function when innbind is not necessary. */
-    if (innconf->port >= 1024 || geteuid() == 0) {
+    if (!network_innbind_needed()) {
         return network_bind_all(type, port, fds, count);
     }
 
@@ -344,7 +360,7 @@ network_innbind_all(int type, unsigned short port, socket_type **fds,
     socket_type fd;
 
     /* Use the generic network function when innbind is not necessary. */
-    if (innconf->port >= 1024 || geteuid() == 0) {
+    if (!network_innbind_needed()) {
         return network_bind_all(type, port, fds, count);
     }
 
@@ -101,6 +101,22 @@ network_set_reuseaddr(socket_type fd UNUSED)
 }
 
 
+/*
+ * Set SO_REUSEPORT on a socket if possible, so that several daemons can
+ * listen on the same port and share the incoming connections.
+ */
+void
+network_set_reuseport(socket_type fd UNUSED)
+{
+#ifdef SO_REUSEPORT
+    int flag = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) < 0)
+        syswarn("cannot mark bind port shareable");
+#endif
+}
+
+
 /*
  * Set IPV6_V6ONLY on a socket if possible, since the IPv6 behavior is more
  * consistent and easier to understand.
@@ -499,96 +515,296 @@ network_source(socket_type fd, int family, const char *source)
 
 
 /*
- * Internal helper function that waits for a non-blocking connect to complete
- * on a socket.  Takes the file descriptor and the timeout.  Returns 0 on a
- * successful completion of the connect within the timeout and -1 on failure.
- * On failure, sets the socket errno.
+ * The state of a race between connection attempts to the addresses of a
+ * remote service.  The addresses are tried in the order given by addrs, one
+ * more every stagger seconds as long as none of the attempts in progress has
+ * connected, or at once when all of them have failed.
  */
-static int
-connect_wait(socket_type fd, time_t timeout)
+struct network_race {
+    const struct addrinfo **addrs; /* Addresses in the order to try them. */
+    size_t count;                  /* Number of addresses. */
+    size_t next;                   /* Index of the next address to try. */
+    socket_type *fds;              /* Sockets of the attempts in progress. */
+    double *started;               /* When each of these attempts started. */
+    size_t active;                 /* Number of attempts in progress. */
+    char *source;                  /* Source address, if any. */
+    double stagger;                /* Seconds between two attempts. */
+    time_t timeout;                /* Seconds before giving up an attempt. */
+    double last;                   /* When the last attempt started. */
+    int error;                     /* Error of the last failed attempt. */
+};
+
+
+/*
+ * Return the current time in seconds, as a double.
+ */
+static double
+network_now(void)
 {
-    int status, err;
-    socklen_t length;
     struct timeval tv;
-    fd_set set;
 
-    /*
-     * Use select to poll the file descriptor.  Loop if interrupted by a
-     * caught signal.  This means we could wait for longer than the timeout
-     * when interrupted, but there's no good way of recovering the elapsed
-     * time that's worth the hassle.
-     */
-    do {
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
-        FD_ZERO(&set);
-        FD_SET(fd, &set);
-        status = select(fd + 1, NULL, &set, NULL, &tv);
-    } while (status < 0 && socket_errno == EINTR);
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
 
-    /*
-     * If we timed out, set errno appropriately.  If the connection completes,
-     * retrieve the actual status from the socket.
-     */
-    if (status == 0 && !FD_ISSET(fd, &set)) {
-        status = -1;
-        socket_set_errno(ETIMEDOUT);
-    } else if (status > 0 && FD_ISSET(fd, &set)) {
-        length = sizeof(err);
-        status = getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &length);
-        if (status == 0) {
-            status = (err == 0) ? 0 : -1;
-            socket_set_errno(err);
+
+/*
+ * Drop the attempt at the given index of those in progress, closing its
+ * socket, and remember its error.
+ */
+static void
+network_race_drop(struct network_race *race, size_t i, int error)
+{
+    socket_close(race->fds[i]);
+    race->error = error;
+    race->active--;
+    race->fds[i] = race->fds[race->active];
+    race->started[i] = race->started[race->active];
+}
+
+
+/*
+ * Start a connection attempt to the next address.  Returns the socket if it
+ * connected at once, and otherwise INVALID_SOCKET, having either added the
+ * attempt to those in progress or recorded its error.
+ */
+static socket_type
+network_race_next(struct network_race *race, double now)
+{
+    const struct addrinfo *ai;
+    socket_type fd;
+    int status;
+
+    ai = race->addrs[race->next++];
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == INVALID_SOCKET) {
+        race->error = socket_errno;
+        return INVALID_SOCKET;
+    }
+    if (!network_source(fd, ai->ai_family, race->source)
+        || !fdflag_nonblocking(fd, true)) {
+        race->error = socket_errno;
+        socket_close(fd);
+        return INVALID_SOCKET;
+    }
+    status = connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (status == 0)
+        return fd;
+    if (socket_errno != EINPROGRESS) {
+        race->error = socket_errno;
+        socket_close(fd);
+        return INVALID_SOCKET;
+    }
+    race->fds[race->active] = fd;
+    race->started[race->active] = now;
+    race->active++;
+    race->last = now;
+    return INVALID_SOCKET;
+}
+
+
+/*
+ * Start racing connection attempts to the remote service given by the linked
+ * list of addrinfo structs, which must not be freed before the race is.  As
+ * recommended by RFC 8305, the addresses are tried alternating between the
+ * family of the first one and the other ones, so that a family that doesn't
+ * work only delays the connection by stagger seconds.
+ */
+struct network_race *
+network_race_start(const struct addrinfo *ai, const char *source,
+                   double stagger, time_t timeout)
+{
+    struct network_race *race;
+    const struct addrinfo *p, *q;
+    size_t count;
+
+    race = xcalloc(1, sizeof(struct network_race));
+    for (count = 0, p = ai; p != NULL; p = p->ai_next)
+        count++;
+    race->addrs = xcalloc(count + 1, sizeof(const struct addrinfo *));
+    race->fds = xcalloc(count + 1, sizeof(socket_type));
+    race->started = xcalloc(count + 1, sizeof(double));
+    race->source = (source == NULL) ? NULL : xstrdup(source);
+    race->stagger = (stagger < 0) ? 0 : stagger;
+    race->timeout = timeout;
+    race->error = EHOSTUNREACH;
+
+    /* Interleave the first family with the other ones. */
+    p = ai;
+    q = ai;
+    while (race->count < count) {
+        while (p != NULL && p->ai_family != ai->ai_family)
+            p = p->ai_next;
+        if (p != NULL) {
+            race->addrs[race->count++] = p;
+            p = p->ai_next;
+        }
+        while (q != NULL && q->ai_family == ai->ai_family)
+            q = q->ai_next;
+        if (q != NULL) {
+            race->addrs[race->count++] = q;
+            q = q->ai_next;
         }
     }
-    return status;
+    return race;
 }
 
 
 /*
- * Given a linked list of addrinfo structs representing the remote service,
- * try to create a local socket and connect to that service.  Takes an
- * optional source address.  Try each address in turn until one of them
- * connects.  Returns the file descriptor of the open socket on success, or
- * INVALID_SOCKET on failure.  Tries to leave the reason for the failure in
- * errno.
+ * Move the race forward without blocking: collect the attempts that have
+ * completed, give up on those that have timed out, and start the attempts
+ * that are due.  Returns the socket of the first attempt that connected, put
+ * back in blocking mode, which the race no longer owns.  Otherwise, returns
+ * INVALID_SOCKET with the socket errno set to EINPROGRESS if attempts are
+ * still in progress, after filling set with their sockets, maxfd with the
+ * highest of them, and wait with how many seconds to wait at most for one of
+ * them to become writable before calling this function again (or -1 if there
+ * is no limit).  If every attempt failed, the socket errno is set to the
+ * error of the last one.
  */
 socket_type
-network_connect(const struct addrinfo *ai, const char *source, time_t timeout)
+network_race_poll(struct network_race *race, fd_set *set, socket_type *maxfd,
+                  double *wait)
 {
+    struct timeval tv;
     socket_type fd = INVALID_SOCKET;
-    int oerrno, status;
+    socklen_t length;
+    double now;
+    size_t i;
+    int err;
 
-    for (status = -1; status != 0 && ai != NULL; ai = ai->ai_next) {
-        if (fd != INVALID_SOCKET)
-            socket_close(fd);
-        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-        if (fd == INVALID_SOCKET)
-            continue;
-        if (!network_source(fd, ai->ai_family, source))
-            continue;
-        if (timeout == 0)
-            status = connect(fd, ai->ai_addr, ai->ai_addrlen);
-        else {
-            fdflag_nonblocking(fd, true);
-            status = connect(fd, ai->ai_addr, ai->ai_addrlen);
-            if (status < 0 && socket_errno == EINPROGRESS)
-                status = connect_wait(fd, timeout);
-            oerrno = socket_errno;
-            fdflag_nonblocking(fd, false);
-            socket_set_errno(oerrno);
+    /* Collect the attempts that have completed. */
+    if (race->active > 0) {
+        FD_ZERO(set);
+        *maxfd = 0;
+        for (i = 0; i < race->active; i++) {
+            FD_SET(race->fds[i], set);
+            if (race->fds[i] > *maxfd)
+                *maxfd = race->fds[i];
+        }
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        if (select(*maxfd + 1, NULL, set, NULL, &tv) > 0) {
+            for (i = 0; i < race->active && fd == INVALID_SOCKET;) {
+                if (!FD_ISSET(race->fds[i], set)) {
+                    i++;
+                    continue;
+                }
+                length = sizeof(err);
+                if (getsockopt(race->fds[i], SOL_SOCKET, SO_ERROR, &err,
+                               &length)
+                    < 0)
+                    err = socket_errno;
+                if (err == 0) {
+                    fd = race->fds[i];
+                    race->active--;
+                    race->fds[i] = race->fds[race->active];
+                    race->started[i] = race->started[race->active];
+                } else {
+                    FD_CLR(race->fds[i], set);
+                    network_race_drop(race, i, err);
+                }
+            }
         }
     }
-    if (status == 0)
+
+    /* Give up on the attempts that have timed out, and start those due. */
+    now = network_now();
+    if (fd == INVALID_SOCKET && race->timeout > 0) {
+        for (i = 0; i < race->active;)
+            if (now >= race->started[i] + race->timeout)
+                network_race_drop(race, i, ETIMEDOUT);
+            else
+                i++;
+    }
+    while (fd == INVALID_SOCKET && race->next < race->count
+           && (race->active == 0 || now >= race->last + race->stagger))
+        fd = network_race_next(race, now);
+    if (fd != INVALID_SOCKET) {
+        fdflag_nonblocking(fd, false);
         return fd;
-    else {
-        if (fd != INVALID_SOCKET) {
-            oerrno = socket_errno;
-            socket_close(fd);
-            socket_set_errno(oerrno);
-        }
+    }
+    if (race->active == 0) {
+        socket_set_errno(race->error);
         return INVALID_SOCKET;
     }
+
+    /* Still racing.  Tell the caller what to wait for. */
+    FD_ZERO(set);
+    *maxfd = 0;
+    *wait = -1;
+    for (i = 0; i < race->active; i++) {
+        FD_SET(race->fds[i], set);
+        if (race->fds[i] > *maxfd)
+            *maxfd = race->fds[i];
+        if (race->timeout > 0
+            && (*wait < 0 || race->started[i] + race->timeout - now < *wait))
+            *wait = race->started[i] + race->timeout - now;
+    }
+    if (race->next < race->count
+        && (*wait < 0 || race->last + race->stagger - now < *wait))
+        *wait = race->last + race->stagger - now;
+    if (*wait < -0.5)
+        *wait = -1;
+    else if (*wait < 0)
+        *wait = 0;
+    socket_set_errno(EINPROGRESS);
+    return INVALID_SOCKET;
+}
+
+
+/*
+ * Free a race, closing the sockets of the attempts still in progress.
+ */
+void
+network_race_free(struct network_race *race)
+{
+    size_t i;
+
+    for (i = 0; i < race->active; i++)
+        socket_close(race->fds[i]);
+    free(race->addrs);
+    free(race->fds);
+    free(race->started);
+    free(race->source);
+    free(race);
+}
+
+
+/*
+ * Given a linked list of addrinfo structs representing the remote service,
+ * try to create a local socket and connect to that service.  Takes an
+ * optional source address.  The addresses are raced with a delay of
+ * NETWORK_RACE_STAGGER between two attempts, and the first one to connect is
+ * used.  Returns the file descriptor of the open socket on success, or
+ * INVALID_SOCKET on failure.  Tries to leave the reason for the failure in
+ * errno.
+ */
+socket_type
+network_connect(const struct addrinfo *ai, const char *source, time_t timeout)
+{
+    struct network_race *race;
+    struct timeval tv;
+    fd_set set;
+    socket_type fd, maxfd;
+    double wait;
+    int oerrno;
+
+    race = network_race_start(ai, source, NETWORK_RACE_STAGGER, timeout);
+    while (true) {
+        fd = network_race_poll(race, &set, &maxfd, &wait);
+        if (fd != INVALID_SOCKET || socket_errno != EINPROGRESS)
+            break;
+        tv.tv_sec = (time_t) wait;
+        tv.tv_usec = (long) ((wait - tv.tv_sec) * 1e6);
+        if (select(maxfd + 1, NULL, &set, NULL, (wait < 0) ? NULL : &tv) < 0
+            && socket_errno != EINTR)
+            break;
+    }
+    oerrno = socket_errno;
+    network_race_free(race);
+    socket_set_errno(oerrno);
+    return fd;
 }
 
 
@@ -5,10 +5,17 @@
 **  This package uses internal buffering like stdio, but is even more
 **  aggressive about its buffering.  The basic read call reads a single line
 **  and returns the whole line, provided that it can fit in the buffer.
+**
+**  Regular files larger than a buffer are instead mapped privately, with
+**  sequential access advised, and each line is cut in place by overwriting
+**  its newline, so nothing is copied.  Once the end of the mapping is
+**  reached (a last line without a newline, or data appended after the file
+**  was mapped), reading goes on from the descriptor as usual.
 */
 
 #include "config.h"
 #include "clibrary.h"
+#include "portable/mmap.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -17,6 +24,67 @@
 #include "inn/libinn.h"
 
 
+/*
+**  Try to map the rest of the file open on a quick file, from the current
+**  offset of its descriptor, which is then moved to the end of the mapping.
+**  Does nothing and returns false if the descriptor isn't a regular file or
+**  there isn't enough data left in it to be worth it.
+*/
+static bool
+QIOmap(QIOSTATE *qp)
+{
+    struct stat st;
+    off_t offset, base;
+    size_t length;
+    void *p;
+
+    if (fstat(qp->_fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return false;
+    offset = lseek(qp->_fd, 0, SEEK_CUR);
+    if (offset < 0 || st.st_size - offset <= QIO_BUFFERSIZE)
+        return false;
+    base = offset - offset % getpagesize();
+    length = st.st_size - base;
+    if ((off_t) length != st.st_size - base)
+        return false;
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, qp->_fd,
+             base);
+    if (p == MAP_FAILED)
+        return false;
+    if (lseek(qp->_fd, st.st_size, SEEK_SET) < 0) {
+        munmap(p, length);
+        return false;
+    }
+    madvise(p, length, MADV_SEQUENTIAL);
+    qp->_map = p;
+    qp->_maplength = length;
+    qp->_start = qp->_map + (offset - base);
+    qp->_end = qp->_map + length;
+    qp->_count += st.st_size - offset;
+    return true;
+}
+
+
+/*
+**  Give up the mapping of a quick file, moving the unread data at its end
+**  to the buffer.  There is always less than QIO_BUFFERSIZE of it.
+*/
+static void
+QIOunmap(QIOSTATE *qp)
+{
+    size_t nleft;
+
+    nleft = qp->_end - qp->_start;
+    if (nleft > 0)
+        memcpy(qp->_buffer, qp->_start, nleft);
+    munmap(qp->_map, qp->_maplength);
+    qp->_map = NULL;
+    qp->_maplength = 0;
+    qp->_start = qp->_buffer;
+    qp->_end = qp->_buffer + nleft;
+}
+
+
 /*
 **  Open a quick file from a descriptor.
 */
@@ -33,7 +101,10 @@ QIOfdopen(const int fd)
     qp->_start = qp->_buffer;
     qp->_end = qp->_buffer;
     qp->_count = 0;
+    qp->_map = NULL;
+    qp->_maplength = 0;
     qp->_flag = QIO_ok;
+    QIOmap(qp);
 
     return qp;
 }
@@ -60,6 +131,8 @@ QIOopen(const char *name)
 void
 QIOclose(QIOSTATE *qp)
 {
+    if (qp->_map != NULL)
+        munmap(qp->_map, qp->_maplength);
     close(qp->_fd);
     free(qp->_buffer);
     free(qp);
@@ -76,8 +149,16 @@ QIOrewind(QIOSTATE *qp)
 {
     ssize_t nread;
 
+    if (qp->_map != NULL) {
+        munmap(qp->_map, qp->_maplength);
+        qp->_map = NULL;
+        qp->_maplength = 0;
+    }
     if (lseek(qp->_fd, 0, SEEK_SET) < 0)
         return -1;
+    qp->_count = 0;
+    if (QIOmap(qp))
+        return 0;
     nread = read(qp->_fd, qp->_buffer, qp->_size);
     if (nread < 0)
         return nread;
@@ -88,6 +169,18 @@ QIOrewind(QIOSTATE *qp)
 }
 
 
+/*
+**  Return true if a complete line is already in the buffer, so that the next
+**  QIOread won't have to wait for more data.  Lets callers that batch their
+**  work flush it before they would block.
+*/
+bool
+QIOhasline(const QIOSTATE *qp)
+{
+    return memchr(qp->_start, '\n', qp->_end - qp->_start) != NULL;
+}
+
+
 /*
 **  Get the next newline-terminated line from a quick file, replacing the
 **  newline with a nul.  Returns a pointer to that line on success and NULL
@@ -105,46 +198,51 @@ QIOread(QIOSTATE *qp)
     while (1) {
         nleft = qp->_end - qp->_start;
 
-        /* If (unsigned) nleft = 0, the buffer currently contains no data that
-           hasn't previously been returned by QIOread, so we can overwrite the
-           buffer with new data.  Otherwise, first check the existing data
-           to see if we have a full line. */
-        if (nleft == 0) {
-            qp->_start = qp->_buffer;
-            qp->_end = qp->_buffer;
-        } else {
+        /* First check the data that hasn't been returned by QIOread yet to
+           see if we have a full line.  A line of QIO_BUFFERSIZE or more,
+           which only fits in a mapping or a grown buffer, is too long. */
+        if (nleft > 0) {
             p = memchr(qp->_start, '\n', nleft);
             if (p != NULL) {
                 *p = '\0';
                 qp->_length = p - qp->_start;
                 line = qp->_start;
                 qp->_start = p + 1;
+                if (qp->_length >= QIO_BUFFERSIZE)
+                    qp->_flag = QIO_long;
                 return (qp->_flag == QIO_long) ? NULL : line;
             }
 
-            /* Not there.  See if our buffer is full.  If so, tag as having
-               seen too long of a line.  This will cause us to keep reading
-               as normal until we finally see the end of a line and then
-               return NULL. */
-            if (nleft >= qp->_size) {
+            /* Not there.  See if we already have too much of the line.  If
+               so, tag as having seen too long of a line.  This will cause us
+               to keep reading as normal until we finally see the end of a
+               line and then return NULL. */
+            if (nleft >= QIO_BUFFERSIZE) {
                 qp->_flag = QIO_long;
                 qp->_start = qp->_end;
                 nleft = 0;
             }
+        }
 
-            /* We need to read more data.  If there's read data in buffer,
-               then move the unread data down to the beginning of the buffer
-               first. */
-            if (qp->_start > qp->_buffer) {
-                if (nleft > 0)
-                    memmove(qp->_buffer, qp->_start, nleft);
-                qp->_start = qp->_buffer;
-                qp->_end = qp->_buffer + nleft;
-            }
+        /* At the end of the mapping, go on reading from the descriptor. */
+        if (qp->_map != NULL) {
+            QIOunmap(qp);
+            continue;
+        }
+
+        /* We need to read more data.  If there's read data in buffer, then
+           move the unread data down to the beginning of the buffer first. */
+        if (qp->_start > qp->_buffer) {
+            if (nleft > 0)
+                memmove(qp->_buffer, qp->_start, nleft);
+            qp->_start = qp->_buffer;
+            qp->_end = qp->_buffer + nleft;
         }
 
         /* Read in some more data, and then let the loop try to find the
-           newline again or discover that the line is too long. */
+           newline again or discover that the line is too long.  If the read
+           filled the buffer, more is probably waiting, so grow the buffer
+           to read more at once next time. */
         do {
             nread = read(qp->_fd, qp->_end, qp->_size - nleft);
         } while (nread == -1 && errno == EINTR);
@@ -155,5 +253,13 @@ QIOread(QIOSTATE *qp)
         }
         qp->_count += nread;
         qp->_end += nread;
+        if ((size_t) nread == qp->_size - nleft
+            && qp->_size < QIO_MAXBUFFER) {
+            nleft = qp->_end - qp->_buffer;
+            qp->_size *= 2;
+            qp->_buffer = xrealloc(qp->_buffer, qp->_size);
+            qp->_start = qp->_buffer;
+            qp->_end = qp->_buffer + nleft;
+        }
     }
 }
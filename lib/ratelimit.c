@@ -0,0 +1,189 @@
+/*
+**  Token buckets limiting the rate of a flow of bytes.
+**
+**  See include/inn/ratelimit.h for the interface.  A bucket is only kept as
+**  the time at which it will be full again: it then holds burst bytes less
+**  what the rate gives back until that time.  Charging it pushes that time
+**  further by the time the rate takes to give back what is sent, and the
+**  sender has to wait until the bucket would no longer be empty.
+**
+**  The file of shared buckets starts with a header giving its layout,
+**  followed by the slots, each one holding only that time.  A key is kept
+**  in the slot given by its hash modulo the number of slots, and a slot is
+**  read and written with pread and pwrite under an fcntl lock of its range,
+**  which is only held for that long.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ratelimit.h"
+
+#define RATELIMIT_MAGIC   0x494e4e54U
+#define RATELIMIT_VERSION 1
+
+struct ratelimit_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long slots;
+};
+
+struct ratelimit_table {
+    int fd;
+    char *path;
+    unsigned long slots;
+};
+
+
+/*
+**  Charge a bucket with the given time when it will be full again, and
+**  return how long to wait.
+*/
+static double
+ratelimit_update(double *full, double rate, double burst, size_t length,
+                 double now)
+{
+    double wait;
+
+    if (rate <= 0)
+        return 0;
+    if (*full < now)
+        *full = now;
+    *full += length / rate;
+    wait = *full - now - burst / rate;
+    return (wait > 0) ? wait : 0;
+}
+
+
+void
+ratelimit_init(struct ratelimit *bucket, unsigned long rate,
+               unsigned long burst)
+{
+    bucket->rate = rate;
+    bucket->burst = (burst == 0) ? rate : burst;
+    bucket->full = 0;
+}
+
+
+double
+ratelimit_charge(struct ratelimit *bucket, size_t length, double now)
+{
+    return ratelimit_update(&bucket->full, bucket->rate, bucket->burst,
+                            length, now);
+}
+
+
+struct ratelimit_table *
+ratelimit_table_open(const char *path, unsigned long slots)
+{
+    struct ratelimit_table *table;
+    struct ratelimit_header header;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        syswarn("cannot open %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat %s", path);
+        goto fail;
+    }
+
+    /* Several processes may be creating the file at the same time. */
+    if (st.st_size == 0) {
+        if (!inn_lock_file(fd, INN_LOCK_WRITE, true)) {
+            syswarn("cannot lock %s", path);
+            goto fail;
+        }
+        if (fstat(fd, &st) < 0) {
+            syswarn("cannot stat %s", path);
+            goto fail;
+        }
+        if (st.st_size == 0) {
+            memset(&header, 0, sizeof(header));
+            header.magic = RATELIMIT_MAGIC;
+            header.version = RATELIMIT_VERSION;
+            header.slots = (slots == 0) ? 1 : slots;
+            if (ftruncate(fd, sizeof(header) + header.slots * sizeof(double))
+                < 0) {
+                syswarn("cannot extend %s", path);
+                goto fail;
+            }
+            if (xpwrite(fd, &header, sizeof(header), 0)
+                < (ssize_t) sizeof(header)) {
+                syswarn("cannot write to %s", path);
+                goto fail;
+            }
+        }
+        inn_lock_file(fd, INN_LOCK_UNLOCK, false);
+    }
+    if (pread(fd, &header, sizeof(header), 0) < (ssize_t) sizeof(header)) {
+        warn("%s is too short", path);
+        goto fail;
+    }
+    if (header.magic != RATELIMIT_MAGIC || header.version != RATELIMIT_VERSION
+        || header.slots == 0) {
+        warn("%s is invalid", path);
+        goto fail;
+    }
+
+    table = xmalloc(sizeof(struct ratelimit_table));
+    table->fd = fd;
+    table->path = xstrdup(path);
+    table->slots = header.slots;
+    return table;
+
+fail:
+    close(fd);
+    return NULL;
+}
+
+
+double
+ratelimit_table_charge(struct ratelimit_table *table, const char *key,
+                       unsigned long rate, unsigned long burst, size_t length,
+                       double now)
+{
+    HASH hash;
+    unsigned long bucket;
+    off_t offset;
+    double full, wait;
+
+    if (rate == 0)
+        return 0;
+    if (burst == 0)
+        burst = rate;
+    hash = Hash(key, strlen(key));
+    memcpy(&bucket, &hash, sizeof(bucket));
+    offset = sizeof(struct ratelimit_header)
+        + (off_t) (bucket % table->slots) * sizeof(double);
+    if (!inn_lock_range(table->fd, INN_LOCK_WRITE, true, offset,
+                        sizeof(double))) {
+        syswarn("cannot lock %s", table->path);
+        return 0;
+    }
+    if (pread(table->fd, &full, sizeof(full), offset) < (ssize_t) sizeof(full))
+        full = 0;
+    wait = ratelimit_update(&full, rate, burst, length, now);
+    if (xpwrite(table->fd, &full, sizeof(full), offset)
+        < (ssize_t) sizeof(full))
+        syswarn("cannot write to %s", table->path);
+    inn_lock_range(table->fd, INN_LOCK_UNLOCK, false, offset, sizeof(double));
+    return wait;
+}
+
+
+void
+ratelimit_table_free(struct ratelimit_table *table)
+{
+    close(table->fd);
+    free(table->path);
+    free(table);
+}
@@ -0,0 +1,263 @@
+/*
+**  Shared cache of ready-to-send replies.
+**
+**  See include/inn/replycache.h for the interface.  The file starts with a
+**  header giving its layout, followed by the slots.  Each slot is a small
+**  header holding a sequence count, the hash of the key of the reply it
+**  holds (a slot whose hash is all zeroes is empty) and the length of the
+**  reply, followed by room for slotsize bytes of reply.  A key is stored in
+**  the slot given by its hash modulo the number of slots.
+**
+**  The sequence count of a slot is odd while a writer is filling it, so a
+**  reader copies a reply between two reads of the count and gives up if it
+**  saw an odd count or if the count changed in the meantime.  Writers take
+**  an fcntl lock on the slot header without blocking, which is released if
+**  they die; a writer finding an odd count left by a dead one just goes on
+**  filling the slot.  As for lib/activemap.c, this needs memory barriers on
+**  processors that reorder loads and stores.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "inn/buffer.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/replycache.h"
+
+#define REPLYCACHE_MAGIC   0x494e4e52U
+#define REPLYCACHE_VERSION 1
+
+#if defined(__GNUC__)
+# define replycache_barrier() __sync_synchronize()
+#else
+# define replycache_barrier() /* empty */
+#endif
+
+struct replycache_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long slots;
+    unsigned long slotsize;     /* Room for the reply in each slot. */
+};
+
+struct replycache_slot {
+    unsigned int sequence;      /* Odd while a writer fills the slot. */
+    unsigned int length;
+    HASH key;
+};
+
+struct replycache {
+    int fd;
+    void *base;
+    size_t size;
+    unsigned long slots;
+    size_t slotsize;
+    size_t stride;              /* Distance between two slots. */
+};
+
+
+/*
+**  Return the distance between two slots for a given room for the reply,
+**  keeping the slot headers aligned.
+*/
+static size_t
+replycache_stride(size_t slotsize)
+{
+    size_t align = sizeof(unsigned long);
+    size_t stride = sizeof(struct replycache_slot) + slotsize;
+
+    return (stride + align - 1) / align * align;
+}
+
+
+/*
+**  Return the offset in the file of the slot for a key, and set the hash of
+**  the key.
+*/
+static off_t
+replycache_slot(struct replycache *cache, const char *key, HASH *hash)
+{
+    unsigned long bucket;
+
+    *hash = Hash(key, strlen(key));
+    memcpy(&bucket, hash, sizeof(bucket));
+    return sizeof(struct replycache_header)
+        + (off_t) (bucket % cache->slots) * cache->stride;
+}
+
+
+/*
+**  Give a new file its layout.  Called with the file locked.
+*/
+static bool
+replycache_init(int fd, const char *path, size_t size, size_t slotsize)
+{
+    struct replycache_header header;
+    size_t stride;
+
+    stride = replycache_stride(slotsize);
+    memset(&header, 0, sizeof(header));
+    header.magic = REPLYCACHE_MAGIC;
+    header.version = REPLYCACHE_VERSION;
+    header.slotsize = slotsize;
+    header.slots = size / stride;
+    if (header.slots == 0)
+        header.slots = 1;
+    if (ftruncate(fd, sizeof(header) + header.slots * stride) < 0) {
+        syswarn("cannot extend %s", path);
+        return false;
+    }
+    if (xpwrite(fd, &header, sizeof(header), 0) < (ssize_t) sizeof(header)) {
+        syswarn("cannot write to %s", path);
+        return false;
+    }
+    return true;
+}
+
+
+struct replycache *
+replycache_open(const char *path, size_t size, size_t slotsize)
+{
+    struct replycache *cache;
+    const struct replycache_header *header;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        syswarn("cannot open %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat %s", path);
+        goto fail;
+    }
+
+    /* Several processes may be creating the file at the same time. */
+    if (st.st_size == 0) {
+        if (!inn_lock_file(fd, INN_LOCK_WRITE, true)) {
+            syswarn("cannot lock %s", path);
+            goto fail;
+        }
+        if (fstat(fd, &st) < 0) {
+            syswarn("cannot stat %s", path);
+            goto fail;
+        }
+        if (st.st_size == 0) {
+            if (!replycache_init(fd, path, size, slotsize))
+                goto fail;
+            if (fstat(fd, &st) < 0) {
+                syswarn("cannot stat %s", path);
+                goto fail;
+            }
+        }
+        inn_lock_file(fd, INN_LOCK_UNLOCK, false);
+    }
+    if ((size_t) st.st_size < sizeof(struct replycache_header)) {
+        warn("%s is too short", path);
+        goto fail;
+    }
+
+    cache = xcalloc(1, sizeof(struct replycache));
+    cache->fd = fd;
+    cache->size = st.st_size;
+    cache->base = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+    if (cache->base == MAP_FAILED) {
+        syswarn("cannot mmap %s", path);
+        free(cache);
+        goto fail;
+    }
+    header = cache->base;
+    cache->slots = header->slots;
+    cache->slotsize = header->slotsize;
+    cache->stride = replycache_stride(cache->slotsize);
+    if (header->magic != REPLYCACHE_MAGIC
+        || header->version != REPLYCACHE_VERSION || cache->slots == 0
+        || cache->size != sizeof(struct replycache_header)
+                              + cache->slots * cache->stride) {
+        warn("%s is invalid", path);
+        replycache_free(cache);
+        return NULL;
+    }
+    return cache;
+
+fail:
+    close(fd);
+    return NULL;
+}
+
+
+bool
+replycache_get(struct replycache *cache, const char *key,
+               struct buffer *reply)
+{
+    volatile struct replycache_slot *slot;
+    char *start;
+    unsigned int sequence, length;
+    HASH hash;
+    off_t offset;
+
+    offset = replycache_slot(cache, key, &hash);
+    start = (char *) cache->base + offset;
+    slot = (void *) start;
+    sequence = slot->sequence;
+    replycache_barrier();
+    if ((sequence & 1) != 0)
+        return false;
+    if (memcmp(start + offsetof(struct replycache_slot, key), &hash,
+               sizeof(hash)) != 0)
+        return false;
+    length = slot->length;
+    if (length > cache->slotsize)
+        return false;
+    buffer_set(reply, start + sizeof(struct replycache_slot), length);
+    replycache_barrier();
+    return slot->sequence == sequence;
+}
+
+
+bool
+replycache_put(struct replycache *cache, const char *key, const char *data,
+               size_t length)
+{
+    volatile struct replycache_slot *slot;
+    char *start;
+    HASH hash;
+    off_t offset;
+
+    if (length > cache->slotsize)
+        return false;
+    offset = replycache_slot(cache, key, &hash);
+    if (!inn_lock_range(cache->fd, INN_LOCK_WRITE, false, offset,
+                        sizeof(struct replycache_slot)))
+        return false;
+    start = (char *) cache->base + offset;
+    slot = (void *) start;
+    if ((slot->sequence & 1) == 0)
+        slot->sequence++;
+    replycache_barrier();
+    memcpy(start + offsetof(struct replycache_slot, key), &hash, sizeof(hash));
+    slot->length = length;
+    memcpy(start + sizeof(struct replycache_slot), data, length);
+    replycache_barrier();
+    slot->sequence++;
+    inn_lock_range(cache->fd, INN_LOCK_UNLOCK, false, offset,
+                   sizeof(struct replycache_slot));
+    return true;
+}
+
+
+void
+replycache_free(struct replycache *cache)
+{
+    munmap(cache->base, cache->size);
+    close(cache->fd);
+    free(cache);
+}
@@ -30,6 +30,15 @@
 **  be a sub-timer of more than one timer or a timer without a parent, and
 **  each of those counts will be reported separately.
 **
+**  Besides the totals logged by TMRsummary, each timer keeps the number of
+**  times it was stopped, the shortest and longest durations and a latency
+**  histogram, all in microseconds, since the initialization or the last
+**  reset, which TMRstats reports on demand.  If the system has static
+**  probes (sys/sdt.h), TMRstart and TMRstop also fire the inn:timer__start
+**  and inn:timer__stop probes with the timer number and, for the latter,
+**  the duration in microseconds, so the timers can be traced in production
+**  with tools such as bpftrace without any cost when nobody is listening.
+**
 **  Note that this code is not thread-safe and in fact would need to be
 **  completely overhauled for a threaded server (since the idea of global
 **  timing statistics doesn't make as much sense when different tasks are
@@ -45,6 +54,17 @@
 #endif
 #include <time.h>
 
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define TMR_PROBE_START(id)      DTRACE_PROBE1(inn, timer__start, id)
+# define TMR_PROBE_STOP(id, usec) DTRACE_PROBE2(inn, timer__stop, id, usec)
+#else
+# define TMR_PROBE_START(id)      /* empty */
+# define TMR_PROBE_STOP(id, usec) /* empty */
+#endif
+
+#include "inn/buffer.h"
+#include "inn/histogram.h"
 #include "inn/messages.h"
 #include "inn/timer.h"
 #include "inn/libinn.h"
@@ -63,15 +83,19 @@
    that tree.
 
    Note that without the parent pointer, this is a tree.  id is the
-   identifier of the timer.  start stores the time (relative to the last
-   summary) at which TMRstart was last called for each timer.  total is
-   the total time accrued by that timer since the last summary.  count is
-   the number of times the timer has been stopped since the last summary. */
+   identifier of the timer.  start stores the time in microseconds at which
+   TMRstart was last called for each timer.  total is the total time in
+   microseconds accrued by that timer since the last summary.  count is the
+   number of times the timer has been stopped since the last summary.  min
+   and hist are the statistics reported by TMRstats, kept since the
+   initialization or the last reset. */
 struct timer {
     unsigned int id;
     unsigned long start;
     unsigned long total;
     unsigned long count;
+    unsigned long min;
+    struct histogram *hist;
 
     struct timer *parent;
     struct timer *brother;
@@ -135,6 +159,26 @@ TMRgettime(bool reset)
 }
 
 
+/*
+**  Returns the number of microseconds since the initialization of the
+**  timers, used to time each of them.  The result may wrap around, but
+**  durations are computed with unsigned arithmetic, so only a timer running
+**  for longer than that would be wrong.
+*/
+static unsigned long
+TMRgetusec(bool reset)
+{
+    static struct timeval base;
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    if (reset)
+        base = tv;
+    return (unsigned long) (tv.tv_sec - base.tv_sec) * 1000000UL
+           + (unsigned long) (tv.tv_usec - base.tv_usec);
+}
+
+
 /*
 **  Initialize the timer.  Zero out even variables that would initially be
 **  zero so that this function can be called multiple times if wanted.
@@ -151,6 +195,7 @@ TMRinit(unsigned int count)
         for (i = 0; i < count; i++)
             timers[i] = NULL;
         TMRgettime(true);
+        TMRgetusec(true);
     }
     timer_count = count;
 }
@@ -168,6 +213,7 @@ TMRfreeone(struct timer *timer)
         TMRfreeone(timer->child);
     if (timer->brother != NULL)
         TMRfreeone(timer->brother);
+    histogram_free(timer->hist);
     free(timer);
 }
 
@@ -205,6 +251,8 @@ TMRnew(unsigned int id, struct timer *parent)
     timer->start = 0;
     timer->total = 0;
     timer->count = 0;
+    timer->min = 0;
+    timer->hist = histogram_new();
     return timer;
 }
 
@@ -255,7 +303,8 @@ TMRstart(unsigned int timer)
             }
         }
     }
-    timer_current->start = TMRgettime(false);
+    timer_current->start = TMRgetusec(false);
+    TMR_PROBE_START(timer);
 }
 
 
@@ -266,6 +315,8 @@ TMRstart(unsigned int timer)
 void
 TMRstop(unsigned int timer)
 {
+    unsigned long elapsed;
+
     if (timer_count == 0) {
         /* this should happen if innconf->timer == 0 */
         return;
@@ -276,8 +327,14 @@ TMRstop(unsigned int timer)
         warn("timer %u stopped doesn't match running timer %u", timer,
              timer_current->id);
     else {
-        timer_current->total += TMRgettime(false) - timer_current->start;
+        elapsed = TMRgetusec(false) - timer_current->start;
+        TMR_PROBE_STOP(timer, elapsed);
+        timer_current->total += elapsed;
         timer_current->count++;
+        if (histogram_count(timer_current->hist) == 0
+            || elapsed < timer_current->min)
+            timer_current->min = elapsed;
+        histogram_record(timer_current->hist, elapsed);
         timer_current = timer_current->parent;
     }
 }
@@ -341,7 +398,7 @@ TMRsumone(const char *const *labels, struct timer *timer, char *buf,
     if (off > 0)
         off--;
 
-    rc = snprintf(buf + off, len - off, " %lu(%lu) ", timer->total,
+    rc = snprintf(buf + off, len - off, " %lu(%lu) ", timer->total / 1000,
                     timer->count);
     if (rc < 0) {
         /* Do nothing. */
@@ -417,3 +474,66 @@ TMRsummary(const char *prefix, const char *const *labels)
     notice("%s", buf);
     free(buf);
 }
+
+
+/*
+**  Append the path of a timer to a buffer, from the timer to its topmost
+**  parent as in the summary.
+*/
+static void
+TMRpath(struct buffer *out, const char *const *labels,
+        const struct timer *timer)
+{
+    const struct timer *node;
+
+    for (node = timer; node != NULL; node = node->parent)
+        buffer_append_sprintf(out, "%s%s", TMRlabel(labels, node->id),
+                              node->parent == NULL ? "" : "/");
+}
+
+
+/*
+**  Recursively append the statistics of a single timer tree to a buffer,
+**  resetting them if asked to.
+*/
+static void
+TMRstatsone(struct buffer *out, const char *prefix,
+            const char *const *labels, struct timer *timer, bool reset)
+{
+    if (histogram_count(timer->hist) > 0) {
+        if (prefix != NULL)
+            buffer_append_sprintf(out, "%s ", prefix);
+        TMRpath(out, labels, timer);
+        buffer_append(out, " ", 1);
+        histogram_summary(timer->hist, out);
+        buffer_append_sprintf(out, " min %lu\n", timer->min);
+        if (reset) {
+            histogram_reset(timer->hist);
+            timer->min = 0;
+        }
+    }
+    if (timer->child != NULL)
+        TMRstatsone(out, prefix, labels, timer->child, reset);
+    if (timer->brother != NULL)
+        TMRstatsone(out, prefix, labels, timer->brother, reset);
+}
+
+
+/*
+**  Append the statistics of every timer stopped at least once since the
+**  initialization or the last reset to a buffer, one line per timer with
+**  its path as in the summary, the number of times it was stopped, the
+**  mean, percentiles and maximum of its durations and the minimum, in
+**  microseconds.  Unlike TMRsummary, this doesn't reset the totals logged
+**  by the summary, and only resets these statistics if asked to.
+*/
+void
+TMRstats(struct buffer *out, const char *prefix, const char *const *labels,
+         bool reset)
+{
+    unsigned int i;
+
+    for (i = 0; i < timer_count; i++)
+        if (timers[i] != NULL)
+            TMRstatsone(out, prefix, labels, timers[i], reset);
+}
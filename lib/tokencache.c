@@ -0,0 +1,295 @@
+/*
+**  Shared cache of message-ID to storage token translations.
+**
+**  See include/inn/tokencache.h for the interface.  The file starts with a
+**  header giving the number of buckets, followed by the buckets.  Each
+**  bucket holds the clock hand used to pick the entry to replace, and
+**  TOKENCACHE_WAYS entries.  An entry holds a sequence count, a flag set
+**  when it is looked up, the hash of the message-ID (all zeroes for an
+**  empty entry) and the token.
+**
+**  The sequence count of an entry is odd while a writer is filling it.  A
+**  writer makes it odd with a compare and swap, so only one writer at a
+**  time can fill an entry, and the others give up.  A reader copies the
+**  entry between two reads of the count and gives up if it saw an odd
+**  count or if the count changed in the meantime.  This needs the atomic
+**  builtins of GCC and compatible compilers; without them, the cache can't
+**  be opened.  A writer dying while it fills an entry leaves the entry
+**  unusable until the file is removed, which only costs one entry.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/tokencache.h"
+
+#define TOKENCACHE_MAGIC   0x494e4e54U
+#define TOKENCACHE_VERSION 1
+#define TOKENCACHE_WAYS    8
+
+#if defined(__GNUC__)
+# define TOKENCACHE_ATOMIC 1
+# define tokencache_barrier() __sync_synchronize()
+# define tokencache_claim(p, old) \
+    __sync_bool_compare_and_swap((p), (old), (old) + 1)
+#else
+# define TOKENCACHE_ATOMIC 0
+#endif
+
+struct tokencache_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long buckets;
+};
+
+struct tokencache_entry {
+    unsigned int sequence;      /* Odd while a writer fills the entry. */
+    unsigned int referenced;    /* Looked up since the hand went by. */
+    HASH hash;
+    TOKEN token;
+};
+
+struct tokencache_bucket {
+    unsigned int hand;
+    struct tokencache_entry entries[TOKENCACHE_WAYS];
+};
+
+struct tokencache {
+    void *base;
+    size_t size;
+    unsigned long buckets;
+    struct tokencache_bucket *table;
+};
+
+
+#if TOKENCACHE_ATOMIC
+
+/*
+**  Return the bucket for a hash.
+*/
+static struct tokencache_bucket *
+tokencache_bucket(struct tokencache *cache, const HASH *hash)
+{
+    unsigned long bucket;
+
+    memcpy(&bucket, hash, sizeof(bucket));
+    return &cache->table[bucket % cache->buckets];
+}
+
+
+/*
+**  Copy an entry if it holds the given hash and isn't being written.
+**  Returns true if the token was copied.
+*/
+static bool
+tokencache_read(volatile struct tokencache_entry *entry, const HASH *hash,
+                TOKEN *token)
+{
+    unsigned int sequence;
+    bool found;
+
+    sequence = entry->sequence;
+    tokencache_barrier();
+    if ((sequence & 1) != 0)
+        return false;
+    found = (memcmp((const void *) &entry->hash, hash, sizeof(HASH)) == 0);
+    if (found)
+        memcpy(token, (const void *) &entry->token, sizeof(TOKEN));
+    tokencache_barrier();
+    return found && entry->sequence == sequence;
+}
+
+
+/*
+**  Fill an entry, unless another writer is filling it.
+*/
+static void
+tokencache_write(volatile struct tokencache_entry *entry, const HASH *hash,
+                 const TOKEN *token)
+{
+    unsigned int sequence;
+
+    sequence = entry->sequence;
+    if ((sequence & 1) != 0 || !tokencache_claim(&entry->sequence, sequence))
+        return;
+    tokencache_barrier();
+    memcpy((void *) &entry->hash, hash, sizeof(HASH));
+    memcpy((void *) &entry->token, token, sizeof(TOKEN));
+    entry->referenced = 0;
+    tokencache_barrier();
+    entry->sequence = sequence + 2;
+}
+
+#endif /* TOKENCACHE_ATOMIC */
+
+
+struct tokencache *
+tokencache_open(const char *path, unsigned long entries)
+{
+    struct tokencache *cache;
+    struct tokencache_header header;
+    const struct tokencache_header *mapped;
+    struct stat st;
+    size_t size;
+    int fd;
+
+    if (!TOKENCACHE_ATOMIC) {
+        warn("shared token cache not supported by this compiler");
+        return NULL;
+    }
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        syswarn("cannot open %s", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat %s", path);
+        goto fail;
+    }
+
+    /* Several processes may be creating the file at the same time. */
+    if (st.st_size == 0) {
+        if (!inn_lock_file(fd, INN_LOCK_WRITE, true)) {
+            syswarn("cannot lock %s", path);
+            goto fail;
+        }
+        if (fstat(fd, &st) < 0) {
+            syswarn("cannot stat %s", path);
+            goto fail;
+        }
+        if (st.st_size == 0) {
+            memset(&header, 0, sizeof(header));
+            header.magic = TOKENCACHE_MAGIC;
+            header.version = TOKENCACHE_VERSION;
+            header.buckets = (entries + TOKENCACHE_WAYS - 1) / TOKENCACHE_WAYS;
+            if (header.buckets == 0)
+                header.buckets = 1;
+            size = sizeof(header)
+                   + header.buckets * sizeof(struct tokencache_bucket);
+            if (ftruncate(fd, size) < 0) {
+                syswarn("cannot extend %s", path);
+                goto fail;
+            }
+            if (xpwrite(fd, &header, sizeof(header), 0)
+                < (ssize_t) sizeof(header)) {
+                syswarn("cannot write to %s", path);
+                goto fail;
+            }
+            st.st_size = size;
+        }
+        inn_lock_file(fd, INN_LOCK_UNLOCK, false);
+    }
+    if ((size_t) st.st_size < sizeof(struct tokencache_header)) {
+        warn("%s is too short", path);
+        goto fail;
+    }
+
+    cache = xcalloc(1, sizeof(struct tokencache));
+    cache->size = st.st_size;
+    cache->base = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+    close(fd);
+    if (cache->base == MAP_FAILED) {
+        syswarn("cannot mmap %s", path);
+        free(cache);
+        return NULL;
+    }
+    mapped = cache->base;
+    cache->buckets = mapped->buckets;
+    cache->table = (void *) ((char *) cache->base + sizeof(*mapped));
+    if (mapped->magic != TOKENCACHE_MAGIC
+        || mapped->version != TOKENCACHE_VERSION || cache->buckets == 0
+        || cache->size != sizeof(*mapped)
+                              + cache->buckets
+                                    * sizeof(struct tokencache_bucket)) {
+        warn("%s is invalid", path);
+        tokencache_free(cache);
+        return NULL;
+    }
+    return cache;
+
+fail:
+    close(fd);
+    return NULL;
+}
+
+
+void
+tokencache_add(struct tokencache *cache UNUSED, const HASH *hash UNUSED,
+               const TOKEN *token UNUSED)
+{
+#if TOKENCACHE_ATOMIC
+    struct tokencache_bucket *bucket;
+    volatile struct tokencache_entry *entry;
+    TOKEN old;
+    unsigned int hand, i;
+
+    if (HashEmpty(*hash))
+        return;
+    bucket = tokencache_bucket(cache, hash);
+
+    /* Replace the token if the message-ID is already there. */
+    for (i = 0; i < TOKENCACHE_WAYS; i++) {
+        entry = &bucket->entries[i];
+        if (tokencache_read(entry, hash, &old)) {
+            if (memcmp(&old, token, sizeof(TOKEN)) != 0)
+                tokencache_write(entry, hash, token);
+            return;
+        }
+    }
+
+    /* Otherwise, move the hand past the entries looked up since it last
+       went by, clearing their flag, and replace the first other one.  The
+       hand is only a hint, so races on it don't matter. */
+    hand = bucket->hand;
+    for (i = 0; i < TOKENCACHE_WAYS; i++) {
+        entry = &bucket->entries[(hand + i) % TOKENCACHE_WAYS];
+        if (!entry->referenced)
+            break;
+        entry->referenced = 0;
+    }
+    hand = (hand + i) % TOKENCACHE_WAYS;
+    bucket->hand = (hand + 1) % TOKENCACHE_WAYS;
+    tokencache_write(&bucket->entries[hand], hash, token);
+#endif
+}
+
+
+bool
+tokencache_get(struct tokencache *cache UNUSED, const HASH *hash UNUSED,
+               TOKEN *token UNUSED)
+{
+#if TOKENCACHE_ATOMIC
+    struct tokencache_bucket *bucket;
+    volatile struct tokencache_entry *entry;
+    unsigned int i;
+
+    if (HashEmpty(*hash))
+        return false;
+    bucket = tokencache_bucket(cache, hash);
+    for (i = 0; i < TOKENCACHE_WAYS; i++) {
+        entry = &bucket->entries[i];
+        if (tokencache_read(entry, hash, token)) {
+            if (!entry->referenced)
+                entry->referenced = 1;
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+
+void
+tokencache_free(struct tokencache *cache)
+{
+    munmap(cache->base, cache->size);
+    free(cache);
+}
@@ -53,35 +53,48 @@
 
 /* A single node in the ternary search trie.  Stores a character, which is
    part of the string formed by walking the tree from its root down to the
-   node, and left, right, and middle pointers to child nodes.  If value is
-   non-zero (not a nul), middle is the pointer to follow if the desired
+   node, and left, right, and middle links to child nodes.  If value is
+   non-zero (not a nul), middle is the link to follow if the desired
    string's character matches value.  left is used if it's less than value and
    right is used if it's greater than value.  If value is zero, this is a
-   terminal node, and middle holds a pointer to the data associated with the
-   string that ends at this point. */
+   terminal node, and middle holds the index of the data associated with the
+   string that ends at this point.
+
+   Nodes are kept in a single array and linked by their 32-bit index in it,
+   which makes them half the size of nodes linked by pointers on 64-bit
+   systems.  Index 0 is never used, so that it can stand for no node. */
 struct node {
+    uint32_t left;
+    uint32_t middle;
+    uint32_t right;
     unsigned char value;
-    struct node *left;
-    struct node *middle;
-    struct node *right;
 };
 
-/* The search trie structure.  node_line_width is the number of nodes that are
-   allocated at a time, and node_lines holds a linked list of groups of nodes.
-   The free_list is a linked list (through the middle pointers) of available
-   nodes to use, and head holds pointers to the first nodes for each possible
-   first letter of the string. */
-struct tst {
-    int node_line_width;
-    struct node_lines *node_lines;
-    struct node *free_list;
-    struct node *head[256];
+#define NONE 0
+
+/* A slot of the array of data pointers of the terminal nodes, or the index
+   of the next free slot if it isn't in use. */
+union data {
+    void *data;
+    uint32_t next;
 };
 
-/* A simple linked list structure used to hold all the groups of nodes. */
-struct node_lines {
-    struct node *node_line;
-    struct node_lines *next;
+/* The search trie structure.  width is the minimum number of nodes that are
+   added to the array of nodes when it is full.  The free lists are linked
+   lists (through the middle links for nodes) of available nodes and data
+   slots to use, and head holds the first node for each possible first
+   letter of the string.  free_count is kept to know when to compact the
+   trie. */
+struct tst {
+    uint32_t width;
+    struct node *nodes;
+    uint32_t node_count;
+    uint32_t free_list;
+    uint32_t free_count;
+    union data *data;
+    uint32_t data_count;
+    uint32_t data_free;
+    uint32_t head[256];
 };
 
 
@@ -94,55 +107,86 @@ struct node_lines {
 
 
 /*
-**  Allocate new nodes for the free list, called when the free list is empty.
+**  Make sure that there are at least count free nodes and one free data
+**  slot, growing the arrays if needed, so that no pointer into them is
+**  invalidated while inserting a key.  The arrays grow by half their size,
+**  and at least by width entries.
 */
 static void
-tst_grow_node_free_list(struct tst *tst)
+tst_reserve(struct tst *tst, size_t count)
 {
-    struct node *current_node;
-    struct node_lines *new_line;
-    int i;
-
-    new_line = xmalloc(sizeof(struct node_lines));
-    new_line->node_line = xcalloc(tst->node_line_width, sizeof(struct node));
-    new_line->next = tst->node_lines;
-    tst->node_lines = new_line;
-
-    current_node = tst->node_lines->node_line;
-    tst->free_list = current_node;
-    for (i = 1; i < tst->node_line_width; i++) {
-        current_node->middle = &(tst->node_lines->node_line[i]);
-        current_node = current_node->middle;
+    uint32_t grow, i;
+
+    if (tst->free_count < count) {
+        grow = tst->node_count / 2;
+        if (grow < tst->width)
+            grow = tst->width;
+        if (grow < count)
+            grow = count;
+        tst->nodes = xreallocarray(tst->nodes, tst->node_count + grow,
+                                   sizeof(struct node));
+        for (i = tst->node_count + grow - 1; i >= tst->node_count; i--) {
+            tst->nodes[i].middle = tst->free_list;
+            tst->free_list = i;
+        }
+        tst->node_count += grow;
+        tst->free_count += grow;
+    }
+    if (tst->data_free == NONE) {
+        grow = tst->data_count / 2;
+        if (grow < tst->width / 8 + 1)
+            grow = tst->width / 8 + 1;
+        tst->data = xreallocarray(tst->data, tst->data_count + grow,
+                                  sizeof(union data));
+        for (i = tst->data_count + grow - 1; i >= tst->data_count; i--) {
+            tst->data[i].next = tst->data_free;
+            tst->data_free = i;
+        }
+        tst->data_count += grow;
     }
-    current_node->middle = NULL;
 }
 
 
 /*
 **  Grab a node from the free list and initialize it with the given value.
+**  There must be one, reserved with tst_reserve.
 */
-static struct node *
+static uint32_t
 tst_get_free_node(struct tst *tst, unsigned char value)
 {
-    struct node *free_node;
+    uint32_t free_node;
 
-    if (tst->free_list == NULL)
-        tst_grow_node_free_list(tst);
     free_node = tst->free_list;
-    tst->free_list = tst->free_list->middle;
-    free_node->middle = NULL;
-    free_node->value = value;
+    tst->free_list = tst->nodes[free_node].middle;
+    tst->free_count--;
+    tst->nodes[free_node].left = NONE;
+    tst->nodes[free_node].middle = NONE;
+    tst->nodes[free_node].right = NONE;
+    tst->nodes[free_node].value = value;
     return free_node;
 }
 
 
+/*
+**  Store a data pointer in a free data slot, reserved with tst_reserve, and
+**  return its index.
+*/
+static uint32_t
+tst_get_free_data(struct tst *tst, void *data)
+{
+    uint32_t slot;
+
+    slot = tst->data_free;
+    tst->data_free = tst->data[slot].next;
+    tst->data[slot].data = data;
+    return slot;
+}
+
+
 /*
 **  tst_init allocates memory for members of struct tst, and allocates the
-**  first node_line_width nodes.  The value for width must be chosen very
-**  carefully.  One node is required for every character in the tree.  If you
-**  choose a value that is too small, your application will spend too much
-**  time calling malloc and your node space will be too spread out.  Too large
-**  a value is just a waste of space.
+**  first width nodes.  The array of nodes grows by half its size when it
+**  is full, and at least by width nodes.
 */
 struct tst *
 tst_init(int width)
@@ -150,9 +194,14 @@ tst_init(int width)
     struct tst *tst;
 
     tst = xcalloc(1, sizeof(struct tst));
-    tst->node_lines = NULL;
-    tst->node_line_width = width;
-    tst_grow_node_free_list(tst);
+    tst->width = (width > 0) ? width : 1;
+
+    /* Index 0 of both arrays stands for no node or slot. */
+    tst->node_count = 1;
+    tst->nodes = xcalloc(1, sizeof(struct node));
+    tst->data_count = 1;
+    tst->data = xcalloc(1, sizeof(union data));
+    tst_reserve(tst, tst->width);
     return tst;
 }
 
@@ -178,8 +227,8 @@ tst_insert(struct tst *tst, const unsigned char *key, void *data, int option,
            void **exist_ptr)
 {
     struct node *current_node = NULL;
-    struct node **root_node = NULL;
-    int key_index;
+    uint32_t *root_node = NULL;
+    size_t key_index;
 
     if (data == NULL)
         return TST_NULL_DATA;
@@ -187,53 +236,57 @@ tst_insert(struct tst *tst, const unsigned char *key, void *data, int option,
     if (key == NULL || *key == '\0')
         return TST_NULL_KEY;
 
+    /* At most one node per character of the key and one for its end are
+       needed; reserving them first keeps pointers into the array valid. */
+    tst_reserve(tst, strlen((const char *) key) + 1);
+
     key_index = 1;
-    if (tst->head[*key] == NULL)
+    if (tst->head[*key] == NONE)
         root_node = &tst->head[*key];
     else
-        current_node = tst->head[*key];
+        current_node = &tst->nodes[tst->head[*key]];
 
     while (root_node == NULL) {
         if (key[key_index] == current_node->value) {
             if (key[key_index] == '\0') {
                 if (exist_ptr != NULL)
-                    *exist_ptr = current_node->middle;
+                    *exist_ptr = tst->data[current_node->middle].data;
                 if (option == TST_REPLACE) {
-                    current_node->middle = data;
+                    tst->data[current_node->middle].data = data;
                     return TST_OK;
                 } else
                     return TST_DUPLICATE_KEY;
             }
-            if (current_node->middle == NULL)
+            if (current_node->middle == NONE)
                 root_node = &current_node->middle;
             else {
-                current_node = current_node->middle;
+                current_node = &tst->nodes[current_node->middle];
                 key_index++;
             }
         } else if (LEFTP(current_node, key[key_index])) {
-            if (current_node->left == NULL)
+            if (current_node->left == NONE)
                 root_node = &current_node->left;
             else
-                current_node = current_node->left;
+                current_node = &tst->nodes[current_node->left];
         } else {
-            if (current_node->right == NULL)
+            if (current_node->right == NONE)
                 root_node = &current_node->right;
             else
-                current_node = current_node->right;
+                current_node = &tst->nodes[current_node->right];
         }
 
     }
 
     *root_node = tst_get_free_node(tst, key[key_index]);
-    current_node = *root_node;
+    current_node = &tst->nodes[*root_node];
 
     while (key[key_index] != '\0') {
         key_index++;
         current_node->middle = tst_get_free_node(tst, key[key_index]);
-        current_node = current_node->middle;
+        current_node = &tst->nodes[current_node->middle];
     }
 
-    current_node->middle = data;
+    current_node->middle = tst_get_free_data(tst, data);
     return TST_OK;
 }
 
@@ -245,30 +298,29 @@ tst_insert(struct tst *tst, const unsigned char *key, void *data, int option,
 void *
 tst_search(struct tst *tst, const unsigned char *key)
 {
-    struct node *current_node;
-    int key_index;
+    const struct node *current_node;
+    uint32_t current;
+    size_t key_index;
 
     if (key == NULL || *key == '\0')
         return NULL;
 
-    if (tst->head[*key] == NULL)
-        return NULL;
-
-    current_node = tst->head[*key];
+    current = tst->head[*key];
     key_index = 1;
-    while (current_node != NULL) {
+    while (current != NONE) {
+        current_node = &tst->nodes[current];
         if (key[key_index] == current_node->value) {
             if (current_node->value == '\0')
-                return current_node->middle;
+                return tst->data[current_node->middle].data;
             else {
-                current_node = current_node->middle;
+                current = current_node->middle;
                 key_index++;
                 continue;
             }
         } else if (LEFTP(current_node, key[key_index]))
-            current_node = current_node->left;
+            current = current_node->left;
         else
-            current_node = current_node->right;
+            current = current_node->right;
     }
     return NULL;
 }
@@ -277,33 +329,38 @@ tst_search(struct tst *tst, const unsigned char *key)
 /*
 **  tst_delete deletes the string key from the tree if it exists and returns
 **  the data pointer assocaited with that key, or NULL if it wasn't found.
+**  The nodes of the key go back to the free list, and the trie is compacted
+**  once more than half of its nodes are free.
 */
 void *
 tst_delete(struct tst *tst, const unsigned char *key)
 {
-    struct node *current_node;
-    struct node *current_node_parent;
-    struct node *last_branch;
-    struct node *last_branch_parent;
-    struct node *next_node;
-    struct node *last_branch_replacement;
-    struct node *last_branch_dangling_child;
-    int key_index;
+    struct node *nodes = tst->nodes;
+    uint32_t current_node;
+    uint32_t current_node_parent;
+    uint32_t last_branch;
+    uint32_t last_branch_parent;
+    uint32_t next_node;
+    uint32_t last_branch_replacement;
+    uint32_t last_branch_dangling_child;
+    size_t key_index;
+    void *data;
 
     if (key == NULL || *key == '\0')
         return NULL;
 
-    if (tst->head[*key] == NULL)
+    if (tst->head[*key] == NONE)
         return NULL;
 
-    last_branch = NULL;
-    last_branch_parent = NULL;
+    last_branch = NONE;
+    last_branch_parent = NONE;
     current_node = tst->head[*key];
-    current_node_parent = NULL;
+    current_node_parent = NONE;
     key_index = 1;
-    while (current_node != NULL) {
-        if (key[key_index] == current_node->value) {
-            if (current_node->left != NULL || current_node->right != NULL) {
+    while (current_node != NONE) {
+        if (key[key_index] == nodes[current_node].value) {
+            if (nodes[current_node].left != NONE
+                || nodes[current_node].right != NONE) {
                 last_branch = current_node;
                 last_branch_parent = current_node_parent;
             }
@@ -311,61 +368,63 @@ tst_delete(struct tst *tst, const unsigned char *key)
                 break;
             else {
                 current_node_parent = current_node;
-                current_node = current_node->middle;
+                current_node = nodes[current_node].middle;
                 key_index++;
             }
-        } else if (LEFTP(current_node, key[key_index])) {
+        } else if (LEFTP(&nodes[current_node], key[key_index])) {
             last_branch_parent = current_node;
             current_node_parent = current_node;
-            current_node = current_node->left;
+            current_node = nodes[current_node].left;
             last_branch = current_node;
         } else {
             last_branch_parent = current_node;
             current_node_parent = current_node;
-            current_node = current_node->right;
+            current_node = nodes[current_node].right;
             last_branch = current_node;
         }
     }
-    if (current_node == NULL)
+    if (current_node == NONE)
         return NULL;
 
-    if (last_branch == NULL) {
+    if (last_branch == NONE) {
         next_node = tst->head[*key];
-        tst->head[*key] = NULL;
-    } else if (last_branch->left == NULL && last_branch->right == NULL) {
-        if (last_branch_parent->left == last_branch)
-            last_branch_parent->left = NULL;
+        tst->head[*key] = NONE;
+    } else if (nodes[last_branch].left == NONE
+               && nodes[last_branch].right == NONE) {
+        if (nodes[last_branch_parent].left == last_branch)
+            nodes[last_branch_parent].left = NONE;
         else
-            last_branch_parent->right = NULL;
+            nodes[last_branch_parent].right = NONE;
         next_node = last_branch;
     } else {
-        if (last_branch->left != NULL && last_branch->right != NULL) {
-            last_branch_replacement = last_branch->right;
-            last_branch_dangling_child = last_branch->left;
-        } else if (last_branch->right != NULL) {
-            last_branch_replacement = last_branch->right;
-            last_branch_dangling_child = NULL;
+        if (nodes[last_branch].left != NONE
+            && nodes[last_branch].right != NONE) {
+            last_branch_replacement = nodes[last_branch].right;
+            last_branch_dangling_child = nodes[last_branch].left;
+        } else if (nodes[last_branch].right != NONE) {
+            last_branch_replacement = nodes[last_branch].right;
+            last_branch_dangling_child = NONE;
         } else {
-            last_branch_replacement = last_branch->left;
-            last_branch_dangling_child = NULL;
+            last_branch_replacement = nodes[last_branch].left;
+            last_branch_dangling_child = NONE;
         }
 
-        if (last_branch_parent == NULL)
+        if (last_branch_parent == NONE)
             tst->head[*key] = last_branch_replacement;
         else {
-            if (last_branch_parent->left == last_branch)
-                last_branch_parent->left = last_branch_replacement;
-            else if (last_branch_parent->right == last_branch)
-                last_branch_parent->right = last_branch_replacement;
+            if (nodes[last_branch_parent].left == last_branch)
+                nodes[last_branch_parent].left = last_branch_replacement;
+            else if (nodes[last_branch_parent].right == last_branch)
+                nodes[last_branch_parent].right = last_branch_replacement;
             else
-                last_branch_parent->middle = last_branch_replacement;
+                nodes[last_branch_parent].middle = last_branch_replacement;
         }
 
-        if (last_branch_dangling_child != NULL) {
+        if (last_branch_dangling_child != NONE) {
             current_node = last_branch_replacement;
-            while (current_node->left != NULL)
-                current_node = current_node->left;
-            current_node->left = last_branch_dangling_child;
+            while (nodes[current_node].left != NONE)
+                current_node = nodes[current_node].left;
+            nodes[current_node].left = last_branch_dangling_child;
         }
 
         next_node = last_branch;
@@ -373,15 +432,104 @@ tst_delete(struct tst *tst, const unsigned char *key)
 
     do {
         current_node = next_node;
-        next_node = current_node->middle;
+        next_node = nodes[current_node].middle;
 
-        current_node->left = NULL;
-        current_node->right = NULL;
-        current_node->middle = tst->free_list;
+        nodes[current_node].left = NONE;
+        nodes[current_node].right = NONE;
+        nodes[current_node].middle = tst->free_list;
         tst->free_list = current_node;
-    } while (current_node->value != 0);
+        tst->free_count++;
+    } while (nodes[current_node].value != 0);
+
+    /* next_node is now the data slot of the key. */
+    data = tst->data[next_node].data;
+    tst->data[next_node].next = tst->data_free;
+    tst->data_free = next_node;
+
+    if (tst->free_count > tst->width
+        && tst->free_count > (tst->node_count - tst->free_count))
+        tst_compact(tst);
+    return data;
+}
 
-    return next_node;
+
+/*
+**  tst_compact copies the nodes in use to a new array, in depth-first order
+**  with the middle child first so that the nodes of a key mostly follow
+**  each other, and frees the old one along with the free nodes.  The data
+**  slots in use are likewise moved to the start of a new array.
+*/
+void
+tst_compact(struct tst *tst)
+{
+    struct node *nodes;
+    union data *data;
+    uint32_t *map, *stack;
+    uint32_t used, data_used, node, i;
+    size_t depth, stack_size;
+
+    /* Number the nodes in use in the order they'll be in, following the
+       links from each head with an explicit stack. */
+    map = xcalloc(tst->node_count, sizeof(uint32_t));
+    stack_size = 256;
+    stack = xmalloc(stack_size * sizeof(uint32_t));
+    used = 1;
+    data_used = 1;
+    for (i = 256; i-- > 0;) {
+        if (tst->head[i] == NONE)
+            continue;
+        depth = 0;
+        stack[depth++] = tst->head[i];
+        while (depth > 0) {
+            node = stack[--depth];
+            map[node] = used++;
+            if (depth + 3 > stack_size) {
+                stack_size *= 2;
+                stack = xreallocarray(stack, stack_size, sizeof(uint32_t));
+            }
+            if (tst->nodes[node].right != NONE)
+                stack[depth++] = tst->nodes[node].right;
+            if (tst->nodes[node].left != NONE)
+                stack[depth++] = tst->nodes[node].left;
+            if (tst->nodes[node].value != 0)
+                stack[depth++] = tst->nodes[node].middle;
+            else
+                data_used++;
+        }
+    }
+    free(stack);
+
+    /* Copy the nodes to their new place, translating their links. */
+    nodes = xmalloc(used * sizeof(struct node));
+    data = xmalloc(data_used * sizeof(union data));
+    memset(&nodes[0], 0, sizeof(struct node));
+    memset(&data[0], 0, sizeof(union data));
+    data_used = 1;
+    for (node = 1; node < tst->node_count; node++) {
+        if (map[node] == NONE)
+            continue;
+        nodes[map[node]].value = tst->nodes[node].value;
+        nodes[map[node]].left = map[tst->nodes[node].left];
+        nodes[map[node]].right = map[tst->nodes[node].right];
+        if (tst->nodes[node].value != 0)
+            nodes[map[node]].middle = map[tst->nodes[node].middle];
+        else {
+            data[data_used] = tst->data[tst->nodes[node].middle];
+            nodes[map[node]].middle = data_used++;
+        }
+    }
+    for (i = 0; i < 256; i++)
+        tst->head[i] = map[tst->head[i]];
+    free(map);
+    free(tst->nodes);
+    free(tst->data);
+    tst->nodes = nodes;
+    tst->node_count = used;
+    tst->free_list = NONE;
+    tst->free_count = 0;
+    tst->data = data;
+    tst->data_count = data_used;
+    tst->data_free = NONE;
 }
 
 
@@ -392,16 +540,7 @@ tst_delete(struct tst *tst, const unsigned char *key)
 void
 tst_cleanup(struct tst *tst)
 {
-    struct node_lines *current_line;
-    struct node_lines *next_line;
-
-    next_line = tst->node_lines;
-    do {
-        current_line = next_line;
-        next_line = current_line->next;
-        free(current_line->node_line);
-        free(current_line);
-    } while (next_line != NULL);
-
+    free(tst->nodes);
+    free(tst->data);
     free(tst);
 }
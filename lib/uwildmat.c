@@ -449,3 +449,273 @@ uwildmat_simple(const char *text, const char *pat)
         return (match_pattern(utext, upat, upat + length - 1) == true);
     }
 }
+
+
+/*
+**  Compiled wildmat expressions.
+**
+**  Callers that match the same expression against many strings, like innd
+**  checking every newsgroup of every article against the subscriptions of
+**  every site, can parse it once with uwildmat_compile and then match with
+**  uwildmat_match.  Each pattern of the expression is classified when it is
+**  compiled; the common forms (a literal, a literal followed by a star, a star
+**  followed by a literal, or a lone star) are then matched with a single
+**  memcmp instead of running through match_pattern.  Anything else falls back
+**  on match_pattern.
+**
+**  Since the last matching pattern determines the result of an expression,
+**  the patterns are tried from last to first and matching stops at the first
+**  hit.
+*/
+enum wildmat_type {
+    WILDMAT_ALL,                /* Only stars, matches anything. */
+    WILDMAT_LITERAL,            /* No metacharacters at all. */
+    WILDMAT_PREFIX,             /* A literal followed by stars. */
+    WILDMAT_SUFFIX,             /* Stars followed by a literal. */
+    WILDMAT_PATTERN,            /* Anything else, use match_pattern. */
+    WILDMAT_EXPRESSION          /* A full expression, in a list. */
+};
+
+struct wildmat_pattern {
+    enum wildmat_type type;
+    bool reverse;               /* Introduced by ! or @. */
+    bool poison;                /* Introduced by @. */
+    const unsigned char *start; /* The literal part, or the pattern. */
+    const unsigned char *end;   /* Last character of the pattern. */
+    size_t length;              /* Length of the literal part. */
+};
+
+struct wildmat {
+    size_t count;
+    size_t size;
+    struct wildmat_pattern *patterns;
+    char *strings;              /* Our copy of the expression. */
+};
+
+
+/*
+**  Find the end of the pattern starting at start in an expression ending at
+**  end, the same way as match_expression does.  Returns a pointer to the
+**  comma ending it, or to end + 1 if it is the last one.
+*/
+static const unsigned char *
+find_split(const unsigned char *start, const unsigned char *end)
+{
+    const unsigned char *split;
+    bool escaped;
+
+    for (escaped = false, split = start; split <= end; split++) {
+        if (*split == '[') {
+            split++;
+            if (*split == ']')
+                split++;
+            while (split <= end && *split != ']')
+                split++;
+        }
+        if (*split == ',' && !escaped)
+            break;
+        escaped = (*split == '\\') ? !escaped : false;
+    }
+    return split;
+}
+
+
+/*
+**  Add the pattern between start and end, inclusive, to a compiled
+**  expression, working out the fastest way to match it.
+*/
+static void
+add_pattern(struct wildmat *wildmat, enum wildmat_type type,
+            const unsigned char *start, const unsigned char *end,
+            bool reverse, bool poison)
+{
+    struct wildmat_pattern *pattern;
+    const unsigned char *p, *first, *last;
+
+    if (wildmat->count == wildmat->size) {
+        wildmat->size = (wildmat->size == 0) ? 4 : wildmat->size * 2;
+        wildmat->patterns = xreallocarray(wildmat->patterns, wildmat->size,
+                                          sizeof(struct wildmat_pattern));
+    }
+    pattern = &wildmat->patterns[wildmat->count++];
+    pattern->reverse = reverse;
+    pattern->poison = poison;
+    pattern->start = start;
+    pattern->end = end;
+    pattern->length = 0;
+    pattern->type = type;
+    if (type == WILDMAT_EXPRESSION)
+        return;
+
+    /* Find the literal part between the leading and the trailing stars. */
+    for (first = start; first <= end && *first == '*'; first++)
+        ;
+    if (first > end) {
+        pattern->type = (end < start) ? WILDMAT_LITERAL : WILDMAT_ALL;
+        return;
+    }
+    for (last = end; *last == '*'; last--)
+        ;
+    pattern->type = WILDMAT_PATTERN;
+    for (p = first; p <= last; p++)
+        if (*p == '*' || *p == '?' || *p == '[' || *p == '\\')
+            return;
+
+    /* A star only moves over whole characters, so a suffix starting with a
+       UTF-8 continuation octet needs match_pattern. */
+    if (first > start && last < end)
+        return;
+    else if (first > start && (*first & 0xc0) == 0x80)
+        return;
+    else if (first > start)
+        pattern->type = WILDMAT_SUFFIX;
+    else if (last < end)
+        pattern->type = WILDMAT_PREFIX;
+    else
+        pattern->type = WILDMAT_LITERAL;
+    pattern->start = first;
+    pattern->length = last - first + 1;
+}
+
+
+/*
+**  Compile a wildmat expression.  If allowpoison is set, @ introduces a
+**  poison pattern as with uwildmat_poison.  The result should be freed with
+**  uwildmat_free.
+*/
+struct wildmat *
+uwildmat_compile(const char *pat, bool allowpoison)
+{
+    struct wildmat *wildmat;
+    const unsigned char *p, *end, *split;
+    bool reverse, poison;
+
+    wildmat = xcalloc(1, sizeof(struct wildmat));
+    wildmat->strings = xstrdup(pat);
+    p = (const unsigned char *) wildmat->strings;
+
+    /* As in match_expression, the empty expression only matches the empty
+       string. */
+    if (!*p) {
+        add_pattern(wildmat, WILDMAT_LITERAL, p, p - 1, false, false);
+        return wildmat;
+    }
+    end = p + strlen(pat) - 1;
+    for (; p <= end + 1; p = split + 1) {
+        poison = allowpoison && (*p == '@');
+        reverse = (*p == '!') || poison;
+        if (reverse)
+            p++;
+        split = find_split(p, end);
+        add_pattern(wildmat, WILDMAT_PATTERN, p, split - 1, reverse, poison);
+    }
+    return wildmat;
+}
+
+
+/*
+**  Compile a list of wildmat expressions, each optionally preceded by ! to
+**  invert its sense (or by @ for poison, if allowpoison is set).  Matching
+**  the result gives the same answer as matching each one in turn with
+**  uwildmat with the last match winning, the way newsfeeds and readers.conf
+**  newsgroup lists are evaluated.  The list is terminated by a NULL pointer.
+*/
+struct wildmat *
+uwildmat_compile_list(char *const *pats, bool allowpoison)
+{
+    struct wildmat *wildmat;
+    const unsigned char *p, *end;
+    size_t i, length;
+    char *copy;
+    bool reverse, poison;
+
+    wildmat = xcalloc(1, sizeof(struct wildmat));
+    for (length = 0, i = 0; pats[i] != NULL; i++)
+        length += strlen(pats[i]) + 1;
+    wildmat->strings = xmalloc(length + 1);
+    for (copy = wildmat->strings, i = 0; pats[i] != NULL; i++) {
+        length = strlen(pats[i]);
+        memcpy(copy, pats[i], length + 1);
+        p = (const unsigned char *) copy;
+        copy += length + 1;
+
+        poison = allowpoison && (*p == '@');
+        reverse = (*p == '!') || poison;
+        if (reverse)
+            p++;
+
+        /* What is left is itself given to uwildmat, so it may be a whole
+           expression on its own, which we won't try to flatten. */
+        end = (const unsigned char *) copy - 2;
+        if (*p == '!' || find_split(p, end) <= end)
+            add_pattern(wildmat, WILDMAT_EXPRESSION, p, end, reverse, poison);
+        else
+            add_pattern(wildmat, WILDMAT_PATTERN, p, end, reverse, poison);
+    }
+    return wildmat;
+}
+
+
+/*
+**  Match text against a compiled wildmat expression.  Returns UWILDMAT_POISON
+**  only if it was compiled with allowpoison.
+*/
+enum uwildmat
+uwildmat_match(const struct wildmat *wildmat, const char *text)
+{
+    const unsigned char *utext = (const unsigned char *) text;
+    const struct wildmat_pattern *pattern;
+    size_t i, length;
+    bool matched;
+
+    length = strlen(text);
+    for (i = wildmat->count; i-- > 0; ) {
+        pattern = &wildmat->patterns[i];
+        switch (pattern->type) {
+        case WILDMAT_ALL:
+            matched = true;
+            break;
+        case WILDMAT_LITERAL:
+            matched = (length == pattern->length
+                       && memcmp(text, pattern->start, length) == 0);
+            break;
+        case WILDMAT_PREFIX:
+            matched = (length >= pattern->length
+                       && memcmp(text, pattern->start, pattern->length) == 0);
+            break;
+        case WILDMAT_SUFFIX:
+            matched = (length >= pattern->length
+                       && memcmp(text + length - pattern->length,
+                                 pattern->start, pattern->length) == 0);
+            break;
+        case WILDMAT_EXPRESSION:
+            matched = (uwildmat(text, (const char *) pattern->start));
+            break;
+        case WILDMAT_PATTERN:
+        default:
+            matched = (match_pattern(utext, pattern->start, pattern->end)
+                       == true);
+            break;
+        }
+        if (!matched)
+            continue;
+        if (!pattern->reverse)
+            return UWILDMAT_MATCH;
+        return pattern->poison ? UWILDMAT_POISON : UWILDMAT_FAIL;
+    }
+    return UWILDMAT_FAIL;
+}
+
+
+/*
+**  Free a compiled wildmat expression.
+*/
+void
+uwildmat_free(struct wildmat *wildmat)
+{
+    if (wildmat == NULL)
+        return;
+    free(wildmat->patterns);
+    free(wildmat->strings);
+    free(wildmat);
+}
@@ -21,6 +21,14 @@
 #include "clibrary.h"
 #include <assert.h>
 
+/* Use vector instructions in wire_findspecial and wire_finddotline where the
+   compiler provides them unconditionally for the target. */
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+#endif
+
 #include "inn/wire.h"
 #include "inn/libinn.h"
 
@@ -54,6 +62,136 @@ wire_findbody(const char *article, size_t length)
 }
 
 
+/*
+**  Find the first nul, CR or LF in the length octets at data, returning NULL
+**  if there is none.  This is where the readers of articles off the network
+**  spend most of their time, so whole blocks of octets are checked at once:
+**  16 at a time with SSE2 or NEON, and otherwise a word at a time with the
+**  classic trick of subtracting 1 from each octet to find the first zero one
+**  (after exclusive-or with the character looked for).  Once a block holds a
+**  match, its position is found octet by octet.
+*/
+char *
+wire_findspecial(const char *data, size_t length)
+{
+    const char *p = data;
+    const char *end = data + length;
+
+#if defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i nul = _mm_setzero_si128();
+    __m128i block, match;
+
+    for (; end - p >= 16; p += 16) {
+        block = _mm_loadu_si128((const void *) p);
+        match = _mm_or_si128(_mm_cmpeq_epi8(block, cr),
+                             _mm_cmpeq_epi8(block, lf));
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(block, nul));
+        if (_mm_movemask_epi8(match) != 0)
+            break;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t lf = vdupq_n_u8('\n');
+    uint8x16_t block, match;
+
+    for (; end - p >= 16; p += 16) {
+        block = vld1q_u8((const uint8_t *) p);
+        match = vorrq_u8(vceqq_u8(block, cr), vceqq_u8(block, lf));
+        match = vorrq_u8(match, vceqzq_u8(block));
+        if (vmaxvq_u8(match) != 0)
+            break;
+    }
+#else
+    const unsigned long ones = (unsigned long) -1 / 0xff;
+    const unsigned long highs = ones * 0x80;
+    unsigned long word, cr, lf;
+
+    for (; (size_t) (end - p) >= sizeof(word); p += sizeof(word)) {
+        memcpy(&word, p, sizeof(word));
+        cr = word ^ (ones * '\r');
+        lf = word ^ (ones * '\n');
+        if ((((word - ones) & ~word) | ((cr - ones) & ~cr)
+             | ((lf - ones) & ~lf)) & highs)
+            break;
+    }
+#endif
+
+    for (; p < end; p++)
+        if (*p == '\r' || *p == '\n' || *p == '\0')
+            return (char *) p;
+    return NULL;
+}
+
+
+/*
+**  Find the first period at the start of a line (the first octet of data
+**  counts as the start of a line) in the length octets at data, returning
+**  NULL if there is none.  Lines starting with a period are the only ones
+**  that need dot-stuffing, and most articles have none, so blocks of 16
+**  octets are checked at once with SSE2 or NEON by comparing each octet
+**  with a period and the octet before it with LF.  Without them, the line
+**  endings are found with memchr, which the C library already vectorizes.
+*/
+char *
+wire_finddotline(const char *data, size_t length)
+{
+    const char *p = data;
+    const char *end = data + length;
+
+    if (length == 0)
+        return NULL;
+    if (*p == '.')
+        return (char *) p;
+    p++;
+
+#if defined(__SSE2__)
+    {
+        const __m128i dot = _mm_set1_epi8('.');
+        const __m128i lf = _mm_set1_epi8('\n');
+        __m128i block, before, match;
+
+        for (; end - p >= 16; p += 16) {
+            block = _mm_loadu_si128((const void *) p);
+            before = _mm_loadu_si128((const void *) (p - 1));
+            match = _mm_and_si128(_mm_cmpeq_epi8(block, dot),
+                                  _mm_cmpeq_epi8(before, lf));
+            if (_mm_movemask_epi8(match) != 0)
+                break;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    {
+        const uint8x16_t dot = vdupq_n_u8('.');
+        const uint8x16_t lf = vdupq_n_u8('\n');
+        uint8x16_t block, before, match;
+
+        for (; end - p >= 16; p += 16) {
+            block = vld1q_u8((const uint8_t *) p);
+            before = vld1q_u8((const uint8_t *) (p - 1));
+            match = vandq_u8(vceqq_u8(block, dot), vceqq_u8(before, lf));
+            if (vmaxvq_u8(match) != 0)
+                break;
+        }
+    }
+#else
+    for (p--; p < end; p++) {
+        p = memchr(p, '\n', end - p);
+        if (p == NULL || p + 1 >= end)
+            return NULL;
+        if (p[1] == '.')
+            return (char *) p + 1;
+    }
+#endif
+
+    for (; p < end; p++)
+        if (*p == '.' && p[-1] == '\n')
+            return (char *) p;
+    return NULL;
+}
+
+
 /*
 **  Given a pointer into an article and a pointer to the last octet of the
 **  article, find the next line ending and return a pointer to the first
@@ -155,6 +293,60 @@ wire_findheader(const char *article, size_t length, const char *header,
 }
 
 
+/*
+**  Given a pointer to the start of the article, the article length, and an
+**  array of headers to look for, find all of them in a single pass over the
+**  headers of the article, with the same rules as wire_findheader.  Stops
+**  early once all the headers have been found, unless the last occurrence
+**  of one of them is wanted.
+*/
+void
+wire_findheaders(const char *article, size_t length,
+                 struct wire_header *headers, size_t count, bool stripspaces)
+{
+    char *p, *value;
+    const char *end;
+    size_t i, left, headerlen;
+    bool last = false;
+
+    for (i = 0; i < count; i++) {
+        headers[i].value = NULL;
+        if (headers[i].last)
+            last = true;
+    }
+    left = count;
+    end = article + length - 1;
+    p = (char *) article;
+    while (p != NULL && end - p > 2 && (left > 0 || last)) {
+        if (p[0] == '\r' && p[1] == '\n')
+            return;
+
+        /* Continuation lines can't start a header. */
+        if (!ISWHITE(p[0])) {
+            for (i = 0; i < count; i++) {
+                if (headers[i].value != NULL && !headers[i].last)
+                    continue;
+                headerlen = strlen(headers[i].name);
+                if (end - p <= (ptrdiff_t) headerlen + 2
+                    || !isheader(p, headers[i].name, headerlen))
+                    continue;
+                value = p + headerlen + 2;
+                if (stripspaces)
+                    value = skip_fws_bounded(value, end);
+                if (value == NULL)
+                    continue;
+                if (value >= end || value[0] != '\r' || value[1] != '\n') {
+                    if (headers[i].value == NULL)
+                        left--;
+                    headers[i].value = value;
+                }
+            }
+        }
+        p = wire_nextline(p, end);
+    }
+}
+
+
 /*
 **  Given a pointer to a header and a pointer to the last octet of the
 **  article, find the end of the header (a pointer to the final \n of the
@@ -187,38 +379,44 @@ wire_from_native(const char *article, size_t len, size_t *newlen)
 {
     size_t bytes;
     char *newart;
-    const char *p;
+    const char *p, *q, *dot;
+    const char *end = article + len;
     char *dest;
-    bool at_start = true;
 
     /* First go thru article and count number of bytes we need.  Add a CR for
        every LF and an extra character for any period at the beginning of a
-       line for dot-stuffing.  Add 3 characters at the end for .\r\n. */
-    for (bytes = 0, p = article; p < article + len; p++) {
-        if (at_start && *p == '.')
-            bytes++;
+       line for dot-stuffing.  Add 3 characters at the end for .\r\n.  Whole
+       lines are skipped at once, and most articles have no line to stuff. */
+    bytes = len + 3;
+    for (p = article; (p = memchr(p, '\n', end - p)) != NULL; p++)
         bytes++;
-        at_start = (*p == '\n');
-        if (at_start)
-            bytes++;
+    for (p = article; (p = wire_finddotline(p, end - p)) != NULL; p++) {
+        bytes++;
+        p = memchr(p, '\n', end - p);
+        if (p == NULL)
+            break;
     }
-    bytes += 3;
 
-    /* Now copy the article, making the required changes. */
+    /* Now copy the article a line at a time, making the required changes. */
     newart = xmalloc(bytes + 1);
     *newlen = bytes;
-    at_start = true;
-    for (p = article, dest = newart; p < article + len; p++) {
-        if (*p == '\n') {
-            *dest++ = '\r';
-            *dest++ = '\n';
-            at_start = true;
-        } else {
-            if (at_start && *p == '.')
-                *dest++ = '.';
-            *dest++ = *p;
-            at_start = false;
+    dest = newart;
+    dot = wire_finddotline(article, len);
+    for (p = article; p < end; p = q + 1) {
+        q = memchr(p, '\n', end - p);
+        if (p == dot) {
+            *dest++ = '.';
+            dot = (q == NULL) ? NULL : wire_finddotline(q + 1, end - q - 1);
+        }
+        if (q == NULL) {
+            memcpy(dest, p, end - p);
+            dest += end - p;
+            break;
         }
+        memcpy(dest, p, q - p);
+        dest += q - p;
+        *dest++ = '\r';
+        *dest++ = '\n';
     }
     *dest++ = '.';
     *dest++ = '\r';
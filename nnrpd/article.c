@@ -10,9 +10,19 @@
 #endif
 #include <sys/uio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+# define ART_SENDFILE 1
+#endif
 
+#include "inn/buffer.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
+#include "inn/paths.h"
+#include "inn/ratelimit.h"
+#include "inn/replycache.h"
 #include "inn/wire.h"
 #include "nnrpd.h"
 #include "inn/ov.h"
@@ -56,8 +66,43 @@ static SENDDATA		SENDhead = {
 };
 
 static struct iovec	iov[IOV_MAX > 1024 ? 1024 : IOV_MAX];
+
+/* Largest piece of a reply sent at once to a client that is rate limited,
+   and number of slots in the file of buckets shared by access groups. */
+#define RATE_CHUNK	16384
+#define RATE_SLOTS	256
+
+/* Room for a reply in each slot of the shared cache of OVER replies, enough
+   for the overview of several hundred articles. */
+#define OVER_CACHE_SLOT (256 * 1024)
+
+/* The reply to the current OVER command, kept to be stored in the shared
+   cache, unless it becomes too large. */
+static struct buffer	*OVERfill = NULL;
+static bool		OVERfilling = false;
 static int		queued_iov = 0;
 
+/* The value of the header sent for the current line of a HDR, XHDR or XPAT
+   reply from overview, reused from one line to the next. */
+static struct buffer	*PATvalue = NULL;
+
+/* The overview of the article found by OVERbyid. */
+static struct buffer	*OVERline = NULL;
+
+/* The tokens of the articles listed by the last OVER commands in the
+   current newsgroup, by increasing article number, so that reading them by
+   number afterwards needs no overview lookup.  Successive OVER commands
+   moving forward in the group add to them, up to OVER_TOKENS of them. */
+#define OVER_TOKENS	100000
+struct overtoken {
+    ARTNUM	artnum;
+    TOKEN	token;
+};
+static struct overtoken	*OVERtokens = NULL;
+static size_t		OVERtokencount = 0;
+static size_t		OVERtokensize = 0;
+static char		*OVERtokengroup = NULL;
+
 static void
 PushIOvHelper(struct iovec* vec, int* countp)
 {
@@ -114,6 +159,8 @@ Again:
 	} else
 #endif /* HAVE_OPENSSL */
 	    result = xwritev(STDOUT_FILENO, vec, *countp);
+	if (result > 0)
+	    NNTPsent += result;
 
 #ifdef HAVE_SASL
     }
@@ -129,24 +176,90 @@ Again:
     *countp = 0;
 }
 
+/*
+**  Return the buckets shared by the clients of each access group with a
+**  max_total_rate, opening them the first time, or NULL if they are
+**  unusable.
+*/
+static struct ratelimit_table *
+RATEtable(void)
+{
+    static struct ratelimit_table *table = NULL;
+    static bool tried = false;
+    char *path;
+
+    if (tried)
+        return table;
+    tried = true;
+    path = concatpath(innconf->pathrun, INN_PATH_RATELIMIT);
+    table = ratelimit_table_open(path, RATE_SLOTS);
+    free(path);
+    return table;
+}
+
+/*
+**  Wait for the given number of seconds before sending more to a client
+**  that is rate limited.  The process has nothing else to do meanwhile, but
+**  it keeps an eye on the connection so that a client which goes away does
+**  not keep it around until the end of the wait.
+*/
+static void
+RATEwait(double delay)
+{
+    struct pollfd pfd;
+    double start, now, end;
+    int n;
+
+    start = now = TMRnow_double();
+    end = start + delay;
+    pfd.fd = STDOUT_FILENO;
+    pfd.events = 0;
+    do {
+        n = poll(&pfd, 1, (int) ((end - now) * 1000) + 1);
+        if (n > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+            ExitWithStats(1, true);
+        if (n < 0 && errno != EINTR) {
+            syswarn("%s: poll in PushIOvRateLimited failed", Client.host);
+            break;
+        }
+        now = TMRnow_double();
+    } while (now < end);
+    IDLEtime += now - start;
+}
+
+/*
+**  Send what is queued in pieces, first charging the bucket of the client
+**  and the one it shares with the clients of the same access group for
+**  each piece, and waiting as long as they say.  A piece is no larger than
+**  what a bucket holds, so that the rate is kept to even on short times.
+*/
 static void
 PushIOvRateLimited(void)
 {
-    double              start, end, elapsed, target;
+    static struct ratelimit session;
+    struct ratelimit_table *table;
     struct iovec        newiov[IOV_MAX > 1024 ? 1024 : IOV_MAX];
     int                 newiov_len;
     int                 sentiov;
     int                 i;
-    int                 bytesfound;
-    int                 chunkbittenoff;
-    struct timeval      waittime;
+    long                chunk, bytesfound, chunkbittenoff;
+    double              now, delay, total;
+
+    if (session.rate != MaxBytesPerSecond)
+        ratelimit_init(&session, MaxBytesPerSecond, 0);
+    chunk = RATE_CHUNK;
+    if (MaxBytesPerSecond != 0 && MaxBytesPerSecond < chunk)
+        chunk = MaxBytesPerSecond;
+    if (MaxTotalRate != 0 && MaxTotalRate < chunk)
+        chunk = MaxTotalRate;
+    table = (MaxTotalRate != 0) ? RATEtable() : NULL;
 
     while (queued_iov) {
 	bytesfound = newiov_len = 0;
 	sentiov = 0;
-	for (i = 0; (i < queued_iov) && (bytesfound < MaxBytesPerSecond); i++) {
-	    if ((signed)iov[i].iov_len + bytesfound > MaxBytesPerSecond) {
-		chunkbittenoff = MaxBytesPerSecond - bytesfound;
+	for (i = 0; (i < queued_iov) && (bytesfound < chunk); i++) {
+	    if ((long) iov[i].iov_len + bytesfound > chunk) {
+		chunkbittenoff = chunk - bytesfound;
 		newiov[newiov_len].iov_base = iov[i].iov_base;
 		newiov[newiov_len++].iov_len = chunkbittenoff;
 		iov[i].iov_base = (char *)iov[i].iov_base + chunkbittenoff;
@@ -159,38 +272,35 @@ PushIOvRateLimited(void)
 	    }
 	}
 	assert(sentiov <= queued_iov);
-        start = TMRnow_double();
+        now = TMRnow_double();
+        delay = ratelimit_charge(&session, bytesfound, now);
+        if (table != NULL) {
+            total = ratelimit_table_charge(table, PERMaccessconf->name,
+                                           MaxTotalRate, 0, bytesfound, now);
+            if (total > delay)
+                delay = total;
+        }
+        if (delay > 0)
+            RATEwait(delay);
 	PushIOvHelper(newiov, &newiov_len);
-        end = TMRnow_double();
-        target = (double) bytesfound / MaxBytesPerSecond;
-        elapsed = end - start;
-        if (elapsed < 1 && elapsed < target) {
-            waittime.tv_sec = 0;
-            waittime.tv_usec = (target - elapsed) * 1e6;
-            start = TMRnow_double();
-	    if (select(0, NULL, NULL, NULL, &waittime) != 0)
-                syswarn("%s: select in PushIOvRateLimit failed", Client.host);
-            end = TMRnow_double();
-            IDLEtime += end - start;
-	}
 	memmove(iov, &iov[sentiov], (queued_iov - sentiov) * sizeof(struct iovec));
 	queued_iov -= sentiov;
     }
 }
 
-static void
+void
 PushIOv(void)
 {
     TMRstart(TMR_NNTPWRITE);
     fflush(stdout);
     TMRstop(TMR_NNTPWRITE);
-    if (MaxBytesPerSecond != 0)
+    if (MaxBytesPerSecond != 0 || MaxTotalRate != 0)
 	PushIOvRateLimited();
     else
 	PushIOvHelper(iov, &queued_iov);
 }
 
-static void
+void
 SendIOv(const char *p, int len)
 {
     char                *q;
@@ -208,10 +318,82 @@ SendIOv(const char *p, int len)
 	PushIOv();
 }
 
+#ifdef ART_SENDFILE
+/* Smaller spans are cheaper to send along with the rest of the response. */
+#define SENDFILE_MIN	8192
+
+/*
+**  Send len bytes of the current article starting at p straight from the
+**  file holding it, without copying them through our buffers.  Only done on
+**  a plain connection, or a TLS one whose records the kernel encrypts,
+**  without rate limiting, and when the storage method says where the
+**  article is stored.  Returns the number of bytes sent; the caller queues
+**  the rest with SendIOv as usual.
+*/
+static size_t
+ARTsendfile(const char *p, size_t len)
+{
+    struct artfile	af;
+    off_t		offset;
+    ssize_t		n;
+    size_t		sent = 0;
+#ifdef HAVE_OPENSSL
+    bool		ktls;
+#endif
+
+    if (len < SENDFILE_MIN || MaxBytesPerSecond != 0 || MaxTotalRate != 0)
+	return 0;
+#if defined(HAVE_ZLIB)
+    if (compression_layer_on)
+	return 0;
+#endif
+#ifdef HAVE_SASL
+    if (sasl_conn && sasl_ssf)
+	return 0;
+#endif
+#ifdef HAVE_OPENSSL
+    ktls = false;
+    if (tls_conn) {
+# ifdef SSL_OP_ENABLE_KTLS
+	ktls = BIO_get_ktls_send(SSL_get_wbio(tls_conn));
+# endif
+	if (!ktls)
+	    return 0;
+    }
+#endif
+    af.art = ARThandle;
+    if (ARThandle->token == NULL || !SMprobe(SMARTFILE, ARThandle->token, &af))
+	return 0;
+    offset = af.offset + (p - ARThandle->data);
+
+    /* The response line has to go out first. */
+    PushIOv();
+    TMRstart(TMR_NNTPWRITE);
+    while (sent < len) {
+#if defined(HAVE_OPENSSL) && defined(SSL_OP_ENABLE_KTLS)
+	if (ktls) {
+	    n = SSL_sendfile(tls_conn, af.fd, offset, len - sent, 0);
+	    if (n > 0)
+		offset += n;
+	} else
+#endif
+	n = sendfile(STDOUT_FILENO, af.fd, &offset, len - sent);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	sent += n;
+    }
+    TMRstop(TMR_NNTPWRITE);
+    NNTPsent += sent;
+    return sent;
+}
+#endif /* ART_SENDFILE */
+
 static char		*_IO_buffer_ = NULL;
 static int		highwater = 0;
 
-static void
+void
 PushIOb(void)
 {
 #if defined(HAVE_ZLIB)
@@ -224,7 +406,7 @@ PushIOb(void)
     highwater = 0;
 }
 
-static void
+void
 SendIOb(const char *p, int len)
 {
     int tocopy;
@@ -279,6 +461,110 @@ ARTinstorebytoken(TOKEN token)
     return false;
 }
 
+/*
+**  Called before an OVER command lists the articles from low on.  The
+**  tokens kept so far are forgotten, unless they are for the same newsgroup
+**  and all before low.
+*/
+static void
+OVERtokenstart(ARTNUM low)
+{
+    if (OVERtokengroup != NULL && strcmp(OVERtokengroup, GRPcur) == 0
+        && (OVERtokencount == 0
+            || OVERtokens[OVERtokencount - 1].artnum < low))
+        return;
+    free(OVERtokengroup);
+    OVERtokengroup = xstrdup(GRPcur);
+    OVERtokencount = 0;
+}
+
+/*
+**  Keep the token of an article listed by an OVER command.
+*/
+static void
+OVERtokenadd(ARTNUM artnum, TOKEN token)
+{
+    if (OVERtokencount >= OVER_TOKENS)
+        return;
+    if (OVERtokencount > 0 && OVERtokens[OVERtokencount - 1].artnum >= artnum)
+        return;
+    if (OVERtokencount == OVERtokensize) {
+        OVERtokensize = (OVERtokensize == 0) ? 256 : OVERtokensize * 2;
+        OVERtokens = xreallocarray(OVERtokens, OVERtokensize,
+                                   sizeof(struct overtoken));
+    }
+    OVERtokens[OVERtokencount].artnum = artnum;
+    OVERtokens[OVERtokencount].token = token;
+    OVERtokencount++;
+}
+
+/*
+**  Find the token of an article of the current newsgroup among those kept
+**  from OVER commands.  Returns false if it is not there.
+*/
+static bool
+OVERtokenfind(ARTNUM artnum, TOKEN *token)
+{
+    size_t low, high, mid;
+
+    if (OVERtokencount == 0 || GRPcur == NULL
+        || strcmp(OVERtokengroup, GRPcur) != 0)
+        return false;
+    low = 0;
+    high = OVERtokencount;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (OVERtokens[mid].artnum < artnum)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == OVERtokencount || OVERtokens[low].artnum != artnum)
+        return false;
+    *token = OVERtokens[low].token;
+    return true;
+}
+
+/*
+**  Called when the client reads the articles of a newsgroup one after the
+**  other, so that the storage method starts reading the next ones in the
+**  background while this one is sent.  Each article is only asked for once,
+**  so this costs one overview lookup per article read; the tokens found are
+**  handed to the storage API together.
+*/
+static void
+ARTreadahead(ARTNUM artnum)
+{
+    static char		*group = NULL;
+    static ARTNUM	ahead;
+    static TOKEN	*tokens = NULL;
+    static size_t	size = 0;
+    ARTNUM		last, n;
+    size_t		count;
+
+    if (group == NULL || strcmp(group, GRPcur) != 0) {
+	free(group);
+	group = xstrdup(GRPcur);
+	ahead = 0;
+    }
+    if (ahead < artnum)
+	ahead = artnum;
+    last = artnum + innconf->nnrpdreadahead;
+    if (last > ARThigh)
+	last = ARThigh;
+    if (size < innconf->nnrpdreadahead) {
+	size = innconf->nnrpdreadahead;
+	tokens = xrealloc(tokens, size * sizeof(TOKEN));
+    }
+    for (count = 0, n = ahead + 1; n <= last && count < size; n++)
+	if (OVERtokenfind(n, &tokens[count])
+	    || OVgetartinfo(GRPcur, n, &tokens[count]))
+	    count++;
+    SMadvise(tokens, count);
+    if (last > ahead)
+	ahead = last;
+}
+
 /*
 **  If the article name is valid, open it and stuff in the ID.
 */
@@ -295,7 +581,8 @@ ARTopen(ARTNUM artnum)
     }
     ARTclose();
 
-    if (!OVgetartinfo(GRPcur, artnum, &token))
+    if (!OVERtokenfind(artnum, &token)
+        && !OVgetartinfo(GRPcur, artnum, &token))
 	return false;
   
     TMRstart(TMR_READART);
@@ -305,22 +592,21 @@ ARTopen(ARTNUM artnum)
 	return false;
     }
 
+    if (innconf->nnrpdreadahead > 0 && artnum == save_artnum + 1)
+	ARTreadahead(artnum);
     save_artnum = artnum;
     return true;
 }
 
 
 /*
-**  Open the article for a given message-ID.
+**  Find the token of the article with a given message-ID.
 */
 static bool
-ARTopenbyid(char *msg_id, ARTNUM *ap, bool final)
+ARTtokenbyid(char *msg_id, TOKEN *token, bool final)
 {
-    TOKEN token;
-
-    *ap = 0;
-    token = cache_get(HashMessageID(msg_id), final);
-    if (token.type == TOKEN_EMPTY) {
+    *token = cache_get(HashMessageID(msg_id), final);
+    if (token->type == TOKEN_EMPTY) {
 	if (History == NULL) {
 	    time_t statinterval;
 
@@ -337,10 +623,23 @@ ARTopenbyid(char *msg_id, ARTNUM *ap, bool final)
 	    statinterval = 30;
 	    HISctl(History, HISCTLS_STATINTERVAL, &statinterval);
 	}
-	if (!HISlookup(History, msg_id, NULL, NULL, NULL, &token))
+	if (!HISlookup(History, msg_id, NULL, NULL, NULL, token))
 	    return false;
     }
-    if (token.type == TOKEN_EMPTY)
+    return token->type != TOKEN_EMPTY;
+}
+
+
+/*
+**  Open the article for a given message-ID.
+*/
+static bool
+ARTopenbyid(char *msg_id, ARTNUM *ap, bool final)
+{
+    TOKEN token;
+
+    *ap = 0;
+    if (!ARTtokenbyid(msg_id, &token, final))
 	return false;
     TMRstart(TMR_READART);
     ARThandle = SMretrieve(token, RETR_ALL);
@@ -364,31 +663,17 @@ ARTsendmmap(SENDTYPE what)
 
     ARTcount++;
     GRParticles++;
-    lastchar = -1;
-
-    /* Get the headers and detect if wire format. */
-    if (what == STarticle) {
-	q = ARThandle->data;
-	p = ARThandle->data + ARThandle->len;
-     } else {
-	for (q = p = ARThandle->data; p < (ARThandle->data + ARThandle->len); p++) {
-	    if (*p == '\r')
-		continue;
-	    if (*p == '\n') {
-		if (lastchar == '\n') {
-		    if (what == SThead) {
-			if (*(p-1) == '\r')
-			    p--;
-			break;
-		    } else {
-			q = p + 1;
-			p = ARThandle->data + ARThandle->len;
-			break;
-		    }
-		}
-	    }
-	    lastchar = *p;
-	}
+
+    /* Articles from the storage API are in wire format, so the headers end
+       at the first empty line.  Without one, the whole article is sent. */
+    q = ARThandle->data;
+    p = ARThandle->data + ARThandle->len;
+    if (what != STarticle) {
+	r = wire_findbody(ARThandle->data, ARThandle->len);
+	if (r != NULL && what == SThead)
+	    p = r - 2;
+	else if (r != NULL)
+	    q = r;
     }
 
     /* q points to the start of the article buffer, p to the end of it. */
@@ -468,8 +753,15 @@ ARTsendmmap(SENDTYPE what)
 	        SendIOv(path, p - path);
 	    }
 	}
-    } else
-	SendIOv(q, p - q);
+    } else {
+#ifdef ART_SENDFILE
+	r = q + ARTsendfile(q, p - q);
+#else
+	r = q;
+#endif
+	if (r < p)
+	    SendIOv(r, p - r);
+    }
     ARTgetsize += p - q;
     if (what == SThead) {
 	SendIOv(".\r\n", 3);
@@ -885,30 +1177,210 @@ CMDgetrange(int ac, char *av[], ARTRANGE *rp, bool *DidReply)
 
 
 /*
-**  Apply virtual hosting to an Xref: field.
+**  Apply virtual hosting to an Xref: field of the given length, replacing
+**  the server name with the domain of the access group, and put the result
+**  in the provided buffer.  Returns false if the field is malformed.
 */
-static char *
-vhost_xref(char *p)
+static bool
+vhost_xref(const char *p, size_t length, struct buffer *value)
 {
-    char *space;
-    size_t offset;
-    char *field = NULL;
+    const char *space;
 
-    space = strchr(p, ' ');
+    space = memchr(p, ' ', length);
     if (space == NULL) {
-        warn("malformed Xref: `%s'", p);
-        goto fail;
+        warn("malformed Xref: `%.*s'", (int) length, p);
+        return false;
     }
-    offset = space - p;
-    space = strchr(p + offset, ' ');
-    if (space == NULL) {
-        warn("malformed Xref: `%s'", p);
-        goto fail;
+    buffer_set(value, PERMaccessconf->domain, strlen(PERMaccessconf->domain));
+    buffer_append(value, space, length - (space - p));
+    return true;
+}
+
+
+/*
+**  Find the overview of the article with the given message-ID, as returned
+**  by OVsearch, and copy it to OVERline.  A newsgroup and number of the
+**  article come from the token index of the overview when it knows the
+**  article, so that the article isn't read, and otherwise from the first
+**  newsgroup of its Xref: header field.  Replies with an error and returns
+**  false if the article or its overview is not found, or if the user is not
+**  allowed to read it.
+*/
+static bool
+OVERbyid(char *msg_id)
+{
+    OVTOKENINFO info;
+    ARTHANDLE *art;
+    TOKEN token, found;
+    ARTNUM artnum = 0, n;
+    const char *xref, *end, *p, *colon, *field;
+    char *group = NULL, *data;
+    size_t fieldlen;
+    void *handle;
+    int len;
+    bool status = false;
+
+    if (!ARTtokenbyid(msg_id, &token, false)
+        || (PERMaccessconf->nnrpdcheckart && !ARTinstorebytoken(token))) {
+        Reply("%d No such article\r\n", NNTP_FAIL_MSGID_NOTFOUND);
+        return false;
+    }
+    info.token = token;
+    if (OVctl(OVTOKENLOOKUP, &info)) {
+        group = xstrdup(info.group);
+        artnum = info.artnum;
+    } else {
+        TMRstart(TMR_READART);
+        art = SMretrieve(token, RETR_HEAD);
+        TMRstop(TMR_READART);
+        if (art != NULL) {
+            xref = wire_findheader(art->data, art->len, "Xref", true);
+            end = NULL;
+            if (xref != NULL)
+                end = wire_endheader(xref, art->data + art->len - 1);
+            p = (end != NULL) ? memchr(xref, ' ', end - xref) : NULL;
+            if (p != NULL) {
+                for (p++; p < end && *p == ' '; p++)
+                    ;
+                colon = memchr(p, ':', end - p);
+                if (colon != NULL && colon > p) {
+                    group = xstrndup(p, colon - p);
+                    artnum = strtoul(colon + 1, NULL, 10);
+                }
+            }
+            SMfreearticle(art);
+        }
+    }
+
+    if (group != NULL && artnum > 0) {
+        handle = OVopensearch(group, artnum, artnum);
+        if (handle != NULL) {
+            while (OVsearch(handle, &n, &data, &len, &found, NULL))
+                if (n == artnum && len > 0
+                    && memcmp(&found, &token, sizeof(TOKEN)) == 0) {
+                    if (OVERline == NULL)
+                        OVERline = buffer_new();
+                    buffer_set(OVERline, data, len);
+                    status = true;
+                }
+            OVclosesearch(handle);
+        }
+    }
+    free(group);
+    if (!status || overhdr_xref == -1
+        || !overview_find_field(OVERline->data, OVERline->left, overhdr_xref,
+                                "Xref", &field, &fieldlen)) {
+        Reply("%d No such article\r\n", NNTP_FAIL_MSGID_NOTFOUND);
+        return false;
+    }
+
+    /* Check the newsgroups of the article like PERMartok does. */
+    group = xstrndup(field, fieldlen);
+    status = PERMxrefok(group);
+    free(group);
+    if (!status)
+        Reply("%d Read access denied for this article\r\n",
+              PERMcanauthenticate ? NNTP_FAIL_AUTH_NEEDED : NNTP_ERR_ACCESS);
+    return status;
+}
+
+
+/*
+**  Answer OVER for a message-ID.  The article number is replaced with 0, as
+**  RFC 3977 wants.
+*/
+static void
+OVERmessageid(char *msg_id)
+{
+    const char *data, *end, *field, *p, *q;
+    size_t fieldlen;
+
+    if (!OVERbyid(msg_id))
+        return;
+    data = OVERline->data;
+    end = OVERline->data + OVERline->left;
+    Reply("%d Overview information for %s follows\r\n", NNTP_OK_OVER,
+          msg_id);
+    p = memchr(data, '\t', end - data);
+    if (p == NULL)
+        p = end;
+    SendIOb("0", 1);
+    if (VirtualPathlen > 0
+        && overview_find_field(data, end - data, overhdr_xref, "Xref",
+                               &field, &fieldlen)) {
+        for (q = field; q < end && *q == ' '; q++)
+            ;
+        SendIOb(p, q - p);
+        p = memchr(q, ' ', end - q);
+        if (p == NULL)
+            p = end;
+        /* Copy the virtual path without its final '!'. */
+        SendIOb(VirtualPath, VirtualPathlen - 1);
+    }
+    SendIOb(p, end - p);
+    SendIOb(".\r\n", 3);
+    PushIOb();
+}
+
+
+/*
+**  Return the shared cache of OVER replies, opening it the first time, or
+**  NULL if nnrpdovercachesize is not set or if it is unusable.
+*/
+static struct replycache *
+OVERcache(void)
+{
+    static struct replycache *cache = NULL;
+    static bool tried = false;
+    char *path;
+
+    if (innconf->nnrpdovercachesize == 0 || tried)
+        return cache;
+    tried = true;
+    path = concatpath(innconf->pathrun, INN_PATH_OVERCACHE);
+    cache = replycache_open(path, innconf->nnrpdovercachesize * 1024,
+                            OVER_CACHE_SLOT);
+    free(path);
+    return cache;
+}
+
+
+/*
+**  Return the key of a reply to OVER in the shared cache.  Besides the
+**  newsgroup and the range, it has the water marks of the newsgroup, so
+**  that a reply is no longer used once new articles arrive, and all that
+**  changes the lines sent.  The caller frees it.
+*/
+static char *
+OVERkey(ARTRANGE *range)
+{
+    char *key;
+
+    xasprintf(&key, "%s %lu-%lu %lu %lu %d %d %s", GRPcur, range->Low,
+              range->High, ARTlow, ARThigh, overhdr_xref,
+              PERMaccessconf->nnrpdcheckart ? 1 : 0,
+              VirtualPathlen > 0 ? VirtualPath : "");
+    return key;
+}
+
+
+/*
+**  Send part of the overview lines of a reply to OVER, copying them if copy
+**  is true, and keep them for the shared cache if the reply is being kept.
+*/
+static void
+OVERsend(const char *p, int len, bool copy)
+{
+    if (copy)
+        SendIOb(p, len);
+    else
+        SendIOv(p, len);
+    if (OVERfilling) {
+        if (OVERfill->left + len > OVER_CACHE_SLOT)
+            OVERfilling = false;
+        else
+            buffer_append(OVERfill, p, len);
     }
-    field = concat(PERMaccessconf->domain, space, NULL);
- fail:
-    free(p);
-    return field;
 }
 
 
@@ -930,16 +1402,12 @@ CMDover(int ac, char *av[])
     TOKEN		token;
     struct cvector *vector = NULL;
     bool                xover, mid;
+    struct replycache	*cache;
+    char		*key = NULL;
 
     xover = (strcasecmp(av[0], "XOVER") == 0);
     mid = (ac > 1 && IsValidMessageID(av[1], true, laxmid));
 
-    if (mid && !xover) {
-        /* FIXME:  We still do not support OVER MSGID, sorry! */
-        Reply("%d Overview by message-ID unsupported\r\n", NNTP_ERR_UNAVAILABLE);
-        return;
-    }
-
     /* Check the syntax of the arguments first.
      * We do not accept a message-ID for XOVER, contrary to OVER.  A range
      * is accepted for both of them. */
@@ -957,7 +1425,7 @@ CMDover(int ac, char *av[])
     }
 
     /* Trying to read. */
-    if (GRPcount == 0) {
+    if (GRPcount == 0 && !mid) {
         Reply("%d Not in a newsgroup\r\n", NNTP_FAIL_NO_GROUP);
         return;
     }
@@ -970,12 +1438,42 @@ CMDover(int ac, char *av[])
 	return;
     }
 
+    if (mid) {
+        OVERmessageid(av[1]);
+        return;
+    }
+
     /* Parse range.  CMDgetrange() correctly sets the range when
      * there is no arguments. */
     if (!CMDgetrange(ac, av, &range, &DidReply))
         if (DidReply)
             return;
 
+    /* Send the reply from the shared cache if another nnrpd has just
+       generated it; otherwise, keep it to store it there. */
+    cache = mid ? NULL : OVERcache();
+    if (cache != NULL) {
+        if (OVERfill == NULL)
+            OVERfill = buffer_new();
+        key = OVERkey(&range);
+        if (replycache_get(cache, key, OVERfill) && OVERfill->left > 0) {
+            if (ac > 1)
+                Reply("%d Overview information for %s follows\r\n",
+                      NNTP_OK_OVER, av[1]);
+            else
+                Reply("%d Overview information for %lu follows\r\n",
+                      NNTP_OK_OVER, ARTnumber);
+            fflush(stdout);
+            SendIOv(OVERfill->data, OVERfill->left);
+            SendIOv(".\r\n", 3);
+            PushIOv();
+            free(key);
+            return;
+        }
+        buffer_set(OVERfill, NULL, 0);
+        OVERfilling = true;
+    }
+
     if (PERMaccessconf->nnrpdoverstats) {
         OVERcount++;
         gettimeofday(&stv, NULL);
@@ -991,6 +1489,8 @@ CMDover(int ac, char *av[])
                   xover ? NNTP_OK_OVER : NNTP_FAIL_ARTNUM_NOTFOUND, ARTnumber);
         if (xover)
             Printf(".\r\n");
+        OVERfilling = false;
+        free(key);
         return;
     }
     if (PERMaccessconf->nnrpdoverstats) {
@@ -1007,6 +1507,7 @@ CMDover(int ac, char *av[])
        SendIOb because it copies the data. */
     OVctl(OVSTATICSEARCH, &useIOb);
 
+    OVERtokenstart(range.Low);
     HasNotReplied = true;
     while (OVsearch(handle, &artnum, &data, &len, &token, NULL)) {
 	if (PERMaccessconf->nnrpdoverstats) {
@@ -1025,6 +1526,7 @@ CMDover(int ac, char *av[])
 	    OVERhit++;
 	    OVERsize += len;
 	}
+        OVERtokenadd(artnum, token);
 
         if (HasNotReplied) {
             if (ac > 1)
@@ -1065,20 +1567,11 @@ CMDover(int ac, char *av[])
                 continue;
             }
             /* Copy the virtual path without its final '!'. */
-	    if(useIOb) {
-		SendIOb(data, p - data);
-		SendIOb(VirtualPath, VirtualPathlen - 1);
-		SendIOb(q, len - (q - data));
-	    } else {
-		SendIOv(data, p - data);
-		SendIOv(VirtualPath, VirtualPathlen - 1);
-		SendIOv(q, len - (q - data));
-	    }
+	    OVERsend(data, p - data, useIOb);
+	    OVERsend(VirtualPath, VirtualPathlen - 1, useIOb);
+	    OVERsend(q, len - (q - data), useIOb);
 	} else {
-	    if(useIOb)
-		SendIOb(data, len);
-	    else
-		SendIOv(data, len);
+	    OVERsend(data, len, useIOb);
 	}
 	if (PERMaccessconf->nnrpdoverstats)
 	    gettimeofday(&stv, NULL);
@@ -1112,7 +1605,11 @@ CMDover(int ac, char *av[])
             SendIOv(".\r\n", 3);
             PushIOv();
         }
+        if (OVERfilling)
+            replycache_put(cache, key, OVERfill->data, OVERfill->left);
     }
+    OVERfilling = false;
+    free(key);
 
     if (PERMaccessconf->nnrpdoverstats)
 	gettimeofday(&stv, NULL);
@@ -1125,6 +1622,61 @@ CMDover(int ac, char *av[])
 
 }
 
+/*
+**  Return the number of the open article in the current newsgroup, from its
+**  Xref header field, or 0 if it isn't there.
+*/
+static ARTNUM
+ARTgroupnumber(void)
+{
+    char *xref, *p;
+    size_t length;
+
+    xref = GetHeader("Xref", true);
+    if (xref == NULL)
+        return 0;
+    length = strlen(GRPcur);
+    for (p = strchr(xref, ' '); p != NULL; p = strchr(p, ' ')) {
+        p++;
+        if (strncmp(p, GRPcur, length) == 0 && p[length] == ':')
+            return strtoul(p + length + 1, NULL, 10);
+    }
+    return 0;
+}
+
+
+/*
+**  Answer XPAT for an exact message-ID in the Message-ID header field, by
+**  looking it up in the history instead of searching the overview of the
+**  whole range.
+*/
+static void
+PATmessageid(const char *header, char *msgid, ARTRANGE *range)
+{
+    ARTNUM artnum = 0;
+    const char *p;
+
+    if (range->High > 0 && ARTopenbyid(msgid, &artnum, false)) {
+        artnum = ARTgroupnumber();
+        p = GetHeader("Message-ID", true);
+        if (p == NULL || strcmp(p, msgid) != 0 || artnum < range->Low
+            || artnum > range->High)
+            artnum = 0;
+        ARTclose();
+    }
+    if (artnum == 0) {
+        Reply("%d No header or metadata information for %s follows (from overview)\r\n",
+              NNTP_OK_HEAD, header);
+        Printf(".\r\n");
+        return;
+    }
+    Reply("%d Header or metadata information for %s follows (from overview)\r\n",
+          NNTP_OK_HEAD, header);
+    Printf("%lu %s\r\n", artnum, msgid);
+    Printf(".\r\n");
+}
+
+
 /*
 **  Access specific fields from an article with HDR.
 **  The legacy XHDR and XPAT are also kept, with their specific behaviours.
@@ -1146,9 +1698,10 @@ CMDpat(int ac, char *av[])
     char		buff[SPOOLNAMEBUFF];
     void                *handle;
     char                *data;
+    const char          *field;
     int                 len;
+    size_t              fieldlen;
     TOKEN               token;
-    struct cvector *vector = NULL;
     bool                hdr, mid;
 
     hdr = (strcasecmp(av[0], "HDR") == 0);
@@ -1228,6 +1781,38 @@ CMDpat(int ac, char *av[])
             }
 
 	    p = av[2];
+
+            /* Answer from overview if the header is there. */
+            Overview = overview_index(header, OVextra);
+            if (Overview >= 0 && !IsBytes && !IsLines) {
+                if (!OVERbyid(p))
+                    break;
+                Reply("%d Header information for %s follows (from overview)\r\n",
+                      hdr ? NNTP_OK_HDR : NNTP_OK_HEAD, av[1]);
+                text = NULL;
+                if (overview_find_field(OVERline->data, OVERline->left,
+                                        Overview, header, &field,
+                                        &fieldlen)) {
+                    if (PATvalue == NULL)
+                        PATvalue = buffer_new();
+                    if (!PERMaccessconf->virtualhost
+                        || Overview != overhdr_xref)
+                        buffer_set(PATvalue, field, fieldlen);
+                    else if (!vhost_xref(field, fieldlen, PATvalue))
+                        buffer_set(PATvalue, NULL, 0);
+                    if (PATvalue->left > 0) {
+                        buffer_append(PATvalue, "", 1);
+                        text = PATvalue->data;
+                    }
+                }
+                if (text != NULL && (!pattern || uwildmat_simple(text, pattern)))
+                    Printf("%s %s\r\n", hdr ? "0" : p, text);
+                else if (hdr)
+                    Printf("0 \r\n");
+                Printf(".\r\n");
+                break;
+            }
+
 	    if (!ARTopenbyid(p, &artnum, false)) {
 		Reply("%d No such article\r\n", NNTP_FAIL_MSGID_NOTFOUND);
 		break;
@@ -1262,6 +1847,14 @@ CMDpat(int ac, char *av[])
             if (DidReply)
                 break;
 
+        /* An exact message-ID is found without searching the range. */
+        if (pattern != NULL && strcasecmp(header, "Message-ID") == 0
+            && IsValidMessageID(pattern, true, laxmid)
+            && strpbrk(pattern, "*?[\\") == NULL) {
+            PATmessageid(av[1], pattern, &range);
+            break;
+        }
+
 	/* In overview? */
         Overview = overview_index(header, OVextra);
 
@@ -1338,33 +1931,36 @@ CMDpat(int ac, char *av[])
                       hdr ? NNTP_OK_HDR : NNTP_OK_HEAD, av[1]);
                 HasNotReplied = false;
             }
-	    vector = overview_split(data, len, NULL, vector);
-            if (Overview < OVERVIEW_MAX) {
-                p = overview_get_standard_header(vector, Overview);
-            } else {
-                p = overview_get_extra_header(vector, header);
-            }
-	    if (p != NULL) {
+            /* Only look for the field wanted rather than split the line,
+             * and copy it in a buffer kept from one line to the next. */
+            p = NULL;
+            if (overview_find_field(data, len, Overview, header, &field,
+                                    &fieldlen)) {
+                if (PATvalue == NULL)
+                    PATvalue = buffer_new();
 		if (PERMaccessconf->virtualhost &&
 			   Overview == overhdr_xref) {
-		    p = vhost_xref(p);
-		    if (p == NULL) {
+		    if (!vhost_xref(field, fieldlen, PATvalue)) {
                         if (hdr) {
                             snprintf(buff, sizeof(buff), "%lu \r\n", artnum);
                             SendIOb(buff, strlen(buff));
                         }
 			continue;
                     }
-		}
+		} else
+                    buffer_set(PATvalue, field, fieldlen);
+                buffer_append(PATvalue, "", 1);
+                p = PATvalue->data;
+            }
+	    if (p != NULL) {
 		if (!pattern || uwildmat_simple(p, pattern)) {
 		    snprintf(buff, sizeof(buff), "%lu ", artnum);
 		    SendIOb(buff, strlen(buff));
-		    SendIOb(p, strlen(p));
+		    SendIOb(p, PATvalue->left - 1);
 		    SendIOb("\r\n", 2);
 		}
                 /* No need to have another condition for HDR because
                  * pattern is NULL for it, and p is not NULL here. */
-		free(p);
 	    } else if (hdr) {
                 snprintf(buff, sizeof(buff), "%lu \r\n", artnum);
                 SendIOb(buff, strlen(buff));
@@ -1391,9 +1987,6 @@ CMDpat(int ac, char *av[])
 	OVclosesearch(handle);
     } while (0);
 
-    if (vector)
-	cvector_free(vector);
-
     if (pattern)
 	free(pattern);
 }
@@ -2,15 +2,20 @@
 **  External authenticator support.
 **
 **  Run an external resolver or authenticator to determine the username of the
-**  client and return that information to INN.  For more information about the
-**  protocol used, see doc/external-auth.
+**  client and return that information to INN, or ask one running as a server
+**  on a Unix domain socket.  For more information about the protocol used,
+**  see doc/external-auth.
 */
 
 #include "config.h"
 #include "clibrary.h"
+#include "portable/socket.h"
 #include <errno.h>
 #include <signal.h>
 #include <sys/wait.h>
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+# include <sys/un.h>
+#endif
 
 #include "inn/buffer.h"
 #include "inn/messages.h"
@@ -311,12 +316,123 @@ append_client_info(struct client *client, struct buffer *data)
 }
 
 
+/*
+**  Send a request to an authenticator running as a server on the Unix
+**  domain socket at path, and read its reply:  User: and Error: lines, as
+**  printed by an authenticator on its standard output and standard error,
+**  up to a line holding a single period.  Uses the same five-second timeout
+**  as for programs.  Returns the username in newly allocated memory, or NULL
+**  if none was found.
+*/
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+static char *
+ask_server(struct client *client, const char *path, struct buffer *request)
+{
+    struct sockaddr_un address;
+    struct buffer *input;
+    fd_set fds;
+    struct timeval tv;
+    int fd, status;
+    ssize_t count;
+    char *line, *start;
+    char *user = NULL;
+    double begin, end;
+    bool done = false;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        warn("%s auth: socket path %s too long", client->host, path);
+        return NULL;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        syswarn("%s auth: cannot create socket", client->host);
+        return NULL;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strlcpy(address.sun_path, path, sizeof(address.sun_path));
+    if (connect(fd, (struct sockaddr *) &address, SUN_LEN(&address)) < 0) {
+        syswarn("%s auth: cannot connect to %s", client->host, path);
+        close(fd);
+        return NULL;
+    }
+    if (xwrite(fd, request->data, request->left) < 0) {
+        syswarn("%s auth: cannot write to %s", client->host, path);
+        close(fd);
+        return NULL;
+    }
+
+    input = buffer_new();
+    while (!done) {
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        tv.tv_sec = 5;
+        tv.tv_usec = 0;
+        begin = TMRnow_double();
+        status = select(fd + 1, &fds, NULL, NULL, &tv);
+        end = TMRnow_double();
+        IDLEtime += end - begin;
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0) {
+            if (status == 0)
+                warn("%s auth: server timeout", client->host);
+            else
+                syswarn("%s auth: select failed", client->host);
+            break;
+        }
+
+        buffer_compact(input);
+        buffer_resize(input, input->left + 1024);
+        count = buffer_read(input, fd);
+        if (count <= 0) {
+            if (count < 0)
+                syswarn("%s auth: read error", client->host);
+            else
+                warn("%s auth: server closed the connection", client->host);
+            break;
+        }
+        start = input->data + input->used;
+        line = memchr(start, '\n', input->left);
+        while (line != NULL) {
+            *line = '\0';
+            if (line > start && line[-1] == '\r')
+                line[-1] = '\0';
+            if (strcmp(start, ".") == 0) {
+                done = true;
+                break;
+            } else if (strncasecmp(start, "Error:", strlen("Error:")) == 0)
+                handle_error(client, start + strlen("Error:"), &user);
+            else
+                handle_result(client, start, &user);
+            input->used += line - start + 1;
+            input->left -= line - start + 1;
+            start = input->data + input->used;
+            line = memchr(start, '\n', input->left);
+        }
+        if (input->left > 8192) {
+            warn("%s auth: output too long from server", client->host);
+            break;
+        }
+    }
+    buffer_free(input);
+    close(fd);
+    if (!done && user != NULL) {
+        free(user);
+        user = NULL;
+    }
+    return user;
+}
+#endif /* HAVE_UNIX_DOMAIN_SOCKETS */
+
+
 /*
 **  Execute a program to get the remote username.  Takes the client info, the
 **  command to run, the subdirectory in which to look for programs, and
 **  optional username and password information to pass to the program.
-**  Returns the username in newly allocated memory if successful, NULL
-**  otherwise.
+**  A command of the form unix:<path> names the socket of an authenticator
+**  running as a server instead.  Returns the username in newly allocated
+**  memory if successful, NULL otherwise.
 */
 char *
 auth_external(struct client *client, const char *command,
@@ -327,12 +443,7 @@ auth_external(struct client *client, const char *command,
     struct process *process;
     struct buffer *input;
 
-    /* Start the program. */
-    process = start_process(client, command, directory);
-    if (process == NULL)
-        return NULL;
-
-    /* Feed it data. */
+    /* Build the data to feed it. */
     input = buffer_new();
     append_client_info(client, input);
     if (username != NULL)
@@ -340,6 +451,24 @@ auth_external(struct client *client, const char *command,
     if (password != NULL)
         buffer_append_sprintf(input, "ClientPassword: %s\r\n", password);
     buffer_append_sprintf(input, ".\r\n");
+
+    if (strncmp(command, "unix:", strlen("unix:")) == 0) {
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+        user = ask_server(client, command + strlen("unix:"), input);
+#else
+        warn("%s auth: Unix domain sockets not supported", client->host);
+        user = NULL;
+#endif
+        buffer_free(input);
+        return user;
+    }
+
+    /* Start the program. */
+    process = start_process(client, command, directory);
+    if (process == NULL) {
+        buffer_free(input);
+        return NULL;
+    }
     xwrite(process->write_fd, input->data, input->left);
     close(process->write_fd);
     buffer_free(input);
@@ -7,6 +7,10 @@
 **  built during (X)OVER/(X)HDR/XPAT/NEWNEWS.  If we hit in the cache when
 **  retrieving articles, the (relatively) expensive cost of a trip
 **  through the history database is saved.
+**
+**  If sharedmsgidcachesize is set, translations are also kept in a cache
+**  shared with innd and the other nnrpd processes (see lib/tokencache.c),
+**  which is looked up when this one misses.
 */
 
 #include "config.h"
@@ -16,7 +20,9 @@
 #include "inn/tst.h"
 #include "inn/list.h"
 #include "inn/libinn.h"
+#include "inn/paths.h"
 #include "inn/storage.h"
+#include "inn/tokencache.h"
 
 #include "cache.h"
 
@@ -40,6 +46,27 @@ struct cache_entry {
 
 static struct list unused, used;
 
+/*
+**  The cache shared with innd and the other nnrpd processes, if
+**  sharedmsgidcachesize is set.  Only tried to be opened once.
+*/
+static struct tokencache *sharedcache;
+static bool sharedtried;
+
+static struct tokencache *
+cache_shared(void)
+{
+    char *path;
+
+    if (!sharedtried && innconf->sharedmsgidcachesize != 0) {
+        sharedtried = true;
+        path = concatpath(innconf->pathrun, INN_PATH_MSGIDCACHE);
+        sharedcache = tokencache_open(path, innconf->sharedmsgidcachesize);
+        free(path);
+    }
+    return sharedcache;
+}
+
 /*
 **  Add a translation from HASH, h, to TOKEN, t, to the message-ID
 **  cache.
@@ -47,6 +74,8 @@ static struct list unused, used;
 void
 cache_add(const HASH h, const TOKEN t)
 {
+    if (cache_shared() != NULL)
+        tokencache_add(sharedcache, &h, &t);
     if (innconf->msgidcachesize != 0) {
 	struct cache_entry *entry, *old;
 	const unsigned char *p;
@@ -118,5 +147,10 @@ cache_get(const HASH h, bool final)
 	    return last_token;
 	}
     }
+    if (cache_shared() != NULL
+        && tokencache_get(sharedcache, &h, &last_token)) {
+        last_hash = h;
+        return last_token;
+    }
     return empty_token;
 }
@@ -288,6 +288,7 @@ CMDauthinfo(int ac, char *av[])
 	    case 1:
 		PERMspecified = NGgetlist(&PERMreadlist, accesslist);
 		PERMpostlist = PERMreadlist;
+		PERMcompile();
 		syslog(L_NOTICE, "%s auth %s (%s -> %s)", Client.host, PERMuser,
 			logrec, PERMauthstring? PERMauthstring: "" );
 		Reply("%d Authentication succeeded\r\n", NNTP_OK_AUTHINFO);
@@ -485,7 +486,6 @@ CMDnewgroups(int ac, char *av[])
     char	        *q;
     QIOSTATE	        *qp;
     time_t		date;
-    char		*grplist[2];
     int                 hi, lo, count, flag;
     GROUPDATA           *grouplist = NULL;
     GROUPDATA           key;
@@ -534,9 +534,7 @@ CMDnewgroups(int ac, char *av[])
 	    continue;
 
 	if (PERMspecified) {
-	    grplist[0] = p;
-	    grplist[1] = NULL;
-	    if (!PERMmatch(PERMreadlist, grplist))
+	    if (!PERMgroupok(p))
 		continue;
 	}
 	else 
@@ -5,10 +5,29 @@
 #include "config.h"
 #include "clibrary.h"
 
+#include "inn/activemap.h"
 #include "inn/innconf.h"
 #include "nnrpd.h"
 #include "inn/ov.h"
 
+/*
+**  Open a search of the overview of a group for which only the article
+**  numbers, tokens and arrival times are needed, so that the overview method
+**  can answer it from its index without reading the overview data.
+*/
+static void *
+GRPopenindexsearch(char *group, ARTNUM low, ARTNUM high)
+{
+    void *handle;
+    bool indexonly = true;
+
+    OVctl(OVINDEXONLY, &indexonly);
+    handle = OVopensearch(group, low, high);
+    indexonly = false;
+    OVctl(OVINDEXONLY, &indexonly);
+    return handle;
+}
+
 /*
 **  Change to or list the specified newsgroup.  If invalid, stay in the old
 **  group.
@@ -19,7 +38,6 @@ CMDgroup(int ac, char *av[])
 {
     ARTNUM              i;
     int                 low, high;
-    char		*grplist[2];
     char		*group;
     void                *handle;
     TOKEN               token;
@@ -59,7 +77,7 @@ CMDgroup(int ac, char *av[])
     }
 
     /* FIXME: Temporarily work around broken API. */
-    if (!OVgroupstats(group, &low, &high, &count, NULL)) {
+    if (!GRPstats(group, &low, &high, &count, NULL)) {
         Reply("%d No such group %s\r\n", NNTP_FAIL_BAD_GROUP, group);
         free(group);
         return;
@@ -88,9 +106,7 @@ CMDgroup(int ac, char *av[])
 
     if (!hookpresent) {
         if (PERMspecified) {
-            grplist[0] = group;
-            grplist[1] = NULL;
-            if (!PERMmatch(PERMreadlist, grplist)) {
+            if (!PERMgroupok(group)) {
                 Reply("%d Read access denied\r\n",
                       PERMcanauthenticate ? NNTP_FAIL_AUTH_NEEDED : NNTP_ERR_ACCESS);
                 free(group);
@@ -134,7 +150,7 @@ CMDgroup(int ac, char *av[])
 		    nfslow = ARTlow;
 		else
 		    nfslow = ARThigh - innconf->nfsreaderdelay;
-		handle = OVopensearch(group, nfslow, ARThigh);
+		handle = GRPopenindexsearch(group, nfslow, ARThigh);
 		if (!handle) {
 		    Reply("%d group disappeared\r\n", NNTP_FAIL_ACTION);
 		    free(group);
@@ -201,7 +217,8 @@ CMDgroup(int ac, char *av[])
             /* If OVopensearch() is restricted to the range, it returns NULL
              * in case there isn't any article within the range.  We already
              * know that the group exists. */
-            if ((handle = OVopensearch(group, range.Low, range.High)) != NULL) {
+            handle = GRPopenindexsearch(group, range.Low, range.High);
+            if (handle != NULL) {
                 while (OVsearch(handle, &i, NULL, NULL, &token, NULL)) {
                     if (PERMaccessconf->nnrpdcheckart && !ARTinstorebytoken(token))
                         continue;
@@ -244,6 +261,44 @@ GRPreport(void)
 }
 
 
+/*
+**  Return the table of newsgroups published by innd when sharedactive is
+**  set, opening it the first time, or NULL if there is none.
+*/
+struct activemap *
+GRPmap(void)
+{
+    static struct activemap *map = NULL;
+    static bool tried = false;
+    char *path;
+
+    if (innconf->sharedactive && !tried) {
+        tried = true;
+        path = concatpath(innconf->pathrun, INN_PATH_ACTIVEMAP);
+        map = activemap_open(path);
+        free(path);
+    }
+    return map;
+}
+
+
+/*
+**  Get the water marks, count and flag of a newsgroup like OVgroupstats, but
+**  from the table published by innd when sharedactive is set, so as not to
+**  query the overview method.  Newsgroups that aren't in the table, if any,
+**  are still looked up in the overview.
+*/
+bool
+GRPstats(char *group, int *lo, int *hi, int *count, int *flag)
+{
+    struct activemap *map = GRPmap();
+
+    if (map != NULL && activemap_lookup(map, group, lo, hi, count, flag))
+        return true;
+    return OVgroupstats(group, lo, hi, count, flag);
+}
+
+
 /*
 **  Used by ANU-News clients.
 */
@@ -254,7 +309,6 @@ CMDxgtitle(int ac, char *av[])
     char	*line;
     char	*p;
     char	*q;
-    char		*grplist[2];
     char		save;
 
     /* Parse the arguments. */
@@ -290,12 +344,8 @@ CMDxgtitle(int ac, char *av[])
 	save = *q;
 	*q = '\0';
 	if (uwildmat(line, p)) {
-	    if (PERMspecified) {
-		grplist[0] = line;
-		grplist[1] = NULL;
-		if (!PERMmatch(PERMreadlist, grplist))
-		    continue;
-	    }
+	    if (PERMspecified && !PERMgroupok(line))
+		continue;
 	    *q = save;
 	    Printf("%s\r\n", line);
 	}
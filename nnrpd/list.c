@@ -4,8 +4,11 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include "portable/mmap.h"
+#include <sys/uio.h>
 
 #include "nnrpd.h"
+#include "inn/buffer.h"
 #include "inn/ov.h"
 #include "inn/overview.h"
 #include "inn/innconf.h"
@@ -84,6 +87,257 @@ static LISTINFO *info[] = {
 };
 
 
+/*
+**  Snapshots of the newsgroups and active.times files in wire format.
+**
+**  These files only change when newsgroups are created, removed or
+**  described, but they used to be parsed and sent a line at a time for
+**  each LIST command.  The first process listing one of them after it
+**  changed writes a snapshot in pathrun, named after the file with .wire
+**  appended, that all processes then map.  It holds a header identifying
+**  the version of the file it was made from, an index giving the offset and
+**  length of each line and the length of the newsgroup name starting it,
+**  and the lines with CRLF line endings.  The lines the client may see are
+**  then sent from the snapshot in runs, without copying them.
+**
+**  The active file isn't handled that way since innd updates it with each
+**  article it accepts.
+*/
+#define SNAPSHOT_MAGIC   0x494e4e4cU
+#define SNAPSHOT_VERSION 1
+
+struct snapshot_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long mtime;        /* Identification of the source file. */
+    unsigned long size;
+    unsigned long inode;
+    unsigned long lines;
+};
+
+struct snapshot_line {
+    unsigned long offset;       /* From the start of the lines. */
+    unsigned int length;        /* Including CRLF. */
+    unsigned int namelen;
+};
+
+struct snapshot {
+    void *base;
+    size_t size;
+    const struct snapshot_header *header;
+    const struct snapshot_line *index;
+    const char *text;
+};
+
+
+/*
+**  Write a new snapshot of source at path, for the version of it given by
+**  st.  Lines that would break the protocol are left out, as when listing
+**  the file.  Returns false on failure, after logging it.
+*/
+static bool
+snapshot_build(const char *source, const char *path, const struct stat *st)
+{
+    struct snapshot_header header;
+    struct snapshot_line *index = NULL;
+    struct buffer *text;
+    struct iovec iov[3];
+    QIOSTATE *qp;
+    char *p, *temp;
+    size_t allocated = 0;
+    int fd;
+    bool ok;
+
+    qp = QIOopen(source);
+    if (qp == NULL)
+        return false;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.mtime = st->st_mtime;
+    header.size = st->st_size;
+    header.inode = st->st_ino;
+    text = buffer_new();
+    for (;;) {
+        p = QIOread(qp);
+        if (p == NULL && QIOtoolong(qp))
+            continue;
+        if (p == NULL)
+            break;
+        if (p[0] == '.' && p[1] != '.') {
+            syslog(L_ERROR, "%s bad dot-stuffing in %s", Client.host, source);
+            continue;
+        }
+        if (header.lines == allocated) {
+            allocated = (allocated == 0) ? 1024 : allocated * 2;
+            index = xreallocarray(index, allocated, sizeof(*index));
+        }
+        index[header.lines].offset = text->left;
+        index[header.lines].length = QIOlength(qp) + 2;
+        index[header.lines].namelen = strcspn(p, " \t");
+        header.lines++;
+        buffer_append(text, p, QIOlength(qp));
+        buffer_append(text, "\r\n", 2);
+    }
+    ok = !QIOerror(qp);
+    QIOclose(qp);
+
+    /* Write it under a temporary name, in case other processes are
+       building it at the same time. */
+    xasprintf(&temp, "%s.%lu", path, (unsigned long) getpid());
+    if (ok) {
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = index;
+        iov[1].iov_len = header.lines * sizeof(*index);
+        iov[2].iov_base = text->data;
+        iov[2].iov_len = text->left;
+        fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = (fd >= 0 && xwritev(fd, iov, 3) >= 0);
+        if (fd >= 0 && close(fd) < 0)
+            ok = false;
+        if (ok && rename(temp, path) < 0)
+            ok = false;
+        if (!ok) {
+            syslog(L_ERROR, "%s cannot write %s %m", Client.host, path);
+            unlink(temp);
+        }
+    }
+    free(temp);
+    free(index);
+    buffer_free(text);
+    return ok;
+}
+
+
+/*
+**  Map the snapshot at path, returning NULL if it doesn't exist or is
+**  unusable.
+*/
+static struct snapshot *
+snapshot_map(const char *path)
+{
+    struct snapshot *snap;
+    struct stat st;
+    const struct snapshot_header *header;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0
+        || (size_t) st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+    snap = xcalloc(1, sizeof(struct snapshot));
+    snap->size = st.st_size;
+    snap->base = mmap(NULL, snap->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (snap->base == MAP_FAILED) {
+        free(snap);
+        return NULL;
+    }
+    header = snap->base;
+    snap->header = header;
+    snap->index = (const void *) (header + 1);
+    snap->text = (const char *) (snap->index + header->lines);
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION
+        || header->lines > (snap->size - sizeof(*header)) / sizeof(*snap->index)
+        || (header->lines > 0
+            && snap->index[header->lines - 1].offset
+                       + snap->index[header->lines - 1].length
+                   != snap->size - (size_t) (snap->text - (char *) snap->base))) {
+        munmap(snap->base, snap->size);
+        free(snap);
+        return NULL;
+    }
+    return snap;
+}
+
+
+static void
+snapshot_free(struct snapshot *snap)
+{
+    munmap(snap->base, snap->size);
+    free(snap);
+}
+
+
+/*
+**  Return a snapshot of the file at source, called name in pathdb, building
+**  it if it is missing or out of date.  Returns NULL if no snapshot can be
+**  used, in which case the caller should read the file.
+*/
+static struct snapshot *
+snapshot_open(const char *source, const char *name)
+{
+    struct snapshot *snap;
+    struct stat st;
+    char *path;
+
+    if (stat(source, &st) < 0)
+        return NULL;
+    path = concat(innconf->pathrun, "/", name, ".wire", (char *) 0);
+    snap = snapshot_map(path);
+    if (snap != NULL
+        && (snap->header->mtime != (unsigned long) st.st_mtime
+            || snap->header->size != (unsigned long) st.st_size
+            || snap->header->inode != (unsigned long) st.st_ino)) {
+        snapshot_free(snap);
+        snap = NULL;
+    }
+    if (snap == NULL && snapshot_build(source, path, &st))
+        snap = snapshot_map(path);
+    free(path);
+    return snap;
+}
+
+
+/*
+**  Send the lines of a snapshot whose newsgroup the client may read and,
+**  if wildarg isn't NULL, matches it, followed by the end of the response.
+*/
+static void
+snapshot_send(struct snapshot *snap, const char *wildarg)
+{
+    const struct snapshot_line *line;
+    unsigned long i;
+    char *name = NULL;
+    size_t size = 0;
+
+    for (i = 0; i < snap->header->lines; i++) {
+        line = &snap->index[i];
+        if (line->namelen >= size) {
+            size = line->namelen + 1;
+            name = xrealloc(name, size);
+        }
+        memcpy(name, snap->text + line->offset, line->namelen);
+        name[line->namelen] = '\0';
+        if (!PERMgroupok(name))
+            continue;
+        if (wildarg != NULL && !uwildmat(name, wildarg))
+            continue;
+        SendIOv(snap->text + line->offset, line->length);
+    }
+    SendIOv(".\r\n", 3);
+    PushIOv();
+    free(name);
+}
+
+
+/*
+**  Send a line of a LIST response, along with the other lines, once
+**  PushIOb is called.
+*/
+static void
+list_line(const char *p)
+{
+    SendIOb(p, strlen(p));
+    SendIOb("\r\n", 2);
+}
+
+
 /*
 **  List the overview schema (standard and extra fields).
 */
@@ -142,15 +396,11 @@ cmd_list_headers(LISTINFO *lp, int ac, char *av[])
 static bool
 CMD_list_single(char *group)
 {
-    char *grplist[2] = { NULL, NULL };
     int lo, hi, count, flag;
 
-    if (PERMspecified) {
-        grplist[0] = group;
-        if (!PERMmatch(PERMreadlist, grplist))
-            return false;
-    }
-    if (OVgroupstats(group, &lo, &hi, &count, &flag) && flag != NF_FLAG_ALIAS) {
+    if (PERMspecified && !PERMgroupok(group))
+        return false;
+    if (GRPstats(group, &lo, &hi, &count, &flag) && flag != NF_FLAG_ALIAS) {
         /* When the connected user has the right to locally post, mention it. */
         if (PERMaccessconf->locpost && (flag == NF_FLAG_IGNORE
                                         || flag == NF_FLAG_JUNK
@@ -185,6 +435,8 @@ CMDlist(int ac, char *av[])
     LISTINFO		*lp;
     char		*wildarg = NULL;
     char		savec;
+    char		buff[MED_BUFFER];
+    struct snapshot	*snap;
     unsigned int i;
     int         lo, hi, count, flag;
 
@@ -243,6 +495,19 @@ CMDlist(int ac, char *av[])
 	(strstr(lp->File, "newsgroups") != NULL))
 	path = innconf->pathdb;
     path = concatpath(path, lp->File);
+
+    /* Send the newsgroups and active.times files from their snapshot. */
+    if (PERMspecified && (lp == &INFOgroups || lp == &INFOactivetimes)) {
+        snap = snapshot_open(path, lp->File);
+        if (snap != NULL) {
+            free(path);
+            Reply("%d %s\r\n", NNTP_OK_LIST, lp->Format);
+            snapshot_send(snap, wildarg);
+            snapshot_free(snap);
+            return;
+        }
+    }
+
     qp = QIOopen(path);
     free(path);
     if (qp == NULL) {
@@ -276,7 +541,7 @@ CMDlist(int ac, char *av[])
         }
         if (lp == &INFOmotd) {
             if (is_valid_utf8(p)) {
-                Printf("%s\r\n", p);
+                list_line(p);
             } else {
                 syslog(L_ERROR, "%s bad encoding in %s (UTF-8 expected)",
                        Client.host, lp->File);
@@ -300,13 +565,13 @@ CMDlist(int ac, char *av[])
 		    continue;
 		*save = ':';
 	    }
-	    Printf("%s\r\n", p);
+	    list_line(p);
 	    continue;
 	}
 	if (lp == &INFOdistribs || lp == &INFOmoderators) {
             if (*p != '\0' && *p != '#' && *p != ';' && *p != ' ') {
                 if (is_valid_utf8(p)) {
-                    Printf("%s\r\n", p);
+                    list_line(p);
                 } else if (lp == &INFOdistribs) {
                     syslog(L_ERROR, "%s bad encoding in %s (UTF-8 expected)",
                            Client.host, lp->File);
@@ -324,11 +589,8 @@ CMDlist(int ac, char *av[])
 	}
 
         /* Check whether the reader has access to the newsgroup. */
-	if (PERMspecified) {
-	    grplist[0] = p;
-	    if (!PERMmatch(PERMreadlist, grplist))
-		continue;
-	}
+	if (PERMspecified && !PERMgroupok(p))
+	    continue;
 
         /* Check whether the newsgroup matches the wildmat pattern,
          * if given. */
@@ -336,25 +598,29 @@ CMDlist(int ac, char *av[])
 	    continue;
 
         if (lp == &INFOcounts) {
-            if (OVgroupstats(p, &lo, &hi, &count, &flag)) {
+            if (GRPstats(p, &lo, &hi, &count, &flag)) {
                 /* When a newsgroup is empty, the high water mark should be
                  * one less than the low water mark according to RFC 3977. */
                 if (count == 0)
                     lo = hi + 1;
 
                 if (flag != NF_FLAG_ALIAS) {
-                    Printf("%s %u %u %u %c\r\n", p, hi, lo, count,
-                           PERMaccessconf->locpost
-                           && (flag == NF_FLAG_IGNORE
-                               || flag == NF_FLAG_JUNK
-                               || flag == NF_FLAG_NOLOCAL)
-                           ? NF_FLAG_OK : flag);
+                    snprintf(buff, sizeof(buff), "%s %u %u %u %c", p, hi, lo,
+                             count,
+                             PERMaccessconf->locpost
+                             && (flag == NF_FLAG_IGNORE
+                                 || flag == NF_FLAG_JUNK
+                                 || flag == NF_FLAG_NOLOCAL)
+                             ? NF_FLAG_OK : flag);
+                    list_line(buff);
                 } else if (savec != '\0') {
                     *save = savec;
 
                     if ((q = strrchr(p, NF_FLAG_ALIAS)) != NULL) {
                         *save = '\0';
-                        Printf("%s %u %u %u %s\r\n", p, hi, lo, count, q);
+                        snprintf(buff, sizeof(buff), "%s %u %u %u %s", p, hi,
+                                 lo, count, q);
+                        list_line(buff);
                     }
                 }
             }
@@ -376,9 +642,10 @@ CMDlist(int ac, char *av[])
             }
         }
 
-	Printf("%s\r\n", p);
+	list_line(p);
     }
     QIOclose(qp);
 
-    Printf(".\r\n");
+    SendIOb(".\r\n", 3);
+    PushIOb();
 }
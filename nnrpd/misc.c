@@ -10,6 +10,7 @@
 # include <sys/select.h>
 #endif
 
+#include "inn/activemap.h"
 #include "inn/innconf.h"
 #include "nnrpd.h"
 #include "tls.h"
@@ -25,6 +26,87 @@ extern bool encryption_layer_on;
 #endif /* HAVE_OPENSSL */ 
 
 
+/*
+**  Answers of PERMgroupok, as two bitmaps indexed by the slots of the table
+**  of newsgroups published by innd: whether the answer is known, and whether
+**  the newsgroup can be read.  Only valid for the generation of the table
+**  they were made for.
+*/
+static unsigned char	*PERMknownbits = NULL;
+static unsigned char	*PERMreadbits = NULL;
+static unsigned long	PERMbitsgeneration = 0;
+
+#define BIT_TEST(bits, i)	(((bits)[(i) / 8] & (1 << ((i) % 8))) != 0)
+#define BIT_SET(bits, i)	((bits)[(i) / 8] |= (1 << ((i) % 8)))
+
+
+/*
+**  Compile PERMreadlist and PERMpostlist for PERMmatch.  Must be called each
+**  time one of them is changed.
+*/
+void
+PERMcompile(void)
+{
+    uwildmat_free(PERMreadwildmat);
+    uwildmat_free(PERMpostwildmat);
+    PERMreadwildmat = PERMpostwildmat = NULL;
+    if (PERMreadlist != NULL)
+	PERMreadwildmat = uwildmat_compile_list(PERMreadlist, false);
+    if (PERMpostlist != NULL)
+	PERMpostwildmat = uwildmat_compile_list(PERMpostlist, false);
+
+    /* Forget the answers for the previous read list. */
+    free(PERMknownbits);
+    free(PERMreadbits);
+    PERMknownbits = PERMreadbits = NULL;
+    PERMbitsgeneration = 0;
+}
+
+
+/*
+**  Return whether PERMreadlist allows reading a newsgroup.  The answer for
+**  each newsgroup of the table published by innd is remembered for the
+**  session, so that commands going through all the newsgroups, like LIST
+**  ACTIVE, only match each of them against the read list once.
+*/
+bool
+PERMgroupok(char *group)
+{
+    struct activemap	*map;
+    unsigned long	generation, slots;
+    char		*grplist[2];
+    long		slot;
+    bool		ok;
+
+    grplist[0] = group;
+    grplist[1] = NULL;
+    map = GRPmap();
+    if (map == NULL || PERMreadlist == NULL || PERMreadlist[0] == NULL)
+	return PERMmatch(PERMreadlist, grplist);
+    generation = activemap_refresh(map);
+    if (generation == 0)
+	return PERMmatch(PERMreadlist, grplist);
+    if (generation != PERMbitsgeneration) {
+	slots = activemap_slots(map);
+	free(PERMknownbits);
+	free(PERMreadbits);
+	PERMknownbits = xcalloc((slots + 7) / 8, 1);
+	PERMreadbits = xcalloc((slots + 7) / 8, 1);
+	PERMbitsgeneration = generation;
+    }
+    slot = activemap_find(map, group);
+    if (slot < 0)
+	return PERMmatch(PERMreadlist, grplist);
+    if (BIT_TEST(PERMknownbits, slot))
+	return BIT_TEST(PERMreadbits, slot);
+    ok = PERMmatch(PERMreadlist, grplist);
+    BIT_SET(PERMknownbits, slot);
+    if (ok)
+	BIT_SET(PERMreadbits, slot);
+    return ok;
+}
+
+
 /*
 **  Match a list of newsgroup specifiers against a list of newsgroups.
 **  func is called to see if there is a match.
@@ -35,10 +117,23 @@ PERMmatch(char **Pats, char **list)
     int	                i;
     char	        *p;
     int                 match = false;
+    struct wildmat	*wildmat = NULL;
 
     if (Pats == NULL || Pats[0] == NULL)
 	return true;
 
+    /* Use the compiled form of the lists of the user. */
+    if (Pats == PERMreadlist)
+	wildmat = PERMreadwildmat;
+    else if (Pats == PERMpostlist)
+	wildmat = PERMpostwildmat;
+    if (wildmat != NULL) {
+	for ( ; *list; list++)
+	    if (uwildmat_match(wildmat, *list) == UWILDMAT_MATCH)
+		return true;
+	return false;
+    }
+
     for ( ; *list; list++) {
 	for (i = 0; (p = Pats[i]) != NULL; i++) {
 	    if (p[0] == '!') {
@@ -58,45 +153,12 @@ PERMmatch(char **Pats, char **list)
 
 
 /*
-**  Check to see if user is allowed to see this article by matching
-**  Xref: (or Newsgroups:) line.
+**  Check to see if user is allowed to see an article in the given list of
+**  newsgroups.  p is what is handed to the Python dynamic access hook.
 */
-bool
-PERMartok(void)
+static bool
+PERMlistok(char **grplist, char *p UNUSED)
 {
-    static char		**grplist;
-    char		*p, **grp;
-
-    if (!PERMspecified)
-	return false;
-
-    if ((p = GetHeader("Xref", true)) == NULL) {
-	/* In case article does not include Xref:. */
-	if ((p = GetHeader("Newsgroups", true)) != NULL) {
-	    if (!NGgetlist(&grplist, p))
-		/* No newgroups or null entry. */
-		return true;
-	} else {
-	    return true;
-	}
-    } else {
-	/* Skip path element. */
-	if ((p = strchr(p, ' ')) == NULL)
-	    return true;
-	for (p++ ; *p == ' ' ; p++);
-	if (*p == '\0')
-	    return true;
-	if (!NGgetlist(&grplist, p))
-	    /* No newgroups or null entry. */
-	    return true;
-	/* Chop ':' and article number. */
-	for (grp = grplist ; *grp != NULL ; grp++) {
-	    if ((p = strchr(*grp, ':')) == NULL)
-		return true;
-	    *p = '\0';
-	}
-    }
-
 #ifdef DO_PYTHON
     if (PY_use_dynamic) {
         char    *reply;
@@ -119,6 +181,64 @@ PERMartok(void)
 }
 
 
+/*
+**  Check to see if user is allowed to see an article given the value of its
+**  Xref: header field, which is modified.
+*/
+bool
+PERMxrefok(char *xref)
+{
+    static char		**grplist;
+    char		*p, **grp;
+
+    if (!PERMspecified)
+	return false;
+
+    /* Skip path element. */
+    if ((p = strchr(xref, ' ')) == NULL)
+	return true;
+    for (p++ ; *p == ' ' ; p++);
+    if (*p == '\0')
+	return true;
+    if (!NGgetlist(&grplist, p))
+	/* No newgroups or null entry. */
+	return true;
+    /* Chop ':' and article number. */
+    for (grp = grplist ; *grp != NULL ; grp++) {
+	if ((p = strchr(*grp, ':')) == NULL)
+	    return true;
+	*p = '\0';
+    }
+    return PERMlistok(grplist, p);
+}
+
+
+/*
+**  Check to see if user is allowed to see this article by matching
+**  Xref: (or Newsgroups:) line.
+*/
+bool
+PERMartok(void)
+{
+    static char		**grplist;
+    char		*p;
+
+    if (!PERMspecified)
+	return false;
+
+    if ((p = GetHeader("Xref", true)) != NULL)
+	return PERMxrefok(p);
+
+    /* In case article does not include Xref:. */
+    if ((p = GetHeader("Newsgroups", true)) == NULL)
+	return true;
+    if (!NGgetlist(&grplist, p))
+	/* No newgroups or null entry. */
+	return true;
+    return PERMlistok(grplist, p);
+}
+
+
 /*
 **  Parse a newsgroups line, return true if there were any.
 */
@@ -212,6 +212,62 @@ process_newnews(char *group, bool AllGroups, time_t date)
     }
 }
 
+/*
+**  Answer NEWNEWS from the log of arrivals kept when newnewsindexhours is
+**  set, listing each article once, for the first of its newsgroups that
+**  the client may read and asked for.  Returns false without replying if the
+**  log doesn't go back to date, in which case overview has to be searched.
+*/
+static bool
+process_arrivals(bool AllGroups, time_t date)
+{
+    void *handle;
+    OVARRIVAL arrival;
+    char *group, *p;
+    char *list[2];
+    bool found;
+    time_t now;
+    unsigned long artcount = 0;
+
+    time(&now);
+    if (innconf->nfsreader && date >= (time_t) innconf->nfsreaderdelay)
+        date -= innconf->nfsreaderdelay;
+    handle = OVopenarrivals(date);
+    if (handle == NULL)
+        return false;
+
+    Reply("%d New news follows\r\n", NNTP_OK_NEWNEWS);
+    list[1] = NULL;
+    while (OVarrival(handle, &arrival)) {
+        if (innconf->nfsreader != 0
+            && (time_t) (arrival.arrived + innconf->nfsreaderdelay) > now)
+            continue;
+        found = false;
+        for (group = arrival.groups; group != NULL && !found; group = p) {
+            p = strchr(group, ' ');
+            if (p != NULL)
+                *p++ = '\0';
+            if (strchr(group, ':') == NULL)
+                continue;
+            *strchr(group, ':') = '\0';
+            list[0] = group;
+            found = (AllGroups || PERMmatch(groups, list))
+                    && (!PERMspecified || PERMmatch(PERMreadlist, list));
+        }
+        if (!found)
+            continue;
+        if (PERMaccessconf->nnrpdcheckart && !ARTinstorebytoken(arrival.token))
+            continue;
+
+        ++artcount;
+        cache_add(HashMessageID(arrival.msgid), arrival.token);
+        Printf("%s\r\n", arrival.msgid);
+    }
+    OVclosearrivals(handle);
+    notice("%s newnews arrivals %lu", Client.host, artcount);
+    return true;
+}
+
 /*
 **  NEWNEWS wildmat date time [GMT]
 **  Return the message-ID of any articles after the specified date.
@@ -290,6 +346,13 @@ CMDnewnews(int ac, char *av[])
       innconf->nicenewnews = 0;
   }
 
+  /* The log of arrivals lists the articles of all newsgroups at once. */
+  if (process_arrivals(AllGroups, date)) {
+      Printf(".\r\n");
+      TMRstop(TMR_NEWNEWS);
+      return;
+  }
+
   if (strcspn(av[1], "\\!*[?]") == strlen(av[1])) {
       /* Optimise case -- don't need to scan the active file pattern
        * matching. */
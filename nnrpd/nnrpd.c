@@ -21,7 +21,10 @@
 #endif
 #include <sys/wait.h>
 
+#include "inn/buffer.h"
+#include "inn/histogram.h"
 #include "inn/innconf.h"
+#include "inn/latencytable.h"
 #include "inn/libinn.h"
 #include "inn/messages.h"
 #include "inn/network.h"
@@ -205,6 +208,133 @@ static const char *const timer_name[] = {
 };
 
 
+/* How many access groups the table shared by all the processes holds. */
+#define CMD_STATS_SLOTS 256
+
+/*
+**  What nnrpdcommandstats measured of each command, by its index in
+**  CMDtable, since the last time it was logged, and the access group it was
+**  measured for.
+*/
+static struct histogram *CMDlatency[ARRAY_SIZE(CMDtable)];
+static unsigned long CMDbytes[ARRAY_SIZE(CMDtable)];
+static char *CMDaccess = NULL;
+
+
+/*
+**  Log what was measured of each command, to syslog and to the local
+**  tracking log if there is one, and add it to the table shared by all the
+**  nnrpd processes.  Then start anew.
+*/
+static void
+CMDstatsflush(void)
+{
+    static struct latency_table *table = NULL;
+    static bool tried = false;
+    const char *ops[ARRAY_SIZE(CMDtable) - 1];
+    struct buffer *summary;
+    char *path;
+    size_t i;
+
+    if (CMDaccess == NULL)
+        return;
+    if (!tried) {
+        tried = true;
+        for (i = 0; i < ARRAY_SIZE(ops); i++)
+            ops[i] = CMDtable[i].Name;
+        path = concatpath(innconf->pathrun, INN_PATH_NNRPDSTATS);
+        table = latency_table_open(path, CMD_STATS_SLOTS, ops,
+                                   ARRAY_SIZE(ops));
+        free(path);
+    }
+    summary = buffer_new();
+    for (i = 0; i < ARRAY_SIZE(CMDtable); i++) {
+        if (CMDlatency[i] == NULL || histogram_count(CMDlatency[i]) == 0)
+            continue;
+        buffer_set(summary, NULL, 0);
+        histogram_summary(CMDlatency[i], summary);
+        buffer_append(summary, "", 1);
+        syslog(L_NOTICE, "%s cmdstats %s %s bytes %lu %s", Client.host,
+               CMDaccess, CMDtable[i].Name, CMDbytes[i], summary->data);
+        if (LLOGenable)
+            fprintf(locallog, "%s cmdstats %s %s bytes %lu %s\n",
+                    Client.host, CMDaccess, CMDtable[i].Name, CMDbytes[i],
+                    summary->data);
+        if (table != NULL)
+            latency_table_add(table, CMDaccess, i, CMDlatency[i],
+                              CMDbytes[i]);
+        histogram_reset(CMDlatency[i]);
+        CMDbytes[i] = 0;
+    }
+    buffer_free(summary);
+    free(CMDaccess);
+    CMDaccess = NULL;
+}
+
+
+/*
+**  Run a command, measuring how long it takes and how many bytes it sends
+**  if nnrpdcommandstats is set.  What was measured for another access group
+**  is logged first.
+*/
+static void
+CMDrun(CMDENT *cp, int ac, char *av[])
+{
+    struct timeval start;
+    unsigned long sent;
+    const char *group;
+    size_t i;
+
+    if (!innconf->nnrpdcommandstats) {
+        (*cp->Function)(ac, av);
+        return;
+    }
+    group = (PERMaccessconf != NULL && PERMaccessconf->name != NULL)
+        ? PERMaccessconf->name : "none";
+    if (CMDaccess != NULL && strcmp(CMDaccess, group) != 0)
+        CMDstatsflush();
+    if (CMDaccess == NULL)
+        CMDaccess = xstrdup(group);
+    i = cp - CMDtable;
+    if (CMDlatency[i] == NULL)
+        CMDlatency[i] = histogram_new();
+    sent = NNTPsent;
+    gettimeofday(&start, NULL);
+    (*cp->Function)(ac, av);
+    histogram_record_since(CMDlatency[i], &start);
+    CMDbytes[i] += NNTPsent - sent;
+}
+
+
+/*
+**  Log the latencies of the storage and overview methods during this
+**  session, one line per method and operation, and those of the timers if
+**  they are enabled, to syslog and to the local tracking log if there is
+**  one.
+*/
+static void
+LogLatency(void)
+{
+    struct buffer *latency;
+    char *line, *end;
+
+    latency = buffer_new();
+    SMlatency(latency, false);
+    OVlatency(latency, false);
+    if (innconf->timer != 0)
+        TMRstats(latency, "timer", timer_name, false);
+    buffer_append(latency, "", 1);
+    for (line = latency->data; (end = strchr(line, '\n')) != NULL;
+         line = end + 1) {
+        *end = '\0';
+        syslog(L_NOTICE, "%s latency %s", Client.host, line);
+        if (LLOGenable)
+            fprintf(locallog, "%s latency %s\n", Client.host, line);
+    }
+    buffer_free(latency);
+}
+
+
 /*
 **  Log a summary status message and exit.
 */
@@ -216,6 +346,7 @@ ExitWithStats(int x, bool readconf)
 
     line_free(&NNTPline);
     fflush(stdout);
+    ARTpostclose();
     STATfinish = TMRnow_double();
     if (GetResourceUsage(&usertime, &systime) < 0) {
 	usertime = 0;
@@ -231,6 +362,9 @@ ExitWithStats(int x, bool readconf)
 	   Client.host, POSTreceived, POSTrejected);
     syslog(L_NOTICE, "%s times user %.3f system %.3f idle %.3f elapsed %.3f",
 	Client.host, usertime, systime, IDLEtime, STATfinish - STATstart);
+    if (!readconf && PERMaccessconf && PERMaccessconf->nnrpdoverstats)
+        LogLatency();
+    CMDstatsflush();
     /* Tracking code - Make entries in the logfile(s) to show that we have
      * finished with this session. */
     if (!readconf && PERMaccessconf && PERMaccessconf->readertrack) {
@@ -466,7 +600,7 @@ CMDcapabilities(int ac, char *av[])
     }
 
     if (PERMcanread) {
-        Printf("OVER\r\n");
+        Printf("OVER MSGID\r\n");
     }
 
     if (PERMcanpost) {
@@ -682,6 +816,7 @@ write_buffer(const char *buff, ssize_t len)
 
     TMRstart(TMR_NNTPWRITE);
     p = buff;
+    NNTPsent += len;
 
 #if defined(HAVE_ZLIB)
     if (compression_layer_on) {
@@ -901,33 +1036,52 @@ WaitChild(int s NO_SIGACTION_UNUSED)
 }
 
 
-static void
-SetupDaemon(void)
+/*
+**  Open the storage and overview methods.  Returns false, after logging the
+**  reason, if one of them could not be opened; it may then be called again.
+*/
+static bool SpoolOpen = false;
+
+static bool
+OpenSpool(void)
 {
     bool                val;
 
+    if (SpoolOpen)
+        return true;
     val = true;
     if (SMsetup(SM_PREOPEN, (void *)&val) && !SMinit()) {
 	syslog(L_NOTICE, "can't initialize storage method, %s", SMerrorstr);
-	Reply("%d NNTP server unavailable.  Try later!\r\n", NNTP_FAIL_TERMINATING);
-	ExitWithStats(1, true);
+	return false;
     }
-    OVextra = overview_extra_fields(false);
     if (OVextra == NULL) {
-	/* overview_extra_fields() should already have logged something
-	 * useful. */
-	Reply("%d NNTP server unavailable.  Try later!\r\n", NNTP_FAIL_TERMINATING);
-	ExitWithStats(1, true);
+        OVextra = overview_extra_fields(false);
+        if (OVextra == NULL) {
+            /* overview_extra_fields() should already have logged something
+             * useful. */
+            return false;
+        }
+        overhdr_xref = overview_index("Xref", OVextra);
     }
-    overhdr_xref = overview_index("Xref", OVextra);
     if (!OVopen(OV_READ)) {
 	/* This shouldn't really happen. */
 	syslog(L_NOTICE, "can't open overview %m");
-	Reply("%d NNTP server unavailable.  Try later!\r\n", NNTP_FAIL_TERMINATING);
-	ExitWithStats(1, true);
+	return false;
     }
     if (!OVctl(OVCACHEKEEP, &val)) {
 	syslog(L_NOTICE, "can't enable overview cache %m");
+	OVclose();
+	return false;
+    }
+    SpoolOpen = true;
+    return true;
+}
+
+
+static void
+SetupDaemon(void)
+{
+    if (!OpenSpool()) {
 	Reply("%d NNTP server unavailable.  Try later!\r\n", NNTP_FAIL_TERMINATING);
 	ExitWithStats(1, true);
     }
@@ -977,6 +1131,7 @@ main(int argc, char *argv[])
     int			clienttimeout;
     char		*ConfFile = NULL;
     char                *path;
+    char                *cpus;
     bool                validcommandtoolong;
 
     int respawn = 0;
@@ -989,6 +1144,7 @@ main(int argc, char *argv[])
     LLOGenable = false;
     GRPcur = NULL;
     MaxBytesPerSecond = 0;
+    MaxTotalRate = 0;
     strlcpy(Username, "unknown", sizeof(Username));
 
     /* Set up the pathname, first thing, and teach our error handlers about
@@ -1092,6 +1248,17 @@ main(int argc, char *argv[])
     if (innconf->nicennrpd != 0)
 	nice(innconf->nicennrpd);
 
+    /* Run on the processors we are given, and report them once when running
+     * as a daemon, since the children inherit them. */
+    if (innconf->nnrpdcpus != NULL) {
+        if (!inn_setaffinity(innconf->nnrpdcpus))
+            syswarn("cannot run on processors %s", innconf->nnrpdcpus);
+        else if (DaemonMode && (cpus = inn_getaffinity()) != NULL) {
+            notice("running on processors %s", cpus);
+            free(cpus);
+        }
+    }
+
     HISTORY = concatpath(innconf->pathdb, INN_PATH_HISTORY);
     ACTIVE = concatpath(innconf->pathdb, INN_PATH_ACTIVE);
     ACTIVETIMES = concatpath(innconf->pathdb, INN_PATH_ACTIVETIMES);
@@ -1211,6 +1378,11 @@ main(int argc, char *argv[])
 		    --respawn;
 		    pid = fork();
 		    if (pid == 0) {
+			/* Get ready for the client while nobody waits.  If
+			 * this fails, it is tried again once connected. */
+			setproctitle("opening spool");
+			OpenSpool();
+			setproctitle("accepting connections");
 			do {
                             fd = -1;
 
@@ -1601,7 +1773,7 @@ main(int argc, char *argv[])
 	}
 	setproctitle("%s %s", Client.host, av[0]);
 
-        (*cp->Function)(ac, av);
+        CMDrun(cp, ac, av);
 
         if (PushedBack)
 	    break;
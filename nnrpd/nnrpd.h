@@ -90,8 +90,20 @@ typedef struct _ACCESSGROUP {
     int virtualhost;
     char *newsmaster;
     long maxbytespersecond;
+    long maxtotalrate;
+    int compressmemory;
 } ACCESSGROUP;
 
+/*
+**  How much memory the compressor of a COMPRESS layer may use.
+*/
+typedef enum _COMPRESSMEM {
+    CMlow,
+    CMmedium,
+    CMhigh
+} COMPRESSMEM;
+
+
 /*
 **  What line_read returns.
 */
@@ -175,6 +187,8 @@ EXTERN bool 	Offlinepost;
 EXTERN bool 	initialSSL;
 EXTERN char	**PERMreadlist;
 EXTERN char	**PERMpostlist;
+EXTERN struct wildmat *PERMreadwildmat;	/* PERMreadlist, compiled */
+EXTERN struct wildmat *PERMpostwildmat;	/* PERMpostlist, compiled */
 EXTERN struct client Client;
 EXTERN char	Username[SMBUF];
 extern char	*ACTIVETIMES;
@@ -189,6 +203,7 @@ EXTERN ARTNUM	ARThigh;	/* Current high number for group. */
 EXTERN ARTNUM	ARTlow;		/* Current low number for group. */
 EXTERN unsigned long	ARTcount;	/* Number of articles in group. */
 EXTERN long	MaxBytesPerSecond; /* Maximum bytes per sec a client can use, defaults to 0. */
+EXTERN long	MaxTotalRate;	/* Same for all the clients of its access group. */
 EXTERN long	ARTget;
 EXTERN long	ARTgettime;
 EXTERN long	ARTgetsize;
@@ -207,6 +222,7 @@ EXTERN long	GRPcount;
 EXTERN char	*GRPcur;
 EXTERN long	POSTreceived;
 EXTERN long	POSTrejected;
+EXTERN unsigned long	NNTPsent;	/* Bytes sent to the client. */
 
 EXTERN bool     BACKOFFenabled;
 EXTERN char	*VirtualPath;
@@ -218,6 +234,7 @@ EXTERN int	overhdr_xref;
 EXTERN bool     LLOGenable;
 
 extern const char	*ARTpost(char *article, char *idbuff, bool *permanent);
+extern void		ARTpostclose(void);
 extern void		ARTclose(void);
 extern int		TrimSpaces(char *line);
 extern void		InitBackoffConstants(void);
@@ -228,14 +245,24 @@ extern int		RateLimit(long *sleeptime, char *path);
 extern void		ExitWithStats(int x, bool readconf)
     __attribute__ ((__noreturn__));
 extern char		*GetHeader(const char *header, bool stripspaces);
+extern struct activemap	*GRPmap(void);
 extern void		GRPreport(void);
+extern bool		GRPstats(char *group, int *lo, int *hi, int *count,
+				 int *flag);
 extern bool		NGgetlist(char ***argvp, char *list);
 extern bool		PERMartok(void);
+extern bool		PERMxrefok(char *xref);
 extern void             PERMgetinitialaccess(char *readersconf);
 extern void             PERMgetaccess(bool initialconnection);
 extern void		PERMgetpermissions(void);
 extern void		PERMlogin(char *uname, char *pass, int* code, char *errorstr);
 extern bool		PERMmatch(char **Pats, char **list);
+extern bool		PERMgroupok(char *group);
+extern void		PushIOb(void);
+extern void		PushIOv(void);
+extern void		SendIOb(const char *p, int len);
+extern void		SendIOv(const char *p, int len);
+extern void		PERMcompile(void);
 extern bool		ParseDistlist(char ***argvp, char *list);
 extern void 		SetDefaultAccess(ACCESSGROUP*);
 extern void		Reply(const char *fmt, ...)
@@ -161,11 +161,13 @@ extern bool PerlLoaded;
 #define PERMperl_access         59
 #define PERMpython_access       60
 #define PERMpython_dynamic      61
+#define PERMcompress_memory     62
+#define PERMmaxtotalrate        63
 #if defined(HAVE_OPENSSL) || defined(HAVE_SASL)
-#define PERMrequire_ssl         62
-#define PERMMAX                 63
+#define PERMrequire_ssl         64
+#define PERMMAX                 65
 #else
-#define PERMMAX			62
+#define PERMMAX			64
 #endif
 
 #define TEST_CONFIG(a, b) \
@@ -251,6 +253,8 @@ static CONFTOKEN PERMtoks[] = {
     { PERMperl_access,          (char *) "perl_access:"         },
     { PERMpython_access,        (char *) "python_access:"       },
     { PERMpython_dynamic,       (char *) "python_dynamic:"      },
+    { PERMcompress_memory,      (char *) "compress_memory:"     },
+    { PERMmaxtotalrate,         (char *) "max_total_rate:"      },
 #if defined(HAVE_OPENSSL) || defined(HAVE_SASL)
     { PERMrequire_ssl,          (char *) "require_ssl:"         },
 #endif
@@ -512,6 +516,8 @@ SetDefaultAccess(ACCESSGROUP *curaccess)
     curaccess->virtualhost = false;
     curaccess->newsmaster = NULL;
     curaccess->maxbytespersecond = 0;
+    curaccess->maxtotalrate = 0;
+    curaccess->compressmemory = CMhigh;
 }
 
 static void
@@ -1062,6 +1068,24 @@ accessdecl_parse(ACCESSGROUP *curaccess, CONFFILE *f, CONFTOKEN *tok)
 	curaccess->maxbytespersecond = atol(tok->name);
 	SET_CONFIG(oldtype);
 	break;
+      case PERMmaxtotalrate:
+	curaccess->maxtotalrate = atol(tok->name);
+	SET_CONFIG(oldtype);
+	break;
+      case PERMcompress_memory:
+	if (strcasecmp(tok->name, "low") == 0)
+	    curaccess->compressmemory = CMlow;
+	else if (strcasecmp(tok->name, "medium") == 0)
+	    curaccess->compressmemory = CMmedium;
+	else if (strcasecmp(tok->name, "high") == 0)
+	    curaccess->compressmemory = CMhigh;
+	else {
+	    snprintf(buff, sizeof(buff),
+		     "Unknown value '%s' for compress_memory.", tok->name);
+	    ReportError(f, buff);
+	}
+	SET_CONFIG(oldtype);
+	break;
       default:
 	snprintf(buff, sizeof(buff), "Unexpected token '%s'.", tok->name);
 	ReportError(f, buff);
@@ -1773,8 +1797,10 @@ PERMgetpermissions(void)
 	    syslog(L_TRACE, "%s no_post %s", Client.host, access_realms[i]->name);
 	    PERMcanpost = false;
 	}
+	PERMcompile();
 	PERMaccessconf = access_realms[i];
 	MaxBytesPerSecond = PERMaccessconf->maxbytespersecond;
+	MaxTotalRate = PERMaccessconf->maxtotalrate;
 	if (PERMaccessconf->virtualhost) {
 	    if (PERMaccessconf->domain == NULL) {
 		syslog(L_ERROR, "%s virtualhost needs domain parameter (%s).",
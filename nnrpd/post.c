@@ -19,6 +19,10 @@ char	**OtherHeaders;
 size_t	        OtherCount;
 bool   HeadersModified;
 static size_t   OtherSize;
+static FILE     *PostFromServer;
+static FILE     *PostToServer;
+static char     *PostHost;
+static unsigned long PostPort;
 static const char * const BadDistribs[] = {
     BAD_DISTRIBS
 };
@@ -928,6 +932,119 @@ SendQuit(FILE *FromServer, FILE *ToServer)
 }
 
 
+/*
+**  Close the connection to the server articles are posted to, without a
+**  QUIT if something went wrong with it.
+*/
+static void
+PostDrop(bool quit)
+{
+    if (PostToServer == NULL)
+        return;
+    if (quit)
+        SendQuit(PostFromServer, PostToServer);
+    else {
+        fclose(PostFromServer);
+        fclose(PostToServer);
+    }
+    PostFromServer = NULL;
+    PostToServer = NULL;
+}
+
+
+/*
+**  Close the connection to the server at the end of the session.
+*/
+void
+ARTpostclose(void)
+{
+    PostDrop(true);
+    free(PostHost);
+    PostHost = NULL;
+}
+
+
+/*
+**  Whether the connection kept open since the last post can be used for
+**  this one:  it must go to the server this post goes to, and the server
+**  must not have said anything since, which would be that it is closing
+**  the connection.
+*/
+static bool
+PostReusable(void)
+{
+    fd_set readset;
+    struct timeval tv;
+    int fd;
+
+    if (PostToServer == NULL)
+        return false;
+    if ((PERMaccessconf->nnrpdposthost == NULL) != (PostHost == NULL)
+        || (PostHost != NULL
+            && (strcmp(PostHost, PERMaccessconf->nnrpdposthost) != 0
+                || PostPort != PERMaccessconf->nnrpdpostport))) {
+        PostDrop(true);
+        return false;
+    }
+    fd = fileno(PostFromServer);
+    FD_ZERO(&readset);
+    FD_SET(fd, &readset);
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    if (select(fd + 1, &readset, NULL, NULL, &tv) != 0) {
+        PostDrop(false);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+**  Open a connection to the server this post goes to, putting its greeting
+**  in buff.  Returns -1 on failure, with the reason in Error.
+*/
+static int
+PostConnect(char *buff, size_t buffsize)
+{
+    int i;
+
+    if (PERMaccessconf->nnrpdposthost != NULL)
+	i = NNTPconnect(PERMaccessconf->nnrpdposthost,
+                        PERMaccessconf->nnrpdpostport, &PostFromServer,
+                        &PostToServer, buff, buffsize);
+    else {
+#if	defined(HAVE_UNIX_DOMAIN_SOCKETS)
+	i = NNTPlocalopen(&PostFromServer, &PostToServer, buff, buffsize);
+#else
+	i = NNTPremoteopen(innconf->port, &PostFromServer, &PostToServer, buff,
+                           buffsize);
+#endif	/* defined(HAVE_UNIX_DOMAIN_SOCKETS) */
+    }
+    if (i < 0) {
+        PostFromServer = NULL;
+        PostToServer = NULL;
+	if (buff[0])
+	    strlcpy(Error, buff, sizeof(Error));
+        else {
+            snprintf(Error, sizeof(Error),
+                     "Can't send connect request to server, %s",
+                     strerror(errno));
+        }
+        return i;
+    }
+    free(PostHost);
+    PostHost = NULL;
+    if (PERMaccessconf->nnrpdposthost != NULL)
+        PostHost = xstrdup(PERMaccessconf->nnrpdposthost);
+    PostPort = PERMaccessconf->nnrpdpostport;
+
+    if (Tracing)
+	syslog(L_TRACE, "%s post_connect %s",
+	    Client.host, PERMaccessconf->nnrpdposthost ? PERMaccessconf->nnrpdposthost : "localhost");
+    return i;
+}
+
+
 /*
 **  Offer the article to the server, return its reply.
 */
@@ -1100,6 +1217,7 @@ ARTpost(char *article, char *idbuff, bool *permanent)
     HEADER	*hp;
     FILE	*ToServer;
     FILE	*FromServer;
+    bool	reused;
     char	buff[NNTP_MAXLEN_COMMAND + 2], frombuf[SMBUF];
     char	*modgroup = NULL;
     const char	*error;
@@ -1276,55 +1394,45 @@ ARTpost(char *article, char *idbuff, bool *permanent)
     if (Offlinepost)
          return Spoolit(article,Error);
 
-    /* Open a local connection to the server. */
-    if (PERMaccessconf->nnrpdposthost != NULL)
-	i = NNTPconnect(PERMaccessconf->nnrpdposthost,
-                        PERMaccessconf->nnrpdpostport, &FromServer,
-                        &ToServer, buff, sizeof(buff));
-    else {
-#if	defined(HAVE_UNIX_DOMAIN_SOCKETS)
-	i = NNTPlocalopen(&FromServer, &ToServer, buff, sizeof(buff));
-#else
-	i = NNTPremoteopen(innconf->port, &FromServer, &ToServer, buff,
-                           sizeof(buff));
-#endif	/* defined(HAVE_UNIX_DOMAIN_SOCKETS) */
-    }
-
-    /* If we cannot open the connection, initialize the error message and
+    /* Use the connection to the server kept open since the last post if
+     * possible, or open a new one.  If we cannot open the connection,
      * attempt to recover from this by spooling it locally. */
-    if (i < 0) {
-	if (buff[0])
-	    strlcpy(Error, buff, sizeof(Error));
-        else {
-            snprintf(Error, sizeof(Error),
-                     "Can't send connect request to server, %s",
-                     strerror(errno));
-        }
-        return Spoolit(article,Error);
-    }
-
-    if (Tracing)
-	syslog(L_TRACE, "%s post_connect %s",
-	    Client.host, PERMaccessconf->nnrpdposthost ? PERMaccessconf->nnrpdposthost : "localhost");
+    reused = PostReusable();
+    if (!reused && PostConnect(buff, sizeof(buff)) < 0)
+        return Spoolit(article, Error);
+    FromServer = PostFromServer;
+    ToServer = PostToServer;
 
     /* The code below ignores too many return values for my tastes.  At least
      * they are all inside cases that are most likely never going to happen --
      * for example, if the server crashes. */
 
-    /* Offer article to server. */
+    /* Offer article to server.  A connection kept open may have been closed
+     * by the server in the meantime, in which case a new one is tried. */
     i = OfferArticle(buff, (int)sizeof buff, FromServer, ToServer);
+    if (reused && (i < 0 || i == NNTP_FAIL_TERMINATING)) {
+        PostDrop(false);
+        if (PostConnect(buff, sizeof(buff)) < 0)
+            return Spoolit(article, Error);
+        FromServer = PostFromServer;
+        ToServer = PostToServer;
+        i = OfferArticle(buff, (int)sizeof buff, FromServer, ToServer);
+    }
     if (i == NNTP_FAIL_AUTH_NEEDED) {
         /* Send authorization. */
         if (NNTPsendpassword(PERMaccessconf->nnrpdposthost, FromServer, ToServer) < 0) {
             snprintf(Error, sizeof(Error), "Can't authorize with %s",
                      PERMaccessconf->nnrpdposthost ? PERMaccessconf->nnrpdposthost : "innd");
+            PostDrop(true);
             return Spoolit(article,Error);
         }
         i = OfferArticle(buff, (int)sizeof buff, FromServer, ToServer);
     }
     if (i != NNTP_CONT_IHAVE) {
         strlcpy(Error, buff, sizeof(Error));
-        SendQuit(FromServer, ToServer);
+        /* The connection can be used again after a refusal. */
+        if (i != NNTP_FAIL_IHAVE_REFUSE && i != NNTP_FAIL_IHAVE_DEFER)
+            PostDrop(i >= 0);
 	if (i == NNTP_FAIL_IHAVE_REJECT || i == NNTP_FAIL_IHAVE_DEFER) {
 	    *permanent = false;
 	}
@@ -1373,8 +1481,7 @@ ARTpost(char *article, char *idbuff, bool *permanent)
     if (FLUSH_ERROR(ToServer)) {
         snprintf(Error, sizeof(Error), "Can't send headers to server, %s",
                  strerror(errno));
-	fclose(FromServer);
-	fclose(ToServer);
+	PostDrop(false);
 	return Spoolit(article, Error);
     }
 
@@ -1383,15 +1490,16 @@ ARTpost(char *article, char *idbuff, bool *permanent)
      || fgets(buff, sizeof buff, FromServer) == NULL) {
         snprintf(Error, sizeof(Error), "Can't send article to server, %s",
                  strerror(errno));
-	fclose(FromServer);
-	fclose(ToServer);
+	PostDrop(false);
 	return Spoolit(article, Error);
     }
 
-    /* Did the server want the article? */
+    /* Did the server want the article?  The connection is kept for the
+     * next post unless the server is going away. */
     if ((i = atoi(buff)) != NNTP_OK_IHAVE) {
 	strlcpy(Error, buff, sizeof(Error));
-	SendQuit(FromServer, ToServer);
+	if (i != NNTP_FAIL_IHAVE_REJECT && i != NNTP_FAIL_IHAVE_DEFER)
+	    PostDrop(true);
 	syslog(L_TRACE, "%s server rejects %s from %s", Client.host, HDR(HDR__MESSAGEID), HDR(HDR__PATH));
 	if (i != NNTP_FAIL_IHAVE_REJECT && i != NNTP_FAIL_IHAVE_REFUSE)
 	    return Spoolit(article, Error);
@@ -1401,9 +1509,6 @@ ARTpost(char *article, char *idbuff, bool *permanent)
 	return Error;
     }
 
-    /* Send a quit and close down. */
-    SendQuit(FromServer, ToServer);
-
     /* Tracking. */
     if (PERMaccessconf->readertrack) {
         TrackID = concat(innconf->pathlog, "/trackposts/track.",
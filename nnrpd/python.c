@@ -106,6 +106,9 @@ static const void *file_key(const void *p);
 static bool file_equal(const void *k, const void *p);
 static void file_free(void *p);
 static void file_trav(void *data, void* null);
+static const void *verdict_key(const void *p);
+static bool verdict_equal(const void *k, const void *p);
+static void verdict_free(void *p);
 
 bool PythonLoaded = false;
 
@@ -122,6 +125,18 @@ struct hash *files;
 /*  For passing the dynamic module filename from perm.c. */
 char* dynamic_file;
 
+/*  Answers of the dynamic method, keyed by the type of access and the
+    newsgroup, and only valid for the user they were given for.  They are
+    kept for the session, unless the method asked for a shorter time. */
+typedef struct PyVerdict {
+    char        *key;           /* "read:group" or "post:group". */
+    char        *refusal;       /* NULL if access is granted. */
+    time_t      expires;        /* 0 for the whole session. */
+} PyVerdict;
+
+static struct hash *verdicts = NULL;
+static char *verdicts_user = NULL;
+
 
 
 /*
@@ -415,11 +430,14 @@ PY_dynamic_init (char* file)
 int
 PY_dynamic(char *User, char *NewsGroup, int PostFlag, char **reply_message)
 {
-    PyObject	*result, *proc;
+    PyObject	*result, *proc, *value;
     char        *string;
     const char  *temp;
     int		authnum;
     int		i;
+    long        ttl;
+    char        *key;
+    PyVerdict   *verdict;
 
     PY_load_python();
     proc = PY_setup(PYTHONdynamic, PYTHONmain, dynamic_file);
@@ -428,6 +446,30 @@ PY_dynamic(char *User, char *NewsGroup, int PostFlag, char **reply_message)
     if (proc == NULL)
         return -1;
 
+    /* Use the answer already given for this newsgroup, if any.  They are
+       all forgotten when another user authenticates. */
+    if (verdicts_user != NULL && strcmp(verdicts_user, User) != 0) {
+        hash_free(verdicts);
+        verdicts = NULL;
+        free(verdicts_user);
+        verdicts_user = NULL;
+    }
+    if (verdicts == NULL) {
+        verdicts = hash_create(64, hash_string, verdict_key, verdict_equal,
+                               verdict_free);
+        verdicts_user = xstrdup(User);
+    }
+    key = concat(PostFlag ? "post:" : "read:", NewsGroup, (char *) 0);
+    verdict = hash_lookup(verdicts, key);
+    if (verdict != NULL
+        && (verdict->expires == 0 || verdict->expires > time(NULL))) {
+        free(key);
+        if (reply_message != NULL)
+            *reply_message = (verdict->refusal == NULL) ? NULL
+                : xstrdup(verdict->refusal);
+        return verdict->refusal == NULL ? 0 : 1;
+    }
+
     /* Initialize PythonAuthObject with group method specific items. */
     authnum = 0;
 
@@ -480,8 +522,20 @@ PY_dynamic(char *User, char *NewsGroup, int PostFlag, char **reply_message)
     */
     result = PyObject_CallFunction(proc, (char *) "O", PYauthinfo);
 
+    /* The method may return a tuple of its answer and how many seconds it
+       is valid for, 0 meaning it must not be reused and a negative number
+       the whole session (as for an answer alone). */
+    value = result;
+    ttl = -1;
+    if (result != NULL && PyTuple_Check(result)
+        && PyTuple_GET_SIZE(result) == 2
+        && PyInt_Check(PyTuple_GET_ITEM(result, 1))) {
+        value = PyTuple_GET_ITEM(result, 0);
+        ttl = PyInt_AS_LONG(PyTuple_GET_ITEM(result, 1));
+    }
+
     /* Check the response. */
-    if (result == NULL || (result != Py_None && !PyString_Check(result)))
+    if (value == NULL || (value != Py_None && !PyString_Check(value)))
     {
         syslog(L_ERROR, "python dynamic method (%s access) returned wrong result", PostFlag ? "post" : "read");
 	Reply("%d Internal error (2).  Goodbye!\r\n", NNTP_FAIL_TERMINATING);
@@ -489,12 +543,24 @@ PY_dynamic(char *User, char *NewsGroup, int PostFlag, char **reply_message)
     }
 
     /* Get the response string. */
-    if (result == Py_None) {
+    if (value == Py_None) {
         string = NULL;
     } else {
-        temp = PyString_AS_STRING(result);
+        temp = PyString_AS_STRING(value);
         string = xstrdup(temp);
     }
+    Py_DECREF(result);
+
+    /* Keep the answer for the next times. */
+    if (ttl != 0) {
+        verdict = xmalloc(sizeof(PyVerdict));
+        verdict->key = key;
+        verdict->refusal = (string == NULL) ? NULL : xstrdup(string);
+        verdict->expires = (ttl < 0) ? 0 : time(NULL) + ttl;
+        if (!hash_insert(verdicts, key, verdict))
+            hash_replace(verdicts, key, verdict);
+    } else
+        free(key);
 
     /* Clean up the dictionary object. */
     PyDict_Clear(PYauthinfo);
@@ -536,6 +602,12 @@ PY_close_python(void)
 	free(dynamic_file);
         dynamic_file = NULL;
     }
+    if (verdicts != NULL) {
+        hash_free(verdicts);
+        verdicts = NULL;
+        free(verdicts_user);
+        verdicts_user = NULL;
+    }
 }
 
 
@@ -901,4 +973,47 @@ file_free(void *p)
     free(fp);
 }
 
+
+
+/*
+**  Return the key of a PyVerdict, used by the hash table.
+*/
+static const void *
+verdict_key(const void *p)
+{
+    const struct PyVerdict *v = p;
+
+    return v->key;
+}
+
+
+
+/*
+**  Check to see if a provided key matches the key of a PyVerdict, used by
+**  the hash table.
+*/
+static bool
+verdict_equal(const void *k, const void *p)
+{
+    const char *key = k;
+    const struct PyVerdict *v = p;
+
+    return strcmp(key, v->key) == 0;
+}
+
+
+
+/*
+**  Free a PyVerdict, used by the hash table.
+*/
+static void
+verdict_free(void *p)
+{
+    struct PyVerdict *v = p;
+
+    free(v->key);
+    free(v->refusal);
+    free(v);
+}
+
 #endif /* defined(DO_PYTHON) */
@@ -8,12 +8,15 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <syslog.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 
 #include "nnrpd.h"
 #include "inn/innconf.h"
+#include "inn/paths.h"
 
 /* Outside the ifdef so that make depend works even ifndef HAVE_OPENSSL. */
 #include "tls.h"
@@ -719,6 +722,72 @@ tls_init_serverengine(int verifydepth, int askcert, int requirecert,
 }
 
 
+/*
+**  Make the session tickets issued by this process usable by all the other
+**  nnrpd processes, so that a client reconnecting can resume its session
+**  whichever process serves it.  The key protecting the tickets is kept in
+**  a file in pathrun, and replaced by a new random one when it is older than
+**  lifetime seconds.  Two processes may replace it at the same time; the
+**  tickets issued by the one whose key is lost then only cost their clients
+**  a full handshake.  Failures are logged and leave the key of the process.
+*/
+static void
+tls_share_tickets(unsigned long lifetime)
+{
+    unsigned char key[128];
+    char *path, *temp;
+    struct stat st;
+    long keylen;
+    int fd;
+
+    keylen = SSL_CTX_get_tlsext_ticket_keys(CTX, NULL, 0);
+    if (keylen <= 0 || (size_t) keylen > sizeof(key)) {
+        syslog(L_ERROR, "cannot share TLS session tickets");
+        return;
+    }
+    path = concatpath(innconf->pathrun, INN_PATH_TLSTICKETKEY);
+
+    /* Use the current key if it is recent enough. */
+    fd = open(path, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &st) == 0
+        && st.st_mtime + (time_t) lifetime > time(NULL)
+        && read(fd, key, keylen) == keylen) {
+        close(fd);
+        goto done;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    /* Otherwise, replace it. */
+    if (RAND_bytes(key, keylen) != 1) {
+        syslog(L_ERROR, "cannot generate a TLS session ticket key");
+        free(path);
+        return;
+    }
+    temp = concat(path, ".new", (char *) 0);
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || xwrite(fd, key, keylen) < 0 || close(fd) < 0
+        || rename(temp, path) < 0) {
+        syslog(L_ERROR, "cannot write %s: %m", temp);
+        if (fd >= 0)
+            unlink(temp);
+        free(temp);
+        free(path);
+        return;
+    }
+    free(temp);
+
+done:
+    if (SSL_CTX_set_tlsext_ticket_keys(CTX, key, keylen) != 1)
+        syslog(L_ERROR, "cannot set the TLS session ticket key from %s",
+               path);
+    else
+        SSL_CTX_set_timeout(CTX, lifetime);
+    memset(key, 0, sizeof(key));
+    free(path);
+}
+
+
 /*
 **  The function called by nnrpd to initialize the TLS support.  Calls
 **  tls_init_serverengine and checks the result.  On any sort of failure,
@@ -760,6 +829,13 @@ tls_init(void)
         return -1;
     }
 
+    if (innconf->tlsticketlifetime > 0)
+        tls_share_tickets(innconf->tlsticketlifetime);
+#ifdef SSL_OP_ENABLE_KTLS
+    if (innconf->tlsktls)
+        SSL_CTX_set_options(CTX, SSL_OP_ENABLE_KTLS);
+#endif
+
     tls_initialized = true;
     return 0;
 }
@@ -10,8 +10,25 @@
 
 #if defined(HAVE_ZLIB)
 # define ZBUFSIZE 65536
-# define MEM_LEVEL 9
 # define WINDOW_BITS (-15)      /* Raw deflate. */
+
+/*
+**  Settings of the compressor for each value of compress_memory in
+**  readers.conf.  deflate needs about (1 << (windowBits + 2)) + (1 <<
+**  (memLevel + 9)) bytes, so from about 12 KB for low to 384 KB for high,
+**  at the cost of a lower compression ratio.  The decompressor always uses
+**  the largest window, since a client may compress with it; it needs about
+**  40 KB.
+*/
+static const struct {
+    int window_bits;
+    int mem_level;
+    size_t buffer_size;
+} zlib_presets[] = {
+    { -10, 4, 16384 },          /* CMlow */
+    { -12, 6, 32768 },          /* CMmedium */
+    { WINDOW_BITS, 9, ZBUFSIZE }, /* CMhigh */
+};
 bool compression_layer_on = false;
 bool tls_compression_on = false;
 z_stream *zstream_in = NULL;
@@ -50,6 +67,12 @@ bool
 zlib_init(void)
 {
     int result;
+    COMPRESSMEM preset = CMhigh;
+
+    if (PERMaccessconf != NULL)
+        preset = PERMaccessconf->compressmemory;
+    zbuf_out_size = zlib_presets[preset].buffer_size;
+
     zstream_in = (z_stream *) xmalloc(sizeof(z_stream));
     zstream_out = (z_stream *) xmalloc(sizeof(z_stream));
 
@@ -81,7 +104,9 @@ zlib_init(void)
     }
 
     result = deflateInit2(zstream_out, Z_BEST_COMPRESSION, Z_DEFLATED,
-                          WINDOW_BITS, MEM_LEVEL, Z_DEFAULT_STRATEGY);
+                          zlib_presets[preset].window_bits,
+                          zlib_presets[preset].mem_level,
+                          Z_DEFAULT_STRATEGY);
 
     if (result != Z_OK) {
         syslog(L_NOTICE, "deflateInit2() failed with error %d", result);
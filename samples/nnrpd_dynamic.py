@@ -79,6 +79,10 @@ class DYNACCESS:
         #  else:
         #      syslog('notice', 'dynamic authorization access type is not known: %s' % attributes['type'])
         #      return "Internal error";
+        #
+        # nnrpd remembers the answer for the rest of the connection.  To
+        # have this method called again after five minutes instead:
+        #  return (None, 300)
         return None
 
     def dynamic_close(self):
@@ -36,7 +36,7 @@ my %ctlinnd = ('a', 'addhist',     'D', 'allow',
 	       'E', 'logmode',     'F', 'feedinfo',
 	       'S', 'status',      'P', 'perl',
                'L', 'lowmark',     'Y', 'python',
-               'Z', 'timer');
+               'Z', 'timer',       'K', 'batch');
 
 my %timer_names = (idle     => 'idle',
                    hishave  => 'history lookup',
@@ -697,6 +697,10 @@ sub collect($$$$$$) {
       $innd_his{'Do not exist'}  += $4;
       return 1;
     }
+    # ME HIScache x size x used x evicted
+    # Sizing of the history cache; not a lookup result, so not counted
+    # with the HISstats figures above.
+    return 1 if $left =~ m/^ME HIScache \d+ size \d+ used \d+ evicted$/o;
     # SERVER history cache final: 388656 lookups, 1360 hits
     if ($left =~ m/^SERVER history cache final: (\d+) lookups, (\d+) hits$/) {
       $innd_cache{'Lookups'} += $1;
@@ -936,6 +940,8 @@ sub collect($$$$$$) {
 
     # final
     return 1 if $left =~ m/\S+ final seconds/o;
+    # checkpoint and final of the large-article lane
+    return 1 if $left =~ m/\S+ (?:checkpoint|final) large offered/o;
 
     # ME file xxxx shrunk from yyyy to zzz
     if ($left =~ /^ME file (.*)\.output shrunk from (\d+) to (\d+)$/) {
@@ -22,6 +22,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #if HAVE_LIMITS_H
 # include <limits.h>
 #endif
@@ -242,11 +243,25 @@ typedef struct {
   ARTNUM		hi;
   int			cur;
   bool			needov;
+  bool			indexonly;	/* numbers and tokens only, without
+					   mapping the data blocks */
   GROUPLOC		gloc;
   int			count;
   GROUPDATABLOCK	gdb;	/* used for caching current block */
+  bool			snapshot;	/* index read without the group
+					   lock held */
+  time_t		expired;	/* group version the index was */
+  OV			baseindex;	/* read at, see GROUPcurrent */
 } OVSEARCH;
 
+/* Number of lock-free attempts at reading a group index before falling back
+   to a shared lock. */
+#define OV_SNAPSHOT_TRIES	3
+
+/* Groups with less than one discontinuity per this many blocks are not worth
+   compacting. */
+#define OV_COMPACT_SPAN		8
+
 #define GROUPDATAHASHSIZE	25
 
 static GROUPDATABLOCK	*groupdatablock[GROUPDATAHASHSIZE];
@@ -274,6 +289,7 @@ static bool		Nospace;
 static bool		Needunlink;
 static bool		Cutofflow;
 static bool		Cache;
+static bool		Indexonly;
 static OVSEARCH		*Cachesearch;
 
 static int ovbuffmode;
@@ -282,7 +298,8 @@ static GROUPLOC GROUPnewnode(void);
 static bool GROUPremapifneeded(GROUPLOC loc);
 static void GROUPLOCclear(GROUPLOC *loc);
 static bool GROUPLOCempty(GROUPLOC loc);
-static bool GROUPlockhash(enum inn_locktype type);
+static bool GROUPlockbucket(unsigned int bucket, enum inn_locktype type);
+static bool GROUPlockfreelist(enum inn_locktype type);
 static bool GROUPlock(GROUPLOC gloc, enum inn_locktype type);
 static off_t GROUPfilesize(int count);
 static bool GROUPexpand(int mode);
@@ -1165,8 +1182,20 @@ buffindexed_groupadd(const char *group, ARTNUM lo, ARTNUM hi, char *flag)
   grouphash = Hash(group, strlen(group));
   memcpy(&i, &grouphash, sizeof(i));
   i = i % GROUPHEADERHASHSIZE;
-  GROUPlockhash(INN_LOCK_WRITE);
+  GROUPlockbucket(i, INN_LOCK_WRITE);
+  /* Someone else may have added it since we looked. */
+  gloc = GROUPfind(group, true);
+  if (!GROUPLOCempty(gloc)) {
+    GROUPlockbucket(i, INN_LOCK_UNLOCK);
+    return buffindexed_groupadd(group, lo, hi, flag);
+  }
+  GROUPlockfreelist(INN_LOCK_WRITE);
   gloc = GROUPnewnode();
+  GROUPlockfreelist(INN_LOCK_UNLOCK);
+  if (GROUPLOCempty(gloc)) {
+    GROUPlockbucket(i, INN_LOCK_UNLOCK);
+    return false;
+  }
   ge = &GROUPentries[gloc.recno];
   setinitialge(ge, grouphash, flag, GROUPheader->hash[i], lo, hi);
   GROUPheader->hash[i] = gloc;
@@ -1182,7 +1211,7 @@ buffindexed_groupadd(const char *group, ARTNUM lo, ARTNUM hi, char *flag)
     name_table = ntp;
   }
 #endif /* OV_DEBUG */
-  GROUPlockhash(INN_LOCK_UNLOCK);
+  GROUPlockbucket(i, INN_LOCK_UNLOCK);
   return true;
 }
 
@@ -1272,6 +1301,11 @@ static bool GROUPexpand(int mode) {
 static GROUPLOC GROUPnewnode(void) {
   GROUPLOC	loc;
 
+  /* Another writer may have grown the index since we mapped it, in which
+     case the freelist can point past the end of our mapping. */
+  loc.recno = GROUPcount;
+  GROUPremapifneeded(loc);
+
   /* If we didn't find any free space, then make some */
   if (GROUPLOCempty(GROUPheader->freelist)) {
     if (!GROUPexpand(ovbuffmode)) {
@@ -1310,8 +1344,20 @@ static bool GROUPLOCempty(GROUPLOC loc) {
   return (loc.recno < 0);
 }
 
-static bool GROUPlockhash(enum inn_locktype type) {
-  return inn_lock_range(GROUPfd, type, true, 0, sizeof(GROUPHEADER));
+/*
+** The group index header is locked piecewise: adding a group locks only the
+** hash chain it goes into, and the freelist while it takes an entry from it.
+** Chains are always locked before the freelist.
+*/
+static bool GROUPlockbucket(unsigned int bucket, enum inn_locktype type) {
+  return inn_lock_range(GROUPfd, type, true,
+	     offsetof(GROUPHEADER, hash) + sizeof(GROUPLOC) * bucket,
+	     sizeof(GROUPLOC));
+}
+
+static bool GROUPlockfreelist(enum inn_locktype type) {
+  return inn_lock_range(GROUPfd, type, true,
+	     offsetof(GROUPHEADER, freelist), sizeof(GROUPLOC));
 }
 
 static bool GROUPlock(GROUPLOC gloc, enum inn_locktype type) {
@@ -1322,6 +1368,28 @@ static bool GROUPlock(GROUPLOC gloc, enum inn_locktype type) {
 	     sizeof(GROUPENTRY));
 }
 
+/*
+** Readers do not hold the group lock while they search.  Adding records
+** never moves what is already in the index and data blocks, so a copy of
+** the index stays good until the group is expired or compacted, which
+** rebuilds it from a new base index block, frees the old blocks and stamps
+** the group.  The
+** stamp only ever goes up, so (expired, baseindex) acts as a version.
+*/
+static void GROUPstamp(GROUPENTRY *ge) {
+  time_t	now = time(NULL);
+
+  ge->expired = (now > ge->expired) ? now : ge->expired + 1;
+}
+
+static bool GROUPcurrent(const OVSEARCH *search) {
+  const GROUPENTRY	*ge = &GROUPentries[search->gloc.recno];
+
+  return ge->expired == search->expired
+    && ge->baseindex.index == search->baseindex.index
+    && ge->baseindex.blocknum == search->baseindex.blocknum;
+}
+
 #ifdef OV_DEBUG
 static bool ovsetcurindexblock(GROUPENTRY *ge, GROUPENTRY *georig) {
 #else
@@ -1557,6 +1625,26 @@ buffindexed_add(const char *group, ARTNUM artnum, TOKEN token, char *data,
   return true;
 }
 
+/*
+**  Everything is written to memory-mapped buffers, so there is no system
+**  call to save by batching; just add the records one after the other.
+*/
+bool
+buffindexed_addbatch(struct ov_record *records, size_t count)
+{
+  size_t	i;
+  bool		success = true;
+
+  for (i = 0 ; i < count ; i++) {
+    records[i].stored = buffindexed_add(records[i].group, records[i].artnum,
+      records[i].token, records[i].data, records[i].len, records[i].arrived,
+      records[i].expires);
+    if (!records[i].stored)
+      success = false;
+  }
+  return success;
+}
+
 bool buffindexed_cancel(const char *group UNUSED, ARTNUM artnum UNUSED) {
     return true;
 }
@@ -1651,6 +1739,8 @@ ovgroupmmap(GROUPENTRY *ge, ARTNUM low, ARTNUM high, bool needov)
   OVBLOCK		*ovblock;
   void *		addr;
   GIBLIST		*giblist;
+  bool			last;
+  int			blocks = 0;
 
   if (low > high) {
     Gibcount = 0;
@@ -1662,6 +1752,12 @@ ovgroupmmap(GROUPENTRY *ge, ARTNUM low, ARTNUM high, bool needov)
   Gib = xmalloc(Gibcount * sizeof(OVINDEX));
   count = 0;
   while (ov.index != NULLINDEX) {
+    /* ge may be a copy taken without the lock; don't follow a chain that
+       was rewritten under us for ever. */
+    if (++blocks > ge->count / (int) OVINDEXMAX + 2) {
+      ovgroupunmap();
+      return false;
+    }
     ovbuff = getovbuff(ov);
     if (ovbuff == NULL) {
       warn("buffindexed: ovgroupmmap ovbuff is null(ovindex is %d, ovblock is %d", ov.index, ov.blocknum);
@@ -1678,7 +1774,8 @@ ovgroupmmap(GROUPENTRY *ge, ARTNUM low, ARTNUM high, bool needov)
       return false;
     }
     ovblock = (void *)((char *)addr + pagefudge);
-    if (ov.index == ge->curindex.index && ov.blocknum == ge->curindex.blocknum) {
+    last = (ov.index == ge->curindex.index && ov.blocknum == ge->curindex.blocknum);
+    if (last) {
       limit = ge->curindexoffset;
     } else {
       limit = OVINDEXMAX;
@@ -1694,7 +1791,8 @@ ovgroupmmap(GROUPENTRY *ge, ARTNUM low, ARTNUM high, bool needov)
     giblist->ov = ov;
     giblist->next = Giblist;
     Giblist = giblist;
-    ov = ovblock->ovindexhead.next;
+    /* Index blocks linked after curindex are not filled yet. */
+    ov = last ? ovnull : ovblock->ovindexhead.next;
     munmap(addr, len);
   }
   Gibcount = count;
@@ -1787,17 +1885,121 @@ ovopensearch(const char *group, ARTNUM low, ARTNUM high, bool needov)
   search->cur = 0;
   search->group = xstrdup(group);
   search->needov = needov;
+  search->indexonly = false;
   search->gloc = gloc;
   search->count = ge->count;
   search->gdb.mmapped = false;
+  search->snapshot = false;
+  return (void *)search;
+}
+
+/* Release what ovgroupmmap and ovsearch mapped for a search, and the copy of
+   the index. */
+static void ovgroupdrop(OVSEARCH *search) {
+  GROUPDATABLOCK	*gdb;
+  int			i;
+
+  for (i = 0 ; i < GROUPDATAHASHSIZE ; i++) {
+    for (gdb = groupdatablock[i] ; gdb != NULL ; gdb = gdb->next) {
+      if (gdb->mmapped)
+	munmap(gdb->addr, gdb->len);
+    }
+  }
+  if (search->gdb.mmapped) {
+    munmap(search->gdb.addr, search->gdb.len);
+    search->gdb.mmapped = false;
+  }
+  ovgroupunmap();
+  if (Gib != NULL) {
+    free(Gib);
+    Gib = NULL;
+  }
+}
+
+/*
+** Read the index of the group of a search into Gib without taking the group
+** lock, checking that the group did not change while we were at it (see
+** GROUPcurrent).  Adding records makes this fail too, and after a few tries
+** the copy is taken under a shared lock, which only waits for the writer
+** that is currently adding to the group.
+*/
+static bool
+ovgroupsnapshot(OVSEARCH *search, ARTNUM low, ARTNUM high)
+{
+  GROUPENTRY	ge, *live;
+  HASH		grouphash;
+  bool		locked = false, ok;
+  int		i;
+
+  grouphash = Hash(search->group, strlen(search->group));
+  live = &GROUPentries[search->gloc.recno];
+  for (i = 0 ; ; i++) {
+    if (i == OV_SNAPSHOT_TRIES) {
+      GROUPlock(search->gloc, INN_LOCK_READ);
+      locked = true;
+    }
+    ge = *live;
+    if (ge.deleted != 0 || memcmp(&grouphash, &ge.hash, sizeof(HASH)) != 0) {
+      if (locked)
+	GROUPlock(search->gloc, INN_LOCK_UNLOCK);
+      return false;
+    }
+    search->lo = (low < ge.low) ? ge.low : low;
+    search->hi = (high > ge.high) ? ge.high : high;
+    ok = ovgroupmmap(&ge, search->lo, search->hi, search->needov);
+    if (locked) {
+      GROUPlock(search->gloc, INN_LOCK_UNLOCK);
+      if (!ok)
+	return false;
+      break;
+    }
+    if (ok && ge.expired == live->expired && ge.count == live->count
+	&& ge.baseindex.index == live->baseindex.index
+	&& ge.baseindex.blocknum == live->baseindex.blocknum
+	&& ge.curindex.index == live->curindex.index
+	&& ge.curindex.blocknum == live->curindex.blocknum
+	&& ge.curindexoffset == live->curindexoffset)
+      break;
+    if (ok)
+      ovgroupdrop(search);
+  }
+  search->cur = 0;
+  search->count = ge.count;
+  search->expired = ge.expired;
+  search->baseindex = ge.baseindex;
+  return true;
+}
+
+/* The reader side of ovopensearch; the group lock is not held afterwards. */
+static void *
+ovopenreader(const char *group, ARTNUM low, ARTNUM high, bool needov)
+{
+  GROUPLOC		gloc;
+  OVSEARCH		*search;
+
+  gloc = GROUPfind(group, false);
+  if (GROUPLOCempty(gloc))
+    return NULL;
+
+  search = xmalloc(sizeof(OVSEARCH));
+  search->group = xstrdup(group);
+  search->needov = needov;
+  search->indexonly = false;
+  search->gloc = gloc;
+  search->gdb.mmapped = false;
+  search->snapshot = true;
+  if (!ovgroupsnapshot(search, low, high)) {
+    free(search->group);
+    free(search);
+    return NULL;
+  }
   return (void *)search;
 }
 
 void *
 buffindexed_opensearch(const char *group, int low, int high)
 {
-  GROUPLOC		gloc;
-  void			*handle;
+  OVSEARCH		*search;
 
   if (Gib != NULL) {
     free(Gib);
@@ -1808,14 +2010,10 @@ buffindexed_opensearch(const char *group, int low, int high)
       Cachesearch = NULL;
     }
   }
-  gloc = GROUPfind(group, false);
-  if (GROUPLOCempty(gloc)) {
-    return NULL;
-  }
-  GROUPlock(gloc, INN_LOCK_WRITE);
-  if ((handle = ovopensearch(group, low, high, true)) == NULL)
-    GROUPlock(gloc, INN_LOCK_UNLOCK);
-  return(handle);
+  search = ovopenreader(group, low, high, !Indexonly);
+  if (search != NULL)
+    search->indexonly = Indexonly;
+  return search;
 }
 
 static bool ovsearch(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN *token, time_t *arrived, time_t *expires) {
@@ -1838,7 +2036,18 @@ static bool ovsearch(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN
   if (Gib[search->cur].artnum > search->hi)
       return false;
 
-  if (search->needov) {
+  if (search->indexonly) {
+    if (artnum)
+      *artnum = Gib[search->cur].artnum;
+    if (len)
+      *len = 0;
+    if (data)
+      *data = NULL;
+    if (arrived)
+      *arrived = Gib[search->cur].arrived;
+    if (expires)
+      *expires = Gib[search->cur].expires;
+  } else if (search->needov) {
     if (Gib[search->cur].index == NULLINDEX) {
       if (len)
 	*len = 0;
@@ -1900,7 +2109,8 @@ static bool ovsearch(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN
     }
   }
   if (token) {
-    if (Gib[search->cur].index == NULLINDEX && !search->needov) {
+    if (Gib[search->cur].index == NULLINDEX && !search->needov
+        && !search->indexonly) {
       search->cur++;
       return false;
     }
@@ -1911,7 +2121,23 @@ static bool ovsearch(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN
 }
 
 bool buffindexed_search(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN *token, time_t *arrived) {
-  return(ovsearch(handle, artnum, data, len, token, arrived, NULL));
+  OVSEARCH	*search = (OVSEARCH *)handle;
+  ARTNUM	current;
+  int		i;
+
+  for (i = 0 ; ; i++) {
+    if (!ovsearch(handle, artnum, data, len, token, arrived, NULL))
+      return false;
+    if (!search->snapshot || i == OV_SNAPSHOT_TRIES || GROUPcurrent(search))
+      return true;
+    /* The group was expired since we read its index, so what we just
+       returned may come from a block that has been reused.  Read the index
+       again and carry on from the same article. */
+    current = Gib[search->cur - 1].artnum;
+    ovgroupdrop(search);
+    if (!ovgroupsnapshot(search, current, search->hi))
+      return false;
+  }
 }
 
 static void ovclosesearch(void *handle, bool freeblock) {
@@ -1953,12 +2179,7 @@ static void ovclosesearch(void *handle, bool freeblock) {
 }
 
 void buffindexed_closesearch(void *handle) {
-  OVSEARCH	*search = (OVSEARCH *)handle;
-  GROUPLOC	gloc;
-
-  gloc = search->gloc;
   ovclosesearch(handle, false);
-  GROUPlock(gloc, INN_LOCK_UNLOCK);
 }
 
 /* get token from sorted index */
@@ -2012,7 +2233,7 @@ buffindexed_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
 {
   GROUPLOC	gloc;
   void		*handle;
-  bool		retval, grouplocked = false;
+  bool		retval;
 
   if (Gib != NULL) {
     if (Cachesearch != NULL && strcmp(Cachesearch->group, group) != 0) {
@@ -2030,13 +2251,10 @@ buffindexed_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
 	if (GROUPLOCempty(gloc)) {
 	  return false;
 	}
-	GROUPlock(gloc, INN_LOCK_WRITE);
 	if ((Cachesearch != NULL) && (GROUPentries[gloc.recno].count == Cachesearch->count)) {
 	  /* no new overview data is stored */
-	  GROUPlock(gloc, INN_LOCK_UNLOCK);
 	  return false;
 	} else {
-	  grouplocked = true;
 	  free(Gib);
 	  Gib = NULL;
 	  if (Cachesearch != NULL) {
@@ -2048,20 +2266,11 @@ buffindexed_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
       }
     }
   }
-  gloc = GROUPfind(group, false);
-  if (GROUPLOCempty(gloc)) {
-    return false;
-  }
-  if (!grouplocked) {
-    GROUPlock(gloc, INN_LOCK_WRITE);
-  }
-  if (!(handle = ovopensearch(group, artnum, artnum, false))) {
-    GROUPlock(gloc, INN_LOCK_UNLOCK);
+  if (!(handle = ovopenreader(group, artnum, artnum, false))) {
     return false;
   }
   retval = buffindexed_search(handle, NULL, NULL, NULL, token, NULL);
   ovclosesearch(handle, false);
-  GROUPlock(gloc, INN_LOCK_UNLOCK);
   return retval;
 }
 
@@ -2102,20 +2311,22 @@ buffindexed_expiregroup(const char *group, int *lo, struct history *h)
       search.lo = ge->low;
       search.cur = 0;
       search.needov = true;
+      search.indexonly = false;
       while (ovsearch((void *)&search, NULL, &data, &len, &token, &arrived, &expires)) {
 	if (innconf->groupbaseexpiry)
 	  /* assuming "." is not real newsgroup */
 	  OVgroupbasedexpire(token, ".", data, len, arrived, expires);
       }
+      /* Readers must see the new version before the blocks are reused. */
+      GROUPstamp(ge);
+      ge->count = 0;
+      ge->baseindex = ge->curindex = ge->curdata = ovnull;
 #ifdef OV_DEBUG
       freegroupblock(ge);
 #else
       freegroupblock();
 #endif
       ovgroupunmap();
-      ge->expired = time(NULL);
-      ge->count = 0;
-      ge->baseindex = ge->curindex = ge->curdata = ovnull;
       GROUPlock(gloc, INN_LOCK_UNLOCK);
     }
     return true;
@@ -2130,7 +2341,7 @@ buffindexed_expiregroup(const char *group, int *lo, struct history *h)
     ge->low = ge->high + 1;
     if (lo != NULL)
       *lo = ge->low;
-    ge->expired = time(NULL);
+    GROUPstamp(ge);
     GROUPlock(gloc, INN_LOCK_UNLOCK);
     return true;
   }
@@ -2143,7 +2354,7 @@ buffindexed_expiregroup(const char *group, int *lo, struct history *h)
   newge.low = 0;
   setinitialge(&newge, hash, &flag, next, 0, high);
   if ((handle = ovopensearch(group, low, high, true)) == NULL) {
-    ge->expired = time(NULL);
+    GROUPstamp(ge);
     GROUPlock(gloc, INN_LOCK_UNLOCK);
     warn("buffindexed: could not open overview for '%s'", group);
     return false;
@@ -2169,7 +2380,7 @@ buffindexed_expiregroup(const char *group, int *lo, struct history *h)
 #endif /* OV_DEBUG */
       /* Old group cannot be freed. */
       ovclosesearch(handle, false);
-      ge->expired = time(NULL);
+      GROUPstamp(ge);
       GROUPlock(gloc, INN_LOCK_UNLOCK);
       warn("buffindexed: not enough room to expire overview for group '%s'",
            group);
@@ -2197,16 +2408,288 @@ buffindexed_expiregroup(const char *group, int *lo, struct history *h)
      * when there is no article in the group. */
     newge.low = newge.high + 1;
   }
+  newge.expired = ge->expired;
+  GROUPstamp(&newge);
   *ge = newge;
   if (lo != NULL) {
     *lo = ge->low;
   }
   ovclosesearch(handle, true);
-  ge->expired = time(NULL);
   GROUPlock(gloc, INN_LOCK_UNLOCK);
   return true;
 }
 
+/*
+**  Compaction.  Blocks are handed out one at a time from all ovbuffs in
+**  turn, so the index and data blocks of a group end up scattered and
+**  reading it means one seek per block.  Compacting a group copies its
+**  records, in article order, into a single run of free blocks, index
+**  blocks first, and then swaps the group entry over and frees the old
+**  blocks, just like expiry does.  The group lock is held while copying,
+**  which only holds up writers to that group; readers notice the new
+**  version and reread the index.
+*/
+
+/* Allocate count contiguous blocks in one ovbuff.  Returns the first one, or
+   ovnull if no ovbuff has such a run free. */
+static OV ovblockrun(int count) {
+  OVBUFF	*ovbuff;
+  OV		ov;
+  ULONG		*table;
+  unsigned int	i, run, bits = sizeof(long) * 8;
+  int		j;
+
+  for (ovbuff = ovbufftab ; ovbuff != NULL ; ovbuff = ovbuff->next) {
+    ovlock(ovbuff, INN_LOCK_WRITE);
+    ovreadhead(ovbuff);
+    if (ovbuff->totalblk - ovbuff->usedblk < (unsigned int) count) {
+      ovlock(ovbuff, INN_LOCK_UNLOCK);
+      continue;
+    }
+    table = ((ULONG *) ovbuff->bitfield + (OV_BEFOREBITF / sizeof(long)));
+    for (i = 0, run = 0 ; i < ovbuff->totalblk && run < (unsigned int) count ; i++) {
+      if (i % bits == 0 && table[i / bits] == ~0UL && i + bits <= ovbuff->totalblk) {
+	/* skip full words */
+	i += bits - 1;
+	run = 0;
+      } else if (ovusedblock(ovbuff, i, false, false))
+	run = 0;
+      else
+	run++;
+    }
+    if (run < (unsigned int) count) {
+      ovlock(ovbuff, INN_LOCK_UNLOCK);
+      continue;
+    }
+    ov.index = ovbuff->index;
+    ov.blocknum = i - count;
+    for (j = 0 ; j < count ; j++)
+      ovusedblock(ovbuff, ov.blocknum + j, true, true);
+    ovbuff->usedblk += count;
+    if (ovbuff->freeblk >= ov.blocknum && ovbuff->freeblk < i)
+      ovnextblock(ovbuff);
+    ovbuff->dirty += count;
+    ovflushhead(ovbuff);
+    ovlock(ovbuff, INN_LOCK_UNLOCK);
+    return ov;
+  }
+  return ovnull;
+}
+
+/* Free count blocks of a run starting at ov. */
+static void ovblockrunfree(OV ov, int count, GROUPENTRY *ge UNUSED) {
+  for (; count > 0 ; count--, ov.blocknum++) {
+#ifdef OV_DEBUG
+    ovblockfree(ov, ge);
+#else
+    ovblockfree(ov);
+#endif /* OV_DEBUG */
+  }
+}
+
+/* Write out a whole block of ovbuff. */
+static bool ovblockwrite(OVBUFF *ovbuff, unsigned int blocknum, void *buf) {
+  return PWRITE(ovbuff->fd, buf, OV_BLOCKSIZE,
+		ovbuff->base + OV_OFFSET(blocknum)) == OV_BLOCKSIZE;
+}
+
+/* Count the places where reading the group mapped by ovgroupmmap has to
+   seek: between index blocks in chain order, from the last index block to
+   the first data block, and between data blocks in article order. */
+static int ovgroupbreaks(OVSEARCH *search) {
+  GIBLIST	*giblist;
+  OV		prev = ovnull, ov;
+  int		i, breaks = 0;
+
+  /* Giblist is in reverse chain order. */
+  for (giblist = Giblist ; giblist != NULL ; giblist = giblist->next) {
+    if (prev.index != NULLINDEX && (giblist->ov.index != prev.index
+	|| giblist->ov.blocknum + 1 != prev.blocknum))
+      breaks++;
+    if (prev.index == NULLINDEX)
+      ov = giblist->ov;
+    prev = giblist->ov;
+  }
+  prev = (Giblist != NULL) ? ov : ovnull;
+  for (i = 0 ; i < Gibcount ; i++) {
+    if (Gib[i].artnum == 0 || Gib[i].artnum < search->lo
+	|| Gib[i].artnum > search->hi || Gib[i].index == NULLINDEX)
+      continue;
+    if (Gib[i].index == prev.index && Gib[i].blocknum == prev.blocknum)
+      continue;
+    if (prev.index != NULLINDEX && (Gib[i].index != prev.index
+	|| Gib[i].blocknum != prev.blocknum + 1))
+      breaks++;
+    prev.index = Gib[i].index;
+    prev.blocknum = Gib[i].blocknum;
+  }
+  return breaks;
+}
+
+static bool ovcompactgroup(OVCOMPACT *oc) {
+  static unsigned long	debt = 0;
+  GROUPLOC	gloc;
+  GROUPENTRY	*ge, newge;
+  OVSEARCH	*search;
+  OVBUFF	*ovbuff;
+  OVBLOCK	*ovblock;
+  OV		start, spare;
+  OVINDEX	*ie;
+  char		*block, *data;
+  ARTNUM	artnum;
+  TOKEN		token;
+  time_t	arrived, expires;
+  int		i, len, nentries, nindex, ndata, total, offset;
+  int		k, n, j, count;
+  bool		ok = true;
+
+  oc->compacted = false;
+  gloc = GROUPfind(oc->group, false);
+  if (GROUPLOCempty(gloc))
+    return false;
+  GROUPlock(gloc, INN_LOCK_WRITE);
+  ge = &GROUPentries[gloc.recno];
+  if (ge->count == 0) {
+    GROUPlock(gloc, INN_LOCK_UNLOCK);
+    return true;
+  }
+  search = ovopensearch(oc->group, ge->low, ge->high, true);
+  if (search == NULL) {
+    GROUPlock(gloc, INN_LOCK_UNLOCK);
+    return false;
+  }
+
+  /* Lay the records out as ovaddrec would, to size the run. */
+  nentries = ndata = 0;
+  offset = OV_BLOCKSIZE;
+  for (i = 0 ; i < Gibcount ; i++) {
+    if (Gib[i].artnum == 0 || Gib[i].artnum < search->lo
+	|| Gib[i].artnum > search->hi || Gib[i].index == NULLINDEX
+	|| Gib[i].len <= 0)
+      continue;
+    nentries++;
+    if (OV_BLOCKSIZE - offset < Gib[i].len) {
+      ndata++;
+      offset = 0;
+    }
+    offset += Gib[i].len;
+  }
+  nindex = (nentries + OVINDEXMAX - 1) / OVINDEXMAX;
+  total = nindex + ndata;
+  if (nentries == 0 || ovgroupbreaks(search) * OV_COMPACT_SPAN < total) {
+    ovclosesearch(search, false);
+    GROUPlock(gloc, INN_LOCK_UNLOCK);
+    return true;
+  }
+  start = ovblockrun(total);
+  if (start.index == NULLINDEX) {
+    ovclosesearch(search, false);
+    GROUPlock(gloc, INN_LOCK_UNLOCK);
+    notice("buffindexed: no room to compact '%s' (%d blocks)", oc->group,
+	   total);
+    return true;
+  }
+  ovbuff = getovbuff(start);
+
+  /* Copy the records.  k and n are the current index block and entry, j
+     the current data block; each block is written out once full. */
+  ovblock = xcalloc(1, OV_BLOCKSIZE);
+  block = xcalloc(1, OV_BLOCKSIZE);
+  k = n = 0;
+  j = -1;
+  offset = OV_BLOCKSIZE;
+  count = 0;
+  while (ok && ovsearch(search, &artnum, &data, &len, &token, &arrived, &expires)) {
+    if (len <= 0)
+      continue;
+    if (OV_BLOCKSIZE - offset < len) {
+      if (j >= 0 && !ovblockwrite(ovbuff, start.blocknum + nindex + j, block))
+	ok = false;
+      if (++j >= ndata)
+	ok = false;
+      offset = 0;
+    }
+    if (n == (int) OVINDEXMAX) {
+      ovblock->ovindexhead.next.index = start.index;
+      ovblock->ovindexhead.next.blocknum = start.blocknum + k + 1;
+      if (!ovblockwrite(ovbuff, start.blocknum + k, ovblock))
+	ok = false;
+      memset(ovblock, '\0', OV_BLOCKSIZE);
+      k++;
+      n = 0;
+    }
+    if (!ok)
+      break;
+    memcpy(block + offset, data, len);
+    ie = &ovblock->ovindex[n++];
+    ie->artnum = artnum;
+    ie->blocknum = start.blocknum + nindex + j;
+    ie->index = start.index;
+    ie->token = token;
+    ie->offset = offset;
+    ie->len = len;
+    ie->arrived = arrived;
+    ie->expires = expires;
+    if (ovblock->ovindexhead.low == 0 || ovblock->ovindexhead.low > artnum)
+      ovblock->ovindexhead.low = artnum;
+    if (ovblock->ovindexhead.high < artnum)
+      ovblock->ovindexhead.high = artnum;
+    offset += len;
+    count++;
+  }
+  if (count == 0)
+    ok = false;
+  if (ok) {
+    ovblock->ovindexhead.next = ovnull;
+    if (!ovblockwrite(ovbuff, start.blocknum + nindex + j, block)
+	|| !ovblockwrite(ovbuff, start.blocknum + k, ovblock))
+      ok = false;
+  }
+  if (!ok) {
+    syswarn("buffindexed: could not compact '%s'", oc->group);
+    ovblockrunfree(start, total, ge);
+    ovclosesearch(search, false);
+    GROUPlock(gloc, INN_LOCK_UNLOCK);
+    free(ovblock);
+    free(block);
+    return false;
+  }
+
+  /* Give back what was planned for records that turned out to be empty. */
+  spare.index = start.index;
+  spare.blocknum = start.blocknum + k + 1;
+  ovblockrunfree(spare, nindex - k - 1, ge);
+  spare.blocknum = start.blocknum + nindex + j + 1;
+  ovblockrunfree(spare, ndata - j - 1, ge);
+
+  newge = *ge;
+  newge.baseindex = start;
+  newge.curindex.index = start.index;
+  newge.curindex.blocknum = start.blocknum + k;
+  newge.curindexoffset = n;
+  newge.curlow = ovblock->ovindexhead.low;
+  newge.curhigh = ovblock->ovindexhead.high;
+  newge.curdata.index = start.index;
+  newge.curdata.blocknum = start.blocknum + nindex + j;
+  newge.curoffset = offset;
+  newge.count = count;
+  GROUPstamp(&newge);
+  *ge = newge;
+  ovclosesearch(search, true);
+  GROUPlock(gloc, INN_LOCK_UNLOCK);
+  free(ovblock);
+  free(block);
+  oc->compacted = true;
+
+  /* Rate limiting, done here rather than while the group is locked. */
+  if (oc->rate > 0) {
+    debt += (unsigned long) total * (OV_BLOCKSIZE / 1024);
+    for (; debt >= oc->rate ; debt -= oc->rate)
+      sleep(1);
+  }
+  return true;
+}
+
 bool buffindexed_ctl(OVCTLTYPE type, void *val) {
   int			total, used, *i, j;
   float                 *f;
@@ -2249,6 +2732,13 @@ bool buffindexed_ctl(OVCTLTYPE type, void *val) {
   case OVCACHEKEEP:
     Cache = *(bool *)val;
     return true;
+  case OVINDEXONLY:
+    Indexonly = *(bool *)val;
+    return true;
+  case OVCOMPACTGROUP:
+    if (!(ovbuffmode & OV_WRITE))
+      return false;
+    return ovcompactgroup((OVCOMPACT *)val);
   case OVCACHEFREE:
     boolval = (bool *)val;
     *boolval = true;
@@ -5,6 +5,8 @@
 
 BEGIN_DECLS
 
+struct ov_record;
+
 bool buffindexed_open(int mode);
 bool buffindexed_groupstats(const char *group, int *lo, int *hi, int *count,
                             int *flag);
@@ -13,6 +15,7 @@ bool buffindexed_groupadd(const char *group, ARTNUM lo, ARTNUM hi,
 bool buffindexed_groupdel(const char *group);
 bool buffindexed_add(const char *group, ARTNUM artnum, TOKEN token,
                      char *data, int len, time_t arrived, time_t expires);
+bool buffindexed_addbatch(struct ov_record *records, size_t count);
 bool buffindexed_cancel(const char *group, ARTNUM artnum);
 void *buffindexed_opensearch(const char *group, int low, int high);
 bool buffindexed_search(void *handle, ARTNUM *artnum, char **data, int *len,
@@ -1,4 +1,16 @@
-/* Shared memory control utility. */
+/*
+** Shared memory control utility.
+**
+** The segment is locked with a robust process-shared mutex kept after the
+** data, where available.  Taking it when it is free doesn't leave user
+** space, whereas each semop on the SysV semaphores used otherwise is a
+** system call, and the kernel still hands it over to the next process if
+** its holder dies.  The mutex is exclusive: the shared locks are only held
+** by readers while they check the buffer header when opening it, so they
+** gain nothing from running at the same time.  The creator of the segment
+** records in it whether the mutex could be set up, so that everybody
+** attaching it uses the same kind of lock.
+*/
 
 #include "config.h"
 #include "clibrary.h"
@@ -15,6 +27,26 @@
 #include "inn/libinn.h"
 #include "shmem.h"
 
+#if defined(HAVE_PTHREAD) && defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)
+# include <pthread.h>
+# define SMC_MUTEX 1
+
+# define SMC_LOCK_MUTEX     0x4d555458U    /* "MUTX" */
+# define SMC_LOCK_SEMAPHORE 0x53454d41U    /* "SEMA" */
+
+/* Found at the first multiple of 64 bytes after the data. */
+struct smclock {
+    unsigned int magic;
+    pthread_mutex_t mutex;
+};
+
+# define SMC_LOCK_OFFSET(size) (((size_t) (size) + 63) & ~((size_t) 63))
+# define SMC_SEGMENT_SIZE(size) \
+    (SMC_LOCK_OFFSET(size) + sizeof(struct smclock))
+#else
+# define SMC_SEGMENT_SIZE(size) (size)
+#endif
+
 #ifdef _TEST_
 # include <syslog.h> /* for openlog */
 # include <sys/file.h> /* for flock */
@@ -74,6 +106,65 @@ static int smcCreateSemaphore(const char *name)
     return id;
 }
 
+#ifdef SMC_MUTEX
+/*
+** Set up the mutex of a new segment, returning false if it cannot be used.
+*/
+static bool smcInitMutex(struct smclock *lock)
+{
+    pthread_mutexattr_t attr;
+    int status;
+
+    if ((status = pthread_mutexattr_init(&attr)) != 0)
+        goto fail;
+    if ((status = pthread_mutexattr_setpshared(&attr,
+                                               PTHREAD_PROCESS_SHARED)) != 0
+        || (status = pthread_mutexattr_setrobust(&attr,
+                                                 PTHREAD_MUTEX_ROBUST)) != 0
+        || (status = pthread_mutex_init(&lock->mutex, &attr)) != 0) {
+        pthread_mutexattr_destroy(&attr);
+        goto fail;
+    }
+    pthread_mutexattr_destroy(&attr);
+    return true;
+
+fail:
+    errno = status;
+    syswarn("cant set up shared memory mutex, using a semaphore");
+    return false;
+}
+
+static int smcLockMutex(smcd_t *this)
+{
+    int status;
+
+    status = pthread_mutex_lock(this->mutex);
+    if (status == EOWNERDEAD) {
+        warn("shared memory lock holder died, recovering the lock");
+        status = pthread_mutex_consistent(this->mutex);
+    }
+    if (status != 0) {
+        errno = status;
+        syswarn("cant lock shared memory mutex");
+        return(-1);
+    }
+    return(0);
+}
+
+static int smcUnlockMutex(smcd_t *this)
+{
+    int status;
+
+    status = pthread_mutex_unlock(this->mutex);
+    if (status != 0) {
+        errno = status;
+        syswarn("cant unlock shared memory mutex");
+        return(-1);
+    }
+    return(0);
+}
+#endif /* SMC_MUTEX */
+
 int smcGetExclusiveLock(smcd_t *this)
 {
     struct sembuf sops[3] = {
@@ -82,6 +173,11 @@ int smcGetExclusiveLock(smcd_t *this)
         {1, 0, SEM_UNDO}     /* wait for shared lock */
     };
 
+#ifdef SMC_MUTEX
+    if (this->mutex != NULL)
+        return smcLockMutex(this);
+#endif
+
     /* Get a lock for the buffer. Try again if it fails because our
        SIGHUP may interrupt this semop() call */
     if (semop(this->semap, sops, 3) < 0 &&
@@ -100,6 +196,11 @@ int smcGetSharedLock(smcd_t *this)
         {1, 1, SEM_UNDO}     /* increase access count */
     };
 
+#ifdef SMC_MUTEX
+    if (this->mutex != NULL)
+        return smcLockMutex(this);
+#endif
+
     /* Get a lock for the buffer. Try again if it fails because our
        SIGHUP may interrupt this semop() call */
     if (semop(this->semap, sops, 2) < 0 &&
@@ -115,6 +216,11 @@ int smcReleaseSharedLock(smcd_t *this)
 {
     struct sembuf sops = { 1, -1, SEM_UNDO|IPC_NOWAIT };
 
+#ifdef SMC_MUTEX
+    if (this->mutex != NULL)
+        return smcUnlockMutex(this);
+#endif
+
     /* Release the lock */
     if (semop(this->semap, &sops, 1) < 0) {
         syswarn("semop failed to release shared lock");
@@ -127,6 +233,11 @@ int smcReleaseExclusiveLock(smcd_t *this)
 {
     struct sembuf sops = { 0, -1, SEM_UNDO|IPC_NOWAIT };
 
+#ifdef SMC_MUTEX
+    if (this->mutex != NULL)
+        return smcUnlockMutex(this);
+#endif
+
     /* Release the lock */
     if (semop(this->semap, &sops, 1) < 0) {
         syswarn("semop failed to release exclusive lock");
@@ -140,13 +251,17 @@ int smcReleaseExclusiveLock(smcd_t *this)
 */
 smcd_t* smcGetShmemBuffer(const char *name, int size)
 {
-    int     shmid, semap;
+    int     shmid, semap = -1;
+    void    *mutex = NULL;
     smcd_t  *this;
     caddr_t addr;
     key_t   fk = ftok( (char *)name, 0 );
+#ifdef SMC_MUTEX
+    struct smclock *lock;
+#endif
 
     /* create shared memory buffer */
-    shmid = shmget(fk, size, S_IRWXU|S_IRGRP|S_IROTH);
+    shmid = shmget(fk, SMC_SEGMENT_SIZE(size), S_IRWXU|S_IRGRP|S_IROTH);
     if (shmid < 0) {
         /* this is normal */
         return NULL;
@@ -160,8 +275,23 @@ smcd_t* smcGetShmemBuffer(const char *name, int size)
         return NULL;
     }
 
+#ifdef SMC_MUTEX
+    /* Use whichever lock the creator set up */
+    lock = (void *) (addr + SMC_LOCK_OFFSET(size));
+    if (lock->magic == SMC_LOCK_MUTEX)
+        mutex = &lock->mutex;
+    else if (lock->magic != SMC_LOCK_SEMAPHORE) {
+        warn("no lock set up in shared memory for %s", name);
+        if (shmdt(addr) < 0)
+            syswarn("cant detach shared memory");
+        if (shmctl(shmid, IPC_RMID, 0) < 0)
+            syswarn("cant remove shared memory");
+        return NULL;
+    }
+#endif
+
     /* Get control semaphore */
-    if ((semap = smcGetSemaphore(name)) < 0) {
+    if (mutex == NULL && (semap = smcGetSemaphore(name)) < 0) {
         warn("failed to get semaphore for key %s", name);
         if (shmdt(addr) < 0)
             syswarn("cant detach shared memory");
@@ -175,6 +305,7 @@ smcd_t* smcGetShmemBuffer(const char *name, int size)
     this->size = size;
     this->shmid = shmid;
     this->semap = semap;
+    this->mutex = mutex;
 
     /* This makes news log file huge if enabled */
     debug("got shmid %d semap %d addr %p size %d", shmid, semap,
@@ -188,13 +319,18 @@ smcd_t* smcGetShmemBuffer(const char *name, int size)
 */
 smcd_t* smcCreateShmemBuffer(const char *name, int size)
 {
-    int     shmid, semap;
+    int     shmid, semap = -1;
+    void    *mutex = NULL;
     smcd_t  *this;
     caddr_t addr;
     key_t   fk = ftok( (char *)name, 0 );
+#ifdef SMC_MUTEX
+    struct smclock *lock;
+#endif
 
     /* create shared memory buffer */
-    shmid = shmget(fk, size, IPC_CREAT|S_IRWXU|S_IRGRP|S_IROTH);
+    shmid = shmget(fk, SMC_SEGMENT_SIZE(size),
+                   IPC_CREAT|S_IRWXU|S_IRGRP|S_IROTH);
     if (shmid < 0) {
         /* try to get existing segment */
         shmid = shmget(fk, 4, S_IRWXU|S_IRGRP|S_IROTH);
@@ -206,7 +342,8 @@ smcd_t* smcCreateShmemBuffer(const char *name, int size)
                 return NULL;
             }
             notice("recreating another shmem segment");
-            shmid = shmget(fk, size, IPC_CREAT|S_IRWXU|S_IRGRP|S_IROTH);
+            shmid = shmget(fk, SMC_SEGMENT_SIZE(size),
+                           IPC_CREAT|S_IRWXU|S_IRGRP|S_IROTH);
         }
     }
     if (shmid < 0) {
@@ -222,10 +359,16 @@ smcd_t* smcCreateShmemBuffer(const char *name, int size)
         return NULL;
     }
     /* clear the data */
-    memset( addr, 0, size );
+    memset( addr, 0, SMC_SEGMENT_SIZE(size) );
+
+#ifdef SMC_MUTEX
+    lock = (void *) (addr + SMC_LOCK_OFFSET(size));
+    if (smcInitMutex(lock))
+        mutex = &lock->mutex;
+#endif
 
     /* Create control semaphore */
-    if ((semap = smcCreateSemaphore(name)) < 0) {
+    if (mutex == NULL && (semap = smcCreateSemaphore(name)) < 0) {
         warn("failed to create semaphore for %s", name);
         if (shmdt(addr) < 0)
             syswarn("cant detach shared memory");
@@ -239,6 +382,10 @@ smcd_t* smcCreateShmemBuffer(const char *name, int size)
     this->size = size;
     this->shmid = shmid;
     this->semap = semap;
+    this->mutex = mutex;
+#ifdef SMC_MUTEX
+    lock->magic = (mutex != NULL) ? SMC_LOCK_MUTEX : SMC_LOCK_SEMAPHORE;
+#endif
 
     debug("created shmid %d semap %d addr %p size %d", shmid, semap,
           (void *) addr, size);
@@ -265,20 +412,20 @@ void smcClose( smcd_t *this )
             syswarn("cant delete shmid %d", this->shmid);
         else
             debug("shmid %d deleted", this->shmid);
-        /* Delete the semaphore too */
+        /* Delete the semaphore too, if there is one */
+        if (this->semap >= 0) {
 #ifdef HAVE_UNION_SEMUN
-        {
             union semun semArg;
             semArg.val = 0;
             if (semctl(this->semap, 0, IPC_RMID, semArg) < 0) {
                 syswarn("can't remove semaphore %d", this->semap);
             }
-        }
 #else
-        if (semctl(this->semap, 0, IPC_RMID, NULL) < 0) {
-            syswarn("can't remove semaphore %d", this->semap);
-        }
+            if (semctl(this->semap, 0, IPC_RMID, NULL) < 0) {
+                syswarn("can't remove semaphore %d", this->semap);
+            }
 #endif
+        }
     }
     free( this );
 }
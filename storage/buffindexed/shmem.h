@@ -11,7 +11,8 @@ typedef struct {
     caddr_t addr;	/* attached shared memory address */
     size_t  size;	/* size of the shared memory */
     int     shmid;	/* shared memory segment id */
-    int     semap;	/* semaphore id */
+    int     semap;	/* semaphore id, or -1 if mutex is used */
+    void    *mutex;	/* process-shared mutex in the segment, or NULL */
     int     locktype;	/* current lock type */
 } smcd_t;
 
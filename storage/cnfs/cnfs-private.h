@@ -24,11 +24,19 @@
 #define	CNFS_MAGICV4	"CBuf4"		/* CNFSMASIZ bytes */
 #define	CNFS_DFL_BLOCKSIZE	4096	/* Unit block size we'll work with */
 #define	CNFS_MAX_BLOCKSIZE	16384	/* Max unit block size */
+#define	CNFS_READAHEAD		16384	/* Read with the article header */
+#define	CNFS_PREFETCH_SIZE	65536	/* Read ahead for SMPREFETCH */
+#define	CNFS_SCANCHUNK		(4 * 1024 * 1024) /* Read at once by SMnext */
+#define	CNFS_SCANMARGIN		((off_t) 64 * 1024 * 1024) /* ...not that
+						   close ahead of free */
+#define	CNFS_SCANSLICE		((off_t) 1024 * 1024 * 1024) /* Shared out
+						   by SM_PARTITION */
 
 /* Amount of data stored at beginning of CYCBUFF before the bitfield */
 #define	CNFS_BEFOREBITF		512	/* Rounded up to CNFS_HDR_PAGESIZE */
 
 struct metacycbuff;		/* Definition comes below */
+struct cnfswriter;		/* Writer thread, private to cnfs.c */
 
 #define	CNFSMAXCYCBUFFNAME	8
 #define	CNFSMASIZ	8
@@ -57,6 +65,16 @@ typedef struct _CYCBUFF {
   bool		currentbuff;	/* true if this cycbuff is currently used */
   char		metaname[CNFSNASIZ];/* Symbolic name of meta */
   int		order;		/* Order in meta, start from 1 not 0 */
+  char		*wbuf;		/* Articles not yet written, or NULL */
+  size_t	wsize;		/* Size of wbuf */
+  off_t		wstart;		/* Offset of the first of them */
+  size_t	wlen;		/* Bytes used in wbuf */
+  time_t	wtime;		/* When the first of them was stored */
+  struct cnfswriter *writer;	/* Writer thread for STRIPE, or NULL */
+  unsigned char	*dirty;		/* One bit per page of the bitfield mapping
+				   changed since last written back, or NULL
+				   if read only */
+  time_t	bflushed;	/* When the bitfield was last written back */
 } CYCBUFF;
 
 /*
@@ -79,8 +97,9 @@ typedef struct {
 
 #define METACYCBUFF_UPDATE	25
 #define REFRESH_INTERVAL	30
+#define BITFIELD_FLUSH		0
 
-typedef enum {INTERLEAVE, SEQUENTIAL} METAMODE;
+typedef enum {INTERLEAVE, SEQUENTIAL, STRIPE} METAMODE;
 
 typedef struct metacycbuff {
   char		*name;		/* Symbolic name of the pool */
@@ -102,6 +121,8 @@ typedef struct {
   long		size;		/* Size of the article */
   time_t	arrived;	/* This is the time when article arrived */
   STORAGECLASS	class;		/* storage class */
+  uint16_t	headsize;	/* Bytes up to the body, or 0 if unknown;
+				   fits in what used to be padding */
 } CNFSARTHEADER;
 
 /* uncomment below for old cnfs spool */
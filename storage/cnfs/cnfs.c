@@ -20,6 +20,11 @@
 #endif
 #include <time.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+# include <signal.h>
+#endif
+
 #include "inn/fdflag.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
@@ -55,16 +60,68 @@ typedef struct {
     CYCBUFF		*cycbuff;	/* pointer to current CYCBUFF */
     off_t               offset;		/* offset to current article */
     bool		rollover;	/* true if the search is rollovered */
+    off_t		baseoffset;	/* offset of base in the cycbuff, or
+					   -1 if unknown */
+    bool		mapped;		/* base was mmap()ed, not allocated */
 } PRIV_CNFS;
 
+#ifdef HAVE_PTHREAD
+/* The writer thread of a cycbuff in a STRIPE metacycbuff.  Only the main
+   thread changes buf, size, offset and len, and only while the writer
+   isn't pending; the rest is protected by lock. */
+struct cnfswriter {
+    pthread_t		thread;
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;		/* Signaled on any change */
+    char		*buf;		/* Articles handed to the writer */
+    size_t		size;		/* Size of buf */
+    off_t		offset;		/* Where they are written */
+    size_t		len;		/* Their length, 0 once collected */
+    bool		pending;	/* Not written yet */
+    bool		failed;		/* Write failed with errnum */
+    int			errnum;
+    bool		shutdown;	/* Writer should exit */
+};
+
+/* Writer threads mark the articles they've written in the bitfield, so
+   every change to a bitfield is made with this lock held. */
+static pthread_mutex_t	bitfield_lock = PTHREAD_MUTEX_INITIALIZER;
+# define CNFSlockbitfield()	pthread_mutex_lock(&bitfield_lock)
+# define CNFSunlockbitfield()	pthread_mutex_unlock(&bitfield_lock)
+#else
+# define CNFSlockbitfield()	/* empty */
+# define CNFSunlockbitfield()	/* empty */
+#endif
+
 static CYCBUFF		*cycbufftab = (CYCBUFF *)NULL;
 static METACYCBUFF 	*metacycbufftab = (METACYCBUFF *)NULL;
 static CNFSEXPIRERULES	*metaexprulestab = (CNFSEXPIRERULES *)NULL;
 static long		pagesize = 0;
 static int		metabuff_update = METACYCBUFF_UPDATE;
 static int		refresh_interval = REFRESH_INTERVAL;
+static int		bitfield_flush = BITFIELD_FLUSH;
+static char		artahead[CNFS_READAHEAD];
+
+/* The chunk of a cycbuff cnfs_next last read. */
+static struct {
+    CYCBUFF		*cycbuff;	/* NULL if none */
+    off_t		start;
+    size_t		len;
+    char		*data;
+} scanchunk;
+
+/* While cnfs_storebatch is storing a batch, the size of the write buffers,
+   so that the articles of the batch are written out together even if
+   cnfswritebuffer is smaller.  0 otherwise. */
+static size_t		batchbuffer = 0;
+#define CNFS_BATCHBUFFER	(1024 * 1024)
 
 static CYCBUFF          *CNFSgetcycbuffbyname(char *name);
+static bool             CNFSsyncwrite(CYCBUFF *cycbuff);
+#ifdef HAVE_PTHREAD
+static void             CNFSstartwriter(CYCBUFF *cycbuff);
+static void             CNFSstopwriter(CYCBUFF *cycbuff);
+#endif
 
 
 /*
@@ -221,6 +278,64 @@ static off_t CNFShex2offt(char *hex) {
     }
 }
 
+/*
+**  Note that the len bytes of the bitfield mapping at p have changed, so
+**  that the pages holding them are written back by the next
+**  CNFSflushbitfield.  Must be called with the bitfield lock held.
+*/
+static void
+CNFSdirtybitfield(CYCBUFF *cycbuff, const void *p, size_t len)
+{
+    size_t	page, last;
+
+    if (cycbuff->dirty == NULL || len == 0)
+	return;
+    page = ((const char *) p - (const char *) cycbuff->bitfield) / pagesize;
+    last = ((const char *) p + len - 1 - (const char *) cycbuff->bitfield)
+	   / pagesize;
+    for (; page <= last; page++)
+	cycbuff->dirty[page / 8] |= 1 << (page % 8);
+}
+
+/*
+**  Start writing back the pages of the bitfield mapping changed since they
+**  were last written, one run of consecutive pages at a time.  Unless all
+**  is true, only the first page, holding the cycbuff header, is written if
+**  the bitfield was written back less than bitfieldflush seconds ago, so
+**  that frequent header updates don't each write out a large bitfield.
+*/
+static void
+CNFSflushbitfield(CYCBUFF *cycbuff, bool all)
+{
+    size_t	pages, first, end;
+    time_t	now;
+
+    if (cycbuff->dirty == NULL)
+	return;
+    pages = cycbuff->minartoffset / pagesize;
+    now = time(NULL);
+    if (!all && now - cycbuff->bflushed < (time_t) bitfield_flush)
+	pages = 1;
+    else
+	cycbuff->bflushed = now;
+    for (first = 0; first < pages; first = end) {
+	CNFSlockbitfield();
+	while (first < pages && cycbuff->dirty[first / 8] == 0
+	       && first % 8 == 0)
+	    first += 8;
+	while (first < pages
+	       && (cycbuff->dirty[first / 8] & (1 << (first % 8))) == 0)
+	    first++;
+	for (end = first; end < pages
+	     && (cycbuff->dirty[end / 8] & (1 << (end % 8))) != 0; end++)
+	    cycbuff->dirty[end / 8] &= ~(1 << (end % 8));
+	CNFSunlockbitfield();
+	if (end > first)
+	    msync((char *) cycbuff->bitfield + first * pagesize,
+		  (end - first) * pagesize, MS_ASYNC);
+    }
+}
+
 static bool CNFSflushhead(CYCBUFF *cycbuff) {
   CYCBUFFEXTERN		rpx;
 
@@ -260,7 +375,14 @@ static bool CNFSflushhead(CYCBUFF *cycbuff) {
 # pragma GCC diagnostic warning "-Wstringop-truncation"
 #endif
     memcpy(cycbuff->bitfield, &rpx, sizeof(CYCBUFFEXTERN));
-    msync(cycbuff->bitfield, cycbuff->minartoffset, MS_ASYNC);
+    if (cycbuff->dirty == NULL)
+	msync(cycbuff->bitfield, cycbuff->minartoffset, MS_ASYNC);
+    else {
+	CNFSlockbitfield();
+	CNFSdirtybitfield(cycbuff, cycbuff->bitfield, sizeof(CYCBUFFEXTERN));
+	CNFSunlockbitfield();
+	CNFSflushbitfield(cycbuff, false);
+    }
     cycbuff->needflush = false;
   } else {
     warn("CNFS: CNFSflushhead: bogus magicver for %s: %d", cycbuff->name,
@@ -273,14 +395,24 @@ static bool CNFSflushhead(CYCBUFF *cycbuff) {
 static void CNFSshutdowncycbuff(CYCBUFF *cycbuff) {
     if (cycbuff == (CYCBUFF *)NULL)
 	return;
+    CNFSsyncwrite(cycbuff);
+#ifdef HAVE_PTHREAD
+    CNFSstopwriter(cycbuff);
+#endif
+    free(cycbuff->wbuf);
+    cycbuff->wbuf = NULL;
+    cycbuff->wsize = 0;
     if (cycbuff->needflush) {
         notice("CNFS: CNFSshutdowncycbuff: flushing %s", cycbuff->name);
 	CNFSflushhead(cycbuff);
     }
     if (cycbuff->bitfield != NULL) {
+	CNFSflushbitfield(cycbuff, true);
 	munmap(cycbuff->bitfield, cycbuff->minartoffset);
 	cycbuff->bitfield = NULL;
     }
+    free(cycbuff->dirty);
+    cycbuff->dirty = NULL;
     if (cycbuff->fd >= 0)
 	close(cycbuff->fd);
     cycbuff->fd = -1;
@@ -289,6 +421,10 @@ static void CNFSshutdowncycbuff(CYCBUFF *cycbuff) {
 static void CNFScleancycbuff(void) {
     CYCBUFF	*cycbuff, *nextcycbuff;
 
+    free(scanchunk.data);
+    scanchunk.data = NULL;
+    scanchunk.cycbuff = NULL;
+
     for (cycbuff = cycbufftab; cycbuff != (CYCBUFF *)NULL;) {
       CNFSshutdowncycbuff(cycbuff);
       nextcycbuff = cycbuff->next;
@@ -438,6 +574,12 @@ static bool CNFSparse_part_line(char *l) {
   cycbuff->needflush = false;
   cycbuff->bitfield = NULL;
   cycbuff->minartoffset = 0;
+  cycbuff->wbuf = NULL;
+  cycbuff->wsize = 0;
+  cycbuff->wlen = 0;
+  cycbuff->writer = NULL;
+  cycbuff->dirty = NULL;
+  cycbuff->bflushed = 0;
   if (cycbufftab == (CYCBUFF *)NULL)
     cycbufftab = cycbuff;
   else {
@@ -481,7 +623,15 @@ static bool CNFSparse_metapart_line(char *l) {
 	metacycbuff->metamode = INTERLEAVE;
       else if (strcmp(p, "SEQUENTIAL") == 0)
 	metacycbuff->metamode = SEQUENTIAL;
-      else {
+      else if (strcmp(p, "STRIPE") == 0) {
+#ifdef HAVE_PTHREAD
+	metacycbuff->metamode = STRIPE;
+#else
+        warn("CNFS: STRIPE needs thread support, using INTERLEAVE for"
+             " metacycbuff '%s'", metacycbuff->name);
+	metacycbuff->metamode = INTERLEAVE;
+#endif
+      } else {
         warn("CNFS: unknown mode in line '%s'", q);
 	return false;
       }
@@ -718,6 +868,10 @@ static bool CNFSinit_disks(CYCBUFF *cycbuff) {
       cycbuff->bitfield = NULL;
       return false;
     }
+    if (SMopenmode && cycbuff->dirty == NULL) {
+	cycbuff->dirty = xcalloc(cycbuff->minartoffset / pagesize / 8 + 1, 1);
+	cycbuff->bflushed = time(NULL);
+    }
 
     if (cycbuff->free == 0)
       cycbuff->free = cycbuff->minartoffset;
@@ -802,7 +956,8 @@ static bool CNFSread_config(void) {
     bool	metacycbufffound = false;
     bool	cycbuffupdatefound = false;
     bool	refreshintervalfound = false;
-    int		update, refresh;
+    bool	bitfieldflushfound = false;
+    int		update, refresh, flush;
 
     path = concatpath(innconf->pathetc, _PATH_CYCBUFFCONFIG);
     config = ReadInFile(path, NULL);
@@ -908,6 +1063,22 @@ static bool CNFSread_config(void) {
 		refresh_interval = REFRESH_INTERVAL;
 	    else
 		refresh_interval = refresh;
+	} else if (strncmp(ctab[ctab_i], "bitfieldflush:", 14) == 0) {
+	    if (bitfieldflushfound) {
+                warn("CNFS: duplicate bitfieldflush entries");
+		free(config);
+		free(ctab);
+		return false;
+	    }
+	    bitfieldflushfound = true;
+	    flush = atoi(ctab[ctab_i] + 14);
+	    if (flush < 0) {
+                warn("CNFS: invalid bitfieldflush");
+		free(config);
+		free(ctab);
+		return false;
+	    }
+	    bitfield_flush = flush;
 	} else {
             warn("CNFS: bogus metacycbuff config line '%s' ignored",
                  ctab[ctab_i]);
@@ -959,39 +1130,49 @@ cnfs_mapcntl(void *p, size_t length, int flags)
 }
 
 /*
-**	Bit arithmetic by brute force.
+**	Bit arithmetic on the bitfield, one long at a time.  The bit of a
+**	block is counted from the 'left' side of its long, so that the first
+**	used block in a long is given by its leading zeros.
 **
 **	XXXYYYXXX WARNING: the code below is not endian-neutral!
 */
 
 typedef unsigned long	ULONG;
 
+#define CNFS_LONGBITS	((int) sizeof(ULONG) * 8)
+#define CNFS_BIT(b)	((ULONG) 1 << (CNFS_LONGBITS - 1 - (b)))
+
+/* Empty longs are skipped this many at a time, a cache line on most
+   machines. */
+#define CNFS_SKIPLONGS	8
+
+static ULONG *
+CNFSbitlongs(CYCBUFF *cycbuff)
+{
+    return (ULONG *) cycbuff->bitfield + CNFS_BEFOREBITF / sizeof(ULONG);
+}
+
+/* The position of the leftmost bit set in a long, which must not be 0. */
+static int
+CNFSfirstbit(ULONG bitlong)
+{
+#if defined(__GNUC__)
+    return __builtin_clzl(bitlong);
+#else
+    int i;
+
+    for (i = 0; (bitlong & CNFS_BIT(i)) == 0; i++)
+	;
+    return i;
+#endif
+}
+
 static int CNFSUsedBlock(CYCBUFF *cycbuff, off_t offset,
 	      bool set_operation, bool setbitvalue) {
     off_t               blocknum;
-    off_t               longoffset;
-    int			bitoffset;	/* From the 'left' side of the long */
-    static int		uninitialized = 1;
-    static int		longsize = sizeof(long);
-    int	i;
-    ULONG		bitlong, on, off, mask;
-    static ULONG	onarray[64], offarray[64];
+    ULONG		mask;
     ULONG		*where;
 
-    if (uninitialized) {
-	on = 1;
-	off = on;
-	off ^= ULONG_MAX;
-	for (i = (longsize * 8) - 1; i >= 0; i--) {
-	    onarray[i] = on;
-	    offarray[i] = off;
-	    on <<= 1;
-	    off = on;
-	    off ^= ULONG_MAX;
-	}
-	uninitialized = 0;
-    }
-
     /* We allow bit-setting under minartoffset, but it better be false */
     if ((offset < cycbuff->minartoffset && setbitvalue) ||
 	offset > cycbuff->len) {
@@ -1012,33 +1193,102 @@ static int CNFSUsedBlock(CYCBUFF *cycbuff, off_t offset,
 	return 0;
     }
     blocknum = offset / cycbuff->blksz;
-    longoffset = blocknum / (longsize * 8);
-    bitoffset = blocknum % (longsize * 8);
-    where = (ULONG *)cycbuff->bitfield + (CNFS_BEFOREBITF / longsize)
-	+ longoffset;
-    bitlong = *where;
+    where = CNFSbitlongs(cycbuff) + blocknum / CNFS_LONGBITS;
+    mask = CNFS_BIT(blocknum % CNFS_LONGBITS);
     if (set_operation) {
-	if (setbitvalue) {
-	    mask = onarray[bitoffset];
-	    bitlong |= mask;
-	} else {
-	    mask = offarray[bitoffset];
-	    bitlong &= mask;
-	}
-	*where = bitlong;
+	if (setbitvalue)
+	    *where |= mask;
+	else
+	    *where &= ~mask;
+	CNFSdirtybitfield(cycbuff, where, sizeof *where);
 	if (innconf->nfswriter) {
 	    cnfs_mapcntl(where, sizeof *where, MS_ASYNC);
 	}
 	return 2;	/* XXX Clean up return semantics */
     }
     /* It's a read operation */
-    mask = onarray[bitoffset];
+    return (*where & mask) ? 1 : 0;
+}
 
 /*
- * return bitlong & mask; doesn't work if sizeof(ulong) > sizeof(int)
- */
-    if ( bitlong & mask ) return 1; else return 0;
+**  Clear the bits of all the blocks from offset up to limit, a whole long
+**  at a time where possible.  Both must be on a block boundary.
+*/
+static void
+CNFSclearblocks(CYCBUFF *cycbuff, off_t offset, off_t limit)
+{
+    off_t		first, end, i, last;
+    ULONG		*bitlongs;
+
+    if (offset >= limit)
+	return;
+    if (offset < cycbuff->minartoffset || limit > cycbuff->len
+	|| offset % cycbuff->blksz != 0 || limit % cycbuff->blksz != 0) {
+	for (; offset < limit; offset += cycbuff->blksz)
+	    CNFSUsedBlock(cycbuff, offset, true, false);
+	return;
+    }
+    bitlongs = CNFSbitlongs(cycbuff);
+    first = offset / cycbuff->blksz;
+    end = limit / cycbuff->blksz;
+    i = first / CNFS_LONGBITS;
+    last = (end - 1) / CNFS_LONGBITS;
+    if (i == last) {
+	bitlongs[i] &= ~((ULONG_MAX >> (first % CNFS_LONGBITS))
+			 & ~(ULONG_MAX >> 1 >> ((end - 1) % CNFS_LONGBITS)));
+    } else {
+	bitlongs[i] &= ~(ULONG_MAX >> (first % CNFS_LONGBITS));
+	memset(&bitlongs[i + 1], 0, (last - i - 1) * sizeof(ULONG));
+	bitlongs[last] &= ULONG_MAX >> 1 >> ((end - 1) % CNFS_LONGBITS);
+    }
+    CNFSdirtybitfield(cycbuff, &bitlongs[i], (last - i + 1) * sizeof(ULONG));
+    if (innconf->nfswriter)
+	cnfs_mapcntl(&bitlongs[i], (last - i + 1) * sizeof(ULONG), MS_ASYNC);
+}
 
+/*
+**  Find the first used block from offset on, looking at whole longs of the
+**  bitfield at a time and skipping runs of empty ones, rather than testing
+**  each block in turn.  If there is none before limit, returns the offset
+**  of the first block at or after limit (or offset itself if it's already
+**  past limit), which is where walking the blocks one by one would stop.
+*/
+static off_t
+CNFSnextusedblock(CYCBUFF *cycbuff, off_t offset, off_t limit)
+{
+    off_t		block, end, i, last;
+    ULONG		*bitlongs, bitlong;
+    int			j;
+
+    if (offset >= limit)
+	return offset;
+    bitlongs = CNFSbitlongs(cycbuff);
+    block = (offset + cycbuff->blksz - 1) / cycbuff->blksz;
+    end = (limit + cycbuff->blksz - 1) / cycbuff->blksz;
+    if (end > cycbuff->len / cycbuff->blksz)
+	end = cycbuff->len / cycbuff->blksz;
+    if (block >= end)
+	return end * cycbuff->blksz;
+    i = block / CNFS_LONGBITS;
+    last = (end - 1) / CNFS_LONGBITS;
+    bitlong = bitlongs[i] & (ULONG_MAX >> (block % CNFS_LONGBITS));
+    while (bitlong == 0) {
+	if (++i > last)
+	    return end * cycbuff->blksz;
+	while (i + CNFS_SKIPLONGS <= last) {
+	    bitlong = 0;
+	    for (j = 0; j < CNFS_SKIPLONGS; j++)
+		bitlong |= bitlongs[i + j];
+	    if (bitlong != 0)
+		break;
+	    i += CNFS_SKIPLONGS;
+	}
+	bitlong = bitlongs[i];
+    }
+    block = i * CNFS_LONGBITS + CNFSfirstbit(bitlong);
+    if (block >= end)
+	return end * cycbuff->blksz;
+    return block * cycbuff->blksz;
 }
 
 static int CNFSArtMayBeHere(CYCBUFF *cycbuff, off_t offset, uint32_t cycnum) {
@@ -1135,6 +1385,16 @@ bool cnfs_init(SMATTRIBUTE *attr) {
 	  SMseterror(SMERR_INTERNAL, NULL);
 	  return false;
 	}
+#ifdef HAVE_PTHREAD
+      /* Only worth it for a writer that keeps its cycbuffs open. */
+      if (metacycbuff->metamode == STRIPE && SMpreopen && SMopenmode) {
+	int i;
+
+	for (i = 0; i < metacycbuff->count; i++)
+	  if (metacycbuff->members[i]->writer == NULL)
+	    CNFSstartwriter(metacycbuff->members[i]);
+      }
+#endif
     }
     if (!SMpreopen) {
       for (cycbuff = cycbufftab; cycbuff != (CYCBUFF *)NULL; cycbuff = cycbuff->next) {
@@ -1144,6 +1404,471 @@ bool cnfs_init(SMATTRIBUTE *attr) {
     return true;
 }
 
+/*
+**  Write an article at offset, with a single system call where pwritev is
+**  available.  Falls back on lseek and xwritev for whatever pwritev didn't
+**  write (or when it can't take that many iovecs).  Returns false on
+**  failure.
+*/
+static bool
+CNFSwritev(int fd, struct iovec *iov, int iovcnt, size_t totlen,
+	   off_t offset)
+{
+    size_t done = 0;
+
+#ifdef HAVE_PWRITEV
+    ssize_t status;
+
+    status = pwritev(fd, iov, iovcnt, offset);
+    if (status == (ssize_t) totlen)
+	return true;
+    if (status < 0 && errno != EINTR && errno != EINVAL)
+	return false;
+    if (status > 0)
+	done = status;
+    while (iovcnt > 0 && done >= iov->iov_len) {
+	done -= iov->iov_len;
+	offset += iov->iov_len;
+	iov++;
+	iovcnt--;
+    }
+    if (iovcnt == 0)
+	return true;
+    iov->iov_base = (char *) iov->iov_base + done;
+    iov->iov_len -= done;
+    offset += done;
+#endif
+    if (lseek(fd, offset, SEEK_SET) < 0)
+	return false;
+    return xwritev(fd, iov, iovcnt) >= 0;
+}
+
+/*
+**  Whether offset falls in the range of len bytes starting at start.
+*/
+static bool
+CNFSinrange(off_t offset, off_t start, size_t len)
+{
+    return len > 0 && offset >= start && offset < start + (off_t) len;
+}
+
+/*
+**  Whether the article at offset is still in the cycbuff's write buffer, or
+**  being written out by its writer thread.
+*/
+static bool
+CNFSinwbuf(CYCBUFF *cycbuff, off_t offset)
+{
+    if (CNFSinrange(offset, cycbuff->wstart, cycbuff->wlen))
+	return true;
+#ifdef HAVE_PTHREAD
+    if (cycbuff->writer != NULL
+	&& CNFSinrange(offset, cycbuff->writer->offset, cycbuff->writer->len))
+	return true;
+#endif
+    return false;
+}
+
+/*
+**  Mark in the bitfield the articles in the len bytes of buf, which have
+**  just been written at offset.  They are only marked once they are on
+**  disk, so that other processes never find an article that isn't there
+**  yet.  Must be called with the bitfield lock held.
+*/
+static void
+CNFSmarkwritten(CYCBUFF *cycbuff, const char *buf, off_t offset, size_t len)
+{
+    CNFSARTHEADER	cah;
+    size_t		done, artlen;
+
+    for (done = 0; done < len; done += artlen) {
+	memcpy(&cah, buf + done, sizeof(cah));
+	CNFSUsedBlock(cycbuff, offset + done, true, true);
+	artlen = sizeof(cah) + ntohl(cah.size);
+	artlen = (artlen + cycbuff->blksz - 1) & ~((size_t) cycbuff->blksz - 1);
+    }
+    if (innconf->nfswriter)
+	cnfs_mapcntl(NULL, 0, MS_ASYNC);
+}
+
+#ifdef HAVE_PTHREAD
+/*
+**  The writer thread of a cycbuff in a STRIPE metacycbuff.  Writes out
+**  whatever write buffer the main thread hands it, so that the main thread
+**  can go on storing articles into the other members meanwhile.
+*/
+static void *
+CNFSwriter(void *arg)
+{
+    CYCBUFF		*cycbuff = arg;
+    struct cnfswriter	*writer = cycbuff->writer;
+    struct iovec	iov;
+    sigset_t		set;
+    bool		status;
+
+    /* All signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->shutdown) {
+	if (!writer->pending) {
+	    pthread_cond_wait(&writer->cond, &writer->lock);
+	    continue;
+	}
+	iov.iov_base = writer->buf;
+	iov.iov_len = writer->len;
+	pthread_mutex_unlock(&writer->lock);
+	status = CNFSwritev(cycbuff->fd, &iov, 1, iov.iov_len,
+			    writer->offset);
+	if (status) {
+	    CNFSlockbitfield();
+	    CNFSmarkwritten(cycbuff, writer->buf, writer->offset, writer->len);
+	    CNFSunlockbitfield();
+	}
+	pthread_mutex_lock(&writer->lock);
+	writer->failed = !status;
+	writer->errnum = status ? 0 : errno;
+	writer->pending = false;
+	pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/*
+**  Start the writer thread of a cycbuff.  On failure, the cycbuff is just
+**  written to synchronously.
+*/
+static void
+CNFSstartwriter(CYCBUFF *cycbuff)
+{
+    struct cnfswriter	*writer;
+    int			status;
+
+    writer = xcalloc(1, sizeof(struct cnfswriter));
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    cycbuff->writer = writer;
+    status = pthread_create(&writer->thread, NULL, CNFSwriter, cycbuff);
+    if (status != 0) {
+	errno = status;
+	syswarn("CNFS: cannot start writer thread for '%s'", cycbuff->name);
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->lock);
+	free(writer);
+	cycbuff->writer = NULL;
+    }
+}
+
+/*
+**  Collect the result of the write handed to the writer thread of the
+**  cycbuff, if any, waiting for it to complete if wait is true.  Returns
+**  false if it failed, in which case the articles are lost.
+*/
+static bool
+CNFSreapwrite(CYCBUFF *cycbuff, bool wait)
+{
+    struct cnfswriter	*writer = cycbuff->writer;
+    bool		status = true;
+
+    if (writer == NULL || writer->len == 0)
+	return true;
+    pthread_mutex_lock(&writer->lock);
+    while (wait && writer->pending)
+	pthread_cond_wait(&writer->cond, &writer->lock);
+    if (!writer->pending) {
+	if (writer->failed) {
+	    errno = writer->errnum;
+	    syswarn("CNFS: cannot write %lu buffered bytes to '%s' offset 0x%s",
+		    (unsigned long) writer->len, cycbuff->name,
+		    CNFSofft2hex(writer->offset, false));
+	    status = false;
+	}
+	writer->len = 0;
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return status;
+}
+
+/*
+**  Stop the writer thread of a cycbuff, once it has written out everything.
+*/
+static void
+CNFSstopwriter(CYCBUFF *cycbuff)
+{
+    struct cnfswriter	*writer = cycbuff->writer;
+
+    if (writer == NULL)
+	return;
+    CNFSreapwrite(cycbuff, true);
+    pthread_mutex_lock(&writer->lock);
+    writer->shutdown = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->buf);
+    free(writer);
+    cycbuff->writer = NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/*
+**  Write out the articles gathered in the cycbuff's write buffer with a
+**  single write.  If the cycbuff has a writer thread, hand the buffer over
+**  to it instead (after waiting for its previous write) and return without
+**  waiting.  Returns false on failure, in which case the articles are lost.
+*/
+static bool
+CNFSflushwrite(CYCBUFF *cycbuff)
+{
+    struct iovec	iov;
+    bool		status;
+
+    if (cycbuff->wlen == 0)
+	return true;
+#ifdef HAVE_PTHREAD
+    if (cycbuff->writer != NULL) {
+	struct cnfswriter	*writer = cycbuff->writer;
+	char			*buf;
+	size_t			size;
+
+	status = CNFSreapwrite(cycbuff, true);
+	buf = writer->buf;
+	size = writer->size;
+	pthread_mutex_lock(&writer->lock);
+	writer->buf = cycbuff->wbuf;
+	writer->size = cycbuff->wsize;
+	writer->offset = cycbuff->wstart;
+	writer->len = cycbuff->wlen;
+	writer->pending = true;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->lock);
+	cycbuff->wbuf = buf;
+	cycbuff->wsize = size;
+	cycbuff->wlen = 0;
+	return status;
+    }
+#endif
+    iov.iov_base = cycbuff->wbuf;
+    iov.iov_len = cycbuff->wlen;
+    status = CNFSwritev(cycbuff->fd, &iov, 1, cycbuff->wlen, cycbuff->wstart);
+    if (!status)
+	syswarn("CNFS: cannot write %lu buffered bytes to '%s' offset 0x%s",
+		(unsigned long) cycbuff->wlen, cycbuff->name,
+		CNFSofft2hex(cycbuff->wstart, false));
+    else {
+	CNFSlockbitfield();
+	CNFSmarkwritten(cycbuff, cycbuff->wbuf, cycbuff->wstart,
+			cycbuff->wlen);
+	CNFSunlockbitfield();
+    }
+    cycbuff->wlen = 0;
+    return status;
+}
+
+/*
+**  Like CNFSflushwrite, but also wait for the writer thread, so that all
+**  the articles stored in the cycbuff are on disk when it returns.
+*/
+static bool
+CNFSsyncwrite(CYCBUFF *cycbuff)
+{
+    bool status;
+
+    status = CNFSflushwrite(cycbuff);
+#ifdef HAVE_PTHREAD
+    if (!CNFSreapwrite(cycbuff, true))
+	status = false;
+#endif
+    return status;
+}
+
+/*
+**  Write out the write buffers of all cycbuffs and wait for them, or if
+**  expired is true, only start writing out those in which an article has
+**  waited for cnfswritedelay seconds and collect the writes that are done.
+*/
+static void
+CNFSflushallwrites(bool expired)
+{
+    CYCBUFF	*cycbuff;
+    time_t	now;
+
+    now = time(NULL);
+    for (cycbuff = cycbufftab; cycbuff != NULL; cycbuff = cycbuff->next) {
+	if (!expired)
+	    CNFSsyncwrite(cycbuff);
+	else {
+	    if (cycbuff->wlen > 0
+		&& now - cycbuff->wtime >= (time_t) innconf->cnfswritedelay)
+		CNFSflushwrite(cycbuff);
+#ifdef HAVE_PTHREAD
+	    CNFSreapwrite(cycbuff, false);
+#endif
+	}
+    }
+}
+
+/*
+**  Write an article at offset.  If cnfswritebuffer is set and the cycbuffs
+**  are kept open, append it to the cycbuff's write buffer instead when it
+**  fits there, first writing out the articles already in the buffer if it
+**  doesn't directly follow them.  All articles are multiples of the block
+**  size, so the buffer is written out in large aligned chunks.  A cycbuff
+**  with a writer thread always goes through the buffer, which is handed
+**  over to the thread after each article if cnfswritebuffer isn't set.
+**  Returns false on failure.
+*/
+static bool
+CNFSwrite(CYCBUFF *cycbuff, struct iovec *iov, int iovcnt, size_t totlen,
+	  off_t offset)
+{
+    size_t	size;
+    int		i;
+
+    size = innconf->cnfswritebuffer * 1024;
+    if (size < batchbuffer)
+	size = batchbuffer;
+#ifdef HAVE_PTHREAD
+    if (cycbuff->writer != NULL && size < totlen)
+	size = totlen;
+#endif
+    if (size == 0 || !SMpreopen || totlen > size) {
+	CNFSflushwrite(cycbuff);
+	return CNFSwritev(cycbuff->fd, iov, iovcnt, totlen, offset);
+    }
+    if (cycbuff->wlen > 0
+	&& (cycbuff->wstart + (off_t) cycbuff->wlen != offset
+	    || cycbuff->wlen + totlen > cycbuff->wsize))
+	CNFSflushwrite(cycbuff);
+    if (cycbuff->wsize < size) {
+	cycbuff->wbuf = xrealloc(cycbuff->wbuf, size);
+	cycbuff->wsize = size;
+    }
+    if (cycbuff->wlen == 0) {
+	cycbuff->wstart = offset;
+	cycbuff->wtime = time(NULL);
+    }
+    for (i = 0; i < iovcnt; i++) {
+	memcpy(cycbuff->wbuf + cycbuff->wlen, iov[i].iov_base, iov[i].iov_len);
+	cycbuff->wlen += iov[i].iov_len;
+    }
+    if ((innconf->cnfswritebuffer == 0 && batchbuffer == 0)
+	|| cycbuff->wsize - cycbuff->wlen < (size_t) cycbuff->blksz)
+	return CNFSflushwrite(cycbuff);
+    return true;
+}
+
+#ifdef HAVE_PTHREAD
+/*
+**  Pick the member of a STRIPE metacycbuff to store the next article into:
+**  the first one, in round-robin order, whose writer thread has nothing
+**  being written, or else the one with the least data being written.
+*/
+static int
+CNFSleastbusy(METACYCBUFF *metacycbuff)
+{
+    CYCBUFF	*cycbuff;
+    int		i, n, best;
+    size_t	busy, least = 0;
+
+    best = metacycbuff->memb_next;
+    for (i = 0; i < metacycbuff->count; i++) {
+	n = (metacycbuff->memb_next + i) % metacycbuff->count;
+	cycbuff = metacycbuff->members[n];
+	busy = 0;
+	if (cycbuff->writer != NULL) {
+	    CNFSreapwrite(cycbuff, false);
+	    busy = cycbuff->writer->len;
+	}
+	if (busy == 0)
+	    return n;
+	if (i == 0 || busy < least) {
+	    best = n;
+	    least = busy;
+	}
+    }
+    return best;
+}
+#endif
+
+/*
+**  pread() from the cycbuff, taking what is still in its write buffer or
+**  being written out by its writer thread from there.
+*/
+static ssize_t
+CNFSpread(CYCBUFF *cycbuff, void *buf, size_t len, off_t offset)
+{
+    const char	*from;
+    off_t	start;
+    size_t	have;
+
+    if (CNFSinrange(offset, cycbuff->wstart, cycbuff->wlen)) {
+	from = cycbuff->wbuf;
+	start = cycbuff->wstart;
+	have = cycbuff->wlen;
+    }
+#ifdef HAVE_PTHREAD
+    else if (cycbuff->writer != NULL
+	     && CNFSinrange(offset, cycbuff->writer->offset,
+			    cycbuff->writer->len)) {
+	from = cycbuff->writer->buf;
+	start = cycbuff->writer->offset;
+	have = cycbuff->writer->len;
+    }
+#endif
+    else
+	return pread(cycbuff->fd, buf, len, offset);
+    have -= offset - start;
+    if (len > have)
+	len = have;
+    memcpy(buf, from + (offset - start), len);
+    return len;
+}
+
+/*
+**  Return the length of the headers of an article to be stored, up to and
+**  including the empty line before its body, or 0 if there is no body or
+**  the headers are too long to be recorded.  The article may be split
+**  anywhere between its iovecs, so the end of the headers is matched one
+**  character of "\r\n\r\n" at a time; starting halfway through it finds
+**  the empty line of an article without headers.
+*/
+static uint16_t
+CNFSheadsize(const ARTHANDLE *article)
+{
+    const char	*p, *end, *cr;
+    size_t	seen = 0, matched = 2;
+    int		i;
+
+    for (i = 0; i < article->iovcnt && seen < 0xFFFF; i++) {
+	p = article->iov[i].iov_base;
+	end = p + article->iov[i].iov_len;
+	while (p < end) {
+	    if (matched == 0) {
+		cr = memchr(p, '\r', end - p);
+		if (cr == NULL)
+		    break;
+		p = cr;
+	    }
+	    if (*p == "\r\n\r\n"[matched])
+		matched++;
+	    else
+		matched = (*p == '\r') ? 1 : 0;
+	    p++;
+	    if (matched == 4) {
+		seen += p - (const char *) article->iov[i].iov_base;
+		return (seen <= 0xFFFF) ? seen : 0;
+	    }
+	}
+	seen += article->iov[i].iov_len;
+    }
+    return 0;
+}
+
 TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
     TOKEN               token;
     CYCBUFF		*cycbuff = NULL;
@@ -1175,6 +1900,10 @@ TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
     }
     metacycbuff = metaexprule->dest;
 
+#ifdef HAVE_PTHREAD
+    if (metacycbuff->metamode == STRIPE)
+	metacycbuff->memb_next = CNFSleastbusy(metacycbuff);
+#endif
     cycbuff = metacycbuff->members[metacycbuff->memb_next];
     if (cycbuff == NULL) {
 	SMseterror(SMERR_INTERNAL, "no cycbuff found");
@@ -1200,13 +1929,16 @@ TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
     else
         left = cycbuff->len - cycbuff->free - cycbuff->blksz - 1;
     if ((off_t) article.len > left) {
-	for (middle = cycbuff->free ;middle < cycbuff->len - cycbuff->blksz - 1;
-	    middle += cycbuff->blksz) {
-	    CNFSUsedBlock(cycbuff, middle, true, false);
-	}
+	CNFSlockbitfield();
+	/* Up to the first block at or after len - blksz - 1. */
+	middle = cycbuff->len - 2;
+	middle -= middle % cycbuff->blksz;
+	CNFSclearblocks(cycbuff, cycbuff->free, middle);
 	if (innconf->nfswriter) {
 	    cnfs_mapcntl(NULL, 0, MS_ASYNC);
 	}
+	CNFSunlockbitfield();
+	CNFSsyncwrite(cycbuff);
 	cycbuff->free = cycbuff->minartoffset;
 	cycbuff->cyclenum++;
 	if (cycbuff->magicver <= 3) {
@@ -1217,7 +1949,7 @@ TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
 	      cycbuff->cyclenum = 2;		/* cnfs_next() needs this */
 	}
 	cycbuff->needflush = true;
-	if (metacycbuff->metamode == INTERLEAVE) {
+	if (metacycbuff->metamode != SEQUENTIAL) {
 	  CNFSflushhead(cycbuff);		/* Flush, just for giggles */
           notice("CNFS: cycbuff %s rollover to cycle 0x%x... remain calm",
                  cycbuff->name, cycbuff->cyclenum);
@@ -1254,15 +1986,8 @@ TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
     else
 	cah.arrived = htonl(article.arrived);
     cah.class = class;
+    cah.headsize = htons(CNFSheadsize(&article));
 
-    if (lseek(cycbuff->fd, artoffset, SEEK_SET) < 0) {
-	SMseterror(SMERR_INTERNAL, "lseek failed");
-        syswarn("CNFS: lseek failed for '%s' offset 0x%s", cycbuff->name,
-                CNFSofft2hex(artoffset, false));
-	token.type = TOKEN_EMPTY;
-	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
-	return token;
-    }
     if (iovcnt == 0) {
 	iov = xmalloc((article.iovcnt + 2) * sizeof(struct iovec));
 	iovcnt = article.iovcnt + 2;
@@ -1286,7 +2011,16 @@ TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
 	totlen += iov[i].iov_len;
 	i++;
     }
-    if (xwritev(cycbuff->fd, iov, i) < 0) {
+
+    /* Clear the blocks the article overwrites before writing it.  When it
+       goes through the write buffer, its first block is only marked once
+       it is written out, possibly by a writer thread. */
+    CNFSlockbitfield();
+    middle = artoffset + (off_t) totlen + cycbuff->blksz - 1;
+    middle -= middle % cycbuff->blksz;
+    CNFSclearblocks(cycbuff, artoffset, middle);
+    CNFSunlockbitfield();
+    if (!CNFSwrite(cycbuff, iov, i, totlen, artoffset)) {
 	SMseterror(SMERR_INTERNAL, "cnfs_store() xwritev() failed");
         syswarn("CNFS: cnfs_store xwritev failed for '%s' offset 0x%s",
                 artcycbuffname, CNFSofft2hex(artoffset, false));
@@ -1303,26 +2037,115 @@ TOKEN cnfs_store(const ARTHANDLE article, const STORAGECLASS class) {
     ** If cycbuff->free > cycbuff->len, don't worry.  The next cnfs_store()
     ** will detect the situation & wrap around correctly.
     */
-    if (metacycbuff->metamode == INTERLEAVE)
+    if (metacycbuff->metamode != SEQUENTIAL)
       metacycbuff->memb_next = (metacycbuff->memb_next + 1) % metacycbuff->count;
     if (++metacycbuff->write_count % metabuff_update == 0) {
 	for (i = 0; i < metacycbuff->count; i++) {
 	    CNFSflushhead(metacycbuff->members[i]);
 	}
     }
-    CNFSUsedBlock(cycbuff, artoffset, true, true);
-    for (middle = artoffset + cycbuff->blksz; middle < cycbuff->free;
-	 middle += cycbuff->blksz) {
-	CNFSUsedBlock(cycbuff, middle, true, false);
-    }
+    CNFSlockbitfield();
+    if (!CNFSinwbuf(cycbuff, artoffset))
+	CNFSUsedBlock(cycbuff, artoffset, true, true);
     if (innconf->nfswriter) {
 	cnfs_mapcntl(NULL, 0, MS_ASYNC);
     }
-    if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
+    CNFSunlockbitfield();
+    if (!SMpreopen)
+	CNFSshutdowncycbuff(cycbuff);
+    else if (batchbuffer == 0)
+	CNFSflushallwrites(true);
     return CNFSMakeToken(artcycbuffname, artoffset,
 			cycbuff->blksz, artcyclenum, class);
 }
 
+/*
+**  Store a batch of articles.  When the cycbuffs are kept open, the articles
+**  are gathered in the write buffers of their cycbuffs, so that those
+**  stored one after the other in the same cycbuff are written out with a
+**  single system call at the end of the batch, and the buffers are only
+**  checked for writes to do once.
+*/
+bool cnfs_storebatch(struct sm_record *records, size_t count) {
+    CYCBUFF		*cycbuff;
+    size_t		i;
+    bool		success = true;
+
+    if (SMpreopen)
+	batchbuffer = CNFS_BATCHBUFFER;
+    for (i = 0; i < count; i++) {
+	records[i].token = cnfs_store(*records[i].article, records[i].class);
+	if (records[i].token.type == TOKEN_EMPTY)
+	    success = false;
+    }
+    if (batchbuffer != 0) {
+	batchbuffer = 0;
+	if (innconf->cnfswritebuffer == 0)
+	    for (cycbuff = cycbufftab; cycbuff != NULL; cycbuff = cycbuff->next)
+		if (cycbuff->wlen > 0)
+		    CNFSflushwrite(cycbuff);
+	CNFSflushallwrites(true);
+    }
+    return success;
+}
+
+/*
+**  Read the header of the article at offset.  When articles aren't mmapped,
+**  read the start of the article along with it, so that most articles are
+**  read with a single system call.  An article to be mmapped must be on
+**  disk, so write it out if it is still in the write buffer.  Returns the
+**  number of bytes read into artahead, or -1 on failure.
+*/
+static ssize_t
+CNFSreadheader(CYCBUFF *cycbuff, off_t offset, CNFSARTHEADER *cah)
+{
+    ssize_t nread;
+
+    if (innconf->articlemmap && CNFSinwbuf(cycbuff, offset)
+	&& !CNFSsyncwrite(cycbuff))
+	return -1;
+    nread = CNFSpread(cycbuff, artahead,
+		  innconf->articlemmap ? sizeof(*cah) : sizeof(artahead),
+		  offset);
+    if (nread < (ssize_t) sizeof(*cah))
+	return -1;
+    memcpy(cah, artahead, sizeof(*cah));
+    return nread;
+}
+
+/*
+**  Read size bytes of an article at offset into a new buffer, taking the
+**  part read along with the header from artahead, where it starts at skip.
+**  Returns NULL on failure.
+*/
+static char *
+CNFSreadarticle(CYCBUFF *cycbuff, off_t offset, size_t size, ssize_t ahead,
+		size_t skip)
+{
+    char *data;
+    size_t have = 0;
+    ssize_t nread;
+
+    data = xmalloc(size);
+    if (ahead > (ssize_t) skip) {
+	have = ahead - skip;
+	if (have > size)
+	    have = size;
+	memcpy(data, artahead + skip, have);
+    }
+    while (have < size) {
+	nread = CNFSpread(cycbuff, data + have, size - have, offset + have);
+	if (nread <= 0) {
+	    if (nread == 0)
+		errno = EIO;
+	    free(data);
+	    return NULL;
+	}
+	have += nread;
+    }
+    return data;
+}
+
 ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
     char		cycbuffname[9];
     off_t               offset;
@@ -1338,6 +2161,8 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
     static TOKEN	ret_token;
     static bool		nomessage = false;
     int			plusoffset = 0;
+    ssize_t		ahead;
+    size_t		want, headsize;
 
     if (token.type != TOKEN_CNFS) {
 	SMseterror(SMERR_INTERNAL, NULL);
@@ -1363,7 +2188,8 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
 	return NULL;
     }
     offset = (off_t)block * cycbuff->blksz;
-    if (! CNFSArtMayBeHere(cycbuff, offset, cycnum)) {
+    if (!CNFSinwbuf(cycbuff, offset)
+	&& !CNFSArtMayBeHere(cycbuff, offset, cycnum)) {
 	SMseterror(SMERR_NOENT, NULL);
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
 	return NULL;
@@ -1388,7 +2214,7 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
     ** XXX water here.  So, to be safe, we double MAX_ART_SIZE and add enough
     ** XXX extra for the pagesize fudge factor and CNFSARTHEADER structure.
     */
-    if (pread(cycbuff->fd, &cah, sizeof(cah), offset) != sizeof(cah)) {
+    if ((ahead = CNFSreadheader(cycbuff, offset, &cah)) < 0) {
         SMseterror(SMERR_UNDEFINED, "read failed");
         syswarn("CNFS: could not read token %s %s:0x%s:%d",
 		TokenToText(token), cycbuffname,
@@ -1413,6 +2239,7 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
 	cah.size = cahh.size;
 	cah.arrived = htonl(time(NULL));
 	cah.class = 0;
+	cah.headsize = 0;
 	plusoffset = sizeof(oldCNFSARTHEADER)-sizeof(CNFSARTHEADER);
     }
 #endif /* OLD_CNFS */
@@ -1453,10 +2280,23 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
     art->private = (void *)private;
     art->arrived = ntohl(cah.arrived);
     offset += sizeof(cah) + plusoffset;
+    private->cycbuff = cycbuff;
+    private->mapped = innconf->articlemmap;
+
+    /* Only read the headers when their length was recorded.  It is checked
+       against where the body is found, since articles stored by older
+       versions may have anything there. */
+    want = ntohl(cah.size);
+    headsize = ntohs(cah.headsize);
+    if (amount == RETR_HEAD && headsize >= 4 && headsize < want)
+	want = headsize;
+  retry:
+    private->baseoffset = offset;
     if (innconf->articlemmap) {
 	pagefudge = offset % pagesize;
 	mmapoffset = offset - pagefudge;
-	private->len = pagefudge + ntohl(cah.size);
+	private->baseoffset = mmapoffset;
+	private->len = pagefudge + want;
 	if ((private->base = mmap(NULL, private->len, PROT_READ,
 		MAP_SHARED, cycbuff->fd, mmapoffset)) == MAP_FAILED) {
 	    SMseterror(SMERR_UNDEFINED, "mmap failed");
@@ -1469,19 +2309,19 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
 	    return NULL;
 	}
 	mmap_invalidate(private->base, private->len);
-        if (amount == RETR_ALL)
+        if (amount == RETR_ALL || want < ntohl(cah.size))
 	    madvise(private->base, private->len, MADV_WILLNEED);
         else
 	    madvise(private->base, private->len, MADV_SEQUENTIAL);
     } else {
-	private->base = xmalloc(ntohl(cah.size));
 	pagefudge = 0;
-	if (pread(cycbuff->fd, private->base, ntohl(cah.size), offset) < 0) {
+	private->base = CNFSreadarticle(cycbuff, offset, want, ahead,
+					sizeof(cah) + plusoffset);
+	if (private->base == NULL) {
 	    SMseterror(SMERR_UNDEFINED, "read failed");
             syswarn("CNFS: could not read token %s %s:0x%s:%d",
                     TokenToText(token), cycbuffname,
                     CNFSofft2hex(offset, false), cycnum);
-	    free(private->base);
 	    free(art->private);
 	    free(art);
 	    if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
@@ -1490,18 +2330,22 @@ ARTHANDLE *cnfs_retrieve(const TOKEN token, const RETRTYPE amount) {
     }
     ret_token = token;
     art->token = &ret_token;
-    art->len = ntohl(cah.size);
+    art->len = want;
     if (amount == RETR_ALL) {
 	art->data = innconf->articlemmap ? private->base + pagefudge : private->base;
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
 	return art;
     }
     if ((p = wire_findbody(innconf->articlemmap ? private->base + pagefudge : private->base, art->len)) == NULL) {
-        SMseterror(SMERR_NOBODY, NULL);
 	if (innconf->articlemmap)
 	    munmap(private->base, private->len);
 	else
 	    free(private->base);
+	if (want < ntohl(cah.size)) {
+	    want = ntohl(cah.size);
+	    goto retry;
+	}
+        SMseterror(SMERR_NOBODY, NULL);
         free(art->private);
         free(art);
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
@@ -1548,7 +2392,7 @@ void cnfs_freearticle(ARTHANDLE *article) {
 
     if (article->private) {
 	private = (PRIV_CNFS *)article->private;
-	if (innconf->articlemmap)
+	if (private->mapped)
 	    munmap(private->base, private->len);
 	else
 	    free(private->base);
@@ -1583,6 +2427,10 @@ bool cnfs_cancel(TOKEN token) {
 	return false;
     }
     offset = (off_t)block * cycbuff->blksz;
+    if (CNFSinwbuf(cycbuff, offset) && !CNFSsyncwrite(cycbuff)) {
+	SMseterror(SMERR_UNDEFINED, "write failed");
+	return false;
+    }
     if (! (cycnum == cycbuff->cyclenum ||
 	(cycnum == cycbuff->cyclenum - 1 && offset > cycbuff->free) ||
 	(cycnum + 1 == 0 && cycbuff->cyclenum == 2 && offset > cycbuff->free))) {
@@ -1595,14 +2443,155 @@ bool cnfs_cancel(TOKEN token) {
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
 	return false;
     }
+    CNFSlockbitfield();
     CNFSUsedBlock(cycbuff, offset, true, false);
     if (innconf->nfswriter) {
 	cnfs_mapcntl(NULL, 0, MS_ASYNC);
     }
+    CNFSunlockbitfield();
     if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
     return true;
 }
 
+/*
+** Position of a cycbuff in cycbufftab, used to split cnfs_next between
+** several processes.
+*/
+static unsigned long
+CNFScycbuffindex(CYCBUFF *cycbuff)
+{
+    CYCBUFF *p;
+    unsigned long i = 0;
+
+    for (p = cycbufftab; p != NULL && p != cycbuff; p = p->next)
+        i++;
+    return i;
+}
+
+/*
+**  Find the first used block from offset on which is in one of the slices
+**  of the cycbuffs given to this process by SM_PARTITION, with the same
+**  return value as CNFSnextusedblock.  Each cycbuff is cut into slices of
+**  CNFS_SCANSLICE bytes, numbered from the position of the cycbuff, so that
+**  several processes can scan a single cycbuff together.  An article
+**  belongs to the slice where it starts.
+*/
+static off_t
+CNFSnextownblock(CYCBUFF *cycbuff, off_t offset, off_t limit)
+{
+    unsigned long	index;
+    off_t		middle, slice;
+
+    index = CNFScycbuffindex(cycbuff);
+    for (;;) {
+	middle = CNFSnextusedblock(cycbuff, offset, limit);
+	if (middle >= limit)
+	    return middle;
+	slice = middle / CNFS_SCANSLICE;
+	if (SMpartitioned(index + slice))
+	    return middle;
+	offset = (slice + 1) * CNFS_SCANSLICE;
+    }
+}
+
+/*
+**  Whether the bytes of a cycbuff from start up to end can be read into
+**  scanchunk and used from there for a while.  They cannot if they are in
+**  the write buffers, or near enough after the free pointer to be
+**  overwritten meanwhile, including at the beginning of the cycbuff if it
+**  is about to wrap.  The free pointer is taken both from memory and from
+**  the header on disk, which may have been updated by innd since.
+*/
+static bool
+CNFSscansafe(CYCBUFF *cycbuff, off_t start, off_t end)
+{
+    CYCBUFFEXTERN	rpx;
+    char		buf[64];
+    off_t		low, high, ondisk;
+
+    memcpy(&rpx, cycbuff->bitfield, sizeof(CYCBUFFEXTERN));
+    strncpy(buf, rpx.freea, CNFSLASIZ);
+    buf[CNFSLASIZ] = '\0';
+    ondisk = CNFShex2offt(buf);
+    low = (ondisk < cycbuff->free) ? ondisk : cycbuff->free;
+    high = ((ondisk > cycbuff->free) ? ondisk : cycbuff->free)
+	+ CNFS_SCANMARGIN;
+    if (cycbuff->wlen > 0 && cycbuff->wstart < low)
+	low = cycbuff->wstart;
+#ifdef HAVE_PTHREAD
+    if (cycbuff->writer != NULL && cycbuff->writer->len > 0
+	&& cycbuff->writer->offset < low)
+	low = cycbuff->writer->offset;
+#endif
+    if (start < high && end > low)
+	return false;
+    if (high > cycbuff->len
+	&& start < cycbuff->minartoffset + (high - cycbuff->len))
+	return false;
+    return true;
+}
+
+/*
+**  Read len bytes at offset of a cycbuff for cnfs_next.  They are taken
+**  from scanchunk, which is filled with the next CNFS_SCANCHUNK bytes of
+**  the cycbuff whenever they aren't in it, and the kernel is asked to read
+**  the chunk after it meanwhile.  Where that isn't safe, the bytes are read
+**  directly.  Returns false on failure.
+*/
+static bool
+CNFSscanread(CYCBUFF *cycbuff, void *buf, size_t len, off_t offset)
+{
+    char		*p = buf;
+    size_t		n;
+    ssize_t		nread;
+    off_t		end;
+
+    while (len > 0) {
+	if (scanchunk.cycbuff != cycbuff || offset < scanchunk.start
+	    || offset >= scanchunk.start + (off_t) scanchunk.len) {
+	    scanchunk.cycbuff = NULL;
+	    end = offset + CNFS_SCANCHUNK;
+	    if (end > cycbuff->len)
+		end = cycbuff->len;
+	    if (end <= offset || !CNFSscansafe(cycbuff, offset, end)) {
+		nread = CNFSpread(cycbuff, p, len, offset);
+		if (nread <= 0) {
+		    if (nread == 0)
+			errno = EIO;
+		    return false;
+		}
+		p += nread;
+		offset += nread;
+		len -= nread;
+		continue;
+	    }
+	    if (scanchunk.data == NULL)
+		scanchunk.data = xmalloc(CNFS_SCANCHUNK);
+	    nread = pread(cycbuff->fd, scanchunk.data, end - offset, offset);
+	    if (nread <= 0) {
+		if (nread == 0)
+		    errno = EIO;
+		return false;
+	    }
+	    scanchunk.cycbuff = cycbuff;
+	    scanchunk.start = offset;
+	    scanchunk.len = nread;
+#ifdef HAVE_POSIX_FADVISE
+	    posix_fadvise(cycbuff->fd, offset + nread, CNFS_SCANCHUNK,
+			  POSIX_FADV_WILLNEED);
+#endif
+	}
+	n = scanchunk.start + scanchunk.len - offset;
+	if (n > len)
+	    n = len;
+	memcpy(p, scanchunk.data + (offset - scanchunk.start), n);
+	p += n;
+	offset += n;
+	len -= n;
+    }
+    return true;
+}
+
 ARTHANDLE *
 cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 {
@@ -1612,10 +2601,9 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
     off_t               middle = 0, limit;
     CNFSARTHEADER	cah;
     off_t               offset;
-    long		pagefudge, blockfudge;
+    long		blockfudge;
     static TOKEN	token;
     int			tonextblock;
-    off_t               mmapoffset;
     char		*p;
     int			plusoffset = 0;
 
@@ -1631,17 +2619,13 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 	priv = *(PRIV_CNFS *)article->private;
 	free(article->private);
 	free(article);
-	if (innconf->articlemmap)
-	    munmap(priv.base, priv.len);
-	else {
-	    /* In the case we return art->data = NULL, we
-             * must not free an already stale pointer.
-               -mibsoft@mibsoftware.com
-	     */
-	    if (priv.base) {
-	        free(priv.base);
-		priv.base = 0;
-	    }
+	/* In the case we return art->data = NULL, we
+	 * must not free an already stale pointer.
+	   -mibsoft@mibsoftware.com
+	 */
+	if (priv.base) {
+	    free(priv.base);
+	    priv.base = 0;
 	}
 	cycbuff = priv.cycbuff;
     }
@@ -1669,22 +2653,21 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 	    }
 	}
 	if (!priv.rollover) {
-	    for (middle = priv.offset ;middle < cycbuff->len - cycbuff->blksz - 1;
-		middle += cycbuff->blksz) {
-		if (CNFSUsedBlock(cycbuff, middle, false, false) != 0)
-		    break;
-	    }
+	    middle = CNFSnextownblock(cycbuff, priv.offset,
+				      cycbuff->len - cycbuff->blksz - 1);
 	    if (middle >= cycbuff->len - cycbuff->blksz - 1) {
 		priv.rollover = true;
-		middle = cycbuff->minartoffset;
+		middle = CNFSnextownblock(cycbuff, cycbuff->minartoffset,
+					  cycbuff->free);
+		if (middle >= cycbuff->free) {
+		    middle = 0;
+		    if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
+		    continue;
+		}
 	    }
 	    break;
 	} else {
-	    for (middle = priv.offset ;middle < cycbuff->free;
-		middle += cycbuff->blksz) {
-		if (CNFSUsedBlock(cycbuff, middle, false, false) != 0)
-		    break;
-	    }
+	    middle = CNFSnextownblock(cycbuff, priv.offset, cycbuff->free);
 	    if (middle >= cycbuff->free) {
 		middle = 0;
 		if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
@@ -1697,7 +2680,7 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 	return (ARTHANDLE *)NULL;
 
     offset = middle;
-    if (pread(cycbuff->fd, &cah, sizeof(cah), offset) != sizeof(cah)) {
+    if (!CNFSscanread(cycbuff, &cah, sizeof(cah), offset)) {
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
 	return (ARTHANDLE *)NULL;
     }
@@ -1722,6 +2705,8 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
     *private = priv;
     private->cycbuff = cycbuff;
     private->offset = middle;
+    private->baseoffset = -1;
+    private->mapped = false;
     if (cycbuff->len - cycbuff->free < (off_t) ntohl(cah.size) + cycbuff->blksz + 1) {
 	private->offset += cycbuff->blksz;
 	art->data = NULL;
@@ -1734,12 +2719,9 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
     blockfudge = (sizeof(cah) + plusoffset + ntohl(cah.size)) % cycbuff->blksz;
     limit = private->offset + sizeof(cah) + plusoffset + ntohl(cah.size) - blockfudge + cycbuff->blksz;
     if (offset < cycbuff->free) {
-	for (middle = offset + cycbuff->blksz; (middle < cycbuff->free) && (middle < limit);
-	    middle += cycbuff->blksz) {
-	    if (CNFSUsedBlock(cycbuff, middle, false, false) != 0)
-		/* Bitmap set.  This article assumes to be broken */
-		break;
-	}
+	/* A used block before limit means the article is broken. */
+	middle = CNFSnextusedblock(cycbuff, offset + cycbuff->blksz,
+				   (cycbuff->free < limit) ? cycbuff->free : limit);
 	if ((middle > cycbuff->free) || (middle != limit)) {
 	    private->offset = middle;
 	    art->data = NULL;
@@ -1749,12 +2731,8 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 	    return art;
 	}
     } else {
-	for (middle = offset + cycbuff->blksz; (middle < cycbuff->len) && (middle < limit);
-	    middle += cycbuff->blksz) {
-	    if (CNFSUsedBlock(cycbuff, middle, false, false) != 0)
-		/* Bitmap set.  This article assumes to be broken */
-		break;
-	}
+	middle = CNFSnextusedblock(cycbuff, offset + cycbuff->blksz,
+				   (cycbuff->len < limit) ? cycbuff->len : limit);
 	if ((middle >= cycbuff->len) || (middle != limit)) {
 	    private->offset = middle;
 	    art->data = NULL;
@@ -1783,40 +2761,23 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 	cah.class);
     art->token = &token;
     offset += sizeof(cah) + plusoffset;
-    if (innconf->articlemmap) {
-	pagefudge = offset % pagesize;
-	mmapoffset = offset - pagefudge;
-	private->len = pagefudge + ntohl(cah.size);
-	if ((private->base = mmap(0, private->len, PROT_READ,
-	    MAP_SHARED, cycbuff->fd, mmapoffset)) == MAP_FAILED) {
-	    art->data = NULL;
-	    art->len = 0;
-	    art->token = NULL;
-	    if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
-	    return art;
-	}
-	mmap_invalidate(private->base, private->len);
-	madvise(private->base, private->len, MADV_SEQUENTIAL);
-    } else {
-	private->base = xmalloc(ntohl(cah.size));
-	pagefudge = 0;
-	if (pread(cycbuff->fd, private->base, ntohl(cah.size), offset) < 0) {
-	    art->data = NULL;
-	    art->len = 0;
-	    art->token = NULL;
-	    if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
-	    free(private->base);
-	    private->base = 0;
-	    return art;
-	}
+    private->base = xmalloc(ntohl(cah.size));
+    if (!CNFSscanread(cycbuff, private->base, ntohl(cah.size), offset)) {
+	free(private->base);
+	private->base = NULL;
+	art->data = NULL;
+	art->len = 0;
+	art->token = NULL;
+	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
+	return art;
     }
     art->len = ntohl(cah.size);
     if (amount == RETR_ALL) {
-	art->data = innconf->articlemmap ? private->base + pagefudge : private->base;
+	art->data = private->base;
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
 	return art;
     }
-    if ((p = wire_findbody(innconf->articlemmap ? private->base + pagefudge : private->base, art->len)) == NULL) {
+    if ((p = wire_findbody(private->base, art->len)) == NULL) {
 	art->data = NULL;
 	art->len = 0;
 	art->token = NULL;
@@ -1824,13 +2785,8 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
 	return art;
     }
     if (amount == RETR_HEAD) {
-	if (innconf->articlemmap) {
-	    art->data = private->base + pagefudge;
-	    art->len = p - private->base - pagefudge;
-	} else {
-	    art->data = private->base;
-	    art->len = p - private->base;
-	}
+	art->data = private->base;
+	art->len = p - private->base;
         /* Headers end just before the first empty line (\r\n). */
         art->len = art->len - 2;
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
@@ -1838,10 +2794,7 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
     }
     if (amount == RETR_BODY) {
 	art->data = p;
-	if (innconf->articlemmap)
-	    art->len = art->len - (p - private->base - pagefudge);
-	else
-	    art->len = art->len - (p - private->base);
+	art->len = art->len - (p - private->base);
 	if (!SMpreopen) CNFSshutdowncycbuff(cycbuff);
 	return art;
     }
@@ -1852,8 +2805,14 @@ cnfs_next(ARTHANDLE *article, const RETRTYPE amount)
     return art;
 }
 
-bool cnfs_ctl(PROBETYPE type, TOKEN *token UNUSED, void *value) {
+bool cnfs_ctl(PROBETYPE type, TOKEN *token, void *value) {
     struct artngnum *ann;
+    struct artfile *af;
+    PRIV_CNFS *private;
+    char cycbuffname[9];
+    uint32_t block, cycnum;
+    CYCBUFF *cycbuff;
+    off_t offset;
 
     switch (type) {
     case SMARTNGNUM:
@@ -1862,14 +2821,46 @@ bool cnfs_ctl(PROBETYPE type, TOKEN *token UNUSED, void *value) {
 	/* make SMprobe() call cnfs_retrieve() */
 	ann->artnum = 0;
 	return true;
+    case SMARTFILE:
+	/* Without SMpreopen, the cycbuff is closed once retrieved. */
+	af = (struct artfile *)value;
+	private = (PRIV_CNFS *)af->art->private;
+	if (!SMpreopen || private == NULL || af->art->data == NULL
+	    || private->baseoffset < 0 || private->cycbuff->fd < 0)
+	    return false;
+	if (CNFSinwbuf(private->cycbuff, private->baseoffset)
+	    && !CNFSsyncwrite(private->cycbuff))
+	    return false;
+	af->fd = private->cycbuff->fd;
+	af->offset = private->baseoffset + (af->art->data - private->base);
+	return true;
+    case SMPREFETCH:
+	/* The length of the article is only known once its header is read,
+	   so read ahead a fixed amount, which covers most articles. */
+#ifdef HAVE_POSIX_FADVISE
+	if (!SMpreopen || !CNFSBreakToken(*token, cycbuffname, &block, &cycnum))
+	    return false;
+	cycbuff = CNFSgetcycbuffbyname(cycbuffname);
+	if (cycbuff == NULL || cycbuff->fd < 0)
+	    return false;
+	offset = (off_t) block * cycbuff->blksz;
+	if (CNFSinwbuf(cycbuff, offset))
+	    return true;
+	return posix_fadvise(cycbuff->fd, offset, CNFS_PREFETCH_SIZE,
+			     POSIX_FADV_WILLNEED) == 0;
+#else
+	return false;
+#endif
     default:
 	return false;
     }
 }
 
 bool cnfs_flushcacheddata(FLUSHTYPE type) {
-    if (type == SM_ALL || type == SM_HEAD)
+    if (type == SM_ALL || type == SM_HEAD) {
+	CNFSflushallwrites(false);
 	CNFSflushallheads();
+    }
     return true;
 }
 
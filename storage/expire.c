@@ -86,6 +86,19 @@ static NGHASH           NGHtable[NGH_SIZE];
 static char             **arts;
 static enum KRP         *krps;
 
+/* The group OVgroupbasedexpire was last called for, and its entry. */
+static char             *CurrentGroup;
+static NEWSGROUP        *CurrentNG;
+
+/* Articles to cancel, which are only cancelled once the current group has
+   been expired (or there are EXP_CANCELBATCH of them), all together in the
+   order of their tokens.  That way the articles of each storage method, and
+   of each cycbuff or directory of the method, are cancelled one after the
+   other. */
+#define EXP_CANCELBATCH 8192
+static TOKEN            *Cancels;
+static size_t           nCancels;
+
 static ARTOVERFIELD *   ARTfields;
 static int              ARTfieldsize;
 static bool             ReadOverviewfmt = false;
@@ -467,16 +480,27 @@ EXPnotfound(char *Entry)
 }
 
 /*
-**  Should we keep the specified article?
+**  Find the expiration settings of a group, whether it is in the active file
+**  or not.
 */
-static enum KRP
-EXPkeepit(char *Entry, time_t when, time_t expires)
+static NEWSGROUP *
+EXPfind(char *Entry)
 {
     NEWSGROUP           *ngp;
-    enum KRP            retval = Remove;
 
     if ((ngp = NGfind(Entry)) == NULL)
         ngp = EXPnotfound(Entry);
+    return ngp;
+}
+
+/*
+**  Should we keep the specified article, in the group given by its
+**  expiration settings?
+*/
+static enum KRP
+EXPkeepit(NEWSGROUP *ngp, time_t when, time_t expires)
+{
+    enum KRP            retval = Remove;
 
     /* Bad posting date? */
     if (when > OVrealnow + 86400) {
@@ -503,9 +527,42 @@ EXPkeepit(char *Entry, time_t when, time_t expires)
 }
 
 /*
-**  An article can be removed.  Either print a note, or actually remove it.
-**  Takes in the Xref information so that it can pass this to the storage
-**  API callback used to generate the list of files to remove.
+**  Sorting predicate to put tokens in the order of their storage method and
+**  then of their location.
+*/
+static int
+EXPtokencompare(const void *p1, const void *p2)
+{
+    return memcmp(p1, p2, sizeof(TOKEN));
+}
+
+/*
+**  Cancel the articles batched by OVEXPremove.
+*/
+void
+OVEXPflush(void)
+{
+    size_t              i;
+
+    if (nCancels == 0)
+        return;
+    qsort(Cancels, nCancels, sizeof(TOKEN), EXPtokencompare);
+    for (i = 0; i < nCancels; i++) {
+        if (i > 0 && memcmp(&Cancels[i], &Cancels[i - 1], sizeof(TOKEN)) == 0)
+            continue;
+        if (!SMcancel(Cancels[i]) && SMerrno != SMERR_NOENT
+            && SMerrno != SMERR_UNINIT)
+            fprintf(stderr, "Can't unlink %s: %s\n",
+                    TokenToText(Cancels[i]), SMerrorstr);
+    }
+    nCancels = 0;
+}
+
+/*
+**  An article can be removed.  Either print a note, or batch it to be
+**  removed by OVEXPflush.  Takes in the Xref information so that it can pass
+**  this to the storage API callback used to generate the list of files to
+**  remove.
 */
 void
 OVEXPremove(TOKEN token, bool deletedgroups, char **xref, int ngroups)
@@ -524,9 +581,11 @@ OVEXPremove(TOKEN token, bool deletedgroups, char **xref, int ngroups)
         fclose(EXPunlinkfile);
         EXPunlinkfile = NULL;
     }
-    if (!SMcancel(token) && SMerrno != SMERR_NOENT && SMerrno != SMERR_UNINIT)
-        fprintf(stderr, "Can't unlink %s: %s\n", TokenToText(token),
-                SMerrorstr);
+    if (Cancels == NULL)
+        Cancels = xmalloc(EXP_CANCELBATCH * sizeof(TOKEN));
+    Cancels[nCancels++] = token;
+    if (nCancels == EXP_CANCELBATCH)
+        OVEXPflush();
 }
 
 /*
@@ -686,7 +745,9 @@ OVgroupbasedexpire(TOKEN token, const char *group, const char *data,
     bool                keeper;
     bool                delete;
     bool                purge;
+    bool                current;
     char                *Xref;
+    NEWSGROUP           *ngp;
 
     if (SMprobe(SELFEXPIRE, &token, NULL)) {
         if (!OVignoreselfexpire)
@@ -744,17 +805,31 @@ OVgroupbasedexpire(TOKEN token, const char *group, const char *data,
         *p = '\0';
     }
 
+    /* The settings of the group being expired are looked up only once. */
+    if (CurrentGroup == NULL || strcmp(group, CurrentGroup) != 0) {
+        free(CurrentGroup);
+        CurrentGroup = xstrdup(group);
+        CurrentNG = NULL;
+    }
+
     /* First check all postings */
     poisoned = false;
     keeper = false;
     delete = false;
     purge = true;
     for (i = 0; i < count; ++i) {
-        if ((krps[i] = EXPkeepit(arts[i], when, expires)) == Poison)
+        current = (strcmp(group, arts[i]) == 0);
+        if (current) {
+            if (CurrentNG == NULL)
+                CurrentNG = EXPfind(arts[i]);
+            ngp = CurrentNG;
+        } else
+            ngp = EXPfind(arts[i]);
+        if ((krps[i] = EXPkeepit(ngp, when, expires)) == Poison)
             poisoned = true;
         if (OVkeep && (krps[i] == Keep))
             keeper = true;
-        if ((krps[i] == Remove) && strcmp(group, arts[i]) == 0)
+        if ((krps[i] == Remove) && current)
             delete = true;
         if (krps[i] == Keep)
             purge = false;
@@ -811,6 +886,12 @@ OVEXPcleanup(void)
     ARTOVERFIELD *fp;
     NGHASH *htp;
 
+    OVEXPflush();
+    free(Cancels);
+    Cancels = NULL;
+    free(CurrentGroup);
+    CurrentGroup = NULL;
+    CurrentNG = NULL;
     if (EXPprocessed != 0) {
         if (!OVquiet) {
             printf("Article lines processed %8ld\n", EXPprocessed);
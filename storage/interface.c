@@ -5,9 +5,19 @@
 #include "clibrary.h"
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
 #include <time.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #include "conffile.h"
+#include "inn/buffer.h"
+#include "inn/histogram.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
 #include "inn/wire.h"
@@ -22,17 +32,85 @@ typedef struct {
     bool		configured;
     bool		selfexpire;
     bool		expensivestat;
+    bool		threadsafe;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t	lock;		/* Held around the calls into the method
+					   unless it is thread-safe */
+#endif
 } METHOD_DATA;
 
 METHOD_DATA method_data[NUM_STORAGE_METHODS];
 
 static STORAGE_SUB      *subscriptions = NULL;
 static unsigned int     typetoindex[256];
-int                     SMerrno;
-char                    *SMerrorstr = NULL;
+SM_THREAD_LOCAL int     SMerrno;
+SM_THREAD_LOCAL char    *SMerrorstr = NULL;
 static bool             Initialized = false;
 bool			SMopenmode = false;
 bool			SMpreopen = false;
+static SMPARTITION	SMpartition = { 0, 1 };
+static time_t		MinAge = 0;	/* Smallest age: in storage.conf */
+
+/* Latencies of the store and retrieve calls into each method. */
+static struct histogram *store_latency[NUM_STORAGE_METHODS];
+static struct histogram *retrieve_latency[NUM_STORAGE_METHODS];
+
+/*
+**  Several threads may use the storage manager at once.  init_lock
+**  serializes reading storage.conf and the initialization and shutdown of
+**  the methods, after which the subscriptions and method_data only change
+**  again in SMshutdown.  latency_lock protects the histograms.  The calls
+**  into a method which doesn't declare itself thread-safe in its init
+**  function are serialized by the lock of that method.
+*/
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t	latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t	locks_once = PTHREAD_ONCE_INIT;
+
+static void
+InitMethodLocks(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_STORAGE_METHODS; i++)
+	pthread_mutex_init(&method_data[i].lock, NULL);
+}
+
+# define SMlockinit()		(pthread_once(&locks_once, InitMethodLocks), \
+				 pthread_mutex_lock(&init_lock))
+# define SMunlockinit()		pthread_mutex_unlock(&init_lock)
+# define SMlocklatency()	pthread_mutex_lock(&latency_lock)
+# define SMunlocklatency()	pthread_mutex_unlock(&latency_lock)
+# define SMlockmethod(i)	do { if (!method_data[i].threadsafe) \
+				    pthread_mutex_lock(&method_data[i].lock); \
+				} while (0)
+# define SMunlockmethod(i)	do { if (!method_data[i].threadsafe) \
+				    pthread_mutex_unlock(&method_data[i].lock); \
+				} while (0)
+#else
+# define SMlockinit()		/* empty */
+# define SMunlockinit()		/* empty */
+# define SMlocklatency()	/* empty */
+# define SMunlocklatency()	/* empty */
+# define SMlockmethod(i)	/* empty */
+# define SMunlockmethod(i)	/* empty */
+#endif
+
+static void ShutdownAll(void);
+
+/*
+**  Record the latency of a call into a method started at start.
+*/
+static void
+RecordLatency(struct histogram **histogram, const struct timeval *start)
+{
+    SMlocklatency();
+    if (*histogram == NULL)
+        *histogram = histogram_new();
+    histogram_record_since(*histogram, start);
+    SMunlocklatency();
+}
 
 /*
 ** Checks to see if the token is valid.
@@ -240,6 +318,8 @@ static time_t ParseTime(char *tmbuf)
 #define SMexpire  14
 #define SMoptions 15
 #define SMexactmatch 16
+#define SMage     17
+#define SMcompress 18
 
 static CONFTOKEN smtoks[] = {
     { SMlbrace,         (char *) "{"            },
@@ -251,6 +331,8 @@ static CONFTOKEN smtoks[] = {
     { SMexpire,         (char *) "expires:"     },
     { SMoptions,        (char *) "options:"     },
     { SMexactmatch,     (char *) "exactmatch:"  },
+    { SMage,            (char *) "age:"         },
+    { SMcompress,       (char *) "compress:"    },
     { 0,                NULL                    }
 };
 
@@ -271,12 +353,15 @@ SMreadconfig(void)
     size_t              maxsize = 0;
     time_t		minexpire = 0;
     time_t		maxexpire = 0;
+    time_t		minage = 0;
+    time_t		maxage = 0;
     int                 class = 0;
     STORAGE_SUB         *sub = NULL;
     STORAGE_SUB         *prev = NULL;
     char		*options = 0;
     int			inbrace;
     bool		exactmatch = false;
+    bool		compress = false;
 
     /* if innconf isn't already read in, do so. */
     if (innconf == NULL) {
@@ -290,6 +375,7 @@ SMreadconfig(void)
 	method_data[i].initialized = INIT_NO;
 	method_data[i].configured = false;
     }
+    MinAge = 0;
     path = concatpath(innconf->pathetc, INN_PATH_STORAGECTL);
     f = CONFfopen(path);
     if (f == NULL) {
@@ -328,7 +414,10 @@ SMreadconfig(void)
 	    options = NULL;
 	    minexpire = 0;
 	    maxexpire = 0;
+	    minage = 0;
+	    maxage = 0;
 	    exactmatch = false;
+	    compress = false;
 
 	} else {
 	    type = tok->type;
@@ -371,6 +460,14 @@ SMreadconfig(void)
 		    if (q)
 			maxexpire = ParseTime(q);
 		    break;
+		  case SMage:
+		    q = strchr(p, ',');
+		    if (q)
+			*q++ = 0;
+		    minage = ParseTime(p);
+		    if (q)
+			maxage = ParseTime(q);
+		    break;
 		  case SMoptions:
 		    if (options)
 			free(options);
@@ -382,6 +479,12 @@ SMreadconfig(void)
                         || strcasecmp(p, "on") == 0)
 			exactmatch = true;
 		    break;
+		  case SMcompress:
+		    if (strcasecmp(p, "true") == 0
+                        || strcasecmp(p, "yes") == 0
+                        || strcasecmp(p, "on") == 0)
+			compress = true;
+		    break;
 		  default:
 		    SMseterror(SMERR_CONFIG,
                                "Unknown keyword in method declaration");
@@ -412,6 +515,15 @@ SMreadconfig(void)
 		free(sub);
 		return false;
 	    }
+	    /* tradspool may rewrite articles in native format. */
+	    if (compress && strcasecmp(method, "tradspool") == 0) {
+		SMseterror(SMERR_CONFIG, "tradspool cannot compress");
+		warn("SM: compress is not supported by tradspool, line %d",
+                     f->lineno);
+		free(options);
+		free(sub);
+		return false;
+	    }
 	    if (!pattern) {
 		SMseterror(SMERR_CONFIG, "pattern not defined");
                 warn("SM: no pattern defined");
@@ -426,7 +538,12 @@ SMreadconfig(void)
 	    sub->options = options;
 	    sub->minexpire = minexpire;
 	    sub->maxexpire = maxexpire;
+	    sub->minage = minage;
+	    sub->maxage = maxage;
 	    sub->exactmatch = exactmatch;
+	    sub->compress = compress;
+	    if (minage != 0 && (MinAge == 0 || minage < MinAge))
+		MinAge = minage;
 
 	    free(method);
 	    method = 0;
@@ -458,17 +575,31 @@ bool SMsetup(SMSETUP type, void *value) {
     case SM_PREOPEN:
 	SMpreopen = *(bool *)value;
 	break;
+    case SM_PARTITION:
+	SMpartition = *(SMPARTITION *)value;
+	if (SMpartition.count == 0 || SMpartition.index >= SMpartition.count)
+	    return false;
+	break;
     default:
 	return false;
     }
     return true;
 }
 
+/*
+** Used by the next functions of the methods to skip the units of the spool
+** (cycbuffs, directories, hash buckets) which belong to another slice when
+** SM_PARTITION has been set up.
+*/
+bool SMpartitioned(unsigned long unit) {
+    return unit % SMpartition.count == SMpartition.index;
+}
+
 /*
 ** Calls the setup function for all of the configured methods and returns
 ** true if they all initialize ok, false if they don't
 */
-bool SMinit(void) {
+static bool InitAll(void) {
     int                 i;
     bool		allok = true;
     static		bool once = false;
@@ -480,21 +611,24 @@ bool SMinit(void) {
     Initialized = true;
 
     if (!SMreadconfig()) {
-	SMshutdown();
+	ShutdownAll();
 	Initialized = false;
 	return false;
     }
 
     for (i = 0; i < NUM_STORAGE_METHODS; i++) {
 	if (method_data[i].configured) {
+	    memset(&smattr, 0, sizeof(smattr));
 	    if (method_data[i].configured && storage_methods[i].init(&smattr)) {
 		method_data[i].initialized = INIT_DONE;
 		method_data[i].selfexpire = smattr.selfexpire;
 		method_data[i].expensivestat = smattr.expensivestat;
+		method_data[i].threadsafe = smattr.threadsafe;
 	    } else {
 		method_data[i].initialized = INIT_FAIL;
 		method_data[i].selfexpire = false;
 		method_data[i].expensivestat = true;
+		method_data[i].threadsafe = false;
                 warn("SM: storage method '%s' failed initialization",
                      storage_methods[i].name);
 		allok = false;
@@ -503,7 +637,7 @@ bool SMinit(void) {
 	typetoindex[storage_methods[i].type] = i;
     }
     if (!allok) {
-	SMshutdown();
+	ShutdownAll();
 	Initialized = false;
 	SMseterror(SMERR_UNDEFINED,
                    "one or more storage methods failed initialization");
@@ -511,48 +645,74 @@ bool SMinit(void) {
 	return false;
     }
     if (!once && atexit(SMshutdown) < 0) {
-	SMshutdown();
+	ShutdownAll();
 	Initialized = false;
 	SMseterror(SMERR_UNDEFINED, NULL);
 	return false;
     }
     once = true;
+    SMcacheopen();
     return true;
 }
 
+bool SMinit(void) {
+    bool		status;
+
+    SMlockinit();
+    status = InitAll();
+    SMunlockinit();
+    return status;
+}
+
+/*
+**  Initialize a method on its first use, when SMinit hasn't been called.
+**  Another thread may have done it meanwhile, so the state of the method is
+**  checked again with the lock held.
+*/
 static bool InitMethod(STORAGETYPE method) {
     SMATTRIBUTE		smattr;
+    bool		status = false;
 
+    SMlockinit();
     if (!Initialized)
 	if (!SMreadconfig()) {
 	    Initialized = false;
-	    return false;
+	    goto done;
 	}
     Initialized = true;
 
-    if (method_data[method].initialized == INIT_DONE)
-	return true;
+    if (method_data[method].initialized == INIT_DONE) {
+	status = true;
+	goto done;
+    }
 
     if (method_data[method].initialized == INIT_FAIL)
-	return false;
+	goto done;
 
     if (!method_data[method].configured) {
 	method_data[method].initialized = INIT_FAIL;
 	SMseterror(SMERR_UNDEFINED, "storage method is not configured");
-	return false;
+	goto done;
     }
+    memset(&smattr, 0, sizeof(smattr));
     if (!storage_methods[method].init(&smattr)) {
 	method_data[method].initialized = INIT_FAIL;
 	method_data[method].selfexpire = false;
 	method_data[method].expensivestat = true;
+	method_data[method].threadsafe = false;
 	SMseterror(SMERR_UNDEFINED,
                    "Could not initialize storage method late");
-	return false;
+	goto done;
     }
-    method_data[method].initialized = INIT_DONE;
     method_data[method].selfexpire = smattr.selfexpire;
     method_data[method].expensivestat = smattr.expensivestat;
-    return true;
+    method_data[method].threadsafe = smattr.threadsafe;
+    method_data[method].initialized = INIT_DONE;
+    status = true;
+
+done:
+    SMunlockinit();
+    return status;
 }
 
 static bool
@@ -596,6 +756,7 @@ MatchGroups(const char *g, int len, const char *pattern, bool exactmatch)
 
 STORAGE_SUB *SMgetsub(const ARTHANDLE article) {
     STORAGE_SUB         *sub;
+    time_t              age;
 
     if (article.len == 0) {
 	SMseterror(SMERR_BADHANDLE, NULL);
@@ -605,12 +766,17 @@ STORAGE_SUB *SMgetsub(const ARTHANDLE article) {
     if (article.groups == NULL)
 	return NULL;
 
+    /* Articles being stored for the first time have no arrival time yet. */
+    age = (article.arrived == 0) ? 0 : time(NULL) - article.arrived;
+
     for (sub = subscriptions; sub != NULL; sub = sub->next) {
 	if (!(method_data[typetoindex[sub->type]].initialized == INIT_FAIL) &&
 	    (article.len >= sub->minsize) &&
 	    (!sub->maxsize || (article.len <= sub->maxsize)) &&
 	    (!sub->minexpire || article.expires >= sub->minexpire) &&
 	    (!sub->maxexpire || (article.expires <= sub->maxexpire)) &&
+	    (!sub->minage || age >= sub->minage) &&
+	    (!sub->maxage || age <= sub->maxage) &&
 	    MatchGroups(article.groups, article.groupslen, sub->pattern,
                         sub->exactmatch)) {
 	    if (InitMethod(typetoindex[sub->type]))
@@ -622,6 +788,34 @@ STORAGE_SUB *SMgetsub(const ARTHANDLE article) {
     return NULL;
 }
 
+/*
+**  Store an article with the storage method and class of sub, compressing
+**  its body first if sub asks for it.
+*/
+static TOKEN
+StoreIn(const STORAGE_SUB *sub, const ARTHANDLE *article)
+{
+    ARTHANDLE           copy;
+    TOKEN               result;
+    struct timeval      start;
+    int                 i;
+
+    i = typetoindex[sub->type];
+    gettimeofday(&start, NULL);
+    if (sub->compress && SMzipstore(article, &copy)) {
+        SMlockmethod(i);
+        result = storage_methods[i].store(copy, sub->class);
+        SMunlockmethod(i);
+        SMzipstorefree(&copy);
+    } else {
+        SMlockmethod(i);
+        result = storage_methods[i].store(*article, sub->class);
+        SMunlockmethod(i);
+    }
+    RecordLatency(&store_latency[i], &start);
+    return result;
+}
+
 TOKEN SMstore(const ARTHANDLE article) {
     STORAGE_SUB         *sub;
     TOKEN               result;
@@ -636,11 +830,131 @@ TOKEN SMstore(const ARTHANDLE article) {
     if ((sub = SMgetsub(article)) == NULL) {
 	return result;
     }
-    return storage_methods[typetoindex[sub->type]].store(article, sub->class);
+    return StoreIn(sub, &article);
+}
+
+/*
+**  Store several articles, handing all those going to the same storage
+**  method to it with a single call so that it can batch its writes.  Sets
+**  the token of each article as SMstore would have returned it, and returns
+**  false if any of them couldn't be stored.
+*/
+bool
+SMstorebatch(SMBATCH *articles, size_t count)
+{
+    struct sm_record *records;
+    ARTHANDLE *copies;
+    bool *zipped;
+    size_t *which;
+    STORAGE_SUB **subs;
+    struct timeval start;
+    size_t j, n;
+    int i;
+    bool success = true;
+
+    for (j = 0; j < count; j++) {
+	memset(&articles[j].token, 0, sizeof(TOKEN));
+	articles[j].token.type = TOKEN_EMPTY;
+    }
+    if (!SMopenmode) {
+	SMseterror(SMERR_INTERNAL, "read only storage api");
+	return false;
+    }
+    if (count == 0)
+	return true;
+    records = xmalloc(count * sizeof(struct sm_record));
+    copies = xmalloc(count * sizeof(ARTHANDLE));
+    zipped = xmalloc(count * sizeof(bool));
+    which = xmalloc(count * sizeof(size_t));
+
+    /* Find out where each article goes first, then store them method by
+       method. */
+    subs = xmalloc(count * sizeof(STORAGE_SUB *));
+    for (j = 0; j < count; j++)
+	if ((subs[j] = SMgetsub(articles[j].article)) == NULL)
+	    success = false;
+    for (i = 0; i < NUM_STORAGE_METHODS; i++) {
+	for (j = 0, n = 0; j < count; j++) {
+	    if (subs[j] == NULL || typetoindex[subs[j]->type] != i)
+		continue;
+	    records[n].article = &articles[j].article;
+	    records[n].class = subs[j]->class;
+	    which[n++] = j;
+	}
+	if (n == 0)
+	    continue;
+	gettimeofday(&start, NULL);
+	for (j = 0; j < n; j++) {
+	    zipped[j] = subs[which[j]]->compress
+		&& SMzipstore(records[j].article, &copies[j]);
+	    if (zipped[j])
+		records[j].article = &copies[j];
+	}
+	SMlockmethod(i);
+	storage_methods[i].storebatch(records, n);
+	SMunlockmethod(i);
+	for (j = 0; j < n; j++)
+	    if (zipped[j])
+		SMzipstorefree(&copies[j]);
+	RecordLatency(&store_latency[i], &start);
+	for (j = 0; j < n; j++) {
+	    articles[which[j]].token = records[j].token;
+	    if (records[j].token.type == TOKEN_EMPTY)
+		success = false;
+	}
+    }
+    free(subs);
+    free(records);
+    free(copies);
+    free(zipped);
+    free(which);
+    return success;
+}
+
+/*
+**  Return the smallest age given with the age: key in storage.conf, or 0 if
+**  no entry has one, in which case articles never have to be migrated.
+*/
+time_t
+SMminage(void)
+{
+    return MinAge;
+}
+
+/*
+**  Store again an article already stored under token, if storage.conf now
+**  routes it to another method or storage class because of its age.  The
+**  article is given as for SMstore, with its original arrival time.  Returns
+**  the new token, the unchanged token if the article stays where it is, or
+**  a TOKEN_EMPTY token on error.  The old copy is left for the caller to
+**  cancel once nothing refers to it anymore.
+*/
+TOKEN
+SMmigrate(const TOKEN token, const ARTHANDLE article)
+{
+    STORAGE_SUB         *sub;
+    TOKEN               result;
+
+    memset(&result, 0, sizeof(result));
+    result.type = TOKEN_EMPTY;
+    if (!SMopenmode) {
+	SMseterror(SMERR_INTERNAL, "read only storage api");
+	return result;
+    }
+    if (MinAge == 0 || article.arrived == 0
+        || time(NULL) - article.arrived < MinAge)
+	return token;
+    if ((sub = SMgetsub(article)) == NULL)
+	return result;
+    if (sub->type == token.type && sub->class == token.class)
+	return token;
+    return StoreIn(sub, &article);
 }
 
 ARTHANDLE *SMretrieve(const TOKEN token, const RETRTYPE amount) {
     ARTHANDLE           *art;
+    struct timeval      start;
+    int                 i;
 
     if (method_data[typetoindex[token.type]].initialized == INIT_FAIL) {
 	SMseterror(SMERR_UNINIT, NULL);
@@ -652,9 +966,21 @@ ARTHANDLE *SMretrieve(const TOKEN token, const RETRTYPE amount) {
 	SMseterror(SMERR_UNINIT, NULL);
 	return NULL;
     }
-    art = storage_methods[typetoindex[token.type]].retrieve(token, amount);
-    if (art)
+    i = typetoindex[token.type];
+    if ((art = SMcacheget(token, amount)) != NULL)
+	return art;
+    gettimeofday(&start, NULL);
+    SMlockmethod(i);
+    art = storage_methods[i].retrieve(token, amount);
+    SMunlockmethod(i);
+    RecordLatency(&retrieve_latency[i], &start);
+    if (art) {
 	art->nextmethod = 0;
+	art = SMzipretrieve(art, amount);
+	/* Self-expiring methods overwrite articles without cancelling them. */
+	if (!method_data[i].selfexpire)
+	    SMcacheput(token, amount, art);
+    }
     return art;
 
 }
@@ -668,8 +994,10 @@ SMnext(ARTHANDLE *article, const RETRTYPE amount)
 
     if (article == NULL)
 	start = 0;
-    else
+    else {
+	article = SMzipinner(article);
 	start= article->nextmethod;
+    }
 
     if (method_data[start].initialized == INIT_FAIL) {
 	SMseterror(SMERR_UNINIT, NULL);
@@ -682,8 +1010,14 @@ SMnext(ARTHANDLE *article, const RETRTYPE amount)
     }
 
     for (i = start, newart = NULL; i < NUM_STORAGE_METHODS; i++) {
-	if (method_data[i].configured && (newart = storage_methods[i].next(article, amount)) != (ARTHANDLE *)NULL) {
+	if (method_data[i].configured) {
+	    SMlockmethod(i);
+	    newart = storage_methods[i].next(article, amount);
+	    SMunlockmethod(i);
+	}
+	if (newart != NULL) {
 	    newart->nextmethod = i;
+	    newart = SMzipretrieve(newart, amount);
 	    break;
 	} else
 	    article = NULL;
@@ -693,6 +1027,11 @@ SMnext(ARTHANDLE *article, const RETRTYPE amount)
 }
 
 void SMfreearticle(ARTHANDLE *article) {
+    int			i;
+
+    if (SMcachefree(article))
+	return;
+    article = SMzipinner(article);
     if (method_data[typetoindex[article->type]].initialized == INIT_FAIL) {
 	return;
     }
@@ -700,10 +1039,16 @@ void SMfreearticle(ARTHANDLE *article) {
 	warn("SM: can't free article with uninitialized method");
 	return;
     }
-    storage_methods[typetoindex[article->type]].freearticle(article);
+    i = typetoindex[article->type];
+    SMlockmethod(i);
+    storage_methods[i].freearticle(article);
+    SMunlockmethod(i);
 }
 
 bool SMcancel(TOKEN token) {
+    int			i;
+    bool		status;
+
     if (!SMopenmode) {
 	SMseterror(SMERR_INTERNAL, "read only storage api");
 	return false;
@@ -717,22 +1062,78 @@ bool SMcancel(TOKEN token) {
 	warn("SM: can't cancel article with uninitialized method");
 	return false;
     }
-    return storage_methods[typetoindex[token.type]].cancel(token);
+    SMcachedrop(token);
+    i = typetoindex[token.type];
+    SMlockmethod(i);
+    status = storage_methods[i].cancel(token);
+    SMunlockmethod(i);
+    return status;
+}
+
+/*
+**  Sorting predicate for SMcancelbatch, grouping the tokens by storage
+**  method and class.  The methods which encode the arrival time in their
+**  tokens do it in network byte order, so the articles stored together then
+**  also come one after the other.
+*/
+static int
+tokencmp(const void *a, const void *b)
+{
+    const TOKEN *ta = a;
+    const TOKEN *tb = b;
+
+    if (ta->type != tb->type)
+        return (ta->type < tb->type) ? -1 : 1;
+    if (ta->class != tb->class)
+        return (ta->class < tb->class) ? -1 : 1;
+    return memcmp(ta->token, tb->token, sizeof(ta->token));
+}
+
+
+/*
+**  Cancel several articles, sorting their tokens first so that each storage
+**  method gets the articles stored together one after the other:  timecaf
+**  then removes all the articles of a CAF file with a single update of it,
+**  and the removals of tradspool and timehash stay within a directory.  The
+**  tokens are reordered.  Returns false if any article couldn't be cancelled
+**  for another reason than being already gone or its storage method not
+**  being available, with the error of the last such failure.
+*/
+bool
+SMcancelbatch(TOKEN *tokens, size_t count)
+{
+    size_t i;
+    bool success = true;
+
+    if (!SMopenmode) {
+        SMseterror(SMERR_INTERNAL, "read only storage api");
+        return false;
+    }
+    qsort(tokens, count, sizeof(TOKEN), tokencmp);
+    for (i = 0; i < count; i++)
+        if (!SMcancel(tokens[i]) && SMerrno != SMERR_NOENT
+            && SMerrno != SMERR_UNINIT)
+            success = false;
+    SMflushcacheddata(SM_CANCELLEDART);
+    return success;
 }
 
 bool SMprobe(PROBETYPE type, TOKEN *token, void *value) {
     struct artngnum	*ann;
     ARTHANDLE		*art;
+    int			i;
+    bool		status;
 
+    i = typetoindex[token->type];
     switch (type) {
     case SELFEXPIRE:
-	return (method_data[typetoindex[token->type]].selfexpire);
+	return (method_data[i].selfexpire);
     case SMARTNGNUM:
-	if (method_data[typetoindex[token->type]].initialized == INIT_FAIL) {
+	if (method_data[i].initialized == INIT_FAIL) {
 	    SMseterror(SMERR_UNINIT, NULL);
 	    return false;
 	}
-	if (method_data[typetoindex[token->type]].initialized == INIT_NO && !InitMethod(typetoindex[token->type])) {
+	if (method_data[i].initialized == INIT_NO && !InitMethod(i)) {
 	    SMseterror(SMERR_UNINIT, NULL);
 	    warn("SM: can't probe article with uninitialized method");
 	    return false;
@@ -740,48 +1141,89 @@ bool SMprobe(PROBETYPE type, TOKEN *token, void *value) {
 	if ((ann = (struct artngnum *)value) == NULL)
 	    return false;
 	ann->groupname = NULL;
-	if (storage_methods[typetoindex[token->type]].ctl(type, token, value)) {
-	    if (ann->artnum != 0) {
-		/* set by storage method */
-		return true;
-	    } else {
-		art = storage_methods[typetoindex[token->type]].retrieve(*token, RETR_HEAD);
-		if (art == NULL) {
-		    if (ann->groupname != NULL)
-			free(ann->groupname);
-		    storage_methods[typetoindex[token->type]].freearticle(art);
-		    return false;
-		}
-		if ((ann->groupname = GetXref(art)) == NULL) {
-		    if (ann->groupname != NULL)
-			free(ann->groupname);
-		    storage_methods[typetoindex[token->type]].freearticle(art);
-		    return false;
-		}
-		storage_methods[typetoindex[token->type]].freearticle(art);
-		if ((ann->artnum = GetGroups(ann->groupname)) == 0) {
-		    if (ann->groupname != NULL)
-			free(ann->groupname);
-		    return false;
-		}
-		return true;
-	    }
-	} else {
+	SMlockmethod(i);
+	status = storage_methods[i].ctl(type, token, value);
+	SMunlockmethod(i);
+	if (!status)
 	    return false;
+	if (ann->artnum != 0) {
+	    /* set by storage method */
+	    return true;
 	}
+	SMlockmethod(i);
+	art = storage_methods[i].retrieve(*token, RETR_HEAD);
+	if (art != NULL) {
+	    ann->groupname = GetXref(art);
+	    storage_methods[i].freearticle(art);
+	}
+	SMunlockmethod(i);
+	if (ann->groupname == NULL)
+	    return false;
+	if ((ann->artnum = GetGroups(ann->groupname)) == 0) {
+	    free(ann->groupname);
+	    return false;
+	}
+	return true;
     case EXPENSIVESTAT:
-	return (method_data[typetoindex[token->type]].expensivestat);
+	return (method_data[i].expensivestat);
+    case THREADSAFE:
+	if (method_data[i].initialized == INIT_FAIL
+	    || (method_data[i].initialized == INIT_NO && !InitMethod(i)))
+	    return false;
+	return method_data[i].threadsafe;
+    case SMPREFETCH:
+	if (method_data[i].initialized == INIT_FAIL
+	    || (method_data[i].initialized == INIT_NO && !InitMethod(i)))
+	    return false;
+	SMlockmethod(i);
+	status = storage_methods[i].ctl(type, token, value);
+	SMunlockmethod(i);
+	return status;
+    case SMARTFILE:
+	/* The article has been retrieved, so the method is initialized. */
+	if (value == NULL || ((struct artfile *)value)->art == NULL
+	    || method_data[i].initialized != INIT_DONE)
+	    return false;
+	SMlockmethod(i);
+	status = storage_methods[i].ctl(type, token, value);
+	SMunlockmethod(i);
+	return status;
     default:
 	return false;
     }
 }
 
+/*
+**  Tell the storage methods that the articles of the count tokens, given in
+**  the order in which they are likely to be retrieved, will be retrieved
+**  soon, so that they start reading them in the background.  Returns the
+**  number of articles whose reading could be started.
+*/
+size_t
+SMadvise(const TOKEN *tokens, size_t count)
+{
+    TOKEN token;
+    size_t i, started;
+
+    for (started = 0, i = 0; i < count; i++) {
+        token = tokens[i];
+        if (SMprobe(SMPREFETCH, &token, NULL))
+            started++;
+    }
+    return started;
+}
+
 bool SMflushcacheddata(FLUSHTYPE type) {
     int		i;
+    bool	status;
 
     for (i = 0; i < NUM_STORAGE_METHODS; i++) {
-	if (method_data[i].initialized == INIT_DONE &&
-	    !storage_methods[i].flushcacheddata(type))
+	if (method_data[i].initialized != INIT_DONE)
+	    continue;
+	SMlockmethod(i);
+	status = storage_methods[i].flushcacheddata(type);
+	SMunlockmethod(i);
+	if (!status)
 	    warn("SM: can't flush cached data method '%s'",
                  storage_methods[i].name);
     }
@@ -789,6 +1231,8 @@ bool SMflushcacheddata(FLUSHTYPE type) {
 }
 
 void SMprintfiles(FILE *file, TOKEN token, char **xref, int ngroups) {
+    int		i;
+
     if (method_data[typetoindex[token.type]].initialized == INIT_FAIL)
 	return;
     if (method_data[typetoindex[token.type]].initialized == INIT_NO
@@ -797,7 +1241,10 @@ void SMprintfiles(FILE *file, TOKEN token, char **xref, int ngroups) {
 	warn("SM: can't print files for article with uninitialized method");
 	return;
     }
-    storage_methods[typetoindex[token.type]].printfiles(file, token, xref, ngroups);
+    i = typetoindex[token.type];
+    SMlockmethod(i);
+    storage_methods[i].printfiles(file, token, xref, ngroups);
+    SMunlockmethod(i);
 }
 
 /*
@@ -809,7 +1256,44 @@ SMexplaintoken(const TOKEN token)
     return storage_methods[typetoindex[token.type]].explaintoken(token);
 }
 
-void SMshutdown(void) {
+/*
+**  Append a line per method and operation that has been timed to output,
+**  with the latency summary in microseconds, and optionally start again
+**  from empty histograms.
+*/
+void SMlatency(struct buffer *output, bool reset) {
+    int                 i;
+
+    SMlocklatency();
+    for (i = 0; i < NUM_STORAGE_METHODS; i++) {
+        if (store_latency[i] != NULL && histogram_count(store_latency[i]) > 0) {
+            buffer_append_sprintf(output, "storage %s store ",
+                                  storage_methods[i].name);
+            histogram_summary(store_latency[i], output);
+            buffer_append(output, "\n", 1);
+        }
+        if (retrieve_latency[i] != NULL
+            && histogram_count(retrieve_latency[i]) > 0) {
+            buffer_append_sprintf(output, "storage %s retrieve ",
+                                  storage_methods[i].name);
+            histogram_summary(retrieve_latency[i], output);
+            buffer_append(output, "\n", 1);
+        }
+        if (reset) {
+            if (store_latency[i] != NULL)
+                histogram_reset(store_latency[i]);
+            if (retrieve_latency[i] != NULL)
+                histogram_reset(retrieve_latency[i]);
+        }
+    }
+    SMunlocklatency();
+}
+
+/*
+**  Shut down all the methods and forget storage.conf.  No other thread may
+**  be using the storage manager anymore.
+*/
+static void ShutdownAll(void) {
     int                 i;
     STORAGE_SUB         *old;
 
@@ -821,7 +1305,9 @@ void SMshutdown(void) {
 	    storage_methods[i].shutdown();
 	    method_data[i].initialized = INIT_NO;
 	    method_data[i].configured = false;
+	    method_data[i].threadsafe = false;
 	}
+    SMcacheclose();
     while (subscriptions) {
 	old = subscriptions;
 	subscriptions = subscriptions->next;
@@ -832,6 +1318,34 @@ void SMshutdown(void) {
     Initialized = false;
 }
 
+void SMshutdown(void) {
+    SMlockinit();
+    ShutdownAll();
+    SMunlockinit();
+}
+
+/*
+**  Used by methods storing each article in its own file to answer
+**  SMprobe(SMPREFETCH): ask the kernel to read the file in the background.
+*/
+bool
+SMprefetchfile(const char *path)
+{
+#ifdef HAVE_POSIX_FADVISE
+    int fd;
+    bool status;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    status = (posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0);
+    close(fd);
+    return status;
+#else
+    return false;
+#endif
+}
+
 void
 SMseterror(int errornum, const char *error)
 {
@@ -9,16 +9,29 @@
 #include "inn/storage.h"
 #include <stdio.h>
 
+/* Set by the init function of a method; what it doesn't set is false.  A
+   method is threadsafe if its functions may be called by several threads
+   at once, otherwise the storage manager serializes the calls into it. */
 typedef struct {
     bool	selfexpire;
     bool	expensivestat;
+    bool	threadsafe;
 } SMATTRIBUTE;
 
+/* One article passed to the storebatch method, which sets token to the token
+   it was stored with, or to TOKEN_EMPTY if it couldn't be stored. */
+struct sm_record {
+    const ARTHANDLE     *article;
+    STORAGECLASS        class;
+    TOKEN               token;
+};
+
 typedef struct {
     const char          *name;
     unsigned char       type;
     bool                (*init)(SMATTRIBUTE *attr);
     TOKEN               (*store)(const ARTHANDLE article, const STORAGECLASS storageclass);
+    bool                (*storebatch)(struct sm_record *records, size_t count);
     ARTHANDLE           *(*retrieve)(const TOKEN token, const RETRTYPE amount);
     ARTHANDLE           *(*next)(ARTHANDLE *article, const RETRTYPE amount);
     void                (*freearticle)(ARTHANDLE *article);
@@ -36,6 +49,8 @@ typedef struct __S_SUB__ {
     size_t              maxsize;     /* Maximum size to send to this method */
     time_t		minexpire;   /* Minimum expire offset to send method */
     time_t		maxexpire;   /* Maximum expire offset to send method */
+    time_t		minage;      /* Minimum age of articles moved here */
+    time_t		maxage;      /* Maximum age of articles moved here */
     int                 numpatterns; /* Number of patterns in patterns */
     int                 class;       /* Number of the storage class for this subscription */
     char                *pattern;    /* Wildmat pattern to check against the
@@ -45,6 +60,7 @@ typedef struct __S_SUB__ {
 				        method */
     bool		exactmatch;  /* all newsgroups to which article belongs
 				        should match the patterns */
+    bool		compress;    /* compress the bodies of the articles */
     struct __S_SUB__   *next;
 } STORAGE_SUB;
 
@@ -54,5 +70,22 @@ char *SMFindBody(char *article, int len);
 STORAGE_SUB *SMGetConfig(STORAGETYPE type, STORAGE_SUB *sub);
 STORAGE_SUB *SMgetsub(const ARTHANDLE article);
 void SMseterror(int errorno, const char *error);
+bool SMprefetchfile(const char *path);
+bool SMpartitioned(unsigned long unit);
+
+/* Shared article cache, in smcache.c. */
+bool SMcacheopen(void);
+void SMcacheclose(void);
+ARTHANDLE *SMcacheget(const TOKEN token, const RETRTYPE amount);
+void SMcacheput(const TOKEN token, const RETRTYPE amount,
+                const ARTHANDLE *art);
+void SMcachedrop(const TOKEN token);
+bool SMcachefree(ARTHANDLE *art);
+
+/* Compression of article bodies, in smcompress.c. */
+bool SMzipstore(const ARTHANDLE *article, ARTHANDLE *copy);
+void SMzipstorefree(ARTHANDLE *copy);
+ARTHANDLE *SMzipretrieve(ARTHANDLE *art, RETRTYPE amount);
+ARTHANDLE *SMzipinner(ARTHANDLE *art);
 
 #endif /* __INTERFACE_H__ */
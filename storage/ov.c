@@ -14,7 +14,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
 
+#include "inn/buffer.h"
+#include "inn/histogram.h"
 #include "inn/innconf.h"
 #include "inn/messages.h"
 #include "inn/wire.h"
@@ -26,6 +31,23 @@
 
 static bool             OVdelayrm;
 static OV_METHOD	ov;
+static bool             hot;    /* Whether the in-memory tier is in use. */
+
+/* Latencies of the calls into the overview method, by operation. */
+static struct histogram *add_latency;
+static struct histogram *search_latency;
+static struct histogram *getartinfo_latency;
+
+/*
+**  Record the time elapsed since start in *hist, allocating it on first use.
+*/
+static void
+OVrecordlatency(struct histogram **hist, const struct timeval *start)
+{
+    if (*hist == NULL)
+        *hist = histogram_new();
+    histogram_record_since(*hist, start);
+}
 
 time_t	OVrealnow = 0;
 bool    OVstatall = false;
@@ -62,10 +84,16 @@ OVopen(int mode)
     }
     ov = ov_methods[i];
     val = (*ov.open)(mode);
+    if (!val) {
+	/* so that a later call may try again */
+	memset(&ov, '\0', sizeof(ov));
+	return false;
+    }
     if (atexit(OVclose) < 0) {
 	OVclose();
 	return false;
     }
+    hot = OVhotopen();
     return val;
 }
 
@@ -89,7 +117,10 @@ OVgroupadd(char *group, ARTNUM lo, ARTNUM hi, char *flag)
         warn("ovopen must be called first");
 	return false;
     }
-    return ((*ov.groupadd)(group, lo, hi, flag));
+    if (!(*ov.groupadd)(group, lo, hi, flag))
+        return false;
+    OVreploggroupadd(group, lo, hi, flag);
+    return true;
 }
 
 bool
@@ -100,17 +131,28 @@ OVgroupdel(char *group)
         warn("ovopen must be called first");
 	return false;
     }
-    return ((*ov.groupdel)(group));
+    if (!(*ov.groupdel)(group))
+        return false;
+    OVreploggroupdel(group);
+    OVhotdrop(group);
+    return true;
 }
 
-OVADDRESULT
-OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires)
+/*
+**  Parse the Xref field of the overview data for one article and add a
+**  record to set for each group it should be stored in, tagged with article.
+**  The records added for this article are dropped again if it can't be
+**  stored at all.
+*/
+static OVADDRESULT
+OVaddrecords(struct ov_recordset *set, size_t article, TOKEN token,
+             char *data, int len, time_t arrived, time_t expires)
 {
     char		*next, *nextcheck;
-    static char		*xrefdata, *patcheck, *overdata;
+    static char		*xrefdata, *patcheck;
     char                *xrefstart = NULL;
     char		*xrefend;
-    static int		xrefdatalen = 0, overdatalen = 0;
+    static int		xrefdatalen = 0;
     bool		found = false;
     int			xreflen;
     int			i;
@@ -118,12 +160,6 @@ OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires)
     ARTNUM		artnum;
     enum uwildmat       groupmatch;
 
-    if (!ov.open) {
-	/* Must be opened. */
-        warn("ovopen must be called first");
-	return OVADDFAILED;
-    }
-
     /*
      * Find last Xref: in the overview line.  Note we need to find the *last*
      * Xref:, since there have been corrupted articles on Usenet with Xref:
@@ -170,14 +206,6 @@ OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires)
         if (innconf->ovgrouppat != NULL)
             patcheck = xrealloc(patcheck, xrefdatalen + 1);
     }
-    if (overdatalen == 0) {
-	overdatalen = BIG_BUFFER;
-	overdata = xmalloc(overdatalen);
-    }
-    if (len + 16 > overdatalen) {
-	overdatalen = len + 16;
-        overdata = xrealloc(overdata, overdatalen);
-    }
 
     if (innconf->ovgrouppat != NULL) {
         memcpy(patcheck, next, xreflen);
@@ -208,8 +236,10 @@ OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires)
         /* Parse the Xref: part into group name and article number. */
         while (isspace((unsigned char) *group))
             group++;
-        if ((next = memchr(group, ':', xreflen - (group - xrefdata))) == NULL)
+        if ((next = memchr(group, ':', xreflen - (group - xrefdata))) == NULL) {
+            OVrecordsdrop(set, article);
             return OVADDFAILED;
+        }
         *next++ = '\0';
         artnum = atoi(next);
         if (artnum <= 0)
@@ -221,20 +251,72 @@ OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires)
             continue;
         }
 
-        sprintf(overdata, "%ld\t", artnum);
-        i = strlen(overdata);
-        memcpy(overdata + i, data, len);
-        i += len;
-        memcpy(overdata + i, "\r\n", 2);
-        i += 2;
-
-	if(! (*ov.add)(group, artnum, token, overdata, i, arrived, expires))
-	    return OVADDFAILED;
+        OVrecordsadd(set, group, artnum, token, data, len, arrived, expires,
+                     article);
     }
 
     return OVADDCOMPLETED;
 }
 
+OVADDRESULT
+OVadd(TOKEN token, char *data, int len, time_t arrived, time_t expires)
+{
+    OVBATCH article;
+
+    article.token = token;
+    article.data = data;
+    article.len = len;
+    article.arrived = arrived;
+    article.expires = expires;
+    OVaddbatch(&article, 1);
+    return article.result;
+}
+
+/*
+**  Store the overview data for several articles with a single call to the
+**  overview method, which can then batch its writes.  Sets the result of
+**  each article as OVadd would have returned it, and returns false if any of
+**  them failed.
+*/
+bool
+OVaddbatch(OVBATCH *articles, size_t count)
+{
+    static struct ov_recordset *set = NULL;
+    size_t i;
+    bool success = true;
+    struct timeval start;
+
+    if (!ov.open) {
+	/* Must be opened. */
+        warn("ovopen must be called first");
+        for (i = 0; i < count; i++)
+            articles[i].result = OVADDFAILED;
+	return false;
+    }
+    gettimeofday(&start, NULL);
+    if (set == NULL)
+        set = OVrecordsnew();
+    OVrecordsclear(set);
+    for (i = 0; i < count; i++)
+        articles[i].result = OVaddrecords(set, i, articles[i].token,
+                                          articles[i].data, articles[i].len,
+                                          articles[i].arrived,
+                                          articles[i].expires);
+    if (!OVrecordsstore(set, &ov))
+        for (i = 0; i < set->count; i++)
+            if (!set->records[i].stored)
+                articles[set->articles[i]].result = OVADDFAILED;
+    OVrecordlatency(&add_latency, &start);
+    for (i = 0; i < count; i++) {
+        if (articles[i].result == OVADDFAILED)
+            success = false;
+        else if (articles[i].result == OVADDCOMPLETED)
+            OVarrivaladd(articles[i].token, articles[i].data,
+                         articles[i].len, articles[i].arrived);
+    }
+    return success;
+}
+
 bool
 OVcancel(TOKEN token)
 {
@@ -281,7 +363,10 @@ OVcancel(TOKEN token)
 
         /* Don't worry about the return status; the article may have already
            expired out of some or all of the groups. */
-        (*ov.cancel)(group, artnum);
+        if ((*ov.cancel)(group, artnum)) {
+            OVreplogcancel(group, artnum);
+            OVhotcancel(group, artnum);
+        }
     }
     free(xref_copy);
     cvector_free(groups);
@@ -300,6 +385,8 @@ OVopensearch(char *group, int low, int high)
         warn("ovopen must be called first");
 	return false;
     }
+    if (hot)
+        return OVhotopensearch(&ov, group, low, high);
     return ((*ov.opensearch)(group, low, high));
 }
 
@@ -307,12 +394,21 @@ bool
 OVsearch(void *handle, ARTNUM *artnum, char **data, int *len, TOKEN *token,
          time_t *arrived)
 {
+    struct timeval start;
+    bool found;
+
     if (!ov.open) {
 	/* must be opened */
 	warn("ovopen must be called first");
 	return false;
     }
-    return ((*ov.search)(handle, artnum, data, len, token, arrived));
+    gettimeofday(&start, NULL);
+    if (hot)
+        found = OVhotsearch(&ov, handle, artnum, data, len, token, arrived);
+    else
+        found = (*ov.search)(handle, artnum, data, len, token, arrived);
+    OVrecordlatency(&search_latency, &start);
+    return found;
 }
 
 void
@@ -323,30 +419,44 @@ OVclosesearch(void *handle)
 	warn("ovopen must be called first");
 	return;
     }
-    (*ov.closesearch)(handle);
+    if (hot)
+        OVhotclosesearch(&ov, handle);
+    else
+        (*ov.closesearch)(handle);
     return;
 }
 
 bool
 OVgetartinfo(char *group, ARTNUM artnum, TOKEN *token)
 {
+    struct timeval start;
+    bool found;
+
     if (!ov.open) {
 	/* must be opened */
 	warn("ovopen must be called first");
 	return false;
     }
-    return ((*ov.getartinfo)(group, artnum, token));
+    gettimeofday(&start, NULL);
+    found = (*ov.getartinfo)(group, artnum, token);
+    OVrecordlatency(&getartinfo_latency, &start);
+    return found;
 }
 
 bool
 OVexpiregroup(char *group, int *lo, struct history *h)
 {
+    bool status;
+
     if (!ov.open) {
 	/* must be opened */
 	warn("ovopen must be called first");
 	return false;
     }
-    return ((*ov.expiregroup)(group, lo, h));
+    status = OVreplogexpire(&ov, group, lo, h);
+    OVhotdrop(group);
+    OVEXPflush();
+    return status;
 }
 
 bool
@@ -386,11 +496,54 @@ OVctl(OVCTLTYPE type, void *val)
     case OVSTATALL:
 	OVstatall = *(bool *)val;
 	return true;
+    case OVEXPIRESTATS:
+	((OVEXPSTATS *)val)->processed = EXPprocessed;
+	((OVEXPSTATS *)val)->dropped = EXPunlinked;
+	((OVEXPSTATS *)val)->indexdropped = EXPoverindexdrop;
+	EXPprocessed = EXPunlinked = EXPoverindexdrop = 0;
+	return true;
+    case OVTOKENLOOKUP:
+	return OVtokenlookup(&ov, (OVTOKENINFO *)val);
     default:
 	return ((*ov.ctl)(type, val));
     }
 }
 
+/*
+**  Append a line per timed operation of the overview method to output, with
+**  the latency summary in microseconds, and optionally reset the histograms.
+**  Does nothing if the overview isn't open, since the method name is then
+**  unknown.
+*/
+void
+OVlatency(struct buffer *output, bool reset)
+{
+    static const struct {
+        const char *name;
+        struct histogram **hist;
+    } ops[] = {
+        { "add",        &add_latency        },
+        { "search",     &search_latency     },
+        { "getartinfo", &getartinfo_latency },
+    };
+    size_t i;
+
+    if (!ov.open)
+        return;
+    for (i = 0; i < ARRAY_SIZE(ops); i++) {
+        if (*ops[i].hist == NULL)
+            continue;
+        if (histogram_count(*ops[i].hist) > 0) {
+            buffer_append_sprintf(output, "overview %s %s ", ov.name,
+                                  ops[i].name);
+            histogram_summary(*ops[i].hist, output);
+            buffer_append(output, "\n", 1);
+        }
+        if (reset)
+            histogram_reset(*ops[i].hist);
+    }
+}
+
 void
 OVclose(void)
 {
@@ -399,4 +552,130 @@ OVclose(void)
     (*ov.close)();
     memset(&ov, '\0', sizeof(ov));
     OVEXPcleanup();
+    OVarrivalclose();
+    OVreplogclose();
+    OVhotclose();
+    OVtokenclose();
+    hot = false;
+}
+
+/*
+**  Return the overview method in use, or NULL if the overview isn't open.
+*/
+const OV_METHOD *
+OVmethod(void)
+{
+    return ov.open ? &ov : NULL;
+}
+
+/*
+**  Record sets collect the per-group overview records for the addbatch
+**  method.  The group name and the overview line (with the article number
+**  in front and CRLF at the end, as the methods expect) of every record are
+**  appended to a single buffer, and the pointers in the records are only
+**  filled in by OVrecordsstore once the buffer won't move anymore.
+*/
+struct ov_recordset *
+OVrecordsnew(void)
+{
+    struct ov_recordset *set;
+
+    set = xcalloc(1, sizeof(struct ov_recordset));
+    set->text = buffer_new();
+    return set;
+}
+
+void
+OVrecordsclear(struct ov_recordset *set)
+{
+    set->count = 0;
+    buffer_set(set->text, NULL, 0);
+}
+
+void
+OVrecordsadd(struct ov_recordset *set, const char *group, ARTNUM artnum,
+             TOKEN token, const char *data, int len, time_t arrived,
+             time_t expires, size_t article)
+{
+    struct ov_record *record;
+    size_t start;
+
+    if (set->count == set->size) {
+        set->size = (set->size == 0) ? 16 : set->size * 2;
+        set->records = xreallocarray(set->records, set->size,
+                                     sizeof(struct ov_record));
+        set->offsets = xreallocarray(set->offsets, set->size,
+                                     sizeof(size_t));
+        set->articles = xreallocarray(set->articles, set->size,
+                                      sizeof(size_t));
+    }
+    record = &set->records[set->count];
+    set->offsets[set->count] = set->text->left;
+    set->articles[set->count] = article;
+    set->count++;
+
+    buffer_append(set->text, group, strlen(group) + 1);
+    start = set->text->left;
+    buffer_append_sprintf(set->text, "%lu\t", artnum);
+    buffer_append(set->text, data, len);
+    buffer_append(set->text, "\r\n", 2);
+
+    record->group = NULL;
+    record->artnum = artnum;
+    record->token = token;
+    record->data = NULL;
+    record->len = set->text->left - start;
+    record->arrived = arrived;
+    record->expires = expires;
+    record->stored = false;
+}
+
+/*
+**  Remove the records for article, which must be the last ones added.
+*/
+void
+OVrecordsdrop(struct ov_recordset *set, size_t article)
+{
+    while (set->count > 0 && set->articles[set->count - 1] == article) {
+        set->count--;
+        set->text->left = set->offsets[set->count];
+    }
+}
+
+/*
+**  Hand all the records in the set to the addbatch method of the given
+**  overview method.  Returns true if every record was stored; otherwise, the
+**  stored flag of each record says which ones were.
+*/
+bool
+OVrecordsstore(struct ov_recordset *set, const OV_METHOD *method)
+{
+    struct ov_record *record;
+    size_t i;
+    bool status;
+
+    if (set->count == 0)
+        return true;
+    for (i = 0; i < set->count; i++) {
+        record = &set->records[i];
+        record->group = set->text->data + set->offsets[i];
+        record->data = (char *) record->group + strlen(record->group) + 1;
+    }
+    status = (*method->addbatch)(set->records, set->count);
+    OVreplogadd(set->records, set->count);
+    OVhotadd(set->records, set->count);
+    OVtokenadd(set->records, set->count);
+    return status;
+}
+
+void
+OVrecordsfree(struct ov_recordset *set)
+{
+    if (set == NULL)
+        return;
+    free(set->records);
+    free(set->offsets);
+    free(set->articles);
+    buffer_free(set->text);
+    free(set);
 }
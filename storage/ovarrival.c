@@ -0,0 +1,346 @@
+/*
+**  The log of article arrivals, used to answer NEWNEWS.
+**
+**  When newnewsindexhours is set, every article whose overview data is
+**  stored is also appended to a log of arrivals in the arrivals directory
+**  under pathoverview.  The log is split in one file per hour of arrival,
+**  named after the number of hours since the epoch, so that a reader only
+**  opens the files covering the time it is asked about and old files are
+**  simply removed.  Each line holds the arrival time, the storage token,
+**  the message-ID and the newsgroup:number pairs of the Xref header field,
+**  separated by spaces.
+**
+**  Lines are written with O_APPEND in a single write, so several writers
+**  don't mix their lines.  A reader may see the last line of a file only
+**  partly written; such a line has no newline and is skipped.
+**
+**  The directory also holds a file named start, created with it, whose
+**  modification time tells since when arrivals are logged.  Readers must
+**  fall back on searching overview for earlier times.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/overview.h"
+#include "inn/paths.h"
+#include "inn/qio.h"
+#include "ovinterface.h"
+
+#define ARRIVAL_HOUR(t) ((unsigned long) (t) / (60 * 60))
+
+/* The bucket currently open for writing. */
+static int arrival_fd = -1;
+static unsigned long arrival_hour;
+
+/* State of a read through the log. */
+struct arrival_search {
+    char *dir;
+    time_t since;
+    unsigned long hour;         /* Bucket currently read. */
+    unsigned long last;         /* Last bucket to read. */
+    QIOSTATE *qp;
+};
+
+
+/*
+**  Return the path to a file in the arrivals directory, to be freed by the
+**  caller.
+*/
+static char *
+arrival_path(const char *dir, unsigned long hour)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "%lu", hour);
+    return concatpath(dir, name);
+}
+
+
+/*
+**  Create the arrivals directory and its start file if needed.  Returns
+**  false if the directory can't be used.
+*/
+static bool
+arrival_setup(const char *dir)
+{
+    char *path;
+    int fd;
+
+    if (mkdir(dir, GROUPDIR_MODE) < 0 && errno != EEXIST) {
+        syswarn("cannot create %s", dir);
+        return false;
+    }
+    path = concatpath(dir, "start");
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, ARTFILE_MODE);
+    if (fd < 0 && errno != EEXIST) {
+        syswarn("cannot create %s", path);
+        free(path);
+        return false;
+    }
+    if (fd >= 0)
+        close(fd);
+    free(path);
+    return true;
+}
+
+
+/*
+**  Remove the buckets that fell out of the time kept.  Called each time a
+**  writer opens a new bucket, so about once per hour.
+*/
+static void
+arrival_prune(const char *dir, unsigned long oldest)
+{
+    DIR *dp;
+    struct dirent *ep;
+    char *path, *end;
+    unsigned long hour;
+
+    dp = opendir(dir);
+    if (dp == NULL)
+        return;
+    while ((ep = readdir(dp)) != NULL) {
+        if (!isdigit((unsigned char) ep->d_name[0]))
+            continue;
+        hour = strtoul(ep->d_name, &end, 10);
+        if (*end != '\0' || hour >= oldest)
+            continue;
+        path = concatpath(dir, ep->d_name);
+        if (unlink(path) < 0 && errno != ENOENT)
+            syswarn("cannot remove %s", path);
+        free(path);
+    }
+    closedir(dp);
+}
+
+
+/*
+**  Find the field of an overview line, as given to OVadd (so without the
+**  article number), that starts after the given number of tabs.  Sets its
+**  length and returns a pointer to it, or NULL if there are not enough
+**  fields.
+*/
+static const char *
+arrival_field(const char *data, int len, int tabs, size_t *length)
+{
+    const char *p = data, *end = data + len, *next;
+
+    for (; tabs > 0; tabs--) {
+        p = memchr(p, '\t', end - p);
+        if (p == NULL)
+            return NULL;
+        p++;
+    }
+    next = memchr(p, '\t', end - p);
+    *length = (next != NULL ? next : end) - p;
+    return p;
+}
+
+
+/*
+**  Log the arrival of an article whose overview was just stored.  Failures
+**  are only warned about, since NEWNEWS will use overview whenever the log
+**  can't be trusted.
+*/
+void
+OVarrivaladd(TOKEN token, const char *data, int len, time_t arrived)
+{
+    static char *dir = NULL;
+    const char *msgid, *xref, *p, *end;
+    size_t msgidlen, xreflen;
+    unsigned long hour, now;
+    char *path, *line;
+
+    if (innconf->newnewsindexhours == 0)
+        return;
+    now = ARRIVAL_HOUR(time(NULL));
+    if (ARRIVAL_HOUR(arrived) + innconf->newnewsindexhours <= now)
+        return;
+
+    /* Find the message-ID and the newsgroups in the last Xref field, after
+       the name of the server. */
+    msgid = arrival_field(data, len, OVERVIEW_MESSAGE_ID, &msgidlen);
+    if (msgid == NULL || msgidlen == 0 || memchr(msgid, ' ', msgidlen) != NULL)
+        return;
+    xref = NULL;
+    end = data + len;
+    for (p = data; (p = memchr(p, '\t', end - p)) != NULL; p++)
+        if (end - p > 6 && strncasecmp(p + 1, "Xref: ", 6) == 0)
+            xref = p + 7;
+    if (xref == NULL)
+        return;
+    p = memchr(xref, '\t', end - xref);
+    xreflen = (p != NULL ? p : end) - xref;
+    p = memchr(xref, ' ', xreflen);
+    if (p == NULL)
+        return;
+    xreflen -= p + 1 - xref;
+    xref = p + 1;
+
+    if (dir == NULL) {
+        dir = concatpath(innconf->pathoverview, INN_PATH_ARRIVALS);
+        if (!arrival_setup(dir)) {
+            free(dir);
+            dir = NULL;
+            return;
+        }
+    }
+    hour = ARRIVAL_HOUR(arrived);
+    if (arrival_fd < 0 || hour != arrival_hour) {
+        if (arrival_fd >= 0)
+            close(arrival_fd);
+        path = arrival_path(dir, hour);
+        arrival_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, ARTFILE_MODE);
+        if (arrival_fd < 0) {
+            syswarn("cannot open %s", path);
+            free(path);
+            return;
+        }
+        fdflag_close_exec(arrival_fd, true);
+        free(path);
+        arrival_hour = hour;
+        if (hour == now)
+            arrival_prune(dir, now + 1 - innconf->newnewsindexhours);
+    }
+
+    xasprintf(&line, "%lu %s %.*s %.*s\n", (unsigned long) arrived,
+              TokenToText(token), (int) msgidlen, msgid, (int) xreflen, xref);
+    if (xwrite(arrival_fd, line, strlen(line)) < 0)
+        syswarn("cannot write to arrivals log");
+    free(line);
+}
+
+
+/*
+**  Close the bucket open for writing, if any.
+*/
+void
+OVarrivalclose(void)
+{
+    if (arrival_fd >= 0) {
+        close(arrival_fd);
+        arrival_fd = -1;
+    }
+}
+
+
+/*
+**  Start reading the arrivals since the given time.  Returns NULL if they
+**  are not all in the log, either because it is not kept or because it
+**  doesn't go back that far; the caller should then search overview.
+*/
+void *
+OVopenarrivals(time_t since)
+{
+    struct arrival_search *search;
+    struct stat st;
+    char *dir, *path;
+    unsigned long now;
+
+    if (innconf->newnewsindexhours == 0)
+        return NULL;
+    now = ARRIVAL_HOUR(time(NULL));
+    if (ARRIVAL_HOUR(since) + innconf->newnewsindexhours <= now)
+        return NULL;
+    dir = concatpath(innconf->pathoverview, INN_PATH_ARRIVALS);
+    path = concatpath(dir, "start");
+    if (stat(path, &st) < 0 || st.st_mtime > since) {
+        free(path);
+        free(dir);
+        return NULL;
+    }
+    free(path);
+
+    search = xcalloc(1, sizeof(struct arrival_search));
+    search->dir = dir;
+    search->since = since;
+    search->hour = ARRIVAL_HOUR(since);
+    search->last = now;
+    return search;
+}
+
+
+/*
+**  Return the next arrival of the log at or after the time given to
+**  OVopenarrivals, in order of arrival.  The strings returned point into
+**  internal storage and are only valid until the next call.  Returns false
+**  at the end of the log.
+*/
+bool
+OVarrival(void *handle, OVARRIVAL *arrival)
+{
+    struct arrival_search *search = handle;
+    char *line, *p, *token, *path;
+
+    for (;;) {
+        if (search->qp == NULL) {
+            if (search->hour > search->last)
+                return false;
+            path = arrival_path(search->dir, search->hour);
+            search->qp = QIOopen(path);
+            if (search->qp == NULL && errno != ENOENT)
+                syswarn("cannot open %s", path);
+            free(path);
+            if (search->qp == NULL) {
+                search->hour++;
+                continue;
+            }
+        }
+        line = QIOread(search->qp);
+        if (line == NULL && QIOtoolong(search->qp))
+            continue;
+        if (line == NULL) {
+            QIOclose(search->qp);
+            search->qp = NULL;
+            search->hour++;
+            continue;
+        }
+
+        /* arrived token msgid groups */
+        arrival->arrived = strtoul(line, &p, 10);
+        if (*p != ' ' || arrival->arrived < search->since)
+            continue;
+        token = p + 1;
+        p = strchr(token, ' ');
+        if (p == NULL)
+            continue;
+        *p++ = '\0';
+        if (!IsToken(token))
+            continue;
+        arrival->token = TextToToken(token);
+        arrival->msgid = p;
+        p = strchr(p, ' ');
+        if (p == NULL)
+            continue;
+        *p++ = '\0';
+        arrival->groups = p;
+        return true;
+    }
+}
+
+
+/*
+**  Stop reading the log.
+*/
+void
+OVclosearrivals(void *handle)
+{
+    struct arrival_search *search = handle;
+
+    if (search->qp != NULL)
+        QIOclose(search->qp);
+    free(search->dir);
+    free(search);
+}
@@ -51,6 +51,7 @@ struct ovdb_conf {
     int useshm;
     int shmkey;
     int compress;
+    int writethreads;
 };
 
 typedef u_int32_t group_id_t;
@@ -122,13 +123,16 @@ bool ovdb_check_user(void);
 #define CMD_SRCH	0x04
 #define CMD_CLOSESRCH	0x05
 #define CMD_ARTINFO	0x06
+#define CMD_SRCHBATCH	0x07
 #define CMD_MASK	0x0F
 #define RPLY_OK		0x00
 #define RPLY_ERROR	0x10
 #define OVDB_SERVER	(1<<4)
-#define OVDB_SERVER_BANNER "ovdb read protocol 1"
+#define OVDB_SERVER_BANNER "ovdb read protocol 2"
 #define OVDB_SERVER_PORT 32323	/* only used if don't have unix domain sockets */
 #define OVDB_SERVER_SOCKET "ovdb.server"
+#define OVDB_SERVER_BATCH 128	/* most records in a CMD_SRCHBATCH reply */
+#define OVDB_SERVER_BATCH_SIZE (64 * 1024)	/* and most bytes, roughly */
 
 struct rs_cmd {
     uint32_t	what;
@@ -162,6 +166,15 @@ struct rs_srch {
     /* char data */
 };
 
+/* Followed by count records, each a struct rs_srch and its data, for len
+   bytes in all.  done is set once the search has no more records. */
+struct rs_srchbatch {
+    uint32_t	status;
+    uint32_t	count;
+    uint32_t	len;
+    uint32_t	done;
+};
+
 struct rs_artinfo {
     uint32_t	status;
     TOKEN	token;
@@ -79,6 +79,9 @@
 # include <limits.h>
 #endif
 #include <signal.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 #ifdef HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif
@@ -132,6 +135,9 @@ bool ovdb_groupdel(const char *group UNUSED)
 bool ovdb_add(const char *group UNUSED, ARTNUM artnum UNUSED, TOKEN token UNUSED, char *data UNUSED, int len UNUSED, time_t arrived UNUSED, time_t expires UNUSED)
 { return false; }
 
+bool ovdb_addbatch(struct ov_record *records UNUSED, size_t count UNUSED)
+{ return false; }
+
 bool ovdb_cancel(const char *group UNUSED, ARTNUM artnum UNUSED)
 { return false; }
 
@@ -188,6 +194,7 @@ static DB *groupaliases = NULL;
 #define OVDBshmkey	12
 #define OVDBcompress	13
 #define OVDBncache	14
+#define OVDBwritethreads 15
 
 static CONFTOKEN toks[] = {
     { OVDBtxn_nosync,   (char *) "txn_nosync"   },
@@ -204,6 +211,7 @@ static CONFTOKEN toks[] = {
     { OVDBshmkey,       (char *) "shmkey"       },
     { OVDBcompress,     (char *) "compress"     },
     { OVDBncache,       (char *) "ncache"       },
+    { OVDBwritethreads, (char *) "writethreads" },
     { 0,                NULL                    }
 };
 
@@ -342,11 +350,91 @@ static int client_connect(void)
     return 0;
 }
 
+/* A search in the read server, as seen by the client.  Its records come in
+   batches, and the next batch is asked for as soon as one arrives, so that
+   the server looks it up while the caller goes through the one it has.  A
+   batch that was asked for has to be read before sending anything else to
+   the server. */
+struct client_batch {
+    char *data;
+    size_t size;
+    size_t length;
+    size_t used;
+    uint32_t left;
+};
+
+struct client_search {
+    void *handle;
+    struct client_batch current;
+    struct client_batch next;
+    bool pending;
+    bool done;
+};
+
+static struct client_search *client_pending = NULL;
+
+/* Ask the server for the next batch of records of a search. */
+static bool
+client_request(struct client_search *cs)
+{
+    struct rs_cmd rs;
+
+    memset(&rs, 0, sizeof(rs));
+    rs.what = CMD_SRCHBATCH;
+    rs.arthi = OVDB_SERVER_BATCH;
+    rs.handle = cs->handle;
+    if (csend(&rs, sizeof(rs)) < 0) {
+	cs->done = true;
+	return false;
+    }
+    cs->pending = true;
+    client_pending = cs;
+    return true;
+}
+
+/* Read the batch asked for into the next batch of a search, which the
+   caller has to have gone through. */
+static bool
+client_receive(struct client_search *cs)
+{
+    struct rs_srchbatch repl;
+    struct client_batch *b = &cs->next;
+
+    cs->pending = false;
+    client_pending = NULL;
+    crecv(&repl, sizeof(repl));
+    if (repl.status != CMD_SRCHBATCH) {
+	cs->done = true;
+	return false;
+    }
+    if (repl.len > b->size) {
+	b->size = repl.len;
+	b->data = xrealloc(b->data, b->size);
+    }
+    crecv(b->data, repl.len);
+    b->length = repl.len;
+    b->used = 0;
+    b->left = repl.count;
+    if (repl.done)
+	cs->done = true;
+    return true;
+}
+
+/* Read the reply to a batch asked for, if any, before sending anything else
+   to the server. */
+static void
+client_drain(void)
+{
+    if (client_pending != NULL)
+	client_receive(client_pending);
+}
+
 static void
 client_disconnect(void)
 {
     struct rs_cmd rs;
 
+    client_drain();
     if (clientfd != -1) {
 	rs.what = CMD_QUIT;
 	csend(&rs, sizeof(rs));
@@ -416,6 +504,7 @@ void read_ovdb_conf(void)
     ovdb_conf.useshm = 0;
     ovdb_conf.shmkey = 6400;
     ovdb_conf.compress = 0;
+    ovdb_conf.writethreads = 0;
 
     path = concatpath(innconf->pathetc, _PATH_OVDBCONF);
     f = CONFfopen(path);
@@ -566,6 +655,16 @@ void read_ovdb_conf(void)
 		}
 #endif
 		break;
+	    case OVDBwritethreads:
+		tok = CONFgettoken(0, f);
+		if(!tok) {
+		    done = 1;
+		    continue;
+		}
+		if(conf_long_val(tok->name, &l) && l >= 0) {
+		    ovdb_conf.writethreads = l;
+		}
+		break;
 	    }
 	}
 	CONFfclose(f);
@@ -664,9 +763,9 @@ static DB *get_db_bynum(int which)
 }
 
 
-int
-ovdb_getgroupinfo(const char *group, struct groupinfo *gi, int ignoredeleted,
-                  DB_TXN *tid, int getflags)
+static int
+getgroupinfo(DB *gidb, const char *group, struct groupinfo *gi,
+             int ignoredeleted, DB_TXN *tid, int getflags)
 {
     int ret;
     DBT key, val;
@@ -683,7 +782,7 @@ ovdb_getgroupinfo(const char *group, struct groupinfo *gi, int ignoredeleted,
     val.ulen = sizeof(struct groupinfo);
     val.flags = DB_DBT_USERMEM;
 
-    ret = groupinfo->get(groupinfo, tid, &key, &val, getflags);
+    ret = gidb->get(gidb, tid, &key, &val, getflags);
     if (ret != 0)
 	return ret;
 
@@ -698,6 +797,13 @@ ovdb_getgroupinfo(const char *group, struct groupinfo *gi, int ignoredeleted,
     return 0;
 }
 
+int
+ovdb_getgroupinfo(const char *group, struct groupinfo *gi, int ignoredeleted,
+                  DB_TXN *tid, int getflags)
+{
+    return getgroupinfo(groupinfo, group, gi, ignoredeleted, tid, getflags);
+}
+
 #define GROUPID_MAX_FREELIST 10240
 #define GROUPID_MIN_FREELIST 100
 
@@ -1625,6 +1731,184 @@ bool ovdb_open(int mode)
     return true;
 }
 
+/*
+ * Bulk loading, turned on with OVctl(OVBULKLOAD) by programs rebuilding the
+ * overview, such as makehistory -O.  The records added to a group are kept
+ * in memory and stored in one transaction, committed when a record for
+ * another group comes or after BULK_TXN_SIZE records, so that the groupinfo
+ * of the group is only updated once for all of them.  The log isn't synced
+ * at commit; it is flushed and the environment checkpointed when bulk
+ * loading ends, so a crash before that may lose what was loaded.  Since the
+ * records are kept until committed, a transaction that deadlocks is just
+ * run again.  Records come sorted by group and article number, and the
+ * keys of a group start with its ID, so they are appended to the end of
+ * its range of the btree.
+ */
+#define BULK_TXN_SIZE 1000
+
+struct bulk_record {
+    ARTNUM artnum;
+    char *data;
+    int len;
+};
+
+static struct {
+    bool on;
+    char *group;
+    struct bulk_record *records;
+    size_t count;
+    size_t size;
+} bulk;
+
+/* Store the records kept for a group, in the given transaction.  Returns 0
+   when they were stored or deliberately skipped, TRYAGAIN when the
+   transaction should be run again, or another error. */
+static int
+bulk_store(DB_TXN *tid)
+{
+    DB *db;
+    DBT key, val;
+    struct groupinfo gi;
+    struct datakey dk;
+    struct bulk_record *rec;
+    size_t i;
+    int ret;
+
+    ret = ovdb_getgroupinfo(bulk.group, &gi, true, tid, DB_RMW);
+    if (ret == DB_NOTFOUND)
+	return 0;
+    if (ret != 0)
+	return ret;
+
+    memset(&dk, 0, sizeof dk);
+    memset(&key, 0, sizeof key);
+    memset(&val, 0, sizeof val);
+    key.data = &dk;
+    key.size = sizeof dk;
+    for (i = 0; i < bulk.count; i++) {
+	rec = &bulk.records[i];
+	if (Cutofflow && gi.low > rec->artnum)
+	    continue;
+	if (gi.low == 0 || gi.low > rec->artnum)
+	    gi.low = rec->artnum;
+	if (gi.high < rec->artnum)
+	    gi.high = rec->artnum;
+	gi.count++;
+
+	db = get_db_bynum(gi.current_db);
+	if (db == NULL)
+	    return EINVAL;
+	dk.groupnum = gi.current_gid;
+	dk.artnum = htonl((u_int32_t) rec->artnum);
+	val.data = rec->data;
+	val.size = rec->len;
+	ret = db->put(db, tid, &key, &val, 0);
+	if (ret != 0)
+	    return ret;
+
+	/* See ovdb_add. */
+	if (rec->artnum < gi.high && gi.status & GROUPINFO_MOVING) {
+	    db = get_db_bynum(gi.new_db);
+	    if (db == NULL)
+		return EINVAL;
+	    dk.groupnum = gi.new_gid;
+	    ret = db->put(db, tid, &key, &val, 0);
+	    if (ret != 0)
+		return ret;
+	}
+    }
+
+    key.data = bulk.group;
+    key.size = strlen(bulk.group);
+    val.data = &gi;
+    val.size = sizeof gi;
+    return groupinfo->put(groupinfo, tid, &key, &val, 0);
+}
+
+/* Store the records kept, if any. */
+static bool
+bulk_flush(void)
+{
+    DB_TXN *tid;
+    size_t i;
+    int ret;
+
+    if (bulk.count == 0)
+	return true;
+    do {
+	ret = OVDBenv->txn_begin(OVDBenv, NULL, &tid, 0);
+	if (ret != 0)
+	    break;
+	ret = bulk_store(tid);
+	if (ret == 0)
+	    ret = tid->commit(tid, 0);
+	else
+	    tid->abort(tid);
+    } while (ret == TRYAGAIN);
+    if (ret != 0)
+        warn("OVDB: bulk load of %s: %s", bulk.group, db_strerror(ret));
+
+    for (i = 0; i < bulk.count; i++)
+	free(bulk.records[i].data);
+    bulk.count = 0;
+    return ret == 0;
+}
+
+/* Keep a record for a group, storing those kept before if it's another
+   group or there are enough of them. */
+static bool
+bulk_add(const char *group, ARTNUM artnum, const char *data, int len)
+{
+    struct bulk_record *rec;
+    bool success = true;
+
+    if (bulk.count > 0
+	&& (bulk.count >= BULK_TXN_SIZE || strcmp(group, bulk.group) != 0))
+	success = bulk_flush();
+    if (bulk.count == 0) {
+	free(bulk.group);
+	bulk.group = xstrdup(group);
+    }
+    if (bulk.count == bulk.size) {
+	bulk.size += BULK_TXN_SIZE;
+	bulk.records = xreallocarray(bulk.records, bulk.size,
+				     sizeof(struct bulk_record));
+    }
+    rec = &bulk.records[bulk.count++];
+    rec->artnum = artnum;
+    rec->data = xmalloc(len);
+    memcpy(rec->data, data, len);
+    rec->len = len;
+    return success;
+}
+
+/* Turn bulk loading on or off.  Turning it off stores what is left and
+   makes everything loaded durable. */
+static bool
+bulk_load(bool on)
+{
+    bool success = true;
+
+    if (on == bulk.on)
+	return true;
+    if (on)
+	OVDBenv->set_flags(OVDBenv, DB_TXN_NOSYNC, 1);
+    else {
+	success = bulk_flush();
+	if (!ovdb_conf.txn_nosync)
+	    OVDBenv->set_flags(OVDBenv, DB_TXN_NOSYNC, 0);
+	OVDBenv->log_flush(OVDBenv, NULL);
+	OVDBenv->txn_checkpoint(OVDBenv, 0, 0, 0);
+	free(bulk.records);
+	free(bulk.group);
+	bulk.records = NULL;
+	bulk.group = NULL;
+	bulk.size = 0;
+    }
+    bulk.on = on;
+    return success;
+}
+
 
 bool
 ovdb_groupstats(const char *group, int *lo, int *hi, int *count, int *flag)
@@ -1636,6 +1920,7 @@ ovdb_groupstats(const char *group, int *lo, int *hi, int *count, int *flag)
 	struct rs_cmd rs;
 	struct rs_groupstats repl;
 
+	client_drain();
 	rs.what = CMD_GROUPSTATS;
 	rs.grouplen = strlen(group)+1;
 
@@ -1667,6 +1952,7 @@ ovdb_groupstats(const char *group, int *lo, int *hi, int *count, int *flag)
 	return true;
     }
 
+    bulk_flush();
     ret = ovdb_getgroupinfo(group, &gi, true, NULL, 0);
     switch (ret)
     {
@@ -1908,29 +2194,23 @@ ovdb_groupdel(const char *group)
     return true;
 }
 
-bool
-ovdb_add(const char *group, ARTNUM artnum, TOKEN token, char *data, int len,
-         time_t arrived, time_t expires)
+/* Build the stored form of an overview record in *bufp, growing it as
+   needed, and return its length. */
+static int
+pack_ovdata(char **bufp, size_t *buflenp, TOKEN token, char *data, int len,
+            time_t arrived, time_t expires)
 {
-    static size_t databuflen = 0;
-    static char *databuf;
+    char *databuf;
 #ifdef HAVE_ZLIB
     uLong	c_sz = 0;
+    int ret;
 #else
     #define	c_sz 0
 #endif
-    DB		*db;
-    DBT		key, val;
-    DB_TXN	*tid;
-    struct groupinfo gi;
-    struct datakey dk;
-    int ret = 0;
-
-    memset(&dk, 0, sizeof dk);
 
-    if(databuflen == 0) {
-	databuflen = BIG_BUFFER;
-	databuf = xmalloc(databuflen);
+    if(*buflenp == 0) {
+	*buflenp = BIG_BUFFER;
+	*bufp = xmalloc(*buflenp);
     }
 #ifdef HAVE_ZLIB
     if(ovdb_conf.compress) {
@@ -1939,10 +2219,11 @@ ovdb_add(const char *group, ARTNUM artnum, TOKEN token, char *data, int len,
     }
 #endif
     
-    if(databuflen < len + sizeof(struct ovdata) + c_sz) {
-	databuflen = len + sizeof(struct ovdata) + c_sz;
-        databuf = xrealloc(databuf, databuflen);
+    if(*buflenp < len + sizeof(struct ovdata) + c_sz) {
+	*buflenp = len + sizeof(struct ovdata) + c_sz;
+        *bufp = xrealloc(*bufp, *buflenp);
     }
+    databuf = *bufp;
 
     /* Hmm...  Berkeley DB needs something like a 'struct iovec' so that we don't
        have to make a new buffer and copy everything in to it. */
@@ -1978,7 +2259,31 @@ ovdb_add(const char *group, ARTNUM artnum, TOKEN token, char *data, int len,
       len += sizeof(struct ovdata);
 #ifdef HAVE_ZLIB
     }
+#else
+    #undef c_sz
 #endif
+    return len;
+}
+
+bool
+ovdb_add(const char *group, ARTNUM artnum, TOKEN token, char *data, int len,
+         time_t arrived, time_t expires)
+{
+    static size_t databuflen = 0;
+    static char *databuf;
+    DB		*db;
+    DBT		key, val;
+    DB_TXN	*tid;
+    struct groupinfo gi;
+    struct datakey dk;
+    int ret = 0;
+
+    memset(&dk, 0, sizeof dk);
+
+    len = pack_ovdata(&databuf, &databuflen, token, data, len, arrived,
+                      expires);
+    if (bulk.on)
+	return bulk_add(group, artnum, databuf, len);
 
     memset(&key, 0, sizeof key);
     memset(&val, 0, sizeof val);
@@ -2093,6 +2398,430 @@ ovdb_add(const char *group, ARTNUM artnum, TOKEN token, char *data, int len,
     return true;
 }
 
+#ifdef HAVE_PTHREAD
+
+/*
+ * Writer threads for ovdb_addbatch.  Berkeley DB handles opened by the main
+ * thread are not free-threaded (DB_THREAD is not used, and many gets rely on
+ * library-owned DBT memory), so each writer joins the environment with its
+ * own DB_ENV handle, exactly like a separate process would, and opens its
+ * own groupinfo and overview handles.  Groups are assigned to writers by the
+ * overview file they live in, so two writers never update the same group
+ * and rarely contend for the same btree pages.
+ */
+struct ovdb_writer {
+    pthread_t thread;
+    DB_ENV *env;
+    DB *groupinfo;
+    DB **dbs;
+    char *databuf;
+    size_t databuflen;
+    struct ov_record **records;
+    size_t count;
+    size_t size;
+    bool success;
+};
+
+static struct {
+    struct ovdb_writer *writers;
+    int count;
+    int busy;
+    unsigned long generation;
+    bool shutdown;
+    bool failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+} ovdb_writers;
+
+static DB *
+writer_db(struct ovdb_writer *w, int which)
+{
+    int ret;
+    DB_TXN *tid;
+
+    if (which < 0 || which >= ovdb_conf.numdbfiles)
+	return NULL;
+    if (w->dbs[which] == NULL) {
+	char name[16];
+
+	snprintf(name, sizeof(name), "ov%05d", which);
+	ret = db_create(&w->dbs[which], w->env, 0);
+	if (ret != 0) {
+	    warn("OVDB: writer: db_create: %s", db_strerror(ret));
+	    w->dbs[which] = NULL;
+	    return NULL;
+	}
+	ret = w->env->txn_begin(w->env, NULL, &tid, 0);
+	if (ret == 0) {
+	    ret = w->dbs[which]->open(w->dbs[which], tid, name, NULL,
+				      DB_BTREE, _db_flags, 0666);
+	    if (ret == 0)
+		tid->commit(tid, 0);
+	    else
+		tid->abort(tid);
+	}
+	if (ret != 0) {
+	    warn("OVDB: writer: open %s: %s", name, db_strerror(ret));
+	    w->dbs[which]->close(w->dbs[which], 0);
+	    w->dbs[which] = NULL;
+	}
+    }
+    return w->dbs[which];
+}
+
+/* The body of ovdb_add, against the writer's own handles.  Returns 0 when
+   the record was stored or deliberately skipped, TRYAGAIN when the caller
+   should retry, or another Berkeley DB error. */
+static int
+writer_add(struct ovdb_writer *w, struct ov_record *rec, int len)
+{
+    DB *db;
+    DBT key, val;
+    DB_TXN *tid;
+    struct groupinfo gi;
+    struct datakey dk;
+    int ret;
+
+    ret = w->env->txn_begin(w->env, NULL, &tid, 0);
+    if (ret != 0) {
+	warn("OVDB: writer: txn_begin: %s", db_strerror(ret));
+	return ret;
+    }
+
+    ret = getgroupinfo(w->groupinfo, rec->group, &gi, true, tid, DB_RMW);
+    if (ret == DB_NOTFOUND || (ret == 0 && Cutofflow && gi.low > rec->artnum)) {
+	tid->abort(tid);
+	return 0;
+    }
+    if (ret != 0)
+	goto fail;
+
+    if (gi.low == 0 || gi.low > rec->artnum)
+	gi.low = rec->artnum;
+    if (gi.high < rec->artnum)
+	gi.high = rec->artnum;
+    gi.count++;
+
+    memset(&key, 0, sizeof key);
+    memset(&val, 0, sizeof val);
+    key.data = (char *) rec->group;
+    key.size = strlen(rec->group);
+    val.data = &gi;
+    val.size = sizeof gi;
+    ret = w->groupinfo->put(w->groupinfo, tid, &key, &val, 0);
+    if (ret != 0)
+	goto fail;
+
+    db = writer_db(w, gi.current_db);
+    if (db == NULL) {
+	ret = DB_NOTFOUND;
+	goto fail;
+    }
+    memset(&dk, 0, sizeof dk);
+    dk.groupnum = gi.current_gid;
+    dk.artnum = htonl((u_int32_t)rec->artnum);
+    key.data = &dk;
+    key.size = sizeof dk;
+    val.data = w->databuf;
+    val.size = len;
+    ret = db->put(db, tid, &key, &val, 0);
+    if (ret != 0)
+	goto fail;
+
+    if (rec->artnum < gi.high && gi.status & GROUPINFO_MOVING) {
+	/* See ovdb_add. */
+	db = writer_db(w, gi.new_db);
+	if (db == NULL) {
+	    ret = DB_NOTFOUND;
+	    goto fail;
+	}
+	dk.groupnum = gi.new_gid;
+	ret = db->put(db, tid, &key, &val, 0);
+	if (ret != 0)
+	    goto fail;
+    }
+
+    return tid->commit(tid, 0);
+
+fail:
+    tid->abort(tid);
+    if (ret != TRYAGAIN)
+	warn("OVDB: writer: add %s:%lu: %s", rec->group,
+	     (unsigned long) rec->artnum, db_strerror(ret));
+    return ret;
+}
+
+static void
+writer_run(struct ovdb_writer *w)
+{
+    size_t i;
+    int len, ret;
+    struct ov_record *rec;
+
+    w->success = true;
+    for (i = 0; i < w->count; i++) {
+	rec = w->records[i];
+	len = pack_ovdata(&w->databuf, &w->databuflen, rec->token, rec->data,
+			  rec->len, rec->arrived, rec->expires);
+	do {
+	    ret = writer_add(w, rec, len);
+	} while (ret == TRYAGAIN);
+	rec->stored = (ret == 0);
+	if (!rec->stored)
+	    w->success = false;
+    }
+    w->count = 0;
+}
+
+static void *
+writer_main(void *arg)
+{
+    struct ovdb_writer *w = arg;
+    unsigned long seen = 0;
+    sigset_t set;
+
+    /* Leave signal handling to the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&ovdb_writers.mutex);
+    for (;;) {
+	while (!ovdb_writers.shutdown && ovdb_writers.generation == seen)
+	    pthread_cond_wait(&ovdb_writers.work, &ovdb_writers.mutex);
+	if (ovdb_writers.shutdown)
+	    break;
+	seen = ovdb_writers.generation;
+	pthread_mutex_unlock(&ovdb_writers.mutex);
+
+	writer_run(w);
+
+	pthread_mutex_lock(&ovdb_writers.mutex);
+	if (--ovdb_writers.busy == 0)
+	    pthread_cond_signal(&ovdb_writers.done);
+    }
+    pthread_mutex_unlock(&ovdb_writers.mutex);
+    return NULL;
+}
+
+static void
+close_writer(struct ovdb_writer *w)
+{
+    int i;
+
+    if (w->dbs != NULL) {
+	for (i = 0; i < ovdb_conf.numdbfiles; i++)
+	    if (w->dbs[i] != NULL)
+		w->dbs[i]->close(w->dbs[i], 0);
+	free(w->dbs);
+	w->dbs = NULL;
+    }
+    if (w->groupinfo != NULL) {
+	w->groupinfo->close(w->groupinfo, 0);
+	w->groupinfo = NULL;
+    }
+    if (w->env != NULL) {
+	w->env->close(w->env, 0);
+	w->env = NULL;
+    }
+    free(w->records);
+    w->records = NULL;
+    free(w->databuf);
+    w->databuf = NULL;
+}
+
+/* Open a writer's own environment and groupinfo handles.  The overview
+   files are opened lazily by writer_db. */
+static int
+open_writer(struct ovdb_writer *w)
+{
+    int ret;
+    u_int32_t ai_flags = DB_INIT_LOCK|DB_INIT_LOG|DB_INIT_MPOOL|DB_INIT_TXN;
+    DB_TXN *tid;
+
+    ret = db_env_create(&w->env, 0);
+    if (ret != 0) {
+	w->env = NULL;
+	return ret;
+    }
+    if (ovdb_conf.useshm)
+	ai_flags |= DB_SYSTEM_MEM;
+    w->env->set_shm_key(w->env, ovdb_conf.shmkey);
+    w->env->set_errcall(w->env, OVDBerror);
+    if (ovdb_conf.txn_nosync)
+	w->env->set_flags(w->env, DB_TXN_NOSYNC, 1);
+    ret = w->env->open(w->env, ovdb_conf.home, ai_flags, 0666);
+    if (ret != 0)
+	return ret;
+
+    ret = db_create(&w->groupinfo, w->env, 0);
+    if (ret != 0) {
+	w->groupinfo = NULL;
+	return ret;
+    }
+    ret = w->env->txn_begin(w->env, NULL, &tid, 0);
+    if (ret != 0)
+	return ret;
+    ret = w->groupinfo->open(w->groupinfo, tid, "groupinfo", NULL, DB_BTREE,
+			     _db_flags, 0666);
+    if (ret == 0)
+	tid->commit(tid, 0);
+    else
+	tid->abort(tid);
+    if (ret != 0)
+	return ret;
+
+    w->dbs = xcalloc(ovdb_conf.numdbfiles, sizeof(DB *));
+    return 0;
+}
+
+static void
+stop_writers(void)
+{
+    int i;
+
+    if (ovdb_writers.writers == NULL)
+	return;
+    pthread_mutex_lock(&ovdb_writers.mutex);
+    ovdb_writers.shutdown = true;
+    pthread_cond_broadcast(&ovdb_writers.work);
+    pthread_mutex_unlock(&ovdb_writers.mutex);
+    for (i = 0; i < ovdb_writers.count; i++) {
+	pthread_join(ovdb_writers.writers[i].thread, NULL);
+	close_writer(&ovdb_writers.writers[i]);
+    }
+    pthread_cond_destroy(&ovdb_writers.work);
+    pthread_cond_destroy(&ovdb_writers.done);
+    pthread_mutex_destroy(&ovdb_writers.mutex);
+    free(ovdb_writers.writers);
+    ovdb_writers.writers = NULL;
+    ovdb_writers.count = 0;
+}
+
+/* Start the writer threads the first time a batch is added.  On any failure
+   the pool is left disabled and batches go through ovdb_add as before. */
+static bool
+start_writers(void)
+{
+    int i, n, ret;
+
+    if (ovdb_writers.writers != NULL)
+	return true;
+    if (ovdb_writers.failed)
+	return false;
+    ovdb_writers.failed = true;
+
+    n = ovdb_conf.writethreads;
+    if (n > ovdb_conf.numdbfiles)
+	n = ovdb_conf.numdbfiles;
+    if (n < 2 || !(OVDBmode & OV_WRITE) || clientmode)
+	return false;
+
+    ovdb_writers.writers = xcalloc(n, sizeof(struct ovdb_writer));
+    for (i = 0; i < n; i++) {
+	ret = open_writer(&ovdb_writers.writers[i]);
+	if (ret != 0) {
+	    warn("OVDB: cannot open writer %d: %s", i, db_strerror(ret));
+	    while (i >= 0)
+		close_writer(&ovdb_writers.writers[i--]);
+	    free(ovdb_writers.writers);
+	    ovdb_writers.writers = NULL;
+	    return false;
+	}
+    }
+
+    pthread_mutex_init(&ovdb_writers.mutex, NULL);
+    pthread_cond_init(&ovdb_writers.work, NULL);
+    pthread_cond_init(&ovdb_writers.done, NULL);
+    ovdb_writers.busy = 0;
+    ovdb_writers.generation = 0;
+    ovdb_writers.shutdown = false;
+    ovdb_writers.count = 0;
+    for (i = 0; i < n; i++) {
+	if (pthread_create(&ovdb_writers.writers[i].thread, NULL, writer_main,
+			   &ovdb_writers.writers[i]) != 0) {
+	    syswarn("OVDB: cannot start writer thread");
+	    break;
+	}
+	ovdb_writers.count++;
+    }
+    if (ovdb_writers.count < 2) {
+	for (i = ovdb_writers.count; i < n; i++)
+	    close_writer(&ovdb_writers.writers[i]);
+	stop_writers();
+	return false;
+    }
+    for (i = ovdb_writers.count; i < n; i++)
+	close_writer(&ovdb_writers.writers[i]);
+    ovdb_writers.failed = false;
+    return true;
+}
+
+static bool
+writers_addbatch(struct ov_record *records, size_t count)
+{
+    struct ovdb_writer *w;
+    size_t i;
+    int n;
+    bool success = true;
+
+    for (i = 0; i < count; i++) {
+	w = &ovdb_writers.writers[which_db(records[i].group)
+				  % ovdb_writers.count];
+	if (w->count == w->size) {
+	    w->size = w->size == 0 ? 64 : w->size * 2;
+	    w->records = xreallocarray(w->records, w->size,
+				       sizeof(struct ov_record *));
+	}
+	w->records[w->count++] = &records[i];
+    }
+
+    pthread_mutex_lock(&ovdb_writers.mutex);
+    ovdb_writers.busy = ovdb_writers.count;
+    ovdb_writers.generation++;
+    pthread_cond_broadcast(&ovdb_writers.work);
+    while (ovdb_writers.busy > 0)
+	pthread_cond_wait(&ovdb_writers.done, &ovdb_writers.mutex);
+    pthread_mutex_unlock(&ovdb_writers.mutex);
+
+    for (n = 0; n < ovdb_writers.count; n++)
+	if (!ovdb_writers.writers[n].success)
+	    success = false;
+    return success;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*
+ * Each record is still added in its own transaction.  Those are committed
+ * without a synchronous log flush unless txn_nosync is turned off, and
+ * keeping them small avoids holding locks on many groups at once.  With
+ * writethreads set, records are spread over that many threads by overview
+ * file so that independent groups are written in parallel.
+ */
+bool
+ovdb_addbatch(struct ov_record *records, size_t count)
+{
+    size_t i;
+    bool success = true;
+
+#ifdef HAVE_PTHREAD
+    if (count > 1 && !bulk.on && ovdb_conf.writethreads > 1
+	&& start_writers())
+	return writers_addbatch(records, count);
+#endif
+
+    for (i = 0; i < count; i++) {
+	records[i].stored = ovdb_add(records[i].group, records[i].artnum,
+				     records[i].token, records[i].data,
+				     records[i].len, records[i].arrived,
+				     records[i].expires);
+	if (!records[i].stored)
+	    success = false;
+    }
+    return success;
+}
+
 bool ovdb_cancel(const char *group UNUSED, ARTNUM artnum UNUSED)
 {
     return true;
@@ -2159,7 +2888,9 @@ ovdb_opensearch(const char *group, int low, int high)
     if(clientmode) {
 	struct rs_cmd rs;
 	struct rs_opensrch repl;
+	struct client_search *cs;
 
+	client_drain();
 	rs.what = CMD_OPENSRCH;
 	rs.grouplen = strlen(group)+1;
 	rs.artlo = low;
@@ -2174,9 +2905,12 @@ ovdb_opensearch(const char *group, int low, int high)
 	if(repl.status != CMD_OPENSRCH)
 	    return NULL;
 
-	return repl.handle;
+	cs = xcalloc(1, sizeof(struct client_search));
+	cs->handle = repl.handle;
+	return cs;
     }
 
+    bulk_flush();
     ret = ovdb_getgroupinfo(group, &gi, true, NULL, 0);
     switch (ret)
     {
@@ -2237,31 +2971,43 @@ ovdb_search(void *handle, ARTNUM *artnum, char **data, int *len,
     char *dp;
 
     if (clientmode) {
-	struct rs_cmd rs;
+	struct client_search *cs = handle;
+	struct client_batch swap;
 	struct rs_srch repl;
-	static char *databuf;
-	static int buflen = 0;
-
-	rs.what = CMD_SRCH;
-	rs.handle = handle;
-
-	if (csend(&rs, sizeof(rs)) < 0)
-            return false;
-	if (crecv(&repl, sizeof(repl)) < 0)
-            return false;
+	char *record;
+
+	/* Move on to the next batch, waiting for it if needed, and ask for
+	   the one after it right away. */
+	if (cs->current.left == 0) {
+	    if (cs->pending)
+		client_receive(cs);
+	    else if (cs->next.left == 0 && !cs->done)
+		if (client_request(cs))
+		    client_receive(cs);
+	    if (cs->next.left == 0)
+		return false;
+	    swap = cs->current;
+	    cs->current = cs->next;
+	    cs->next = swap;
+	    cs->next.left = 0;
+	    if (!cs->done)
+		client_request(cs);
+	}
 
-	if(repl.status != CMD_SRCH)
+	record = cs->current.data + cs->current.used;
+	if (cs->current.used + sizeof(repl) > cs->current.length)
+	    return false;
+	memcpy(&repl, record, sizeof(repl));
+	if (repl.len < 0
+	    || cs->current.used + sizeof(repl) + (size_t) repl.len
+	       > cs->current.length) {
+	    warn("OVDB: rc: bad record length from server");
+	    cs->current.left = 0;
+	    cs->done = true;
 	    return false;
-	if(repl.len > buflen) {
-	    if(buflen == 0) {
-		buflen = repl.len + 512;
-		databuf = xmalloc(buflen);
-	    } else {
-		buflen = repl.len + 512;
-                databuf = xrealloc(databuf, buflen);
-	    }
 	}
-	crecv(databuf, repl.len);
+	cs->current.used += sizeof(repl) + repl.len;
+	cs->current.left--;
 
 	if(artnum)
 	    *artnum = repl.artnum;
@@ -2272,7 +3018,7 @@ ovdb_search(void *handle, ARTNUM *artnum, char **data, int *len,
 	if(len)
 	    *len = repl.len;
 	if(data)
-	    *data = databuf;
+	    *data = record + sizeof(repl);
 	return true;
     }
 
@@ -2408,11 +3154,16 @@ void ovdb_closesearch(void *handle)
     int i;
     if(clientmode) {
 	struct rs_cmd rs;
+	struct client_search *cs = handle;
 
+	client_drain();
 	rs.what = CMD_CLOSESRCH;
-	rs.handle = handle;
+	rs.handle = cs->handle;
 	csend(&rs, sizeof(rs));
 	/* no reply is sent for a CMD_CLOSESRCH */
+	free(cs->current.data);
+	free(cs->next.data);
+	free(cs);
     } else {
 	struct ovdbsearch *s = (struct ovdbsearch *)handle;
 
@@ -2449,6 +3200,7 @@ ovdb_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
 	struct rs_cmd rs;
 	struct rs_artinfo repl;
 
+	client_drain();
 	rs.what = CMD_ARTINFO;
 	rs.grouplen = strlen(group)+1;
 	rs.artlo = artnum;
@@ -2468,6 +3220,7 @@ ovdb_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
 	return true;
     }
 
+    bulk_flush();
     while(1) {
         ret = ovdb_getgroupinfo(group, &gi, true, NULL, 0);
 	switch (ret)
@@ -2564,6 +3317,7 @@ ovdb_expiregroup(const char *group, int *lo, struct history *h)
     u_int32_t artnum = 0, currentart, lowest;
     int i, compact, done, currentcount, newcount;
 
+    bulk_flush();
     if(eo_start == 0) {
 	eo_start = time(NULL);
 	delete_old_stuff(0);	/* remove deleted groups first */
@@ -3011,6 +3765,10 @@ bool ovdb_ctl(OVCTLTYPE type, void *val)
         boolval = (bool *)val;
         *boolval = false;
         return true;
+    case OVBULKLOAD:
+	if (!(OVDBmode & OV_WRITE) || clientmode)
+	    return false;
+	return bulk_load(*(bool *)val);
     default:
         return false;
     }
@@ -3034,6 +3792,12 @@ void ovdb_close(void)
 	return;
     }
 
+    bulk_load(false);
+#ifdef HAVE_PTHREAD
+    stop_writers();
+    ovdb_writers.failed = false;
+#endif
+
     while(searches != NULL && nsearches) {
 	ovdb_closesearch(searches[0]);
     }
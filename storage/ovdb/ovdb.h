@@ -5,6 +5,8 @@
 
 BEGIN_DECLS
 
+struct ov_record;
+
 bool ovdb_open(int mode);
 bool ovdb_groupstats(const char *group, int *lo, int *hi, int *count,
                      int *flag);
@@ -12,6 +14,7 @@ bool ovdb_groupadd(const char *group, ARTNUM lo, ARTNUM hi, char *flag);
 bool ovdb_groupdel(const char *group);
 bool ovdb_add(const char *group, ARTNUM artnum, TOKEN token, char *data,
               int len, time_t arrived, time_t expires);
+bool ovdb_addbatch(struct ov_record *records, size_t count);
 bool ovdb_cancel(const char *group, ARTNUM artnum);
 void *ovdb_opensearch(const char *group, int low, int high);
 bool ovdb_search(void *handle, ARTNUM *artnum, char **data, int *len,
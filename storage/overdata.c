@@ -96,44 +96,25 @@ overview_extra_fields(bool hidden)
 
 
 /*
-**  Given an article, its length, the name of a header, and a buffer to append
-**  the data to, append header data for that header to the overview data
-**  that's being constructed.  Doesn't append any data if the header isn't
-**  found.
+**  Given an article, its length, the value of a header as found by
+**  wire_findheaders (or NULL), and a buffer to append the data to, append
+**  header data for that header to the overview data that's being
+**  constructed.  Doesn't append any data if the header wasn't found.
 */
 static void
-build_header(const char *article, size_t length, const char *header,
+build_header(const char *article, size_t length, const char *data,
              struct buffer *overview)
 {
     ptrdiff_t size;
     size_t offset;
-    const char *data, *end, *p;
+    const char *end, *p;
 
-    data = wire_findheader(article, length, header, false);
     if (data == NULL)
         return;
     end = wire_endheader(data, article + length - 1);
     if (end == NULL)
         return;
 
-    /* Someone managed to break their server so that they were appending
-       multiple Xref headers, and INN had a bug where it wouldn't notice this
-       and reject the article.  Just in case, see if there are multiple Xref
-       headers and use the last one. */
-    if (strcasecmp(header, "xref") == 0) {
-        const char *next = end + 1;
-
-        while (next != NULL) {
-            next = wire_findheader(next, length - (next - article), header, false);
-            if (next != NULL) {
-                data = next;
-                end = wire_endheader(data, article + length - 1);
-                if (end == NULL)
-                    return;
-            }
-        }
-    }
-
     size = end - data + 1;
     offset = overview->used + overview->left;
     buffer_resize(overview, offset + size);
@@ -163,8 +144,26 @@ overview_build(ARTNUM number, const char *article, size_t length,
                const struct vector *extra, struct buffer *overview)
 {
     unsigned int field;
+    size_t count;
+    struct wire_header *headers;
     char buffer[32];
 
+    /* Find all the headers in one pass over the article.  Someone managed to
+       break their server so that they were appending multiple Xref headers,
+       and INN had a bug where it wouldn't notice this and reject the
+       article.  Just in case, use the last Xref header. */
+    count = ARRAY_SIZE(fields) + (extra != NULL ? extra->count : 0);
+    headers = xcalloc(count, sizeof(struct wire_header));
+    for (field = 0; field < ARRAY_SIZE(fields); field++)
+        headers[field].name = fields[field];
+    if (extra != NULL)
+        for (field = 0; field < extra->count; field++) {
+            headers[ARRAY_SIZE(fields) + field].name = extra->strings[field];
+            headers[ARRAY_SIZE(fields) + field].last =
+                (strcasecmp(extra->strings[field], "Xref") == 0);
+        }
+    wire_findheaders(article, length, headers, count, false);
+
     snprintf(buffer, sizeof(buffer), "%lu", number);
     if (overview == NULL)
         overview = buffer_new();
@@ -175,7 +174,7 @@ overview_build(ARTNUM number, const char *article, size_t length,
             snprintf(buffer, sizeof(buffer), "%lu", (unsigned long) length);
             buffer_append(overview, buffer, strlen(buffer));
         } else
-            build_header(article, length, fields[field], overview);
+            build_header(article, length, headers[field].value, overview);
     }
     if (extra != NULL) {
         for (field = 0; field < extra->count; field++) {
@@ -183,10 +182,12 @@ overview_build(ARTNUM number, const char *article, size_t length,
             buffer_append(overview, extra->strings[field],
                           strlen(extra->strings[field]));
             buffer_append(overview, ": ", 2);
-            build_header(article, length, extra->strings[field], overview);
+            build_header(article, length,
+                         headers[ARRAY_SIZE(fields) + field].value, overview);
         }
     }
     buffer_append(overview, "\r\n", 2);
+    free(headers);
     return overview;
 }
 
@@ -422,3 +423,55 @@ overview_get_extra_header(const struct cvector *vector, const char *header)
     return NULL;
 }
 
+
+/*
+**  Find a field of an overview line, starting with the article number as
+**  returned by the overview methods, without splitting all of it.  element
+**  is the index of the field as returned by overview_index; for an extra
+**  field, the name of its header is also needed, and it is looked for among
+**  all the extra fields like overview_get_extra_header does.  Sets field and
+**  fieldlen to the value within line and returns true, or returns false if
+**  the line doesn't have that field.
+*/
+bool
+overview_find_field(const char *line, size_t length, int element,
+                    const char *header, const char **field, size_t *fieldlen)
+{
+    const char *end = line + length;
+    const char *p, *next, *stop;
+    size_t i, skip, headerlen;
+    bool extra;
+
+    extra = ((size_t) element >= ARRAY_SIZE(fields));
+    skip = extra ? ARRAY_SIZE(fields) + 1 : (size_t) element + 1;
+    headerlen = extra ? strlen(header) : 0;
+    p = line;
+    for (i = 0; i < skip; i++) {
+        p = memchr(p, '\t', end - p);
+        if (p == NULL)
+            return false;
+        p++;
+    }
+    for (;;) {
+        /* The last field is followed by \r\n instead of a tab. */
+        next = memchr(p, '\t', end - p);
+        stop = (next != NULL) ? next : end - 2;
+        if (stop < p)
+            stop = p;
+        if (!extra) {
+            *field = p;
+            *fieldlen = stop - p;
+            return true;
+        }
+        if ((size_t) (stop - p) >= headerlen + 2
+            && strncasecmp(p, header, headerlen) == 0
+            && p[headerlen] == ':' && p[headerlen + 1] == ' ') {
+            *field = p + headerlen + 2;
+            *fieldlen = stop - *field;
+            return true;
+        }
+        if (next == NULL)
+            return false;
+        p = next + 1;
+    }
+}
@@ -34,6 +34,7 @@ struct overview {
     bool cutoff;
     struct buffer *overdata;
     struct cvector *groups;
+    struct ov_recordset *batch;
     struct overview_method *method;
     void *private;
 };
@@ -83,6 +84,7 @@ overview_open(int mode)
     overview->cutoff = false;
     overview->overdata = NULL;
     overview->groups = NULL;
+    overview->batch = NULL;
     overview->method = &ov_methods[i];
     overview->private = NULL;
     return overview;
@@ -99,6 +101,9 @@ overview_close(struct overview *overview)
     if (overview == NULL)
         return;
     overview->method->close();
+    OVreplogclose();
+    OVhotclose();
+    OVrecordsfree(overview->batch);
     free(overview);
 }
 
@@ -134,8 +139,15 @@ bool
 overview_group_add(struct overview *overview, const char *group,
                    struct overview_group *stats)
 {
-    return overview->method->groupadd(group, stats->low, stats->high,
-                                      &stats->flag);
+    char flag[2];
+
+    if (!overview->method->groupadd(group, stats->low, stats->high,
+                                    &stats->flag))
+        return false;
+    flag[0] = stats->flag;
+    flag[1] = '\0';
+    OVreploggroupadd(group, stats->low, stats->high, flag);
+    return true;
 }
 
 
@@ -146,7 +158,11 @@ overview_group_add(struct overview *overview, const char *group,
 bool
 overview_group_delete(struct overview *overview, const char *group)
 {
-    return overview->method->groupdel(group);
+    if (!overview->method->groupdel(group))
+        return false;
+    OVreploggroupdel(group);
+    OVhotdrop(group);
+    return true;
 }
 
 
@@ -158,6 +174,8 @@ bool
 overview_add(struct overview *overview, const char *group,
              struct overview_data *data)
 {
+    struct ov_record record;
+
     /* We have to add the article number to the beginning of the overview data
        and CRLF to the end.  Use the overdata buffer as temporary storage
        space. */
@@ -170,10 +188,18 @@ overview_add(struct overview *overview, const char *group,
     buffer_append(overview->overdata, "\r\n", 2);
 
     /* Call the underlying method. */
-    return overview->method->add(group, data->number, data->token,
-                                 overview->overdata->data,
-                                 overview->overdata->left,
-                                 data->arrived, data->expires);
+    record.group = group;
+    record.artnum = data->number;
+    record.token = data->token;
+    record.data = overview->overdata->data;
+    record.len = overview->overdata->left;
+    record.arrived = data->arrived;
+    record.expires = data->expires;
+    record.stored = overview->method->add(group, record.artnum, record.token,
+                                          record.data, record.len,
+                                          record.arrived, record.expires);
+    OVreplogadd(&record, 1);
+    return record.stored;
 }
 
 
@@ -190,31 +216,66 @@ overview_add(struct overview *overview, const char *group,
 bool
 overview_add_xref(struct overview *overview, const char *xref,
                   struct overview_data *data)
+{
+    bool success;
+
+    overview_add_xref_batch(overview, &xref, data, &success, 1);
+    return success;
+}
+
+
+/*
+**  The same for several articles at once.  All of the records are handed to
+**  the overview method in one call so that it can batch its writes.  Sets
+**  success[i] to whether data[i] was stored in every group, and returns true
+**  only if all of them were.
+*/
+bool
+overview_add_xref_batch(struct overview *overview, const char **xref,
+                        struct overview_data *data, bool *success,
+                        size_t count)
 {
     char *xref_copy;
     const char *group;
     char *p, *end;
-    size_t i;
-    bool success = true;
-
-    xref_copy = xstrdup(xref);
-    p = strchr(xref_copy, '\n');
-    if (p != NULL)
-        *p = '\0';
-    overview->groups = cvector_split_space(xref_copy, overview->groups);
-    for (i = 0; i < overview->groups->count; i++) {
-        group = overview->groups->strings[i];
-        p = (char *) strchr(group, ':');
-        if (p == NULL || p == group || p[1] == '-')
-            continue;
-        *p = '\0';
-        errno = 0;
-        data->number = strtoul(p + 1, &end, 10);
-        if (data->number == 0 || *end != '\0' || errno == ERANGE)
-            continue;
-        success = success && overview_add(overview, group, data);
+    size_t i, j;
+    ARTNUM number;
+    bool status = true;
+
+    if (overview->batch == NULL)
+        overview->batch = OVrecordsnew();
+    OVrecordsclear(overview->batch);
+    for (i = 0; i < count; i++) {
+        success[i] = true;
+        xref_copy = xstrdup(xref[i]);
+        p = strchr(xref_copy, '\n');
+        if (p != NULL)
+            *p = '\0';
+        overview->groups = cvector_split_space(xref_copy, overview->groups);
+        for (j = 0; j < overview->groups->count; j++) {
+            group = overview->groups->strings[j];
+            p = (char *) strchr(group, ':');
+            if (p == NULL || p == group || p[1] == '-')
+                continue;
+            *p = '\0';
+            errno = 0;
+            number = strtoul(p + 1, &end, 10);
+            if (number == 0 || *end != '\0' || errno == ERANGE)
+                continue;
+            OVrecordsadd(overview->batch, group, number, data[i].token,
+                         data[i].overview, data[i].overlen, data[i].arrived,
+                         data[i].expires, i);
+        }
+        free(xref_copy);
     }
-    return success;
+    if (!OVrecordsstore(overview->batch, overview->method)) {
+        for (j = 0; j < overview->batch->count; j++)
+            if (!overview->batch->records[j].stored) {
+                success[overview->batch->articles[j]] = false;
+                status = false;
+            }
+    }
+    return status;
 }
 
 
@@ -224,7 +285,11 @@ overview_add_xref(struct overview *overview, const char *xref,
 bool
 overview_cancel(struct overview *overview, const char *group, ARTNUM artnum)
 {
-    return overview->method->cancel(group, artnum);
+    if (!overview->method->cancel(group, artnum))
+        return false;
+    OVreplogcancel(group, artnum);
+    OVhotcancel(group, artnum);
+    return true;
 }
 
 
@@ -360,7 +425,8 @@ overview_expire(struct overview *overview, const char *group, ARTNUM *low,
     EXPprocessed = 0;
     EXPunlinked = 0;
     EXPoverindexdrop = 0;
-    status = overview->method->expiregroup(group, &newlow, data->history);
+    status = OVreplogexpire(overview->method, group, &newlow, data->history);
+    OVhotdrop(group);
     data->processed += EXPprocessed;
     data->dropped += EXPunlinked;
     data->indexdropped += EXPoverindexdrop;
@@ -0,0 +1,677 @@
+/*
+**  A shared in-memory tier of recent overview data.
+**
+**  When ovhotsize is set in inn.conf, the overview records of newly stored
+**  articles are also kept in a file named ovhot in pathrun, mapped in
+**  memory by every process using the overview API, so that OVsearch can
+**  answer for the newest articles of a group, which readers ask for most,
+**  without going to the overview method.  Older articles, and those of
+**  groups without a bucket, are searched for in the overview method as
+**  before.
+**
+**  The file holds a header followed by fixed size buckets, each owned by at
+**  most one group, chosen by a hash of its name.  A group only takes over a
+**  bucket owned by another one if that group got no article for OVHOT_IDLE
+**  seconds, so that busy groups keep theirs.  A bucket keeps the records of
+**  its group in a ring of data, indexed by article number modulo
+**  OVHOT_SLOTS, and holds every record stored for its group from article
+**  low to article high.  Older records are dropped as the ring wraps
+**  around, raising low.
+**
+**  Writers serialize on a fcntl lock of the bucket.  Readers take no lock:
+**  each slot has a sequence count, odd while it is written, which a reader
+**  checks around its copy of the record, and the bucket has a generation
+**  count, odd while it changes hands or is emptied.  A writer raises low
+**  before reusing the slots and data of the records it drops, so a reader
+**  which misses an article it had in range and then finds it below low
+**  knows that the record was dropped rather than cancelled, and goes on
+**  with the overview method.  As for the shared token cache, this needs the
+**  atomic builtins of GCC and compatible compilers.  Threads of a process
+**  must not add to the tier at the same time, since fcntl locks don't keep
+**  them apart; innd hands all its overview writes to a single thread.
+**
+**  Records are only added once stored by the overview method, and removed
+**  when cancelled.  Expiring or removing a group empties its bucket, and so
+**  does an article number not following the last one added, since the
+**  records in between may have been stored without going through the tier
+**  (while it was disabled, for instance).
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "ovinterface.h"
+
+#define OVHOT_NAME      "ovhot"
+#define OVHOT_MAGIC     0x494e4f48U
+#define OVHOT_VERSION   1
+#define OVHOT_SLOTS     1024
+#define OVHOT_DATA      (256 * 1024)
+#define OVHOT_GROUPLEN  128
+#define OVHOT_IDLE      (60 * 60)
+
+#if defined(__GNUC__)
+# define OVHOT_ATOMIC 1
+# define ovhot_barrier() __sync_synchronize()
+#else
+# define OVHOT_ATOMIC 0
+# define ovhot_barrier() /* empty */
+#endif
+
+struct ovhot_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long buckets;
+};
+
+struct ovhot_slot {
+    unsigned int sequence;      /* Odd while the slot is written. */
+    unsigned int len;
+    ARTNUM artnum;              /* 0 if the slot is empty. */
+    unsigned long offset;       /* Where the record is in data. */
+    time_t arrived;
+    TOKEN token;
+};
+
+struct ovhot_bucket {
+    unsigned int generation;    /* Odd while the bucket is reset. */
+    ARTNUM low;                 /* First article held. */
+    ARTNUM high;                /* Last article added. */
+    unsigned long head;         /* Where the next record goes in data. */
+    time_t last;                /* When the last article was added. */
+    char group[OVHOT_GROUPLEN];
+    struct ovhot_slot slots[OVHOT_SLOTS];
+    char data[OVHOT_DATA];
+};
+
+/* What a reader found for an article. */
+enum ovhot_lookup {
+    OVHOT_FOUND,
+    OVHOT_ABSENT,               /* No record for it; go on with the next. */
+    OVHOT_LOST                  /* Dropped meanwhile; ask the method. */
+};
+
+/* Where a search is. */
+enum ovhot_phase {
+    PHASE_BEFORE,               /* In the method, before the bucket. */
+    PHASE_HOT,                  /* In the bucket. */
+    PHASE_AFTER                 /* In the method, after the bucket. */
+};
+
+struct ovhot_search {
+    char *group;
+    ARTNUM low;
+    ARTNUM high;
+    ARTNUM next;                /* Next article to look for in the bucket. */
+    ARTNUM hotlow;              /* What the bucket held when opened. */
+    ARTNUM hothigh;
+    enum ovhot_phase phase;
+    void *handle;               /* Search of the method, or NULL. */
+    struct buffer *line;        /* Copy of the record last returned. */
+};
+
+static int hot_fd = -1;
+static char *hot_base = NULL;
+static size_t hot_size;
+static unsigned long hot_buckets;
+static bool hot_writable;
+static bool hot_failed;
+
+
+/*
+**  Open the tier, creating it if needed with as many buckets as fit in
+**  ovhotsize.  If the file already exists, the number of buckets it was
+**  created with is used.  Returns false if the tier is disabled or can't be
+**  used.
+*/
+bool
+OVhotopen(void)
+{
+    struct ovhot_header head;
+    struct stat st;
+    char *path;
+    unsigned long buckets;
+
+    if (hot_base != NULL)
+        return true;
+    if (innconf->ovhotsize == 0 || hot_failed)
+        return false;
+    if (!OVHOT_ATOMIC) {
+        warn("OVER: in-memory overview not supported by this compiler");
+        return false;
+    }
+    buckets = (innconf->ovhotsize * 1024) / sizeof(struct ovhot_bucket);
+    if (buckets == 0)
+        buckets = 1;
+
+    path = concatpath(innconf->pathrun, OVHOT_NAME);
+    hot_writable = true;
+    hot_fd = open(path, O_RDWR | O_CREAT, 0664);
+    if (hot_fd < 0) {
+        hot_writable = false;
+        hot_fd = open(path, O_RDONLY);
+    }
+    if (hot_fd < 0) {
+        syswarn("OVER: cannot open %s", path);
+        free(path);
+        return false;
+    }
+    fdflag_close_exec(hot_fd, true);
+
+    /* Whoever gets the lock first initializes a new file. */
+    if (hot_writable)
+        inn_lock_file(hot_fd, INN_LOCK_WRITE, true);
+    if (fstat(hot_fd, &st) < 0)
+        goto fail;
+    if (st.st_size >= (off_t) sizeof(head)
+        && pread(hot_fd, &head, sizeof(head), 0) == sizeof(head)
+        && head.magic == OVHOT_MAGIC && head.version == OVHOT_VERSION
+        && head.buckets > 0
+        && (size_t) st.st_size == sizeof(head)
+                                  + head.buckets
+                                        * sizeof(struct ovhot_bucket)) {
+        buckets = head.buckets;
+    } else if (hot_writable) {
+        memset(&head, 0, sizeof(head));
+        head.magic = OVHOT_MAGIC;
+        head.version = OVHOT_VERSION;
+        head.buckets = buckets;
+        if (ftruncate(hot_fd, 0) < 0
+            || ftruncate(hot_fd, sizeof(head)
+                                     + buckets * sizeof(struct ovhot_bucket))
+                   < 0
+            || pwrite(hot_fd, &head, sizeof(head), 0) != sizeof(head))
+            goto fail;
+    } else {
+        errno = EINVAL;
+        goto fail;
+    }
+    hot_size = sizeof(head) + buckets * sizeof(struct ovhot_bucket);
+    hot_base = mmap(NULL, hot_size,
+                    hot_writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_SHARED, hot_fd, 0);
+    if (hot_base == MAP_FAILED) {
+        hot_base = NULL;
+        goto fail;
+    }
+    if (hot_writable)
+        inn_lock_file(hot_fd, INN_LOCK_UNLOCK, false);
+    hot_buckets = buckets;
+    free(path);
+    return true;
+
+fail:
+    syswarn("OVER: cannot set up %s", path);
+    if (hot_writable)
+        inn_lock_file(hot_fd, INN_LOCK_UNLOCK, false);
+    close(hot_fd);
+    hot_fd = -1;
+    free(path);
+    hot_failed = true;
+    return false;
+}
+
+
+/*
+**  Unmap the tier.
+*/
+void
+OVhotclose(void)
+{
+    if (hot_base != NULL) {
+        munmap(hot_base, hot_size);
+        hot_base = NULL;
+    }
+    if (hot_fd >= 0) {
+        close(hot_fd);
+        hot_fd = -1;
+    }
+}
+
+
+/*
+**  Return the number of the bucket a group goes to.
+*/
+static unsigned long
+hot_bucketnum(const char *group)
+{
+    const unsigned char *p;
+    unsigned long hash = 2166136261UL;
+
+    for (p = (const unsigned char *) group; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 16777619UL;
+    }
+    return hash % hot_buckets;
+}
+
+static off_t
+hot_offset(unsigned long n)
+{
+    return sizeof(struct ovhot_header) + n * sizeof(struct ovhot_bucket);
+}
+
+static volatile struct ovhot_bucket *
+hot_bucket(unsigned long n)
+{
+    return (void *) (hot_base + hot_offset(n));
+}
+
+static bool
+hot_lock(unsigned long n, enum inn_locktype type)
+{
+    return inn_lock_range(hot_fd, type, type != INN_LOCK_UNLOCK,
+                          hot_offset(n), sizeof(struct ovhot_bucket));
+}
+
+
+/*
+**  Whether a bucket belongs to a group.
+*/
+static bool
+hot_owns(volatile struct ovhot_bucket *bucket, const char *group)
+{
+    size_t i;
+
+    for (i = 0; i < OVHOT_GROUPLEN; i++) {
+        if (bucket->group[i] != group[i])
+            return false;
+        if (group[i] == '\0')
+            return true;
+    }
+    return false;
+}
+
+
+/*
+**  Empty a bucket and give it to group, with article next as the first one
+**  it will hold.  Called with the bucket locked.
+*/
+static void
+hot_reset(volatile struct ovhot_bucket *bucket, const char *group,
+          ARTNUM next)
+{
+    size_t i;
+
+    bucket->generation++;
+    ovhot_barrier();
+    for (i = 0; i < OVHOT_SLOTS; i++)
+        bucket->slots[i].artnum = 0;
+    for (i = 0; group[i] != '\0'; i++)
+        bucket->group[i] = group[i];
+    bucket->group[i] = '\0';
+    bucket->low = next;
+    bucket->high = next - 1;
+    bucket->head = 0;
+    ovhot_barrier();
+    bucket->generation++;
+}
+
+
+/*
+**  Drop the oldest record of a bucket, raising low before the slot and the
+**  data of the record can be reused.  Called with the bucket locked.
+*/
+static void
+hot_dropoldest(volatile struct ovhot_bucket *bucket)
+{
+    volatile struct ovhot_slot *slot;
+    ARTNUM artnum = bucket->low;
+
+    bucket->low = artnum + 1;
+    ovhot_barrier();
+    slot = &bucket->slots[artnum % OVHOT_SLOTS];
+    if (slot->artnum == artnum) {
+        slot->sequence++;
+        ovhot_barrier();
+        slot->artnum = 0;
+        ovhot_barrier();
+        slot->sequence++;
+    }
+}
+
+
+/*
+**  Whether the oldest record of a bucket has to go to make room for len
+**  bytes at start, wrapped telling whether the data wrapped around to start
+**  from an end at head.
+*/
+static bool
+hot_inway(volatile struct ovhot_bucket *bucket, unsigned long start,
+          unsigned long len, bool wrapped, unsigned long head)
+{
+    volatile struct ovhot_slot *slot;
+
+    slot = &bucket->slots[bucket->low % OVHOT_SLOTS];
+    if (slot->artnum != bucket->low)
+        return true;
+    if (wrapped && slot->offset >= head)
+        return true;
+    return slot->offset < start + len && start < slot->offset + slot->len;
+}
+
+
+/*
+**  Add a record to the bucket of its group.  Called with the bucket
+**  locked.
+*/
+static void
+hot_addrecord(volatile struct ovhot_bucket *bucket,
+              const struct ov_record *record, time_t now)
+{
+    volatile struct ovhot_slot *slot;
+    unsigned long start;
+    bool wrapped;
+
+    if (!hot_owns(bucket, record->group)) {
+        if (bucket->low <= bucket->high && now - bucket->last < OVHOT_IDLE)
+            return;
+        hot_reset(bucket, record->group, record->artnum);
+    } else if (record->artnum != bucket->high + 1) {
+        /* Records may be missing before this one. */
+        hot_reset(bucket, record->group, record->artnum);
+    }
+    if (record->len > OVHOT_DATA / 4) {
+        hot_reset(bucket, record->group, record->artnum + 1);
+        return;
+    }
+
+    /* Make room in the index and in the data. */
+    while (bucket->low <= bucket->high
+           && bucket->low + OVHOT_SLOTS <= record->artnum)
+        hot_dropoldest(bucket);
+    start = bucket->head;
+    wrapped = (start + record->len > OVHOT_DATA);
+    if (wrapped)
+        start = 0;
+    while (bucket->low <= bucket->high
+           && hot_inway(bucket, start, record->len, wrapped, bucket->head))
+        hot_dropoldest(bucket);
+    if (bucket->low > bucket->high)
+        bucket->low = record->artnum;
+
+    /* Write the record, then publish it. */
+    slot = &bucket->slots[record->artnum % OVHOT_SLOTS];
+    slot->sequence++;
+    ovhot_barrier();
+    memcpy((char *) bucket->data + start, record->data, record->len);
+    slot->len = record->len;
+    slot->offset = start;
+    slot->arrived = record->arrived;
+    memcpy((void *) &slot->token, &record->token, sizeof(TOKEN));
+    slot->artnum = record->artnum;
+    ovhot_barrier();
+    slot->sequence++;
+    ovhot_barrier();
+    bucket->head = start + record->len;
+    bucket->last = now;
+    bucket->high = record->artnum;
+}
+
+
+/*
+**  Add the records stored by the overview method to the tier.
+*/
+void
+OVhotadd(const struct ov_record *records, size_t count)
+{
+    unsigned long n;
+    size_t i;
+    time_t now;
+
+    if (!OVhotopen() || !hot_writable)
+        return;
+    now = time(NULL);
+    for (i = 0; i < count; i++) {
+        if (!records[i].stored || strlen(records[i].group) >= OVHOT_GROUPLEN)
+            continue;
+        n = hot_bucketnum(records[i].group);
+        if (!hot_lock(n, INN_LOCK_WRITE))
+            continue;
+        hot_addrecord(hot_bucket(n), &records[i], now);
+        hot_lock(n, INN_LOCK_UNLOCK);
+    }
+}
+
+
+/*
+**  Remove the record of a cancelled article.
+*/
+void
+OVhotcancel(const char *group, ARTNUM artnum)
+{
+    volatile struct ovhot_bucket *bucket;
+    volatile struct ovhot_slot *slot;
+    unsigned long n;
+
+    if (!OVhotopen() || !hot_writable)
+        return;
+    n = hot_bucketnum(group);
+    bucket = hot_bucket(n);
+    if (!hot_owns(bucket, group) || !hot_lock(n, INN_LOCK_WRITE))
+        return;
+    slot = &bucket->slots[artnum % OVHOT_SLOTS];
+    if (hot_owns(bucket, group) && slot->artnum == artnum) {
+        slot->sequence++;
+        ovhot_barrier();
+        slot->artnum = 0;
+        ovhot_barrier();
+        slot->sequence++;
+    }
+    hot_lock(n, INN_LOCK_UNLOCK);
+}
+
+
+/*
+**  Empty the bucket of a group, after its overview was expired or removed.
+*/
+void
+OVhotdrop(const char *group)
+{
+    volatile struct ovhot_bucket *bucket;
+    unsigned long n;
+
+    if (!OVhotopen() || !hot_writable)
+        return;
+    n = hot_bucketnum(group);
+    bucket = hot_bucket(n);
+    if (!hot_owns(bucket, group) || !hot_lock(n, INN_LOCK_WRITE))
+        return;
+    if (hot_owns(bucket, group))
+        hot_reset(bucket, group, bucket->high + 1);
+    hot_lock(n, INN_LOCK_UNLOCK);
+}
+
+
+/*
+**  Find out which articles the bucket of a group holds.  Returns false if
+**  it holds none.
+*/
+static bool
+hot_range(const char *group, ARTNUM *low, ARTNUM *high)
+{
+    volatile struct ovhot_bucket *bucket;
+    unsigned int generation;
+
+    bucket = hot_bucket(hot_bucketnum(group));
+    generation = bucket->generation;
+    ovhot_barrier();
+    if ((generation & 1) != 0 || !hot_owns(bucket, group))
+        return false;
+    *low = bucket->low;
+    *high = bucket->high;
+    ovhot_barrier();
+    return bucket->generation == generation && *low <= *high;
+}
+
+
+/*
+**  Look for the record of an article in the bucket of a group, copying it
+**  into line.
+*/
+static enum ovhot_lookup
+hot_lookup(const char *group, ARTNUM artnum, struct buffer *line,
+           TOKEN *token, time_t *arrived)
+{
+    volatile struct ovhot_bucket *bucket;
+    volatile struct ovhot_slot *slot;
+    unsigned int generation, sequence;
+    unsigned long offset, len;
+    bool found;
+
+    bucket = hot_bucket(hot_bucketnum(group));
+    slot = &bucket->slots[artnum % OVHOT_SLOTS];
+    generation = bucket->generation;
+    ovhot_barrier();
+    if ((generation & 1) != 0 || !hot_owns(bucket, group))
+        return OVHOT_LOST;
+    sequence = slot->sequence;
+    ovhot_barrier();
+    found = ((sequence & 1) == 0 && slot->artnum == artnum);
+    if (found) {
+        offset = slot->offset;
+        len = slot->len;
+        if (offset + len > OVHOT_DATA)
+            return OVHOT_LOST;
+        buffer_set(line, (const char *) bucket->data + offset, len);
+        memcpy(token, (const void *) &slot->token, sizeof(TOKEN));
+        *arrived = slot->arrived;
+    }
+    ovhot_barrier();
+    if (bucket->generation != generation)
+        return OVHOT_LOST;
+    if (found && slot->sequence == sequence)
+        return OVHOT_FOUND;
+    return (artnum < bucket->low) ? OVHOT_LOST : OVHOT_ABSENT;
+}
+
+
+/*
+**  Start a search of the articles from low to high in a group, taking from
+**  the tier what it holds and the rest from the overview method.  Returns
+**  NULL if the group is neither in the tier nor known to the method.
+*/
+void *
+OVhotopensearch(const OV_METHOD *method, const char *group, int low,
+                int high)
+{
+    struct ovhot_search *search;
+    ARTNUM hotlow, hothigh;
+
+    search = xcalloc(1, sizeof(struct ovhot_search));
+    search->low = low;
+    search->high = high;
+    if (!hot_range(group, &hotlow, &hothigh) || (ARTNUM) high < hotlow) {
+        search->phase = PHASE_AFTER;
+        search->handle = (*method->opensearch)(group, low, high);
+        if (search->handle == NULL) {
+            free(search);
+            return NULL;
+        }
+        return search;
+    }
+    search->group = xstrdup(group);
+    search->hotlow = hotlow;
+    search->hothigh = hothigh;
+    search->line = buffer_new();
+    if ((ARTNUM) low < hotlow) {
+        search->phase = PHASE_BEFORE;
+        search->handle = (*method->opensearch)(group, low, hotlow - 1);
+        if (search->handle == NULL) {
+            OVhotclosesearch(method, search);
+            return NULL;
+        }
+    } else {
+        search->phase = PHASE_HOT;
+        search->next = low;
+    }
+    return search;
+}
+
+
+/*
+**  Return the next article of a search, as the search method of the
+**  overview method does.
+*/
+bool
+OVhotsearch(const OV_METHOD *method, void *handle, ARTNUM *artnum,
+            char **data, int *len, TOKEN *token, time_t *arrived)
+{
+    struct ovhot_search *search = handle;
+    enum ovhot_lookup status;
+    ARTNUM last;
+    TOKEN hottoken;
+    time_t hotarrived;
+
+    if (search->phase == PHASE_BEFORE) {
+        if ((*method->search)(search->handle, artnum, data, len, token,
+                              arrived))
+            return true;
+        (*method->closesearch)(search->handle);
+        search->handle = NULL;
+        search->phase = PHASE_HOT;
+        search->next = search->hotlow;
+    }
+    if (search->phase == PHASE_HOT) {
+        last = (search->high < search->hothigh) ? search->high
+                                                : search->hothigh;
+        while (search->next <= last) {
+            status = hot_lookup(search->group, search->next, search->line,
+                                &hottoken, &hotarrived);
+            if (status == OVHOT_LOST)
+                break;
+            search->next++;
+            if (status == OVHOT_ABSENT)
+                continue;
+            if (artnum != NULL)
+                *artnum = search->next - 1;
+            if (data != NULL)
+                *data = search->line->data;
+            if (len != NULL)
+                *len = search->line->left;
+            if (token != NULL)
+                *token = hottoken;
+            if (arrived != NULL)
+                *arrived = hotarrived;
+            return true;
+        }
+
+        /* Go on with the method from where the tier stopped helping. */
+        search->phase = PHASE_AFTER;
+        if (search->next <= search->high)
+            search->handle = (*method->opensearch)(search->group,
+                                                   search->next,
+                                                   search->high);
+    }
+    if (search->handle == NULL)
+        return false;
+    return (*method->search)(search->handle, artnum, data, len, token,
+                             arrived);
+}
+
+
+/*
+**  Free a search.
+*/
+void
+OVhotclosesearch(const OV_METHOD *method, void *handle)
+{
+    struct ovhot_search *search = handle;
+
+    if (search->handle != NULL)
+        (*method->closesearch)(search->handle);
+    free(search->group);
+    if (search->line != NULL)
+        buffer_free(search->line);
+    free(search);
+}
@@ -13,6 +13,21 @@
 struct buffer;
 struct vector;
 
+/*
+**  One overview record for a single group, as passed to the addbatch method.
+**  The method sets stored for each record it successfully wrote.
+*/
+struct ov_record {
+    const char	*group;
+    ARTNUM	artnum;
+    TOKEN	token;
+    char	*data;
+    int		len;
+    time_t	arrived;
+    time_t	expires;
+    bool	stored;
+};
+
 typedef struct overview_method {
     const char	*name;
     bool	(*open)(int mode);
@@ -23,6 +38,7 @@ typedef struct overview_method {
     bool	(*groupdel)(const char *group);
     bool	(*add)(const char *group, ARTNUM artnum, TOKEN token,
                        char *data, int len, time_t arrived, time_t expires);
+    bool	(*addbatch)(struct ov_record *records, size_t count);
     bool	(*cancel)(const char *group, ARTNUM artnum);
     void	*(*opensearch)(const char *group, int low, int high);
     bool	(*search)(void *handle, ARTNUM *artnum, char **data, int *len,
@@ -34,11 +50,56 @@ typedef struct overview_method {
     void	(*close)(void);
 } OV_METHOD;
 
+/* A growing set of ov_records and the buffer holding their group names and
+   overview data, used to build the argument to the addbatch method.  For
+   each record, articles holds the index given by the caller. */
+struct ov_recordset {
+    struct ov_record	*records;
+    size_t		*offsets;
+    size_t		*articles;
+    size_t		count;
+    size_t		size;
+    struct buffer	*text;
+};
+
+struct ov_recordset *OVrecordsnew(void);
+void OVrecordsclear(struct ov_recordset *);
+void OVrecordsadd(struct ov_recordset *, const char *group, ARTNUM artnum,
+                  TOKEN token, const char *data, int len, time_t arrived,
+                  time_t expires, size_t article);
+void OVrecordsdrop(struct ov_recordset *, size_t article);
+bool OVrecordsstore(struct ov_recordset *, const OV_METHOD *);
+void OVrecordsfree(struct ov_recordset *);
+
 bool OVgroupbasedexpire(TOKEN token, const char *group, const char *data,
                         int len, time_t arrived, time_t expires);
 bool OVhisthasmsgid(struct history *, const char *data);
 void OVEXPremove(TOKEN token, bool deletedgroups, char **xref, int ngroups);
+void OVEXPflush(void);
 void OVEXPcleanup(void);
+void OVarrivaladd(TOKEN token, const char *data, int len, time_t arrived);
+void OVarrivalclose(void);
+const OV_METHOD *OVmethod(void);
+void OVreplogadd(const struct ov_record *records, size_t count);
+void OVreplogcancel(const char *group, ARTNUM artnum);
+void OVreploggroupadd(const char *group, ARTNUM lo, ARTNUM hi,
+                      const char *flag);
+void OVreploggroupdel(const char *group);
+bool OVreplogexpire(const OV_METHOD *, const char *group, int *lo,
+                    struct history *h);
+void OVreplogclose(void);
+bool OVhotopen(void);
+void OVhotclose(void);
+void OVhotadd(const struct ov_record *records, size_t count);
+void OVhotcancel(const char *group, ARTNUM artnum);
+void OVhotdrop(const char *group);
+void *OVhotopensearch(const OV_METHOD *, const char *group, int low, int high);
+bool OVhotsearch(const OV_METHOD *, void *handle, ARTNUM *artnum, char **data,
+                 int *len, TOKEN *token, time_t *arrived);
+void OVhotclosesearch(const OV_METHOD *, void *handle);
+void OVtokenadd(const struct ov_record *records, size_t count);
+bool OVtokenlookup(const OV_METHOD *, OVTOKENINFO *info);
+void OVtokenclose(void);
 
 extern time_t OVnow;
 extern FILE *EXPunlinkfile;
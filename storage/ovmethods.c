@@ -0,0 +1,79 @@
+/* This file is automatically generated by buildconfig. */
+
+#include "ovinterface.h"
+#include "buffindexed/buffindexed.h"
+#include "ovdb/ovdb.h"
+#include "ovsqlite/ovsqlite.h"
+#include "tradindexed/tradindexed.h"
+
+OV_METHOD ov_methods[4] = {
+{
+    "buffindexed",
+    buffindexed_open,
+    buffindexed_groupstats,
+    buffindexed_groupadd,
+    buffindexed_groupdel,
+    buffindexed_add,
+    buffindexed_addbatch,
+    buffindexed_cancel,
+    buffindexed_opensearch,
+    buffindexed_search,
+    buffindexed_closesearch,
+    buffindexed_getartinfo,
+    buffindexed_expiregroup,
+    buffindexed_ctl,
+    buffindexed_close
+},
+{
+    "ovdb",
+    ovdb_open,
+    ovdb_groupstats,
+    ovdb_groupadd,
+    ovdb_groupdel,
+    ovdb_add,
+    ovdb_addbatch,
+    ovdb_cancel,
+    ovdb_opensearch,
+    ovdb_search,
+    ovdb_closesearch,
+    ovdb_getartinfo,
+    ovdb_expiregroup,
+    ovdb_ctl,
+    ovdb_close
+},
+{
+    "ovsqlite",
+    ovsqlite_open,
+    ovsqlite_groupstats,
+    ovsqlite_groupadd,
+    ovsqlite_groupdel,
+    ovsqlite_add,
+    ovsqlite_addbatch,
+    ovsqlite_cancel,
+    ovsqlite_opensearch,
+    ovsqlite_search,
+    ovsqlite_closesearch,
+    ovsqlite_getartinfo,
+    ovsqlite_expiregroup,
+    ovsqlite_ctl,
+    ovsqlite_close
+},
+{
+    "tradindexed",
+    tradindexed_open,
+    tradindexed_groupstats,
+    tradindexed_groupadd,
+    tradindexed_groupdel,
+    tradindexed_add,
+    tradindexed_addbatch,
+    tradindexed_cancel,
+    tradindexed_opensearch,
+    tradindexed_search,
+    tradindexed_closesearch,
+    tradindexed_getartinfo,
+    tradindexed_expiregroup,
+    tradindexed_ctl,
+    tradindexed_close
+}
+};
+
@@ -0,0 +1,926 @@
+/*
+**  The overview replication log.
+**
+**  When ovreplicationhours is set, every change made to overview through
+**  the overview API is also appended to a binary log in the replog
+**  directory under pathoverview, so that the overview of other machines can
+**  follow it.  As for the log of arrivals, there is one file per hour,
+**  named after the number of hours since the epoch, and the files older
+**  than ovreplicationhours are removed.  On the master, ovreplicate reads
+**  the log with OVopenreplog and OVreplogread and sends it to a follower,
+**  where another ovreplicate hands it to OVreplay to apply it to the local
+**  overview.
+**
+**  Each record starts with a u32 giving its total length in bytes
+**  (including the length itself) and a u8 giving its type, followed by:
+**
+**      replog_add       u64 artnum, u64 arrived, u64 expires, u8 token[18],
+**                       u16 grouplen, u8 group[grouplen], overview data
+**      replog_cancel    u64 artnum, u16 grouplen, u8 group[grouplen]
+**      replog_groupadd  u64 low, u64 high, u16 flaglen, u8 flag[flaglen],
+**                       u16 grouplen, u8 group[grouplen]
+**      replog_groupdel  u16 grouplen, u8 group[grouplen]
+**      replog_expire    u16 grouplen, u8 group[grouplen], u32 count,
+**                       u64 artnum[count]
+**      replog_position  u64 hour, u64 offset
+**
+**  Integers are in network byte order.  The overview data of replog_add
+**  runs to the end of the record, without the article number and the CRLF
+**  that the overview methods see.  replog_expire lists the articles that
+**  expiry removed from a newsgroup, since the follower can't tell itself.
+**  replog_position records are never written to the log:  OVreplogread
+**  inserts one each time it starts reading a file, so that the follower
+**  knows where it is in the log.
+**
+**  Writers use O_APPEND and write all the records of a call in a single
+**  write, so the records of several writers (innd or overchan, expireover,
+**  ctlinnd through innd) don't mix.  A reader may find the last record of a
+**  file only partly written, and waits for the rest.  Since a writer may
+**  still append to the file of an hour just after that hour has ended,
+**  readers only move past a file REPLOG_GRACE seconds after its hour.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/paths.h"
+#include "ovinterface.h"
+
+#define REPLOG_HOUR(t)  ((unsigned long) (t) / (60 * 60))
+
+/* How long after the end of its hour a file may still be written to. */
+#define REPLOG_GRACE    60
+
+/* How long a reader following the log waits before looking again, in
+   milliseconds. */
+#define REPLOG_POLL     100
+
+/* The largest record accepted, and the most articles a replog_expire record
+   lists. */
+#define REPLOG_MAXRECORD        0x1000000
+#define REPLOG_MAXEXPIRE        65536
+
+/* The size of the header of a record, and of a token in a record. */
+#define REPLOG_HEADER   5
+#define REPLOG_TOKEN    18
+
+/* How much a reader reads from a file at once. */
+#define REPLOG_CHUNK    (256 * 1024)
+
+enum {
+    replog_add = 1,
+    replog_cancel,
+    replog_groupadd,
+    replog_groupdel,
+    replog_expire,
+    replog_position
+};
+
+/* The file currently open for writing, and the records to write to it. */
+static char *replog_dir = NULL;
+static int replog_fd = -1;
+static unsigned long replog_hour;
+static struct buffer *replog_records = NULL;
+
+/* State of a read through the log. */
+struct replog_reader {
+    char *dir;
+    unsigned long hour;         /* File currently read. */
+    unsigned long offset;       /* Offset of the next record in the file. */
+    bool follow;
+    int fd;
+    struct buffer *pending;     /* Data read but not returned yet. */
+};
+
+
+/*
+**  Append integers in network byte order to a buffer.
+*/
+static void
+pack_u8(struct buffer *buffer, unsigned int value)
+{
+    char byte = value & 0xff;
+
+    buffer_append(buffer, &byte, 1);
+}
+
+static void
+pack_integer(struct buffer *buffer, uint64_t value, size_t length)
+{
+    char bytes[8];
+    size_t i;
+
+    for (i = length; i > 0; i--) {
+        bytes[i - 1] = value & 0xff;
+        value >>= 8;
+    }
+    buffer_append(buffer, bytes, length);
+}
+
+static void
+pack_string(struct buffer *buffer, const char *string, size_t length)
+{
+    pack_integer(buffer, length, 2);
+    buffer_append(buffer, string, length);
+}
+
+
+/*
+**  Take integers in network byte order and strings from the start of a
+**  record, advancing it.  Return false if the record is too short.
+*/
+static bool
+unpack_integer(const char **data, const char *end, size_t length,
+               uint64_t *value)
+{
+    const unsigned char *p = (const unsigned char *) *data;
+    size_t i;
+
+    if ((size_t) (end - *data) < length)
+        return false;
+    *value = 0;
+    for (i = 0; i < length; i++)
+        *value = (*value << 8) | p[i];
+    *data += length;
+    return true;
+}
+
+static bool
+unpack_string(const char **data, const char *end, struct buffer *string)
+{
+    uint64_t length;
+
+    if (!unpack_integer(data, end, 2, &length))
+        return false;
+    if ((size_t) (end - *data) < length)
+        return false;
+    buffer_set(string, *data, length);
+    buffer_append(string, "", 1);
+    *data += length;
+    return true;
+}
+
+
+/*
+**  Start a record of the given type at the end of a buffer, returning where
+**  it starts, and fill in its length once complete.
+*/
+static size_t
+record_start(struct buffer *buffer, unsigned int type)
+{
+    size_t start = buffer->left;
+
+    pack_integer(buffer, 0, 4);
+    pack_u8(buffer, type);
+    return start;
+}
+
+static void
+record_finish(struct buffer *buffer, size_t start)
+{
+    unsigned char *p;
+    uint32_t length;
+
+    p = (unsigned char *) buffer->data + buffer->used + start;
+    length = buffer->left - start;
+    p[0] = (length >> 24) & 0xff;
+    p[1] = (length >> 16) & 0xff;
+    p[2] = (length >> 8) & 0xff;
+    p[3] = length & 0xff;
+}
+
+
+/*
+**  Return the length of the record at the start of data, or 0 if it isn't
+**  all there yet.  Sets *bad and returns 0 if the length is invalid.
+*/
+static size_t
+record_length(const char *data, size_t left, bool *bad)
+{
+    uint64_t length;
+
+    *bad = false;
+    if (left < REPLOG_HEADER)
+        return 0;
+    unpack_integer(&data, data + left, 4, &length);
+    if (length < REPLOG_HEADER || length > REPLOG_MAXRECORD) {
+        *bad = true;
+        return 0;
+    }
+    return (length <= left) ? length : 0;
+}
+
+
+/*
+**  Return the path to a file in the replog directory, to be freed by the
+**  caller.
+*/
+static char *
+replog_path(const char *dir, unsigned long hour)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "%lu", hour);
+    return concatpath(dir, name);
+}
+
+
+/*
+**  Return the first hour after the given one that has a file in the replog
+**  directory, or 0 if there is none.
+*/
+static unsigned long
+replog_next(const char *dir, unsigned long after)
+{
+    DIR *dp;
+    struct dirent *ep;
+    char *end;
+    unsigned long hour, next = 0;
+
+    dp = opendir(dir);
+    if (dp == NULL)
+        return 0;
+    while ((ep = readdir(dp)) != NULL) {
+        if (!isdigit((unsigned char) ep->d_name[0]))
+            continue;
+        hour = strtoul(ep->d_name, &end, 10);
+        if (*end != '\0' || hour <= after)
+            continue;
+        if (next == 0 || hour < next)
+            next = hour;
+    }
+    closedir(dp);
+    return next;
+}
+
+
+/*
+**  Remove the files that fell out of the time kept.  Called each time a
+**  writer opens a new file, so about once per hour.
+*/
+static void
+replog_prune(const char *dir, unsigned long oldest)
+{
+    DIR *dp;
+    struct dirent *ep;
+    char *path, *end;
+    unsigned long hour;
+
+    dp = opendir(dir);
+    if (dp == NULL)
+        return;
+    while ((ep = readdir(dp)) != NULL) {
+        if (!isdigit((unsigned char) ep->d_name[0]))
+            continue;
+        hour = strtoul(ep->d_name, &end, 10);
+        if (*end != '\0' || hour >= oldest)
+            continue;
+        path = concatpath(dir, ep->d_name);
+        if (unlink(path) < 0 && errno != ENOENT)
+            syswarn("cannot remove %s", path);
+        free(path);
+    }
+    closedir(dp);
+}
+
+
+/*
+**  Start building the records of a change, returning the buffer to add
+**  them to, or NULL if the log isn't kept.
+*/
+static struct buffer *
+replog_begin(void)
+{
+    if (innconf->ovreplicationhours == 0)
+        return NULL;
+    if (replog_records == NULL)
+        replog_records = buffer_new();
+    buffer_set(replog_records, NULL, 0);
+    return replog_records;
+}
+
+
+/*
+**  Append the records built since replog_begin to the file of the current
+**  hour.  Failures are only warned about:  the followers have to be
+**  resynchronized anyway if the log can't be written.
+*/
+static void
+replog_write(void)
+{
+    unsigned long now;
+    char *path;
+
+    if (replog_records->left == 0)
+        return;
+    if (replog_dir == NULL) {
+        replog_dir = concatpath(innconf->pathoverview, INN_PATH_REPLOG);
+        if (mkdir(replog_dir, GROUPDIR_MODE) < 0 && errno != EEXIST) {
+            syswarn("cannot create %s", replog_dir);
+            free(replog_dir);
+            replog_dir = NULL;
+            return;
+        }
+    }
+    now = REPLOG_HOUR(time(NULL));
+    if (replog_fd < 0 || now != replog_hour) {
+        if (replog_fd >= 0)
+            close(replog_fd);
+        path = replog_path(replog_dir, now);
+        replog_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, ARTFILE_MODE);
+        if (replog_fd < 0) {
+            syswarn("cannot open %s", path);
+            free(path);
+            return;
+        }
+        fdflag_close_exec(replog_fd, true);
+        free(path);
+        replog_hour = now;
+        replog_prune(replog_dir, now + 1 - innconf->ovreplicationhours);
+    }
+    if (xwrite(replog_fd, replog_records->data + replog_records->used,
+               replog_records->left) < 0)
+        syswarn("cannot write to overview replication log");
+}
+
+
+/*
+**  Log the records an addbatch (or add) method call stored.
+*/
+void
+OVreplogadd(const struct ov_record *records, size_t count)
+{
+    struct buffer *buffer;
+    const struct ov_record *record;
+    const char *data, *end;
+    size_t i, start;
+
+    buffer = replog_begin();
+    if (buffer == NULL)
+        return;
+    for (i = 0; i < count; i++) {
+        record = &records[i];
+        if (!record->stored || record->len < 2)
+            continue;
+
+        /* Strip the article number and CRLF added for the method. */
+        end = record->data + record->len - 2;
+        data = memchr(record->data, '\t', end - record->data);
+        data = (data == NULL) ? record->data : data + 1;
+
+        start = record_start(buffer, replog_add);
+        pack_integer(buffer, record->artnum, 8);
+        pack_integer(buffer, record->arrived, 8);
+        pack_integer(buffer, record->expires, 8);
+        pack_u8(buffer, record->token.type);
+        pack_u8(buffer, record->token.class);
+        buffer_append(buffer, record->token.token, sizeof(record->token.token));
+        pack_string(buffer, record->group, strlen(record->group));
+        buffer_append(buffer, data, end - data);
+        record_finish(buffer, start);
+    }
+    replog_write();
+}
+
+
+/*
+**  Log the removal of an article from a newsgroup by a cancel.
+*/
+void
+OVreplogcancel(const char *group, ARTNUM artnum)
+{
+    struct buffer *buffer;
+    size_t start;
+
+    buffer = replog_begin();
+    if (buffer == NULL)
+        return;
+    start = record_start(buffer, replog_cancel);
+    pack_integer(buffer, artnum, 8);
+    pack_string(buffer, group, strlen(group));
+    record_finish(buffer, start);
+    replog_write();
+}
+
+
+/*
+**  Log the creation of a newsgroup, or the change of its flag.
+*/
+void
+OVreploggroupadd(const char *group, ARTNUM lo, ARTNUM hi, const char *flag)
+{
+    struct buffer *buffer;
+    size_t start;
+
+    buffer = replog_begin();
+    if (buffer == NULL)
+        return;
+    start = record_start(buffer, replog_groupadd);
+    pack_integer(buffer, lo, 8);
+    pack_integer(buffer, hi, 8);
+    pack_string(buffer, flag, strcspn(flag, "\n"));
+    pack_string(buffer, group, strlen(group));
+    record_finish(buffer, start);
+    replog_write();
+}
+
+
+/*
+**  Log the removal of a newsgroup.
+*/
+void
+OVreploggroupdel(const char *group)
+{
+    struct buffer *buffer;
+    size_t start;
+
+    buffer = replog_begin();
+    if (buffer == NULL)
+        return;
+    start = record_start(buffer, replog_groupdel);
+    pack_string(buffer, group, strlen(group));
+    record_finish(buffer, start);
+    replog_write();
+}
+
+
+/*
+**  Return the numbers of the articles in the overview of a newsgroup, in
+**  increasing order, and set *count to how many there are.
+*/
+static ARTNUM *
+replog_articles(const OV_METHOD *method, const char *group, size_t *count)
+{
+    ARTNUM *articles = NULL;
+    ARTNUM artnum;
+    size_t size = 0;
+    int lo, hi, total, flag;
+    void *handle;
+
+    *count = 0;
+    if (!(*method->groupstats)(group, &lo, &hi, &total, &flag))
+        return NULL;
+    handle = (*method->opensearch)(group, lo, hi);
+    if (handle == NULL)
+        return NULL;
+    while ((*method->search)(handle, &artnum, NULL, NULL, NULL, NULL)) {
+        if (*count == size) {
+            size = (size == 0) ? 1024 : size * 2;
+            articles = xreallocarray(articles, size, sizeof(ARTNUM));
+        }
+        articles[(*count)++] = artnum;
+    }
+    (*method->closesearch)(handle);
+    return articles;
+}
+
+
+/*
+**  Fill in the count of articles of a replog_expire record and its length.
+*/
+static void
+expire_finish(struct buffer *buffer, size_t start, size_t countpos,
+              uint32_t count)
+{
+    unsigned char *p;
+
+    p = (unsigned char *) buffer->data + buffer->used + countpos;
+    p[0] = (count >> 24) & 0xff;
+    p[1] = (count >> 16) & 0xff;
+    p[2] = (count >> 8) & 0xff;
+    p[3] = count & 0xff;
+    record_finish(buffer, start);
+}
+
+
+/*
+**  Expire a newsgroup with the given method and log the articles it
+**  removed, found by comparing the articles in its overview before and
+**  after.  Passing NULL as the group only cleans up after expiry, which
+**  doesn't concern the followers.
+*/
+bool
+OVreplogexpire(const OV_METHOD *method, const char *group, int *lo,
+               struct history *h)
+{
+    struct buffer *buffer;
+    ARTNUM *before, *after;
+    size_t nbefore, nafter, i, j, start, countpos;
+    uint32_t count;
+    bool status;
+
+    if (innconf->ovreplicationhours == 0 || group == NULL)
+        return (*method->expiregroup)(group, lo, h);
+
+    before = replog_articles(method, group, &nbefore);
+    status = (*method->expiregroup)(group, lo, h);
+    if (!status || nbefore == 0) {
+        free(before);
+        return status;
+    }
+    after = replog_articles(method, group, &nafter);
+
+    buffer = replog_begin();
+    start = countpos = 0;
+    count = 0;
+    for (i = 0, j = 0; i < nbefore; i++) {
+        while (j < nafter && after[j] < before[i])
+            j++;
+        if (j < nafter && after[j] == before[i])
+            continue;
+        if (count == 0) {
+            start = record_start(buffer, replog_expire);
+            pack_string(buffer, group, strlen(group));
+            countpos = buffer->left;
+            pack_integer(buffer, 0, 4);
+        }
+        pack_integer(buffer, before[i], 8);
+        count++;
+        if (count == REPLOG_MAXEXPIRE) {
+            expire_finish(buffer, start, countpos, count);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        expire_finish(buffer, start, countpos, count);
+    replog_write();
+    free(before);
+    free(after);
+    return status;
+}
+
+
+/*
+**  Close the file open for writing, if any.  The directory is looked up
+**  again on the next write, since pathoverview may have changed.
+*/
+void
+OVreplogclose(void)
+{
+    if (replog_fd >= 0) {
+        close(replog_fd);
+        replog_fd = -1;
+    }
+    free(replog_dir);
+    replog_dir = NULL;
+}
+
+
+/*
+**  Start reading the log at the given position.  An hour of 0 starts at the
+**  oldest file.  If follow is true, OVreplogread waits for new records at
+**  the end of the log instead of returning false.  Returns NULL if the log
+**  isn't kept or no longer goes back to that position.
+*/
+void *
+OVopenreplog(unsigned long hour, unsigned long offset, bool follow)
+{
+    struct replog_reader *reader;
+    unsigned long now;
+    char *dir;
+
+    if (innconf->ovreplicationhours == 0) {
+        warn("ovreplicationhours is not set");
+        return NULL;
+    }
+    now = REPLOG_HOUR(time(NULL));
+    dir = concatpath(innconf->pathoverview, INN_PATH_REPLOG);
+    if (hour == 0) {
+        hour = replog_next(dir, 0);
+        if (hour == 0)
+            hour = now;
+        offset = 0;
+    } else if (hour + innconf->ovreplicationhours <= now) {
+        warn("position %lu:%lu is no longer in the replication log", hour,
+             offset);
+        free(dir);
+        return NULL;
+    }
+
+    reader = xcalloc(1, sizeof(struct replog_reader));
+    reader->dir = dir;
+    reader->hour = hour;
+    reader->offset = offset;
+    reader->follow = follow;
+    reader->fd = -1;
+    reader->pending = buffer_new();
+    return reader;
+}
+
+
+/*
+**  Move a reader to the next file of the log.  All the files for hours
+**  ending more than REPLOG_GRACE seconds ago are complete, so the hours
+**  before that without a file are skipped.
+*/
+static void
+replog_advance(struct replog_reader *reader)
+{
+    unsigned long next, settled;
+
+    if (reader->fd >= 0) {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+    next = replog_next(reader->dir, reader->hour);
+    settled = REPLOG_HOUR(time(NULL) - REPLOG_GRACE);
+    if (next == 0 || next > settled)
+        next = (settled > reader->hour + 1) ? settled : reader->hour + 1;
+    reader->hour = next;
+    reader->offset = 0;
+    buffer_set(reader->pending, NULL, 0);
+}
+
+
+/*
+**  Append the next complete records of the log to output, preceded by a
+**  replog_position record whenever a new file is started.  Returns false at
+**  the end of the log if not following it, or on error.
+*/
+bool
+OVreplogread(void *handle, struct buffer *output)
+{
+    struct replog_reader *reader = handle;
+    struct buffer *pending = reader->pending;
+    size_t initial = output->left;
+    size_t length, start, returned;
+    ssize_t count;
+    bool bad, done;
+    char *path;
+
+    for (;;) {
+        done = (time(NULL) >= (time_t) ((reader->hour + 1) * 60 * 60
+                                        + REPLOG_GRACE));
+        if (reader->fd < 0) {
+            path = replog_path(reader->dir, reader->hour);
+            reader->fd = open(path, O_RDONLY);
+            if (reader->fd < 0 && errno != ENOENT) {
+                syswarn("cannot open %s", path);
+                free(path);
+                return false;
+            }
+            if (reader->fd < 0 && reader->offset != 0) {
+                warn("%s is missing from the replication log", path);
+                free(path);
+                return false;
+            }
+            free(path);
+            if (reader->fd >= 0) {
+                fdflag_close_exec(reader->fd, true);
+                if (lseek(reader->fd, reader->offset, SEEK_SET) < 0) {
+                    syswarn("cannot seek in replication log");
+                    return false;
+                }
+                start = record_start(output, replog_position);
+                pack_integer(output, reader->hour, 8);
+                pack_integer(output, reader->offset, 8);
+                record_finish(output, start);
+                buffer_set(pending, NULL, 0);
+            }
+        }
+
+        /* Read what is there and return the complete records. */
+        returned = 0;
+        count = 0;
+        if (reader->fd >= 0) {
+            buffer_compact(pending);
+            if (pending->size < pending->left + REPLOG_CHUNK)
+                buffer_resize(pending, pending->left + REPLOG_CHUNK);
+            count = buffer_read(pending, reader->fd);
+            if (count < 0) {
+                syswarn("cannot read replication log");
+                return false;
+            }
+            for (;;) {
+                length = record_length(pending->data + pending->used,
+                                       pending->left, &bad);
+                if (bad) {
+                    warn("invalid record at %lu:%lu in replication log",
+                         reader->hour, reader->offset);
+                    return false;
+                }
+                if (length == 0)
+                    break;
+                buffer_append(output, pending->data + pending->used, length);
+                pending->used += length;
+                pending->left -= length;
+                reader->offset += length;
+                returned += length;
+                if (returned >= REPLOG_CHUNK)
+                    break;
+            }
+        }
+        if (output->left > initial)
+            return true;
+
+        /* Nothing new.  Move on if this hour is over, else wait. */
+        if (count == 0 && done) {
+            if (pending->left > 0)
+                warn("truncated record at %lu:%lu in replication log",
+                     reader->hour, reader->offset);
+            replog_advance(reader);
+            continue;
+        }
+        if (!reader->follow)
+            return false;
+        poll(NULL, 0, REPLOG_POLL);
+    }
+}
+
+
+/*
+**  Stop reading the log.
+*/
+void
+OVclosereplog(void *handle)
+{
+    struct replog_reader *reader = handle;
+
+    if (reader->fd >= 0)
+        close(reader->fd);
+    buffer_free(reader->pending);
+    free(reader->dir);
+    free(reader);
+}
+
+
+/*
+**  Store the overview records collected from a run of replog_add records.
+*/
+static bool
+replay_flush(struct ov_recordset *set)
+{
+    bool status;
+
+    status = OVrecordsstore(set, OVmethod());
+    if (!status)
+        warn("cannot store replicated overview data");
+    OVrecordsclear(set);
+    return status;
+}
+
+
+/*
+**  Apply one record other than replog_add to the overview.  Returns false,
+**  after saying why, if it is malformed or can't be applied.
+*/
+static bool
+replay_record(unsigned int type, const char *data, const char *end,
+              unsigned long *hour, unsigned long *offset)
+{
+    static struct buffer *group = NULL, *flag = NULL;
+    const OV_METHOD *method = OVmethod();
+    uint64_t first, second, count;
+
+    if (group == NULL) {
+        group = buffer_new();
+        flag = buffer_new();
+    }
+    switch (type) {
+    case replog_position:
+        if (!unpack_integer(&data, end, 8, &first)
+            || !unpack_integer(&data, end, 8, &second))
+            break;
+        *hour = first;
+        *offset = second;
+        return true;
+    case replog_cancel:
+        if (!unpack_integer(&data, end, 8, &first)
+            || !unpack_string(&data, end, group))
+            break;
+
+        /* The article may be gone already. */
+        if ((*method->cancel)(group->data, first))
+            OVreplogcancel(group->data, first);
+        return true;
+    case replog_groupadd:
+        if (!unpack_integer(&data, end, 8, &first)
+            || !unpack_integer(&data, end, 8, &second)
+            || !unpack_string(&data, end, flag)
+            || !unpack_string(&data, end, group))
+            break;
+        if (!(*method->groupadd)(group->data, first, second, flag->data)) {
+            warn("cannot add newsgroup %s", group->data);
+            return false;
+        }
+        OVreploggroupadd(group->data, first, second, flag->data);
+        return true;
+    case replog_groupdel:
+        if (!unpack_string(&data, end, group))
+            break;
+        if (!(*method->groupdel)(group->data)) {
+            warn("cannot remove newsgroup %s", group->data);
+            return false;
+        }
+        OVreploggroupdel(group->data);
+        return true;
+    case replog_expire:
+        if (!unpack_string(&data, end, group)
+            || !unpack_integer(&data, end, 4, &count)
+            || (uint64_t) (end - data) != count * 8)
+            break;
+        while (unpack_integer(&data, end, 8, &first))
+            if ((*method->cancel)(group->data, first))
+                OVreplogcancel(group->data, first);
+        return true;
+    default:
+        break;
+    }
+    warn("malformed record in replication stream at %lu:%lu", *hour,
+         *offset);
+    return false;
+}
+
+
+/*
+**  Apply the complete records at the start of input to the overview, which
+**  must be open for writing, and remove them from input.  Consecutive
+**  replog_add records are stored with a single call to the overview method.
+**  The position in the log of the master after the last record applied is
+**  kept in *hour and *offset.  Returns false if a record is malformed or
+**  can't be applied; the records before it have been applied.
+*/
+bool
+OVreplay(struct buffer *input, unsigned long *hour, unsigned long *offset)
+{
+    static struct ov_recordset *set = NULL;
+    static struct buffer *group = NULL;
+    const char *data, *end, *overview;
+    uint64_t artnum, arrived, expires;
+    unsigned int type;
+    TOKEN token;
+    size_t length;
+    bool bad;
+
+    if (OVmethod() == NULL) {
+        warn("ovopen must be called first");
+        return false;
+    }
+    if (set == NULL) {
+        set = OVrecordsnew();
+        group = buffer_new();
+    }
+    OVrecordsclear(set);
+    for (;;) {
+        data = input->data + input->used;
+        length = record_length(data, input->left, &bad);
+        if (bad || length == 0)
+            break;
+        end = data + length;
+        type = (unsigned char) data[4];
+        data += REPLOG_HEADER;
+
+        if (type == replog_add) {
+            if (!unpack_integer(&data, end, 8, &artnum)
+                || !unpack_integer(&data, end, 8, &arrived)
+                || !unpack_integer(&data, end, 8, &expires)
+                || end - data < REPLOG_TOKEN)
+                goto malformed;
+            token.type = data[0];
+            token.class = data[1];
+            memcpy(token.token, data + 2, sizeof(token.token));
+            data += REPLOG_TOKEN;
+            if (!unpack_string(&data, end, group))
+                goto malformed;
+            overview = data;
+            OVrecordsadd(set, group->data, artnum, token, overview,
+                         end - overview, arrived, expires, 0);
+        } else {
+            if (set->count > 0 && !replay_flush(set))
+                return false;
+            if (!replay_record(type, data, end, hour, offset))
+                return false;
+        }
+        input->used += length;
+        input->left -= length;
+        if (type != replog_position)
+            *offset += length;
+    }
+    if (bad) {
+        warn("invalid record length in replication stream");
+        return false;
+    }
+    if (set->count > 0 && !replay_flush(set))
+        return false;
+    return true;
+
+malformed:
+    warn("malformed record in replication stream at %lu:%lu", *hour,
+         *offset);
+    if (set->count > 0)
+        replay_flush(set);
+    return false;
+}
@@ -3,6 +3,8 @@
 #ifdef HAVE_SQLITE3
 
 #include <string.h>
+#include "inn/concat.h"
+#include "inn/libinn.h"
 #include "inn/xmalloc.h"
 
 bool unpack_now(
@@ -59,4 +61,46 @@ size_t pack_later(
     return result;
 }
 
+/*
+ * Partition 0 keeps the plain file names, so that an unpartitioned overview
+ * doesn't change.  The other ones get their number before the extension,
+ * like "ovsqlite-3.db".
+ */
+char *partition_path(
+    char const *dir,
+    char const *name,
+    unsigned long partition)
+{
+    char const *dot;
+    char *file, *path;
+
+    if (partition==0)
+        return concatpath(dir, name);
+    dot = strrchr(name, '.');
+    if (!dot)
+        dot = name+strlen(name);
+    xasprintf(&file, "%.*s-%lu%s", (int)(dot-name), name, partition, dot);
+    path = concatpath(dir, file);
+    free(file);
+    return path;
+}
+
+unsigned long partition_of(
+    char const *group,
+    size_t group_len,
+    unsigned long partitions)
+{
+    HASH hash;
+    unsigned char const *bytes;
+    unsigned long value;
+
+    if (partitions<=1)
+        return 0;
+    hash = Hash(group, group_len);
+    bytes = (unsigned char const *)hash.hash;
+    value = ((unsigned long)bytes[0]<<24) | ((unsigned long)bytes[1]<<16)
+        | ((unsigned long)bytes[2]<<8) | bytes[3];
+    return value%partitions;
+}
+
 #endif /* HAVE_SQLITE3 */
@@ -10,11 +10,19 @@
 #include "inn/buffer.h"
 
 #define OVSQLITE_SCHEMA_VERSION         1
-#define OVSQLITE_PROTOCOL_VERSION       1
+#define OVSQLITE_PROTOCOL_VERSION       2
 
 #define OVSQLITE_SERVER_SOCKET          "ovsqlite.sock"
 #define OVSQLITE_SERVER_PIDFILE         "ovsqlite.pid"
 
+/*
+ * The shared-memory response area of a client, and the smallest response
+ * worth passing through it rather than through the socket.
+ */
+#define OVSQLITE_SHM_FILE               "ovsqlite-shm.XXXXXX"
+#define OVSQLITE_SHM_SIZE               0x40000
+#define OVSQLITE_SHM_THRESHOLD          0x1000
+
 #ifndef HAVE_UNIX_DOMAIN_SOCKETS
 
 #define OVSQLITE_SERVER_PORT            "ovsqlite.port"
@@ -47,6 +55,7 @@ enum {
     request_start_expire_group,
     request_expire_group,
     request_finish_expire,
+    request_map_shm,
 
     count_request_codes
 };
@@ -60,6 +69,7 @@ enum {
     response_artinfo,
     response_artlist,
     response_artlist_done,
+    response_shm,
 
     response_error                      = 0x80,
     response_sequence_error,
@@ -115,6 +125,21 @@ extern size_t pack_later(
     buffer_t *dst,
     size_t count);
 
+/*
+ * With the partitions parameter, each partition of the overview has its
+ * own database file and server socket, named by partition_path.  Groups
+ * are assigned to partitions by partition_of, from a hash of their name.
+ */
+extern char *partition_path(
+    char const *dir,
+    char const *name,
+    unsigned long partition);
+
+extern unsigned long partition_of(
+    char const *group,
+    size_t group_len,
+    unsigned long partitions);
+
 END_DECLS
 
 #endif /* HAVE_SQLITE3 */
@@ -124,7 +149,7 @@ END_DECLS
 
 /****************************************************************************
 
-ovsqlite-server protocol version 1
+ovsqlite-server protocol version 2
 
 The protocol is binary and uses no alignment padding anywhere.
 All integer values are in native byte order.
@@ -161,6 +186,7 @@ The version field specifies the expected protocol version.
 The mode field contains the read/write flags.
 The cookie field is present only when running on a system without
 Unix-domain sockets and contains the 16-byte authentication cookie.
+The server also accepts version 1, which lacks request_map_shm.
 
 
 request_setcutofflow
@@ -290,13 +316,33 @@ it only does a limited amount of work each time.  The client should repeat
 the request until it receives a response_done.
 
 
+request_map_shm
+    u32 length
+    u8 code
+    u16 path_len
+    u8 path[path_len]
+
+Asks the server to map the file at path, OVSQLITE_SHM_SIZE bytes long, as
+the response area of this connection.  Returns response_ok on success, and
+response_error if the server doesn't use shared memory or can't map the
+file, in which case all responses keep going through the socket.  Once
+the response is received, the client can remove the file.
+
+
 === response formats ===
 
 response_ok
     u32 length
     u8 code
+    u32 partition   (conditional)
+    u32 partitions  (conditional)
 
 The generic success response.
+When answering a request_hello of version 2 or later, it also gives the
+partition this server is in charge of and the number of partitions.
+The client connects to the server of partition 0 first, then to those
+of the other ones, and sends the requests about a group to the server
+of its partition.
 
 
 response_done
@@ -371,6 +417,18 @@ The code response_artlist_done means that this is the last batch
 of articles and further requests are pointless.
 
 
+response_shm
+    u32 length
+    u8 code
+    u32 size
+
+Sent on the socket instead of any response of at least
+OVSQLITE_SHM_THRESHOLD bytes once a response area has been mapped.
+The actual response, size bytes long, has been written at the start
+of the response area.  Since only one request is ever outstanding,
+the client can read it in place until it sends the next request.
+
+
 response_error
     u32 length
     u8 code
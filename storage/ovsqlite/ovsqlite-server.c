@@ -11,6 +11,7 @@
 
 #ifdef HAVE_SQLITE3
 
+#include <ctype.h>
 #include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -22,7 +23,12 @@
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "portable/setproctitle.h"
 #include "portable/socket.h"
@@ -36,6 +42,8 @@
 #include "inn/xmalloc.h"
 #include "inn/innconf.h"
 #include "inn/confparse.h"
+#include "inn/hashtab.h"
+#include "inn/ov.h"
 #include "inn/storage.h"
 
 #include "sql-main.h"
@@ -71,8 +79,36 @@ static char const basedict_format[] =
     "Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec "
     "GMT\t (UTC)\tXref: %s ";
 
-static char dictionary[0x8000];
+#define DICTIONARY_SIZE 0x8000
+
+/* Largest trained dictionary for a hierarchy. */
+#define HIERDICT_SIZE 0x1000
+
+/* Overview data collected from a hierarchy before training its dictionary. */
+#define HIERDICT_SAMPLES 0x8000
+
+/* Hierarchies being sampled at the same time. */
+#define HIERDICT_TRAINING_MAX 256
+
+/* Longest hierarchy name that can have a dictionary. */
+#define HIERARCHY_MAX 256
+
+static char basedict[DICTIONARY_SIZE-HIERDICT_SIZE];
 static unsigned int basedict_len;
+static char dictionary[DICTIONARY_SIZE];
+
+typedef struct hierdict_t {
+    char *hierarchy;
+    uint8_t *data;
+    size_t len;                 /* 0 if the hierarchy has no dictionary. */
+} hierdict_t;
+
+typedef struct hiersample_t {
+    char *hierarchy;
+    buffer_t *data;
+} hiersample_t;
+
+static struct hash *hiersamples;
 
 #endif /* USE_DICTIONARY */
 
@@ -81,10 +117,30 @@ static unsigned int basedict_len;
 enum {
     client_flag_init    = 0x01,
     client_flag_term    = 0x02,
+    client_flag_reader  = 0x04,
 };
 
 #define INITIAL_CAPACITY 0x400
 
+/*
+ * Everything a request handler needs to query the database.
+ * The main thread uses the primary connection; each reader thread
+ * has a session of its own.
+ */
+
+typedef struct session_t {
+    sqlite3 *connection;
+    sql_main_t *sql;
+#ifdef HAVE_ZLIB
+    z_stream *inflation;
+    buffer_t *flate;
+#ifdef USE_DICTIONARY
+    char *dictionary;
+    struct hash *hierdicts;
+#endif
+#endif
+} session_t;
+
 typedef struct client_t {
     uint8_t flags;
     bool cutofflow;
@@ -92,8 +148,10 @@ typedef struct client_t {
     int sock;
     uint32_t mode;
     time_t expiration_start;
+    session_t *session;
     buffer_t *request;
     buffer_t *response;
+    char *shm;
 } client_t;
 
 #ifndef HAVE_UNIX_DOMAIN_SOCKETS
@@ -101,6 +159,9 @@ static ovsqlite_port port;
 #endif /* ! HAVE_UNIX_DOMAIN_SOCKETS */
 
 static char *pidfile = NULL;
+static unsigned long partitions = 1;
+static unsigned long partition;
+static pid_t *children = NULL;
 static int listensock = -1;
 static int maxsock = -1;
 static client_t *clients = NULL;
@@ -110,16 +171,26 @@ static bool volatile terminating;
 
 static sqlite3 *connection;
 static sql_main_t sql_main;
+static session_t primary;
 
 static bool use_compression;
 static unsigned long pagesize;
 static unsigned long cachesize;
+static bool use_wal;
+static bool use_shm;
+static unsigned long reader_threads;
+static unsigned long dict_levels;
 static struct timeval transaction_time_limit = {10, 0};
 static unsigned long transaction_row_limit = 10000;
+static unsigned long transaction_size_limit;
+static struct timeval transaction_idle_time;
+static bool async_commit;
 
 static bool in_transaction;
 static unsigned int transaction_rowcount;
+static size_t transaction_bytes;
 static struct timeval next_commit;
+static struct timeval last_write;
 
 
 static void timeval_normalise(
@@ -169,6 +240,13 @@ static struct timeval timeval_difference(
     return result;
 }
 
+static bool timeval_before(
+    struct timeval a,
+    struct timeval b)
+{
+    return a.tv_sec<b.tv_sec || (a.tv_sec==b.tv_sec && a.tv_usec<b.tv_usec);
+}
+
 static void catcher(
     int sig UNUSED)
 {
@@ -208,6 +286,7 @@ static client_t *add_client(
     memset(result, 0, sizeof (client_t));
     result->sock = sock;
     result->flags = client_flag_init;
+    result->session = &primary;
     result->request = buffer_new();
     buffer_resize(result->request, INITIAL_CAPACITY);
     result->response = buffer_new();
@@ -235,6 +314,8 @@ static void del_client(
     close(sock);
     buffer_free(client->request);
     buffer_free(client->response);
+    if (client->shm)
+        munmap(client->shm, OVSQLITE_SHM_SIZE);
     if (ix+1<client_count)
         *client = clients[client_count-1];
     client_count--;
@@ -263,7 +344,7 @@ static void make_unix_listener(void)
         sysdie("cannot create socket");
     memset(&sa, 0, sizeof sa);
     sa.sun_family = AF_UNIX;
-    path = concatpath(innconf->pathrun, OVSQLITE_SERVER_SOCKET);
+    path = partition_path(innconf->pathrun, OVSQLITE_SERVER_SOCKET, partition);
     strlcpy(sa.sun_path, path, sizeof(sa.sun_path));
     unlink(sa.sun_path);
     free(path);
@@ -317,7 +398,7 @@ static void make_inet_listener(void)
         sysdie("cannot extract socket port number");
     port.port = sa.sin_port;
 
-    path = concatpath(innconf->pathrun, OVSQLITE_SERVER_PORT);
+    path = partition_path(innconf->pathrun, OVSQLITE_SERVER_PORT, partition);
     unlink(path);
     fd = open(path, O_CREAT|O_TRUNC|O_WRONLY, 0440);
     if (fd==-1)
@@ -366,7 +447,7 @@ static void load_config(void)
 {
     char *path;
     struct config_group *top;
-    double timelimit;
+    double timelimit, idletime;
 
     if (strcmp(innconf->ovmethod, "ovsqlite"))
         die("ovmethod not set to ovsqlite in inn.conf");
@@ -387,6 +468,25 @@ static void load_config(void)
         }
         config_param_unsigned_number(
             top, "transrowlimit", &transaction_row_limit);
+        config_param_unsigned_number(
+            top, "transsizelimit", &transaction_size_limit);
+        if (config_param_real(top, "transidletime", &idletime)
+                && idletime>0) {
+            transaction_idle_time.tv_sec = idletime;
+            transaction_idle_time.tv_usec =
+                (idletime-transaction_idle_time.tv_sec)*1E6+0.5;
+            timeval_normalise(&transaction_idle_time);
+        }
+        config_param_boolean(top, "asynccommit", &async_commit);
+        config_param_boolean(top, "walmode", &use_wal);
+        config_param_boolean(top, "sharedmemory", &use_shm);
+        config_param_unsigned_number(top, "partitions", &partitions);
+        if (partitions==0)
+            partitions = 1;
+        config_param_unsigned_number(
+            top, "readerthreads", &reader_threads);
+        config_param_unsigned_number(
+            top, "dictlevels", &dict_levels);
 
         config_free(top);
     }
@@ -430,11 +530,11 @@ static void setup_compression(
 #ifdef USE_DICTIONARY
     if (init) {
         basedict_len = snprintf(
-            dictionary, sizeof dictionary,
+            basedict, sizeof basedict,
             basedict_format, innconf->pathhost);
         sqlite3_bind_text(sql_main.setmisc, 1, "basedict", -1, SQLITE_STATIC);
         sqlite3_bind_blob(
-            sql_main.setmisc, 2, dictionary, basedict_len, SQLITE_STATIC);
+            sql_main.setmisc, 2, basedict, basedict_len, SQLITE_STATIC);
         status = sqlite3_step(sql_main.setmisc);
         if (status!=SQLITE_DONE) {
             die("cannot store compression dictionary: %s",
@@ -453,9 +553,9 @@ static void setup_compression(
         }
         dict = sqlite3_column_blob(sql_main.getmisc, 0);
         size = sqlite3_column_bytes(sql_main.getmisc, 0);
-        if (!dict || size>=sizeof dictionary)
+        if (!dict || size>=sizeof basedict)
             die("invalid compression dictionary in database");
-        memcpy(dictionary, dict, size);
+        memcpy(basedict, dict, size);
         basedict_len = size;
         resetclear(sql_main.getmisc);
     }
@@ -516,23 +616,458 @@ static uint32_t unpack_length(
 
 #ifdef USE_DICTIONARY
 
+/*
+ * The preset dictionary of a record is the trained dictionary of its
+ * hierarchy, if any, then the base dictionary, then the newsgroup name
+ * and article number.  inflate reports the Adler-32 checksum of the
+ * dictionary a record needs, which tells which one was used.
+ */
+
 static unsigned int make_dict(
+    char *dict,
+    hierdict_t const *hier,
     char const *groupname,
     int groupname_len,
     uint64_t artnum)
 {
+    unsigned int used = 0;
+
+    if (hier) {
+        memcpy(dict, hier->data, hier->len);
+        used = hier->len;
+    }
+    memcpy(dict+used, basedict, basedict_len);
+    used += basedict_len;
     sqlite3_snprintf(
-        sizeof dictionary-basedict_len, dictionary+basedict_len,
+        DICTIONARY_SIZE-used, dict+used,
         "%.*s:%llu\r\n",
         groupname_len, groupname, artnum);
-    return basedict_len+strlen(dictionary+basedict_len);
+    return used+strlen(dict+used);
+}
+
+/*
+ * Trained dictionaries.
+ *
+ * A hierarchy is the first dictlevels components of a newsgroup name.
+ * Once HIERDICT_SAMPLES bytes of overview data have been seen for a
+ * hierarchy without a dictionary, the strings that occur most often in
+ * them become its dictionary, stored in the misc table under the key
+ * "dict:" followed by the hierarchy.  A stored dictionary is never
+ * changed, since records compressed with it must remain readable.
+ *
+ * Every session keeps its own cache of the dictionaries it has looked
+ * up, including the hierarchies found to have none.  Only the main
+ * thread creates dictionaries, so its cache is always right; a reader
+ * thread which cannot find the dictionary of a record reloads the
+ * candidates from the database.
+ */
+
+static const void *hierdict_key(
+    const void *entry)
+{
+    return ((const hierdict_t *)entry)->hierarchy;
 }
 
+static const void *hiersample_key(
+    const void *entry)
+{
+    return ((const hiersample_t *)entry)->hierarchy;
+}
+
+static bool hierdict_equal(
+    const void *key,
+    const void *entry)
+{
+    return strcmp(key, ((const hierdict_t *)entry)->hierarchy)==0;
+}
+
+static bool hiersample_equal(
+    const void *key,
+    const void *entry)
+{
+    return strcmp(key, ((const hiersample_t *)entry)->hierarchy)==0;
+}
+
+static void hierdict_delete(
+    void *entry)
+{
+    hierdict_t *hier = entry;
+
+    free(hier->hierarchy);
+    free(hier->data);
+    free(hier);
+}
+
+static void hiersample_delete(
+    void *entry)
+{
+    hiersample_t *sample = entry;
+
+    free(sample->hierarchy);
+    buffer_free(sample->data);
+    free(sample);
+}
+
+static struct hash *hierdict_table(void)
+{
+    return hash_create(
+        64, hash_string, hierdict_key, hierdict_equal, hierdict_delete);
+}
+
+/*
+ * Copy the first levels components of a newsgroup name to buf, which must
+ * hold HIERARCHY_MAX bytes.  Returns false if that doesn't fit.
+ */
+
+static bool hierarchy_name(
+    char *buf,
+    char const *groupname,
+    unsigned int groupname_len,
+    unsigned long levels)
+{
+    unsigned int len;
+
+    for (len = 0; len<groupname_len; len++) {
+        if (groupname[len]=='.' && --levels==0)
+            break;
+    }
+    if (len>=HIERARCHY_MAX)
+        return false;
+    memcpy(buf, groupname, len);
+    buf[len] = '\0';
+    return true;
+}
+
+static hierdict_t *hierdict_lookup(
+    session_t *session,
+    char const *hierarchy,
+    bool reload)
+{
+    hierdict_t *hier;
+    sqlite3_stmt *stmt;
+    char key[HIERARCHY_MAX+5];
+    void const *data;
+    int size;
+
+    hier = hash_lookup(session->hierdicts, hierarchy);
+    if (hier && (hier->len>0 || !reload))
+        return hier;
+    if (!hier) {
+        hier = xcalloc(1, sizeof (hierdict_t));
+        hier->hierarchy = xstrdup(hierarchy);
+        hash_insert(session->hierdicts, hier->hierarchy, hier);
+    }
+    snprintf(key, sizeof key, "dict:%s", hierarchy);
+    stmt = session->sql->getmisc;
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt)==SQLITE_ROW) {
+        data = sqlite3_column_blob(stmt, 0);
+        size = sqlite3_column_bytes(stmt, 0);
+        if (data && size>0 && size<=HIERDICT_SIZE) {
+            hier->data = xmalloc(size);
+            memcpy(hier->data, data, size);
+            hier->len = size;
+        }
+    }
+    resetclear(stmt);
+    return hier;
+}
+
+/*
+ * Find the dictionary a compressed record needs, from the Adler-32
+ * checksum inflate reported, and hand it to inflate.
+ */
+
+static int inflate_dict(
+    session_t *session,
+    z_stream *stream,
+    char const *groupname,
+    unsigned int groupname_len,
+    uint64_t artnum)
+{
+    char *dict = session->dictionary;
+    char hierarchy[HIERARCHY_MAX];
+    unsigned long levels, ix;
+    unsigned int size;
+    int pass;
+
+    size = make_dict(dict, NULL, groupname, groupname_len, artnum);
+    if (adler32(adler32(0, NULL, 0), (uint8_t *)dict, size)==stream->adler)
+        return inflateSetDictionary(stream, (uint8_t *)dict, size);
+    levels = 1;
+    for (ix = 0; ix<groupname_len; ix++)
+        if (groupname[ix]=='.')
+            levels++;
+    for (pass = 0; pass<2; pass++) {
+        for (ix = levels; ix>0; ix--) {
+            hierdict_t *hier;
+
+            if (!hierarchy_name(hierarchy, groupname, groupname_len, ix))
+                continue;
+            hier = hierdict_lookup(session, hierarchy, pass>0);
+            if (hier->len==0)
+                continue;
+            size = make_dict(dict, hier, groupname, groupname_len, artnum);
+            if (adler32(adler32(0, NULL, 0), (uint8_t *)dict, size)
+                    ==stream->adler)
+                return inflateSetDictionary(stream, (uint8_t *)dict, size);
+        }
+    }
+    return Z_DATA_ERROR;
+}
+
+/*
+ * The dictionary to compress a new record of a newsgroup with:  that of
+ * the longest hierarchy with one, up to dictlevels components.
+ */
+
+static hierdict_t *deflate_dict(
+    char const *groupname,
+    unsigned int groupname_len)
+{
+    char hierarchy[HIERARCHY_MAX];
+    unsigned long ix;
+
+    for (ix = dict_levels; ix>0; ix--) {
+        hierdict_t *hier;
+
+        if (!hierarchy_name(hierarchy, groupname, groupname_len, ix))
+            continue;
+        hier = hierdict_lookup(&primary, hierarchy, false);
+        if (hier->len>0)
+            return hier;
+    }
+    return NULL;
+}
+
+typedef struct hiertoken_t {
+    char *text;
+    size_t len;
+    unsigned long count;
+} hiertoken_t;
+
+typedef struct hiertoken_list_t {
+    hiertoken_t **tokens;
+    size_t count;
+} hiertoken_list_t;
+
+static const void *hiertoken_key(
+    const void *entry)
+{
+    return ((const hiertoken_t *)entry)->text;
+}
+
+static bool hiertoken_equal(
+    const void *key,
+    const void *entry)
+{
+    return strcmp(key, ((const hiertoken_t *)entry)->text)==0;
+}
+
+static void hiertoken_delete(
+    void *entry)
+{
+    hiertoken_t *token = entry;
+
+    free(token->text);
+    free(token);
+}
+
+static void hiertoken_collect(
+    void *entry,
+    void *cookie)
+{
+    hiertoken_t *token = entry;
+    hiertoken_list_t *list = cookie;
+
+    if (token->count>1)
+        list->tokens[list->count++] = token;
+}
+
+static int hiertoken_compare(
+    const void *a,
+    const void *b)
+{
+    hiertoken_t const *ta = *(hiertoken_t * const *)a;
+    hiertoken_t const *tb = *(hiertoken_t * const *)b;
+    unsigned long sa = ta->count*(ta->len+1);
+    unsigned long sb = tb->count*(tb->len+1);
+
+    if (sa!=sb)
+        return sa>sb ? -1 : 1;
+    return strcmp(ta->text, tb->text);
+}
+
+/*
+ * Build a dictionary from sample overview data, one record per line.
+ * The words that occur more than once are ranked by how many bytes they
+ * account for, leaving out numbers and the article numbers of Xref
+ * entries, and the best ones are kept, the best last since deflate
+ * reaches the end of its dictionary with the shortest distances.
+ * Returns the size of the dictionary written to dict.
+ */
+
+static size_t hierdict_train(
+    buffer_t *samples,
+    uint8_t *dict)
+{
+    struct hash *counts;
+    hiertoken_list_t list;
+    char *p, *end;
+    size_t ix, picked, used;
+
+    counts = hash_create(
+        1024, hash_string, hiertoken_key, hiertoken_equal, hiertoken_delete);
+    p = samples->data;
+    end = p+samples->left;
+    while (p<end) {
+        char *word = p;
+        size_t len, digits;
+        hiertoken_t *token;
+
+        while (p<end && !strchr("\t\r\n ", *p))
+            p++;
+        len = p-word;
+        if (p<end)
+            p++;
+        /* Keep "group:" of "group:1234". */
+        digits = 0;
+        while (digits<len && isdigit((unsigned char)word[len-1-digits]))
+            digits++;
+        if (digits==len)
+            continue;
+        if (digits>0 && word[len-1-digits]==':')
+            len -= digits;
+        if (len<3 || len>200)
+            continue;
+        word[len] = '\0';
+        token = hash_lookup(counts, word);
+        if (!token) {
+            token = xmalloc(sizeof (hiertoken_t));
+            token->text = xstrdup(word);
+            token->len = len;
+            token->count = 0;
+            hash_insert(counts, token->text, token);
+        }
+        token->count++;
+    }
+
+    list.tokens = xmalloc(hash_count(counts)*sizeof (hiertoken_t *)+1);
+    list.count = 0;
+    hash_traverse(counts, hiertoken_collect, &list);
+    qsort(list.tokens, list.count, sizeof (hiertoken_t *), hiertoken_compare);
+    used = 0;
+    for (picked = 0; picked<list.count; picked++) {
+        hiertoken_t *token = list.tokens[picked];
+
+        if (used+token->len+1>HIERDICT_SIZE)
+            break;
+        used += token->len+1;
+    }
+    used = 0;
+    for (ix = picked; ix-->0; ) {
+        hiertoken_t *token = list.tokens[ix];
+
+        memcpy(dict+used, token->text, token->len);
+        used += token->len;
+        dict[used++] = '\t';
+    }
+    free(list.tokens);
+    hash_free(counts);
+    return used;
+}
+
+/*
+ * Add the overview data of a new record to the samples of its hierarchy,
+ * if that hierarchy still lacks a dictionary, and train one once there
+ * are enough samples.  Called by the main thread within a transaction.
+ */
+
+static void hierdict_sample(
+    char const *groupname,
+    unsigned int groupname_len,
+    char const *overview,
+    size_t overview_len)
+{
+    char hierarchy[HIERARCHY_MAX];
+    char key[HIERARCHY_MAX+5];
+    hierdict_t *hier;
+    hiersample_t *sample;
+    uint8_t *dict;
+    size_t size;
+    int status;
+
+    if (!hierarchy_name(hierarchy, groupname, groupname_len, dict_levels))
+        return;
+    hier = hierdict_lookup(&primary, hierarchy, false);
+    if (hier->len>0)
+        return;
+    if (!hiersamples)
+        hiersamples = hash_create(
+            64, hash_string, hiersample_key, hiersample_equal,
+            hiersample_delete);
+    sample = hash_lookup(hiersamples, hierarchy);
+    if (!sample) {
+        if (hash_count(hiersamples)>=HIERDICT_TRAINING_MAX)
+            return;
+        sample = xmalloc(sizeof (hiersample_t));
+        sample->hierarchy = xstrdup(hierarchy);
+        sample->data = buffer_new();
+        buffer_resize(sample->data, HIERDICT_SAMPLES);
+        hash_insert(hiersamples, sample->hierarchy, sample);
+    }
+    buffer_append(sample->data, overview, overview_len);
+    buffer_append(sample->data, "\n", 1);
+    if (sample->data->left<HIERDICT_SAMPLES)
+        return;
+
+    dict = xmalloc(HIERDICT_SIZE);
+    size = hierdict_train(sample->data, dict);
+    hash_delete(hiersamples, hierarchy);
+    if (size==0) {
+        free(dict);
+        return;
+    }
+    snprintf(key, sizeof key, "dict:%s", hierarchy);
+    sqlite3_bind_text(sql_main.setmisc, 1, key, -1, SQLITE_STATIC);
+    sqlite3_bind_blob(sql_main.setmisc, 2, dict, size, SQLITE_STATIC);
+    status = sqlite3_step(sql_main.setmisc);
+    resetclear(sql_main.setmisc);
+    if (status!=SQLITE_DONE) {
+        warn("cannot store compression dictionary for %s: %s",
+             hierarchy, sqlite3_errmsg(connection));
+        free(dict);
+        return;
+    }
+    free(hier->data);
+    hier->data = dict;
+    hier->len = size;
+}
 
 #endif
 
 #endif /* HAVE_ZLIB */
 
+static void set_cachesize(
+    sqlite3 *db)
+{
+    int status;
+    char *errmsg;
+    char sqltext[64];
+
+    if (!cachesize)
+        return;
+    snprintf(
+        sqltext, sizeof sqltext,
+        "pragma cache_size = -%lu;",
+        cachesize);
+    status = sqlite3_exec(db, sqltext, 0, NULL, &errmsg);
+    if (status!=SQLITE_OK) {
+        warn("cannot set cache size: %s", errmsg);
+        sqlite3_free(errmsg);
+    }
+}
+
 static void open_db(void)
 {
     char *path;
@@ -542,7 +1077,7 @@ static void open_db(void)
     bool init;
     char sqltext[64];
 
-    path = concatpath(innconf->pathoverview, OVSQLITE_DB_FILE);
+    path = partition_path(innconf->pathoverview, OVSQLITE_DB_FILE, partition);
     init = stat(path, &sb)==-1;
     if (init) {
         sql_init_t sql_init;
@@ -651,17 +1186,33 @@ static void open_db(void)
     if (use_compression)
         setup_compression(init);
 #endif
-    if (cachesize) {
-        snprintf(
-            sqltext, sizeof sqltext,
-            "pragma cache_size = -%lu;",
-            cachesize);
-        status = sqlite3_exec(connection, sqltext, 0, NULL, &errmsg);
-        if (status!=SQLITE_OK) {
-            warn("cannot set cache size: %s", errmsg);
-            sqlite3_free(errmsg);
-        }
+    /* can't use placeholders for pragma arguments, alas */
+    snprintf(sqltext, sizeof sqltext,
+             "pragma journal_mode = '%s';",
+             use_wal ? "WAL" : "PERSIST");
+    status = sqlite3_exec(connection, sqltext, 0, NULL, &errmsg);
+    if (status!=SQLITE_OK)
+        die("cannot set journal mode: %s", errmsg);
+    if (async_commit && use_wal) {
+        status = sqlite3_exec(
+            connection, "pragma synchronous = NORMAL;", 0, NULL, &errmsg);
+        if (status!=SQLITE_OK)
+            die("cannot set synchronous mode: %s", errmsg);
+    }
+    set_cachesize(connection);
+
+    primary.connection = connection;
+    primary.sql = &sql_main;
+#ifdef HAVE_ZLIB
+    if (use_compression) {
+        primary.inflation = &inflation;
+        primary.flate = flate;
+#ifdef USE_DICTIONARY
+        primary.dictionary = dictionary;
+        primary.hierdicts = hierdict_table();
+#endif
     }
+#endif
 }
 
 static void close_db(void)
@@ -677,6 +1228,14 @@ static void close_db(void)
         deflateEnd(&deflation);
         buffer_free(flate);
         flate = NULL;
+#ifdef USE_DICTIONARY
+        hash_free(primary.hierdicts);
+        primary.hierdicts = NULL;
+        if (hiersamples) {
+            hash_free(hiersamples);
+            hiersamples = NULL;
+        }
+#endif
     }
 #endif
 }
@@ -722,8 +1281,24 @@ static void start_response(
 static void finish_response(
     client_t *client)
 {
-    *(uint32_t *)(void *)client->response->data = client->response->left;
-    FD_SET(client->sock, &write_fds);
+    uint32_t size;
+
+    size = client->response->left;
+    *(uint32_t *)(void *)client->response->data = size;
+
+    /*
+     * Large responses go through the shared-memory area, if the client
+     * mapped one, and only a notice of their size through the socket.
+     */
+    if (client->shm && size>=OVSQLITE_SHM_THRESHOLD
+            && size<=OVSQLITE_SHM_SIZE) {
+        memcpy(client->shm, client->response->data, size);
+        start_response(client, response_shm);
+        pack_now(client->response, &size, sizeof size);
+        *(uint32_t *)(void *)client->response->data = client->response->left;
+    }
+    if (!(client->flags & client_flag_reader))
+        FD_SET(client->sock, &write_fds);
 }
 
 static void simple_response(
@@ -734,18 +1309,156 @@ static void simple_response(
     finish_response(client);
     if (code>=response_fatal) {
         client->flags |= client_flag_term;
-        FD_CLR(client->sock, &read_fds);
+        if (!(client->flags & client_flag_reader))
+            FD_CLR(client->sock, &read_fds);
     }
 }
 
-static void begin_transaction(void)
+#ifdef HAVE_PTHREAD
+
+/*
+ * Checkpoint thread.
+ *
+ * With asynccommit in WAL mode, a commit only appends the transaction to
+ * the write-ahead log without syncing it, and the main thread goes back to
+ * receiving requests at once.  Syncing the log and copying it back into
+ * the database is left to this thread, with a connection of its own, which
+ * runs a passive checkpoint after each commit.  Checkpoints requested while
+ * one is running are folded into the next one.
+ */
+
+static struct {
+    pthread_t thread;
+    sqlite3 *connection;
+    bool running;
+    bool pending;
+    bool shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+} checkpointer;
+
+static void *checkpointer_main(
+    void *arg UNUSED)
 {
-    struct timeval now;
+    sigset_t set;
+    int status;
+
+    /* Signals are for the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&checkpointer.lock);
+    for (;;) {
+        while (!checkpointer.pending && !checkpointer.shutdown)
+            pthread_cond_wait(&checkpointer.work, &checkpointer.lock);
+        if (!checkpointer.pending)
+            break;
+        checkpointer.pending = false;
+        pthread_mutex_unlock(&checkpointer.lock);
+
+        status = sqlite3_wal_checkpoint_v2(
+            checkpointer.connection, NULL, SQLITE_CHECKPOINT_PASSIVE,
+            NULL, NULL);
+        if (status!=SQLITE_OK && status!=SQLITE_BUSY)
+            warn("cannot checkpoint database: %s",
+                 sqlite3_errmsg(checkpointer.connection));
+
+        pthread_mutex_lock(&checkpointer.lock);
+    }
+    pthread_mutex_unlock(&checkpointer.lock);
+    return NULL;
+}
 
+static void wake_checkpointer(void)
+{
+    if (!checkpointer.running)
+        return;
+    pthread_mutex_lock(&checkpointer.lock);
+    checkpointer.pending = true;
+    pthread_cond_signal(&checkpointer.work);
+    pthread_mutex_unlock(&checkpointer.lock);
+}
+
+static void start_checkpointer(void)
+{
+    char *path;
+    char *errmsg;
+    int status;
+
+    if (!async_commit)
+        return;
+    if (!use_wal) {
+        warn("asynccommit requires walmode, committing synchronously");
+        return;
+    }
+    if (!sqlite3_threadsafe()) {
+        warn("SQLite library is not thread-safe, checkpointing inline");
+        return;
+    }
+    path = partition_path(innconf->pathoverview, OVSQLITE_DB_FILE, partition);
+    status = sqlite3_open_v2(
+        path, &checkpointer.connection, SQLITE_OPEN_READWRITE, NULL);
+    free(path);
+    /* The connection only knows about the log once it has read it. */
+    if (status==SQLITE_OK)
+        status = sqlite3_exec(
+            checkpointer.connection, "pragma journal_mode = WAL;", 0, NULL,
+            NULL);
+    if (status!=SQLITE_OK) {
+        warn("cannot open database for checkpoints: %s",
+             sqlite3_errstr(status));
+        sqlite3_close_v2(checkpointer.connection);
+        checkpointer.connection = NULL;
+        return;
+    }
+    checkpointer.pending = false;
+    checkpointer.shutdown = false;
+    pthread_mutex_init(&checkpointer.lock, NULL);
+    pthread_cond_init(&checkpointer.work, NULL);
+    status = pthread_create(
+        &checkpointer.thread, NULL, checkpointer_main, NULL);
+    if (status!=0) {
+        errno = status;
+        syswarn("cannot start checkpoint thread");
+        pthread_cond_destroy(&checkpointer.work);
+        pthread_mutex_destroy(&checkpointer.lock);
+        sqlite3_close_v2(checkpointer.connection);
+        checkpointer.connection = NULL;
+        return;
+    }
+    checkpointer.running = true;
+    status = sqlite3_exec(
+        connection, "pragma wal_autocheckpoint = 0;", 0, NULL, &errmsg);
+    if (status!=SQLITE_OK) {
+        warn("cannot turn off automatic checkpoints: %s", errmsg);
+        sqlite3_free(errmsg);
+    }
+}
+
+static void stop_checkpointer(void)
+{
+    if (!checkpointer.running)
+        return;
+    pthread_mutex_lock(&checkpointer.lock);
+    checkpointer.shutdown = true;
+    pthread_cond_signal(&checkpointer.work);
+    pthread_mutex_unlock(&checkpointer.lock);
+    pthread_join(checkpointer.thread, NULL);
+    pthread_cond_destroy(&checkpointer.work);
+    pthread_mutex_destroy(&checkpointer.lock);
+    sqlite3_close_v2(checkpointer.connection);
+    checkpointer.connection = NULL;
+    checkpointer.running = false;
+}
+
+#endif /* HAVE_PTHREAD */
+
+static void begin_transaction(void)
+{
+    gettimeofday(&last_write, NULL);
     if (in_transaction)
         return;
-    gettimeofday(&now, NULL);
-    next_commit = timeval_sum(now, transaction_time_limit);
+    next_commit = timeval_sum(last_write, transaction_time_limit);
     sqlite3_step(sql_main.begin);
     sqlite3_reset(sql_main.begin);
     in_transaction = true;
@@ -758,7 +1471,38 @@ static void commit_transaction(void)
     sqlite3_step(sql_main.commit);
     sqlite3_reset(sql_main.commit);
     transaction_rowcount = 0;
+    transaction_bytes = 0;
     in_transaction = false;
+#ifdef HAVE_PTHREAD
+    wake_checkpointer();
+#endif
+}
+
+/*
+ * Whether the open transaction should be committed now.  If not, delta
+ * is set to how long it may stay open while no request comes in:  until
+ * its time limit, or until transidletime has passed without any write.
+ */
+
+static bool commit_due(
+    struct timeval now,
+    struct timeval *delta)
+{
+    struct timeval idle;
+
+    if (transaction_rowcount>=transaction_row_limit)
+        return true;
+    if (transaction_size_limit>0
+            && transaction_bytes>=transaction_size_limit*1024)
+        return true;
+    *delta = timeval_difference(next_commit, now);
+    if (transaction_idle_time.tv_sec>0 || transaction_idle_time.tv_usec>0) {
+        idle = timeval_difference(
+            timeval_sum(last_write, transaction_idle_time), now);
+        if (timeval_before(idle, *delta))
+            *delta = idle;
+    }
+    return delta->tv_sec<0 || delta->tv_usec<0;
 }
 
 static void savepoint(void)
@@ -790,7 +1534,7 @@ static void sql_error_response(
 
     respbuf = client->response;
     status_r = status;
-    errmsg = sqlite3_errmsg(connection);
+    errmsg = sqlite3_errmsg(client->session->connection);
     if (errmsg) {
         errmsg_len = strlen(errmsg);
     } else {
@@ -885,7 +1629,7 @@ static void do_hello(
     if (!finish_request(client))
         fail(response_bad_request);
 
-    if (version!=OVSQLITE_PROTOCOL_VERSION)
+    if (version<1 || version>OVSQLITE_PROTOCOL_VERSION)
         fail(response_wrong_version);
 #ifndef HAVE_UNIX_DOMAIN_SOCKETS
     if (memcmp(cookie, port.cookie, OVSQLITE_COOKIE_LENGTH)!=0)
@@ -894,7 +1638,15 @@ static void do_hello(
 
     client->flags &= ~client_flag_init;
     client->mode = mode;
-    simple_response(client, response_ok);
+    start_response(client, response_ok);
+    if (version>=2) {
+        uint32_t r_partition = partition;
+        uint32_t r_partitions = partitions;
+
+        pack_now(client->response, &r_partition, sizeof r_partition);
+        pack_now(client->response, &r_partitions, sizeof r_partitions);
+    }
+    finish_response(client);
     return;
 
     failhandling;
@@ -1026,7 +1778,7 @@ static void do_get_groupinfo(
     if (!finish_request(client))
         fail(response_bad_request);
 
-    stmt = sql_main.get_groupinfo;
+    stmt = client->session->sql->get_groupinfo;
     sqlite3_bind_blob(stmt, 1, groupname, groupname_len, SQLITE_STATIC);
     status = sqlite3_step(stmt);
     switch (status) {
@@ -1281,10 +2033,14 @@ static void do_add_article(
         deflation.next_in = overview;
         deflation.avail_in = overview_len;
 #ifdef USE_DICTIONARY
+        if (dict_levels>0)
+            hierdict_sample(groupname, groupname_len,
+                            (char *)overview, overview_len);
         status = deflateSetDictionary(
             &deflation,
             (uint8_t *)dictionary,
-            make_dict(groupname, groupname_len, artnum));
+            make_dict(dictionary, deflate_dict(groupname, groupname_len),
+                      groupname, groupname_len, artnum));
         if (status==Z_OK)
 #endif
             status = deflate(&deflation, Z_FINISH);
@@ -1338,6 +2094,7 @@ static void do_add_article(
     release_savepoint();
     have_savepoint = false;
     transaction_rowcount++;
+    transaction_bytes += overview_len;
     simple_response(client, response_ok);
     return;
 
@@ -1365,7 +2122,7 @@ static void do_get_artinfo(
     if (!finish_request(client))
         fail(response_bad_request);
 
-    stmt = sql_main.get_artinfo;
+    stmt = client->session->sql->get_artinfo;
     sqlite3_bind_blob(stmt, 1, groupname, groupname_len, SQLITE_STATIC);
     sqlite3_bind_int64(stmt, 2, artnum);
     status = sqlite3_step(stmt);
@@ -1481,6 +2238,7 @@ static void do_search_group(
     uint64_t high;
     size_t off_count, off_code;
     uint32_t count;
+    sql_main_t *sql;
     failvar_stmt;
 
     reqbuf = client->request;
@@ -1515,17 +2273,18 @@ static void do_search_group(
     off_count = pack_later(respbuf, sizeof count);
     count = 0;
 
+    sql = client->session->sql;
     if (flags & search_flag_high) {
         if (cols & search_col_overview) {
-            stmt = sql_main.list_articles_high_overview;
+            stmt = sql->list_articles_high_overview;
         } else {
-            stmt = sql_main.list_articles_high;
+            stmt = sql->list_articles_high;
         }
     } else {
         if (cols & search_col_overview) {
-            stmt = sql_main.list_articles_overview;
+            stmt = sql->list_articles_overview;
         } else {
-            stmt = sql_main.list_articles;
+            stmt = sql->list_articles;
         }
     }
     sqlite3_bind_blob(stmt, 1, groupname, groupname_len, SQLITE_STATIC);
@@ -1604,37 +2363,38 @@ static void do_search_group(
              *    smaller than expected.
              */
             if (use_compression) {
+                session_t *session = client->session;
+                z_stream *zs = session->inflation;
+                buffer_t *out = session->flate;
                 uint32_t raw_len;
 
-                inflation.next_in = (uint8_t *)overview;
-                inflation.avail_in = overview_len;
+                zs->next_in = (uint8_t *)overview;
+                zs->avail_in = overview_len;
 
-                raw_len = unpack_length(&inflation);
+                raw_len = unpack_length(zs);
                 if (raw_len>100000)
                     goto corrupted;
                 if (raw_len>0) {
-                    buffer_resize(flate, raw_len);
-                    inflation.next_out = (uint8_t *)flate->data;
-                    inflation.avail_out = raw_len;
-                    status = inflate(&inflation, Z_FINISH);
+                    buffer_resize(out, raw_len);
+                    zs->next_out = (uint8_t *)out->data;
+                    zs->avail_out = raw_len;
+                    status = inflate(zs, Z_FINISH);
 #ifdef USE_DICTIONARY
                     if (status==Z_NEED_DICT) {
-                        status = inflateSetDictionary(
-                            &inflation,
-                            (uint8_t *)dictionary,
-                            make_dict(groupname, groupname_len, artnum));
+                        status = inflate_dict(
+                            session, zs, groupname, groupname_len, artnum);
                         if (status==Z_OK)
-                            status = inflate(&inflation, Z_FINISH);
+                            status = inflate(zs, Z_FINISH);
                     }
 #endif
-                    flate->left = (char *)inflation.next_out-flate->data;
-                    inflation.next_in = NULL;
-                    inflation.avail_in = 0;
-                    inflateReset(&inflation);
-                    if (status!=Z_STREAM_END || inflation.avail_out>0)
+                    out->left = (char *)zs->next_out-out->data;
+                    zs->next_in = NULL;
+                    zs->avail_in = 0;
+                    inflateReset(zs);
+                    if (status!=Z_STREAM_END || zs->avail_out>0)
                         goto corrupted;
-                    overview = (uint8_t *)flate->data;
-                    overview_len = flate->left;
+                    overview = (uint8_t *)out->data;
+                    overview_len = out->left;
                 } else {
                     overview++;
                     overview_len--;
@@ -1902,6 +2662,55 @@ static void do_finish_expire(
     failhandling_stmt_savepoint;
 }
 
+static void do_map_shm(
+    client_t *client)
+{
+    buffer_t *reqbuf;
+    uint16_t path_len;
+    char *path;
+    int fd;
+    struct stat st;
+    void *shm;
+    failvar;
+
+    reqbuf = client->request;
+    if (!unpack_now(reqbuf, &path_len, sizeof path_len))
+        fail(response_bad_request);
+    path = unpack_later(reqbuf, path_len);
+    if (!path)
+        fail(response_bad_request);
+    if (!finish_request(client))
+        fail(response_bad_request);
+
+    if (!use_shm || client->shm)
+        fail(response_error);
+    path = xstrndup(path, path_len);
+    fd = open(path, O_RDWR);
+    if (fd==-1) {
+        syswarn("cannot open response area %s", path);
+        free(path);
+        fail(response_error);
+    }
+    free(path);
+    if (fstat(fd, &st)==-1 || st.st_size!=OVSQLITE_SHM_SIZE) {
+        close(fd);
+        fail(response_error);
+    }
+    shm = mmap(NULL, OVSQLITE_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    close(fd);
+    if (shm==MAP_FAILED) {
+        syswarn("cannot map response area");
+        fail(response_error);
+    }
+    /* This response still goes through the socket, being that small. */
+    client->shm = shm;
+    simple_response(client, response_ok);
+    return;
+
+    failhandling;
+}
+
 /*
  * This needs to stay in sync with the request code enum
  * in ovsqlite-private.h or things will explode.
@@ -1922,9 +2731,322 @@ static void (*dispatch[count_request_codes])(
     do_search_group,
     do_start_expire_group,
     do_expire_group,
-    do_finish_expire
+    do_finish_expire,
+    do_map_shm
 };
 
+#ifdef HAVE_PTHREAD
+
+/*
+ * Reader threads.
+ *
+ * In WAL mode, reading the database doesn't block writing it and vice
+ * versa, so requests that only read can be served by a pool of threads,
+ * each with a connection of its own, while the main thread keeps doing
+ * all the writing and all the socket I/O.  Once a read request has been
+ * received, the main thread queues a copy of the client for the readers;
+ * the client is in neither fd set until its response comes back.
+ * A reader runs the handler on the copy, moves it to the done list and
+ * writes a byte to the wakeup pipe so that select returns.
+ *
+ * Clients that opened the overview for writing (innd, expireover, ...)
+ * are always served by the main thread:  they expect to see their own
+ * changes, which readers only see once the transaction is committed.
+ */
+
+typedef struct reader_job_t {
+    struct reader_job_t *next;
+    unsigned int code;
+    client_t client;
+} reader_job_t;
+
+typedef struct reader_t {
+    pthread_t thread;
+    sql_main_t sql;
+    session_t session;
+#ifdef HAVE_ZLIB
+    z_stream inflation;
+#ifdef USE_DICTIONARY
+    char dictionary[DICTIONARY_SIZE];
+#endif
+#endif
+} reader_t;
+
+static struct {
+    reader_t *readers;
+    size_t count;
+    reader_job_t *pending;
+    reader_job_t **pending_tail;
+    reader_job_t *done;
+    bool shutdown;
+    int wakeup[2];
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+} pool;
+
+static void *reader_main(
+    void *arg)
+{
+    reader_t *reader = arg;
+    reader_job_t *job;
+    sigset_t set;
+
+    /* Signals are for the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (!pool.pending && !pool.shutdown)
+            pthread_cond_wait(&pool.work, &pool.lock);
+        job = pool.pending;
+        if (!job)
+            break;
+        pool.pending = job->next;
+        if (!pool.pending)
+            pool.pending_tail = &pool.pending;
+        pthread_mutex_unlock(&pool.lock);
+
+        job->client.session = &reader->session;
+        (*dispatch[job->code])(&job->client);
+
+        pthread_mutex_lock(&pool.lock);
+        job->next = pool.done;
+        pool.done = job;
+        /* A full pipe is fine, select will fire anyway. */
+        if (write(pool.wakeup[1], "", 1)==-1 && errno!=EAGAIN)
+            syswarn("cannot wake up main thread");
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+static bool open_reader(
+    reader_t *reader,
+    char const *path)
+{
+    session_t *session;
+    sqlite3 *db;
+    int status;
+    char *errmsg;
+
+    session = &reader->session;
+    status = sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (status!=SQLITE_OK) {
+        warn("cannot open database for reader: %s", sqlite3_errstr(status));
+        sqlite3_close_v2(db);
+        return false;
+    }
+    sqlite3_extended_result_codes(db, 1);
+    status = sqlite_helper_init(
+        &sql_main_helper,
+        (sqlite3_stmt **)&reader->sql,
+        db,
+        SQLITE_PREPARE_PERSISTENT,
+        &errmsg);
+    if (status==SQLITE_OK)
+        status = sqlite3_exec(db, "pragma query_only = 1;", 0, NULL, &errmsg);
+    if (status!=SQLITE_OK) {
+        warn("cannot set up reader session: %s", errmsg);
+        sqlite3_free(errmsg);
+        sqlite_helper_term(&sql_main_helper, (sqlite3_stmt **)&reader->sql);
+        sqlite3_close_v2(db);
+        return false;
+    }
+    set_cachesize(db);
+    session->connection = db;
+    session->sql = &reader->sql;
+#ifdef HAVE_ZLIB
+    if (use_compression) {
+        memset(&reader->inflation, 0, sizeof reader->inflation);
+        if (inflateInit(&reader->inflation)!=Z_OK)
+            die("cannot set up decompression for reader");
+        session->inflation = &reader->inflation;
+        session->flate = buffer_new();
+#ifdef USE_DICTIONARY
+        session->dictionary = reader->dictionary;
+        session->hierdicts = hierdict_table();
+#endif
+    }
+#endif
+    return true;
+}
+
+static void close_reader(
+    reader_t *reader)
+{
+    session_t *session;
+
+    session = &reader->session;
+    sqlite_helper_term(&sql_main_helper, (sqlite3_stmt **)&reader->sql);
+    sqlite3_close_v2(session->connection);
+    session->connection = NULL;
+#ifdef HAVE_ZLIB
+    if (use_compression) {
+        inflateEnd(&reader->inflation);
+        buffer_free(session->flate);
+        session->flate = NULL;
+#ifdef USE_DICTIONARY
+        hash_free(session->hierdicts);
+        session->hierdicts = NULL;
+#endif
+    }
+#endif
+}
+
+/*
+ * Must be called after open_db and before make_listener,
+ * so that the wakeup pipe doesn't need to be accounted for in maxsock.
+ */
+
+static void start_readers(void)
+{
+    char *path;
+    size_t ix;
+    int status;
+
+    if (reader_threads==0)
+        return;
+    if (!use_wal) {
+        warn("readerthreads requires walmode, not starting readers");
+        return;
+    }
+    if (!sqlite3_threadsafe()) {
+        warn("SQLite library is not thread-safe, not starting readers");
+        return;
+    }
+    if (pipe(pool.wakeup)==-1)
+        sysdie("cannot create reader wakeup pipe");
+    fdflag_nonblocking(pool.wakeup[0], 1);
+    fdflag_nonblocking(pool.wakeup[1], 1);
+    pool.readers = xcalloc(reader_threads, sizeof (reader_t));
+    pool.pending = NULL;
+    pool.pending_tail = &pool.pending;
+    pool.done = NULL;
+    pool.shutdown = false;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    path = partition_path(innconf->pathoverview, OVSQLITE_DB_FILE, partition);
+    for (ix = 0; ix<reader_threads; ix++) {
+        reader_t *reader = pool.readers+ix;
+
+        if (!open_reader(reader, path))
+            break;
+        status = pthread_create(&reader->thread, NULL, reader_main, reader);
+        if (status!=0) {
+            errno = status;
+            syswarn("cannot start reader thread");
+            close_reader(reader);
+            break;
+        }
+    }
+    free(path);
+    pool.count = ix;
+    if (pool.count==0) {
+        pthread_cond_destroy(&pool.work);
+        pthread_mutex_destroy(&pool.lock);
+        free(pool.readers);
+        pool.readers = NULL;
+        close(pool.wakeup[0]);
+        close(pool.wakeup[1]);
+        return;
+    }
+    FD_SET(pool.wakeup[0], &read_fds);
+}
+
+static void stop_readers(void)
+{
+    reader_job_t *job;
+    size_t ix;
+
+    if (pool.count==0)
+        return;
+    pthread_mutex_lock(&pool.lock);
+    pool.shutdown = true;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for (ix = 0; ix<pool.count; ix++) {
+        pthread_join(pool.readers[ix].thread, NULL);
+        close_reader(pool.readers+ix);
+    }
+    while ((job = pool.done)) {
+        pool.done = job->next;
+        free(job);
+    }
+    pthread_cond_destroy(&pool.work);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.readers);
+    pool.readers = NULL;
+    pool.count = 0;
+    FD_CLR(pool.wakeup[0], &read_fds);
+    close(pool.wakeup[0]);
+    close(pool.wakeup[1]);
+}
+
+static bool reader_request(
+    client_t *client,
+    unsigned int code)
+{
+    if (pool.count==0 || client->mode & OV_WRITE)
+        return false;
+    switch (code) {
+    case request_get_groupinfo:
+    case request_get_artinfo:
+    case request_search_group:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void queue_reader_request(
+    client_t *client,
+    unsigned int code)
+{
+    reader_job_t *job;
+
+    job = xmalloc(sizeof (reader_job_t));
+    job->next = NULL;
+    job->code = code;
+    job->client = *client;
+    job->client.flags |= client_flag_reader;
+    pthread_mutex_lock(&pool.lock);
+    *pool.pending_tail = job;
+    pool.pending_tail = &job->next;
+    pthread_cond_signal(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void handle_readers_done(void)
+{
+    reader_job_t *jobs, *job;
+    char drain[64];
+    size_t ix;
+
+    while (read(pool.wakeup[0], drain, sizeof drain)>0)
+        ;
+    pthread_mutex_lock(&pool.lock);
+    jobs = pool.done;
+    pool.done = NULL;
+    pthread_mutex_unlock(&pool.lock);
+    while ((job = jobs)) {
+        jobs = job->next;
+        /* Busy clients are never deleted, so it's still there. */
+        for (ix = 0; ix<client_count; ix++) {
+            client_t *client = clients+ix;
+
+            if (client->sock==job->client.sock) {
+                client->flags = job->client.flags & ~client_flag_reader;
+                FD_SET(client->sock, &write_fds);
+                break;
+            }
+        }
+        free(job);
+    }
+}
+
+#endif /* HAVE_PTHREAD */
+
 #if defined(EWOULDBLOCK)
   #if defined(EAGAIN) && EAGAIN!=EWOULDBLOCK
     #define case_NONBLOCK case EWOULDBLOCK: case EAGAIN:
@@ -2041,6 +3163,12 @@ static void handle_read(
         simple_response(client, response_wrong_state);
         return;
     }
+#ifdef HAVE_PTHREAD
+    if (reader_request(client, code)) {
+        queue_reader_request(client, code);
+        return;
+    }
+#endif
     (*dispatch[code])(client);
     return;
 }
@@ -2074,9 +3202,7 @@ static void mainloop(void)
             struct timeval now;
 
             gettimeofday(&now, NULL);
-            delta = timeval_difference(next_commit, now);
-            if (delta.tv_sec<0 || delta.tv_usec<0
-                    || transaction_rowcount>=transaction_row_limit) {
+            if (commit_due(now, &delta)) {
                 commit_transaction();
                 continue;
             }
@@ -2093,6 +3219,12 @@ static void mainloop(void)
             n--;
             handle_accept();
         }
+#ifdef HAVE_PTHREAD
+        if (pool.count>0 && FD_ISSET(pool.wakeup[0], &read_fds_out)) {
+            n--;
+            handle_readers_done();
+        }
+#endif
         for (client = clients+client_count; n>0 && client>clients; ) {
             client--;
             if (FD_ISSET(client->sock, &read_fds_out)) {
@@ -2107,6 +3239,61 @@ static void mainloop(void)
     commit_transaction();
 }
 
+/*
+ * With several partitions, the server started by rc.news serves partition
+ * 0 and forks one child per other partition, each with its own database,
+ * socket, transactions and threads.  The parent stops the children when
+ * it terminates, and terminates when one of them does.
+ */
+
+static void stop_partitions(void)
+{
+    unsigned long ix;
+
+    if (!children)
+        return;
+    for (ix = 1; ix<partitions; ix++)
+        if (children[ix]>0)
+            kill(children[ix], SIGTERM);
+    for (ix = 1; ix<partitions; ix++)
+        if (children[ix]>0)
+            while (waitpid(children[ix], NULL, 0)==-1 && errno==EINTR)
+                ;
+    free(children);
+    children = NULL;
+}
+
+static void start_partitions(void)
+{
+    unsigned long ix;
+    pid_t pid;
+
+    if (partitions<=1)
+        return;
+    children = xcalloc(partitions, sizeof (pid_t));
+    for (ix = 1; ix<partitions; ix++) {
+        pid = fork();
+        if (pid==-1) {
+            syswarn("cannot fork server for partition %lu", ix);
+            stop_partitions();
+            if (pidfile)
+                unlink(pidfile);
+            exit(1);
+        }
+        if (pid==0) {
+            partition = ix;
+            free(children);
+            children = NULL;
+            free(pidfile);
+            pidfile = NULL;
+            setproctitle("partition %lu", ix);
+            return;
+        }
+        children[ix] = pid;
+    }
+    xsignal_norestart(SIGCHLD, catcher);
+}
+
 static void usage(void)
 {
     fputs("Usage: ovsqlite-server [ -d ]\n", stderr);
@@ -2118,6 +3305,7 @@ int main(
     char **argv)
 {
     bool debug = false;
+    char *cpus;
 
     setproctitle_init(argc, argv);
     message_program_name = "ovsqlite-server";
@@ -2146,19 +3334,37 @@ int main(
     if (!innconf_read(NULL))
         exit(1);
     load_config();
+    if (innconf->ovsqlitecpus != NULL) {
+        if (!inn_setaffinity(innconf->ovsqlitecpus))
+            syswarn("cannot run on processors %s", innconf->ovsqlitecpus);
+        else if ((cpus = inn_getaffinity()) != NULL) {
+            notice("running on processors %s", cpus);
+            free(cpus);
+        }
+    }
     if (!debug)
         daemonize(innconf->pathtmp);
     catch_signals();
     make_pidfile();
+    start_partitions();
     open_db();
+#ifdef HAVE_PTHREAD
+    start_readers();
+    start_checkpointer();
+#endif
     make_listener();
     innconf_free(innconf);
     innconf = NULL;
     if (setfdlimit(FD_SETSIZE)==-1)
         syswarn("cannot set file descriptor limit");
     mainloop();
+#ifdef HAVE_PTHREAD
+    stop_checkpointer();
+    stop_readers();
+#endif
     close_sockets();
     close_db();
+    stop_partitions();
     if (pidfile)
         unlink(pidfile);
     return 0;
@@ -12,6 +12,7 @@
 #ifdef HAVE_SQLITE3
 
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include "portable/socket.h"
 #ifdef HAVE_UNIX_DOMAIN_SOCKETS
@@ -41,7 +42,9 @@ typedef struct handle_t {
     TOKEN *token;
     uint16_t groupname_len;
     uint8_t cols;
+    uint8_t prefetch_cols;
     bool done;
+    unsigned long partition;
     char groupname[1];
 } handle_t;
 
@@ -49,10 +52,91 @@ static int sock = -1;
 static buffer_t *request;
 static buffer_t *response;
 
+/*
+ * Large responses are written by the server into a shared-memory area
+ * mapped by both sides, and only their size is sent through the socket;
+ * response then points to shm_response, which covers the area, instead
+ * of socket_response, until the next response is read.
+ */
+static buffer_t *socket_response;
+static char *shm = NULL;
+static buffer_t shm_response;
+
+/*
+ * While nnrpd formats the articles of one batch of search results, the
+ * server is already looking up the next one:  as soon as a batch that
+ * doesn't finish the range has been unpacked, the request for the next
+ * batch is sent, and its response is only read when the handle needs it.
+ * At most one such request is in flight.  If anything else is sent to
+ * the server in the meantime, the response to it is read and thrown away
+ * first, so that the responses stay in step with the requests.
+ */
+static bool prefetch_pending = false;
+static handle_t *prefetch_handle = NULL;
+
 #ifndef HAVE_UNIX_DOMAIN_SOCKETS
 static ovsqlite_port port;
 #endif
 
+/*
+ * When the overview is split into partitions, there is one server, and
+ * thus one connection, per partition.  The variables above always describe
+ * the connection to the current partition; use_partition saves them and
+ * loads those of another one.
+ */
+typedef struct server_t {
+    int sock;
+    buffer_t *request;
+    buffer_t *socket_response;
+    char *shm;
+    bool prefetch_pending;
+    handle_t *prefetch_handle;
+#ifndef HAVE_UNIX_DOMAIN_SOCKETS
+    ovsqlite_port port;
+#endif
+} server_t;
+
+static server_t *servers = NULL;
+static unsigned long partitions = 1;
+static unsigned long current = 0;
+
+static void use_partition(
+    unsigned long ix)
+{
+    server_t *server;
+
+    if (ix==current)
+        return;
+    server = servers+current;
+    server->sock = sock;
+    server->request = request;
+    server->socket_response = socket_response;
+    server->shm = shm;
+    server->prefetch_pending = prefetch_pending;
+    server->prefetch_handle = prefetch_handle;
+#ifndef HAVE_UNIX_DOMAIN_SOCKETS
+    server->port = port;
+#endif
+    server = servers+ix;
+    sock = server->sock;
+    request = server->request;
+    socket_response = server->socket_response;
+    response = socket_response;
+    shm = server->shm;
+    prefetch_pending = server->prefetch_pending;
+    prefetch_handle = server->prefetch_handle;
+#ifndef HAVE_UNIX_DOMAIN_SOCKETS
+    port = server->port;
+#endif
+    current = ix;
+}
+
+static void use_group(
+    char const *group)
+{
+    use_partition(partition_of(group, strlen(group), partitions));
+}
+
 static bool server_connect(void)
 {
     char *path;
@@ -69,7 +153,7 @@ static bool server_connect(void)
     }
     memset(&sa, 0, sizeof sa);
     sa.sun_family = AF_UNIX;
-    path = concatpath(innconf->pathrun, OVSQLITE_SERVER_SOCKET);
+    path = partition_path(innconf->pathrun, OVSQLITE_SERVER_SOCKET, current);
     strlcpy(sa.sun_path, path, sizeof(sa.sun_path));
     free(path);
 
@@ -81,7 +165,7 @@ static bool server_connect(void)
     int fd;
     ssize_t got;
 
-    path = concatpath(innconf->pathrun, OVSQLITE_SERVER_PORT);
+    path = partition_path(innconf->pathrun, OVSQLITE_SERVER_PORT, current);
     fd = open(path, O_RDONLY);
     if (fd==-1) {
         syswarn("ovsqlite: cannot open port file %s", path);
@@ -120,8 +204,9 @@ static bool server_connect(void)
 
     request = buffer_new();
     buffer_resize(request, 0x400);
-    response = buffer_new();
-    buffer_resize(response, 0x400);
+    socket_response = buffer_new();
+    buffer_resize(socket_response, 0x400);
+    response = socket_response;
 
     return true;
 }
@@ -156,17 +241,30 @@ static bool finish_response(void)
     return response->left==0;
 }
 
+static bool read_response(void);
+
+static bool drop_prefetch(void)
+{
+    prefetch_handle = NULL;
+    if (!prefetch_pending)
+        return true;
+    prefetch_pending = false;
+    return read_response();
+}
+
 static bool write_request(void)
 {
     char *data;
     size_t left;
 
+    if (!drop_prefetch())
+        return false;
     data = request->data+request->used;
     left = request->left;
     while (left>0) {
         ssize_t got;
 
-        got = write(sock, request->data, request->left);
+        got = write(sock, data, left);
         if (got==-1) {
             if (errno==EINTR)
                 continue;
@@ -186,7 +284,9 @@ static bool read_response(void)
 {
     char *data;
     size_t size, response_size;
+    uint32_t shm_size;
 
+    response = socket_response;
     buffer_set(response, NULL, 0);
     data = response->data;
     size = 0;
@@ -235,16 +335,38 @@ static bool read_response(void)
             }
         }
     }
+    if (size==9 && (uint8_t)response->data[4]==response_shm) {
+        memcpy(&shm_size, response->data+5, sizeof shm_size);
+        if (!shm || shm_size<5 || shm_size>OVSQLITE_SHM_SIZE
+                || *(uint32_t *)(void *)shm!=shm_size) {
+            warn("ovsqlite: invalid shared-memory response");
+            close(sock);
+            sock = -1;
+            return false;
+        }
+        shm_response.size = OVSQLITE_SHM_SIZE;
+        shm_response.used = 0;
+        shm_response.left = shm_size;
+        shm_response.data = shm;
+        response = &shm_response;
+    }
     return true;
 }
 
-static bool server_handshake(
-    uint32_t mode)
+/*
+ * Returns response_ok on success, or the code of the failure, which is
+ * response_fatal if the server couldn't be talked to at all.  The number
+ * of partitions the server knows about is stored in count.
+ */
+static unsigned int server_handshake(
+    uint32_t version,
+    uint32_t mode,
+    unsigned long *count)
 {
-    uint32_t version;
     unsigned int code;
+    uint32_t r_partition = 0;
+    uint32_t r_partitions = 1;
 
-    version = OVSQLITE_PROTOCOL_VERSION;
     start_request(request_hello);
     pack_now(request, &version, sizeof version);
     pack_now(request, &mode, sizeof mode);
@@ -253,37 +375,178 @@ static bool server_handshake(
 #endif /* ! HAVE_UNIX_DOMAIN_SOCKETS */
     finish_request();
     if (!write_request())
-        return false;
+        return response_fatal;
 
     if (!read_response())
-        return false;
+        return response_fatal;
     code = start_response();
     if (code!=response_ok) {
         close(sock);
         sock = -1;
-        warn("ovsqlite: server handshake failed (%u)", code);
-        return false;
+        /* The caller retries with version 1 for an older server. */
+        if (code!=response_wrong_version || version==1)
+            warn("ovsqlite: server handshake failed (%u)", code);
+        return code;
+    }
+    if (version>=2) {
+        if (!unpack_now(response, &r_partition, sizeof r_partition)
+                || !unpack_now(response, &r_partitions, sizeof r_partitions))
+            r_partitions = 0;
     }
-    if (!finish_response()) {
+    if (r_partitions==0 || r_partition!=current || !finish_response()) {
         close(sock);
         sock = -1;
         warn("ovsqlite: protocol failure");
+        return response_fatal;
+    }
+    *count = r_partitions;
+    return response_ok;
+}
+
+/*
+ * Map a shared-memory response area and ask the server to use it.  The
+ * file is created in pathrun, next to the socket, and removed as soon as
+ * the server has mapped it.  Any failure just leaves the responses going
+ * through the socket.
+ */
+static void server_map_shm(void)
+{
+    char *path;
+    int fd;
+    uint16_t path_len;
+    void *area;
+    unsigned int code;
+
+    path = concatpath(innconf->pathrun, OVSQLITE_SHM_FILE);
+    fd = mkstemp(path);
+    if (fd==-1) {
+        syswarn("ovsqlite: cannot create %s", path);
+        free(path);
+        return;
+    }
+    area = MAP_FAILED;
+    if (ftruncate(fd, OVSQLITE_SHM_SIZE)==-1)
+        syswarn("ovsqlite: cannot extend %s", path);
+    else
+        area = mmap(NULL, OVSQLITE_SHM_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    close(fd);
+    if (area==MAP_FAILED) {
+        unlink(path);
+        free(path);
+        return;
+    }
+
+    path_len = strlen(path);
+    start_request(request_map_shm);
+    pack_now(request, &path_len, sizeof path_len);
+    pack_now(request, path, path_len);
+    finish_request();
+    code = response_error;
+    if (write_request() && read_response()) {
+        code = start_response();
+        if (!finish_response())
+            code = response_error;
+    }
+    unlink(path);
+    free(path);
+    if (code==response_ok)
+        shm = area;
+    else
+        munmap(area, OVSQLITE_SHM_SIZE);
+}
+
+static void server_close(void)
+{
+    if (sock!=-1) {
+        close(sock);
+        sock = -1;
+    }
+    prefetch_pending = false;
+    prefetch_handle = NULL;
+    if (shm) {
+        munmap(shm, OVSQLITE_SHM_SIZE);
+        shm = NULL;
+    }
+    buffer_free(request);
+    request = NULL;
+    buffer_free(socket_response);
+    socket_response = NULL;
+    response = NULL;
+}
+
+static void close_partitions(void)
+{
+    unsigned long ix;
+
+    for (ix = partitions; ix-->0; ) {
+        use_partition(ix);
+        server_close();
+    }
+    free(servers);
+    servers = NULL;
+    partitions = 1;
+}
+
+/*
+ * Connect to the server of the current partition.  The server of partition
+ * 0 tells how many partitions there are; the others have to agree.
+ */
+static bool open_partition(
+    uint32_t mode,
+    unsigned long *count)
+{
+    unsigned int code;
+
+    prefetch_pending = false;
+    prefetch_handle = NULL;
+    shm = NULL;
+    if (!server_connect())
         return false;
+    code = server_handshake(OVSQLITE_PROTOCOL_VERSION, mode, count);
+    if (code==response_wrong_version && current==0) {
+        /* Still talk to a server which hasn't been restarted since. */
+        buffer_free(request);
+        buffer_free(socket_response);
+        if (!server_connect())
+            return false;
+        return server_handshake(1, mode, count)==response_ok;
     }
+    if (code!=response_ok)
+        return false;
+    server_map_shm();
     return true;
 }
 
 bool ovsqlite_open(
     int mode)
 {
+    unsigned long count, other;
+    unsigned long ix;
+
     if (sock!=-1) {
         warn("ovsqlite_open called more than once");
         return false;
     }
-    if (!server_connect())
-        return false;
-    if (!server_handshake(mode))
-        return false;
+    current = 0;
+    if (!open_partition(mode, &count))
+        return false;
+    if (count>1) {
+        servers = xcalloc(count, sizeof (server_t));
+        for (ix = 1; ix<count; ix++)
+            servers[ix].sock = -1;
+        partitions = count;
+        for (ix = 1; ix<count; ix++) {
+            use_partition(ix);
+            if (!open_partition(mode, &other) || other!=count) {
+                if (sock!=-1)
+                    warn("ovsqlite: servers disagree on partition count");
+                close_partitions();
+                return false;
+            }
+        }
+        use_partition(0);
+    }
     return true;
 }
 
@@ -306,6 +569,7 @@ bool ovsqlite_groupstats(
         warn("ovsqlite: not connected to server");
         return false;
     }
+    use_group(group);
     groupname_len = strlen(group);
     start_request(request_get_groupinfo);
     pack_now(request, &groupname_len, sizeof groupname_len);
@@ -359,6 +623,7 @@ bool ovsqlite_groupadd(
         warn("ovsqlite: not connected to server");
         return false;
     }
+    use_group(group);
     groupname_len = strlen(group);
     r_low = low;
     r_high = high;
@@ -394,6 +659,7 @@ bool ovsqlite_groupdel(
         warn("ovsqlite: not connected to server");
         return false;
     }
+    use_group(group);
     groupname_len = strlen(group);
     start_request(request_delete_group);
     pack_now(request, &groupname_len, sizeof groupname_len);
@@ -412,59 +678,126 @@ bool ovsqlite_groupdel(
     return true;
 }
 
-bool ovsqlite_add(
-    const char *group,
-    ARTNUM artnum,
-    TOKEN token,
-    char *data,
-    int len,
-    time_t arrived,
-    time_t expires)
+/*
+ * The add_article requests for a batch are all written before any response
+ * is read, so storing a batch costs one round trip to the server instead of
+ * one per record.  The server handles the requests of a client one at a
+ * time and in order, so the responses come back in the same order.  The
+ * number of requests in flight is bounded so that their responses always fit
+ * in the socket buffer while the requests are still being written.
+ */
+#define ADDBATCH_MAX 256
+
+static void pack_add_article(
+    const struct ov_record *record)
 {
+    size_t start;
+    uint8_t code_r;
     uint16_t groupname_len;
     uint64_t r_artnum;
     uint32_t overview_len;
     uint64_t r_arrived;
     uint64_t r_expires;
-    unsigned int code;
 
-    if (sock==-1) {
-        warn("ovsqlite: not connected to server");
-        return false;
-    }
-    groupname_len = strlen(group);
-    r_artnum = artnum;
-    overview_len = len;
-    r_arrived = arrived;
-    r_expires = expires;
-    start_request(request_add_article);
+    groupname_len = strlen(record->group);
+    r_artnum = record->artnum;
+    overview_len = record->len;
+    r_arrived = record->arrived;
+    r_expires = record->expires;
+    start = pack_later(request, 4);
+    code_r = request_add_article;
+    pack_now(request, &code_r, sizeof code_r);
     pack_now(request, &groupname_len, sizeof groupname_len);
-    pack_now(request, group, groupname_len);
+    pack_now(request, record->group, groupname_len);
     pack_now(request, &r_artnum, sizeof r_artnum);
     pack_now(request, &r_arrived, sizeof r_arrived);
     pack_now(request, &r_expires, sizeof r_expires);
-    pack_now(request, &token, sizeof token);
+    pack_now(request, &record->token, sizeof record->token);
     pack_now(request, &overview_len, sizeof overview_len);
-    pack_now(request, data, overview_len);
-    finish_request();
-    if (!write_request())
-        return false;
+    pack_now(request, record->data, overview_len);
+    *(uint32_t *)(void *)(request->data+start) = request->left-start;
+}
 
-    if (!read_response())
-        return false;
-    code = start_response();
-    if (!finish_response())
-        return false;
-    switch (code) {
-    case response_ok:
-    case response_no_group:
-        /* Handle unknown newsgroups as a success.
-         * For instance for crossposts to newsgroups not present or no longer
-         * present in active. */
-        return true;
-    default:
+/*
+ * With several partitions, the records of a batch are sent to the server
+ * of each partition in turn, and in order within each partition.
+ */
+bool ovsqlite_addbatch(
+    struct ov_record *records,
+    size_t count)
+{
+    size_t start, n, i, j;
+    size_t batch[ADDBATCH_MAX];
+    unsigned long ix;
+    unsigned int code;
+    bool success;
+
+    if (sock==-1) {
+        warn("ovsqlite: not connected to server");
         return false;
     }
+    success = true;
+    for (ix = 0; ix<partitions; ix++) {
+        use_partition(ix);
+        for (start = 0; start<count; start = i) {
+            buffer_set(request, NULL, 0);
+            for (n = 0, i = start; i<count && n<ADDBATCH_MAX; i++) {
+                if (partitions>1
+                        && partition_of(records[i].group,
+                                        strlen(records[i].group),
+                                        partitions)!=ix)
+                    continue;
+                pack_add_article(&records[i]);
+                batch[n++] = i;
+            }
+            if (n==0)
+                break;
+            if (!write_request())
+                return false;
+
+            for (j = 0; j<n; j++) {
+                if (!read_response())
+                    return false;
+                code = start_response();
+                if (!finish_response())
+                    return false;
+                switch (code) {
+                case response_ok:
+                case response_no_group:
+                    /* Handle unknown newsgroups as a success.
+                     * For instance for crossposts to newsgroups not present
+                     * or no longer present in active. */
+                    records[batch[j]].stored = true;
+                    break;
+                default:
+                    records[batch[j]].stored = false;
+                    success = false;
+                }
+            }
+        }
+    }
+    return success;
+}
+
+bool ovsqlite_add(
+    const char *group,
+    ARTNUM artnum,
+    TOKEN token,
+    char *data,
+    int len,
+    time_t arrived,
+    time_t expires)
+{
+    struct ov_record record;
+
+    record.group = group;
+    record.artnum = artnum;
+    record.token = token;
+    record.data = data;
+    record.len = len;
+    record.arrived = arrived;
+    record.expires = expires;
+    return ovsqlite_addbatch(&record, 1);
 }
 
 bool ovsqlite_cancel(
@@ -479,6 +812,7 @@ bool ovsqlite_cancel(
         warn("ovsqlite: not connected to server");
         return false;
     }
+    use_group(group);
     groupname_len = strlen(group);
     r_artnum = artnum;
     start_request(request_delete_article);
@@ -520,24 +854,19 @@ void *ovsqlite_opensearch(
     rh->groupname_len = groupname_len;
     rh->cols = 0;
     rh->done = false;
+    rh->partition = partition_of(group, groupname_len, partitions);
     memcpy(rh->groupname, group, groupname_len);
     return rh;
 }
 
-static bool fill_search_buffer(
+static bool send_search_request(
     handle_t *rh)
 {
     unsigned int cols;
     uint32_t space;
     uint8_t flags;
-    unsigned int code;
-    uint32_t count, ix;
-    uint8_t *store;
     size_t wiresize, storesize, storespace;
-    uint8_t resp_cols;
 
-    rh->count = 0;
-    rh->index = 0;
     storespace = SEARCHSPACE;
     wiresize = 8;
     storesize = sizeof (ARTNUM);
@@ -567,8 +896,29 @@ static bool fill_search_buffer(
     pack_now(request, &rh->low, sizeof rh->low);
     pack_now(request, &rh->high, sizeof rh->high);
     finish_request();
-    if (!write_request())
-        return false;
+    return write_request();
+}
+
+static bool fill_search_buffer(
+    handle_t *rh)
+{
+    unsigned int cols;
+    unsigned int code;
+    uint32_t count, ix;
+    uint8_t *store;
+    uint8_t resp_cols;
+
+    use_partition(rh->partition);
+    rh->count = 0;
+    rh->index = 0;
+    cols = rh->cols;
+    if (prefetch_handle==rh && rh->prefetch_cols==cols) {
+        prefetch_handle = NULL;
+        prefetch_pending = false;
+    } else {
+        if (!send_search_request(rh))
+            return false;
+    }
 
     if (!read_response())
         return false;
@@ -639,6 +989,18 @@ static bool fill_search_buffer(
     if (cols & search_col_overview)
         rh->overview[count] = (char *)store;
     rh->count = count;
+
+    if (!rh->done && count>0) {
+        uint64_t low = rh->low;
+
+        rh->low = rh->artnum[count-1]+1;
+        if (send_search_request(rh)) {
+            prefetch_pending = true;
+            prefetch_handle = rh;
+            rh->prefetch_cols = cols;
+        }
+        rh->low = low;
+    }
     return true;
 }
 
@@ -701,6 +1063,10 @@ void ovsqlite_closesearch(
         warn("ovsqlite: not connected to server");
     if (!handle)
         return;
+    use_partition(((handle_t *)handle)->partition);
+    /* The response to a pending prefetch is dropped by the next request. */
+    if (prefetch_handle==handle)
+        prefetch_handle = NULL;
     free(handle);
 }
 
@@ -717,6 +1083,7 @@ bool ovsqlite_getartinfo(
         warn("ovsqlite: not connected to server");
         return false;
     }
+    use_group(group);
     groupname_len = strlen(group);
     r_artnum = artnum;
     start_request(request_get_artinfo);
@@ -932,9 +1299,17 @@ bool ovsqlite_expiregroup(
         return false;
     }
     if (group) {
+        use_group(group);
         return expire_one(group, low, h);
     } else {
-        return expire_finish();
+        unsigned long ix;
+
+        for (ix = 0; ix<partitions; ix++) {
+            use_partition(ix);
+            if (!expire_finish())
+                return false;
+        }
+        return true;
     }
 }
 
@@ -974,8 +1349,16 @@ bool ovsqlite_ctl(
     case OVSORT:
         *(OVSORTTYPE *)val = OVNEWSGROUP;
         return true;
-    case OVCUTOFFLOW:
-        return set_cutofflow(*(bool *)val);
+    case OVCUTOFFLOW: {
+        unsigned long ix;
+
+        for (ix = 0; ix<partitions; ix++) {
+            use_partition(ix);
+            if (!set_cutofflow(*(bool *)val))
+                return false;
+        }
+        return true;
+    }
     case OVSTATICSEARCH:
         *(int *)val = true;
         return true;
@@ -994,8 +1377,7 @@ void ovsqlite_close(void)
         warn("ovsqlite: not connected to server");
         return;
     }
-    close(sock);
-    sock = -1;
+    close_partitions();
 }
 
 #else /* ! HAVE_SQLITE3 */
@@ -1044,6 +1426,13 @@ bool ovsqlite_add(
     return false;
 }
 
+bool ovsqlite_addbatch(
+    struct ov_record *records UNUSED,
+    size_t count UNUSED)
+{
+    return false;
+}
+
 bool ovsqlite_cancel(
     const char *group UNUSED,
     ARTNUM artnum UNUSED)
@@ -8,6 +8,8 @@
 
 BEGIN_DECLS
 
+struct ov_record;
+
 bool ovsqlite_open(
     int mode);
 bool ovsqlite_groupstats(
@@ -31,6 +33,9 @@ bool ovsqlite_add(
     int len,
     time_t arrived,
     time_t expires);
+bool ovsqlite_addbatch(
+    struct ov_record *records,
+    size_t count);
 bool ovsqlite_cancel(
     const char *group,
     ARTNUM artnum);
@@ -1,7 +1,5 @@
 pragma foreign_keys = 1;
 
-pragma journal_mode = 'PERSIST';
-
 pragma busy_timeout = 999999999;
 
 -- .random
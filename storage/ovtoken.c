@@ -0,0 +1,300 @@
+/*
+**  The token index, finding the overview of an article from its token.
+**
+**  When ovtokenindexsize is set in inn.conf, every program storing overview
+**  data also records, for each article, one of the newsgroups and article
+**  numbers under which its overview was stored, in a file named ovtoken in
+**  pathoverview mapped in memory.  nnrpd then answers OVER and HDR by
+**  message-ID from overview, going from the message-ID to the token with
+**  the history and from the token to the overview with this index, instead
+**  of retrieving the article to find its Xref header field.
+**
+**  The file holds a header followed by buckets of OVTOKEN_WAYS entries, a
+**  token only going to the bucket given by its hash.  When a bucket is full,
+**  an entry chosen by the hash is replaced, so the index only keeps the
+**  articles that fit and is not exhaustive.  Neither writers nor readers
+**  take locks: what a reader finds is only a hint, which is checked against
+**  the overview method with getartinfo before being returned, so an entry
+**  being rewritten, or pointing to an article since cancelled or expired,
+**  just makes the lookup fail and the caller fall back on the article.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "ovinterface.h"
+
+#define OVTOKEN_NAME     "ovtoken"
+#define OVTOKEN_MAGIC    0x494e4f54U
+#define OVTOKEN_VERSION  1
+#define OVTOKEN_WAYS     4
+#define OVTOKEN_GROUPLEN 96
+
+struct ovtoken_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long buckets;
+};
+
+/* An entry is empty when its artnum is 0.  Groups whose name doesn't fit in
+   group with its nul are not recorded. */
+struct ovtoken_entry {
+    TOKEN token;
+    ARTNUM artnum;
+    char group[OVTOKEN_GROUPLEN];
+};
+
+struct ovtoken_bucket {
+    struct ovtoken_entry entries[OVTOKEN_WAYS];
+};
+
+static int token_fd = -1;
+static char *token_base = NULL;
+static size_t token_size;
+static unsigned long token_buckets;
+static bool token_writable;
+static bool token_failed;
+
+/* The group of the last successful lookup. */
+static char token_group[OVTOKEN_GROUPLEN];
+
+
+/*
+**  Open the index, creating it if needed with as many buckets as fit in
+**  ovtokenindexsize.  If the file already exists, the number of buckets it
+**  was created with is used.  Returns false if the index is disabled or
+**  can't be used.
+*/
+static bool
+token_open(void)
+{
+    struct ovtoken_header head;
+    struct stat st;
+    char *path;
+    unsigned long buckets;
+
+    if (token_base != NULL)
+        return true;
+    if (innconf->ovtokenindexsize == 0 || token_failed)
+        return false;
+    buckets = (innconf->ovtokenindexsize * 1024)
+              / sizeof(struct ovtoken_bucket);
+    if (buckets == 0)
+        buckets = 1;
+
+    path = concatpath(innconf->pathoverview, OVTOKEN_NAME);
+    token_writable = true;
+    token_fd = open(path, O_RDWR | O_CREAT, 0664);
+    if (token_fd < 0) {
+        token_writable = false;
+        token_fd = open(path, O_RDONLY);
+    }
+    if (token_fd < 0) {
+        syswarn("cannot open %s", path);
+        free(path);
+        token_failed = true;
+        return false;
+    }
+    fdflag_close_exec(token_fd, true);
+
+    /* Whoever gets the lock first initializes a new file. */
+    if (token_writable)
+        inn_lock_file(token_fd, INN_LOCK_WRITE, true);
+    if (fstat(token_fd, &st) < 0)
+        goto fail;
+    if (st.st_size >= (off_t) sizeof(head)
+        && pread(token_fd, &head, sizeof(head), 0) == sizeof(head)
+        && head.magic == OVTOKEN_MAGIC && head.version == OVTOKEN_VERSION
+        && head.buckets > 0
+        && (size_t) st.st_size == sizeof(head)
+                                  + head.buckets
+                                        * sizeof(struct ovtoken_bucket)) {
+        buckets = head.buckets;
+    } else if (token_writable) {
+        memset(&head, 0, sizeof(head));
+        head.magic = OVTOKEN_MAGIC;
+        head.version = OVTOKEN_VERSION;
+        head.buckets = buckets;
+        if (ftruncate(token_fd, 0) < 0
+            || ftruncate(token_fd,
+                         sizeof(head)
+                             + buckets * sizeof(struct ovtoken_bucket))
+                   < 0
+            || pwrite(token_fd, &head, sizeof(head), 0) != sizeof(head))
+            goto fail;
+    } else {
+        errno = EINVAL;
+        goto fail;
+    }
+    token_size = sizeof(head) + buckets * sizeof(struct ovtoken_bucket);
+    token_base = mmap(NULL, token_size,
+                      token_writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                      MAP_SHARED, token_fd, 0);
+    if (token_base == MAP_FAILED) {
+        token_base = NULL;
+        goto fail;
+    }
+    if (token_writable)
+        inn_lock_file(token_fd, INN_LOCK_UNLOCK, false);
+    token_buckets = buckets;
+    free(path);
+    return true;
+
+fail:
+    syswarn("cannot set up %s", path);
+    if (token_writable)
+        inn_lock_file(token_fd, INN_LOCK_UNLOCK, false);
+    close(token_fd);
+    token_fd = -1;
+    free(path);
+    token_failed = true;
+    return false;
+}
+
+
+/*
+**  Unmap the index.
+*/
+void
+OVtokenclose(void)
+{
+    if (token_base != NULL) {
+        munmap(token_base, token_size);
+        token_base = NULL;
+    }
+    if (token_fd >= 0) {
+        close(token_fd);
+        token_fd = -1;
+    }
+    token_failed = false;
+}
+
+
+/*
+**  Return the hash of a token, used to choose its bucket and the entry it
+**  replaces in it.
+*/
+static unsigned long
+token_hash(const TOKEN *token)
+{
+    const unsigned char *p;
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (p = (const unsigned char *) token, i = 0; i < sizeof(TOKEN); i++) {
+        hash ^= p[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static struct ovtoken_bucket *
+token_bucket(unsigned long hash)
+{
+    return (void *) (token_base + sizeof(struct ovtoken_header)
+                     + (hash % token_buckets)
+                           * sizeof(struct ovtoken_bucket));
+}
+
+
+/*
+**  Record where the overview of the given records was stored.  A record is
+**  skipped if it has the same token as the last one recorded, since all the
+**  records of a crossposted article come together and one of its groups is
+**  enough.
+*/
+void
+OVtokenadd(const struct ov_record *records, size_t count)
+{
+    const struct ov_record *record;
+    const TOKEN *last = NULL;
+    struct ovtoken_bucket *bucket;
+    struct ovtoken_entry *entry;
+    unsigned long hash;
+    size_t i, j, length;
+
+    if (!token_open() || !token_writable)
+        return;
+    for (i = 0; i < count; i++) {
+        record = &records[i];
+        if (!record->stored || record->artnum == 0)
+            continue;
+        if (last != NULL && memcmp(last, &record->token, sizeof(TOKEN)) == 0)
+            continue;
+        length = strlen(record->group);
+        if (length >= OVTOKEN_GROUPLEN)
+            continue;
+        hash = token_hash(&record->token);
+        bucket = token_bucket(hash);
+
+        /* Take the entry of the same token, or else an empty one, or else
+           the one chosen by the hash. */
+        entry = NULL;
+        for (j = 0; j < OVTOKEN_WAYS; j++)
+            if (memcmp(&bucket->entries[j].token, &record->token,
+                       sizeof(TOKEN))
+                == 0) {
+                entry = &bucket->entries[j];
+                break;
+            }
+        for (j = 0; entry == NULL && j < OVTOKEN_WAYS; j++)
+            if (bucket->entries[j].artnum == 0)
+                entry = &bucket->entries[j];
+        if (entry == NULL)
+            entry = &bucket->entries[(hash / token_buckets) % OVTOKEN_WAYS];
+        entry->artnum = 0;
+        memcpy(entry->group, record->group, length + 1);
+        entry->token = record->token;
+        entry->artnum = record->artnum;
+        last = &record->token;
+    }
+}
+
+
+/*
+**  Find a newsgroup and article number under which the overview of the
+**  article with the given token is stored, checking it with the getartinfo
+**  method.  The group is returned in internal storage, valid until the next
+**  call.  Returns false if the index doesn't know the article.
+*/
+bool
+OVtokenlookup(const OV_METHOD *method, OVTOKENINFO *info)
+{
+    const struct ovtoken_bucket *bucket;
+    const struct ovtoken_entry *entry;
+    TOKEN token;
+    ARTNUM artnum;
+    size_t i;
+
+    if (!token_open())
+        return false;
+    bucket = token_bucket(token_hash(&info->token));
+    for (i = 0; i < OVTOKEN_WAYS; i++) {
+        entry = &bucket->entries[i];
+        if (memcmp(&entry->token, &info->token, sizeof(TOKEN)) != 0)
+            continue;
+
+        /* The entry may be rewritten while it is copied; the check with
+           the overview method below catches that. */
+        artnum = entry->artnum;
+        memcpy(token_group, entry->group, sizeof(token_group));
+        token_group[sizeof(token_group) - 1] = '\0';
+        if (artnum == 0 || token_group[0] == '\0')
+            continue;
+        if (!(*method->getartinfo)(token_group, artnum, &token)
+            || memcmp(&token, &info->token, sizeof(TOKEN)) != 0)
+            continue;
+        info->group = token_group;
+        info->artnum = artnum;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,353 @@
+/*
+**  A cache of recently retrieved articles, shared by all the processes
+**  using the storage manager.
+**
+**  When articlecachesize is set, SMretrieve looks articles up in a file
+**  named smcache in pathrun, mapped in memory by every process, before
+**  asking the storage method for them, and stores there the articles it had
+**  to ask for.  A popular article is then read from disk once instead of
+**  once per reader.
+**
+**  The file holds a header followed by fixed size slots, each able to hold
+**  one article of up to SMCACHE_MAXART bytes, either whole or only its
+**  headers.  An article can only be in the slot chosen by a hash of its
+**  token, and replaces whatever was there.  Each slot is protected by a
+**  fcntl lock on its range of the file:  readers copy the article out of
+**  the slot under a shared lock, and writers give up instead of waiting if
+**  the slot is busy.  Cancelled articles are removed from the cache.
+**
+**  Articles of self-expiring methods can be overwritten without being
+**  cancelled, so they are never cached.
+**
+**  fcntl locks don't keep apart the threads of a process, so within a
+**  process the cache is used by one thread at a time.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "inn/fdflag.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/wire.h"
+#include "interface.h"
+
+#define SMCACHE_NAME    "smcache"
+#define SMCACHE_MAGIC   "SMCACHE1"
+#define SMCACHE_MAXART  (16 * 1024)
+
+typedef struct {
+    char                magic[8];
+    uint32_t            slots;
+    uint32_t            maxart;
+} SMCACHEHEADER;
+
+typedef struct {
+    TOKEN               token;
+    uint32_t            len;        /* Length of the data, 0 if empty */
+    uint32_t            headonly;   /* Whether only the headers are there */
+    time_t              arrived;
+} SMCACHESLOT;
+
+#define SLOT_SIZE       (sizeof(SMCACHESLOT) + SMCACHE_MAXART)
+#define SLOT_OFFSET(n)  (sizeof(SMCACHEHEADER) + (off_t) (n) * SLOT_SIZE)
+
+/* A retrieved article handed out from the cache, with its own copy of the
+   data. */
+struct cached {
+    ARTHANDLE           art;
+    TOKEN               token;
+    char                *data;
+    struct cached       *next;
+};
+
+static int cache_fd = -1;
+static char *cache_base = NULL;
+static size_t cache_size;
+static uint32_t cache_slots;
+static struct cached *cache_handles = NULL;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+# define CACHElock()    pthread_mutex_lock(&cache_lock)
+# define CACHEunlock()  pthread_mutex_unlock(&cache_lock)
+#else
+# define CACHElock()    /* empty */
+# define CACHEunlock()  /* empty */
+#endif
+
+
+/*
+**  Open the cache file, creating it if needed with as many slots as fit in
+**  articlecachesize.  If the file already exists, the number of slots it
+**  was created with is used.  Returns false if the cache is disabled or
+**  can't be used.
+*/
+bool
+SMcacheopen(void)
+{
+    SMCACHEHEADER head;
+    struct stat st;
+    char *path;
+    uint32_t slots;
+
+    if (cache_base != NULL)
+        return true;
+    if (innconf->articlecachesize == 0)
+        return false;
+    slots = (innconf->articlecachesize * 1024) / SLOT_SIZE;
+    if (slots == 0)
+        return false;
+
+    path = concatpath(innconf->pathrun, SMCACHE_NAME);
+    cache_fd = open(path, O_RDWR | O_CREAT, 0664);
+    if (cache_fd < 0) {
+        syswarn("SM: cannot open %s", path);
+        free(path);
+        return false;
+    }
+    fdflag_close_exec(cache_fd, true);
+
+    /* Whoever gets the lock first initializes a new file. */
+    inn_lock_file(cache_fd, INN_LOCK_WRITE, true);
+    if (fstat(cache_fd, &st) < 0)
+        goto fail;
+    if (st.st_size >= (off_t) sizeof(head)
+        && pread(cache_fd, &head, sizeof(head), 0) == sizeof(head)
+        && memcmp(head.magic, SMCACHE_MAGIC, sizeof(head.magic)) == 0
+        && head.maxart == SMCACHE_MAXART && head.slots > 0
+        && st.st_size >= SLOT_OFFSET(head.slots)) {
+        slots = head.slots;
+    } else {
+        memcpy(head.magic, SMCACHE_MAGIC, sizeof(head.magic));
+        head.slots = slots;
+        head.maxart = SMCACHE_MAXART;
+        if (ftruncate(cache_fd, 0) < 0
+            || ftruncate(cache_fd, SLOT_OFFSET(slots)) < 0
+            || pwrite(cache_fd, &head, sizeof(head), 0) != sizeof(head))
+            goto fail;
+    }
+    cache_size = SLOT_OFFSET(slots);
+    cache_base = mmap(NULL, cache_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      cache_fd, 0);
+    if (cache_base == MAP_FAILED) {
+        cache_base = NULL;
+        goto fail;
+    }
+    inn_lock_file(cache_fd, INN_LOCK_UNLOCK, false);
+    cache_slots = slots;
+    free(path);
+    return true;
+
+fail:
+    syswarn("SM: cannot set up %s", path);
+    inn_lock_file(cache_fd, INN_LOCK_UNLOCK, false);
+    close(cache_fd);
+    cache_fd = -1;
+    free(path);
+    return false;
+}
+
+
+/*
+**  Unmap the cache file.  Articles still handed out remain valid.
+*/
+void
+SMcacheclose(void)
+{
+    if (cache_base != NULL) {
+        munmap(cache_base, cache_size);
+        cache_base = NULL;
+    }
+    if (cache_fd >= 0) {
+        close(cache_fd);
+        cache_fd = -1;
+    }
+}
+
+
+/*
+**  Return the slot an article goes to.
+*/
+static uint32_t
+cache_slot(const TOKEN *token)
+{
+    const unsigned char *p = (const unsigned char *) token;
+    uint32_t hash = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < sizeof(TOKEN); i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+    return hash % cache_slots;
+}
+
+
+/*
+**  Look an article up in the cache.  RETR_ALL and RETR_BODY need the whole
+**  article to be cached, RETR_HEAD is also answered from cached headers.
+**  Returns NULL if the article isn't there.
+*/
+ARTHANDLE *
+SMcacheget(const TOKEN token, const RETRTYPE amount)
+{
+    SMCACHESLOT *slot;
+    struct cached *entry;
+    const char *body;
+    uint32_t n;
+    size_t len;
+    bool headonly;
+
+    if (cache_base == NULL || amount == RETR_STAT)
+        return NULL;
+    n = cache_slot(&token);
+    slot = (SMCACHESLOT *) (cache_base + SLOT_OFFSET(n));
+    CACHElock();
+    if (!inn_lock_range(cache_fd, INN_LOCK_READ, true, SLOT_OFFSET(n),
+                        SLOT_SIZE)) {
+        CACHEunlock();
+        return NULL;
+    }
+    if (slot->len == 0 || memcmp(&slot->token, &token, sizeof(token)) != 0
+        || (slot->headonly && amount != RETR_HEAD)) {
+        inn_lock_range(cache_fd, INN_LOCK_UNLOCK, false, SLOT_OFFSET(n),
+                       SLOT_SIZE);
+        CACHEunlock();
+        return NULL;
+    }
+    entry = xcalloc(1, sizeof(struct cached));
+    len = slot->len;
+    entry->data = xmalloc(len);
+    memcpy(entry->data, (char *) slot + sizeof(SMCACHESLOT), len);
+    entry->art.arrived = slot->arrived;
+    headonly = slot->headonly;
+    inn_lock_range(cache_fd, INN_LOCK_UNLOCK, false, SLOT_OFFSET(n),
+                   SLOT_SIZE);
+    CACHEunlock();
+
+    entry->token = token;
+    entry->art.type = token.type;
+    entry->art.token = &entry->token;
+    /* No private data, so that SMprobe(SMARTFILE) fails. */
+    entry->art.private = NULL;
+    entry->art.data = entry->data;
+    entry->art.len = len;
+    if (amount != RETR_ALL && !headonly) {
+        /* Cut the article the same way the storage methods do. */
+        body = wire_findbody(entry->data, len);
+        if (body == NULL) {
+            free(entry->data);
+            free(entry);
+            return NULL;
+        }
+        if (amount == RETR_HEAD)
+            entry->art.len = body - entry->data - 2;
+        else {
+            entry->art.data = body;
+            entry->art.len = len - (body - entry->data);
+        }
+    }
+    CACHElock();
+    entry->next = cache_handles;
+    cache_handles = entry;
+    CACHEunlock();
+    return &entry->art;
+}
+
+
+/*
+**  Store an article just retrieved with RETR_ALL or RETR_HEAD in the cache,
+**  unless it is too large or another process is using the slot.  Headers
+**  don't replace the whole article.
+*/
+void
+SMcacheput(const TOKEN token, const RETRTYPE amount, const ARTHANDLE *art)
+{
+    SMCACHESLOT *slot;
+    uint32_t n;
+
+    if (cache_base == NULL || (amount != RETR_ALL && amount != RETR_HEAD))
+        return;
+    if (art->len == 0 || art->len > SMCACHE_MAXART)
+        return;
+    n = cache_slot(&token);
+    slot = (SMCACHESLOT *) (cache_base + SLOT_OFFSET(n));
+    CACHElock();
+    if (!inn_lock_range(cache_fd, INN_LOCK_WRITE, false, SLOT_OFFSET(n),
+                        SLOT_SIZE)) {
+        CACHEunlock();
+        return;
+    }
+    if (amount == RETR_ALL || slot->len == 0 || slot->headonly
+        || memcmp(&slot->token, &token, sizeof(token)) != 0) {
+        slot->len = 0;
+        memcpy((char *) slot + sizeof(SMCACHESLOT), art->data, art->len);
+        slot->token = token;
+        slot->headonly = (amount == RETR_HEAD);
+        slot->arrived = art->arrived;
+        slot->len = art->len;
+    }
+    inn_lock_range(cache_fd, INN_LOCK_UNLOCK, false, SLOT_OFFSET(n),
+                   SLOT_SIZE);
+    CACHEunlock();
+}
+
+
+/*
+**  Remove a cancelled article from the cache.
+*/
+void
+SMcachedrop(const TOKEN token)
+{
+    SMCACHESLOT *slot;
+    uint32_t n;
+
+    if (cache_base == NULL)
+        return;
+    n = cache_slot(&token);
+    slot = (SMCACHESLOT *) (cache_base + SLOT_OFFSET(n));
+    CACHElock();
+    if (inn_lock_range(cache_fd, INN_LOCK_WRITE, true, SLOT_OFFSET(n),
+                       SLOT_SIZE)) {
+        if (memcmp(&slot->token, &token, sizeof(token)) == 0)
+            slot->len = 0;
+        inn_lock_range(cache_fd, INN_LOCK_UNLOCK, false, SLOT_OFFSET(n),
+                       SLOT_SIZE);
+    }
+    CACHEunlock();
+}
+
+
+/*
+**  Free an article if it was handed out by SMcacheget.  Returns false if it
+**  belongs to a storage method.
+*/
+bool
+SMcachefree(ARTHANDLE *art)
+{
+    struct cached *entry, **prev;
+
+    CACHElock();
+    for (prev = &cache_handles; *prev != NULL; prev = &(*prev)->next) {
+        entry = *prev;
+        if (&entry->art == art) {
+            *prev = entry->next;
+            CACHEunlock();
+            free(entry->data);
+            free(entry);
+            return true;
+        }
+    }
+    CACHEunlock();
+    return false;
+}
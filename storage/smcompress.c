@@ -0,0 +1,246 @@
+/*
+**  Compression of article bodies by the storage manager.
+**
+**  When the storage.conf entry an article matches has compress: set, SMstore
+**  compresses its body with zlib before handing it to the storage method,
+**  which stores it as it would any other article.  The headers are left as
+**  they are, so that retrieving them alone, as SMprobe and most of nnrpd
+**  do, costs no decompression.  A compressed body starts with SMZIP_MAGIC,
+**  followed by its original length in network byte order and the zlib
+**  stream.  Bodies are only stored compressed if that makes them smaller.
+**
+**  SMretrieve and SMnext recognize compressed bodies whatever storage.conf
+**  now says, and hand out a copy of the article with the body decompressed
+**  in a handle of their own, kept on a list as the article cache does.
+**  Such a handle has no private data, so the methods refuse SMARTFILE for
+**  it and the article is sent from memory.  If a body merely looks like a
+**  compressed one but does not decompress to its recorded length, it is
+**  handed out as it is.  The list is protected by a lock, since threads may
+**  retrieve and free articles at once.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/socket.h"
+#include <sys/uio.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "inn/messages.h"
+#include "inn/wire.h"
+#include "inn/xmalloc.h"
+#include "interface.h"
+
+#define SMZIP_MAGIC     "\0INNzip\1"
+#define SMZIP_MAGICLEN  8
+#define SMZIP_PREFIX    (SMZIP_MAGICLEN + 4)
+
+/* A retrieved article with its body decompressed, and the handle of the
+   storage method holding the compressed article. */
+struct zipped {
+    ARTHANDLE           art;
+    ARTHANDLE           *inner;
+    char                *data;
+    struct zipped       *next;
+};
+
+static struct zipped *zip_handles = NULL;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t zip_lock = PTHREAD_MUTEX_INITIALIZER;
+# define ZIPlock()      pthread_mutex_lock(&zip_lock)
+# define ZIPunlock()    pthread_mutex_unlock(&zip_lock)
+#else
+# define ZIPlock()      /* empty */
+# define ZIPunlock()    /* empty */
+#endif
+
+
+/*
+**  Compress the body of an article into a copy of its handle.  The copy has
+**  two iovecs, the headers of the original article and a newly allocated
+**  compressed body, to be freed with SMzipstorefree.  Returns false if the
+**  article has no body or compression does not make it smaller, in which
+**  case the original article should be stored.
+*/
+bool
+SMzipstore(const ARTHANDLE *article, ARTHANDLE *copy)
+{
+#ifdef HAVE_ZLIB
+    char *whole = NULL, *body, *zipped;
+    const char *start;
+    struct iovec *iov;
+    size_t headlen, bodylen, offset;
+    uLongf ziplen;
+    uint32_t length;
+    int i;
+
+    if (article->iov == NULL || article->iovcnt == 0)
+        return false;
+    if (article->iovcnt == 1)
+        start = article->iov[0].iov_base;
+    else {
+        whole = xmalloc(article->len);
+        for (offset = 0, i = 0; i < article->iovcnt; i++) {
+            memcpy(whole + offset, article->iov[i].iov_base,
+                   article->iov[i].iov_len);
+            offset += article->iov[i].iov_len;
+        }
+        start = whole;
+    }
+    body = wire_findbody(start, article->len);
+    if (body == NULL || body == start + article->len) {
+        free(whole);
+        return false;
+    }
+    headlen = body - start;
+    bodylen = article->len - headlen;
+    ziplen = compressBound(bodylen);
+    zipped = xmalloc(SMZIP_PREFIX + ziplen);
+    if (compress2((Bytef *) zipped + SMZIP_PREFIX, &ziplen, (Bytef *) body,
+                  bodylen, Z_DEFAULT_COMPRESSION) != Z_OK
+        || SMZIP_PREFIX + ziplen >= bodylen) {
+        free(zipped);
+        free(whole);
+        return false;
+    }
+    memcpy(zipped, SMZIP_MAGIC, SMZIP_MAGICLEN);
+    length = htonl(bodylen);
+    memcpy(zipped + SMZIP_MAGICLEN, &length, sizeof(length));
+
+    /* The headers are copied too if the article had to be gathered. */
+    *copy = *article;
+    iov = xmalloc(2 * sizeof(struct iovec) + (whole != NULL ? headlen : 0));
+    iov[0].iov_base = (char *) start;
+    if (whole != NULL) {
+        iov[0].iov_base = (char *) (iov + 2);
+        memcpy(iov[0].iov_base, start, headlen);
+        if (article->groups != NULL && article->groups >= start
+            && article->groups < body)
+            copy->groups = (char *) iov[0].iov_base
+                + (article->groups - start);
+        free(whole);
+    }
+    iov[0].iov_len = headlen;
+    iov[1].iov_base = zipped;
+    iov[1].iov_len = SMZIP_PREFIX + ziplen;
+    copy->iov = iov;
+    copy->iovcnt = 2;
+    copy->len = headlen + SMZIP_PREFIX + ziplen;
+    return true;
+#else
+    static bool warned = false;
+
+    if (!warned) {
+        warn("SM: cannot compress articles: INN was built without zlib");
+        warned = true;
+    }
+    return false;
+#endif
+}
+
+
+/*
+**  Free the copy of an article made by SMzipstore.
+*/
+void
+SMzipstorefree(ARTHANDLE *copy)
+{
+    free(copy->iov[1].iov_base);
+    free(copy->iov);
+}
+
+
+/*
+**  Given an article retrieved from a storage method with RETR_ALL or
+**  RETR_BODY, return a handle on it with its body decompressed, or the
+**  article itself if its body is not compressed.
+*/
+ARTHANDLE *
+SMzipretrieve(ARTHANDLE *art, RETRTYPE amount)
+{
+#ifdef HAVE_ZLIB
+    struct zipped *entry;
+    const char *body;
+    size_t headlen;
+    uint32_t length;
+    uLongf bodylen;
+
+    if (art == NULL || art->data == NULL)
+        return art;
+    if (amount == RETR_BODY)
+        body = art->data;
+    else if (amount == RETR_ALL)
+        body = wire_findbody(art->data, art->len);
+    else
+        return art;
+    if (body == NULL)
+        return art;
+    headlen = body - art->data;
+    if (art->len - headlen < SMZIP_PREFIX
+        || memcmp(body, SMZIP_MAGIC, SMZIP_MAGICLEN) != 0)
+        return art;
+
+    memcpy(&length, body + SMZIP_MAGICLEN, sizeof(length));
+    bodylen = ntohl(length);
+    entry = xmalloc(sizeof(struct zipped));
+    entry->data = xmalloc(headlen + bodylen + 1);
+    memcpy(entry->data, art->data, headlen);
+    if (uncompress((Bytef *) entry->data + headlen, &bodylen,
+                   (const Bytef *) body + SMZIP_PREFIX,
+                   art->len - headlen - SMZIP_PREFIX) != Z_OK
+        || bodylen != ntohl(length)) {
+        free(entry->data);
+        free(entry);
+        return art;
+    }
+    entry->art = *art;
+    entry->art.data = entry->data;
+    entry->art.len = headlen + bodylen;
+    entry->art.iov = NULL;
+    entry->art.iovcnt = 0;
+    entry->art.private = NULL;
+    entry->inner = art;
+    ZIPlock();
+    entry->next = zip_handles;
+    zip_handles = entry;
+    ZIPunlock();
+    return &entry->art;
+#else
+    return art;
+#endif
+}
+
+
+/*
+**  If art is a handle made by SMzipretrieve, free it and return the handle
+**  of the storage method it was made from, to be freed or passed to its next
+**  method.  Otherwise, return art.
+*/
+ARTHANDLE *
+SMzipinner(ARTHANDLE *art)
+{
+    struct zipped *entry, **prev;
+    ARTHANDLE *inner;
+
+    ZIPlock();
+    for (prev = &zip_handles; *prev != NULL; prev = &(*prev)->next) {
+        entry = *prev;
+        if (&entry->art == art) {
+            *prev = entry->next;
+            ZIPunlock();
+            inner = entry->inner;
+            inner->nextmethod = art->nextmethod;
+            free(entry->data);
+            free(entry);
+            return inner;
+        }
+    }
+    ZIPunlock();
+    return art;
+}
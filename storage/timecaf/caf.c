@@ -14,6 +14,7 @@
 
 #include "inn/messages.h"
 #include "inn/libinn.h"
+#include "inn/xwrite.h"
 
 #define CAF_INNARDS 1
 #include "caf.h"
@@ -53,8 +54,6 @@
 #define STATFORMTPAD	"%*ld"
 #endif /* HAVE_STATFS */
 
-int CAFClean(char *path, int verbose, double PercentFreeThreshold);
-
 int caf_error = 0;
 int caf_errno = 0;
 
@@ -1038,6 +1037,74 @@ CAFFinishArtWrite(int fd)
     return 0;
 }
 
+/*
+** Append count articles, each given by iovcnts[i] iovecs starting at
+** iovs[i], to a CAF file already open for writing and locked, and set
+** arts[i] to the article number given to each of them.  Does what
+** CAFStartWriteFd and CAFFinishArtWrite do for each article, but reads and
+** writes the header once and writes all the TOC entries with a single
+** write.  The articles all go at the end of the file; free blocks aren't
+** reused.  Returns -1 if they can't all be written, in which case none of
+** them is in the TOC, and 0 on success.
+*/
+int
+CAFWriteArticles(int fd, struct iovec *const *iovs, const int *iovcnts,
+                 size_t count, ARTNUM *arts)
+{
+    CAFHEADER head;
+    CAFTOCENT *toc;
+    off_t offset;
+    size_t i, size;
+    int j;
+
+    if (CAFReadHeader(fd, &head) < 0)
+        return -1;
+    if (head.High + count >= head.Low + head.NumSlots) {
+        CAFError(CAF_ERR_ARTWONTFIT);
+        return -1;
+    }
+    if ((offset = lseek(fd, 0, SEEK_END)) < 0) {
+        CAFError(CAF_ERR_IO);
+        return -1;
+    }
+
+    toc = xcalloc(count, sizeof(CAFTOCENT));
+    for (i = 0; i < count; i++) {
+        offset = CAFRoundOffsetUp(offset, head.BlockSize);
+        if (lseek(fd, offset, SEEK_SET) < 0) {
+            CAFError(CAF_ERR_IO);
+            free(toc);
+            return -1;
+        }
+        for (size = 0, j = 0; j < iovcnts[i]; j++)
+            size += iovs[i][j].iov_len;
+        if (xwritev(fd, iovs[i], iovcnts[i]) != (ssize_t) size) {
+            CAFError(CAF_ERR_IO);
+            free(toc);
+            return -1;
+        }
+        arts[i] = head.High + 1 + i;
+        toc[i].Offset = offset;
+        toc[i].Size = size;
+        toc[i].ModTime = time(NULL);
+        offset += size;
+    }
+
+    /* The articles only exist once they are in the TOC and below High. */
+    if (CAFSeekTOCEnt(fd, &head, head.High + 1) < 0
+        || OurWrite(fd, toc, count * sizeof(CAFTOCENT)) < 0) {
+        free(toc);
+        return -1;
+    }
+    free(toc);
+    head.High += count;
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        CAFError(CAF_ERR_IO);
+        return -1;
+    }
+    return OurWrite(fd, &head, sizeof(CAFHEADER));
+}
+
 /*
 ** return a string containing a description of the error.
 ** Warning: uses a static buffer, or possibly a static string.
@@ -1272,8 +1339,6 @@ CAFRemoveMultArts(char *path, unsigned int narts, ARTNUM *artnums)
 	return -1;
     }
 
-    if (CAFClean(path, 0, 10.0) < 0) errorfound=true;
-
     return errorfound ? -1 : 0;
 }
 
@@ -1357,6 +1422,46 @@ CAFStatArticle(char *path, ARTNUM art, struct stat *stbuf)
 */
 #define TOC_COMPACT_RATIO 5
 
+/*
+** Flag a CAF file which has just been renamed over or unlinked, for the
+** benefit of readers which cache open CAF files.
+*/
+static void
+CAFMarkReplaced(int fd)
+{
+    int flag = CAF_REPLACED;
+
+    xpwrite(fd, &flag, sizeof(flag), offsetof(CAFHEADER, spare));
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+/*
+** Have the kernel copy size bytes of an article from fdin to out, so that
+** they don't go through our buffers (and, on some filesystems, aren't
+** copied at all).  Returns the number of bytes copied, which is less than
+** size if copy_file_range can't handle these files; the caller copies the
+** rest itself.  The position of out is left just after what was copied.
+*/
+static size_t
+CAFCopyRange(int fdin, off_t inoff, FILE *out, off_t outoff, size_t size)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    if (fflush(out) == EOF)
+	return 0;
+    while (done < size) {
+	n = copy_file_range(fdin, &inoff, fileno(out), &outoff, size - done, 0);
+	if (n <= 0)
+	    break;
+	done += n;
+    }
+    if (done > 0 && fseeko(out, outoff, SEEK_SET) < 0)
+	return 0;
+    return done;
+}
+#endif
+
 int
 CAFClean(char *path, int verbose, double PercentFreeThreshold)
 {
@@ -1495,6 +1600,7 @@ CAFClean(char *path, int verbose, double PercentFreeThreshold)
     */
     if (newlow == head.High + 1) {
         unlink(path);
+	CAFMarkReplaced(fdin);
 	fclose(infile);
 	free(tocarray);
 	free(newpath);
@@ -1710,10 +1816,16 @@ CAFClean(char *path, int verbose, double PercentFreeThreshold)
 	    newtocp->Size = tocp->Size;
 	    newtocp->ModTime = tocp->ModTime;
 
+	    nbytes = tocp->Size;
+#ifdef HAVE_COPY_FILE_RANGE
+	    nbytes -= CAFCopyRange(fdin, tocp->Offset, outfile, startoffset,
+				   nbytes);
+#endif
+
 	    /* seek to right place in input. */
-	    fseeko(infile, (off_t) tocp->Offset, SEEK_SET);
+	    fseeko(infile, (off_t) (tocp->Offset + tocp->Size - nbytes),
+		   SEEK_SET);
 
-	    nbytes = tocp->Size;
 	    while (nbytes > 0) {
 		ncur = (nbytes > BUFSIZ) ? BUFSIZ : nbytes;
 		if (fread(buf, sizeof(char), ncur, infile) < ncur
@@ -1825,6 +1937,8 @@ CAFClean(char *path, int verbose, double PercentFreeThreshold)
 	/* if can't rename, probably no point in trying to unlink newpath, is there? */
 	return -1;
     }
+    CAFMarkReplaced(fdin);
+
     /* written and flushed newtocarray, can safely fclose and get out of
        here! */
     free(newtocarray);
@@ -24,6 +24,12 @@ typedef struct _CAFHEADER {
 } CAFHEADER;
 
 #define CAF_MAGIC "CRMT"
+
+/*
+** spare[0] is set to this once a file has been replaced by a cleaned copy
+** or removed, so that processes which keep it open know to let it go.
+*/
+#define CAF_REPLACED 1
 #define CAF_MAGIC_LEN 4
 #define CAF_DEFAULT_BLOCKSIZE 512
 
@@ -115,15 +121,20 @@ typedef struct _CAFTOCENT {
 */
 #define CAF_NAME "CF"
 
+struct iovec;
+
 extern int CAFOpenArtRead(const char *cfpath, ARTNUM art, size_t *len);
 extern int CAFOpenArtWrite(char *cfpath, ARTNUM *art, int WaitLock, size_t size);
 extern int CAFStartWriteFd(int fd, ARTNUM *art, size_t size);
 extern int CAFFinishWriteFd(int fd);
 extern int CAFFinishArtWrite(int fd);
+extern int CAFWriteArticles(int fd, struct iovec *const *iovs,
+                            const int *iovcnts, size_t count, ARTNUM *arts);
 extern int CAFCreateCAFFile(char *cfpath, ARTNUM lowart, ARTNUM tocsize, size_t cfsize, int nolink, char *temppath, size_t pathlen);
 extern const char *CAFErrorStr(void);
 extern CAFTOCENT *CAFReadTOC(char *cfpath, CAFHEADER *ch);
 extern int CAFRemoveMultArts(char *cfpath, unsigned int narts, ARTNUM *arts);
+extern int CAFClean(char *cfpath, int verbose, double PercentFreeThreshold);
 extern int CAFStatArticle(char *path, ARTNUM art, struct stat *st);
 
 #ifdef CAF_INNARDS
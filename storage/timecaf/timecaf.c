@@ -31,6 +31,8 @@ typedef struct {
     char		*mmapbase; /* actual start of mmaped region (on pagesize bndry, not necessarily == artdaya */
     unsigned int	artlen; /* art length. */
     size_t		mmaplen; /* length of mmap region. */
+    int			fd; /* open descriptor on the CAF file, or -1 */
+    off_t		artoffset; /* offset of artdata in the CAF file */
     DIR			*top; /* open handle on top level dir. */
     DIR	       		*sec; /* open handle on the 2nd level directory */
     DIR 		*ter; /* open handle on 3rd level dir. */
@@ -42,6 +44,11 @@ typedef struct {
     CAFHEADER		curheader;
 } PRIV_TIMECAF;
 
+/* How much of an article to read at first for its headers alone; more is
+   read, four times as much each time, until the end of the headers turns
+   up. */
+#define HEAD_CHUNK 8192
+
 /* current path/fd for an open CAF file */
 typedef struct {
     char	*path; /* path to file. */
@@ -97,6 +104,29 @@ typedef struct caftocl3cache CAFTOCL3CACHE;
 static CAFTOCL3CACHE *TOCCache[256]; /* indexed by storage class! */
 static int TOCCacheHits, TOCCacheMisses;
 
+/*
+** Cache of the CAF files most recently retrieved from, kept open with
+** their header, free zone table and TOC mapped, so that retrieving another
+** article from one of them needs neither an open nor reads of its header
+** and TOC.  The mapping is shared, so it follows the articles added and
+** cancelled by other processes; an entry is dropped once CAFClean flags the
+** file as replaced.
+*/
+#define READCACHE_SIZE 8
+
+typedef struct {
+    time_t		timestamp; /* time>>8 of the file, as in MakePath */
+    STORAGECLASS	class;
+    int			fd; /* -1 if the slot is unused */
+    char		*base; /* mapped header, free zone table and TOC */
+    size_t		len;
+    off_t		size; /* size of the file when last checked */
+    unsigned long	used; /* for LRU replacement */
+} CAFREADCACHE;
+
+static CAFREADCACHE ReadCache[READCACHE_SIZE];
+static unsigned long ReadCacheClock;
+
 /*
 **  The token is @04nn00aabbccyyyyxxxx0000000000000000@
 **  where "04" is the timecaf method number,
@@ -201,6 +231,8 @@ static TOKEN *PathNumToToken(char *path, ARTNUM artnum) {
 
 
 bool timecaf_init(SMATTRIBUTE *attr) {
+    int i;
+
     if (attr == NULL) {
         warn("timecaf: attr is NULL");
 	SMseterror(SMERR_INTERNAL, "attr is NULL");
@@ -215,6 +247,117 @@ bool timecaf_init(SMATTRIBUTE *attr) {
     }
     ReadingFile.fd = WritingFile.fd = -1;
     ReadingFile.path = WritingFile.path = (char *)NULL;
+    for (i = 0; i < READCACHE_SIZE; i++)
+	ReadCache[i].fd = -1;
+    return true;
+}
+
+/*
+** Routines for managing the cache of CAF files open for reading.
+*/
+
+static void
+ReadCacheDrop(CAFREADCACHE *cent)
+{
+    if (cent->fd < 0)
+	return;
+    munmap(cent->base, cent->len);
+    close(cent->fd);
+    cent->fd = -1;
+}
+
+/*
+** Return the cache entry for the CAF file with the given timestamp and
+** class, opening and mapping it if need be.  Returns NULL if the file can't
+** be cached, in which case the caller goes the usual way.
+*/
+static CAFREADCACHE *
+ReadCacheGet(time_t timestamp, STORAGECLASS class, const char *path)
+{
+    CAFREADCACHE *cent, *victim;
+    CAFHEADER head;
+    struct stat st;
+    int i, fd;
+
+    victim = &ReadCache[0];
+    for (i = 0; i < READCACHE_SIZE; i++) {
+	cent = &ReadCache[i];
+	if (cent->fd >= 0 && cent->timestamp == timestamp
+	    && cent->class == class) {
+	    if (((CAFHEADER *) cent->base)->spare[0] != CAF_REPLACED) {
+		cent->used = ++ReadCacheClock;
+		return cent;
+	    }
+	    ReadCacheDrop(cent);
+	}
+	if (cent->fd < 0 || (victim->fd >= 0 && cent->used < victim->used))
+	    victim = cent;
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return NULL;
+    if (pread(fd, &head, sizeof(head), 0) != sizeof(head)
+	|| strncmp(head.Magic, CAF_MAGIC, CAF_MAGIC_LEN) != 0
+	|| head.spare[0] == CAF_REPLACED || fstat(fd, &st) < 0) {
+	close(fd);
+	return NULL;
+    }
+    ReadCacheDrop(victim);
+    victim->len = sizeof(CAFHEADER) + head.FreeZoneTabSize
+	+ head.NumSlots * sizeof(CAFTOCENT);
+    victim->base = mmap(NULL, victim->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (victim->base == MAP_FAILED) {
+	close(fd);
+	return NULL;
+    }
+    fdflag_close_exec(fd, true);
+    victim->fd = fd;
+    victim->timestamp = timestamp;
+    victim->class = class;
+    victim->size = st.st_size;
+    victim->used = ++ReadCacheClock;
+    return victim;
+}
+
+/*
+** Find an article in a cached CAF file, the way CAFOpenArtRead does.
+** Returns false and sets caf_error if it isn't there.
+*/
+static bool
+ReadCacheFind(CAFREADCACHE *cent, ARTNUM art, off_t *offset, size_t *len)
+{
+    const CAFHEADER *head;
+    const CAFTOCENT *tocent;
+    struct stat st;
+
+    head = (const CAFHEADER *) cent->base;
+    mmap_invalidate(cent->base, cent->len);
+    if (art < head->Low || art > head->High
+	|| art - head->Low >= head->NumSlots) {
+	caf_error = CAF_ERR_ARTNOTHERE;
+	return false;
+    }
+    tocent = (const CAFTOCENT *) (cent->base + sizeof(CAFHEADER)
+				  + head->FreeZoneTabSize);
+    tocent += art - head->Low;
+    if (tocent->Size == 0) {
+	caf_error = CAF_ERR_ARTNOTHERE;
+	return false;
+    }
+
+    /* Make sure the article is within the file before it gets mapped, as
+       CAFOpenArtRead does, but only stat the file again when it seems to
+       have grown. */
+    if (tocent->Offset + (off_t) tocent->Size > cent->size) {
+	if (fstat(cent->fd, &st) == 0)
+	    cent->size = st.st_size;
+	if (tocent->Offset + (off_t) tocent->Size > cent->size) {
+	    caf_error = CAF_ERR_IO;
+	    return false;
+	}
+    }
+    *offset = tocent->Offset;
+    *len = tocent->Size;
     return true;
 }
 
@@ -454,12 +597,91 @@ TOKEN timecaf_store(const ARTHANDLE article, const STORAGECLASS class) {
     return MakeToken(timestamp, art, class, article.token);
 }
 
-/* Get a handle to article artnum in CAF-file path. */
-static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE amount) {
+/*
+**  Store a batch of articles.  Consecutive articles going to the same CAF
+**  file are added to it together:  the first one is stored as usual, which
+**  leaves the file open and locked, and the others are then appended with a
+**  single update of the header and the TOC.  If that fails, they are stored
+**  one by one.
+*/
+bool timecaf_storebatch(struct sm_record *records, size_t count) {
+    ARTHANDLE           article;
+    struct iovec        **iovs;
+    int                 *iovcnts;
+    ARTNUM              *arts;
+    time_t              now, timestamp;
+    size_t              i, j, k, n;
+    bool                success = true;
+
+    iovs = xmalloc(count * sizeof(struct iovec *));
+    iovcnts = xmalloc(count * sizeof(int));
+    arts = xmalloc(count * sizeof(ARTNUM));
+    now = time(NULL);
+    for (i = 0; i < count; i = j) {
+	/* Give articles without an arrival time the same one, so that they
+	   all go to the same file. */
+	article = *records[i].article;
+	if (article.arrived == 0)
+	    article.arrived = now;
+	timestamp = article.arrived >> 8;
+	for (j = i + 1; j < count; j++) {
+	    if (records[j].class != records[i].class)
+		break;
+	    if ((records[j].article->arrived == 0 ? now
+		 : records[j].article->arrived) >> 8 != timestamp)
+		break;
+	}
+
+	records[i].token = timecaf_store(article, records[i].class);
+	if (records[i].token.type == TOKEN_EMPTY) {
+	    success = false;
+	    j = i + 1;
+	    continue;
+	}
+	n = j - i - 1;
+	if (n == 0)
+	    continue;
+	for (k = 0; k < n; k++) {
+	    iovs[k] = records[i + 1 + k].article->iov;
+	    iovcnts[k] = records[i + 1 + k].article->iovcnt;
+	}
+	if (CAFWriteArticles(WritingFile.fd, iovs, iovcnts, n, arts) == 0) {
+	    for (k = 0; k < n; k++)
+		records[i + 1 + k].token =
+		    MakeToken(timestamp, arts[k], records[i].class,
+			      records[i + 1 + k].article->token);
+	    continue;
+	}
+	if (caf_error != CAF_ERR_ARTWONTFIT)
+	    warn("timecaf: could not append %lu articles to %s: %s",
+		 (unsigned long) n, WritingFile.path, CAFErrorStr());
+	CloseOpenFile(&WritingFile);
+	for (k = i + 1; k < j; k++) {
+	    article = *records[k].article;
+	    if (article.arrived == 0)
+		article.arrived = now;
+	    records[k].token = timecaf_store(article, records[k].class);
+	    if (records[k].token.type == TOKEN_EMPTY)
+		success = false;
+	}
+    }
+    free(iovs);
+    free(iovcnts);
+    free(arts);
+    return success;
+}
+
+/*
+** Get a handle to article artnum in CAF-file path, found through cent if
+** it's not NULL (in which case the file descriptor belongs to the cache).
+*/
+static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE amount,
+			      CAFREADCACHE *cent) {
     int                 fd;
     PRIV_TIMECAF        *private;
     char                *p;
     size_t		len;
+    off_t		offset;
     ARTHANDLE           *art;
     static long		pagesize = 0;
 
@@ -472,8 +694,17 @@ static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE am
         }
     }
 
-/* XXX need to figure some way to cache open fds or something? */
-    if ((fd = CAFOpenArtRead(path, artnum, &len)) < 0) {
+    if (cent != NULL) {
+	if (!ReadCacheFind(cent, artnum, &offset, &len))
+	    fd = -1;
+	else
+	    fd = cent->fd;
+    } else {
+	fd = CAFOpenArtRead(path, artnum, &len);
+	if (fd >= 0)
+	    offset = lseek(fd, (off_t) 0, SEEK_CUR);
+    }
+    if (fd < 0) {
         if (caf_error == CAF_ERR_ARTNOTHERE) {
 	    SMseterror(SMERR_NOENT, NULL);
 	} else {
@@ -489,24 +720,28 @@ static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE am
 	art->data = NULL;
 	art->len = 0;
 	art->private = NULL;
-	close(fd);
+	if (cent == NULL)
+	    close(fd);
 	return art;
     }
 
     private = xmalloc(sizeof(PRIV_TIMECAF));
     art->private = (void *)private;
     private->artlen = len;
+    private->artoffset = offset;
     if (innconf->articlemmap) {
 	off_t curoff, tmpoff;
 	size_t delta;
 
-	curoff = lseek(fd, (off_t) 0, SEEK_CUR);
+	curoff = private->artoffset;
 	delta = curoff % pagesize;
 	tmpoff = curoff - delta;
 	private->mmaplen = len + delta;
 	if ((private->mmapbase = mmap(NULL, private->mmaplen, PROT_READ, MAP_SHARED, fd, tmpoff)) == MAP_FAILED) {
 	    SMseterror(SMERR_UNDEFINED, NULL);
             syswarn("timecaf: could not mmap article");
+	    if (cent == NULL)
+		close(fd);
 	    free(art->private);
 	    free(art);
 	    return NULL;
@@ -518,17 +753,34 @@ static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE am
             madvise(private->mmapbase, private->mmaplen, MADV_SEQUENTIAL);
 	private->artdata = private->mmapbase + delta;
     } else {
-        private->artdata = xmalloc(private->artlen);
-	if (read(fd, private->artdata, private->artlen) < 0) {
+	size_t want = private->artlen, more;
+	ssize_t got;
+
+	if (amount == RETR_HEAD && want > HEAD_CHUNK)
+	    want = HEAD_CHUNK;
+        private->artdata = xmalloc(want);
+	got = pread(fd, private->artdata, want, offset);
+	while (got >= 0 && want < private->artlen
+	       && wire_findbody(private->artdata, want) == NULL) {
+	    more = (want * 4 < private->artlen) ? want * 4 : private->artlen;
+	    private->artdata = xrealloc(private->artdata, more);
+	    got = pread(fd, private->artdata + want, more - want,
+			offset + want);
+	    want = more;
+	}
+	private->artlen = want;
+	if (got < 0) {
 	    SMseterror(SMERR_UNDEFINED, NULL);
             syswarn("timecaf: could not read article");
+	    if (cent == NULL)
+		close(fd);
 	    free(private->artdata);
 	    free(art->private);
 	    free(art);
 	    return NULL;
 	}
     }
-    close(fd);
+    private->fd = (cent == NULL) ? fd : -1;
 
     private->top = NULL;
     private->sec = NULL;
@@ -551,6 +803,8 @@ static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE am
 	    munmap(private->mmapbase, private->mmaplen);
 	else
 	    free(private->artdata);
+	if (private->fd >= 0)
+	    close(private->fd);
 	free(art->private);
 	free(art);
 	return NULL;
@@ -574,6 +828,8 @@ static ARTHANDLE *OpenArticle(const char *path, ARTNUM artnum, const RETRTYPE am
 	munmap(private->mmapbase, private->mmaplen);
     else
 	free(private->artdata);
+    if (private->fd >= 0)
+	close(private->fd);
     free(art->private);
     free(art);
     return NULL;
@@ -614,7 +870,9 @@ ARTHANDLE *timecaf_retrieve(const TOKEN token, const RETRTYPE amount) {
     }
 
     path = MakePath(timestamp, token.class);
-    if ((art = OpenArticle(path, artnum, amount)) != (ARTHANDLE *)NULL) {
+    art = OpenArticle(path, artnum, amount,
+		      ReadCacheGet(timestamp, token.class, path));
+    if (art != (ARTHANDLE *)NULL) {
 	art->arrived = timestamp<<8; /* XXX not quite accurate arrival time,
 				     ** but getting a more accurate one would
 				     ** require more fiddling with CAF innards.
@@ -638,6 +896,8 @@ void timecaf_freearticle(ARTHANDLE *article) {
 	    munmap(private->mmapbase, private->mmaplen);
 	else
 	    free(private->artdata);
+	if (private->fd >= 0)
+	    close(private->fd);
 	if (private->top)
 	    closedir(private->top);
 	if (private->sec)
@@ -667,6 +927,9 @@ DoCancels(void) {
 	    }
 	    /* XXX should really check err. code here, but not much we can really do. */
 	    CAFRemoveMultArts(DeletePath, NumDeleteArtnums, DeleteArtnums);
+	    /* Unless cafclean does it later, clean the file right away. */
+	    if (!innconf->timecafdeferclean)
+		CAFClean(DeletePath, 0, 10.0);
 	    free(DeleteArtnums);
 	    DeleteArtnums = NULL;
 	    NumDeleteArtnums = MaxDeleteArtnums = 0;
@@ -788,6 +1051,8 @@ timecaf_next(ARTHANDLE *article, const RETRTYPE amount)
 	    munmap(priv.mmapbase, priv.mmaplen);
 	else
 	    free(priv.artdata);
+	if (priv.fd >= 0)
+	    close(priv.fd);
     }
 
     while (priv.curtoc == NULL || !FindNextArt(&priv.curheader, priv.curtoc, &priv.curartnum)) {
@@ -830,6 +1095,8 @@ timecaf_next(ARTHANDLE *article, const RETRTYPE amount)
 		if ((priv.sec = opendir(path)) == NULL)
 		    continue;
 	    }
+	    if (!SMpartitioned(strtoul(priv.secde->d_name, NULL, 16)))
+		continue;
 	    snprintf(path, length, "%s/%s/%s", innconf->patharticles, priv.topde->d_name, priv.secde->d_name);
 	    if ((priv.ter = opendir(path)) == NULL)
 		continue;
@@ -840,13 +1107,14 @@ timecaf_next(ARTHANDLE *article, const RETRTYPE amount)
 	priv.curartnum = 0;
     }
     snprintf(path, length, "%s/%s/%s/%s", innconf->patharticles, priv.topde->d_name, priv.secde->d_name, priv.terde->d_name);
-    art = OpenArticle(path, priv.curartnum, amount);
+    art = OpenArticle(path, priv.curartnum, amount, NULL);
     if (art == (ARTHANDLE *)NULL) {
 	art = xmalloc(sizeof(ARTHANDLE));
 	art->type = TOKEN_TIMECAF;
 	art->data = NULL;
 	art->len = 0;
 	art->private = xmalloc(sizeof(PRIV_TIMECAF));
+	((PRIV_TIMECAF *)art->private)->fd = -1;
     }
     newpriv = (PRIV_TIMECAF *)art->private;
     newpriv->top = priv.top;
@@ -866,8 +1134,18 @@ timecaf_next(ARTHANDLE *article, const RETRTYPE amount)
     return art;
 }
 
-bool timecaf_ctl(PROBETYPE type, TOKEN *token UNUSED, void *value) {
+bool timecaf_ctl(PROBETYPE type, TOKEN *token, void *value) {
     struct artngnum *ann;
+    struct artfile *af;
+    PRIV_TIMECAF *private;
+#ifdef HAVE_POSIX_FADVISE
+    CAFREADCACHE *cent;
+    time_t timestamp;
+    ARTNUM artnum;
+    char *path;
+    off_t offset;
+    size_t len;
+#endif
 
     switch (type) {
     case SMARTNGNUM:
@@ -876,6 +1154,28 @@ bool timecaf_ctl(PROBETYPE type, TOKEN *token UNUSED, void *value) {
 	/* make SMprobe() call timecaf_retrieve() */
 	ann->artnum = 0;
 	return true;
+    case SMARTFILE:
+	af = (struct artfile *)value;
+	private = (PRIV_TIMECAF *)af->art->private;
+	if (private == NULL || private->fd < 0 || af->art->data == NULL)
+	    return false;
+	af->fd = private->fd;
+	af->offset = private->artoffset + (af->art->data - private->artdata);
+	return true;
+    case SMPREFETCH:
+	/* The read cache finds the article without reading the TOC, and
+	   keeps the CAF file open for when it is retrieved. */
+#ifdef HAVE_POSIX_FADVISE
+	BreakToken(*token, &timestamp, &artnum);
+	path = MakePath(timestamp, token->class);
+	cent = ReadCacheGet(timestamp, token->class, path);
+	free(path);
+	if (cent == NULL || !ReadCacheFind(cent, artnum, &offset, &len))
+	    return false;
+	return posix_fadvise(cent->fd, offset, len, POSIX_FADV_WILLNEED) == 0;
+#else
+	return false;
+#endif
     default:
 	return false;
     }
@@ -895,6 +1195,10 @@ timecaf_printfiles(FILE *file, TOKEN token, char **xref UNUSED,
 }
 
 void timecaf_shutdown(void) {
+    int i;
+
     CloseOpenFile(&WritingFile);
     DoCancels();
+    for (i = 0; i < READCACHE_SIZE; i++)
+	ReadCacheDrop(&ReadCache[i]);
 }
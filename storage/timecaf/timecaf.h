@@ -12,6 +12,7 @@
 
 bool timecaf_init(SMATTRIBUTE *attr);
 TOKEN timecaf_store(const ARTHANDLE article, const STORAGECLASS class);
+bool timecaf_storebatch(struct sm_record *records, size_t count);
 ARTHANDLE *timecaf_retrieve(const TOKEN token, const RETRTYPE amount);
 ARTHANDLE *timecaf_next(ARTHANDLE *article, const RETRTYPE amount);
 void timecaf_freearticle(ARTHANDLE *article);
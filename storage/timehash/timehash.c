@@ -13,7 +13,9 @@
 #include <sys/stat.h>
 #include <time.h>
 
+#include "inn/fdflag.h"
 #include "inn/innconf.h"
+#include "inn/md5.h"
 #include "inn/messages.h"
 #include "inn/wire.h"
 #include "inn/libinn.h"
@@ -24,6 +26,8 @@
 typedef struct {
     char                *base;    /* Base of the mmaped file */
     int                 len;      /* Length of the file */
+    int                 fd;       /* Open descriptor on the file, or -1 */
+    bool                allocated; /* base was allocated rather than mapped */
     DIR                 *top;     /* Open handle on the top level directory */
     DIR                 *sec;     /* Open handle on the 2nd level directory */
     DIR                 *ter;     /* Open handle on the third level directory */
@@ -37,22 +41,88 @@ typedef enum {FIND_DIR, FIND_ART, FIND_TOPDIR} FINDTYPE;
 
 static int SeqNum = 0;
 
+#ifdef HAVE_OPENAT
 /*
-**  The token is @02nnaabbccddyyyy00000000000000000000@
+**  Articles are created, read and removed relative to cached descriptors on
+**  their time-nn/bb/cc directories, so that the kernel does not have to walk
+**  the whole path from patharticles for each of them.  Each directory holds
+**  256 seconds of articles, so a handful of entries covers both innd, which
+**  writes into the current directory, and readers, which mostly retrieve
+**  recent articles.
+*/
+#define DIRCACHE_SIZE 16
+
+#ifndef O_DIRECTORY
+# define O_DIRECTORY 0
+#endif
+#ifdef O_PATH
+# define DIRCACHE_FLAGS (O_PATH | O_DIRECTORY)
+#else
+# define DIRCACHE_FLAGS (O_RDONLY | O_DIRECTORY)
+#endif
+
+typedef struct {
+    int                 fd;       /* Open descriptor on the directory, or -1 */
+    STORAGECLASS        class;
+    unsigned int        bucket;   /* Bits 8 to 23 of the arrival time */
+    unsigned long       used;     /* Value of DirCacheClock when last used */
+} DIRCACHE;
+
+static DIRCACHE DirCache[DIRCACHE_SIZE];
+static unsigned long DirCacheClock = 0;
+#endif
+
+/*
+**  The token is @02nnaabbccddyyyyffhhhhhhhhhhhhhhhh00@
 **  where "02" is the timehash method number,
 **  "nn" the hexadecimal value of the storage class,
 **  "aabbccdd" the arrival time in hexadecimal,
-**  "yyyy" the hexadecimal sequence number seqnum.
+**  "yyyy" the hexadecimal sequence number seqnum,
+**  "ff" is 01 if the body of the article is deduplicated and 00 otherwise,
+**  "hhhhhhhhhhhhhhhh" the first half of the MD5 hash of a deduplicated body.
 **
 **  innconf->patharticles + '/time-nn/bb/cc/yyyy-aadd'
 **  where "nn" is the hexadecimal value of the storage class,
 **  "aabbccdd" the arrival time in hexadecimal,
 **  "yyyy" the hexadecimal sequence number seqnum.
+**
+**  When timehashdedupsize is set in inn.conf, the bodies at least that large
+**  are deduplicated:  the article file only holds the headers and the empty
+**  line after them, and the body is a hard link named after the article file
+**  with ".b" appended to a file of the body store,
+**  innconf->patharticles + '/bodies/hh/hhhhhhhhhhhhhhhh', named after the
+**  hash of the body.  An article whose body is already in the store only
+**  costs its headers and a link, and the link count of the file in the store
+**  counts the articles sharing it:  cancelling an article removes the store
+**  file along with the last of them.  The content of a body is compared with
+**  the store file before sharing it, so a hash collision only loses the
+**  deduplication.
 */
+#define DEDUP_FLAG      6       /* Offset of "ff" in the token. */
+#define DEDUP_HASH      7       /* Offset of "hhhhhhhhhhhhhhhh" in the token. */
+#define DEDUP_HASHLEN   8
+
+/*
+**  Return the path of the file of the body store holding the body of a
+**  deduplicated article, given the hash in its token.
+*/
+static char *
+BodyStorePath(const char *hash)
+{
+    char                hex[DEDUP_HASHLEN * 2 + 1];
+    char                *path;
+    int                 i;
+
+    for (i = 0; i < DEDUP_HASHLEN; i++)
+        snprintf(hex + i * 2, 3, "%02x", (unsigned char) hash[i]);
+    xasprintf(&path, "%s/bodies/%.2s/%s", innconf->patharticles, hex, hex);
+    return path;
+}
+
 char *
 timehash_explaintoken(const TOKEN token)
 {
-    char                *text;
+    char                *text, *body, *file;
     uint32_t            arrival;
     uint16_t            seqnum;
 
@@ -64,6 +134,13 @@ timehash_explaintoken(const TOKEN token)
               innconf->patharticles, token.class, (ntohl(arrival) >> 16) & 0xff,
               (ntohl(arrival) >> 8) & 0xff, ntohs(seqnum),
               (ntohl(arrival) >> 24) & 0xff, ntohl(arrival) & 0xff);
+    if (token.token[DEDUP_FLAG] == 1) {
+        body = BodyStorePath(&token.token[DEDUP_HASH]);
+        file = text;
+        xasprintf(&text, "%s body=%s", file, body);
+        free(file);
+        free(body);
+    }
 
     return text;
 }
@@ -111,6 +188,20 @@ static char *MakePath(time_t now, int seqnum, const STORAGECLASS class) {
     return path;
 }
 
+/*
+**  Return the path of the file holding the body of a deduplicated article.
+*/
+static char *
+BodyPath(time_t now, int seqnum, const STORAGECLASS class)
+{
+    char                *path;
+
+    path = MakePath(now, seqnum, class);
+    path = xrealloc(path, strlen(path) + 3);
+    strcat(path, ".b");
+    return path;
+}
+
 static TOKEN *PathToToken(char *path) {
     int			n;
     unsigned int        tclass, t1, t2, t3, seqnum;
@@ -129,7 +220,157 @@ static TOKEN *PathToToken(char *path) {
     return &token;
 }
 
+#ifdef HAVE_OPENAT
+/*
+**  Return a descriptor on the directory holding the articles of the given
+**  arrival time and class, creating the directory if asked to, or -1 on
+**  error.
+*/
+static int
+DirCacheGet(time_t now, const STORAGECLASS class, bool create)
+{
+    DIRCACHE            *dir, *victim;
+    unsigned int        bucket;
+    char                *path;
+    int                 i, fd;
+
+    bucket = (now >> 8) & 0xffff;
+    victim = &DirCache[0];
+    for (i = 0; i < DIRCACHE_SIZE; i++) {
+        dir = &DirCache[i];
+        if (dir->fd >= 0 && dir->class == class && dir->bucket == bucket) {
+            dir->used = ++DirCacheClock;
+            return dir->fd;
+        }
+        if (dir->fd < 0 || (victim->fd >= 0 && dir->used < victim->used))
+            victim = dir;
+    }
+
+    xasprintf(&path, "%s/time-%02x/%02x/%02x", innconf->patharticles, class,
+              (bucket >> 8) & 0xff, bucket & 0xff);
+    fd = open(path, DIRCACHE_FLAGS);
+    if (fd < 0 && errno == ENOENT && create) {
+        if (!MakeDirectory(path, true))
+            syswarn("timehash: could not make directory %s", path);
+        else
+            fd = open(path, DIRCACHE_FLAGS);
+    }
+    free(path);
+    if (fd < 0)
+        return -1;
+    fdflag_close_exec(fd, true);
+
+    if (victim->fd >= 0)
+        close(victim->fd);
+    victim->fd = fd;
+    victim->class = class;
+    victim->bucket = bucket;
+    victim->used = ++DirCacheClock;
+    return fd;
+}
+
+/*
+**  Forget the cached descriptor on a directory, in case it has been removed
+**  and created again since it was opened.
+*/
+static void
+DirCacheDrop(time_t now, const STORAGECLASS class)
+{
+    unsigned int        bucket;
+    int                 i;
+
+    bucket = (now >> 8) & 0xffff;
+    for (i = 0; i < DIRCACHE_SIZE; i++)
+        if (DirCache[i].fd >= 0 && DirCache[i].class == class
+            && DirCache[i].bucket == bucket) {
+            close(DirCache[i].fd);
+            DirCache[i].fd = -1;
+        }
+}
+#endif
+
+/*
+**  The operations done on an article file.  They are done relative to the
+**  cached directory descriptor when openat() is available, retrying once
+**  with a fresh descriptor if the file is not found, and on the full path
+**  otherwise.
+*/
+typedef enum {FILE_CREATE, FILE_OPEN, FILE_ACCESS, FILE_UNLINK} FILEOP;
+
+static int
+ArticleFileOp(time_t now, int seqnum, const STORAGECLASS class, FILEOP op)
+{
+    int                 result = -1;
+#ifdef HAVE_OPENAT
+    char                name[16];
+    int                 dirfd, try;
+
+    snprintf(name, sizeof(name), "%04x-%04x", seqnum,
+             (unsigned int)((now & 0xff) | ((now >> 16 & 0xff00))));
+    for (try = 0; try < 2; try++) {
+        if (try > 0)
+            DirCacheDrop(now, class);
+        dirfd = DirCacheGet(now, class, op == FILE_CREATE);
+        if (dirfd < 0)
+            return -1;
+        switch (op) {
+        case FILE_CREATE:
+            result = openat(dirfd, name, O_CREAT|O_EXCL|O_WRONLY,
+                            ARTFILE_MODE);
+            break;
+        case FILE_OPEN:
+            result = openat(dirfd, name, O_RDONLY);
+            break;
+        case FILE_ACCESS:
+            result = faccessat(dirfd, name, R_OK, 0);
+            break;
+        case FILE_UNLINK:
+            result = unlinkat(dirfd, name, 0);
+            break;
+        }
+        if (result >= 0 || errno != ENOENT)
+            break;
+    }
+#else
+    char                *path, *p;
+
+    path = MakePath(now, seqnum, class);
+    switch (op) {
+    case FILE_CREATE:
+        result = open(path, O_CREAT|O_EXCL|O_WRONLY, ARTFILE_MODE);
+        if (result < 0 && errno == ENOENT) {
+            p = strrchr(path, '/');
+            *p = '\0';
+            if (!MakeDirectory(path, true)) {
+                syswarn("timehash: could not make directory %s", path);
+                break;
+            }
+            *p = '/';
+            result = open(path, O_CREAT|O_EXCL|O_WRONLY, ARTFILE_MODE);
+        }
+        break;
+    case FILE_OPEN:
+        result = open(path, O_RDONLY);
+        break;
+    case FILE_ACCESS:
+        result = access(path, R_OK);
+        break;
+    case FILE_UNLINK:
+        result = unlink(path);
+        break;
+    }
+    free(path);
+#endif
+    return result;
+}
+
 bool timehash_init(SMATTRIBUTE *attr) {
+#ifdef HAVE_OPENAT
+    int                 i;
+
+    for (i = 0; i < DIRCACHE_SIZE; i++)
+        DirCache[i].fd = -1;
+#endif
     if (attr == NULL) {
         warn("timehash: attr is NULL");
 	SMseterror(SMERR_INTERNAL, "attr is NULL");
@@ -145,15 +386,163 @@ bool timehash_init(SMATTRIBUTE *attr) {
     return true;
 }
 
+/*
+**  Split an article into its headers, up to and including the empty line
+**  after them, and its body.  head and body must have room for as many
+**  entries as the article has.  Returns false if the end of the headers
+**  cannot be found.
+*/
+static bool
+SplitArticle(const ARTHANDLE *article, struct iovec *head, int *headcnt,
+             struct iovec *body, int *bodycnt, size_t *bodylen)
+{
+    static const char   eoh[] = "\r\n\r\n";
+    const char          *p;
+    size_t              matched = 0, headlen = 0, i;
+    int                 n;
+
+    for (n = 0; n < article->iovcnt; n++) {
+        p = article->iov[n].iov_base;
+        for (i = 0; i < article->iov[n].iov_len; i++) {
+            if (p[i] == eoh[matched])
+                matched++;
+            else
+                matched = (p[i] == '\r') ? 1 : 0;
+            if (matched < 4)
+                continue;
+            memcpy(head, article->iov, n * sizeof(struct iovec));
+            head[n].iov_base = (char *) p;
+            head[n].iov_len = i + 1;
+            *headcnt = n + 1;
+            headlen += i + 1;
+            *bodycnt = 0;
+            if (i + 1 < article->iov[n].iov_len) {
+                body[0].iov_base = (char *) p + i + 1;
+                body[0].iov_len = article->iov[n].iov_len - i - 1;
+                *bodycnt = 1;
+            }
+            memcpy(body + *bodycnt, article->iov + n + 1,
+                   (article->iovcnt - n - 1) * sizeof(struct iovec));
+            *bodycnt += article->iovcnt - n - 1;
+            *bodylen = article->len - headlen;
+            return true;
+        }
+        headlen += article->iov[n].iov_len;
+    }
+    return false;
+}
+
+/*
+**  Whether the open file of the body store holds the given body.
+*/
+static bool
+BodySame(int fd, const struct iovec *body, int bodycnt, size_t bodylen)
+{
+    struct stat         sb;
+    char                buffer[8192];
+    size_t              offset = 0, done, chunk;
+    int                 i;
+
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size != bodylen)
+        return false;
+    for (i = 0; i < bodycnt; i++)
+        for (done = 0; done < body[i].iov_len; done += chunk) {
+            chunk = body[i].iov_len - done;
+            if (chunk > sizeof(buffer))
+                chunk = sizeof(buffer);
+            if (pread(fd, buffer, chunk, offset) != (ssize_t) chunk
+                || memcmp(buffer, (char *) body[i].iov_base + done, chunk) != 0)
+                return false;
+            offset += chunk;
+        }
+    return true;
+}
+
+/*
+**  Write a body to a new file.  Returns false on error, having removed the
+**  file.
+*/
+static bool
+BodyWrite(char *path, const struct iovec *body, int bodycnt, size_t bodylen)
+{
+    char                *p;
+    int                 fd;
+
+    fd = open(path, O_CREAT|O_EXCL|O_WRONLY, ARTFILE_MODE);
+    if (fd < 0 && errno == ENOENT) {
+        p = strrchr(path, '/');
+        *p = '\0';
+        if (!MakeDirectory(path, true))
+            syswarn("timehash: could not make directory %s", path);
+        *p = '/';
+        fd = open(path, O_CREAT|O_EXCL|O_WRONLY, ARTFILE_MODE);
+    }
+    if (fd < 0) {
+        if (errno != EEXIST)
+            syswarn("timehash: could not create %s", path);
+        return false;
+    }
+    if (xwritev(fd, body, bodycnt) != (ssize_t) bodylen) {
+        syswarn("timehash: error writing %s", path);
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/*
+**  Find the body in the body store, adding it if it is not there yet.
+**  Stores the hash of the body in hash and returns the path of its file in
+**  the store, or NULL if it cannot be deduplicated.  created is set if the
+**  file was added.
+*/
+static char *
+BodyStore(const struct iovec *body, int bodycnt, size_t bodylen, char *hash,
+          bool *created)
+{
+    struct md5_context  context;
+    char                *path;
+    int                 fd, i;
+
+    md5_init(&context);
+    for (i = 0; i < bodycnt; i++)
+        md5_update(&context, body[i].iov_base, body[i].iov_len);
+    md5_final(&context);
+    memcpy(hash, context.digest, DEDUP_HASHLEN);
+
+    *created = false;
+    path = BodyStorePath(hash);
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        if (BodySame(fd, body, bodycnt, bodylen)) {
+            close(fd);
+            return path;
+        }
+        close(fd);
+    } else if (errno == ENOENT && BodyWrite(path, body, bodycnt, bodylen)) {
+        *created = true;
+        return path;
+    }
+    free(path);
+    return NULL;
+}
+
 TOKEN timehash_store(const ARTHANDLE article, const STORAGECLASS class) {
     char                *path;
-    char                *p;
     time_t              now;
     TOKEN               token;
     int                 fd;
     ssize_t             result;
     int                 seq;
     int                 i;
+    struct iovec        *iov = NULL, *body = NULL;
+    int                 iovcnt, bodycnt;
+    size_t              len, bodylen;
+    char                hash[DEDUP_HASHLEN];
+    char                *store = NULL;
+    bool                created = false;
 
     if (article.arrived == (time_t)0)
 	now = time(NULL);
@@ -161,33 +550,35 @@ TOKEN timehash_store(const ARTHANDLE article, const STORAGECLASS class) {
 	now = article.arrived;
 
     memset(&token, 0, sizeof(token));
+    token.type = TOKEN_EMPTY;
+
+    /* Only write the headers if the body is shared with the body store. */
+    if (innconf->timehashdedupsize > 0 && article.iov != NULL) {
+        iov = xmalloc(2 * article.iovcnt * sizeof(struct iovec));
+        body = iov + article.iovcnt;
+        if (SplitArticle(&article, iov, &iovcnt, body, &bodycnt, &bodylen)
+            && bodylen >= innconf->timehashdedupsize)
+            store = BodyStore(body, bodycnt, bodylen, hash, &created);
+    }
+    if (store == NULL) {
+        free(iov);
+        iov = article.iov;
+        iovcnt = article.iovcnt;
+        len = article.len;
+    } else
+        len = article.len - bodylen;
 
     for (i = 0; i < 0x10000; i++) {
 	seq = SeqNum;
 	SeqNum = (SeqNum + 1) & 0xffff;
-	path = MakePath(now, seq, class);
-
-        if ((fd = open(path, O_CREAT|O_EXCL|O_WRONLY, ARTFILE_MODE)) < 0) {
+        if ((fd = ArticleFileOp(now, seq, class, FILE_CREATE)) < 0) {
 	    if (errno == EEXIST)
 		continue;
-	    p = strrchr(path, '/');
-	    *p = '\0';
-	    if (!MakeDirectory(path, true)) {
-                syswarn("timehash: could not make directory %s", path);
-	        token.type = TOKEN_EMPTY;
-	        free(path);
-	        SMseterror(SMERR_UNDEFINED, NULL);
-	        return token;
-	    } else {
-	        *p = '/';
-	        if ((fd = open(path, O_CREAT|O_EXCL|O_WRONLY, ARTFILE_MODE)) < 0) {
-		    SMseterror(SMERR_UNDEFINED, NULL);
-                    syswarn("timehash: could not create %s", path);
-		    token.type = TOKEN_EMPTY;
-		    free(path);
-		    return token;
-	        }
-	    }
+	    SMseterror(SMERR_UNDEFINED, NULL);
+	    path = MakePath(now, seq, class);
+            syswarn("timehash: could not create %s", path);
+	    free(path);
+	    goto done;
         }
 	break;
     }
@@ -195,27 +586,147 @@ TOKEN timehash_store(const ARTHANDLE article, const STORAGECLASS class) {
 	SMseterror(SMERR_UNDEFINED, NULL);
         warn("timehash: all sequence numbers for time %lu and class %d are"
              " reserved", (unsigned long) now, class);
-	token.type = TOKEN_EMPTY;
-	free(path);
-	return token;
+	goto done;
     }
 
-    result = xwritev(fd, article.iov, article.iovcnt);
-    if (result != (ssize_t) article.len) {
+    result = xwritev(fd, iov, iovcnt);
+    if (result != (ssize_t) len) {
 	SMseterror(SMERR_UNDEFINED, NULL);
+	path = MakePath(now, seq, class);
         syswarn("timehash: error writing %s", path);
 	close(fd);
-	token.type = TOKEN_EMPTY;
-	unlink(path);
+	ArticleFileOp(now, seq, class, FILE_UNLINK);
 	free(path);
-	return token;
+	goto done;
     }
     close(fd);
+
+    /* Link the body next to the headers.  If the file of the store went
+       away meanwhile, write the body there instead. */
+    if (store != NULL) {
+        path = BodyPath(now, seq, class);
+        if (link(store, path) < 0
+            && !BodyWrite(path, body, bodycnt, bodylen)) {
+            SMseterror(SMERR_UNDEFINED, NULL);
+            syswarn("timehash: could not link %s to %s", path, store);
+            ArticleFileOp(now, seq, class, FILE_UNLINK);
+            free(path);
+            goto done;
+        }
+        free(path);
+    }
+
+    token = MakeToken(now, seq, class, article.token);
+    token.token[DEDUP_FLAG] = (store != NULL) ? 1 : 0;
+    if (store != NULL)
+        memcpy(&token.token[DEDUP_HASH], hash, DEDUP_HASHLEN);
+    else
+        memset(&token.token[DEDUP_HASH], 0, DEDUP_HASHLEN);
+
+done:
+    if (store != NULL) {
+        if (token.type == TOKEN_EMPTY && created)
+            unlink(store);
+        free(store);
+        free(iov);
+    }
+    return token;
+}
+
+/*
+**  Each article goes to its own file, so there is nothing to share between
+**  the articles of a batch.
+*/
+bool timehash_storebatch(struct sm_record *records, size_t count) {
+    size_t              i;
+    bool                success = true;
+
+    for (i = 0; i < count; i++) {
+	records[i].token = timehash_store(*records[i].article, records[i].class);
+	if (records[i].token.type == TOKEN_EMPTY)
+	    success = false;
+    }
+    return success;
+}
+
+/*
+**  Read a whole file into a newly allocated buffer, appending it to the len
+**  bytes already at *base.  Returns false on error.
+*/
+static bool
+ReadWhole(int fd, char **base, int *len)
+{
+    struct stat         sb;
+
+    if (fstat(fd, &sb) < 0)
+        return false;
+    *base = xrealloc(*base, *len + sb.st_size + 1);
+    if (pread(fd, *base + *len, sb.st_size, 0) != sb.st_size)
+        return false;
+    *len += sb.st_size;
+    return true;
+}
+
+/*
+**  Open a deduplicated article for RETR_BODY or RETR_ALL.  The body is read
+**  from its own file, and for RETR_ALL appended to the headers.  For
+**  RETR_BODY the descriptor of the body file is kept so that SMARTFILE can
+**  hand it out.
+*/
+static ARTHANDLE *
+OpenDedupArticle(time_t now, int seqnum, STORAGECLASS class, RETRTYPE amount)
+{
+    PRIV_TIMEHASH       *private;
+    ARTHANDLE           *art;
+    char                *path;
+    int                 fd, bodyfd;
+
+    fd = -1;
+    if (amount == RETR_ALL
+        && (fd = ArticleFileOp(now, seqnum, class, FILE_OPEN)) < 0) {
+        SMseterror(SMERR_UNDEFINED, NULL);
+        return NULL;
+    }
+    path = BodyPath(now, seqnum, class);
+    bodyfd = open(path, O_RDONLY);
     free(path);
-    return MakeToken(now, seq, class, article.token);
+    if (bodyfd < 0) {
+        SMseterror(SMERR_UNDEFINED, NULL);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    private = xcalloc(1, sizeof(PRIV_TIMEHASH));
+    private->allocated = true;
+    if ((fd >= 0 && !ReadWhole(fd, &private->base, &private->len))
+        || !ReadWhole(bodyfd, &private->base, &private->len)) {
+        SMseterror(SMERR_UNDEFINED, NULL);
+        syswarn("timehash: could not read article");
+        if (fd >= 0)
+            close(fd);
+        close(bodyfd);
+        free(private->base);
+        free(private);
+        return NULL;
+    }
+    if (fd >= 0) {
+        close(fd);
+        close(bodyfd);
+        private->fd = -1;
+    } else
+        private->fd = bodyfd;
+
+    art = xmalloc(sizeof(ARTHANDLE));
+    art->type = TOKEN_TIMEHASH;
+    art->private = (void *)private;
+    art->data = private->base;
+    art->len = private->len;
+    return art;
 }
 
-static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
+static ARTHANDLE *OpenArticle(time_t now, int seqnum, STORAGECLASS class,
+                               RETRTYPE amount, bool dedup) {
     int                 fd;
     PRIV_TIMEHASH       *private;
     char                *p;
@@ -223,7 +734,7 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
     ARTHANDLE           *art;
 
     if (amount == RETR_STAT) {
-        if (access(path, R_OK) < 0) {
+        if (ArticleFileOp(now, seqnum, class, FILE_ACCESS) < 0) {
             SMseterror(SMERR_UNDEFINED, NULL);
             return NULL;
         }
@@ -235,7 +746,10 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
 	return art;
     }
 
-    if ((fd = open(path, O_RDONLY)) < 0) {
+    if (dedup && (amount == RETR_BODY || amount == RETR_ALL))
+        return OpenDedupArticle(now, seqnum, class, amount);
+
+    if ((fd = ArticleFileOp(now, seqnum, class, FILE_OPEN)) < 0) {
 	SMseterror(SMERR_UNDEFINED, NULL);
 	return NULL;
     }
@@ -246,6 +760,7 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
     if (fstat(fd, &sb) < 0) {
 	SMseterror(SMERR_UNDEFINED, NULL);
         syswarn("timehash: could not fstat article");
+	close(fd);
 	free(art);
 	return NULL;
     }
@@ -253,10 +768,12 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
     private = xmalloc(sizeof(PRIV_TIMEHASH));
     art->private = (void *)private;
     private->len = sb.st_size;
+    private->allocated = !innconf->articlemmap;
     if (innconf->articlemmap) {
 	if ((private->base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
 	    SMseterror(SMERR_UNDEFINED, NULL);
             syswarn("timehash: could not mmap article");
+	    close(fd);
 	    free(art->private);
 	    free(art);
 	    return NULL;
@@ -270,13 +787,14 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
 	if (read(fd, private->base, private->len) < 0) {
 	    SMseterror(SMERR_UNDEFINED, NULL);
             syswarn("timehash: could not read article");
+	    close(fd);
 	    free(private->base);
 	    free(art->private);
 	    free(art);
 	    return NULL;
 	}
     }
-    close(fd);
+    private->fd = fd;
 
     private->top = NULL;
     private->sec = NULL;
@@ -294,10 +812,11 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
 
     if ((p = wire_findbody(private->base, private->len)) == NULL) {
 	SMseterror(SMERR_NOBODY, NULL);
-	if (innconf->articlemmap)
+	if (!private->allocated)
 	    munmap(private->base, private->len);
 	else
 	    free(private->base);
+	close(private->fd);
 	free(art->private);
 	free(art);
 	return NULL;
@@ -317,10 +836,11 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
 	return art;
     }
     SMseterror(SMERR_UNDEFINED, "Invalid retrieve request");
-    if (innconf->articlemmap)
+    if (!private->allocated)
 	munmap(private->base, private->len);
     else
 	free(private->base);
+    close(private->fd);
     free(art->private);
     free(art);
     return NULL;
@@ -329,7 +849,6 @@ static ARTHANDLE *OpenArticle(const char *path, RETRTYPE amount) {
 ARTHANDLE *timehash_retrieve(const TOKEN token, const RETRTYPE amount) {
     time_t              now;
     int                 seqnum;
-    char                *path;
     ARTHANDLE           *art;
     static TOKEN	ret_token;
 
@@ -339,13 +858,13 @@ ARTHANDLE *timehash_retrieve(const TOKEN token, const RETRTYPE amount) {
     }
 
     BreakToken(token, &now, &seqnum);
-    path = MakePath(now, seqnum, token.class);
-    if ((art = OpenArticle(path, amount)) != (ARTHANDLE *)NULL) {
+    art = OpenArticle(now, seqnum, token.class, amount,
+                      token.token[DEDUP_FLAG] == 1);
+    if (art != (ARTHANDLE *)NULL) {
 	art->arrived = now;
 	ret_token = token;
 	art->token = &ret_token;
     }
-    free(path);
     return art;
 }
 
@@ -357,10 +876,12 @@ void timehash_freearticle(ARTHANDLE *article) {
 
     if (article->private) {
 	private = (PRIV_TIMEHASH *)article->private;
-	if (innconf->articlemmap)
+	if (!private->allocated)
 	    munmap(private->base, private->len);
 	else
 	    free(private->base);
+	if (private->fd >= 0)
+	    close(private->fd);
 	if (private->top)
 	    closedir(private->top);
 	if (private->sec)
@@ -377,17 +898,28 @@ void timehash_freearticle(ARTHANDLE *article) {
 bool timehash_cancel(TOKEN token) {
     time_t              now;
     int                 seqnum;
+
     char                *path;
-    int                 result;
+    struct stat         sb;
 
     BreakToken(token, &now, &seqnum);
-    path = MakePath(now, seqnum, token.class);
-    result = unlink(path);
-    free(path);
-    if (result < 0) {
+    if (ArticleFileOp(now, seqnum, token.class, FILE_UNLINK) < 0) {
 	SMseterror(SMERR_UNDEFINED, NULL);
 	return false;
     }
+
+    /* Drop the link to the body, and the body itself from the body store
+       once no other article links to it. */
+    if (token.token[DEDUP_FLAG] == 1) {
+        path = BodyPath(now, seqnum, token.class);
+        if (unlink(path) < 0 && errno != ENOENT)
+            syswarn("timehash: could not remove %s", path);
+        free(path);
+        path = BodyStorePath(&token.token[DEDUP_HASH]);
+        if (stat(path, &sb) == 0 && sb.st_nlink <= 1)
+            unlink(path);
+        free(path);
+    }
     return true;
 }
 
@@ -425,6 +957,36 @@ static struct dirent *FindDir(DIR *dir, FINDTYPE type) {
     return NULL;
 }
 
+/*
+**  Fill in the deduplication part of a token built from the path of an
+**  article, if the article has its body in the body store.  The hash is not
+**  in the path, so it is computed again from the body.
+*/
+static void
+BodyHashFile(time_t now, int seqnum, TOKEN *token)
+{
+    struct md5_context  context;
+    char                buffer[8192];
+    char                *path;
+    ssize_t             n;
+    int                 fd;
+
+    path = BodyPath(now, seqnum, token->class);
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+        return;
+    md5_init(&context);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        md5_update(&context, (unsigned char *) buffer, n);
+    close(fd);
+    if (n < 0)
+        return;
+    md5_final(&context);
+    token->token[DEDUP_FLAG] = 1;
+    memcpy(&token->token[DEDUP_HASH], context.digest, DEDUP_HASHLEN);
+}
+
 ARTHANDLE *
 timehash_next(ARTHANDLE *article, const RETRTYPE amount)
 {
@@ -433,6 +995,7 @@ timehash_next(ARTHANDLE *article, const RETRTYPE amount)
     char                *path;
     struct dirent       *de;
     ARTHANDLE           *art;
+    time_t              now;
     int                 seqnum;
     size_t              length;
     TOKEN               *nexttoken;
@@ -452,11 +1015,13 @@ timehash_next(ARTHANDLE *article, const RETRTYPE amount)
 	free(article->private);
 	free(article);
 	if (priv.base != NULL) {
-	    if (innconf->articlemmap)
+	    if (!priv.allocated)
 		munmap(priv.base, priv.len);
 	    else
 		free(priv.base);
 	}
+	if (priv.fd >= 0)
+	    close(priv.fd);
     }
 
     while (!priv.artdir || ((de = FindDir(priv.artdir, FIND_ART)) == NULL)) {
@@ -499,6 +1064,8 @@ timehash_next(ARTHANDLE *article, const RETRTYPE amount)
 		if ((priv.sec = opendir(path)) == NULL)
 		    continue;
 	    }
+	    if (!SMpartitioned(strtoul(priv.secde->d_name, NULL, 16)))
+		continue;
 	    snprintf(path, length, "%s/%s/%s", innconf->patharticles, priv.topde->d_name, priv.secde->d_name);
 	    if ((priv.ter = opendir(path)) == NULL)
 		continue;
@@ -509,9 +1076,16 @@ timehash_next(ARTHANDLE *article, const RETRTYPE amount)
     }
     if (de == NULL)
 	return NULL;
-    snprintf(path, length, "%s/%s/%s/%s/%s", innconf->patharticles, priv.topde->d_name, priv.secde->d_name, priv.terde->d_name, de->d_name);
+    snprintf(path, length, "%s/%s/%s/%s", priv.topde->d_name, priv.secde->d_name, priv.terde->d_name, de->d_name);
+    nexttoken = PathToToken(path);
+    free(path);
+    if (nexttoken == (TOKEN *)NULL)
+        return NULL;
+    BreakToken(*nexttoken, &now, &seqnum);
+    BodyHashFile(now, seqnum, nexttoken);
 
-    art = OpenArticle(path, amount);
+    art = OpenArticle(now, seqnum, nexttoken->class, amount,
+                      nexttoken->token[DEDUP_FLAG] == 1);
     if (art == (ARTHANDLE *)NULL) {
 	art = xmalloc(sizeof(ARTHANDLE));
 	art->type = TOKEN_TIMEHASH;
@@ -520,6 +1094,8 @@ timehash_next(ARTHANDLE *article, const RETRTYPE amount)
 	art->private = xmalloc(sizeof(PRIV_TIMEHASH));
 	newpriv = (PRIV_TIMEHASH *)art->private;
 	newpriv->base = NULL;
+	newpriv->allocated = false;
+	newpriv->fd = -1;
     }
     newpriv = (PRIV_TIMEHASH *)art->private;
     newpriv->top = priv.top;
@@ -529,20 +1105,19 @@ timehash_next(ARTHANDLE *article, const RETRTYPE amount)
     newpriv->topde = priv.topde;
     newpriv->secde = priv.secde;
     newpriv->terde = priv.terde;
-    snprintf(path, length, "%s/%s/%s/%s", priv.topde->d_name, priv.secde->d_name, priv.terde->d_name, de->d_name);
-    nexttoken = PathToToken(path);
-    if (nexttoken == (TOKEN *)NULL) {
-        free(path);
-        return NULL;
-    }
     art->token = nexttoken;
-    BreakToken(*art->token, &(art->arrived), &seqnum);
-    free(path);
+    art->arrived = now;
     return art;
 }
 
-bool timehash_ctl(PROBETYPE type, TOKEN *token UNUSED, void *value) {
+bool timehash_ctl(PROBETYPE type, TOKEN *token, void *value) {
     struct artngnum *ann;
+    struct artfile *af;
+    PRIV_TIMEHASH *private;
+    time_t now;
+    int seqnum;
+    char *path;
+    bool status;
 
     switch (type) {
     case SMARTNGNUM:
@@ -551,6 +1126,25 @@ bool timehash_ctl(PROBETYPE type, TOKEN *token UNUSED, void *value) {
 	/* make SMprobe() call timehash_retrieve() */
 	ann->artnum = 0;
 	return true;
+    case SMARTFILE:
+	af = (struct artfile *)value;
+	private = (PRIV_TIMEHASH *)af->art->private;
+	if (private == NULL || private->fd < 0 || af->art->data == NULL)
+	    return false;
+	af->fd = private->fd;
+	af->offset = af->art->data - private->base;
+	return true;
+    case SMPREFETCH:
+	BreakToken(*token, &now, &seqnum);
+	path = MakePath(now, seqnum, token->class);
+	status = SMprefetchfile(path);
+	free(path);
+        if (status && token->token[DEDUP_FLAG] == 1) {
+            path = BodyPath(now, seqnum, token->class);
+            status = SMprefetchfile(path);
+            free(path);
+        }
+	return status;
     default:
 	return false;
     }
@@ -573,7 +1167,22 @@ timehash_printfiles(FILE *file, TOKEN token, char **xref UNUSED,
     BreakToken(token, &now, &seqnum);
     path = MakePath(now, seqnum, token.class);
     fprintf(file, "%s\n", path);
+    free(path);
+    if (token.token[DEDUP_FLAG] == 1) {
+        path = BodyPath(now, seqnum, token.class);
+        fprintf(file, "%s\n", path);
+        free(path);
+    }
 }
 
 void timehash_shutdown(void) {
+#ifdef HAVE_OPENAT
+    int                 i;
+
+    for (i = 0; i < DIRCACHE_SIZE; i++)
+        if (DirCache[i].fd >= 0) {
+            close(DirCache[i].fd);
+            DirCache[i].fd = -1;
+        }
+#endif
 }
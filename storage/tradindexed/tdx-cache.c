@@ -5,11 +5,17 @@
 **  the overhead involved in closing and reopening files.  All opens and
 **  closes should go through this code, and the hit ratio is tracked to check
 **  cache effectiveness.
+**
+**  The entries are kept in a list from the most to the least recently used,
+**  and the least recently used one is dropped when the cache holds too many
+**  groups or, if a limit is set, when the files it holds mapped (or read into
+**  memory) take too much space.  A group only maps its files when it is
+**  searched, after having been looked up, so the space taken by a group is
+**  measured again each time it is looked up and when the next group is.
 */
 
 #include "config.h"
 #include "clibrary.h"
-#include <time.h>
 
 #include "inn/hashtab.h"
 #include "inn/messages.h"
@@ -21,8 +27,12 @@
    information about the cache. */
 struct cache {
     struct hash *hashtable;
+    struct cache_entry *first;  /* Most recently used. */
+    struct cache_entry *last;   /* Least recently used. */
     unsigned int count;
     unsigned int max;
+    off_t size;
+    off_t maxsize;
     unsigned long queries;
     unsigned long hits;
 };
@@ -32,7 +42,9 @@ struct cache {
 struct cache_entry {
     struct group_data *data;
     HASH hash;
-    time_t lastused;
+    off_t size;                 /* Space taken when last measured. */
+    struct cache_entry *prev;
+    struct cache_entry *next;
 };
 
 
@@ -92,40 +104,110 @@ entry_delete(void *data)
 
 
 /*
-**  Called by hash_traverse, this function finds the oldest entry with the
-**  smallest refcount and stores it in the provided pointer so that it can be
-**  freed.  This is used when the cache is full to drop the least useful
-**  entry.
+**  Unlink an entry from the list of entries.
 */
 static void
-entry_find_oldest(void *data, void *cookie)
+entry_unlink(struct cache *cache, struct cache_entry *entry)
 {
-    struct cache_entry *entry = (struct cache_entry *) data;
-    struct cache_entry **oldest = (struct cache_entry **) cookie;
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->first = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->last = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
 
-    if (*oldest == NULL) {
-        *oldest = entry;
-        return;
-    }
-    if (entry->data->refcount > (*oldest)->data->refcount)
-        return;
-    if (entry->lastused > (*oldest)->lastused)
+
+/*
+**  Put an entry at the start of the list of entries, as the most recently
+**  used.
+*/
+static void
+entry_link(struct cache *cache, struct cache_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->first;
+    if (cache->first != NULL)
+        cache->first->prev = entry;
+    else
+        cache->last = entry;
+    cache->first = entry;
+}
+
+
+/*
+**  Measure again the space taken by the files of an entry and update the
+**  total for the cache.
+*/
+static void
+entry_measure(struct cache *cache, struct cache_entry *entry)
+{
+    off_t size = 0;
+
+    if (entry->data->index != NULL)
+        size += entry->data->indexlen;
+    if (entry->data->data != NULL)
+        size += entry->data->datalen;
+    cache->size += size - entry->size;
+    entry->size = size;
+}
+
+
+/*
+**  Remove an entry from the cache and free it.  Returns false if it couldn't
+**  be removed from the hash table.
+*/
+static bool
+entry_remove(struct cache *cache, struct cache_entry *entry)
+{
+    off_t size = entry->size;
+
+    entry_unlink(cache, entry);
+    if (!hash_delete(cache->hashtable, &entry->hash))
+        return false;
+    cache->size -= size;
+    cache->count--;
+    return true;
+}
+
+
+/*
+**  Drop the least recently used entries, except the most recently used one,
+**  while the files the cache holds take more space than allowed.
+*/
+static void
+cache_trim(struct cache *cache)
+{
+    if (cache->maxsize == 0)
         return;
-    *oldest = data;
+    while (cache->size > cache->maxsize && cache->last != cache->first)
+        if (!entry_remove(cache, cache->last)) {
+            warn("tradindexed: cannot delete oldest cache entry");
+            return;
+        }
 }
 
 
 /*
-**  Create a new cache with the given size.
+**  Create a new cache holding at most the given number of groups and, unless
+**  it is 0, at most maxsize bytes of files mapped or read into memory.
 */
 struct cache *
-tdx_cache_create(unsigned int size)
+tdx_cache_create(unsigned int size, off_t maxsize)
 {
     struct cache *cache;
 
     cache = xmalloc(sizeof(struct cache));
+    cache->first = NULL;
+    cache->last = NULL;
     cache->count = 0;
     cache->max = size;
+    cache->size = 0;
+    cache->maxsize = maxsize;
     cache->queries = 0;
     cache->hits = 0;
     cache->hashtable = hash_create(size * 4 / 3, entry_hash, entry_key,
@@ -143,49 +225,54 @@ tdx_cache_lookup(struct cache *cache, HASH hash)
     struct cache_entry *entry;
 
     cache->queries++;
+    if (cache->first != NULL)
+        entry_measure(cache, cache->first);
     entry = hash_lookup(cache->hashtable, &hash);
-    if (entry != NULL) {
-        cache->hits++;
-        entry->lastused = time(NULL);
-    }
-    return (entry == NULL) ? NULL : entry->data;
+    if (entry == NULL)
+        return NULL;
+    cache->hits++;
+    entry_measure(cache, entry);
+    entry_unlink(cache, entry);
+    entry_link(cache, entry);
+    cache_trim(cache);
+    return entry->data;
 }
 
 
 /*
-**  Insert a new entry, clearing out the oldest entry if the cache is
-**  currently full.
+**  Insert a new entry, clearing out the least recently used entry if the
+**  cache is currently full.
 */
 void
 tdx_cache_insert(struct cache *cache, HASH hash, struct group_data *data)
 {
     struct cache_entry *entry;
 
-    if (cache->count == cache->max) {
-        struct cache_entry *oldest = NULL;
-
-        hash_traverse(cache->hashtable, entry_find_oldest, &oldest);
-        if (oldest == NULL) {
+    if (cache->first != NULL)
+        entry_measure(cache, cache->first);
+    if (cache->count >= cache->max) {
+        if (cache->last == NULL) {
             warn("tradindexed: unable to find oldest cache entry");
             return;
-        } else {
-            if (!hash_delete(cache->hashtable, &oldest->hash)) {
-                warn("tradindexed: cannot delete oldest cache entry");
-                return;
-            }
         }
-        cache->count--;
+        if (!entry_remove(cache, cache->last)) {
+            warn("tradindexed: cannot delete oldest cache entry");
+            return;
+        }
     }
     entry = xmalloc(sizeof(struct cache_entry));
     entry->data = data;
     entry->hash = hash;
-    entry->lastused = time(NULL);
+    entry->size = 0;
     if (!hash_insert(cache->hashtable, &entry->hash, entry)) {
         warn("tradindexed: duplicate cache entry for %s", HashToText(hash));
         free(entry);
     } else {
         entry->data->refcount++;
         cache->count++;
+        entry_link(cache, entry);
+        entry_measure(cache, entry);
+        cache_trim(cache);
     }
 }
 
@@ -196,12 +283,12 @@ tdx_cache_insert(struct cache *cache, HASH hash, struct group_data *data)
 void
 tdx_cache_delete(struct cache *cache, HASH hash)
 {
-    if (!hash_delete(cache->hashtable, &hash)) {
+    struct cache_entry *entry;
+
+    entry = hash_lookup(cache->hashtable, &hash);
+    if (entry == NULL || !entry_remove(cache, entry))
         warn("tradindexed: unable to remove cache entry for %s",
              HashToText(hash));
-    } else {
-        cache->count--;
-    }
 }
 
 
@@ -8,6 +8,18 @@
 **  about that article.  The .DAT files contain all of the overview data for
 **  that group in wire format.
 **
+**  The index file is either in the native format (an array of struct
+**  index_entry) or in the compact format (a magic string followed by an
+**  array of struct index_compact).  Everything that accesses index entries
+**  goes through entry_get and entry_set, which hide the difference.  With
+**  a different magic string, the compact format also means that each entry
+**  in the data file is compressed on its own (see record_deflate).
+**
+**  Searches normally map both files, but the files of groups whose index is
+**  smaller than tradindexedpreadsize are read with pread instead, only for
+**  the range of articles requested, so that a process reading many small
+**  groups doesn't accumulate two mappings for each of them.
+**
 **  Externally visible functions have a tdx_ prefix; internal functions do
 **  not.  (Externally visible unfortunately means everything that needs to be
 **  visible outside of this object file, not just interfaces exported to
@@ -20,7 +32,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
 
+#include "inn/buffer.h"
 #include "inn/fdflag.h"
 #include "inn/history.h"
 #include "inn/innconf.h"
@@ -40,8 +58,45 @@ struct search {
     ARTNUM limit;
     ARTNUM current;
     struct group_data *data;
+    struct buffer *inflated;    /* Current entry of compressed data. */
+    bool indexonly;             /* Don't read the data file. */
+
+    /* Only used for searches reading the files with pread. */
+    bool pread;
+    char *entries;              /* Index entries, from first on. */
+    ARTNUM first;
+    ARTNUM count;
+    char *window;               /* Part of the data file read. */
+    off_t windowstart;
+    size_t windowlen;
+    size_t windowsize;
 };
 
+/* How much of the data file a search reading it with pread reads at once. */
+#define TDX_READ_WINDOW (64 * 1024)
+
+/* The start of the preset dictionary used to compress overview data, to
+   which the name of the group is appended.  zlib finds the matches closer to
+   the end of the dictionary more cheaply.  Changing this would make existing
+   compressed data unreadable. */
+static const char dictionary[] =
+    "\tRe: =?UTF-8?Q? =?UTF-8?B? the The and for "
+    "\tMon, \tTue, \tWed, \tThu, \tFri, \tSat, \tSun, "
+    "Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec "
+    "GMT\t (UTC)\t@\t<\t\tXref: ";
+
+#ifdef HAVE_ZLIB
+/* The streams used to compress and decompress, kept between calls. */
+static z_stream deflation;
+static z_stream inflation;
+static bool deflation_ready = false;
+static bool inflation_ready = false;
+#endif
+
+/* Set once a group with compressed overview has been opened.  From then on,
+   the data returned by tdx_search is only valid until the next call. */
+static bool compressed_seen = false;
+
 /* Internal prototypes. */
 static char *group_path(const char *group);
 static int file_open(const char *base, const char *suffix, bool writable,
@@ -57,6 +112,270 @@ static void unmap_data(struct group_data *data);
 static ARTNUM index_base(ARTNUM artnum);
 
 
+/*
+**  Return the size of an index entry, the offset of the first one in the
+**  index file, and the offset of the entry for a particular article (given
+**  relative to the base of the index).
+*/
+static size_t
+entry_size(const struct group_data *data)
+{
+    return data->compact ? sizeof(struct index_compact)
+                         : sizeof(struct index_entry);
+}
+
+static off_t
+entry_start(const struct group_data *data)
+{
+    return data->compact ? TDX_COMPACT_MAGIC_LEN : 0;
+}
+
+static off_t
+entry_offset(const struct group_data *data, ARTNUM n)
+{
+    return entry_start(data) + (off_t) n * entry_size(data);
+}
+
+
+/*
+**  Return the number of entries in the mapped index file.
+*/
+static ARTNUM
+entry_count(const struct group_data *data)
+{
+    if (data->indexlen <= entry_start(data))
+        return 0;
+    return (data->indexlen - entry_start(data)) / entry_size(data);
+}
+
+
+/*
+**  Little-endian encoding and decoding of the fields of a compact entry.
+*/
+static void
+pack_number(unsigned char *p, unsigned long long value, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++, value >>= 8)
+        p[i] = value & 0xff;
+}
+
+static unsigned long long
+unpack_number(const unsigned char *p, size_t length)
+{
+    unsigned long long value = 0;
+
+    while (length-- > 0)
+        value = (value << 8) | p[length];
+    return value;
+}
+
+
+/*
+**  Return the length of the overview data of an entry of the mapped index
+**  file, which is 0 for deleted entries.  Cheaper than entry_get when only
+**  looking for the next article.
+*/
+static int
+entry_length(const struct group_data *data, ARTNUM n)
+{
+    const struct index_compact *compact;
+
+    if (!data->compact)
+        return ((const struct index_entry *) data->index)[n].length;
+    compact = (const struct index_compact *)
+        ((const char *) data->index + entry_start(data));
+    return unpack_number(compact[n].length, sizeof(compact[n].length));
+}
+
+
+/*
+**  Decode an entry in the format of the index file into a struct
+**  index_entry.
+*/
+static void
+entry_decode(const struct group_data *data, const void *raw,
+             struct index_entry *entry)
+{
+    const struct index_compact *compact = raw;
+
+    if (!data->compact) {
+        memcpy(entry, raw, sizeof(*entry));
+        return;
+    }
+    entry->offset = unpack_number(compact->offset, sizeof(compact->offset));
+    entry->length = unpack_number(compact->length, sizeof(compact->length));
+    entry->arrived = unpack_number(compact->arrived, sizeof(compact->arrived));
+    entry->expires = unpack_number(compact->expires, sizeof(compact->expires));
+    entry->token = compact->token;
+}
+
+
+/*
+**  Decode an entry of the mapped index file into a struct index_entry.
+*/
+static void
+entry_get(const struct group_data *data, ARTNUM n, struct index_entry *entry)
+{
+    entry_decode(data, (const char *) data->index + entry_offset(data, n),
+                 entry);
+}
+
+
+/*
+**  Encode a struct index_entry in the format of the index file into buffer,
+**  which must have room for entry_size bytes.  Returns false if the entry
+**  cannot be represented in the compact format.
+*/
+static bool
+entry_set(const struct group_data *data, const struct index_entry *entry,
+          void *buffer)
+{
+    struct index_compact *compact = buffer;
+
+    if (!data->compact) {
+        memcpy(buffer, entry, sizeof(*entry));
+        return true;
+    }
+    if ((unsigned long long) entry->offset >= 1ULL << 40
+        || (unsigned long) entry->length >= 1UL << 24)
+        return false;
+    pack_number(compact->offset, entry->offset, sizeof(compact->offset));
+    pack_number(compact->length, entry->length, sizeof(compact->length));
+    pack_number(compact->arrived, entry->arrived, sizeof(compact->arrived));
+    pack_number(compact->expires, entry->expires, sizeof(compact->expires));
+    compact->token = entry->token;
+    return true;
+}
+
+
+/*
+**  Compress the overview data of an article for a group with compressed
+**  overview, appending the result to the provided buffer.  Each article is
+**  compressed separately, so that it can be retrieved from its index entry
+**  alone, with a preset dictionary of common overview text.
+*/
+static bool
+record_deflate(struct group_data *data, const char *overview, size_t length,
+               struct buffer *out)
+{
+#ifdef HAVE_ZLIB
+    uLong bound;
+    size_t end;
+
+    if (!deflation_ready) {
+        if (deflateInit(&deflation, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            warn("tradindexed: cannot initialize compression");
+            return false;
+        }
+        deflation_ready = true;
+    } else {
+        deflateReset(&deflation);
+    }
+    if (deflateSetDictionary(&deflation, (const Bytef *) data->dictionary,
+                             strlen(data->dictionary)) != Z_OK) {
+        warn("tradindexed: cannot set compression dictionary");
+        return false;
+    }
+    bound = deflateBound(&deflation, length);
+    end = out->used + out->left;
+    buffer_resize(out, end + bound);
+    deflation.next_in = (Bytef *) overview;
+    deflation.avail_in = length;
+    deflation.next_out = (Bytef *) out->data + end;
+    deflation.avail_out = bound;
+    if (deflate(&deflation, Z_FINISH) != Z_STREAM_END) {
+        warn("tradindexed: cannot compress overview data for %s",
+             data->path);
+        return false;
+    }
+    out->left += bound - deflation.avail_out;
+    return true;
+#else
+    warn("tradindexed: cannot compress overview data for %s: INN was built"
+         " without zlib", data->path);
+    return false;
+#endif
+}
+
+
+/*
+**  Decompress the overview data of an article, stored by record_deflate,
+**  into the provided buffer (replacing its contents).
+*/
+static bool
+record_inflate(struct group_data *data, const char *record, size_t length,
+               struct buffer *out)
+{
+#ifdef HAVE_ZLIB
+    int status;
+
+    if (!inflation_ready) {
+        if (inflateInit(&inflation) != Z_OK) {
+            warn("tradindexed: cannot initialize decompression");
+            return false;
+        }
+        inflation_ready = true;
+    } else {
+        inflateReset(&inflation);
+    }
+    out->used = 0;
+    out->left = 0;
+    if (out->size < 4 * length)
+        buffer_resize(out, 4 * length);
+    inflation.next_in = (Bytef *) record;
+    inflation.avail_in = length;
+    while (1) {
+        inflation.next_out = (Bytef *) out->data + out->left;
+        inflation.avail_out = out->size - out->left;
+        status = inflate(&inflation, Z_FINISH);
+        out->left = (char *) inflation.next_out - out->data;
+        if (status == Z_STREAM_END)
+            return true;
+        if (status == Z_NEED_DICT) {
+            if (inflateSetDictionary(&inflation,
+                                     (const Bytef *) data->dictionary,
+                                     strlen(data->dictionary)) != Z_OK)
+                break;
+        } else if (status == Z_BUF_ERROR && inflation.avail_out == 0) {
+            buffer_resize(out, 2 * out->size);
+        } else {
+            break;
+        }
+    }
+    warn("tradindexed: cannot decompress overview data in %s.DAT",
+         data->path);
+    return false;
+#else
+    warn("tradindexed: cannot decompress overview data in %s.DAT: INN was"
+         " built without zlib", data->path);
+    return false;
+#endif
+}
+
+
+/*
+**  Set the format of an index from the start of its contents, or NULL if
+**  the file is empty.
+*/
+static void
+index_format(struct group_data *data, const char *magic)
+{
+    data->compact = false;
+    data->compressed = false;
+    if (magic == NULL)
+        return;
+    if (memcmp(magic, TDX_COMPACT_MAGIC, TDX_COMPACT_MAGIC_LEN) == 0)
+        data->compact = true;
+    else if (memcmp(magic, TDX_COMPRESSED_MAGIC, TDX_COMPACT_MAGIC_LEN) == 0) {
+        data->compact = true;
+        data->compressed = true;
+        compressed_seen = true;
+    }
+}
+
+
 /*
 **  Determine the path to the data files for a particular group and return
 **  it.  Allocates memory which the caller is responsible for freeing.
@@ -181,6 +500,32 @@ file_open_index(struct group_data *data, const char *suffix)
     }
     data->indexinode = st.st_ino;
     fdflag_close_exec(data->indexfd, true);
+
+    /* Find out the format of the index.  A new index gets the format
+       selected in inn.conf. */
+    index_format(data, NULL);
+    if (st.st_size >= TDX_COMPACT_MAGIC_LEN) {
+        char magic[TDX_COMPACT_MAGIC_LEN];
+
+        if (pread(data->indexfd, magic, sizeof(magic), 0) == sizeof(magic))
+            index_format(data, magic);
+    } else if (st.st_size == 0 && data->writable
+               && (innconf->tradindexedcompact
+                   || innconf->tradindexedcompress)) {
+        const char *magic = TDX_COMPACT_MAGIC;
+
+#ifdef HAVE_ZLIB
+        if (innconf->tradindexedcompress)
+            magic = TDX_COMPRESSED_MAGIC;
+#endif
+        if (xpwrite(data->indexfd, magic, TDX_COMPACT_MAGIC_LEN, 0) < 0) {
+            syswarn("tradindexed: cannot write to %s.%s", data->path,
+                    suffix);
+            close(data->indexfd);
+            return false;
+        }
+        index_format(data, magic);
+    }
     return true;
 }
 
@@ -221,6 +566,9 @@ tdx_data_new(const char *group, bool writable)
     data->base = 0;
     data->indexfd = -1;
     data->datafd = -1;
+    data->compact = false;
+    data->compressed = false;
+    data->dictionary = concat(dictionary, " ", group, ":", (char *) 0);
     data->index = NULL;
     data->data = NULL;
     data->indexlen = 0;
@@ -312,7 +660,11 @@ map_index(struct group_data *data)
 	return false;
     data->indexlen = st.st_size;
     data->index = map_file(data->indexfd, data->indexlen, data->path, "IDX");
-    return (data->index == NULL && data->indexlen > 0) ? false : true;
+    if (data->index == NULL)
+        return (data->indexlen > 0) ? false : true;
+    index_format(data, (data->indexlen >= TDX_COMPACT_MAGIC_LEN)
+                           ? data->index : NULL);
+    return true;
 }
 
 
@@ -409,19 +761,65 @@ stale_data(struct group_data *data)
 }
 
 
+/*
+**  Determine whether a group that isn't mapped should be read with pread,
+**  because its index file is smaller than tradindexedpreadsize.  Updates
+**  the length of the index file, and reopens the files if their handles
+**  are stale.
+*/
+static bool
+index_small(struct group_data *data)
+{
+    struct stat st;
+
+    if (innconf->tradindexedpreadsize == 0 || data->index != NULL)
+        return false;
+    if (fstat(data->indexfd, &st) < 0) {
+        if (errno != ESTALE || !file_open_index(data, NULL)
+            || fstat(data->indexfd, &st) < 0)
+            return false;
+    }
+    if (st.st_size >= (off_t) innconf->tradindexedpreadsize * 1024)
+        return false;
+    if (innconf->nfsreader && stale_data(data))
+        if (!file_open_data(data, NULL))
+            return false;
+    data->indexlen = st.st_size;
+    return true;
+}
+
+
 /*
 **  Retrieves the article metainformation stored in the index table (all the
 **  stuff we can return without opening the data file).  Takes the article
-**  number and returns a pointer to the index entry.  Also takes the high
-**  water mark from the group index; this is used to decide whether to attempt
-**  remapping of the index file if the current high water mark is too low.
+**  number and fills in the provided index entry, returning false if there is
+**  none.  Also takes the high water mark from the group index; this is used
+**  to decide whether to attempt remapping of the index file if the current
+**  high water mark is too low.
 */
-const struct index_entry *
-tdx_article_entry(struct group_data *data, ARTNUM article, ARTNUM high)
+bool
+tdx_article_entry(struct group_data *data, ARTNUM article, ARTNUM high,
+                  struct index_entry *entry)
 {
-    struct index_entry *entry;
     ARTNUM offset;
 
+    if (index_small(data)) {
+        char raw[sizeof(struct index_entry)];
+
+        if (high > data->high)
+            data->high = high;
+        if (article < data->base)
+            return false;
+        offset = article - data->base;
+        if (offset >= entry_count(data))
+            return false;
+        if (pread(data->indexfd, raw, entry_size(data),
+                  entry_offset(data, offset)) != (ssize_t) entry_size(data))
+            return false;
+        entry_decode(data, raw, entry);
+        return entry->length != 0;
+    }
+
     if (article > data->high && high > data->high) {
         unmap_index(data);
         map_index(data);
@@ -432,17 +830,143 @@ tdx_article_entry(struct group_data *data, ARTNUM article, ARTNUM high)
         unmap_index(data);
     if (data->index == NULL)
         if (!map_index(data))
-            return NULL;
+            return false;
 
     if (article < data->base)
-        return NULL;
+        return false;
     offset = article - data->base;
-    if (offset >= data->indexlen / sizeof(struct index_entry))
-        return NULL;
-    entry = data->index + offset;
-    if (entry->length == 0)
+    if (offset >= entry_count(data))
+        return false;
+    if (entry_length(data, offset) == 0)
+        return false;
+    entry_get(data, offset, entry);
+    return true;
+}
+
+
+/*
+**  Begin a search of a group read with pread.  The index entries of the
+**  whole range are read at once, and the kernel is asked to read ahead the
+**  part of the data file they point to, which tdx_search then reads a window
+**  at a time.
+*/
+static struct search *
+search_open_pread(struct group_data *data, ARTNUM start, ARTNUM end,
+                  bool indexonly)
+{
+    struct search *search;
+    struct index_entry entry;
+    ARTNUM count, n;
+    size_t size;
+    ssize_t status;
+
+    search = xcalloc(1, sizeof(struct search));
+    search->limit = end - data->base;
+    search->current = (start < data->base) ? 0 : start - data->base;
+    search->data = data;
+    search->data->refcount++;
+    search->inflated = (data->compressed && !indexonly) ? buffer_new() : NULL;
+    search->indexonly = indexonly;
+    search->pread = true;
+    search->first = search->current;
+
+    count = entry_count(data);
+    if (search->limit < count)
+        count = search->limit + 1;
+    if (count <= search->first)
+        return search;
+    size = entry_size(data);
+    search->entries = xmalloc((count - search->first) * size);
+    status = pread(data->indexfd, search->entries,
+                   (count - search->first) * size,
+                   entry_offset(data, search->first));
+    if (status < 0) {
+        syswarn("tradindexed: cannot read %s.IDX", data->path);
+        tdx_search_close(search);
         return NULL;
-    return entry;
+    }
+    search->count = status / size;
+
+#ifdef HAVE_POSIX_FADVISE
+    if (!indexonly) {
+        off_t low = -1, high = 0;
+
+        for (n = 0; n < search->count; n++) {
+            entry_decode(data, search->entries + n * size, &entry);
+            if (entry.length == 0)
+                continue;
+            if (low < 0 || entry.offset < low)
+                low = entry.offset;
+            if (entry.offset + entry.length > high)
+                high = entry.offset + entry.length;
+        }
+        if (low >= 0)
+            posix_fadvise(data->datafd, low, high - low,
+                          POSIX_FADV_WILLNEED);
+    }
+#endif
+    return search;
+}
+
+
+/*
+**  Find the next entry of a search reading the files with pread and read in
+**  its data, if not already in the current window.  Sets overview to the
+**  data, which is only valid until the next call.
+*/
+static bool
+search_next_pread(struct search *search, struct index_entry *entry,
+                  const char **overview)
+{
+    struct group_data *data = search->data;
+    size_t size, length;
+    ssize_t status;
+    ARTNUM n;
+
+    size = entry_size(data);
+    for (; search->current <= search->limit; search->current++) {
+        n = search->current - search->first;
+        if (n >= search->count)
+            return false;
+        entry_decode(data, search->entries + n * size, entry);
+        if (entry->length != 0)
+            break;
+    }
+    if (search->current > search->limit)
+        return false;
+    if (search->indexonly) {
+        *overview = NULL;
+        return true;
+    }
+
+    if (entry->offset < search->windowstart
+        || entry->offset + entry->length
+               > search->windowstart + (off_t) search->windowlen) {
+        length = TDX_READ_WINDOW;
+        if (length < (size_t) entry->length)
+            length = entry->length;
+        if (search->windowsize < length) {
+            search->window = xrealloc(search->window, length);
+            search->windowsize = length;
+        }
+        search->windowlen = 0;
+        status = pread(data->datafd, search->window, length, entry->offset);
+        if (status < 0) {
+            syswarn("tradindexed: cannot read %s.DAT", data->path);
+            return false;
+        }
+        if ((size_t) status < (size_t) entry->length) {
+            warn("Invalid or inaccessible entry for article %lu in %s.IDX:"
+                 " offset %lu length %lu", search->current + data->base,
+                 data->path, (unsigned long) entry->offset,
+                 (unsigned long) entry->length);
+            return false;
+        }
+        search->windowstart = entry->offset;
+        search->windowlen = status;
+    }
+    *overview = search->window + (entry->offset - search->windowstart);
+    return true;
 }
 
 
@@ -453,7 +977,8 @@ tdx_article_entry(struct group_data *data, ARTNUM article, ARTNUM high)
 **  water mark is too low.
 */
 struct search *
-tdx_search_open(struct group_data *data, ARTNUM start, ARTNUM end, ARTNUM high)
+tdx_search_open(struct group_data *data, ARTNUM start, ARTNUM end, ARTNUM high,
+                bool indexonly)
 {
     struct search *search;
 
@@ -462,6 +987,14 @@ tdx_search_open(struct group_data *data, ARTNUM start, ARTNUM end, ARTNUM high)
     if (end < start)
         return NULL;
 
+    if (index_small(data)) {
+        if (high > data->high)
+            data->high = high;
+        if (start > data->high)
+            return NULL;
+        return search_open_pread(data, start, end, indexonly);
+    }
+
     if ((end > data->high && high > data->high) || data->remapoutoforder) {
         data->remapoutoforder = false;
         unmap_data(data);
@@ -478,17 +1011,21 @@ tdx_search_open(struct group_data *data, ARTNUM start, ARTNUM end, ARTNUM high)
     if (data->index == NULL)
         if (!map_index(data))
             return NULL;
-    if (innconf->nfsreader && stale_data(data))
-	unmap_data(data);
-    if (data->data == NULL)
-        if (!map_data(data))
-            return NULL;
+    if (!indexonly) {
+        if (innconf->nfsreader && stale_data(data))
+            unmap_data(data);
+        if (data->data == NULL)
+            if (!map_data(data))
+                return NULL;
+    }
 
-    search = xmalloc(sizeof(struct search));
+    search = xcalloc(1, sizeof(struct search));
     search->limit = end - data->base;
     search->current = (start < data->base) ? 0 : start - data->base;
     search->data = data;
     search->data->refcount++;
+    search->inflated = (data->compressed && !indexonly) ? buffer_new() : NULL;
+    search->indexonly = indexonly;
 
     return search;
 }
@@ -500,24 +1037,35 @@ tdx_search_open(struct group_data *data, ARTNUM start, ARTNUM end, ARTNUM high)
 bool
 tdx_search(struct search *search, struct article *artdata)
 {
-    struct index_entry *entry;
-    size_t max;
+    struct index_entry entry;
+    const char *overview;
+    ARTNUM count;
 
     if (search == NULL || search->data == NULL)
         return false;
-    if (search->data->index == NULL || search->data->data == NULL)
+    if (search->pread) {
+        if (!search_next_pread(search, &entry, &overview))
+            return false;
+        goto found;
+    }
+    if (search->data->index == NULL)
+        return false;
+    if (search->data->data == NULL && !search->indexonly)
         return false;
 
-    max = (search->data->indexlen / sizeof(struct index_entry)) - 1;
-    entry = search->data->index + search->current;
-    while (search->current <= search->limit && search->current <= max) {
-        if (entry->length != 0)
+    count = entry_count(search->data);
+    while (search->current <= search->limit && search->current < count) {
+        if (entry_length(search->data, search->current) != 0)
             break;
         search->current++;
-        entry++;
     }
-    if (search->current > search->limit || search->current > max)
+    if (search->current > search->limit || search->current >= count)
         return false;
+    entry_get(search->data, search->current, &entry);
+    if (search->indexonly) {
+        overview = NULL;
+        goto found;
+    }
 
     /* There is a small chance that remapping the data file could make this
        offset accessible, but changing the memory location in the middle of
@@ -525,28 +1073,52 @@ tdx_search(struct search *search, struct article *artdata)
        seems not to be an issue in limited testing, although write caching
        that leads to on-disk IDX and DAT being out of sync could trigger a
        problem here. */
-    if (entry->offset + entry->length > search->data->datalen) {
+    if (entry.offset + entry.length > search->data->datalen) {
         search->data->remapoutoforder = true;
         warn("Invalid or inaccessible entry for article %lu in %s.IDX:"
              " offset %lu length %lu datalength %lu",
              search->current + search->data->base, search->data->path,
-             (unsigned long) entry->offset, (unsigned long) entry->length,
+             (unsigned long) entry.offset, (unsigned long) entry.length,
              (unsigned long) search->data->datalen);
         return false;
     }
+    overview = search->data->data + entry.offset;
 
+ found:
     artdata->number = search->current + search->data->base;
-    artdata->overview = search->data->data + entry->offset;
-    artdata->overlen = entry->length;
-    artdata->token = entry->token;
-    artdata->arrived = entry->arrived;
-    artdata->expires = entry->expires;
+    artdata->overview = overview;
+    artdata->overlen = (overview == NULL) ? 0 : entry.length;
+    if (search->inflated != NULL) {
+        if (!record_inflate(search->data, artdata->overview,
+                            artdata->overlen, search->inflated))
+            return false;
+        artdata->overview = search->inflated->data;
+        artdata->overlen = search->inflated->left;
+    }
+    artdata->token = entry.token;
+    artdata->arrived = entry.arrived;
+    artdata->expires = entry.expires;
 
     search->current++;
     return true;
 }
 
 
+/*
+**  Return whether the data returned by tdx_search may be overwritten by the
+**  next call, which is the case for compressed overview and for groups read
+**  with pread.  Conservatively true for the rest of the life of the process
+**  once a compressed group has been opened (or when new groups are going to
+**  be compressed).
+*/
+bool
+tdx_search_static(void)
+{
+    return compressed_seen || innconf->tradindexedcompress
+           || innconf->tradindexedpreadsize > 0;
+}
+
+
 /*
 **  End an overview search.
 */
@@ -558,6 +1130,10 @@ tdx_search_close(struct search *search)
         if (search->data->refcount == 0)
             tdx_data_close(search->data);
     }
+    if (search->inflated != NULL)
+        buffer_free(search->inflated);
+    free(search->entries);
+    free(search->window);
     free(search);
 }
 
@@ -584,45 +1160,122 @@ index_base(ARTNUM artnum)
 bool
 tdx_data_store(struct group_data *data, const struct article *article)
 {
+    return tdx_data_store_batch(data, article, 1);
+}
+
+
+/*
+**  Store the data for several articles into the overview files for a group,
+**  with the same assumptions as tdx_data_store.  The data of all of them is
+**  appended with a single writev (or one per IOV_MAX articles), and the index
+**  entries are written with one pwrite for each run of consecutive article
+**  numbers.  For a group with compressed overview, the data is compressed
+**  first into a separate buffer.
+*/
+bool
+tdx_data_store_batch(struct group_data *data, const struct article *articles,
+                     size_t count)
+{
+    static char *entries = NULL;
+    static struct iovec *iov = NULL;
+    static struct buffer *packed = NULL;
+    static size_t size = 0;
+    const struct article *article;
     struct index_entry entry;
     off_t offset;
+    size_t i, start, n, length, end;
+    ARTNUM low;
 
     if (!data->writable)
         return false;
+    if (count == 0)
+        return true;
+    for (low = articles[0].number, i = 1; i < count; i++)
+        if (articles[i].number < low)
+            low = articles[i].number;
     if (data->base == 0)
-        data->base = index_base(article->number);
-    if (data->base > article->number) {
+        data->base = index_base(low);
+    if (data->base > low) {
         warn("tradindexed: cannot add %lu to %s.IDX, base == %lu",
-             article->number, data->path, data->base);
+             low, data->path, data->base);
         return false;
     }
-
-    /* Write out the data and fill in the index entry. */
-    memset(&entry, 0, sizeof(entry));
-    if (xwrite(data->datafd, article->overview, article->overlen) < 0) {
-        syswarn("tradindexed: cannot append %lu of data for %lu to %s.DAT",
-                (unsigned long) article->overlen, article->number,
-                data->path);
-        return false;
+    if (count > size) {
+        size = count;
+        entries = xreallocarray(entries, size, sizeof(struct index_entry));
+        iov = xreallocarray(iov, size, sizeof(struct iovec));
     }
-    entry.offset = lseek(data->datafd, 0, SEEK_CUR);
-    if (entry.offset < 0) {
+    length = entry_size(data);
+
+    /* The data file is opened for append and the caller holds the write
+       lock on the group, so the data goes at the current end of the file. */
+    offset = lseek(data->datafd, 0, SEEK_END);
+    if (offset < 0) {
         syswarn("tradindexed: cannot get offset for article %lu in %s.DAT",
-                article->number, data->path);
+                articles[0].number, data->path);
         return false;
     }
-    entry.length = article->overlen;
-    entry.offset -= entry.length;
-    entry.arrived = article->arrived;
-    entry.expires = article->expires;
-    entry.token = article->token;
-
-    /* Write out the index entry. */
-    offset = (article->number - data->base) * sizeof(struct index_entry);
-    if (xpwrite(data->indexfd, &entry, sizeof(entry), offset) < 0) {
-        syswarn("tradindexed: cannot write index record for %lu in %s.IDX",
-                article->number, data->path);
-        return false;
+
+    /* Fill in the index entries and write out the data.  The iovecs for
+       compressed data are only set once the buffer won't move anymore. */
+    if (data->compressed) {
+        if (packed == NULL)
+            packed = buffer_new();
+        buffer_set(packed, NULL, 0);
+    }
+    memset(&entry, 0, sizeof(entry));
+    for (i = 0; i < count; i++) {
+        article = &articles[i];
+        iov[i].iov_base = (char *) article->overview;
+        iov[i].iov_len = article->overlen;
+        if (data->compressed) {
+            end = packed->left;
+            if (!record_deflate(data, article->overview, article->overlen,
+                                packed))
+                return false;
+            iov[i].iov_len = packed->left - end;
+        }
+        entry.offset = offset;
+        entry.length = iov[i].iov_len;
+        entry.arrived = article->arrived;
+        entry.expires = article->expires;
+        entry.token = article->token;
+        if (!entry_set(data, &entry, entries + i * length)) {
+            warn("tradindexed: cannot store %lu in compact %s.IDX:"
+                 " offset %lu length %lu", article->number, data->path,
+                 (unsigned long) entry.offset, (unsigned long) entry.length);
+            return false;
+        }
+        offset += iov[i].iov_len;
+    }
+    if (data->compressed)
+        for (end = 0, i = 0; i < count; i++) {
+            iov[i].iov_base = packed->data + end;
+            end += iov[i].iov_len;
+        }
+    for (start = 0; start < count; start += n) {
+        n = count - start;
+        if (n > IOV_MAX)
+            n = IOV_MAX;
+        if (xwritev(data->datafd, &iov[start], n) < 0) {
+            syswarn("tradindexed: cannot append data for %lu to %s.DAT",
+                    articles[start].number, data->path);
+            return false;
+        }
+    }
+
+    /* Write out the index entries. */
+    for (start = 0; start < count; start += n) {
+        for (n = 1; start + n < count; n++)
+            if (articles[start + n].number != articles[start].number + n)
+                break;
+        offset = entry_offset(data, articles[start].number - data->base);
+        if (xpwrite(data->indexfd, entries + start * length, n * length,
+                    offset) < 0) {
+            syswarn("tradindexed: cannot write index record for %lu in"
+                    " %s.IDX", articles[start].number, data->path);
+            return false;
+        }
     }
     return true;
 }
@@ -643,8 +1296,8 @@ tdx_data_cancel(struct group_data *data, ARTNUM artnum)
         return false;
     if (data->base == 0 || artnum < data->base || artnum > data->high)
         return false;
-    offset = (artnum - data->base) * sizeof(struct index_entry);
-    if (xpwrite(data->indexfd, &empty, sizeof(empty), offset) < 0) {
+    offset = entry_offset(data, artnum - data->base);
+    if (xpwrite(data->indexfd, &empty, entry_size(data), offset) < 0) {
         syswarn("tradindexed: cannot cancel index record for %lu in %s.IDX",
                 artnum, data->path);
         return false;
@@ -694,15 +1347,23 @@ tdx_data_pack_start(struct group_data *data, ARTNUM artnum)
     if (!map_index(data))
         goto fail;
 
-    /* Write the contents of the old index file to the new index file. */
-    if (lseek(fd, delta * sizeof(struct index_entry), SEEK_SET) < 0) {
+    /* Write the contents of the old index file to the new index file,
+       keeping its format. */
+    if (data->compact)
+        if (xwrite(fd, data->index, TDX_COMPACT_MAGIC_LEN) < 0) {
+            syswarn("tradindexed: cannot write to %s.IDX-NEW", data->path);
+            goto fail;
+        }
+    if (lseek(fd, entry_offset(data, delta), SEEK_SET) < 0) {
         syswarn("tradindexed: cannot seek in %s.IDX-NEW", data->path);
         goto fail;
     }
-    if (xwrite(fd, data->index, data->indexlen) < 0) {
-        syswarn("tradindexed: cannot write to %s.IDX-NEW", data->path);
-        goto fail;
-    }
+    if (data->indexlen > entry_start(data))
+        if (xwrite(fd, (char *) data->index + entry_start(data),
+                   data->indexlen - entry_start(data)) < 0) {
+            syswarn("tradindexed: cannot write to %s.IDX-NEW", data->path);
+            goto fail;
+        }
     if (close(fd) < 0) {
         syswarn("tradindexed: cannot close %s.IDX-NEW", data->path);
         goto fail;
@@ -832,6 +1493,34 @@ tdx_data_rebuild_finish(const char *group)
 }
 
 
+/*
+**  Return whether an article should be removed from the overview of a group
+**  by expire.
+*/
+static bool
+article_expired(const char *group, struct article *article,
+                struct history *history)
+{
+    ARTHANDLE *ah;
+
+    if (!SMprobe(EXPENSIVESTAT, &article->token, NULL) || OVstatall) {
+        ah = SMretrieve(article->token, RETR_STAT);
+        if (ah == NULL)
+            return true;
+        SMfreearticle(ah);
+    } else {
+        if (!OVhisthasmsgid(history, article->overview))
+            return true;
+    }
+    if (innconf->groupbaseexpiry)
+        if (OVgroupbasedexpire(article->token, group, article->overview,
+                               article->overlen, article->arrived,
+                               article->expires))
+            return true;
+    return false;
+}
+
+
 /*
 **  Do the main work of expiring a group.  Step through each article in the
 **  group, only writing the unexpired entries out to the new group.  There's
@@ -839,6 +1528,9 @@ tdx_data_rebuild_finish(const char *group)
 **  so that the files don't have to be rewritten, or newsgroups where all the
 **  data at the end of the file is still good and just needs to be moved
 **  as-is.
+**
+**  If history is NULL, every article is kept; this is used to rewrite the
+**  files of a group in the index format currently selected in inn.conf.
 */
 bool
 tdx_data_expire_start(const char *group, struct group_data *data,
@@ -858,29 +1550,15 @@ tdx_data_expire_start(const char *group, struct group_data *data,
        so that we can treat all errors on opening a search as errors. */
     high = index->high > 0 ? index->high : data->base;
     new_data->high = high;
-    search = tdx_search_open(data, data->base, high, high);
+    search = tdx_search_open(data, data->base, high, high, false);
     if (search == NULL)
         goto fail;
 
     /* Loop through all of the articles in the group, adding the ones that are
        still valid to the new index. */
     while (tdx_search(search, &article)) {
-        ARTHANDLE *ah;
-
-        if (!SMprobe(EXPENSIVESTAT, &article.token, NULL) || OVstatall) {
-            ah = SMretrieve(article.token, RETR_STAT);
-            if (ah == NULL)
-                continue;
-            SMfreearticle(ah);
-        } else {
-            if (!OVhisthasmsgid(history, article.overview))
-                continue;
-        }
-        if (innconf->groupbaseexpiry)
-            if (OVgroupbasedexpire(article.token, group, article.overview,
-                                   article.overlen, article.arrived,
-                                   article.expires))
-                continue;
+        if (history != NULL && article_expired(group, &article, history))
+            continue;
         if (!tdx_data_store(new_data, &article))
             goto fail;
         if (index->base == 0) {
@@ -903,6 +1581,179 @@ tdx_data_expire_start(const char *group, struct group_data *data,
 }
 
 
+/*
+**  Give the blocks of a range of a file back to the file system, keeping its
+**  size so that the offsets of the rest of the data stay valid.  Reading the
+**  range afterwards returns zeroes.  Returns false and sets errno if the
+**  system or the file system doesn't support it.
+*/
+static bool
+punch_hole(int fd, off_t start, off_t end)
+{
+    if (end <= start)
+        return true;
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start,
+                     end - start) == 0;
+#else
+    errno = EOPNOTSUPP;
+    return false;
+#endif
+}
+
+
+/*
+**  Return whether the files of a group are in the format selected in
+**  inn.conf.
+*/
+static bool
+format_current(const struct group_data *data)
+{
+    bool compressed = false;
+
+#ifdef HAVE_ZLIB
+    compressed = innconf->tradindexedcompress;
+#endif
+    return data->compressed == compressed
+           && data->compact == (innconf->tradindexedcompact
+                                || innconf->tradindexedcompress);
+}
+
+
+/*
+**  Expire a group in place, without rewriting its files.  The index entries
+**  of the expired articles are cleared as tdx_data_cancel does.  The space
+**  their overview data used in the data file, and the index entries below
+**  the new low water mark, are then given back to the file system by
+**  punching holes, so that the expire I/O follows the amount of expired data
+**  rather than the size of the group.  Fills in the provided group_entry as
+**  tdx_data_expire_start does, keeping the base and the index file.
+**
+**  Nothing is changed and repack is set to true if the group should be
+**  rewritten by tdx_data_expire_start instead:  when its files aren't in the
+**  format selected in inn.conf, or when more than tradindexedrepack percent
+**  of its data file or of its index would be wasted once the expired
+**  articles are gone.  Where holes can't be punched, the space is only
+**  recovered by that rewrite.
+*/
+bool
+tdx_data_expire_incremental(const char *group, struct group_data *data,
+                            struct group_entry *index,
+                            struct history *history, bool *repack)
+{
+    static const struct index_entry empty;
+    struct search *search;
+    struct article article;
+    struct index_entry entry;
+    struct stat st;
+    ARTNUM *expired = NULL;
+    off_t *holes = NULL;
+    size_t nexpired = 0, nholes = 0, size = 0, i;
+    unsigned long long live = 0;
+    ARTNUM high, total, kept = 0, first = 0;
+    unsigned long threshold = innconf->tradindexedrepack;
+    bool punched = true;
+
+    *repack = false;
+    if (!data->writable)
+        return false;
+    if (!format_current(data)) {
+        *repack = true;
+        return true;
+    }
+
+    /* Map the index so that the entries of the articles returned by the
+       search can be read, as with a pread search it may not be.  Hold a
+       reference so that closing the search doesn't close the group. */
+    unmap_index(data);
+    if (!map_index(data))
+        return false;
+    high = index->high > 0 ? index->high : data->base;
+    search = tdx_search_open(data, data->base, high, high, false);
+    if (search == NULL)
+        return false;
+    data->refcount++;
+
+    /* Find the expired articles, and the ranges of the data file they use,
+       merging the ranges that follow each other.  holes holds pairs of start
+       and end offsets. */
+    while (tdx_search(search, &article)) {
+        entry_get(data, article.number - data->base, &entry);
+        if (!article_expired(group, &article, history)) {
+            live += entry.length;
+            if (first == 0)
+                first = article.number;
+            if (article.number > index->high)
+                index->high = article.number;
+            kept++;
+            continue;
+        }
+        if (nexpired == size) {
+            size = (size == 0) ? 256 : size * 2;
+            expired = xreallocarray(expired, size, sizeof(ARTNUM));
+            holes = xreallocarray(holes, size * 2, sizeof(off_t));
+        }
+        expired[nexpired++] = article.number;
+        if (nholes > 0 && holes[nholes * 2 - 1] == entry.offset)
+            holes[nholes * 2 - 1] = entry.offset + entry.length;
+        else {
+            holes[nholes * 2] = entry.offset;
+            holes[nholes * 2 + 1] = entry.offset + entry.length;
+            nholes++;
+        }
+    }
+    tdx_search_close(search);
+    data->refcount--;
+
+    /* Decide whether the group should rather be rewritten. */
+    if (fstat(data->datafd, &st) < 0) {
+        syswarn("tradindexed: cannot stat %s.DAT", data->path);
+        goto fail;
+    }
+    total = entry_count(data);
+    if ((unsigned long long) st.st_size > live
+        && (st.st_size - live) * 100 > (unsigned long long) st.st_size
+                                           * threshold)
+        *repack = true;
+    if (total > kept && (total - kept) * 100 > total * threshold)
+        *repack = true;
+    if (*repack) {
+        free(expired);
+        free(holes);
+        return true;
+    }
+
+    /* Clear the index entries first, so that no search finds an article
+       whose data is gone, and then give back the space. */
+    for (i = 0; i < nexpired; i++)
+        if (xpwrite(data->indexfd, &empty, entry_size(data),
+                    entry_offset(data, expired[i] - data->base)) < 0) {
+            syswarn("tradindexed: cannot clear index record for %lu in"
+                    " %s.IDX", expired[i], data->path);
+            goto fail;
+        }
+    for (i = 0; i < nholes && punched; i++)
+        punched = punch_hole(data->datafd, holes[i * 2], holes[i * 2 + 1]);
+    if (punched && first > data->base)
+        punched = punch_hole(data->indexfd, entry_offset(data, 0),
+                             entry_offset(data, first - data->base));
+    if (!punched && errno != EOPNOTSUPP && errno != ENOSYS)
+        syswarn("tradindexed: cannot free expired space of %s", data->path);
+
+    index->base = data->base;
+    index->low = first;
+    index->count = kept;
+    free(expired);
+    free(holes);
+    return true;
+
+ fail:
+    free(expired);
+    free(holes);
+    return false;
+}
+
+
 /*
 **  Close the data files for a group and free the data structure.
 */
@@ -915,6 +1766,7 @@ tdx_data_close(struct group_data *data)
         close(data->indexfd);
     if (data->datafd >= 0)
         close(data->datafd);
+    free(data->dictionary);
     free(data->path);
     free(data);
 }
@@ -958,36 +1810,35 @@ tdx_data_delete(const char *group, const char *suffix)
 void
 tdx_data_index_dump(struct group_data *data, FILE *output)
 {
-    ARTNUM current;
-    struct index_entry *entry, *end;
+    ARTNUM n, count;
+    struct index_entry entry;
 
     if (data->index == NULL)
         if (!map_index(data))
             return;
 
-    current = data->base;
-    end = data->index + (data->indexlen / sizeof(struct index_entry));
-    for (entry = data->index; entry < end; entry++) {
-        fprintf(output, "%lu %lu %lu %lu %lu %s\n", current,
-                (unsigned long) entry->offset, (unsigned long) entry->length,
-                (unsigned long) entry->arrived,
-                (unsigned long) entry->expires, TokenToText(entry->token));
-        current++;
+    count = entry_count(data);
+    for (n = 0; n < count; n++) {
+        entry_get(data, n, &entry);
+        fprintf(output, "%lu %lu %lu %lu %lu %s\n", data->base + n,
+                (unsigned long) entry.offset, (unsigned long) entry.length,
+                (unsigned long) entry.arrived,
+                (unsigned long) entry.expires, TokenToText(entry.token));
     }
 }
 
 
 /*
-**  Audit a specific index entry for a particular article.  If there's
-**  anything wrong with it, we delete it; to repair a particular group, it's
+**  Audit a specific index entry for a particular article.  Takes the entry
+**  number n and its decoded contents.  If there's anything wrong with it, we
+**  delete it (setting its length to 0); to repair a particular group, it's
 **  best to just regenerate it from scratch.
 */
 static void
-entry_audit(struct group_data *data, struct index_entry *entry,
+entry_audit(struct group_data *data, ARTNUM n, struct index_entry *entry,
             const char *group, ARTNUM article, bool fix)
 {
-    struct index_entry new_entry;
-    off_t offset;
+    char buffer[sizeof(struct index_entry)];
 
     if (entry->length < 0) {
         warn("tradindexed: negative length %d in %s:%lu", entry->length,
@@ -1012,6 +1863,21 @@ entry_audit(struct group_data *data, struct index_entry *entry,
             goto clear;
         return;
     }
+    if (data->compressed) {
+        static struct buffer *inflated = NULL;
+
+        if (inflated == NULL)
+            inflated = buffer_new();
+        if (!record_inflate(data, data->data + entry->offset, entry->length,
+                            inflated)
+            || !overview_check(inflated->data, inflated->left, article)) {
+            warn("tradindexed: malformed overview data for %s:%lu", group,
+                 article);
+            if (fix)
+                goto clear;
+        }
+        return;
+    }
     if (!overview_check(data->data + entry->offset, entry->length, article)) {
         warn("tradindexed: malformed overview data for %s:%lu", group,
              article);
@@ -1021,11 +1887,11 @@ entry_audit(struct group_data *data, struct index_entry *entry,
     return;
 
  clear:
-    new_entry = *entry;
-    new_entry.offset = 0;
-    new_entry.length = 0;
-    offset = (entry - data->index) * sizeof(struct index_entry);
-    if (xpwrite(data->indexfd, &new_entry, sizeof(new_entry), offset) != 0)
+    entry->offset = 0;
+    entry->length = 0;
+    entry_set(data, entry, buffer);
+    if (xpwrite(data->indexfd, buffer, entry_size(data),
+                entry_offset(data, n)) < 0)
         warn("tradindexed: unable to repair %s:%lu", group, article);
 }
 
@@ -1039,7 +1905,7 @@ void
 tdx_data_audit(const char *group, struct group_entry *index, bool fix)
 {
     struct group_data *data;
-    struct index_entry *entry;
+    struct index_entry entry;
     long count;
     off_t expected;
     unsigned long entries, current;
@@ -1066,8 +1932,8 @@ tdx_data_audit(const char *group, struct group_entry *index, bool fix)
     }
 
     /* Check the index size. */
-    entries = data->indexlen / sizeof(struct index_entry);
-    expected = entries * sizeof(struct index_entry);
+    entries = entry_count(data);
+    expected = (entries == 0) ? entry_start(data) : entry_offset(data, entries);
     if (data->indexlen != expected) {
         warn("tradindexed: %lu bytes of trailing trash in %s.IDX",
              (unsigned long)(data->indexlen - expected), data->path);
@@ -1085,11 +1951,11 @@ tdx_data_audit(const char *group, struct group_entry *index, bool fix)
        the count in the index and verify that the low water mark is
        correct. */
     for (current = 0, count = 0; current < entries; current++) {
-        entry = &data->index[current];
-        if (entry->length == 0)
+        if (entry_length(data, current) == 0)
             continue;
-        entry_audit(data, entry, group, index->base + current, fix);
-        if (entry->length != 0) {
+        entry_get(data, current, &entry);
+        entry_audit(data, current, &entry, group, index->base + current, fix);
+        if (entry.length != 0) {
             if (low == 0)
                 low = index->base + current;
             count++;
@@ -86,7 +86,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 
 #include "inn/fdflag.h"
@@ -124,6 +126,8 @@ static bool index_map(struct group_index *);
 static bool index_maybe_remap(struct group_index *, long loc);
 static void index_unmap(struct group_index *);
 static bool index_expand(struct group_index *);
+static long index_buckets(struct group_index *);
+static int *index_head(struct group_index *, long bucket);
 static long index_find(struct group_index *, const char *group);
 
 
@@ -367,12 +371,15 @@ index_expand(struct group_index *index)
         return false;
     }
 
-    /* If the magic isn't right, assume this is a new index file. */
-    if (index->header->magic != TDX_MAGIC) {
-        index->header->magic = TDX_MAGIC;
+    /* If the magic isn't right, assume this is a new index file, which gets
+       a growable hash table. */
+    if (index->header->magic != TDX_MAGIC
+        && index->header->magic != TDX_MAGIC_GROWABLE) {
         index->header->freelist.recno = -1;
         for (i = 0; i < TDX_HASH_SIZE; i++)
             index->header->hash[i].recno = -1;
+        index->entries[0].extra.table.buckets = TDX_HASH_SIZE;
+        index->header->magic = TDX_MAGIC_GROWABLE;
     }
 
     /* Walk the new entries back to front, adding them to the free list. */
@@ -428,16 +435,64 @@ tdx_index_open(bool writable)
 
 
 /*
-**  Given a group name hash, return an index into the hash table in the
-**  group.index header.
+**  Given a group name hash and the number of buckets in use, return the
+**  bucket of the hash table that the group belongs to.  This is linear
+**  hashing: the table doubles in size one bucket at a time, so the buckets
+**  before the next one to split and those added since the table last
+**  doubled use twice as many buckets as the others.  With TDX_HASH_SIZE
+**  buckets, this is the fixed hash table of older group.index files.
 */
 static long
-index_bucket(HASH hash)
+index_bucket(HASH hash, long buckets)
 {
-    unsigned int bucket;
+    unsigned int value;
+    unsigned long size, bucket;
+
+    memcpy(&value, &hash, sizeof(value));
+    for (size = TDX_HASH_SIZE; size * 2 <= (unsigned long) buckets; size *= 2)
+        ;
+    bucket = value % size;
+    if (bucket < buckets - size)
+        bucket = value % (size * 2);
+    return bucket;
+}
+
+
+/*
+**  Return the number of buckets of the hash table in use.
+*/
+static long
+index_buckets(struct group_index *index)
+{
+    int buckets;
+
+    if (index->header->magic != TDX_MAGIC_GROWABLE || index->count == 0)
+        return TDX_HASH_SIZE;
+    buckets = index->entries[0].extra.table.buckets;
+    return (buckets < TDX_HASH_SIZE) ? TDX_HASH_SIZE : buckets;
+}
+
+
+/*
+**  Return a pointer to the location of the first entry of a bucket of the
+**  hash table, remapping the index file if needed, or NULL if the bucket is
+**  out of range.  Any pointer into the index may be invalidated.
+*/
+static int *
+index_head(struct group_index *index, long bucket)
+{
+    long loc;
 
-    memcpy(&bucket, &hash, sizeof(bucket));
-    return bucket % TDX_HASH_SIZE;
+    if (bucket < TDX_HASH_SIZE)
+        return &index->header->hash[bucket].recno;
+    loc = bucket - TDX_HASH_SIZE;
+    if (!index_maybe_remap(index, loc))
+        return NULL;
+    if (index->header == NULL || loc >= index->count) {
+        warn("tradindexed: bucket %ld out of range", bucket);
+        return NULL;
+    }
+    return &index->entries[loc].extra.table.bucket.recno;
 }
 
 
@@ -471,37 +526,98 @@ static void
 index_add(struct group_index *index, struct group_entry *entry)
 {
     long bucket, loc;
+    int *head;
 
-    bucket = index_bucket(entry->hash);
+    bucket = index_bucket(entry->hash, index_buckets(index));
     loc = entry_loc(index, entry);
-    if (loc == index->header->hash[bucket].recno) {
+    head = index_head(index, bucket);
+    if (head == NULL)
+        return;
+    entry = &index->entries[loc];
+    if (loc == *head) {
         warn("tradindexed: refusing to add a loop for %ld in bucket %ld",
              loc, bucket);
         return;
     }
-    entry->next.recno = index->header->hash[bucket].recno;
-    index->header->hash[bucket].recno = entry_loc(index, entry);
-    inn_msync_page(&index->header->hash[bucket], sizeof(struct loc), MS_ASYNC);
+    entry->next.recno = *head;
+    *head = loc;
+    inn_msync_page(head, sizeof(*head), MS_ASYNC);
     inn_msync_page(entry, sizeof(*entry), MS_ASYNC);
 }
 
 
 /*
-**  Find a group in the index file, returning the group number for that group
-**  or -1 if the group can't be found.
+**  Split up to the given number of buckets of a growable hash table, as long
+**  as there are fewer buckets than entries.  Each split moves the entries of
+**  the next bucket to split that now hash to the new bucket at the end of
+**  the table, and then only counts the new bucket in.  Readers don't lock,
+**  so one may be walking the split bucket and miss an entry that was moved
+**  away; index_find then looks again under a read lock.  The caller is
+**  expected to hold the write lock.
+*/
+static void
+index_rehash(struct group_index *index, long splits)
+{
+    long buckets, size, current, next;
+    int *head, *parent;
+    struct group_entry *entry;
+
+    if (index->header->magic != TDX_MAGIC_GROWABLE)
+        return;
+    for (; splits > 0; splits--) {
+        buckets = index_buckets(index);
+        if (buckets >= index->count)
+            return;
+        for (size = TDX_HASH_SIZE; size * 2 <= buckets; size *= 2)
+            ;
+        head = index_head(index, buckets);
+        if (head == NULL)
+            return;
+        *head = -1;
+        parent = index_head(index, buckets - size);
+        if (parent == NULL)
+            return;
+        current = *parent;
+        while (current >= 0 && current < index->count) {
+            entry = &index->entries[current];
+            next = entry->next.recno;
+            if (index_bucket(entry->hash, buckets + 1) == buckets) {
+                *parent = next;
+                inn_msync_page(parent, sizeof(*parent), MS_ASYNC);
+                entry->next.recno = *head;
+                *head = current;
+                inn_msync_page(entry, sizeof(*entry), MS_ASYNC);
+            } else {
+                parent = &entry->next.recno;
+            }
+            if (next == current)
+                break;
+            current = next;
+        }
+        inn_msync_page(head, sizeof(*head), MS_ASYNC);
+        index->entries[0].extra.table.buckets = buckets + 1;
+        inn_msync_page(&index->entries[0], sizeof(struct group_entry),
+                       MS_ASYNC);
+    }
+}
+
+
+/*
+**  Find a group in the index file by the hash of its name, returning the
+**  group number for that group or -1 if the group can't be found.
 */
 static long
-index_find(struct group_index *index, const char *group)
+index_find_hash(struct group_index *index, HASH hash)
 {
-    HASH hash;
     long loc;
+    int *head;
 
     if (index->header == NULL || index->entries == NULL)
         return -1;
-    hash = Hash(group, strlen(group));
-    if (innconf->nfsreader && !index_maybe_remap(index, LONG_MAX))
-	return -1;
-    loc = index->header->hash[index_bucket(hash)].recno;
+    head = index_head(index, index_bucket(hash, index_buckets(index)));
+    if (head == NULL)
+        return -1;
+    loc = *head;
 
     while (loc >= 0) {
         struct group_entry *entry;
@@ -529,6 +645,33 @@ index_find(struct group_index *index, const char *group)
 }
 
 
+/*
+**  Find a group in the index file, returning the group number for that group
+**  or -1 if the group can't be found.  If it isn't found in a growable hash
+**  table, look again under a read lock in case its bucket was being split.
+*/
+static long
+index_find(struct group_index *index, const char *group)
+{
+    HASH hash;
+    long loc;
+
+    if (index->header == NULL || index->entries == NULL)
+        return -1;
+    hash = Hash(group, strlen(group));
+    if (innconf->nfsreader && !index_maybe_remap(index, LONG_MAX))
+	return -1;
+    loc = index_find_hash(index, hash);
+    if (loc == -1 && index->header != NULL
+        && index->header->magic == TDX_MAGIC_GROWABLE) {
+        index_lock(index->fd, INN_LOCK_READ);
+        loc = index_find_hash(index, hash);
+        index_lock(index->fd, INN_LOCK_UNLOCK);
+    }
+    return loc;
+}
+
+
 /*
 **  Add a given entry to the free list.
 */
@@ -554,7 +697,9 @@ index_unlink_hash(struct group_index *index, HASH hash)
     int *parent;
     long current;
 
-    parent = &index->header->hash[index_bucket(hash)].recno;
+    parent = index_head(index, index_bucket(hash, index_buckets(index)));
+    if (parent == NULL)
+        return -1;
     current = *parent;
 
     while (current >= 0) {
@@ -564,7 +709,10 @@ index_unlink_hash(struct group_index *index, HASH hash)
             if (!index_maybe_remap(index, current)) {
                 return -1;
             }
-            parent = &index->header->hash[index_bucket(hash)].recno;
+            parent = index_head(index,
+                                index_bucket(hash, index_buckets(index)));
+            if (parent == NULL)
+                return -1;
             current = *parent;
             if (current < 0 || current >= index->count) {
                 syswarn("tradindexed: entry %ld out of range", current);
@@ -680,6 +828,7 @@ tdx_index_add(struct group_index *index, const char *group, ARTNUM low,
     entry->indexinode = data->indexinode;
     tdx_data_close(data);
     index_add(index, entry);
+    index_rehash(index, 2);
 
     index_lock(index->fd, INN_LOCK_UNLOCK);
     return true;
@@ -809,12 +958,28 @@ bool
 tdx_data_add(struct group_index *index, struct group_entry *entry,
              struct group_data *data, const struct article *article)
 {
-    ARTNUM old_base;
+    return tdx_data_add_batch(index, entry, data, article, 1);
+}
+
+
+/*
+**  The same for several articles in the same group, which are stored with a
+**  single call to tdx_data_store_batch while holding the lock on the group.
+*/
+bool
+tdx_data_add_batch(struct group_index *index, struct group_entry *entry,
+                   struct group_data *data, const struct article *articles,
+                   size_t count)
+{
+    ARTNUM old_base, low;
     ino_t old_inode;
     ptrdiff_t offset = entry - index->entries;
+    size_t i;
 
     if (!index->writable)
         return false;
+    if (count == 0)
+        return true;
     index_lock_group(index->fd, offset, INN_LOCK_WRITE);
 
     /* Make sure we have the most current data files and that we have the
@@ -828,10 +993,13 @@ tdx_data_add(struct group_index *index, struct group_entry *entry,
         data->base = entry->base;
     }
 
-    /* If the article number is too low to store in the group index, repack
-       the group with a lower base index. */
-    if (entry->base > article->number) {
-        if (!tdx_data_pack_start(data, article->number))
+    /* If the lowest article number is too low to store in the group index,
+       repack the group with a lower base index. */
+    for (low = articles[0].number, i = 1; i < count; i++)
+        if (articles[i].number < low)
+            low = articles[i].number;
+    if (entry->base > low) {
+        if (!tdx_data_pack_start(data, low))
             goto fail;
         old_inode = entry->indexinode;
         old_base = entry->base;
@@ -847,21 +1015,23 @@ tdx_data_add(struct group_index *index, struct group_entry *entry,
     }
 
     /* Store the data. */
-    if (!tdx_data_store(data, article))
+    if (!tdx_data_store_batch(data, articles, count))
         goto fail;
     if (entry->base == 0)
         entry->base = data->base;
-    if (entry->low == 0 || entry->low > article->number)
-        entry->low = article->number;
-    if (entry->high < article->number)
-        entry->high = article->number;
-    entry->count++;
-
-    /* Used to know that we have to remap the data file owing to our
-       OVSTATICSEARCH (an article whose number is lower than the highest has
-       been added at the end of the file). */
-    if (data->high > article->number)
-        data->remapoutoforder = true;
+    for (i = 0; i < count; i++) {
+        if (entry->low == 0 || entry->low > articles[i].number)
+            entry->low = articles[i].number;
+        if (entry->high < articles[i].number)
+            entry->high = articles[i].number;
+        entry->count++;
+
+        /* Used to know that we have to remap the data file owing to our
+           OVSTATICSEARCH (an article whose number is lower than the highest
+           has been added at the end of the file). */
+        if (data->high > articles[i].number)
+            data->remapoutoforder = true;
+    }
 
     inn_msync_page(entry, sizeof(*entry), MS_ASYNC);
     index_lock_group(index->fd, offset, INN_LOCK_UNLOCK);
@@ -927,6 +1097,7 @@ tdx_expire(const char *group, ARTNUM *low, struct history *history)
     ptrdiff_t offset;
     ARTNUM old_base;
     ino_t old_inode;
+    bool repack = true;
 
     index = tdx_index_open(true);
     if (index == NULL)
@@ -938,9 +1109,12 @@ tdx_expire(const char *group, ARTNUM *low, struct history *history)
     }
     tdx_index_rebuild_start(index, entry);
 
-    /* tdx_data_expire_start builds the new IDX and DAT files and fills in the
-       struct group_entry that was passed to it.  tdx_data_rebuild_finish does
-       the renaming of the new files to the final file names. */
+    /* With tradindexedrepack, the group is first expired in place, unless
+       tdx_data_expire_incremental finds that it should be rewritten.
+       Otherwise, tdx_data_expire_start builds the new IDX and DAT files and
+       fills in the struct group_entry that was passed to it, and
+       tdx_data_rebuild_finish does the renaming of the new files to the
+       final file names. */
     new_entry = *entry;
     new_entry.low = 0;
     new_entry.count = 0;
@@ -948,19 +1122,29 @@ tdx_expire(const char *group, ARTNUM *low, struct history *history)
     data = tdx_data_open(index, group, entry);
     if (data == NULL)
         goto fail;
-    if (!tdx_data_expire_start(group, data, &new_entry, history))
-        goto fail;
-    old_inode = entry->indexinode;
-    old_base = entry->base;
-    entry->indexinode = new_entry.indexinode;
-    entry->base = new_entry.base;
-    inn_msync_page(entry, sizeof(*entry), MS_ASYNC);
-    tdx_data_close(data);
-    if (!tdx_data_rebuild_finish(group)) {
-        entry->base = old_base;
-        entry->indexinode = old_inode;
+    if (history != NULL && innconf->tradindexedrepack > 0)
+        if (!tdx_data_expire_incremental(group, data, &new_entry, history,
+                                         &repack))
+            goto fail;
+    if (!repack) {
+        tdx_data_close(data);
+        data = NULL;
+    } else {
+        if (!tdx_data_expire_start(group, data, &new_entry, history))
+            goto fail;
+        old_inode = entry->indexinode;
+        old_base = entry->base;
+        entry->indexinode = new_entry.indexinode;
+        entry->base = new_entry.base;
         inn_msync_page(entry, sizeof(*entry), MS_ASYNC);
-        goto fail;
+        tdx_data_close(data);
+        data = NULL;
+        if (!tdx_data_rebuild_finish(group)) {
+            entry->base = old_base;
+            entry->indexinode = old_inode;
+            inn_msync_page(entry, sizeof(*entry), MS_ASYNC);
+            goto fail;
+        }
     }
 
     /* Almost done.  Update the group index.  If there are no articles in the
@@ -1008,6 +1192,25 @@ struct audit_data {
     bool fix;
 };
 
+/* A group entry to audit, with the inode of its data index file, used to
+   audit the groups in the order of their inodes. */
+struct audit_group {
+    long loc;
+    ino_t inode;
+};
+
+/* How far the audit of the groups is.  Reports are made at most once every
+   AUDIT_PROGRESS_INTERVAL seconds. */
+#define AUDIT_PROGRESS_INTERVAL 30
+
+struct audit_progress {
+    bool report;
+    long done;
+    long total;
+    time_t start;
+    time_t last;
+};
+
 
 /*
 **  Hash table functions for the mapping from group hashes to names.
@@ -1127,8 +1330,8 @@ tdx_index_print(const char *name, const struct group_entry *entry,
 void
 tdx_index_dump(struct group_index *index, FILE *output)
 {
-    int bucket;
-    long current;
+    long bucket, current;
+    int *head;
     struct group_entry *entry;
     struct hash *hashmap;
     struct hashmap *group;
@@ -1137,8 +1340,11 @@ tdx_index_dump(struct group_index *index, FILE *output)
     if (index->header == NULL || index->entries == NULL)
         return;
     hashmap = hashmap_load();
-    for (bucket = 0; bucket < TDX_HASH_SIZE; bucket++) {
-        current = index->header->hash[bucket].recno;
+    for (bucket = 0; bucket < index_buckets(index); bucket++) {
+        head = index_head(index, bucket);
+        if (head == NULL)
+            break;
+        current = *head;
         while (current != -1) {
             if (!index_maybe_remap(index, current))
                 return;
@@ -1228,28 +1434,49 @@ index_audit_deleted(struct group_entry *entry, long number, bool fix)
 static void
 index_audit_header(struct group_index *index, bool fix)
 {
-    long bucket, current;
+    long bucket, buckets, current;
     struct group_entry *entry;
     int *parent, *next;
     bool *reachable;
 
+    reachable = xcalloc(index->count, sizeof(bool));
+
+    /* A growable hash table must have at least its initial size, and no more
+       buckets than there are entries to hold them.  If it's reset, all the
+       entries of the lost buckets are found to be unreachable below and are
+       added again. */
+    if (index->header->magic == TDX_MAGIC_GROWABLE && index->count > 0) {
+        buckets = index->entries[0].extra.table.buckets;
+        if (buckets < TDX_HASH_SIZE || buckets > TDX_HASH_SIZE + index->count) {
+            warn("tradindexed: invalid hash table size %ld", buckets);
+            if (fix) {
+                index->entries[0].extra.table.buckets = TDX_HASH_SIZE;
+                inn_msync_page(&index->entries[0], sizeof(struct group_entry),
+                               MS_ASYNC);
+            }
+        }
+    }
+    buckets = index_buckets(index);
+
     /* First, walk all of the regular hash buckets, making sure that all of
        the group location pointers are valid and sane, that all groups that
        have been deleted are correctly marked as such, and that all groups are
        in their correct hash chain.  Build reachability information as we go,
        used later to ensure that all group entries are reachable. */
-    reachable = xcalloc(index->count, sizeof(bool));
-    for (bucket = 0; bucket < TDX_HASH_SIZE; bucket++) {
-        parent = &index->header->hash[bucket].recno;
+    for (bucket = 0; bucket < buckets; bucket++) {
+        parent = index_head(index, bucket);
+        if (parent == NULL)
+            break;
         index_audit_loc(index, parent, bucket, NULL, fix);
         current = *parent;
         while (current >= 0 && current < index->count) {
             entry = &index->entries[current];
             next = &entry->next.recno;
-            if (entry->deleted == 0 && bucket != index_bucket(entry->hash)) {
+            if (entry->deleted == 0
+                && bucket != index_bucket(entry->hash, buckets)) {
                 warn("tradindexed: entry %ld is in bucket %ld instead of its"
                      " correct bucket %ld", current, bucket,
-                     index_bucket(entry->hash));
+                     index_bucket(entry->hash, buckets));
                 if (fix) {
                     entry_splice(entry, parent);
                     next = parent;
@@ -1344,10 +1571,13 @@ index_audit_group(struct group_index *index, struct group_entry *entry,
         warn("tradindexed: group %ld not found in active file",
              entry_loc(index, entry));
         if (fix) {
+            index_lock(index->fd, INN_LOCK_WRITE);
             index_unlink_hash(index, entry->hash);
+            entry = &index->entries[offset];
             HashClear(&entry->hash);
             entry->deleted = time(NULL);
             freelist_add(index, entry);
+            index_lock(index->fd, INN_LOCK_UNLOCK);
         }
     } else {
         if (entry->flag != group->flag) {
@@ -1385,20 +1615,182 @@ index_audit_active(void *value, void *cookie)
 
 
 /*
-**  Audit the group index for any inconsistencies.  If the argument is true,
-**  also attempt to fix those inconsistencies.
+**  Compare two groups to audit by the inodes of their data index files.
+*/
+static int
+audit_group_compare(const void *p1, const void *p2)
+{
+    const struct audit_group *g1 = p1;
+    const struct audit_group *g2 = p2;
+
+    if (g1->inode != g2->inode)
+        return (g1->inode < g2->inode) ? -1 : 1;
+    return (g1->loc < g2->loc) ? -1 : (g1->loc > g2->loc);
+}
+
+
+/*
+**  Return the list of the groups to audit, storing their number in the last
+**  argument.  They are in the order of their entries in the index or, if
+**  sorted is true, of the inodes of their data index files.  Files created
+**  one after the other mostly get increasing inodes and nearby blocks, so
+**  walking them by inode reads the disk more sequentially.
+*/
+static struct audit_group *
+index_audit_list(struct group_index *index, bool sorted, long *count)
+{
+    struct audit_group *groups;
+    struct group_entry *entry;
+    long loc;
+
+    groups = xmalloc((index->count + 1) * sizeof(struct audit_group));
+    *count = 0;
+    for (loc = 0; loc < index->count; loc++) {
+        entry = &index->entries[loc];
+        if (HashEmpty(entry->hash) || entry->deleted != 0)
+            continue;
+        groups[*count].loc = loc;
+        groups[*count].inode = entry->indexinode;
+        (*count)++;
+    }
+    if (sorted)
+        qsort(groups, *count, sizeof(struct audit_group), audit_group_compare);
+    return groups;
+}
+
+
+/*
+**  Count done more audited groups and, if requested, report how far the
+**  audit is and an estimate of the time left, at most once every
+**  AUDIT_PROGRESS_INTERVAL seconds and once at the end.
+*/
+static void
+audit_progress(struct audit_progress *status, long done)
+{
+    time_t now;
+    long left;
+
+    status->done += done;
+    if (!status->report)
+        return;
+    now = time(NULL);
+    if (status->done < status->total
+        && now - status->last < AUDIT_PROGRESS_INTERVAL)
+        return;
+    status->last = now;
+    left = (long) (now - status->start) * (status->total - status->done)
+           / status->done;
+    notice("tradindexed: audited %ld of %ld groups, %ld:%02ld:%02ld left",
+           status->done, status->total, left / 3600, (left / 60) % 60,
+           left % 60);
+}
+
+
+/*
+**  Audit the groups in jobs worker processes.  Worker n audits the groups
+**  n, n + jobs, n + 2 * jobs and so on of the list, so that they all walk
+**  it in its order, and writes a byte to its pipe after each group so that
+**  the parent can report progress.  Changes to the group entries go to the
+**  shared mapping of the index, and each group is locked while it's
+**  audited, as is the whole index while a group is removed from it.
+*/
+static void
+index_audit_parallel(struct group_index *index, struct hash *hashmap,
+                     const struct audit_group *groups, long count, bool fix,
+                     unsigned long jobs, struct audit_progress *status)
+{
+    struct pollfd *fds;
+    pid_t *workers;
+    int fd[2], wstatus;
+    unsigned long i, running;
+    long n;
+    ssize_t got;
+    char buffer[512];
+
+    if (jobs > (unsigned long) count)
+        jobs = count;
+    fflush(stdout);
+    fflush(stderr);
+    workers = xcalloc(jobs, sizeof(pid_t));
+    fds = xcalloc(jobs, sizeof(struct pollfd));
+    for (i = 0; i < jobs; i++) {
+        if (pipe(fd) < 0)
+            sysdie("tradindexed: cannot create pipe");
+        workers[i] = fork();
+        if (workers[i] < 0)
+            sysdie("tradindexed: cannot fork worker");
+        if (workers[i] == 0) {
+            close(fd[0]);
+            for (n = i; n < count; n += jobs) {
+                index_audit_group(index, &index->entries[groups[n].loc],
+                                  hashmap, fix);
+                if (xwrite(fd[1], "", 1) < 0)
+                    break;
+            }
+            exit(0);
+        }
+        close(fd[1]);
+        fds[i].fd = fd[0];
+        fds[i].events = POLLIN;
+    }
+
+    /* Count the groups done until all the workers have closed their pipes,
+       then reap them. */
+    running = jobs;
+    while (running > 0) {
+        if (poll(fds, jobs, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            syswarn("tradindexed: cannot poll workers");
+            break;
+        }
+        for (i = 0; i < jobs; i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            got = read(fds[i].fd, buffer, sizeof(buffer));
+            if (got > 0)
+                audit_progress(status, got);
+            else if (got == 0 || errno != EINTR) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                running--;
+            }
+        }
+    }
+    for (i = 0; i < jobs; i++) {
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+        while (waitpid(workers[i], &wstatus, 0) < 0)
+            if (errno != EINTR) {
+                syswarn("tradindexed: cannot wait for worker %lu", i);
+                break;
+            }
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+            warn("tradindexed: worker %lu failed", i);
+    }
+    free(fds);
+    free(workers);
+}
+
+
+/*
+**  Audit the group index for any inconsistencies.  If fix is true, also
+**  attempt to fix those inconsistencies.  The data of the groups is checked
+**  by jobs worker processes, in the order of the inodes of their files if
+**  sorted is true, and progress is reported if progress is true.
 */
 void
-tdx_index_audit(bool fix)
+tdx_index_audit(bool fix, unsigned long jobs, bool sorted, bool progress)
 {
     struct group_index *index;
     struct stat st;
     off_t expected;
     int count;
     struct hash *hashmap;
-    long bucket;
-    struct group_entry *entry;
     struct audit_data data;
+    struct audit_group *groups;
+    struct audit_progress status;
+    long ngroups, i;
 
     index = tdx_index_open(true);
     if (index == NULL)
@@ -1442,11 +1834,55 @@ tdx_index_audit(bool fix)
     data.index = index;
     data.fix = fix;
     hash_traverse(hashmap, index_audit_active, &data);
-    for (bucket = 0; bucket < index->count; bucket++) {
-        entry = &index->entries[bucket];
-        if (HashEmpty(entry->hash) || entry->deleted != 0)
-            continue;
-        index_audit_group(index, entry, hashmap, fix);
-    }
+    groups = index_audit_list(index, sorted, &ngroups);
+    memset(&status, 0, sizeof(status));
+    status.report = progress;
+    status.total = ngroups;
+    status.start = time(NULL);
+    status.last = status.start;
+    if (jobs > 1 && ngroups > 1)
+        index_audit_parallel(index, hashmap, groups, ngroups, fix, jobs,
+                             &status);
+    else
+        for (i = 0; i < ngroups; i++) {
+            index_audit_group(index, &index->entries[groups[i].loc], hashmap,
+                              fix);
+            audit_progress(&status, 1);
+        }
+    free(groups);
     hash_free(hashmap);
 }
+
+
+/*
+**  Give the group index a growable hash table if it has the fixed one of
+**  older versions, and grow it to its full size.  This can be done while
+**  the server is running, since it only takes the same write lock as adding
+**  a group.
+*/
+bool
+tdx_index_upgrade(void)
+{
+    struct group_index *index;
+
+    index = tdx_index_open(true);
+    if (index == NULL)
+        return false;
+    index_lock(index->fd, INN_LOCK_WRITE);
+    if (!index_maybe_remap(index, index->count)) {
+        index_lock(index->fd, INN_LOCK_UNLOCK);
+        tdx_index_close(index);
+        return false;
+    }
+    if (index->header->magic == TDX_MAGIC) {
+        index->entries[0].extra.table.buckets = TDX_HASH_SIZE;
+        inn_msync_page(&index->entries[0], sizeof(struct group_entry),
+                       MS_ASYNC);
+        index->header->magic = TDX_MAGIC_GROWABLE;
+        inn_msync_page(index->header, sizeof(index->header->magic), MS_ASYNC);
+    }
+    index_rehash(index, LONG_MAX);
+    index_lock(index->fd, INN_LOCK_UNLOCK);
+    tdx_index_close(index);
+    return true;
+}
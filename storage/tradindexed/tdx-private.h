@@ -14,6 +14,7 @@
 
 /* Forward declarations to avoid unnecessary includes. */
 struct history;
+struct index_entry;
 
 /* Opaque data structure used by the cache. */
 struct cache;
@@ -33,7 +34,10 @@ struct group_data {
     ARTNUM base;
     int indexfd;
     int datafd;
-    struct index_entry *index;
+    bool compact;               /* Index is made of struct index_compact. */
+    bool compressed;            /* Overview data is compressed. */
+    char *dictionary;           /* Preset dictionary for compression. */
+    void *index;
     char *data;
     off_t indexlen;
     off_t datalen;
@@ -57,8 +61,9 @@ BEGIN_DECLS
 
 /* tdx-cache.c */
 
-/* Create a new cache with the given number of entries. */
-struct cache *tdx_cache_create(unsigned int size);
+/* Create a new cache with the given number of entries and, unless 0, the
+   given limit on the space taken by the files it holds mapped. */
+struct cache *tdx_cache_create(unsigned int size, off_t maxsize);
 
 /* Look up a given newsgroup hash in the cache, returning the group_data
    struct for its open data files if present. */
@@ -96,8 +101,14 @@ bool tdx_index_delete(struct group_index *, const char *group);
 /* Dump the contents of the index file to stdout in human-readable form. */
 void tdx_index_dump(struct group_index *, FILE *);
 
-/* Audit all of the overview data, optionally trying to fix it. */
-void tdx_index_audit(bool fix);
+/* Audit all of the overview data, optionally trying to fix it, checking the
+   data of the groups in the given number of worker processes, optionally in
+   the order of their inodes and reporting progress. */
+void tdx_index_audit(bool fix, unsigned long jobs, bool sorted,
+                     bool progress);
+
+/* Give the group index a growable hash table, and grow it. */
+bool tdx_index_upgrade(void);
 
 /* Close the open index file and dispose of the opaque data structure. */
 void tdx_index_close(struct group_index *);
@@ -106,9 +117,12 @@ void tdx_index_close(struct group_index *);
 struct group_data *tdx_data_open(struct group_index *, const char *group,
                                  struct group_entry *);
 
-/* Add a new overview entry. */
+/* Add a new overview entry, or several for the same group. */
 bool tdx_data_add(struct group_index *, struct group_entry *,
                   struct group_data *, const struct article *);
+bool tdx_data_add_batch(struct group_index *, struct group_entry *,
+                        struct group_data *, const struct article *,
+                        size_t count);
 
 /* Handle rebuilds of the data for a particular group.  Call _start first and
    then _finish when done, with the new group_entry information. */
@@ -116,7 +130,8 @@ bool tdx_index_rebuild_start(struct group_index *, struct group_entry *);
 bool tdx_index_rebuild_finish(struct group_index *, struct group_entry *,
                               struct group_entry *new);
 
-/* Expire a single group. */
+/* Expire a single group.  Without a history, nothing is expired and the
+   group is only rewritten (in the index format selected in inn.conf). */
 bool tdx_expire(const char *group, ARTNUM *low, struct history *);
 
 
@@ -129,17 +144,23 @@ struct group_data *tdx_data_new(const char *group, bool writable);
 bool tdx_data_open_files(struct group_data *);
 
 /* Return the metadata about a particular article in a group. */
-const struct index_entry *tdx_article_entry(struct group_data *,
-                                            ARTNUM article, ARTNUM high);
+bool tdx_article_entry(struct group_data *, ARTNUM article, ARTNUM high,
+                       struct index_entry *);
 
-/* Create, perform, and close a search. */
+/* Create, perform, and close a search.  A search opened with indexonly
+   returns no overview data and never reads the data file. */
 struct search *tdx_search_open(struct group_data *, ARTNUM start, ARTNUM end,
-                               ARTNUM high);
+                               ARTNUM high, bool indexonly);
 bool tdx_search(struct search *, struct article *);
 void tdx_search_close(struct search *);
 
-/* Store article data. */
+/* Whether search results are only valid until the next tdx_search call. */
+bool tdx_search_static(void);
+
+/* Store article data, for one article or several in the same group. */
 bool tdx_data_store(struct group_data *, const struct article *);
+bool tdx_data_store_batch(struct group_data *, const struct article *,
+                          size_t count);
 
 /* Cancel an entry. */
 bool tdx_data_cancel(struct group_data *, ARTNUM);
@@ -158,10 +179,18 @@ struct group_data *tdx_data_rebuild_start(const char *group);
 bool tdx_data_rebuild_finish(const char *group);
 
 /* Start the expiration of a newsgroup and do most of the work, filling out
-   the provided group_entry struct.  Complete with tdx_data_rebuild_finish. */
+   the provided group_entry struct.  Complete with tdx_data_rebuild_finish.
+   If the history is NULL, all the articles are kept. */
 bool tdx_data_expire_start(const char *group, struct group_data *,
                            struct group_entry *, struct history *);
 
+/* Expire a newsgroup in place, filling out the provided group_entry struct.
+   Sets the bool and changes nothing if the group should be rewritten with
+   tdx_data_expire_start instead. */
+bool tdx_data_expire_incremental(const char *group, struct group_data *,
+                                 struct group_entry *, struct history *,
+                                 bool *repack);
+
 /* Dump the contents of the index file for a group. */
 void tdx_data_index_dump(struct group_data *, FILE *);
 
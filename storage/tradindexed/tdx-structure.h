@@ -22,6 +22,15 @@
 **  to the end of the file and added to the hash table, and if they collide
 **  with an existing entry are instead linked to the appropriate hash chain.
 **
+**  A group.index file whose header has TDX_MAGIC_GROWABLE as magic number
+**  grows its hash table along with the number of entries, by linear hashing:
+**  one bucket at a time is split in two, moving part of its chain to a new
+**  bucket at the end of the table.  The first TDX_HASH_SIZE buckets are still
+**  those of the header, and the following ones are kept in the alias field
+**  of the entries, which was never used, one bucket per entry; entry 0 also
+**  records there how many buckets are in use.  A file with the old magic
+**  number is the same as one with a table that hasn't grown yet.
+**
 **  The overview information for each group is stored in a pair of files named
 **  <group>.IDX and <group>.DAT.  These files are found in a subdirectory
 **  formed by taking the first letter of component of the newsgroup name as
@@ -41,6 +50,19 @@
 **  of the group_entry for that newsgroup in the group.index file and each
 **  entry stores the data for the next consecutive article.  Index entries may
 **  be tagged as deleted if that article has been deleted or expired.
+**
+**  When tradindexedcompact is set in inn.conf, new .IDX files are instead
+**  written in a compact format:  the magic string TDX_COMPACT_MAGIC followed
+**  by an array of struct index_compact.  Those entries are packed and stored
+**  in little-endian byte order, so the compact format does not depend on the
+**  architecture.  Both formats are read, so existing .IDX files go on working
+**  until they are rewritten by expireover or tdx-util -C.
+**
+**  When tradindexedcompress is set, new .IDX files start with
+**  TDX_COMPRESSED_MAGIC instead and are otherwise in the compact format, but
+**  each overview entry in the matching .DAT file is a separate zlib stream
+**  compressed with a preset dictionary.  The offset and length in the index
+**  entry then give the location of that stream.
 */
 
 #ifndef INN_TDX_STRUCTURE_H
@@ -72,6 +94,9 @@ struct loc {
    This magic number stands for "fifo feed". */
 #define TDX_MAGIC       (~(0xf1f0f33d))
 
+/* The magic number of a group.index file with a growable hash table. */
+#define TDX_MAGIC_GROWABLE      (~(0xf1f0f33e))
+
 /* The header at the top of group.index.  magic contains GROUPHEADERMAGIC
    always; hash contains pointers to the heads of the entry chains, and
    freelist points to a linked list of free entries (entries that were used
@@ -82,6 +107,14 @@ struct group_header {
     struct loc  freelist;
 };
 
+/* What a group entry holds of a growable hash table, in place of its alias
+   field.  The bucket is number TDX_HASH_SIZE plus the location of the entry,
+   and the number of buckets in use is only kept in entry 0. */
+struct group_buckets {
+    struct loc  bucket;
+    int         buckets;
+};
+
 /* An entry for a particular group.  Note that a good bit of active file
    information is duplicated here, and depending on the portion of INN asking
    questions, sometimes the main active file is canonical and sometimes the
@@ -100,8 +133,13 @@ struct group_header {
    since it's currently read as binary structs directly from disk. */
 struct group_entry {
     HASH        hash;           /* MD5 hash of the group name. */
-    HASH        alias;          /* Intended to point to the group this group
+    union {
+        HASH    alias;          /* Intended to point to the group this group
                                    is an alias for.  Not currently used. */
+        struct group_buckets table;
+                                /* With a growable hash table, a bucket of
+                                   it, and the size of the table. */
+    } extra;
     ARTNUM      high;           /* High article number in the group. */
     ARTNUM      low;            /* Low article number in the group. */
     ARTNUM      base;           /* Article number of the first entry in the
@@ -125,4 +163,22 @@ struct index_entry {
     TOKEN       token;
 };
 
+/* The first bytes of a compact .IDX file.  A .IDX file in the native format
+   starts with the offset of an entry in the .DAT file, which can never be
+   this large, so the two formats cannot be confused. */
+#define TDX_COMPACT_MAGIC       "TDXIDX1"
+#define TDX_COMPRESSED_MAGIC    "TDXIDZ1"
+#define TDX_COMPACT_MAGIC_LEN   8
+
+/* An entry in a compact .IDX file.  The offset is limited to 40 bits and the
+   length to 24 bits; the times are unsigned 32-bit counts of seconds since
+   the epoch.  Only made of characters so that there is no padding. */
+struct index_compact {
+    unsigned char offset[5];
+    unsigned char length[3];
+    unsigned char arrived[4];
+    unsigned char expires[4];
+    TOKEN         token;
+};
+
 #endif /* INN_TDX_STRUCTURE_H */
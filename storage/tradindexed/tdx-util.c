@@ -123,7 +123,7 @@ dump_overview(const char *group, ARTNUM low, ARTNUM high, bool overchan)
         low = entry->low;
     if (high == 0)
         high = entry->high;
-    search = tdx_search_open(data, low, high, entry->high);
+    search = tdx_search_open(data, low, high, entry->high, false);
 
     if (search == NULL) {
         if (low == high)
@@ -438,6 +438,9 @@ main(int argc, char *argv[])
     const char *path = NULL;
     ARTNUM artlow = 0;
     ARTNUM arthigh = 0;
+    unsigned long jobs = 1;
+    bool sorted = false;
+    bool progress = false;
 
     message_program_name = "tdx-util";
 
@@ -446,7 +449,7 @@ main(int argc, char *argv[])
 
     /* Parse options. */
     opterr = 0;
-    while ((option = getopt(argc, argv, "a:f:n:p:AFR:cgiOo")) != EOF) {
+    while ((option = getopt(argc, argv, "a:f:j:n:p:ACFR:UcgiOosv")) != EOF) {
         switch (option) {
         case 'a':
             if (!parse_range(optarg, &artlow, &arthigh))
@@ -455,6 +458,11 @@ main(int argc, char *argv[])
         case 'f':
             flag = optarg[0];
             break;
+        case 'j':
+            jobs = strtoul(optarg, NULL, 10);
+            if (!check_number(optarg) || jobs == 0)
+                die("-j must be a positive number of jobs");
+            break;
         case 'n':
             newsgroup = optarg;
             break;
@@ -466,6 +474,11 @@ main(int argc, char *argv[])
                 die("only one mode option allowed");
             mode = 'A';
             break;
+        case 'C':
+            if (mode != '\0')
+                die("only one mode option allowed");
+            mode = 'C';
+            break;
         case 'F':
             if (mode != '\0')
                 die("only one mode option allowed");
@@ -477,6 +490,11 @@ main(int argc, char *argv[])
             mode = 'R';
             path = optarg;
             break;
+        case 'U':
+            if (mode != '\0')
+                die("only one mode option allowed");
+            mode = 'U';
+            break;
         case 'c':
             if (mode != '\0')
                 die("only one mode option allowed");
@@ -502,6 +520,12 @@ main(int argc, char *argv[])
                 die("only one mode option allowed");
             mode = 'o';
             break;
+        case 's':
+            sorted = true;
+            break;
+        case 'v':
+            progress = true;
+            break;
         default:
             die("invalid option %c", optopt);
             break;
@@ -509,24 +533,36 @@ main(int argc, char *argv[])
     }
 
     /* Some modes require a group be specified. */
-    if (strchr("cgoOR", mode) != NULL && newsgroup == NULL)
+    if (strchr("CcgoOR", mode) != NULL && newsgroup == NULL)
         die("group must be specified for -%c", mode);
 
     /* Run the specified function. */
     switch (mode) {
     case 'A':
-        tdx_index_audit(false);
+        tdx_index_audit(false, jobs, sorted, progress);
+        break;
+    case 'C':
+        if (getenv("INN_TESTSUITE") == NULL)
+            ensure_news_user_grp(true, true);
+        if (!tdx_expire(newsgroup, NULL, NULL))
+            die("cannot rewrite the overview of %s", newsgroup);
         break;
     case 'F':
         if (getenv("INN_TESTSUITE") == NULL)
             ensure_news_user_grp(true, true);
-        tdx_index_audit(true);
+        tdx_index_audit(true, jobs, sorted, progress);
         break;
     case 'R':
         if (getenv("INN_TESTSUITE") == NULL)
             ensure_news_user_grp(true, true);
         group_rebuild(newsgroup, path);
         break;
+    case 'U':
+        if (getenv("INN_TESTSUITE") == NULL)
+            ensure_news_user_grp(true, true);
+        if (!tdx_index_upgrade())
+            die("cannot upgrade the group index");
+        break;
     case 'c':
         if (getenv("INN_TESTSUITE") == NULL)
             ensure_news_user_grp(true, true);
@@ -18,6 +18,7 @@
 #include "inn/libinn.h"
 #include "inn/ov.h"
 #include "inn/storage.h"
+#include "ovinterface.h"
 #include "tdx-private.h"
 #include "tdx-structure.h"
 #include "tradindexed.h"
@@ -29,6 +30,7 @@ struct tradindexed {
     struct group_index *index;
     struct cache *cache;
     bool cutoff;
+    bool indexonly;             /* Searches return no overview data. */
 };
 
 /* Global data about the open tradindexed method. */
@@ -90,6 +92,7 @@ tradindexed_open(int mode)
     tradindexed = xmalloc(sizeof(struct tradindexed));
     tradindexed->index = tdx_index_open((mode & OV_WRITE) ? true : false);
     tradindexed->cutoff = false;
+    tradindexed->indexonly = false;
 
     /* Use a cache size of two for read-only connections.  We may want to
        rethink the limitation of the cache for reading later based on
@@ -102,7 +105,8 @@ tradindexed_open(int mode)
              " to at most %lu", cache_size, fdlimit / 2);
         cache_size = (fdlimit > 2) ? fdlimit / 2 : 1;
     }
-    tradindexed->cache = tdx_cache_create(cache_size);
+    tradindexed->cache =
+        tdx_cache_create(cache_size, (off_t) innconf->overcachemapsize * 1024);
 
     return (tradindexed->index == NULL) ? false : true;
 }
@@ -207,6 +211,96 @@ tradindexed_add(const char *group, ARTNUM artnum, TOKEN token, char *data,
 }
 
 
+/*
+**  qsort comparison function for tradindexed_addbatch.  Sorts records by
+**  group, keeping the records of each group in their original order.
+*/
+static int
+record_compare(const void *p1, const void *p2)
+{
+    const struct ov_record *r1 = *(const struct ov_record *const *) p1;
+    const struct ov_record *r2 = *(const struct ov_record *const *) p2;
+    int status;
+
+    status = strcmp(r1->group, r2->group);
+    if (status != 0)
+        return status;
+    return (r1 < r2) ? -1 : (r1 > r2);
+}
+
+
+/*
+**  Add a batch of overview records.  The records are sorted by group so that
+**  all the records of a group can be stored together with
+**  tdx_data_add_batch, which means one write to the data file and usually
+**  one write to the index file per group instead of two per record.
+*/
+bool
+tradindexed_addbatch(struct ov_record *records, size_t count)
+{
+    static struct ov_record **sorted = NULL;
+    static struct article *articles = NULL;
+    static size_t size = 0;
+    struct group_entry *entry;
+    struct group_data *group_data;
+    struct ov_record *record;
+    size_t start, end, i, n;
+    bool stored;
+    bool success = true;
+
+    if (tradindexed == NULL || tradindexed->index == NULL) {
+        warn("tradindexed: overview method not initialized");
+        return false;
+    }
+    if (count > size) {
+        size = count;
+        sorted = xreallocarray(sorted, size, sizeof(struct ov_record *));
+        articles = xreallocarray(articles, size, sizeof(struct article));
+    }
+    for (i = 0; i < count; i++)
+        sorted[i] = &records[i];
+    qsort(sorted, count, sizeof(struct ov_record *), record_compare);
+
+    for (start = 0; start < count; start = end) {
+        for (end = start + 1; end < count; end++)
+            if (strcmp(sorted[end]->group, sorted[start]->group) != 0)
+                break;
+
+        /* As in tradindexed_add, records for unknown groups and records
+           below the low water mark when cutoff is set are skipped. */
+        entry = tdx_index_entry(tradindexed->index, sorted[start]->group);
+        for (n = 0, i = start; i < end; i++) {
+            record = sorted[i];
+            record->stored = true;
+            if (entry == NULL)
+                continue;
+            if (tradindexed->cutoff && entry->low > record->artnum)
+                continue;
+            articles[n].number = record->artnum;
+            articles[n].overview = record->data;
+            articles[n].overlen = record->len;
+            articles[n].token = record->token;
+            articles[n].arrived = record->arrived;
+            articles[n].expires = record->expires;
+            n++;
+        }
+        if (n == 0)
+            continue;
+
+        group_data = data_cache_open(tradindexed, sorted[start]->group, entry);
+        stored = (group_data != NULL
+                  && tdx_data_add_batch(tradindexed->index, entry, group_data,
+                                        articles, n));
+        if (!stored) {
+            for (i = start; i < end; i++)
+                sorted[i]->stored = false;
+            success = false;
+        }
+    }
+    return success;
+}
+
+
 /*
 **  Cancel an article.  We do this by blanking out its entry in the group
 **  index, making the data inaccessible.  The next expiration run will remove
@@ -263,7 +357,8 @@ tradindexed_opensearch(const char *group, int low, int high)
             if (data == NULL)
                 return NULL;
         }
-    return tdx_search_open(data, low, high, entry->high);
+    return tdx_search_open(data, low, high, entry->high,
+                           tradindexed->indexonly);
 }
 
 
@@ -316,7 +411,7 @@ tradindexed_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
 {
     struct group_entry *entry;
     struct group_data *data;
-    const struct index_entry *index_entry;
+    struct index_entry index_entry;
 
     if (tradindexed == NULL || tradindexed->index == NULL) {
         warn("tradindexed: overview method not initialized");
@@ -334,11 +429,10 @@ tradindexed_getartinfo(const char *group, ARTNUM artnum, TOKEN *token)
             if (data == NULL)
                 return false;
         }
-    index_entry = tdx_article_entry(data, artnum, entry->high);
-    if (index_entry == NULL)
+    if (!tdx_article_entry(data, artnum, entry->high, &index_entry))
         return false;
     if (token != NULL)
-        *token = index_entry->token;
+        *token = index_entry.token;
     return true;
 }
 
@@ -395,7 +489,11 @@ tradindexed_ctl(OVCTLTYPE type, void *val)
         return true;
     case OVSTATICSEARCH:
         i = (int *) val;
-        *i = false;
+        *i = tdx_search_static();
+        return true;
+    case OVINDEXONLY:
+        b = (bool *) val;
+        tradindexed->indexonly = *b;
         return true;
     case OVCACHEKEEP:
     case OVCACHEFREE:
@@ -17,6 +17,8 @@
 
 BEGIN_DECLS
 
+struct ov_record;
+
 bool tradindexed_open(int mode);
 bool tradindexed_groupstats(const char *group, int *low, int *high,
                             int *count, int *flag);
@@ -25,6 +27,7 @@ bool tradindexed_groupadd(const char *group, ARTNUM low, ARTNUM high,
 bool tradindexed_groupdel(const char *group);
 bool tradindexed_add(const char *group, ARTNUM artnum, TOKEN token,
                      char *data, int length, time_t arrived, time_t expires);
+bool tradindexed_addbatch(struct ov_record *records, size_t count);
 bool tradindexed_cancel(const char *group, ARTNUM artnum);
 void *tradindexed_opensearch(const char *group, int low, int high);
 bool tradindexed_search(void *handle, ARTNUM *artnum, char **data,
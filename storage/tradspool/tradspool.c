@@ -50,34 +50,44 @@ typedef struct {
 /*
 ** We have two structures here for facilitating newsgroup name->number mapping
 ** and number->name mapping.  NGTable is a hash table based on hashing the
-** newsgroup name, and is used to give the name->number mapping.  NGTree is
-** a binary tree, indexed by newsgroup number, used for the number->name
-** mapping.
+** newsgroup name, and is used to give the name->number mapping.  NGNumTable
+** is an array indexed by newsgroup number, used for the number->name
+** mapping.  Newsgroup numbers are handed out sequentially, so the array stays
+** dense and new groups are simply added at its end.
 */
 
 #define NGT_SIZE  2048
 
+/* Newsgroup numbers larger than this in tradspool.map are taken as
+   corruption rather than grow NGNumTable without bound. */
+#define NGNUM_MAX (1UL << 24)
+
 typedef struct _ngtent {
     char *ngname;
 /*    HASHEDNG hash; XXX */
     unsigned long ngnumber;
     struct _ngtent *next;
-    struct _ngtreenode *node;
 } NGTENT;
 
-typedef struct _ngtreenode {
-    unsigned long ngnumber;
-    struct _ngtreenode *left, *right;
-    NGTENT *ngtp;
-} NGTREENODE;
-
 NGTENT *NGTable[NGT_SIZE];
 unsigned long MaxNgNumber = 0;
-NGTREENODE *NGTree;
+NGTENT **NGNumTable;
+unsigned long NGNumTableSize = 0;
 
 bool NGTableUpdated; /* set to true if we've added any entries since reading
 			in the database file */
 
+/*
+** Entries added since the database file was last written, which DumpDB
+** appends to it, and how far into the database file we have read, so that
+** CheckNeedReloadDB only has to read what other processes appended.
+*/
+static NGTENT **NGPending;
+static size_t NGPendingCount = 0;
+static size_t NGPendingSize = 0;
+static off_t DBFileOffset = 0;
+static ino_t DBFileInode = 0;
+
 static char * TokenToPath(TOKEN token);
 
 /*
@@ -139,7 +149,6 @@ AddNG(char *ng, unsigned long number) {
     unsigned int h;
     HASHEDNG hash;
     NGTENT *ngtp, **ngtpp;
-    NGTREENODE *newnode, *curnode, **nextnode;
 
     p = xstrdup(ng);
     DeDotify(p); /* canonicalize p to standard (/) form. */
@@ -162,45 +171,44 @@ AddNG(char *ng, unsigned long number) {
 	    /* ngtp->hash = hash XXX */
 	    ngtp->next = NULL;
 
-	    /* assign a new NG number if needed (not given) */
+	    /* assign a new NG number if needed (not given), and remember
+	       to append the new entry to the database file. */
 	    if (number == 0) {
 		number = ++MaxNgNumber;
+		if (NGPendingCount == NGPendingSize) {
+		    NGPendingSize = (NGPendingSize == 0) ? 64 : NGPendingSize * 2;
+		    NGPending = xreallocarray(NGPending, NGPendingSize,
+                                              sizeof(NGTENT *));
+		}
+		NGPending[NGPendingCount++] = ngtp;
 	    }
 	    ngtp->ngnumber = number;
 
 	    /* link new table entry into the hash table chain. */
 	    *ngtpp = ngtp;
 
-	    /* Now insert an appropriate record into the binary tree */
-	    newnode = xmalloc(sizeof(NGTREENODE));
-	    newnode->left = newnode->right = (NGTREENODE *) NULL;
-	    newnode->ngnumber = number;
-	    newnode->ngtp = ngtp;
-	    ngtp->node = newnode;
-
-	    if (NGTree == NULL) {
-		/* tree was empty, so put our one element in and return */
-		NGTree = newnode;
-		return;
-	    } else {
-		nextnode = &NGTree;
-		while (*nextnode) {
-		    curnode = *nextnode;
-		    if (curnode->ngnumber < number) {
-			nextnode = &curnode->right;
-		    } else if (curnode->ngnumber > number) {
-			nextnode = &curnode->left;
-		    } else {
-			/* Error, same number is already in NGtree (shouldn't
-                           happen!) */
-                        warn("tradspool: AddNG: duplicate newsgroup number in"
-                             " NGtree: %ld (%s)", number, p);
-			return;
-		    }
-		}
-		*nextnode = newnode;
+	    /* Now record it in the number table, growing it if needed. */
+	    if (number >= NGNumTableSize) {
+		size_t oldsize = NGNumTableSize;
+
+		if (NGNumTableSize == 0)
+		    NGNumTableSize = 1024;
+		while (NGNumTableSize <= number)
+		    NGNumTableSize *= 2;
+		NGNumTable = xreallocarray(NGNumTable, NGNumTableSize,
+                                           sizeof(NGTENT *));
+		memset(NGNumTable + oldsize, 0,
+                       (NGNumTableSize - oldsize) * sizeof(NGTENT *));
+	    }
+	    if (NGNumTable[number] != NULL) {
+		/* Error, same number is already in NGNumTable (shouldn't
+		   happen!) */
+		warn("tradspool: AddNG: duplicate newsgroup number in"
+		     " NGNumTable: %ld (%s)", number, p);
 		return;
 	    }
+	    NGNumTable[number] = ngtp;
+	    return;
 	} else if (strcmp(ngtp->ngname, p) == 0) {
 	    /* entry in table already, so return */
 	    free(p);
@@ -253,71 +261,62 @@ FindNGByName(char *ngname) {
 /* find a newsgroup/spooldir name, given only the newsgroup number */
 static char *
 FindNGByNum(unsigned long ngnumber) {
-    NGTENT *ngtp;
-    NGTREENODE *curnode;
-
-    curnode = NGTree;
-
-    while (curnode) {
-	if (curnode->ngnumber == ngnumber) {
-	    ngtp = curnode->ngtp;
-	    return ngtp->ngname;
-	}
-	if (curnode->ngnumber < ngnumber) {
-	    curnode = curnode->right;
-	} else {
-	    curnode = curnode->left;
-	}
-    }
-    /* not in tree, return NULL */
-    return NULL;
+    if (ngnumber >= NGNumTableSize || NGNumTable[ngnumber] == NULL)
+	return NULL;
+    return NGNumTable[ngnumber]->ngname;
 }
 
 #define _PATH_TRADSPOOLNGDB "tradspool.map"
-#define _PATH_NEWTSNGDB "tradspool.map.new"
 
 
-/* dump DB to file. */
+/*
+**  Append the entries added since the last call to the database file.  The
+**  file is only ever appended to, so that other processes can pick up new
+**  groups by reading what was added since they last looked at it.
+*/
 static void
 DumpDB(void)
 {
-    char *fname, *fnamenew;
+    char *fname;
     NGTENT *ngtp;
-    unsigned int i;
+    size_t i;
+    struct stat sb;
+    off_t oldsize;
     FILE *out;
 
     if (!SMopenmode) return; /* don't write if we're not in read/write mode. */
     if (!NGTableUpdated) return; /* no need to dump new DB */
 
     fname = concatpath(innconf->pathspool, _PATH_TRADSPOOLNGDB);
-    fnamenew = concatpath(innconf->pathspool, _PATH_NEWTSNGDB);
-
-    if ((out = fopen(fnamenew, "w")) == NULL) {
-        syswarn("tradspool: DumpDB: can't write %s", fnamenew);
+    if ((out = fopen(fname, "a")) == NULL) {
+        syswarn("tradspool: DumpDB: can't write %s", fname);
 	free(fname);
-	free(fnamenew);
 	return;
     }
-    for (i = 0 ; i < NGT_SIZE ; ++i) {
-	ngtp = NGTable[i];
-	for ( ; ngtp ; ngtp = ngtp->next) {
-	    fprintf(out, "%s %lu\n", ngtp->ngname, ngtp->ngnumber);
-	}
+    oldsize = (fstat(fileno(out), &sb) < 0) ? -1 : sb.st_size;
+    for (i = 0 ; i < NGPendingCount ; ++i) {
+	ngtp = NGPending[i];
+	fprintf(out, "%s %lu\n", ngtp->ngname, ngtp->ngnumber);
     }
-    if (fclose(out) < 0) {
-        syswarn("tradspool: DumpDB: can't close %s", fnamenew);
+    if (fflush(out) == EOF || ferror(out)) {
+        syswarn("tradspool: DumpDB: can't write %s", fname);
+	fclose(out);
 	free(fname);
-	free(fnamenew);
 	return;
     }
-    if (rename(fnamenew, fname) < 0) {
-        syswarn("tradspool: DumpDB: can't rename %s", fnamenew);
+
+    /* If we were up to date with the file, we already know what we just
+       appended to it. */
+    if (oldsize == DBFileOffset && sb.st_ino == DBFileInode
+        && fstat(fileno(out), &sb) == 0)
+	DBFileOffset = sb.st_size;
+    if (fclose(out) == EOF) {
+        syswarn("tradspool: DumpDB: can't close %s", fname);
 	free(fname);
-	free(fnamenew);
 	return;
     }
     free(fname);
-    free(fnamenew);
+    NGPendingCount = 0;
     NGTableUpdated = false; /* reset modification flag. */
     return;
 }
@@ -326,6 +325,9 @@ DumpDB(void)
 **  Init NGTable from saved database file and from active.  Note that
 **  entries in the database file get added first, and get their specifications
 **  of newsgroup number from there.
+**
+**  ReadDBFile only reads the part of the database file past DBFileOffset,
+**  unless the file has been replaced or truncated since it was last read.
 */
 
 static bool
@@ -333,30 +335,66 @@ ReadDBFile(void)
 {
     char *fname;
     QIOSTATE *qp;
+    struct stat sb;
     char *line;
     char *p;
     unsigned long number;
+    int fd;
 
     fname = concatpath(innconf->pathspool, _PATH_TRADSPOOLNGDB);
-    if ((qp = QIOopen(fname)) == NULL) {
+    if ((fd = open(fname, O_RDONLY)) < 0) {
 	/* only warn if db not found. */
         notice("tradspool: mapping file %s not found", fname);
-    } else {
-	while ((line = QIOread(qp)) != NULL) {
-	    p = strchr(line, ' ');
-	    if (p == NULL) {
-                warn("tradspool: corrupt line in active: %s", line);
-		QIOclose(qp);
-		free(fname);
-		return false;
-	    }
-	    *p++ = 0;
-	    number = atol(p);
-	    AddNG(line, number);
-	    if (MaxNgNumber < number) MaxNgNumber = number;
+	free(fname);
+	return true;
+    }
+    if (fstat(fd, &sb) < 0) {
+        syswarn("tradspool: can't stat %s", fname);
+	close(fd);
+	free(fname);
+	return false;
+    }
+    if (sb.st_ino != DBFileInode || sb.st_size < DBFileOffset) {
+	DBFileInode = sb.st_ino;
+	DBFileOffset = 0;
+    }
+    if (sb.st_size == DBFileOffset) {
+	close(fd);
+	free(fname);
+	return true;
+    }
+    if (lseek(fd, DBFileOffset, SEEK_SET) < 0
+        || (qp = QIOfdopen(fd)) == NULL) {
+        syswarn("tradspool: can't read %s", fname);
+	close(fd);
+	free(fname);
+	return false;
+    }
+    while ((line = QIOread(qp)) != NULL) {
+	p = strchr(line, ' ');
+	if (p == NULL) {
+            warn("tradspool: corrupt line in active: %s", line);
+	    QIOclose(qp);
+	    free(fname);
+	    return false;
+	}
+	*p++ = 0;
+	number = atol(p);
+	if (number > NGNUM_MAX) {
+            warn("tradspool: bad newsgroup number in %s: %s %lu", fname,
+                 line, number);
+	    QIOclose(qp);
+	    free(fname);
+	    return false;
 	}
-	QIOclose(qp);
+	AddNG(line, number);
+	if (MaxNgNumber < number) MaxNgNumber = number;
     }
+
+    /* Stop at the last complete line, in case a writer is in the middle of
+       appending to the file. */
+    DBFileOffset += QIOtell(qp);
+    QIOclose(qp);
     free(fname);
     return true;
 }
@@ -422,15 +460,13 @@ InitNGTable(void)
 static void
 CheckNeedReloadDB(bool force)
 {
-    static time_t lastcheck, oldlastcheck, now;
+    static time_t lastcheck, now;
     struct stat sb;
     char *fname;
 
     now = time(NULL);
     if (!force && lastcheck + RELOAD_TIME_CHECK > now)
         return;
-
-    oldlastcheck = lastcheck;
     lastcheck = now;
 
     fname = concatpath(innconf->pathspool, _PATH_TRADSPOOLNGDB);
@@ -439,7 +475,7 @@ CheckNeedReloadDB(bool force)
 	return;
     }
     free(fname);
-    if (sb.st_mtime > oldlastcheck) {
+    if (sb.st_ino != DBFileInode || sb.st_size != DBFileOffset) {
 	/* add any newly added ngs to our in-memory copy of the db. */
 	ReadDBFile();
     }
@@ -759,6 +795,25 @@ tradspool_store(const ARTHANDLE article, const STORAGECLASS class) {
     return token;
 }
 
+/*
+**  Each article goes to its own file, linked into each of its newsgroups,
+**  so there is nothing to share between the articles of a batch.
+*/
+bool
+tradspool_storebatch(struct sm_record *records, size_t count)
+{
+    size_t i;
+    bool success = true;
+
+    for (i = 0; i < count; i++) {
+        records[i].token = tradspool_store(*records[i].article,
+                                           records[i].class);
+        if (records[i].token.type == TOKEN_EMPTY)
+            success = false;
+    }
+    return success;
+}
+
 static ARTHANDLE *
 OpenArticle(const char *path, RETRTYPE amount) {
     int fd;
@@ -1126,7 +1181,7 @@ tradspool_next(ARTHANDLE *article, const RETRTYPE amount)
 		return NULL;
 	    }
 	    priv.ngtp = NGTable[priv.nextindex];
-	    if (priv.ngtp != NULL)
+	    if (priv.ngtp != NULL && SMpartitioned(priv.nextindex))
 		break;
 	}
 
@@ -1262,7 +1317,7 @@ tradspool_next(ARTHANDLE *article, const RETRTYPE amount)
 }
 
 static void
-FreeNGTree(void)
+FreeNGTables(void)
 {
     unsigned int i;
     NGTENT *ngtp, *nextngtp;
@@ -1272,13 +1327,19 @@ FreeNGTree(void)
         for ( ; ngtp != NULL ; ngtp = nextngtp) {
 	    nextngtp = ngtp->next;
 	    free(ngtp->ngname);
-	    free(ngtp->node);
 	    free(ngtp);
 	}
 	NGTable[i] = NULL;
     }
     MaxNgNumber = 0;
-    NGTree = NULL;
+    free(NGNumTable);
+    NGNumTable = NULL;
+    NGNumTableSize = 0;
+    free(NGPending);
+    NGPending = NULL;
+    NGPendingCount = NGPendingSize = 0;
+    DBFileOffset = 0;
+    DBFileInode = 0;
 }
 
 bool tradspool_ctl(PROBETYPE type, TOKEN *token, void *value) {
@@ -1286,6 +1347,7 @@ bool tradspool_ctl(PROBETYPE type, TOKEN *token, void *value) {
     unsigned long ngnum;
     unsigned long artnum;
     char *ng, *p;
+    bool status;
 
     switch (type) {
     case SMARTNGNUM:
@@ -1309,6 +1371,12 @@ bool tradspool_ctl(PROBETYPE type, TOKEN *token, void *value) {
                 *p = '.';
 	ann->artnum = (ARTNUM)artnum;
 	return true;
+    case SMPREFETCH:
+	if ((p = TokenToPath(*token)) == NULL)
+	    return false;
+	status = SMprefetchfile(p);
+	free(p);
+	return status;
     default:
 	return false;
     }
@@ -1339,5 +1407,5 @@ tradspool_printfiles(FILE *file, TOKEN token UNUSED, char **xref, int ngroups)
 void
 tradspool_shutdown(void) {
     DumpDB();
-    FreeNGTree();
+    FreeNGTables();
 }
@@ -10,6 +10,7 @@
 
 bool tradspool_init(SMATTRIBUTE *attr);
 TOKEN tradspool_store(const ARTHANDLE article, const STORAGECLASS class);
+bool tradspool_storebatch(struct sm_record *records, size_t count);
 ARTHANDLE *tradspool_retrieve(const TOKEN token, const RETRTYPE amount);
 ARTHANDLE *tradspool_next(ARTHANDLE *article, const RETRTYPE amount);
 void tradspool_freearticle(ARTHANDLE *article);
@@ -17,6 +17,7 @@ trash_init(SMATTRIBUTE *attr)
     }
     attr->selfexpire = true;
     attr->expensivestat = false;
+    attr->threadsafe = true;
     return true;
 }
 
@@ -36,6 +37,16 @@ trash_store(const ARTHANDLE article, const STORAGECLASS class)
     return token;
 }
 
+bool
+trash_storebatch(struct sm_record *records, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        records[i].token = trash_store(*records[i].article, records[i].class);
+    return true;
+}
+
 ARTHANDLE *
 trash_retrieve(const TOKEN token, const RETRTYPE amount UNUSED)
 {
@@ -0,0 +1,199 @@
+/* Test suite for the remote history method and hisserver. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+#define HISTORY "hisremote-tmp/db/history"
+#define SERVER  "../history/hisremote/hisserver"
+
+/* More than HISREMOTE_BATCH, so that checks are split between requests. */
+#define ENTRIES 1500
+
+
+static TOKEN
+token(int n)
+{
+    TOKEN t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = 1;
+    t.token[0] = (char) n;
+    return t;
+}
+
+
+/* Write the inn.conf used by hisserver. */
+static void
+write_config(void)
+{
+    FILE *config;
+
+    config = fopen("hisremote-tmp/inn.conf", "w");
+    if (config == NULL)
+        sysbail("can't create hisremote-tmp/inn.conf");
+    fprintf(config, "domain: news.example.com\n");
+    fprintf(config, "mta: \"/usr/sbin/sendmail -oi -oem %%s\"\n");
+    fprintf(config, "hismethod: hisv6\n");
+    fprintf(config, "enableoverview: false\n");
+    fprintf(config, "pathnews: hisremote-tmp\n");
+    fprintf(config, "pathdb: hisremote-tmp/db\n");
+    fprintf(config, "pathrun: hisremote-tmp/db\n");
+    fprintf(config, "pathtmp: hisremote-tmp/db\n");
+    if (fclose(config) != 0)
+        sysbail("can't write hisremote-tmp/inn.conf");
+}
+
+
+/* Start hisserver on port, returning its PID. */
+static pid_t
+start_server(unsigned long port)
+{
+    char portstring[16];
+    pid_t pid;
+
+    snprintf(portstring, sizeof(portstring), "%lu", port);
+    pid = fork();
+    if (pid < 0)
+        sysbail("can't fork");
+    if (pid == 0) {
+        if (setenv("INNCONF", "hisremote-tmp/inn.conf", 1) < 0)
+            _exit(1);
+        execl(SERVER, "hisserver", "-d", "-p", portstring, (char *) 0);
+        _exit(1);
+    }
+    return pid;
+}
+
+
+/* Open the remote history, waiting for hisserver to start listening. */
+static struct history *
+open_remote(void)
+{
+    struct history *h = NULL;
+    int i;
+
+    for (i = 0; i < 100 && h == NULL; i++) {
+        h = HISopen(HISTORY, "hisremote", HIS_RDONLY);
+        if (h == NULL)
+            usleep(100 * 1000);
+    }
+    return h;
+}
+
+
+int
+main(void)
+{
+    struct history *h;
+    TOKEN t, one, two;
+    time_t now, arrived, posted, expires;
+    char key[32];
+    char **keys;
+    bool *found;
+    int i, wrong;
+    pid_t pid;
+    int status;
+
+    if (access(SERVER, X_OK) < 0)
+        skip_all("hisserver not built");
+    innconf = xcalloc(1, sizeof(struct innconf));
+    message_handlers_warn(0);
+    if (system("rm -rf hisremote-tmp") < 0
+        || mkdir("hisremote-tmp", 0755) < 0
+        || mkdir("hisremote-tmp/db", 0755) < 0)
+        sysbail("can't create hisremote-tmp");
+    write_config();
+    plan(12);
+
+    now = time(NULL);
+    one = token(1);
+    two = token(2);
+    h = HISopen(HISTORY, "hisv6", HIS_RDWR | HIS_CREAT);
+    if (h == NULL)
+        bail("can't create %s", HISTORY);
+    for (i = 0; i < ENTRIES; i++) {
+        snprintf(key, sizeof(key), "<%d@example>", i);
+        if (!HISwrite(h, key, now, now - i, 0, (i % 2) ? &one : &two))
+            bail("can't write %s", key);
+    }
+    if (!HISremember(h, "<remembered@example>", now, now))
+        bail("can't remember <remembered@example>");
+    HISclose(h);
+
+    innconf->hisserver = xstrdup("127.0.0.1");
+    innconf->hisserverport = 20000 + getpid() % 20000;
+    pid = start_server(innconf->hisserverport);
+    h = open_remote();
+    ok(h != NULL, "connect to hisserver");
+    if (h == NULL) {
+        kill(pid, SIGTERM);
+        bail("hisserver didn't start");
+    }
+
+    ok(HISlookup(h, "<3@example>", &arrived, &posted, &expires, &t),
+       "lookup");
+    ok(memcmp(&t, &one, sizeof(t)) == 0, "...right token");
+    ok(arrived == now && posted == now - 3 && expires == 0,
+       "...right times");
+    ok(!HISlookup(h, "<remembered@example>", NULL, NULL, NULL, &t),
+       "no token for a remembered entry");
+    ok(HIScheck(h, "<remembered@example>"), "...but it is known");
+    ok(!HIScheck(h, "<none@example>"), "unknown message-ID");
+
+    keys = xmalloc((ENTRIES + 1) * sizeof(char *));
+    found = xmalloc((ENTRIES + 1) * sizeof(bool));
+    for (i = 0; i < ENTRIES; i++) {
+        snprintf(key, sizeof(key), "<%d@%s>", i,
+                 (i % 3) ? "example" : "missing");
+        keys[i] = xstrdup(key);
+    }
+    keys[ENTRIES] = xstrdup("<remembered@example>");
+    ok(HIScheckbatch(h, (const char *const *) keys, ENTRIES + 1, found),
+       "check a batch larger than a request");
+    for (i = 0, wrong = 0; i < ENTRIES; i++)
+        if (found[i] != ((i % 3) != 0))
+            wrong++;
+    is_int(0, wrong, "...right answers");
+    ok(found[ENTRIES], "...including the remembered entry");
+
+    ok(!HISwrite(h, "<new@example>", now, now, 0, &one),
+       "can't write through hisserver");
+
+    /* Restart the server under the open handle; the next lookups have to
+       reconnect. */
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    pid = start_server(innconf->hisserverport);
+    for (i = 0; i < 100; i++) {
+        if (HIScheck(h, "<1@example>"))
+            break;
+        usleep(100 * 1000);
+    }
+    ok(i < 100, "reconnect after a restart of hisserver");
+    HISclose(h);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    for (i = 0; i <= ENTRIES; i++)
+        free(keys[i]);
+    free(keys);
+    free(found);
+    if (system("rm -rf hisremote-tmp") < 0)
+        sysdiag("can't remove hisremote-tmp");
+    free(innconf->hisserver);
+    free(innconf);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/* Test suite for the segmented history method. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+#define HISTORY "hisseg-tmp/history"
+
+/* The token of the article that the expire callback keeps, if any. */
+static TOKEN *alive = NULL;
+
+
+static TOKEN
+token(int n)
+{
+    TOKEN t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = 1;
+    t.token[0] = (char) n;
+    return t;
+}
+
+
+static bool
+expirecb(void *cookie UNUSED, time_t arrived UNUSED, time_t posted UNUSED,
+         time_t expires UNUSED, TOKEN *t)
+{
+    return alive != NULL && memcmp(t, alive, sizeof(TOKEN)) == 0;
+}
+
+
+static bool
+countcb(void *cookie, time_t arrived UNUSED, time_t posted UNUSED,
+        time_t expires UNUSED, const TOKEN *t UNUSED)
+{
+    (*(int *) cookie)++;
+    return true;
+}
+
+
+static bool
+exists(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0;
+}
+
+
+int
+main(void)
+{
+    struct history *h;
+    TOKEN t, one, two, three;
+    time_t now, old, arrived;
+    int count;
+    const char *keys[4] = {
+        "<five@example>", "<four@example>", "<one@example>", "<three@example>"
+    };
+    bool found[4];
+
+    innconf = xcalloc(1, sizeof(struct innconf));
+    message_handlers_warn(0);
+    if (system("rm -rf hisseg-tmp") < 0 || mkdir("hisseg-tmp", 0755) < 0)
+        sysbail("can't create hisseg-tmp");
+    plan(23);
+
+    now = time(NULL);
+    old = now - 30 * 86400;
+    one = token(1);
+    two = token(2);
+    three = token(3);
+
+    /* A history left by hisv6 is the oldest segment. */
+    h = HISopen(HISTORY, "hisv6", HIS_RDWR | HIS_CREAT);
+    ok(h != NULL, "create hisv6 history");
+    HISwrite(h, "<one@example>", old, old, 0, &one);
+    HISwrite(h, "<two@example>", old, old, 0, &two);
+    HISclose(h);
+
+    /* The first write starts a new segment. */
+    h = HISopen(HISTORY, "hisseg", HIS_RDWR);
+    ok(h != NULL, "open it with hisseg");
+    ok(HISwrite(h, "<three@example>", now, now, 0, &three), "write");
+    ok(HISremember(h, "<four@example>", now, now), "remember");
+    ok(HIScheck(h, "<one@example>"), "old message-ID is still known");
+    HISclose(h);
+
+    h = HISopen(HISTORY, "hisseg", HIS_RDONLY);
+    ok(h != NULL, "open read-only");
+    ok(HISlookup(h, "<one@example>", &arrived, NULL, NULL, &t),
+       "lookup in the old segment");
+    is_int(old, arrived, "...with the right arrival time");
+    ok(memcmp(&t, &one, sizeof(t)) == 0, "...and token");
+    ok(HISlookup(h, "<three@example>", NULL, NULL, NULL, &t),
+       "lookup in the new segment");
+    ok(memcmp(&t, &three, sizeof(t)) == 0, "...with the right token");
+    ok(HIScheck(h, "<four@example>"), "remembered message-ID");
+    ok(!HIScheck(h, "<five@example>"), "unknown message-ID");
+    ok(HIScheckbatch(h, keys, 4, found), "check a batch");
+    ok(!found[0] && found[1] && found[2] && found[3],
+       "...in every segment");
+    count = 0;
+    HISwalk(h, NULL, &count, countcb);
+    is_int(4, count, "walk sees every entry");
+
+    /* A segment is kept as long as one of its articles is. */
+    alive = &two;
+    ok(HISexpire(h, NULL, NULL, true, NULL, now - 86400, expirecb),
+       "expire keeping an old article");
+    ok(exists(HISTORY) && HIScheck(h, "<one@example>"),
+       "...keeps the old segment");
+    alive = NULL;
+    ok(HISexpire(h, NULL, NULL, true, NULL, now - 86400, expirecb),
+       "expire everything old");
+    ok(!exists(HISTORY) && !exists(HISTORY ".dir"),
+       "...removes the old segment");
+    ok(!HIScheck(h, "<one@example>"), "...and its entries");
+    ok(HIScheck(h, "<three@example>") && HIScheck(h, "<four@example>"),
+       "...but not the new segment");
+    ok(HISclose(h), "close");
+
+    if (system("rm -rf hisseg-tmp") < 0)
+        sysdiag("can't remove hisseg-tmp");
+    return 0;
+}
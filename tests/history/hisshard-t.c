@@ -0,0 +1,142 @@
+/* Test suite for the sharded history method. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "inn/vector.h"
+#include "tap/basic.h"
+
+#define HISTORY "hisshard-tmp/history"
+#define ENTRIES 60
+
+/* The token of the article that the expire callback keeps, if any. */
+static TOKEN *alive = NULL;
+
+
+static TOKEN
+token(int n)
+{
+    TOKEN t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = 1;
+    t.token[0] = (char) n;
+    return t;
+}
+
+
+static bool
+expirecb(void *cookie UNUSED, time_t arrived UNUSED, time_t posted UNUSED,
+         time_t expires UNUSED, TOKEN *t)
+{
+    return alive != NULL && memcmp(t, alive, sizeof(TOKEN)) == 0;
+}
+
+
+static bool
+countcb(void *cookie, time_t arrived UNUSED, time_t posted UNUSED,
+        time_t expires UNUSED, const TOKEN *t UNUSED)
+{
+    (*(int *) cookie)++;
+    return true;
+}
+
+
+/* Return the size of the file at path, or -1 if it doesn't exist. */
+static off_t
+size(const char *path)
+{
+    struct stat st;
+
+    return (stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+
+int
+main(void)
+{
+    struct history *h;
+    TOKEN t, one, two;
+    time_t now, old;
+    char key[32];
+    int i, count, missing;
+    const char *keys[3] = { "<1@example>", "<none@example>", "<2@example>" };
+    bool found[3];
+
+    innconf = xcalloc(1, sizeof(struct innconf));
+    innconf->hisshards = vector_split_space("a b c", NULL);
+    message_handlers_warn(0);
+    if (system("rm -rf hisshard-tmp") < 0 || mkdir("hisshard-tmp", 0755) < 0)
+        sysbail("can't create hisshard-tmp");
+    plan(17);
+
+    now = time(NULL);
+    old = now - 30 * 86400;
+    one = token(1);
+    two = token(2);
+
+    h = HISopen(HISTORY, "hisshard", HIS_RDWR | HIS_CREAT);
+    ok(h != NULL, "create");
+    for (i = 0; i < ENTRIES; i++) {
+        snprintf(key, sizeof(key), "<%d@example>", i);
+        if (!HISwrite(h, key, (i % 2) ? now : old, (i % 2) ? now : old, 0,
+                      (i % 2) ? &one : &two))
+            break;
+    }
+    is_int(ENTRIES, i, "write entries");
+    ok(HISremember(h, "<remembered@example>", now, now), "remember");
+    HISclose(h);
+    ok(size("hisshard-tmp/a/history") > 0 && size("hisshard-tmp/b/history") > 0
+           && size("hisshard-tmp/c/history") > 0,
+       "every shard has entries");
+    ok(size(HISTORY) == -1, "...and nothing is at the path itself");
+
+    h = HISopen(HISTORY, "hisshard", HIS_RDONLY);
+    ok(h != NULL, "open read-only");
+    for (i = 0, missing = 0; i < ENTRIES; i++) {
+        snprintf(key, sizeof(key), "<%d@example>", i);
+        if (!HISlookup(h, key, NULL, NULL, NULL, &t)
+            || memcmp(&t, (i % 2) ? &one : &two, sizeof(t)) != 0)
+            missing++;
+    }
+    is_int(0, missing, "lookup every entry");
+    ok(HIScheck(h, "<remembered@example>"), "remembered entry is known");
+    ok(!HIScheck(h, "<none@example>"), "unknown message-ID");
+    ok(HIScheckbatch(h, keys, 3, found), "check a batch");
+    ok(found[0] && !found[1] && found[2], "...right answers");
+    count = 0;
+    ok(HISwalk(h, NULL, &count, countcb), "walk");
+    is_int(ENTRIES + 1, count, "...sees every entry of every shard");
+
+    alive = &one;
+    ok(HISexpire(h, NULL, NULL, true, NULL, now - 86400, expirecb),
+       "expire");
+    ok(!HIScheck(h, "<0@example>") && HIScheck(h, "<1@example>")
+           && HIScheck(h, "<remembered@example>"),
+       "...drops old entries in every shard");
+    ok(!HISexpire(h, "hisshard-tmp/new", NULL, true, NULL, now, expirecb),
+       "can't expire to another path");
+    HISclose(h);
+
+    h = HISopen(HISTORY, "hisshard", HIS_RDWR);
+    ok(HISreplace(h, "<1@example>", now, now, 0, &two)
+           && HISlookup(h, "<1@example>", NULL, NULL, NULL, &t)
+           && memcmp(&t, &two, sizeof(t)) == 0,
+       "replace");
+    HISclose(h);
+
+    if (system("rm -rf hisshard-tmp") < 0)
+        sysdiag("can't remove hisshard-tmp");
+    vector_free(innconf->hisshards);
+    free(innconf);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/* Test suite for the write-behind buffer and the threaded expire of the hisv6
+   history method. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+#define HISTORY "hisv6-tmp/history"
+
+/* Enough entries for the history text to take several expire chunks. */
+#define ENTRIES 30000
+
+/* What a walk of the expired history found. */
+struct walked {
+    int count;
+    int tokens;
+    time_t last;
+    bool ordered;
+};
+
+
+static TOKEN
+token(int n)
+{
+    TOKEN t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = 1;
+    t.token[0] = (char) n;
+    return t;
+}
+
+
+static off_t
+size(const char *path)
+{
+    struct stat st;
+
+    return (stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+
+static bool
+countcb(void *cookie, time_t arrived UNUSED, time_t posted UNUSED,
+        time_t expires UNUSED, const TOKEN *t UNUSED)
+{
+    (*(int *) cookie)++;
+    return true;
+}
+
+
+/* Keep the articles with an odd token; safe to call from several threads. */
+static bool
+expirecb(void *cookie UNUSED, time_t arrived UNUSED, time_t posted UNUSED,
+         time_t expires UNUSED, TOKEN *t)
+{
+    return t->token[0] == 1;
+}
+
+
+static bool
+walkcb(void *cookie, time_t arrived, time_t posted UNUSED,
+       time_t expires UNUSED, const TOKEN *t)
+{
+    struct walked *w = cookie;
+
+    w->count++;
+    if (t != NULL)
+        w->tokens++;
+    if (arrived <= w->last)
+        w->ordered = false;
+    w->last = arrived;
+    return true;
+}
+
+
+int
+main(void)
+{
+    struct history *h, *r;
+    TOKEN t, one, two, three;
+    time_t now, arrived;
+    size_t writebehind, threads;
+    bool datasync = true;
+    int count, i;
+    char key[32];
+    time_t base;
+    struct walked w;
+    const char *keys[3] = {"<one@example>", "<four@example>", "<two@example>"};
+    bool found[3];
+
+    innconf = xcalloc(1, sizeof(struct innconf));
+    message_handlers_warn(0);
+    if (system("rm -rf hisv6-tmp") < 0 || mkdir("hisv6-tmp", 0755) < 0)
+        sysbail("can't create hisv6-tmp");
+    plan(26);
+
+    now = time(NULL);
+    one = token(1);
+    two = token(2);
+    three = token(3);
+
+    h = HISopen(HISTORY, "hisv6", HIS_RDWR | HIS_CREAT);
+    ok(h != NULL, "create hisv6 history");
+    writebehind = 3;
+    ok(HISctl(h, HISCTLS_WRITEBEHIND, &writebehind), "hold three writes");
+    ok(HISctl(h, HISCTLS_DATASYNC, &datasync), "sync each batch");
+
+    /* Held entries are seen by this handle only. */
+    ok(HISwrite(h, "<one@example>", now, now, 0, &one), "write");
+    ok(HISremember(h, "<two@example>", now, now), "remember");
+    is_int(0, size(HISTORY), "nothing written yet");
+    ok(HISlookup(h, "<one@example>", &arrived, NULL, NULL, &t),
+       "held entry found by lookup");
+    ok(arrived == now && memcmp(&t, &one, sizeof(t)) == 0,
+       "...with the right arrival time and token");
+    ok(HIScheck(h, "<two@example>"), "held remembered entry checked");
+    ok(HIScheckbatch(h, keys, 3, found), "check a batch");
+    ok(found[0] && !found[1] && found[2], "...sees the held entries");
+    r = HISopen(HISTORY, "hisv6", HIS_RDONLY);
+    ok(r != NULL && !HIScheck(r, "<one@example>"),
+       "...but another handle does not");
+    if (r != NULL)
+        HISclose(r);
+
+    /* The third write fills the buffer. */
+    ok(HISwrite(h, "<three@example>", now, now, 0, &three), "fill");
+    ok(size(HISTORY) > 0, "...writes the batch");
+    r = HISopen(HISTORY, "hisv6", HIS_RDONLY);
+    ok(r != NULL && HIScheck(r, "<one@example>")
+           && HIScheck(r, "<three@example>"),
+       "...which other handles see");
+    if (r != NULL)
+        HISclose(r);
+
+    /* An explicit flush, and a walk, write what is held. */
+    HISwrite(h, "<four@example>", now, now, 0, &one);
+    ok(HISctl(h, HISCTLS_FLUSH, NULL), "flush");
+    r = HISopen(HISTORY, "hisv6", HIS_RDONLY);
+    ok(r != NULL && HISlookup(r, "<four@example>", NULL, NULL, NULL, &t),
+       "...makes the entry visible");
+    if (r != NULL)
+        HISclose(r);
+    HISwrite(h, "<five@example>", now, now, 0, &two);
+    count = 0;
+    HISwalk(h, NULL, &count, countcb);
+    is_int(5, count, "walk sees every entry");
+    HISwrite(h, "<six@example>", now, now, 0, &three);
+    ok(HISclose(h), "close");
+    h = HISopen(HISTORY, "hisv6", HIS_RDONLY);
+    ok(h != NULL && HIScheck(h, "<six@example>"), "close writes the rest");
+    if (h != NULL)
+        HISclose(h);
+
+    /* Expire with threads deciding what to keep. */
+    if (system("rm -rf hisv6-tmp/history*") < 0)
+        sysbail("can't remove hisv6-tmp/history");
+    h = HISopen(HISTORY, "hisv6", HIS_RDWR | HIS_CREAT);
+    base = now - 10 * 86400;
+    for (i = 0; i < ENTRIES; i++) {
+        snprintf(key, sizeof(key), "<%d@example>", i);
+        if (!HISwrite(h, key, base + i, base + i, 0, (i % 2) ? &one : &two))
+            break;
+    }
+    HISclose(h);
+    is_int(ENTRIES, i, "write many entries");
+    h = HISopen(HISTORY, "hisv6", HIS_RDONLY);
+    threads = 4;
+#ifdef HAVE_PTHREAD
+    ok(HISctl(h, HISCTLS_EXPIRETHREADS, &threads), "expire with threads");
+#else
+    skip("POSIX threads not available");
+#endif
+    ok(HISexpire(h, NULL, NULL, true, NULL, base + ENTRIES / 2, expirecb),
+       "expire");
+    HISclose(h);
+    h = HISopen(HISTORY, "hisv6", HIS_RDONLY);
+    memset(&w, 0, sizeof(w));
+    w.ordered = true;
+    HISwalk(h, NULL, &w, walkcb);
+    is_int(ENTRIES / 2 + ENTRIES / 4, w.count,
+           "kept and remembered entries are left");
+    ok(w.tokens == ENTRIES / 2 && w.ordered, "...in their order");
+    ok(HIScheck(h, "<1@example>") && !HIScheck(h, "<0@example>")
+           && HIScheck(h, "<29998@example>")
+           && HISlookup(h, "<29999@example>", NULL, NULL, NULL, &t)
+           && memcmp(&t, &one, sizeof(t)) == 0,
+       "...and found by lookups");
+    HISclose(h);
+
+    if (system("rm -rf hisv6-tmp") < 0)
+        sysdiag("can't remove hisv6-tmp");
+    return 0;
+}
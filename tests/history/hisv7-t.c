@@ -0,0 +1,142 @@
+/* Test suite for the binary history method. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+#define HISTORY "hisv7-tmp/history"
+
+/* The token of the article that the expire callback keeps, if any. */
+static TOKEN *alive = NULL;
+
+
+static TOKEN
+token(int n)
+{
+    TOKEN t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = 1;
+    t.token[0] = (char) n;
+    return t;
+}
+
+
+static bool
+expirecb(void *cookie UNUSED, time_t arrived UNUSED, time_t posted UNUSED,
+         time_t expires UNUSED, TOKEN *t)
+{
+    return alive != NULL && memcmp(t, alive, sizeof(TOKEN)) == 0;
+}
+
+
+static bool
+countcb(void *cookie, time_t arrived UNUSED, time_t posted UNUSED,
+        time_t expires UNUSED, const TOKEN *t UNUSED)
+{
+    (*(int *) cookie)++;
+    return true;
+}
+
+
+static bool
+exists(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0;
+}
+
+
+int
+main(void)
+{
+    struct history *h;
+    TOKEN t, one, two, three;
+    time_t now, old, arrived, posted, expires;
+    int count;
+    const char *keys[4] = {
+        "<five@example>", "<four@example>", "<one@example>", "<three@example>"
+    };
+    bool found[4];
+
+    innconf = xcalloc(1, sizeof(struct innconf));
+    message_handlers_warn(0);
+    message_handlers_notice(0);
+    if (system("rm -rf hisv7-tmp") < 0 || mkdir("hisv7-tmp", 0755) < 0)
+        sysbail("can't create hisv7-tmp");
+    plan(24);
+
+    now = time(NULL);
+    old = now - 30 * 86400;
+    one = token(1);
+    two = token(2);
+    three = token(3);
+
+    /* A history left by hisv6 is converted by the first read/write open. */
+    h = HISopen(HISTORY, "hisv6", HIS_RDWR | HIS_CREAT);
+    ok(h != NULL, "create hisv6 history");
+    HISwrite(h, "<one@example>", old, old, 0, &one);
+    HISwrite(h, "<two@example>", old, old - 60, now + 86400, &two);
+    HISclose(h);
+    ok(HISopen(HISTORY, "hisv7", HIS_RDONLY) == NULL,
+       "hisv6 history can't be opened read-only");
+    h = HISopen(HISTORY, "hisv7", HIS_RDWR);
+    ok(h != NULL, "open it read/write");
+    ok(exists(HISTORY ".v6"), "...which keeps the text history");
+    ok(HISlookup(h, "<two@example>", &arrived, &posted, &expires, &t),
+       "converted entry");
+    ok(arrived == old && posted == old - 60 && expires == now + 86400,
+       "...with the right times");
+    ok(memcmp(&t, &two, sizeof(t)) == 0, "...and token");
+
+    ok(HISwrite(h, "<three@example>", now, now, 0, &three), "write");
+    ok(HISremember(h, "<four@example>", now, now), "remember");
+    HISclose(h);
+
+    h = HISopen(HISTORY, "hisv7", HIS_RDONLY);
+    ok(h != NULL, "open read-only");
+    ok(HISlookup(h, "<three@example>", &arrived, NULL, NULL, &t),
+       "lookup");
+    ok(arrived == now && memcmp(&t, &three, sizeof(t)) == 0,
+       "...with the right arrival time and token");
+    ok(!HISlookup(h, "<four@example>", NULL, NULL, NULL, NULL),
+       "remembered entry has no article");
+    ok(HIScheck(h, "<four@example>"), "...but is known");
+    ok(!HIScheck(h, "<five@example>"), "unknown message-ID");
+    ok(HIScheckbatch(h, keys, 4, found), "check a batch");
+    ok(!found[0] && found[1] && found[2] && found[3], "...right answers");
+    count = 0;
+    ok(HISwalk(h, NULL, &count, countcb), "walk");
+    is_int(4, count, "...sees every entry");
+
+    alive = &three;
+    ok(HISexpire(h, NULL, NULL, true, NULL, now - 86400, expirecb),
+       "expire");
+    ok(HIScheck(h, "<three@example>") && HIScheck(h, "<four@example>"),
+       "...keeps new entries");
+    ok(!HIScheck(h, "<one@example>") && !HIScheck(h, "<two@example>"),
+       "...and drops old ones");
+    HISclose(h);
+
+    h = HISopen(HISTORY, "hisv7", HIS_RDWR);
+    ok(HISreplace(h, "<four@example>", now, now, 0, &one), "replace");
+    ok(HISlookup(h, "<four@example>", NULL, NULL, NULL, &t)
+           && memcmp(&t, &one, sizeof(t)) == 0,
+       "...gives the entry a token");
+    HISclose(h);
+
+    if (system("rm -rf hisv7-tmp") < 0)
+        sysdiag("can't remove hisv7-tmp");
+    return 0;
+}
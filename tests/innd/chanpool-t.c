@@ -0,0 +1,102 @@
+/* Test suite for the pool of channel buffers of innd. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#include "../../innd/innd.h"
+
+
+/*
+**  Channel callback which should never be called.
+*/
+static void
+callback(CHANNEL *cp UNUSED)
+{
+    bail("unexpected callback");
+}
+
+
+/*
+**  Write some data into a pipe.
+*/
+static void
+fill(int fd, size_t length)
+{
+    char data[4096];
+
+    memset(data, 'x', sizeof(data));
+    if (xwrite(fd, data, length) < 0)
+        sysbail("cannot write to pipe");
+}
+
+
+int
+main(void)
+{
+    int fds[2];
+    CHANNEL *cp;
+    char *first;
+
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("innd") != 0)
+                sysbail("cannot cd to innd");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    Log = fopen("/dev/null", "w");
+    if (Log == NULL)
+        sysbail("cannot open /dev/null");
+    message_handlers_notice(0);
+    CHANsetup(32);
+    gettimeofday(&Now, NULL);
+    if (pipe(fds) < 0)
+        sysbail("cannot create pipe");
+
+    plan(10);
+
+    cp = CHANcreate(fds[0], CTany, CSgetbody, callback, callback);
+    is_int(START_BUFF_SIZE, cp->In.size, "new channel gets a small buffer");
+    first = cp->In.data;
+
+    /* Growing goes to the next size class. */
+    fill(fds[1], START_BUFF_SIZE - 100);
+    is_int(START_BUFF_SIZE - 100, CHANreadtext(cp), "read");
+    fill(fds[1], 100);
+    is_int(100, CHANreadtext(cp), "...more");
+    is_int(2 * START_BUFF_SIZE, cp->In.size, "...into a bigger buffer");
+
+    /* Nothing is given back while data is pending. */
+    CHANrelease(cp);
+    ok(cp->In.data != NULL, "buffer kept while in use");
+
+    /* Once the channel is idle, it is, and the small buffer is reused. */
+    cp->In.used = 0;
+    CHANrelease(cp);
+    ok(cp->In.data == NULL && cp->In.size == 0, "buffer given back");
+    ok(cp->Out.data == NULL, "...with the output buffer");
+    fill(fds[1], 10);
+    is_int(10, CHANreadtext(cp), "read after release");
+    ok(cp->In.size == START_BUFF_SIZE && cp->In.data == first,
+       "...into a buffer from the pool");
+
+    /* A new channel gets the buffer of a closed one. */
+    CHANclose(cp, CHANname(cp));
+    if (pipe(fds) < 0)
+        sysbail("cannot create pipe");
+    cp = CHANcreate(fds[0], CTany, CSgetbody, callback, callback);
+    ok(cp->In.data == first, "closed channel buffer reused");
+
+    CHANclose(cp, CHANname(cp));
+    CHANshutdown();
+    return 0;
+}
@@ -0,0 +1,186 @@
+/* Test suite for COMPRESS DEFLATE on the channels of innd. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/socket.h"
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#include "../../innd/innd.h"
+
+#if defined(HAVE_ZLIB)
+# include <zlib.h>
+
+/* The peer side of the connection. */
+static z_stream peerin, peerout;
+
+
+/*
+**  Channel callback which should never be called.
+*/
+static void
+callback(CHANNEL *cp UNUSED)
+{
+    bail("unexpected callback");
+}
+
+
+/*
+**  Deflate data with a sync flush, as a peer would, and write it to fd.
+*/
+static void
+send_deflated(int fd, const char *data, size_t length)
+{
+    unsigned char out[8192];
+    size_t size;
+
+    peerout.next_in = (Bytef *) (uintptr_t) data;
+    peerout.avail_in = length;
+    do {
+        peerout.next_out = out;
+        peerout.avail_out = sizeof(out);
+        if (deflate(&peerout, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+            bail("cannot deflate");
+        size = sizeof(out) - peerout.avail_out;
+        if (size > 0 && xwrite(fd, out, size) < 0)
+            sysbail("cannot write to socket");
+    } while (peerout.avail_out == 0);
+}
+
+
+/*
+**  Read what is in the channel In buffer until it holds length bytes from
+**  cp->Next, and return whether they match data.
+*/
+static bool
+receive(CHANNEL *cp, const char *data, size_t length)
+{
+    int tries;
+
+    for (tries = 0; tries < 1000; tries++) {
+        if (cp->In.used - cp->Next >= length)
+            break;
+        if (CHANreadtext(cp) == -1)
+            return false;
+    }
+    return cp->In.used - cp->Next == length
+           && memcmp(&cp->In.data[cp->Next], data, length) == 0;
+}
+
+
+int
+main(void)
+{
+    int fds[2];
+    CHANNEL *cp;
+    char *data, *p;
+    unsigned char raw[4096];
+    char out[256];
+    size_t length, i;
+    ssize_t count;
+    const char plain[] = "COMPRESS DEFLATE\r\n";
+    const char reply[] = "235 Article transferred OK\r\n";
+
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("innd") != 0)
+                sysbail("cannot cd to innd");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    Log = fopen("/dev/null", "w");
+    if (Log == NULL)
+        sysbail("cannot open /dev/null");
+    message_handlers_notice(0);
+    message_handlers_warn(0);
+    CHANsetup(32);
+    gettimeofday(&Now, NULL);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        sysbail("cannot create socket pair");
+    if (inflateInit2(&peerin, -15) != Z_OK
+        || deflateInit2(&peerout, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                        Z_DEFAULT_STRATEGY) != Z_OK)
+        bail("cannot initialize zlib");
+
+    plan(10);
+
+    /* What the peer sends right after the command is already compressed. */
+    cp = CHANcreate(fds[0], CTnntp, CSgetcmd, callback, callback);
+    if (xwrite(fds[1], plain, strlen(plain)) < 0)
+        sysbail("cannot write to socket");
+    send_deflated(fds[1], "CHECK <a@b>\r\n", 13);
+    while (cp->In.used < strlen(plain))
+        if (CHANreadtext(cp) < 0)
+            sysbail("cannot read from socket");
+    cp->Next = strlen(plain);
+    ok(CHANcompress(cp), "start compression");
+    ok(!CHANcompress(cp), "...only once");
+    ok(receive(cp, "CHECK <a@b>\r\n", 13), "data read with the command");
+
+    /* Large amounts are inflated into a growing buffer. */
+    cp->Next = cp->In.used;
+    length = 200 * 1000;
+    data = xmalloc(length);
+    for (p = data, i = 0; p < data + length - 32; i++)
+        p += sprintf(p, "line %lu of data\r\n", (unsigned long) i);
+    length = p - data;
+    for (i = 0; i < length; i += 10000) {
+        send_deflated(fds[1], data + i,
+                      length - i < 10000 ? length - i : 10000);
+        CHANreadtext(cp);
+    }
+    ok(receive(cp, data, length), "many blocks inflated");
+    ok(cp->In.size > START_BUFF_SIZE, "...into a bigger buffer");
+    free(data);
+
+    /* Replies are deflated, and complete once flushed. */
+    WCHANappend(cp, reply, strlen(reply));
+    ok(cp->ZFlush, "reply waits for a flush");
+    CHANdeflateflush(cp);
+    ok(!cp->ZFlush, "...which is done");
+    length = cp->Out.left;
+    if (xwrite(fds[0], &cp->Out.data[cp->Out.used], length) < 0)
+        sysbail("cannot write to socket");
+    count = read(fds[1], raw, sizeof(raw));
+    ok(count > 0 && (size_t) count == length, "reply written");
+    peerin.next_in = raw;
+    peerin.avail_in = count > 0 ? count : 0;
+    peerin.next_out = (Bytef *) out;
+    peerin.avail_out = sizeof(out);
+    inflate(&peerin, Z_SYNC_FLUSH);
+    ok(sizeof(out) - peerin.avail_out == strlen(reply)
+           && memcmp(out, reply, strlen(reply)) == 0,
+       "...and inflated by the peer");
+
+    /* Corrupt data is an error. */
+    cp->Next = cp->In.used;
+    memset(raw, 0xff, 64);
+    if (xwrite(fds[1], raw, 64) < 0)
+        sysbail("cannot write to socket");
+    is_int(-1, CHANreadtext(cp), "corrupt data is refused");
+
+    CHANclose(cp, CHANname(cp));
+    close(fds[1]);
+    inflateEnd(&peerin);
+    deflateEnd(&peerout);
+    CHANshutdown();
+    return 0;
+}
+
+#else /* !HAVE_ZLIB */
+
+int
+main(void)
+{
+    skip_all("zlib support not compiled in");
+    return 0;
+}
+
+#endif /* !HAVE_ZLIB */
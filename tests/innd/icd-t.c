@@ -0,0 +1,129 @@
+/* Test suite for changing newsgroups in the active file of innd. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#include "../../innd/innd.h"
+
+static const char active[] = "\
+control 0000000000 0000000001 y\n\
+control.cancel 0000000000 0000000001 n\n\
+junk 0000000000 0000000001 y\n\
+misc.test 0000000005 0000000001 y\n";
+
+/* One site gets everything, the other one only moderated newsgroups. */
+static const char newsfeeds[] = "\
+ME:*::\n\
+all:*,!junk:Tf:\n\
+mod:*:Tf,Nm:\n";
+
+
+/*
+**  Write a file in the icd-db directory.
+*/
+static void
+write_file(const char *name, const char *data)
+{
+    char *path;
+    FILE *F;
+
+    path = concatpath("icd-db", name);
+    F = fopen(path, "w");
+    if (F == NULL || fputs(data, F) == EOF || fclose(F) == EOF)
+        sysbail("cannot write %s", path);
+    free(path);
+}
+
+
+/*
+**  Return whether the active file ends with the given line.
+*/
+static bool
+active_ends_with(const char *line)
+{
+    char *data;
+    size_t length;
+    bool status;
+
+    data = ReadInFile("icd-db/active", NULL);
+    if (data == NULL)
+        return false;
+    length = strlen(data);
+    status = length >= strlen(line)
+             && strcmp(data + length - strlen(line), line) == 0;
+    free(data);
+    return status;
+}
+
+
+int
+main(void)
+{
+    NEWSGROUP *ngp;
+
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("innd") != 0)
+                sysbail("cannot cd to innd");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    if (system("rm -rf icd-db") < 0 || mkdir("icd-db", 0755) < 0)
+        sysbail("cannot create icd-db");
+    innconf->pathdb = xstrdup("icd-db");
+    innconf->pathetc = xstrdup("icd-db");
+    innconf->pathoutgoing = xstrdup("icd-db");
+    innconf->enableoverview = false;
+    innconf->sharedactive = false;
+    innconf->mergetogroups = false;
+    write_file("active", active);
+    write_file("newsfeeds", newsfeeds);
+    message_handlers_warn(0);
+
+    plan(13);
+
+    ICDsetup(false);
+    is_int(4, nGroups, "active file parsed");
+
+    /* A new newsgroup is appended in place. */
+    ok(ICDnewgroup((char *) "example.new", (char *) "y"), "newgroup");
+    is_int(5, nGroups, "...added to the in-core tables");
+    ngp = NGfind("example.new");
+    ok(ngp != NULL && ngp->Rest[0] == 'y', "...and found");
+    ok(active_ends_with("misc.test 0000000005 0000000001 y\n"
+                        "example.new 0000000000 0000000001 y\n"),
+       "...and written to the active file");
+    ok(ngp != NULL && ngp->nSites == 1
+           && strcmp(Sites[ngp->Sites[0]].Name, "all") == 0,
+       "...and fed to the right sites");
+    ngp = NGfind("misc.test");
+    ok(ngp != NULL && ngp->Last == 5 && strcmp(ngp->Name, "misc.test") == 0
+           && strncmp(ngp->Rest, "y\n", 2) == 0,
+       "other newsgroups are kept");
+
+    /* Its flag is changed in place too. */
+    ngp = NGfind("example.new");
+    ok(ICDchangegroup(ngp, (char *) "m"), "changegroup");
+    ok(active_ends_with("example.new 0000000000 0000000001 m\n"),
+       "...written to the active file");
+    ok(NGfind("example.new") == ngp && ngp->nSites == 2,
+       "...and now fed to moderated sites");
+
+    /* An alias needs the whole file to be parsed again. */
+    ok(ICDchangegroup(ngp, (char *) "=misc.test"), "changegroup to alias");
+    ngp = NGfind("example.new");
+    ok(ngp != NULL && ngp->Alias == NGfind("misc.test"), "...resolved");
+    ok(active_ends_with("example.new 0000000000 0000000001 =misc.test\n"),
+       "...and written to the active file");
+
+    if (system("rm -rf icd-db") < 0)
+        sysdiag("cannot remove icd-db");
+    return 0;
+}
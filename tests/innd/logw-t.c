@@ -0,0 +1,110 @@
+/* Test suite for the log writer of innd. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "tap/basic.h"
+
+#include "../../innd/innd.h"
+
+
+/*
+**  Return the contents of a log, or "none" if it doesn't exist.  The
+**  result should be freed.
+*/
+static char *
+contents(const char *name)
+{
+    char *path, *data;
+
+    path = concatpath("logw-log", name);
+    data = ReadInFile(path, NULL);
+    free(path);
+    return data == NULL ? xstrdup("none") : data;
+}
+
+
+/*
+**  Write to the logs through the writer, rotating them in between, as innd
+**  would do.  Run in a child, since it replaces stdout and stderr.
+*/
+static void
+child(void)
+{
+    if (freopen("logw-log/news", "a", stdout) == NULL
+        || freopen("logw-log/errlog", "a", stderr) == NULL)
+        _exit(1);
+    Log = stdout;
+    Errlog = stderr;
+    CHANsetup(32);
+    LOGWsetup();
+    fputs("first\n", stdout);
+    fputs("error\n", stderr);
+    if (!LOGWrotate(stdout) || !LOGWrotate(stderr))
+        _exit(2);
+    fputs("second\n", stdout);
+    exit(0);
+}
+
+
+int
+main(void)
+{
+    char *data;
+    pid_t pid;
+    int i, status;
+
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("innd") != 0)
+                sysbail("cannot cd to innd");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    if (system("rm -rf logw-log") < 0 || mkdir("logw-log", 0755) < 0)
+        sysbail("cannot create logw-log");
+    innconf->pathlog = xstrdup("logw-log");
+    innconf->logwriter = true;
+    innconf->logsync = 1;
+
+    plan(5);
+    fflush(stdout);
+
+    pid = fork();
+    if (pid < 0)
+        sysbail("cannot fork");
+    if (pid == 0)
+        child();
+    if (waitpid(pid, &status, 0) != pid)
+        sysbail("cannot wait for child");
+    is_int(0, status, "logs written and rotated");
+
+    /* The writer outlives innd until it has written out everything. */
+    for (i = 0; i < 100; i++) {
+        data = contents("news");
+        if (strcmp(data, "second\n") == 0)
+            break;
+        free(data);
+        usleep(100000);
+    }
+    is_string("second\n", data, "news log");
+    free(data);
+    data = contents("news.old");
+    is_string("first\n", data, "...and its rotated part");
+    free(data);
+    data = contents("errlog");
+    is_string("", data, "error log");
+    free(data);
+    data = contents("errlog.old");
+    is_string("error\n", data, "...and its rotated part");
+    free(data);
+
+    if (system("rm -rf logw-log") < 0)
+        sysdiag("cannot remove logw-log");
+    return 0;
+}
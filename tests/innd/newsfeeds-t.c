@@ -0,0 +1,175 @@
+/* Test suite for the cache of site subscriptions of innd. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#include "../../innd/innd.h"
+
+static const char active[] = "\
+control 0000000000 0000000001 y\n\
+control.cancel 0000000000 0000000001 n\n\
+junk 0000000000 0000000001 y\n\
+misc.test 0000000005 0000000001 y\n\
+misc.moderated 0000000000 0000000001 m\n";
+
+static const char newsfeeds1[] = "\
+ME:*,!junk::\n\
+all:*:Tf:\n\
+misc:misc.*,@control.cancel:Tf:\n\
+mod:*:Tf,Nm:\n";
+
+/* The same, with the patterns and exclusions of one site changed. */
+static const char newsfeeds2[] = "\
+ME:*,!junk::\n\
+all:*:Tf:\n\
+misc/Peer.Example,other:misc.test,control:Tf:\n\
+mod:*:Tf,Nm:\n";
+
+
+/*
+**  Write a file in the nf-db directory.
+*/
+static void
+write_file(const char *name, const char *data)
+{
+    char *path;
+    FILE *F;
+
+    path = concatpath("nf-db", name);
+    F = fopen(path, "w");
+    if (F == NULL || fputs(data, F) == EOF || fclose(F) == EOF)
+        sysbail("cannot write %s", path);
+    free(path);
+}
+
+
+/*
+**  Return the inode of the cache, or 0 if there is none.
+*/
+static ino_t
+cache_inode(void)
+{
+    struct stat st;
+
+    if (stat("nf-db/" INN_PATH_FEEDCACHE, &st) < 0)
+        return 0;
+    return st.st_ino;
+}
+
+
+/*
+**  Return the names of the sites which get a newsgroup, followed by those
+**  for which it is poison, as a static string.
+*/
+static const char *
+sites(const char *name)
+{
+    static char result[256];
+    NEWSGROUP *ngp;
+    int i;
+
+    result[0] = '\0';
+    ngp = NGfind(name);
+    if (ngp == NULL)
+        return "none";
+    for (i = 0; i < ngp->nSites; i++) {
+        strlcat(result, Sites[ngp->Sites[i]].Name, sizeof(result));
+        strlcat(result, " ", sizeof(result));
+    }
+    strlcat(result, "/", sizeof(result));
+    for (i = 0; i < ngp->nPoison; i++) {
+        strlcat(result, " ", sizeof(result));
+        strlcat(result, Sites[ngp->Poison[i]].Name, sizeof(result));
+    }
+    return result;
+}
+
+
+/*
+**  Return the site with the given name, or NULL.
+*/
+static SITE *
+site(const char *name)
+{
+    int i;
+
+    for (i = 0; i < nSites; i++)
+        if (Sites[i].Name != NULL && strcmp(Sites[i].Name, name) == 0)
+            return &Sites[i];
+    return NULL;
+}
+
+
+int
+main(void)
+{
+    ino_t inode;
+    SITE *sp;
+
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("innd") != 0)
+                sysbail("cannot cd to innd");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    if (system("rm -rf nf-db") < 0 || mkdir("nf-db", 0755) < 0)
+        sysbail("cannot create nf-db");
+    innconf->pathdb = xstrdup("nf-db");
+    innconf->pathetc = xstrdup("nf-db");
+    innconf->pathoutgoing = xstrdup("nf-db");
+    write_file("active", active);
+    write_file("newsfeeds", newsfeeds1);
+    message_handlers_warn(0);
+
+    plan(17);
+
+    /* Without a cache, the subscriptions are computed and saved. */
+    ICDsetup(false);
+    is_string("all misc /", sites("misc.test"), "subscriptions");
+    is_string("all misc mod /", sites("misc.moderated"), "...moderated");
+    is_string("all / misc", sites("control.cancel"), "...poison");
+    is_string("all /", sites("junk"), "...after those of ME");
+    inode = cache_inode();
+    ok(inode != 0, "cache written");
+
+    /* Parsing again uses the cache as it is. */
+    ICDsetup(false);
+    is_string("all misc /", sites("misc.test"), "subscriptions from cache");
+    is_string("all misc mod /", sites("misc.moderated"), "...moderated");
+    is_string("all / misc", sites("control.cancel"), "...poison");
+    ok(cache_inode() == inode, "...without writing it");
+
+    /* A change of the patterns of a site is noticed. */
+    write_file("newsfeeds", newsfeeds2);
+    ICDsetup(false);
+    is_string("all misc /", sites("control.cancel"), "changed subscriptions");
+    is_string("all misc /", sites("control"), "...of another newsgroup");
+    ok(cache_inode() != inode, "...and cache written");
+
+    /* The names of the sites and their exclusions are hashed for ARTpost. */
+    sp = site("misc");
+    if (sp == NULL)
+        bail("site misc not found");
+    is_int(ARThophash("MISC"), sp->NameHash, "site name hashed");
+    is_int(ARThophash("peer.example"), sp->ExclusionHashes[0],
+           "...and exclusions, without case");
+    is_int(ARThophash("other"), sp->ExclusionHashes[1], "...all of them");
+
+    /* A cache not matching the active file is ignored. */
+    write_file(INN_PATH_FEEDCACHE, "INNFC01");
+    ICDsetup(false);
+    is_string("all misc /", sites("misc.test"), "damaged cache ignored");
+    is_string("all misc mod /", sites("misc.moderated"), "...moderated");
+
+    if (system("rm -rf nf-db") < 0)
+        sysdiag("cannot remove nf-db");
+    return 0;
+}
@@ -0,0 +1,137 @@
+/* Test suite for finding the peer of a connection in incoming.conf. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include "portable/socket.h"
+#include <netdb.h>
+#include <sys/stat.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#include "../../innd/innd.h"
+
+/* The first version of incoming.conf:  a host within an address block. */
+static const char config1[] = "\
+peer block {\n\
+    hostname: \"192.0.2.0/24, 2001:db8::/32\"\n\
+    patterns: \"*, !local.*\"\n\
+    max-connections: 5\n\
+}\n\
+peer host {\n\
+    hostname: 192.0.2.7\n\
+}\n\
+peer bad {\n\
+    hostname: \"198.51.100.0/33\"\n\
+}\n";
+
+/* The second version, after a reload. */
+static const char config2[] = "\
+peer other {\n\
+    hostname: \"192.0.2.0/25\"\n\
+}\n";
+
+
+/*
+**  Write incoming.conf in the rc-etc directory.
+*/
+static void
+write_config(const char *config)
+{
+    FILE *F;
+
+    F = fopen("rc-etc/incoming.conf", "w");
+    if (F == NULL || fputs(config, F) == EOF || fclose(F) == EOF)
+        sysbail("cannot write rc-etc/incoming.conf");
+}
+
+
+/*
+**  Set the address of a fake channel from its string form.
+*/
+static CHANNEL *
+channel(const char *address)
+{
+    static CHANNEL cp;
+    struct addrinfo hints, *ai;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(address, NULL, &hints, &ai) != 0)
+        bail("cannot parse %s", address);
+    memset(&cp, 0, sizeof(cp));
+    memcpy(&cp.Address, ai->ai_addr, ai->ai_addrlen);
+    freeaddrinfo(ai);
+    return &cp;
+}
+
+
+/*
+**  Return the label of the peer of an address, or "none".
+*/
+static const char *
+label(const char *address)
+{
+    char *name;
+
+    name = RClabelname(channel(address));
+    return name == NULL ? "none" : name;
+}
+
+
+int
+main(void)
+{
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("innd") != 0)
+                sysbail("cannot cd to innd");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    if (system("rm -rf rc-etc") < 0 || mkdir("rc-etc", 0755) < 0)
+        sysbail("cannot create rc-etc");
+    free(innconf->pathetc);
+    innconf->pathetc = xstrdup("rc-etc");
+    message_handlers_warn(0);
+
+    plan(16);
+
+    write_config(config1);
+    RCreadlist();
+    is_string("host", label("192.0.2.7"), "single host");
+    is_string("block", label("192.0.2.8"), "address in a block");
+    is_string("block", label("192.0.2.255"), "...up to its end");
+    is_string("none", label("192.0.3.1"), "address out of any block");
+    is_string("none", label("198.51.100.1"), "invalid prefix ignored");
+    is_string("block", label("::ffff:192.0.2.9"), "IPv4-mapped address");
+#ifdef HAVE_INET6
+    is_string("block", label("2001:db8:1::2"), "IPv6 block");
+    is_string("none", label("2001:db9::2"), "...and outside of it");
+#else
+    skip_block(2, "IPv6 not supported");
+#endif
+    is_string("192.0.2.7", RChostname(channel("192.0.2.7")), "host name");
+    is_string("192.0.2.8", RChostname(channel("192.0.2.8")),
+              "address of a host in a block");
+    is_int(5, RClimit(channel("192.0.2.8")), "settings of the block");
+    is_int(0, RClimit(channel("192.0.2.7")), "...not used for the host");
+    is_int(1, RCcanpost(channel("192.0.2.8"), (char *) "news.test"),
+           "posting allowed");
+    is_int(0, RCcanpost(channel("192.0.2.8"), (char *) "local.test"),
+           "...and refused");
+
+    write_config(config2);
+    RCreadlist();
+    is_string("other", label("192.0.2.7"), "reloaded configuration");
+    is_string("none", label("192.0.2.200"), "...replacing the old one");
+
+    RCclose();
+    if (system("rm -rf rc-etc") < 0)
+        sysdiag("cannot remove rc-etc");
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* Test suite for the shared table of newsgroup statistics. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/activemap.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#define PATH "activemap.tmp"
+
+int
+main(void)
+{
+    struct activemap *map, *old, *reader;
+    long slot;
+    unsigned long generation;
+    int lo, hi, count, flag;
+
+    plan(20);
+
+    unlink(PATH);
+    message_handlers_warn(0);
+    ok(activemap_open(PATH) == NULL, "no table yet");
+
+    map = activemap_create(PATH, 2, 32);
+    ok(map != NULL, "create");
+    ok(activemap_add(map, "news.software.nntp", 1, 10, 7, 'y') >= 0, "add");
+    slot = activemap_add(map, "misc.test", 5, 4, 0, 'm');
+    ok(slot >= 0, "add another");
+    ok(activemap_add(map, "alt.toolong.for.the.names", 1, 0, 0, 'y') < 0,
+       "no room left for names");
+    ok(activemap_open(PATH) == NULL, "not visible before publication");
+    ok(activemap_publish(map), "publish");
+
+    reader = activemap_open(PATH);
+    ok(reader != NULL, "open for reading");
+    ok(activemap_lookup(reader, "news.software.nntp", &lo, &hi, &count,
+                        &flag),
+       "lookup");
+    ok(lo == 1 && hi == 10 && count == 7 && flag == 'y', "...with the data");
+    ok(!activemap_lookup(reader, "news.software.b", NULL, NULL, NULL, NULL),
+       "lookup of a missing newsgroup");
+
+    activemap_begin(map);
+    activemap_set(map, slot, 5, 9, 5);
+    activemap_end(map);
+    ok(activemap_lookup(reader, "misc.test", &lo, &hi, &count, &flag),
+       "lookup after update");
+    ok(lo == 5 && hi == 9 && count == 5 && flag == 'm', "...sees the update");
+    activemap_begin(map);
+    activemap_setflag(map, slot, 'y');
+    activemap_end(map);
+    ok(activemap_lookup(reader, "misc.test", NULL, NULL, NULL, &flag)
+           && flag == 'y',
+       "...and a new flag");
+    is_int(slot, activemap_find(map, "misc.test"), "find");
+
+    generation = activemap_refresh(reader);
+    ok(generation != 0, "refresh");
+    ok(activemap_slots(reader) >= 2, "...with slots for the newsgroups");
+
+    /* Replace the table, and check that the reader follows. */
+    old = map;
+    map = activemap_create(PATH, 1, 16);
+    activemap_add(map, "local.test", 1, 2, 2, 'n');
+    activemap_publish(map);
+    activemap_retire(old);
+    ok(!activemap_lookup(reader, "misc.test", NULL, NULL, NULL, NULL),
+       "removed newsgroup is gone from the new table");
+    ok(activemap_lookup(reader, "local.test", NULL, &hi, NULL, NULL)
+           && hi == 2,
+       "added newsgroup is found");
+    ok(activemap_refresh(reader) != generation, "...in a new generation");
+
+    activemap_free(reader);
+    activemap_retire(map);
+    unlink(PATH);
+    return 0;
+}
@@ -0,0 +1,55 @@
+/* Test suite for binding a process to some processors. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <errno.h>
+
+#include "inn/libinn.h"
+#include "tap/basic.h"
+
+/* Whether a list of processors is refused as invalid. */
+static bool
+invalid(const char *list)
+{
+    errno = 0;
+    return !inn_setaffinity(list) && errno == EINVAL;
+}
+
+int
+main(void)
+{
+    char *initial, *cpus, first[32];
+
+    initial = inn_getaffinity();
+    if (initial == NULL)
+        skip_all("processor affinity not supported");
+
+    plan(11);
+
+    ok(initial[0] != '\0', "current processors %s", initial);
+    ok(inn_setaffinity(initial), "set the current processors");
+    cpus = inn_getaffinity();
+    is_string(initial, cpus, "...and get them back");
+    free(cpus);
+
+    ok(invalid(""), "empty list");
+    ok(invalid("a"), "not a number");
+    ok(invalid("3-1"), "reversed range");
+    ok(invalid("1,"), "trailing comma");
+    ok(invalid("1-"), "open range");
+    ok(invalid("0-999999"), "too many processors");
+
+    /* Restrict to the first processor, then go back. */
+    strlcpy(first, initial, sizeof(first));
+    first[strspn(first, "0123456789")] = '\0';
+    ok(inn_setaffinity(first), "restrict to processor %s", first);
+    cpus = inn_getaffinity();
+    is_string(first, cpus, "...and only run there");
+    free(cpus);
+
+    inn_setaffinity(initial);
+    free(initial);
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include "clibrary.h"
 
 #include <fcntl.h>
+#include <sys/uio.h>
 
 #include "tap/basic.h"
 #include "inn/buffer.h"
@@ -71,8 +72,10 @@ main(void)
     char *data;
     ssize_t count;
     size_t offset;
+    struct iovec iov[2];
+    int fds[2];
 
-    plan(89);
+    plan(108);
 
     /* buffer_set, buffer_append, buffer_swap */
     buffer_set(&one, test_string1, sizeof(test_string1));
@@ -288,6 +291,58 @@ main(void)
     free(data);
     buffer_free(three);
 
+    /* The ring buffer functions. */
+    three = buffer_new();
+    data = bmalloc(1024);
+    memset(data, 'a', 1000);
+    memset(data + 1000, 'b', 24);
+    buffer_ring_append(three, data, 1000);
+    is_int(1024, three->size, "buffer_ring_append sizes the ring");
+    buffer_ring_consume(three, 900);
+    is_int(900, three->used, "buffer_ring_consume moves used");
+    is_int(100, three->left, "...and left");
+    buffer_ring_append(three, data + 1000, 24);
+    buffer_ring_append(three, "cdef", 4);
+    is_int(1024, three->size, "appending wraps around instead of growing");
+    is_int(128, three->left, "...and left is correct");
+    ok(memcmp(three->data, "cdef", 4) == 0, "...with the tail at the front");
+    is_int(2, buffer_ring_iov(three, iov), "buffer_ring_iov sees two segments");
+    ok(iov[0].iov_len == 124 && iov[1].iov_len == 4
+           && iov[0].iov_base == three->data + 900,
+       "...with the right lengths");
+    if (pipe(fds) < 0)
+        sysbail("cannot create pipe");
+    is_int(128, buffer_ring_write(three, fds[1]), "buffer_ring_write");
+    is_int(0, three->left, "...consumes everything");
+    is_int(0, three->used, "...and rewinds the ring");
+    buffer_ring_append(three, data, 1000);
+    buffer_ring_consume(three, 1000);
+    buffer_ring_append(three, "xy", 2);
+    is_int(0, three->used, "an emptied ring starts over");
+    is_int(128, buffer_ring_read(three, fds[0]), "buffer_ring_read");
+    ok(memcmp(three->data, "xyaaaa", 6) == 0
+           && memcmp(three->data + 102, "bbbb", 4) == 0
+           && memcmp(three->data + 126, "cdef", 4) == 0,
+       "...appends to the data");
+    buffer_ring_consume(three, 100);
+    buffer_ring_append(three, data, 1000);
+    is_int(1030, three->left, "a full ring grows");
+    is_int(0, three->used, "...after linearizing");
+    ok(memcmp(three->data, "aabb", 4) == 0
+           && memcmp(three->data + 26, "cdefaaaa", 8) == 0,
+       "...with the data in order");
+    buffer_ring_consume(three, 1020);
+    buffer_ring_append(three, data, 1024);
+    is_int(1034, three->left, "appending past the end wraps again");
+    buffer_ring_linearize(three);
+    ok(three->used == 0 && memcmp(three->data, "aaaa", 4) == 0
+           && memcmp(three->data + 10, data, 1024) == 0,
+       "buffer_ring_linearize unwraps the data");
+    close(fds[0]);
+    close(fds[1]);
+    free(data);
+    buffer_free(three);
+
     /* Test buffer_free with NULL and ensure it doesn't explode. */
     buffer_free(NULL);
 
@@ -0,0 +1,259 @@
+/* Test suite for dbz, including growth of a full database and its filter */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/dbz.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+/* More than the smallest table (64K entries) can hold at 66% full. */
+#define ENTRIES 150000
+
+
+static HASH
+key(long n)
+{
+    char buffer[64];
+
+    snprintf(buffer, sizeof(buffer), "<%ld@dbz.test>", n);
+    return HashMessageID(buffer);
+}
+
+
+static void
+cleanup(const char *name)
+{
+    static const char *const suffixes[] = { ".dir", ".index", ".hash" };
+    size_t i;
+    char *path;
+
+    for (i = 0; i < ARRAY_SIZE(suffixes); i++) {
+        path = concat(name, suffixes[i], (char *) 0);
+        unlink(path);
+        free(path);
+    }
+}
+
+
+/* Return the version number from the first line of the .dir file. */
+static int
+version(const char *name)
+{
+    FILE *dir;
+    char *path;
+    int v = 0;
+
+    path = concat(name, ".dir", (char *) 0);
+    dir = fopen(path, "r");
+    free(path);
+    if (dir == NULL)
+        return 0;
+    if (fscanf(dir, "dbz %d", &v) != 1)
+        v = 0;
+    fclose(dir);
+    return v;
+}
+
+
+/* Check that every stored entry can be found with the right value. */
+static bool
+fetchall(void)
+{
+    long n;
+    off_t value;
+
+    for (n = 0; n < ENTRIES; n++)
+        if (!dbzfetch(key(n), &value) || value != n * 10)
+            return false;
+    return true;
+}
+
+
+/* Count the calls of the warm-up progress, stopping it if asked to. */
+static int progress_calls;
+static bool progress_done;
+
+static bool
+progress(void *cookie, const char *what UNUSED, off_t done, off_t total)
+{
+    progress_calls++;
+    progress_done = (done == total);
+    return *(bool *) cookie;
+}
+
+
+static void
+test_grow(dbz_incore_val incore, bool filter, bool hugepages,
+          const char *mode)
+{
+    dbzoptions opt;
+    long n;
+    bool stored;
+
+    cleanup("dbz-test");
+    dbzgetoptions(&opt);
+    opt.pag_incore = incore;
+    opt.exists_incore = incore;
+    opt.filter = filter;
+    opt.hugepages = hugepages;
+    dbzsetoptions(opt);
+
+    ok(dbzfresh("dbz-test", dbzsize(1000)), "%s: dbzfresh", mode);
+    stored = true;
+    for (n = 0; n < ENTRIES; n++)
+        if (dbzstore(key(n), n * 10) != DBZSTORE_OK)
+            stored = false;
+    ok(stored, "%s: store more entries than the table holds", mode);
+    ok(dbzstore(key(42), 0) == DBZSTORE_EXISTS, "%s: duplicate", mode);
+    ok(fetchall(), "%s: fetch everything", mode);
+    ok(!dbzexists(key(ENTRIES)), "%s: missing entry", mode);
+    ok(dbzclose(), "%s: dbzclose", mode);
+    is_int(7, version("dbz-test"), "%s: database has grown", mode);
+
+    ok(dbzinit("dbz-test"), "%s: dbzinit", mode);
+    ok(fetchall(), "%s: fetch everything after reopening", mode);
+    ok(dbzclose(), "%s: dbzclose again", mode);
+}
+
+
+int
+main(void)
+{
+    long n;
+    bool stored;
+    dbzstate *state, *other;
+    struct dbz *first, *second;
+    dbzoptions opt;
+    HASH keys[3];
+    bool found[3];
+    off_t value;
+    HASH *batch;
+    off_t *offsets;
+    DBZSTORE_RESULT *results;
+
+    innconf = xcalloc(1, sizeof(struct innconf));
+    message_handlers_notice(0);
+    plan(6 * 10 + 5 + 4 + 6 + 6 + 1 + 3);
+
+    test_grow(INCORE_NO, false, false, "disk");
+    test_grow(INCORE_MEM, false, false, "memory");
+    test_grow(INCORE_MEM, false, true, "memory with huge pages");
+#ifdef HAVE_MMAP
+    test_grow(INCORE_MMAP, false, false, "mmap");
+#else
+    skip_block(10, "mmap not available");
+#endif
+
+    /* The filter must still know about everything once the database has
+       grown, including what is only in memory yet. */
+    test_grow(INCORE_NO, true, false, "disk with filter");
+    test_grow(INCORE_MEM, true, false, "memory with filter");
+
+    /* A rebuild sized from the usage of the grown database needs a single
+       table again. */
+    cleanup("dbz-new");
+    ok(dbzagain("dbz-new", "dbz-test"), "dbzagain");
+    stored = true;
+    for (n = 0; n < ENTRIES; n++)
+        if (dbzstore(key(n), n * 10) != DBZSTORE_OK)
+            stored = false;
+    ok(stored, "store in the rebuilt database");
+    ok(fetchall(), "fetch everything from it");
+    ok(dbzclose(), "dbzclose");
+    is_int(6, version("dbz-new"), "rebuilt database has not grown");
+
+    cleanup("dbz-test");
+    cleanup("dbz-new");
+
+    /* A batch with a key already stored and a key given twice, into a table
+       that has to grow along the way. */
+    ok(dbzfresh("dbz-test", dbzsize(1000)), "dbzfresh for a batch");
+    dbzstore(key(7), 70);
+    batch = xmalloc((ENTRIES + 1) * sizeof(HASH));
+    offsets = xmalloc((ENTRIES + 1) * sizeof(off_t));
+    results = xmalloc((ENTRIES + 1) * sizeof(DBZSTORE_RESULT));
+    for (n = 0; n < ENTRIES; n++) {
+        batch[n] = key(n);
+        offsets[n] = n * 10;
+    }
+    batch[ENTRIES] = key(5);
+    offsets[ENTRIES] = 0;
+    stored = dbzstorebatch(batch, offsets, ENTRIES + 1, results);
+    for (n = 0; n <= ENTRIES; n++)
+        if (results[n] != ((n == 7 || n == ENTRIES) ? DBZSTORE_EXISTS
+                                                    : DBZSTORE_OK))
+            stored = false;
+    ok(stored, "dbzstorebatch");
+    ok(fetchall(), "fetch everything stored in a batch");
+    ok(dbzclose(), "dbzclose");
+    free(batch);
+    free(offsets);
+    free(results);
+    cleanup("dbz-test");
+
+    /* Two databases used in turn by setting one aside. */
+    ok(dbzfresh("dbz-test", dbzsize(1000)), "dbzfresh first database");
+    dbzstore(key(1), 10);
+    state = dbzsave();
+    ok(state != NULL, "dbzsave");
+    ok(dbzfresh("dbz-new", dbzsize(1000)), "dbzfresh second database");
+    dbzstore(key(2), 20);
+    other = dbzsave();
+    ok(dbzrestore(state), "dbzrestore first database");
+    ok(dbzfetch(key(1), &value) && value == 10 && !dbzexists(key(2)),
+       "it has its own contents");
+    dbzclose();
+    dbzrestore(other);
+    ok(dbzfetch(key(2), &value) && value == 20 && !dbzexists(key(1)),
+       "so has the second one");
+    dbzclose();
+
+    cleanup("dbz-test");
+    cleanup("dbz-new");
+
+    /* Two databases open at once through handles. */
+    dbzgetoptions(&opt);
+    opt.pag_incore = INCORE_MEM;
+    opt.exists_incore = INCORE_MEM;
+    first = dbz_fresh("dbz-test", dbzsize(1000), &opt);
+    ok(first != NULL, "dbz_fresh first database");
+    opt.pag_incore = INCORE_NO;
+    opt.exists_incore = INCORE_NO;
+    second = dbz_fresh("dbz-new", dbzsize(1000), &opt);
+    ok(second != NULL, "dbz_fresh second database");
+    ok(dbz_store(first, key(1), 10) == DBZSTORE_OK
+       && dbz_store(second, key(2), 20) == DBZSTORE_OK
+       && dbz_store(first, key(1), 30) == DBZSTORE_EXISTS,
+       "dbz_store");
+    ok(dbz_fetch(first, key(1), &value) && value == 10
+       && !dbz_exists(first, key(2)),
+       "first database has its own contents");
+    ok(dbz_fetch(second, key(2), &value) && value == 20
+       && !dbz_exists(second, key(1)),
+       "so has the second one");
+    keys[0] = key(2);
+    keys[1] = key(1);
+    keys[2] = key(3);
+    dbz_existsbatch(first, keys, 3, found);
+    ok(!found[0] && found[1] && !found[2], "dbz_existsbatch");
+
+    /* Warming up reads each table to the end, unless stopped. */
+    stored = true;
+    ok(dbz_warmup(first, false, progress, &stored)
+       && dbz_warmup(second, false, NULL, NULL), "dbz_warmup");
+    ok(progress_calls == 2 && progress_done, "...reporting each table");
+    stored = false;
+    progress_calls = 0;
+    ok(!dbz_warmup(first, false, progress, &stored) && progress_calls == 1,
+       "...and can be stopped");
+    ok(dbz_close(first) && dbz_close(second), "dbz_close");
+
+    cleanup("dbz-test");
+    cleanup("dbz-new");
+    return 0;
+}
@@ -0,0 +1,84 @@
+/* Test suite for the shared-memory feed ring. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/buffer.h"
+#include "inn/feedring.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#define PATH "feedring.tmp"
+
+int
+main(void)
+{
+    struct feedring *writer, *reader;
+    struct buffer *buffer;
+    char record[64];
+    bool wake;
+    unsigned int i, put, got, wakes, bad;
+
+    plan(14);
+
+    unlink(PATH);
+    message_handlers_warn(0);
+
+    ok(feedring_open(PATH, 0) == NULL, "no ring to open");
+    writer = feedring_open(PATH, 200);
+    ok(writer != NULL, "create");
+    reader = feedring_open(PATH, 0);
+    ok(reader != NULL, "open existing ring");
+
+    buffer = buffer_new();
+    ok(!feedring_get(reader, buffer), "ring empty");
+    ok(feedring_put(writer, "abc", 3, &wake), "put");
+    ok(wake, "...wakes the reader up");
+    ok(feedring_put(writer, "defgh", 5, &wake) && !wake,
+       "second put doesn't");
+    ok(feedring_get(reader, buffer) && buffer->left == 3
+           && memcmp(buffer->data, "abc", 3) == 0,
+       "get first record");
+    buffer_set(buffer, NULL, 0);
+    ok(feedring_get(reader, buffer) && buffer->left == 5
+           && memcmp(buffer->data, "defgh", 5) == 0,
+       "get second record");
+    ok(!feedring_get(reader, buffer), "ring empty again");
+    ok(!feedring_put(writer, record, 300, &wake), "record too large");
+
+    /* Go around the ring many times with records of various sizes, so that
+       they often have to skip the end of the data area. */
+    put = got = wakes = bad = 0;
+    for (i = 0; i < 5000; i++) {
+        memset(record, 'a' + i % 26, sizeof(record));
+        snprintf(record, sizeof(record), "%u", put);
+        if (feedring_put(writer, record, 10 + i % 50, &wake)) {
+            put++;
+            if (wake)
+                wakes++;
+        }
+        if (i % 3 == 0)
+            continue;
+        for (;;) {
+            buffer_set(buffer, NULL, 0);
+            if (!feedring_get(reader, buffer))
+                break;
+            if ((unsigned int) atoi(buffer->data) != got)
+                bad++;
+            got++;
+        }
+    }
+    while (feedring_get(reader, buffer))
+        got++;
+    ok(put > 4000 && got == put, "all records taken (%u of %u)", got, put);
+    ok(bad == 0, "...in order");
+    ok(wakes > 0 && wakes < put, "reader woken up only when needed");
+
+    buffer_free(buffer);
+    feedring_free(reader);
+    feedring_free(writer);
+    unlink(PATH);
+    return 0;
+}
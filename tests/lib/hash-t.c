@@ -11,8 +11,15 @@ main(void)
 {
     HASH h1, h2;
     const char *text;
+    HASH hashes[5];
+    const char *ids[5] = {
+        "<lhs@test.invalid>", "<lhs@TEST.invalid>", "<PostMaster@test.invalid>",
+        "<87is2w1u6i.fsf@windlord.stanford.edu>", "<>"
+    };
+    size_t i;
+    bool same;
 
-    test_init(14);
+    test_init(15);
 
     h1 = HashMessageID("<lhs@test.invalid>");
     h2 = HashMessageID("<lhs@TEST.invalid>");
@@ -49,5 +56,13 @@ main(void)
     h2 = TextToHash("A0D432DC9718979BEFB4ACADA4BAD863");
     ok(14, HashCompare(&h1, &h2) == 0);
 
+    HashMessageIDs(ids, ARRAY_SIZE(ids), hashes);
+    for (same = true, i = 0; i < ARRAY_SIZE(ids); i++) {
+        h1 = HashMessageID(ids[i]);
+        if (HashCompare(&h1, &hashes[i]) != 0)
+            same = false;
+    }
+    ok(15, same);
+
     return 0;
 }
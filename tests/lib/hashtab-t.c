@@ -36,6 +36,14 @@ string_delete(void *entry)
     free(entry);
 }
 
+static void
+count_traverse(void *entry UNUSED, void *data)
+{
+    unsigned long *count = data;
+
+    (*count)++;
+}
+
 static void
 string_traverse(void *entry, void *data)
 {
@@ -57,6 +65,8 @@ main(void)
     FILE *words;
     bool reported;
     int i;
+    unsigned long count;
+    bool *deleted;
     char buffer[1024];
     char *word;
     char *test, *testing, *strange, *change, *foo, *bar;
@@ -70,7 +80,7 @@ main(void)
     strange = xstrdup("strange");
     change = xstrdup("change");
 
-    test_init(38);
+    test_init(41);
     hash = hash_create(4, hash_string, string_key, string_equal,
                        string_delete);
     ok(1, hash != NULL);
@@ -140,11 +150,46 @@ main(void)
     ok(36, hash_count(hash) == 6);
     hash_free(hash);
 
+    /* Many insertions and deletions, so that lookups and deletions happen
+       while the table is being expanded. */
+    hash = hash_create(4, hash_string, string_key, string_equal,
+                       string_delete);
+    deleted = xcalloc(20000, sizeof(bool));
+    reported = false;
+    for (i = 0; i < 20000; i++) {
+        snprintf(buffer, sizeof(buffer), "key%d", i);
+        if (!hash_insert(hash, buffer, xstrdup(buffer)))
+            reported = true;
+        if (hash_insert(hash, buffer, buffer))
+            reported = true;
+        if (i % 3 == 0) {
+            snprintf(buffer, sizeof(buffer), "key%d", i / 2);
+            if (!hash_delete(hash, buffer))
+                reported = true;
+            deleted[i / 2] = true;
+        }
+    }
+    ok(37, !reported);
+    reported = false;
+    for (i = 0; i < 20000; i++) {
+        snprintf(buffer, sizeof(buffer), "key%d", i);
+        word = hash_lookup(hash, buffer);
+        if (deleted[i] ? word != NULL
+                       : (word == NULL || strcmp(word, buffer) != 0))
+            reported = true;
+    }
+    free(deleted);
+    count = 0;
+    hash_traverse(hash, count_traverse, &count);
+    ok(38, !reported && count == hash_count(hash));
+    ok(39, hash_count(hash) == 20000 - 6667);
+    hash_free(hash);
+
     words = fopen("/usr/dict/words", "r");
     if (words == NULL)
         words = fopen("/usr/share/dict/words", "r");
     if (words == NULL) {
-        skip_block(37, 2, "/usr/share/dict/words not available");
+        skip_block(40, 2, "/usr/share/dict/words not available");
         exit(0);
     }
 
@@ -162,7 +207,7 @@ main(void)
             }
         }
     }
-    ok(37, !reported);
+    ok(40, !reported);
 
     if (fseek(words, 0, SEEK_SET) < 0) {
         fclose(words);
@@ -180,7 +225,7 @@ main(void)
             }
         }
     }
-    ok(38, !reported);
+    ok(41, !reported);
 
     hash_free(hash);
     fclose(words);
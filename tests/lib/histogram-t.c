@@ -0,0 +1,81 @@
+/* Test suite for latency histograms. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/buffer.h"
+#include "inn/histogram.h"
+#include "tap/basic.h"
+
+int
+main(void)
+{
+    struct histogram *hist, *other;
+    struct buffer *out;
+    unsigned long i, q;
+
+    plan(19);
+
+    hist = histogram_new();
+    is_int(0, histogram_count(hist), "new histogram is empty");
+    is_int(0, histogram_quantile(hist, 0.5), "...and has no quantiles");
+
+    /* Small durations are exact. */
+    for (i = 1; i <= 10; i++)
+        histogram_record(hist, i);
+    is_int(10, histogram_count(hist), "count");
+    is_int(5, histogram_quantile(hist, 0.45), "exact p45");
+    is_int(10, histogram_quantile(hist, 0.99), "exact p99");
+    is_int(10, histogram_quantile(hist, 1.0), "max");
+
+    /* Larger ones are within the bucket precision. */
+    histogram_reset(hist);
+    is_int(0, histogram_count(hist), "reset");
+    for (i = 1; i <= 100000; i++)
+        histogram_record(hist, i);
+    q = histogram_quantile(hist, 0.5);
+    ok(q >= 50000 && q <= 50000 * 1.07, "p50 of 1..100000 is %lu", q);
+    q = histogram_quantile(hist, 0.99);
+    ok(q >= 99000 && q <= 99000 * 1.07, "p99 is %lu", q);
+    q = histogram_quantile(hist, 0.999);
+    ok(q >= 99900 && q <= 100000, "p999 is %lu, capped at the max", q);
+
+    /* The tail shows up in p99 but not in p50. */
+    histogram_reset(hist);
+    for (i = 0; i < 980; i++)
+        histogram_record(hist, 100);
+    for (i = 0; i < 20; i++)
+        histogram_record(hist, 2000000);
+    ok(histogram_quantile(hist, 0.5) <= 107, "p50 ignores the tail");
+    q = histogram_quantile(hist, 0.99);
+    ok(q >= 2000000 && q <= 2000000 * 1.07, "p99 shows it");
+
+    /* Durations beyond the last bucket are still counted. */
+    histogram_record(hist, 4000000000UL);
+    is_int(1001, histogram_count(hist), "huge duration counted");
+    ok(histogram_quantile(hist, 1.0) == 4000000000UL, "...as the max");
+
+    out = buffer_new();
+    histogram_reset(hist);
+    histogram_record(hist, 3);
+    histogram_summary(hist, out);
+    buffer_append(out, "", 1);
+    is_string("count 1 mean 3 p50 3 p99 3 p999 3 max 3", out->data,
+              "summary");
+    buffer_free(out);
+
+    /* Merging adds the durations of another histogram. */
+    other = histogram_new();
+    histogram_record(other, 5);
+    histogram_record(other, 1000);
+    histogram_merge(hist, other);
+    is_int(3, histogram_count(hist), "merge adds the counts");
+    is_int(1000, histogram_quantile(hist, 1.0), "...and keeps the max");
+    is_int(5, histogram_quantile(hist, 0.5), "...and the buckets");
+    ok(histogram_sum(hist) == 1008, "...and the sums");
+    histogram_free(other);
+    histogram_free(hist);
+    return 0;
+}
@@ -39,7 +39,7 @@ main(void)
         }
     }
 
-    test_init(9);
+    test_init(16);
 
     if (system(cat) != 0)
         die("Unable to create stripped configuration file");
@@ -80,5 +80,35 @@ main(void)
     innconf = NULL;
     ok(9, true);
 
+    /* Snapshots. */
+    if (system(grep) != 0)
+        die("Unable to create stripped configuration file");
+    ok(10, innconf_read("config/tmp"));
+    standard = innconf;
+    innconf = NULL;
+    ok(11, innconf_write_snapshot("config/tmp"));
+    ok(12, access("config/tmp.snapshot", F_OK) == 0);
+    innconf_free(innconf);
+    innconf = NULL;
+    ok(13, innconf_read("config/tmp") && innconf_compare(standard, innconf));
+    innconf_free(standard);
+    config = fopen("config/tmp.snapshot", "r+");
+    if (config == NULL)
+        sysdie("Unable to open snapshot");
+    fputs("garbage", config);
+    fclose(config);
+    ok(14, innconf_read("config/tmp") && innconf->maxartsize != 4242);
+    ok(15, innconf_write_snapshot("config/tmp"));
+    config = fopen("config/tmp", "a");
+    if (config == NULL)
+        sysdie("Unable to open stripped configuration file for append");
+    fputs("maxartsize: 4242\n", config);
+    fclose(config);
+    ok(16, innconf_read("config/tmp") && innconf->maxartsize == 4242);
+    unlink("config/tmp");
+    unlink("config/tmp.snapshot");
+    innconf_free(innconf);
+    innconf = NULL;
+
     return 0;
 }
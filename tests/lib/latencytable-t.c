@@ -0,0 +1,75 @@
+/* Test suite for the shared table of latency histograms. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/histogram.h"
+#include "inn/latencytable.h"
+#include "inn/messages.h"
+#include "tap/basic.h"
+
+#define PATH "latencytable.tmp"
+
+int
+main(void)
+{
+    static const char *const ops[] = { "GROUP", "OVER" };
+    static const char *const others[] = { "GROUP", "BODY" };
+    struct latency_table *table, *other;
+    struct histogram *hist;
+    unsigned long bytes, slot;
+    const char *key;
+    bool found;
+
+    plan(17);
+
+    unlink(PATH);
+    message_handlers_warn(0);
+    hist = histogram_new();
+    table = latency_table_open(PATH, 2, ops, ARRAY_SIZE(ops));
+    ok(table != NULL, "create table");
+    other = latency_table_open(PATH, 16, ops, ARRAY_SIZE(ops));
+    ok(other != NULL, "open existing table");
+    ok(latency_table_open(PATH, 2, others, ARRAY_SIZE(others)) == NULL,
+       "table with other operations refused");
+
+    histogram_record(hist, 100);
+    histogram_record(hist, 300);
+    ok(latency_table_add(table, "readers", 1, hist, 2000), "add");
+    histogram_reset(hist);
+    histogram_record(hist, 500);
+    ok(latency_table_add(other, "readers", 1, hist, 1000),
+       "add from another process");
+    ok(latency_table_add(other, "peers", 0, hist, 10), "add another key");
+    ok(!latency_table_add(other, "others", 0, hist, 10),
+       "no room for a third key");
+    latency_table_free(other);
+    latency_table_free(table);
+
+    /* Read it back without knowing the operations. */
+    table = latency_table_open(PATH, 0, NULL, 0);
+    ok(table != NULL, "open read-only");
+    is_int(2, latency_table_slots(table), "slots from the file");
+    is_int(2, latency_table_ops(table), "operations from the file");
+    is_string("OVER", latency_table_opname(table, 1), "operation name");
+    ok(latency_table_opname(table, 2) == NULL, "no such operation");
+    found = false;
+    for (slot = 0; slot < latency_table_slots(table); slot++) {
+        key = latency_table_key(table, slot);
+        if (key == NULL || strcmp(key, "readers") != 0)
+            continue;
+        found = true;
+        ok(latency_table_get(table, slot, 1, hist, &bytes), "get");
+        is_int(3000, bytes, "...bytes added up");
+        is_int(3, histogram_count(hist), "...histograms merged");
+        is_int(500, histogram_quantile(hist, 1.0), "...with their max");
+    }
+    ok(found, "key found");
+    latency_table_free(table);
+
+    histogram_free(hist);
+    unlink(PATH);
+    return 0;
+}
@@ -0,0 +1,607 @@
+/*
+**  Microbenchmarks for the primitives of the INN library.
+**
+**  Times uwildmat on newsfeeds-like patterns, wire_findbody and
+**  wire_findheader on the articles of the test suite, the hash table and
+**  ternary search trie, HashMessageID, dbzstore and dbzfetch, and QIOread.
+**  All data is generated from a fixed seed, and each benchmark is run
+**  several times so that the best and median times can be compared from one
+**  build to another.
+**
+**  The output has one line per benchmark with tab-separated fields:  its
+**  name, the number of operations in a run, the nanoseconds per operation
+**  of the best and of the median run, and the operations per second of the
+**  best run.  Lines starting with "#" are comments.
+**
+**  This is not part of the test suite; run it with "make bench" in the
+**  tests directory, or directly with options to change the workload and
+**  uwildmat patterns to select benchmarks by name.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include "inn/buffer.h"
+#include "inn/dbz.h"
+#include "inn/hashtab.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/qio.h"
+#include "inn/tst.h"
+#include "inn/wire.h"
+
+/* Directory holding the temporary files of the benchmarks. */
+#define BENCH_DIR "libbench-tmp"
+
+/* Number of generated newsgroups, and of message-IDs at scale 1. */
+#define NGROUPS 5000
+#define NIDS    100000
+
+/* A benchmark.  run does count operations and returns the seconds they
+   took, without its own setup.  Those with a count of 0 do one operation
+   per generated message-ID. */
+struct bench {
+    const char *name;
+    unsigned long count;
+    double (*run)(unsigned long count);
+};
+
+/* Newsfeeds-like patterns, one per outgoing site. */
+static const char *const patterns[] = {
+    "*,!junk,!control,!control.*,!local.*,@alt.binaries.*,!*.test",
+    "comp.*,news.*,sci.*,!*.binaries.*,!*.jobs*,@alt.sex*",
+    "*,!alt.*,alt.folklore.*,alt.usage.*,!de.alt.*",
+    "de.*,at.*,ch.*,!de.alt.dateien.*,@*bina*",
+    "*,!*.test,!*.answers,news.answers,!control*,!junk",
+};
+
+/* Components of the generated newsgroup names. */
+static const char *const hierarchies[] = {
+    "alt", "comp", "news", "rec", "sci", "soc", "misc", "talk", "humanities",
+    "de", "fr", "at", "ch", "local", "alt.binaries", "alt.sex", "control",
+};
+static const char *const words[] = {
+    "lang", "c", "perl", "os", "linux", "misc", "answers", "admin", "test",
+    "folklore", "usage", "jobs", "pictures", "sounds", "sport", "football",
+    "physics", "math", "announce", "software", "dateien", "bina", "groups",
+};
+
+/* The generated data, and the articles of the test suite in wire format. */
+static char *groups[NGROUPS];
+static char **msgids;
+static HASH *hashes;
+static unsigned long nids;
+static char **articles;
+static size_t *sizes;
+static size_t narticles;
+
+/* Where results go so that the compiler can't drop the work. */
+static volatile unsigned long sink;
+
+
+/*
+**  Return the number of seconds elapsed since start.
+*/
+static double
+elapsed(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec)
+           + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+
+/*
+**  Generate the newsgroup names and message-IDs.
+*/
+static void
+generate(unsigned long scale)
+{
+    struct buffer *name;
+    unsigned long i, j, depth;
+
+    srandom(1);
+    name = buffer_new();
+    for (i = 0; i < NGROUPS; i++) {
+        buffer_sprintf(name, "%s",
+                       hierarchies[random() % ARRAY_SIZE(hierarchies)]);
+        depth = 1 + random() % 3;
+        for (j = 0; j < depth; j++)
+            buffer_append_sprintf(name, ".%s",
+                                  words[random() % ARRAY_SIZE(words)]);
+        buffer_append_sprintf(name, "%lu", i);
+        buffer_append(name, "", 1);
+        groups[i] = xstrdup(name->data);
+    }
+    buffer_free(name);
+    nids = NIDS * scale;
+    msgids = xmalloc(nids * sizeof(char *));
+    hashes = xmalloc(nids * sizeof(HASH));
+    for (i = 0; i < nids; i++) {
+        xasprintf(&msgids[i], "<%lu.%lx$%lu@news%lu.example.com>",
+                  (unsigned long) random(), (unsigned long) random(), i,
+                  (unsigned long) random() % 100);
+        hashes[i] = HashMessageID(msgids[i]);
+    }
+}
+
+
+/*
+**  Read the articles of the test suite, converting the ones in native
+**  format to wire format.
+*/
+static void
+load_articles(void)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct buffer *data;
+    char *path;
+    int fd;
+    size_t allocated = 0;
+
+    dir = opendir("../data/articles");
+    if (dir == NULL)
+        sysdie("cannot open ../data/articles");
+    data = buffer_new();
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        path = concatpath("../data/articles", entry->d_name);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            sysdie("cannot open %s", path);
+        buffer_set(data, NULL, 0);
+        if (!buffer_read_file(data, fd))
+            sysdie("cannot read %s", path);
+        close(fd);
+        free(path);
+        if (narticles == allocated) {
+            allocated += 32;
+            articles = xreallocarray(articles, allocated, sizeof(char *));
+            sizes = xreallocarray(sizes, allocated, sizeof(size_t));
+        }
+        if (strncmp(entry->d_name, "wire-", 5) == 0) {
+            articles[narticles] = xmalloc(data->left);
+            memcpy(articles[narticles], data->data, data->left);
+            sizes[narticles] = data->left;
+        } else
+            articles[narticles] = wire_from_native(data->data, data->left,
+                                                   &sizes[narticles]);
+        narticles++;
+    }
+    closedir(dir);
+    buffer_free(data);
+    if (narticles == 0)
+        die("no articles in ../data/articles");
+}
+
+
+/*
+**  uwildmat, interpreting each pattern for each newsgroup.
+*/
+static double
+run_uwildmat(unsigned long count)
+{
+    struct timeval start;
+    unsigned long i, matched = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (uwildmat_poison(groups[i % NGROUPS],
+                            patterns[i % ARRAY_SIZE(patterns)])
+            == UWILDMAT_MATCH)
+            matched++;
+    sink = matched;
+    return elapsed(&start);
+}
+
+
+/*
+**  uwildmat_match, with the patterns compiled beforehand.
+*/
+static double
+run_uwildmat_match(unsigned long count)
+{
+    struct wildmat *compiled[ARRAY_SIZE(patterns)];
+    struct timeval start;
+    unsigned long i, matched = 0;
+    double seconds;
+
+    for (i = 0; i < ARRAY_SIZE(patterns); i++)
+        compiled[i] = uwildmat_compile(patterns[i], true);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (uwildmat_match(compiled[i % ARRAY_SIZE(patterns)],
+                           groups[i % NGROUPS])
+            == UWILDMAT_MATCH)
+            matched++;
+    seconds = elapsed(&start);
+    for (i = 0; i < ARRAY_SIZE(patterns); i++)
+        uwildmat_free(compiled[i]);
+    sink = matched;
+    return seconds;
+}
+
+
+/*
+**  wire_findbody and wire_findheader over the articles.
+*/
+static double
+run_wire_findbody(unsigned long count)
+{
+    struct timeval start;
+    unsigned long i, found = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (wire_findbody(articles[i % narticles], sizes[i % narticles])
+            != NULL)
+            found++;
+    sink = found;
+    return elapsed(&start);
+}
+
+static double
+run_wire_findheader(unsigned long count)
+{
+    static const char *const headers[] = {
+        "Message-ID", "Xref", "Newsgroups", "Lines",
+    };
+    struct timeval start;
+    unsigned long i, found = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (wire_findheader(articles[i % narticles], sizes[i % narticles],
+                            headers[i % ARRAY_SIZE(headers)], true)
+            != NULL)
+            found++;
+    sink = found;
+    return elapsed(&start);
+}
+
+
+/*
+**  The hash table, keyed by message-ID as in the innd caches.
+*/
+static const void *
+string_key(const void *entry)
+{
+    return entry;
+}
+
+static bool
+string_equal(const void *key, const void *entry)
+{
+    return strcmp(key, entry) == 0;
+}
+
+static void
+string_keep(void *entry UNUSED)
+{
+}
+
+static struct hash *
+hash_fill(unsigned long count)
+{
+    struct hash *hash;
+    unsigned long i;
+
+    hash = hash_create(16, hash_string, string_key, string_equal,
+                       string_keep);
+    for (i = 0; i < count; i++)
+        hash_insert(hash, msgids[i], msgids[i]);
+    return hash;
+}
+
+static double
+run_hash_insert(unsigned long count)
+{
+    struct hash *hash;
+    struct timeval start;
+    double seconds;
+
+    gettimeofday(&start, NULL);
+    hash = hash_fill(count);
+    seconds = elapsed(&start);
+    sink = hash_count(hash);
+    hash_free(hash);
+    return seconds;
+}
+
+static double
+run_hash_lookup(unsigned long count)
+{
+    struct hash *hash;
+    struct timeval start;
+    unsigned long i, found = 0;
+    double seconds;
+
+    /* Half of the lookups are for message-IDs which aren't there. */
+    hash = hash_fill(nids / 2);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (hash_lookup(hash, msgids[i % nids]) != NULL)
+            found++;
+    seconds = elapsed(&start);
+    hash_free(hash);
+    sink = found;
+    return seconds;
+}
+
+
+/*
+**  The ternary search trie, keyed by newsgroup name as in innd.
+*/
+static struct tst *
+tst_fill(void)
+{
+    struct tst *tst;
+    unsigned long i;
+
+    tst = tst_init(NGROUPS);
+    for (i = 0; i < NGROUPS / 2; i++)
+        tst_insert(tst, (const unsigned char *) groups[i], groups[i], 0,
+                   NULL);
+    return tst;
+}
+
+static double
+run_tst_insert(unsigned long count)
+{
+    struct tst *tst;
+    struct timeval start;
+    unsigned long i, done;
+    double seconds = 0;
+
+    /* Build as many tries of all the newsgroups as needed. */
+    for (done = 0; done < count; done += NGROUPS) {
+        tst = tst_init(NGROUPS);
+        gettimeofday(&start, NULL);
+        for (i = 0; i < NGROUPS && done + i < count; i++)
+            tst_insert(tst, (const unsigned char *) groups[i], groups[i], 0,
+                       NULL);
+        seconds += elapsed(&start);
+        tst_cleanup(tst);
+    }
+    return seconds;
+}
+
+static double
+run_tst_search(unsigned long count)
+{
+    struct tst *tst;
+    struct timeval start;
+    unsigned long i, found = 0;
+    double seconds;
+
+    /* Half of the searches are for newsgroups which aren't there. */
+    tst = tst_fill();
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (tst_search(tst, (const unsigned char *) groups[i % NGROUPS])
+            != NULL)
+            found++;
+    seconds = elapsed(&start);
+    tst_cleanup(tst);
+    sink = found;
+    return seconds;
+}
+
+
+/*
+**  HashMessageID.
+*/
+static double
+run_hashmessageid(unsigned long count)
+{
+    struct timeval start;
+    unsigned long i, total = 0;
+    HASH hash;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+        hash = HashMessageID(msgids[i % nids]);
+        total += (unsigned char) hash.hash[0];
+    }
+    sink = total;
+    return elapsed(&start);
+}
+
+
+/*
+**  dbzstore into a fresh database sized for the entries, and dbzfetch from
+**  one where half of the message-IDs are.
+*/
+/* Room is made for twice the entries, so that the table doesn't grow. */
+static void
+dbz_create(unsigned long count)
+{
+    if (system("rm -rf " BENCH_DIR) < 0 || mkdir(BENCH_DIR, 0755) < 0)
+        sysdie("cannot create " BENCH_DIR);
+    if (!dbzfresh(BENCH_DIR "/history", dbzsize(count * 2)))
+        sysdie("cannot create dbz database");
+}
+
+static double
+run_dbzstore(unsigned long count)
+{
+    struct timeval start;
+    unsigned long i;
+    double seconds;
+
+    dbz_create(count);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (dbzstore(hashes[i], (off_t) i * 100) == DBZSTORE_ERROR)
+            die("dbzstore failed");
+    seconds = elapsed(&start);
+    dbzclose();
+    return seconds;
+}
+
+static double
+run_dbzfetch(unsigned long count)
+{
+    struct timeval start;
+    unsigned long i, found = 0;
+    off_t offset;
+    double seconds;
+
+    dbz_create(nids / 2);
+    for (i = 0; i < nids / 2; i++)
+        dbzstore(hashes[i], (off_t) i * 100);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+        if (dbzfetch(hashes[i % nids], &offset))
+            found++;
+    seconds = elapsed(&start);
+    dbzclose();
+    sink = found;
+    return seconds;
+}
+
+
+/*
+**  QIOread over a file of history lines.
+*/
+static double
+run_qioread(unsigned long count)
+{
+    QIOSTATE *qp;
+    FILE *F;
+    struct timeval start;
+    unsigned long i, length = 0;
+    double seconds;
+
+    if (system("rm -rf " BENCH_DIR) < 0 || mkdir(BENCH_DIR, 0755) < 0)
+        sysdie("cannot create " BENCH_DIR);
+    F = fopen(BENCH_DIR "/lines", "w");
+    if (F == NULL)
+        sysdie("cannot create " BENCH_DIR "/lines");
+    for (i = 0; i < count; i++)
+        fprintf(F, "[%s]\t%lu~-~%lu\t@0301000000000000%08lx0000@\n",
+                HashToText(hashes[i % nids]), 1700000000 + i, i, i);
+    if (fclose(F) == EOF)
+        sysdie("cannot write " BENCH_DIR "/lines");
+    gettimeofday(&start, NULL);
+    qp = QIOopen(BENCH_DIR "/lines");
+    if (qp == NULL)
+        sysdie("cannot open " BENCH_DIR "/lines");
+    for (i = 0; QIOread(qp) != NULL; i++)
+        length += QIOlength(qp);
+    seconds = elapsed(&start);
+    QIOclose(qp);
+    if (i != count)
+        die("QIOread read %lu lines instead of %lu", i, count);
+    sink = length;
+    return seconds;
+}
+
+
+static const struct bench benches[] = {
+    { "uwildmat",          500000, run_uwildmat        },
+    { "uwildmat_match",    500000, run_uwildmat_match  },
+    { "wire_findbody",     500000, run_wire_findbody   },
+    { "wire_findheader",   500000, run_wire_findheader },
+    { "hash_insert",       0,      run_hash_insert     },
+    { "hash_lookup",       500000, run_hash_lookup     },
+    { "tst_insert",        500000, run_tst_insert      },
+    { "tst_search",        500000, run_tst_search      },
+    { "HashMessageID",     500000, run_hashmessageid   },
+    { "dbzstore",          0,      run_dbzstore        },
+    { "dbzfetch",          500000, run_dbzfetch        },
+    { "QIOread",           500000, run_qioread         },
+};
+
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    const struct bench *b;
+    unsigned long scale = 1, runs = 5, count, i, r;
+    double *times;
+    int option, n;
+    bool selected;
+
+    message_program_name = "libbench";
+    while ((option = getopt(argc, argv, "n:r:")) != EOF) {
+        switch (option) {
+        case 'n':
+            scale = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            runs = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            die("usage: libbench [-n scale] [-r runs] [pattern ...]");
+        }
+    }
+    if (scale == 0 || runs == 0)
+        die("invalid scale or number of runs");
+
+    /* Find the articles of the test suite, as the other tests do. */
+    if (access("../data/articles", F_OK) < 0)
+        if (access("data/articles", F_OK) == 0)
+            if (chdir("lib") != 0)
+                sysdie("cannot cd to lib");
+    innconf = xcalloc(1, sizeof(struct innconf));
+    generate(scale);
+    load_articles();
+    times = xmalloc(runs * sizeof(double));
+
+    printf("# %lu runs, scale %lu, %lu articles\n", runs, scale,
+           (unsigned long) narticles);
+    printf("# benchmark\toperations\tns/op-best\tns/op-median\tops/s-best\n");
+    for (i = 0; i < ARRAY_SIZE(benches); i++) {
+        b = &benches[i];
+        selected = (optind == argc);
+        for (n = optind; n < argc && !selected; n++)
+            selected = uwildmat(b->name, argv[n]);
+        if (!selected)
+            continue;
+        count = (b->count == 0) ? nids : b->count * scale;
+        for (r = 0; r < runs; r++)
+            times[r] = b->run(count);
+        qsort(times, runs, sizeof(double), compare_double);
+        printf("%s\t%lu\t%.1f\t%.1f\t%.0f\n", b->name, count,
+               times[0] * 1e9 / count, times[runs / 2] * 1e9 / count,
+               times[0] > 0 ? count / times[0] : 0.0);
+        fflush(stdout);
+    }
+
+    if (system("rm -rf " BENCH_DIR) < 0)
+        syswarn("cannot remove " BENCH_DIR);
+    for (i = 0; i < NGROUPS; i++)
+        free(groups[i]);
+    for (i = 0; i < nids; i++)
+        free(msgids[i]);
+    for (i = 0; i < narticles; i++)
+        free(articles[i]);
+    free(msgids);
+    free(hashes);
+    free(articles);
+    free(sizes);
+    free(times);
+    return 0;
+}
@@ -92,8 +92,12 @@ main(void)
     unsigned char *data;
     struct md5_context context;
     char hexdigest[33];
+    const unsigned char *many[200];
+    size_t lengths[200];
+    unsigned char digests[200 * 16], digest[16];
+    bool same;
 
-    test_init(12 + ARRAY_SIZE(testdata));
+    test_init(13 + ARRAY_SIZE(testdata));
 
     test_md5(1, "93b885adfe0da089cdf634904fd59f71", SUC"\0", 1);
     test_md5(2, "e94a053c3fbfcfb22b4debaa11af7718", SUC"\0ab\n", 4);
@@ -133,7 +137,20 @@ main(void)
     }
     test_md5(12, "57edf4a22be3c955ac49da2e2107b67a", data, 80);
 
-    n = 13;
+    /* Several buffers at once, of lengths around the block boundaries. */
+    for (i = 0; i < 200; i++) {
+        many[i] = data + i;
+        lengths[i] = (i * 37) % 300;
+    }
+    md5_hash_many(many, lengths, 200, digests);
+    for (same = true, i = 0; i < 200; i++) {
+        md5_hash(many[i], lengths[i], digest);
+        if (memcmp(digest, digests + i * 16, 16) != 0)
+            same = false;
+    }
+    ok(13, same);
+
+    n = 14;
     for (i = 0; i < ARRAY_SIZE(testdata); i++)
         test_md5(n++, testhash[i], testdata[i], ustrlen(testdata[i]));
 
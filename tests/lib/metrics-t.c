@@ -0,0 +1,48 @@
+/* Test suite for the formatting of metrics. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/buffer.h"
+#include "inn/metrics.h"
+#include "tap/basic.h"
+
+/* Check the contents of the buffer and empty it. */
+static void
+is_output(struct buffer *out, const char *expected, const char *label)
+{
+    buffer_append(out, "", 1);
+    is_string(expected, out->data, "%s", label);
+    buffer_set(out, NULL, 0);
+}
+
+int
+main(void)
+{
+    struct buffer *out;
+
+    plan(6);
+
+    out = buffer_new();
+    metrics_family(out, "innd_articles", "counter", "Articles received.");
+    is_output(out, "# TYPE innd_articles counter\n"
+              "# HELP innd_articles Articles received.\n", "family");
+    metrics_sample(out, "innd_up", 1, (char *) NULL);
+    is_output(out, "innd_up 1\n", "sample without labels");
+    metrics_sample(out, "innd_articles_total", 12345678901.0, "peer",
+                   "news.example.com", "result", "accepted", (char *) NULL);
+    is_output(out, "innd_articles_total{peer=\"news.example.com\","
+              "result=\"accepted\"} 12345678901\n", "sample with labels");
+    metrics_sample(out, "innd_bytes", 0.5, "site", "a\"b\\c\nd",
+                   (char *) NULL);
+    is_output(out, "innd_bytes{site=\"a\\\"b\\\\c\\nd\"} 0.5\n",
+              "escaped label value");
+    metrics_sample(out, "innd_empty", 0, "site", "", (char *) NULL);
+    is_output(out, "innd_empty{site=\"\"} 0\n", "empty label value");
+    metrics_end(out);
+    is_output(out, "# EOF\n", "end");
+    buffer_free(out);
+    return 0;
+}
@@ -299,6 +299,59 @@ test_timeout_ipv4(void)
 }
 
 
+/*
+ * Test racing connections to several addresses.  The first address of the
+ * list has nothing listening on it, so the connection has to fall back on the
+ * second one, and then a race where every address is refused.
+ */
+static void
+test_race_ipv4(void)
+{
+    socket_type fd, c;
+    struct addrinfo hints, *refused, *listening;
+    struct network_race *race;
+    fd_set set;
+    socket_type maxfd;
+    double wait;
+
+    fd = network_bind_ipv4(SOCK_STREAM, "127.0.0.1", 11119);
+    if (fd == INVALID_SOCKET)
+        sysbail("cannot create or bind socket");
+    if (listen(fd, 1) < 0)
+        sysbail("cannot listen to socket");
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", "11120", &hints, &refused) != 0)
+        bail("cannot resolve 127.0.0.1");
+    if (getaddrinfo("127.0.0.1", "11119", &hints, &listening) != 0)
+        bail("cannot resolve 127.0.0.1");
+    refused->ai_next = listening;
+
+    alarm(10);
+    c = network_connect(refused, NULL, 0);
+    ok(c != INVALID_SOCKET, "Race: fell back on the second address");
+    if (c != INVALID_SOCKET)
+        socket_close(c);
+
+    refused->ai_next = NULL;
+    race = network_race_start(refused, NULL, 0.1, 0);
+    do {
+        c = network_race_poll(race, &set, &maxfd, &wait);
+        if (c == INVALID_SOCKET && socket_errno == EINPROGRESS)
+            select(maxfd + 1, NULL, &set, NULL, NULL);
+    } while (c == INVALID_SOCKET && socket_errno == EINPROGRESS);
+    ok(c == INVALID_SOCKET, "...and failed when every address is refused");
+    is_int(ECONNREFUSED, socket_errno, "...with correct error code");
+    network_race_free(race);
+    alarm(0);
+
+    freeaddrinfo(refused);
+    freeaddrinfo(listening);
+    socket_close(fd);
+}
+
+
 /*
  * Test the network read function with a timeout.  We fork off a child process
  * that runs delay_writer, and then we read from the network twice, once with
@@ -439,7 +492,7 @@ int
 main(void)
 {
     /* Set up the plan. */
-    plan(22);
+    plan(25);
 
     /* Test network_client_create. */
     test_create_ipv4(NULL);
@@ -448,6 +501,9 @@ main(void)
     /* Test network_connect with a timeout. */
     test_timeout_ipv4();
 
+    /* Test racing connections to several addresses. */
+    test_race_ipv4();
+
     /* Test network_read and network_write. */
     test_network_read();
     test_network_write();
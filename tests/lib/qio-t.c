@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "inn/qio.h"
 #include "inn/libinn.h"
@@ -21,6 +22,53 @@ output(int fd, const void *data, size_t size)
 }
 
 
+/*
+**  Read the lines of a file with lines of count * 256 bytes and shorter
+**  ones in it through a pipe, which QIO can't map, writing the file in a
+**  child process.  Returns the number of lines read, not counting those
+**  that were too long, or -1 on an error.
+*/
+static int
+read_pipe(const char *file)
+{
+    int fds[2], fd, lines;
+    QIOSTATE *qio;
+    char buffer[8192];
+    ssize_t n;
+    pid_t child;
+
+    if (pipe(fds) < 0)
+        sysbail("Can't create pipe");
+    child = fork();
+    if (child < 0)
+        sysbail("Can't fork");
+    else if (child == 0) {
+        close(fds[0]);
+        fd = open(file, O_RDONLY);
+        if (fd < 0)
+            _exit(1);
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+            if (xwrite(fds[1], buffer, n) < 0)
+                _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    qio = QIOfdopen(fds[0]);
+    lines = 0;
+    while (1) {
+        if (QIOread(qio) != NULL)
+            lines++;
+        else if (!QIOtoolong(qio))
+            break;
+    }
+    if (QIOerror(qio))
+        lines = -1;
+    QIOclose(qio);
+    waitpid(child, NULL, 0);
+    return lines;
+}
+
+
 int
 main(void)
 {
@@ -68,7 +116,27 @@ main(void)
     output(fd, line, 256);
     close(fd);
 
-    plan(36);
+    plan(42);
+
+    /* Reading through a pipe should see the same lines, even though the
+       buffer grows to more than QIO_BUFFERSIZE along the way. */
+    is_int(read_pipe(".testout"), 2 * count + 5,
+           "Read the right number of lines through a pipe");
+
+    /* A file opened at an offset which isn't aligned on a page is mapped
+       from that offset. */
+    fd = open(".testout", O_RDONLY);
+    if (fd < 0)
+        sysbail("Can't open .testout");
+    if (lseek(fd, 256, SEEK_SET) < 0)
+        sysbail("Can't seek in .testout");
+    qio = QIOfdopen(fd);
+    result = QIOread(qio);
+    ok(result != NULL && !strcmp(result, (char *) out),
+       "Read from an offset");
+    is_int(QIOtell(qio), 256, "...and QIOtell is relative to it");
+    ok(lseek(fd, 0, SEEK_CUR) > 256, "...and the descriptor moved on");
+    QIOclose(qio);
 
     /* Now make sure we can read all that back correctly. */
     qio = QIOopen(".testout");
@@ -134,8 +202,10 @@ main(void)
     result = QIOread(qio);
     ok(!result, "End of file reached");
     ok(!QIOerror(qio), "...with no error");
+    ok(!QIOhasline(qio), "...and no line is buffered");
     is_int(QIOrewind(qio), 0, "QIOrewind works");
     is_int(QIOtell(qio), 0, "...and QIOtell is correct");
+    ok(QIOhasline(qio), "...and a line is buffered");
     result = QIOread(qio);
     ok(!QIOerror(qio), "Reading the first line works");
     is_int(QIOlength(qio), 255, "...and QIOlength is correct");
@@ -0,0 +1,74 @@
+/* Test suite for the token buckets limiting the rate of a flow of bytes. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/messages.h"
+#include "inn/ratelimit.h"
+#include "tap/basic.h"
+
+#define PATH "ratelimit.tmp"
+
+/* Whether two delays are the same, within rounding. */
+static bool
+near(double got, double wanted)
+{
+    return got > wanted - 1e-9 && got < wanted + 1e-9;
+}
+
+int
+main(void)
+{
+    struct ratelimit bucket;
+    struct ratelimit_table *table, *other;
+
+    plan(14);
+
+    /* 1000 bytes per second, with a burst of one second's worth. */
+    ratelimit_init(&bucket, 1000, 0);
+    ok(near(ratelimit_charge(&bucket, 1000, 100.0), 0),
+       "full bucket sends a burst at once");
+    ok(near(ratelimit_charge(&bucket, 500, 100.0), 0.5),
+       "...then waits for the rate");
+    ok(near(ratelimit_charge(&bucket, 500, 100.5), 0.5),
+       "...including for what is already owed");
+    ok(near(ratelimit_charge(&bucket, 1000, 110.0), 0),
+       "bucket fills up again while idle");
+    ok(near(ratelimit_charge(&bucket, 1000, 110.0), 1.0),
+       "...up to the burst only");
+
+    ratelimit_init(&bucket, 1000, 4000);
+    ok(near(ratelimit_charge(&bucket, 4000, 0.0), 0), "larger burst");
+    ok(near(ratelimit_charge(&bucket, 100, 0.0), 0.1), "...then the rate");
+
+    ratelimit_init(&bucket, 0, 0);
+    ok(near(ratelimit_charge(&bucket, 1000000, 0.0), 0), "no rate, no limit");
+
+    /* Shared buckets. */
+    unlink(PATH);
+    message_handlers_warn(0);
+    table = ratelimit_table_open(PATH, 16);
+    ok(table != NULL, "create table");
+    other = ratelimit_table_open(PATH, 1);
+    ok(other != NULL, "open existing table");
+    ok(near(ratelimit_table_charge(table, "readers", 1000, 0, 1000, 50.0), 0),
+       "shared bucket sends a burst");
+    ok(near(ratelimit_table_charge(other, "readers", 1000, 0, 1000, 50.0),
+            1.0),
+       "...then another process waits");
+    ok(near(ratelimit_table_charge(other, "readers", 0, 0, 1000, 50.0), 0),
+       "no rate, no limit");
+    ratelimit_table_free(other);
+    ratelimit_table_free(table);
+
+    table = ratelimit_table_open(PATH, 16);
+    ok(near(ratelimit_table_charge(table, "readers", 1000, 0, 1000, 50.0),
+            2.0),
+       "bucket kept in the file");
+    ratelimit_table_free(table);
+
+    unlink(PATH);
+    return 0;
+}
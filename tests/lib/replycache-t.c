@@ -0,0 +1,61 @@
+/* Test suite for the shared cache of ready-to-send replies. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/buffer.h"
+#include "inn/messages.h"
+#include "inn/replycache.h"
+#include "tap/basic.h"
+
+#define PATH "replycache.tmp"
+
+int
+main(void)
+{
+    struct replycache *cache, *other;
+    struct buffer *reply;
+    char big[200];
+
+    plan(14);
+
+    unlink(PATH);
+    message_handlers_warn(0);
+    reply = buffer_new();
+
+    cache = replycache_open(PATH, 1024, 128);
+    ok(cache != NULL, "create");
+    ok(!replycache_get(cache, "misc.test 1 10", reply), "nothing cached yet");
+    ok(replycache_put(cache, "misc.test 1 10", "1\tSubject\r\n", 11),
+       "put");
+    ok(replycache_get(cache, "misc.test 1 10", reply), "get");
+    ok(reply->left == 11 && memcmp(reply->data, "1\tSubject\r\n", 11) == 0,
+       "...with the reply");
+    ok(!replycache_get(cache, "misc.test 1 11", reply), "other key missing");
+
+    memset(big, 'a', sizeof(big));
+    ok(!replycache_put(cache, "misc.test 1 12", big, sizeof(big)),
+       "reply longer than a slot not stored");
+    ok(!replycache_get(cache, "misc.test 1 12", reply), "...and not found");
+    ok(replycache_put(cache, "misc.test 1 12", big, 128), "reply of a slot");
+    ok(replycache_get(cache, "misc.test 1 12", reply) && reply->left == 128,
+       "...found");
+
+    /* Another process sees the same cache, with its existing layout. */
+    other = replycache_open(PATH, 1, 1);
+    ok(other != NULL, "open existing cache");
+    ok(replycache_get(other, "misc.test 1 12", reply) && reply->left == 128,
+       "...sees the reply");
+    ok(replycache_put(other, "misc.test 1 12", "2\r\n", 3), "replace");
+    ok(replycache_get(cache, "misc.test 1 12", reply) && reply->left == 3
+           && memcmp(reply->data, "2\r\n", 3) == 0,
+       "...seen by the first");
+
+    replycache_free(other);
+    replycache_free(cache);
+    buffer_free(reply);
+    unlink(PATH);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/* Test suite for the statistics of the timers. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/buffer.h"
+#include "inn/messages.h"
+#include "inn/timer.h"
+#include "tap/basic.h"
+
+static const char *const labels[] = { "outer", "inner" };
+
+int
+main(void)
+{
+    struct buffer *out;
+    unsigned int i;
+
+    plan(7);
+
+    message_handlers_notice(0);
+    out = buffer_new();
+    TMRinit(TMR_APPLICATION + 2);
+    TMRstats(out, "timer", labels, false);
+    is_int(0, out->left, "nothing reported before any timer is stopped");
+
+    /* One top-level timer with a nested one. */
+    for (i = 0; i < 3; i++) {
+        TMRstart(TMR_APPLICATION);
+        TMRstart(TMR_APPLICATION + 1);
+        TMRstop(TMR_APPLICATION + 1);
+        TMRstop(TMR_APPLICATION);
+    }
+    TMRstart(TMR_HISHAVE);
+    TMRstop(TMR_HISHAVE);
+    TMRstats(out, "timer", labels, false);
+    buffer_append(out, "", 1);
+    ok(strncmp(out->data, "timer hishave count 1 mean ", 27) == 0,
+       "library timer");
+    ok(strstr(out->data, "\ntimer outer count 3 mean ") != NULL,
+       "top-level timer");
+    ok(strstr(out->data, "\ntimer inner/outer count 3 mean ") != NULL,
+       "nested timer");
+    ok(strstr(out->data, " min ") != NULL, "minimum reported");
+
+    /* The summary doesn't reset the statistics, but a reset does. */
+    TMRsummary(NULL, labels);
+    buffer_set(out, NULL, 0);
+    TMRstats(out, NULL, labels, true);
+    buffer_append(out, "", 1);
+    ok(strncmp(out->data, "hishave count 1 ", 16) == 0,
+       "statistics kept by the summary, without prefix");
+    buffer_set(out, NULL, 0);
+    TMRstats(out, NULL, labels, false);
+    is_int(0, out->left, "...and cleared by a reset");
+
+    TMRfree();
+    buffer_free(out);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/* Test suite for the shared message-ID to token cache. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/tokencache.h"
+#include "tap/basic.h"
+
+#define PATH "tokencache.tmp"
+
+/* Return a token whose contents depend on n. */
+static TOKEN
+make_token(unsigned int n)
+{
+    TOKEN token;
+
+    memset(&token, 0, sizeof(token));
+    token.type = 1;
+    token.class = 2;
+    memcpy(token.token, &n, sizeof(n));
+    return token;
+}
+
+int
+main(void)
+{
+    struct tokencache *cache, *other;
+    TOKEN token, found;
+    HASH hash;
+    char msgid[64];
+    unsigned int i, hits;
+
+    plan(10);
+
+    unlink(PATH);
+    message_handlers_warn(0);
+
+    cache = tokencache_open(PATH, 64);
+    ok(cache != NULL, "create");
+    hash = HashMessageID("<1@example.com>");
+    ok(!tokencache_get(cache, &hash, &found), "nothing cached yet");
+    token = make_token(1);
+    tokencache_add(cache, &hash, &token);
+    ok(tokencache_get(cache, &hash, &found), "add and get");
+    ok(memcmp(&found, &token, sizeof(token)) == 0, "...with the token");
+    token = make_token(2);
+    tokencache_add(cache, &hash, &token);
+    ok(tokencache_get(cache, &hash, &found)
+           && memcmp(&found, &token, sizeof(token)) == 0,
+       "token replaced");
+
+    /* Another process sees the same cache, with its existing size. */
+    other = tokencache_open(PATH, 1);
+    ok(other != NULL, "open existing cache");
+    ok(tokencache_get(other, &hash, &found)
+           && memcmp(&found, &token, sizeof(token)) == 0,
+       "...sees the token");
+
+    /* Filling the cache well past its size evicts entries, but the entry
+       looked up again and again stays. */
+    for (i = 0; i < 1000; i++) {
+        snprintf(msgid, sizeof(msgid), "<%u@fill.example.com>", i);
+        hash = HashMessageID(msgid);
+        token = make_token(i);
+        tokencache_add(other, &hash, &token);
+        hash = HashMessageID("<1@example.com>");
+        tokencache_get(cache, &hash, &found);
+    }
+    ok(tokencache_get(cache, &hash, &found), "referenced entry kept");
+    for (hits = 0, i = 0; i < 1000; i++) {
+        snprintf(msgid, sizeof(msgid), "<%u@fill.example.com>", i);
+        hash = HashMessageID(msgid);
+        if (tokencache_get(cache, &hash, &found)) {
+            token = make_token(i);
+            if (memcmp(&found, &token, sizeof(token)) == 0)
+                hits++;
+        }
+    }
+    ok(hits > 0 && hits <= 64, "size is bounded (%u entries found)", hits);
+    ok(tokencache_get(cache, &hash, &found), "last one added is there");
+
+    tokencache_free(other);
+    tokencache_free(cache);
+    unlink(PATH);
+    return 0;
+}
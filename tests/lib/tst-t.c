@@ -24,6 +24,8 @@ main(void)
     bool reported;
     void *existing;
     unsigned char *word;
+    char key[32];
+    int i, j;
 
     char test[] = "test";
     char t[] = "t";
@@ -32,7 +34,7 @@ main(void)
     char Strange[] = "Strange";
     char change[] = "\231hange";
 
-    test_init(38);
+    test_init(41);
 
     tst = tst_init(2);
     ok(1, tst != NULL);
@@ -73,11 +75,57 @@ main(void)
     tst_cleanup(tst);
     ok(36, true);
 
+    /* Keep a window of 500 keys while many more go through the trie, the
+       way the nnrpd cache uses it, so that deleted nodes get reused and the
+       trie gets compacted along the way. */
+    tst = tst_init(10);
+    reported = false;
+    for (i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "%08x%d", (unsigned int) i * 2654435761U,
+                 i);
+        if (tst_insert(tst, SUC key, tst, 0, NULL) != TST_OK)
+            reported = true;
+        if (i >= 500) {
+            snprintf(key, sizeof(key), "%08x%d",
+                     (unsigned int) (i - 500) * 2654435761U, i - 500);
+            if (tst_delete(tst, SUC key) != tst)
+                reported = true;
+        }
+    }
+    ok(37, !reported);
+    reported = false;
+    for (i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "%08x%d", (unsigned int) i * 2654435761U,
+                 i);
+        if ((tst_search(tst, SUC key) != NULL) != (i >= 19500))
+            reported = true;
+    }
+    ok(38, !reported);
+    tst_compact(tst);
+    reported = false;
+    for (i = 19500; i < 20000; i++) {
+        snprintf(key, sizeof(key), "%08x%d", (unsigned int) i * 2654435761U,
+                 i);
+        if (tst_search(tst, SUC key) != tst)
+            reported = true;
+        if (i % 2 == 0 && tst_delete(tst, SUC key) != tst)
+            reported = true;
+    }
+    tst_compact(tst);
+    for (j = 19500; j < 20000; j++) {
+        snprintf(key, sizeof(key), "%08x%d", (unsigned int) j * 2654435761U,
+                 j);
+        if ((tst_search(tst, SUC key) != NULL) != (j % 2 == 1))
+            reported = true;
+    }
+    ok(39, !reported);
+    tst_cleanup(tst);
+
     words = fopen("/usr/dict/words", "r");
     if (words == NULL)
         words = fopen("/usr/share/dict/words", "r");
     if (words == NULL) {
-        skip_block(37, 2, "/usr/share/dict/words not available");
+        skip_block(40, 2, "/usr/share/dict/words not available");
         exit(0);
     }
 
@@ -99,7 +147,7 @@ main(void)
             }
         }
     }
-    ok(37, !reported);
+    ok(40, !reported);
 
     if (fseek(words, 0, SEEK_SET) < 0) {
         fclose(words);
@@ -132,7 +180,7 @@ main(void)
     }
     tst_cleanup(tst);
     fclose(words);
-    ok(38, !reported);
+    ok(41, !reported);
 
     return 0;
 }
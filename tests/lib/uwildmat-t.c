@@ -9,27 +9,61 @@
 #include "inn/libinn.h"
 #include "tap/basic.h"
 
+/* Both uwildmat and the compiled form of the pattern are checked. */
 static void
 test_r(int n, const char *text, const char *pattern, bool matches)
 {
-    bool matched;
+    bool matched, compiled;
+    struct wildmat *wildmat;
 
     matched = uwildmat(text, pattern);
-    ok(n, matched == matches);
-    if (matched != matches)
-        diag("  %s\n  %s\n  expected %d\n", text, pattern, matches);
+    wildmat = uwildmat_compile(pattern, false);
+    compiled = (uwildmat_match(wildmat, text) == UWILDMAT_MATCH);
+    uwildmat_free(wildmat);
+    ok(n, matched == matches && compiled == matches);
+    if (matched != matches || compiled != matches)
+        diag("  %s\n  %s\n  expected %d got %d compiled %d\n", text,
+             pattern, matches, matched, compiled);
 }
 
 static void
 test_p(int n, const char *text, const char *pattern, enum uwildmat matches)
 {
-    enum uwildmat matched;
+    enum uwildmat matched, compiled;
+    struct wildmat *wildmat;
 
     matched = uwildmat_poison(text, pattern);
+    wildmat = uwildmat_compile(pattern, true);
+    compiled = uwildmat_match(wildmat, text);
+    uwildmat_free(wildmat);
+    ok(n, matched == matches && compiled == matches);
+    if (matched != matches || compiled != matches)
+        diag("  %s\n  %s\n  expected %d got %d compiled %d\n", text,
+             pattern, (int) matches, (int) matched, (int) compiled);
+}
+
+/* Check a list of patterns, given as a NULL-terminated list of strings. */
+static void
+test_l(int n, const char *text, bool allowpoison, enum uwildmat matches,
+       ...)
+{
+    enum uwildmat matched;
+    struct wildmat *wildmat;
+    const char *pats[10];
+    va_list args;
+    size_t i;
+
+    va_start(args, matches);
+    for (i = 0; (pats[i] = va_arg(args, const char *)) != NULL; i++)
+        ;
+    va_end(args);
+    wildmat = uwildmat_compile_list((char *const *) pats, allowpoison);
+    matched = uwildmat_match(wildmat, text);
+    uwildmat_free(wildmat);
     ok(n, matched == matches);
     if (matched != matches)
-        diag("  %s\n  %s\n  expected %d got %d\n", text, pattern,
-             (int) matches, (int) matched);
+        diag("  %s\n  expected %d got %d\n", text, (int) matches,
+             (int) matched);
 }
 
 static void
@@ -57,7 +91,7 @@ test_v(int n, const char *text, bool matches)
 int
 main(void)
 {
-    test_init(188);
+    test_init(200);
 
     /* Basic wildmat features. */
     test_r(  1, "foo",            "foo",               true);
@@ -276,6 +310,25 @@ main(void)
     test_v(186, "",                                    true);
     test_v(187, "a\303\251b\303\0c",                   false);
     test_v(188, "two words",                           true);
+
+    /* Tests for lists of compiled patterns. */
+    test_l(189, "comp.lang.c", false, UWILDMAT_MATCH, "comp.*", NULL);
+    test_l(190, "comp.lang.c", false, UWILDMAT_FAIL,
+           "comp.*", "!comp.lang.*", NULL);
+    test_l(191, "comp.lang.c", false, UWILDMAT_MATCH,
+           "comp.*", "!comp.lang.*", "*.c", NULL);
+    test_l(192, "alt.test", false, UWILDMAT_FAIL, "comp.*", NULL);
+    test_l(193, "alt.test", false, UWILDMAT_FAIL, "@alt.*", NULL);
+    test_l(194, "alt.test", true, UWILDMAT_POISON,
+           "*", "@alt.*", NULL);
+    test_l(195, "alt.test", true, UWILDMAT_MATCH,
+           "@alt.*", "alt.test", NULL);
+    test_l(196, "alt.test", true, UWILDMAT_FAIL, "*", "!alt.*", NULL);
+    test_l(197, "alt.test", false, UWILDMAT_MATCH, "*", "!!alt.*", NULL);
+    test_l(198, "alt.test", false, UWILDMAT_FAIL,
+           "*", "!alt.foo,alt.test", NULL);
+    test_l(199, "", false, UWILDMAT_FAIL, "*", "!", NULL);
+    test_l(200, "x", false, UWILDMAT_MATCH, "*", "!", NULL);
     
     return 0;
 }
@@ -42,9 +42,19 @@ main(void)
     const char *p, *end;
     char *article, *wire, *native;
     struct stat st;
-    size_t wire_size, native_size, size;
+    size_t wire_size, native_size, size, i;
+    char line[64];
+    bool found;
+    struct wire_header headers[6] = {
+        { "Path", true, NULL },
+        { "From", false, NULL },
+        { "message-id", false, NULL },
+        { "Header", false, NULL },
+        { "Second", false, NULL },
+        { "suBJect", false, NULL }
+    };
 
-    test_init(58);
+    test_init(80);
 
     end = ta + sizeof(ta) - 1;
     p = end - 4;
@@ -200,5 +210,80 @@ main(void)
     ok(58, memcmp("T: f\0\r\n\r\n..\r\n.\r\n", article, 16) == 0);
     free(article);
 
+    /* wire_findspecial, at every offset across the scanned blocks. */
+    memset(line, 'a', sizeof(line));
+    ok(59, wire_findspecial(line, sizeof(line)) == NULL);
+    ok(60, wire_findspecial(line, 0) == NULL);
+    found = true;
+    for (i = 0; i < sizeof(line); i++) {
+        line[i] = "\r\n"[i % 3];         /* CR, LF or nul. */
+        if (wire_findspecial(line, sizeof(line)) != line + i
+            || wire_findspecial(line + i + 1, sizeof(line) - i - 1) != NULL)
+            found = false;
+        line[i] = 'a';
+    }
+    ok(61, found);
+    line[40] = '\r';
+    line[50] = '\n';
+    ok(62, wire_findspecial(line, sizeof(line)) == line + 40);
+    ok(63, wire_findspecial(line, 40) == NULL);
+    ok(64, wire_findspecial(line + 41, sizeof(line) - 41) == line + 50);
+
+    /* wire_finddotline, with a dot line at every offset. */
+    memset(line, 'a', sizeof(line));
+    ok(65, wire_finddotline(line, sizeof(line)) == NULL);
+    ok(66, wire_finddotline(line, 0) == NULL);
+    found = true;
+    for (i = 1; i < sizeof(line); i++) {
+        line[i - 1] = '\n';
+        line[i] = '.';
+        if (wire_finddotline(line, sizeof(line)) != line + i
+            || wire_finddotline(line + i + 1, sizeof(line) - i - 1) != NULL)
+            found = false;
+        line[i] = 'a';
+        line[i - 1] = '.';
+        if (wire_finddotline(line, sizeof(line)) != (i == 1 ? line : NULL))
+            found = false;
+        line[i - 1] = 'a';
+    }
+    ok(67, found);
+    line[0] = '.';
+    ok(68, wire_finddotline(line, sizeof(line)) == line);
+    ok(69, wire_finddotline(line + 1, sizeof(line) - 1) == NULL);
+    line[0] = 'a';
+    line[39] = '\n';
+    line[40] = '.';
+    ok(70, wire_finddotline(line + 40, sizeof(line) - 40) == line + 40);
+    ok(71, wire_finddotline(line, 40) == NULL);
+
+    /* wire_from_native with several lines to stuff. */
+    article = wire_from_native(".a\nb\n..c\n.", 10, &size);
+    ok(72, size == 19
+               && memcmp(article, "..a\r\nb\r\n...c\r\n...\r\n", 19) == 0);
+    free(article);
+
+    /* wire_findheaders, looking for several headers at once. */
+    article = read_file("articles/wire-strange", &st);
+    wire_findheaders(article, st.st_size, headers, ARRAY_SIZE(headers), true);
+    ok(73, headers[0].value == article + 6);
+    ok(74, strncmp(headers[1].value, "This is the real",
+                   strlen("This is the real")) == 0);
+    ok(75, strncmp(headers[2].value, "<foo@example.com>",
+                   strlen("<foo@example.com>")) == 0);
+    ok(76, strncmp(headers[3].value, "This one is real",
+                   strlen("This one is real")) == 0);
+    ok(77, headers[4].value == NULL);
+    ok(78, strncmp(headers[5].value, "This is\rnot",
+                   strlen("This is\rnot")) == 0);
+    headers[1].last = true;
+    wire_findheaders(article, st.st_size, headers, 2, false);
+    ok(79, strncmp(headers[1].value, "This is the real",
+                   strlen("This is the real")) == 0);
+    headers[3].name = "Summary";
+    wire_findheaders(article, st.st_size, headers + 3, 1, false);
+    ok(80, strncmp(headers[3].value, "\t  \t First text",
+                   strlen("\t  \t First text")) == 0);
+    free(article);
+
     return 0;
 }
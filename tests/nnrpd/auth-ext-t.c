@@ -4,6 +4,12 @@
 
 #include "config.h"
 #include "clibrary.h"
+#include "portable/socket.h"
+#include <signal.h>
+#include <sys/wait.h>
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+# include <sys/un.h>
+#endif
 
 #include "inn/messages.h"
 #include "tap/basic.h"
@@ -109,12 +115,102 @@ test_external(struct client *client, const char *arg, const char *user,
     test_file_path_free(auth_test_path);
 }
 
+/* Check one request to an authenticator running as a server, with the
+   expected username and error output. */
+static void
+test_request(struct client *client, const char *username,
+             const char *password, const char *user, const char *error)
+{
+    char *result;
+
+    errors_capture();
+    result = auth_external(client, "unix:auth.sock", ".", username, password);
+    errors_uncapture();
+    is_string(user, result, "user from server for %s", username);
+    is_string(error, errors, "errors from server for %s", username);
+    free(result);
+    free(errors);
+    errors = NULL;
+}
+
+/* Run ckpasswd as a server and check requests to it, including the same one
+   twice, which the second time gets the verdict it remembered. */
+static void
+test_server(struct client *client)
+{
+#ifdef HAVE_UNIX_DOMAIN_SOCKETS
+    char *ckpasswd, *passwd;
+    struct sockaddr_un address;
+    struct timeval tv;
+    pid_t child;
+    int fd, i;
+    char *result;
+
+    ckpasswd = test_file_path("../authprogs/ckpasswd");
+    passwd = test_file_path("data/etc/passwd");
+    if (ckpasswd == NULL || passwd == NULL) {
+        skip_block(9, "ckpasswd not built");
+        return;
+    }
+    unlink("auth.sock");
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    if (child == 0) {
+        execl(ckpasswd, ckpasswd, "-S", "auth.sock", "-f", passwd,
+              (char *) 0);
+        _exit(1);
+    }
+
+    /* Wait for the server to accept connections. */
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strlcpy(address.sun_path, "auth.sock", sizeof(address.sun_path));
+    for (i = 0; i < 100; i++) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            sysbail("cannot create socket");
+        if (connect(fd, (struct sockaddr *) &address, SUN_LEN(&address)) == 0)
+            break;
+        close(fd);
+        tv.tv_sec = 0;
+        tv.tv_usec = 50000;
+        select(0, NULL, NULL, NULL, &tv);
+    }
+    if (i == 100)
+        bail("ckpasswd server didn't start");
+    close(fd);
+
+    test_request(client, "foo", "foopass", "foo", NULL);
+    test_request(client, "foo", "barpass", NULL,
+                 "example.com auth: program error: invalid password for"
+                 " user foo\n");
+    test_request(client, "foo", "foopass", "foo", NULL);
+    test_request(client, "who", "foopass", NULL,
+                 "example.com auth: program error: user who unknown\n");
+
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    unlink("auth.sock");
+    errors_capture();
+    result = auth_external(client, "unix:auth.sock", ".", "foo", "foopass");
+    errors_uncapture();
+    ok(result == NULL && errors != NULL, "no server");
+    free(errors);
+    errors = NULL;
+    test_file_path_free(ckpasswd);
+    test_file_path_free(passwd);
+#else
+    skip_block(9, "Unix domain sockets not supported");
+#endif
+}
+
 int
 main(void)
 {
     struct client *client;
 
-    plan(12 * 6);
+    plan(12 * 6 + 9);
 
     client = client_new();
 
@@ -137,5 +233,6 @@ main(void)
     test_external(client, "partial-error", NULL,
                   "example.com auth: program error: This is an error\n");
 
+    test_server(client);
     return 0;
 }
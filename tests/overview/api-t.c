@@ -706,7 +706,7 @@ main(void)
     }
 
     /* Cancels can't be tested with mmap, so there are only 21 tests there. */
-    test_init(27 * 2 + 21);
+    test_init(27 * 6 + 21);
 
     fake_innconf();
     innconf->ovmethod = xstrdup("tradindexed");
@@ -717,6 +717,32 @@ main(void)
     diag("tradindexed without mmap");
     n = overview_mmap_tests(n);
 
+    innconf->tradindexedmmap = true;
+    innconf->tradindexedcompact = true;
+    diag("tradindexed with compact index");
+    n = overview_tests(n);
+    innconf->tradindexedcompact = false;
+
+    innconf->tradindexedpreadsize = 1024;
+    diag("tradindexed with pread");
+    n = overview_tests(n);
+    innconf->tradindexedpreadsize = 0;
+
+    innconf->overcachemapsize = 1;
+    diag("tradindexed with a small cache");
+    n = overview_tests(n);
+    innconf->overcachemapsize = 0;
+
+#ifdef HAVE_ZLIB
+    innconf->tradindexedcompress = true;
+    diag("tradindexed with compressed overview");
+    n = overview_tests(n);
+    innconf->tradindexedcompress = false;
+#else
+    skip_block(n, 27, "zlib not available");
+    n += 27;
+#endif
+
     free(innconf->ovmethod);
     innconf->ovmethod = xstrdup("buffindexed");
     diag("buffindexed");
@@ -0,0 +1,148 @@
+/* Test suite for the in-memory tier of recent overview data. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+/* Used as the artificial token for all articles inserted into overview. */
+static const TOKEN faketoken = { 1, 1, "" };
+
+
+/*
+**  Build a stripped-down innconf struct that contains only those settings
+**  that tradindexed and the in-memory tier care about.
+*/
+static void
+fake_innconf(unsigned long hotsize)
+{
+    if (innconf != NULL) {
+        free(innconf->ovmethod);
+        free(innconf->pathoverview);
+        free(innconf->pathrun);
+        free(innconf);
+    }
+    innconf = xcalloc(1, sizeof(*innconf));
+    innconf->enableoverview = true;
+    innconf->groupbaseexpiry = true;
+    innconf->overcachesize = 20;
+    innconf->ovhotsize = hotsize;
+    innconf->ovmethod = xstrdup("tradindexed");
+    innconf->pathoverview = xstrdup("ov-tmp");
+    innconf->pathrun = xstrdup("ov-tmp");
+    innconf->tradindexedmmap = true;
+}
+
+
+/*
+**  Add the overview of article n of example.test, padded to make some of
+**  them larger than others.
+*/
+static bool
+add(int n)
+{
+    char *data;
+    bool status;
+
+    xasprintf(&data, "Subject %d\tauthor\tdate\t<%d@example>\t\t100\t10"
+              "\tXref: news.example example.test:%d\t%*s", n, n, n,
+              (n % 7) * 100, "");
+    status = (OVadd(faketoken, data, strlen(data), time(NULL), 0)
+              == OVADDCOMPLETED);
+    free(data);
+    return status;
+}
+
+
+/*
+**  Search articles low to high of example.test and return how many are
+**  found, or -1 if one is not the expected article or they don't come in
+**  order.
+*/
+static int
+search(int low, int high)
+{
+    void *handle;
+    ARTNUM artnum, last = 0;
+    char *data, *expected;
+    int len, count = 0;
+    bool good = true;
+
+    handle = OVopensearch((char *) "example.test", low, high);
+    if (handle == NULL)
+        return -1;
+    while (OVsearch(handle, &artnum, &data, &len, NULL, NULL)) {
+        xasprintf(&expected, "%lu\tSubject %lu\t", artnum, artnum);
+        if (artnum <= last || artnum < (ARTNUM) low || artnum > (ARTNUM) high
+            || (size_t) len < strlen(expected)
+            || memcmp(data, expected, strlen(expected)) != 0)
+            good = false;
+        free(expected);
+        last = artnum;
+        count++;
+    }
+    OVclosesearch(handle);
+    return good ? count : -1;
+}
+
+
+int
+main(void)
+{
+    struct stat st;
+    int i;
+    bool status;
+
+    message_handlers_warn(0);
+    if (system("rm -rf ov-tmp") < 0 || mkdir("ov-tmp", 0755) < 0)
+        sysbail("can't create ov-tmp");
+    plan(12);
+
+    /* Store some articles before the tier exists. */
+    fake_innconf(0);
+    if (!OVopen(OV_READ | OV_WRITE))
+        bail("can't open overview");
+    OVgroupadd((char *) "example.test", 0, 0, (char *) "y");
+    for (i = 1; i <= 3; i++)
+        add(i);
+    OVclose();
+
+    /* Then some more with it. */
+    fake_innconf(1024);
+    ok(OVopen(OV_READ | OV_WRITE), "open overview with the tier");
+    ok(stat("ov-tmp/ovhot", &st) == 0 && st.st_size > 1024 * 1024 / 2,
+       "...which creates it");
+    for (status = true, i = 4; i <= 10; i++)
+        status = add(i) && status;
+    ok(status, "add articles");
+    is_int(7, search(4, 10), "search the articles in memory");
+    is_int(10, search(1, 10), "search articles on disk and in memory");
+    is_int(3, search(2, 4), "search across the boundary");
+    is_int(2, search(9, 20), "search past the last article");
+    is_int(0, search(11, 20), "search after the last article");
+
+    /* Wrap around the ring of the bucket many times. */
+    for (status = true, i = 11; i <= 3000; i++)
+        status = add(i) && status;
+    ok(status, "add many articles");
+    is_int(3000, search(1, 3000), "search all of them");
+    is_int(100, search(2901, 3000), "search the last ones");
+
+    /* Removing the group drops its bucket. */
+    OVgroupdel((char *) "example.test");
+    is_int(-1, search(2901, 3000), "nothing found once the group is gone");
+
+    OVclose();
+    if (system("rm -rf ov-tmp") < 0)
+        sysdiag("can't remove ov-tmp");
+    return 0;
+}
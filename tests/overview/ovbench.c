@@ -0,0 +1,444 @@
+/*
+**  Benchmark for the overview methods.
+**
+**  Loads synthetic overview data into each of the overview methods given on
+**  the command line through OVadd, and then runs XOVER-like searches of
+**  ranges of articles, random lookups with OVgetartinfo and a group-based
+**  expiration of every newsgroup, as expireover does.  For each method and
+**  operation, it reports the number of operations per second and the
+**  latency distribution in microseconds.
+**
+**  This is not part of the test suite; run it with "make bench" in the
+**  tests directory, or directly with options to change the workload.
+*/
+
+#include "config.h"
+#include "clibrary.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/histogram.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/storage.h"
+
+/* Directory holding the overview data during the benchmark. */
+#define BENCH_DIR "ovbench-tmp"
+
+/* A small article stored for real, whose token all overview records use.
+   Expiration of buffindexed checks that articles still exist in storage. */
+static const char article[] =
+    "Path: ovbench!not-for-mail\r\n"
+    "From: ovbench@example.com\r\n"
+    "Newsgroups: ovbench.group0\r\n"
+    "Subject: ovbench\r\n"
+    "Message-ID: <ovbench@example.com>\r\n"
+    "\r\n"
+    "Body.\r\n"
+    ".\r\n";
+
+/* The workload. */
+struct workload {
+    unsigned long groups;       /* Number of newsgroups. */
+    unsigned long articles;     /* Number of articles. */
+    unsigned long header;       /* Size of the overview data of an article. */
+    unsigned long crosspost;    /* Maximum number of newsgroups per article. */
+    unsigned long searches;     /* Number of searches. */
+    unsigned long range;        /* Number of articles per search. */
+    unsigned long lookups;      /* Number of OVgetartinfo calls. */
+};
+
+/* Names and high water marks of the newsgroups. */
+static char **names;
+static ARTNUM *highs;
+
+
+/*
+**  Return the number of seconds elapsed since start.
+*/
+static double
+elapsed(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec)
+           + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+
+/*
+**  Print the results of one operation and reset the histogram.
+*/
+static void
+report(const char *method, const char *operation, struct histogram *hist,
+       double seconds)
+{
+    struct buffer *summary;
+    unsigned long count;
+
+    count = histogram_count(hist);
+    if (count == 0) {
+        printf("%-12s %-11s no operations\n", method, operation);
+        return;
+    }
+    summary = buffer_new();
+    histogram_summary(hist, summary);
+    printf("%-12s %-11s %10.0f ops/s  %.*s\n", method, operation,
+           seconds > 0 ? count / seconds : 0.0, (int) summary->left,
+           summary->data + summary->used);
+    buffer_free(summary);
+    histogram_reset(hist);
+}
+
+
+/*
+**  Write a file in the benchmark directory.
+*/
+static void
+write_file(const char *name, const char *data)
+{
+    char *path;
+    FILE *F;
+
+    path = concatpath(BENCH_DIR, name);
+    F = fopen(path, "w");
+    if (F == NULL || fputs(data, F) == EOF || fclose(F) == EOF)
+        sysdie("cannot write %s", path);
+    free(path);
+}
+
+
+/*
+**  Create an empty benchmark directory for the given method, with what the
+**  method and group-based expiration need.
+*/
+static void
+setup(const char *method, const struct workload *load)
+{
+    struct buffer *active;
+    unsigned long i, size;
+    int fd;
+
+    if (system("rm -rf " BENCH_DIR) < 0 || mkdir(BENCH_DIR, 0755) < 0)
+        sysdie("cannot create " BENCH_DIR);
+    free(innconf->ovmethod);
+    innconf->ovmethod = xstrdup(method);
+
+    /* Size the buffindexed buffer from the workload, with some slack. */
+    if (strcmp(method, "buffindexed") == 0) {
+        size = load->articles * (load->header + 100) * load->crosspost / 512
+               + 4096;
+        active = buffer_new();
+        buffer_sprintf(active, "0:" BENCH_DIR "/buffer:%lu\n", size);
+        buffer_append(active, "", 1);
+        write_file("buffindexed.conf", active->data);
+        buffer_free(active);
+        fd = open(BENCH_DIR "/buffer", O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t) size * 1024) < 0 || close(fd) < 0)
+            sysdie("cannot create " BENCH_DIR "/buffer");
+    }
+
+    /* timecaf, as it doesn't need a buffer and stats are cheap. */
+    write_file("storage.conf",
+               "method timecaf {\n    newsgroups: *\n    class: 0\n}\n");
+
+    /* Everything older than a day expires. */
+    write_file("expire.ctl", "/remember/:1\n*:A:1:1:1\n");
+    active = buffer_new();
+    for (i = 0; i < load->groups; i++)
+        buffer_append_sprintf(active, "%s 0000000000 0000000001 y\n",
+                              names[i]);
+    buffer_append(active, "", 1);
+    write_file("active", active->data);
+    buffer_free(active);
+}
+
+
+/*
+**  Store the article in storage and return its token.
+*/
+static TOKEN
+store(void)
+{
+    ARTHANDLE handle = ARTHANDLE_INITIALIZER;
+    struct iovec iov;
+    TOKEN token;
+
+    if (!SMinit())
+        die("cannot initialize storage manager: %s", SMerrorstr);
+    iov.iov_base = (char *) article;
+    iov.iov_len = sizeof(article) - 1;
+    handle.type = TOKEN_EMPTY;
+    handle.data = article;
+    handle.iov = &iov;
+    handle.iovcnt = 1;
+    handle.len = iov.iov_len;
+    handle.arrived = time(NULL);
+    handle.groups = (char *) "ovbench.group0:1";
+    handle.groupslen = strlen(handle.groups);
+    token = SMstore(handle);
+    if (token.type == TOKEN_EMPTY)
+        die("cannot store article: %s", SMerrorstr);
+    return token;
+}
+
+
+/*
+**  Build the overview data of an article in the given buffer, with the
+**  Xref: header listing the newsgroups it is in.
+*/
+static void
+build(struct buffer *data, const struct workload *load, unsigned long n,
+      unsigned long *groups, unsigned long count)
+{
+    unsigned long i;
+    size_t length;
+
+    buffer_sprintf(data, "Subject %lu\tposter%lu@example.com\t"
+                   "Thu, 01 Jan 2026 00:00:00 +0000\t<%lu@ovbench>\t\t%lu\t"
+                   "%lu\t", n, n % 997, n, load->header * 4, load->header / 40);
+    length = data->left;
+    if (length < load->header) {
+        buffer_resize(data, load->header + BIG_BUFFER);
+        memset(data->data + length, 'r', load->header - length);
+        data->left = load->header;
+    }
+    buffer_append_sprintf(data, "\tXref: ovbench");
+    for (i = 0; i < count; i++)
+        buffer_append_sprintf(data, " %s:%lu", names[groups[i]],
+                              highs[groups[i]]);
+}
+
+
+/*
+**  Run the benchmark for one method.  Returns false if the method can't be
+**  opened.
+*/
+static bool
+bench(const char *method, const struct workload *load)
+{
+    struct histogram *hist;
+    struct buffer *data;
+    struct timeval start, begin;
+    unsigned long groups[64];
+    unsigned long i, j, k, count, found;
+    time_t now;
+    OVGE ovge;
+    void *search;
+    ARTNUM artnum, low;
+    char *overview;
+    int len, lo;
+    TOKEN stored, token;
+    time_t arrived;
+
+    setup(method, load);
+    stored = store();
+    if (!OVopen(OV_READ | OV_WRITE)) {
+        warn("cannot open %s, skipping it", method);
+        SMshutdown();
+        return false;
+    }
+    for (i = 0; i < load->groups; i++) {
+        highs[i] = 0;
+        if (!OVgroupadd(names[i], 0, 0, (char *) "y")) {
+            warn("cannot add %s to %s, skipping it", names[i], method);
+            OVclose();
+            SMshutdown();
+            return false;
+        }
+    }
+    hist = histogram_new();
+    data = buffer_new();
+    now = time(NULL);
+
+    /* Load the articles, half of them old enough to expire. */
+    gettimeofday(&begin, NULL);
+    for (i = 0; i < load->articles; i++) {
+        count = 1 + (unsigned long) random() % load->crosspost;
+        if (count > load->groups)
+            count = load->groups;
+        for (j = 0; j < count; j++) {
+            groups[j] = (unsigned long) random() % load->groups;
+            for (k = 0; k < j; k++)
+                if (groups[k] == groups[j])
+                    break;
+            if (k < j)
+                j--;
+        }
+        for (j = 0; j < count; j++)
+            highs[groups[j]]++;
+        build(data, load, i, groups, count);
+        arrived = (i % 2 == 0) ? now - 10 * 86400 : now;
+        gettimeofday(&start, NULL);
+        if (OVadd(stored, data->data, (int) data->left, arrived, 0)
+            == OVADDFAILED)
+            die("cannot add article %lu to %s", i, method);
+        histogram_record_since(hist, &start);
+    }
+    report(method, "add", hist, elapsed(&begin));
+
+    /* XOVER-like searches of ranges of articles. */
+    found = 0;
+    gettimeofday(&begin, NULL);
+    for (i = 0; i < load->searches; i++) {
+        j = (unsigned long) random() % load->groups;
+        if (highs[j] == 0)
+            continue;
+        low = 1 + (unsigned long) random() % highs[j];
+        gettimeofday(&start, NULL);
+        search = OVopensearch(names[j], (int) low, (int) (low + load->range));
+        if (search == NULL)
+            die("cannot search %s in %s", names[j], method);
+        while (OVsearch(search, &artnum, &overview, &len, &token, &arrived))
+            found++;
+        OVclosesearch(search);
+        histogram_record_since(hist, &start);
+    }
+    report(method, "search", hist, elapsed(&begin));
+
+    /* Random lookups of articles. */
+    gettimeofday(&begin, NULL);
+    for (i = 0; i < load->lookups; i++) {
+        j = (unsigned long) random() % load->groups;
+        if (highs[j] == 0)
+            continue;
+        artnum = 1 + (unsigned long) random() % highs[j];
+        gettimeofday(&start, NULL);
+        if (!OVgetartinfo(names[j], artnum, &token))
+            die("cannot find %s:%lu in %s", names[j], artnum, method);
+        histogram_record_since(hist, &start);
+    }
+    report(method, "getartinfo", hist, elapsed(&begin));
+
+    /* Group-based expiration of every newsgroup. */
+    memset(&ovge, 0, sizeof(ovge));
+    ovge.delayrm = true;
+    ovge.filename = (char *) BENCH_DIR "/expired";
+    ovge.quiet = true;
+    ovge.now = time(NULL);
+    if (!OVctl(OVGROUPBASEDEXPIRE, &ovge))
+        die("cannot configure expiration of %s", method);
+    gettimeofday(&begin, NULL);
+    for (i = 0; i < load->groups; i++) {
+        gettimeofday(&start, NULL);
+        if (!OVexpiregroup(names[i], &lo, NULL))
+            die("cannot expire %s in %s", names[i], method);
+        histogram_record_since(hist, &start);
+    }
+    report(method, "expiregroup", hist, elapsed(&begin));
+
+    OVclose();
+    SMshutdown();
+    histogram_free(hist);
+    buffer_free(data);
+    if (found == 0 && load->searches > 0)
+        warn("searches in %s found nothing", method);
+    return true;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct workload load;
+    unsigned long i;
+    int option, ran = 0;
+    bool value;
+
+    message_program_name = "ovbench";
+    load.groups = 100;
+    load.articles = 20000;
+    load.header = 400;
+    load.crosspost = 3;
+    load.searches = 1000;
+    load.range = 100;
+    load.lookups = 10000;
+    while ((option = getopt(argc, argv, "a:g:h:l:r:s:x:")) != EOF) {
+        switch (option) {
+        case 'a':
+            load.articles = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            load.groups = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            load.header = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            load.lookups = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            load.range = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            load.searches = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            load.crosspost = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            die("usage: ovbench [-a articles] [-g groups] [-h header-size]"
+                " [-l lookups] [-r range] [-s searches] [-x crossposts]"
+                " method ...");
+        }
+    }
+    if (optind == argc)
+        die("no overview method given");
+    if (load.groups == 0 || load.crosspost == 0 || load.crosspost > 64)
+        die("invalid number of groups or crossposts");
+
+    /* Use the inn.conf of the test suite, with everything in BENCH_DIR. */
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("overview") != 0)
+                sysdie("cannot cd to overview");
+    if (!innconf_read("../data/etc/inn.conf"))
+        exit(1);
+    innconf->enableoverview = true;
+    innconf->groupbaseexpiry = true;
+    free(innconf->pathdb);
+    innconf->pathdb = xstrdup(BENCH_DIR);
+    free(innconf->pathetc);
+    innconf->pathetc = xstrdup(BENCH_DIR);
+    free(innconf->pathoverview);
+    innconf->pathoverview = xstrdup(BENCH_DIR);
+    free(innconf->pathrun);
+    innconf->pathrun = xstrdup(BENCH_DIR);
+    free(innconf->pathspool);
+    innconf->pathspool = xstrdup(BENCH_DIR);
+    free(innconf->patharticles);
+    innconf->patharticles = xstrdup(BENCH_DIR);
+    value = true;
+    if (!SMsetup(SM_RDWR, &value))
+        die("cannot set up storage manager");
+
+    names = xmalloc(load.groups * sizeof(char *));
+    highs = xmalloc(load.groups * sizeof(ARTNUM));
+    for (i = 0; i < load.groups; i++)
+        xasprintf(&names[i], "ovbench.group%lu", i);
+
+    printf("%lu articles in %lu newsgroups, %lu bytes of overview, up to"
+           " %lu crossposts\n", load.articles, load.groups, load.header,
+           load.crosspost);
+    for (; optind < argc; optind++) {
+        srandom(1);
+        if (bench(argv[optind], &load))
+            ran++;
+    }
+
+    if (system("rm -rf " BENCH_DIR) < 0)
+        syswarn("cannot remove " BENCH_DIR);
+    for (i = 0; i < load.groups; i++)
+        free(names[i]);
+    free(names);
+    free(highs);
+    return (ran > 0) ? 0 : 1;
+}
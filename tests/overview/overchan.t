@@ -46,7 +46,7 @@ INN_TESTSUITE=true; export INN_TESTSUITE
 mkdir -p ov-tmp
 
 # Print out the number of tests
-echo 2
+echo 3
 
 # We can use a common prefix; the way overchan works isn't going to corrupt
 # tokens and arrival times differently for different articles.
@@ -72,6 +72,12 @@ $tdxutil -O -n example.config -a 2 >> output
 $tdxutil -O -n example.test   -a 3 >> output
 compare input output
 
+# Add the other groups of the active file with a parallel repair, after which
+# a parallel audit should find nothing.
+$tdxutil -F -j 2 -s > /dev/null 2>&1
+$tdxutil -A -j 2 -s > output 2>&1
+compare output /dev/null
+
 # All done.  Clean up.
 rm -f input output
 rm -rf ov-tmp
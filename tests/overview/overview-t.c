@@ -19,6 +19,7 @@
 #include "inn/ov.h"
 #include "inn/storage.h"
 
+#include "../storage/ovinterface.h"
 #include "../storage/buffindexed/buffindexed.h"
 #include "../storage/tradindexed/tradindexed.h"
 
@@ -33,6 +34,8 @@
    two macro redirections since we want to expand the OVTYPE argument. */
 #define OV_ADD(type, g, n, t, d, l, a, e) XV_ADD(type, g, n, t, d, l, a, e)
 #define XV_ADD(type, g, n, t, d, l, a, e) type ## _add(g, n, t, d, l, a, e)
+#define OV_ADDBATCH(type, r, n)           XV_ADDBATCH(type, r, n)
+#define XV_ADDBATCH(type, r, n)           type ## _addbatch(r, n)
 
 /* Used as the artificial token for all articles inserted into overview. */
 static const TOKEN faketoken = { 1, 1, "" };
@@ -158,9 +161,10 @@ overview_data_parse(char *data, unsigned long *artnum)
 /* Load an empty overview database from a file, in the process populating a
    hash table with each group, the high water mark, and the count of messages
    that should be in the group.  Returns the hash table on success and dies on
-   failure.  Takes the name of the data file to load. */
+   failure.  Takes the name of the data file to load and whether to store all
+   of it with a single call to the addbatch method. */
 static struct hash *
-overview_load(const char *data)
+overview_load(const char *data, bool batch)
 {
     struct hash *groups;
     struct group *group;
@@ -169,6 +173,8 @@ overview_load(const char *data)
     char flag[] = NF_FLAG_OK_STRING;
     char *start;
     unsigned long artnum;
+    struct ov_record *records = NULL;
+    size_t count = 0, i;
 
     /* Run through the overview data.  Each time we see a group, we update our
        stored information about that group, which we'll use for verification
@@ -205,12 +211,35 @@ overview_load(const char *data)
         /* Do the actual insert of the data.  Note that we set the arrival
            time and expires time in a deterministic fashion so that we can
            check later if that data is being stored properly. */
-        if (!OV_ADD(OVTYPE, group->group, artnum, faketoken, start,
-                    strlen(start), artnum * 10,
-                    (artnum % 5 == 0) ? artnum * 100 : artnum))
+        if (batch) {
+            records = xreallocarray(records, count + 1,
+                                    sizeof(struct ov_record));
+            records[count].group = group->group;
+            records[count].artnum = artnum;
+            records[count].token = faketoken;
+            records[count].data = xstrdup(start);
+            records[count].len = strlen(start);
+            records[count].arrived = artnum * 10;
+            records[count].expires = (artnum % 5 == 0) ? artnum * 100 : artnum;
+            records[count].stored = false;
+            count++;
+        } else if (!OV_ADD(OVTYPE, group->group, artnum, faketoken, start,
+                           strlen(start), artnum * 10,
+                           (artnum % 5 == 0) ? artnum * 100 : artnum))
             die("Cannot insert %s:%lu into overview", group->group, artnum);
     }
     fclose(overview);
+    if (batch) {
+        if (!OV_ADDBATCH(OVTYPE, records, count))
+            die("Cannot insert a batch of %lu records into overview",
+                (unsigned long) count);
+        for (i = 0; i < count; i++) {
+            if (!records[i].stored)
+                die("%s:%lu not stored", records[i].group, records[i].artnum);
+            free(records[i].data);
+        }
+        free(records);
+    }
     return groups;
 }
 
@@ -254,6 +283,24 @@ overview_verify_groups(void *data, void *cookie)
     }
 }
 
+/* Compact a group, counting the groups that were rewritten in the unsigned
+   long pointed to by the second argument.  This function is meant to be
+   called as a hash traversal function. */
+static void
+overview_compact_group(void *data, void *cookie)
+{
+    struct group *group = (struct group *) data;
+    unsigned long *compacted = (unsigned long *) cookie;
+    OVCOMPACT compact;
+
+    compact.group = group->group;
+    compact.rate = 0;
+    if (!OVctl(OVCOMPACTGROUP, &compact))
+        warn("Unable to compact %s", group->group);
+    else if (compact.compacted)
+        (*compacted)++;
+}
+
 /* Verify the components of the overview data for a particular entry. */
 static bool
 check_data(const char *group, unsigned long artnum, const char *expected,
@@ -494,13 +541,92 @@ overview_verify_full_search(const char *data)
     return status;
 }
 
+/* Same as overview_verify_full_search, but with a search opened with
+   OVINDEXONLY set, which should return everything but the overview data.
+   Returns true if everything checks out, false otherwise. */
+static bool
+overview_verify_index_search(const char *data)
+{
+    unsigned long artnum, overnum, i;
+    unsigned long end = 0;
+    struct vector *expected;
+    char *line;
+    char *group = NULL;
+    FILE *overview;
+    char buffer[4096];
+    int length;
+    TOKEN token;
+    void *search;
+    time_t arrived;
+    bool status = true;
+    bool indexonly;
+
+    overview = fopen(data, "r");
+    if (overview == NULL)
+        sysdie("Cannot open %s for reading", data);
+    expected = vector_new();
+    while (fgets(buffer, sizeof(buffer), overview) != NULL) {
+        line = overview_data_parse(buffer, &artnum);
+        if (group == NULL)
+            group = xstrdup(buffer);
+        vector_add(expected, line);
+        end = artnum;
+    }
+    indexonly = true;
+    if (!OVctl(OVINDEXONLY, &indexonly)) {
+        warn("Unable to set OVINDEXONLY");
+        status = false;
+    }
+    search = OVopensearch(group, 1, end + 1);
+    indexonly = false;
+    OVctl(OVINDEXONLY, &indexonly);
+    if (search == NULL) {
+        warn("Unable to open index search for %s", group);
+        free(group);
+        vector_free(expected);
+        fclose(overview);
+        return false;
+    }
+    i = 0;
+    while (OVsearch(search, &overnum, &line, &length, &token, &arrived)) {
+        if (line != NULL || length != 0) {
+            warn("Overview data returned for %s:%lu", group, overnum);
+            status = false;
+        }
+        if (memcmp(&token, &faketoken, sizeof(token)) != 0) {
+            warn("Token wrong for %s:%lu", group, overnum);
+            status = false;
+        }
+        if ((unsigned long) arrived != overnum * 10) {
+            warn("Arrival time wrong for %s:%lu: %lu != %lu", group, overnum,
+                 (unsigned long) arrived, overnum * 10);
+            status = false;
+        }
+        i++;
+    }
+    OVclosesearch(search);
+    if (overnum != end) {
+        warn("End of search in %s wrong: %lu != %lu", group, overnum, end);
+        status = false;
+    }
+    if (i != expected->count) {
+        warn("Didn't see all expected entries in %s", group);
+        status = false;
+    }
+    free(group);
+    vector_free(expected);
+    fclose(overview);
+    return status;
+}
+
 int
 main(void)
 {
     struct hash *groups;
     bool status;
+    unsigned long compacted;
 
-    test_init(21);
+    test_init(37);
 
     if (access("../data/overview/basic", F_OK) == 0) {
         if (chdir("../data") < 0) {
@@ -521,7 +647,7 @@ main(void)
         die("Opening the overview database failed, cannot continue");
     ok(1, true);
 
-    groups = overview_load("overview/basic");
+    groups = overview_load("overview/basic", false);
     ok(2, true);
     status = true;
     hash_traverse(groups, overview_verify_groups, &status);
@@ -536,7 +662,7 @@ main(void)
         die("Opening the overview database failed, cannot continue");
     ok(7, true);
 
-    groups = overview_load("overview/reversed");
+    groups = overview_load("overview/reversed", false);
     ok(8, true);
     status = true;
     hash_traverse(groups, overview_verify_groups, &status);
@@ -551,7 +677,7 @@ main(void)
         die("Opening the overview database failed, cannot continue");
     ok(13, true);
 
-    groups = overview_load("overview/high-numbered");
+    groups = overview_load("overview/high-numbered", false);
     ok(14, true);
     ok(15, overview_verify_data("overview/high-numbered"));
     ok(16, overview_verify_full_search("overview/high-numbered"));
@@ -563,14 +689,72 @@ main(void)
         die("Opening the overview database failed, cannot continue");
     ok(18, true);
 
-    groups = overview_load("overview/bogus");
+    groups = overview_load("overview/bogus", false);
     ok(19, true);
     ok(20, overview_verify_data("overview/bogus"));
     hash_free(groups);
     OVclose();
+    ok(21, true);
+
+    /* The same data, stored with a single call to the addbatch method. */
+    if (!overview_init())
+        die("Opening the overview database failed, cannot continue");
+    ok(22, true);
+
+    groups = overview_load("overview/basic", true);
+    status = true;
+    hash_traverse(groups, overview_verify_groups, &status);
+    ok(23, status);
+    ok(24, overview_verify_data("overview/basic"));
+    ok(25, overview_verify_search("overview/basic"));
+    hash_free(groups);
+    OVclose();
+    ok(26, true);
+
+    if (!overview_init())
+        die("Opening the overview database failed, cannot continue");
+    ok(27, true);
+
+    groups = overview_load("overview/reversed", true);
+    status = true;
+    hash_traverse(groups, overview_verify_groups, &status);
+    ok(28, status);
+    ok(29, overview_verify_data("overview/basic"));
+    ok(30, overview_verify_search("overview/basic"));
+    hash_free(groups);
+    OVclose();
+    ok(31, true);
+
+    if (!overview_init())
+        die("Opening the overview database failed, cannot continue");
+    groups = overview_load("overview/high-numbered", true);
+    ok(32, overview_verify_data("overview/high-numbered"));
+    ok(33, overview_verify_index_search("overview/high-numbered"));
+    hash_free(groups);
+    OVclose();
+
+    /* Compacting the overview must not change what is read back. */
+    if (strcmp(innconf->ovmethod, "buffindexed") == 0) {
+        if (!overview_init())
+            die("Opening the overview database failed, cannot continue");
+        groups = overview_load("overview/reversed", false);
+        compacted = 0;
+        hash_traverse(groups, overview_compact_group, &compacted);
+        ok(34, compacted > 0);
+        status = true;
+        hash_traverse(groups, overview_verify_groups, &status);
+        ok(35, status);
+        ok(36, overview_verify_data("overview/basic")
+                   && overview_verify_search("overview/basic"));
+        hash_free(groups);
+        OVclose();
+    } else {
+        skip_block(34, 3, "compaction is only supported by buffindexed");
+    }
+
     if (system("/bin/rm -rf ov-tmp") <0)
         sysdie("Cannot rm ov-tmp");
-    ok(21, true);
+    ok(37, true);
 
     return 0;
 }
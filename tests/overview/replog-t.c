@@ -0,0 +1,159 @@
+/* Test suite for the overview replication log. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/buffer.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+/* Used as the artificial token for all articles inserted into overview. */
+static const TOKEN faketoken = { 1, 1, "" };
+
+
+/*
+**  Build a stripped-down innconf struct that contains only those settings
+**  that tradindexed and the replication log care about, storing overview
+**  in the given directory.
+*/
+static void
+fake_innconf(const char *dir, unsigned long hours)
+{
+    if (innconf != NULL) {
+        free(innconf->ovmethod);
+        free(innconf->pathoverview);
+        free(innconf);
+    }
+    innconf = xcalloc(1, sizeof(*innconf));
+    innconf->enableoverview = true;
+    innconf->groupbaseexpiry = true;
+    innconf->overcachesize = 20;
+    innconf->ovmethod = xstrdup("tradindexed");
+    innconf->ovreplicationhours = hours;
+    innconf->pathoverview = xstrdup(dir);
+    innconf->tradindexedmmap = true;
+}
+
+
+/*
+**  Add the overview of an article posted to the given Xref newsgroups.
+*/
+static bool
+add(int n, const char *xref)
+{
+    char *data;
+    bool status;
+
+    xasprintf(&data, "Subject %d\tauthor\tdate\t<%d@example>\t\t100\t10"
+              "\tXref: news.example %s", n, n, xref);
+    status = (OVadd(faketoken, data, strlen(data), time(NULL), 0)
+              == OVADDCOMPLETED);
+    free(data);
+    return status;
+}
+
+
+/*
+**  Return whether article artnum of group has the overview of article n.
+*/
+static bool
+has(const char *group, ARTNUM artnum, int n)
+{
+    void *search;
+    ARTNUM found;
+    char *data, *expected;
+    int len;
+    bool status = false;
+
+    search = OVopensearch((char *) group, artnum, artnum);
+    if (search == NULL)
+        return false;
+    if (OVsearch(search, &found, &data, &len, NULL, NULL)) {
+        xasprintf(&expected, "%lu\tSubject %d\t", artnum, n);
+        status = (found == artnum && (size_t) len > strlen(expected)
+                  && memcmp(data, expected, strlen(expected)) == 0);
+        free(expected);
+    }
+    OVclosesearch(search);
+    return status;
+}
+
+
+int
+main(void)
+{
+    struct buffer *log;
+    struct stat st;
+    void *reader;
+    unsigned long hour, offset;
+    char *path;
+    int lo, hi, count, flag;
+
+    message_handlers_warn(0);
+    if (system("rm -rf ov-master ov-follower") < 0
+        || mkdir("ov-master", 0755) < 0 || mkdir("ov-follower", 0755) < 0)
+        sysbail("can't create overview directories");
+    plan(17);
+
+    /* Make some changes to the overview of the master. */
+    fake_innconf("ov-master", 1);
+    ok(OVopen(OV_READ | OV_WRITE), "open master overview");
+    ok(OVgroupadd((char *) "example.one", 0, 0, (char *) "y"),
+       "add newsgroups");
+    OVgroupadd((char *) "example.two", 0, 0, (char *) "m");
+    OVgroupadd((char *) "example.gone", 0, 0, (char *) "y");
+    ok(add(1, "example.one:1 example.two:1"), "add articles");
+    add(2, "example.one:2");
+    add(3, "example.two:2 example.gone:1");
+    ok(OVgroupdel((char *) "example.gone"), "remove a newsgroup");
+    OVclose();
+
+    /* Read the whole log. */
+    log = buffer_new();
+    reader = OVopenreplog(0, 0, false);
+    ok(reader != NULL, "open replication log");
+    while (OVreplogread(reader, log))
+        ;
+    OVclosereplog(reader);
+    ok(log->left > 0, "...which has records");
+
+    /* Apply it to the follower. */
+    fake_innconf("ov-follower", 0);
+    ok(OVopen(OV_READ | OV_WRITE), "open follower overview");
+    hour = 0;
+    offset = 0;
+    ok(OVreplay(log, &hour, &offset), "replay the log");
+    is_int(0, log->left, "...consuming all of it");
+    xasprintf(&path, "ov-master/replog/%lu", hour);
+    ok(stat(path, &st) == 0 && (off_t) offset == st.st_size,
+       "...and reaching its end");
+    free(path);
+
+    ok(OVgroupstats((char *) "example.one", &lo, &hi, &count, &flag),
+       "replicated newsgroup");
+    ok(lo == 1 && hi == 2 && count == 2, "...with the right articles");
+    ok(OVgroupstats((char *) "example.two", &lo, &hi, &count, &flag)
+           && flag == 'm',
+       "...and flag");
+    ok(has("example.one", 1, 1) && has("example.one", 2, 2),
+       "replicated overview");
+    ok(has("example.two", 1, 1) && has("example.two", 2, 3),
+       "...in every newsgroup");
+    ok(!OVgroupstats((char *) "example.gone", &lo, &hi, &count, &flag),
+       "removed newsgroup");
+    OVclose();
+    ok(stat("ov-follower/replog", &st) < 0, "follower keeps no log");
+
+    buffer_free(log);
+    if (system("rm -rf ov-master ov-follower") < 0)
+        sysdiag("can't remove overview directories");
+    return 0;
+}
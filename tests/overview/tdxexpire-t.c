@@ -0,0 +1,268 @@
+/* Test suite for the incremental expiration of tradindexed. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "inn/history.h"
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+#define TEST_DIR "tdxexpire-tmp"
+#define GROUP    "example.test"
+
+/* A small article stored for real, whose token all overview records use, so
+   that expiration finds it in storage and only expires by arrival time. */
+static const char article[] =
+    "Path: tdxexpire!not-for-mail\r\n"
+    "From: tdxexpire@example.com\r\n"
+    "Newsgroups: example.test\r\n"
+    "Subject: tdxexpire\r\n"
+    "Message-ID: <tdxexpire@example.com>\r\n"
+    "\r\n"
+    "Body.\r\n"
+    ".\r\n";
+
+static TOKEN token;
+
+
+/*
+**  Write a file in the test directory.
+*/
+static void
+write_file(const char *name, const char *data)
+{
+    char *path;
+    FILE *F;
+
+    path = concatpath(TEST_DIR, name);
+    F = fopen(path, "w");
+    if (F == NULL || fputs(data, F) == EOF || fclose(F) == EOF)
+        sysbail("cannot write %s", path);
+    free(path);
+}
+
+
+/*
+**  Store the article in storage and remember its token.
+*/
+static void
+store(void)
+{
+    ARTHANDLE handle = ARTHANDLE_INITIALIZER;
+    struct iovec iov;
+    bool value = true;
+
+    if (!SMsetup(SM_RDWR, &value) || !SMinit())
+        bail("cannot initialize storage manager: %s", SMerrorstr);
+    iov.iov_base = (char *) article;
+    iov.iov_len = sizeof(article) - 1;
+    handle.type = TOKEN_EMPTY;
+    handle.data = article;
+    handle.iov = &iov;
+    handle.iovcnt = 1;
+    handle.len = iov.iov_len;
+    handle.arrived = time(NULL);
+    handle.groups = (char *) GROUP ":1";
+    handle.groupslen = strlen(handle.groups);
+    token = SMstore(handle);
+    if (token.type == TOKEN_EMPTY)
+        bail("cannot store article: %s", SMerrorstr);
+}
+
+
+/*
+**  Add articles low to high, arrived on the given day, with enough overview
+**  data that they take several blocks of the data file.
+*/
+static bool
+add(int low, int high, time_t arrived)
+{
+    char *data;
+    int n;
+    bool status = true;
+
+    for (n = low; n <= high; n++) {
+        xasprintf(&data, "Subject %d\tauthor\tdate\t<%d@example>\t\t100\t10"
+                  "\tXref: tdxexpire " GROUP ":%d\t%400s", n, n, n, "");
+        if (OVadd(token, data, strlen(data), arrived, 0) != OVADDCOMPLETED)
+            status = false;
+        free(data);
+    }
+    return status;
+}
+
+
+/*
+**  Return how many articles a search of the whole group finds, or -1 if one
+**  of them doesn't have the right overview data.
+*/
+static int
+search(void)
+{
+    void *handle;
+    ARTNUM artnum;
+    char *data, *expected;
+    int len, count = 0;
+    bool good = true;
+
+    handle = OVopensearch((char *) GROUP, 1, 1000);
+    if (handle == NULL)
+        return -1;
+    while (OVsearch(handle, &artnum, &data, &len, NULL, NULL)) {
+        xasprintf(&expected, "%lu\tSubject %lu\t", artnum, artnum);
+        if (len < 400 || memcmp(data, expected, strlen(expected)) != 0)
+            good = false;
+        free(expected);
+        count++;
+    }
+    OVclosesearch(handle);
+    return good ? count : -1;
+}
+
+
+/*
+**  Expire the group and check its low water mark and count.
+*/
+static bool
+expire(struct history *history, int low, int count)
+{
+    int lo, hi, n;
+
+    if (!OVexpiregroup((char *) GROUP, &lo, history))
+        return false;
+    if (!OVgroupstats((char *) GROUP, &lo, &hi, &n, NULL))
+        return false;
+    return lo == low && n == count;
+}
+
+
+int
+main(void)
+{
+    struct history *history;
+    struct stat before, after, data;
+    OVGE ovge;
+    TOKEN t;
+    time_t now, old;
+    blkcnt_t blocks;
+    off_t size;
+
+    if (access("../data/etc/inn.conf", F_OK) < 0)
+        if (access("data/etc/inn.conf", F_OK) == 0)
+            if (chdir("overview") != 0)
+                sysbail("cannot cd to overview");
+    if (!innconf_read("../data/etc/inn.conf"))
+        bail("cannot read inn.conf");
+    message_handlers_warn(0);
+    innconf->enableoverview = true;
+    innconf->groupbaseexpiry = true;
+    innconf->tradindexedcompact = false;
+    innconf->tradindexedcompress = false;
+    innconf->tradindexedrepack = 50;
+    free(innconf->ovmethod);
+    innconf->ovmethod = xstrdup("tradindexed");
+    free(innconf->pathdb);
+    innconf->pathdb = xstrdup(TEST_DIR);
+    free(innconf->pathetc);
+    innconf->pathetc = xstrdup(TEST_DIR);
+    free(innconf->pathoverview);
+    innconf->pathoverview = xstrdup(TEST_DIR);
+    free(innconf->pathrun);
+    innconf->pathrun = xstrdup(TEST_DIR);
+    free(innconf->pathspool);
+    innconf->pathspool = xstrdup(TEST_DIR);
+    free(innconf->patharticles);
+    innconf->patharticles = xstrdup(TEST_DIR);
+
+    if (system("rm -rf " TEST_DIR) < 0 || mkdir(TEST_DIR, 0755) < 0)
+        sysbail("cannot create " TEST_DIR);
+    write_file("storage.conf",
+               "method timecaf {\n    newsgroups: *\n    class: 0\n}\n");
+    write_file("expire.ctl", "/remember/:1\n*:A:1:1:1\n");
+    write_file("active", GROUP " 0000000000 0000000001 y\n");
+    store();
+    history = HISopen(TEST_DIR "/history", "hisv6", HIS_RDWR | HIS_CREAT);
+    if (history == NULL)
+        bail("cannot create history");
+    if (!OVopen(OV_READ | OV_WRITE))
+        bail("cannot open overview");
+    if (!OVgroupadd((char *) GROUP, 0, 0, (char *) "y"))
+        bail("cannot add " GROUP);
+    memset(&ovge, 0, sizeof(ovge));
+    ovge.delayrm = true;
+    ovge.filename = (char *) TEST_DIR "/expired";
+    ovge.quiet = true;
+    ovge.now = time(NULL);
+    if (!OVctl(OVGROUPBASEDEXPIRE, &ovge))
+        bail("cannot configure expiration");
+
+    plan(16);
+
+    /* The oldest quarter of the group expires in place. */
+    now = time(NULL);
+    old = now - 10 * 86400;
+    ok(add(1, 100, old) && add(101, 400, now), "add articles");
+    if (stat(TEST_DIR "/e/t/" GROUP ".IDX", &before) < 0
+        || stat(TEST_DIR "/e/t/" GROUP ".DAT", &data) < 0)
+        sysbail("cannot stat the files of " GROUP);
+    blocks = data.st_blocks;
+    ok(expire(history, 101, 300), "expire the oldest articles");
+    if (stat(TEST_DIR "/e/t/" GROUP ".IDX", &after) < 0
+        || stat(TEST_DIR "/e/t/" GROUP ".DAT", &data) < 0)
+        sysbail("cannot stat the files of " GROUP);
+    ok(before.st_ino == after.st_ino, "...without rewriting the index");
+    ok(data.st_size > 400 * 400, "...or the data");
+    size = data.st_size;
+    if (data.st_blocks < blocks)
+        ok(true, "...whose expired part is freed");
+    else
+        skip("hole punching not supported here");
+    is_int(300, search(), "the other articles are found");
+    ok(!OVgetartinfo((char *) GROUP, 50, &t), "expired ones are not");
+
+    /* Expired articles in the middle are cleared as well, and new articles
+       are still added. */
+    ok(add(401, 450, old) && add(451, 500, now), "add more articles");
+    ok(expire(history, 101, 350), "expire in place again");
+    is_int(350, search(), "the other articles are found");
+    ok(!OVgetartinfo((char *) GROUP, 420, &t)
+           && OVgetartinfo((char *) GROUP, 460, &t),
+       "...and only them");
+    ok(add(501, 501, now) && search() == 351, "articles can still be added");
+
+    /* Past the threshold, the group is rewritten. */
+    innconf->tradindexedrepack = 10;
+    ok(expire(history, 101, 351), "expire with a lower threshold");
+    if (stat(TEST_DIR "/e/t/" GROUP ".IDX", &after) < 0
+        || stat(TEST_DIR "/e/t/" GROUP ".DAT", &data) < 0)
+        sysbail("cannot stat the files of " GROUP);
+    ok(before.st_ino != after.st_ino && data.st_size < size,
+       "...rewrites the files");
+    is_int(351, search(), "...keeping the articles");
+
+    /* So is a group whose files aren't in the selected format. */
+    innconf->tradindexedrepack = 90;
+    innconf->tradindexedcompact = true;
+    before = after;
+    expire(history, 101, 351);
+    if (stat(TEST_DIR "/e/t/" GROUP ".IDX", &after) < 0)
+        sysbail("cannot stat the index of " GROUP);
+    ok(before.st_ino != after.st_ino && search() == 351,
+       "a change of format rewrites the files");
+
+    OVclose();
+    HISclose(history);
+    SMshutdown();
+    if (system("rm -rf " TEST_DIR) < 0)
+        sysdiag("cannot remove " TEST_DIR);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/* Test suite for the index of overview by token. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/ov.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+
+/*
+**  Build a stripped-down innconf struct that contains only those settings
+**  that tradindexed and the token index care about.
+*/
+static void
+fake_innconf(unsigned long indexsize)
+{
+    if (innconf != NULL) {
+        free(innconf->ovmethod);
+        free(innconf->pathoverview);
+        free(innconf->pathrun);
+        free(innconf);
+    }
+    innconf = xcalloc(1, sizeof(*innconf));
+    innconf->enableoverview = true;
+    innconf->groupbaseexpiry = true;
+    innconf->overcachesize = 20;
+    innconf->ovtokenindexsize = indexsize;
+    innconf->ovmethod = xstrdup("tradindexed");
+    innconf->pathoverview = xstrdup("ov-tmp");
+    innconf->pathrun = xstrdup("ov-tmp");
+    innconf->tradindexedmmap = true;
+}
+
+
+/*
+**  Return the token of article n, different for each article.
+*/
+static TOKEN
+token(int n)
+{
+    TOKEN t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = 1;
+    t.class = 1;
+    memcpy(t.token, &n, sizeof(n));
+    return t;
+}
+
+
+/*
+**  Add the overview of article n, stored in the given Xref pairs.
+*/
+static bool
+add(int n, const char *groups)
+{
+    char *data;
+    bool status;
+
+    xasprintf(&data, "Subject %d\tauthor\tdate\t<%d@example>\t\t100\t10"
+              "\tXref: news.example %s", n, n, groups);
+    status = (OVadd(token(n), data, strlen(data), time(NULL), 0)
+              == OVADDCOMPLETED);
+    free(data);
+    return status;
+}
+
+
+/*
+**  Look up article n and check that it is found under the given group and
+**  number.
+*/
+static bool
+found(int n, const char *group, ARTNUM artnum)
+{
+    OVTOKENINFO info;
+
+    info.token = token(n);
+    if (!OVctl(OVTOKENLOOKUP, &info))
+        return false;
+    return strcmp(info.group, group) == 0 && info.artnum == artnum;
+}
+
+
+int
+main(void)
+{
+    OVTOKENINFO info;
+    struct stat st;
+    char *groups;
+    int i, hits;
+    bool status;
+
+    message_handlers_warn(0);
+    if (system("rm -rf ov-tmp") < 0 || mkdir("ov-tmp", 0755) < 0)
+        sysbail("can't create ov-tmp");
+    plan(14);
+
+    /* Without the index, nothing is found. */
+    fake_innconf(0);
+    if (!OVopen(OV_READ | OV_WRITE))
+        bail("can't open overview");
+    OVgroupadd((char *) "example.test", 0, 0, (char *) "y");
+    OVgroupadd((char *) "example.other", 0, 0, (char *) "y");
+    add(1, "example.test:1");
+    info.token = token(1);
+    ok(!OVctl(OVTOKENLOOKUP, &info), "no lookup without the index");
+    OVclose();
+
+    /* With it, articles are found under one of their groups. */
+    fake_innconf(64);
+    ok(OVopen(OV_READ | OV_WRITE), "open overview with the index");
+    ok(!found(1, "example.test", 1), "articles added before are not known");
+    for (status = true, i = 2; i <= 10; i++) {
+        xasprintf(&groups, "example.test:%d", i);
+        status = add(i, groups) && status;
+        free(groups);
+    }
+    ok(status, "add articles");
+    ok(stat("ov-tmp/ovtoken", &st) == 0 && st.st_size > 64 * 1024 / 2,
+       "...which creates the index");
+    ok(found(5, "example.test", 5) && found(10, "example.test", 10),
+       "...where they are found");
+    ok(add(11, "example.test:11 example.other:1"), "add a crosspost");
+    ok(found(11, "example.test", 11) || found(11, "example.other", 1),
+       "...found in one of its groups");
+
+    /* An entry no longer matching the overview is not returned. */
+    add(12, "example.test:5");
+    ok(!found(5, "example.test", 5), "a replaced article is not found");
+    ok(found(12, "example.test", 5), "...but its replacement is");
+
+    /* A full index keeps some articles, and only returns the right ones. */
+    OVclose();
+    if (unlink("ov-tmp/ovtoken") < 0)
+        sysbail("can't remove the index");
+    fake_innconf(1);
+    ok(OVopen(OV_READ | OV_WRITE), "open overview with a small index");
+    for (i = 100; i < 300; i++) {
+        xasprintf(&groups, "example.test:%d", i);
+        add(i, groups);
+        free(groups);
+    }
+    for (hits = 0, status = true, i = 100; i < 300; i++) {
+        info.token = token(i);
+        if (!OVctl(OVTOKENLOOKUP, &info))
+            continue;
+        hits++;
+        if (strcmp(info.group, "example.test") != 0
+            || info.artnum != (ARTNUM) i)
+            status = false;
+    }
+    ok(hits > 0 && hits < 200, "the index keeps some of the articles");
+    ok(status, "...and finds them in the right place");
+
+    /* Articles whose group is removed are no longer found. */
+    OVgroupdel((char *) "example.test");
+    ok(!found(299, "example.test", 299), "removed articles are not found");
+    OVclose();
+
+    if (system("rm -rf ov-tmp") < 0)
+        sysdiag("can't remove ov-tmp");
+    return 0;
+}
@@ -0,0 +1,108 @@
+#! /bin/sh
+#
+# Test suite for the compression of article bodies by the storage manager.
+
+# The count starts at 1 and is updated each time ok is printed.  printcount
+# takes "ok" or "not ok".
+count=1
+printcount () {
+    echo "$1 $count $2"
+    count=`expr $count + 1`
+}
+
+# Print ok if the command given succeeds and not ok otherwise.
+check () {
+    if "$@" ; then
+        printcount "ok"
+    else
+        printcount "not ok"
+    fi
+}
+
+# Store an article and make sure that sm succeeds.
+store () {
+    token=`$sm -s < $1`
+    check [ $? = 0 ]
+}
+
+# Check that an article retrieved via sm is the same as the given article.
+retrieve () {
+    if "$sm" "$1" > compress/test && cmp -s "$2" compress/test ; then
+        printcount "ok"
+    else
+        printcount "not ok"
+    fi
+}
+
+# Print the path of the file holding an article.
+artfile () {
+    $sm -c "$1" | sed -n 's/.* file=//p'
+}
+
+# Find the right directory.
+sm="../../frontends/sm"
+dirs='../data data tests/data'
+for dir in $dirs ; do
+    if [ -r "$dir/articles/1" ] ; then
+        cd $dir
+        break
+    fi
+done
+if [ ! -x "$sm" ] ; then
+    echo "Could not find sm" >&2
+    exit 1
+fi
+
+# Print out the count of tests.
+echo 10
+
+# Set up an inn.conf and a storage.conf storing everything in timehash with
+# compression, and an article with a large body.
+rm -rf compress
+mkdir -p compress/etc compress/spool
+sed -e 's/^patharticles:.*/patharticles:           compress\/spool/' \
+    etc/inn.conf > compress/etc/inn.conf
+echo 'pathetc:                compress/etc' >> compress/etc/inn.conf
+cat > compress/etc/storage.conf <<EOF
+method timehash {
+    newsgroups: *
+    class: 0
+    compress: true
+}
+EOF
+INNCONF=compress/etc/inn.conf; export INNCONF
+cp articles/1 compress/big
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 ; do
+    sed '1,/^$/d' articles/2 >> compress/big
+done
+
+# A large body is stored compressed, and a small one as it is.
+store compress/big
+token1="$token"
+store articles/1
+token2="$token"
+file1=`artfile "$token1"`
+file2=`artfile "$token2"`
+check [ `wc -c < "$file1"` -lt `wc -c < compress/big` ]
+"$sm" -R "$token2" > compress/test
+check cmp -s "$file2" compress/test
+
+# Both come back whole, and the headers of the compressed one are stored as
+# they are.
+retrieve "$token1" compress/big
+retrieve "$token2" articles/1
+sed '/^$/q' compress/big | sed '/^$/d' > compress/real
+"$sm" -H "$token1" > compress/test
+check cmp -s compress/real compress/test
+grep 'Message-ID: <example-1@' "$file1" > /dev/null
+check [ $? = 0 ]
+
+# Articles stored compressed are still read once compression is turned off.
+grep -v compress: compress/etc/storage.conf > compress/storage.conf
+mv compress/storage.conf compress/etc/storage.conf
+retrieve "$token1" compress/big
+"$sm" -r "$token1"
+check [ ! -r "$file1" ]
+
+# All done.  Clean up.
+rm -rf compress
@@ -0,0 +1,115 @@
+#! /bin/sh
+#
+# Test suite for the deduplication of article bodies by timehash.
+
+# The count starts at 1 and is updated each time ok is printed.  printcount
+# takes "ok" or "not ok".
+count=1
+printcount () {
+    echo "$1 $count $2"
+    count=`expr $count + 1`
+}
+
+# Print ok if the command given succeeds and not ok otherwise.
+check () {
+    if "$@" ; then
+        printcount "ok"
+    else
+        printcount "not ok"
+    fi
+}
+
+# Store an article and make sure that sm succeeds.
+store () {
+    token=`$sm -s < $1`
+    check [ $? = 0 ]
+}
+
+# Check that an article retrieved via sm is the same as the given article.
+retrieve () {
+    if "$sm" "$1" > dedup/test && cmp -s "$2" dedup/test ; then
+        printcount "ok"
+    else
+        printcount "not ok"
+    fi
+}
+
+# Print the path of the body store file of a token.
+bodyfile () {
+    $sm -c "$1" | sed -n 's/.* body=//p'
+}
+
+# Print the number of links to a file.
+links () {
+    ls -l "$1" | awk '{ print $2 }'
+}
+
+# Find the right directory.
+sm="../../frontends/sm"
+dirs='../data data tests/data'
+for dir in $dirs ; do
+    if [ -r "$dir/articles/1" ] ; then
+        cd $dir
+        break
+    fi
+done
+if [ ! -x "$sm" ] ; then
+    echo "Could not find sm" >&2
+    exit 1
+fi
+
+# Print out the count of tests.
+echo 15
+
+# Set up an inn.conf and a storage.conf storing everything in timehash with
+# deduplication of all bodies, and two articles differing only by their
+# Message-ID.
+rm -rf dedup
+mkdir -p dedup/etc dedup/spool
+sed -e 's/^patharticles:.*/patharticles:           dedup\/spool/' \
+    etc/inn.conf > dedup/etc/inn.conf
+echo 'pathetc:                dedup/etc' >> dedup/etc/inn.conf
+echo 'timehashdedupsize:      1' >> dedup/etc/inn.conf
+cat > dedup/etc/storage.conf <<EOF
+method timehash {
+    newsgroups: *
+    class: 0
+}
+EOF
+INNCONF=dedup/etc/inn.conf; export INNCONF
+sed 's/example-1@/example-dup@/' articles/1 > dedup/dup
+
+# Store both articles and a different one.  The first two share their body.
+store articles/1
+token1="$token"
+store dedup/dup
+token2="$token"
+store articles/2
+token3="$token"
+body1=`bodyfile "$token1"`
+body2=`bodyfile "$token2"`
+body3=`bodyfile "$token3"`
+check [ -n "$body1" ]
+check [ "$body1" = "$body2" ]
+check [ "$body1" != "$body3" ]
+check [ "`links "$body1"`" = 3 ]
+
+# The articles come back whole, and their headers alone.
+retrieve "$token1" articles/1
+retrieve "$token2" dedup/dup
+retrieve "$token3" articles/2
+$sm -H "$token1" | grep 'Message-ID: <example-1@' > /dev/null
+check [ $? = 0 ]
+
+# Removing one of the articles sharing the body keeps it for the other one,
+# and removing the second one removes it from the store.
+$sm -r "$token1"
+check [ "`links "$body1"`" = 2 ]
+retrieve "$token2" dedup/dup
+$sm -r "$token2"
+check [ ! -r "$body1" ]
+$sm -r "$token3"
+check [ ! -r "$body3" ]
+
+# All done.  Clean up.
+rm -rf dedup
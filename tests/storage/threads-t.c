@@ -0,0 +1,223 @@
+/* Test suite for the use of the storage manager by several threads. */
+
+#define LIBTEST_NEW_FORMAT 1
+
+#include "config.h"
+#include "clibrary.h"
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "inn/innconf.h"
+#include "inn/libinn.h"
+#include "inn/messages.h"
+#include "inn/storage.h"
+#include "tap/basic.h"
+
+#define ARTICLES 50
+#define THREADS  4
+#define ROUNDS   20
+
+static TOKEN tokens[ARTICLES];
+
+/* Where each thread starts and what it found. */
+struct result {
+    int start;
+    int retrieved;
+    int errors;
+    int smerrno;
+};
+
+
+/*
+**  Build a stripped-down innconf struct that contains only those settings
+**  that the storage manager and timehash care about, with the article cache
+**  and the compression of bodies on so that they are used by the threads
+**  too.
+*/
+static void
+fake_innconf(void)
+{
+    innconf = xcalloc(1, sizeof(*innconf));
+    innconf->pathetc = xstrdup("sm-tmp");
+    innconf->patharticles = xstrdup("sm-tmp/articles");
+    innconf->pathrun = xstrdup("sm-tmp");
+    innconf->articlecachesize = 64;
+}
+
+
+/*
+**  Return the text of article n, whose body is long enough to be stored
+**  compressed.
+*/
+static char *
+article(int n)
+{
+    char *text;
+
+    xasprintf(&text,
+              "Path: example!not-for-mail\r\n"
+              "From: tester@example.com\r\n"
+              "Newsgroups: example.test\r\n"
+              "Subject: article %d\r\n"
+              "Message-ID: <%d@example.com>\r\n"
+              "Date: Sat, 06 Mar 2004 21:39:44 -0800\r\n"
+              "Xref: example example.test:%d\r\n"
+              "\r\n"
+              "%0400d\r\n",
+              n, n, n + 1, n);
+    return text;
+}
+
+
+/*
+**  Store article n, as if it had been posted to group.
+*/
+static TOKEN
+store(int n, const char *group)
+{
+    ARTHANDLE art;
+    struct iovec iov;
+    TOKEN token;
+    char *text;
+
+    text = article(n);
+    memset(&art, 0, sizeof(art));
+    art.type = TOKEN_EMPTY;
+    art.data = text;
+    art.len = strlen(text);
+    iov.iov_base = text;
+    iov.iov_len = art.len;
+    art.iov = &iov;
+    art.iovcnt = 1;
+    art.arrived = time(NULL);
+    art.groups = (char *) group;
+    art.groupslen = strlen(group);
+    token = SMstore(art);
+    free(text);
+    return token;
+}
+
+
+/*
+**  Retrieve all the articles several times, each thread starting at a
+**  different one, and check that they are the right ones.  The retrieval of
+**  a token that doesn't exist checks that SMerrno is per thread.
+*/
+static void *
+reader(void *arg)
+{
+    struct result *result = arg;
+    ARTHANDLE *art;
+    TOKEN bogus;
+    char *text;
+    int i, n;
+
+    for (i = 0; i < ROUNDS * ARTICLES; i++) {
+        n = (result->start + i) % ARTICLES;
+        art = SMretrieve(tokens[n], i % 3 == 0 ? RETR_HEAD : RETR_ALL);
+        if (art == NULL) {
+            result->errors++;
+            continue;
+        }
+        text = article(n);
+        if (art->len > strlen(text) || memcmp(art->data, text, art->len) != 0)
+            result->errors++;
+        else
+            result->retrieved++;
+        free(text);
+        SMfreearticle(art);
+    }
+    bogus = tokens[0];
+    bogus.token[0] ^= 0xff;
+    bogus.token[1] ^= 0xff;
+    if (SMretrieve(bogus, RETR_ALL) == NULL)
+        result->smerrno = SMerrno;
+    return NULL;
+}
+
+
+int
+main(void)
+{
+    struct result results[THREADS];
+    FILE *conf;
+    TOKEN token;
+    int i, ok_count;
+    bool status;
+#ifdef HAVE_PTHREAD
+    pthread_t threads[THREADS];
+#endif
+
+    if (system("rm -rf sm-tmp") < 0 || mkdir("sm-tmp", 0755) < 0)
+        sysbail("can't create sm-tmp");
+    conf = fopen("sm-tmp/storage.conf", "w");
+    if (conf == NULL)
+        sysbail("can't create sm-tmp/storage.conf");
+    fprintf(conf, "method trash {\n  newsgroups: junk\n  class: 1\n}\n");
+    fprintf(conf, "method timehash {\n  newsgroups: *\n  class: 0\n"
+                  "  compress: true\n}\n");
+    fclose(conf);
+    fake_innconf();
+    message_handlers_warn(0);
+    status = true;
+    if (!SMsetup(SM_RDWR, &status) || !SMsetup(SM_PREOPEN, &status)
+        || !SMinit())
+        bail("can't initialize the storage manager");
+    plan(8);
+
+    /* Store the articles from the main thread. */
+    for (status = true, i = 0; i < ARTICLES; i++) {
+        tokens[i] = store(i, "example.test");
+        if (tokens[i].type == TOKEN_EMPTY)
+            status = false;
+    }
+    ok(status, "store articles");
+
+    /* The methods declare whether they can be called by several threads. */
+    token = tokens[0];
+    ok(!SMprobe(THREADSAFE, &token, NULL), "timehash is serialized");
+    token = store(0, "junk");
+    ok(SMprobe(THREADSAFE, &token, NULL), "trash is thread-safe");
+
+    /* Retrieve them from several threads at once. */
+    memset(results, 0, sizeof(results));
+    for (i = 0; i < THREADS; i++)
+        results[i].start = i * ARTICLES / THREADS;
+    SMerrno = SMERR_INTERNAL;
+#ifdef HAVE_PTHREAD
+    for (i = 0; i < THREADS; i++)
+        if (pthread_create(&threads[i], NULL, reader, &results[i]) != 0)
+            sysbail("can't create thread");
+    for (i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+#else
+    for (i = 0; i < THREADS; i++)
+        reader(&results[i]);
+#endif
+    for (ok_count = 0, i = 0; i < THREADS; i++)
+        if (results[i].retrieved == ROUNDS * ARTICLES)
+            ok_count++;
+    is_int(THREADS, ok_count, "all the threads retrieve all the articles");
+    for (ok_count = 0, i = 0; i < THREADS; i++)
+        ok_count += results[i].errors;
+    is_int(0, ok_count, "...without any error");
+    for (ok_count = 0, i = 0; i < THREADS; i++)
+        if (results[i].smerrno == SMERR_NOENT)
+            ok_count++;
+    is_int(THREADS, ok_count, "each thread sees its own error");
+    is_int(SMERR_INTERNAL, SMerrno, "...and not the other threads' ones");
+
+    for (status = true, i = 0; i < ARTICLES; i++)
+        if (!SMcancel(tokens[i]))
+            status = false;
+    ok(status, "cancel the articles");
+
+    SMshutdown();
+    if (system("rm -rf sm-tmp") < 0)
+        sysdiag("can't remove sm-tmp");
+    return 0;
+}